@@ -2,12 +2,12 @@
  * c.f.: https://raw.githubusercontent.com/rabauke/mpl/master/examples/parallel_sort_mpi.c
  * parallel sort algorithm for distributed memory computers
  *
- * algorithm works as follows:
- *   1) each process draws (size-1) random samples from its local data
- *   2) all processes gather local random samples => size*(size-1) samples
- *   3) size*(size-1) samples are sorted locally
- *   4) pick (size-1) pivot elements from the globally sorted sample
- *   5) partition local data with respect to the pivot elements into size bins
+ * algorithm works as follows (sample sort by regular sampling):
+ *   1) each process sorts its local data (radix sort)
+ *   2) each process takes up to PIO_SORT_NSAMPLES evenly spaced samples
+ *   3) all processes gather the samples, and sort them
+ *   4) pick (size-1) evenly spaced pivot elements from the sorted samples
+ *   5) find the bins of the sorted local data by binary search on the pivots
  *   6) redistribute data such that data in bin i goes to process with rank i
  *   7) sort redistributed data locally
  *
@@ -24,6 +24,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <string.h>
 #include "pio_internal.h"
 
 /**
@@ -41,28 +42,90 @@ static int cmp(const void *p1_, const void *p2_) {
 }
 
 /**
- * partition
+ * local_sort
  *
- * @param first
- * @param last
- * @param pivot
- * @return pointer to first
+ * Sort an array on this process. For PIO_Offset keys this is an LSD
+ * radix sort, one byte at a time, with the sign bit flipped so that
+ * negative keys sort first. A pass is skipped when every key has the
+ * same value in that byte, which is true of the high bytes of most
+ * decomposition maps. Short arrays, and double keys, use qsort().
+ *
+ * @param v the array to sort
+ * @param n the length of v
+ * @return 0 for success, error code otherwise.
  */
-datatype *partition(datatype *first, datatype *last, datatype pivot) {
-  for (; first != last; ++first)
-    if (!((*first) < pivot))
-      break;
-
-  if (first == last)
-    return first;
-
-  for (datatype *i = first + 1; i != last; ++i) {
-    if ((*i) < pivot) {
-      datatype temp = *i;
-      *i = *first;
-      *first = temp;
-      ++first;
+static int local_sort(datatype *v, size_t n) {
+#ifdef DO_DOUBLE
+  if (n > 1)
+    qsort(v, n, sizeof(datatype), cmp);
+#else
+  typedef unsigned long long ukey;
+  const ukey flip = (ukey)1 << (8 * sizeof(datatype) - 1);
+  size_t counts[sizeof(datatype)][256] = {{0}};
+  datatype *tmp, *src = v, *dst;
+
+  if (n < PIO_SORT_RADIX_MIN) {
+    if (n > 1)
+      qsort(v, n, sizeof(datatype), cmp);
+    return PIO_NOERR;
+  }
+  if (!(tmp = malloc(n * sizeof(datatype))))
+    return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+  dst = tmp;
+
+  /* Count the values of every byte in one pass over the keys. */
+  for (size_t i = 0; i < n; i++) {
+    ukey k = (ukey)v[i] ^ flip;
+    for (int b = 0; b < sizeof(datatype); b++)
+      counts[b][(k >> (8 * b)) & 0xff]++;
+  }
+
+  for (int b = 0; b < sizeof(datatype); b++) {
+    size_t pos = 0;
+    ukey first = (((ukey)v[0] ^ flip) >> (8 * b)) & 0xff;
+
+    /* All keys have the same byte here, nothing moves. */
+    if (counts[b][first] == n)
+      continue;
+
+    for (int d = 0; d < 256; d++) {
+      size_t c = counts[b][d];
+      counts[b][d] = pos;
+      pos += c;
+    }
+    for (size_t i = 0; i < n; i++) {
+      ukey k = (ukey)src[i] ^ flip;
+      dst[counts[b][(k >> (8 * b)) & 0xff]++] = src[i];
     }
+    datatype *t = src;
+    src = dst;
+    dst = t;
+  }
+
+  /* After an odd number of passes the result is in tmp. */
+  if (src != v)
+    memcpy(v, src, n * sizeof(datatype));
+  free(tmp);
+#endif /* DO_DOUBLE */
+
+  return PIO_NOERR;
+}
+
+/**
+ * lower_bound
+ *
+ * @param first pointer to the first element of a sorted array
+ * @param last pointer past the last element of the array
+ * @param pivot the value to look for
+ * @return pointer to the first element that is not less than pivot
+ */
+static datatype *lower_bound(datatype *first, datatype *last, datatype pivot) {
+  while (first < last) {
+    datatype *mid = first + (last - first) / 2;
+    if (*mid < pivot)
+      first = mid + 1;
+    else
+      last = mid;
   }
   return first;
 }
@@ -93,8 +156,19 @@ bool is_unique(CVector v) {
 /**
  * parallel_sort
  *
+ * This is sorting by regular sampling: each process sorts its data
+ * and picks up to PIO_SORT_NSAMPLES evenly spaced samples, the
+ * samples of all processes are gathered and sorted, and size - 1 of
+ * them become the pivots. Each process then sends the values between
+ * pivots i and i + 1 to process i, and sorts (merges) what it
+ * receives. The local sorts are radix sorts, see local_sort(). Equal
+ * values always go to the same process. Only O(size) values are
+ * exchanged between all processes, besides the data itself, and no
+ * random numbers are used.
+ *
  * @param comm the MPI communicator over which v is distributed
- * @param v A CVector distributed over comm
+ * @param v A CVector distributed over comm. Its data is sorted in
+ *        place.
  * @param ierr indicates an error was encountered
  * @return A CVector sorted over comm, the size of the new vector may be different 
  *         than v with a worst case of the entire result on one task. 
@@ -102,78 +176,106 @@ bool is_unique(CVector v) {
 
 CVector parallel_sort(MPI_Comm comm, CVector v, int *ierr) {
   int rank, size;
-  MPI_Comm_rank(comm, &rank);
-  MPI_Comm_size(comm, &size);
-  datatype *local_pivots, *pivots, **pivot_pos;
+  int nsamples, total_samples = 0;
+  int *sample_counts = NULL, *sample_displs = NULL;
+  datatype *local_samples = NULL, *samples = NULL, *pivots = NULL;
+  int *sendcounts = NULL, *sdispls = NULL, *recvcounts = NULL, *rdispls = NULL;
+  datatype *v2 = NULL;
+  int recv_pos = 0;
+  int mpierr;
 
   *ierr = PIO_NOERR;
-  if(!(local_pivots = malloc(size * sizeof(*local_pivots))))
-      *ierr = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__,__LINE__);
-  if(!(pivots = malloc(size * (size + 1) * sizeof(*pivots))))
-      *ierr =  pio_err(NULL, NULL, PIO_ENOMEM, __FILE__,__LINE__);
-
-  if ( v.N == 0)
-      for (int i = 0; i < size - 1; ++i)
-          local_pivots[i] = 0;
-  else
-      for (int i = 0; i < size - 1; ++i)
-          local_pivots[i] = v.data[(size_t)(v.N * (double)rand() / (RAND_MAX + 1.))];
-
-  MPI_Allgather(local_pivots, size - 1, MY_MPI_DATATYPE,
-                pivots, size - 1, MY_MPI_DATATYPE,
-                comm);
-
-  qsort(pivots, size * (size - 1), sizeof(datatype), cmp);
-
-  for (size_t i = 1; i < size; ++i)
-    local_pivots[i - 1] = pivots[i * (size - 1)];
-
-  if(!(pivot_pos = malloc((size + 1) * sizeof(*pivot_pos))))
-      *ierr = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__,__LINE__);
-  
-  pivot_pos[0] = v.data;
-  for (size_t i = 0; i < size - 1; ++i)
-    pivot_pos[i + 1] = partition(pivot_pos[i], v.data + v.N, local_pivots[i]);
-  pivot_pos[size] = v.data + v.N;
-
-  int *local_block_sizes, *block_sizes;
-  if(!(local_block_sizes = malloc(size * sizeof(*local_block_sizes))))
-      *ierr = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__,__LINE__);
-
-  if(!(block_sizes = malloc(size * size * sizeof(*block_sizes))))
-      *ierr = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__,__LINE__);
-
-  for (size_t i = 0; i < size; ++i)
-    local_block_sizes[i] = pivot_pos[i + 1] - pivot_pos[i];
-
-  MPI_Allgather(local_block_sizes, size, MPI_INT, block_sizes, size, MPI_INT, comm);
+  if ((mpierr = MPI_Comm_rank(comm, &rank)) || (mpierr = MPI_Comm_size(comm, &size))) {
+    *ierr = check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    return (CVector){NULL, 0};
+  }
 
-  int send_pos = 0, recv_pos = 0;
-  int sendcounts[size], sdispls[size], recvcounts[size], rdispls[size];
+  /* Sort the local data, and take regular samples from it. */
+  if ((*ierr = local_sort(v.data, v.N)))
+    return (CVector){NULL, 0};
+  nsamples = (int)(v.N < PIO_SORT_NSAMPLES ? v.N : PIO_SORT_NSAMPLES);
+  if (!(local_samples = malloc((nsamples + 1) * sizeof(datatype))) ||
+      !(sample_counts = malloc(size * sizeof(int))) ||
+      !(sample_displs = malloc(size * sizeof(int))) ||
+      !(pivots = malloc(size * sizeof(datatype))) ||
+      !(sendcounts = malloc(size * 4 * sizeof(int)))) {
+    *ierr = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    goto exit;
+  }
+  sdispls = sendcounts + size;
+  recvcounts = sdispls + size;
+  rdispls = recvcounts + size;
+  for (int i = 0; i < nsamples; i++)
+    local_samples[i] = v.data[(size_t)((double)v.N * (i + 0.5) / nsamples)];
+
+  /* Gather and sort all the samples. */
+  if ((mpierr = MPI_Allgather(&nsamples, 1, MPI_INT, sample_counts, 1, MPI_INT, comm))) {
+    *ierr = check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    goto exit;
+  }
+  for (int i = 0; i < size; i++) {
+    sample_displs[i] = total_samples;
+    total_samples += sample_counts[i];
+  }
+  if (!(samples = malloc((total_samples + 1) * sizeof(datatype)))) {
+    *ierr = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    goto exit;
+  }
+  if ((mpierr = MPI_Allgatherv(local_samples, nsamples, MY_MPI_DATATYPE, samples,
+                               sample_counts, sample_displs, MY_MPI_DATATYPE, comm))) {
+    *ierr = check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    goto exit;
+  }
+  if ((*ierr = local_sort(samples, total_samples)))
+    goto exit;
+
+  /* Pick size - 1 evenly spaced pivots, and find where they fall in
+   * the local data. */
+  for (int i = 1; i < size; i++)
+    pivots[i - 1] = total_samples ? samples[(size_t)i * total_samples / size] : 0;
+  {
+    datatype *pos = v.data;
+    for (int i = 0; i < size; i++) {
+      datatype *next = (i < size - 1) ? lower_bound(pos, v.data + v.N, pivots[i]) :
+                                        v.data + v.N;
+      sendcounts[i] = (int)(next - pos);
+      sdispls[i] = (int)(pos - v.data);
+      pos = next;
+    }
+  }
 
-  for (size_t i = 0; i < size; ++i) {
-    sendcounts[i] = block_sizes[rank * size + i];
-    sdispls[i] = send_pos;
-    send_pos += block_sizes[rank * size + i];
-    recvcounts[i] = block_sizes[rank + size * i];
+  /* Send each bin to its process. */
+  if ((mpierr = MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, comm))) {
+    *ierr = check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    goto exit;
+  }
+  for (int i = 0; i < size; i++) {
     rdispls[i] = recv_pos;
-    recv_pos += block_sizes[rank + size * i];
+    recv_pos += recvcounts[i];
   }
-  datatype *v2;
-  if(!(v2 = malloc(recv_pos * sizeof(*v2))))
-      *ierr = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__,__LINE__);
-
-  MPI_Alltoallv(v.data, sendcounts, sdispls, MY_MPI_DATATYPE,
-                v2, recvcounts, rdispls, MY_MPI_DATATYPE,
-                comm);
-  if(recv_pos > 0)
-      qsort(v2, recv_pos, sizeof(datatype), cmp);
+  if (!(v2 = malloc((recv_pos + 1) * sizeof(*v2)))) {
+    *ierr = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    goto exit;
+  }
+  if ((mpierr = MPI_Alltoallv(v.data, sendcounts, sdispls, MY_MPI_DATATYPE,
+                              v2, recvcounts, rdispls, MY_MPI_DATATYPE, comm))) {
+    *ierr = check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    goto exit;
+  }
+  if ((*ierr = local_sort(v2, recv_pos)))
+    goto exit;
 
-  free(block_sizes);
-  free(local_block_sizes);
-  free(pivot_pos);
+exit:
+  free(sendcounts);
   free(pivots);
-  free(local_pivots);
+  free(samples);
+  free(sample_displs);
+  free(sample_counts);
+  free(local_samples);
+  if (*ierr) {
+    free(v2);
+    return (CVector){NULL, 0};
+  }
 
   return (CVector){v2, recv_pos};
 }
@@ -181,31 +283,50 @@ CVector parallel_sort(MPI_Comm comm, CVector v, int *ierr) {
 /**
  * run_unique_check
  *
+ * An exact check for repeated values in an array distributed over
+ * comm, using parallel_sort(), so the whole array is never gathered
+ * on one task. Values less than 1 (holes in a decomposition map) are
+ * left out, and may repeat. v is not changed.
+ *
  * @param comm The MPI_comm to use
  * @param N the local size of v
  * @param v an array distributed over comm
  * @param has_dups A bool indicating if the array contains duplicate values
- *
+ * @return 0 for success, error code otherwise.
  */
 int run_unique_check(MPI_Comm comm, size_t N,datatype *v, bool *has_dups)
 {
   int rank, size, i, r;
-  int mpierr=MPI_SUCCESS, mpierr2;
+  int mpierr;
   int ierr;
+  datatype *mine;
+  size_t n = 0;
+
   if ((mpierr = MPI_Comm_rank(comm, &rank)))
-    check_mpi(NULL, NULL, mpierr2, __FILE__, __LINE__);
+    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
   if ((mpierr = MPI_Comm_size(comm, &size)))
-    check_mpi(NULL, NULL, mpierr2, __FILE__, __LINE__);
-    
-  srand(time(NULL) * rank);
+    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+  /* Copy the values that count, since the sort reorders them. */
+  if (!(mine = malloc((N + 1) * sizeof(datatype))))
+    return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+  for (size_t j = 0; j < N; j++)
+    if (v[j] > 0)
+      mine[n++] = v[j];
 
-  CVector sorted = parallel_sort(comm, (CVector){v, N}, &ierr);
+  CVector sorted = parallel_sort(comm, (CVector){mine, n}, &ierr);
+  free(mine);
+  if (ierr)
+    return ierr;
 
   int i_have_dups = is_unique(sorted) ? 0:1;
   int global_dups;
   if ((mpierr = MPI_Allreduce(&i_have_dups, &global_dups, 1, MPI_INT, MPI_MAX, comm)))
-    check_mpi(NULL, NULL, mpierr2, __FILE__, __LINE__);
+  {
+    free(sorted.data);
+    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+  }
     
   if(global_dups > 0)
     *has_dups = true;
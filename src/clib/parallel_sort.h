@@ -17,6 +17,14 @@ extern "C" {
 #  define MY_MPI_DATATYPE MPI_OFFSET
 #endif
 
+/* The most samples each process contributes to choose the pivots
+ * in parallel_sort(). */
+#define PIO_SORT_NSAMPLES 64
+
+/* Arrays shorter than this are sorted with qsort() rather than a
+ * radix sort. */
+#define PIO_SORT_RADIX_MIN 256
+
 typedef struct {
   datatype *data;
   size_t N;
@@ -86,6 +86,52 @@
 /** Name of var in decomp file that holds map. */
 #define DECOMP_MAP_VAR_NAME "map"
 
+/** Name of var in ragged decomp files that holds the start of the
+ * map of each task in the map var. */
+#define DECOMP_MAP_OFFSET_VAR_NAME "map_offset"
+
+/** Name of attribute with the layout of the map in decomp files. It
+ * is absent from decomp files with the dense layout. */
+#define DECOMP_LAYOUT_ATT_NAME "map_layout"
+
+/** String used to indicate a decomposition file has the maps of all
+ * tasks concatenated, instead of padded to max_maplen. */
+#define DECOMP_RAGGED_STR "ragged"
+
+/* The parts of the library with their own log level, see
+ * PIOc_set_log_level_subsys(). */
+#define PIO_LOG_GENERAL 0 /**< Everything not below. */
+#define PIO_LOG_REARR 1   /**< The rearrangers and pio_swapm(). */
+#define PIO_LOG_DARRAY 2  /**< Distributed array reads and writes. */
+#define PIO_LOG_MSG 3     /**< The async message handler. */
+#define PIO_LOG_NUM_SUBSYS 4 /**< Number of subsystems. */
+
+/* The categories of the memory allocated by the library, see
+ * PIOc_get_mem_usage(). */
+#define PIO_MEM_WMB 0     /**< Multi-var write buffers (wmb->data). */
+#define PIO_MEM_IOBUF 1   /**< Darray buffers of the IO tasks. */
+#define PIO_MEM_FILLBUF 2 /**< Fill value buffers of the holes. */
+#define PIO_MEM_INDEX 3   /**< The sindex and rindex of decompositions. */
+#define PIO_MEM_MPITYPE 4 /**< The arrays of MPI types of decompositions. */
+#define PIO_MEM_MSG 5     /**< Async message buffers. */
+#define PIO_MEM_ACCUM 6   /**< Reductions of PIOc_accumulate_darray(). */
+#define PIO_MEM_READ_CACHE 7 /**< Arrays kept by the read cache. */
+#define PIO_MEM_NUM_CAT 8 /**< Number of categories. */
+
+/** The number of timers of each IO system, see PIOc_get_timing(). */
+#define PIO_NUM_TIMERS 15
+
+/** Name of attribute with a summary of the balance of the IO tasks
+ * of the decomposition, see PIOc_get_decomp_report(). */
+#define DECOMP_REPORT_ATT_NAME "decomp_report"
+
+/** The longest decomp_report attribute, with its null terminator. */
+#define DECOMP_REPORT_LEN 512
+
+/** The most background operations (a sync and a close) pending on a
+ * file, see PIOc_closefile_async(). */
+#define PIO_MAX_BG 2
+
 /** String used to indicate a decomposition file is in C
  * array-order. */
 #define DECOMP_C_ORDER_STR "C"
@@ -113,12 +159,6 @@ typedef struct var_desc_t
      * unlimited dimension. */
     int record;
 
-    /** ID of each outstanding pnetcdf request for this variable. */
-    int *request;
-
-    /** Number of requests pending with pnetcdf. */
-    int nreqs;
-
     /** Holds the fill value of this var. */
     void *fillvalue;
 
@@ -129,9 +169,30 @@ typedef struct var_desc_t
     int use_fill;
 
     /** Buffer that contains the holegrid fill values used to fill in
-     * missing sections of data when using the subset rearranger. */
+     * missing sections of data when using the subset rearranger. For
+     * record vars it is kept for the next record, holegridsize
+     * values per var written, until the var is freed when the file
+     * is closed. */
     void *fillbuf;
 
+    /** The size in bytes of the holegrid part of fillbuf, which is
+     * followed by the fill values it was filled with. */
+    size_t fillbuf_size;
+
+    /** The decomposition and number of vars fillbuf was filled
+     * for. */
+    int fillbuf_ioid;
+    int fillbuf_nvars;
+
+    /** The ID of the decomposition the holes of this non-record var
+     * have been written for, or 0. */
+    int holes_ioid;
+
+    /** The next var of the list of vars of the file which have a
+     * fillbuf (file->fillbuf_vars), and true if this var is on it. */
+    struct var_desc_t *fillbuf_next;
+    bool fillbuf_listed;
+
     /** The PIO data type. */
     int pio_type;
 
@@ -144,6 +205,53 @@ typedef struct var_desc_t
     /** The size in bytes of a datum of MPI type mpitype. */
     int mpi_type_size;
 
+    /** The quantization of the data written with the darray
+     * functions (a PIO_QUANTIZE), or 0 for none. */
+    int quantize_mode;
+
+    /** The number of significant digits (bitgroom) or bits
+     * (bitround) kept by quantization. */
+    int nsd;
+
+    /** The ID of the decomposition that the chunk cache of this var
+     * was sized for, or 0 if none. */
+    int cache_ioid;
+
+    /** True if PIOc_write_darray() skips arrays that are the same as
+     * the last one written to this var, and the ID of the var that
+     * gets the frame holding the data of each record, or -1. See
+     * PIOc_set_var_skip_unchanged(). */
+    bool skip_unchanged;
+    int skip_refvarid;
+
+    /** The hash of the last array written to this var, whether there
+     * is one, and the frame it was written to. */
+    unsigned long long skip_hash;
+    bool skip_valid;
+    int skip_frame;
+
+    /** The reduction (a PIO_ACCUM), decomposition and number of the
+     * arrays accumulated with PIOc_accumulate_darray() since the last
+     * PIOc_write_accumulated(). */
+    int accum_op;
+    int accum_ioid;
+    int accum_n;
+
+    /** On IO tasks, the reduced values (as doubles) in the layout of
+     * the IO buffer of accum_ioid, followed by the number of values
+     * reduced for each element (as ints). NULL until first needed. */
+    void *accum;
+
+    /** The fill value of the accumulated arrays, and whether they
+     * have one. */
+    double accum_fill;
+    bool accum_has_fill;
+
+    /** The ID of the decomposition set with nc_def_var_decomp(), or 0
+     * if nc_put_vara()/nc_get_vara() on this var are not distributed
+     * array calls. */
+    int ncint_ioid;
+
     /** Hash table entry. */
     UT_hash_handle hh;
 
@@ -187,7 +295,17 @@ enum PIO_REARR_COMM_TYPE
     PIO_REARR_COMM_P2P = (0),
 
     /** Collective */
-    PIO_REARR_COMM_COLL
+    PIO_REARR_COMM_COLL,
+
+    /** Neighborhood collective, over a distributed graph of the
+     * tasks that exchange data. */
+    PIO_REARR_COMM_NEIGHBOR,
+
+    /** For the subset rearranger, when all tasks of a subset are on
+     * the node of their IO task, the compute tasks store their data
+     * straight into a shared memory window of the IO task (MPI-3
+     * shared memory). Otherwise, the same as PIO_REARR_COMM_COLL. */
+    PIO_REARR_COMM_SHM
 };
 
 /**
@@ -212,6 +330,116 @@ enum PIO_REARR_COMM_FC_DIR
 /** Constant to indicate unlimited requests for the rearranger. */
 #define PIO_REARR_COMM_UNLIMITED_PEND_REQ -1
 
+/**
+ * How tasks agree to flush the write multi buffer in
+ * PIOc_write_darray(). See PIOc_set_darray_flush_mode().
+ */
+enum PIO_DARRAY_FLUSH_MODE
+{
+    /** All computation tasks vote on each call (one MPI_Allreduce
+     * per call). This is the default. */
+    PIO_FLUSH_VOTE = 0,
+
+    /** Each task decides from values known on all tasks, without
+     * communication. The IO tasks also decide when to flush pnetcdf
+     * writes from the sizes of the decompositions written. */
+    PIO_FLUSH_DETERMINISTIC
+};
+
+/**
+ * Which computation tasks get the data read from non-distributed
+ * variables with the PIOc_get_var*() functions. See
+ * PIOc_set_read_delivery().
+ */
+enum PIO_READ_DELIVERY
+{
+    /** Every computation task gets a copy. This is the default. */
+    PIO_READ_ALL = 0,
+
+    /** Only one computation task gets the data. */
+    PIO_READ_ROOT,
+
+    /** One task on each node gets the data, into a buffer from
+     * PIOc_alloc_node_buf() that is shared by the tasks of the
+     * node. */
+    PIO_READ_NODE
+};
+
+/**
+ * How the data of a box decomposition are split between the IO
+ * tasks. See PIOc_set_iopart().
+ */
+enum PIO_IOPART
+{
+    /** Blocks of about blocksize bytes (see PIOc_set_blocksize()),
+     * the partition of CalcStartandCount(). This is the default. */
+    PIO_IOPART_BLOCK = 0,
+
+    /** Slabs of the slowest varying dimension, so each IO task has
+     * a contiguous part of the file. */
+    PIO_IOPART_SLAB,
+
+    /** Slabs of whole file system stripes, see
+     * PIOc_set_stripe_align(). */
+    PIO_IOPART_STRIPE,
+
+    /** Every IO task is used, with the bytes balanced between them. */
+    PIO_IOPART_BYTES,
+
+    /** The partition of a user function, see PIOc_set_iopart_fn(). */
+    PIO_IOPART_USER
+};
+
+/**
+ * How the computation tasks are grouped with the IO tasks by the
+ * SUBSET rearranger. See PIOc_set_subset_part().
+ */
+enum PIO_SUBSET_PART
+{
+    /** Blocks of consecutive computation ranks. This is the
+     * default. */
+    PIO_SUBSET_PART_RANK = 0,
+
+    /** Computation tasks go to an IO task on their node when there
+     * is one, so the rearranger data stays in shared memory. */
+    PIO_SUBSET_PART_NODE,
+
+    /** Computation tasks with adjacent parts of the map (by their
+     * smallest map value) go to the same IO task. The groups depend
+     * on the decomposition, so each has its own communicator. */
+    PIO_SUBSET_PART_MAP
+};
+
+/**
+ * How the IO tasks of async IO systems wait for messages from the
+ * computation tasks. See PIOc_set_async_wait().
+ */
+enum PIO_ASYNC_WAIT
+{
+    /** Block in MPI_Waitsome() and MPI_Bcast(). Most MPI libraries
+     * poll while blocked, so each IO task keeps a core busy. This is
+     * the default. */
+    PIO_ASYNC_WAIT_BLOCK = 0,
+
+    /** Test for messages, sleeping between tests for an interval
+     * that doubles, up to a maximum, while no message comes. The IO
+     * tasks then leave their cores to other work when idle, at the
+     * cost of up to the maximum sleep in latency. */
+    PIO_ASYNC_WAIT_BACKOFF
+};
+
+/**
+ * A user function to find the IO partition of a box
+ * decomposition. It is called on each IO task, and must set the start
+ * and count (each of length ndims) of the part of the data on IO task
+ * myiorank, and the number of IO tasks with data, which must be the
+ * first num_aiotasks IO tasks. Together they must cover all of
+ * gdims. It returns 0 on success, or a PIO error code.
+ */
+typedef int (*PIO_iopart_fn)(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                             int myiorank, void *arg, PIO_Offset *start, PIO_Offset *count,
+                             int *num_aiotasks);
+
 /**
  * Rearranger comm flow control options.
  */
@@ -250,6 +478,103 @@ typedef struct rearr_opt
     rearr_comm_fc_opt_t io2comp;
 } rearr_opt_t;
 
+/**
+ * Persistent MPI requests for a rearrangement that is done over and
+ * over with the same buffers. They are created the first time the
+ * rearrangement is done, and started again each time it is repeated
+ * with the same buffers and number of variables.
+ */
+typedef struct rearr_persist_t
+{
+    /** Number of variables moved by the requests. */
+    int nvars;
+
+    /** Send buffer the requests were created for. */
+    void *sbuf;
+
+    /** Receive buffer the requests were created for. */
+    void *rbuf;
+
+    /** Number of requests. */
+    int nreqs;
+
+    /** The persistent requests, NULL if there are none. */
+    MPI_Request *reqs;
+
+    /** Number of MPI types in types. */
+    int ntypes;
+
+    /** MPI types used by the requests, freed along with them. */
+    MPI_Datatype *types;
+} rearr_persist_t;
+
+/**
+ * I/O statistics of a file or a decomposition, on one task. See
+ * PIOc_get_file_stats() and PIOc_get_iodesc_stats().
+ */
+typedef struct pio_stats_t
+{
+    /** Bytes given to the rearranger for writes, and got from it for
+     * reads, on this computation task. */
+    PIO_Offset comp2io_bytes;
+    PIO_Offset io2comp_bytes;
+
+    /** Bytes of the IO buffer of this IO task written to (including
+     * holes) and read from the file. */
+    PIO_Offset bytes_written;
+    PIO_Offset bytes_read;
+
+    /** Number of regions of the file written and read by this IO
+     * task. */
+    PIO_Offset nregions;
+
+    /** Number of darray writes (of one or more vars) and reads. The
+     * writes of the fill values of holes are not counted. */
+    PIO_Offset nwrites;
+    PIO_Offset nreads;
+
+    /** Number of flushes of the pending writes of a file, and of
+     * waits for pending pnetcdf requests. Files only. */
+    PIO_Offset nflushes;
+    PIO_Offset nwaits;
+
+    /** Seconds spent in the rearranger, writing, reading, and
+     * waiting for pending pnetcdf requests. */
+    double rearrange_time;
+    double write_time;
+    double read_time;
+    double wait_time;
+} pio_stats_t;
+
+/**
+ * The balance of the load of a decomposition over the tasks of its IO
+ * system. See PIOc_get_decomp_report().
+ */
+typedef struct pio_decomp_report_t
+{
+    /** The number of IO tasks. */
+    int num_iotasks;
+
+    /** Bytes of one field in the IO buffer of each IO task: the
+     * minimum, maximum and mean over the IO tasks. */
+    PIO_Offset min_iobytes;
+    PIO_Offset max_iobytes;
+    double mean_iobytes;
+
+    /** Regions of the file written by each IO task. */
+    int min_regions;
+    int max_regions;
+
+    /** The most messages sent by a computation task, and received
+     * by an IO task, in the rearranger. */
+    int max_comp_msgs;
+    int max_io_msgs;
+
+    /** The fraction of the elements written by the IO tasks which are
+     * fill values for the holes of the decomposition. */
+    double fill_fraction;
+} pio_decomp_report_t;
+
 /**
  * IO descriptor structure.
  *
@@ -264,8 +589,14 @@ typedef struct io_desc_t
     /** The length of the decomposition map. */
     int maplen;
 
+    /** The IO partition used for a box decomposition, see
+     * PIO_IOPART. */
+    int iopart;
+
     /** A 1-D array with iodesc->maplen elements, which are the
-     * 1-based mappings to the global array for that task. */
+     * 1-based mappings to the global array for that task. NULL after
+     * the rearranger is set up if the IO system releases maps, see
+     * PIOc_set_map_release(). */
     PIO_Offset *map;
 
     /** If the map passed in is not monotonically increasing
@@ -275,6 +606,18 @@ typedef struct io_desc_t
     /** Remap. */
     int *remap;
 
+    /** Number of runs in remap_runs. */
+    int nremap_runs;
+
+    /** If remap is mostly made of runs of consecutive indices, an
+     * array of nremap_runs + 1 positions in remap where each run
+     * starts (the last element is maplen). Elements remap_runs[r] to
+     * remap_runs[r + 1] - 1 of the sorted array come from consecutive
+     * elements of the original array, starting at
+     * remap[remap_runs[r]]. NULL if the runs are too short to be
+     * worth using. */
+    int *remap_runs;
+
     /** Number of tasks involved in the communication between comp and
      * io tasks. */
     int nrecvs;
@@ -313,6 +656,23 @@ typedef struct io_desc_t
     /** The maximum number of bytes of this iodesc before flushing. */
     int maxbytes;
 
+    /** With PIOc_set_adaptive_aggregation() on, the number of arrays
+     * buffered before a flush, no more than maxbytes allows. 0 until
+     * the first full flush. */
+    int agg_arrays;
+
+    /** The direction agg_arrays was last changed in: 1 (doubled) or
+     * -1 (halved). */
+    int agg_dir;
+
+    /** The rate (arrays per second) of the last full flush, 0 until
+     * the first one. */
+    double agg_rate;
+
+    /** The time of the pnetcdf waits for the writes of this
+     * decomposition since its last full flush, in seconds. */
+    double agg_wait;
+
     /** The PIO type of the data. */
     int piotype;
 
@@ -351,11 +711,24 @@ typedef struct io_desc_t
     int *scount;
 
     /** Array (length ndof) for the BOX rearranger with the index
-     * for computation taks (send side during writes). */
-    PIO_Offset *sindex;
+     * for computation taks (send side during writes). Indices into
+     * the local array, which has ndof (an int) elements, so they are
+     * stored as int. */
+    int *sindex;
 
-    /** Index for the IO tasks (receive side during writes). */
-    PIO_Offset *rindex;
+    /** Index for the IO tasks (receive side during writes). Indices
+     * into the IO buffer, which can't have more than INT_MAX elements
+     * (the MPI datatypes built from them have int displacements). */
+    int *rindex;
+
+    /** For the SUBSET rearranger, rindex sorted by the computation
+     * task the elements come from, for PIOc_set_rearr_pack(). NULL
+     * until first needed. */
+    int *pack_rindex;
+
+    /** The most elements of one variable packed by any task of the
+     * rearranger, for PIOc_set_rearr_pack(). 0 until first needed. */
+    PIO_Offset pack_maxlen;
 
     /** Array (of length nrecvs) of receive MPI types in pio_swapm() call. */
     MPI_Datatype *rtype;
@@ -366,6 +739,11 @@ typedef struct io_desc_t
     /** Number of send MPI types in pio_swapm() call. */
     int num_stypes;
 
+    /** Array (length num_stypes) of send MPI types which index the
+     * caller's unsorted array, used by PIOc_write_darray_nocopy() when
+     * needssort is true. NULL until first needed. */
+    MPI_Datatype *ustype;
+
     /** Used when writing fill data. */
     int holegridsize;
 
@@ -388,14 +766,224 @@ typedef struct io_desc_t
 
     /** In the subset communicator each io task is associated with a
      * unique group of comp tasks this is the communicator for that
-     * group. */
+     * group. This is the subset_comm of the IO system, shared by its
+     * decompositions, unless subset_comm_private is true. */
     MPI_Comm subset_comm;
 
+    /** True if subset_comm belongs to this decomposition only. */
+    bool subset_comm_private;
+
+    /** Number of tasks in peers. */
+    int npeers;
+
+    /** Sorted ranks (in the rearranger communicator) of the tasks
+     * this task exchanges data with in the rearranger. */
+    int *peers;
+
+    /** Space for the counts and displacements (4 * npeers) of a
+     * rearranger exchange. */
+    int *peer_counts;
+
+    /** Space for the types (2 * npeers) of a rearranger exchange. */
+    MPI_Datatype *peer_types;
+
+    /** Distributed graph communicator over peers, used with
+     * PIO_REARR_COMM_NEIGHBOR. */
+    MPI_Comm neighbor_comm;
+
+    /** Number of computation tasks on this node, with
+     * PIO_REARR_NODE, or 0. When non-zero, the data of the node is
+     * gathered on its first task (the node leader), and the BOX
+     * rearrangement is done between the node leaders and the IO
+     * tasks. */
+    int nnode;
+
+    /** Communicator of the tasks on this node, with PIO_REARR_NODE. */
+    MPI_Comm node_comm;
+
+    /** Number of elements gathered on this task with PIO_REARR_NODE
+     * (0 except on node leaders). This is the length of the map used
+     * by the BOX rearrangement. */
+    int node_ndof;
+
+    /** On node leaders, the number of elements from each task of
+     * node_comm. */
+    int *node_counts;
+
+    /** On node leaders, where the elements of each task of node_comm
+     * start in the gathered data. */
+    int *node_displs;
+
+    /** On node leaders, buffer for the gathered data. */
+    void *node_buf;
+
+    /** Size in bytes of node_buf. */
+    size_t node_bufsize;
+
+    /** Type that picks a task's data out of an unsorted array in
+     * sorted order, with PIO_REARR_NODE and needssort. */
+    MPI_Datatype node_ustype;
+
+    /** With PIO_REARR_COMM_SHM, 1 if the shared memory window can be
+     * used, -1 if it can't, and 0 if this has not been checked. */
+    int shm_state;
+
+    /** Shared memory window of the IO task of the subset. */
+    MPI_Win shm_win;
+
+    /** Start of the IO task's part of shm_win. */
+    void *shm_base;
+
+    /** Number of variables shm_win has room for (0 if shm_win has
+     * not been allocated). */
+    int shm_nvars;
+
+    /** For each element this task sends, its index in the IO task's
+     * buffer. */
+    PIO_Offset *shm_dst;
+
+    /** Persistent requests for moving data from compute to IO
+     * tasks. */
+    rearr_persist_t comp2io_persist;
+
+    /** Persistent requests for moving data from IO to compute
+     * tasks. */
+    rearr_persist_t io2comp_persist;
+
+    /** The file types of ncmpi_put_vard() and ncmpi_get_vard() for the
+     * first record of the data (0) and the holes (1) of this
+     * decomposition, and the number of file dimensions and length of
+     * dimension 0 they were made for. vard_fndims is 0 if a type has
+     * not been made yet. See PIOc_set_vard(). */
+    MPI_Datatype vard_type[2];
+    int vard_fndims[2];
+    PIO_Offset vard_gdim0[2];
+
+    /** For a decomposition made with PIOc_init_decomp_coarse(), the
+     * ID of the decomposition it coarsens, the factor of each
+     * dimension, and the PIO_COARSE method. coarse_factor is NULL
+     * for other decompositions. */
+    int coarse_parent;
+    int *coarse_factor;
+    int coarse_op;
+
+    /** For a decomposition made with PIOc_init_decomp_gathered(), the
+     * ID of the decomposition it gathers, 0 for others. */
+    int gather_parent;
+
+    /** For a decomposition made with PIOc_init_decomp_extrude(), the
+     * ID of the decomposition it extrudes, and the number of levels,
+     * 0 for others. The levels are moved by the rearranger of that
+     * decomposition, as extrude_nlev variables. */
+    int extrude_parent;
+    int extrude_nlev;
+
+    /** On the computation tasks, the ID of the decomposition made by
+     * PIOc_init_decomp_gathered() from this one, 0 if none. */
+    int gathered_ioid;
+
+    /** The ID of the IO system this decomposition belongs to. */
+    int iosysid;
+
+    /** Hash of the PIOc_InitDecomp() inputs, used to find identical
+     * decompositions, see PIOc_set_decomp_sharing(). */
+    unsigned long long map_hash;
+
+    /** The number of PIOc_InitDecomp() calls which got this
+     * decomposition. PIOc_freedecomp() frees it when this drops to
+     * 0. */
+    int refcount;
+
+    /** I/O statistics of this decomposition on this task. */
+    pio_stats_t stats;
+
     /** Hash table entry. */
     UT_hash_handle hh;
 
 } io_desc_t;
 
+/**
+ * A buffer shared by the computation tasks of a node, see
+ * PIOc_alloc_node_buf().
+ */
+typedef struct pio_node_buf_t
+{
+    /** The buffer, as mapped on this task. */
+    void *buf;
+
+    /** Size of the buffer in bytes. */
+    PIO_Offset size;
+
+    /** The MPI shared memory window of the buffer. */
+    MPI_Win win;
+
+    /** Pointer to the next buffer of the iosystem. */
+    struct pio_node_buf_t *next;
+} pio_node_buf_t;
+
+/**
+ * An array kept by the read cache of an IO system, see
+ * PIOc_set_read_cache(). It holds the data of one record of a
+ * variable, as read by PIOc_read_darray() on a computation task.
+ */
+typedef struct pio_read_cache_entry
+{
+    /** The name of the file the data were read from. */
+    char *fname;
+
+    /** The ID of the variable. */
+    int varid;
+
+    /** The record of the variable, or -1. */
+    int frame;
+
+    /** The ID of the decomposition. */
+    int ioid;
+
+    /** Size of data in bytes. */
+    PIO_Offset size;
+
+    /** The data, in the order of the user's array. */
+    void *data;
+
+    /** Pointer to the next entry, which was used less recently. */
+    struct pio_read_cache_entry *next;
+} pio_read_cache_entry;
+
+/**
+ * The broadcast of the result of a background sync or close, posted
+ * by the IO tasks, see PIOc_closefile_async().
+ */
+typedef struct pio_bg_req
+{
+    /** The MPI request of the broadcast. */
+    MPI_Request req;
+
+    /** The result. */
+    int err;
+
+    /** Pointer to the next request. */
+    struct pio_bg_req *next;
+} pio_bg_req;
+
+/**
+ * A timer of an IO system, see PIOc_set_timing().
+ */
+typedef struct pio_timer_t
+{
+    /** The MPI_Wtime() it was last started. */
+    double start;
+
+    /** The total time, in seconds. */
+    double total;
+
+    /** The number of times it was stopped. */
+    PIO_Offset count;
+
+    /** True if it was started and not yet stopped. */
+    bool running;
+} pio_timer_t;
+
 /**
  * IO system descriptor structure.
  *
@@ -428,6 +1016,11 @@ typedef struct iosystem_desc_t
      * non-async) or the union (for async) communicator. */
     MPI_Comm my_comm;
 
+    /** If the communicators are shared with other IO systems (see
+     * PIOc_set_comm_sharing()), the number of IO systems using them,
+     * shared by all of them. NULL if they are not shared. */
+    int *comm_refs;
+
     /** The number of tasks in the IO communicator. */
     int num_iotasks;
 
@@ -494,12 +1087,228 @@ typedef struct iosystem_desc_t
     /** MPI Info object. */
     MPI_Info info;
 
+    /** The cb_nodes MPI-IO hint of the parallel files created in this
+     * iosystem, or 0 for all IO tasks, see PIOc_set_file_cb_nodes(). */
+    int file_cb_nodes;
+
+    /** Non-zero to derive MPI-IO hints for the parallel files
+     * created and opened in this iosystem, see
+     * PIOc_set_hint_auto(). */
+    int hint_auto;
+
+    /** The number of subfiles that PIO_IOTYPE_NETCDF files created in
+     * this iosystem are written as, or 0 for one file, see
+     * PIOc_set_subfiles(). */
+    int num_subfiles;
+
+    /** The node-local directory where the darray writes of pnetcdf
+     * files created in this iosystem are staged, or NULL, see
+     * PIOc_set_stage_dir(). */
+    char *stage_dir;
+
+    /** Non-zero if the distributed arrays of the files created and
+     * opened in this iosystem go to checkpoint files, see
+     * PIOc_set_checkpoint(). */
+    int checkpoint;
+
+    /** Non-zero if the arrays passed to the darray functions on the
+     * computation tasks of this iosystem may be in device (GPU)
+     * memory, see PIOc_set_device_buffers(). */
+    int device_buffers;
+
+    /** The compression (see PIO_COMPRESSION) of the variables defined
+     * in netCDF-4 files created in this iosystem afterwards, see
+     * PIOc_set_compression(). */
+    int compression;
+
+    /** The level of the compression, or 0 for the default. */
+    int compression_level;
+
+    /** The largest chunk cache, in bytes, that each IO task sets for
+     * each var of a PIO_IOTYPE_NETCDF4P file from the decomposition
+     * it is accessed with, or 0 to leave the chunk caches alone, see
+     * PIOc_set_auto_chunk_cache(). */
+    PIO_Offset auto_chunk_cache;
+
     /** Index of this component in the list of components. */
     int comp_idx;
 
     /** Rearranger options. */
     rearr_opt_t rearr_opts;
 
+    /** True if the rearranger options are tuned for each
+     * decomposition, see PIOc_set_rearr_autotune(). */
+    bool rearr_autotune;
+
+    /** Name of the file that caches tuned rearranger options
+     * between runs, or NULL. See PIOc_set_rearr_tune_file(). */
+    char *rearr_tune_file;
+
+    /** Name of the file the trace of the library calls is written
+     * to when the IO system is freed, or NULL. See
+     * PIOc_set_trace(). */
+    char *trace_file;
+
+    /** True if the timers of this IO system are on, see
+     * PIOc_set_timing(). */
+    bool timing;
+
+    /** The timers, indexed by the PIO_TIMER_* IDs. */
+    pio_timer_t timers[PIO_NUM_TIMERS];
+
+    /** How box decompositions are split between the IO tasks, see
+     * PIO_IOPART. */
+    int iopart;
+
+    /** True if box decomposition maps are checked for repeated
+     * values, see PIOc_set_map_dup_check(). */
+    bool map_dup_check;
+
+    /** True if identical decompositions are shared, see
+     * PIOc_set_decomp_sharing(). */
+    bool decomp_sharing;
+
+    /** True if decomposition maps are freed once the rearranger is
+     * set up, see PIOc_set_map_release(). */
+    bool map_release;
+
+    /** True if files are opened on first use, see
+     * PIOc_set_lazy_open(). */
+    bool lazy_open;
+
+    /** True if PIO packs the buffers of the rearranger itself, see
+     * PIOc_set_rearr_pack(). */
+    bool rearr_pack;
+
+    /** True if the metadata of NETCDF4P files is accessed
+     * collectively, see PIOc_set_nc4p_coll_meta(). */
+    bool nc4p_coll_meta;
+
+    /** True if the number of arrays buffered before a flush is found
+     * from the write rate, see PIOc_set_adaptive_aggregation(). */
+    bool adaptive_agg;
+
+    /** Network bandwidth (bytes/s) and latency (s) between the
+     * computation and IO tasks, and file system bandwidth and latency
+     * of the IO tasks, measured by PIOc_probe_iosystem(), or 0 if not
+     * measured. */
+    double probe_net_bw;
+    double probe_net_lat;
+    double probe_fs_bw;
+    double probe_fs_lat;
+
+    /** True if the holes of SUBSET decompositions are left to the
+     * fill mode of the netCDF library, see PIOc_set_library_fill(). */
+    bool library_fill;
+
+    /** True if the I/O statistics of each file are printed when it
+     * is closed, see PIOc_set_stats_report(). */
+    bool stats_report;
+
+    /** True if the errors of metadata calls are deferred for files
+     * created or opened from now, see PIOc_set_defer_errors(). */
+    bool defer_errors;
+
+    /** True if read_node_comm and read_leader_comm have been
+     * created. */
+    bool read_comms;
+
+    /** Communicator of the computation tasks on this node, for
+     * PIO_READ_NODE. */
+    MPI_Comm read_node_comm;
+
+    /** Communicator of the IO root task (rank 0) and the first
+     * computation task of each node, for PIO_READ_NODE. */
+    MPI_Comm read_leader_comm;
+
+    /** The buffers from PIOc_alloc_node_buf(). */
+    pio_node_buf_t *node_bufs;
+
+    /** The subset communicator of the SUBSET rearranger, which only
+     * depends on the IO system, so is shared by its decompositions. */
+    MPI_Comm subset_comm;
+
+    /** Number of decompositions using subset_comm. It is created
+     * with the first, and freed with the last. */
+    int subset_comm_refs;
+
+    /** How the computation tasks are grouped by the SUBSET
+     * rearranger, see PIO_SUBSET_PART. */
+    int subset_part;
+
+    /** The PIO_SUBSET_PART of subset_comm. */
+    int subset_comm_part;
+
+    /** The darray buffers of the IO tasks that are free for reuse,
+     * see PIOc_set_iobuf_pool(). */
+    void *iobuf_pool;
+
+    /** Bytes in iobuf_pool. */
+    PIO_Offset iobuf_pool_bytes;
+
+    /** Most bytes kept in iobuf_pool, or 0 for no pool. */
+    PIO_Offset iobuf_pool_max;
+
+    /** True if the darray buffers of the IO tasks are allocated with
+     * MPI_Alloc_mem(). */
+    bool iobuf_mpi_mem;
+
+    /** User function for the PIO_IOPART_USER IO partition. */
+    PIO_iopart_fn iopart_fn;
+
+    /** Argument passed to iopart_fn. */
+    void *iopart_arg;
+
+    /** Stripe size in bytes for PIO_IOPART_STRIPE, or 0 to use the
+     * striping_unit hint. */
+    int stripe_unit;
+
+    /** Number of stripes (OSTs) for PIO_IOPART_STRIPE, or 0 to use
+     * the striping_factor hint. */
+    int stripe_factor;
+
+    /** How the write multi buffer flush is decided, see
+     * PIO_DARRAY_FLUSH_MODE. */
+    int flush_mode;
+
+    /** True if darray writes to pnetcdf files are copied into the
+     * attached buffer of the file, see PIOc_set_pnetcdf_bput(). */
+    bool pnetcdf_bput;
+
+    /** Fraction of the free node memory used to size the pnetcdf
+     * buffers of files, or 0 to use the fixed limit, see
+     * PIOc_set_buffer_size_auto(). */
+    double buffer_frac;
+
+    /** Number of IO tasks on the node of this task. 0 until needed
+     * by PIOc_set_buffer_size_auto() or PIOc_set_hint_auto(). */
+    int node_iotasks;
+
+    /** True if the attributes written by the computation tasks of
+     * an async iosystem are queued and sent together, see
+     * PIOc_set_defer_atts(). */
+    bool defer_atts;
+
+    /** True if the computation tasks of an async iosystem don't wait
+     * for the IO tasks to write the distributed arrays, see
+     * PIOc_set_write_behind(). */
+    bool write_behind;
+
+    /** The arrays kept by the read cache, most recently used first,
+     * see PIOc_set_read_cache(). */
+    struct pio_read_cache_entry *read_cache;
+
+    /** The most bytes the read cache may keep on a task, or 0 if it
+     * is off. */
+    PIO_Offset read_cache_max;
+
+    /** The bytes kept by the read cache on this task. */
+    PIO_Offset read_cache_size;
+
+    /** On the IO tasks of an async iosystem, the result broadcasts of
+     * background syncs and closes that are not complete. */
+    struct pio_bg_req *bg_reqs;
+
     /** Pointer to the next iosystem_desc_t in the list. */
     struct iosystem_desc_t *next;
 } iosystem_desc_t;
@@ -539,6 +1348,23 @@ typedef struct wmulti_buffer
     /** Pointer to the data. */
     void *data;
 
+    /** Number of arrays for which memory has been reserved in vid,
+     * frame and fillvalue. This memory is kept when the buffer is
+     * flushed, and reused for the next arrays. */
+    int capacity;
+
+    /** Number of bytes of memory reserved in data. */
+    size_t data_size;
+
+    /** True if this buffer holds references to the caller's arrays
+     * (see PIOc_write_darray_nocopy()) instead of copies of the
+     * data. */
+    bool nocopy;
+
+    /** For nocopy buffers, an array of pointers to the caller's
+     * arrays. One element per variable. */
+    void **arrays;
+
     /** uthash handle for hash of buffers */
     int htid;
 
@@ -546,6 +1372,116 @@ typedef struct wmulti_buffer
     UT_hash_handle hh;
 } wmulti_buffer;
 
+/**
+ * A pending pnetcdf write of a file, see pio_queue_put_request().
+ */
+typedef struct pio_put_req
+{
+    /** The pnetcdf request ID. */
+    int request;
+
+    /** Offset in the file of the variable (and record) written,
+     * which orders the requests when they are waited for. */
+    PIO_Offset offset;
+
+    /** Bytes written by this task. */
+    PIO_Offset bytes;
+
+    /** The decomposition of a darray write, or 0. */
+    int ioid;
+} pio_put_req;
+
+/**
+ * One darray record in the checkpoint files of a file, see
+ * PIOc_set_checkpoint().
+ */
+typedef struct pio_ckpt_entry
+{
+    /** The ID of the var. */
+    int varid;
+
+    /** The frame of a record var, or -1. */
+    int frame;
+
+    /** The PIO type of the data. */
+    int pio_type;
+
+    /** The number of dimensions of the var in the file. */
+    int fndims;
+
+    /** The number of regions. */
+    int rrcnt;
+
+    /** The checkpoint file the record is in, which is the IO rank of
+     * the task that wrote it. */
+    int fidx;
+
+    /** The number of values of data. */
+    PIO_Offset nelems;
+
+    /** The offset in the checkpoint file of the region table of the
+     * record, which is followed by the data. */
+    long offset;
+} pio_ckpt_entry;
+
+/**
+ * Holds one non-blocking write or read of a distributed array,
+ * started with PIOc_iwrite_darray() or PIOc_iread_darray() and
+ * completed with PIOc_wait_darray().
+ */
+typedef struct darray_req
+{
+    /** The request ID returned to the user. */
+    int reqid;
+
+    /** The ID that describes the decomposition. */
+    int ioid;
+
+    /** The ID of the variable being written or read. */
+    int varid;
+
+    /** True if this is a read (PIOc_iread_darray()). */
+    bool read;
+
+    /** Record number for record vars, -1 otherwise. */
+    int frame;
+
+    /** Data on the compute task. For writes, a copy of the caller's
+     * data, sorted if the decomposition needs it. For reads, the
+     * buffer the data are received into before they are sorted into
+     * array, if the decomposition needs it. */
+    void *sbuf;
+
+    /** Buffer of the data on the IO task. */
+    void *iobuf;
+
+    /** For reads, the caller's array that gets the data. */
+    void *array;
+
+    /** For pnetcdf reads, true while the read into iobuf has been
+     * posted but not completed. */
+    bool get_pending;
+
+    /** For reads, true once the messages that move the data from
+     * iobuf to the compute tasks have been posted. */
+    bool exchange_posted;
+
+    /** For pnetcdf reads, the ID of the pnetcdf request. */
+    int getreq;
+
+    /** Fill value of the variable. */
+    void *fillvalue;
+
+    /** Number of MPI requests in reqs. */
+    int nreqs;
+
+    /** MPI requests of the messages in flight. */
+    MPI_Request *reqs;
+
+    /** Hash table entry. */
+    UT_hash_handle hh;
+} darray_req_t;
+
 /**
  * File descriptor structure.
  *
@@ -569,33 +1505,207 @@ typedef struct file_desc_t
     /** List of variables in this file. */
     struct var_desc_t *varlist;
 
+    /** Index of varlist by varid, for the first var_index_len
+     * varids. An entry is NULL until the var is first looked up, see
+     * get_file_var_desc(). */
+    struct var_desc_t **var_index;
+    int var_index_len;
+
+    /** The vars which have a fillbuf, for flush_output_buffer() to
+     * free. */
+    struct var_desc_t *fillbuf_vars;
+
     /** Number of variables. */
     int nvars;
 
     /** True if file can be written to. */
     int writable;
 
+    /** The name the file was created or opened with. */
+    char *fname;
+
+    /** On the computation tasks of an async iosystem, the requests
+     * that get the results of a background sync and close, see
+     * PIOc_sync_async() and PIOc_closefile_async(). */
+    MPI_Request bg_reqs[PIO_MAX_BG];
+
+    /** The results of the background operations. */
+    int bg_errs[PIO_MAX_BG];
+
+    /** Number of background operations not waited for. */
+    int nbg;
+
+    /** True if the file was closed in the background. */
+    bool bg_close;
+
     /** The wmulti_buffer is used to aggregate multiple variables with
      * the same communication pattern prior to a write. */
     struct wmulti_buffer *buffer;
 
+    /** Non-blocking darray writes that have not been waited for. */
+    struct darray_req *darray_reqs;
+
+    /** The request ID to use for the next non-blocking darray
+     * write. */
+    int next_darray_reqid;
+
+    /** Pending pnetcdf writes of this file, of all variables and
+     * decompositions. They are waited for together by
+     * flush_output_buffer(). */
+    pio_put_req *put_reqs;
+
+    /** Number of entries in put_reqs. */
+    int nput_reqs;
+
+    /** True if put_reqs has writes of PIOc_put_var*(), which must be
+     * flushed before the file is read. The same on all IO tasks. */
+    bool var_puts_pending;
+
+    /** Size of the pnetcdf buffer attached to this file, and the
+     * usage at which its writes are flushed. */
+    PIO_Offset buffer_limit;
+
+    /** Number of calls to check_output_buffer(). */
+    int nflush_checks;
+
+    /** An upper bound on the usage of the attached pnetcdf buffer of
+     * all IO tasks, kept without communication for
+     * PIO_FLUSH_DETERMINISTIC. */
+    PIO_Offset buffer_usage;
+
+    /** Attributes queued on the computation tasks of an async
+     * iosystem, packed as the arguments of one message, or NULL. */
+    struct pio_msg_args *deferred_atts;
+
+    /** On the IO tasks of an async iosystem, the first error from
+     * writing distributed arrays in write behind mode. It is
+     * returned by the next PIOc_sync() or PIOc_closefile(). */
+    int write_behind_err;
+
+    /** True if the errors of the calls that change the metadata are
+     * kept until the next PIOc_enddef(), PIOc_redef(), PIOc_sync(),
+     * PIOc_closefile() or PIOc_check_errors(). See
+     * PIOc_set_defer_errors(). */
+    bool defer_errors;
+
+    /** On each task, the first deferred error since they were last
+     * checked. */
+    int deferred_err;
+
     /** Data buffer for this file. */
     void *iobuf;
 
+    /** True if the darray write in progress is copied into the
+     * attached pnetcdf buffer, so iobuf can be freed as soon as it
+     * has been queued. */
+    bool darray_bput;
+
     /** PIO data type. */
     int pio_type;
 
+    /** The metadata cache of a file opened through the netCDF
+     * integration layer, or NULL. */
+    void *ncint_meta;
+
+    /** The header read when a file was opened through the netCDF
+     * integration layer, until it is moved into ncint_meta, or
+     * NULL. */
+    struct pio_file_meta *open_meta;
+
     /** Hash table entry. */
     UT_hash_handle hh;
 
+    /** True if the file was opened with PIOc_set_lazy_open() on, and
+     * has not been used yet, so it is not open in the netCDF
+     * library. The mode and retry of the open, for when it is. */
+    bool lazy;
+    int lazy_mode;
+    int lazy_retry;
+
+    /** For a lazily opened file, the frames set with PIOc_setframe()
+     * or PIOc_advanceframe() before it was opened, as nlazy_frames
+     * pairs of varid and frame. */
+    int nlazy_frames;
+    int *lazy_frames;
+
     /** True if this task should participate in IO (only true for one
-     * task with netcdf serial files. */
+     * task with netcdf serial files, or one task for each subfile. */
     int do_io;
 
+    /** The fill mode of the file, NC_FILL or NC_NOFILL, see
+     * PIOc_set_fill(). */
+    int fill_mode;
+
+    /** Which tasks get the data of reads of non-distributed vars
+     * (see PIO_READ_DELIVERY), and the computation task that gets it
+     * with PIO_READ_ROOT. See PIOc_set_read_delivery(). */
+    int read_delivery;
+    int read_root;
+
+    /** True if the distributed arrays of this pnetcdf file are read
+     * and written with the vard functions of pnetcdf, instead of the
+     * varn functions. See PIOc_set_vard(). */
+    bool use_vard;
+
+    /** On IO tasks of a pnetcdf file created with a stage directory
+     * (see PIOc_set_stage_dir()), the node-local log that the darray
+     * writes go to until they are drained into the file. Otherwise
+     * NULL. */
+    FILE *stage_fp;
+
+    /** The bytes of data in stage_fp not yet drained. */
+    PIO_Offset stage_bytes;
+
+    /** The number of checkpoint files of the file, which is the
+     * number of IO tasks that wrote them, or 0 if the distributed
+     * arrays are in the netCDF file, see PIOc_set_checkpoint(). */
+    int ckpt_nfiles;
+
+    /** On IO tasks, the checkpoint files, NULL for those not yet
+     * opened. */
+    FILE **ckpt_fps;
+
+    /** On IO tasks, the darray records in the open checkpoint
+     * files. */
+    pio_ckpt_entry *ckpt_index;
+
+    /** The number of records in ckpt_index. */
+    int ckpt_nindex;
+
+    /** The allocated length of ckpt_index. */
+    int ckpt_maxindex;
+
+    /** The number of subfiles of a PIO_IOTYPE_NETCDF file, or 0 if it
+     * is not written as subfiles. */
+    int num_subfiles;
+
+    /** For subfiled files, on IO tasks, the communicator of the IO
+     * tasks whose data are in the same subfile as the data of this
+     * task. Rank 0 is the task that does the IO. */
+    MPI_Comm subfile_comm;
+
+    /** The compression (see PIO_COMPRESSION) and its level, for the
+     * variables defined in this file, if it is a netCDF-4 file. Set
+     * from the iosystem when the file is created. */
+    int compression;
+    int compression_level;
+
+    /** True if darrays are written to this PIO_IOTYPE_NETCDF4P file
+     * with independent access, see PIOc_set_par_access(). */
+    bool independent;
+
+    /** True if the access of all the vars of this PIO_IOTYPE_NETCDF4P
+     * file was made collective when it was opened, see
+     * PIOc_set_nc4p_coll_meta(). */
+    bool coll_access;
+
     /** True if this file was opened with the netCDF integration
      * feature. One consequence is that PIO_IOTYPE_NETCDF4C files will
      * not have deflate automatically turned on for each var. */
     int ncint_file;
+
+    /** I/O statistics of this file on this task. */
+    pio_stats_t stats;
 } file_desc_t;
 
 /**
@@ -617,6 +1727,79 @@ enum PIO_IOTYPE
     PIO_IOTYPE_NETCDF4P = 4
 };
 
+/**
+ * These are the compression methods which can be set with
+ * PIOc_set_compression() for netCDF-4 files.
+ */
+enum PIO_COMPRESSION
+{
+    /** No compression. */
+    PIO_COMPRESS_NONE = 0,
+
+    /** Zlib (deflate), with shuffle. Levels 1 to 9. */
+    PIO_COMPRESS_ZLIB = 1,
+
+    /** Szip, if netCDF was built with szip write. The level is the
+     * number of pixels per block, an even number up to 32. */
+    PIO_COMPRESS_SZIP = 2,
+
+    /** Zstandard, with shuffle, if netCDF was built with it. Levels 1
+     * to 22. */
+    PIO_COMPRESS_ZSTD = 3
+};
+
+/**
+ * These are the quantization methods which can be set with
+ * PIOc_def_var_quantize(). The values are the same as those of the
+ * netCDF quantize modes.
+ */
+enum PIO_QUANTIZE
+{
+    /** No quantization. */
+    PIO_NOQUANTIZE = 0,
+
+    /** Bit grooming. Keeps a number of significant decimal digits,
+     * 1 to 7 for floats, 1 to 15 for doubles. */
+    PIO_QUANTIZE_BITGROOM = 1,
+
+    /** Bit rounding. Keeps a number of significant bits of the
+     * mantissa, 1 to 23 for floats, 1 to 52 for doubles. */
+    PIO_QUANTIZE_BITROUND = 3
+};
+
+/**
+ * These are the reductions of the arrays accumulated with
+ * PIOc_accumulate_darray().
+ */
+enum PIO_ACCUM
+{
+    /** The mean of the arrays. */
+    PIO_ACCUM_MEAN = 1,
+
+    /** The sum of the arrays. */
+    PIO_ACCUM_SUM = 2,
+
+    /** The smallest value of each element. */
+    PIO_ACCUM_MIN = 3,
+
+    /** The largest value of each element. */
+    PIO_ACCUM_MAX = 4
+};
+
+/**
+ * These are the methods of the coarse decompositions made with
+ * PIOc_init_decomp_coarse().
+ */
+enum PIO_COARSE
+{
+    /** Every factor-th element along each dimension. */
+    PIO_COARSE_SUBSAMPLE = 1,
+
+    /** The mean of each block of factor elements along each
+     * dimension. */
+    PIO_COARSE_MEAN = 2
+};
+
 /**
  * These are the supported output data rearrangement methods.
  */
@@ -626,7 +1809,11 @@ enum PIO_REARRANGERS
     PIO_REARR_BOX = 1,
 
     /** Subset rearranger. */
-    PIO_REARR_SUBSET = 2
+    PIO_REARR_SUBSET = 2,
+
+    /** Box rearranger, with the data of the tasks on each node first
+     * gathered on one task of the node. Not supported for async. */
+    PIO_REARR_NODE = 3
 };
 
 /**
@@ -676,6 +1863,8 @@ enum PIO_ERROR_HANDLERS
 #define PIO_MAX_VAR_DIMS NC_MAX_VAR_DIMS /**< max per variable dimensions */
 #define PIO_64BIT_OFFSET NC_64BIT_OFFSET /**< Use large (64-bit) file offsets. Mode flag for nc_create(). */
 #define PIO_64BIT_DATA NC_64BIT_DATA /**< CDF5 format. */
+#define PIO_INDEPENDENT 0        /**< Independent parallel access, as NC_INDEPENDENT. */
+#define PIO_COLLECTIVE 1         /**< Collective parallel access, as NC_COLLECTIVE. */
 
 /** Define the netCDF-based error codes. */
 #define PIO_NOERR  NC_NOERR           /**< No Error */
@@ -779,7 +1968,10 @@ extern "C" {
 #endif
     /* Error handling. */
     int PIOc_strerror(int pioerr, char *errstr);
+    int PIOc_set_defer_errors(int iosysid, bool enable);
+    int PIOc_check_errors(int ncid);
     int PIOc_set_log_level(int level);
+    int PIOc_set_log_level_subsys(int subsys, int level);
     int PIOc_set_global_log_level(int iosysid, int level);
 
     /* Decomposition. */
@@ -796,6 +1988,18 @@ extern "C" {
                          const PIO_Offset *compmap, int *ioidp, int rearranger,
                          const PIO_Offset *iostart, const PIO_Offset *iocount);
 
+    /* Init decomposition with runs of elements. */
+    int PIOc_init_decomp_runs(int iosysid, int pio_type, int ndims, const int *gdimlen,
+                              int nruns, const PIO_Offset *runstart, const PIO_Offset *runlen,
+                              const PIO_Offset *runstride, int *ioidp, int rearranger,
+                              const PIO_Offset *iostart, const PIO_Offset *iocount);
+
+    /* Init decomposition for the levels of a decomposition. */
+    int PIOc_init_decomp_extrude(int iosysid, int ioid, int nlev, int *ioidp);
+    int PIOc_init_decomp_gathered(int iosysid, int ioid, PIO_Offset *npointsp, int *ioidp);
+    int PIOc_init_decomp_coarse(int iosysid, int ioid, int op, const int *factor,
+                                int *ioidp);
+
     /* Free resources associated with a decomposition. */
     int PIOc_freedecomp(int iosysid, int ioid);
 
@@ -808,6 +2012,12 @@ extern "C" {
     int PIOc_writemap_from_f90(const char *file, int ndims, const int *gdims,
                                PIO_Offset maplen, const PIO_Offset *map, int f90_comm);
 
+    /* Read and write binary decomposition files with MPI-IO. */
+    int PIOc_readmap_bin(const char *file, int *ndims, int **gdims, PIO_Offset *fmaplen,
+                         PIO_Offset **map, MPI_Comm comm);
+    int PIOc_writemap_bin(const char *file, int ndims, const int *gdims, PIO_Offset maplen,
+                          PIO_Offset *map, MPI_Comm comm);
+
     /* Write a decomposition file. */
     int PIOc_write_decomp(const char *file, int iosysid, int ioid, MPI_Comm comm);
 
@@ -815,6 +2025,10 @@ extern "C" {
     int PIOc_write_nc_decomp(int iosysid, const char *filename, int cmode, int ioid,
                              char *title, char *history, int fortran_order);
 
+    /* Write a netCDF decomposition file with the ragged layout. */
+    int PIOc_write_nc_decomp_ragged(int iosysid, const char *filename, int cmode, int ioid,
+                                    char *title, char *history, int fortran_order);
+
     /* Read a netCDF decomposition file. */
     int PIOc_read_nc_decomp(int iosysid, const char *filename, int *ioid, MPI_Comm comm,
                             int pio_type, char *title, char *history, int *fortran_order);
@@ -824,10 +2038,20 @@ extern "C" {
                         int *num_procs_per_comp, int **proc_list, MPI_Comm *io_comm, MPI_Comm *comp_comm,
                         int rearranger, int *iosysidp);
 
+    /* Initializing IO system for async, with IO tasks for each component. */
+    int PIOc_init_async_split(MPI_Comm world, int component_count, int *num_io_procs,
+                              int **io_proc_list, int *num_procs_per_comp, int **proc_list,
+                              int rearranger, int *iosysidp);
+
     /* Initializing IO system for async - alternative interface. */
     int PIOc_init_async_from_comms(MPI_Comm world, int component_count, MPI_Comm *comp_comm,
                                    MPI_Comm io_comm, int rearranger, int *iosysidp);
 
+    /* Initializing IO system for async, with the IO tasks divided between components. */
+    int PIOc_init_async_from_comms_split(MPI_Comm world, int component_count,
+                                         MPI_Comm *comp_comm, MPI_Comm io_comm,
+                                         const int *io_share, int rearranger, int *iosysidp);
+
     /* How many IO tasks in this iosysid? */
     int PIOc_get_numiotasks(int iosysid, int *numiotasks);
 
@@ -835,6 +2059,17 @@ extern "C" {
     int PIOc_Init_Intracomm(MPI_Comm comp_comm, int num_iotasks, int stride, int base, int rearr,
                             int *iosysidp);
 
+    /* Initialize PIO for intracomm mode, spreading the IO tasks over the nodes. */
+    int PIOc_Init_Intracomm_topo(MPI_Comm comp_comm, int num_iotasks, int iotasks_per_node,
+                                 int rearr, int *iosysidp);
+
+    /* Share the communicators of IO systems with the same tasks. */
+    bool PIOc_set_comm_sharing(bool enable);
+
+    /* Report the placement of the IO tasks on the nodes. */
+    int PIOc_get_iotask_layout(int iosysid, int *num_nodes, int *num_ionodes, int *ioranks,
+                               int *ionodes);
+
     /** Shut down an iosystem and free all associated resources. Use
      * PIOc_free_iosystem() instead. */
     int PIOc_finalize(int iosysid);
@@ -861,6 +2096,54 @@ extern "C" {
     int PIOc_iotype_available(int iotype);
 
     /* Set the options for the rearranger. */
+    int PIOc_set_rearr_autotune(int iosysid, bool enable);
+    int PIOc_set_rearr_tune_file(int iosysid, const char *filename);
+
+    /* Align the box rearranger IO partition to file system stripes. */
+    int PIOc_set_stripe_align(int iosysid, bool enable, int striping_unit, int striping_factor);
+
+    /* Choose how box decompositions are split between the IO tasks. */
+    int PIOc_set_iopart(int iosysid, int iopart);
+    int PIOc_set_iopart_fn(int iosysid, PIO_iopart_fn fn, void *arg);
+
+    /* Choose how the SUBSET rearranger groups the tasks. */
+    int PIOc_set_subset_part(int iosysid, int part);
+
+    /* Check the maps of box decompositions for repeated values. */
+    int PIOc_set_map_dup_check(int iosysid, bool enable);
+
+    /* Free the maps of decompositions once their rearrangers are set up. */
+    int PIOc_set_map_release(int iosysid, bool enable);
+    int PIOc_set_lazy_open(int iosysid, bool enable);
+    int PIOc_set_rearr_pack(int iosysid, bool enable);
+    int PIOc_set_nc4p_coll_meta(int iosysid, bool enable);
+    int PIOc_set_adaptive_aggregation(int iosysid, bool enable);
+    int PIOc_probe_iosystem(int iosysid, const char *scratch_dir, const char *cache_file);
+    int PIOc_get_probe(int iosysid, double *net_bw, double *net_lat, double *fs_bw,
+                       double *fs_lat);
+    int PIOc_set_decomp_sharing(int iosysid, bool enable);
+    int PIOc_set_library_fill(int iosysid, bool enable);
+    int PIOc_set_read_delivery(int ncid, int delivery, int root);
+    int PIOc_alloc_node_buf(int iosysid, PIO_Offset size, void **bufp);
+    int PIOc_free_node_buf(int iosysid, void *buf);
+    int PIOc_set_vard(int ncid, bool enable);
+    int PIOc_inq_vard(int ncid, bool *use_vard);
+
+    /* Get the I/O statistics of a file or decomposition. */
+    int PIOc_get_file_stats(int ncid, pio_stats_t *stats);
+    int PIOc_get_iodesc_stats(int ioid, pio_stats_t *stats);
+    int PIOc_get_decomp_report(int iosysid, int ioid, pio_decomp_report_t *report);
+    int PIOc_set_stats_report(int iosysid, bool enable);
+
+    /* Turn on or off, and get, the timers of the library. */
+    int PIOc_set_timing(int iosysid, bool enable);
+    int PIOc_get_timing(int iosysid, const char *name, double *time, PIO_Offset *count);
+    int PIOc_reset_timing(int iosysid);
+    int PIOc_set_trace(int iosysid, const char *filename);
+
+    /* Get the memory allocated by the library on this task. */
+    int PIOc_get_mem_usage(int category, PIO_Offset *current, PIO_Offset *peak);
+    int PIOc_set_iobuf_pool(int iosysid, PIO_Offset max_bytes, bool mpi_mem);
     int PIOc_set_rearr_opts(int iosysid, int comm_type, int fcd,
                             bool enable_hs_c2i, bool enable_isend_c2i,
                             int max_pend_req_c2i,
@@ -873,24 +2156,54 @@ extern "C" {
     /* Set the record number. */
     int PIOc_setframe(int ncid, int varid, int frame);
 
+    /* Set the quantization of the data written to a var. */
+    int PIOc_def_var_quantize(int ncid, int varid, int quantize_mode, int nsd);
+    int PIOc_set_var_skip_unchanged(int ncid, int varid, bool enable, int refvarid);
+
     /* Write a distributed array. */
     int PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
                           void *fillvalue);
 
+    /* Write a distributed array, converting it from the type in memory. */
+    int PIOc_write_darray_tc(int ncid, int varid, int ioid, PIO_Offset arraylen, int memtype,
+                             void *array, void *fillvalue);
+
     /* Write multiple darrays. */
     int PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars, PIO_Offset arraylen,
                                 void *array, const int *frame, void **fillvalue, bool flushtodisk);
 
+    /* Write a darray, and a coarse version of it computed on the IO tasks. */
+    int PIOc_write_darray_coarse(int ncid, int varid, int cvarid, int ioid,
+                                 PIO_Offset arraylen, void *array, void *fillvalue);
+
+    /* Write a darray to several files, with one rearrangement. */
+    int PIOc_write_darray_files(int nfiles, const int *ncids, const int *varids, int ioid,
+                                PIO_Offset arraylen, void *array, void *fillvalue);
+
+    /* Reduce distributed arrays on the IO tasks, and write the result. */
+    int PIOc_accumulate_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
+                               int op);
+    int PIOc_write_accumulated(int ncid, int varid);
+
     /* Read distributed array. */
     int PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array);
 
+    /* Read multiple darrays. */
+    int PIOc_read_darray_subset(int ncid, int varid, int ioid, const PIO_Offset *start,
+                                const PIO_Offset *count, PIO_Offset arraylen, void *array);
+    int PIOc_read_darray_multi(int ncid, const int *varids, int ioid, int nvars,
+                               PIO_Offset arraylen, void *array);
+
     /* Get size of local distributed array. */
     int PIOc_get_local_array_size(int ioid);
 
     /* Handling files. */
     int PIOc_redef(int ncid);
     int PIOc_enddef(int ncid);
+    int PIOc_enddef_align(int ncid, PIO_Offset h_minfree, PIO_Offset v_align,
+                          PIO_Offset v_minfree, PIO_Offset r_align);
     int PIOc_sync(int ncid);
+    int PIOc_sync_async(int ncid);
     int PIOc_deletefile(int iosysid, const char *filename);
     int PIOc_createfile(int iosysid, int *ncidp,  int *iotype, const char *fname, int mode);
     int PIOc_create(int iosysid, const char *path, int cmode, int *ncidp);
@@ -898,6 +2211,9 @@ extern "C" {
     int PIOc_openfile2(int iosysid, int *ncidp, int *iotype, const char *fname, int mode);
     int PIOc_open(int iosysid, const char *path, int mode, int *ncidp);
     int PIOc_closefile(int ncid);
+    int PIOc_closefile_async(int ncid);
+    int PIOc_file_test(int ncid, int *done);
+    int PIOc_file_wait(int ncid);
     int PIOc_inq_format(int ncid, int *formatp);
     int PIOc_inq(int ncid, int *ndimsp, int *nvarsp, int *ngattsp, int *unlimdimidp);
     int PIOc_inq_ndims(int ncid, int *ndimsp);
@@ -907,19 +2223,48 @@ extern "C" {
     int PIOc_inq_unlimdims(int ncid, int *nunlimdimsp, int *unlimdimidsp);
     int PIOc_inq_type(int ncid, nc_type xtype, char *name, PIO_Offset *sizep);
     int PIOc_set_blocksize(int newblocksize);
+
+    /* Choose how async IO tasks wait for messages. */
+    int PIOc_set_async_wait(int wait, int max_sleep);
     int PIOc_File_is_Open(int ncid);
 
     /* Set the IO node data buffer size limit. */
     PIO_Offset PIOc_set_buffer_size_limit(PIO_Offset limit);
+    PIO_Offset PIOc_set_compute_buffer_limit(PIO_Offset limit);
+    int PIOc_set_buffer_size_auto(int iosysid, double fraction);
+    int PIOc_set_darray_flush_mode(int iosysid, int mode, int *old_mode);
+    int PIOc_set_pnetcdf_bput(int iosysid, bool enable);
+    int PIOc_set_defer_atts(int iosysid, bool enable);
+    int PIOc_set_write_behind(int iosysid, bool enable);
+    int PIOc_set_read_cache(int iosysid, PIO_Offset max_bytes);
+    int PIOc_clear_read_cache(int iosysid, const char *filename);
+    int PIOc_write_darray_nocopy(int ncid, int varid, int ioid, PIO_Offset arraylen,
+                                 void *array, void *fillvalue);
+    int PIOc_write_darray_nocopy_wait(int ncid);
+    int PIOc_write_gathered_list(int ncid, int varid, int ioid);
+    int PIOc_iwrite_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
+                           void *fillvalue, int *request);
+    int PIOc_iread_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
+                          int *request);
+    int PIOc_wait_darray(int ncid, int request);
 
     /* Set the error hanlding for a file. */
     int PIOc_Set_File_Error_Handling(int ncid, int method);
 
     int PIOc_set_hint(int iosysid, const char *hint, const char *hintval);
+    int PIOc_set_hint_auto(int iosysid, int enable);
+    int PIOc_set_file_cb_nodes(int iosysid, int cb_nodes);
+    int PIOc_set_subfiles(int iosysid, int num_subfiles);
+    int PIOc_set_stage_dir(int iosysid, const char *dir);
+    int PIOc_set_checkpoint(int iosysid, int enable);
+    int PIOc_set_device_buffers(int iosysid, int enable);
+    int PIOc_set_compression(int iosysid, int compression, int level);
     int PIOc_set_chunk_cache(int iosysid, int iotype, PIO_Offset size, PIO_Offset nelems,
                              float preemption);
     int PIOc_get_chunk_cache(int iosysid, int iotype, PIO_Offset *sizep, PIO_Offset *nelemsp,
                              float *preemptionp);
+    int PIOc_set_auto_chunk_cache(int iosysid, PIO_Offset max_size);
+    int PIOc_set_par_access(int ncid, int par_access);
 
     /* Dimensions. */
     int PIOc_inq_dim(int ncid, int dimid, char *name, PIO_Offset *lenp);
@@ -951,6 +2296,7 @@ extern "C" {
     int PIOc_inq_var_deflate(int ncid, int varid, int *shufflep, int *deflatep,
                              int *deflate_levelp);
     int PIOc_def_var_chunking(int ncid, int varid, int storage, const PIO_Offset *chunksizesp);
+    int PIOc_def_var_chunking_decomp(int ncid, int varid, int ioid);
     int PIOc_inq_var_chunking(int ncid, int varid, int *storagep, PIO_Offset *chunksizesp);
     int PIOc_def_var_endian(int ncid, int varid, int endian);
     int PIOc_inq_var_endian(int ncid, int varid, int *endianp);
@@ -1268,6 +2614,9 @@ extern "C" {
     /* Release resources associated with a decomposition. */
     int nc_free_decomp(int ioid);
 
+    /* Make nc_put_vara()/nc_get_vara() on a var use a decomposition. */
+    int nc_def_var_decomp(int ncid, int varid, int ioid);
+
     /* Data reads - read a distributed array. */
     int nc_get_vard(int ncid, int varid, int decompid, const size_t recnum, void *buf);
     int nc_get_vard_text(int ncid, int varid, int decompid, const size_t recnum,
@@ -0,0 +1,431 @@
+/**
+ * @file
+ * Header-only C++ interface to the PIO darray functions.
+ *
+ * This wraps the IO system, file and decomposition of the C
+ * interface in classes that free them when they go out of scope,
+ * and gives typed versions of PIOc_write_darray() and
+ * PIOc_read_darray(). The PIO type is found from the C++ type at
+ * compile time, so the type of the data is checked against the
+ * decomposition, and contiguous data are handed to the C library
+ * without being copied into a staging buffer.
+ *
+ * Data may be given as a pointer and length, a std::vector, a
+ * std::span (C++20) or a std::mdspan (C++23). The local array of an
+ * mdspan is its elements in row-major order, as for a C array; views
+ * with layout_right (or exhaustive views of rank 1) are passed
+ * without a copy, other views are gathered into a temporary array.
+ *
+ * Errors are thrown as pio::error, which holds the PIO error code.
+ *
+ * The destructors of pio::iosystem, pio::decomp and pio::file call
+ * PIOc_free_iosystem(), PIOc_freedecomp() and PIOc_closefile(), which
+ * are collective. So an exception thrown on some tasks only, such as
+ * one from a check of the caller's own, unwinds the objects on those
+ * tasks alone, and their destructors wait forever for the other
+ * tasks. Errors of PIO, with the default error handling, are returned
+ * on all tasks, so they are thrown on all tasks together. Handle
+ * other errors so that all tasks leave the scope of the objects
+ * together, or call MPI_Abort().
+ *
+ * @author Ed Hartnett
+ * @date 2026
+ *
+ * @see https://github.com/NCAR/ParallelIO
+ */
+#ifndef _PIO_HPP_
+#define _PIO_HPP_
+
+#include <pio.h>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#endif
+#if __has_include(<mdspan>)
+#include <mdspan>
+#endif
+#endif
+
+namespace pio
+{
+    /** An error returned by the PIO C library. */
+    class error : public std::runtime_error
+    {
+    public:
+        /** Make an error from a PIO error code. */
+        explicit error(int code) : std::runtime_error(message(code)), code_(code) {}
+
+        /** The PIO error code. */
+        int code() const { return code_; }
+
+    private:
+        static std::string message(int code)
+        {
+            char msg[PIO_MAX_NAME + 1];
+
+            PIOc_strerror(code, msg);
+            return msg;
+        }
+
+        int code_;
+    };
+
+    /** Throw a pio::error if ret is not PIO_NOERR. */
+    inline void check(int ret)
+    {
+        if (ret != PIO_NOERR)
+            throw error(ret);
+    }
+
+    /**
+     * The PIO type of a C++ type, in value. Integers are mapped by
+     * size and sign, so int64_t, long and long long all work. There
+     * is no value for types PIO can't store, so using them does not
+     * compile.
+     */
+    template <typename T, typename Enable = void>
+    struct pio_type;
+
+    /** @cond */
+    template <> struct pio_type<char> { static const int value = PIO_CHAR; };
+    template <> struct pio_type<float> { static const int value = PIO_FLOAT; };
+    template <> struct pio_type<double> { static const int value = PIO_DOUBLE; };
+
+    template <typename T>
+    struct pio_type<T, typename std::enable_if<std::is_integral<T>::value &&
+                                               !std::is_same<T, char>::value &&
+                                               !std::is_same<T, bool>::value &&
+                                               sizeof(T) <= 8>::type>
+    {
+        static const int value = sizeof(T) == 1 ? (std::is_signed<T>::value ? PIO_BYTE : PIO_UBYTE) :
+            sizeof(T) == 2 ? (std::is_signed<T>::value ? PIO_SHORT : PIO_USHORT) :
+            sizeof(T) == 4 ? (std::is_signed<T>::value ? PIO_INT : PIO_UINT) :
+            (std::is_signed<T>::value ? PIO_INT64 : PIO_UINT64);
+    };
+    /** @endcond */
+
+    /**
+     * An IO system. It is freed with PIOc_free_iosystem() when the
+     * object is destroyed, so it must be destroyed on all tasks of the
+     * IO system, like the other objects here, also while an exception
+     * is unwinding the stack.
+     */
+    class iosystem
+    {
+    public:
+        /** Create an IO system with PIOc_Init_Intracomm(). */
+        iosystem(MPI_Comm comp_comm, int num_iotasks, int stride, int base,
+                 int rearr = PIO_REARR_BOX)
+        {
+            check(PIOc_Init_Intracomm(comp_comm, num_iotasks, stride, base, rearr, &id_));
+        }
+
+        /** Take ownership of an IO system created with the C interface. */
+        explicit iosystem(int iosysid) : id_(iosysid) {}
+
+        iosystem(const iosystem &) = delete;
+        iosystem &operator=(const iosystem &) = delete;
+        iosystem(iosystem &&o) noexcept : id_(o.id_) { o.id_ = -1; }
+        iosystem &operator=(iosystem &&o) noexcept
+        {
+            std::swap(id_, o.id_);
+            return *this;
+        }
+
+        ~iosystem()
+        {
+            if (id_ >= 0)
+                PIOc_free_iosystem(id_);
+        }
+
+        /** The iosysid, for the C interface. */
+        int id() const { return id_; }
+
+    private:
+        int id_ = -1;
+    };
+
+    /**
+     * A decomposition of data of type T, made with
+     * PIOc_init_decomp(). The map is 0-based, and its length is the
+     * length of the local array. It is freed with the collective
+     * PIOc_freedecomp() when the object is destroyed.
+     */
+    template <typename T>
+    class decomp
+    {
+    public:
+        /** Create a decomposition over the global dimensions gdimlen. */
+        decomp(const iosystem &ios, const std::vector<int> &gdimlen,
+               const std::vector<PIO_Offset> &compmap, int rearranger = 0)
+            : iosysid_(ios.id()), maplen_(compmap.size())
+        {
+            check(PIOc_init_decomp(iosysid_, pio_type<T>::value, (int)gdimlen.size(),
+                                   gdimlen.data(), (int)compmap.size(), compmap.data(), &id_,
+                                   rearranger, NULL, NULL));
+        }
+
+        decomp(const decomp &) = delete;
+        decomp &operator=(const decomp &) = delete;
+        decomp(decomp &&o) noexcept : iosysid_(o.iosysid_), id_(o.id_), maplen_(o.maplen_)
+        {
+            o.id_ = -1;
+        }
+        decomp &operator=(decomp &&o) noexcept
+        {
+            std::swap(iosysid_, o.iosysid_);
+            std::swap(id_, o.id_);
+            std::swap(maplen_, o.maplen_);
+            return *this;
+        }
+
+        ~decomp()
+        {
+            if (id_ >= 0)
+                PIOc_freedecomp(iosysid_, id_);
+        }
+
+        /** The ioid, for the C interface. */
+        int id() const { return id_; }
+
+        /** The length of the local array. */
+        std::size_t size() const { return maplen_; }
+
+    private:
+        int iosysid_;
+        int id_ = -1;
+        std::size_t maplen_;
+    };
+
+    /**
+     * A file, created or opened with PIOc_createfile() or
+     * PIOc_openfile(), and closed with PIOc_closefile() when the
+     * object is destroyed, or by close(). Both are collective, and
+     * errors of the close in the destructor are lost, so call close()
+     * to see them.
+     */
+    class file
+    {
+    public:
+        /** Create a file. */
+        static file create(const iosystem &ios, int iotype, const std::string &name,
+                           int mode = PIO_CLOBBER)
+        {
+            int ncid;
+
+            check(PIOc_createfile(ios.id(), &ncid, &iotype, name.c_str(), mode));
+            return file(ncid);
+        }
+
+        /** Open a file. */
+        static file open(const iosystem &ios, int iotype, const std::string &name,
+                         int mode = PIO_NOWRITE)
+        {
+            int ncid;
+
+            check(PIOc_openfile(ios.id(), &ncid, &iotype, name.c_str(), mode));
+            return file(ncid);
+        }
+
+        file(const file &) = delete;
+        file &operator=(const file &) = delete;
+        file(file &&o) noexcept : ncid_(o.ncid_) { o.ncid_ = -1; }
+        file &operator=(file &&o) noexcept
+        {
+            std::swap(ncid_, o.ncid_);
+            return *this;
+        }
+
+        ~file()
+        {
+            if (ncid_ >= 0)
+                PIOc_closefile(ncid_);
+        }
+
+        /** Close the file, reporting errors. */
+        void close()
+        {
+            int ncid = ncid_;
+
+            ncid_ = -1;
+            check(PIOc_closefile(ncid));
+        }
+
+        /** The ncid, for the C interface. */
+        int ncid() const { return ncid_; }
+
+        /** Define a dimension, and return its ID. */
+        int def_dim(const std::string &name, PIO_Offset len)
+        {
+            int dimid;
+
+            check(PIOc_def_dim(ncid_, name.c_str(), len, &dimid));
+            return dimid;
+        }
+
+        /** Define a variable of the PIO type of T, and return its ID. */
+        template <typename T>
+        int def_var(const std::string &name, const std::vector<int> &dimids)
+        {
+            int varid;
+
+            check(PIOc_def_var(ncid_, name.c_str(), pio_type<T>::value, (int)dimids.size(),
+                               dimids.data(), &varid));
+            return varid;
+        }
+
+        /** Leave define mode. */
+        void enddef() { check(PIOc_enddef(ncid_)); }
+
+        /** Set the record that the next darray of a var goes to. */
+        void setframe(int varid, int frame) { check(PIOc_setframe(ncid_, varid, frame)); }
+
+        /** Flush the buffered data to the file. */
+        void sync() { check(PIOc_sync(ncid_)); }
+
+        /**
+         * Write a distributed array with PIOc_write_darray(). If T is
+         * not the type of the decomposition, the data are converted
+         * while they are buffered, with PIOc_write_darray_tc(). The
+         * data are not changed, or kept after the call.
+         */
+        template <typename F, typename T>
+        void write_darray(int varid, const decomp<F> &d, const T *data, std::size_t len,
+                          const F *fillvalue = NULL)
+        {
+            void *array = const_cast<T *>(data);
+            void *fill = const_cast<F *>(fillvalue);
+
+            typedef typename std::remove_cv<T>::type M;
+
+            if (std::is_same<M, F>::value)
+                check(PIOc_write_darray(ncid_, varid, d.id(), len, array, fill));
+            else
+                check(PIOc_write_darray_tc(ncid_, varid, d.id(), len, pio_type<M>::value,
+                                           array, fill));
+        }
+
+        /** Write a distributed array held in a vector. */
+        template <typename F, typename T>
+        void write_darray(int varid, const decomp<F> &d, const std::vector<T> &data,
+                          const F *fillvalue = NULL)
+        {
+            write_darray(varid, d, data.data(), data.size(), fillvalue);
+        }
+
+        /** Read a distributed array with PIOc_read_darray(). */
+        template <typename T>
+        void read_darray(int varid, const decomp<T> &d, T *data, std::size_t len)
+        {
+            check(PIOc_read_darray(ncid_, varid, d.id(), len, data));
+        }
+
+        /** Read a distributed array into a vector, which must have the
+         * size of the local array. */
+        template <typename T>
+        void read_darray(int varid, const decomp<T> &d, std::vector<T> &data)
+        {
+            read_darray(varid, d, data.data(), data.size());
+        }
+
+#ifdef __cpp_lib_span
+        /** Write a distributed array held in a span. */
+        template <typename F, typename T, std::size_t E>
+        void write_darray(int varid, const decomp<F> &d, std::span<T, E> data,
+                          const F *fillvalue = NULL)
+        {
+            write_darray(varid, d, data.data(), data.size(), fillvalue);
+        }
+
+        /** Read a distributed array into a span. */
+        template <typename T, std::size_t E>
+        void read_darray(int varid, const decomp<T> &d, std::span<T, E> data)
+        {
+            read_darray(varid, d, data.data(), data.size());
+        }
+#endif /* __cpp_lib_span */
+
+#ifdef __cpp_lib_mdspan
+        /** Write a distributed array held in an mdspan. */
+        template <typename F, typename T, typename X, typename L>
+        void write_darray(int varid, const decomp<F> &d,
+                          std::mdspan<T, X, L, std::default_accessor<T>> data,
+                          const F *fillvalue = NULL)
+        {
+            if (row_major(data))
+                write_darray(varid, d, data.data_handle(), data.size(), fillvalue);
+            else
+                write_darray(varid, d, gather(data), fillvalue);
+        }
+
+        /** Read a distributed array into an mdspan. */
+        template <typename T, typename X, typename L>
+        void read_darray(int varid, const decomp<T> &d,
+                         std::mdspan<T, X, L, std::default_accessor<T>> data)
+        {
+            if (row_major(data))
+                read_darray(varid, d, data.data_handle(), data.size());
+            else
+            {
+                std::vector<T> tmp(data.size());
+
+                read_darray(varid, d, tmp);
+                for_each_index(data, [&](std::size_t k, const auto &idx) { data[idx] = tmp[k]; });
+            }
+        }
+#endif /* __cpp_lib_mdspan */
+
+    private:
+        explicit file(int ncid) : ncid_(ncid) {}
+
+#ifdef __cpp_lib_mdspan
+        /* True if the elements of m are contiguous in row-major order. */
+        template <typename M>
+        static bool row_major(const M &m)
+        {
+            return m.is_exhaustive() && m.is_unique() &&
+                (M::rank() <= 1 || std::is_same<typename M::layout_type, std::layout_right>::value);
+        }
+
+        /* Call f(k, idx) for the k-th element of m in row-major order,
+         * with its multi-index idx. */
+        template <typename M, typename Fn>
+        static void for_each_index(const M &m, Fn f)
+        {
+            std::array<typename M::index_type, M::rank()> idx{};
+
+            for (std::size_t k = 0; k < m.size(); k++)
+            {
+                f(k, idx);
+                for (std::size_t r = M::rank(); r-- > 0; )
+                {
+                    if (++idx[r] < m.extent(r))
+                        break;
+                    idx[r] = 0;
+                }
+            }
+        }
+
+        /* Copy the elements of a non-contiguous view, in row-major order. */
+        template <typename M>
+        static std::vector<typename M::value_type> gather(const M &m)
+        {
+            std::vector<typename M::value_type> tmp(m.size());
+
+            for_each_index(m, [&](std::size_t k, const auto &idx) { tmp[k] = m[idx]; });
+            return tmp;
+        }
+#endif /* __cpp_lib_mdspan */
+
+        int ncid_ = -1;
+    };
+}
+
+#endif /* _PIO_HPP_ */
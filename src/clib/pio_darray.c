@@ -8,10 +8,13 @@
  *
  * @author Jim Edwards
  */
+#define PIO_LOG_SUBSYS PIO_LOG_DARRAY
 #include <config.h>
 #include <pio.h>
 #include <pio_internal.h>
 #include <uthash.h>
+#include <unistd.h>
+#include <float.h>
 
 /**
  * @defgroup PIO_read_darray_c Reading Distributes Arrays
@@ -24,11 +27,9 @@
 /** 10MB default limit. */
 PIO_Offset pio_pnetcdf_buffer_size_limit = PIO_BUFFER_SIZE;
 
-/** Global buffer pool pointer. */
-void *CN_bpool = NULL;
-
-/** Maximum buffer usage. */
-PIO_Offset maxusage = 0;
+/** 32MB default limit of the write multi buffers of a computation
+ * task. */
+PIO_Offset pio_cnbuffer_limit = 33554432;
 
 /** For write_darray_multi_serial() and write_darray_multi_par() to
  * indicate that fill is being written. */
@@ -66,256 +67,710 @@ PIOc_set_buffer_size_limit(PIO_Offset limit)
 }
 
 /**
- * Write one or more arrays with the same IO decomposition to the
- * file.
+ * Set the limit of the memory of the write multi buffers of each
+ * computation task, in which PIOc_write_darray() collects the arrays
+ * of the variables before they are sent to the IO tasks.
  *
- * This funciton is similar to PIOc_write_darray(), but allows the
- * caller to use their own data buffering (instead of using the
- * buffering implemented in PIOc_write_darray()).
+ * The number of arrays of a decomposition buffered before a flush is
+ * sized from this limit, and with the default PIO_FLUSH_ADAPTIVE
+ * flush mode the buffers of all files and decompositions of the task
+ * together are kept within it: when an array would go over, the empty
+ * buffers of the file being written give back their memory, and if
+ * that is not enough, the buffer of the array is flushed. The buffers
+ * of other files are not flushed, so they can leave less room. A
+ * single array is always taken. With PIO_FLUSH_DETERMINISTIC only the
+ * limit of each decomposition is used, since its flushes must not
+ * depend on the memory of a task.
  *
- * When the user calls PIOc_write_darray() one or more times, then
- * PIO_write_darray_multi() will be called when the buffer is flushed.
+ * The limit of the task applies at once, the number of arrays of a
+ * decomposition only to decompositions created after it is changed.
  *
- * Internally, this function will:
- * <ul>
- * <li>Find info about file, decomposition, and variable.
- * <li>Do a special flush for pnetcdf if needed.
- * <li>Allocates a buffer big enough to hold all the data in the
- * multi-buffer, for all tasks.
- * <li>Calls rearrange_comp2io() to move data from compute to IO
- * tasks.
- * <li>For parallel iotypes (pnetcdf and netCDF-4 parallel) call
- * pio_write_darray_multi_nc().
- * <li>For serial iotypes (netcdf classic and netCDF-4 serial) call
- * write_darray_multi_serial().
- * <li>For subset rearranger, create holegrid to write missing
- * data. Then call pio_write_darray_multi_nc() or
- * write_darray_multi_serial() to write the holegrid.
- * <li>Special buffer flush for pnetcdf.
- * </ul>
+ * @param limit the most bytes, or 0 or less to keep the limit.
+ * @return The previous limit setting.
+ * @author Ed Hartnett
+ */
+PIO_Offset
+PIOc_set_compute_buffer_limit(PIO_Offset limit)
+{
+    PIO_Offset oldsize = pio_cnbuffer_limit;
+
+    /* If the user passed a valid size, use it. */
+    if (limit > 0)
+        pio_cnbuffer_limit = limit;
+
+    return oldsize;
+}
+
+/**
+ * Find the memory of this node which is free, or can be reclaimed
+ * from the page cache.
  *
- * @param ncid identifies the netCDF file.
- * @param varids an array of length nvars containing the variable ids to
- * be written.
- * @param ioid the I/O description ID as passed back by
- * PIOc_InitDecomp().
- * @param nvars the number of variables to be written with this
- * call.
- * @param arraylen the length of the array to be written. This is the
- * length of the distrubited array. That is, the length of the portion
- * of the data that is on the processor. The same arraylen is used for
- * all variables in the call.
- * @param array pointer to the data to be written. This is a pointer
- * to an array of arrays with the distributed portion of the array
- * that is on this processor. There are nvars arrays of data, and each
- * array of data contains one record worth of data for that variable.
- * @param frame an array of length nvars with the frame or record
- * dimension for each of the nvars variables in IOBUF. NULL if this
- * iodesc contains non-record vars.
- * @param fillvalue pointer an array (of length nvars) of pointers to
- * the fill value to be used for missing data.
- * @param flushtodisk non-zero to cause buffers to be flushed to disk.
- * @return 0 for success, error code otherwise.
+ * @returns the number of bytes, or 0 if it is unknown.
+ * @author Ed Hartnett
+ */
+static PIO_Offset
+avail_node_memory(void)
+{
+    PIO_Offset avail = 0;
+    FILE *f;
+
+    /* On Linux, MemAvailable includes the reclaimable caches. */
+    if ((f = fopen("/proc/meminfo", "r")))
+    {
+        char line[256];
+        long long kb;
+
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1)
+            {
+                avail = (PIO_Offset)kb * 1024;
+                break;
+            }
+        fclose(f);
+    }
+
+#if defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+    /* Otherwise use the free pages. */
+    if (!avail)
+    {
+        long pages = sysconf(_SC_AVPHYS_PAGES);
+        long page_size = sysconf(_SC_PAGESIZE);
+
+        if (pages > 0 && page_size > 0)
+            avail = (PIO_Offset)pages * page_size;
+    }
+#endif
+
+    return avail;
+}
+
+/**
+ * Size the pnetcdf buffers of the files opened after this call from
+ * the memory of the nodes, instead of the fixed limit of
+ * PIOc_set_buffer_size_limit().
+ *
+ * When a pnetcdf file is created or opened for writing, each IO task
+ * takes fraction of the free memory of its node, divided by the
+ * number of IO tasks on the node. The smallest of these over the IO
+ * tasks (but at least PIO_AUTO_BUFFER_MIN bytes) is the size of the
+ * buffer attached to the file, and the usage at which its pending
+ * writes are flushed. So a file on large nodes gets fewer, larger
+ * writes, and a file on small nodes doesn't run them out of memory.
+ *
+ * This function must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param fraction the fraction, between 0 and 1, of the free node
+ * memory to use for the buffers of one file. 0 (the default) goes
+ * back to the fixed limit.
+ * @returns 0 for success, error code otherwise.
  * @ingroup PIO_write_darray_c
- * @author Jim Edwards, Ed Hartnett
+ * @author Ed Hartnett
  */
 int
-PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
-                        PIO_Offset arraylen, void *array, const int *frame,
-                        void **fillvalue, bool flushtodisk)
+PIOc_set_buffer_size_auto(int iosysid, double fraction)
 {
-    iosystem_desc_t *ios;  /* Pointer to io system information. */
-    file_desc_t *file;     /* Pointer to file information. */
-    io_desc_t *iodesc;     /* Pointer to IO description information. */
-    int rlen;              /* Total data buffer size. */
-    var_desc_t *vdesc0;    /* First entry in array of var_desc structure for each var. */
-    int fndims, fndims2;            /* Number of dims in the var in the file. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
-    int ierr;              /* Return code. */
-    void *tmparray;
+    iosystem_desc_t *ios;
 
-/* #ifdef USE_MPE */
-/*     pio_start_mpe_log(DARRAY_WRITE); */
-/* #endif /\* USE_MPE *\/ */
+    PLOG((1, "PIOc_set_buffer_size_auto iosysid = %d fraction = %g", iosysid, fraction));
 
-    /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
-    ios = file->iosystem;
 
     /* Check inputs. */
-    if (nvars <= 0 || !varids)
-        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    if (!(fraction >= 0 && fraction < 1))
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    PLOG((1, "PIOc_write_darray_multi ncid = %d ioid = %d nvars = %d arraylen = %ld "
-          "flushtodisk = %d",
-          ncid, ioid, nvars, arraylen, flushtodisk));
+    /* Count the IO tasks on this node, once. */
+    if (fraction > 0 && ios->ioproc)
+    {
+        int ret;
 
-    /* Check that we can write to this file. */
-    if (!file->writable)
-        return pio_err(ios, file, PIO_EPERM, __FILE__, __LINE__);
+        if ((ret = pio_count_node_iotasks(ios)))
+            return ret;
+    }
 
-    /* Get iodesc. */
-    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
-        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
-    pioassert(iodesc->rearranger == PIO_REARR_BOX || iodesc->rearranger == PIO_REARR_SUBSET,
-              "unknown rearranger", __FILE__, __LINE__);
+    ios->buffer_frac = fraction;
 
-    pioassert(iodesc->readonly == 0,"Multiple sources in map for a single destination",__FILE__,__LINE__);
+    return PIO_NOERR;
+}
 
+/**
+ * Count the IO tasks on the node of this task into
+ * ios->node_iotasks. The count is made once, the first time this is
+ * called. It is collective over the IO tasks and only called on
+ * them.
+ *
+ * @param ios pointer to the IO system info.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_count_node_iotasks(iosystem_desc_t *ios)
+{
+    MPI_Comm node_comm;
+    int mpierr;
 
-    /* Check the types of all the vars. They must match the type of
-     * the decomposition. */
-    for (int v = 0; v < nvars; v++)
-    {
-        var_desc_t *vdesc;
-        if ((ierr = get_var_desc(varids[v], &file->varlist, &vdesc)))
-            return pio_err(ios, file, ierr, __FILE__, __LINE__);
-        /* if (vdesc->pio_type != iodesc->piotype)
-           return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);*/
-    }
+    if (ios->node_iotasks)
+        return PIO_NOERR;
 
-    /* Get a pointer to the variable info for the first variable. */
-    if ((ierr = get_var_desc(varids[0], &file->varlist, &vdesc0)))
-        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_split_type(ios->io_comm, MPI_COMM_TYPE_SHARED, ios->io_rank,
+                                      MPI_INFO_NULL, &node_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    mpierr = MPI_Comm_size(node_comm, &ios->node_iotasks);
+    MPI_Comm_free(&node_comm);
+    if (mpierr)
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "node_iotasks = %d", ios->node_iotasks));
 
-    /* Run these on all tasks if async is not in use, but only on
-     * non-IO tasks if async is in use. */
-    if (!ios->async || !ios->ioproc)
+    return PIO_NOERR;
+}
+
+/**
+ * Find the size of the pnetcdf buffer of a file being created or
+ * opened for writing. This is the fixed limit, unless
+ * PIOc_set_buffer_size_auto() was called. Then it is found from the
+ * free memory of the nodes, and this is collective over the IO
+ * tasks.
+ *
+ * This is only called on IO tasks.
+ *
+ * @param ios pointer to the IO system info.
+ * @param limitp pointer that gets the size in bytes.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+get_file_buffer_limit(iosystem_desc_t *ios, PIO_Offset *limitp)
+{
+    PIO_Offset limit = pio_pnetcdf_buffer_size_limit;
+
+    pioassert(ios && ios->ioproc && limitp, "invalid input", __FILE__, __LINE__);
+
+    if (ios->buffer_frac > 0)
     {
-        /* Get the number of dims for this var. */
-        PLOG((3, "about to call PIOc_inq_varndims varids[0] = %d", varids[0]));
-        if ((ierr = PIOc_inq_varndims(file->pio_ncid, varids[0], &fndims)))
-            return check_netcdf(file, ierr, __FILE__, __LINE__);
-        PLOG((3, "called PIOc_inq_varndims varids[0] = %d fndims = %d", varids[0], fndims));
-        for (int v=1; v < nvars; v++){
-            if ((ierr = PIOc_inq_varndims(file->pio_ncid, varids[v], &fndims2)))
-                return check_netcdf(file, ierr, __FILE__, __LINE__);
-            if(fndims != fndims2)
-                return pio_err(ios, file, PIO_EVARDIMMISMATCH, __FILE__, __LINE__);
-        }
+        PIO_Offset avail = avail_node_memory();
+        int mpierr;
+
+        /* If the memory can't be found, use the fixed limit. */
+        if (avail > 0)
+            limit = max((PIO_Offset)(avail * ios->buffer_frac / max(ios->node_iotasks, 1)),
+                        (PIO_Offset)PIO_AUTO_BUFFER_MIN);
 
+        /* All IO tasks use the same size. */
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &limit, 1, MPI_OFFSET, MPI_MIN,
+                                    ios->io_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        PLOG((2, "get_file_buffer_limit avail = %lld limit = %lld", avail, limit));
     }
 
-    /* If async is in use, and this is not an IO task, bcast the
-     * parameters. */
-    if (ios->async)
-    {
-        if (!ios->ioproc)
-        {
-            int msg = PIO_MSG_WRITEDARRAYMULTI;
-            char frame_present = frame ? true : false;         /* Is frame non-NULL? */
-            char fillvalue_present = fillvalue ? true : false; /* Is fillvalue non-NULL? */
-            int flushtodisk_int = flushtodisk; /* Need this to be int not boolean. */
+    *limitp = limit;
 
-            if (ios->compmaster == MPI_ROOT)
-                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+    return PIO_NOERR;
+}
 
-            /* Send the function parameters and associated informaiton
-             * to the msg handler. */
-            if (!mpierr)
-                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&nvars, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast((void *)varids, nvars, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&arraylen, 1, MPI_OFFSET, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(array, arraylen * iodesc->piotype_size, MPI_CHAR, ios->compmaster,
-                                   ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&frame_present, 1, MPI_CHAR, ios->compmaster, ios->intercomm);
-            if (!mpierr && frame_present)
-                mpierr = MPI_Bcast((void *)frame, nvars, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&fillvalue_present, 1, MPI_CHAR, ios->compmaster, ios->intercomm);
-            if (!mpierr && fillvalue_present)
-                mpierr = MPI_Bcast((void *)fillvalue, nvars * iodesc->piotype_size, MPI_CHAR,
-                                   ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&flushtodisk_int, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            PLOG((2, "PIOc_write_darray_multi file->pio_ncid = %d nvars = %d ioid = %d arraylen = %d "
-                  "frame_present = %d fillvalue_present = %d flushtodisk = %d", file->pio_ncid, nvars,
-                  ioid, arraylen, frame_present, fillvalue_present, flushtodisk));
-        }
+/**
+ * Set the method used by PIOc_write_darray() to decide when to flush
+ * the write multi buffer.
+ *
+ * With PIO_FLUSH_VOTE (the default) all computation tasks agree on
+ * each call to PIOc_write_darray(), with an MPI_Allreduce(). With
+ * PIO_FLUSH_DETERMINISTIC the buffer is flushed when it holds as many
+ * arrays as the aggregate buffer limit of the decomposition allows
+ * (iodesc->maxbytes). That value is the same on all tasks, so no
+ * communication is needed until the flush itself. The memory for
+ * that many arrays is reserved when the buffer is first used; if it
+ * can't be found, PIOc_write_darray() returns PIO_ENOMEM.
+ *
+ * The mode also applies to the pnetcdf writes of the IO tasks. With
+ * PIO_FLUSH_DETERMINISTIC they bound the usage of the attached
+ * buffer from the largest write of each decomposition
+ * (iodesc->maxiobuflen), instead of finding it with an
+ * MPI_Allreduce() after each write.
+ *
+ * This function must be called on all computation tasks of the IO
+ * system, with the same mode.
+ *
+ * @param iosysid the IO system ID.
+ * @param mode PIO_FLUSH_VOTE or PIO_FLUSH_DETERMINISTIC.
+ * @param old_mode pointer to int that will get the previous
+ * mode. Ignored if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_set_darray_flush_mode(int iosysid, int mode, int *old_mode)
+{
+    iosystem_desc_t *ios;
 
-        /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    PLOG((1, "PIOc_set_darray_flush_mode iosysid = %d mode = %d", iosysid, mode));
 
-        /* Share results known only on computation tasks with IO tasks. */
-        if ((mpierr = MPI_Bcast(&fndims, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-        PLOG((3, "shared fndims = %d", fndims));
-    }
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* if the buffer is already in use in pnetcdf we need to flush first */
-    if (file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
-        if ((ierr = flush_output_buffer(file, 1, 0)))
-            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    /* Check inputs. */
+    if (mode != PIO_FLUSH_VOTE && mode != PIO_FLUSH_DETERMINISTIC)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    pioassert(!file->iobuf, "buffer overwrite",__FILE__, __LINE__);
+    if (old_mode)
+        *old_mode = ios->flush_mode;
+    ios->flush_mode = mode;
 
-    /* Determine total size of aggregated data (all vars/records).
-     * For netcdf serial writes we collect the data on io nodes and
-     * then move that data one node at a time to the io master node
-     * and write (or read). The buffer size on io task 0 must be as
-     * large as the largest used to accommodate this serial io
-     * method.  */
-    rlen = 0;
-    if (iodesc->llen > 0 ||
-        ((file->iotype == PIO_IOTYPE_NETCDF ||
-          file->iotype == PIO_IOTYPE_NETCDF4C) && ios->iomaster))
-        rlen = iodesc->maxiobuflen * nvars;
+    return PIO_NOERR;
+}
 
-    /* Allocate iobuf. */
-    if (rlen > 0)
-    {
-        /* Allocate memory for the buffer for all vars/records. */
-        if (!(file->iobuf = malloc(iodesc->mpitype_size * (size_t)rlen)))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-        PLOG((3, "allocated %lld bytes for variable buffer", (size_t)rlen * iodesc->mpitype_size));
+/**
+ * Set whether darray writes to pnetcdf files use the buffer attached
+ * to the file (of size pio_pnetcdf_buffer_size_limit, see
+ * PIOc_set_buffer_size_limit()).
+ *
+ * By default the data are queued with ncmpi_iput_varn(), which reads
+ * them from the IO buffer of PIO when the requests are waited
+ * for. Until then the IO buffer can't be reused, so each write of a
+ * distributed array flushes the writes before it. With this mode on,
+ * the data are queued with ncmpi_bput_varn(), which copies them into
+ * the attached buffer. The IO buffer is freed at once, and the
+ * writes of many arrays, with any decompositions, are done by one
+ * ncmpi_wait_all() when the attached buffer fills, or the file is
+ * synced or closed. A write too large for the attached buffer is
+ * queued with ncmpi_iput_varn() as before.
+ *
+ * This function must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to copy writes into the attached buffer, false
+ * (the default) to queue them with ncmpi_iput_varn().
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_pnetcdf_bput(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-        /* If fill values are desired, and we're using the BOX
-         * rearranger, insert fill values. */
-        if (iodesc->needsfill && iodesc->rearranger == PIO_REARR_BOX && fillvalue)
-        {
-            PLOG((3, "inerting fill values iodesc->maxiobuflen = %d", iodesc->maxiobuflen));
-            for (int nv = 0; nv < nvars; nv++)
-                for (int i = 0; i < iodesc->maxiobuflen; i++)
-                    memcpy(&((char *)file->iobuf)[iodesc->mpitype_size * (i + nv * iodesc->maxiobuflen)],
-                           &((char *)fillvalue)[nv * iodesc->mpitype_size], iodesc->mpitype_size);
-        }
-    }
+    PLOG((1, "PIOc_set_pnetcdf_bput iosysid = %d enable = %d", iosysid, enable));
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    ios->pnetcdf_bput = enable;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Turn write behind on or off, for the computation tasks of an async
+ * iosystem.
+ *
+ * With it on, PIOc_write_darray_multi() (and so the flushes of
+ * PIOc_write_darray()) returns on the computation tasks as soon as
+ * the data have been moved to the IO tasks. The IO tasks then write
+ * them without the computation tasks waiting for the result; for
+ * pnetcdf the data are copied into the attached buffer, as with
+ * PIOc_set_pnetcdf_bput(), and written when it fills. The first error
+ * of these writes is returned by the next PIOc_sync() or
+ * PIOc_closefile() of the file.
+ *
+ * Only the pnetcdf iotype is buffered. For the serial iotypes
+ * (PIO_IOTYPE_NETCDF and PIO_IOTYPE_NETCDF4C) IO task 0 still
+ * collects and writes the data of the other IO tasks before the IO
+ * tasks go on, so write behind only moves the report of the errors
+ * to PIOc_sync(). PIO_IOTYPE_NETCDF4P writes are not buffered either.
+ *
+ * The setting has no effect if async is not in use. This function
+ * must be called on all computation tasks of the IO system. The IO
+ * tasks get the setting with each write.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to not wait for the writes of the IO tasks.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_write_behind(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_write_behind iosysid = %d enable = %d", iosysid, enable));
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    ios->write_behind = enable;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Fill a buffer with copies of one value. The common type sizes are
+ * filled with a typed loop, which the compiler can vectorize, other
+ * sizes by doubling memcpy() calls, instead of one memcpy() for each
+ * element.
+ *
+ * @param buf the buffer to fill.
+ * @param value pointer to the value.
+ * @param size the size of the value in bytes.
+ * @param n the number of copies of the value to put in buf.
+ * @author Ed Hartnett
+ */
+static void
+fill_buffer(void *buf, const void *value, int size, PIO_Offset n)
+{
+    if (n <= 0)
+        return;
+
+    switch (size)
+    {
+    case 1:
+        memset(buf, *(const unsigned char *)value, n);
+        break;
+    case 2:
+    {
+        uint16_t v, *b = buf;
+        memcpy(&v, value, sizeof(v));
+        for (PIO_Offset i = 0; i < n; i++)
+            b[i] = v;
+        break;
+    }
+    case 4:
+    {
+        uint32_t v, *b = buf;
+        memcpy(&v, value, sizeof(v));
+        for (PIO_Offset i = 0; i < n; i++)
+            b[i] = v;
+        break;
+    }
+    case 8:
+    {
+        uint64_t v, *b = buf;
+        memcpy(&v, value, sizeof(v));
+        for (PIO_Offset i = 0; i < n; i++)
+            b[i] = v;
+        break;
+    }
+    default:
+    {
+        /* Copy the filled part onto the rest, doubling it each time. */
+        size_t done = size, total = (size_t)size * n;
+
+        memcpy(buf, value, size);
+        while (done < total)
+        {
+            size_t len = done < total - done ? done : total - done;
+            memcpy((char *)buf + done, buf, len);
+            done += len;
+        }
+    }
+    }
+}
+
+/**
+ * Allocate the buffer that the IO tasks receive the data of nvars
+ * arrays into. If the decomposition needs them, fill values are
+ * inserted for the BOX rearranger. For pnetcdf a 1-byte token is
+ * allocated on IO tasks that have no data, so that
+ * flush_output_buffer() is called collectively.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param nvars the number of arrays.
+ * @param fillvalue pointer to nvars fill values. May be NULL.
+ * @param iobufp pointer that gets the buffer, or NULL if this task
+ * needs none.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+alloc_darray_iobuf(file_desc_t *file, io_desc_t *iodesc, int nvars, void *fillvalue,
+                   void **iobufp)
+{
+    iosystem_desc_t *ios = file->iosystem; /* Pointer to io system information. */
+    PIO_Offset rlen;       /* Total data buffer size. */
+
+    *iobufp = NULL;
+
+    /* Determine total size of aggregated data (all vars/records).
+     * For netcdf serial writes we collect the data on io nodes and
+     * then move that data one node at a time to the io master node
+     * and write (or read). The buffer size on io task 0 must be as
+     * large as the largest used to accommodate this serial io
+     * method.  */
+    rlen = 0;
+    if (iodesc->llen > 0 ||
+        ((file->iotype == PIO_IOTYPE_NETCDF ||
+          file->iotype == PIO_IOTYPE_NETCDF4C) && ios->iomaster))
+        rlen = (PIO_Offset)iodesc->maxiobuflen * nvars;
+
+    /* Allocate iobuf. */
+    if (rlen > 0)
+    {
+        /* Allocate memory for the buffer for all vars/records. */
+        if (!(*iobufp = pio_iobuf_alloc(ios, iodesc->mpitype_size * (size_t)rlen)))
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        PLOG((3, "allocated %lld bytes for variable buffer", (size_t)rlen * iodesc->mpitype_size));
+
+        /* If fill values are desired, and we're using the BOX
+         * rearranger, insert fill values. */
+        if (iodesc->needsfill && iodesc->rearranger == PIO_REARR_BOX && fillvalue)
+        {
+            PLOG((3, "inerting fill values iodesc->maxiobuflen = %d", iodesc->maxiobuflen));
+            for (int nv = 0; nv < nvars; nv++)
+                fill_buffer((char *)*iobufp + (size_t)iodesc->mpitype_size * nv * iodesc->maxiobuflen,
+                            (char *)fillvalue + nv * iodesc->mpitype_size, iodesc->mpitype_size,
+                            iodesc->maxiobuflen);
+        }
+    }
     else if (file->iotype == PIO_IOTYPE_PNETCDF && ios->ioproc)
     {
         /* this assures that iobuf is allocated on all iotasks thus
-           assuring that the flush_output_buffer call above is called
+           assuring that flush_output_buffer() is called
            collectively (from all iotasks) */
-        if (!(file->iobuf = malloc(1)))
+        if (!(*iobufp = pio_iobuf_alloc(ios, 1)))
             return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
         PLOG((3, "allocated token for variable buffer"));
     }
-    if (iodesc->needssort)
+
+    return PIO_NOERR;
+}
+
+/** The number of mantissa bits of a float. */
+#define FLT_MANT_BITS 23
+
+/** The number of mantissa bits of a double. */
+#define DBL_MANT_BITS 52
+
+/** The number of bits needed for one decimal digit, log2(10). */
+#define BITS_PER_DIGIT 3.32192809488736
+
+/**
+ * Find the number of mantissa bits kept by a quantization.
+ *
+ * @param quantize_mode the PIO_QUANTIZE mode.
+ * @param nsd the number of significant digits or bits.
+ * @param dbl true for doubles.
+ * @return the number of bits to keep.
+ * @author Ed Hartnett
+ */
+static int
+quantize_keep_bits(int quantize_mode, int nsd, bool dbl)
+{
+    /* Bitgroom keeps a guard bit, and doubles need one more. */
+    if (quantize_mode == PIO_QUANTIZE_BITGROOM)
+        return (int)ceil(nsd * BITS_PER_DIGIT) + (dbl ? 2 : 1);
+    return nsd;
+}
+
+/**
+ * Quantize an array of floats in place. Fill values, zeros, NaNs and
+ * infinities are not changed.
+ *
+ * @param data the data.
+ * @param len the number of values.
+ * @param quantize_mode the PIO_QUANTIZE mode.
+ * @param nsd the number of significant digits or bits.
+ * @param fill the fill value of the var.
+ * @param hole the fill value of the holes of the decomposition.
+ * @author Ed Hartnett
+ */
+static void
+quantize_float(float *data, PIO_Offset len, int quantize_mode, int nsd, float fill,
+               float hole)
+{
+    int keep = quantize_keep_bits(quantize_mode, nsd, false);
+    uint32_t zero_mask, one_mask, half;
+    union {float f; uint32_t u;} v;
+
+    if (keep >= FLT_MANT_BITS)
+        return;
+    zero_mask = UINT32_MAX << (FLT_MANT_BITS - keep);
+    one_mask = ~zero_mask;
+    half = one_mask & (zero_mask >> 1);
+
+    for (PIO_Offset i = 0; i < len; i++)
     {
-        if (!(tmparray = malloc(arraylen*nvars*iodesc->piotype_size)))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        pio_sorted_copy(array, tmparray, iodesc, nvars, 0);
+        if (data[i] == fill || data[i] == hole || data[i] == 0.0f || !isfinite(data[i]))
+            continue;
+        v.f = data[i];
+        if (quantize_mode == PIO_QUANTIZE_BITROUND)
+            v.u = (v.u + half) & zero_mask;
+        else if (i % 2)
+            v.u |= one_mask;
+        else
+            v.u &= zero_mask;
+        data[i] = v.f;
     }
-    else
+}
+
+/**
+ * Quantize an array of doubles in place. Fill values, zeros, NaNs
+ * and infinities are not changed.
+ *
+ * @param data the data.
+ * @param len the number of values.
+ * @param quantize_mode the PIO_QUANTIZE mode.
+ * @param nsd the number of significant digits or bits.
+ * @param fill the fill value of the var.
+ * @param hole the fill value of the holes of the decomposition.
+ * @author Ed Hartnett
+ */
+static void
+quantize_double(double *data, PIO_Offset len, int quantize_mode, int nsd, double fill,
+                double hole)
+{
+    int keep = quantize_keep_bits(quantize_mode, nsd, true);
+    uint64_t zero_mask, one_mask, half;
+    union {double d; uint64_t u;} v;
+
+    if (keep >= DBL_MANT_BITS)
+        return;
+    zero_mask = UINT64_MAX << (DBL_MANT_BITS - keep);
+    one_mask = ~zero_mask;
+    half = one_mask & (zero_mask >> 1);
+
+    for (PIO_Offset i = 0; i < len; i++)
     {
-        tmparray = array;
+        if (data[i] == fill || data[i] == hole || data[i] == 0.0 || !isfinite(data[i]))
+            continue;
+        v.d = data[i];
+        if (quantize_mode == PIO_QUANTIZE_BITROUND)
+            v.u = (v.u + half) & zero_mask;
+        else if (i % 2)
+            v.u |= one_mask;
+        else
+            v.u &= zero_mask;
+        data[i] = v.d;
     }
+}
 
-    /* Move data from compute to IO tasks. */
-    if ((ierr = rearrange_comp2io(ios, iodesc, tmparray, file->iobuf, nvars)))
+/**
+ * Quantize the data in file->iobuf of the vars that have a
+ * quantization set with PIOc_def_var_quantize(). This is done on the
+ * IO tasks, after the data have been rearranged, so the cost falls on
+ * the IO tasks and not on the computation.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param varids an array of length nvars containing the variable ids.
+ * @param nvars the number of variables in iobuf.
+ * @param fillvalue pointer to the nvars fill values put in the holes
+ * of iobuf by the BOX rearranger. May be NULL.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+quantize_iobuf(file_desc_t *file, io_desc_t *iodesc, const int *varids, int nvars,
+               const void *fillvalue)
+{
+    int ierr;
+
+    /* Only floating point data can be quantized. */
+    if (iodesc->piotype != PIO_FLOAT && iodesc->piotype != PIO_DOUBLE)
+        return PIO_NOERR;
+
+    for (int nv = 0; nv < nvars; nv++)
+    {
+        var_desc_t *vdesc;
+        void *buf = (char *)file->iobuf + nv * iodesc->llen * iodesc->mpitype_size;
+        bool have_fill;
+
+        if ((ierr = get_file_var_desc(file, varids[nv], &vdesc)))
+            return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+        if (!vdesc->quantize_mode)
+            continue;
+        PLOG((3, "quantize_iobuf varid %d quantize_mode %d nsd %d", varids[nv],
+              vdesc->quantize_mode, vdesc->nsd));
+
+        /* The fill value of the var is only of use if it has the
+         * type of the data. The holes may have been given another
+         * fill value by the caller; those values are left alone
+         * too. */
+        have_fill = vdesc->fillvalue && vdesc->pio_type == iodesc->piotype;
+        if (iodesc->piotype == PIO_FLOAT)
+        {
+            float fill = have_fill ? *(float *)vdesc->fillvalue : PIO_FILL_FLOAT;
+
+            quantize_float(buf, iodesc->llen, vdesc->quantize_mode, vdesc->nsd, fill,
+                           fillvalue ? ((const float *)fillvalue)[nv] : fill);
+        }
+        else
+        {
+            double fill = have_fill ? *(double *)vdesc->fillvalue : PIO_FILL_DOUBLE;
+
+            quantize_double(buf, iodesc->llen, vdesc->quantize_mode, vdesc->nsd, fill,
+                            fillvalue ? ((const double *)fillvalue)[nv] : fill);
+        }
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write data that have already been moved to file->iobuf on the IO
+ * tasks, then write the fill values of the holes for the SUBSET
+ * rearranger.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param varids an array of length nvars containing the variable ids to
+ * be written.
+ * @param nvars the number of variables to be written.
+ * @param fndims the number of dimensions of the variables in the file.
+ * @param frame an array of length nvars with the record number of
+ * each variable. NULL for non-record vars.
+ * @param fillvalue pointer to nvars fill values.
+ * @param flushtodisk non-zero to cause buffers to be flushed to disk.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+write_darray_iobuf(file_desc_t *file, io_desc_t *iodesc, const int *varids, int nvars,
+                   int fndims, const int *frame, void *fillvalue, bool flushtodisk)
+{
+    iosystem_desc_t *ios = file->iosystem; /* Pointer to io system information. */
+    var_desc_t *vdesc0;    /* First entry in array of var_desc structure for each var. */
+    int ierr;              /* Return code. */
+
+    /* Get a pointer to the variable info for the first variable. */
+    if ((ierr = get_file_var_desc(file, varids[0], &vdesc0)))
         return pio_err(ios, file, ierr, __FILE__, __LINE__);
 
+    /* Quantize the data, if asked for. */
+    if (ios->ioproc && file->iobuf)
+        if ((ierr = quantize_iobuf(file, iodesc, varids, nvars, fillvalue)))
+            return ierr;
+
+    /* With checkpoint files, the arrays go to the checkpoint file of
+     * each IO task, and the holes are not written. */
+    if (file->ckpt_nfiles)
+    {
+        ierr = pio_ckpt_write(file, iodesc, nvars, varids, fndims, frame);
+        if (file->iobuf)
+        {
+            pio_iobuf_free(ios, file->iobuf);
+            file->iobuf = NULL;
+        }
+        return ierr;
+    }
+
+    /* Make room in the attached buffer, if it is to be used. */
+    file->darray_bput = false;
+    if (ios->ioproc && ios->async && ios->write_behind &&
+        file->iotype != PIO_IOTYPE_PNETCDF)
+        PLOG((2, "write behind does not buffer iotype %d, writing now", file->iotype));
+    if (ios->ioproc && file->iotype == PIO_IOTYPE_PNETCDF &&
+        (ios->pnetcdf_bput || (ios->async && ios->write_behind)))
+        if ((ierr = reserve_bput_buffer(file, iodesc, nvars)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
     /* Write the darray based on the iotype. */
     PLOG((2, "about to write darray for iotype = %d", file->iotype));
     switch (file->iotype)
@@ -337,14 +792,16 @@ PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
         return pio_err(NULL, NULL, PIO_EBADIOTYPE, __FILE__, __LINE__);
     }
 
-    /* For PNETCDF the iobuf is freed in flush_output_buffer() */
-    if (file->iotype != PIO_IOTYPE_PNETCDF)
+    /* For PNETCDF the iobuf is freed in flush_output_buffer(),
+     * unless the data were copied into the attached buffer or the
+     * stage log. */
+    if (file->iotype != PIO_IOTYPE_PNETCDF || file->darray_bput || file->stage_fp)
     {
         /* Release resources. */
         if (file->iobuf)
         {
             PLOG((3,"freeing variable buffer in pio_darray"));
-            free(file->iobuf);
+            pio_iobuf_free(ios, file->iobuf);
             file->iobuf = NULL;
         }
     }
@@ -361,654 +818,3968 @@ PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
      * those values later. */
     if (iodesc->rearranger == PIO_REARR_SUBSET && iodesc->needsfill)
     {
+        size_t fsize = (size_t)iodesc->mpitype_size * nvars;
+        size_t bufsize = 0;
+        bool written = !frame;
+
         PLOG((2, "nvars = %d holegridsize = %ld iodesc->needsfill = %d\n", nvars,
               iodesc->holegridsize, iodesc->needsfill));
 
-        pioassert(!vdesc0->fillbuf, "buffer overwrite",__FILE__, __LINE__);
+        /* In fill mode, the netCDF library may have filled the holes
+         * already. Pnetcdf does not fill records. The holes of
+         * non-record vars otherwise only have to be written once for
+         * each decomposition. */
+        if (ios->library_fill && file->fill_mode == NC_FILL &&
+            (!frame || file->iotype != PIO_IOTYPE_PNETCDF))
+            written = true;
+        else
+            for (int nv = 0; written && nv < nvars; nv++)
+            {
+                var_desc_t *vdesc;
+
+                if ((ierr = get_file_var_desc(file, varids[nv], &vdesc)))
+                    return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                written = vdesc->holes_ioid == iodesc->ioid;
+            }
+        PLOG((3, "holes already written = %d", written));
 
-        /* Get a buffer. */
-        if (ios->io_rank == 0)
-            vdesc0->fillbuf = malloc(iodesc->maxholegridsize * iodesc->mpitype_size * nvars);
+        if (pio_serial_root(ios, file))
+            bufsize = iodesc->maxholegridsize * fsize;
         else if (iodesc->holegridsize > 0)
-            vdesc0->fillbuf = malloc(iodesc->holegridsize * iodesc->mpitype_size * nvars);
+            bufsize = iodesc->holegridsize * fsize;
 
-        /* copying the fill value into the data buffer for the box
-         * rearranger. This will be overwritten with data where
-         * provided. */
-        if(fillvalue)
-            for (int nv = 0; nv < nvars; nv++)
-                for (int i = 0; i < iodesc->holegridsize; i++)
-                    memcpy(&((char *)vdesc0->fillbuf)[iodesc->mpitype_size * (i + nv * iodesc->holegridsize)],
-                           &((char *)fillvalue)[iodesc->mpitype_size * nv], iodesc->mpitype_size);
+        /* The fill buffer of the last write is kept for the next one,
+         * if it is for the same decomposition and fill values. */
+        if (!written && vdesc0->fillbuf &&
+            !(fillvalue && vdesc0->fillbuf_ioid == iodesc->ioid &&
+              vdesc0->fillbuf_nvars == nvars && vdesc0->fillbuf_size == bufsize &&
+              !memcmp((char *)vdesc0->fillbuf + bufsize, fillvalue, fsize)))
+        {
+            /* A pending pnetcdf write may still use the buffer. */
+            pioassert(file->iotype != PIO_IOTYPE_PNETCDF || file->darray_bput,
+                      "buffer overwrite", __FILE__, __LINE__);
+            pio_free(PIO_MEM_FILLBUF, vdesc0->fillbuf);
+            vdesc0->fillbuf = NULL;
+        }
 
-        /* Write the darray based on the iotype. */
-        switch (file->iotype)
+        /* Get a buffer, with the fill values it has after it. */
+        if (!written && !vdesc0->fillbuf && bufsize)
         {
-        case PIO_IOTYPE_PNETCDF:
-        case PIO_IOTYPE_NETCDF4P:
-            if ((ierr = write_darray_multi_par(file, nvars, fndims, varids, iodesc,
-                                               DARRAY_FILL, frame)))
-                return pio_err(ios, file, ierr, __FILE__, __LINE__);
-            break;
-        case PIO_IOTYPE_NETCDF4C:
-        case PIO_IOTYPE_NETCDF:
-            if ((ierr = write_darray_multi_serial(file, nvars, fndims, varids, iodesc,
-                                                  DARRAY_FILL, frame)))
-                return pio_err(ios, file, ierr, __FILE__, __LINE__);
-            break;
-        default:
-            return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
+            if (!(vdesc0->fillbuf = pio_malloc(PIO_MEM_FILLBUF, bufsize + fsize)))
+                return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+            vdesc0->fillbuf_size = bufsize;
+            vdesc0->fillbuf_ioid = fillvalue ? iodesc->ioid : 0;
+            vdesc0->fillbuf_nvars = nvars;
+            if (!vdesc0->fillbuf_listed)
+            {
+                vdesc0->fillbuf_next = file->fillbuf_vars;
+                file->fillbuf_vars = vdesc0;
+                vdesc0->fillbuf_listed = true;
+            }
+
+            /* copying the fill value into the data buffer for the box
+             * rearranger. This will be overwritten with data where
+             * provided. */
+            if (fillvalue)
+            {
+                memcpy((char *)vdesc0->fillbuf + bufsize, fillvalue, fsize);
+                for (int nv = 0; nv < nvars; nv++)
+                    fill_buffer((char *)vdesc0->fillbuf + (size_t)iodesc->mpitype_size * nv * iodesc->holegridsize,
+                                (char *)fillvalue + iodesc->mpitype_size * nv, iodesc->mpitype_size,
+                                iodesc->holegridsize);
+            }
         }
 
-        /* For PNETCDF fillbuf is freed in flush_output_buffer() */
-        if (file->iotype != PIO_IOTYPE_PNETCDF)
+        /* Write the darray based on the iotype. */
+        if (!written)
         {
-            /* Free resources. */
-            if (vdesc0->fillbuf)
+            switch (file->iotype)
             {
-                free(vdesc0->fillbuf);
-                vdesc0->fillbuf = NULL;
+            case PIO_IOTYPE_PNETCDF:
+            case PIO_IOTYPE_NETCDF4P:
+                if ((ierr = write_darray_multi_par(file, nvars, fndims, varids, iodesc,
+                                                   DARRAY_FILL, frame)))
+                    return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                break;
+            case PIO_IOTYPE_NETCDF4C:
+            case PIO_IOTYPE_NETCDF:
+                if ((ierr = write_darray_multi_serial(file, nvars, fndims, varids, iodesc,
+                                                      DARRAY_FILL, frame)))
+                    return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                break;
+            default:
+                return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
             }
+
+            /* Remember that the holes of these vars are written. */
+            if (!frame)
+                for (int nv = 0; nv < nvars; nv++)
+                {
+                    var_desc_t *vdesc;
+
+                    if ((ierr = get_file_var_desc(file, varids[nv], &vdesc)))
+                        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                    vdesc->holes_ioid = iodesc->ioid;
+                }
         }
-    }
 
-    if(iodesc->needssort && tmparray != NULL)
-        free(tmparray);
+        /* For PNETCDF fillbuf is freed in flush_output_buffer(),
+         * unless it was copied into the attached buffer. Otherwise it
+         * is kept for the next record, at a cost of holegridsize *
+         * nvars values on each IO task until the var is freed, or
+         * freed now for non-record vars, which do not write their
+         * holes again. */
+        if (!frame && vdesc0->fillbuf &&
+            (file->iotype != PIO_IOTYPE_PNETCDF || file->darray_bput))
+        {
+            pio_free(PIO_MEM_FILLBUF, vdesc0->fillbuf);
+            vdesc0->fillbuf = NULL;
+        }
+    }
 
     /* Flush data to disk for pnetcdf. */
     if (ios->ioproc && file->iotype == PIO_IOTYPE_PNETCDF)
-        if ((ierr = flush_output_buffer(file, flushtodisk, 0)))
+        if ((ierr = check_output_buffer(file, flushtodisk)))
             return pio_err(ios, file, ierr, __FILE__, __LINE__);
 
-/* #ifdef USE_MPE */
-/*     pio_stop_mpe_log(DARRAY_WRITE, __func__); */
-/* #endif /\* USE_MPE *\/ */
-
     return PIO_NOERR;
 }
 
 /**
- * Find the fill value that would be used for a variable, if fill mode
- * was turned on.
- *
- * @param ncid File ID.
- * @param varid Variable ID.
- * @param pio_type Type of the variable.
- * @param type_size Size of one element of this type.
- * @param fillvalue Pointer that will get the fill value.
+ * Move nvars contiguous arrays from the computation tasks to the IO
+ * buffer of the IO tasks, sorting them first if the decomposition
+ * needs it.
  *
+ * @param ios pointer to the iosystem info.
+ * @param iodesc pointer to the decomposition info.
+ * @param nvars the number of arrays.
+ * @param arraylen the length of each local array.
+ * @param array pointer to nvars contiguous arrays of data. Ignored
+ * on tasks that are not computation tasks.
+ * @param rbuf the IO buffer. May be NULL.
  * @return 0 for success, error code otherwise.
  * @ingroup PIO_write_darray_c
- * @author Ed Hartnett
+ * @author Jim Edwards, Ed Hartnett
  */
 static int
-pio_inq_var_fill_expected(int ncid, int varid, int pio_type, PIO_Offset type_size,
-                          void *fillvalue)
+comp2io_darray(iosystem_desc_t *ios, io_desc_t *iodesc, int nvars, PIO_Offset arraylen,
+               void *array, void *rbuf)
 {
-    signed char byte_fill_value = NC_FILL_BYTE;
-    char char_fill_value = NC_FILL_CHAR;
-    short short_fill_value = NC_FILL_SHORT;
-    int int_fill_value = NC_FILL_INT;
-    float float_fill_value = NC_FILL_FLOAT;
-    double double_fill_value = NC_FILL_DOUBLE;
-    unsigned char ubyte_fill_value = NC_FILL_UBYTE;
-    unsigned short ushort_fill_value = NC_FILL_USHORT;
-    unsigned int uint_fill_value = NC_FILL_UINT;
-    long long int64_fill_value = NC_FILL_INT64;
-    unsigned long long uint64_fill_value = NC_FILL_UINT64;
-    char *string_fill_value = "";
-    int ret;
-
-    /* Check inputs. */
-    assert(fillvalue);
-
-    PLOG((2, "pio_inq_var_fill_expected ncid %d varid %d pio_type %d type_size %d",
-          ncid, varid, pio_type, type_size));
+    void *tmparray;
+    int ierr;
 
-    /* Is there a _FillValue attribute? */
-    ret = PIOc_inq_att_eh(ncid, varid, "_FillValue", 0, NULL, NULL);
+    /* Device arrays are not sorted on the CPU, but sent straight
+     * from the caller's memory. */
+    if (ios->device_buffers && array)
+    {
+        void *darrays[nvars];
 
-    PLOG((3, "pio_inq_var_fill_expected ret %d", ret));
+        for (int v = 0; v < nvars; v++)
+            darrays[v] = (char *)array + v * arraylen * iodesc->mpitype_size;
+        return rearrange_comp2io_nocopy(ios, iodesc, darrays, rbuf, nvars);
+    }
 
-    /* If there is a fill value, get it. */
-    if (!ret)
+    /* With async the IO tasks have no data of their own, and get
+     * the data of the computation tasks from the rearranger. */
+    if (iodesc->needssort && (!ios->async || ios->compproc))
     {
-        if ((ret = PIOc_get_att(ncid, varid, "_FillValue", fillvalue)))
-            return ret;
+        if (!(tmparray = malloc(arraylen*nvars*iodesc->piotype_size)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        pio_sorted_copy(array, tmparray, iodesc, nvars, 0);
     }
-    else /* If no _FillValue at was found we still have work to do. */
+    else
     {
-        /* Did we get some other error? */
-        if (ret != PIO_ENOTATT)
-            return ret;
-
+        tmparray = array;
+    }
+
+    /* Move data from compute to IO tasks. */
+    ierr = rearrange_comp2io(ios, iodesc, tmparray, rbuf, nvars);
+
+    if (tmparray != array)
+        free(tmparray);
+
+    return ierr;
+}
+
+/**
+ * Rearrange and write one or more arrays with the same IO
+ * decomposition to the file. This does the work of
+ * PIOc_write_darray_multi() after the parameters have been checked
+ * (and sent to the IO tasks, if async is in use).
+ *
+ * The data are either in one contiguous array (array), or, for
+ * buffers filled by PIOc_write_darray_nocopy(), in nvars separate
+ * arrays of the caller (arrays). In the second case the data are
+ * sent directly from the caller's arrays, without being copied or
+ * sorted.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param varids an array of length nvars containing the variable ids to
+ * be written.
+ * @param nvars the number of variables to be written.
+ * @param fndims the number of dimensions of the variables in the file.
+ * @param arraylen the length of each local array.
+ * @param array pointer to nvars contiguous arrays of data. Ignored if
+ * arrays is not NULL.
+ * @param arrays NULL, or an array (length nvars) of pointers to the
+ * data of each variable.
+ * @param frame an array of length nvars with the record number of
+ * each variable. NULL for non-record vars.
+ * @param fillvalue pointer to nvars fill values.
+ * @param flushtodisk non-zero to cause buffers to be flushed to disk.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+write_darray_multi_int(file_desc_t *file, io_desc_t *iodesc, const int *varids, int nvars,
+                       int fndims, PIO_Offset arraylen, void *array, void **arrays,
+                       const int *frame, void **fillvalue, bool flushtodisk)
+{
+    iosystem_desc_t *ios = file->iosystem; /* Pointer to io system information. */
+    double start;          /* For the I/O statistics. */
+    int ierr;              /* Return code. */
+
+    /* if the buffer is already in use in pnetcdf we need to flush first */
+    if (file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
+        if ((ierr = flush_output_buffer(file, 1, 0)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    pioassert(!file->iobuf, "buffer overwrite",__FILE__, __LINE__);
+
+    /* Allocate iobuf. */
+    if ((ierr = alloc_darray_iobuf(file, iodesc, nvars, fillvalue, &file->iobuf)))
+        return ierr;
+
+    start = MPI_Wtime();
+    if (arrays)
+    {
+        /* Move data from the caller's arrays to IO tasks. */
+        if ((ierr = rearrange_comp2io_nocopy(ios, iodesc, arrays, file->iobuf, nvars)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+    else if ((ierr = comp2io_darray(ios, iodesc, nvars, arraylen, array, file->iobuf)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    pio_stats_add(file, iodesc, rearrange_time, MPI_Wtime() - start);
+    pio_stats_add(file, iodesc, comp2io_bytes, iodesc->ndof * nvars * iodesc->mpitype_size);
+
+    /* Write the data and any holes. */
+    return write_darray_iobuf(file, iodesc, varids, nvars, fndims, frame, fillvalue,
+                              flushtodisk);
+}
+
+/**
+ * Find the decomposition to write or read a var with. A
+ * decomposition that was gathered (see PIOc_init_decomp_gathered())
+ * is replaced by the gathered decomposition for the vars that have
+ * one dimension besides the unlimited one, when it has more.
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable.
+ * @param ioid the I/O description ID passed by the caller.
+ * @returns the I/O description ID to use. Errors are left to the
+ * caller to find.
+ * @author Ed Hartnett
+ */
+static int
+find_darray_ioid(int ncid, int varid, int ioid)
+{
+    file_desc_t *file;
+    io_desc_t *iodesc;
+    var_desc_t *vdesc;
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)) || !iodesc->gathered_ioid ||
+        iodesc->ndims < 2 || pio_get_file_open(ncid, &file) ||
+        get_file_var_desc(file, varid, &vdesc))
+        return ioid;
+
+    return vdesc->ndims - (vdesc->rec_var ? 1 : 0) == 1 ? iodesc->gathered_ioid : ioid;
+}
+
+/**
+ * Write one or more arrays with the same IO decomposition to the
+ * file.
+ *
+ * This funciton is similar to PIOc_write_darray(), but allows the
+ * caller to use their own data buffering (instead of using the
+ * buffering implemented in PIOc_write_darray()).
+ *
+ * When the user calls PIOc_write_darray() one or more times, then
+ * PIO_write_darray_multi() will be called when the buffer is flushed.
+ *
+ * Internally, this function will:
+ * <ul>
+ * <li>Find info about file, decomposition, and variable.
+ * <li>Do a special flush for pnetcdf if needed.
+ * <li>Allocates a buffer big enough to hold all the data in the
+ * multi-buffer, for all tasks.
+ * <li>Calls rearrange_comp2io() to move data from compute to IO
+ * tasks.
+ * <li>For parallel iotypes (pnetcdf and netCDF-4 parallel) call
+ * pio_write_darray_multi_nc().
+ * <li>For serial iotypes (netcdf classic and netCDF-4 serial) call
+ * write_darray_multi_serial().
+ * <li>For subset rearranger, create holegrid to write missing
+ * data. Then call pio_write_darray_multi_nc() or
+ * write_darray_multi_serial() to write the holegrid.
+ * <li>Special buffer flush for pnetcdf.
+ * </ul>
+ *
+ * @param ncid identifies the netCDF file.
+ * @param varids an array of length nvars containing the variable ids to
+ * be written.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param nvars the number of variables to be written with this
+ * call.
+ * @param arraylen the length of the array to be written. This is the
+ * length of the distrubited array. That is, the length of the portion
+ * of the data that is on the processor. The same arraylen is used for
+ * all variables in the call.
+ * @param array pointer to the data to be written. This is a pointer
+ * to an array of arrays with the distributed portion of the array
+ * that is on this processor. There are nvars arrays of data, and each
+ * array of data contains one record worth of data for that variable.
+ * @param frame an array of length nvars with the frame or record
+ * dimension for each of the nvars variables in IOBUF. NULL if this
+ * iodesc contains non-record vars, or to use the records set with
+ * PIOc_setframe() for record vars.
+ * @param fillvalue pointer an array (of length nvars) of pointers to
+ * the fill value to be used for missing data.
+ * @param flushtodisk non-zero to cause buffers to be flushed to disk.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_write_darray_multi(int ncid, const int *varids, int ioid, int nvars,
+                        PIO_Offset arraylen, void *array, const int *frame,
+                        void **fillvalue, bool flushtodisk)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    io_desc_t *iodesc;     /* Pointer to IO description information. */
+    int fndims, fndims2;            /* Number of dims in the var in the file. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
+    int ierr;              /* Return code. */
+
+/* #ifdef USE_MPE */
+/*     pio_start_mpe_log(DARRAY_WRITE); */
+/* #endif /\* USE_MPE *\/ */
+    /* Vars of gathered points use the gathered decomposition. */
+    if (varids && nvars > 0)
+        ioid = find_darray_ioid(ncid, varids[0], ioid);
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_WRITE_DARRAY_MULTI)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (nvars <= 0 || !varids)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    PLOG((1, "PIOc_write_darray_multi ncid = %d ioid = %d nvars = %d arraylen = %ld "
+          "flushtodisk = %d",
+          ncid, ioid, nvars, arraylen, flushtodisk));
+
+    /* Check that we can write to this file. */
+    if (!file->writable)
+        return pio_err(ios, file, PIO_EPERM, __FILE__, __LINE__);
+
+    /* Get iodesc. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+    pioassert(iodesc->rearranger == PIO_REARR_BOX || iodesc->rearranger == PIO_REARR_SUBSET,
+              "unknown rearranger", __FILE__, __LINE__);
+
+    pioassert(iodesc->readonly == 0,"Multiple sources in map for a single destination",__FILE__,__LINE__);
+
+
+    /* Check the types of all the vars. They must match the type of
+     * the decomposition. Remember the records set with
+     * PIOc_setframe(), in case the caller did not pass frame. */
+    int recs[nvars];
+    int have_rec_var = 0;
+    for (int v = 0; v < nvars; v++)
+    {
+        var_desc_t *vdesc;
+        if ((ierr = get_file_var_desc(file, varids[v], &vdesc)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        /* if (vdesc->pio_type != iodesc->piotype)
+           return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);*/
+        recs[v] = vdesc->record;
+        if (vdesc->rec_var)
+            have_rec_var++;
+    }
+    if (!frame && have_rec_var && (!ios->async || !ios->ioproc))
+        frame = recs;
+
+    /* Run these on all tasks if async is not in use, but only on
+     * non-IO tasks if async is in use. */
+    if (!ios->async || !ios->ioproc)
+    {
+        /* Get the number of dims for this var. */
+        PLOG((3, "about to call PIOc_inq_varndims varids[0] = %d", varids[0]));
+        if ((ierr = PIOc_inq_varndims(file->pio_ncid, varids[0], &fndims)))
+            return check_netcdf(file, ierr, __FILE__, __LINE__);
+        PLOG((3, "called PIOc_inq_varndims varids[0] = %d fndims = %d", varids[0], fndims));
+        for (int v=1; v < nvars; v++){
+            if ((ierr = PIOc_inq_varndims(file->pio_ncid, varids[v], &fndims2)))
+                return check_netcdf(file, ierr, __FILE__, __LINE__);
+            if(fndims != fndims2)
+                return pio_err(ios, file, PIO_EVARDIMMISMATCH, __FILE__, __LINE__);
+        }
+
+    }
+
+    /* If async is in use, and this is not an IO task, bcast the
+     * parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_WRITEDARRAYMULTI;
+            char frame_present = frame ? true : false;         /* Is frame non-NULL? */
+            char fillvalue_present = fillvalue ? true : false; /* Is fillvalue non-NULL? */
+            int flushtodisk_int = flushtodisk; /* Need this to be int not boolean. */
+            int write_behind = ios->write_behind;
+            pio_msg_args args;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            /* Send the function parameters and associated informaiton
+             * to the msg handler in one message. */
+            pio_msg_args_init(&args, ios);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &ncid, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &nvars, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, varids, nvars, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &ioid, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &arraylen, 1, MPI_OFFSET);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &frame_present, 1, MPI_CHAR);
+            if (!mpierr && frame_present)
+                mpierr = pio_msg_args_pack(&args, frame, nvars, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &fillvalue_present, 1, MPI_CHAR);
+            if (!mpierr && fillvalue_present)
+                mpierr = pio_msg_args_pack(&args, fillvalue, nvars * iodesc->piotype_size,
+                                           MPI_CHAR);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &flushtodisk_int, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &write_behind, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_send(ios, &args);
+            pio_msg_args_free(&args);
+            PLOG((2, "PIOc_write_darray_multi file->pio_ncid = %d nvars = %d ioid = %d arraylen = %d "
+                  "frame_present = %d fillvalue_present = %d flushtodisk = %d", file->pio_ncid, nvars,
+                  ioid, arraylen, frame_present, fillvalue_present, flushtodisk));
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+        /* Share results known only on computation tasks with IO tasks. */
+        if ((mpierr = MPI_Bcast(&fndims, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        PLOG((3, "shared fndims = %d", fndims));
+    }
+
+    /* Rearrange and write the data. */
+    if ((ierr = write_darray_multi_int(file, iodesc, varids, nvars, fndims, arraylen,
+                                       array, NULL, frame, fillvalue, flushtodisk)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+/* #ifdef USE_MPE */
+/*     pio_stop_mpe_log(DARRAY_WRITE, __func__); */
+/* #endif /\* USE_MPE *\/ */
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_WRITE_DARRAY_MULTI)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the fill value that would be used for a variable, if fill mode
+ * was turned on.
+ *
+ * @param ncid File ID.
+ * @param varid Variable ID.
+ * @param pio_type Type of the variable.
+ * @param type_size Size of one element of this type.
+ * @param fillvalue Pointer that will get the fill value.
+ *
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+static int
+pio_inq_var_fill_expected(int ncid, int varid, int pio_type, PIO_Offset type_size,
+                          void *fillvalue)
+{
+    signed char byte_fill_value = NC_FILL_BYTE;
+    char char_fill_value = NC_FILL_CHAR;
+    short short_fill_value = NC_FILL_SHORT;
+    int int_fill_value = NC_FILL_INT;
+    float float_fill_value = NC_FILL_FLOAT;
+    double double_fill_value = NC_FILL_DOUBLE;
+    unsigned char ubyte_fill_value = NC_FILL_UBYTE;
+    unsigned short ushort_fill_value = NC_FILL_USHORT;
+    unsigned int uint_fill_value = NC_FILL_UINT;
+    long long int64_fill_value = NC_FILL_INT64;
+    unsigned long long uint64_fill_value = NC_FILL_UINT64;
+    char *string_fill_value = "";
+    int ret;
+
+    /* Check inputs. */
+    assert(fillvalue);
+
+    PLOG((2, "pio_inq_var_fill_expected ncid %d varid %d pio_type %d type_size %d",
+          ncid, varid, pio_type, type_size));
+
+    /* Is there a _FillValue attribute? */
+    ret = PIOc_inq_att_eh(ncid, varid, "_FillValue", 0, NULL, NULL);
+
+    PLOG((3, "pio_inq_var_fill_expected ret %d", ret));
+
+    /* If there is a fill value, get it. */
+    if (!ret)
+    {
+        if ((ret = PIOc_get_att(ncid, varid, "_FillValue", fillvalue)))
+            return ret;
+    }
+    else /* If no _FillValue at was found we still have work to do. */
+    {
+        /* Did we get some other error? */
+        if (ret != PIO_ENOTATT)
+            return ret;
+
         /* What is the default fill value for this type? */
         switch (pio_type)
         {
-        case PIO_BYTE:
-            memcpy(fillvalue, &byte_fill_value, type_size);
-            break;
-        case PIO_CHAR:
-            memcpy(fillvalue, &char_fill_value, type_size);
-            break;
-        case PIO_SHORT:
-            memcpy(fillvalue, &short_fill_value, type_size);
-            break;
-        case PIO_INT:
-            memcpy(fillvalue, &int_fill_value, type_size);
-            break;
-        case PIO_FLOAT:
-            memcpy(fillvalue, &float_fill_value, type_size);
-            break;
-        case PIO_DOUBLE:
-            memcpy(fillvalue, &double_fill_value, type_size);
-            break;
-#if defined(_NETCDF4) || defined(_PNETCDF)
-        case PIO_UBYTE:
-            memcpy(fillvalue, &ubyte_fill_value, type_size);
-            break;
-        case PIO_USHORT:
-            memcpy(fillvalue, &ushort_fill_value, type_size);
-            break;
-        case PIO_UINT:
-            memcpy(fillvalue, &uint_fill_value, type_size);
-            break;
-        case PIO_INT64:
-            memcpy(fillvalue, &int64_fill_value, type_size);
-            break;
-        case PIO_UINT64:
-            memcpy(fillvalue, &uint64_fill_value, type_size);
-            break;
-#ifdef _NETCDF4
-        case PIO_STRING:
-            memcpy(fillvalue, string_fill_value, type_size);
-            break;
-#endif /* _NETCDF4 */
-#endif/* _NETCDF4 || _PNETCDF */
-        default:
-            return PIO_EBADTYPE;
+        case PIO_BYTE:
+            memcpy(fillvalue, &byte_fill_value, type_size);
+            break;
+        case PIO_CHAR:
+            memcpy(fillvalue, &char_fill_value, type_size);
+            break;
+        case PIO_SHORT:
+            memcpy(fillvalue, &short_fill_value, type_size);
+            break;
+        case PIO_INT:
+            memcpy(fillvalue, &int_fill_value, type_size);
+            break;
+        case PIO_FLOAT:
+            memcpy(fillvalue, &float_fill_value, type_size);
+            break;
+        case PIO_DOUBLE:
+            memcpy(fillvalue, &double_fill_value, type_size);
+            break;
+#if defined(_NETCDF4) || defined(_PNETCDF)
+        case PIO_UBYTE:
+            memcpy(fillvalue, &ubyte_fill_value, type_size);
+            break;
+        case PIO_USHORT:
+            memcpy(fillvalue, &ushort_fill_value, type_size);
+            break;
+        case PIO_UINT:
+            memcpy(fillvalue, &uint_fill_value, type_size);
+            break;
+        case PIO_INT64:
+            memcpy(fillvalue, &int64_fill_value, type_size);
+            break;
+        case PIO_UINT64:
+            memcpy(fillvalue, &uint64_fill_value, type_size);
+            break;
+#ifdef _NETCDF4
+        case PIO_STRING:
+            memcpy(fillvalue, string_fill_value, type_size);
+            break;
+#endif /* _NETCDF4 */
+#endif/* _NETCDF4 || _PNETCDF */
+        default:
+            return PIO_EBADTYPE;
+        }
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the fillvalue that should be used for a variable.
+ *
+ * @param file Info about file we are writing to.
+ * @param varid the variable ID.
+ * @param vdesc pointer to var_desc_t info for this var.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+find_var_fillvalue(file_desc_t *file, int varid, var_desc_t *vdesc)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    int pio_type;
+    PIO_Offset type_size;
+    int no_fill;
+    int ierr;
+
+    /* Check inputs. */
+    pioassert(file && file->iosystem && vdesc, "invalid input", __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    PLOG((3, "find_var_fillvalue file->pio_ncid = %d varid = %d", file->pio_ncid, varid));
+
+    /* Find out PIO data type of var. */
+    if ((ierr = PIOc_inq_vartype(file->pio_ncid, varid, &pio_type)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    /* Find out length of type. */
+    if ((ierr = PIOc_inq_type(file->pio_ncid, pio_type, NULL, &type_size)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    PLOG((3, "getting fill value for varid = %d pio_type = %d type_size = %d",
+          varid, pio_type, type_size));
+
+    /* Allocate storage for the fill value. */
+    if (!(vdesc->fillvalue = malloc(type_size)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Get the fill mode and value, if fill mode is on (which is will
+     * not be, because it is turned off at open/create). */
+    if ((ierr = PIOc_inq_var_fill(file->pio_ncid, varid, &no_fill, vdesc->fillvalue)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    vdesc->use_fill = no_fill ? 0 : 1;
+    PLOG((3, "vdesc->use_fill = %d", vdesc->use_fill));
+
+    /* Get the fill value one would expect, if NOFILL were not turned
+     * on. */
+    if (!vdesc->use_fill)
+        if ((ierr = pio_inq_var_fill_expected(file->pio_ncid, varid, pio_type, type_size,
+                                              vdesc->fillvalue)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the file, decomposition and variable info for a call to
+ * PIOc_write_darray() or PIOc_write_darray_nocopy(), and check the
+ * parameters. If we don't have a fill value for this variable,
+ * determine one and remember it for future calls.
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable that these data will be written
+ * to.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param arraylen the length of the array to be written.
+ * @param fillvalue pointer to the fill value to be used for missing
+ * data. May be NULL.
+ * @param filep pointer that gets the file info.
+ * @param iodescp pointer that gets the decomposition info.
+ * @param vdescp pointer that gets the variable info.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+check_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *fillvalue,
+                   file_desc_t **filep, io_desc_t **iodescp, var_desc_t **vdescp)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Info about file we are writing to. */
+    io_desc_t *iodesc;     /* The IO description. */
+    var_desc_t *vdesc;     /* Info about the var being written. */
+    int ierr;              /* Return code. */
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Can we write to this file? */
+    if (!file->writable)
+        return pio_err(ios, file, PIO_EPERM, __FILE__, __LINE__);
+
+    /* Get decomposition information. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+
+    pioassert(iodesc->readonly == 0,"Multiple sources in map for a single destination",__FILE__,__LINE__);
+
+    /* Coarse decompositions have no data on the computation tasks. */
+    if (iodesc->coarse_factor)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Check that the local size of the variable passed in matches the
+     * size expected by the io descriptor. Fail if arraylen is too
+     * small, just put a warning in the log if it is too big (the
+     * excess values will be ignored.) */
+    if (arraylen < iodesc->ndof)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    PLOG((2, "%s arraylen = %d iodesc->ndof = %d",
+          (iodesc->ndof != arraylen) ? "WARNING: iodesc->ndof != arraylen" : "",
+          arraylen, iodesc->ndof));
+
+    /* Get var description. */
+    if ((ierr = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* If the type of the var doesn't match the type of the
+     * decomposition, return an error. */
+    /* if (iodesc->piotype != vdesc->pio_type) */
+    /*     return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__); */
+    /* pioassert(iodesc->mpitype_size == vdesc->mpi_type_size, "wrong mpi info", */
+    /*           __FILE__, __LINE__); */
+
+    /* If we don't know the fill value for this var, get it. */
+    if (!vdesc->fillvalue)
+        if ((ierr = find_var_fillvalue(file, varid, vdesc)))
+            return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check that if the user passed a fill value, it is correct. If
+     * use_fill is false, then find_var_fillvalue will not end up
+     * getting a fill value. */
+    if (fillvalue && vdesc->use_fill)
+        if (memcmp(fillvalue, vdesc->fillvalue, vdesc->pio_type_size))
+            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    *filep = file;
+    *iodescp = iodesc;
+    *vdescp = vdesc;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the write multi buffer for a decomposition and kind of
+ * variable (record or not), or create a new one if there is none.
+ *
+ * @param file pointer to the file info.
+ * @param ioid the I/O description ID.
+ * @param vdesc pointer to the info of the variable being written.
+ * @param arraylen the length of the array to be written.
+ * @param nocopy true for buffers that hold references to the caller's
+ * arrays (see PIOc_write_darray_nocopy()).
+ * @param wmbp pointer that gets the buffer.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+get_multi_buffer(file_desc_t *file, int ioid, var_desc_t *vdesc, PIO_Offset arraylen,
+                 bool nocopy, wmulti_buffer **wmbp)
+{
+    wmulti_buffer *wmb;    /* The write multi buffer for one or more vars. */
+    int hashid;
+
+    /* Move to end of list or the entry that matches this ioid. */
+    hashid = ioid * 10 + vdesc->rec_var + (nocopy ? 2 : 0);
+    HASH_FIND_INT( file->buffer, &hashid, wmb);
+    if (wmb)
+        PLOG((3, "wmb->ioid = %d wmb->recordvar = %d", wmb->ioid, wmb->recordvar));
+
+    /* If we did not find an existing wmb entry, create a new wmb. */
+    if (!wmb)
+    {
+        /* Allocate a buffer. */
+        if (!(wmb = malloc(sizeof(wmulti_buffer))))
+            return pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+
+        /* Set pointer to newly allocated buffer and initialize.*/
+        wmb->recordvar = vdesc->rec_var;
+        wmb->ioid = ioid;
+        wmb->num_arrays = 0;
+        wmb->arraylen = arraylen;
+        wmb->vid = NULL;
+        wmb->data = NULL;
+        wmb->frame = NULL;
+        wmb->fillvalue = NULL;
+        wmb->capacity = 0;
+        wmb->data_size = 0;
+        wmb->nocopy = nocopy;
+        wmb->arrays = NULL;
+        wmb->htid = hashid;
+        HASH_ADD_INT( file->buffer, htid, wmb );
+    }
+
+    *wmbp = wmb;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Copy the data of an array into a write multi buffer, converting
+ * them from the type in memory to the type of the decomposition.
+ *
+ * Only the conversions that narrow the data are done here, so that
+ * less data are sent to the IO tasks: PIO_DOUBLE to PIO_FLOAT, and
+ * PIO_INT64 to PIO_INT. The loops are simple enough for the compiler
+ * to vectorize. As with netCDF, values out of the range of the
+ * decomposition type are still converted, and PIO_ERANGE is returned.
+ *
+ * @param dst the buffer, of n elements of type piotype.
+ * @param piotype the PIO type of the decomposition.
+ * @param src the array, of n elements of type memtype.
+ * @param memtype the PIO type of the array.
+ * @param n the number of elements.
+ * @returns 0 for success, PIO_ERANGE if values were out of range,
+ * PIO_EINVAL if the conversion is not supported.
+ * @author Ed Hartnett
+ */
+static int
+convert_darray_data(void *dst, int piotype, const void *src, int memtype, PIO_Offset n)
+{
+    int range = 0;
+
+    if (memtype == PIO_DOUBLE && piotype == PIO_FLOAT)
+    {
+        const double *a = src;
+        float *b = dst;
+
+        for (PIO_Offset i = 0; i < n; i++)
+        {
+            range |= (a[i] > FLT_MAX) | (a[i] < -FLT_MAX);
+            b[i] = (float)a[i];
+        }
+    }
+    else if (memtype == PIO_INT64 && piotype == PIO_INT)
+    {
+        const long long *a = src;
+        int *b = dst;
+
+        for (PIO_Offset i = 0; i < n; i++)
+        {
+            range |= (a[i] > INT_MAX) | (a[i] < INT_MIN);
+            b[i] = (int)a[i];
+        }
+    }
+    else
+        return PIO_EINVAL;
+
+    return range ? PIO_ERANGE : PIO_NOERR;
+}
+
+/**
+ * Hash an array with FNV-1a, eight bytes at a time, for
+ * PIOc_set_var_skip_unchanged().
+ *
+ * @param ioid the decomposition the array is written with, which is
+ * hashed too.
+ * @param array pointer to the data.
+ * @param nbytes the size of the data in bytes.
+ * @param fillvalue pointer to the fill value of the holes, which is
+ * hashed too, or NULL.
+ * @param fillsize the size of the fill value in bytes.
+ * @return the hash.
+ * @author Ed Hartnett
+ */
+static unsigned long long
+darray_hash(int ioid, const void *array, size_t nbytes, const void *fillvalue,
+            int fillsize)
+{
+    unsigned long long h = 14695981039346656037ULL ^ (unsigned)ioid;
+    const unsigned char *b = array;
+    size_t i = 0;
+
+    for (; i + sizeof(h) <= nbytes; i += sizeof(h))
+    {
+        unsigned long long w;
+
+        memcpy(&w, b + i, sizeof(w));
+        h = (h ^ w) * 1099511628211ULL;
+    }
+    for (; i < nbytes; i++)
+        h = (h ^ b[i]) * 1099511628211ULL;
+    h = (h ^ nbytes) * 1099511628211ULL;
+
+    if (fillvalue)
+        for (b = fillvalue, i = 0; i < (size_t)fillsize; i++)
+            h = (h ^ b[i]) * 1099511628211ULL;
+
+    return h;
+}
+
+/**
+ * Hash the array of a write to a var that skips unchanged arrays
+ * (see PIOc_set_var_skip_unchanged()). A device array is first
+ * copied to host memory by MPI, which can read it (see
+ * PIOc_set_device_buffers()).
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition info.
+ * @param ioid the decomposition the array is written with.
+ * @param memtype the PIO type of the data in array, or NC_NAT if it
+ * is the type of the decomposition.
+ * @param arraylen the length of the array.
+ * @param array pointer to the data.
+ * @param fillvalue pointer to the fill value of the holes, or NULL.
+ * @param hash pointer that gets the hash.
+ * @returns 0 for success, non-zero error code for failure.
+ * @author Ed Hartnett
+ */
+static int
+skip_hash(iosystem_desc_t *ios, io_desc_t *iodesc, int ioid, int memtype,
+          PIO_Offset arraylen, const void *array, const void *fillvalue,
+          unsigned long long *hash)
+{
+    int type_size = iodesc->mpitype_size;
+    size_t nbytes;
+    void *host = NULL;
+    int mpierr;
+    int ierr;
+
+    if (memtype != NC_NAT && (ierr = find_mpi_type(memtype, NULL, &type_size)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    nbytes = arraylen * type_size;
+
+    if (ios->device_buffers && nbytes)
+    {
+        if (!(host = malloc(nbytes)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        if ((mpierr = MPI_Sendrecv(array, nbytes, MPI_BYTE, 0, 0, host, nbytes, MPI_BYTE,
+                                   0, 0, MPI_COMM_SELF, MPI_STATUS_IGNORE)))
+        {
+            free(host);
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
+        array = host;
+    }
+
+    *hash = darray_hash(ioid, array, nbytes, fillvalue, iodesc->mpitype_size);
+    free(host);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the frame that holds the data of the current record of a var
+ * to its reference var, if it has one (see
+ * PIOc_set_var_skip_unchanged()). This is the record itself if the
+ * data were written, or the record they were last written to if
+ * they were skipped.
+ *
+ * @param file pointer to the file info.
+ * @param vdesc pointer to the info of the var.
+ * @returns 0 for success, non-zero error code for failure.
+ * @author Ed Hartnett
+ */
+static int
+write_frame_ref(file_desc_t *file, var_desc_t *vdesc)
+{
+    PIO_Offset index = vdesc->record;
+
+    PLOG((2, "write_frame_ref varid = %d record = %d skip_frame = %d", vdesc->varid,
+          vdesc->record, vdesc->skip_frame));
+
+    if (!vdesc->rec_var || vdesc->skip_refvarid < 0)
+        return PIO_NOERR;
+
+    return PIOc_put_var1_int(file->pio_ncid, vdesc->skip_refvarid, &index, &vdesc->skip_frame);
+}
+
+/**
+ * Remember the hash of an array written to a var that skips
+ * unchanged arrays, and write the frame of its data to the reference
+ * var, if it has one (see PIOc_set_var_skip_unchanged()).
+ *
+ * @param file pointer to the file info.
+ * @param vdesc pointer to the info of the var.
+ * @param hash the hash of the array.
+ * @returns 0 for success, non-zero error code for failure.
+ * @author Ed Hartnett
+ */
+static int
+set_skip_hash(file_desc_t *file, var_desc_t *vdesc, unsigned long long hash)
+{
+    vdesc->skip_hash = hash;
+    vdesc->skip_valid = true;
+    vdesc->skip_frame = vdesc->rec_var ? vdesc->record : 0;
+
+    return write_frame_ref(file, vdesc);
+}
+
+/**
+ * Buffer a distributed array for writing, converting it from the
+ * memory type if needed. This is the work of PIOc_write_darray() and
+ * PIOc_write_darray_tc().
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable that these data will be written
+ * to.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param arraylen the length of the array to be written.
+ * @param memtype the PIO type of the data in array, or NC_NAT if it
+ * is the type of the decomposition.
+ * @param array pointer to the data to be written.
+ * @param fillvalue pointer to the fill value to be used for missing
+ * data, of the type of the decomposition. May be NULL.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+write_darray_int(int ncid, int varid, int ioid, PIO_Offset arraylen, int memtype,
+                 void *array, void *fillvalue)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Info about file we are writing to. */
+    io_desc_t *iodesc;     /* The IO description. */
+    var_desc_t *vdesc;     /* Info about the var being written. */
+    void *bufptr;          /* A data buffer. */
+    wmulti_buffer *wmb;    /* The write multi buffer for one or more vars. */
+    int needsflush = 0;    /* True if we need to flush buffer. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI functions. */
+    int ierr = PIO_NOERR;      /* Return code. */
+    int range_err = PIO_NOERR; /* PIO_ERANGE if the conversion was out of range. */
+    size_t io_data_size;          /* potential elements of data on io task */
+    unsigned long long hash = 0;  /* Hash of the array, for skip_unchanged. */
+    int changed = 1;              /* False if the array is the same as the last one. */
+    int vote[2];                  /* The flush vote and changed, for all tasks. */
+
+#ifdef USE_MPE
+    pio_start_mpe_log(DARRAY_WRITE);
+#endif /* USE_MPE */
+    /* Vars of gathered points use the gathered decomposition. */
+    ioid = find_darray_ioid(ncid, varid, ioid);
+
+    /* Find and check the file, decomposition and variable. */
+    if ((ierr = check_write_darray(ncid, varid, ioid, arraylen, fillvalue, &file,
+                                   &iodesc, &vdesc)))
+        return ierr;
+    ios = file->iosystem;
+
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_WRITE_DARRAY)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Data of the decomposition type are just copied. Check that any
+     * other type can be converted before buffering anything. */
+    if (memtype == iodesc->piotype)
+        memtype = NC_NAT;
+    if (memtype != NC_NAT &&
+        !(memtype == PIO_DOUBLE && iodesc->piotype == PIO_FLOAT) &&
+        !(memtype == PIO_INT64 && iodesc->piotype == PIO_INT))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    if (ios->device_buffers && memtype != NC_NAT)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Is the array different from the last one written to the var?
+     * The fill value of the holes is hashed too, so that a write
+     * with another fill value is not skipped. */
+    if (vdesc->skip_unchanged)
+    {
+        if ((ierr = skip_hash(ios, iodesc, ioid, memtype, arraylen, array,
+                              fillvalue ? fillvalue :
+                              iodesc->needsfill ? vdesc->fillvalue : NULL, &hash)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        changed = !vdesc->skip_valid || hash != vdesc->skip_hash;
+    }
+
+    /* Device arrays are not copied (or converted) into the write
+     * multi buffer, but sent to the IO tasks at once. */
+    if (ios->device_buffers)
+    {
+        if (vdesc->skip_unchanged)
+        {
+            /* There is no flush vote, so the tasks must agree whether
+             * the array changed. */
+            if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_MAX,
+                                        ios->comp_comm)))
+                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+            if ((ierr = changed ? set_skip_hash(file, vdesc, hash) :
+                 write_frame_ref(file, vdesc)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        }
+        if ((ierr = pio_stop_timer(ios, PIO_TIMER_WRITE_DARRAY)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if (!changed)
+            return PIO_NOERR;
+        return PIOc_write_darray_multi(ncid, &varid, ioid, 1, arraylen, array,
+                                       vdesc->record >= 0 ? &vdesc->record : NULL,
+                                       iodesc->needsfill ? vdesc->fillvalue : NULL, false);
+    }
+
+    /* Find or create the buffer for this decomposition. */
+    if ((ierr = get_multi_buffer(file, ioid, vdesc, arraylen, false, &wmb)))
+        return ierr;
+    PLOG((2, "wmb->num_arrays = %d arraylen = %d iodesc->mpitype_size = %d\n",
+          wmb->num_arrays, arraylen, iodesc->mpitype_size));
+
+    if (ios->flush_mode == PIO_FLUSH_DETERMINISTIC)
+    {
+        /* iodesc->maxbytes is the same on all tasks, so all tasks
+         * decide to flush at the same call without communication. The
+         * memory for a full buffer is reserved on first use, so it
+         * is not necessary to flush because memory is short. Since
+         * maxbytes is no larger than INT_MAX divided by maxiobuflen,
+         * the ROMIO limit on contiguous data holds too. */
+        int maxarrays = agg_max_arrays(ios, iodesc);
+
+        /* There is no flush vote, so the tasks must agree whether the
+         * array changed. */
+        if (vdesc->skip_unchanged)
+            if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_MAX,
+                                        ios->comp_comm)))
+                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+        if (wmb->num_arrays >= maxarrays)
+            needsflush = 1;
+
+        if ((ierr = reserve_multi_buffer(wmb, iodesc, max(maxarrays, wmb->num_arrays + 1),
+                                         arraylen, vdesc->record >= 0, NULL)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+    else
+    {
+        /* Make sure there is room in the buffer for one more
+         * array. If memory can't be found, flush the buffer and try
+         * again after the flush. */
+        if ((ierr = reserve_multi_buffer(wmb, iodesc, wmb->num_arrays + 1, arraylen,
+                                         vdesc->record >= 0, file)))
+        {
+            if (ierr != PIO_ENOMEM)
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            needsflush = 1;
+        }
+
+        /* The ROMIO limit of INT_MAX bytes in one write (see
+         * https://github.com/pmodels/mpich/pull/2888) is kept by
+         * flush_output_buffer(), which waits for the pnetcdf requests
+         * in groups below it. The elements on an IO task must still
+         * fit the int counts of the serial writes. */
+        io_data_size = (1 + wmb->num_arrays) * (size_t)iodesc->maxiobuflen;
+        if (io_data_size > INT_MAX)
+            needsflush = 2;
+
+        /* Flush at the size chosen from the write rate. */
+        if (ios->adaptive_agg && !needsflush &&
+            wmb->num_arrays >= agg_max_arrays(ios, iodesc))
+            needsflush = 1;
+
+        /* Tell all tasks on the computation communicator whether we need
+         * to flush data, and whether the array changed. */
+        vote[0] = needsflush;
+        vote[1] = changed;
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, vote, 2, MPI_INT, MPI_MAX, ios->comp_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        needsflush = vote[0];
+        changed = vote[1];
+    }
+    PLOG((2, "wmb->capacity = %d wmb->data_size = %ld needsflush = %d", wmb->capacity,
+          wmb->data_size, needsflush));
+
+    /* Flush data if needed. */
+    if (needsflush > 0)
+    {
+        /* If needsflush == 2 flush to disk otherwise just flush to io
+         * node. This will cause PIOc_write_darray_multi() to be
+         * called. */
+        if ((ierr = flush_buffer(ncid, wmb, needsflush == 2)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+        /* Try again to reserve memory, now that the buffer is empty. */
+        if ((ierr = reserve_multi_buffer(wmb, iodesc, 1, arraylen, vdesc->record >= 0,
+                                         ios->flush_mode == PIO_FLUSH_DETERMINISTIC ? NULL : file)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+
+    /* Skip the array if it is the same as the last one. */
+    if (!changed)
+    {
+#ifdef USE_MPE
+        pio_stop_mpe_log(DARRAY_WRITE, __func__);
+#endif /* USE_MPE */
+        if ((ierr = write_frame_ref(file, vdesc)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if ((ierr = pio_stop_timer(ios, PIO_TIMER_WRITE_DARRAY)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        return PIO_NOERR;
+    }
+    if (vdesc->skip_unchanged)
+        if ((ierr = set_skip_hash(file, vdesc, hash)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* If we need a fill value, get it. If we are using the subset
+     * rearranger and not using the netcdf fill mode then we need to
+     * do an extra write to fill in the holes with the fill value. */
+    if (iodesc->needsfill)
+        memcpy((char *)wmb->fillvalue + iodesc->mpitype_size * wmb->num_arrays,
+               vdesc->fillvalue, iodesc->mpitype_size);
+
+    /* Tell the buffer about the data it is getting. */
+    wmb->arraylen = arraylen;
+    wmb->vid[wmb->num_arrays] = varid;
+    PLOG((3, "wmb->num_arrays = %d wmb->vid[wmb->num_arrays] = %d", wmb->num_arrays,
+          wmb->vid[wmb->num_arrays]));
+
+    /* Copy the user-provided data to the buffer. */
+    bufptr = (void *)((char *)wmb->data + arraylen * iodesc->mpitype_size * wmb->num_arrays);
+    if (arraylen > 0 && memtype != NC_NAT)
+    {
+        PLOG((3, "converting %ld elements of user data from type %d", arraylen, memtype));
+        range_err = convert_darray_data(bufptr, iodesc->piotype, array, memtype, arraylen);
+    }
+    else if (arraylen > 0)
+    {
+        PLOG((3, "copying %ld bytes of user data %d", arraylen * iodesc->mpitype_size, iodesc->mpitype_size));
+        memcpy(bufptr, array, arraylen * iodesc->mpitype_size);
+    }
+
+    /* Add the unlimited dimension value of this variable to the frame
+     * array in wmb. */
+    if (wmb->frame)
+        wmb->frame[wmb->num_arrays] = vdesc->record;
+    wmb->num_arrays++;
+
+#ifdef USE_MPE
+    pio_stop_mpe_log(DARRAY_WRITE, __func__);
+#endif /* USE_MPE */
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_WRITE_DARRAY)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    PLOG((2, "wmb->num_arrays = %d iodesc->maxbytes / iodesc->mpitype_size = %d "
+          "iodesc->ndof = %d iodesc->llen = %d", wmb->num_arrays,
+          iodesc->maxbytes / iodesc->mpitype_size, iodesc->ndof, iodesc->llen));
+
+    return range_err;
+}
+
+/**
+ * Write a distributed array to the output file.
+ *
+ * This routine aggregates output on the compute nodes and only sends
+ * it to the IO nodes when the compute buffer is full or when a flush
+ * is triggered.
+ *
+ * Internally, this function will:
+ * <ul>
+ * <li>Locate info about this file, decomposition, and variable.
+ * <li>If we don't have a fillvalue for this variable, determine one
+ * and remember it for future calls.
+ * <li>Initialize or find the multi_buffer for this record/var.
+ * <li>Find out how much free space is available in the multi buffer
+ * and flush if needed.
+ * <li>Store the new user data in the mutli buffer.
+ * <li>If needed (only for subset rearranger), fill in gaps in data
+ * with fillvalue.
+ * <li>Remember the frame value (i.e. record number) of this data if
+ * there is one.
+ * </ul>
+ *
+ * NOTE: The write multi buffer wmulti_buffer is the cache on compute
+ * nodes that will collect and store multiple variables before sending
+ * them to the io nodes. Aggregating variables in this way leads to a
+ * considerable savings in communication expense. Variables in the wmb
+ * array must have the same decomposition and base data size and we
+ * also need to keep track of whether each is a recordvar (has an
+ * unlimited dimension) or not.
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable that these data will be written
+ * to.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param arraylen the length of the array to be written. This should
+ * be at least the length of the local component of the distrubited
+ * array. (Any values beyond length of the local component will be
+ * ignored.)
+ * @param array pointer to an array of length arraylen with the data
+ * to be written. This is a pointer to the distributed portion of the
+ * array that is on this task.
+ * @param fillvalue pointer to the fill value to be used for missing
+ * data.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
+                  void *fillvalue)
+{
+    PLOG((1, "PIOc_write_darray ncid = %d varid = %d ioid = %d arraylen = %d",
+          ncid, varid, ioid, arraylen));
+
+    return write_darray_int(ncid, varid, ioid, arraylen, NC_NAT, array, fillvalue);
+}
+
+/**
+ * Write a distributed array to the output file, converting it on the
+ * computation tasks from the type of the data in memory to the type
+ * of the decomposition.
+ *
+ * This works like PIOc_write_darray(), except that array holds data
+ * of type memtype, while the decomposition ioid (and the variable)
+ * has a narrower type. The data are converted while they are copied
+ * into the write multi buffer, so only the narrower data are sent to
+ * the IO tasks and held in their buffers. For a model that keeps its
+ * state in double and writes float history, this halves the data
+ * moved by the rearranger.
+ *
+ * The conversions PIO_DOUBLE to PIO_FLOAT and PIO_INT64 to PIO_INT
+ * are supported. If memtype is the type of the decomposition, the
+ * data are copied as with PIOc_write_darray().
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable that these data will be written
+ * to.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp(), with the type of the data in the file.
+ * @param arraylen the length of the array to be written.
+ * @param memtype the PIO type of the data in array.
+ * @param array pointer to an array of length arraylen with the data
+ * to be written.
+ * @param fillvalue pointer to the fill value to be used for missing
+ * data, of the type of the decomposition. May be NULL.
+ * @returns 0 for success, PIO_ERANGE if some values were out of the
+ * range of the type of the decomposition (they are still written, as
+ * with netCDF), PIO_EINVAL if the conversion is not supported, other
+ * non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_write_darray_tc(int ncid, int varid, int ioid, PIO_Offset arraylen, int memtype,
+                     void *array, void *fillvalue)
+{
+    PLOG((1, "PIOc_write_darray_tc ncid = %d varid = %d ioid = %d arraylen = %d "
+          "memtype = %d", ncid, varid, ioid, arraylen, memtype));
+
+    return write_darray_int(ncid, varid, ioid, arraylen, memtype, array, fillvalue);
+}
+
+/**
+ * Write one distributed array to a variable in each of several open
+ * files, such as a history file and an auxiliary file with the same
+ * fields, rearranging the data only once.
+ *
+ * The array is moved from the computation tasks to the IO tasks in
+ * one rearrangement, and each IO task then writes its part to all of
+ * the files. This saves the comp->io traffic of all but one of the
+ * files, compared with a PIOc_write_darray() call for each file. The
+ * data are not buffered on the computation tasks: the rearrangement
+ * is done at once, and with pnetcdf the writes are posted as with
+ * PIOc_write_darray_multi().
+ *
+ * The files must belong to the same IO system, and the variables are
+ * written at their current frame, as set with PIOc_setframe(). If
+ * fill values are written for the holes of the BOX rearranger, the
+ * variables must have the same fill value. With async, each file is
+ * written with PIOc_write_darray().
+ *
+ * This function must be called on all computation tasks.
+ *
+ * @param nfiles the number of files.
+ * @param ncids an array of length nfiles with the ncids of the open
+ * files.
+ * @param varids an array of length nfiles with the ID of the variable
+ * in each file.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param arraylen the length of the array to be written.
+ * @param array pointer to an array of length arraylen with the data
+ * to be written.
+ * @param fillvalue pointer to the fill value to be used for missing
+ * data. May be NULL.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_write_darray_files(int nfiles, const int *ncids, const int *varids, int ioid,
+                        PIO_Offset arraylen, void *array, void *fillvalue)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file[nfiles > 0 ? nfiles : 1];  /* The files. */
+    var_desc_t *vdesc[nfiles > 0 ? nfiles : 1];  /* The vars. */
+    io_desc_t *iodesc;     /* The IO description. */
+    void *rbuf = NULL;     /* The rearranged data on IO tasks. */
+    double start;          /* For the I/O statistics. */
+    int ierr = PIO_NOERR;  /* Return code. */
+
+    PLOG((1, "PIOc_write_darray_files nfiles = %d ioid = %d arraylen = %d", nfiles,
+          ioid, arraylen));
+
+    if (nfiles <= 0 || !ncids || !varids)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Find and check the files, decomposition and variables. */
+    for (int f = 0; f < nfiles; f++)
+    {
+        if ((ierr = check_write_darray(ncids[f], varids[f], ioid, arraylen, fillvalue,
+                                       &file[f], &iodesc, &vdesc[f])))
+            return ierr;
+        if (file[f]->iosystem != file[0]->iosystem)
+            return pio_err(file[f]->iosystem, file[f], PIO_EINVAL, __FILE__, __LINE__);
+        if (iodesc->needsfill && iodesc->rearranger == PIO_REARR_BOX &&
+            memcmp(vdesc[f]->fillvalue, vdesc[0]->fillvalue, iodesc->mpitype_size))
+            return pio_err(file[f]->iosystem, file[f], PIO_EINVAL, __FILE__, __LINE__);
+    }
+    ios = file[0]->iosystem;
+
+    /* With async, the IO tasks only learn about one file at a
+     * time. */
+    if (ios->async)
+    {
+        for (int f = 0; f < nfiles; f++)
+            if ((ierr = PIOc_write_darray(ncids[f], varids[f], ioid, arraylen, array,
+                                          fillvalue)))
+                return ierr;
+        return PIO_NOERR;
+    }
+
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_WRITE_DARRAY_MULTI)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    /* Rearrange the data once, into a buffer with the fill values in
+     * the holes, if they are needed. */
+    if (ios->ioproc && iodesc->llen > 0)
+    {
+        if (!(rbuf = pio_iobuf_alloc(ios, iodesc->mpitype_size * (size_t)iodesc->llen)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        if (iodesc->needsfill && iodesc->rearranger == PIO_REARR_BOX)
+            fill_buffer(rbuf, vdesc[0]->fillvalue, iodesc->mpitype_size, iodesc->llen);
+    }
+    start = MPI_Wtime();
+    if ((ierr = comp2io_darray(ios, iodesc, 1, arraylen, array, rbuf)))
+    {
+        pio_iobuf_free(ios, rbuf);
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    }
+    pio_stats_add(file[0], iodesc, rearrange_time, MPI_Wtime() - start);
+    pio_stats_add(file[0], iodesc, comp2io_bytes, iodesc->ndof * iodesc->mpitype_size);
+
+    /* Write the data to each file. */
+    for (int f = 0; !ierr && f < nfiles; f++)
+    {
+        int fndims;
+
+        if ((ierr = PIOc_inq_varndims(ncids[f], varids[f], &fndims)))
+            break;
+
+        /* if the buffer is already in use in pnetcdf we need to
+         * flush first */
+        if (file[f]->iotype == PIO_IOTYPE_PNETCDF && file[f]->iobuf)
+            if ((ierr = flush_output_buffer(file[f], 1, 0)))
+                break;
+        if ((ierr = alloc_darray_iobuf(file[f], iodesc, 1, NULL, &file[f]->iobuf)))
+            break;
+        if (rbuf)
+            memcpy(file[f]->iobuf, rbuf, iodesc->mpitype_size * (size_t)iodesc->llen);
+        ierr = write_darray_iobuf(file[f], iodesc, &varids[f], 1, fndims,
+                                  vdesc[f]->rec_var ? &vdesc[f]->record : NULL,
+                                  iodesc->needsfill ? vdesc[f]->fillvalue : NULL, false);
+    }
+    pio_iobuf_free(ios, rbuf);
+    if (ierr)
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_WRITE_DARRAY_MULTI)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get an element of an IO buffer as a double, for the coarse means.
+ *
+ * @param buf the buffer.
+ * @param i the index of the element.
+ * @param piotype the type of the data, PIO_INT, PIO_FLOAT or
+ * PIO_DOUBLE.
+ * @return the value.
+ * @author Ed Hartnett
+ */
+static double
+coarse_get(const void *buf, PIO_Offset i, int piotype)
+{
+    switch (piotype)
+    {
+    case PIO_INT:
+        return ((const int *)buf)[i];
+    case PIO_FLOAT:
+        return ((const float *)buf)[i];
+    default:
+        return ((const double *)buf)[i];
+    }
+}
+
+/**
+ * Set an element of an IO buffer from a double, for the coarse
+ * means. A PIO_INT is rounded to the nearest integer, halves away
+ * from zero.
+ *
+ * @param buf the buffer.
+ * @param i the index of the element.
+ * @param piotype the type of the data, PIO_INT, PIO_FLOAT or
+ * PIO_DOUBLE.
+ * @param v the value.
+ * @author Ed Hartnett
+ */
+static void
+coarse_put(void *buf, PIO_Offset i, int piotype, double v)
+{
+    switch (piotype)
+    {
+    case PIO_INT:
+        ((int *)buf)[i] = (int)(v < 0 ? v - 0.5 : v + 0.5);
+        break;
+    case PIO_FLOAT:
+        ((float *)buf)[i] = (float)v;
+        break;
+    default:
+        ((double *)buf)[i] = v;
+    }
+}
+
+/**
+ * Compute the coarse elements of one region of an IO task from the
+ * data of the region in the IO buffer (see
+ * PIOc_init_decomp_coarse()).
+ *
+ * @param coarse pointer to the coarse decomposition info.
+ * @param fregion the region of the decomposition being coarsened.
+ * @param cregion the coarse region.
+ * @param fbuf the data of fregion.
+ * @param cbuf gets the data of cregion.
+ * @param fillvalue the fill value of the data, which is skipped by
+ * the means, or NULL.
+ * @param cfillvalue the fill value of the coarse data, for the means
+ * of blocks with no values, or NULL.
+ * @author Ed Hartnett
+ */
+static void
+coarsen_region(const io_desc_t *coarse, const io_region *fregion, const io_region *cregion,
+               const char *fbuf, char *cbuf, const void *fillvalue, const void *cfillvalue)
+{
+    int ndims = coarse->ndims;
+    int size = coarse->mpitype_size;
+    const int *factor = coarse->coarse_factor;
+    PIO_Offset stride[ndims];   /* Strides of fregion, in elements. */
+    PIO_Offset idx[ndims];      /* Coarse element, relative to cregion. */
+    PIO_Offset lo[ndims], hi[ndims], b[ndims];
+    PIO_Offset n = 1;
+
+    for (int d = ndims - 1; d >= 0; d--)
+    {
+        stride[d] = d == ndims - 1 ? 1 : stride[d + 1] * fregion->count[d + 1];
+        n *= cregion->count[d];
+        idx[d] = 0;
+    }
+
+    for (PIO_Offset c = 0; c < n; c++)
+    {
+        PIO_Offset off = 0;
+        double sum = 0;
+        int cnt = 0;
+        int d;
+
+        /* The first element of the block, and its end in fregion. */
+        for (d = 0; d < ndims; d++)
+        {
+            lo[d] = (cregion->start[d] + idx[d]) * factor[d] - fregion->start[d];
+            hi[d] = min(lo[d] + factor[d], fregion->count[d]);
+            b[d] = lo[d];
+            off += lo[d] * stride[d];
+        }
+
+        if (coarse->coarse_op == PIO_COARSE_SUBSAMPLE)
+            memcpy(cbuf + c * size, fbuf + off * size, size);
+        else
+        {
+            /* Add up the values of the block. */
+            while (1)
+            {
+                for (d = 0, off = 0; d < ndims; d++)
+                    off += b[d] * stride[d];
+                if (!fillvalue || memcmp(fbuf + off * size, fillvalue, size))
+                {
+                    sum += coarse_get(fbuf, off, coarse->piotype);
+                    cnt++;
+                }
+                for (d = ndims - 1; d >= 0; d--)
+                {
+                    if (++b[d] < hi[d])
+                        break;
+                    b[d] = lo[d];
+                }
+                if (d < 0)
+                    break;
+            }
+            if (cnt)
+                coarse_put(cbuf, c, coarse->piotype, sum / cnt);
+            else if (cfillvalue)
+                memcpy(cbuf + c * size, cfillvalue, size);
+            else
+                coarse_put(cbuf, c, coarse->piotype, 0);
+        }
+
+        /* Next coarse element. */
+        for (d = ndims - 1; d >= 0; d--)
+        {
+            if (++idx[d] < cregion->count[d])
+                break;
+            idx[d] = 0;
+        }
+    }
+}
+
+/**
+ * Write a distributed array, and a coarse version of it, computed on
+ * the IO tasks, to another variable.
+ *
+ * The array is moved to the IO tasks as with PIOc_write_darray(),
+ * and each IO task computes the coarse elements of its part of the
+ * array, as set up with PIOc_init_decomp_coarse(). So the coarse
+ * array costs no extra data movement from the computation tasks. The
+ * data are not buffered on the computation tasks: the rearrangement
+ * is done at once, and with pnetcdf the writes are posted as with
+ * PIOc_write_darray_multi().
+ *
+ * Both variables are written at their current frame, as set with
+ * PIOc_setframe(). This is not supported with async.
+ *
+ * This function must be called on all computation tasks.
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable the array is written to.
+ * @param cvarid the ID of the variable the coarse array is written
+ * to.
+ * @param ioid the ID of the coarse decomposition, as returned by
+ * PIOc_init_decomp_coarse(). The array has the decomposition it
+ * coarsens.
+ * @param arraylen the length of the array to be written.
+ * @param array pointer to an array of length arraylen with the data
+ * to be written.
+ * @param fillvalue pointer to the fill value to be used for missing
+ * data. May be NULL.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_write_darray_coarse(int ncid, int varid, int cvarid, int ioid, PIO_Offset arraylen,
+                         void *array, void *fillvalue)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Info about file we are writing to. */
+    io_desc_t *coarse;     /* The coarse decomposition. */
+    io_desc_t *iodesc;     /* The decomposition of the array. */
+    var_desc_t *vdesc;     /* Info about the var of the array. */
+    var_desc_t *cvdesc;    /* Info about the var of the coarse array. */
+    void *cbuf = NULL;     /* The coarse data on IO tasks. */
+    double start;          /* For the I/O statistics. */
+    int fndims, cfndims;   /* Number of dims of the vars in the file. */
+    int ierr;              /* Return code. */
+
+    PLOG((1, "PIOc_write_darray_coarse ncid = %d varid = %d cvarid = %d ioid = %d",
+          ncid, varid, cvarid, ioid));
+
+    /* Find and check the file, decompositions and variables. */
+    if (!(coarse = pio_get_iodesc_from_id(ioid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!coarse->coarse_factor)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if ((ierr = check_write_darray(ncid, varid, coarse->coarse_parent, arraylen, fillvalue,
+                                   &file, &iodesc, &vdesc)))
+        return ierr;
+    ios = file->iosystem;
+    if (ios->async)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    if ((ierr = get_file_var_desc(file, cvarid, &cvdesc)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if (!cvdesc->fillvalue)
+        if ((ierr = find_var_fillvalue(file, cvarid, cvdesc)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if ((ierr = PIOc_inq_varndims(ncid, varid, &fndims)) ||
+        (ierr = PIOc_inq_varndims(ncid, cvarid, &cfndims)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_WRITE_DARRAY_MULTI)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Move the array to the IO tasks. */
+    if (file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
+        if ((ierr = flush_output_buffer(file, 1, 0)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if ((ierr = alloc_darray_iobuf(file, iodesc, 1, iodesc->needsfill ? vdesc->fillvalue : NULL,
+                                   &file->iobuf)))
+        return ierr;
+    start = MPI_Wtime();
+    if ((ierr = comp2io_darray(ios, iodesc, 1, arraylen, array, file->iobuf)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    pio_stats_add(file, iodesc, rearrange_time, MPI_Wtime() - start);
+    pio_stats_add(file, iodesc, comp2io_bytes, iodesc->ndof * iodesc->mpitype_size);
+
+    /* Compute the coarse data, region by region. */
+    if (ios->ioproc && coarse->llen > 0)
+    {
+        io_region *cregion = coarse->firstregion;
+
+        if (!(cbuf = pio_iobuf_alloc(ios, coarse->mpitype_size * (size_t)coarse->llen)))
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        for (io_region *region = iodesc->firstregion; region && cregion;
+             region = region->next, cregion = cregion->next)
+            coarsen_region(coarse, region, cregion,
+                           (char *)file->iobuf + region->loffset * iodesc->mpitype_size,
+                           (char *)cbuf + cregion->loffset * coarse->mpitype_size,
+                           vdesc->fillvalue, cvdesc->fillvalue);
+    }
+
+    /* Write the array, then the coarse array. */
+    ierr = write_darray_iobuf(file, iodesc, &varid, 1, fndims,
+                              vdesc->rec_var ? &vdesc->record : NULL,
+                              iodesc->needsfill ? vdesc->fillvalue : NULL, false);
+    if (!ierr && file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
+        ierr = flush_output_buffer(file, 1, 0);
+    if (!ierr)
+        ierr = alloc_darray_iobuf(file, coarse, 1, NULL, &file->iobuf);
+    if (!ierr && cbuf)
+        memcpy(file->iobuf, cbuf, coarse->mpitype_size * (size_t)coarse->llen);
+    pio_iobuf_free(ios, cbuf);
+    if (!ierr)
+        ierr = write_darray_iobuf(file, coarse, &cvarid, 1, cfndims,
+                                  cvdesc->rec_var ? &cvdesc->record : NULL, NULL, false);
+    if (ierr)
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_WRITE_DARRAY_MULTI)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write a distributed array to the output file, without copying the
+ * data.
+ *
+ * This works like PIOc_write_darray(), but instead of copying the
+ * caller's array into the write multi buffer, only a reference to the
+ * array is kept. When the buffer is flushed the data are sent to the
+ * IO tasks directly from the caller's arrays, with MPI datatypes built
+ * over them, so the data are never duplicated on the computation
+ * tasks (not even when the decomposition map needs sorting).
+ *
+ * The caller must not change or free the array until
+ * PIOc_write_darray_nocopy_wait(), PIOc_sync() or PIOc_closefile()
+ * has been called for this file. The buffer is also flushed (at the
+ * same call on all tasks) when it holds as many arrays as the
+ * aggregate buffer limit of the decomposition allows, so the first
+ * arrays in the buffer may be released earlier.
+ *
+ * When the async interface is in use, the data have to be sent to
+ * the IO tasks anyway, and this function just calls
+ * PIOc_write_darray().
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable that these data will be written
+ * to.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param arraylen the length of the array to be written. This should
+ * be at least the length of the local component of the distrubited
+ * array.
+ * @param array pointer to an array of length arraylen with the data
+ * to be written.
+ * @param fillvalue pointer to the fill value to be used for missing
+ * data.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_write_darray_nocopy(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
+                         void *fillvalue)
+{
+    file_desc_t *file;     /* Info about file we are writing to. */
+    io_desc_t *iodesc;     /* The IO description. */
+    var_desc_t *vdesc;     /* Info about the var being written. */
+    wmulti_buffer *wmb;    /* The write multi buffer for one or more vars. */
+    int maxarrays;         /* Number of arrays held before a flush. */
+    int ierr;              /* Return code. */
+
+    PLOG((1, "PIOc_write_darray_nocopy ncid = %d varid = %d ioid = %d arraylen = %d",
+          ncid, varid, ioid, arraylen));
+
+    /* Vars of gathered points use the gathered decomposition. */
+    ioid = find_darray_ioid(ncid, varid, ioid);
+
+    /* Find and check the file, decomposition and variable. */
+    if ((ierr = check_write_darray(ncid, varid, ioid, arraylen, fillvalue, &file,
+                                   &iodesc, &vdesc)))
+        return ierr;
+
+    /* With async the data must be copied to the IO tasks. */
+    if (file->iosystem->async)
+        return PIOc_write_darray(ncid, varid, ioid, arraylen, array, fillvalue);
+
+    /* Find or create the buffer for this decomposition. */
+    if ((ierr = get_multi_buffer(file, ioid, vdesc, arraylen, true, &wmb)))
+        return ierr;
+
+    /* Nothing is copied, so memory can't run short. Flush when the
+     * IO side limit is reached. iodesc->maxbytes is the same on all
+     * tasks, so no communication is needed to agree on this. */
+    maxarrays = agg_max_arrays(file->iosystem, iodesc);
+    if (wmb->num_arrays >= maxarrays)
+        if ((ierr = flush_buffer(ncid, wmb, false)))
+            return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+
+    /* Make room for one more reference. */
+    if ((ierr = reserve_multi_buffer(wmb, iodesc, wmb->num_arrays + 1, 0,
+                                     vdesc->record >= 0, NULL)))
+        return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+
+    /* Remember the fill value, if needed. */
+    if (iodesc->needsfill)
+        memcpy((char *)wmb->fillvalue + iodesc->mpitype_size * wmb->num_arrays,
+               vdesc->fillvalue, iodesc->mpitype_size);
+
+    /* Tell the buffer about the data it is getting. */
+    wmb->arraylen = arraylen;
+    wmb->vid[wmb->num_arrays] = varid;
+    wmb->arrays[wmb->num_arrays] = array;
+    if (wmb->frame)
+        wmb->frame[wmb->num_arrays] = vdesc->record;
+    wmb->num_arrays++;
+
+    PLOG((2, "wmb->num_arrays = %d maxarrays = %d", wmb->num_arrays, maxarrays));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Complete all writes started with PIOc_write_darray_nocopy() on this
+ * file. The data are sent to the IO tasks (but not necessarily
+ * written to disk). After this function returns the caller may
+ * change or free the arrays passed to PIOc_write_darray_nocopy().
+ *
+ * This function must be called on all computation tasks.
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_write_darray_nocopy_wait(int ncid)
+{
+    file_desc_t *file;     /* Info about file we are writing to. */
+    wmulti_buffer *wmb, *twmb;
+    int ierr;              /* Return code. */
+
+    PLOG((1, "PIOc_write_darray_nocopy_wait ncid = %d", ncid));
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Flush the buffers that hold references. */
+    HASH_ITER(hh, file->buffer, wmb, twmb)
+    {
+        if (wmb->nocopy && wmb->num_arrays > 0)
+            if ((ierr = flush_buffer(ncid, wmb, false)))
+                return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the list variable of a gathered decomposition (see
+ * PIOc_init_decomp_gathered()): the zero-based offset of each point
+ * in the full grid of the decomposition it gathers, in C order. This
+ * is the list variable of the CF "compression by gathering", so the
+ * var should be of type PIO_INT, on the gathered dimension only, with
+ * a "compress" attribute with the names of the dimensions of the full
+ * grid.
+ *
+ * The offsets come from the maps of the decompositions, so the
+ * caller has no data to pass. The list is written with a temporary
+ * decomposition, and the file is synced before it is freed. This
+ * function must be called on all computation tasks, once per file.
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the list variable.
+ * @param ioid the ID of the gathered decomposition.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_write_gathered_list(int ncid, int varid, int ioid)
+{
+    file_desc_t *file;
+    io_desc_t *iodesc, *parent;
+    PIO_Offset *compmap;
+    PIO_Offset gsize = 1;
+    int *list;
+    int listid;
+    int rearr;
+    int ierr;
+
+    PLOG((1, "PIOc_write_gathered_list ncid = %d varid = %d ioid = %d", ncid, varid, ioid));
+
+    /* Get the file and the decompositions. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(file->iosystem, file, PIO_EBADID, __FILE__, __LINE__);
+    if (!iodesc->gather_parent || !(parent = pio_get_iodesc_from_id(iodesc->gather_parent)))
+        return pio_err(file->iosystem, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* The maps are needed, the offsets must fit the list, and each
+     * point must come from one task. */
+    for (int d = 0; d < parent->ndims; d++)
+        gsize *= parent->dimlen[d];
+    if (!iodesc->map || !parent->map || parent->readonly || gsize > INT_MAX)
+        return pio_err(file->iosystem, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    if (!(list = malloc(sizeof(int) * (parent->maplen + 1))) ||
+        !(compmap = malloc(sizeof(PIO_Offset) * (iodesc->maplen + 1))))
+    {
+        free(list);
+        return pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+
+    /* Both maps are sorted, put them back in the order of the
+     * arrays. */
+    for (int m = 0; m < iodesc->maplen; m++)
+        compmap[iodesc->remap ? iodesc->remap[m] : m] = iodesc->map[m];
+    for (int m = 0; m < parent->maplen; m++)
+        list[parent->remap ? parent->remap[m] : m] = parent->map[m] > 0 ? parent->map[m] - 1 : 0;
+
+    rearr = iodesc->rearranger;
+    if (!(ierr = PIOc_InitDecomp(iodesc->iosysid, PIO_INT, 1, iodesc->dimlen, iodesc->maplen,
+                                 compmap, &listid, &rearr, NULL, NULL)))
+    {
+        if (!(ierr = PIOc_write_darray(ncid, varid, listid, iodesc->maplen, list, NULL)))
+            ierr = PIOc_sync(ncid);
+        if (!ierr)
+            ierr = PIOc_freedecomp(iodesc->iosysid, listid);
+        else
+            PIOc_freedecomp(iodesc->iosysid, listid);
+    }
+
+    free(list);
+    free(compmap);
+
+    return ierr;
+}
+
+/**
+ * Write the contents of a nocopy write multi buffer (one filled by
+ * PIOc_write_darray_nocopy()). This is called from flush_buffer().
+ *
+ * @param file pointer to the file info.
+ * @param wmb pointer to the wmulti_buffer structure.
+ * @param flushtodisk if true, then flush data to disk.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+write_darray_nocopy_buffer(file_desc_t *file, wmulti_buffer *wmb, bool flushtodisk)
+{
+    io_desc_t *iodesc;     /* The IO description. */
+    int fndims;            /* Number of dims in the var in the file. */
+    int ierr;              /* Return code. */
+
+    pioassert(file && wmb && wmb->nocopy && !file->iosystem->async, "invalid input",
+              __FILE__, __LINE__);
+
+    /* Get decomposition information. */
+    if (!(iodesc = pio_get_iodesc_from_id(wmb->ioid)))
+        return pio_err(file->iosystem, file, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Get the number of dims for the vars. */
+    if ((ierr = PIOc_inq_varndims(file->pio_ncid, wmb->vid[0], &fndims)))
+        return check_netcdf(file, ierr, __FILE__, __LINE__);
+
+    return write_darray_multi_int(file, iodesc, wmb->vid, wmb->num_arrays, fndims,
+                                  wmb->arraylen, NULL, wmb->arrays, wmb->frame,
+                                  wmb->fillvalue, flushtodisk);
+}
+
+/**
+ * Define the kernels of the accumulated reductions for the type TYPE.
+ * accumulate_NAME() adds one array in the layout of the IO buffer
+ * to the accumulated values acc, counting the values of each element
+ * in cnt; values equal to the fill value are missing and are
+ * skipped. reduce_NAME() puts the reduced values in the IO buffer,
+ * with the fill value (or 0) where no value was accumulated.
+ */
+#define PIO_DEFINE_ACCUM(NAME, TYPE)                                    \
+    static void                                                         \
+    accumulate_##NAME(const void *buf, PIO_Offset n, int op, bool has_fill, \
+                      double fill, double *restrict acc, int *restrict cnt) \
+    {                                                                   \
+        const TYPE *b = buf;                                            \
+        for (PIO_Offset i = 0; i < n; i++)                              \
+        {                                                               \
+            double v = b[i];                                            \
+            if (has_fill && b[i] == (TYPE)fill)                         \
+                continue;                                               \
+            if (!cnt[i])                                                \
+                acc[i] = v;                                             \
+            else if (op == PIO_ACCUM_MIN)                               \
+                acc[i] = v < acc[i] ? v : acc[i];                       \
+            else if (op == PIO_ACCUM_MAX)                               \
+                acc[i] = v > acc[i] ? v : acc[i];                       \
+            else                                                        \
+                acc[i] += v;                                            \
+            cnt[i]++;                                                   \
+        }                                                               \
+    }                                                                   \
+    static void                                                         \
+    reduce_##NAME(void *buf, PIO_Offset n, int op, double fill,         \
+                  const double *restrict acc, const int *restrict cnt)  \
+    {                                                                   \
+        TYPE *b = buf;                                                  \
+        for (PIO_Offset i = 0; i < n; i++)                              \
+        {                                                               \
+            if (!cnt[i])                                                \
+                b[i] = (TYPE)fill;                                      \
+            else if (op == PIO_ACCUM_MEAN)                              \
+                b[i] = (TYPE)(acc[i] / cnt[i]);                         \
+            else                                                        \
+                b[i] = (TYPE)acc[i];                                    \
+        }                                                               \
+    }
+
+PIO_DEFINE_ACCUM(int, int)
+PIO_DEFINE_ACCUM(float, float)
+PIO_DEFINE_ACCUM(double, double)
+
+/**
+ * Find the fill value of the data accumulated for a var, as a double.
+ *
+ * @param piotype the type of the data.
+ * @param fillvalue pointer to the fill value of that type, or NULL.
+ * @return the fill value, or 0 if there is none.
+ * @author Ed Hartnett
+ */
+static double
+accum_fill_value(int piotype, const void *fillvalue)
+{
+    if (!fillvalue)
+        return 0;
+    switch (piotype)
+    {
+    case PIO_INT:
+        return *(const int *)fillvalue;
+    case PIO_FLOAT:
+        return *(const float *)fillvalue;
+    default:
+        return *(const double *)fillvalue;
+    }
+}
+
+/**
+ * Send an array of a var to the IO tasks with the rearranger, and
+ * reduce it there with the arrays sent since the last
+ * PIOc_write_accumulated() of the var. The reduced array is kept on
+ * the IO tasks, in the layout of their IO buffer, and only written to
+ * the file by PIOc_write_accumulated(). This is how running means,
+ * minima and maxima of history fields are found on the IO tasks,
+ * instead of the computation tasks having to keep them. With async,
+ * the reductions are done by the IO tasks while the computation
+ * tasks go on.
+ *
+ * The reduction is done in double precision. Values equal to the
+ * fill value of the var are missing: they are not counted in the
+ * reduction of their element, and elements with no values are
+ * written as the fill value. The var must have the type of the
+ * decomposition, one of PIO_INT, PIO_FLOAT or PIO_DOUBLE.
+ *
+ * All the arrays of a var reduced together must use the same
+ * decomposition and reduction. This function must be called on all
+ * tasks of the IO system.
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param arraylen the length of the array. This should be at least
+ * the length of the local component of the distrubited array.
+ * @param array pointer to the data of this task. Ignored on the IO
+ * tasks with async.
+ * @param op the reduction, PIO_ACCUM_MEAN, PIO_ACCUM_SUM,
+ * PIO_ACCUM_MIN or PIO_ACCUM_MAX.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_accumulate_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
+                       int op)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Info about file we are writing to. */
+    io_desc_t *iodesc;     /* The IO description. */
+    var_desc_t *vdesc;     /* Info about the var being written. */
+    void *iobuf = NULL;    /* The rearranged data, on the IO tasks. */
+    void *tmparray;        /* The sorted data. */
+    char has_fill = 0;     /* True if there are missing values. */
+    char fillvalue[sizeof(double)]; /* The fill value. */
+    int mpierr = MPI_SUCCESS, mpierr2; /* Return code from MPI functions. */
+    int ierr;              /* Return code. */
+
+    PLOG((1, "PIOc_accumulate_darray ncid = %d varid = %d ioid = %d arraylen = %d op = %d",
+          ncid, varid, ioid, arraylen, op));
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Get decomposition and var information. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+    if ((ierr = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Check the reduction and the type. */
+    if (op < PIO_ACCUM_MEAN || op > PIO_ACCUM_MAX)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    if (iodesc->piotype != vdesc->pio_type ||
+        (iodesc->piotype != PIO_INT && iodesc->piotype != PIO_FLOAT &&
+         iodesc->piotype != PIO_DOUBLE))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    if (vdesc->accum_n && (op != vdesc->accum_op || ioid != vdesc->accum_ioid))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* The computation tasks check the file and array, and find the
+     * fill value. */
+    if (!ios->async || !ios->ioproc)
+    {
+        if ((ierr = check_write_darray(ncid, varid, ioid, arraylen, NULL, &file,
+                                       &iodesc, &vdesc)))
+            return ierr;
+        if ((has_fill = vdesc->fillvalue != NULL))
+            memcpy(fillvalue, vdesc->fillvalue, iodesc->piotype_size);
+    }
+
+    /* If async is in use, and this is not an IO task, send the
+     * parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_ACCUMULATE_DARRAY;
+            pio_msg_args args;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            pio_msg_args_init(&args, ios);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &ncid, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &varid, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &ioid, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &arraylen, 1, MPI_OFFSET);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &op, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_send(ios, &args);
+            pio_msg_args_free(&args);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+        /* Share the fill value, known only on computation tasks, with
+         * IO tasks. */
+        if ((mpierr = MPI_Bcast(&has_fill, 1, MPI_CHAR, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Bcast(fillvalue, iodesc->piotype_size, MPI_CHAR, ios->comproot,
+                                ios->my_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Get the accumulated values, if this is the first array. */
+    if (!vdesc->accum_n)
+    {
+        if (vdesc->accum && vdesc->accum_ioid != ioid)
+        {
+            pio_free(PIO_MEM_ACCUM, vdesc->accum);
+            vdesc->accum = NULL;
+        }
+        if (ios->ioproc && iodesc->llen > 0 && !vdesc->accum &&
+            !(vdesc->accum = pio_malloc(PIO_MEM_ACCUM, iodesc->llen *
+                                        (sizeof(double) + sizeof(int)))))
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        if (vdesc->accum)
+            memset((double *)vdesc->accum + iodesc->llen, 0, iodesc->llen * sizeof(int));
+        vdesc->accum_op = op;
+        vdesc->accum_ioid = ioid;
+        vdesc->accum_has_fill = has_fill;
+        vdesc->accum_fill = accum_fill_value(iodesc->piotype, has_fill ? fillvalue : NULL);
+    }
+
+    /* Move the data to the IO tasks, filling the holes of the BOX
+     * rearranger with missing values. */
+    if ((ierr = alloc_darray_iobuf(file, iodesc, 1, has_fill ? fillvalue : NULL, &iobuf)))
+        return ierr;
+    tmparray = array;
+    if (iodesc->needssort && (!ios->async || ios->compproc))
+    {
+        if (!(tmparray = malloc(arraylen * iodesc->piotype_size)))
+        {
+            pio_iobuf_free(ios, iobuf);
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+        pio_sorted_copy(array, tmparray, iodesc, 1, 0);
+    }
+    ierr = rearrange_comp2io(ios, iodesc, tmparray, iobuf, 1);
+    if (tmparray != array)
+        free(tmparray);
+    if (ierr)
+    {
+        pio_iobuf_free(ios, iobuf);
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+
+    /* Reduce it with the earlier arrays. */
+    if (ios->ioproc && iodesc->llen > 0)
+    {
+        double *acc = vdesc->accum;
+        int *cnt = (int *)(acc + iodesc->llen);
+
+        switch (iodesc->piotype)
+        {
+        case PIO_INT:
+            accumulate_int(iobuf, iodesc->llen, op, has_fill, vdesc->accum_fill, acc, cnt);
+            break;
+        case PIO_FLOAT:
+            accumulate_float(iobuf, iodesc->llen, op, has_fill, vdesc->accum_fill, acc, cnt);
+            break;
+        default:
+            accumulate_double(iobuf, iodesc->llen, op, has_fill, vdesc->accum_fill, acc, cnt);
+        }
+    }
+    if (iobuf)
+        pio_iobuf_free(ios, iobuf);
+    vdesc->accum_n++;
+    PLOG((2, "PIOc_accumulate_darray accum_n = %d", vdesc->accum_n));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the reduction of the arrays of a var accumulated by
+ * PIOc_accumulate_darray() to the file, at the record set with
+ * PIOc_setframe() for record vars, and start a new reduction.
+ *
+ * The reduced array is already on the IO tasks, so no data are sent
+ * by the computation tasks. This function must be called on all
+ * tasks of the IO system.
+ *
+ * @param ncid the ncid of the open netCDF file.
+ * @param varid the ID of the variable.
+ * @returns 0 for success, PIO_EINVAL if no arrays were accumulated,
+ * other non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_write_accumulated(int ncid, int varid)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Info about file we are writing to. */
+    io_desc_t *iodesc;     /* The IO description. */
+    var_desc_t *vdesc;     /* Info about the var being written. */
+    char fillvalue[sizeof(double)]; /* The fill value, in the type of the var. */
+    int mpierr = MPI_SUCCESS, mpierr2; /* Return code from MPI functions. */
+    int ierr;              /* Return code. */
+
+    PLOG((1, "PIOc_write_accumulated ncid = %d varid = %d", ncid, varid));
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Can we write to this file? */
+    if (!file->writable)
+        return pio_err(ios, file, PIO_EPERM, __FILE__, __LINE__);
+
+    /* Get the var, and the decomposition of its arrays. */
+    if ((ierr = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if (!vdesc->accum_n)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(vdesc->accum_ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+
+    /* If async is in use, and this is not an IO task, send the
+     * parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_WRITE_ACCUMULATED;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Get the fill value in the type of the var. */
+    switch (iodesc->piotype)
+    {
+    case PIO_INT:
+        *(int *)fillvalue = (int)vdesc->accum_fill;
+        break;
+    case PIO_FLOAT:
+        *(float *)fillvalue = (float)vdesc->accum_fill;
+        break;
+    default:
+        *(double *)fillvalue = vdesc->accum_fill;
+    }
+
+    /* If the buffer is already in use in pnetcdf we need to flush
+     * first. */
+    if (file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
+        if ((ierr = flush_output_buffer(file, 1, 0)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Put the reduced values in the IO buffer. */
+    if ((ierr = alloc_darray_iobuf(file, iodesc, 1, fillvalue, &file->iobuf)))
+        return ierr;
+    if (ios->ioproc && iodesc->llen > 0)
+    {
+        const double *acc = vdesc->accum;
+        const int *cnt = (const int *)(acc + iodesc->llen);
+
+        switch (iodesc->piotype)
+        {
+        case PIO_INT:
+            reduce_int(file->iobuf, iodesc->llen, vdesc->accum_op, vdesc->accum_fill, acc, cnt);
+            break;
+        case PIO_FLOAT:
+            reduce_float(file->iobuf, iodesc->llen, vdesc->accum_op, vdesc->accum_fill, acc, cnt);
+            break;
+        default:
+            reduce_double(file->iobuf, iodesc->llen, vdesc->accum_op, vdesc->accum_fill, acc,
+                          cnt);
+        }
+    }
+
+    /* The next array starts a new reduction. */
+    vdesc->accum_n = 0;
+
+    /* Write the data and any holes. */
+    return write_darray_iobuf(file, iodesc, &varid, 1, vdesc->ndims,
+                              vdesc->record >= 0 ? &vdesc->record : NULL,
+                              vdesc->accum_has_fill ? fillvalue : NULL, false);
+}
+
+/**
+ * Turn on the read cache of an IO system, or turn it off.
+ *
+ * With the cache on, each array read by PIOc_read_darray() from a
+ * file opened without PIO_WRITE is kept on the computation tasks,
+ * keyed by the file name, variable, record and decomposition. Reading
+ * the same array again, from this or a later open of the file, is
+ * served from the cache, with no file access and no rearrangement.
+ * This is meant for static fields (like grids and topography) read
+ * again and again by the same or different components.
+ *
+ * When a task would keep more than max_bytes, the least recently used
+ * arrays are dropped. The arrays of a file are dropped when a file of
+ * that name is created or opened with PIO_WRITE, and those of a
+ * decomposition when it is freed. If a file is changed outside of
+ * this IO system, call PIOc_clear_read_cache().
+ *
+ * A read is served from the cache only if it is in the cache of all
+ * computation tasks, which costs one MPI_Allreduce() on the
+ * computation tasks for each read. This function must be called on
+ * all computation tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param max_bytes the most bytes to keep on each task, or 0 to turn
+ * the cache off and free it.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_read_cache(int iosysid, PIO_Offset max_bytes)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_read_cache iosysid = %d max_bytes = %lld", iosysid, max_bytes));
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (max_bytes < 0)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    ios->read_cache_max = max_bytes;
+    if (!max_bytes)
+        pio_read_cache_clear(ios, NULL, -1);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Drop the arrays read from a file from the read cache of an IO
+ * system, see PIOc_set_read_cache(). This must be called on all
+ * computation tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param filename the name of the file, or NULL to empty the cache.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_clear_read_cache(int iosysid, const char *filename)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_clear_read_cache iosysid = %d filename = %s", iosysid,
+          filename ? filename : "(all)"));
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    pio_read_cache_clear(ios, filename, -1);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Drop arrays from the read cache of an IO system.
+ *
+ * @param ios pointer to the IO system info.
+ * @param fname drop the arrays of the file of this name, or NULL for
+ * any file.
+ * @param ioid drop the arrays of this decomposition, or -1 for any
+ * decomposition.
+ * @author Ed Hartnett
+ */
+void
+pio_read_cache_clear(iosystem_desc_t *ios, const char *fname, int ioid)
+{
+    pio_read_cache_entry **prev = &ios->read_cache;
+
+    while (*prev)
+    {
+        pio_read_cache_entry *e = *prev;
+
+        if ((!fname || !strcmp(e->fname, fname)) && (ioid < 0 || e->ioid == ioid))
+        {
+            *prev = e->next;
+            ios->read_cache_size -= e->size;
+            free(e->fname);
+            pio_free(PIO_MEM_READ_CACHE, e->data);
+            free(e);
+        }
+        else
+            prev = &e->next;
+    }
+}
+
+/**
+ * Find the record of a variable to use in the read cache key.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param framep pointer that gets the record, or -1.
+ * @returns true if reads of this variable may be cached.
+ * @author Ed Hartnett
+ */
+static bool
+read_cache_key(file_desc_t *file, int varid, int *framep)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    var_desc_t *vdesc;
+
+    if (!ios->read_cache_max || !ios->compproc || file->writable || !file->fname)
+        return false;
+    if (get_file_var_desc(file, varid, &vdesc))
+        return false;
+    *framep = vdesc->record;
+
+    return true;
+}
+
+/**
+ * Serve a read of PIOc_read_darray() from the read cache, if all
+ * computation tasks have the array. This is collective across the
+ * computation tasks.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param ioid the decomposition ID.
+ * @param array gets the data on a hit.
+ * @param hitp pointer that gets true if the array was in the cache.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+read_cache_get(file_desc_t *file, int varid, int ioid, void *array, bool *hitp)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    pio_read_cache_entry **prev, *e = NULL;
+    int frame;
+    int hit;
+    int mpierr;
+
+    *hitp = false;
+    if (!read_cache_key(file, varid, &frame))
+        return PIO_NOERR;
+
+    for (prev = &ios->read_cache; *prev; prev = &(*prev)->next)
+        if ((*prev)->varid == varid && (*prev)->ioid == ioid && (*prev)->frame == frame &&
+            !strcmp((*prev)->fname, file->fname))
+        {
+            e = *prev;
+            break;
+        }
+
+    /* The entry may have been dropped on some tasks. */
+    hit = e != NULL;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &hit, 1, MPI_INT, MPI_MIN, ios->comp_comm)))
+        return check_mpi(ios, file, mpierr, __FILE__, __LINE__);
+    if (!hit)
+        return PIO_NOERR;
+
+    /* Copy the data, and move the entry to the front of the list. */
+    if (e->size)
+        memcpy(array, e->data, e->size);
+    *prev = e->next;
+    e->next = ios->read_cache;
+    ios->read_cache = e;
+    *hitp = true;
+    PLOG((2, "read of varid %d frame %d ioid %d served from the read cache", varid, frame,
+          ioid));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Keep an array read by PIOc_read_darray() in the read cache, if it
+ * fits.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param ioid the decomposition ID.
+ * @param array the data.
+ * @param size size of the data in bytes.
+ * @author Ed Hartnett
+ */
+static void
+read_cache_put(file_desc_t *file, int varid, int ioid, const void *array, PIO_Offset size)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    pio_read_cache_entry *e;
+    int frame;
+
+    if (!read_cache_key(file, varid, &frame) || size > ios->read_cache_max)
+        return;
+
+    /* Drop the least recently used arrays until this one fits. */
+    while (ios->read_cache && ios->read_cache_size + size > ios->read_cache_max)
+    {
+        pio_read_cache_entry **last = &ios->read_cache;
+
+        while ((*last)->next)
+            last = &(*last)->next;
+        e = *last;
+        *last = NULL;
+        ios->read_cache_size -= e->size;
+        free(e->fname);
+        pio_free(PIO_MEM_READ_CACHE, e->data);
+        free(e);
+    }
+
+    /* Failing to keep the array is not an error. */
+    if (!(e = calloc(1, sizeof(pio_read_cache_entry))))
+        return;
+    if (!(e->fname = strdup(file->fname)) ||
+        (size && !(e->data = pio_malloc(PIO_MEM_READ_CACHE, size))))
+    {
+        free(e->fname);
+        free(e);
+        return;
+    }
+    e->varid = varid;
+    e->frame = frame;
+    e->ioid = ioid;
+    e->size = size;
+    if (size)
+        memcpy(e->data, array, size);
+    e->next = ios->read_cache;
+    ios->read_cache = e;
+    ios->read_cache_size += size;
+}
+
+/**
+ * Read a field from a file to the IO library using distributed
+ * arrays.
+ *
+ * @param ncid identifies the netCDF file.
+ * @param varid the variable ID to be read.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param arraylen this parameter is ignored. Nominally it is the
+ * length of the array to be read. This is the length of the
+ * distrubited array. That is, the length of the portion of the data
+ * that is on the processor. This is already known because it is in
+ * the decomposition.
+ * @param array pointer to the data to be read. This is a
+ * pointer to the distributed portion of the array that is on this
+ * processor.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen,
+                 void *array)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    io_desc_t *iodesc;     /* Pointer to IO description information. */
+    void *iobuf = NULL;    /* holds the data as read on the io node. */
+    size_t rlen = 0;       /* the length of data in iobuf. */
+    void *tmparray;        /* unsorted copy of array buf if required */
+    double start;          /* For the I/O statistics. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
+    int ierr;              /* Return code. */
+
+#ifdef USE_MPE
+    pio_start_mpe_log(DARRAY_READ);
+#endif /* USE_MPE */
+    PLOG((1, "PIOc_read_darray ncid %d varid %d ioid %d arraylen %ld ",
+          ncid, varid, ioid, arraylen));
+
+    /* Vars of gathered points use the gathered decomposition. */
+    ioid = find_darray_ioid(ncid, varid, ioid);
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_READ_DARRAY)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Serve the read from the read cache, if the array is there. */
+    if (ios->read_cache_max && !ios->device_buffers)
+    {
+        bool hit;
+
+        if ((ierr = read_cache_get(file, varid, ioid, array, &hit)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if (hit)
+        {
+#ifdef USE_MPE
+            pio_stop_mpe_log(DARRAY_READ, __func__);
+#endif /* USE_MPE */
+            if ((ierr = pio_stop_timer(ios, PIO_TIMER_READ_DARRAY)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            return PIO_NOERR;
+        }
+    }
+
+    /* If async is in use, and this is not an IO task, bcast the
+     * parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_READDARRAY;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            /* Send the function parameters and associated informaiton
+             * to the msg handler. */
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&arraylen, 1, MPI_OFFSET, ios->compmaster, ios->intercomm);
+            PLOG((2, "PIOc_read_darray ncid %d varid %d ioid %d arraylen %d",
+                  ncid, varid, ioid, arraylen));
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Get the iodesc. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+    pioassert(iodesc->rearranger == PIO_REARR_BOX || iodesc->rearranger == PIO_REARR_SUBSET,
+              "unknown rearranger", __FILE__, __LINE__);
+    if (iodesc->coarse_factor)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* iomaster (and, for subfiles, the first IO task of each
+     * subfile) needs max of buflen, others need local len */
+    if (pio_serial_root(ios, file))
+        rlen = iodesc->maxiobuflen;
+    else
+        rlen = iodesc->llen;
+
+    /* Allocate a buffer for one record. */
+    if (ios->ioproc && rlen > 0)
+        if (!(iobuf = pio_iobuf_alloc(ios, iodesc->mpitype_size * rlen)))
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Call the correct darray read function based on iotype. */
+    switch (file->iotype)
+    {
+    case PIO_IOTYPE_NETCDF:
+    case PIO_IOTYPE_NETCDF4C:
+        if ((ierr = pio_read_darray_nc_serial(file, iodesc, varid, iobuf)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        break;
+    case PIO_IOTYPE_PNETCDF:
+    case PIO_IOTYPE_NETCDF4P:
+        if ((ierr = pio_read_darray_nc(file, iodesc, varid, iobuf, NULL)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        break;
+    default:
+        return pio_err(NULL, NULL, PIO_EBADIOTYPE, __FILE__, __LINE__);
+    }
+
+    /* If the map is not monotonically increasing we will need to sort
+     * it. */
+    PLOG((3, "iodesc->needssort %d", iodesc->needssort));
+
+    if (iodesc->needssort && !ios->device_buffers)
+    {
+        if (!(tmparray = malloc(iodesc->piotype_size * iodesc->maplen)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    else
+        tmparray = array;
+
+    /* prefill the output array with 0 then overwrite from iobuf */
+    /*    switch(iodesc->piotype)
+      {
+      case PIO_SHORT:
+        for(int i=0; i<iodesc->maplen; i++)
+          ((short *) array)[i] = (short) 0;
+        break;
+      case PIO_INT:
+        for(int i=0; i<iodesc->maplen; i++)
+          ((int *) array)[i] = (int) 0;
+        break;
+      case PIO_FLOAT:
+        for(int i=0; i<iodesc->maplen; i++)
+          ((float *) array)[i] = (float) 0;
+        break;
+      case PIO_DOUBLE:
+        for(int i=0; i<iodesc->maplen; i++)
+          ((double *) array)[i] = (double) 0;
+        break;
+      default:
+        return PIO_EBADTYPE;
+      }
+    */
+
+    /* Rearrange the data. */
+    start = MPI_Wtime();
+    if (ios->device_buffers)
+        ierr = rearrange_io2comp_nocopy(ios, iodesc, iobuf, array);
+    else
+        ierr = rearrange_io2comp(ios, iodesc, iobuf, tmparray);
+    if (ierr)
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    pio_stats_add(file, iodesc, rearrange_time, MPI_Wtime() - start);
+    pio_stats_add(file, iodesc, io2comp_bytes, iodesc->ndof * iodesc->mpitype_size);
+
+    /* If we need to sort the map, do it. */
+    if (tmparray != array && ios->compproc)
+    {
+        pio_sorted_copy(tmparray, array, iodesc, 1, 1);
+        free(tmparray);
+    }
+
+    /* Free the buffer. */
+    if (rlen > 0)
+        pio_iobuf_free(ios, iobuf);
+
+    /* Keep the array, if the read cache is on. */
+    if (ios->read_cache_max && !ios->device_buffers)
+        read_cache_put(file, varid, ioid, array, iodesc->maplen * iodesc->piotype_size);
+
+#ifdef USE_MPE
+    pio_stop_mpe_log(DARRAY_READ, __func__);
+#endif /* USE_MPE */
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_READ_DARRAY)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    PLOG((2, "done with PIOc_read_darray()"));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the part of an IO region that is in a box.
+ *
+ * @param ndims the number of dims of the decomposition.
+ * @param region pointer to the region.
+ * @param start the start of the box.
+ * @param count the count of the box.
+ * @param lo gets the start of the part.
+ * @param hi gets the end (exclusive) of the part.
+ * @returns the number of elements of the part.
+ * @author Ed Hartnett
+ */
+static PIO_Offset
+clip_region(int ndims, const io_region *region, const PIO_Offset *start,
+            const PIO_Offset *count, PIO_Offset *lo, PIO_Offset *hi)
+{
+    PIO_Offset size = 1;
+
+    for (int d = 0; d < ndims; d++)
+    {
+        lo[d] = max(region->start[d], start[d]);
+        hi[d] = min(region->start[d] + region->count[d], start[d] + count[d]);
+        size *= hi[d] > lo[d] ? hi[d] - lo[d] : 0;
+    }
+
+    return size;
+}
+
+/**
+ * Make the list of the parts of the IO regions of a decomposition
+ * that are in a box, for PIOc_read_darray_subset(). The data of the
+ * parts are one after the other, in the order of the regions.
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition.
+ * @param start the start of the box.
+ * @param count the count of the box.
+ * @param firstp pointer that gets the list of parts, NULL if there
+ * are none.
+ * @param nregionsp pointer that gets the number of parts.
+ * @param lenp pointer that gets the number of elements of the parts.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+clip_regions(iosystem_desc_t *ios, io_desc_t *iodesc, const PIO_Offset *start,
+             const PIO_Offset *count, io_region **firstp, int *nregionsp,
+             PIO_Offset *lenp)
+{
+    io_region *region = iodesc->firstregion;
+    io_region **next = firstp;
+    int ndims = iodesc->ndims;
+    int ret;
+
+    *firstp = NULL;
+    *nregionsp = 0;
+    *lenp = 0;
+    if (!iodesc->llen)
+        return PIO_NOERR;
+
+    for (int r = 0; r < iodesc->maxregions && region; r++, region = region->next)
+    {
+        PIO_Offset lo[ndims + 1], hi[ndims + 1];
+        PIO_Offset size;
+
+        if (!(size = clip_region(ndims, region, start, count, lo, hi)))
+            continue;
+        if ((ret = alloc_region2(ios, ndims, next)))
+            return ret;
+        for (int d = 0; d < ndims; d++)
+        {
+            (*next)->start[d] = lo[d];
+            (*next)->count[d] = hi[d] - lo[d];
         }
+        (*next)->loffset = (int)*lenp;
+        *lenp += size;
+        (*nregionsp)++;
+        next = &(*next)->next;
     }
 
     return PIO_NOERR;
 }
 
 /**
- * Find the fillvalue that should be used for a variable.
+ * Copy the parts of the IO regions read by PIOc_read_darray_subset()
+ * to their places in the regions, a row of the last dim at a time.
  *
- * @param file Info about file we are writing to.
- * @param varid the variable ID.
- * @param vdesc pointer to var_desc_t info for this var.
- * @returns 0 for success, non-zero error code for failure.
- * @ingroup PIO_write_darray_c
+ * @param iodesc pointer to the decomposition.
+ * @param start the start of the box.
+ * @param count the count of the box.
+ * @param cbuf the data of the parts, see clip_regions().
+ * @param iobuf the buffer of the regions.
+ * @author Ed Hartnett
+ */
+static void
+expand_clipped(io_desc_t *iodesc, const PIO_Offset *start, const PIO_Offset *count,
+               const void *cbuf, void *iobuf)
+{
+    io_region *region = iodesc->firstregion;
+    int ndims = iodesc->ndims;
+    size_t tsize = iodesc->mpitype_size;
+    PIO_Offset coffset = 0;
+
+    if (!iodesc->llen)
+        return;
+
+    for (int r = 0; r < iodesc->maxregions && region; r++, region = region->next)
+    {
+        PIO_Offset lo[ndims + 1], hi[ndims + 1], idx[ndims + 1];
+        PIO_Offset size, rowlen;
+
+        if (!(size = clip_region(ndims, region, start, count, lo, hi)))
+            continue;
+        rowlen = ndims ? hi[ndims - 1] - lo[ndims - 1] : 1;
+        memcpy(idx, lo, ndims * sizeof(PIO_Offset));
+
+        for (PIO_Offset done = 0; done < size; done += rowlen)
+        {
+            PIO_Offset offset = 0;
+
+            for (int d = 0; d < ndims; d++)
+                offset = offset * region->count[d] + idx[d] - region->start[d];
+            memcpy((char *)iobuf + (region->loffset + offset) * tsize,
+                   (char *)cbuf + (coffset + done) * tsize, rowlen * tsize);
+
+            /* Move to the next row. */
+            for (int d = ndims - 2; d >= 0; d--)
+            {
+                if (++idx[d] < hi[d])
+                    break;
+                idx[d] = lo[d];
+            }
+        }
+        coffset += size;
+    }
+}
+
+/**
+ * Is an element of a decomposition map in a box?
+ *
+ * @param iodesc pointer to the decomposition.
+ * @param idx the 1-based global index of the element, 0 for a hole.
+ * @param start the start of the box.
+ * @param count the count of the box.
+ * @returns true if the element is in the box.
+ * @author Ed Hartnett
+ */
+static bool
+map_in_box(io_desc_t *iodesc, PIO_Offset idx, const PIO_Offset *start,
+           const PIO_Offset *count)
+{
+    if (idx <= 0)
+        return false;
+
+    idx--;
+    for (int d = iodesc->ndims - 1; d >= 0; d--)
+    {
+        PIO_Offset i = idx % iodesc->dimlen[d];
+
+        if (i < start[d] || i >= start[d] + count[d])
+            return false;
+        idx /= iodesc->dimlen[d];
+    }
+
+    return true;
+}
+
+/**
+ * Read the part of a field in a box, with distributed arrays.
+ *
+ * This is like PIOc_read_darray(), but only the elements of the
+ * decomposition that are in the box given by start and count are
+ * read; the other elements of array are not changed. The IO tasks
+ * read only the parts of their IO regions that are in the box, so
+ * reading a small window of a global field costs about as much as
+ * the window. The data are moved to the computation tasks with the
+ * rearranger of the decomposition.
+ *
+ * The box is in the dimensions of the decomposition; for a record
+ * variable the record is set with PIOc_setframe(), as for
+ * PIOc_read_darray().
+ *
+ * Async is not supported, nor are decompositions whose map was
+ * released (see PIOc_set_map_release()), coarse decompositions, and
+ * vars of gathered points (see PIOc_init_decomp_gathered()); for
+ * those PIO_EINVAL is returned.
+ *
+ * @param ncid identifies the netCDF file.
+ * @param varid the variable ID to be read.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param start array of the start of the box, one value for each
+ * dimension of the decomposition.
+ * @param count array of the count of the box.
+ * @param arraylen this parameter is ignored, as in
+ * PIOc_read_darray().
+ * @param array pointer to the data to be read, the distributed
+ * portion of the array that is on this processor.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray_c
  * @author Ed Hartnett
  */
 int
-find_var_fillvalue(file_desc_t *file, int varid, var_desc_t *vdesc)
+PIOc_read_darray_subset(int ncid, int varid, int ioid, const PIO_Offset *start,
+                        const PIO_Offset *count, PIO_Offset arraylen, void *array)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
-    int pio_type;
-    PIO_Offset type_size;
-    int no_fill;
-    int ierr;
+    file_desc_t *file;     /* Pointer to file information. */
+    io_desc_t *iodesc;     /* Pointer to IO description information. */
+    io_desc_t win;         /* The decomposition, cut to the box. */
+    io_region *clipped = NULL; /* The parts of the IO regions in the box. */
+    int nclipped = 0;      /* The number of parts. */
+    PIO_Offset clen = 0;   /* The number of elements of the parts. */
+    bool cut;              /* True if the regions are cut to the box. */
+    void *cbuf = NULL;     /* The data as read on the io node. */
+    void *iobuf = NULL;    /* The data in the layout of the regions. */
+    void *tmparray = NULL; /* The data as rearranged. */
+    size_t rlen;           /* The length of cbuf. */
+    int mpierr;            /* Return code from MPI function calls. */
+    int ierr;              /* Return code. */
 
-    /* Check inputs. */
-    pioassert(file && file->iosystem && vdesc, "invalid input", __FILE__, __LINE__);
+    PLOG((1, "PIOc_read_darray_subset ncid %d varid %d ioid %d arraylen %ld",
+          ncid, varid, ioid, arraylen));
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
     ios = file->iosystem;
 
-    PLOG((3, "find_var_fillvalue file->pio_ncid = %d varid = %d", file->pio_ncid, varid));
+    /* Get the iodesc. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Find out PIO data type of var. */
-    if ((ierr = PIOc_inq_vartype(file->pio_ncid, varid, &pio_type)))
-        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    /* The map tells which elements are in the box. The box is in the
+     * dimensions of the decomposition, so vars of gathered points
+     * can't be read. */
+    if (ios->async || !start || !count || !iodesc->map || iodesc->coarse_factor ||
+        find_darray_ioid(ncid, varid, ioid) != ioid)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    for (int d = 0; d < iodesc->ndims; d++)
+        if (start[d] < 0 || count[d] < 0 || start[d] + count[d] > iodesc->dimlen[d])
+            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* Find out length of type. */
-    if ((ierr = PIOc_inq_type(file->pio_ncid, pio_type, NULL, &type_size)))
-        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-    PLOG((3, "getting fill value for varid = %d pio_type = %d type_size = %d",
-          varid, pio_type, type_size));
+    /* The read is done with a copy of the decomposition that has the
+     * parts of the IO regions in the box. Checkpoint files are read
+     * whole. */
+    win = *iodesc;
+    cut = !file->ckpt_nfiles;
+    if (cut)
+    {
+        if (ios->ioproc)
+        {
+            int red[3];    /* Reduced over the IO tasks with MPI_MAX. */
 
-    /* Allocate storage for the fill value. */
-    if (!(vdesc->fillvalue = malloc(type_size)))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+            ierr = clip_regions(ios, iodesc, start, count, &clipped, &nclipped, &clen);
 
-    /* Get the fill mode and value, if fill mode is on (which is will
-     * not be, because it is turned off at open/create). */
-    if ((ierr = PIOc_inq_var_fill(file->pio_ncid, varid, &no_fill, vdesc->fillvalue)))
-        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-    vdesc->use_fill = no_fill ? 0 : 1;
-    PLOG((3, "vdesc->use_fill = %d", vdesc->use_fill));
+            /* All IO tasks take part, even if the clip failed on
+             * some. The error codes are negative. */
+            red[0] = nclipped;
+            red[1] = (int)clen;
+            red[2] = -ierr;
+            if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, red, 3, MPI_INT, MPI_MAX, ios->io_comm)))
+            {
+                free_region_list(clipped);
+                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+            }
+            win.firstregion = clipped;
+            win.llen = clen;
+            win.rllen = clen;
+            win.maxregions = max(red[0], 1);
+            win.maxiobuflen = red[1];
+            ierr = -red[2];
+            for (int f = 0; f < 2; f++)
+            {
+                win.vard_type[f] = MPI_DATATYPE_NULL;
+                win.vard_fndims[f] = 0;
+            }
+        }
 
-    /* Get the fill value one would expect, if NOFILL were not turned
-     * on. */
-    if (!vdesc->use_fill)
-        if ((ierr = pio_inq_var_fill_expected(file->pio_ncid, varid, pio_type, type_size,
-                                              vdesc->fillvalue)))
-            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+        /* The computation tasks must not wait for the data. */
+        if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        {
+            free_region_list(clipped);
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        }
+        if (ierr)
+        {
+            free_region_list(clipped);
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        }
+    }
+
+    /* Allocate the buffers. */
+    if (ios->ioproc)
+    {
+        rlen = pio_serial_root(ios, file) ? win.maxiobuflen : win.llen;
+        if (rlen > 0 && !(cbuf = malloc(iodesc->mpitype_size * rlen)))
+            ierr = PIO_ENOMEM;
+        if (!cut)
+            iobuf = cbuf;
+        else if (!ierr && iodesc->llen > 0 &&
+                 !(iobuf = calloc(iodesc->llen, iodesc->mpitype_size)))
+            ierr = PIO_ENOMEM;
+        if (ierr)
+        {
+            free(cbuf);
+            free_region_list(clipped);
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        }
+    }
+
+    /* Read the parts. */
+    switch (file->iotype)
+    {
+    case PIO_IOTYPE_NETCDF:
+    case PIO_IOTYPE_NETCDF4C:
+        ierr = pio_read_darray_nc_serial(file, &win, varid, cbuf);
+        break;
+    case PIO_IOTYPE_PNETCDF:
+    case PIO_IOTYPE_NETCDF4P:
+        ierr = pio_read_darray_nc(file, &win, varid, cbuf, NULL);
+        break;
+    default:
+        ierr = PIO_EBADIOTYPE;
+    }
+    if (cut)
+    {
+        for (int f = 0; f < 2; f++)
+            if (win.vard_fndims[f] && win.vard_type[f] != MPI_DATATYPE_NULL)
+                MPI_Type_free(&win.vard_type[f]);
+        free_region_list(clipped);
+        if (!ierr && ios->ioproc)
+            expand_clipped(iodesc, start, count, cbuf, iobuf);
+        free(cbuf);
+    }
+    if (ierr)
+    {
+        free(iobuf);
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+
+    /* Rearrange the data, and keep the elements in the box. */
+    if (ios->compproc && !(tmparray = malloc(iodesc->piotype_size * iodesc->maplen + 1)))
+    {
+        free(iobuf);
+        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    ierr = rearrange_io2comp(ios, iodesc, iobuf, tmparray);
+    free(iobuf);
+    if (ierr)
+    {
+        free(tmparray);
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+    if (ios->compproc)
+        for (int m = 0; m < iodesc->maplen; m++)
+            if (map_in_box(iodesc, iodesc->map[m], start, count))
+                memcpy((char *)array + (PIO_Offset)(iodesc->remap ? iodesc->remap[m] : m) *
+                       iodesc->piotype_size, (char *)tmparray + (PIO_Offset)m *
+                       iodesc->piotype_size, iodesc->piotype_size);
+    free(tmparray);
 
     return PIO_NOERR;
 }
 
 /**
- * Write a distributed array to the output file.
- *
- * This routine aggregates output on the compute nodes and only sends
- * it to the IO nodes when the compute buffer is full or when a flush
- * is triggered.
+ * Read several fields that share a decomposition from a file, with
+ * distributed arrays.
  *
- * Internally, this function will:
- * <ul>
- * <li>Locate info about this file, decomposition, and variable.
- * <li>If we don't have a fillvalue for this variable, determine one
- * and remember it for future calls.
- * <li>Initialize or find the multi_buffer for this record/var.
- * <li>Find out how much free space is available in the multi buffer
- * and flush if needed.
- * <li>Store the new user data in the mutli buffer.
- * <li>If needed (only for subset rearranger), fill in gaps in data
- * with fillvalue.
- * <li>Remember the frame value (i.e. record number) of this data if
- * there is one.
- * </ul>
+ * This does the work of nvars calls to PIOc_read_darray(), but the
+ * data of all the variables are moved from the IO tasks to the
+ * compute tasks in one rearrangement, and with pnetcdf the reads of
+ * all the variables are posted and completed with one
+ * ncmpi_wait_all() call.
  *
- * NOTE: The write multi buffer wmulti_buffer is the cache on compute
- * nodes that will collect and store multiple variables before sending
- * them to the io nodes. Aggregating variables in this way leads to a
- * considerable savings in communication expense. Variables in the wmb
- * array must have the same decomposition and base data size and we
- * also need to keep track of whether each is a recordvar (has an
- * unlimited dimension) or not.
+ * The variables are read at their current frame, as set with
+ * PIOc_setframe().
  *
- * @param ncid the ncid of the open netCDF file.
- * @param varid the ID of the variable that these data will be written
- * to.
+ * @param ncid identifies the netCDF file.
+ * @param varids an array of length nvars with the IDs of the
+ * variables to be read.
  * @param ioid the I/O description ID as passed back by
  * PIOc_InitDecomp().
- * @param arraylen the length of the array to be written. This should
- * be at least the length of the local component of the distrubited
- * array. (Any values beyond length of the local component will be
- * ignored.)
- * @param array pointer to an array of length arraylen with the data
- * to be written. This is a pointer to the distributed portion of the
- * array that is on this task.
- * @param fillvalue pointer to the fill value to be used for missing
- * data.
- * @returns 0 for success, non-zero error code for failure.
- * @ingroup PIO_write_darray_c
- * @author Jim Edwards, Ed Hartnett
+ * @param nvars the number of variables to be read.
+ * @param arraylen the length of the array of one variable. Must be
+ * at least the length of the decomposition on this task.
+ * @param array pointer to the data to be read, nvars arrays of
+ * length arraylen, one after the other.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_read_darray_c
+ * @author Ed Hartnett
  */
 int
-PIOc_write_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
-                  void *fillvalue)
+PIOc_read_darray_multi(int ncid, const int *varids, int ioid, int nvars,
+                       PIO_Offset arraylen, void *array)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
-    file_desc_t *file;     /* Info about file we are writing to. */
-    io_desc_t *iodesc;     /* The IO description. */
-    var_desc_t *vdesc;     /* Info about the var being written. */
-    void *bufptr;          /* A data buffer. */
-    wmulti_buffer *wmb;    /* The write multi buffer for one or more vars. */
-    int needsflush = 0;    /* True if we need to flush buffer. */
-    void *realloc_data = NULL;
-    int hashid;
-    int mpierr = MPI_SUCCESS;  /* Return code from MPI functions. */
-    int ierr = PIO_NOERR;      /* Return code. */
-    size_t io_data_size;          /* potential size of data on io task */
+    file_desc_t *file;     /* Pointer to file information. */
+    io_desc_t *iodesc;     /* Pointer to IO description information. */
+    void *iobuf = NULL;    /* holds the data as read on the io node. */
+    size_t rlen = 0;       /* the length of data in iobuf. */
+    void *tmparray;        /* unsorted copy of array buf if required */
+    double start;          /* For the I/O statistics. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
+    int ierr;              /* Return code. */
 
-    PLOG((1, "PIOc_write_darray ncid = %d varid = %d ioid = %d arraylen = %d",
-          ncid, varid, ioid, arraylen));
-#ifdef USE_MPE
-    pio_start_mpe_log(DARRAY_WRITE);
-#endif /* USE_MPE */
+    PLOG((1, "PIOc_read_darray_multi ncid %d ioid %d nvars %d arraylen %ld",
+          ncid, ioid, nvars, arraylen));
+
+    /* Vars of gathered points use the gathered decomposition. */
+    if (varids && nvars > 0)
+        ioid = find_darray_ioid(ncid, varids[0], ioid);
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
     ios = file->iosystem;
 
-    /* Can we write to this file? */
-    if (!file->writable)
-        return pio_err(ios, file, PIO_EPERM, __FILE__, __LINE__);
-
-    /* Get decomposition information. */
-    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
-        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+    /* Check inputs. */
+    if (nvars <= 0 || !varids)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
 
-    pioassert(iodesc->readonly == 0,"Multiple sources in map for a single destination",__FILE__,__LINE__);
+    /* If async is in use, and this is not an IO task, send the
+     * parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_READDARRAYMULTI;
+            pio_msg_args args;
 
-    /* Check that the local size of the variable passed in matches the
-     * size expected by the io descriptor. Fail if arraylen is too
-     * small, just put a warning in the log if it is too big (the
-     * excess values will be ignored.) */
-    if (arraylen < iodesc->ndof)
-        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
-    PLOG((2, "%s arraylen = %d iodesc->ndof = %d",
-          (iodesc->ndof != arraylen) ? "WARNING: iodesc->ndof != arraylen" : "",
-          arraylen, iodesc->ndof));
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
 
-    /* Get var description. */
-    if ((ierr = get_var_desc(varid, &file->varlist, &vdesc)))
-        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            /* Send the function parameters and associated informaiton
+             * to the msg handler in one message. */
+            pio_msg_args_init(&args, ios);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &ncid, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &nvars, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, varids, nvars, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &ioid, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &arraylen, 1, MPI_OFFSET);
+            if (!mpierr)
+                mpierr = pio_msg_args_send(ios, &args);
+            pio_msg_args_free(&args);
+        }
 
-    /* If the type of the var doesn't match the type of the
-     * decomposition, return an error. */
-    /* if (iodesc->piotype != vdesc->pio_type) */
-    /*     return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__); */
-    /* pioassert(iodesc->mpitype_size == vdesc->mpi_type_size, "wrong mpi info", */
-    /*           __FILE__, __LINE__); */
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
 
-    /* If we don't know the fill value for this var, get it. */
-    if (!vdesc->fillvalue)
-        if ((ierr = find_var_fillvalue(file, varid, vdesc)))
-            return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+    /* Get the iodesc. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+    pioassert(iodesc->rearranger == PIO_REARR_BOX || iodesc->rearranger == PIO_REARR_SUBSET,
+              "unknown rearranger", __FILE__, __LINE__);
+    if (ios->compproc && arraylen < iodesc->ndof)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* Check that if the user passed a fill value, it is correct. If
-     * use_fill is false, then find_var_fillvalue will not end up
-     * getting a fill value. */
-    if (fillvalue && vdesc->use_fill)
-        if (memcmp(fillvalue, vdesc->fillvalue, vdesc->pio_type_size))
-            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    /* iomaster (and, for subfiles, the first IO task of each
+     * subfile) needs max of buflen, others need local len. The data
+     * of variable v start at v * llen; the serial root uses the space
+     * of the variables not yet read while reading. */
+    if (pio_serial_root(ios, file))
+        rlen = iodesc->maxiobuflen;
+    else
+        rlen = iodesc->llen;
 
-    /* Move to end of list or the entry that matches this ioid. */
-    hashid = ioid * 10 + vdesc->rec_var;
-    HASH_FIND_INT( file->buffer, &hashid, wmb);
-    if (wmb)
-        PLOG((3, "wmb->ioid = %d wmb->recordvar = %d", wmb->ioid, wmb->recordvar));
+    /* Allocate a buffer for one record of each variable. */
+    if (ios->ioproc && rlen > 0)
+        if (!(iobuf = pio_iobuf_alloc(ios, iodesc->mpitype_size *
+                                      ((nvars - 1) * iodesc->llen + rlen))))
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
 
-    /* If we did not find an existing wmb entry, create a new wmb. */
-    if (!wmb)
+    /* Read the data of each variable. The buffer is freed if this
+     * fails. */
+    switch (file->iotype)
     {
-        /* Allocate a buffer. */
-        if (!(wmb = malloc(sizeof(wmulti_buffer))))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    case PIO_IOTYPE_NETCDF:
+    case PIO_IOTYPE_NETCDF4C:
+        for (int v = 0; !ierr && v < nvars; v++)
+            ierr = pio_read_darray_nc_serial(file, iodesc, varids[v], iobuf ?
+                                             (char *)iobuf + v * iodesc->llen *
+                                             iodesc->mpitype_size : NULL);
+        break;
+    case PIO_IOTYPE_PNETCDF:
+    case PIO_IOTYPE_NETCDF4P:
+    {
+        int getreqs[nvars];
 
-        /* Set pointer to newly allocated buffer and initialize.*/
-        wmb->recordvar = vdesc->rec_var;
-        wmb->ioid = ioid;
-        wmb->num_arrays = 0;
-        wmb->arraylen = arraylen;
-        wmb->vid = NULL;
-        wmb->data = NULL;
-        wmb->frame = NULL;
-        wmb->fillvalue = NULL;
-        wmb->htid = hashid;
-        HASH_ADD_INT( file->buffer, htid, wmb );
-    }
-    PLOG((2, "wmb->num_arrays = %d arraylen = %d iodesc->mpitype_size = %d\n",
-          wmb->num_arrays, arraylen, iodesc->mpitype_size));
+        /* With pnetcdf the reads are only posted here. */
+        for (int v = 0; !ierr && v < nvars; v++)
+            ierr = pio_read_darray_nc(file, iodesc, varids[v], iobuf ?
+                                      (char *)iobuf + v * iodesc->llen *
+                                      iodesc->mpitype_size : NULL,
+                                      file->iotype == PIO_IOTYPE_PNETCDF ?
+                                      &getreqs[v] : NULL);
+#ifdef _PNETCDF
+        if (!ierr && file->iotype == PIO_IOTYPE_PNETCDF && ios->ioproc)
+        {
+            int status[nvars];
 
-    /* Try realloc first and call flush if realloc fails. */
-    if (arraylen > 0)
+            start = MPI_Wtime();
+            if (!(ierr = pio_start_timer(ios, PIO_TIMER_WAIT_ALL)))
+                ierr = ncmpi_wait_all(file->fh, nvars, getreqs, status);
+            if (!ierr)
+                ierr = pio_stop_timer(ios, PIO_TIMER_WAIT_ALL);
+            file->stats.nwaits++;
+            file->stats.wait_time += MPI_Wtime() - start;
+            if (ierr)
+                ierr = check_netcdf(file, ierr, __FILE__, __LINE__);
+        }
+#endif /* _PNETCDF */
+    }
+        break;
+    default:
+        ierr = PIO_EBADIOTYPE;
+    }
+    if (ierr)
     {
-        size_t data_size = (1 + wmb->num_arrays) * arraylen * iodesc->mpitype_size;
+        pio_iobuf_free(ios, iobuf);
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
 
-        if ((realloc_data = realloc(wmb->data, data_size)))
+    /* Unless the data can be received straight into array, receive
+     * them in a buffer with the arrays of the variables ndof
+     * apart. */
+    if (ios->compproc && (iodesc->needssort || arraylen != iodesc->ndof) && iodesc->ndof > 0)
+    {
+        if (!(tmparray = malloc(iodesc->piotype_size * iodesc->ndof * nvars)))
         {
-            needsflush = 0;
-            wmb->data = realloc_data;
+            pio_iobuf_free(ios, iobuf);
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
         }
-        else /* Failed to realloc, but wmb->data is still valid for a flush. */
+    }
+    else
+        tmparray = array;
+
+    /* Rearrange the data of all the variables at once. */
+    start = MPI_Wtime();
+    if ((ierr = rearrange_io2comp_multi(ios, iodesc, iobuf, tmparray, nvars)))
+    {
+        if (tmparray != array)
+            free(tmparray);
+        pio_iobuf_free(ios, iobuf);
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+    pio_stats_add(file, iodesc, rearrange_time, MPI_Wtime() - start);
+    pio_stats_add(file, iodesc, io2comp_bytes, nvars * iodesc->ndof * iodesc->mpitype_size);
+
+    /* Sort the data, or move them to their place in array. */
+    if (tmparray != array)
+    {
+        for (int v = 0; v < nvars; v++)
         {
-            needsflush = 1;
+            char *src = (char *)tmparray + v * iodesc->ndof * iodesc->piotype_size;
+            char *dst = (char *)array + v * arraylen * iodesc->piotype_size;
+
+            if (iodesc->needssort)
+                pio_sorted_copy(src, dst, iodesc, 1, 1);
+            else
+                memcpy(dst, src, iodesc->ndof * iodesc->piotype_size);
         }
-        PLOG((2, "realloc attempted to get %ld bytes for data, needsflush %d", data_size,
-              needsflush));
+        free(tmparray);
     }
 
-    /* the limit of data_size < INT_MAX is due to a bug in ROMIO which limits
-       the size of contiguous data to INT_MAX, a fix has been proposed in
-       https://github.com/pmodels/mpich/pull/2888 */
-    io_data_size = (1 + wmb->num_arrays) * iodesc->maxiobuflen * iodesc->mpitype_size;
-    if(io_data_size > INT_MAX)
-        needsflush = 2;
+    /* Free the buffer. */
+    if (iobuf)
+        pio_iobuf_free(ios, iobuf);
 
-    /* Tell all tasks on the computation communicator whether we need
-     * to flush data. */
-    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &needsflush, 1,  MPI_INT,  MPI_MAX,
-                                ios->comp_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    PLOG((2, "needsflush = %d", needsflush));
+    PLOG((2, "done with PIOc_read_darray_multi()"));
 
-    /* Flush data if needed. */
-    if (needsflush > 0)
-    {
-        /* If needsflush == 2 flush to disk otherwise just flush to io
-         * node. This will cause PIOc_write_darray_multi() to be
-         * called. */
-        if ((ierr = flush_buffer(ncid, wmb, needsflush == 2)))
-            return pio_err(ios, file, ierr, __FILE__, __LINE__);
-    }
+    return PIO_NOERR;
+}
+
+/**
+ * Free a non-blocking darray request and its buffers. The request
+ * must not be in the hash table of the file.
+ *
+ * @param ios pointer to the IO system info.
+ * @param req pointer to the request.
+ * @author Ed Hartnett
+ */
+static void
+free_darray_req(iosystem_desc_t *ios, darray_req_t *req)
+{
+    free(req->reqs);
+    free(req->sbuf);
+    free(req->fillvalue);
+    pio_iobuf_free(ios, req->iobuf);
+    free(req);
+}
+
+/**
+ * Start a non-blocking write of a distributed array to the output
+ * file.
+ *
+ * The data are copied (and sorted, if the decomposition needs it),
+ * and the messages that move them from the compute tasks to the IO
+ * tasks are posted, but not waited for. The caller may change or free
+ * array as soon as this function returns, and go on computing while
+ * the data are in flight. PIOc_wait_darray() completes the messages
+ * and writes the data to the file. Requests not waited for are
+ * completed by PIOc_sync() and PIOc_closefile().
+ *
+ * Like PIOc_write_darray(), this function must be called on all tasks
+ * of the IO system. PIOc_wait_darray() must also be called on all
+ * tasks, for the same requests, in the same order.
+ *
+ * If async is in use, the data are written with PIOc_write_darray()
+ * and PIO_REQ_NULL is returned in request.
+ *
+ * @param ncid identifies the netCDF file.
+ * @param varid the variable ID to be written.
+ * @param ioid the I/O description ID as passed back by
+ * PIOc_InitDecomp().
+ * @param arraylen the length of the array to be written.
+ * @param array pointer to the data to be written.
+ * @param fillvalue pointer to the fill value to be used for missing
+ * data. May be NULL.
+ * @param request pointer that gets the ID of the request.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_iwrite_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
+                   void *fillvalue, int *request)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Info about file we are writing to. */
+    io_desc_t *iodesc;     /* The IO description. */
+    var_desc_t *vdesc;     /* Info about the var being written. */
+    darray_req_t *req;     /* The new request. */
+    int ierr;              /* Return code. */
+
+    PLOG((1, "PIOc_iwrite_darray ncid = %d varid = %d ioid = %d arraylen = %d",
+          ncid, varid, ioid, arraylen));
+
+    /* Vars of gathered points use the gathered decomposition. */
+    ioid = find_darray_ioid(ncid, varid, ioid);
+
+    /* Find and check the file, decomposition and variable. */
+    if ((ierr = check_write_darray(ncid, varid, ioid, arraylen, fillvalue, &file,
+                                   &iodesc, &vdesc)))
+        return ierr;
+    ios = file->iosystem;
+
+    if (!request)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* Try realloc again if there is a flush. */
-    if (arraylen > 0 && needsflush > 0)
+    /* With async the data are sent to the IO tasks by message. */
+    if (ios->async)
     {
-        if (!(wmb->data = realloc(wmb->data, (1 + wmb->num_arrays) * arraylen * iodesc->mpitype_size)))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-        PLOG((2, "after a flush, realloc got %ld bytes for data", (1 + wmb->num_arrays) * arraylen * iodesc->mpitype_size));
+        *request = PIO_REQ_NULL;
+        return PIOc_write_darray(ncid, varid, ioid, arraylen, array, fillvalue);
     }
 
-    /* vid is an array of variable ids in the wmb list, grow the list
-     * and add the new entry. */
-    if (!(wmb->vid = realloc(wmb->vid, sizeof(int) * (1 + wmb->num_arrays))))
+    /* Allocate the request. */
+    if (!(req = calloc(1, sizeof(darray_req_t))))
         return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    req->reqid = file->next_darray_reqid++;
+    req->ioid = ioid;
+    req->varid = varid;
+    req->frame = vdesc->record;
 
-    /* wmb->frame is the record number, we assume that the variables
-     * in the wmb list may not all have the same unlimited dimension
-     * value although they usually do. */
-    if (vdesc->record >= 0)
-        if (!(wmb->frame = realloc(wmb->frame, sizeof(int) * (1 + wmb->num_arrays))))
+    /* Remember the fill value, if needed. */
+    if (iodesc->needsfill && vdesc->fillvalue)
+    {
+        if (!(req->fillvalue = malloc(iodesc->mpitype_size)))
+        {
+            free_darray_req(ios, req);
             return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+        memcpy(req->fillvalue, vdesc->fillvalue, iodesc->mpitype_size);
+    }
 
-    /* If we need a fill value, get it. If we are using the subset
-     * rearranger and not using the netcdf fill mode then we need to
-     * do an extra write to fill in the holes with the fill value. */
-    if (iodesc->needsfill)
+    /* Copy the data, so the caller can reuse array right away. */
+    if (iodesc->ndof > 0)
     {
-        /* Get memory to hold fill value. */
-        if (!(wmb->fillvalue = realloc(wmb->fillvalue, iodesc->mpitype_size * (1 + wmb->num_arrays))))
+        if (!(req->sbuf = malloc(iodesc->ndof * iodesc->mpitype_size)))
+        {
+            free_darray_req(ios, req);
             return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-
-        memcpy((char *)wmb->fillvalue + iodesc->mpitype_size * wmb->num_arrays,
-               vdesc->fillvalue, iodesc->mpitype_size);
+        }
+        if (iodesc->needssort)
+            pio_sorted_copy(array, req->sbuf, iodesc, 1, 0);
+        else
+            memcpy(req->sbuf, array, iodesc->ndof * iodesc->mpitype_size);
     }
 
-    /* Tell the buffer about the data it is getting. */
-    wmb->arraylen = arraylen;
-    wmb->vid[wmb->num_arrays] = varid;
-    PLOG((3, "wmb->num_arrays = %d wmb->vid[wmb->num_arrays] = %d", wmb->num_arrays,
-          wmb->vid[wmb->num_arrays]));
-
-    /* Copy the user-provided data to the buffer. */
-    bufptr = (void *)((char *)wmb->data + arraylen * iodesc->mpitype_size * wmb->num_arrays);
-    if (arraylen > 0)
+    /* Get the buffer on the IO tasks. */
+    if ((ierr = alloc_darray_iobuf(file, iodesc, 1, req->fillvalue, &req->iobuf)))
     {
-        PLOG((3, "copying %ld bytes of user data %d", arraylen * iodesc->mpitype_size, iodesc->mpitype_size));
-        memcpy(bufptr, array, arraylen * iodesc->mpitype_size);
+        free_darray_req(ios, req);
+        return ierr;
     }
 
-    /* Add the unlimited dimension value of this variable to the frame
-     * array in wmb. */
-    if (wmb->frame)
-        wmb->frame[wmb->num_arrays] = vdesc->record;
-    wmb->num_arrays++;
+    /* Post the messages that move the data to the IO tasks. */
+    if ((ierr = rearrange_comp2io_start(ios, iodesc, req->sbuf, req->iobuf, &req->reqs,
+                                        &req->nreqs)))
+    {
+        free_darray_req(ios, req);
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
 
-#ifdef USE_MPE
-    pio_stop_mpe_log(DARRAY_WRITE, __func__);
-#endif /* USE_MPE */
+    HASH_ADD_INT(file->darray_reqs, reqid, req);
+    *request = req->reqid;
 
-    PLOG((2, "wmb->num_arrays = %d iodesc->maxbytes / iodesc->mpitype_size = %d "
-          "iodesc->ndof = %d iodesc->llen = %d", wmb->num_arrays,
-          iodesc->maxbytes / iodesc->mpitype_size, iodesc->ndof, iodesc->llen));
+    PLOG((2, "PIOc_iwrite_darray started request %d with %d messages", req->reqid,
+          req->nreqs));
 
     return PIO_NOERR;
 }
 
 /**
- * Read a field from a file to the IO library using distributed
- * arrays.
+ * Start a non-blocking read of a distributed array from a file.
+ *
+ * With pnetcdf the read is posted on the IO tasks with
+ * ncmpi_iget_varn(), and the reads of all outstanding requests of the
+ * file are completed together by the first PIOc_wait_darray() call
+ * for one of them. With other iotypes the data are read right away,
+ * and only the messages that move them to the compute tasks are left
+ * in flight. Either way, the caller may go on computing until the
+ * data are needed, for example to read the next forcing record while
+ * the current one is used.
+ *
+ * The data are in array only after PIOc_wait_darray() has returned
+ * for this request. The caller must not touch array before then.
+ *
+ * Like PIOc_read_darray(), this function must be called on all tasks
+ * of the IO system. PIOc_wait_darray() must also be called on all
+ * tasks, for the same requests, in the same order. Requests not
+ * waited for are completed by PIOc_closefile().
+ *
+ * If async is in use, the data are read with PIOc_read_darray() and
+ * PIO_REQ_NULL is returned in request.
  *
  * @param ncid identifies the netCDF file.
  * @param varid the variable ID to be read.
  * @param ioid the I/O description ID as passed back by
  * PIOc_InitDecomp().
  * @param arraylen this parameter is ignored. Nominally it is the
- * length of the array to be read. This is the length of the
- * distrubited array. That is, the length of the portion of the data
- * that is on the processor. This is already known because it is in
- * the decomposition.
- * @param array pointer to the data to be read. This is a
- * pointer to the distributed portion of the array that is on this
- * processor.
- * @return 0 for success, error code otherwise.
+ * length of the array buffer on this task.
+ * @param array pointer to the array that will get the data.
+ * @param request pointer that gets the ID of the request.
+ * @returns 0 for success, non-zero error code for failure.
  * @ingroup PIO_read_darray_c
- * @author Jim Edwards, Ed Hartnett
+ * @author Ed Hartnett
  */
 int
-PIOc_read_darray(int ncid, int varid, int ioid, PIO_Offset arraylen,
-                 void *array)
+PIOc_iread_darray(int ncid, int varid, int ioid, PIO_Offset arraylen, void *array,
+                  int *request)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     io_desc_t *iodesc;     /* Pointer to IO description information. */
-    void *iobuf = NULL;    /* holds the data as read on the io node. */
+    var_desc_t *vdesc;     /* Info about the var being read. */
+    darray_req_t *req;     /* The new request. */
     size_t rlen = 0;       /* the length of data in iobuf. */
-    void *tmparray;        /* unsorted copy of array buf if required */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
     int ierr;              /* Return code. */
 
-#ifdef USE_MPE
-    pio_start_mpe_log(DARRAY_READ);
-#endif /* USE_MPE */
-
-    PLOG((1, "PIOc_read_darray ncid %d varid %d ioid %d arraylen %ld ",
+    PLOG((1, "PIOc_iread_darray ncid %d varid %d ioid %d arraylen %ld ",
           ncid, varid, ioid, arraylen));
 
+    /* Vars of gathered points use the gathered decomposition. */
+    ioid = find_darray_ioid(ncid, varid, ioid);
+
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
     ios = file->iosystem;
 
-    /* If async is in use, and this is not an IO task, bcast the
-     * parameters. */
+    if (!request)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* With async the data are sent from the IO tasks by message. */
     if (ios->async)
     {
-        if (!ios->ioproc)
-        {
-            int msg = PIO_MSG_READDARRAY;
-
-            if (ios->compmaster == MPI_ROOT)
-                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
-
-            /* Send the function parameters and associated informaiton
-             * to the msg handler. */
-            if (!mpierr)
-                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&arraylen, 1, MPI_OFFSET, ios->compmaster, ios->intercomm);
-            PLOG((2, "PIOc_read_darray ncid %d varid %d ioid %d arraylen %d",
-                  ncid, varid, ioid, arraylen));
-        }
-
-        /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        *request = PIO_REQ_NULL;
+        return PIOc_read_darray(ncid, varid, ioid, arraylen, array);
     }
 
-    /* Get the iodesc. */
+    /* Get the iodesc and var info. */
     if (!(iodesc = pio_get_iodesc_from_id(ioid)))
         return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
-    pioassert(iodesc->rearranger == PIO_REARR_BOX || iodesc->rearranger == PIO_REARR_SUBSET,
-              "unknown rearranger", __FILE__, __LINE__);
+    if ((ierr = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Allocate the request. */
+    if (!(req = calloc(1, sizeof(darray_req_t))))
+        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    req->reqid = file->next_darray_reqid++;
+    req->ioid = ioid;
+    req->varid = varid;
+    req->read = true;
+    req->array = array;
+    req->frame = -1;
+    req->getreq = NC_REQ_NULL;
 
-    /* iomaster needs max of buflen, others need local len */
-    if (ios->iomaster == MPI_ROOT)
+    /* iomaster (and, for subfiles, the first IO task of each
+     * subfile) needs max of buflen, others need local len */
+    if (pio_serial_root(ios, file))
         rlen = iodesc->maxiobuflen;
     else
         rlen = iodesc->llen;
 
     /* Allocate a buffer for one record. */
     if (ios->ioproc && rlen > 0)
-        if (!(iobuf = malloc(iodesc->mpitype_size * rlen)))
+        if (!(req->iobuf = pio_iobuf_alloc(ios, iodesc->mpitype_size * rlen)))
+        {
+            free_darray_req(ios, req);
             return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        }
 
-    /* Call the correct darray read function based on iotype. */
+    /* If the map is not monotonically increasing the data are
+     * received into a buffer, then sorted into array. */
+    if (iodesc->needssort && iodesc->maplen > 0)
+        if (!(req->sbuf = malloc(iodesc->piotype_size * iodesc->maplen)))
+        {
+            free_darray_req(ios, req);
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+
+    /* Read the data, or post the read for pnetcdf. */
     switch (file->iotype)
     {
     case PIO_IOTYPE_NETCDF:
     case PIO_IOTYPE_NETCDF4C:
-        if ((ierr = pio_read_darray_nc_serial(file, iodesc, varid, iobuf)))
-            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        ierr = pio_read_darray_nc_serial(file, iodesc, varid, req->iobuf);
         break;
     case PIO_IOTYPE_PNETCDF:
+        req->get_pending = true;
+        ierr = pio_read_darray_nc(file, iodesc, varid, req->iobuf, &req->getreq);
+        break;
     case PIO_IOTYPE_NETCDF4P:
-        if ((ierr = pio_read_darray_nc(file, iodesc, varid, iobuf)))
-            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        ierr = pio_read_darray_nc(file, iodesc, varid, req->iobuf, NULL);
         break;
     default:
-        return pio_err(NULL, NULL, PIO_EBADIOTYPE, __FILE__, __LINE__);
+        ierr = PIO_EBADIOTYPE;
     }
 
-    /* If the map is not monotonically increasing we will need to sort
-     * it. */
-    PLOG((3, "iodesc->needssort %d", iodesc->needssort));
+    /* If the data have been read, start moving them to the compute
+     * tasks. */
+    if (!ierr && !req->get_pending)
+    {
+        ierr = rearrange_io2comp_start(ios, iodesc, req->iobuf, req->sbuf ? req->sbuf : array,
+                                       &req->reqs, &req->nreqs);
+        req->exchange_posted = true;
+    }
+    if (ierr)
+    {
+        free_darray_req(ios, req);
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    }
+
+    HASH_ADD_INT(file->darray_reqs, reqid, req);
+    *request = req->reqid;
+
+    PLOG((2, "PIOc_iread_darray started request %d", req->reqid));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Complete the pnetcdf reads of all outstanding non-blocking darray
+ * reads of a file, with one ncmpi_wait_all() call. This is
+ * collective across the IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_read_darray_c
+ * @author Ed Hartnett
+ */
+static int
+complete_pending_reads(file_desc_t *file)
+{
+    darray_req_t *req, *treq;
+    int ngets = 0;
+    int ierr = PIO_NOERR;
 
-    if (iodesc->needssort)
+    /* Count the pending reads. */
+    HASH_ITER(hh, file->darray_reqs, req, treq)
+        if (req->get_pending)
+            ngets++;
+    PLOG((2, "complete_pending_reads ngets = %d", ngets));
+
+#ifdef _PNETCDF
+    if (file->iosystem->ioproc && ngets > 0)
     {
-        if (!(tmparray = malloc(iodesc->piotype_size * iodesc->maplen)))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        int getreqs[ngets];
+        int status[ngets];
+        int g = 0;
+        double start = MPI_Wtime();
+
+        HASH_ITER(hh, file->darray_reqs, req, treq)
+            if (req->get_pending)
+                getreqs[g++] = req->getreq;
+
+        if (!(ierr = pio_start_timer(file->iosystem, PIO_TIMER_WAIT_ALL)))
+            ierr = ncmpi_wait_all(file->fh, ngets, getreqs, status);
+        if (!ierr)
+            ierr = pio_stop_timer(file->iosystem, PIO_TIMER_WAIT_ALL);
+        file->stats.nwaits++;
+        file->stats.wait_time += MPI_Wtime() - start;
     }
-    else
-        tmparray = array;
+#endif /* _PNETCDF */
 
-    /* prefill the output array with 0 then overwrite from iobuf */
-    /*    switch(iodesc->piotype)
-      {
-      case PIO_SHORT:
-        for(int i=0; i<iodesc->maplen; i++)
-          ((short *) array)[i] = (short) 0;
-        break;
-      case PIO_INT:
-        for(int i=0; i<iodesc->maplen; i++)
-          ((int *) array)[i] = (int) 0;
-        break;
-      case PIO_FLOAT:
-        for(int i=0; i<iodesc->maplen; i++)
-          ((float *) array)[i] = (float) 0;
-        break;
-      case PIO_DOUBLE:
-        for(int i=0; i<iodesc->maplen; i++)
-          ((double *) array)[i] = (double) 0;
-        break;
-      default:
-        return PIO_EBADTYPE;
-      }
-    */
+    /* The data are now in the IO buffers. */
+    HASH_ITER(hh, file->darray_reqs, req, treq)
+        req->get_pending = false;
 
-    /* Rearrange the data. */
-    if ((ierr = rearrange_io2comp(ios, iodesc, iobuf, tmparray)))
-        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if (ierr)
+        return check_netcdf(file, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Complete a non-blocking darray read, so that the data are in the
+ * caller's array, then free the request.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param req pointer to the request.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_read_darray_c
+ * @author Ed Hartnett
+ */
+static int
+wait_darray_read(file_desc_t *file, io_desc_t *iodesc, darray_req_t *req)
+{
+    iosystem_desc_t *ios = file->iosystem; /* Pointer to io system information. */
+    int mpierr;            /* Return code from MPI functions. */
+    int ierr;              /* Return code. */
+
+    /* The request is done, whatever happens. */
+    HASH_DEL(file->darray_reqs, req);
+
+    /* Finish the pnetcdf reads (of all requests of the file), then
+     * start moving the data of this one. Requests whose reads were
+     * completed by an earlier wait still need their exchange. */
+    if (!req->exchange_posted)
+    {
+        if (req->get_pending)
+            if ((ierr = complete_pending_reads(file)))
+            {
+                free_darray_req(ios, req);
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            }
+        req->exchange_posted = true;
+        if ((ierr = rearrange_io2comp_start(ios, iodesc, req->iobuf,
+                                            req->sbuf ? req->sbuf : req->array,
+                                            &req->reqs, &req->nreqs)))
+        {
+            free_darray_req(ios, req);
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        }
+    }
+
+    /* Complete the messages. */
+    if (req->nreqs > 0)
+        if ((mpierr = MPI_Waitall(req->nreqs, req->reqs, MPI_STATUSES_IGNORE)))
+        {
+            free_darray_req(ios, req);
+            return check_mpi(ios, file, mpierr, __FILE__, __LINE__);
+        }
 
     /* If we need to sort the map, do it. */
-    if (iodesc->needssort && ios->compproc)
+    if (req->sbuf && ios->compproc)
+        pio_sorted_copy(req->sbuf, req->array, iodesc, 1, 1);
+
+    free_darray_req(ios, req);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Complete a non-blocking darray write or read, then free the
+ * request. For writes the data are written to the file.
+ *
+ * @param file pointer to the file info.
+ * @param req pointer to the request.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+static int
+wait_darray_req(file_desc_t *file, darray_req_t *req)
+{
+    iosystem_desc_t *ios = file->iosystem; /* Pointer to io system information. */
+    io_desc_t *iodesc;     /* The IO description. */
+    int fndims;            /* Number of dims in the var in the file. */
+    int mpierr;            /* Return code from MPI functions. */
+    int ierr;              /* Return code. */
+
+    PLOG((2, "wait_darray_req reqid = %d nreqs = %d", req->reqid, req->nreqs));
+
+    /* Get decomposition information. */
+    if (!(iodesc = pio_get_iodesc_from_id(req->ioid)))
     {
-        pio_sorted_copy(tmparray, array, iodesc, 1, 1);
-        free(tmparray);
+        HASH_DEL(file->darray_reqs, req);
+        free_darray_req(ios, req);
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
     }
 
-    /* Free the buffer. */
-    if (rlen > 0)
-        free(iobuf);
+    if (req->read)
+        return wait_darray_read(file, iodesc, req);
 
-#ifdef USE_MPE
-    pio_stop_mpe_log(DARRAY_READ, __func__);
-#endif /* USE_MPE */
+    /* Complete the messages. */
+    HASH_DEL(file->darray_reqs, req);
+    if (req->nreqs > 0)
+        if ((mpierr = MPI_Waitall(req->nreqs, req->reqs, MPI_STATUSES_IGNORE)))
+        {
+            free_darray_req(ios, req);
+            return check_mpi(ios, file, mpierr, __FILE__, __LINE__);
+        }
 
-    PLOG((2, "done with PIOc_read_darray()"));
+    /* Get the number of dims for the var. */
+    if ((ierr = PIOc_inq_varndims(file->pio_ncid, req->varid, &fndims)))
+    {
+        free_darray_req(ios, req);
+        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    }
+
+    /* If the buffer is already in use in pnetcdf we need to flush
+     * first. */
+    if (file->iotype == PIO_IOTYPE_PNETCDF && file->iobuf)
+        if ((ierr = flush_output_buffer(file, 1, 0)))
+        {
+            free_darray_req(ios, req);
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        }
+    pioassert(!file->iobuf, "buffer overwrite", __FILE__, __LINE__);
+
+    /* The received data now belong to the file. */
+    file->iobuf = req->iobuf;
+    req->iobuf = NULL;
+    ierr = write_darray_iobuf(file, iodesc, &req->varid, 1, fndims,
+                              req->frame >= 0 ? &req->frame : NULL, req->fillvalue,
+                              false);
+    free_darray_req(ios, req);
+    if (ierr)
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Wait for a non-blocking darray write started with
+ * PIOc_iwrite_darray() to complete, and write its data to the file,
+ * or wait for a non-blocking darray read started with
+ * PIOc_iread_darray() to complete, so the data are in the caller's
+ * array. This must be called on all tasks of the IO system.
+ *
+ * @param ncid identifies the netCDF file.
+ * @param request the ID of the request returned by
+ * PIOc_iwrite_darray() or PIOc_iread_darray(). If PIO_REQ_NULL,
+ * nothing is done.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_wait_darray(int ncid, int request)
+{
+    file_desc_t *file;     /* Info about file we are writing to. */
+    darray_req_t *req;     /* The request. */
+    int ierr;              /* Return code. */
+
+    PLOG((1, "PIOc_wait_darray ncid = %d request = %d", ncid, request));
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (request == PIO_REQ_NULL)
+        return PIO_NOERR;
+
+    /* Find the request. */
+    HASH_FIND_INT(file->darray_reqs, &request, req);
+    if (!req)
+        return pio_err(file->iosystem, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    return wait_darray_req(file, req);
+}
+
+/**
+ * Complete all non-blocking darray writes and reads of a file, in
+ * the order they were started. This is called from PIOc_sync() and
+ * PIOc_closefile().
+ *
+ * @param file pointer to the file info.
+ * @returns 0 for success, non-zero error code for failure.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+wait_darray_requests(file_desc_t *file)
+{
+    darray_req_t *req, *treq;
+    int ierr;              /* Return code. */
+
+    HASH_ITER(hh, file->darray_reqs, req, treq)
+    {
+        if ((ierr = wait_darray_req(file, req)))
+            return ierr;
+    }
 
     return PIO_NOERR;
 }
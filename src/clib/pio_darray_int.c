@@ -10,109 +10,70 @@
  * @author Jim Edwards
  */
 
+#define PIO_LOG_SUBSYS PIO_LOG_DARRAY
 #include <config.h>
+#include <unistd.h>
 #include <pio.h>
 #include <pio_internal.h>
 
-#if USE_VARD
-#define USE_VARD_READ 1
-#define USE_VARD_WRITE 1
-#endif
-
-/** 10MB default limit. */
-extern PIO_Offset pio_pnetcdf_buffer_size_limit;
-
-/** Initial size of compute buffer. */
-long pio_cnbuffer_limit = 33554432;
-
-/** Global buffer pool pointer. */
-extern void *CN_bpool;
-
-/** Maximum buffer usage. */
-extern PIO_Offset maxusage;
-
-/**
- * Handler for freeing the memory buffer pool.
- *
- * @param p pointer to the memory buffer pool.
- * @author Jim Edwards
- */
-void
-bpool_free(void *p)
-{
-    free(p);
-    if(p == CN_bpool){
-        CN_bpool = NULL;
-    }
-}
-
-#if USE_VARD
+#ifdef _PNETCDF
 /**
- * Get the length of dimension 0.
+ * Get the length of dimension 0 of a variable which has more
+ * dimensions than the decomposition, but no unlimited dimension. The
+ * record number of PIOc_setframe() is then an index in dimension 0.
  *
  * @param file pointer to the file descriptor.
- * @param iosdesc pointer to the iosystem descriptor.
+ * @param iodesc pointer to the decomposition.
  * @param varid variable ID.
- * @param fndims number of dimensions in the file.
- * @param gdim0 pointer that gets gdim0.
+ * @param fndims number of dimensions of the variable in the file.
+ * @param gdim0 pointer that gets the length of dimension 0, or 0 if
+ * it is not needed.
  * @returns 0 for success, error code otherwise.
  * @author Jim Edwards
  */
-int
-get_gdim0(file_desc_t *file,io_desc_t *iodesc, int varid, int fndims,
+static int
+get_gdim0(file_desc_t *file, io_desc_t *iodesc, int varid, int fndims,
           MPI_Offset *gdim0)
 {
-    int ierr = PIO_NOERR;
+    var_desc_t *vdesc;
+    int ierr;
 
     *gdim0 = 0;
-    if (file->iotype == PIO_IOTYPE_PNETCDF && iodesc->ndims < fndims)
-    {
-        int numunlimdims;
-
-        /* We need to confirm the file has an unlimited dimension and
-           if it doesn't we need to find the extent of the first
-           variable dimension. */
-        PLOG((3,"look for numunlimdims"));
-        if ((ierr = PIOc_inq_unlimdims(file->pio_ncid, &numunlimdims, NULL)))
-            return check_netcdf(file, ierr, __FILE__, __LINE__);
-        PLOG((3,"numunlimdims = %d", numunlimdims));
-        if (numunlimdims <= 0)
-        {
-            int dimids[fndims];
-            if ((ierr = PIOc_inq_vardimid(file->pio_ncid, varid, dimids)))
-                return check_netcdf(file, ierr, __FILE__, __LINE__);
-            if ((ierr = PIOc_inq_dimlen(file->pio_ncid, dimids[0], gdim0)))
-                return check_netcdf(file, ierr, __FILE__, __LINE__);
-        }
+    if ((ierr = get_file_var_desc(file, varid, &vdesc)))
+        return ierr;
+
+    if (iodesc->ndims < fndims && !vdesc->rec_var)
+    {
+        int dimids[fndims];
+
+        if ((ierr = ncmpi_inq_vardimid(file->fh, varid, dimids)))
+            return ierr;
+        if ((ierr = ncmpi_inq_dimlen(file->fh, dimids[0], gdim0)))
+            return ierr;
     }
     PLOG((3,"gdim0 = %d",*gdim0));
-    return ierr;
-}
 
+    return PIO_NOERR;
+}
 
 /**
- * Get the MPI data type of vard.
+ * Get the MPI data type of vard, for the first record of a variable.
  *
- * @param iosdesc pointer to the iosystem descriptor.
- * @param gdim0
- * @param unlimdimoffset
- * @param rrcnt
+ * @param iodesc pointer to the decomposition.
+ * @param gdim0 the length of dimension 0, from get_gdim0().
+ * @param rrcnt the number of start/count arrays.
  * @param ndims the number of dimensions in the decomposition.
  * @param fndims the number of dimensions in the file.
- * @param varid variable ID.
- * @param fndims number of dimensions in the file.
- * @param frame the record number.
- * @param startlist
- * @param countlist
+ * @param startlist the start arrays of the regions.
+ * @param countlist the count arrays of the regions.
  * @param filetype a pointer that gets the MPI data type.
  * @returns 0 for success, error code otherwise.
  * @author Jim Edwards
  */
-static
-int get_vard_mpidatatype(io_desc_t *iodesc, MPI_Offset gdim0, PIO_Offset unlimdimoffset,
-                         int rrcnt, int ndims, int fndims,
-                         int frame, PIO_Offset **startlist, PIO_Offset **countlist,
-                         MPI_Datatype *filetype)
+static int
+get_vard_mpidatatype(io_desc_t *iodesc, MPI_Offset gdim0, int rrcnt, int ndims,
+                     int fndims, PIO_Offset **startlist, PIO_Offset **countlist,
+                     MPI_Datatype *filetype)
 {
 
     int sa_ndims;
@@ -123,9 +84,6 @@ int get_vard_mpidatatype(io_desc_t *iodesc, MPI_Offset gdim0, PIO_Offset unlimdi
     int blocklengths[rrcnt];
     MPI_Datatype subarray[rrcnt];
 
-    /* preserve the value of unlimdimoffset, as it may be changed */
-    PIO_Offset _unlimdimoffset = unlimdimoffset;
-
     *filetype = MPI_DATATYPE_NULL;
 
     if(rrcnt == 0)
@@ -174,14 +132,10 @@ int get_vard_mpidatatype(io_desc_t *iodesc, MPI_Offset gdim0, PIO_Offset unlimdi
             sacount[i-dim_offset] = (int) countlist[rc][i];
             sastart[i-dim_offset] = (int) startlist[rc][i];
         }
+
+        /* The first record. */
         if(gdim0 > 0)
-        {
-            unlimdimoffset = gdim0;
-            sastart[0] = max(0, frame);
-            displacements[rc]=0;
-        }
-        else
-            displacements[rc] = unlimdimoffset * max(0, frame);
+            sastart[0] = 0;
 
         /* Check whether this request is actually contiguous. If contiguous,
          * we do not need to create an MPI derived datatype.
@@ -211,13 +165,11 @@ int get_vard_mpidatatype(io_desc_t *iodesc, MPI_Offset gdim0, PIO_Offset unlimdi
                 }
             }
         }
-        /* if this is a record variable, add the gap of record size */
-        disp += _unlimdimoffset * max(0, frame);
 
 #if PIO_ENABLE_LOGGING
         for (int i=0; i< sa_ndims; i++)
-            PLOG((3, "vard: sastart[%d]=%d sacount[%d]=%d gdims[%d]=%d %ld %ld displacement = %ld un %d",
-                  i,sastart[i], i,sacount[i], i, gdims[i], startlist[rc][i], countlist[rc][i], displacements[rc], unlimdimoffset));
+            PLOG((3, "vard: sastart[%d]=%d sacount[%d]=%d gdims[%d]=%d %ld %ld",
+                  i,sastart[i], i,sacount[i], i, gdims[i], startlist[rc][i], countlist[rc][i]));
 #endif
         if (isContig) { /* this request rc is contiguous, no need to create a new MPI datatype */
             if (prev_end == disp) {
@@ -248,7 +200,7 @@ int get_vard_mpidatatype(io_desc_t *iodesc, MPI_Offset gdim0, PIO_Offset unlimdi
         }
 
 #if PIO_ENABLE_LOGGING
-        PLOG((3,"vard: blocklengths[%d]=%d displacement[%d]=%ld unlimdimoffset=%ld",rc,blocklengths[rc], rc, displacements[rc], unlimdimoffset));
+        PLOG((3,"vard: blocklengths[%d]=%d displacement[%d]=%ld",rc,blocklengths[rc], rc, displacements[rc]));
 #endif
 
     }
@@ -269,7 +221,172 @@ int get_vard_mpidatatype(io_desc_t *iodesc, MPI_Offset gdim0, PIO_Offset unlimdi
     return PIO_NOERR;
 }
 
-#endif
+/**
+ * Get the file type of a vard read or write of some variables through
+ * a decomposition. The type of the first record is only built once
+ * for each decomposition, and kept in the io_desc_t. The variables
+ * and their records are then placed with the displacements of a
+ * struct type around it.
+ *
+ * @param file pointer to the file descriptor.
+ * @param iodesc pointer to the decomposition.
+ * @param fill 1 for the holes of the decomposition, 0 for the data.
+ * @param nvars the number of variables, which must all have the same
+ * type and number of dimensions.
+ * @param varids the IDs of the variables.
+ * @param fndims the number of dimensions of the variables in the
+ * file.
+ * @param frame the record numbers of the variables. May be NULL.
+ * @param rrcnt the number of start/count arrays.
+ * @param startlist the start arrays of the regions.
+ * @param countlist the count arrays of the regions.
+ * @param filetype a pointer that gets the file type, which must be
+ * freed by the caller if it is not MPI_DATATYPE_NULL (which it is if
+ * this task has no data).
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+get_vard_filetype(file_desc_t *file, io_desc_t *iodesc, int fill, int nvars,
+                  const int *varids, int fndims, const int *frame, int rrcnt,
+                  PIO_Offset **startlist, PIO_Offset **countlist,
+                  MPI_Datatype *filetype)
+{
+    MPI_Aint displacements[nvars];
+    int blocklengths[nvars];
+    MPI_Datatype types[nvars];
+    MPI_Offset gdim0;
+    MPI_Offset var0_offset;
+    int mpierr;
+    int ierr;
+
+    *filetype = MPI_DATATYPE_NULL;
+    if ((ierr = get_gdim0(file, iodesc, varids[0], fndims, &gdim0)))
+        return ierr;
+
+    /* Build the type of the first record, if it is not in the cache. */
+    if (iodesc->vard_fndims[fill] != fndims || iodesc->vard_gdim0[fill] != gdim0)
+    {
+        if (iodesc->vard_fndims[fill] && iodesc->vard_type[fill] != MPI_DATATYPE_NULL)
+            if ((mpierr = MPI_Type_free(&iodesc->vard_type[fill])))
+                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        iodesc->vard_fndims[fill] = 0;
+        if ((ierr = get_vard_mpidatatype(iodesc, gdim0, rrcnt, iodesc->ndims, fndims,
+                                         startlist, countlist, &iodesc->vard_type[fill])))
+            return ierr;
+        iodesc->vard_fndims[fill] = fndims;
+        iodesc->vard_gdim0[fill] = gdim0;
+    }
+
+    /* This task has no data. */
+    if (iodesc->vard_type[fill] == MPI_DATATYPE_NULL)
+        return PIO_NOERR;
+
+    /* Place each variable at its record, relative to the start of the
+     * first variable. */
+    for (int nv = 0; nv < nvars; nv++)
+    {
+        MPI_Offset offset;
+        int thisframe = frame && iodesc->ndims < fndims ? max(0, frame[nv]) : 0;
+
+        if ((ierr = ncmpi_inq_varoffset(file->fh, varids[nv], &offset)))
+            return ierr;
+        if (!nv)
+            var0_offset = offset;
+        displacements[nv] = offset - var0_offset;
+
+        if (thisframe)
+        {
+            MPI_Offset recsize = iodesc->mpitype_size;
+
+            if (gdim0 > 0)
+                for (int d = 0; d < iodesc->ndims; d++)
+                    recsize *= iodesc->dimlen[d];
+            else if ((ierr = ncmpi_inq_recsize(file->fh, &recsize)))
+                return ierr;
+            displacements[nv] += recsize * thisframe;
+        }
+        blocklengths[nv] = 1;
+        types[nv] = iodesc->vard_type[fill];
+    }
+
+    if ((mpierr = MPI_Type_create_struct(nvars, blocklengths, displacements, types,
+                                         filetype)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Type_commit(filetype)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the variables of write_darray_multi_par() to a pnetcdf file
+ * with ncmpi_put_vard_all(). pnetcdf can only convert the data of a
+ * vard call to the types of the variables if they all have the same
+ * type, so the variables are written in runs of the same type.
+ *
+ * @param file pointer to the file descriptor.
+ * @param iodesc pointer to the decomposition.
+ * @param nvars the number of variables.
+ * @param varids the IDs of the variables.
+ * @param fndims the number of dimensions of the variables in the
+ * file.
+ * @param fill 1 for the holes of the decomposition, 0 for the data.
+ * @param frame the record numbers of the variables. May be NULL.
+ * @param iobuf the data of the variables, one after another.
+ * @param llen the number of elements of each variable in iobuf.
+ * @param rrcnt the number of start/count arrays.
+ * @param startlist the start arrays of the regions.
+ * @param countlist the count arrays of the regions.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+put_vard_vars(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+              int fndims, int fill, const int *frame, void *iobuf, PIO_Offset llen,
+              int rrcnt, PIO_Offset **startlist, PIO_Offset **countlist)
+{
+    int v0 = 0;  /* First var of this run. */
+    int mpierr;
+    int ierr;
+
+    for (int nv = 0; nv < nvars; nv++)
+    {
+        var_desc_t *vdesc, *next;
+        MPI_Datatype filetype;
+        void *bufptr;
+
+        /* Keep going while the next var has the same type. */
+        if ((ierr = get_file_var_desc(file, varids[nv], &vdesc)))
+            return ierr;
+        if (nv < nvars - 1)
+        {
+            if ((ierr = get_file_var_desc(file, varids[nv + 1], &next)))
+                return ierr;
+            if (next->pio_type == vdesc->pio_type)
+                continue;
+        }
+
+        /* Write vars v0 to nv. */
+        if ((ierr = get_vard_filetype(file, iodesc, fill, nv - v0 + 1, &varids[v0], fndims,
+                                      frame ? &frame[v0] : NULL, rrcnt, startlist,
+                                      countlist, &filetype)))
+            return ierr;
+        bufptr = (char *)iobuf + v0 * iodesc->mpitype_size * llen;
+        PLOG((3, "vard: call ncmpi_put_vard nvars = %d llen = %d", nv - v0 + 1, llen));
+        ierr = ncmpi_put_vard_all(file->fh, varids[v0], filetype, bufptr,
+                                  (nv - v0 + 1) * llen, iodesc->mpitype);
+        PLOG((3, "vard: return ncmpi_put_vard ierr = %d", ierr));
+        if (filetype != MPI_DATATYPE_NULL && (mpierr = MPI_Type_free(&filetype)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        if (ierr)
+            return ierr;
+        v0 = nv + 1;
+    }
+
+    return PIO_NOERR;
+}
+#endif /* _PNETCDF */
 
 /**
  * Fill start/count arrays for write_darray_multi_par(). This is an
@@ -346,11 +463,330 @@ find_start_count(int ndims, int fndims, var_desc_t *vdesc,
     return PIO_NOERR;
 }
 
+#ifdef _PNETCDF
+/**
+ * Build the MPI type of the IO buffer for a pnetcdf write of several
+ * frames of a record var at once. Each region is written for all the
+ * frames, with the record count of the region set to nframes, so the
+ * file wants the data of the first region for each frame, then the
+ * second region for each frame, and so on. In the IO buffer the data
+ * of each frame are one array of llen elements, with the regions one
+ * after another.
+ *
+ * @param iodesc pointer to the decomposition info.
+ * @param llen the length of each array in the IO buffer.
+ * @param rrcnt the number of regions.
+ * @param fndims the number of dimensions of the var in the file.
+ * @param countlist the counts of the regions. The record dimension
+ * is not counted.
+ * @param nframes the number of frames.
+ * @param batch the index, in the IO buffer, of the array of each
+ * frame.
+ * @param buftypep pointer that gets the committed type, with the
+ * start of the IO buffer as origin. It must be freed by the caller.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+get_frames_buftype(io_desc_t *iodesc, PIO_Offset llen, int rrcnt, int fndims,
+                   PIO_Offset **countlist, int nframes, const int *batch,
+                   MPI_Datatype *buftypep)
+{
+    int *blocklens;
+    MPI_Aint *displs;
+    PIO_Offset roff = 0; /* Offset of the region in each array. */
+    int nblocks = rrcnt * nframes;
+    int mpierr;
+
+    /* A task with no regions gets an empty type. */
+    if (!(blocklens = malloc((nblocks ? nblocks : 1) * sizeof(int))))
+        return PIO_ENOMEM;
+    if (!(displs = malloc((nblocks ? nblocks : 1) * sizeof(MPI_Aint))))
+    {
+        free(blocklens);
+        return PIO_ENOMEM;
+    }
+
+    for (int rc = 0; rc < rrcnt; rc++)
+    {
+        PIO_Offset rsize = 1;
+
+        for (int i = 1; i < fndims; i++)
+            rsize *= countlist[rc][i];
+        for (int k = 0; k < nframes; k++)
+        {
+            blocklens[rc * nframes + k] = rsize;
+            displs[rc * nframes + k] = (MPI_Aint)(batch[k] * llen + roff) * iodesc->mpitype_size;
+        }
+        roff += rsize;
+    }
+
+    if (!(mpierr = MPI_Type_create_hindexed(nblocks, blocklens, displs,
+                                            iodesc->mpitype, buftypep)))
+        if ((mpierr = MPI_Type_commit(buftypep)))
+            MPI_Type_free(buftypep);
+    free(blocklens);
+    free(displs);
+
+    return mpierr ? check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__) : PIO_NOERR;
+}
+
+/** The header of one var written to the stage log of a file (see
+ * PIOc_set_stage_dir()). It is followed by the starts, then the
+ * counts, of the rrcnt regions, fndims PIO_Offset values each, then
+ * nelems values of type pio_type. */
+typedef struct pio_stage_rec
+{
+    /** The ID of the var. */
+    int varid;
+
+    /** The PIO type of the data. */
+    int pio_type;
+
+    /** The number of dimensions of the var in the file. */
+    int fndims;
+
+    /** The number of regions. */
+    int rrcnt;
+
+    /** The number of values of data. */
+    PIO_Offset nelems;
+} pio_stage_rec;
+
+/**
+ * Append the arrays of a darray write of a pnetcdf file to the stage
+ * log of the file, instead of posting them to pnetcdf. They are
+ * written to the file later by pio_stage_drain(). This is only called
+ * on IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param nvars the number of arrays.
+ * @param varids the ID of the var of each array.
+ * @param fndims the number of dimensions of the vars in the file.
+ * @param frame the frame of each array, or NULL for non-record vars.
+ * @param iobuf the arrays, llen values each.
+ * @param llen the length of each array.
+ * @param rrcnt the number of regions.
+ * @param startlist the starts of the regions.
+ * @param countlist the counts of the regions.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+stage_put_vars(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+               int fndims, const int *frame, void *iobuf, PIO_Offset llen, int rrcnt,
+               PIO_Offset **startlist, PIO_Offset **countlist)
+{
+    pio_stage_rec rec = {0, iodesc->piotype, fndims, rrcnt, llen};
+    var_desc_t *vdesc;
+    size_t ok = 1;
+    int ierr;
+
+    for (int nv = 0; nv < nvars && ok; nv++)
+    {
+        if ((ierr = get_file_var_desc(file, varids[nv], &vdesc)))
+            return ierr;
+        if (vdesc->record >= 0 && iodesc->ndims < fndims)
+            for (int rc = 0; rc < rrcnt; rc++)
+                startlist[rc][0] = frame[nv];
+
+        rec.varid = varids[nv];
+        ok = fwrite(&rec, sizeof(rec), 1, file->stage_fp);
+        for (int rc = 0; rc < rrcnt && ok; rc++)
+            ok = fwrite(startlist[rc], sizeof(PIO_Offset), fndims, file->stage_fp) == fndims;
+        for (int rc = 0; rc < rrcnt && ok; rc++)
+            ok = fwrite(countlist[rc], sizeof(PIO_Offset), fndims, file->stage_fp) == fndims;
+        if (ok && llen)
+            ok = fwrite((char *)iobuf + nv * iodesc->mpitype_size * llen, iodesc->mpitype_size,
+                        llen, file->stage_fp) == llen;
+        file->stage_bytes += llen * iodesc->mpitype_size;
+    }
+    PLOG((2, "stage_put_vars nvars = %d stage_bytes = %lld", nvars, file->stage_bytes));
+
+    return ok ? PIO_NOERR : PIO_EIO;
+}
+
+/**
+ * Write the darray data staged in the log of a pnetcdf file (see
+ * PIOc_set_stage_dir()) to the file, and empty the log. The records
+ * are read in groups of up to PIO_STAGE_DRAIN_BYTES of data, posted
+ * with ncmpi_iput_varn() and waited for together. This is collective
+ * over the IO tasks, and is only called on them, with the file in
+ * data mode.
+ *
+ * @param file pointer to the file info.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+pio_stage_drain(file_desc_t *file)
+{
+    void **bufs = NULL;    /* The data of the posted records. */
+    int *reqs = NULL;      /* The requests of the posted records. */
+    int maxreqs = 0;
+    int more = 1;
+    int ierr = PIO_NOERR;
+    int mpierr;
+
+    /* Errors are returned after the loop, so all tasks take part in
+     * the waits. */
+    if (fflush(file->stage_fp) || fseek(file->stage_fp, 0, SEEK_SET))
+        ierr = PIO_EIO;
+    PLOG((2, "pio_stage_drain stage_bytes = %lld", file->stage_bytes));
+
+    /* Tasks that run out of records keep taking part in the waits
+     * until all are done. */
+    while (more)
+    {
+        PIO_Offset bytes = 0;
+        int nreqs = 0;
+        int ret;
+
+        while (!ierr && bytes < PIO_STAGE_DRAIN_BYTES)
+        {
+            pio_stage_rec rec;
+            MPI_Datatype mpitype;
+            PIO_Offset *startcount;
+            int type_size;
+
+            if (fread(&rec, sizeof(rec), 1, file->stage_fp) != 1)
+                break;
+
+            PIO_Offset *startlist[rec.rrcnt + 1], *countlist[rec.rrcnt + 1];
+            if ((ierr = find_mpi_type(rec.pio_type, &mpitype, &type_size)))
+                break;
+            if (nreqs == maxreqs)
+            {
+                void *p;
+
+                maxreqs = maxreqs ? 2 * maxreqs : 16;
+                if (!(p = realloc(bufs, maxreqs * sizeof(void *))))
+                {
+                    ierr = PIO_ENOMEM;
+                    break;
+                }
+                bufs = p;
+                if (!(p = realloc(reqs, maxreqs * sizeof(int))))
+                {
+                    ierr = PIO_ENOMEM;
+                    break;
+                }
+                reqs = p;
+            }
+
+            /* The starts, counts and data are read into one buffer,
+             * which is kept until the request is done. */
+            if (!(bufs[nreqs] = malloc(2 * rec.rrcnt * rec.fndims * sizeof(PIO_Offset) +
+                                       rec.nelems * type_size + 1)))
+            {
+                ierr = PIO_ENOMEM;
+                break;
+            }
+            startcount = bufs[nreqs];
+            if (fread(startcount, sizeof(PIO_Offset), 2 * rec.rrcnt * rec.fndims,
+                      file->stage_fp) != 2 * rec.rrcnt * rec.fndims ||
+                fread(startcount + 2 * rec.rrcnt * rec.fndims, type_size, rec.nelems,
+                      file->stage_fp) != rec.nelems)
+            {
+                free(bufs[nreqs]);
+                ierr = PIO_EIO;
+                break;
+            }
+            for (int rc = 0; rc < rec.rrcnt; rc++)
+            {
+                startlist[rc] = startcount + rc * rec.fndims;
+                countlist[rc] = startcount + (rec.rrcnt + rc) * rec.fndims;
+            }
+            if ((ret = ncmpi_iput_varn(file->fh, rec.varid, rec.rrcnt, startlist, countlist,
+                                       startcount + 2 * rec.rrcnt * rec.fndims, rec.nelems,
+                                       mpitype, &reqs[nreqs])))
+            {
+                free(bufs[nreqs]);
+                ierr = ret;
+                break;
+            }
+            bytes += rec.nelems * type_size;
+            nreqs++;
+        }
+
+        if ((ret = ncmpi_wait_all(file->fh, nreqs, reqs, NULL)) && !ierr)
+            ierr = ret;
+        for (int r = 0; r < nreqs; r++)
+            free(bufs[r]);
+
+        /* Go on while any task has records left. */
+        more = !ierr && bytes >= PIO_STAGE_DRAIN_BYTES;
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &more, 1, MPI_INT, MPI_MAX,
+                                    file->iosystem->io_comm)))
+        {
+            free(bufs);
+            free(reqs);
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        }
+    }
+    free(bufs);
+    free(reqs);
+
+    /* Empty the log. */
+    if (fseek(file->stage_fp, 0, SEEK_SET) || ftruncate(fileno(file->stage_fp), 0))
+    {
+        if (!ierr)
+            ierr = PIO_EIO;
+    }
+    else
+        file->stage_bytes = 0;
+
+    /* Get the same error on all IO tasks. */
+    return pio_subfile_err(file->iosystem, ierr);
+}
+#endif /* _PNETCDF */
+
+#ifdef _NETCDF4
+/**
+ * Find whether a var of a netCDF-4 file uses any filter (compression,
+ * shuffle, checksum, or another filter). HDF5 runs filters
+ * collectively, so such vars can't be written independently. Vars
+ * may get filters with PIOc_set_compression(), PIOc_def_var_deflate()
+ * and the other per-var functions, or from the file they were read
+ * from.
+ *
+ * @param file pointer to the file info.
+ * @param varid the ID of the var.
+ * @param filtered pointer that gets true if the var is filtered.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+var_is_filtered(file_desc_t *file, int varid, bool *filtered)
+{
+    int shuffle, deflate, fletcher32;
+    unsigned int id = 0;
+    int ret;
+
+    if ((ret = nc_inq_var_deflate(file->fh, varid, &shuffle, &deflate, NULL)))
+        return ret;
+    if ((ret = nc_inq_var_fletcher32(file->fh, varid, &fletcher32)))
+        return ret;
+
+    /* There is no filter if this fails with NC_ENOFILTER. */
+    nc_inq_var_filter(file->fh, varid, &id, NULL, NULL);
+    *filtered = shuffle || deflate || fletcher32 || id;
+
+    return PIO_NOERR;
+}
+#endif /* _NETCDF4 */
+
 /**
  * Write a set of one or more aggregated arrays to output file. This
  * function is only used with parallel-netcdf and netcdf-4 parallel
  * iotypes. Serial io types use write_darray_multi_serial().
  *
+ * For pnetcdf, the arrays of consecutive frames of a record var
+ * (such as those buffered by PIOc_write_darray() for a var written
+ * at each time step) are written by one request, with each region
+ * extended along the record dimension over all the frames.
+ *
  * @param file a pointer to the open file descriptor for the file
  * that will be written to
  * @param nvars the number of variables to be written with this
@@ -371,15 +807,12 @@ write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *vari
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     var_desc_t *vdesc;    /* Pointer to var info struct. */
-#ifdef _PNETCDF
     int dsize;             /* Data size (for one region). */
-#endif
+    bool independent = false; /* True for independent NETCDF4P writes. */
+    double start = MPI_Wtime(); /* For the I/O statistics. */
     int ierr = PIO_NOERR;
-#if USE_VARD_WRITE
-    PIO_Offset gdim0;  /* global size of first dimension if no unlimited dimension and ndims<fndims */
-    bool use_vard=true;
-    gdim0 = 0;
-#endif
+    int ret;
+
     /* Check inputs. */
     pioassert(file && file->iosystem && varids && varids[0] >= 0 && varids[0] <= PIO_MAX_VARS &&
               iodesc, "invalid input", __FILE__, __LINE__);
@@ -388,17 +821,15 @@ write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *vari
           "iodesc->maxregions = %d iodesc->llen = %d", nvars, iodesc->ndims,
           iodesc->mpitype, iodesc->maxregions, iodesc->llen));
 
-#ifdef TIMING
-    /* Start timer if desired. */
-    if ((ierr = pio_start_timer("PIO:write_darray_multi_par")))
-        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
-#endif /* TIMING */
-
     /* Get pointer to iosystem. */
     ios = file->iosystem;
 
+    /* Start timer if they are on. */
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_WRITE_MULTI_PAR)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
     /* Point to var description scruct for first var. */
-    if ((ierr = get_var_desc(varids[0], &file->varlist, &vdesc)))
+    if ((ierr = get_file_var_desc(file, varids[0], &vdesc)))
         return pio_err(NULL, file, ierr, __FILE__, __LINE__);
 
     /* Set these differently for data and fill writing. */
@@ -407,15 +838,6 @@ write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *vari
     PIO_Offset llen = fill ? iodesc->holegridsize : iodesc->llen;
     void *iobuf = fill ? vdesc->fillbuf : file->iobuf;
 
-#if USE_VARD_WRITE
-    if (!ios->async || !ios->ioproc)
-    {
-        if ((ierr = get_gdim0(file, iodesc, varids[0], fndims, &gdim0)))
-            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-
-    }
-#endif
-
     /* If this is an IO task write the data. */
     if (ios->ioproc)
     {
@@ -429,13 +851,40 @@ write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *vari
         PIO_Offset *countlist[num_regions]; /* Array of count  arrays for ncmpi_iput_varn(). */
 #endif /* _PNETCDF */
 
+        /* Size the chunk caches for this decomposition, if asked
+         * for. */
+        if (!fill)
+            for (int nv = 0; nv < nvars; nv++)
+                if ((ierr = pio_auto_chunk_cache(file, iodesc, varids[nv])))
+                    return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+#ifdef _NETCDF4
+        /* Set the access mode of all the vars once, before the
+         * regions are written. HDF5 can only extend datasets and run
+         * filters collectively. */
+        if (file->iotype == PIO_IOTYPE_NETCDF4P)
+        {
+            independent = file->independent && !vdesc->rec_var;
+            for (int nv = 0; !ierr && independent && nv < nvars; nv++)
+            {
+                bool filtered;
+
+                if (!(ierr = var_is_filtered(file, varids[nv], &filtered)))
+                    independent = !filtered;
+            }
+            for (int nv = 0; !ierr && nv < nvars; nv++)
+                ierr = nc_var_par_access(file->fh, varids[nv],
+                                         independent ? NC_INDEPENDENT : NC_COLLECTIVE);
+        }
+#endif
+
         /* Process each region of data to be written. */
         for (int regioncnt = 0; regioncnt < num_regions; regioncnt++)
         {
             /* Fill the start/count arrays. */
-            if ((ierr = find_start_count(iodesc->ndims, fndims, vdesc, region, frame,
-                                         start, count)))
-                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            if ((ret = find_start_count(iodesc->ndims, fndims, vdesc, region, frame,
+                                        start, count)))
+                return pio_err(ios, file, ret, __FILE__, __LINE__);
 
             /* IO tasks will run the netCDF/pnetcdf functions to write the data. */
             switch (file->iotype)
@@ -454,12 +903,22 @@ write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *vari
                     if (region)
                         bufptr = (void *)((char *)iobuf + iodesc->mpitype_size * (nv * llen + region->loffset));
 
-                    /* Ensure collective access. */
-                    ierr = nc_var_par_access(file->fh, varids[nv], NC_COLLECTIVE);
+                    /* With independent access, tasks with nothing to
+                     * write in this region don't call netCDF. */
+                    if (independent)
+                    {
+                        dsize = 1;
+                        for (int i = 0; i < fndims; i++)
+                            dsize *= count[i];
+                        if (!dsize)
+                            continue;
+                    }
 
-                    /* Write the data for this variable. */
-                    if (!ierr)
-                        ierr = nc_put_vara(file->fh, varids[nv], (size_t *)start, (size_t *)count, bufptr);
+                    /* Write the data for this variable, keeping the
+                     * first error. */
+                    if ((ret = nc_put_vara(file->fh, varids[nv], (size_t *)start,
+                                           (size_t *)count, bufptr)) && !ierr)
+                        ierr = ret;
                 }
                 break;
 #endif
@@ -497,176 +956,102 @@ write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *vari
                 /* Do this when we reach the last region. */
                 if (regioncnt == num_regions - 1)
                 {
-#ifdef USE_VARD_WRITE
-                    MPI_Aint   var0_offset, var_offsets[nvars];
-                    MPI_Offset vari_offset, vard_llen=0;
-                    MPI_Datatype vartypes[nvars];
-                    MPI_Datatype filetype = MPI_DATATYPE_NULL;
-                    int blocklens[nvars];
-                    int fvartype, var0_id;
-                    int numReqs=0;
-                    void *vard_bufptr;
-                    int doFlush[nvars]; /* whether to flush or not */
-
-                    /* construct doFlush[], so later when looping through nvars,
-                     * it tells whether to flush or not.
-                     */
-                    for (int nv = 0; nv < nvars; nv++) {
-                        /* Get the var info. */
-                        if ((ierr = get_var_desc(varids[nv], &file->varlist, &vdesc)))
-                            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-                        if (nv == 0) { /* first variable */
-                            fvartype = vdesc->pio_type; /* first var's var type */
-                            continue;
-                        }
-                        if (fvartype != vdesc->pio_type) {
-                            /* nv's external datatype is different from nv-1 */
-                            doFlush[nv-1] = 1;
-                            fvartype = vdesc->pio_type;
-                        }
-                        else /* same as nv-1, no flush */
-                            doFlush[nv-1] = 0;
-                    }
-                    doFlush[nvars-1] = 1; /* flush when reach the last variable */
-#endif
-                    /* For each variable to be written. */
-                    for (int nv = 0; nv < nvars; nv++)
+                    if (file->stage_fp)
+                        ierr = stage_put_vars(file, iodesc, nvars, varids, fndims, frame,
+                                              iobuf, llen, rrcnt, startlist, countlist);
+                    else if (file->use_vard)
+                        ierr = put_vard_vars(file, iodesc, nvars, varids, fndims, fill, frame,
+                                             iobuf, llen, rrcnt, startlist, countlist);
+                    else
                     {
-#if USE_VARD_WRITE
-                        /* PnetCDF 1.10.0 and later support type conversion in
-                         * vard APIs. However, it requires all variables
-                         * accessed by the filetype are of the same NC data
-                         * type.
-                         */
-
-                        /* obtain file offset of variable nv */
-                        if ((ierr = ncmpi_inq_varoffset(file->fh, varids[nv], &vari_offset)))
-                            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-
-                        if (numReqs == 0) { /* 1st variable of same datatype */
-                            var0_offset = vari_offset;
-                            var0_id = varids[nv];
-                        }
-                        /* calculate the offset relative to the first var */
-                        var_offsets[numReqs] = vari_offset - var0_offset;
-                        blocklens[nv] = 1; /* 1 for each vartypes[nv] */
-
-                        /* If this is the first variable or the frame has changed between variables (this should be rare) */
-                        if(nv==0 || (nv > 0 && frame != NULL && frame[nv] != frame[nv-1])){
-                            int thisframe;
-                            PIO_Offset unlimdimoffset;
-                            if (gdim0 == 0) /* if there is an unlimited dimension get the offset between records of a variable */
-                            {
-                                if((ierr = ncmpi_inq_recsize(file->fh, &unlimdimoffset)))
-                                    return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-                                PLOG((3, "num_regions = %d unlimdimoffset %ld", num_regions, unlimdimoffset));
-                            }else
-                                unlimdimoffset = gdim0;
-                            if (frame)
-                                thisframe = frame[nv];
-                            else
-                                thisframe = 0;
+                        bool batched[nvars]; /* True for arrays written with an earlier one. */
 
-                            ierr = get_vard_mpidatatype(iodesc, gdim0, unlimdimoffset,
-                                                        rrcnt, ndims, fndims,
-                                                        thisframe, startlist, countlist,
-                                                        &vartypes[numReqs]);
-                        }
-                        else /* reuse the previous variable's datatype */
-                            vartypes[numReqs] = vartypes[numReqs-1];
-#else
-                        /* Get the var info. */
-                        if ((ierr = get_var_desc(varids[nv], &file->varlist, &vdesc)))
-                            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-
-                        if (vdesc->record >= 0 && ndims < fndims)
-                            for (int rc = 0; rc < rrcnt; rc++)
-                                startlist[rc][0] = frame[nv];
-#endif
-                        /* Get a pointer to the data. */
-                        bufptr = (void *)((char *)iobuf + nv * iodesc->mpitype_size * llen);
+                        for (int nv = 0; nv < nvars; nv++)
+                            batched[nv] = false;
 
-#if USE_VARD_WRITE
-                        if (numReqs == 0) { /* first var of the same type */
-                            vard_bufptr = bufptr; /* preserve variable ID */
-                            vard_llen = llen;     /* reset I/O request size */
-                        }
-                        numReqs++;
-
-                        if (doFlush[nv]) { /* flush the data now */
-                            int mpierr;
-                            /* concatenate vartypes[0...numReqs-1] */
-                            if (numReqs > 1) {
-                                /* check and remove NULL vartype */
-                                int i, j=0;
-                                for (i=0; i<numReqs; i++) {
-                                    if (vartypes[i] != MPI_DATATYPE_NULL) {
-                                        if (j < i) vartypes[j] = vartypes[i];
-                                        j++;
+                        /* For each variable to be written. */
+                        for (int nv = 0; nv < nvars; nv++)
+                        {
+                            int request = NC_REQ_NULL;
+                            int batch[nvars]; /* Arrays of consecutive frames of this var. */
+                            int nframes = 1;
+                            MPI_Datatype buftype = iodesc->mpitype;
+                            PIO_Offset bufcount = llen;
+
+                            if (batched[nv])
+                                continue;
+
+                            /* Get the var info. */
+                            if ((ierr = get_file_var_desc(file, varids[nv], &vdesc)))
+                                return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+
+                            /* Get a pointer to the data. */
+                            bufptr = (void *)((char *)iobuf + nv * iodesc->mpitype_size * llen);
+
+                            if (vdesc->record >= 0 && ndims < fndims)
+                            {
+                                /* Find the arrays of the next frames of
+                                 * this var, and write them all with the
+                                 * regions extended along the record
+                                 * dimension. */
+                                batch[0] = nv;
+                                for (int m = nv + 1; m < nvars; m++)
+                                    if (varids[m] == varids[nv] && !batched[m] &&
+                                        frame[m] == frame[nv] + nframes)
+                                    {
+                                        batch[nframes++] = m;
+                                        batched[m] = true;
                                     }
+
+                                for (int rc = 0; rc < rrcnt; rc++)
+                                {
+                                    startlist[rc][0] = frame[nv];
+                                    countlist[rc][0] = nframes;
                                 }
-                                if (j > 0) { /* at least one vartypes[] is not NULL */
-                                    /* concatenate non-NULL vartypes */
-                                    if((mpierr = MPI_Type_create_struct(j, blocklens, var_offsets, vartypes, &filetype)))
-                                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-                                    if((mpierr = MPI_Type_commit(&filetype)))
-                                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-                                    /* free vartypes */
-                                    for (i=j-1; i>0; i--) {
-                                        if (vartypes[i] == vartypes[i-1]) continue;
-                                        if((mpierr = MPI_Type_free(&vartypes[i])))
-                                            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-                                    }
-                                    if((mpierr = MPI_Type_free(&vartypes[0])))
-                                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+                                /* The data of each region are taken from
+                                 * each of the arrays in turn. */
+                                if (nframes > 1 &&
+                                    (ierr = get_frames_buftype(iodesc, llen, rrcnt, fndims,
+                                                               countlist, nframes, batch,
+                                                               &buftype)))
+                                    return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                                if (nframes > 1)
+                                {
+                                    bufptr = iobuf;
+                                    bufcount = 1;
                                 }
-                                else /* all vartypes[] are NULL */
-                                    filetype = MPI_DATATYPE_NULL;
                             }
-                            else /* there is only one variable to flush */
-                                filetype = vartypes[0];
 
-                            PLOG((3, "vard: call ncmpi_put_vard llen = %d %d", llen, iodesc->mpitype_size ));
-                            ierr = ncmpi_put_vard_all(file->fh, var0_id, filetype, vard_bufptr, vard_llen, iodesc->mpitype);
-                            PLOG((3, "vard: return ncmpi_put_vard ierr = %d", ierr));
-                            if(filetype != MPI_DATATYPE_NULL)
+                            /* Write, in non-blocking fashion, a list of subarrays. */
+                            if (file->darray_bput)
+                                ierr = ncmpi_bput_varn(file->fh, varids[nv], rrcnt, startlist,
+                                                       countlist, bufptr, bufcount, buftype,
+                                                       &request);
+                            else
+                                ierr = ncmpi_iput_varn(file->fh, varids[nv], rrcnt, startlist,
+                                                       countlist, bufptr, bufcount, buftype,
+                                                       &request);
+
+                            /* The data are packed by pnetcdf when the
+                             * request is posted. */
+                            if (nframes > 1)
                             {
-                                if((mpierr = MPI_Type_free(&filetype)))
-                                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+                                MPI_Type_free(&buftype);
+                                for (int rc = 0; rc < rrcnt; rc++)
+                                    countlist[rc][0] = 1;
                             }
-                            vard_llen = 0; /* reset request size to 0 */
-                            numReqs = 0;
-                        }
-                        else /* don't flush yet, accumulate the request size */
-                            vard_llen += llen;
-#else
-                        if (vdesc->nreqs % PIO_REQUEST_ALLOC_CHUNK == 0)
-                        {
-                            if (!(vdesc->request = realloc(vdesc->request, sizeof(int) *
-                                                           (vdesc->nreqs + PIO_REQUEST_ALLOC_CHUNK))))
-                                return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
 
-                            for (int i = vdesc->nreqs; i < vdesc->nreqs + PIO_REQUEST_ALLOC_CHUNK; i++)
-                                vdesc->request[i] = NC_REQ_NULL;
+                            /* Queue the request, even if it is NC_REQ_NULL,
+                             * to keep the wait calls in sync. */
+                            if (!ierr)
+                                ierr = pio_queue_put_request(file, varids[nv],
+                                                             vdesc->record >= 0 && ndims < fndims ?
+                                                             frame[nv] : -1, request,
+                                                             nframes * llen * iodesc->mpitype_size,
+                                                             iodesc->ioid);
                         }
-
-                        /* Write, in non-blocking fashion, a list of subarrays. */
-//                        PLOG((3, "about to call ncmpi_iput_varn() varids[%d] = %d rrcnt = %d, llen = %d",
-//                              nv, varids[nv], rrcnt, llen));
-//                        for(int i=0;i < llen; i++)
-//                            PLOG((3, "bufptr[%d] = %d",i,((int *)bufptr)[i]));
-                        ierr = ncmpi_iput_varn(file->fh, varids[nv], rrcnt, startlist, countlist,
-                                               bufptr, llen, iodesc->mpitype, &vdesc->request[vdesc->nreqs]);
-
-                        /* keeps wait calls in sync */
-                        if (vdesc->request[vdesc->nreqs] == NC_REQ_NULL)
-                            vdesc->request[vdesc->nreqs] = PIO_REQ_NULL;
-
-                        vdesc->nreqs++;
-#endif
-                    }
+                    }
 
                     /* Free resources. */
                     for (int i = 0; i < rrcnt; i++)
@@ -687,13 +1072,17 @@ write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *vari
         } /* next regioncnt */
     } /* endif (ios->ioproc) */
 
-    /* Check the return code from the netCDF/pnetcdf call. */
-    ierr = check_netcdf(file, ierr, __FILE__,__LINE__);
+    /* Check the return code from the netCDF/pnetcdf call. In write
+     * behind mode the computation tasks don't wait for it, and the
+     * IO tasks keep it for PIOc_sync(). */
+    if (!ios->async || !ios->write_behind)
+        ierr = check_netcdf(file, ierr, __FILE__,__LINE__);
 
-#ifdef TIMING
-    if ((ierr = pio_stop_timer("PIO:write_darray_multi_par")))
-        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-#endif /* TIMING */
+    if (ios->ioproc)
+        pio_stats_io(file, iodesc, true, fill, nvars, llen, num_regions, start);
+
+    if ((ret = pio_stop_timer(ios, PIO_TIMER_WRITE_MULTI_PAR)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
     return ierr;
 }
@@ -778,6 +1167,35 @@ find_all_start_count(io_region *region, int maxregions, int fndims,
     return PIO_NOERR;
 }
 
+/**
+ * Get the IO tasks whose data are written or read by the same IO task,
+ * for the serial iotypes. These are all of the IO tasks, or, for
+ * subfiled files (see PIOc_set_subfiles()), those of the subfile of
+ * this task. Rank 0 does the IO.
+ *
+ * @param file a pointer to the open file descriptor.
+ * @param comm pointer that gets the communicator.
+ * @param rank pointer that gets the rank of this task in comm.
+ * @param size pointer that gets the size of comm.
+ * @author Ed Hartnett
+ */
+static void
+serial_comm(file_desc_t *file, MPI_Comm *comm, int *rank, int *size)
+{
+    if (file->num_subfiles)
+    {
+        *comm = file->subfile_comm;
+        MPI_Comm_rank(*comm, rank);
+        MPI_Comm_size(*comm, size);
+    }
+    else
+    {
+        *comm = file->iosystem->io_comm;
+        *rank = file->iosystem->io_rank;
+        *size = file->iosystem->num_iotasks;
+    }
+}
+
 /**
  * Internal function called by IO tasks other than IO task 0 to send
  * their tmp_start/tmp_count arrays to IO task 0.
@@ -785,48 +1203,65 @@ find_all_start_count(io_region *region, int maxregions, int fndims,
  * This is an internal function which is only called on io tasks other
  * than IO task 0. It is called by write_darray_multi_serial().
  *
+ * After the handshake from IO task 0, the length of the IO buffer,
+ * the number of regions and the start/count arrays are sent in one
+ * header message (of PIO_Offset), then the data.
+ *
  * @return 0 for success, error code otherwise.
  * @ingroup PIO_write_darray_c
  * @author Jim Edwards, Ed Hartnett
  */
 int
-send_all_start_count(iosystem_desc_t *ios, io_desc_t *iodesc, PIO_Offset llen,
+send_all_start_count(file_desc_t *file, io_desc_t *iodesc, PIO_Offset llen,
                      int maxregions, int nvars, int fndims, size_t *tmp_start,
                      size_t *tmp_count, void *iobuf)
 {
+    iosystem_desc_t *ios = file->iosystem;
+    MPI_Comm comm;         /* The IO tasks that send to the same task. */
+    int rank, size;        /* Rank and size of comm. */
+    PIO_Offset *hdr;       /* The packed header. */
+    int hlen = 2;          /* Length of the header. */
     MPI_Status status;     /* Recv status for MPI. */
     int mpierr;  /* Return code from MPI function codes. */
     int ierr;    /* Return code. */
 
+    serial_comm(file, &comm, &rank, &size);
+
     /* Check inputs. */
-    pioassert(ios && ios->ioproc && ios->io_rank > 0 && maxregions >= 0,
+    pioassert(ios && ios->ioproc && rank > 0 && maxregions >= 0,
               "invalid inputs", __FILE__, __LINE__);
 
-    /* Do a handshake. */
-    if ((mpierr = MPI_Recv(&ierr, 1, MPI_INT, 0, 0, ios->io_comm, &status)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    /* Local length of iobuffer for each field (all fields are the
+     * same length), then the number of data regions and the
+     * start/count for all regions. */
+    if (!(hdr = malloc((2 + 2 * maxregions * fndims) * sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    hdr[0] = llen;
+    hdr[1] = maxregions;
+    if (llen > 0)
+    {
+        for (int i = 0; i < maxregions * fndims; i++)
+        {
+            hdr[2 + i] = tmp_start[i];
+            hdr[2 + maxregions * fndims + i] = tmp_count[i];
+        }
+        hlen += 2 * maxregions * fndims;
+    }
 
-    /* Send local length of iobuffer for each field (all
-     * fields are the same length). */
-    if ((mpierr = MPI_Send((void *)&llen, 1, MPI_OFFSET, 0, ios->io_rank, ios->io_comm)))
+    /* Do a handshake. */
+    mpierr = MPI_Recv(&ierr, 1, MPI_INT, 0, 0, comm, &status);
+    if (!mpierr)
+        mpierr = MPI_Send(hdr, hlen, MPI_OFFSET, 0, rank, comm);
+    free(hdr);
+    if (mpierr)
         return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    PLOG((3, "sent llen = %d", llen));
+    PLOG((3, "sent llen = %d maxregions = %d", llen, maxregions));
 
-    /* Send the number of data regions, the start/count for
-     * all regions, and the data buffer with all the data. */
+    /* Send the data buffer with all the data. */
     if (llen > 0)
     {
-        if ((mpierr = MPI_Send((void *)&maxregions, 1, MPI_INT, 0, ios->io_rank + ios->num_iotasks,
-                               ios->io_comm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Send(tmp_start, maxregions * fndims, MPI_OFFSET, 0,
-                               ios->io_rank + 2 * ios->num_iotasks, ios->io_comm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Send(tmp_count, maxregions * fndims, MPI_OFFSET, 0,
-                               ios->io_rank + 3 * ios->num_iotasks, ios->io_comm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
         if ((mpierr = MPI_Send(iobuf, nvars * llen, iodesc->mpitype, 0,
-                               ios->io_rank + 4 * ios->num_iotasks, ios->io_comm)))
+                               rank + size, comm)))
             return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
         PLOG((3, "sent data for maxregions = %d", maxregions));
     }
@@ -834,11 +1269,118 @@ send_all_start_count(iosystem_desc_t *ios, io_desc_t *iodesc, PIO_Offset llen,
     return PIO_NOERR;
 }
 
+/**
+ * Write the data of one IO task. This is called on IO task 0 by
+ * recv_and_write_data().
+ *
+ * @param file a pointer to the open file descriptor for the file
+ * that will be written to.
+ * @param varids an array of the variable ids to be written
+ * @param frame the record dimension for each of the nvars variables
+ * in iobuf.  NULL if this iodesc contains non-record vars.
+ * @param iodesc pointer to the decomposition info.
+ * @param rlen length of the data of each variable.
+ * @param rregions number of regions.
+ * @param nvars the number of variables.
+ * @param fndims the number of dimensions in the file.
+ * @param tmp_start the start values of all regions.
+ * @param tmp_count the count values of all regions.
+ * @param iobuf the data.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+write_task_regions(file_desc_t *file, const int *varids, const int *frame,
+                   io_desc_t *iodesc, size_t rlen, int rregions, int nvars, int fndims,
+                   const size_t *tmp_start, const size_t *tmp_count, void *iobuf)
+{
+    size_t start[fndims], count[fndims];
+    size_t loffset = 0;
+    void *bufptr;
+    var_desc_t *vdesc;    /* Contains info about the variable. */
+    int ierr;    /* Return code. */
+
+    if ((ierr = get_file_var_desc(file, varids[0], &vdesc)))
+        return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+
+    for (int regioncnt = 0; regioncnt < rregions; regioncnt++)
+    {
+        PLOG((3, "writing data for region with regioncnt = %d", regioncnt));
+        bool needtowrite = true;
+
+        /* Get the start/count arrays for this region. */
+        for (int i = 0; i < fndims; i++)
+        {
+            start[i] = tmp_start[i + regioncnt * fndims];
+            count[i] = tmp_count[i + regioncnt * fndims];
+            PLOG((3, "needtowrite %d count[%d] %d\n",needtowrite, i, count[i]));
+            if(i>0 || vdesc->record <0)
+                needtowrite = (count[i] > 0 && needtowrite);
+        }
+
+        /* Process each variable in the buffer. */
+        for (int nv = 0; nv < nvars; nv++)
+        {
+            PLOG((3, "writing buffer var %d", nv));
+
+            /* Get a pointer to the correct part of the buffer. */
+            bufptr = (void *)((char *)iobuf + iodesc->mpitype_size * (nv * rlen + loffset));
+
+            /* If this var has an unlimited dim, set
+             * the start on that dim to the frame
+             * value for this variable. */
+            if (vdesc->record >= 0)
+            {
+                if (fndims > 1 && iodesc->ndims < fndims && count[1] > 0)
+                {
+                    count[0] = 1;
+                    start[0] = frame[nv];
+                }
+                else if (fndims == iodesc->ndims)
+                {
+                    start[0] += vdesc->record;
+                }
+            }
+
+#ifdef LOGGING
+            if(needtowrite)
+                for (int i = 1; i < fndims; i++)
+                    PLOG((3, "(serial) start[%d] %d count[%d] %d needtowrite %d", i, start[i], i, count[i], needtowrite));
+#endif /* LOGGING */
+
+            /* Call the netCDF functions to write the data. */
+            if (needtowrite)
+                if ((ierr = nc_put_vara(file->fh, varids[nv], start, count, bufptr)))
+                    return ierr;
+
+        } /* next var */
+
+        /* Calculate the total size. */
+        size_t tsize = 1;
+        for (int i = 0; i < fndims; i++)
+            tsize *= count[i];
+
+        /* Keep track of where we are in the buffer. */
+        loffset += tsize;
+
+        PLOG((3, " at bottom of loop regioncnt = %d tsize = %d loffset = %d", regioncnt,
+              tsize, loffset));
+    } /* next regioncnt */
+
+    return PIO_NOERR;
+}
+
 /**
  * This is an internal function that is run only on IO proc 0. It
  * receives data from all the other IO tasks, and write that data to
  * disk. This is called from write_darray_multi_serial().
  *
+ * The receives are pipelined with the writes: while the data of one
+ * task are written, the data of the next are already being received
+ * with MPI_Irecv(), into the other of two buffers. One of these is
+ * iobuf, which is free once this task's own data are written.
+ *
  * @param file a pointer to the open file descriptor for the file
  * that will be written to.
  * @param varids an array of the variable ids to be written
@@ -875,15 +1417,17 @@ recv_and_write_data(file_desc_t *file, const int *varids, const int *frame,
                     int fndims, size_t *tmp_start, size_t *tmp_count, void *iobuf)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
-    size_t rlen;    /* Length of IO buffer on this task. */
-    int rregions;   /* Number of regions in buffer for this task. */
-    size_t start[fndims], count[fndims];
-    size_t loffset;
-    void *bufptr;
-    var_desc_t *vdesc;    /* Contains info about the variable. */
+    MPI_Comm comm;         /* The IO tasks that send to this task. */
+    int rank, size;        /* Rank and size of comm. */
+    int hlen = 2 + 2 * maxregions * fndims; /* Length of the headers. */
+    PIO_Offset *hdr[2];    /* Headers of the tasks in the two buffers. */
+    void *buf[2];          /* The two data buffers. */
+    size_t bufsize = 0;    /* Size of buf[1]. */
+    MPI_Request req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
     MPI_Status status;     /* Recv status for MPI. */
-    int mpierr;  /* Return code from MPI function codes. */
-    int ierr;    /* Return code. */
+    int werr = PIO_NOERR;  /* First error from the writes. */
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
+    int ierr = PIO_NOERR;  /* Return code. */
 
     /* Check inputs. */
     pioassert(file && varids && iodesc && tmp_start && tmp_count, "invalid input",
@@ -894,125 +1438,110 @@ recv_and_write_data(file_desc_t *file, const int *varids, const int *frame,
 
     /* Get pointer to IO system. */
     ios = file->iosystem;
+    serial_comm(file, &comm, &rank, &size);
+
+    if (!(hdr[0] = malloc(2 * hlen * sizeof(PIO_Offset))))
+        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    hdr[1] = hdr[0] + hlen;
+
+    /* Task 0 writes its own data from iobuf, which then takes the
+     * data of the even tasks. */
+    buf[0] = iobuf;
+    buf[1] = NULL;
+    hdr[0][0] = llen;
+    hdr[0][1] = maxregions;
 
     /* For each of the other tasks that are using this task
-     * for IO. */
-    for (int rtask = 0; rtask < ios->num_iotasks; rtask++)
+     * for IO. An MPI or memory error stops the loop, and the buffers
+     * are freed below. */
+    for (int rtask = 0; rtask < size; rtask++)
     {
-        /* From the remote tasks, we send information about
-         * the data regions. and also the data. */
-        if (rtask)
+        int slot = rtask % 2;
+        int next = rtask + 1;
+        size_t rlen;    /* Length of IO buffer on this task. */
+        int rregions;   /* Number of regions in buffer for this task. */
+
+        /* Start receiving the data of the next task. The buffer it
+         * goes to was written from on the last pass. */
+        if (next < size)
         {
+            PIO_Offset *nhdr = hdr[next % 2];
+
             /* handshake - tell the sending task I'm ready */
-            if ((mpierr = MPI_Send(&ierr, 1, MPI_INT, rtask, 0, ios->io_comm)))
-                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            if ((mpierr = MPI_Send(&ierr, 1, MPI_INT, next, 0, comm)))
+                break;
 
-            /* Get length of iobuffer for each field on this
-             * task (all fields are the same length). */
-            if ((mpierr = MPI_Recv(&rlen, 1, MPI_OFFSET, rtask, rtask, ios->io_comm,
+            /* Get the length of iobuffer for each field on this task
+             * (all fields are the same length), the number of
+             * regions and the start/count values for all regions. */
+            if ((mpierr = MPI_Recv(nhdr, hlen, MPI_OFFSET, next, next, comm,
                                    &status)))
-                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-            PLOG((3, "received rlen = %d", rlen));
+                break;
+            PLOG((3, "received rlen = %d rregions = %d", nhdr[0], nhdr[1]));
 
-            /* Get the number of regions, the start/count
-             * values for all regions, and the data buffer. */
-            if (rlen > 0)
+            if (nhdr[0] > 0)
             {
-                if ((mpierr = MPI_Recv(&rregions, 1, MPI_INT, rtask, rtask + ios->num_iotasks,
-                                       ios->io_comm, &status)))
-                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-                if ((mpierr = MPI_Recv(tmp_start, rregions * fndims, MPI_OFFSET, rtask,
-                                       rtask + 2 * ios->num_iotasks, ios->io_comm, &status)))
-                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-                if ((mpierr = MPI_Recv(tmp_count, rregions * fndims, MPI_OFFSET, rtask,
-                                       rtask + 3 * ios->num_iotasks, ios->io_comm, &status)))
-                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-                if ((mpierr = MPI_Recv(iobuf, nvars * rlen, iodesc->mpitype, rtask,
-                                       rtask + 4 * ios->num_iotasks, ios->io_comm, &status)))
-                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-                PLOG((3, "received data rregions = %d fndims = %d", rregions, fndims));
+                size_t nbytes = nvars * nhdr[0] * iodesc->mpitype_size;
+
+                if (next % 2 && nbytes > bufsize)
+                {
+                    free(buf[1]);
+                    if (!(buf[1] = malloc(nbytes)))
+                    {
+                        ierr = PIO_ENOMEM;
+                        break;
+                    }
+                    bufsize = nbytes;
+                }
+                if ((mpierr = MPI_Irecv(buf[next % 2], nvars * nhdr[0], iodesc->mpitype, next,
+                                        next + size, comm, &req[next % 2])))
+                    break;
             }
         }
-        else /* task 0 */
-        {
-            rlen = llen;
-            rregions = maxregions;
-        }
+
+        rlen = hdr[slot][0];
+        rregions = hdr[slot][1];
         PLOG((3, "rtask = %d rlen = %d rregions = %d", rtask, rlen, rregions));
 
-        /* If there is data from this task, write it. */
+        /* If there is data from this task, write it. After an error
+         * the data are still received, so that the other IO tasks
+         * don't hang, but not written. */
         if (rlen > 0)
         {
-            loffset = 0;
-            for (int regioncnt = 0; regioncnt < rregions; regioncnt++)
+            if (rtask)
             {
-                PLOG((3, "writing data for region with regioncnt = %d", regioncnt));
-                bool needtowrite = true;
-
-                if ((ierr = get_var_desc(varids[0], &file->varlist, &vdesc)))
-                    return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-
-                /* Get the start/count arrays for this region. */
-                for (int i = 0; i < fndims; i++)
+                for (int i = 0; i < rregions * fndims; i++)
                 {
-                    start[i] = tmp_start[i + regioncnt * fndims];
-                    count[i] = tmp_count[i + regioncnt * fndims];
-                    PLOG((3, "needtowrite %d count[%d] %d\n",needtowrite, i, count[i]));
-                    if(i>0 || vdesc->record <0)
-                        needtowrite = (count[i] > 0 && needtowrite);
+                    tmp_start[i] = hdr[slot][2 + i];
+                    tmp_count[i] = hdr[slot][2 + rregions * fndims + i];
                 }
-
-                /* Process each variable in the buffer. */
-                for (int nv = 0; nv < nvars; nv++)
-                {
-                    PLOG((3, "writing buffer var %d", nv));
-
-                    /* Get a pointer to the correct part of the buffer. */
-                    bufptr = (void *)((char *)iobuf + iodesc->mpitype_size * (nv * rlen + loffset));
-
-                    /* If this var has an unlimited dim, set
-                     * the start on that dim to the frame
-                     * value for this variable. */
-                    if (vdesc->record >= 0)
-                    {
-                        if (fndims > 1 && iodesc->ndims < fndims && count[1] > 0)
-                        {
-                            count[0] = 1;
-                            start[0] = frame[nv];
-                        }
-                        else if (fndims == iodesc->ndims)
-                        {
-                            start[0] += vdesc->record;
-                        }
-                    }
-
-#ifdef LOGGING
-                    if(needtowrite)
-                        for (int i = 1; i < fndims; i++)
-                            PLOG((3, "(serial) start[%d] %d count[%d] %d needtowrite %d", i, start[i], i, count[i], needtowrite));
-#endif /* LOGGING */
-
-                    /* Call the netCDF functions to write the data. */
-                    if (needtowrite)
-                        if ((ierr = nc_put_vara(file->fh, varids[nv], start, count, bufptr)))
-                            return check_netcdf2(ios, NULL, ierr, __FILE__, __LINE__);
-
-                } /* next var */
-
-                /* Calculate the total size. */
-                size_t tsize = 1;
-                for (int i = 0; i < fndims; i++)
-                    tsize *= count[i];
-
-                /* Keep track of where we are in the buffer. */
-                loffset += tsize;
-
-                PLOG((3, " at bottom of loop regioncnt = %d tsize = %d loffset = %d", regioncnt,
-                      tsize, loffset));
-            } /* next regioncnt */
+                if ((mpierr = MPI_Wait(&req[slot], &status)))
+                    break;
+            }
+            if (!werr)
+                werr = write_task_regions(file, varids, frame, iodesc, rlen, rregions, nvars,
+                                          fndims, tmp_start, tmp_count, buf[slot]);
         } /* endif (rlen > 0) */
     } /* next rtask */
 
+    /* A receive still pending after an error must not go to a freed
+     * buffer. */
+    for (int r = 0; r < 2; r++)
+        if (req[r] != MPI_REQUEST_NULL)
+        {
+            MPI_Cancel(&req[r]);
+            MPI_Wait(&req[r], MPI_STATUS_IGNORE);
+        }
+    free(hdr[0]);
+    free(buf[1]);
+
+    if (mpierr)
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (ierr)
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+    if (werr)
+        return check_netcdf2(ios, NULL, werr, __FILE__, __LINE__);
+
     return PIO_NOERR;
 }
 
@@ -1042,6 +1571,7 @@ write_darray_multi_serial(file_desc_t *file, int nvars, int fndims, const int *v
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     var_desc_t *vdesc;     /* Contains info about the variable. */
+    double start = MPI_Wtime(); /* For the I/O statistics. */
     int ierr;              /* Return code. */
 
     /* Check inputs. */
@@ -1055,7 +1585,7 @@ write_darray_multi_serial(file_desc_t *file, int nvars, int fndims, const int *v
     ios = file->iosystem;
 
     /* Get the var info. */
-    if ((ierr = get_var_desc(varids[0], &file->varlist, &vdesc)))
+    if ((ierr = get_file_var_desc(file, varids[0], &vdesc)))
         return pio_err(NULL, file, ierr, __FILE__, __LINE__);
 
     /* Set these differently for data and fill writing. iobuf may be
@@ -1065,17 +1595,17 @@ write_darray_multi_serial(file_desc_t *file, int nvars, int fndims, const int *v
     PIO_Offset llen = fill ? iodesc->holegridsize : iodesc->llen;
     void *iobuf = fill ? vdesc->fillbuf : file->iobuf;
 
-#ifdef TIMING
-    /* Start timer if desired. */
-    if ((ierr = pio_start_timer("PIO:write_darray_multi_serial")))
+    /* Start timer if they are on. */
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_WRITE_MULTI_SERIAL)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-#endif /* TIMING */
 
     /* Only IO tasks participate in this code. */
     if (ios->ioproc)
     {
         size_t tmp_start[fndims * num_regions]; /* A start array for each region. */
         size_t tmp_count[fndims * num_regions]; /* A count array for each region. */
+        MPI_Comm comm;  /* The IO tasks whose data are written by the same task. */
+        int rank, size; /* Rank and size of comm. */
 
         PLOG((3, "num_regions = %d", num_regions));
 
@@ -1085,12 +1615,14 @@ write_darray_multi_serial(file_desc_t *file, int nvars, int fndims, const int *v
                                          tmp_start, tmp_count)))
             return pio_err(ios, file, ierr, __FILE__, __LINE__);
 
-        /* Tasks other than 0 will send their data to task 0. */
-        if (ios->io_rank > 0)
+        /* Tasks other than 0 will send their data to task 0 (of
+         * their subfile). */
+        serial_comm(file, &comm, &rank, &size);
+        if (rank > 0)
         {
             /* Send the tmp_start and tmp_count arrays from this IO task
              * to task 0. */
-            if ((ierr = send_all_start_count(ios, iodesc, llen, num_regions, nvars, fndims,
+            if ((ierr = send_all_start_count(file, iodesc, llen, num_regions, nvars, fndims,
                                              tmp_start, tmp_count, iobuf)))
                 return pio_err(ios, file, ierr, __FILE__, __LINE__);
         }
@@ -1102,12 +1634,12 @@ write_darray_multi_serial(file_desc_t *file, int nvars, int fndims, const int *v
                                             tmp_start, tmp_count, iobuf)))
                 return pio_err(ios, file, ierr, __FILE__, __LINE__);
         }
+
+        pio_stats_io(file, iodesc, true, fill, nvars, llen, num_regions, start);
     }
 
-#ifdef TIMING
-    if ((ierr = pio_stop_timer("PIO:write_darray_multi_serial")))
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_WRITE_MULTI_SERIAL)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-#endif /* TIMING */
 
     return PIO_NOERR;
 }
@@ -1126,22 +1658,26 @@ write_darray_multi_serial(file_desc_t *file, int nvars, int fndims, const int *v
  * on each io task and so if the total number of bytes to write is
  * less than blocksize*numiotasks then some iotasks will have a NULL
  * iobuf.)
+ * @param getreq NULL to read the data before returning. Otherwise,
+ * with pnetcdf, the read is only posted (with ncmpi_iget_varn()) and
+ * the ID of the pnetcdf request is put here on IO tasks. It must be
+ * completed with ncmpi_wait_all() before iobuf is used. Other iotypes
+ * (and pnetcdf with PIOc_set_vard()) always read the data before
+ * returning and put NC_REQ_NULL here.
  * @return 0 on success, error code otherwise.
  * @ingroup PIO_read_darray_c
  * @author Jim Edwards, Ed Hartnett
  */
 int
-pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf)
+pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf,
+                   int *getreq)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     var_desc_t *vdesc;     /* Information about the variable. */
     int ndims;             /* Number of dims in decomposition. */
     int fndims;            /* Number of dims for this var in file. */
+    double start_time = MPI_Wtime(); /* For the I/O statistics. */
     int ierr;              /* Return code from netCDF functions. */
-#ifdef USE_VARD_READ
-    MPI_Offset gdim0;
-    gdim0 = 0;
-#endif
 
     /* Check inputs. */
     pioassert(file && file->iosystem && iodesc && vid <= PIO_MAX_VARS, "invalid input",
@@ -1151,14 +1687,12 @@ pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf)
     ios = file->iosystem;
     PLOG((3, "pio_read_darray_nc ios->ioproc %d", ios->ioproc));
 
-#ifdef TIMING
-    /* Start timer if desired. */
-    if ((ierr = pio_start_timer("PIO:read_darray_nc")))
+    /* Start timer if they are on. */
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_READ_NC)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-#endif /* TIMING */
 
     /* Get the variable info. */
-    if ((ierr = get_var_desc(vid, &file->varlist, &vdesc)))
+    if ((ierr = get_file_var_desc(file, vid, &vdesc)))
         return pio_err(NULL, file, ierr, __FILE__, __LINE__);
 
     /* Get the number of dimensions in the decomposition. */
@@ -1168,11 +1702,17 @@ pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf)
     fndims = vdesc->ndims;
     PLOG((4, "fndims %d ndims %d", fndims, ndims));
 
-    /* ??? */
-#if USE_VARD_READ
-    if(!ios->async || !ios->ioproc)
-        ierr = get_gdim0(file, iodesc, vid, fndims, &gdim0);
-#endif
+    if (getreq)
+        *getreq = NC_REQ_NULL;
+
+    /* Read from the checkpoint files of the file, if it has them. */
+    if (file->ckpt_nfiles)
+    {
+        ierr = pio_ckpt_read(file, iodesc, vid, iobuf);
+        if (!ierr)
+            ierr = pio_stop_timer(ios, PIO_TIMER_READ_NC);
+        return ierr;
+    }
 
     /* IO procs will read the data. */
     if (ios->ioproc)
@@ -1188,6 +1728,11 @@ pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf)
         PIO_Offset *countlist[iodesc->maxregions];
 #endif
 
+        /* Size the chunk cache for this decomposition, if asked
+         * for. */
+        if ((ierr = pio_auto_chunk_cache(file, iodesc, vid)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
         /* buffer is incremented by byte and loffset is in terms of
            the iodessc->mpitype so we need to multiply by the size of
            the mpitype. */
@@ -1330,31 +1875,27 @@ pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf)
                 /* Is this is the last region to process? */
                 if (regioncnt == iodesc->maxregions - 1)
                 {
-#if USE_VARD_READ
-                    MPI_Datatype filetype;
-                    PIO_Offset unlimdimoffset;
-                    int mpierr;
-                    if (gdim0 == 0) /* if there is an unlimited dimension get the offset between records of a variable */
+                    if (file->use_vard)
                     {
-                        if((ierr = ncmpi_inq_recsize(file->fh, &unlimdimoffset)))
-                            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+                        MPI_Datatype filetype;
+                        int mpierr;
+
+                        if (!(ierr = get_vard_filetype(file, iodesc, 0, 1, &vid, fndims,
+                                                       &vdesc->record, rrlen, startlist,
+                                                       countlist, &filetype)))
+                            ierr = ncmpi_get_vard_all(file->fh, vid, filetype, iobuf,
+                                                      iodesc->rllen, iodesc->mpitype);
+                        if (filetype != MPI_DATATYPE_NULL && (mpierr = MPI_Type_free(&filetype)))
+                            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
                     }
+                    /* Read a list of subarrays, or post the read if
+                     * the caller will wait for it. */
+                    else if (getreq)
+                        ierr = ncmpi_iget_varn(file->fh, vid, rrlen, startlist, countlist,
+                                               iobuf, iodesc->rllen, iodesc->mpitype, getreq);
                     else
-                        unlimdimoffset = gdim0;
-
-                    ierr = get_vard_mpidatatype(iodesc, gdim0, unlimdimoffset,
-                                                rrlen, ndims, fndims,
-                                                vdesc->record, startlist, countlist, &filetype);
-                    ierr = ncmpi_get_vard_all(file->fh, vid, filetype, iobuf, iodesc->llen, iodesc->mpitype);
-                    if(filetype != MPI_DATATYPE_NULL && (mpierr = MPI_Type_free(&filetype)))
-                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-#else
-                    //printf("rllen %d mpitype %d\n",iodesc->rllen, iodesc->mpitype);
-                    /* Read a list of subarrays. */
-                    ierr = ncmpi_get_varn_all(file->fh, vid, rrlen, startlist,
-                                              countlist, iobuf, iodesc->rllen, iodesc->mpitype);
-#endif
+                        ierr = ncmpi_get_varn_all(file->fh, vid, rrlen, startlist,
+                                                  countlist, iobuf, iodesc->rllen, iodesc->mpitype);
                     /* Release the start and count arrays. */
                     for (int i = 0; i < rrlen; i++)
                     {
@@ -1378,16 +1919,122 @@ pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf)
             if (region)
                 region = region->next;
         } /* next regioncnt */
+
+        pio_stats_io(file, iodesc, false, false, 1, iodesc->rllen, iodesc->maxregions,
+                     start_time);
     }
 
-#ifdef TIMING
-    if ((ierr = pio_stop_timer("PIO:read_darray_nc")))
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_READ_NC)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-#endif /* TIMING */
 
     return PIO_NOERR;
 }
 
+/**
+ * Read one region of a variable with the serial netCDF library, for
+ * pio_read_darray_nc_serial().
+ *
+ * @param file a pointer to the open file descriptor.
+ * @param iodesc a pointer to the decomposition.
+ * @param vid the variable id.
+ * @param start the start of the region.
+ * @param count the count of the region.
+ * @param bufptr where the data go.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+read_region(file_desc_t *file, io_desc_t *iodesc, int vid, const size_t *start,
+            const size_t *count, void *bufptr)
+{
+    int ierr;
+
+    /* ierr = nc_get_vara(file->fh, vid, start, count, bufptr); */
+        switch (iodesc->piotype)
+        {
+        case PIO_BYTE:
+            ierr = nc_get_vara_schar(file->fh, vid, start, count, (signed char*)bufptr);
+            break;
+        case PIO_CHAR:
+            ierr = nc_get_vara_text(file->fh, vid, start, count, (char*)bufptr);
+            break;
+        case PIO_SHORT:
+            ierr = nc_get_vara_short(file->fh, vid, start, count, (short*)bufptr);
+            break;
+        case PIO_INT:
+            ierr = nc_get_vara_int(file->fh, vid, start, count, (int*)bufptr);
+            break;
+        case PIO_FLOAT:
+            ierr = nc_get_vara_float(file->fh, vid, start, count, (float*)bufptr);
+            break;
+        case PIO_DOUBLE:
+            ierr = nc_get_vara_double(file->fh, vid, start, count, (double*)bufptr);
+            break;
+#ifdef _NETCDF4
+        case PIO_UBYTE:
+            ierr = nc_get_vara_uchar(file->fh, vid, start, count, (unsigned char*)bufptr);
+            break;
+        case PIO_USHORT:
+            ierr = nc_get_vara_ushort(file->fh, vid, start, count, (unsigned short*)bufptr);
+            break;
+        case PIO_UINT:
+            ierr = nc_get_vara_uint(file->fh, vid, start, count, (unsigned int*)bufptr);
+            break;
+        case PIO_INT64:
+            ierr = nc_get_vara_longlong(file->fh, vid, start, count, (long long*)bufptr);
+            break;
+        case PIO_UINT64:
+            ierr = nc_get_vara_ulonglong(file->fh, vid, start, count, (unsigned long long*)bufptr);
+            break;
+        case PIO_STRING:
+            ierr = nc_get_vara_string(file->fh, vid, start, count, (char**)bufptr);
+            break;
+#endif /* _NETCDF4 */
+        default:
+            return pio_err(file->iosystem, file, PIO_EBADTYPE, __FILE__, __LINE__);
+        }
+
+    return ierr;
+}
+
+/**
+ * Drop the regions that have no data, so that they are not sent to
+ * IO task 0 and read with empty calls. The regions left keep their
+ * order, so their data are still packed one after another in the
+ * buffer.
+ *
+ * @param nregions the number of regions.
+ * @param fndims the number of dimensions in the file.
+ * @param start the start values of all regions. Changed in place.
+ * @param count the count values of all regions. Changed in place.
+ * @returns the number of regions left.
+ * @author Ed Hartnett
+ */
+static int
+drop_empty_regions(int nregions, int fndims, size_t *start, size_t *count)
+{
+    int n = 0;
+
+    for (int r = 0; r < nregions; r++)
+    {
+        size_t size = 1;
+
+        for (int m = 0; m < fndims; m++)
+            size *= count[r * fndims + m];
+        if (!size)
+            continue;
+
+        if (r != n)
+        {
+            memmove(&start[n * fndims], &start[r * fndims], fndims * sizeof(size_t));
+            memmove(&count[n * fndims], &count[r * fndims], fndims * sizeof(size_t));
+        }
+        n++;
+    }
+
+    return n;
+}
+
 /**
  * Read an array of data from a file to the (serial) IO library. This
  * function is only used with netCDF classic and netCDF-4 serial
@@ -1417,6 +2064,7 @@ pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
     int ndims;             /* Number of dims in decomposition. */
     int fndims;            /* Number of dims for this var in file. */
     MPI_Status status;
+    double start_time = MPI_Wtime(); /* For the I/O statistics. */
     int mpierr;  /* Return code from MPI functions. */
     int ierr;
 
@@ -1427,14 +2075,12 @@ pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
     PLOG((2, "pio_read_darray_nc_serial vid = %d", vid));
     ios = file->iosystem;
 
-#ifdef TIMING
-    /* Start timer if desired. */
-    if ((ierr = pio_start_timer("PIO:read_darray_nc_serial")))
+    /* Start timer if they are on. */
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_READ_NC_SERIAL)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-#endif /* TIMING */
 
     /* Get var info for this var. */
-    if ((ierr = get_var_desc(vid, &file->varlist, &vdesc)))
+    if ((ierr = get_file_var_desc(file, vid, &vdesc)))
         return pio_err(NULL, file, ierr, __FILE__, __LINE__);
 
     /* Get the number of dims in our decomposition. */
@@ -1455,6 +2101,14 @@ pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
               (fndims == ndims + 1 && vdesc->record >= 0),
               "unexpected record", __FILE__, __LINE__);
 
+    /* Read from the checkpoint files of the file, if it has them. */
+    if (file->ckpt_nfiles)
+    {
+        if ((ierr = pio_ckpt_read(file, iodesc, vid, iobuf)))
+            return ierr;
+        return pio_stop_timer(ios, PIO_TIMER_READ_NC_SERIAL);
+    }
+
     if (ios->ioproc)
     {
         io_region *region;
@@ -1462,7 +2116,13 @@ pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
         size_t count[fndims];
         size_t tmp_start[fndims * iodesc->maxregions];
         size_t tmp_count[fndims * iodesc->maxregions];
-        size_t tmp_bufsize;
+        size_t this_start[fndims * iodesc->maxregions];
+        size_t this_count[fndims * iodesc->maxregions];
+        size_t loffset, regionsize;
+        int my_nregions;       /* Number of regions of this task after coalescing. */
+        int nregions;
+        MPI_Comm comm;         /* The IO tasks whose data are read by the same task. */
+        int rank, size;        /* Rank and size of comm. */
         void *bufptr;
 
         /* buffer is incremented by byte and loffset is in terms of
@@ -1531,172 +2191,388 @@ pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid,
                 region = region->next;
         } /* next regioncnt */
 
-        /* IO tasks other than 0 send their starts/counts and data to
-         * IO task 0. */
-        if (ios->io_rank > 0)
+        /* Only the regions with data are sent and read. */
+        my_nregions = drop_empty_regions(iodesc->maxregions, fndims, tmp_start, tmp_count);
+        nregions = my_nregions;
+
+        /* IO tasks other than 0 (of their subfile) send their
+         * starts/counts to IO task 0, in one header message, and get
+         * their data back. */
+        serial_comm(file, &comm, &rank, &size);
+        if (rank > 0)
         {
-            if ((mpierr = MPI_Send(&iodesc->llen, 1, MPI_OFFSET, 0, ios->io_rank, ios->io_comm)))
-                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-            PLOG((3, "sent iodesc->llen = %d", iodesc->llen));
+            PIO_Offset *hdr;
+            int hlen = 2;
 
+            if (!(hdr = malloc((2 + 2 * nregions * fndims) * sizeof(PIO_Offset))))
+                return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+            hdr[0] = iodesc->llen;
+            hdr[1] = nregions;
             if (iodesc->llen > 0)
             {
-                if ((mpierr = MPI_Send(&(iodesc->maxregions), 1, MPI_INT, 0,
-                                       ios->num_iotasks + ios->io_rank, ios->io_comm)))
-                    return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-                if ((mpierr = MPI_Send(tmp_count, iodesc->maxregions * fndims, MPI_OFFSET, 0,
-                                       2 * ios->num_iotasks + ios->io_rank, ios->io_comm)))
-                    return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-                if ((mpierr = MPI_Send(tmp_start, iodesc->maxregions * fndims, MPI_OFFSET, 0,
-                                       3 * ios->num_iotasks + ios->io_rank, ios->io_comm)))
-                    return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-                PLOG((3, "sent iodesc->maxregions = %d tmp_count and tmp_start arrays", iodesc->maxregions));
+                for (int i = 0; i < nregions * fndims; i++)
+                {
+                    hdr[2 + i] = tmp_start[i];
+                    hdr[2 + nregions * fndims + i] = tmp_count[i];
+                }
+                hlen += 2 * nregions * fndims;
+            }
+            mpierr = MPI_Send(hdr, hlen, MPI_OFFSET, 0, rank, comm);
+            free(hdr);
+            if (mpierr)
+                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+            PLOG((3, "sent iodesc->llen = %d nregions = %d", iodesc->llen, nregions));
 
+            if (iodesc->llen > 0)
+            {
                 if ((mpierr = MPI_Recv(iobuf, iodesc->llen, iodesc->mpitype, 0,
-                                       4 * ios->num_iotasks + ios->io_rank, ios->io_comm, &status)))
+                                       size + rank, comm, &status)))
                     return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
                 PLOG((3, "received %d elements of data", iodesc->llen));
             }
         }
-        else if (ios->io_rank == 0)
+        else
         {
-            /* This is IO task 0. Get starts/counts and data from
-             * other IO tasks. */
-            int maxregions = 0;
-            size_t loffset, regionsize;
-            size_t this_start[fndims * iodesc->maxregions];
-            size_t this_count[fndims * iodesc->maxregions];
-
-            for (int rtask = 1; rtask <= ios->num_iotasks; rtask++)
+            /* This is IO task 0. Get starts/counts from the other IO
+             * tasks, read their data and send it to them. The data
+             * of each task are read into one of two buffers while the
+             * send of the other is still going on. One buffer is
+             * iobuf, into which the data of this task are read
+             * last. */
+            int hlen = 2 + 2 * iodesc->maxregions * fndims;
+            PIO_Offset *hdr;
+            void *buf[2] = {iobuf, NULL};
+            size_t bufsize = 0;    /* Size of buf[1]. */
+            MPI_Request req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+            int rerr = PIO_NOERR;  /* First error from the reads. */
+
+            if (!(hdr = malloc(hlen * sizeof(PIO_Offset))))
+                return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+
+            /* An MPI or memory error stops the loop, and the buffers
+             * are freed below. */
+            mpierr = MPI_SUCCESS;
+            for (int rtask = 1; rtask <= size; rtask++)
             {
-                if (rtask < ios->num_iotasks)
-                {
-                    if ((mpierr = MPI_Recv(&tmp_bufsize, 1, MPI_OFFSET, rtask, rtask, ios->io_comm, &status)))
-                        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-                    PLOG((3, "received tmp_bufsize = %d", tmp_bufsize));
+                int slot = rtask < size ? rtask % 2 : 0;
+                size_t tmp_bufsize;
 
-                    if (tmp_bufsize > 0)
+                if (rtask < size)
+                {
+                    if ((mpierr = MPI_Recv(hdr, hlen, MPI_OFFSET, rtask, rtask, comm,
+                                           &status)))
+                        break;
+                    tmp_bufsize = hdr[0];
+                    nregions = hdr[1];
+                    PLOG((3, "received tmp_bufsize = %d nregions = %d", tmp_bufsize, nregions));
+                    if (tmp_bufsize == 0)
+                        continue;
+                    for (int i = 0; i < nregions * fndims; i++)
                     {
-                        if ((mpierr = MPI_Recv(&maxregions, 1, MPI_INT, rtask, ios->num_iotasks + rtask,
-                                               ios->io_comm, &status)))
-                            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-                        if ((mpierr = MPI_Recv(this_count, maxregions * fndims, MPI_OFFSET, rtask,
-                                               2 * ios->num_iotasks + rtask, ios->io_comm, &status)))
-                            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-                        if ((mpierr = MPI_Recv(this_start, maxregions * fndims, MPI_OFFSET, rtask,
-                                               3 * ios->num_iotasks + rtask, ios->io_comm, &status)))
-                            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-                        PLOG((3, "received maxregions = %d this_count, this_start arrays ", maxregions));
+                        this_start[i] = hdr[2 + i];
+                        this_count[i] = hdr[2 + nregions * fndims + i];
                     }
                 }
                 else
                 {
-                    maxregions = iodesc->maxregions;
+                    nregions = my_nregions;
                     tmp_bufsize = iodesc->llen;
+                    memcpy(this_start, tmp_start, nregions * fndims * sizeof(size_t));
+                    memcpy(this_count, tmp_count, nregions * fndims * sizeof(size_t));
+                }
+                PLOG((3, "nregions = %d tmp_bufsize = %d", nregions, tmp_bufsize));
+
+                /* The buffer must be done with its last send. */
+                if ((mpierr = MPI_Wait(&req[slot], &status)))
+                    break;
+                if (rtask == size)
+                    if ((mpierr = MPI_Wait(&req[1], &status)))
+                        break;
+                if (slot && tmp_bufsize * iodesc->mpitype_size > bufsize)
+                {
+                    free(buf[1]);
+                    bufsize = tmp_bufsize * iodesc->mpitype_size;
+                    if (!(buf[1] = malloc(bufsize)))
+                    {
+                        ierr = PIO_ENOMEM;
+                        break;
+                    }
                 }
-                PLOG((3, "maxregions = %d tmp_bufsize = %d", maxregions, tmp_bufsize));
 
-                /* Now get each region of data. */
+                /* Now get each region of data. After an error, the
+                 * other tasks still get their (unread) data, so that
+                 * they don't hang. */
                 loffset = 0;
-                for (int regioncnt = 0; regioncnt < maxregions; regioncnt++)
+                for (int regioncnt = 0; regioncnt < nregions && !rerr; regioncnt++)
                 {
                     /* Get pointer where data should go. */
-                    bufptr = (void *)((char *)iobuf + iodesc->mpitype_size * loffset);
+                    bufptr = (void *)((char *)buf[slot] + iodesc->mpitype_size * loffset);
                     regionsize = 1;
-
-                    /* ??? */
-                    if (rtask < ios->num_iotasks)
-                    {
-                        for (int m = 0; m < fndims; m++)
-                        {
-                            start[m] = this_start[m + regioncnt * fndims];
-                            count[m] = this_count[m + regioncnt * fndims];
-                            regionsize *= count[m];
-                        }
-                    }
-                    else
+                    for (int m = 0; m < fndims; m++)
                     {
-                        for (int m = 0; m < fndims; m++)
-                        {
-                            start[m] = tmp_start[m + regioncnt * fndims];
-                            count[m] = tmp_count[m + regioncnt * fndims];
-                            regionsize *= count[m];
-                        }
+                        start[m] = this_start[m + regioncnt * fndims];
+                        count[m] = this_count[m + regioncnt * fndims];
+                        regionsize *= count[m];
                     }
                     loffset += regionsize;
 
                     /* Read the data. */
-                    /* ierr = nc_get_vara(file->fh, vid, start, count, bufptr); */
-                    switch (iodesc->piotype)
-                    {
-                    case PIO_BYTE:
-                        ierr = nc_get_vara_schar(file->fh, vid, start, count, (signed char*)bufptr);
-                        break;
-                    case PIO_CHAR:
-                        ierr = nc_get_vara_text(file->fh, vid, start, count, (char*)bufptr);
-                        break;
-                    case PIO_SHORT:
-                        ierr = nc_get_vara_short(file->fh, vid, start, count, (short*)bufptr);
-                        break;
-                    case PIO_INT:
-                        ierr = nc_get_vara_int(file->fh, vid, start, count, (int*)bufptr);
-                        break;
-                    case PIO_FLOAT:
-                        ierr = nc_get_vara_float(file->fh, vid, start, count, (float*)bufptr);
-                        break;
-                    case PIO_DOUBLE:
-                        ierr = nc_get_vara_double(file->fh, vid, start, count, (double*)bufptr);
-                        break;
-#ifdef _NETCDF4
-                    case PIO_UBYTE:
-                        ierr = nc_get_vara_uchar(file->fh, vid, start, count, (unsigned char*)bufptr);
-                        break;
-                    case PIO_USHORT:
-                        ierr = nc_get_vara_ushort(file->fh, vid, start, count, (unsigned short*)bufptr);
-                        break;
-                    case PIO_UINT:
-                        ierr = nc_get_vara_uint(file->fh, vid, start, count, (unsigned int*)bufptr);
-                        break;
-                    case PIO_INT64:
-                        ierr = nc_get_vara_longlong(file->fh, vid, start, count, (long long*)bufptr);
-                        break;
-                    case PIO_UINT64:
-                        ierr = nc_get_vara_ulonglong(file->fh, vid, start, count, (unsigned long long*)bufptr);
-                        break;
-                    case PIO_STRING:
-                        ierr = nc_get_vara_string(file->fh, vid, start, count, (char**)bufptr);
-                        break;
-#endif /* _NETCDF4 */
-                    default:
-                        return pio_err(ios, file, PIO_EBADTYPE, __FILE__, __LINE__);
-                    }
-
-                    /* Check error code of netCDF call. */
-                    if (ierr)
-                        return check_netcdf(file, ierr, __FILE__, __LINE__);
+                    rerr = read_region(file, iodesc, vid, start, count, bufptr);
                 }
 
                 /* The decomposition may not use all of the active io
                  * tasks. rtask here is the io task rank and
-                 * ios->num_iotasks is the number of iotasks actually
+                 * size is the number of iotasks actually
                  * used in this decomposition. */
-                if (rtask < ios->num_iotasks && tmp_bufsize > 0)
-                    if ((mpierr = MPI_Send(iobuf, tmp_bufsize, iodesc->mpitype, rtask,
-                                           4 * ios->num_iotasks + rtask, ios->io_comm)))
-                        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+                if (rtask < size)
+                    if ((mpierr = MPI_Isend(buf[slot], tmp_bufsize, iodesc->mpitype, rtask,
+                                            size + rtask, comm, &req[slot])))
+                        break;
             }
-        }
+
+            /* A send still pending after an error must not be from a
+             * freed buffer. */
+            for (int r = 0; r < 2; r++)
+                if (req[r] != MPI_REQUEST_NULL)
+                {
+                    MPI_Cancel(&req[r]);
+                    MPI_Wait(&req[r], MPI_STATUS_IGNORE);
+                }
+            free(hdr);
+            free(buf[1]);
+            if (mpierr)
+                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+            if (ierr)
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+            /* Check error code of netCDF call. */
+            if (rerr)
+                return check_netcdf(file, rerr, __FILE__, __LINE__);
+        }
+
+        pio_stats_io(file, iodesc, false, false, 1, iodesc->rllen, iodesc->maxregions,
+                     start_time);
     }
 
-#ifdef TIMING
-    if ((ierr = pio_stop_timer("PIO:read_darray_nc_serial")))
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_READ_NC_SERIAL)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-#endif /* TIMING */
 
     PLOG((2, "pio_read_darray_nc_serial complete ierr %d", ierr));
     return PIO_NOERR;
 }
 
+/**
+ * Make room in the attached pnetcdf buffer of a file for a darray
+ * write, and decide whether the write is copied into it (with
+ * ncmpi_bput_varn()). If the write would overflow the buffer on any
+ * IO task the pending writes are flushed first. A write that would
+ * not fit even in an empty buffer is queued with ncmpi_iput_varn(),
+ * as it is when no buffer is attached.
+ *
+ * The decision is the same on all IO tasks, so that they keep their
+ * IO buffers, and flush them, together. This is collective over the
+ * IO tasks, and is only called on them.
+ *
+ * @param file pointer to the file_desc_t info. The result is put in
+ * file->darray_bput.
+ * @param iodesc pointer to the decomposition info.
+ * @param nvars the number of variables to be written.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+reserve_bput_buffer(file_desc_t *file, io_desc_t *iodesc, int nvars)
+{
+    int ierr = PIO_NOERR;
+
+    /* Check inputs. */
+    pioassert(file && file->iosystem && file->iosystem->ioproc && iodesc && nvars > 0,
+              "invalid input", __FILE__, __LINE__);
+    file->darray_bput = false;
+
+#ifdef _PNETCDF
+    MPI_Offset bufsize = 0;
+    MPI_Offset usage = 0;
+    PIO_Offset need[2]; /* Usage after this write, and size of this write. */
+    int mpierr;
+
+    /* A file with no attached buffer has a size of 0. */
+    if ((ierr = ncmpi_inq_buffer_size(file->fh, &bufsize)))
+    {
+        if (ierr != NC_ENULLABUF)
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+        bufsize = 0;
+        ierr = PIO_NOERR;
+    }
+
+    if (file->iosystem->flush_mode == PIO_FLUSH_DETERMINISTIC)
+    {
+        /* The largest write of any IO task is known from the
+         * decomposition, so the usage can be bounded without
+         * communication. */
+        need[1] = iodesc->maxiobuflen;
+        if (iodesc->rearranger == PIO_REARR_SUBSET && iodesc->needsfill)
+            need[1] += iodesc->maxholegridsize;
+        need[1] *= (PIO_Offset)nvars * iodesc->mpitype_size;
+        need[0] = file->buffer_usage + need[1];
+    }
+    else
+    {
+        /* The data, and the fill of the holes for the subset
+         * rearranger. */
+        need[1] = iodesc->llen;
+        if (iodesc->rearranger == PIO_REARR_SUBSET && iodesc->needsfill)
+            need[1] += iodesc->holegridsize;
+        need[1] *= (PIO_Offset)nvars * iodesc->mpitype_size;
+
+        if (bufsize && (ierr = ncmpi_inq_buffer_usage(file->fh, &usage)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+        need[0] = usage + need[1];
+
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, need, 2, MPI_OFFSET, MPI_MAX,
+                                    file->iosystem->io_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+    PLOG((2, "reserve_bput_buffer bufsize = %lld usage = %lld need = %lld", bufsize,
+          need[0], need[1]));
+
+    /* Too big for the buffer. */
+    if (need[1] > bufsize)
+        return PIO_NOERR;
+
+    /* Wait for the pending writes, keeping the data of this one. */
+    if (need[0] > bufsize)
+    {
+        void *iobuf = file->iobuf;
+
+        file->iobuf = NULL;
+        ierr = flush_output_buffer(file, true, 0);
+        file->iobuf = iobuf;
+        if (ierr)
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+    }
+
+    file->buffer_usage += need[1];
+    file->darray_bput = true;
+#endif /* _PNETCDF */
+
+    return ierr;
+}
+
+/**
+ * Compare the offsets of two pnetcdf write requests. Requests at the
+ * same offset keep their order, since pnetcdf numbers requests in the
+ * order they are made. This function is passed to qsort.
+ *
+ * @param a pointer to a pio_put_req.
+ * @param b pointer to another pio_put_req.
+ * @returns -1, 0 or 1.
+ * @author Ed Hartnett
+ */
+static int
+compare_put_reqs(const void *a, const void *b)
+{
+    const pio_put_req *x = a;
+    const pio_put_req *y = b;
+
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return (x->request > y->request) - (x->request < y->request);
+}
+
+/**
+ * Add a pnetcdf write request to the queue of the file. The queue
+ * holds the requests of all variables and decompositions, which are
+ * waited for together by flush_output_buffer().
+ *
+ * @param file pointer to the file_desc_t info.
+ * @param varid the ID of the variable written.
+ * @param frame the record written, or -1 for all of a variable.
+ * @param request the pnetcdf request ID. May be NC_REQ_NULL.
+ * @param bytes the bytes written by this task.
+ * @param ioid the decomposition of a darray write, or 0.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+pio_queue_put_request(file_desc_t *file, int varid, int frame, int request,
+                      PIO_Offset bytes, int ioid)
+{
+    PIO_Offset offset = 0;
+
+    pioassert(file, "invalid input", __FILE__, __LINE__);
+
+#ifdef _PNETCDF
+    {
+        MPI_Offset varoffset;
+        MPI_Offset recsize;
+        int ierr;
+
+        /* Find where the data go in the file. */
+        if ((ierr = ncmpi_inq_varoffset(file->fh, varid, &varoffset)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+        offset = varoffset;
+        if (frame > 0)
+        {
+            if ((ierr = ncmpi_inq_recsize(file->fh, &recsize)))
+                return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+            offset += frame * recsize;
+        }
+    }
+#endif /* _PNETCDF */
+
+    if (file->nput_reqs % PIO_REQUEST_ALLOC_CHUNK == 0)
+    {
+        pio_put_req *put_reqs;
+
+        if (!(put_reqs = realloc(file->put_reqs, sizeof(pio_put_req) *
+                                 (file->nput_reqs + PIO_REQUEST_ALLOC_CHUNK))))
+            return pio_err(NULL, file, PIO_ENOMEM, __FILE__, __LINE__);
+        file->put_reqs = put_reqs;
+    }
+    file->put_reqs[file->nput_reqs].request = request;
+    file->put_reqs[file->nput_reqs].offset = offset;
+    file->put_reqs[file->nput_reqs].bytes = bytes;
+    file->put_reqs[file->nput_reqs].ioid = ioid;
+    file->nput_reqs++;
+
+    return PIO_NOERR;
+}
+
+#ifdef _PNETCDF
+/**
+ * Add the time of a pnetcdf wait to the decompositions of the darray
+ * writes waited for, in proportion to the bytes of each, so that
+ * adapt_aggregation() counts the time of the writes, which are only
+ * done in the wait.
+ *
+ * @param file pointer to the file_desc_t info.
+ * @param rcnt the number of requests waited for.
+ * @param elapsed the time of the wait, in seconds.
+ * @author Ed Hartnett
+ */
+static void
+share_agg_wait(file_desc_t *file, int rcnt, double elapsed)
+{
+    PIO_Offset total = 0;
+    io_desc_t *iodesc = NULL;
+
+    for (int r = 0; r < rcnt; r++)
+        total += file->put_reqs[r].bytes;
+    for (int r = 0; total && r < rcnt; r++)
+    {
+        if (!file->put_reqs[r].ioid)
+            continue;
+        if (!iodesc || iodesc->ioid != file->put_reqs[r].ioid)
+            iodesc = pio_get_iodesc_from_id(file->put_reqs[r].ioid);
+        if (iodesc)
+            iodesc->agg_wait += elapsed * file->put_reqs[r].bytes / total;
+    }
+}
+#endif /* _PNETCDF */
+
 /**
  * Flush the output buffer. This is only relevant for files opened
  * with pnetcdf.
@@ -1724,9 +2600,12 @@ flush_output_buffer(file_desc_t *file, bool force, PIO_Offset addsize)
     PLOG((1, "flush_output_buffer"));
     /* Find out the buffer usage. */
     if ((ierr = ncmpi_inq_buffer_usage(file->fh, &usage)))
+    {
         /* allow the buffer to be undefined */
         if (ierr != NC_ENULLABUF)
             return pio_err(NULL, file, PIO_EBADID, __FILE__, __LINE__);
+        ierr = PIO_NOERR;
+    }
 
     /* If we are not forcing a flush, spread the usage to all IO
      * tasks. */
@@ -1739,94 +2618,275 @@ flush_output_buffer(file_desc_t *file, bool force, PIO_Offset addsize)
     }
 
     /* Keep track of the maximum usage. */
-    if (usage > maxusage)
-        maxusage = usage;
+    if (!force && usage > file->buffer_usage)
+        file->buffer_usage = usage;
 
     PLOG((2, "flush_output_buffer usage=%ld force=%d",usage, force));
     /* If the user forces it, or the buffer has exceeded the size
      * limit, then flush to disk. */
-    if (force || (usage >= pio_pnetcdf_buffer_size_limit))
+    if (force || (usage >= (file->buffer_limit ? file->buffer_limit :
+                            pio_pnetcdf_buffer_size_limit)))
     {
-        int rcnt;
-        int  maxreq;
-        int reqcnt;
-        maxreq = 0;
-        reqcnt = 0;
-        rcnt = 0;
+        int rcnt = file->nput_reqs;
 
-        for (int i = 0; i < file->nvars; i++)
-        {
-            if ((ierr = get_var_desc(i, &file->varlist, &vdesc)))
+        file->stats.nflushes++;
+
+        /* Write the staged darray data first, on a forced flush. */
+        if (force && file->stage_fp && file->iosystem->ioproc)
+            if ((ierr = pio_stage_drain(file)))
                 return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-            reqcnt += vdesc->nreqs;
-            if (vdesc->nreqs > 0)
-                maxreq = i;
-        }
-        int request[reqcnt];
-        int status[reqcnt];
 
-        if (file->varlist)
+        /* Wait for the writes of all variables and decompositions
+         * together, in the order they are in the file. The queues of
+         * all IO tasks have the same number of requests. */
+        if (rcnt > 0)
         {
-            for (int i = 0; i <= maxreq; i++)
+            int *request;
+            int *status;
+            int nwaits = 0;
+            PIO_Offset bytes = 0;
+            double start;
+
+            if (!(request = malloc(2 * rcnt * sizeof(int))))
+                return pio_err(NULL, file, PIO_ENOMEM, __FILE__, __LINE__);
+            status = request + rcnt;
+
+            qsort(file->put_reqs, rcnt, sizeof(pio_put_req), compare_put_reqs);
+            for (int r = 0; r < rcnt; r++)
             {
-                if ((ierr = get_var_desc(i, &file->varlist, &vdesc)))
-                    return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-#ifdef MPIO_ONESIDED
-                /*onesided optimization requires that all of the requests in a wait_all call represent
-                  a contiguous block of data in the file */
-                if (rcnt > 0 && (prev_record != vdesc->record || vdesc->nreqs == 0))
+                request[r] = file->put_reqs[r].request;
+
+                /* Count the groups of at most PIO_MAX_WAIT_BYTES. */
+                if (!r || bytes + file->put_reqs[r].bytes > PIO_MAX_WAIT_BYTES)
                 {
-                    ierr = ncmpi_wait_all(file->fh, rcnt, request, status);
-                    rcnt = 0;
+                    nwaits++;
+                    bytes = 0;
                 }
-                prev_record = vdesc->record;
-#endif
-                for (reqcnt = 0; reqcnt < vdesc->nreqs; reqcnt++)
-                    request[rcnt++] = max(vdesc->request[reqcnt], NC_REQ_NULL);
-                PLOG((3,"flush_output_buffer rcnt=%d",rcnt));
-
-                if (vdesc->request != NULL)
-                    free(vdesc->request);
-                vdesc->request = NULL;
-                vdesc->nreqs = 0;
-
-#ifdef FLUSH_EVERY_VAR
-                ierr = ncmpi_wait_all(file->fh, rcnt, request, status);
-                rcnt = 0;
-#endif
+                bytes += file->put_reqs[r].bytes;
             }
-        }
 
-        if (rcnt > 0)
-            ierr = ncmpi_wait_all(file->fh, rcnt, request, status);
+            /* Every IO task makes as many waits as the one needing
+             * the most. */
+            if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &nwaits, 1, MPI_INT, MPI_MAX,
+                                        file->iosystem->io_comm)))
+            {
+                free(request);
+                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+            }
+            PLOG((3, "flush_output_buffer rcnt=%d nwaits=%d", rcnt, nwaits));
+
+            start = MPI_Wtime();
+            if (!(ierr = pio_start_timer(file->iosystem, PIO_TIMER_WAIT_ALL)))
+            {
+                int r0 = 0;
+
+                /* The same groups as counted above; tasks with fewer
+                 * groups wait for no requests at the end. */
+                for (int w = 0; w < nwaits; w++)
+                {
+                    int r1 = r0;
+                    int ret;
+
+                    for (bytes = 0; r1 < rcnt && (r1 == r0 || bytes + file->put_reqs[r1].bytes <=
+                                                  PIO_MAX_WAIT_BYTES); r1++)
+                        bytes += file->put_reqs[r1].bytes;
+                    if ((ret = ncmpi_wait_all(file->fh, r1 - r0, request + r0, status + r0)) &&
+                        !ierr)
+                        ierr = ret;
+                    r0 = r1;
+                }
+            }
+            if (!ierr)
+                ierr = pio_stop_timer(file->iosystem, PIO_TIMER_WAIT_ALL);
+            file->stats.nwaits++;
+            file->stats.wait_time += MPI_Wtime() - start;
+            free(request);
+
+            /* Share the wait among the decompositions written, by
+             * bytes, for the adaptive aggregation. */
+            if (file->iosystem->adaptive_agg)
+                share_agg_wait(file, rcnt, MPI_Wtime() - start);
+            file->nput_reqs = 0;
+        }
+        file->buffer_usage = 0;
+        file->var_puts_pending = false;
 
         /* Release resources. */
         if (file->iobuf)
         {
             PLOG((3,"freeing variable buffer in flush_output_buffer"));
-            free(file->iobuf);
+            pio_iobuf_free(file->iosystem, file->iobuf);
             file->iobuf = NULL;
         }
 
-        for (int v = 0; v < file->nvars; v++)
+        /* Only the vars on the list have a fillbuf. */
+        for (vdesc = file->fillbuf_vars; vdesc; vdesc = vdesc->fillbuf_next)
         {
-            if ((ierr = get_var_desc(v, &file->varlist, &vdesc)))
-                return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-            if (vdesc->fillbuf)
-            {
-                free(vdesc->fillbuf);
-                vdesc->fillbuf = NULL;
-            }
+            pio_free(PIO_MEM_FILLBUF, vdesc->fillbuf);
+            vdesc->fillbuf = NULL;
+            vdesc->fillbuf_listed = false;
         }
+        file->fillbuf_vars = NULL;
     }
 
 #endif /* _PNETCDF */
     return ierr;
 }
 
+/**
+ * Flush the pending writes of a pnetcdf file after a darray write, if
+ * it is forced, or if the attached buffer is full on any IO task.
+ *
+ * Finding the usage of all IO tasks needs an MPI_Allreduce(), so it
+ * is only done every PIO_FLUSH_CHECK_INTERVAL calls. That is safe,
+ * since the writes which copy data into the attached buffer make
+ * room for it first (see reserve_bput_buffer()); a late check only
+ * delays the flush. With PIO_FLUSH_DETERMINISTIC there is no
+ * MPI_Allreduce(): the decision uses file->buffer_usage, a bound on
+ * the usage found from the decompositions written, which is the same
+ * on all IO tasks.
+ *
+ * This is collective over the IO tasks, and is only called on them.
+ *
+ * @param file pointer to the file_desc_t info.
+ * @param force true to force the flushing of the buffer.
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+check_output_buffer(file_desc_t *file, bool force)
+{
+    pioassert(file, "invalid input", __FILE__, __LINE__);
+
+    if (!force && file->iosystem->flush_mode == PIO_FLUSH_DETERMINISTIC)
+    {
+        PIO_Offset limit = file->buffer_limit ? file->buffer_limit :
+            pio_pnetcdf_buffer_size_limit;
+
+        PLOG((2, "check_output_buffer buffer_usage = %lld", file->buffer_usage));
+        if (file->buffer_usage < limit)
+            return PIO_NOERR;
+        return flush_output_buffer(file, true, 0);
+    }
+
+    if (!force && ++file->nflush_checks % PIO_FLUSH_CHECK_INTERVAL)
+        return PIO_NOERR;
+
+    return flush_output_buffer(file, force, 0);
+}
+
+/**
+ * Find the number of arrays a write multi buffer of a decomposition
+ * holds before it is flushed. This is the number of arrays the
+ * aggregate buffer limit (iodesc->maxbytes) allows, or, with
+ * PIOc_set_adaptive_aggregation() on, the number chosen from the
+ * write rate of the earlier flushes, which is never larger. Before
+ * the first full flush, if the file system was measured by
+ * PIOc_probe_iosystem(), it is the number of arrays for which the
+ * file system latency is PIO_AGG_TOLERANCE of the flush time. The
+ * result is the same on all computation tasks.
+ *
+ * @param ios pointer to the IO system structure.
+ * @param iodesc pointer to the decomposition.
+ * @returns the number of arrays, at least 1.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+agg_max_arrays(iosystem_desc_t *ios, io_desc_t *iodesc)
+{
+    int maxarrays = max(1, iodesc->maxbytes / iodesc->mpitype_size);
+
+    /* Start from the probed file system, if there is no rate yet. */
+    if (ios->adaptive_agg && !iodesc->agg_arrays && ios->probe_fs_bw > 0)
+    {
+        double bytes = iodesc->mpitype_size;
+        double narrays;
+
+        for (int d = 0; d < iodesc->ndims; d++)
+            bytes *= iodesc->dimlen[d];
+        narrays = ios->probe_fs_lat * ios->probe_fs_bw / PIO_AGG_TOLERANCE / max(bytes, 1);
+        iodesc->agg_arrays = narrays >= maxarrays ? maxarrays : (int)narrays + 1;
+        PLOG((2, "agg_max_arrays ioid = %d starts at %d arrays", iodesc->ioid,
+              iodesc->agg_arrays));
+    }
+
+    if (ios->adaptive_agg && iodesc->agg_arrays > 0)
+        maxarrays = min(maxarrays, iodesc->agg_arrays);
+
+    return maxarrays;
+}
+
+/**
+ * Choose the number of arrays buffered before the next flush of a
+ * decomposition, from the time taken by a full flush. This is a hill
+ * climb: the number is doubled or halved after each full flush, and
+ * the direction is reversed when the rate (arrays per second) falls
+ * by more than PIO_AGG_TOLERANCE. When the rate holds, larger
+ * flushes are preferred. The number stays between 1 and what
+ * iodesc->maxbytes allows, so the memory limits still hold.
+ *
+ * The time of the slowest task is used, so all computation tasks
+ * choose the same number. With pnetcdf, the writes are done when the
+ * requests are waited for, which is often after the flush, so the
+ * time of the waits for this decomposition since its last full flush
+ * (iodesc->agg_wait, on the IO tasks) is added. It is that of the
+ * arrays of the earlier flushes, which is close to that of these when
+ * the flush size changes slowly. This must be called on all
+ * computation tasks.
+ *
+ * @param ios pointer to the IO system structure.
+ * @param iodesc pointer to the decomposition.
+ * @param narrays the number of arrays flushed.
+ * @param elapsed the time the flush took on this task, in seconds.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+adapt_aggregation(iosystem_desc_t *ios, io_desc_t *iodesc, int narrays, double elapsed)
+{
+    int maxarrays = max(1, iodesc->maxbytes / iodesc->mpitype_size);
+    int target;
+    double rate;
+    int mpierr;
+
+    elapsed += iodesc->agg_wait;
+    iodesc->agg_wait = 0;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX,
+                                ios->comp_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    rate = narrays / max(elapsed, 1e-9);
+
+    /* The first full flush uses the starting size (the static limit,
+     * or the one from the probe); try smaller flushes next. */
+    if (!iodesc->agg_rate)
+        iodesc->agg_dir = -1;
+    else if (rate < iodesc->agg_rate * (1 - PIO_AGG_TOLERANCE))
+        iodesc->agg_dir = -iodesc->agg_dir;
+    else if (rate <= iodesc->agg_rate * (1 + PIO_AGG_TOLERANCE))
+        iodesc->agg_dir = 1;
+    iodesc->agg_rate = rate;
+
+    if (iodesc->agg_dir > 0)
+        target = narrays > maxarrays / 2 ? maxarrays : narrays * 2;
+    else
+        target = narrays / 2;
+    iodesc->agg_arrays = min(max(1, target), maxarrays);
+
+    PLOG((2, "adapt_aggregation ioid = %d narrays = %d elapsed = %g rate = %g agg_arrays = %d",
+          iodesc->ioid, narrays, elapsed, rate, iodesc->agg_arrays));
+
+    return PIO_NOERR;
+}
+
 /**
  * Flush the buffer.
  *
+ * With PIOc_set_adaptive_aggregation() on, full flushes (those of as
+ * many arrays as agg_max_arrays() allows) are timed, to choose the
+ * size of the next ones.
+ *
  * @param ncid identifies the netCDF file.
  * @param wmb pointer to the wmulti_buffer structure.
  * @param flushtodisk if true, then flush data to disk.
@@ -1844,7 +2904,7 @@ flush_buffer(int ncid, wmulti_buffer *wmb, bool flushtodisk)
     pioassert(wmb, "invalid input", __FILE__, __LINE__);
 
     /* Get the file info (to get error handler). */
-    if ((ret = pio_get_file(ncid, &file)))
+    if ((ret = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
 
     PLOG((1, "flush_buffer ncid = %d flushtodisk = %d", ncid, flushtodisk));
@@ -1852,290 +2912,403 @@ flush_buffer(int ncid, wmulti_buffer *wmb, bool flushtodisk)
     /* If there are any variables in this buffer... */
     if (wmb->num_arrays > 0)
     {
+        io_desc_t *iodesc = NULL;
+        int narrays = wmb->num_arrays;
+        double start = 0;
+        double wait = 0;
+
+        /* Time full flushes, to adapt the aggregation. The number of
+         * arrays is the same on all computation tasks. */
+        if (file->iosystem->adaptive_agg)
+        {
+            if (!(iodesc = pio_get_iodesc_from_id(wmb->ioid)))
+                return pio_err(NULL, file, PIO_EBADID, __FILE__, __LINE__);
+            if (narrays >= agg_max_arrays(file->iosystem, iodesc))
+            {
+                start = MPI_Wtime();
+                wait = iodesc->agg_wait;
+            }
+            else
+                iodesc = NULL;
+        }
+
         /* Write any data in the buffer. */
-        ret = PIOc_write_darray_multi(ncid, wmb->vid,  wmb->ioid, wmb->num_arrays,
-                                      wmb->arraylen, wmb->data, wmb->frame,
-                                      wmb->fillvalue, flushtodisk);
+        if (wmb->nocopy)
+            ret = write_darray_nocopy_buffer(file, wmb, flushtodisk);
+        else
+            ret = PIOc_write_darray_multi(ncid, wmb->vid,  wmb->ioid, wmb->num_arrays,
+                                          wmb->arraylen, wmb->data, wmb->frame,
+                                          wmb->fillvalue, flushtodisk);
         PLOG((2, "return from PIOc_write_darray_multi ret = %d", ret));
 
+        /* The buffer is now empty. Its memory is kept, so that it
+         * can be reused for the next arrays without reallocation. It
+         * is released in free_multi_buffer(). */
         wmb->num_arrays = 0;
 
-        /* Release the list of variable IDs. */
-        free(wmb->vid);
-        wmb->vid = NULL;
-
-        /* Release the data memory. */
-        free(wmb->data);
-        wmb->data = NULL;
-
-        /* If there is a fill value, release it. */
-        if (wmb->fillvalue)
-            free(wmb->fillvalue);
-        wmb->fillvalue = NULL;
-
-        /* Release the record number. */
-        if (wmb->frame)
-            free(wmb->frame);
-        wmb->frame = NULL;
-
         if (ret)
             return pio_err(NULL, file, ret, __FILE__, __LINE__);
+
+        /* Waits during this flush are in its time already. */
+        if (iodesc)
+            iodesc->agg_wait = wait;
+        if (iodesc && (ret = adapt_aggregation(file->iosystem, iodesc, narrays,
+                                               MPI_Wtime() - start)))
+            return pio_err(NULL, file, ret, __FILE__, __LINE__);
     }
 
     return PIO_NOERR;
 }
 
+/* Get the bytes of the write multi buffers of this task, other than
+ * those of wmb. */
+static PIO_Offset
+pio_wmb_bytes(wmulti_buffer *wmb)
+{
+    PIO_Offset current;
+
+    PIOc_get_mem_usage(PIO_MEM_WMB, &current, NULL);
+
+    return current - wmb->data_size;
+}
+
 /**
- * Sort the contents of an array.
+ * Make sure that a write multi buffer has room for narrays
+ * arrays. Memory is reserved for several arrays at a time, starting
+ * with PIO_WMB_ALLOC_CHUNK arrays, and then doubling as needed, but
+ * never more than the aggregate buffer limit in iodesc->maxbytes
+ * allows (unless narrays is larger). Since flush_buffer() keeps this
+ * memory, the buffer is not reallocated for every call to
+ * PIOc_write_darray().
  *
- * @param array pointer to the array
- * @param sortedarray pointer that gets the sorted array.
- * @param iodesc pointer to the iodesc.
- * @param nvars number of variables.
- * @param direction sort direction.
- * @returns 0 for success, error code otherwise.
+ * When file is given, the data of all the write multi buffers of the
+ * task are kept within pio_cnbuffer_limit (see
+ * PIOc_set_compute_buffer_limit()), except for the first array of a
+ * buffer, which is always taken.
+ *
+ * If memory cannot be found, or the limit is reached, the buffer is
+ * left unchanged (and it remains valid for a flush), and PIO_ENOMEM
+ * is returned. No error handler is called in that case, the caller is
+ * expected to flush the buffer and try again.
+ *
+ * @param wmb pointer to the wmulti_buffer structure.
+ * @param iodesc pointer to the decomposition of the buffer.
+ * @param narrays the number of arrays the buffer must be able to
+ * hold.
+ * @param arraylen the length of each array.
+ * @param need_frame true if a record number must be kept for the
+ * arrays.
+ * @param file the file of the buffer, to keep within
+ * pio_cnbuffer_limit, or NULL for no limit.
+ * @returns 0 for success, PIO_ENOMEM if memory can't be found.
  * @ingroup PIO_write_darray_c
- * @author Jim Edwards
+ * @author Jim Edwards, Ed Hartnett
  */
 int
-pio_sorted_copy(const void *array, void *sortedarray, io_desc_t *iodesc,
-                int nvars, int direction)
+reserve_multi_buffer(wmulti_buffer *wmb, io_desc_t *iodesc, int narrays,
+                     PIO_Offset arraylen, bool need_frame, file_desc_t *file)
 {
-    int maplen = iodesc->maplen;
+    int capacity = wmb->capacity; /* Number of arrays to reserve. */
+    int maxarrays = 0;            /* Number of arrays allowed by maxbytes. */
+    size_t array_size = arraylen * iodesc->mpitype_size;
+    void *tmp;
 
-    if (direction == 0){
-        switch (iodesc->piotype)
+    /* Check inputs. */
+    pioassert(wmb && iodesc && narrays > 0 && arraylen >= 0, "invalid input",
+              __FILE__, __LINE__);
+
+    /* Find the new capacity of the buffer. */
+    if (iodesc->mpitype_size > 0)
+        maxarrays = iodesc->maxbytes / iodesc->mpitype_size;
+    if (!capacity)
+        capacity = PIO_WMB_ALLOC_CHUNK;
+    while (capacity < narrays)
+        capacity *= 2;
+    if (maxarrays > 0)
+        capacity = max(narrays, min(capacity, maxarrays));
+
+    /* Grow the data memory, if needed. If the geometric growth can't
+     * be satisfied try to get just enough memory for this array. */
+    if (array_size > 0 && narrays * array_size > wmb->data_size)
+    {
+        size_t data_size = max(capacity, narrays) * array_size;
+
+        /* Keep the write multi buffers of this task within
+         * pio_cnbuffer_limit, first by giving back the memory of the
+         * empty buffers of the file, then by reserving just enough
+         * memory. The first array is always taken. */
+        if (file && pio_cnbuffer_limit > 0 &&
+            pio_wmb_bytes(wmb) + data_size > pio_cnbuffer_limit)
         {
-        case PIO_BYTE:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((signed char *)sortedarray)[m+maplen*v] = ((signed char *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        case PIO_CHAR:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((char *)sortedarray)[m+maplen*v] = ((char *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        case PIO_SHORT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((short *)sortedarray)[m+maplen*v] = ((short *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
+            wmulti_buffer *owmb, *towmb;
 
-            break;
-        case PIO_INT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((int *)sortedarray)[m+maplen*v] = ((int *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        case PIO_FLOAT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((float *)sortedarray)[m+maplen*v] = ((float *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        case PIO_DOUBLE:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
+            HASH_ITER(hh, file->buffer, owmb, towmb)
+                if (owmb != wmb && !owmb->num_arrays && owmb->data)
                 {
-                    ((double *)sortedarray)[m+maplen*v] = ((double *)array)[iodesc->remap[m]+maplen*v];
+                    pio_free(PIO_MEM_WMB, owmb->data);
+                    owmb->data = NULL;
+                    owmb->data_size = 0;
                 }
-            }
-            break;
-        case PIO_UBYTE:
-            for (int v=0; v < nvars; v++)
+            if (pio_wmb_bytes(wmb) + data_size > pio_cnbuffer_limit)
             {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((unsigned char *)sortedarray)[m+maplen*v] = ((unsigned char *)array)[iodesc->remap[m]+maplen*v];
-                }
+                capacity = narrays;
+                data_size = narrays * array_size;
+                if (narrays > 1 && pio_wmb_bytes(wmb) + data_size > pio_cnbuffer_limit)
+                    return PIO_ENOMEM;
             }
-            break;
-        case PIO_USHORT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((unsigned short *)sortedarray)[m+maplen*v] = ((unsigned short *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        case PIO_UINT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((unsigned int *)sortedarray)[m+maplen*v] = ((unsigned int *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        case PIO_INT64:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((long long *)sortedarray)[m+maplen*v] = ((long long *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        case PIO_UINT64:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((unsigned long long *)sortedarray)[m+maplen*v] = ((unsigned long long *)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        case PIO_STRING:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((char **)sortedarray)[m+maplen*v] = ((char **)array)[iodesc->remap[m]+maplen*v];
-                }
-            }
-            break;
-        default:
-            return pio_err(NULL, NULL, PIO_EBADTYPE, __FILE__, __LINE__);
         }
+
+        if (!(tmp = pio_realloc(PIO_MEM_WMB, wmb->data, data_size)))
+        {
+            capacity = narrays;
+            data_size = narrays * array_size;
+            if (!(tmp = pio_realloc(PIO_MEM_WMB, wmb->data, data_size)))
+                return PIO_ENOMEM;
+        }
+        wmb->data = tmp;
+        wmb->data_size = data_size;
+        PLOG((2, "reserve_multi_buffer reserved %ld bytes for %d arrays", data_size,
+              capacity));
     }
-    else
+
+    /* Grow the list of variable IDs, the record numbers, and the
+     * fill values, if needed. */
+    if (capacity > wmb->capacity || (need_frame && !wmb->frame) ||
+        (iodesc->needsfill && !wmb->fillvalue))
     {
-        switch (iodesc->piotype)
+        capacity = max(capacity, wmb->capacity);
+
+        if (!(tmp = realloc(wmb->vid, sizeof(int) * capacity)))
+            return PIO_ENOMEM;
+        wmb->vid = tmp;
+
+        if (need_frame || wmb->frame)
         {
-        case PIO_BYTE:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((signed char *)sortedarray)[iodesc->remap[m]+maplen*v] = ((signed char *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_CHAR:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((char *)sortedarray)[iodesc->remap[m]+maplen*v] = ((char *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_SHORT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((short *)sortedarray)[iodesc->remap[m]+maplen*v] = ((short *)array)[m+maplen*v];
-                }
-            }
+            if (!(tmp = realloc(wmb->frame, sizeof(int) * capacity)))
+                return PIO_ENOMEM;
+            wmb->frame = tmp;
+        }
 
-            break;
-        case PIO_INT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((int *)sortedarray)[iodesc->remap[m]+maplen*v] = ((int *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_FLOAT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((float *)sortedarray)[iodesc->remap[m]+maplen*v] = ((float *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_DOUBLE:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((double *)sortedarray)[iodesc->remap[m]+maplen*v] = ((double *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_UBYTE:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((unsigned char *)sortedarray)[iodesc->remap[m]+maplen*v] = ((unsigned char *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_USHORT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((unsigned short *)sortedarray)[iodesc->remap[m]+maplen*v] = ((unsigned short *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_UINT:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((unsigned int *)sortedarray)[iodesc->remap[m]+maplen*v] = ((unsigned int *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_INT64:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((long long *)sortedarray)[iodesc->remap[m]+maplen*v] = ((long long *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_UINT64:
-            for (int v=0; v < nvars; v++)
-            {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((unsigned long long *)sortedarray)[iodesc->remap[m]+maplen*v] = ((unsigned long long *)array)[m+maplen*v];
-                }
-            }
-            break;
-        case PIO_STRING:
-            for (int v=0; v < nvars; v++)
+        if (iodesc->needsfill)
+        {
+            if (!(tmp = realloc(wmb->fillvalue, iodesc->mpitype_size * capacity)))
+                return PIO_ENOMEM;
+            wmb->fillvalue = tmp;
+        }
+
+        if (wmb->nocopy)
+        {
+            if (!(tmp = realloc(wmb->arrays, sizeof(void *) * capacity)))
+                return PIO_ENOMEM;
+            wmb->arrays = tmp;
+        }
+
+        wmb->capacity = capacity;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Release the memory held by a write multi buffer. The wmulti_buffer
+ * struct itself is not freed.
+ *
+ * @param wmb pointer to the wmulti_buffer structure.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+void
+free_multi_buffer(wmulti_buffer *wmb)
+{
+    pioassert(wmb, "invalid input", __FILE__, __LINE__);
+
+    if (wmb->vid)
+        free(wmb->vid);
+    wmb->vid = NULL;
+
+    if (wmb->data)
+        pio_free(PIO_MEM_WMB, wmb->data);
+    wmb->data = NULL;
+
+    if (wmb->fillvalue)
+        free(wmb->fillvalue);
+    wmb->fillvalue = NULL;
+
+    if (wmb->frame)
+        free(wmb->frame);
+    wmb->frame = NULL;
+
+    if (wmb->arrays)
+        free(wmb->arrays);
+    wmb->arrays = NULL;
+
+    wmb->num_arrays = 0;
+    wmb->capacity = 0;
+    wmb->data_size = 0;
+}
+
+/**
+ * Define the copy kernels for elements of size N bytes, using the
+ * unsigned integer type TYPE of that size. remap_gather_N() copies
+ * dst[m] = src[remap[m]], remap_scatter_N() copies dst[remap[m]] =
+ * src[m], for one block of maplen elements. The loops are simple
+ * enough for the compiler to vectorize them (with gather/scatter
+ * instructions where the target has them).
+ */
+#define PIO_DEFINE_REMAP_COPY(N, TYPE)                                  \
+    static void                                                         \
+    remap_gather_##N(const void *restrict src, void *restrict dst,      \
+                     const int *restrict remap, int maplen)             \
+    {                                                                   \
+        const TYPE *s = src;                                            \
+        TYPE *d = dst;                                                  \
+        for (int m = 0; m < maplen; m++)                                \
+            d[m] = s[remap[m]];                                         \
+    }                                                                   \
+    static void                                                         \
+    remap_scatter_##N(const void *restrict src, void *restrict dst,     \
+                      const int *restrict remap, int maplen)            \
+    {                                                                   \
+        const TYPE *s = src;                                            \
+        TYPE *d = dst;                                                  \
+        for (int m = 0; m < maplen; m++)                                \
+            d[remap[m]] = s[m];                                         \
+    }
+
+PIO_DEFINE_REMAP_COPY(1, uint8_t)
+PIO_DEFINE_REMAP_COPY(2, uint16_t)
+PIO_DEFINE_REMAP_COPY(4, uint32_t)
+PIO_DEFINE_REMAP_COPY(8, uint64_t)
+
+/**
+ * Sort the contents of an array, or undo the sort.
+ *
+ * With direction 0, the data of each variable in array are gathered
+ * through iodesc->remap into sortedarray, so they are in the order of
+ * the sorted map. With direction 1, the data in array (in sorted
+ * order) are scattered back to the order of the user's map in
+ * sortedarray.
+ *
+ * If PIOc_InitDecomp() found that the remap is made of long runs of
+ * consecutive indices (iodesc->remap_runs), each run is copied with
+ * memcpy(). Otherwise elements are copied by size (1, 2, 4 or 8
+ * bytes), so one kernel serves all types of that size. If PIO is
+ * built with OpenMP, the variables are copied in parallel. Each level
+ * of an extruded decomposition is sorted as a variable of the
+ * decomposition it extrudes.
+ *
+ * @param array pointer to the array
+ * @param sortedarray pointer that gets the sorted array.
+ * @param iodesc pointer to the iodesc.
+ * @param nvars number of variables.
+ * @param direction sort direction.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_write_darray_c
+ * @author Jim Edwards
+ */
+int
+pio_sorted_copy(const void *array, void *sortedarray, io_desc_t *iodesc,
+                int nvars, int direction)
+{
+    void (*copy)(const void *, void *, const int *, int);
+    int maplen = iodesc->maplen;
+    size_t elsize;
+
+    if (iodesc->extrude_parent)
+    {
+        io_desc_t *parent;
+
+        if (!(parent = pio_get_iodesc_from_id(iodesc->extrude_parent)))
+            return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+        return pio_sorted_copy(array, sortedarray, parent, nvars * iodesc->extrude_nlev,
+                               direction);
+    }
+
+    /* Find the size of one element. */
+    switch (iodesc->piotype)
+    {
+    case PIO_BYTE:
+    case PIO_CHAR:
+    case PIO_UBYTE:
+        elsize = 1;
+        break;
+    case PIO_SHORT:
+    case PIO_USHORT:
+        elsize = 2;
+        break;
+    case PIO_INT:
+    case PIO_FLOAT:
+    case PIO_UINT:
+        elsize = 4;
+        break;
+    case PIO_DOUBLE:
+    case PIO_INT64:
+    case PIO_UINT64:
+        elsize = 8;
+        break;
+    case PIO_STRING:
+        elsize = sizeof(char *);
+        break;
+    default:
+        return pio_err(NULL, NULL, PIO_EBADTYPE, __FILE__, __LINE__);
+    }
+
+    /* Pick the kernel. */
+    switch (elsize)
+    {
+    case 1:
+        copy = direction ? remap_scatter_1 : remap_gather_1;
+        break;
+    case 2:
+        copy = direction ? remap_scatter_2 : remap_gather_2;
+        break;
+    case 4:
+        copy = direction ? remap_scatter_4 : remap_gather_4;
+        break;
+    case 8:
+        copy = direction ? remap_scatter_8 : remap_gather_8;
+        break;
+    default:
+        return pio_err(NULL, NULL, PIO_EBADTYPE, __FILE__, __LINE__);
+    }
+
+    /* If the map is made of long runs, copy whole runs. */
+    if (iodesc->remap_runs)
+    {
+#ifdef _OPENMP
+#pragma omp parallel for if (nvars > 1)
+#endif /* _OPENMP */
+        for (int v = 0; v < nvars; v++)
+        {
+            const char *src = (const char *)array + (size_t)maplen * v * elsize;
+            char *dst = (char *)sortedarray + (size_t)maplen * v * elsize;
+
+            for (int r = 0; r < iodesc->nremap_runs; r++)
             {
-                for (int m=0; m < maplen; m++)
-                {
-                    ((char **)sortedarray)[iodesc->remap[m]+maplen*v] = ((char **)array)[m+maplen*v];
-                }
+                int m = iodesc->remap_runs[r];
+                size_t len = (size_t)(iodesc->remap_runs[r + 1] - m) * elsize;
+
+                if (direction)
+                    memcpy(dst + (size_t)iodesc->remap[m] * elsize, src + (size_t)m * elsize, len);
+                else
+                    memcpy(dst + (size_t)m * elsize, src + (size_t)iodesc->remap[m] * elsize, len);
             }
-            break;
-        default:
-            return pio_err(NULL, NULL, PIO_EBADTYPE, __FILE__, __LINE__);
         }
+        return PIO_NOERR;
+    }
+
+    /* Copy each variable. */
+#ifdef _OPENMP
+#pragma omp parallel for if (nvars > 1)
+#endif /* _OPENMP */
+    for (int v = 0; v < nvars; v++)
+    {
+        size_t offset = (size_t)maplen * v * elsize;
+
+        copy((const char *)array + offset, (char *)sortedarray + offset, iodesc->remap,
+             maplen);
     }
+
     return PIO_NOERR;
 }
 
@@ -2162,13 +3335,17 @@ compute_maxaggregate_bytes(iosystem_desc_t *ios, io_desc_t *iodesc)
     PLOG((2, "compute_maxaggregate_bytes iodesc->maxiobuflen = %d iodesc->ndof = %d",
           iodesc->maxiobuflen, iodesc->ndof));
 
-    /* Determine the max bytes that can be held on IO task. */
+    /* Determine the max bytes that can be held on IO task. The
+     * number of elements of all arrays must fit the int counts of the
+     * serial writes. */
     if (ios->ioproc && iodesc->maxiobuflen > 0)
-        maxbytesoniotask = pio_pnetcdf_buffer_size_limit / iodesc->maxiobuflen;
+        maxbytesoniotask = min(min(pio_pnetcdf_buffer_size_limit / iodesc->maxiobuflen,
+                                   (PIO_Offset)INT_MAX / iodesc->maxiobuflen * iodesc->mpitype_size),
+                               (PIO_Offset)INT_MAX);
 
     /* Determine the max bytes that can be held on computation task. */
     if (ios->comp_rank >= 0 && iodesc->ndof > 0)
-        maxbytesoncomputetask = pio_cnbuffer_limit / iodesc->ndof;
+        maxbytesoncomputetask = min(pio_cnbuffer_limit / iodesc->ndof, (PIO_Offset)INT_MAX);
 
     /* Take the min of the max IO and max comp bytes. */
     maxbytes = min(maxbytesoniotask, maxbytesoncomputetask);
@@ -2187,3 +3364,705 @@ compute_maxaggregate_bytes(iosystem_desc_t *ios, io_desc_t *iodesc)
 
     return PIO_NOERR;
 }
+
+/** The header of the checkpoint files of a file. */
+typedef struct pio_ckpt_header
+{
+    /** PIO_CKPT_MAGIC. */
+    long long magic;
+
+    /** The number of IO tasks that wrote the checkpoint files. */
+    int num_iotasks;
+
+    /** The IO rank of the task that wrote this file. */
+    int io_rank;
+} pio_ckpt_header;
+
+/** The header of one darray record in a checkpoint file. It is
+ * followed by the starts, then the counts, of the rrcnt regions,
+ * fndims PIO_Offset values each, then nelems values of type
+ * pio_type: the IO buffer of the writing task, as it was. */
+typedef struct pio_ckpt_rec
+{
+    /** The ID of the var. */
+    int varid;
+
+    /** The frame of a record var, or -1. */
+    int frame;
+
+    /** The PIO type of the data. */
+    int pio_type;
+
+    /** The number of dimensions of the var in the file. */
+    int fndims;
+
+    /** The number of regions. */
+    int rrcnt;
+
+    /** The number of values of data. */
+    PIO_Offset nelems;
+} pio_ckpt_rec;
+
+/**
+ * Get the name of a checkpoint file of a file.
+ *
+ * @param filename the name of the netCDF file.
+ * @param fidx the number of the checkpoint file.
+ * @param name array that gets the name, of length len.
+ * @param len the length of name.
+ * @author Ed Hartnett
+ */
+static void
+ckpt_name(const char *filename, int fidx, char *name, size_t len)
+{
+    snprintf(name, len, "%s.ckpt.%d", filename, fidx);
+}
+
+/**
+ * Add a record to the index of the checkpoint files of a file.
+ *
+ * @param file pointer to the file info.
+ * @param rec pointer to the header of the record.
+ * @param fidx the checkpoint file of the record.
+ * @param offset the offset of the region table of the record.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+ckpt_add_entry(file_desc_t *file, const pio_ckpt_rec *rec, int fidx, long offset)
+{
+    pio_ckpt_entry *e;
+
+    if (file->ckpt_nindex == file->ckpt_maxindex)
+    {
+        int maxindex = file->ckpt_maxindex ? 2 * file->ckpt_maxindex : PIO_REQUEST_ALLOC_CHUNK;
+
+        if (!(e = realloc(file->ckpt_index, maxindex * sizeof(pio_ckpt_entry))))
+            return PIO_ENOMEM;
+        file->ckpt_index = e;
+        file->ckpt_maxindex = maxindex;
+    }
+    e = &file->ckpt_index[file->ckpt_nindex++];
+    e->varid = rec->varid;
+    e->frame = rec->frame;
+    e->pio_type = rec->pio_type;
+    e->fndims = rec->fndims;
+    e->rrcnt = rec->rrcnt;
+    e->fidx = fidx;
+    e->nelems = rec->nelems;
+    e->offset = offset;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Open a checkpoint file of a file, check its header, and add its
+ * records to the index. This is only called on IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param filename the name of the netCDF file.
+ * @param fidx the number of the checkpoint file.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+ckpt_open_file(file_desc_t *file, const char *filename, int fidx)
+{
+    char name[strlen(filename) + 32];
+    pio_ckpt_header hdr;
+    pio_ckpt_rec rec;
+    FILE *fp;
+    int ret;
+
+    ckpt_name(filename, fidx, name, sizeof(name));
+    if (!(fp = fopen(name, file->writable ? "r+b" : "rb")))
+        return PIO_ENOTNC;
+    file->ckpt_fps[fidx] = fp;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != PIO_CKPT_MAGIC ||
+        hdr.num_iotasks != file->ckpt_nfiles || hdr.io_rank != fidx)
+        return PIO_ENOTNC;
+
+    /* Index the records, skipping over their regions and data. */
+    while (fread(&rec, sizeof(rec), 1, fp) == 1)
+    {
+        MPI_Datatype mpitype;
+        int type_size;
+
+        if ((ret = find_mpi_type(rec.pio_type, &mpitype, &type_size)))
+            return ret;
+        if ((ret = ckpt_add_entry(file, &rec, fidx, ftell(fp))))
+            return ret;
+        if (fseek(fp, 2 * rec.rrcnt * rec.fndims * sizeof(PIO_Offset) + rec.nelems * type_size,
+                  SEEK_CUR))
+            return PIO_EIO;
+    }
+    PLOG((2, "ckpt_open_file %s nindex = %d", name, file->ckpt_nindex));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the last record of a var and frame in a checkpoint file.
+ *
+ * @param file pointer to the file info.
+ * @param fidx the number of the checkpoint file.
+ * @param varid the ID of the var.
+ * @param frame the frame, or -1.
+ * @return pointer to the index entry, or NULL if there is none.
+ * @author Ed Hartnett
+ */
+static pio_ckpt_entry *
+ckpt_find(file_desc_t *file, int fidx, int varid, int frame)
+{
+    for (int i = file->ckpt_nindex - 1; i >= 0; i--)
+    {
+        pio_ckpt_entry *e = &file->ckpt_index[i];
+
+        if (e->fidx == fidx && e->varid == varid && e->frame == frame)
+            return e;
+    }
+
+    return NULL;
+}
+
+/**
+ * Find the regions of a decomposition on this IO task, for a var and
+ * frame, as they are in a checkpoint record. Empty regions are left
+ * out.
+ *
+ * @param iodesc pointer to the decomposition info.
+ * @param vdesc pointer to the var info.
+ * @param fndims the number of dimensions of the var in the file.
+ * @param frame pointer to the frame, or NULL for non-record vars.
+ * @param table array of 2 * iodesc->maxregions * fndims that gets the
+ * starts, then the counts, of the regions.
+ * @param loffset array of iodesc->maxregions that gets the offset of
+ * each region in the IO buffer. Ignored if NULL.
+ * @return the number of regions.
+ * @author Ed Hartnett
+ */
+static int
+ckpt_regions(io_desc_t *iodesc, var_desc_t *vdesc, int fndims, const int *frame,
+             PIO_Offset *table, PIO_Offset *loffset)
+{
+    io_region *region = iodesc->firstregion;
+    size_t start[fndims], count[fndims];
+    int rrcnt = 0;
+
+    for (int r = 0; r < iodesc->maxregions && region && iodesc->llen; r++, region = region->next)
+    {
+        PIO_Offset size = 1;
+
+        find_start_count(iodesc->ndims, fndims, vdesc, region, frame, start, count);
+        for (int i = 0; i < fndims; i++)
+            size *= count[i];
+        if (size > 0)
+        {
+            for (int i = 0; i < fndims; i++)
+            {
+                table[rrcnt * fndims + i] = start[i];
+                table[(iodesc->maxregions + rrcnt) * fndims + i] = count[i];
+            }
+            if (loffset)
+                loffset[rrcnt] = region->loffset;
+            rrcnt++;
+        }
+    }
+
+    /* Move the counts next to the starts. */
+    memmove(table + rrcnt * fndims, table + iodesc->maxregions * fndims,
+            rrcnt * fndims * sizeof(PIO_Offset));
+
+    return rrcnt;
+}
+
+/**
+ * Create the checkpoint file of a new file on this IO task (see
+ * PIOc_set_checkpoint()). This is only called on IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param filename the name of the netCDF file.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_ckpt_create(file_desc_t *file, const char *filename)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    char name[strlen(filename) + 32];
+    pio_ckpt_header hdr = {PIO_CKPT_MAGIC, ios->num_iotasks, ios->io_rank};
+
+    file->ckpt_nfiles = ios->num_iotasks;
+    if (!(file->ckpt_fps = calloc(file->ckpt_nfiles, sizeof(FILE *))))
+        return PIO_ENOMEM;
+    ckpt_name(filename, ios->io_rank, name, sizeof(name));
+    if (!(file->ckpt_fps[ios->io_rank] = fopen(name, "w+b")))
+        return PIO_EIO;
+    if (fwrite(&hdr, sizeof(hdr), 1, file->ckpt_fps[ios->io_rank]) != 1)
+        return PIO_EIO;
+    PLOG((2, "pio_ckpt_create %s", name));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Mark a new file as having checkpoint files with the global
+ * attribute PIO_CKPT_ATT, the number of checkpoint files (see
+ * PIOc_set_checkpoint()). This is called on the IO tasks, while the
+ * file is in define mode.
+ *
+ * @param file pointer to the file info.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_ckpt_mark(file_desc_t *file)
+{
+    int nfiles = file->iosystem->num_iotasks;
+
+    if (!file->do_io)
+        return PIO_NOERR;
+#ifdef _PNETCDF
+    if (file->iotype == PIO_IOTYPE_PNETCDF)
+        return ncmpi_put_att_int(file->fh, NC_GLOBAL, PIO_CKPT_ATT, NC_INT, 1, &nfiles);
+#endif /* _PNETCDF */
+    return nc_put_att_int(file->fh, NC_GLOBAL, PIO_CKPT_ATT, NC_INT, 1, &nfiles);
+}
+
+/**
+ * Get the number of checkpoint files from the global attribute
+ * PIO_CKPT_ATT of an open file on this IO task.
+ *
+ * @param file pointer to the file info.
+ * @return the number of checkpoint files, 0 if the file has no such
+ * attribute, or was not opened.
+ * @author Ed Hartnett
+ */
+static int
+ckpt_marked(file_desc_t *file)
+{
+    int nfiles = 0;
+    int ret;
+
+#ifdef _PNETCDF
+    if (file->iotype == PIO_IOTYPE_PNETCDF)
+    {
+        MPI_Offset len;
+        nc_type xtype;
+
+        if (!(ret = ncmpi_inq_att(file->fh, NC_GLOBAL, PIO_CKPT_ATT, &xtype, &len)) &&
+            (xtype != NC_INT || len != 1))
+            ret = PIO_EINVAL;
+        if (!ret)
+            ret = ncmpi_get_att_int(file->fh, NC_GLOBAL, PIO_CKPT_ATT, &nfiles);
+        return ret ? 0 : nfiles;
+    }
+#endif /* _PNETCDF */
+    {
+        size_t len;
+        nc_type xtype;
+
+        if (!(ret = nc_inq_att(file->fh, NC_GLOBAL, PIO_CKPT_ATT, &xtype, &len)) &&
+            (xtype != NC_INT || len != 1))
+            ret = PIO_EINVAL;
+        if (!ret)
+            ret = nc_get_att_int(file->fh, NC_GLOBAL, PIO_CKPT_ATT, &nfiles);
+    }
+    return ret ? 0 : nfiles;
+}
+
+/**
+ * Look for the checkpoint files of a file being opened (see
+ * PIOc_set_checkpoint()), and index the records of those this task
+ * reads. Files with checkpoint files have the global attribute
+ * PIO_CKPT_ATT, whether or not checkpoint files are on for the
+ * iosystem. If they were written by as many IO tasks as there are
+ * now, each task opens the file it wrote; otherwise all tasks open
+ * all of them. This is collective over the IO tasks, and only called
+ * on them, also if the file could not be opened on some of
+ * them. file->ckpt_nfiles is left 0 if there are no checkpoint files.
+ *
+ * @param file pointer to the file info.
+ * @param filename the name of the netCDF file.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_ckpt_open(file_desc_t *file, const char *filename)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int nfiles = 0;
+    int ierr = PIO_NOERR;
+    int mpierr;
+
+    /* The attribute has the number of files, and the header of the
+     * first file must agree. */
+    if (!ios->io_rank && (nfiles = ckpt_marked(file)))
+    {
+        char name[strlen(filename) + 32];
+        pio_ckpt_header hdr;
+        FILE *fp;
+
+        ckpt_name(filename, 0, name, sizeof(name));
+        if (!(fp = fopen(name, "rb")))
+            ierr = PIO_EIO;
+        else
+        {
+            if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != PIO_CKPT_MAGIC ||
+                hdr.num_iotasks != nfiles)
+                ierr = PIO_EINVAL;
+            fclose(fp);
+        }
+    }
+    {
+        int info[2] = {ierr, nfiles};
+
+        if ((mpierr = MPI_Bcast(info, 2, MPI_INT, 0, ios->io_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        ierr = info[0];
+        nfiles = info[1];
+    }
+    PLOG((2, "pio_ckpt_open %s nfiles = %d ierr = %d", filename, nfiles, ierr));
+    if (ierr || !nfiles)
+        return ierr;
+
+    file->ckpt_nfiles = nfiles;
+    if (!(file->ckpt_fps = calloc(nfiles, sizeof(FILE *))))
+        ierr = PIO_ENOMEM;
+
+    /* Writes are only appended with the layout that wrote the
+     * files. */
+    if (!ierr && nfiles != ios->num_iotasks && file->writable)
+        ierr = PIO_EINVAL;
+    if (!ierr && nfiles == ios->num_iotasks)
+        ierr = ckpt_open_file(file, filename, ios->io_rank);
+    for (int f = 0; !ierr && nfiles != ios->num_iotasks && f < nfiles; f++)
+        ierr = ckpt_open_file(file, filename, f);
+
+    /* Keep the first error of any IO task. */
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &ierr, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    return ierr;
+}
+
+/**
+ * Write arrays of a darray write to the checkpoint file of this IO
+ * task, instead of the netCDF file: the IO buffer as it is, after the
+ * table of its regions. This is called on all tasks.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param nvars the number of arrays in file->iobuf.
+ * @param varids the ID of the var of each array.
+ * @param fndims the number of dimensions of the vars in the file.
+ * @param frame the frame of each array, or NULL for non-record vars.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_ckpt_write(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+               int fndims, const int *frame)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    double start = MPI_Wtime(); /* For the I/O statistics. */
+    int ierr = PIO_NOERR;
+
+    if (ios->ioproc)
+    {
+        FILE *fp = file->ckpt_fps[ios->io_rank];
+        PIO_Offset *table;
+
+        if (!(table = malloc(2 * max(iodesc->maxregions, 1) * fndims * sizeof(PIO_Offset))))
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+
+        for (int nv = 0; !ierr && nv < nvars; nv++)
+        {
+            var_desc_t *vdesc;
+            pio_ckpt_rec rec;
+            size_t ok;
+
+            if ((ierr = get_file_var_desc(file, varids[nv], &vdesc)))
+                break;
+            rec.varid = varids[nv];
+            rec.frame = vdesc->record >= 0 && iodesc->ndims < fndims ? frame[nv] : -1;
+            rec.pio_type = iodesc->piotype;
+            rec.fndims = fndims;
+            rec.rrcnt = ckpt_regions(iodesc, vdesc, fndims, frame ? &frame[nv] : NULL,
+                                     table, NULL);
+            rec.nelems = iodesc->llen;
+
+            /* Append the record, and index it. */
+            ok = !fseek(fp, 0, SEEK_END) && fwrite(&rec, sizeof(rec), 1, fp) == 1;
+            if (ok && !(ierr = ckpt_add_entry(file, &rec, ios->io_rank, ftell(fp))))
+            {
+                ok = fwrite(table, sizeof(PIO_Offset), 2 * rec.rrcnt * fndims, fp) ==
+                    2 * rec.rrcnt * fndims;
+                if (ok && rec.nelems)
+                    ok = fwrite((char *)file->iobuf + nv * iodesc->mpitype_size * iodesc->llen,
+                                iodesc->mpitype_size, rec.nelems, fp) == rec.nelems;
+            }
+            if (!ierr && !ok)
+                ierr = PIO_EIO;
+        }
+        free(table);
+        if (!ierr)
+            pio_stats_io(file, iodesc, true, false, nvars, iodesc->llen, iodesc->maxregions,
+                         start);
+    }
+
+    /* In write behind mode the IO tasks keep the error for
+     * PIOc_sync(). */
+    if (!ios->async || !ios->write_behind)
+        ierr = check_netcdf(file, ierr, __FILE__, __LINE__);
+
+    return ierr;
+}
+
+/**
+ * Copy the part of a region of a checkpoint record that is inside a
+ * region of this IO task to the IO buffer.
+ *
+ * @param fndims the number of dimensions.
+ * @param size the size of a value in bytes.
+ * @param fstart the start of the record region.
+ * @param fcount the count of the record region.
+ * @param fdata the data of the record region.
+ * @param mstart the start of the region of this task.
+ * @param mcount the count of the region of this task.
+ * @param mdata where the data of the region of this task go.
+ * @author Ed Hartnett
+ */
+static void
+ckpt_copy_box(int fndims, int size, const PIO_Offset *fstart, const PIO_Offset *fcount,
+              const char *fdata, const PIO_Offset *mstart, const PIO_Offset *mcount,
+              char *mdata)
+{
+    PIO_Offset lo[fndims], hi[fndims], idx[fndims];
+    PIO_Offset run;
+
+    /* Find the box both regions have. */
+    for (int d = 0; d < fndims; d++)
+    {
+        lo[d] = max(fstart[d], mstart[d]);
+        hi[d] = min(fstart[d] + fcount[d], mstart[d] + mcount[d]);
+        if (lo[d] >= hi[d])
+            return;
+        idx[d] = lo[d];
+    }
+    run = (hi[fndims - 1] - lo[fndims - 1]) * size;
+
+    /* Copy it one run along the last dimension at a time. */
+    while (1)
+    {
+        PIO_Offset foff = 0, moff = 0;
+        int d;
+
+        for (d = 0; d < fndims; d++)
+        {
+            foff = foff * fcount[d] + idx[d] - fstart[d];
+            moff = moff * mcount[d] + idx[d] - mstart[d];
+        }
+        memcpy(mdata + moff * size, fdata + foff * size, run);
+
+        for (d = fndims - 2; d >= 0; d--)
+        {
+            if (++idx[d] < hi[d])
+                break;
+            idx[d] = lo[d];
+        }
+        if (d < 0)
+            break;
+    }
+}
+
+/**
+ * Read an array from the checkpoint files of a file to the IO buffer
+ * (see PIOc_set_checkpoint()). If the record of each IO task has the
+ * same regions as the decomposition on the task, each task reads its
+ * record back as it is. Otherwise each task reads the parts of its
+ * regions from the records of all the checkpoint files. This is
+ * called on all tasks.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param vid the ID of the var.
+ * @param iobuf the IO buffer, iodesc->llen values.
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_ckpt_read(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    var_desc_t *vdesc;
+    PIO_Offset *table = NULL, *ftable = NULL;
+    PIO_Offset *loffset = NULL;
+    pio_ckpt_entry *e = NULL;
+    double start = MPI_Wtime(); /* For the I/O statistics. */
+    int fndims, frame, rrcnt;
+    int fast;
+    int ierr;
+    int mpierr;
+
+    if (!ios->ioproc)
+        return PIO_NOERR;
+
+    if ((ierr = get_file_var_desc(file, vid, &vdesc)))
+        return ierr;
+    fndims = vdesc->ndims;
+    if (fndims > iodesc->ndims && vdesc->record < 0)
+        vdesc->record = 0;
+    frame = vdesc->record >= 0 && iodesc->ndims < fndims ? vdesc->record : -1;
+
+    /* The regions of this task. Errors on this task are only
+     * returned after the other IO tasks learn of them below. */
+    if (!(table = malloc(2 * max(iodesc->maxregions, 1) * fndims * sizeof(PIO_Offset))) ||
+        !(loffset = malloc(max(iodesc->maxregions, 1) * sizeof(PIO_Offset))))
+        ierr = PIO_ENOMEM;
+    rrcnt = ierr ? 0 : ckpt_regions(iodesc, vdesc, fndims, &vdesc->record, table, loffset);
+
+    /* The record of this task can be read as it is if it has the
+     * same regions. */
+    fast = !ierr && file->ckpt_nfiles == ios->num_iotasks &&
+        (e = ckpt_find(file, ios->io_rank, vid, frame)) && e->nelems == iodesc->llen &&
+        e->pio_type == iodesc->piotype && e->fndims == fndims && e->rrcnt == rrcnt;
+    if (fast && rrcnt)
+    {
+        if (!(ftable = malloc(2 * rrcnt * fndims * sizeof(PIO_Offset))))
+            ierr = PIO_ENOMEM;
+        else if (fseek(file->ckpt_fps[e->fidx], e->offset, SEEK_SET) ||
+                 fread(ftable, sizeof(PIO_Offset), 2 * rrcnt * fndims,
+                       file->ckpt_fps[e->fidx]) != 2 * rrcnt * fndims)
+            ierr = PIO_EIO;
+        else
+            fast = !memcmp(ftable, table, 2 * rrcnt * fndims * sizeof(PIO_Offset));
+        free(ftable);
+        ftable = NULL;
+    }
+    if (ierr)
+        fast = 0;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &fast, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+    {
+        free(table);
+        free(loffset);
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+    PLOG((2, "pio_ckpt_read vid = %d frame = %d fast = %d", vid, frame, fast));
+
+    if (fast)
+    {
+        /* The data follow the region table. */
+        if (iodesc->llen && fread(iobuf, iodesc->mpitype_size, iodesc->llen,
+                                  file->ckpt_fps[e->fidx]) != iodesc->llen)
+            ierr = PIO_EIO;
+    }
+    else
+    {
+        /* Open the checkpoint files of the other tasks. */
+        for (int f = 0; !ierr && f < file->ckpt_nfiles; f++)
+            if (!file->ckpt_fps[f])
+                ierr = ckpt_open_file(file, file->fname, f);
+
+        /* Copy the parts of each region of each record that are in a
+         * region of this task. */
+        for (int f = 0; !ierr && rrcnt && f < file->ckpt_nfiles; f++)
+        {
+            PIO_Offset data_off;
+
+            if (!(e = ckpt_find(file, f, vid, frame)) || !e->rrcnt)
+                continue;
+            if (e->pio_type != iodesc->piotype || e->fndims != fndims)
+            {
+                ierr = PIO_EBADTYPE;
+                break;
+            }
+            if (!(ftable = malloc(2 * e->rrcnt * fndims * sizeof(PIO_Offset))))
+            {
+                ierr = PIO_ENOMEM;
+                break;
+            }
+            if (fseek(file->ckpt_fps[f], e->offset, SEEK_SET) ||
+                fread(ftable, sizeof(PIO_Offset), 2 * e->rrcnt * fndims,
+                      file->ckpt_fps[f]) != 2 * e->rrcnt * fndims)
+                ierr = PIO_EIO;
+            data_off = e->offset + 2 * e->rrcnt * fndims * sizeof(PIO_Offset);
+
+            for (int fr = 0; !ierr && fr < e->rrcnt; fr++)
+            {
+                PIO_Offset *fstart = ftable + fr * fndims;
+                PIO_Offset *fcount = ftable + (e->rrcnt + fr) * fndims;
+                PIO_Offset fsize = 1;
+                char *fdata = NULL;
+
+                for (int d = 0; d < fndims; d++)
+                    fsize *= fcount[d];
+
+                for (int mr = 0; !ierr && mr < rrcnt; mr++)
+                {
+                    PIO_Offset *mstart = table + mr * fndims;
+                    PIO_Offset *mcount = table + (rrcnt + mr) * fndims;
+                    bool overlap = true;
+
+                    for (int d = 0; d < fndims; d++)
+                        if (max(fstart[d], mstart[d]) >= min(fstart[d] + fcount[d],
+                                                             mstart[d] + mcount[d]))
+                            overlap = false;
+                    if (!overlap)
+                        continue;
+
+                    /* Read the data of the record region once. */
+                    if (!fdata)
+                    {
+                        if (!(fdata = malloc(fsize * iodesc->mpitype_size)))
+                            ierr = PIO_ENOMEM;
+                        else if (fseek(file->ckpt_fps[f], data_off, SEEK_SET) ||
+                                 fread(fdata, iodesc->mpitype_size, fsize,
+                                       file->ckpt_fps[f]) != fsize)
+                            ierr = PIO_EIO;
+                        if (ierr)
+                            break;
+                    }
+                    ckpt_copy_box(fndims, iodesc->mpitype_size, fstart, fcount, fdata,
+                                  mstart, mcount,
+                                  (char *)iobuf + loffset[mr] * iodesc->mpitype_size);
+                }
+                free(fdata);
+                data_off += fsize * iodesc->mpitype_size;
+            }
+            free(ftable);
+            ftable = NULL;
+        }
+    }
+    free(table);
+    free(loffset);
+
+    /* Get the same error on all IO tasks, such as a missing record
+     * of another layout. */
+    if ((ierr = pio_subfile_err(ios, ierr)))
+        return ierr;
+    pio_stats_io(file, iodesc, false, false, 1, iodesc->llen, iodesc->maxregions, start);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Close the checkpoint files of a file and free its index. This is
+ * only called on IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @author Ed Hartnett
+ */
+void
+pio_ckpt_close(file_desc_t *file)
+{
+    for (int f = 0; file->ckpt_fps && f < file->ckpt_nfiles; f++)
+        if (file->ckpt_fps[f])
+            fclose(file->ckpt_fps[f]);
+    free(file->ckpt_fps);
+    file->ckpt_fps = NULL;
+    free(file->ckpt_index);
+    file->ckpt_index = NULL;
+    file->ckpt_nindex = 0;
+    file->ckpt_maxindex = 0;
+}
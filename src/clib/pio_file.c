@@ -204,36 +204,174 @@ PIOc_create(int iosysid, const char *path, int cmode, int *ncidp)
 }
 
 /**
- * Close a file previously opened with PIO.
+ * Post the broadcast of the result of a background sync or close
+ * from the IO root to all tasks, see PIOc_closefile_async(). On the
+ * computation tasks the request is kept in the file, to be completed
+ * by PIOc_file_wait(). On the IO tasks it is kept in the IO system,
+ * and completed by pio_bg_progress().
+ *
+ * @param file pointer to the file info.
+ * @param err the result, on the IO tasks.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+post_bg_result(file_desc_t *file, int err)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int mpierr;
+
+    if (ios->ioproc)
+    {
+        pio_bg_req *bg;
+
+        if (!(bg = malloc(sizeof(pio_bg_req))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        bg->err = err;
+        if ((mpierr = MPI_Ibcast(&bg->err, 1, MPI_INT, ios->ioroot, ios->my_comm, &bg->req)))
+        {
+            free(bg);
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
+        bg->next = ios->bg_reqs;
+        ios->bg_reqs = bg;
+    }
+    else
+    {
+        pioassert(file->nbg < PIO_MAX_BG, "too many background operations", __FILE__,
+                  __LINE__);
+        file->bg_errs[file->nbg] = PIO_NOERR;
+        if ((mpierr = MPI_Ibcast(&file->bg_errs[file->nbg], 1, MPI_INT, ios->ioroot,
+                                 ios->my_comm, &file->bg_reqs[file->nbg])))
+            return check_mpi(ios, file, mpierr, __FILE__, __LINE__);
+        file->nbg++;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Complete the broadcasts of the results of background syncs and
+ * closes on the IO tasks. This is called by the message handler
+ * before each message, and by PIOc_finalize().
+ *
+ * @param ios pointer to the IO system info.
+ * @param wait true to wait for all of them, false to only free those
+ * that are complete.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_bg_progress(iosystem_desc_t *ios, bool wait)
+{
+    pio_bg_req **prev = &ios->bg_reqs;
+    int mpierr;
+
+    while (*prev)
+    {
+        pio_bg_req *bg = *prev;
+        int done = 1;
+
+        if (wait)
+            mpierr = MPI_Wait(&bg->req, MPI_STATUS_IGNORE);
+        else
+            mpierr = MPI_Test(&bg->req, &done, MPI_STATUS_IGNORE);
+        if (mpierr)
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if (done)
+        {
+            *prev = bg->next;
+            free(bg);
+        }
+        else
+            prev = &bg->next;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * On computation tasks, wait for the background sync or close of a
+ * file, if one was started.
+ *
+ * @param file pointer to the file info.
+ * @returns the first error of the background operations.
+ * @author Ed Hartnett
+ */
+static int
+wait_file_bg(file_desc_t *file)
+{
+    int ierr = PIO_NOERR;
+    int mpierr;
+
+    if (!file->nbg)
+        return PIO_NOERR;
+
+    if ((mpierr = MPI_Waitall(file->nbg, file->bg_reqs, MPI_STATUSES_IGNORE)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    for (int b = 0; b < file->nbg; b++)
+        if (!ierr)
+            ierr = file->bg_errs[b];
+    file->nbg = 0;
+
+    return ierr;
+}
+
+/**
+ * Close a file previously opened with PIO. This does the work of
+ * PIOc_closefile() and PIOc_closefile_async().
  *
  * @param ncid: the file pointer
+ * @param bg true to not wait for the IO tasks, if async is in use.
  * @returns PIO_NOERR for success, error code otherwise.
  * @ingroup PIO_close_file_c
  * @author Jim Edwards, Ed Hartnett
  */
-int
-PIOc_closefile(int ncid)
+static int
+closefile_int(int ncid, bool bg)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int ierr = PIO_NOERR;  /* Return code from function calls. */
+    int sync_ierr = PIO_NOERR; /* Return code from the sync. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
 #ifdef USE_MPE
     pio_start_mpe_log(CLOSE);
 #endif /* USE_MPE */
-
-    PLOG((1, "PIOc_closefile ncid = %d", ncid));
+    PLOG((1, "PIOc_closefile ncid = %d bg = %d", ncid, bg));
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_CLOSEFILE)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Only async iosystems close in the background. */
+    bg = bg && ios->async;
+
+    /* Complete any non-blocking reads or writes. */
+    if (!ios->async)
+        if ((ierr = wait_darray_requests(file)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Write any queued attributes. */
+    if (ios->async && !ios->ioproc)
+        if ((ierr = flush_deferred_atts(file)))
+            return ierr;
+
     /* Sync changes before closing on all tasks if async is not in
-     * use, but only on non-IO tasks if async is in use. */
+     * use, but only on non-IO tasks if async is in use. The file is
+     * closed even if this fails, but the error (which includes those
+     * of any write behind darray writes) is returned. */
     if (!ios->async || !ios->ioproc)
+    {
         if (file->writable)
-            PIOc_sync(ncid);
+            sync_ierr = bg ? PIOc_sync_async(ncid) : PIOc_sync(ncid);
+        else if (file->defer_errors)
+            sync_ierr = PIOc_check_errors(ncid);
+    }
 
     /* If async is in use and this is a comp tasks, then the compmaster
      * sends a msg to the pio_msg_handler running on the IO master and
@@ -243,7 +381,7 @@ PIOc_closefile(int ncid)
     {
         if (!ios->ioproc)
         {
-            int msg = PIO_MSG_CLOSE_FILE;
+            int msg = bg ? PIO_MSG_CLOSE_FILE_BG : PIO_MSG_CLOSE_FILE;
 
             if (ios->compmaster == MPI_ROOT)
                 mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
@@ -257,6 +395,22 @@ PIOc_closefile(int ncid)
             return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
         if (mpierr)
             return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+        /* In the background, the computation tasks only post the
+         * receive of the result. The file is freed by
+         * PIOc_file_wait(). */
+        if (bg && !ios->ioproc)
+        {
+            if ((ierr = post_bg_result(file, PIO_NOERR)))
+                return ierr;
+            file->bg_close = true;
+#ifdef USE_MPE
+            pio_stop_mpe_log(CLOSE, __func__);
+#endif /* USE_MPE */
+            if ((ierr = pio_stop_timer(ios, PIO_TIMER_CLOSEFILE)))
+                return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+            return sync_ierr;
+        }
     }
 
     /* If this is an IO task, then call the netCDF function. */
@@ -271,26 +425,59 @@ PIOc_closefile(int ncid)
         case PIO_IOTYPE_NETCDF4C:
 #endif
         case PIO_IOTYPE_NETCDF:
-            if (ios->io_rank == 0)
+            if (file->do_io)
                 ierr = nc_close(file->fh);
+            if (file->num_subfiles)
+            {
+                ierr = pio_subfile_err(ios, ierr);
+                MPI_Comm_free(&file->subfile_comm);
+            }
             break;
 #ifdef _PNETCDF
         case PIO_IOTYPE_PNETCDF:
             if (file->writable)
                 ierr = ncmpi_buffer_detach(file->fh);
             ierr = ncmpi_close(file->fh);
+            if (file->stage_fp)
+            {
+                fclose(file->stage_fp);
+                file->stage_fp = NULL;
+            }
             break;
 #endif
         default:
             return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
         }
+
+        /* Close the checkpoint files, if any. */
+        pio_ckpt_close(file);
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+    /* Broadcast and check the return code. In the background the
+     * broadcast is only posted, and completed later. */
+    if (bg)
+    {
+        if ((mpierr = post_bg_result(file, ierr)))
+            return mpierr;
+    }
+    else if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
         return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    /* In the background, only the IO tasks get here, each with its
+     * own error, which the computation tasks learn from
+     * PIOc_file_wait(). The file is freed anyway, since it was
+     * closed. */
     if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    {
+        if (!bg)
+            return check_netcdf(file, ierr, __FILE__, __LINE__);
+        sync_ierr = pio_err(NULL, file, ierr, __FILE__, __LINE__);
+    }
+
+    /* Print the I/O statistics of the file, if asked. */
+    if (ios->stats_report)
+        if ((ierr = pio_report_file_stats(file)))
+            return ierr;
 
     /* Delete file from our list of open files. */
     if ((ierr = pio_delete_file_from_list(ncid)))
@@ -299,8 +486,148 @@ PIOc_closefile(int ncid)
 #ifdef USE_MPE
     pio_stop_mpe_log(CLOSE, __func__);
 #endif /* USE_MPE */
+    if ((ierr = pio_stop_timer(ios, PIO_TIMER_CLOSEFILE)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
 
-    return ierr;
+    return sync_ierr;
+}
+
+/**
+ * Close a file previously opened with PIO.
+ *
+ * @param ncid: the file pointer
+ * @returns PIO_NOERR for success, error code otherwise.
+ * @ingroup PIO_close_file_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_closefile(int ncid)
+{
+    file_desc_t *file;
+    int ierr;
+
+    /* A lazily opened file that was never used was never opened. */
+    if (pio_forget_lazy_file(ncid))
+        return PIO_NOERR;
+
+    /* Finish a background sync first. */
+    if (!pio_get_file(ncid, &file) && file->nbg)
+        if ((ierr = wait_file_bg(file)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+
+    return closefile_int(ncid, false);
+}
+
+/**
+ * Start closing a file, without waiting for the IO tasks.
+ *
+ * With async, the computation tasks move the data still buffered to
+ * the IO tasks, and return as soon as the IO tasks have been told to
+ * close the file. The IO tasks then flush their buffers, write the
+ * fill values and close the file, while the computation tasks go on
+ * computing. PIOc_file_test() or PIOc_file_wait() must be called with
+ * the ncid to learn the result and free the ncid; the ncid may not be
+ * used for anything else.
+ *
+ * If async is not in use, the file is closed before this function
+ * returns, as with PIOc_closefile().
+ *
+ * @param ncid the ncid of the file.
+ * @returns PIO_NOERR for success, error code otherwise.
+ * @ingroup PIO_close_file_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_closefile_async(int ncid)
+{
+    file_desc_t *file;
+    int ierr;
+
+    /* A lazily opened file that was never used was never opened. */
+    if (pio_forget_lazy_file(ncid))
+        return PIO_NOERR;
+
+    /* Finish a background sync first. */
+    if (!pio_get_file(ncid, &file) && file->nbg)
+        if ((ierr = wait_file_bg(file)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+
+    return closefile_int(ncid, true);
+}
+
+/**
+ * Test whether the background sync or close of a file, started with
+ * PIOc_sync_async() or PIOc_closefile_async(), is done. If it is, the
+ * result is returned, and for a close the ncid is freed. This is not
+ * collective.
+ *
+ * If there is no background sync or close for the file, done is set
+ * to true.
+ *
+ * @param ncid the ncid of the file.
+ * @param done pointer that gets true if the operation is done.
+ * @returns PIO_NOERR for success, error code otherwise.
+ * @ingroup PIO_close_file_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_file_test(int ncid, int *done)
+{
+    file_desc_t *file;
+    int mpierr;
+    int ierr;
+
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    if (!done)
+        return pio_err(NULL, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    *done = 1;
+    if (file->nbg)
+        if ((mpierr = MPI_Testall(file->nbg, file->bg_reqs, done, MPI_STATUSES_IGNORE)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    return *done ? PIOc_file_wait(ncid) : PIO_NOERR;
+}
+
+/**
+ * Wait for the background sync or close of a file, started with
+ * PIOc_sync_async() or PIOc_closefile_async(), and return its
+ * result. For a close the ncid is freed. This is not collective.
+ *
+ * @param ncid the ncid of the file.
+ * @returns PIO_NOERR for success, error code otherwise.
+ * @ingroup PIO_close_file_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_file_wait(int ncid)
+{
+    file_desc_t *file;
+    int ierr, ret;
+
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    PLOG((1, "PIOc_file_wait ncid = %d nbg = %d bg_close = %d", ncid, file->nbg,
+          file->bg_close));
+
+    ierr = wait_file_bg(file);
+    if (file->bg_close)
+    {
+        /* Print the I/O statistics of the file, if asked. */
+        if (file->iosystem->stats_report)
+            if ((ret = pio_report_file_stats(file)))
+                return ret;
+        if (ierr)
+            pio_err(NULL, file, ierr, __FILE__, __LINE__);
+        if ((ret = pio_delete_file_from_list(ncid)))
+            return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+        return ierr;
+    }
+    if (ierr)
+        return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
 }
 
 /**
@@ -360,7 +687,28 @@ PIOc_deletefile(int iosysid, const char *filename)
         mpierr = MPI_Barrier(ios->io_comm);
 
         if (!mpierr && ios->io_rank == 0)
+        {
+            int ncid;
+            int num_subfiles = 0;
+
+            /* If this is the index file of a subfiled file, delete
+             * the subfiles too. */
+            if (!nc_open(filename, NC_NOWRITE, &ncid))
+            {
+                if (nc_get_att_int(ncid, NC_GLOBAL, PIO_SUBFILES_ATT, &num_subfiles))
+                    num_subfiles = 0;
+                nc_close(ncid);
+            }
+            for (int s = 0; s < num_subfiles; s++)
+            {
+                char subname[PIO_MAX_NAME + 16];
+
+                snprintf(subname, sizeof(subname), "%s.%d", filename, s);
+                nc_delete(subname);
+            }
+
             ierr = nc_delete(filename);
+        }
 
         if (!mpierr)
             mpierr = MPI_Barrier(ios->io_comm);
@@ -377,33 +725,40 @@ PIOc_deletefile(int iosysid, const char *filename)
 }
 
 /**
- * PIO interface to nc_sync This routine is called collectively by all
- * tasks in the communicator ios.union_comm.
- *
- * Refer to the <A
- * HREF="http://www.unidata.ucar.edu/software/netcdf/docs/modules.html"
- * target="_blank"> netcdf </A> documentation.
+ * Sync a file. This does the work of PIOc_sync() and
+ * PIOc_sync_async().
  *
  * @param ncid the ncid of the file to sync.
+ * @param bg true to not wait for the IO tasks, if async is in use.
  * @returns PIO_NOERR for success, error code otherwise.
  * @ingroup PIO_sync_file_c
  * @author Jim Edwards, Ed Hartnett
  */
-int
-PIOc_sync(int ncid)
+static int
+sync_int(int ncid, bool bg)
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     file_desc_t *file;     /* Pointer to file information. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
     int ierr = PIO_NOERR;  /* Return code from function calls. */
 
-    PLOG((1, "PIOc_sync ncid = %d", ncid));
-
+    PLOG((1, "PIOc_sync ncid = %d bg = %d", ncid, bg));
     /* Get the file info from the ncid. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
+    if ((ierr = pio_start_timer(ios, PIO_TIMER_SYNC)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Only async iosystems sync in the background. */
+    bg = bg && ios->async;
+
+    /* Write any queued attributes. */
+    if (ios->async && !ios->ioproc)
+        if ((ierr = flush_deferred_atts(file)))
+            return ierr;
+
     /* Flush data buffers on computational tasks. */
     if (!ios->async || !ios->ioproc)
     {
@@ -411,6 +766,10 @@ PIOc_sync(int ncid)
         {
             wmulti_buffer *wmb, *twmb;
 
+            /* Complete any non-blocking writes. */
+            if ((ierr = wait_darray_requests(file)))
+                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
             PLOG((3, "PIOc_sync checking buffers"));
             HASH_ITER(hh, file->buffer, wmb, twmb)
             {
@@ -419,6 +778,7 @@ PIOc_sync(int ncid)
                 if (wmb->num_arrays > 0)
                     flush_buffer(ncid, wmb, true);
                 HASH_DEL(file->buffer, wmb);
+                free_multi_buffer(wmb);
                 free(wmb);
 
             }
@@ -431,7 +791,7 @@ PIOc_sync(int ncid)
     {
         if (!ios->ioproc)
         {
-            int msg = PIO_MSG_SYNC;
+            int msg = bg ? PIO_MSG_SYNC_BG : PIO_MSG_SYNC;
 
             if (ios->compmaster == MPI_ROOT)
                 mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
@@ -445,6 +805,15 @@ PIOc_sync(int ncid)
             check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
         if (mpierr)
             return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+        /* In the background, the computation tasks only post the
+         * receive of the result. */
+        if (bg && !ios->ioproc)
+        {
+            if ((ierr = post_bg_result(file, PIO_NOERR)))
+                return ierr;
+            return pio_stop_timer(ios, PIO_TIMER_SYNC);
+        }
     }
 
     /* Call the sync function on IO tasks. */
@@ -461,26 +830,104 @@ PIOc_sync(int ncid)
             case PIO_IOTYPE_NETCDF4C:
 #endif
             case PIO_IOTYPE_NETCDF:
-                if (ios->io_rank == 0)
+                if (file->do_io)
                     ierr = nc_sync(file->fh);
                 break;
 #ifdef _PNETCDF
             case PIO_IOTYPE_PNETCDF:
-                flush_output_buffer(file, true, 0);
+                ierr = flush_output_buffer(file, true, 0);
                 break;
 #endif
             default:
                 return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
             }
+
+            /* Add the first error of the darray writes done in write
+             * behind mode, on any IO task, since the last sync. */
+            if (ios->async)
+            {
+                int wberr;
+
+                if ((mpierr = MPI_Allreduce(&file->write_behind_err, &wberr, 1, MPI_INT,
+                                            MPI_MIN, ios->io_comm)))
+                    return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+                file->write_behind_err = PIO_NOERR;
+                if (!ierr)
+                    ierr = wberr;
+            }
         }
         PLOG((2, "PIOc_sync ierr = %d", ierr));
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf2(ios, NULL, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, with any deferred
+     * errors. In the background, the IO tasks only post the
+     * broadcast. */
+    if (bg)
+    {
+        if ((mpierr = post_bg_result(file, ierr)))
+            return mpierr;
+    }
+    else if ((ierr = check_netcdf_sync(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
-    return ierr;
+    return pio_stop_timer(ios, PIO_TIMER_SYNC);
+}
+
+/**
+ * PIO interface to nc_sync This routine is called collectively by all
+ * tasks in the communicator ios.union_comm.
+ *
+ * Refer to the <A
+ * HREF="http://www.unidata.ucar.edu/software/netcdf/docs/modules.html"
+ * target="_blank"> netcdf </A> documentation.
+ *
+ * @param ncid the ncid of the file to sync.
+ * @returns PIO_NOERR for success, error code otherwise.
+ * @ingroup PIO_sync_file_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_sync(int ncid)
+{
+    file_desc_t *file;
+    int ierr;
+
+    /* Finish a background sync first. */
+    if (!pio_get_file(ncid, &file) && file->nbg)
+        if ((ierr = wait_file_bg(file)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+
+    return sync_int(ncid, false);
+}
+
+/**
+ * Start a sync of a file, without waiting for the IO tasks.
+ *
+ * With async, the computation tasks move the data still buffered to
+ * the IO tasks, and return as soon as the IO tasks have been told to
+ * sync the file. The result is learned with PIOc_file_test() or
+ * PIOc_file_wait(). Other calls may use the file in the meantime; the
+ * IO tasks handle them after the sync. A later sync or close of the
+ * file waits for this one first.
+ *
+ * If async is not in use, the file is synced before this function
+ * returns, as with PIOc_sync().
+ *
+ * @param ncid the ncid of the file to sync.
+ * @returns PIO_NOERR for success, error code otherwise.
+ * @ingroup PIO_sync_file_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_sync_async(int ncid)
+{
+    file_desc_t *file;
+    int ierr;
+
+    /* Finish an earlier background sync first. */
+    if (!pio_get_file(ncid, &file) && file->nbg)
+        if ((ierr = wait_file_bg(file)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+
+    return sync_int(ncid, true);
 }
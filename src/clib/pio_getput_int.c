@@ -11,6 +11,274 @@
 #include <pio.h>
 #include <pio_internal.h>
 
+/**
+ * Write an attribute with the netCDF library of a file. This runs on
+ * the IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param name the name of the attribute.
+ * @param atttype the nc_type of the attribute in the file.
+ * @param len the length of the attribute array.
+ * @param memtype the nc_type of the attribute data in memory.
+ * @param op a pointer with the attribute data.
+ * @return 0 for success, error code from the netCDF library
+ * otherwise.
+ * @author Ed Hartnett
+ */
+int
+put_att_io(file_desc_t *file, int varid, const char *name, nc_type atttype,
+           PIO_Offset len, nc_type memtype, const void *op)
+{
+    int ierr = PIO_NOERR;
+
+    pioassert(file && name && file->iosystem->ioproc, "invalid input", __FILE__, __LINE__);
+
+#ifdef _PNETCDF
+    if (file->iotype == PIO_IOTYPE_PNETCDF)
+    {
+        switch(memtype)
+        {
+        case NC_BYTE:
+            ierr = ncmpi_put_att_schar(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_CHAR:
+            ierr = ncmpi_put_att_text(file->fh, varid, name, len, op);
+            break;
+        case NC_SHORT:
+            ierr = ncmpi_put_att_short(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_INT:
+            ierr = ncmpi_put_att_int(file->fh, varid, name, atttype, len, op);
+            break;
+        case PIO_LONG_INTERNAL:
+            ierr = ncmpi_put_att_long(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_FLOAT:
+            ierr = ncmpi_put_att_float(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_DOUBLE:
+            ierr = ncmpi_put_att_double(file->fh, varid, name, atttype, len, op);
+            break;
+        default:
+            return pio_err(NULL, file, PIO_EBADTYPE, __FILE__, __LINE__);
+        }
+    }
+#endif /* _PNETCDF */
+
+    if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
+    {
+        switch(memtype)
+        {
+        case NC_CHAR:
+            ierr = nc_put_att_text(file->fh, varid, name, len, op);
+            break;
+        case NC_BYTE:
+            ierr = nc_put_att_schar(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_SHORT:
+            ierr = nc_put_att_short(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_INT:
+            ierr = nc_put_att_int(file->fh, varid, name, atttype, len, op);
+            break;
+        case PIO_LONG_INTERNAL:
+            ierr = nc_put_att_long(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_FLOAT:
+            ierr = nc_put_att_float(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_DOUBLE:
+            ierr = nc_put_att_double(file->fh, varid, name, atttype, len, op);
+            break;
+#ifdef _NETCDF4
+        case NC_UBYTE:
+            ierr = nc_put_att_uchar(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_USHORT:
+            ierr = nc_put_att_ushort(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_UINT:
+            ierr = nc_put_att_uint(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_INT64:
+            PLOG((3, "about to call nc_put_att_longlong"));
+            ierr = nc_put_att_longlong(file->fh, varid, name, atttype, len, op);
+            break;
+        case NC_UINT64:
+            ierr = nc_put_att_ulonglong(file->fh, varid, name, atttype, len, op);
+            break;
+            /* case NC_STRING: */
+            /*      ierr = nc_put_att_string(file->fh, varid, name, atttype, len, op); */
+            /*      break; */
+#endif /* _NETCDF4 */
+        default:
+            return pio_err(NULL, file, PIO_EBADTYPE, __FILE__, __LINE__);
+        }
+    }
+
+    return ierr;
+}
+
+/**
+ * Queue an attribute on the computation tasks of an async iosystem,
+ * instead of sending it at once. Only the computation master keeps
+ * the data.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param name the name of the attribute.
+ * @param atttype the nc_type of the attribute in the file.
+ * @param len the length of the attribute array.
+ * @param memtype the nc_type of the attribute data in memory.
+ * @param op a pointer with the attribute data.
+ * @return PIO_NOERR for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+defer_put_att(file_desc_t *file, int varid, const char *name, nc_type atttype,
+              PIO_Offset len, nc_type memtype, const void *op)
+{
+    pio_msg_args *args;
+    PIO_Offset memtype_len;
+    int namelen = strlen(name);
+    int more = 1;
+    int ierr;
+
+    /* The size of the atomic types is known without asking the IO
+     * tasks. */
+    if (memtype == PIO_LONG_INTERNAL)
+        memtype_len = sizeof(long int);
+    else
+    {
+        int type_size;
+
+        if ((ierr = find_mpi_type(memtype, NULL, &type_size)))
+            return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+        memtype_len = type_size;
+    }
+
+    /* Start the queue with the ncid. */
+    if (!file->deferred_atts)
+    {
+        if (!(file->deferred_atts = malloc(sizeof(pio_msg_args))))
+            return pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+        pio_msg_args_init(file->deferred_atts, file->iosystem);
+        if ((ierr = pio_msg_args_pack(file->deferred_atts, &file->pio_ncid, 1, MPI_INT)))
+            return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+    }
+    args = file->deferred_atts;
+
+    /* Each attribute is marked as one more in the queue. */
+    if (!(ierr = pio_msg_args_pack(args, &more, 1, MPI_INT)))
+        ierr = pio_msg_args_pack(args, &varid, 1, MPI_INT);
+    if (!ierr)
+        ierr = pio_msg_args_pack(args, &namelen, 1, MPI_INT);
+    if (!ierr)
+        ierr = pio_msg_args_pack(args, name, namelen + 1, MPI_CHAR);
+    if (!ierr)
+        ierr = pio_msg_args_pack(args, &atttype, 1, MPI_INT);
+    if (!ierr)
+        ierr = pio_msg_args_pack(args, &len, 1, MPI_OFFSET);
+    if (!ierr)
+        ierr = pio_msg_args_pack(args, &memtype, 1, MPI_INT);
+    if (!ierr)
+        ierr = pio_msg_args_pack(args, &memtype_len, 1, MPI_OFFSET);
+    if (!ierr)
+        ierr = pio_msg_args_pack(args, op, len * memtype_len, MPI_BYTE);
+    if (ierr)
+        return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
+
+    PLOG((2, "defer_put_att varid = %d name = %s len = %lld", varid, name, len));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Send the attributes queued on the computation tasks of an async
+ * iosystem to the IO tasks, in one message, and wait for them to be
+ * written. This is called on the computation tasks, before the
+ * PIOc_enddef(), PIOc_redef(), PIOc_sync() or PIOc_closefile() of
+ * the file.
+ *
+ * @param file pointer to the file info.
+ * @return PIO_NOERR for success, otherwise the error of the first
+ * attribute that could not be written.
+ * @author Ed Hartnett
+ */
+int
+flush_deferred_atts(file_desc_t *file)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int msg = PIO_MSG_PUT_ATT_BATCH;
+    int more = 0;
+    int mpierr = MPI_SUCCESS, mpierr2;
+    int ierr = PIO_NOERR;
+
+    pioassert(ios->async && !ios->ioproc, "invalid input", __FILE__, __LINE__);
+
+    if (!file->deferred_atts)
+        return PIO_NOERR;
+
+    if (ios->compmaster == MPI_ROOT)
+        mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+    if (!mpierr)
+        mpierr = pio_msg_args_pack(file->deferred_atts, &more, 1, MPI_INT);
+    if (!mpierr)
+        mpierr = pio_msg_args_send(ios, file->deferred_atts);
+    pio_msg_args_free(file->deferred_atts);
+    free(file->deferred_atts);
+    file->deferred_atts = NULL;
+
+    /* Handle MPI errors. */
+    if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+    if (mpierr)
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    /* Broadcast and check the return code. */
+    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    if (ierr)
+        return check_netcdf(file, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Turn the queueing of attributes on or off, for the computation
+ * tasks of an async iosystem.
+ *
+ * With it on, PIOc_put_att() and the typed functions only queue the
+ * attribute. The queued attributes of a file are sent to the IO tasks
+ * in one message at the next PIOc_enddef(), PIOc_redef(), PIOc_sync()
+ * or PIOc_closefile() of the file, which also returns any error in
+ * writing them. Until then they can't be read back. This saves a
+ * round trip between the components for each attribute.
+ *
+ * The setting has no effect if async is not in use. This function
+ * must be called on all computation tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to queue the attributes.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_defer_atts(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_defer_atts iosysid = %d enable = %d", iosysid, enable));
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    ios->defer_atts = enable;
+
+    return PIO_NOERR;
+}
+
 /**
  * Write a netCDF attribute of any type, converting to any type.
  *
@@ -40,7 +308,7 @@ PIOc_put_att_tc(int ncid, int varid, const char *name, nc_type atttype,
     int ierr;           /* Return code from function calls. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -51,6 +319,10 @@ PIOc_put_att_tc(int ncid, int varid, const char *name, nc_type atttype,
     PLOG((1, "PIOc_put_att_tc ncid = %d varid = %d name = %s atttype = %d len = %d memtype = %d",
           ncid, varid, name, atttype, len, memtype));
 
+    /* Queue the attribute, see PIOc_set_defer_atts(). */
+    if (ios->async && !ios->ioproc && ios->defer_atts)
+        return defer_put_att(file, varid, name, atttype, len, memtype, op);
+
     /* Run these on all tasks if async is not in use, but only on
      * non-IO tasks if async is in use. */
     if (!ios->async || !ios->ioproc)
@@ -77,31 +349,37 @@ PIOc_put_att_tc(int ncid, int varid, const char *name, nc_type atttype,
         {
             int msg = PIO_MSG_PUT_ATT;
 
+            int namelen = strlen(name);
+            pio_msg_args args;
+
             if (ios->compmaster == MPI_ROOT)
                 mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
 
+            /* Send all the parameters in one message. */
+            pio_msg_args_init(&args, ios);
             if (!mpierr)
-                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &ncid, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            int namelen = strlen(name);
+                mpierr = pio_msg_args_pack(&args, &varid, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&namelen, 1, MPI_INT,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &namelen, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast((void *)name, namelen + 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, name, namelen + 1, MPI_CHAR);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &atttype, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&atttype, 1, MPI_INT,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &len, 1, MPI_OFFSET);
             if (!mpierr)
-                mpierr = MPI_Bcast(&len, 1, MPI_OFFSET,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &atttype_len, 1, MPI_OFFSET);
             if (!mpierr)
-                mpierr = MPI_Bcast(&atttype_len, 1, MPI_OFFSET,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &memtype, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&memtype, 1, MPI_INT,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &memtype_len, 1, MPI_OFFSET);
             if (!mpierr)
-                mpierr = MPI_Bcast(&memtype_len, 1, MPI_OFFSET,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, op, len * memtype_len, MPI_BYTE);
             if (!mpierr)
-                mpierr = MPI_Bcast((void *)op, len * memtype_len, MPI_BYTE, ios->compmaster,
-                                   ios->intercomm);
+                mpierr = pio_msg_args_send(ios, &args);
+            pio_msg_args_free(&args);
             PLOG((2, "PIOc_put_att finished bcast ncid = %d varid = %d namelen = %d name = %s "
                   "len = %d atttype_len = %d memtype = %d memtype_len = %d", ncid, varid, namelen,
                   name, len, atttype_len, memtype, memtype_len));
@@ -124,96 +402,11 @@ PIOc_put_att_tc(int ncid, int varid, const char *name, nc_type atttype,
 
     /* If this is an IO task, then call the netCDF function. */
     if (ios->ioproc)
-    {
-#ifdef _PNETCDF
-        if (file->iotype == PIO_IOTYPE_PNETCDF)
-        {
-            switch(memtype)
-            {
-            case NC_BYTE:
-                ierr = ncmpi_put_att_schar(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_CHAR:
-                ierr = ncmpi_put_att_text(file->fh, varid, name, len, op);
-                break;
-            case NC_SHORT:
-                ierr = ncmpi_put_att_short(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_INT:
-                ierr = ncmpi_put_att_int(file->fh, varid, name, atttype, len, op);
-                break;
-            case PIO_LONG_INTERNAL:
-                ierr = ncmpi_put_att_long(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_FLOAT:
-                ierr = ncmpi_put_att_float(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_DOUBLE:
-                ierr = ncmpi_put_att_double(file->fh, varid, name, atttype, len, op);
-                break;
-            default:
-                return pio_err(ios, file, PIO_EBADTYPE, __FILE__, __LINE__);
-            }
-        }
-#endif /* _PNETCDF */
-
-        if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
-        {
-            switch(memtype)
-            {
-            case NC_CHAR:
-                ierr = nc_put_att_text(file->fh, varid, name, len, op);
-                break;
-            case NC_BYTE:
-                ierr = nc_put_att_schar(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_SHORT:
-                ierr = nc_put_att_short(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_INT:
-                ierr = nc_put_att_int(file->fh, varid, name, atttype, len, op);
-                break;
-            case PIO_LONG_INTERNAL:
-                ierr = nc_put_att_long(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_FLOAT:
-                ierr = nc_put_att_float(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_DOUBLE:
-                ierr = nc_put_att_double(file->fh, varid, name, atttype, len, op);
-                break;
-#ifdef _NETCDF4
-            case NC_UBYTE:
-                ierr = nc_put_att_uchar(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_USHORT:
-                ierr = nc_put_att_ushort(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_UINT:
-                ierr = nc_put_att_uint(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_INT64:
-                PLOG((3, "about to call nc_put_att_longlong"));
-                ierr = nc_put_att_longlong(file->fh, varid, name, atttype, len, op);
-                break;
-            case NC_UINT64:
-                ierr = nc_put_att_ulonglong(file->fh, varid, name, atttype, len, op);
-                break;
-                /* case NC_STRING: */
-                /*      ierr = nc_put_att_string(file->fh, varid, name, atttype, len, op); */
-                /*      break; */
-#endif /* _NETCDF4 */
-            default:
-                return pio_err(ios, file, PIO_EBADTYPE, __FILE__, __LINE__);
-            }
-        }
-    }
+        ierr = put_att_io(file, varid, name, atttype, len, memtype, op);
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -249,7 +442,7 @@ PIOc_get_att_tc(int ncid, int varid, const char *name, nc_type memtype, void *ip
     int ierr;               /* Return code from function calls. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -454,6 +647,96 @@ PIOc_get_att_tc(int ncid, int varid, const char *name, nc_type memtype, void *ip
     return PIO_NOERR;
 }
 
+/**
+ * Combine the data read from each subfile of a subfiled file (see
+ * PIOc_set_subfiles()) on IO task 0. The darray data of each IO task
+ * are only in the subfile of its group, and the other subfiles have
+ * fill values there, so the values of the other subfiles that are
+ * not fill values replace those read by IO task 0. This is collective
+ * over the IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param varid the variable ID.
+ * @param start the start indices.
+ * @param count the counts.
+ * @param stride the strides.
+ * @param num_elem the number of elements read.
+ * @param typelen the size of an element of the data read.
+ * @param ierr the error code of the read on this task.
+ * @param rbuf the data read by this task.
+ * @return PIO_NOERR on success, error code otherwise, the same on all
+ * IO tasks.
+ * @author Ed Hartnett
+ */
+static int
+merge_subfiles(file_desc_t *file, int varid, const PIO_Offset *start,
+               const PIO_Offset *count, const PIO_Offset *stride, PIO_Offset num_elem,
+               PIO_Offset typelen, int ierr, void *rbuf)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    char fill[8];             /* The fill value, in the type of the var. */
+    char *vbuf = NULL;        /* The data, in the type of the var. */
+    char *mask = NULL;        /* Non-zero where the data are not fill. */
+    nc_type vartype;
+    size_t varlen;
+    int no_fill;
+    int mpierr;
+
+    /* Find where this subfile has data that are not fill values. */
+    if (file->do_io && !ierr && num_elem)
+    {
+        if (!(ierr = nc_inq_vartype(file->fh, varid, &vartype)) &&
+            !(ierr = nc_inq_type(file->fh, vartype, NULL, &varlen)) &&
+            !(ierr = nc_inq_var_fill(file->fh, varid, &no_fill, fill)))
+        {
+            /* Without fill values, the subfiles can't be combined. */
+            if (no_fill)
+                ierr = PIO_EINVAL;
+            else if (!(vbuf = malloc(num_elem * varlen)) || !(mask = malloc(num_elem)))
+                ierr = PIO_ENOMEM;
+            else if (!(ierr = nc_get_vars(file->fh, varid, (size_t *)start, (size_t *)count,
+                                          (ptrdiff_t *)stride, vbuf)))
+                for (PIO_Offset i = 0; i < num_elem; i++)
+                    mask[i] = memcmp(vbuf + i * varlen, fill, varlen) != 0;
+        }
+        free(vbuf);
+    }
+
+    /* The other subfiles send their data, where they have some, to
+     * IO task 0. */
+    if (!(ierr = pio_subfile_err(ios, ierr)) && file->do_io && num_elem)
+    {
+        if (ios->io_rank)
+        {
+            if ((mpierr = MPI_Send(mask, num_elem, MPI_CHAR, 0, 0, ios->io_comm)) ||
+                (mpierr = MPI_Send(rbuf, num_elem * typelen, MPI_BYTE, 0, 1, ios->io_comm)))
+                ierr = check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        }
+        else if (!(vbuf = malloc(num_elem * typelen)))
+            ierr = PIO_ENOMEM;
+        else
+        {
+            for (int s = 1; !ierr && s < file->num_subfiles; s++)
+            {
+                MPI_Status status;
+
+                if ((mpierr = MPI_Recv(mask, num_elem, MPI_CHAR, MPI_ANY_SOURCE, 0, ios->io_comm,
+                                       &status)) ||
+                    (mpierr = MPI_Recv(vbuf, num_elem * typelen, MPI_BYTE, status.MPI_SOURCE, 1,
+                                       ios->io_comm, MPI_STATUS_IGNORE)))
+                    ierr = check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+                for (PIO_Offset i = 0; !ierr && i < num_elem; i++)
+                    if (mask[i])
+                        memcpy((char *)rbuf + i * typelen, vbuf + i * typelen, typelen);
+            }
+            free(vbuf);
+        }
+    }
+    free(mask);
+
+    return ierr;
+}
+
 /**
  * Internal PIO function which provides a type-neutral interface to
  * nc_get_vars.
@@ -504,6 +787,8 @@ PIOc_get_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
     char stride_present = stride ? true : false;
     PIO_Offset one = 1; /* For fake_stride. */
     PIO_Offset *fake_stride = &one; /* Needed for NULL stride bug in netcdf-4.6.2. */
+    void *rbuf = buf;        /* Where this task reads the data to. */
+    bool receiver = true;    /* True if this task gets the data. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
     int ierr;                           /* Return code. */
 
@@ -512,12 +797,27 @@ PIOc_get_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
           count_present, stride_present));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
+    /* Find out if this task gets the data. */
+    if (file->read_delivery == PIO_READ_ROOT)
+        receiver = ios->comp_rank == file->read_root;
+    else if (file->read_delivery == PIO_READ_NODE)
+    {
+        int node_rank;
+
+        if ((ierr = get_read_comms(ios)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Comm_rank(ios->read_node_comm, &node_rank)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        receiver = !node_rank;
+    }
+
     /* User must provide a place to put some data. */
-    if (!buf)
+    if ((!buf && receiver) ||
+        (file->read_delivery == PIO_READ_NODE && !find_node_buf(ios, buf)))
         return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
 
     /* Run these on all tasks if async is not in use, but only on
@@ -628,6 +928,20 @@ PIOc_get_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
             fake_stride = (PIO_Offset *)stride;
     }
 
+#ifdef _PNETCDF
+    /* Queued writes of PIOc_put_var*() must be done before the
+     * file is read. */
+    if (ios->ioproc && file->iotype == PIO_IOTYPE_PNETCDF && file->var_puts_pending)
+        if ((ierr = flush_output_buffer(file, true, 0)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+#endif /* _PNETCDF */
+
+    /* IO tasks that don't get the data read it to a buffer of their
+     * own. */
+    if (ios->ioproc && !receiver && num_elem * typelen > 0)
+        if (!(rbuf = malloc(num_elem * typelen)))
+            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+
     /* If this is an IO task, then call the netCDF function. */
     if (ios->ioproc)
     {
@@ -636,46 +950,49 @@ PIOc_get_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
 #ifdef _PNETCDF
         if (file->iotype == PIO_IOTYPE_PNETCDF)
         {
+            int ierr2;
+
             PLOG((2, "pnetcdf calling ncmpi_get_vars_*() file->fh = %d varid = %d", file->fh, varid));
-            /* Turn on independent access for pnetcdf file. */
+            /* Turn on independent access for pnetcdf file. Errors
+             * are returned on all tasks below, after rbuf is freed. */
             if ((ierr = ncmpi_begin_indep_data(file->fh)))
-                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                ierr = pio_err(ios, file, ierr, __FILE__, __LINE__);
 
             /* Only the IO master does the IO, so we are not really
              * getting parallel IO here. */
-            if (ios->iomaster == MPI_ROOT)
+            if (!ierr && ios->iomaster == MPI_ROOT)
             {
                 switch(xtype)
                 {
                 case NC_BYTE:
-                    ierr = ncmpi_get_vars_schar(file->fh, varid, start, count, stride, buf);
+                    ierr = ncmpi_get_vars_schar(file->fh, varid, start, count, stride, rbuf);
                     break;
                 case NC_CHAR:
-                    ierr = ncmpi_get_vars_text(file->fh, varid, start, count, stride, buf);
+                    ierr = ncmpi_get_vars_text(file->fh, varid, start, count, stride, rbuf);
                     break;
                 case NC_SHORT:
-                    ierr = ncmpi_get_vars_short(file->fh, varid, start, count, stride, buf);
+                    ierr = ncmpi_get_vars_short(file->fh, varid, start, count, stride, rbuf);
                     break;
                 case NC_INT:
-                    ierr = ncmpi_get_vars_int(file->fh, varid, start, count, stride, buf);
+                    ierr = ncmpi_get_vars_int(file->fh, varid, start, count, stride, rbuf);
                     break;
                 case PIO_LONG_INTERNAL:
-                    ierr = ncmpi_get_vars_long(file->fh, varid, start, count, stride, buf);
+                    ierr = ncmpi_get_vars_long(file->fh, varid, start, count, stride, rbuf);
                     break;
                 case NC_FLOAT:
-                    ierr = ncmpi_get_vars_float(file->fh, varid, start, count, stride, buf);
+                    ierr = ncmpi_get_vars_float(file->fh, varid, start, count, stride, rbuf);
                     break;
                 case NC_DOUBLE:
-                    ierr = ncmpi_get_vars_double(file->fh, varid, start, count, stride, buf);
+                    ierr = ncmpi_get_vars_double(file->fh, varid, start, count, stride, rbuf);
                     break;
                 default:
-                    return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
+                    ierr = pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
                 }
             }
 
             /* Turn off independent access for pnetcdf file. */
-            if ((ierr = ncmpi_end_indep_data(file->fh)))
-                return pio_err(ios, file, ierr, __FILE__, __LINE__);
+            if ((ierr2 = ncmpi_end_indep_data(file->fh)) && !ierr)
+                ierr = pio_err(ios, file, ierr2, __FILE__, __LINE__);
         }
 #endif /* _PNETCDF */
 
@@ -693,53 +1010,53 @@ PIOc_get_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
             {
             case NC_BYTE:
                 ierr = nc_get_vars_schar(file->fh, varid, (size_t *)start, (size_t *)count,
-                                         (ptrdiff_t *)fake_stride, buf);
+                                         (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_CHAR:
                 ierr = nc_get_vars_text(file->fh, varid, (size_t *)start, (size_t *)count,
-                                        (ptrdiff_t *)fake_stride, buf);
+                                        (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_SHORT:
                 ierr = nc_get_vars_short(file->fh, varid, (size_t *)start, (size_t *)count,
-                                         (ptrdiff_t *)fake_stride, buf);
+                                         (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_INT:
                 ierr = nc_get_vars_int(file->fh, varid, (size_t *)start, (size_t *)count,
-                                       (ptrdiff_t *)fake_stride, buf);
+                                       (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case PIO_LONG_INTERNAL:
                 ierr = nc_get_vars_long(file->fh, varid, (size_t *)start, (size_t *)count,
-                                        (ptrdiff_t *)fake_stride, buf);
+                                        (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_FLOAT:
                 ierr = nc_get_vars_float(file->fh, varid, (size_t *)start, (size_t *)count,
-                                         (ptrdiff_t *)fake_stride, buf);
+                                         (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_DOUBLE:
                 ierr = nc_get_vars_double(file->fh, varid, (size_t *)start, (size_t *)count,
-                                          (ptrdiff_t *)fake_stride, buf);
+                                          (ptrdiff_t *)fake_stride, rbuf);
                 break;
 #ifdef _NETCDF4
             case NC_UBYTE:
                 ierr = nc_get_vars_uchar(file->fh, varid, (size_t *)start, (size_t *)count,
-                                         (ptrdiff_t *)fake_stride, buf);
+                                         (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_USHORT:
                 ierr = nc_get_vars_ushort(file->fh, varid, (size_t *)start, (size_t *)count,
-                                          (ptrdiff_t *)fake_stride, buf);
+                                          (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_UINT:
                 ierr = nc_get_vars_uint(file->fh, varid, (size_t *)start, (size_t *)count,
-                                        (ptrdiff_t *)fake_stride, buf);
+                                        (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_INT64:
                 PLOG((3, "about to call nc_get_vars_longlong"));
                 ierr = nc_get_vars_longlong(file->fh, varid, (size_t *)start, (size_t *)count,
-                                            (ptrdiff_t *)fake_stride, buf);
+                                            (ptrdiff_t *)fake_stride, rbuf);
                 break;
             case NC_UINT64:
                 ierr = nc_get_vars_ulonglong(file->fh, varid, (size_t *)start, (size_t *)count,
-                                             (ptrdiff_t *)fake_stride, buf);
+                                             (ptrdiff_t *)fake_stride, rbuf);
                 break;
                 /* case NC_STRING: */
                 /*      ierr = nc_get_vars_string(file->fh, varid, (size_t *)start, (size_t *)count, */
@@ -747,10 +1064,15 @@ PIOc_get_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
                 /*      break; */
 #endif /* _NETCDF4 */
             default:
-                return pio_err(ios, file, PIO_EBADTYPE, __FILE__, __LINE__);
+                ierr = pio_err(ios, file, PIO_EBADTYPE, __FILE__, __LINE__);
             }
         }
 
+
+        /* The data of a subfiled file are in all its subfiles. */
+        if (file->num_subfiles)
+            ierr = merge_subfiles(file, varid, start, count, fake_stride, num_elem, typelen,
+                                  ierr, rbuf);
     }
 
     PLOG((2, "howdy ndims %d", ndims));
@@ -764,17 +1086,53 @@ PIOc_get_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
         free(fake_stride);
 
     /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
+    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)) || ierr)
+    {
+        if (rbuf != buf)
+            free(rbuf);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
         return check_netcdf(file, ierr, __FILE__, __LINE__);
+    }
 
     /* Send the data. */
-    PLOG((2, "PIOc_get_vars_tc bcasting data num_elem = %d typelen = %d ios->ioroot = %d", num_elem,
-          typelen, ios->ioroot));
-    if ((mpierr = MPI_Bcast(buf, num_elem * typelen, MPI_BYTE, ios->ioroot, ios->my_comm)))
+    PLOG((2, "PIOc_get_vars_tc sending data num_elem = %d typelen = %d ios->ioroot = %d "
+          "read_delivery = %d", num_elem, typelen, ios->ioroot, file->read_delivery));
+    if (file->read_delivery == PIO_READ_ROOT)
+    {
+        /* Only the root task gets the data. */
+        if (ios->ioroot != file->read_root)
+        {
+            if (ios->iomaster == MPI_ROOT)
+                mpierr = MPI_Send(rbuf, num_elem * typelen, MPI_BYTE, file->read_root, 0,
+                                  ios->my_comm);
+            else if (receiver)
+                mpierr = MPI_Recv(buf, num_elem * typelen, MPI_BYTE, ios->ioroot, 0,
+                                  ios->my_comm, MPI_STATUS_IGNORE);
+        }
+    }
+    else if (file->read_delivery == PIO_READ_NODE)
+    {
+        MPI_Win win = find_node_buf(ios, buf)->win;
+
+        /* The first task of each node gets the data, into the buffer
+         * shared by the node. */
+        if (ios->read_leader_comm != MPI_COMM_NULL)
+            mpierr = MPI_Bcast(rbuf, num_elem * typelen, MPI_BYTE, 0, ios->read_leader_comm);
+        if (!mpierr)
+            mpierr = MPI_Win_sync(win);
+        if (!mpierr)
+            mpierr = MPI_Barrier(ios->read_node_comm);
+        if (!mpierr)
+            mpierr = MPI_Win_sync(win);
+    }
+    else
+        mpierr = MPI_Bcast(buf, num_elem * typelen, MPI_BYTE, ios->ioroot, ios->my_comm);
+    if (rbuf != buf)
+        free(rbuf);
+    if (mpierr)
         return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    PLOG((2, "PIOc_get_vars_tc bcasting data complete"));
+    PLOG((2, "PIOc_get_vars_tc sending data complete"));
 
     return PIO_NOERR;
 }
@@ -806,7 +1164,7 @@ PIOc_get_var1_tc(int ncid, int varid, const PIO_Offset *index, nc_type xtype,
     int ierr;    /* Return code from function calls. */
 
     /* Find the info about this file. We need this for error handling. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -849,7 +1207,7 @@ PIOc_get_var_tc(int ncid, int varid, nc_type xtype, void *buf)
           xtype));
 
     /* Find the info about this file. We need this for error handling. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -961,7 +1319,7 @@ PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
           start_present, count_present, stride_present, xtype));
 
     /* Get file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1009,44 +1367,46 @@ PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
         if (!ios->ioproc)
         {
             int msg = PIO_MSG_PUT_VARS;
+            pio_msg_args args;
 
             if (ios->compmaster == MPI_ROOT)
                 mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
 
-            /* Send the function parameters and associated informaiton
-             * to the msg handler. */
+            /* Send the function parameters and associated informaiton,
+             * and the data, to the msg handler in one message. */
+            pio_msg_args_init(&args, ios);
             if (!mpierr)
-                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &ncid, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &varid, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&ndims, 1, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &ndims, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&start_present, 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &start_present, 1, MPI_CHAR);
             if (!mpierr && start_present)
-                mpierr = MPI_Bcast((PIO_Offset *)start, ndims, MPI_OFFSET, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, start, ndims, MPI_OFFSET);
             if (!mpierr)
-                mpierr = MPI_Bcast(&count_present, 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &count_present, 1, MPI_CHAR);
             if (!mpierr && count_present)
-                mpierr = MPI_Bcast((PIO_Offset *)count, ndims, MPI_OFFSET, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, count, ndims, MPI_OFFSET);
             if (!mpierr)
-                mpierr = MPI_Bcast(&stride_present, 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &stride_present, 1, MPI_CHAR);
             if (!mpierr && stride_present)
-                mpierr = MPI_Bcast((PIO_Offset *)stride, ndims, MPI_OFFSET, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, stride, ndims, MPI_OFFSET);
             if (!mpierr)
-                mpierr = MPI_Bcast(&xtype, 1, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &xtype, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&num_elem, 1, MPI_OFFSET, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &num_elem, 1, MPI_OFFSET);
             if (!mpierr)
-                mpierr = MPI_Bcast(&typelen, 1, MPI_OFFSET, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &typelen, 1, MPI_OFFSET);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, buf, num_elem * typelen, MPI_BYTE);
+            if (!mpierr)
+                mpierr = pio_msg_args_send(ios, &args);
+            pio_msg_args_free(&args);
             PLOG((2, "PIOc_put_vars_tc ncid = %d varid = %d ndims = %d start_present = %d "
                   "count_present = %d stride_present = %d xtype = %d num_elem = %d", ncid, varid,
                   ndims, start_present, count_present, stride_present, xtype, num_elem));
-
-            /* Send the data. */
-            if (!mpierr)
-                mpierr = MPI_Bcast((void *)buf, num_elem * typelen, MPI_BYTE, ios->compmaster,
-                                   ios->intercomm);
         }
 
         /* Handle MPI errors. */
@@ -1088,69 +1448,68 @@ PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
             /* Scalars have to be handled differently. */
             if (ndims == 0)
             {
-                /* This is a scalar var. */
-                PLOG((2, "pnetcdf writing scalar with ncmpi_put_vars_*() file->fh = %d varid = %d",
+                /* This is a scalar var. The IO master queues the
+                 * write with the other writes of the file, instead of
+                 * writing it in independent mode. */
+                int request = NC_REQ_NULL;
+
+                PLOG((2, "pnetcdf writing scalar with ncmpi_bput_var_*() file->fh = %d varid = %d",
                       file->fh, varid));
                 pioassert(!start && !count && !stride, "expected NULLs", __FILE__, __LINE__);
 
-                /* Turn on independent access for pnetcdf file. */
-                if ((ierr = ncmpi_begin_indep_data(file->fh)))
+                /* Make room for it in the attached buffer. */
+                if ((ierr = flush_output_buffer(file, false, typelen)))
                     return pio_err(ios, file, ierr, __FILE__, __LINE__);
 
-                /* Only the IO master does the IO, so we are not really
-                 * getting parallel IO here. */
                 if (ios->iomaster == MPI_ROOT)
                 {
                     switch(xtype)
                     {
                     case NC_BYTE:
-                        ierr = ncmpi_put_vars_schar(file->fh, varid, start, count, stride, buf);
+                        ierr = ncmpi_bput_var_schar(file->fh, varid, buf, &request);
                         break;
                     case NC_CHAR:
-                        ierr = ncmpi_put_vars_text(file->fh, varid, start, count, stride, buf);
+                        ierr = ncmpi_bput_var_text(file->fh, varid, buf, &request);
                         break;
                     case NC_SHORT:
-                        ierr = ncmpi_put_vars_short(file->fh, varid, start, count, stride, buf);
+                        ierr = ncmpi_bput_var_short(file->fh, varid, buf, &request);
                         break;
                     case NC_INT:
-                        ierr = ncmpi_put_vars_int(file->fh, varid, start, count, stride, buf);
+                        ierr = ncmpi_bput_var_int(file->fh, varid, buf, &request);
                         break;
                     case PIO_LONG_INTERNAL:
-                        ierr = ncmpi_put_vars_long(file->fh, varid, start, count, stride, buf);
+                        ierr = ncmpi_bput_var_long(file->fh, varid, buf, &request);
                         break;
                     case NC_FLOAT:
-                        ierr = ncmpi_put_vars_float(file->fh, varid, start, count, stride, buf);
+                        ierr = ncmpi_bput_var_float(file->fh, varid, buf, &request);
                         break;
                     case NC_DOUBLE:
-                        ierr = ncmpi_put_vars_double(file->fh, varid, start, count, stride, buf);
+                        ierr = ncmpi_bput_var_double(file->fh, varid, buf, &request);
                         break;
                     default:
                         return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
                     }
                 }
 
-                /* Turn off independent access for pnetcdf file. */
-                if ((ierr = ncmpi_end_indep_data(file->fh)))
-                    return pio_err(ios, file, ierr, __FILE__, __LINE__);
+                /* Every IO task queues a request, so they agree on
+                 * the queue. */
+                if (!ierr)
+                    ierr = pio_queue_put_request(file, varid, -1, request, typelen, 0);
+                file->var_puts_pending = true;
             }
             else
             {
                 /* This is not a scalar var. */
                 var_desc_t *vdesc;
-                int *request;
+                int request[1] = {NC_REQ_NULL};
 
                 PLOG((2, "PIOc_put_vars_tc calling pnetcdf function"));
                 flush_output_buffer(file, false, num_elem*typelen);
 
                 /*vdesc = &file->varlist[varid];*/
-                if ((ierr = get_var_desc(varid, &file->varlist, &vdesc)))
+                if ((ierr = get_file_var_desc(file, varid, &vdesc)))
                     return pio_err(ios, file, ierr, __FILE__, __LINE__);
-                if (vdesc->nreqs % PIO_REQUEST_ALLOC_CHUNK == 0)
-                    if (!(vdesc->request = realloc(vdesc->request,
-                                                   sizeof(int) * (vdesc->nreqs + PIO_REQUEST_ALLOC_CHUNK))))
-                        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-                request = vdesc->request + vdesc->nreqs;
-                PLOG((2, "PIOc_put_vars_tc request = %d size = %d", vdesc->request, num_elem*typelen));
+                PLOG((2, "PIOc_put_vars_tc size = %d", num_elem*typelen));
 
                 switch(xtype)
                 {
@@ -1180,8 +1539,12 @@ PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
                 }
                 PLOG((2, "PIOc_put_vars_tc io_rank 0 done with pnetcdf call, ierr=%d", ierr));
 
-
-                vdesc->nreqs++;
+                /* Queue the request with the other writes of the file. */
+                if (!ierr)
+                    ierr = pio_queue_put_request(file, varid,
+                                                 vdesc->rec_var && start ? start[0] : -1,
+                                                 request[0], num_elem * typelen, 0);
+                file->var_puts_pending = true;
 //                flush_output_buffer(file, ierr == PIO_EINSUFFBUF, 0);
 //                PLOG((2, "PIOc_put_vars_tc flushed output buffer"));
 
@@ -1262,6 +1625,10 @@ PIOc_put_vars_tc(int ncid, int varid, const PIO_Offset *start, const PIO_Offset
         if (ndims && !stride_present)
             free(fake_stride);
 
+        /* Each subfile of a subfiled file is written by its own IO
+         * task. */
+        if (file->num_subfiles)
+            ierr = pio_subfile_err(ios, ierr);
     }
 
     /* Broadcast and check the return code. */
@@ -1313,7 +1680,7 @@ PIOc_put_var1_tc(int ncid, int varid, const PIO_Offset *index, nc_type xtype,
     int ierr;    /* Return code from function calls. */
 
     /* Find the info about this file. We need this for error handling. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1369,7 +1736,7 @@ PIOc_put_var_tc(int ncid, int varid, nc_type xtype, const void *op)
           varid, xtype));
 
     /* Find the info about this file. We need this for error handling. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1461,7 +1828,7 @@ PIOc_get_vard_tc(int ncid, int varid, int decompid, const PIO_Offset recnum,
           "xtype %d", ncid, varid, decompid, recnum, xtype));
 
     /* Get file info. */
-    if ((ret = pio_get_file(ncid, &file)))
+    if ((ret = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1470,7 +1837,7 @@ PIOc_get_vard_tc(int ncid, int varid, int decompid, const PIO_Offset recnum,
         return ret;
 
     /* Get var info. */
-    if ((ret = get_var_desc(varid, &file->varlist, &vdesc)))
+    if ((ret = get_file_var_desc(file, varid, &vdesc)))
         return pio_err(ios, file, ret, __FILE__, __LINE__);
     PLOG((2, "vdesc->pio_type %d", vdesc->pio_type));
 
@@ -1514,7 +1881,7 @@ PIOc_put_vard_tc(int ncid, int varid, int decompid, const PIO_Offset recnum,
     int ret;
 
     /* Get file info. */
-    if ((ret = pio_get_file(ncid, &file)))
+    if ((ret = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1527,7 +1894,7 @@ PIOc_put_vard_tc(int ncid, int varid, int decompid, const PIO_Offset recnum,
         return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
 
     /* Get var info. */
-    if ((ret = get_var_desc(varid, &file->varlist, &vdesc)))
+    if ((ret = get_file_var_desc(file, varid, &vdesc)))
         return pio_err(ios, file, ret, __FILE__, __LINE__);
 
     /* Disallow type conversion for now. */
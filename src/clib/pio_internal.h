@@ -14,10 +14,13 @@
 #include <pio.h>
 #include <pio_error.h>
 #include <limits.h>
+#include <stdint.h>
 #include <math.h>
 #include <netcdf.h>
+#include <netcdf_meta.h>
 #ifdef _NETCDF4
 #include <netcdf_par.h>
+#include <netcdf_filter.h>
 #endif
 #ifdef _PNETCDF
 #include <pnetcdf.h>
@@ -73,10 +76,32 @@
 
 #if PIO_ENABLE_LOGGING
 void pio_log(int severity, const char *fmt, ...);
-#define PLOG(e) pio_log e
+
+/** The log level of each subsystem, see PIOc_set_log_level_subsys(). */
+extern int pio_log_levels[PIO_LOG_NUM_SUBSYS];
+
+/** The subsystem of the log messages of a file. A file may define it
+ * before including this header to have its own log level. */
+#ifndef PIO_LOG_SUBSYS
+#define PIO_LOG_SUBSYS PIO_LOG_GENERAL
+#endif
+
+/** The severity of the arguments of a PLOG() call. */
+#define PIO_LOG_SEVERITY(severity, ...) (severity)
+
+/** True if messages of this severity are logged in this file. */
+#define PLOG_ON(severity) ((severity) <= pio_log_levels[PIO_LOG_SUBSYS])
+
+/** Logging macro for debugging. The arguments are only evaluated if
+ * the message is logged. */
+#define PLOG(e) do {                            \
+        if (PLOG_ON(PIO_LOG_SEVERITY e))        \
+            pio_log e;                          \
+    } while (0)
 #else
 /** Logging macro for debugging. */
 #define PLOG(e)
+#define PLOG_ON(severity) 0
 #endif /* PIO_ENABLE_LOGGING */
 
 /** Find maximum. */
@@ -97,6 +122,128 @@ void pio_log(int severity, const char *fmt, ...);
 /** Request allocation size. */
 #define PIO_REQUEST_ALLOC_CHUNK 16
 
+/** Most bytes of the pnetcdf write requests waited for together,
+ * since ROMIO can't write more than INT_MAX bytes in one call. */
+#define PIO_MAX_WAIT_BYTES INT_MAX
+
+/** The bytes of staged darray data (see PIOc_set_stage_dir()) posted
+ * to pnetcdf before each wait when the stage log of a file is
+ * drained. */
+#define PIO_STAGE_DRAIN_BYTES 67108864
+
+/** The first value in the checkpoint files of a file ("PIOCKPT1"),
+ * see PIOc_set_checkpoint(). */
+#define PIO_CKPT_MAGIC 0x50494f434b505431LL
+
+/** The global attribute that marks a file with checkpoint files, and
+ * holds their number, see PIOc_set_checkpoint(). */
+#define PIO_CKPT_ATT "PIO_checkpoint_files"
+
+/** Initial number of arrays reserved in a write multi buffer. */
+#define PIO_WMB_ALLOC_CHUNK 16
+
+/** Smallest pnetcdf buffer size chosen from the node memory, see
+ * PIOc_set_buffer_size_auto(). */
+#define PIO_AUTO_BUFFER_MIN 1048576
+
+/** Number of darray writes between the checks of the pnetcdf buffer
+ * usage of all IO tasks, see check_output_buffer(). */
+#define PIO_FLUSH_CHECK_INTERVAL 8
+
+/** Relative change of the write rate of full flushes that counts as
+ * better or worse, see PIOc_set_adaptive_aggregation(). */
+#define PIO_AGG_TOLERANCE 0.1
+
+/** Bytes each computation task sends to its IO task, and each IO
+ * task writes to the scratch file, in PIOc_probe_iosystem(). */
+#define PIO_PROBE_NET_BYTES (1 << 20)
+#define PIO_PROBE_FS_BYTES (4 << 20)
+
+/** Number of times the network exchange of PIOc_probe_iosystem() is
+ * timed. The fastest is kept. */
+#define PIO_PROBE_NTRIALS 3
+
+/** Size of the first part of the packed arguments of an async
+ * message, which is sent with one broadcast. Longer messages are
+ * sent with a second one, see pio_msg_args_send(). */
+#define PIO_MSG_ARGS_SIZE 1024
+
+/** MPI tag of the second part of long packed async messages. (The
+ * messages themselves are sent with tag 1.) */
+#define PIO_MSG_ARGS_TAG 2
+
+/** Number of values (h_minfree, v_align, v_minfree, r_align) of
+ * PIOc_enddef_align(). */
+#define PIO_ENDDEF_NALIGN 4
+
+/** Header space reserved by default by PIOc_enddef_align() for each
+ * attribute of the file. */
+#define PIO_HEADER_ATT_BYTES 128
+
+/** Default longest sleep, in microseconds, of async IO tasks waiting
+ * for messages with PIO_ASYNC_WAIT_BACKOFF. */
+#define PIO_ASYNC_MAX_SLEEP 1000
+
+/** MPI tag of the messages of the sparse exchange in
+ * compute_counts(). */
+#define PIO_NBX_TAG 3
+
+/** First MPI tag of the MPI_Comm_create_group() calls of
+ * PIOc_init_async(), which uses two more for each component. */
+#define PIO_ASYNC_COMM_TAG 16
+
+/** Minimum average length of the runs of consecutive indices in
+ * iodesc->remap for pio_sorted_copy() to copy whole runs. */
+#define PIO_REMAP_MIN_RUNLEN 8
+
+/** Largest number of sorted runs in a compmap for PIOc_InitDecomp()
+ * to sort it by merging the runs, rather than with a radix sort. */
+#define PIO_SORT_MAX_MERGE_RUNS 16
+
+/** Global attribute of the index file of a subfiled file with the
+ * number of subfiles, see PIOc_set_subfiles(). */
+#define PIO_SUBFILES_ATT "pio_subfiles"
+
+/** Global attribute of the index file of a subfiled file with the
+ * number of IO tasks that wrote it. */
+#define PIO_SUBFILE_IOTASKS_ATT "pio_subfile_iotasks"
+
+/** When built with PIO_THREADS, the global tables of PIO, and the
+ * memory counts, are protected by read/write locks, so that threads
+ * can use different IO systems at the same time. Each IO system is
+ * only used by one thread at a time, with its files and its
+ * decompositions, since their messages travel on the communicators
+ * of the IO system, and the decompositions keep state between calls
+ * without a lock: the persistent requests of the rearranger
+ * (comp2io_persist), the vard datatypes (vard_type) and the fill
+ * buffers of the vars they write (fillbuf). Creating, opening and
+ * closing files and decompositions allocates IDs shared by all IO
+ * systems, so it is done by one thread at a time. */
+#if PIO_THREADS
+#include <pthread.h>
+#define pio_rdlock(l) pthread_rwlock_rdlock(l)
+#define pio_wrlock(l) pthread_rwlock_wrlock(l)
+#define pio_unlock(l) pthread_rwlock_unlock(l)
+#else
+#define pio_rdlock(l)
+#define pio_wrlock(l)
+#define pio_unlock(l)
+#endif
+
+/** The default of PIOc_set_vard() for new and opened pnetcdf files,
+ * from the PIO_USE_PNETCDF_VARD build option. */
+#if USE_VARD
+#define PIO_VARD_DEFAULT true
+#else
+#define PIO_VARD_DEFAULT false
+#endif
+
+/** True on the IO tasks which get the data of other IO tasks, to
+ * write or read them with a serial iotype: IO task 0, or, for
+ * subfiled files, the first IO task of each subfile. */
+#define pio_serial_root(ios, file) \
+    ((ios)->io_rank == 0 || ((file)->num_subfiles && (file)->do_io))
+
 /** This is needed to handle _long() functions. It may not be used as
  * a data type when creating attributes or varaibles, it is only used
  * internally. */
@@ -127,12 +274,39 @@ void pio_log(int severity, const char *fmt, ...);
 #define MPE_MAX_MSG_LEN 32
 #endif /* USE_MPE */
 
+/* These are the timers of the hot paths of the library, see
+ * pio_start_timer(). Their names are in pio_timer_name. There are
+ * PIO_NUM_TIMERS (in pio.h) of them. */
+#define PIO_TIMER_WRITE_MULTI_PAR 0
+#define PIO_TIMER_WRITE_MULTI_SERIAL 1
+#define PIO_TIMER_READ_NC 2
+#define PIO_TIMER_READ_NC_SERIAL 3
+#define PIO_TIMER_COMP2IO 4
+#define PIO_TIMER_IO2COMP 5
+#define PIO_TIMER_BOX_CREATE 6
+#define PIO_TIMER_BOX_CREATE_HOLES 7
+#define PIO_TIMER_SWAPM 8
+#define PIO_TIMER_WAIT_ALL 9
+#define PIO_TIMER_WRITE_DARRAY 10
+#define PIO_TIMER_WRITE_DARRAY_MULTI 11
+#define PIO_TIMER_READ_DARRAY 12
+#define PIO_TIMER_SYNC 13
+#define PIO_TIMER_CLOSEFILE 14
+
+/** The most events kept in the trace of each task, see
+ * PIOc_set_trace(). Later events are dropped. */
+#define PIO_MAX_TRACE_EVENTS (1 << 20)
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
     extern PIO_Offset pio_pnetcdf_buffer_size_limit;
 
+    /* Most bytes of the write multi buffers of a computation task,
+     * see PIOc_set_compute_buffer_limit(). */
+    extern PIO_Offset pio_cnbuffer_limit;
+
     /** Used to sort map points in the subset rearranger. */
     typedef struct mapsort
     {
@@ -149,6 +323,71 @@ extern "C" {
         bool isend; /**< is end? */
     } pio_swapm_defaults;
 
+    /** The packed arguments of an async message. */
+    typedef struct pio_msg_args
+    {
+        char *buf; /**< packed arguments, points to fixed or to malloced memory */
+        int size;  /**< size of buf */
+        int pos;   /**< position in buf of the next argument */
+        MPI_Comm comm; /**< communicator used for packing */
+        bool skip; /**< true on computation tasks whose arguments are not sent */
+        char fixed[PIO_MSG_ARGS_SIZE]; /**< memory for short messages */
+    } pio_msg_args;
+
+    /** A dimension of the header of a file. */
+    typedef struct pio_dim_meta
+    {
+        char name[PIO_MAX_NAME + 1]; /**< name of the dim */
+        PIO_Offset len; /**< length of the dim, when the file was opened */
+        int unlim; /**< non-zero for an unlimited dim */
+    } pio_dim_meta;
+
+    /** A var of the header of a file. */
+    typedef struct pio_var_meta
+    {
+        int rec_var; /**< non-zero for a record var */
+        int pio_type; /**< type of the var */
+        int pio_type_size; /**< size of the type */
+        int mpi_type_size; /**< size of the MPI type of the type */
+        int ndims; /**< number of dims */
+        int natts; /**< number of atts */
+    } pio_var_meta;
+
+    /**
+     * The header of a file, read on the IO root when the file is
+     * opened and broadcast to all tasks in one message. It is one
+     * block of memory, the arrays follow this struct.
+     */
+    typedef struct pio_file_meta
+    {
+        int nvars; /**< number of vars */
+        int ndims; /**< number of dims */
+        int ngatts; /**< number of global atts */
+        int ndimids; /**< sum of the ndims of the vars */
+        int names; /**< non-zero if the var names are included */
+        size_t size; /**< size of the block */
+        pio_dim_meta *dims; /**< the dims */
+        pio_var_meta *vars; /**< the vars */
+        int *dimids; /**< the dimids of all vars, one var after another */
+        char (*var_names)[PIO_MAX_NAME + 1]; /**< the var names, or NULL */
+    } pio_file_meta;
+
+    /** Add to a counter of the I/O statistics of a file and of a
+     * decomposition. Either may be NULL. */
+#define pio_stats_add(file, iodesc, field, value) do {      \
+        if (file)                                           \
+            (file)->stats.field += (value);                 \
+        if (iodesc)                                         \
+            (iodesc)->stats.field += (value);               \
+    } while (0)
+
+    /* Add the statistics of a darray write or read on an IO task. */
+    void pio_stats_io(file_desc_t *file, io_desc_t *iodesc, bool write, bool fill,
+                      int nvars, PIO_Offset llen, int nregions, double start);
+
+    /* Print the I/O statistics of a file. */
+    int pio_report_file_stats(file_desc_t *file);
+
     /* Handle an error in the PIO library. */
     int pio_err(iosystem_desc_t *ios, file_desc_t *file, int err_num, const char *fname,
                 int line);
@@ -170,10 +409,65 @@ extern "C" {
     int check_netcdf2(iosystem_desc_t *ios, file_desc_t *file, int status,
                       const char *fname, int line);
 
+    /* Check the return code of a netCDF call that changes the
+     * metadata, which may be deferred. */
+    int check_netcdf_deferred(file_desc_t *file, int status, const char *fname, int line);
+
+    /* Check the return code of a netCDF call, with the deferred
+     * errors of the file. */
+    int check_netcdf_sync(file_desc_t *file, int status, const char *fname, int line);
+
+    /* Get the same error code on all IO tasks of a subfiled file. */
+    int pio_subfile_err(iosystem_desc_t *ios, int ierr);
+
+    /* Get the MPI Info object to create or open a parallel file with. */
+    int get_file_info(iosystem_desc_t *ios, const char *filename, int iotype, int create,
+                      MPI_Info *infop);
+
+    /* Turn on the compression of the file for a new variable. */
+    int pio_def_var_compression(file_desc_t *file, int varid);
+
+    /* Size the chunk cache of a var from a decomposition. */
+    int pio_auto_chunk_cache(file_desc_t *file, io_desc_t *iodesc, int varid);
+
+    /* Start packing the arguments of an async message. */
+    void pio_msg_args_init(pio_msg_args *args, iosystem_desc_t *ios);
+
+    /* Pack an argument of an async message. */
+    int pio_msg_args_pack(pio_msg_args *args, const void *data, int count,
+                          MPI_Datatype type);
+
+    /* Send the packed arguments from the computation tasks. */
+    int pio_msg_args_send(iosystem_desc_t *ios, pio_msg_args *args);
+
+    /* Receive the packed arguments on the IO tasks. */
+    int pio_msg_args_recv(iosystem_desc_t *ios, pio_msg_args *args);
+
+    /* Unpack an argument of an async message. */
+    int pio_msg_args_unpack(pio_msg_args *args, void *data, int count,
+                            MPI_Datatype type);
+
+    /* Free the packed arguments. */
+    void pio_msg_args_free(pio_msg_args *args);
+
+    /* Write an attribute on the IO tasks. */
+    int put_att_io(file_desc_t *file, int varid, const char *name, nc_type atttype,
+                   PIO_Offset len, nc_type memtype, const void *op);
+
+    /* Send the attributes queued on the computation tasks. */
+    int flush_deferred_atts(file_desc_t *file);
+
     /* For async cases, this runs on IO tasks and listens for messages. */
     int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
                          MPI_Comm io_comm);
 
+    /* Find the node of each task in a communicator. */
+    int pio_node_map(MPI_Comm comm, int *nnodes, int *node_of);
+
+    /* Choose the IO tasks, spread over the nodes of a communicator. */
+    int pio_topo_ioranks(MPI_Comm comm, int num_iotasks, int iotasks_per_node,
+                         int *num_iotasksp, int **ioranksp);
+
     /* List operations for iosystem list. */
     int pio_add_to_iosystem_list(iosystem_desc_t *ios);
     int pio_delete_iosystem_from_list(int piosysid);
@@ -183,21 +477,35 @@ extern "C" {
     int  pio_add_to_iodesc_list(io_desc_t *iodesc);
     io_desc_t *pio_get_iodesc_from_id(int ioid);
     int pio_delete_iodesc_from_list(int ioid);
+    io_desc_t *pio_find_iodesc_by_hash(int iosysid, unsigned long long map_hash);
+    PIO_Offset pio_max_iobuf_bytes(int iosysid);
     int pio_num_iosystem(int *niosysid);
 
+    /* Find an IO system whose communicators can be shared. */
+    iosystem_desc_t *pio_find_comm_iosystem(MPI_Comm comp_comm, int num_iotasks,
+                                            const int *ioranks);
+
     /* Allocate and initialize storage for decomposition information. */
     int malloc_iodesc(iosystem_desc_t *ios, int piotype, int ndims, io_desc_t **iodesc);
 
     /* List operations for file_desc_t list. */
     int pio_get_file(int ncid, file_desc_t **filep);
+    int pio_get_file_open(int ncid, file_desc_t **filep);
+    int pio_set_lazy_frame(int ncid, int varid, int frame, bool advance, bool *done);
     int pio_delete_file_from_list(int ncid);
     void pio_add_to_file_list(file_desc_t *file);
+    void pio_replace_file(file_desc_t *old, file_desc_t *file);
+    bool pio_forget_lazy_file(int ncid);
+
+    /* Open a file that was opened lazily. */
+    int pio_open_lazy_file(file_desc_t *lazy, file_desc_t **filep);
 
     /* List operations for var_desc_t list. */
     int add_to_varlist(int varid, int rec_var, int pio_type, int pio_type_size,
                        MPI_Datatype mpi_type, int mpi_type_size, int ndim,
                        var_desc_t **varlist);
     int get_var_desc(int varid, var_desc_t **varlist, var_desc_t **var_desc);
+    int get_file_var_desc(file_desc_t *file, int varid, var_desc_t **var_desc);
     int delete_var_desc(int varid, var_desc_t **varlist);
 
     /* Create a file. */
@@ -225,6 +533,21 @@ extern "C" {
     int CalcStartandCount(int pio_type, int ndims, const int *gdims, int num_io_procs,
                           int myiorank, PIO_Offset *start, PIO_Offset *count, int *num_aiotasks);
 
+    /* Compute start and count values for each io task, using all io tasks. */
+    int CalcStartandCount_bytes(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                                int myiorank, PIO_Offset *start, PIO_Offset *count,
+                                int *num_aiotasks);
+
+    /* Compute start and count values for each io task, in slabs of the slowest dimension. */
+    int CalcStartandCount_slab(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                               int myiorank, PIO_Offset *start, PIO_Offset *count,
+                               int *num_aiotasks);
+
+    /* Compute start and count values for each io task, aligned to file system stripes. */
+    int CalcStartandCount_stripe(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                                 int myiorank, PIO_Offset stripe_unit, int stripe_factor,
+                                 PIO_Offset *start, PIO_Offset *count, int *num_aiotasks);
+
     /* Completes the mapping for the box rearranger. */
     int compute_counts(iosystem_desc_t *ios, io_desc_t *iodesc, const int *dest_ioproc,
                        const PIO_Offset *dest_ioindex);
@@ -233,9 +556,32 @@ extern "C" {
     int default_subset_partition(iosystem_desc_t *ios, io_desc_t *iodesc);
 
     /* Like MPI_Alltoallw(), but with flow control. */
-    int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
-                  void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
-                  MPI_Comm comm, rearr_comm_fc_opt_t *fc);
+    int pio_swapm(iosystem_desc_t *ios, void *sendbuf, int *sendcounts, int *sdispls,
+                  MPI_Datatype *sendtypes, void *recvbuf, int *recvcounts, int *rdispls,
+                  MPI_Datatype *recvtypes, MPI_Comm comm, rearr_comm_fc_opt_t *fc);
+
+    /* pio_swapm() with arrays indexed by peer. */
+    int pio_swapm_peers(iosystem_desc_t *ios, void *sendbuf, int *sendcounts, int *sdispls,
+                        MPI_Datatype *sendtypes, void *recvbuf, int *recvcounts, int *rdispls,
+                        MPI_Datatype *recvtypes, int npeers, const int *peers, MPI_Comm comm,
+                        rearr_comm_fc_opt_t *fc);
+
+    /* Like MPI_Alltoallw(), but non-blocking. */
+    int pio_iswapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+                   void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+                   int npeers, const int *peers, MPI_Comm comm, int maxreqs,
+                   MPI_Request *reqs, int *nreqs);
+
+    /* pio_swapm() over a neighborhood communicator. */
+    int pio_neighbor_swapm(void *sendbuf, int *sendcounts, MPI_Datatype *sendtypes,
+                           void *recvbuf, int *recvcounts, MPI_Datatype *recvtypes,
+                           int nneighbors, MPI_Comm comm);
+
+    /* Create persistent requests for a pio_swapm() exchange. */
+    int pio_swapm_init(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+                       void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+                       int npeers, const int *peers, MPI_Comm comm, int maxreqs,
+                       MPI_Request *reqs, int *nreqs);
 
     /* Return the greatest common devisor of array ain as int_64. */
     long long lgcd_array(int nain, long long* ain);
@@ -250,6 +596,11 @@ extern "C" {
     /* Convert a global coordinate value into a local array index. */
     PIO_Offset coord_to_lindex(int ndims, const PIO_Offset *lcoord, const PIO_Offset *count);
 
+    /* Find the IO task and IO index of each map element for the box rearranger. */
+    int box_find_dest(int ndims, const int *gdimlen, int nio, const PIO_Offset *sc_info,
+                      int maplen, const PIO_Offset *compmap, int *dest_ioproc,
+                      PIO_Offset *dest_ioindex);
+
     /* Determine whether fill values are needed. */
     int determine_fill(iosystem_desc_t *ios, io_desc_t *iodesc, const int *gsize,
                        const PIO_Offset *compmap);
@@ -282,18 +633,74 @@ extern "C" {
     int box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap, const int *gsize,
                              int ndim, io_desc_t *iodesc);
 
+    /* Create a box rearranger that gathers the data of each node first. */
+    int node_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap,
+                              const int *gsize, int ndim, io_desc_t *iodesc);
+
     /* Move data from IO tasks to compute tasks. */
     int rearrange_io2comp(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf, void *rbuf);
+    int rearrange_io2comp_multi(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                                void *rbuf, int nvars);
+
+    /* Move data from IO tasks to compute tasks, directly into the
+     * caller's array. */
+    int rearrange_io2comp_nocopy(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                                 void *rbuf);
+
+    /* Find the peers of a decomposition in the rearranger. */
+    int define_rearr_peers(iosystem_desc_t *ios, io_desc_t *iodesc);
+
+    /* Free persistent rearranger requests. */
+    int free_rearr_persist(rearr_persist_t *pr);
+
+    /* Free the shared memory window of a decomposition. */
+    int free_shm(io_desc_t *iodesc);
+
+    /* Start moving data from IO tasks to compute tasks. */
+    int rearrange_io2comp_start(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                                void *rbuf, MPI_Request **reqsp, int *nreqs);
 
     /* Move data from compute tasks to IO tasks. */
     int rearrange_comp2io(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf, void *rbuf,
                           int nvars);
 
-    void performance_tune_rearranger(iosystem_desc_t *ios, io_desc_t *iodesc);
+    /* Move data from compute tasks to IO tasks, directly from the
+     * caller's arrays. */
+    int rearrange_comp2io_nocopy(iosystem_desc_t *ios, io_desc_t *iodesc, void **sbufs,
+                                 void *rbuf, int nvars);
+
+    /* Start moving data from compute tasks to IO tasks. */
+    int rearrange_comp2io_start(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                                void *rbuf, MPI_Request **reqsp, int *nreqs);
+
+    /* Time the rearranger options and keep the fastest. */
+    int performance_tune_rearranger(iosystem_desc_t *ios, io_desc_t *iodesc);
 
     /* Flush contents of multi-buffer to disk. */
     int flush_output_buffer(file_desc_t *file, bool force, PIO_Offset addsize);
 
+    /* Flush the pending writes of a file after a darray write, if needed. */
+    int check_output_buffer(file_desc_t *file, bool force);
+
+    /* Find the pnetcdf buffer size of a file being opened. */
+    int get_file_buffer_limit(iosystem_desc_t *ios, PIO_Offset *limit);
+
+    /* Count the IO tasks on the node of this task. */
+    int pio_count_node_iotasks(iosystem_desc_t *ios);
+
+    /* Checkpoint files of distributed arrays. */
+    int pio_ckpt_mark(file_desc_t *file);
+    int pio_ckpt_create(file_desc_t *file, const char *filename);
+    int pio_ckpt_open(file_desc_t *file, const char *filename);
+    int pio_ckpt_write(file_desc_t *file, io_desc_t *iodesc, int nvars, const int *varids,
+                       int fndims, const int *frame);
+    int pio_ckpt_read(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf);
+    void pio_ckpt_close(file_desc_t *file);
+
+    /* Add a pnetcdf write request to the queue of the file. */
+    int pio_queue_put_request(file_desc_t *file, int varid, int frame, int request,
+                              PIO_Offset bytes, int ioid);
+
     int compute_maxaggregate_bytes(iosystem_desc_t *ios, io_desc_t *iodesc);
 
     /* Compute the size that the IO tasks will need to hold the data. */
@@ -319,9 +726,21 @@ extern "C" {
 
     /* Create the derived MPI datatypes used for comp2io and io2comp
      * transfers. */
-    int create_mpi_datatypes(MPI_Datatype basetype, int msgcnt, const PIO_Offset *mindex,
+    int create_mpi_datatypes(MPI_Datatype basetype, int msgcnt, const int *mindex,
                              const int *mcount, int *mfrom, MPI_Datatype *mtype);
 
+    /* Release a datatype created by create_mpi_datatypes(). */
+    int free_mpi_datatype(MPI_Datatype *type);
+
+    /* Create the communicators used by PIO_READ_NODE. */
+    int get_read_comms(iosystem_desc_t *ios);
+
+    /* Find the node buffer that contains buf. */
+    pio_node_buf_t *find_node_buf(iosystem_desc_t *ios, const void *buf);
+
+    /* Free the node buffers and communicators of PIO_READ_NODE. */
+    int free_read_comms(iosystem_desc_t *ios);
+
     /* Used by subset rearranger to sort map. */
     int compare_offsets(const void *a, const void *b) ;
 
@@ -331,12 +750,31 @@ extern "C" {
     /* Flush PIO's data buffer. */
     int flush_buffer(int ncid, wmulti_buffer *wmb, bool flushtodisk);
 
+    /* Number of arrays a write multi buffer holds before a flush. */
+    int agg_max_arrays(iosystem_desc_t *ios, io_desc_t *iodesc);
+
+    /* Reserve memory for arrays in a write multi buffer. */
+    int reserve_multi_buffer(wmulti_buffer *wmb, io_desc_t *iodesc, int narrays,
+                             PIO_Offset arraylen, bool need_frame, file_desc_t *file);
+
+    /* Release the memory held by a write multi buffer. */
+    void free_multi_buffer(wmulti_buffer *wmb);
+
+    /* Write the contents of a buffer filled by PIOc_write_darray_nocopy(). */
+    int write_darray_nocopy_buffer(file_desc_t *file, wmulti_buffer *wmb, bool flushtodisk);
+
+    /* Complete all non-blocking darray writes and reads of a file. */
+    int wait_darray_requests(file_desc_t *file);
+
     /* Compute an element of start/count arrays. */
     void compute_one_dim(int gdim, int ioprocs, int rank, PIO_Offset *start,
                          PIO_Offset *count);
 
     /* Darray support functions. */
 
+    /* Make room in the attached pnetcdf buffer for a darray write. */
+    int reserve_bput_buffer(file_desc_t *file, io_desc_t *iodesc, int nvars);
+
     /* Write aggregated arrays to file using parallel I/O (netCDF-4 parallel/pnetcdf) */
     int write_darray_multi_par(file_desc_t *file, int nvars, int fndims, const int *vid,
                                io_desc_t *iodesc, int fill, const int *frame);
@@ -345,7 +783,8 @@ extern "C" {
     int write_darray_multi_serial(file_desc_t *file, int nvars, int fndims, const int *vid,
                                   io_desc_t *iodesc, int fill, const int *frame);
 
-    int pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf);
+    int pio_read_darray_nc(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf,
+                           int *getreq);
     int pio_read_darray_nc_serial(file_desc_t *file, io_desc_t *iodesc, int vid, void *iobuf);
     int find_var_fillvalue(file_desc_t *file, int varid, var_desc_t *vdesc);
 
@@ -380,7 +819,7 @@ extern "C" {
                               PIO_Offset *sizep);
 
     /* Handle end and re-defs. */
-    int pioc_change_def(int ncid, int is_enddef);
+    int pioc_change_def(int ncid, int is_enddef, const PIO_Offset *align);
 
     /* Initialize and finalize logging, use --enable-logging at configure. */
     int pio_init_logging(void);
@@ -395,7 +834,8 @@ extern "C" {
     /* Write a netCDF decomp file. */
     int pioc_write_nc_decomp_int(iosystem_desc_t *ios, const char *filename, int cmode, int ndims,
                                  int *global_dimlen, int num_tasks, int *task_maplen, int *map,
-                                 const char *title, const char *history, int fortran_order);
+                                 const char *title, const char *history, int fortran_order,
+                                 const char *report);
 
     /* Read a netCDF decomp file. */
     int pioc_read_nc_decomp_int(int iosysid, const char *filename, int *ndims, int **global_dimlen,
@@ -411,13 +851,48 @@ extern "C" {
     int PIOc_inq_att_eh(int ncid, int varid, const char *name, int eh,
                         nc_type *xtypep, PIO_Offset *lenp);
 
-    /* Start a timer. */
-    int pio_start_timer(const char *name);
+    /* Start and stop a timer. */
+    int pio_timer_start(iosystem_desc_t *ios, int timer);
+    int pio_timer_stop(iosystem_desc_t *ios, int timer);
+
+    /* Write the trace of the tasks of an IO system. */
+    int pio_write_trace(iosystem_desc_t *ios);
+
+    /* Allocate and free memory counted in a PIO_MEM_* category. Memory
+     * from these must only be freed with pio_free(). */
+    void *pio_malloc(int category, size_t size);
+    void *pio_calloc(int category, size_t nmemb, size_t size);
+    void *pio_realloc(int category, void *ptr, size_t size);
+    void pio_free(int category, void *ptr);
+
+    /* Allocate and free the darray buffers of the IO tasks, from the
+     * pool of the IO system. */
+    void *pio_iobuf_alloc(iosystem_desc_t *ios, size_t size);
+    void pio_iobuf_free(iosystem_desc_t *ios, void *buf);
+    void pio_iobuf_pool_free(iosystem_desc_t *ios);
+
+    /* Complete the result broadcasts of background syncs and closes
+     * on the IO tasks. */
+    int pio_bg_progress(iosystem_desc_t *ios, bool wait);
+
+    /* Drop the arrays of a file and/or decomposition from the read
+     * cache of the IO system. */
+    void pio_read_cache_clear(iosystem_desc_t *ios, const char *fname, int ioid);
+
+    /* Log the memory allocated by the library. */
+    void pio_log_mem_usage(void);
+
+    /** Start a timer of an IO system, if its timers are on. This
+     * costs only a test when they are off. */
+#define pio_start_timer(ios, timer)                                     \
+    ((ios) && (ios)->timing ? pio_timer_start(ios, timer) : PIO_NOERR)
 
-    /* Stop a timer. */
-    int pio_stop_timer(const char *name);
+    /** Stop a timer of an IO system, if its timers are on. */
+#define pio_stop_timer(ios, timer)                                      \
+    ((ios) && (ios)->timing ? pio_timer_stop(ios, timer) : PIO_NOERR)
 
-    bool check_compmap(iosystem_desc_t *ios, io_desc_t *iodesc,const PIO_Offset *compmap);
+    /* Find whether a decomposition map has repeated values. */
+    int check_compmap(iosystem_desc_t *ios, io_desc_t *iodesc, const PIO_Offset *compmap);
 
 
 #if defined(__cplusplus)
@@ -638,7 +1113,17 @@ enum PIO_MSG
     PIO_MSG_GET_ATT,
     PIO_MSG_PUT_ATT,
     PIO_MSG_INQ_TYPE,
-    PIO_MSG_INQ_UNLIMDIMS
+    PIO_MSG_INQ_UNLIMDIMS,
+    PIO_MSG_PUT_ATT_BATCH,
+    PIO_MSG_DEF_VAR_CHUNKING_DECOMP,
+    PIO_MSG_DEF_VAR_QUANTIZE,
+    PIO_MSG_SET_AUTO_CHUNK_CACHE,
+    PIO_MSG_SET_PAR_ACCESS,
+    PIO_MSG_ACCUMULATE_DARRAY,
+    PIO_MSG_WRITE_ACCUMULATED,
+    PIO_MSG_READDARRAYMULTI,
+    PIO_MSG_SYNC_BG,
+    PIO_MSG_CLOSE_FILE_BG
 };
 
 #endif /* __PIO_INTERNAL__ */
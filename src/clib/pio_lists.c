@@ -15,6 +15,19 @@ static iosystem_desc_t *pio_iosystem_list = NULL;
 static file_desc_t *pio_file_list = NULL;
 static file_desc_t *current_file = NULL;
 
+#if PIO_THREADS
+/** Lock of the lists of files, decompositions and IO systems. Lookups
+ * take it for reading, so threads only wait for each other when a
+ * list changes. The current_file and current_iodesc caches of the
+ * last lookup are not used, since every lookup would write them. */
+static pthread_rwlock_t lists_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Held while a lazily opened file is opened, or its frames are set,
+ * so only one thread opens it, and no thread uses the lazy
+ * file_desc_t after the open has freed it. */
+static pthread_mutex_t lazy_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 /**
  * Add a new entry to the global list of open files.
  *
@@ -26,17 +39,25 @@ pio_add_to_file_list(file_desc_t *file)
 {
     assert(file);
 
+    pio_wrlock(&lists_lock);
+
     /* Keep a global pointer to the current file. */
     current_file = file;
 
     /* Add file to list. */
     HASH_ADD_INT(pio_file_list, pio_ncid, file);
+
+    pio_unlock(&lists_lock);
 }
 
 /**
  * Given ncid, find the file_desc_t data for an open file. The ncid
  * used is the interally generated pio_ncid.
  *
+ * This is only a lookup, so it may be used by functions that are not
+ * collective. A file opened with PIOc_set_lazy_open() on is not
+ * opened; collective functions use pio_get_file_open() instead.
+ *
  * @param ncid the PIO assigned ncid of the open file.
  * @param cfile1 pointer to a pointer to a file_desc_t. The pointer
  * will get a copy of the pointer to the file info.
@@ -56,16 +77,24 @@ pio_get_file(int ncid, file_desc_t **cfile1)
         return PIO_EINVAL;
 
     /* Find the file pointer. */
+#if PIO_THREADS
+    pio_rdlock(&lists_lock);
+    HASH_FIND_INT(pio_file_list, &ncid, cfile);
+    pio_unlock(&lists_lock);
+#else
     if (current_file && current_file->pio_ncid == ncid)
         cfile = current_file;
     else
         HASH_FIND_INT(pio_file_list, &ncid, cfile);
+#endif
 
     /* If not found, return error. */
     if (!cfile)
         return PIO_EBADID;
 
+#if !PIO_THREADS
     current_file = cfile;
+#endif
 
     /* We depend on every file having a pointer to the iosystem. */
     if (!cfile->iosystem)
@@ -80,6 +109,157 @@ pio_get_file(int ncid, file_desc_t **cfile1)
     return PIO_NOERR;
 }
 
+/**
+ * Given ncid, find the file_desc_t data for an open file, opening it
+ * first if it was opened lazily (see PIOc_set_lazy_open()). Since the
+ * open is collective, this is only used by functions that must be
+ * called on all tasks of the IO system.
+ *
+ * @param ncid the PIO assigned ncid of the open file.
+ * @param cfile1 pointer to a pointer to a file_desc_t. The pointer
+ * will get a copy of the pointer to the file info.
+ *
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_get_file_open(int ncid, file_desc_t **cfile1)
+{
+    file_desc_t *cfile;
+    int ret;
+
+    if ((ret = pio_get_file(ncid, &cfile)))
+        return ret;
+
+    /* Open a lazily opened file on its first collective use. Another
+     * thread may be opening it, so look again under the lock. */
+    if (cfile->lazy)
+    {
+#if PIO_THREADS
+        pthread_mutex_lock(&lazy_lock);
+        if (!(ret = pio_get_file(ncid, &cfile)) && cfile->lazy)
+            ret = pio_open_lazy_file(cfile, &cfile);
+        pthread_mutex_unlock(&lazy_lock);
+#else
+        ret = pio_open_lazy_file(cfile, &cfile);
+#endif /* PIO_THREADS */
+        if (ret)
+            return ret;
+    }
+
+    *cfile1 = cfile;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set or advance the frame of a var of a file that was opened lazily
+ * and not used yet. The file has no var info until it is opened, so
+ * the frame is kept, and set on the var by pio_open_lazy_file(). The
+ * varid is checked then. This is not collective, like
+ * PIOc_setframe().
+ *
+ * @param ncid the PIO assigned ncid of the file.
+ * @param varid the varid of the var.
+ * @param frame the frame to set, ignored if advance is true.
+ * @param advance true to advance the frame by one.
+ * @param done pointer that gets true if the file was lazy and the
+ * frame was kept, false if the file is open.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_set_lazy_frame(int ncid, int varid, int frame, bool advance, bool *done)
+{
+    file_desc_t *cfile;
+    int ret;
+
+    *done = false;
+#if PIO_THREADS
+    pthread_mutex_lock(&lazy_lock);
+#endif
+    if (!(ret = pio_get_file(ncid, &cfile)) && cfile->lazy)
+    {
+        int f;
+
+        /* Find the var, or add it with the frame vars start with. */
+        for (f = 0; f < cfile->nlazy_frames; f++)
+            if (cfile->lazy_frames[2 * f] == varid)
+                break;
+        if (f == cfile->nlazy_frames)
+        {
+            int *frames;
+
+            if (!(frames = realloc(cfile->lazy_frames, 2 * (f + 1) * sizeof(int))))
+                ret = PIO_ENOMEM;
+            else
+            {
+                cfile->lazy_frames = frames;
+                cfile->lazy_frames[2 * f] = varid;
+                cfile->lazy_frames[2 * f + 1] = -1;
+                cfile->nlazy_frames++;
+            }
+        }
+        if (!ret)
+        {
+            cfile->lazy_frames[2 * f + 1] = advance ? cfile->lazy_frames[2 * f + 1] + 1 : frame;
+            *done = true;
+        }
+    }
+#if PIO_THREADS
+    pthread_mutex_unlock(&lazy_lock);
+#endif
+
+    return ret;
+}
+
+/**
+ * Put a file in the list in place of another, with the ncid of the
+ * other. The other file is taken out of the list, but not freed.
+ *
+ * @param old pointer to the file_desc_t struct to replace.
+ * @param file pointer to the file_desc_t struct that replaces it.
+ * @author Ed Hartnett
+ */
+void
+pio_replace_file(file_desc_t *old, file_desc_t *file)
+{
+    assert(old && file);
+
+    pio_wrlock(&lists_lock);
+    HASH_DEL(pio_file_list, old);
+    HASH_DEL(pio_file_list, file);
+    file->pio_ncid = old->pio_ncid;
+    HASH_ADD_INT(pio_file_list, pio_ncid, file);
+    current_file = file;
+    pio_unlock(&lists_lock);
+}
+
+/**
+ * Delete a lazily opened file from the list, if it has not been used
+ * yet. It was never opened, so there is nothing to close.
+ *
+ * @param ncid the PIO assigned ncid of the file.
+ * @returns true if the file was lazily opened and unused, and has
+ * been deleted, false otherwise.
+ * @author Ed Hartnett
+ */
+bool
+pio_forget_lazy_file(int ncid)
+{
+    file_desc_t *cfile = NULL;
+
+    pio_rdlock(&lists_lock);
+    HASH_FIND_INT(pio_file_list, &ncid, cfile);
+    pio_unlock(&lists_lock);
+
+    if (!cfile || !cfile->lazy)
+        return false;
+
+    PLOG((2, "pio_forget_lazy_file ncid = %d", ncid));
+    return !pio_delete_file_from_list(ncid);
+}
+
 /**
  * Delete a file from the list of open files.
  *
@@ -94,6 +274,7 @@ pio_delete_file_from_list(int ncid)
     int ret;
 
     /* Find the file pointer. */
+    pio_wrlock(&lists_lock);
     if (current_file && current_file->pio_ncid == ncid)
         cfile = current_file;
     else
@@ -105,13 +286,27 @@ pio_delete_file_from_list(int ncid)
 
         if (current_file == cfile)
             current_file = pio_file_list;
+    }
+    pio_unlock(&lists_lock);
 
+    if (cfile)
+    {
         /* Free the varlist entries for this file. */
         while (cfile->varlist)
             if ((ret = delete_var_desc(cfile->varlist->varid, &cfile->varlist)))
                 return pio_err(NULL, cfile, ret, __FILE__, __LINE__);
 
         /* Free the memory used for this file. */
+        free(cfile->var_index);
+        free(cfile->fname);
+        free(cfile->open_meta);
+        free(cfile->put_reqs);
+        free(cfile->lazy_frames);
+        if (cfile->deferred_atts)
+        {
+            pio_msg_args_free(cfile->deferred_atts);
+            free(cfile->deferred_atts);
+        }
         free(cfile);
 
         return PIO_NOERR;
@@ -135,6 +330,7 @@ pio_delete_iosystem_from_list(int piosysid)
 
     PLOG((1, "pio_delete_iosystem_from_list piosysid = %d", piosysid));
 
+    pio_wrlock(&lists_lock);
     for (ciosystem = pio_iosystem_list; ciosystem; ciosystem = ciosystem->next)
     {
         PLOG((3, "ciosystem->iosysid = %d", ciosystem->iosysid));
@@ -144,11 +340,13 @@ pio_delete_iosystem_from_list(int piosysid)
                 pio_iosystem_list = ciosystem->next;
             else
                 piosystem->next = ciosystem->next;
+            pio_unlock(&lists_lock);
             free(ciosystem);
             return PIO_NOERR;
         }
         piosystem = ciosystem;
     }
+    pio_unlock(&lists_lock);
     return PIO_EBADID;
 }
 
@@ -168,6 +366,7 @@ pio_add_to_iosystem_list(iosystem_desc_t *ios)
     assert(ios);
 
     ios->next = NULL;
+    pio_wrlock(&lists_lock);
     cios = pio_iosystem_list;
     if (!cios)
         pio_iosystem_list = ios;
@@ -183,6 +382,7 @@ pio_add_to_iosystem_list(iosystem_desc_t *ios)
     }
 
     ios->iosysid = i << 16;
+    pio_unlock(&lists_lock);
 
     return ios->iosysid;
 }
@@ -201,11 +401,13 @@ pio_get_iosystem_from_id(int iosysid)
 
     PLOG((2, "pio_get_iosystem_from_id iosysid = %d", iosysid));
 
+    pio_rdlock(&lists_lock);
     for (ciosystem = pio_iosystem_list; ciosystem; ciosystem = ciosystem->next)
         if (ciosystem->iosysid == iosysid)
-            return ciosystem;
+            break;
+    pio_unlock(&lists_lock);
 
-    return NULL;
+    return ciosystem;
 }
 
 /**
@@ -221,11 +423,13 @@ pio_num_iosystem(int *niosysid)
     int count = 0;
 
     /* Count the elements in the list. */
+    pio_rdlock(&lists_lock);
     for (iosystem_desc_t *c = pio_iosystem_list; c; c = c->next)
     {
         PLOG((3, "pio_num_iosystem c->iosysid %d", c->iosysid));
         count++;
     }
+    pio_unlock(&lists_lock);
 
     /* Return count to caller via pointer. */
     if (niosysid)
@@ -234,6 +438,44 @@ pio_num_iosystem(int *niosysid)
     return PIO_NOERR;
 }
 
+/**
+ * Find an open IO system whose communicators can be used by a new
+ * non-async IO system, for PIOc_set_comm_sharing(). Its computation
+ * communicator must have the same tasks as comp_comm, in the same
+ * order, and it must have the same IO tasks. The comparison is
+ * local, but gives the same answer on all tasks of comp_comm, since
+ * the IO systems that match were all created by these tasks, in the
+ * same order.
+ *
+ * @param comp_comm the computation communicator of the new IO
+ * system.
+ * @param num_iotasks the number of IO tasks.
+ * @param ioranks the comp_comm ranks of the IO tasks.
+ * @returns pointer to the first IO system that matches, or NULL.
+ * @author Ed Hartnett
+ */
+iosystem_desc_t *
+pio_find_comm_iosystem(MPI_Comm comp_comm, int num_iotasks, const int *ioranks)
+{
+    iosystem_desc_t *found = NULL;
+
+    pio_rdlock(&lists_lock);
+    for (iosystem_desc_t *c = pio_iosystem_list; c && !found; c = c->next)
+    {
+        int result;
+
+        if (c->async || c->num_iotasks != num_iotasks ||
+            MPI_Comm_compare(comp_comm, c->comp_comm, &result) ||
+            (result != MPI_IDENT && result != MPI_CONGRUENT))
+            continue;
+        if (!memcmp(c->ioranks, ioranks, num_iotasks * sizeof(int)))
+            found = c;
+    }
+    pio_unlock(&lists_lock);
+
+    return found;
+}
+
 /**
  * Add an iodesc.
  *
@@ -244,8 +486,10 @@ pio_num_iosystem(int *niosysid)
 int
 pio_add_to_iodesc_list(io_desc_t *iodesc)
 {
+    pio_wrlock(&lists_lock);
     HASH_ADD_INT(pio_iodesc_list, ioid, iodesc);
     current_iodesc = iodesc;
+    pio_unlock(&lists_lock);
     return PIO_NOERR;
 }
 
@@ -260,6 +504,11 @@ io_desc_t *
 pio_get_iodesc_from_id(int ioid)
 {
     io_desc_t *ciodesc=NULL;
+#if PIO_THREADS
+    pio_rdlock(&lists_lock);
+    HASH_FIND_INT(pio_iodesc_list, &ioid, ciodesc);
+    pio_unlock(&lists_lock);
+#else
     if (current_iodesc && current_iodesc->ioid == ioid)
         ciodesc = current_iodesc;
     else
@@ -267,9 +516,60 @@ pio_get_iodesc_from_id(int ioid)
         HASH_FIND_INT(pio_iodesc_list, &ioid, ciodesc);
         current_iodesc = ciodesc;
     }
+#endif
     return ciodesc;
 }
 
+/**
+ * Find an iodesc of an IO system by the hash of its
+ * PIOc_InitDecomp() inputs.
+ *
+ * @param iosysid the IO system ID.
+ * @param map_hash the hash to look for.
+ * @returns pointer to the first iodesc with that hash, or NULL.
+ * @author Ed Hartnett
+ */
+io_desc_t *
+pio_find_iodesc_by_hash(int iosysid, unsigned long long map_hash)
+{
+    io_desc_t *ciodesc, *tmp, *found = NULL;
+
+    pio_rdlock(&lists_lock);
+    HASH_ITER(hh, pio_iodesc_list, ciodesc, tmp)
+        if (ciodesc->iosysid == iosysid && ciodesc->refcount && ciodesc->map_hash == map_hash)
+        {
+            found = ciodesc;
+            break;
+        }
+    pio_unlock(&lists_lock);
+
+    return found;
+}
+
+/**
+ * Find the size in bytes of the largest IO buffer of the
+ * decompositions of an IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @returns the largest iodesc->maxiobuflen times the size of the
+ * type of its decomposition, or 0 if there are no decompositions.
+ * @author Ed Hartnett
+ */
+PIO_Offset
+pio_max_iobuf_bytes(int iosysid)
+{
+    io_desc_t *ciodesc, *tmp;
+    PIO_Offset maxbytes = 0;
+
+    pio_rdlock(&lists_lock);
+    HASH_ITER(hh, pio_iodesc_list, ciodesc, tmp)
+        if (ciodesc->iosysid == iosysid && ciodesc->refcount)
+            maxbytes = max(maxbytes, (PIO_Offset)ciodesc->maxiobuflen * ciodesc->mpitype_size);
+    pio_unlock(&lists_lock);
+
+    return maxbytes;
+}
+
 /**
  * Delete an iodesc.
  *
@@ -280,14 +580,20 @@ pio_get_iodesc_from_id(int ioid)
 int
 pio_delete_iodesc_from_list(int ioid)
 {
-    io_desc_t *ciodesc;
+    io_desc_t *ciodesc = NULL;
 
-    ciodesc = pio_get_iodesc_from_id(ioid);
+    pio_wrlock(&lists_lock);
+    HASH_FIND_INT(pio_iodesc_list, &ioid, ciodesc);
     if (ciodesc)
     {
         HASH_DEL(pio_iodesc_list, ciodesc);
         if (current_iodesc == ciodesc)
             current_iodesc = pio_iodesc_list;
+    }
+    pio_unlock(&lists_lock);
+
+    if (ciodesc)
+    {
         free(ciodesc);
         return PIO_NOERR;
     }
@@ -373,6 +679,57 @@ get_var_desc(int varid, var_desc_t **varlist, var_desc_t **var_desc)
     return PIO_NOERR;
 }
 
+/**
+ * Get the var_desc_t info for a variable of a file. The vars found
+ * are kept in file->var_index, so that finding them again does not
+ * need the hash table. Since varids are dense, and vars are never
+ * deleted from an open file, the index is grown to hold every varid
+ * looked up.
+ *
+ * @param file pointer to the file info.
+ * @param varid ID of variable to get var_desc_t of.
+ * @param var_desc pointer that gets pointer to var_desc_t struct.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+get_file_var_desc(file_desc_t *file, int varid, var_desc_t **var_desc)
+{
+    var_desc_t *my_var;
+    int ret;
+
+    /* Check inputs. */
+    pioassert(file && var_desc, "invalid input", __FILE__, __LINE__);
+
+    /* Is it in the index? */
+    if (varid >= 0 && varid < file->var_index_len && file->var_index[varid])
+    {
+        *var_desc = file->var_index[varid];
+        return PIO_NOERR;
+    }
+
+    if ((ret = get_var_desc(varid, &file->varlist, &my_var)))
+        return ret;
+
+    /* Add it to the index, growing that to the number of vars. */
+    if (varid >= file->var_index_len)
+    {
+        int len = max(varid + 1, max(file->nvars, 2 * file->var_index_len));
+        var_desc_t **index;
+
+        if (!(index = realloc(file->var_index, len * sizeof(var_desc_t *))))
+            return PIO_ENOMEM;
+        for (int v = file->var_index_len; v < len; v++)
+            index[v] = NULL;
+        file->var_index = index;
+        file->var_index_len = len;
+    }
+    file->var_index[varid] = my_var;
+    *var_desc = my_var;
+
+    return PIO_NOERR;
+}
+
 /**
  * Delete var_desc_t info for a variable.
  *
@@ -402,6 +759,10 @@ delete_var_desc(int varid, var_desc_t **varlist)
     /* Free memory. */
     if (v->fillvalue)
         free(v->fillvalue);
+    if (v->fillbuf)
+        pio_free(PIO_MEM_FILLBUF, v->fillbuf);
+    if (v->accum)
+        pio_free(PIO_MEM_ACCUM, v->accum);
     free(v);
 
     return PIO_NOERR;
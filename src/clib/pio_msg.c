@@ -14,9 +14,11 @@
  * @author Ed Hartnett
  */
 
+#define PIO_LOG_SUBSYS PIO_LOG_MSG
 #include <config.h>
 #include <pio.h>
 #include <pio_internal.h>
+#include <time.h>
 
 #ifdef PIO_ENABLE_LOGGING
 extern int my_rank;
@@ -28,6 +30,220 @@ extern int pio_log_level;
 extern int event_num[2][NUM_EVENTS];
 #endif /* USE_MPE */
 
+/** How the IO tasks wait for messages, see PIOc_set_async_wait(). */
+static int async_wait = PIO_ASYNC_WAIT_BLOCK;
+
+/** The longest sleep, in microseconds, with PIO_ASYNC_WAIT_BACKOFF. */
+static int async_max_sleep = PIO_ASYNC_MAX_SLEEP;
+
+/**
+ * Start packing the arguments of an async message. The arguments
+ * are added with pio_msg_args_pack() and sent with
+ * pio_msg_args_send(), so that the message costs one broadcast
+ * rather than one for each argument.
+ *
+ * @param args pointer to the packed arguments.
+ * @param ios pointer to the iosystem info.
+ * @internal
+ * @author Ed Hartnett
+ */
+void
+pio_msg_args_init(pio_msg_args *args, iosystem_desc_t *ios)
+{
+    pioassert(args && ios, "invalid input", __FILE__, __LINE__);
+
+    args->buf = args->fixed;
+    args->size = PIO_MSG_ARGS_SIZE;
+    args->comm = ios->intercomm;
+
+    /* Only the arguments of the computation master are sent. */
+    args->skip = !ios->ioproc && ios->compmaster != MPI_ROOT;
+
+    /* The total length comes first. */
+    args->pos = sizeof(int);
+}
+
+/**
+ * Pack an argument of an async message, growing the buffer as
+ * needed.
+ *
+ * @param args pointer to the packed arguments.
+ * @param data pointer to the data of the argument.
+ * @param count number of elements of data.
+ * @param type MPI type of the elements.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ * @author Ed Hartnett
+ */
+int
+pio_msg_args_pack(pio_msg_args *args, const void *data, int count, MPI_Datatype type)
+{
+    int need;
+    int mpierr;
+
+    pioassert(args && count >= 0 && (data || !count), "invalid input", __FILE__, __LINE__);
+
+    if (!count || args->skip)
+        return PIO_NOERR;
+
+    if ((mpierr = MPI_Pack_size(count, type, args->comm, &need)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    if (args->pos + need > args->size)
+    {
+        int size = max(2 * args->size, args->pos + need);
+        char *buf;
+
+        if (!(buf = pio_malloc(PIO_MEM_MSG, size)))
+            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        memcpy(buf, args->buf, args->pos);
+        if (args->buf != args->fixed)
+            pio_free(PIO_MEM_MSG, args->buf);
+        args->buf = buf;
+        args->size = size;
+    }
+
+    if ((mpierr = MPI_Pack(data, count, type, args->buf, args->size, &args->pos,
+                           args->comm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Send the packed arguments of an async message from the computation
+ * tasks to the IO tasks. This is called on all computation tasks,
+ * after the message itself has been sent.
+ *
+ * The first PIO_MSG_ARGS_SIZE bytes go in one broadcast over the
+ * intercomm. The rest of a longer message is sent by the computation
+ * master to the IO root, which shares it with the other IO tasks, so
+ * that only the computation master needs to know the length.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param args pointer to the packed arguments.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ * @author Ed Hartnett
+ */
+int
+pio_msg_args_send(iosystem_desc_t *ios, pio_msg_args *args)
+{
+    int mpierr;
+
+    pioassert(ios && args, "invalid input", __FILE__, __LINE__);
+
+    memcpy(args->buf, &args->pos, sizeof(int));
+    PLOG((3, "pio_msg_args_send len = %d", args->pos));
+
+    if ((mpierr = MPI_Bcast(args->buf, PIO_MSG_ARGS_SIZE, MPI_PACKED, ios->compmaster,
+                            ios->intercomm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    if (ios->compmaster == MPI_ROOT && args->pos > PIO_MSG_ARGS_SIZE)
+        if ((mpierr = MPI_Send(args->buf + PIO_MSG_ARGS_SIZE, args->pos - PIO_MSG_ARGS_SIZE,
+                               MPI_PACKED, ios->ioroot, PIO_MSG_ARGS_TAG, ios->union_comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Receive the packed arguments of an async message on the IO
+ * tasks. This is called on all IO tasks, in the message handler.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param args pointer that gets the packed arguments. They are read
+ * with pio_msg_args_unpack(), and freed with pio_msg_args_free().
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ * @author Ed Hartnett
+ */
+int
+pio_msg_args_recv(iosystem_desc_t *ios, pio_msg_args *args)
+{
+    int len;
+    int mpierr = MPI_SUCCESS;
+
+    pio_msg_args_init(args, ios);
+
+    if ((mpierr = MPI_Bcast(args->buf, PIO_MSG_ARGS_SIZE, MPI_PACKED, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    memcpy(&len, args->buf, sizeof(int));
+    PLOG((3, "pio_msg_args_recv len = %d", len));
+
+    /* Get the rest of a long message. */
+    if (len > PIO_MSG_ARGS_SIZE)
+    {
+        if (!(args->buf = pio_malloc(PIO_MEM_MSG, len)))
+        {
+            args->buf = args->fixed;
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+        memcpy(args->buf, args->fixed, PIO_MSG_ARGS_SIZE);
+
+        if (ios->iomaster == MPI_ROOT)
+            mpierr = MPI_Recv(args->buf + PIO_MSG_ARGS_SIZE, len - PIO_MSG_ARGS_SIZE,
+                              MPI_PACKED, ios->comproot, PIO_MSG_ARGS_TAG, ios->union_comm,
+                              MPI_STATUS_IGNORE);
+        if (!mpierr)
+            mpierr = MPI_Bcast(args->buf + PIO_MSG_ARGS_SIZE, len - PIO_MSG_ARGS_SIZE,
+                               MPI_PACKED, 0, ios->io_comm);
+        if (mpierr)
+        {
+            pio_msg_args_free(args);
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
+    }
+    args->size = max(len, PIO_MSG_ARGS_SIZE);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Unpack the next argument of an async message.
+ *
+ * @param args pointer to the packed arguments.
+ * @param data pointer that gets the data of the argument.
+ * @param count number of elements of data.
+ * @param type MPI type of the elements.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ * @author Ed Hartnett
+ */
+int
+pio_msg_args_unpack(pio_msg_args *args, void *data, int count, MPI_Datatype type)
+{
+    int mpierr;
+
+    pioassert(args && count >= 0 && (data || !count), "invalid input", __FILE__, __LINE__);
+
+    if (!count)
+        return PIO_NOERR;
+
+    if ((mpierr = MPI_Unpack(args->buf, args->size, &args->pos, data, count, type,
+                             args->comm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free the packed arguments of an async message.
+ *
+ * @param args pointer to the packed arguments.
+ * @internal
+ * @author Ed Hartnett
+ */
+void
+pio_msg_args_free(pio_msg_args *args)
+{
+    if (args && args->buf != args->fixed)
+        pio_free(PIO_MEM_MSG, args->buf);
+    if (args)
+        args->buf = args->fixed;
+}
+
 /**
  * This function is run on the IO tasks to handle nc_inq_type*()
  * functions.
@@ -174,6 +390,7 @@ int create_file_handler(iosystem_desc_t *ios)
     int mode;
     int use_ext_ncid;
     char ncidp_present;
+    int slen;
 #ifdef NETCDF_INTEGRATION
     int iosysid;
 #endif /* NETCDF_INTEGRATION */
@@ -212,6 +429,41 @@ int create_file_handler(iosystem_desc_t *ios)
     PLOG((1, "create_file_handler iosysid %d", iosysid));
 #endif /* NETCDF_INTEGRATION */
 
+    /* The cb_nodes hint of the file, see PIOc_set_file_cb_nodes(). */
+    if ((mpierr = MPI_Bcast(&ios->file_cb_nodes, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* The number of subfiles, see PIOc_set_subfiles(). */
+    if ((mpierr = MPI_Bcast(&ios->num_subfiles, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* The compression, see PIOc_set_compression(). */
+    if ((mpierr = MPI_Bcast(&ios->compression, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&ios->compression_level, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* The automatic hints, see PIOc_set_hint_auto(). */
+    if ((mpierr = MPI_Bcast(&ios->hint_auto, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* The stage directory, see PIOc_set_stage_dir(). */
+    if ((mpierr = MPI_Bcast(&slen, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    free(ios->stage_dir);
+    ios->stage_dir = NULL;
+    if (slen)
+    {
+        if (!(ios->stage_dir = malloc(slen + 1)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        if ((mpierr = MPI_Bcast(ios->stage_dir, slen + 1, MPI_CHAR, 0, ios->intercomm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* The checkpoint files, see PIOc_set_checkpoint(). */
+    if ((mpierr = MPI_Bcast(&ios->checkpoint, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
     /* Call the create file function. */
     if (use_ext_ncid)
     {
@@ -239,12 +491,14 @@ int create_file_handler(iosystem_desc_t *ios)
  * only ever run on the IO tasks.
  *
  * @param ios pointer to the iosystem_desc_t.
+ * @param msg PIO_MSG_CLOSE_FILE, or PIO_MSG_CLOSE_FILE_BG for
+ * PIOc_closefile_async().
  * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
  * from netCDF base function.
  * @internal
  * @author Ed Hartnett
  */
-int close_file_handler(iosystem_desc_t *ios)
+int close_file_handler(iosystem_desc_t *ios, int msg)
 {
     int ncid;
     int mpierr;
@@ -259,7 +513,10 @@ int close_file_handler(iosystem_desc_t *ios)
     PLOG((1, "close_file_handler got parameter ncid = %d", ncid));
 
     /* Call the close file function. */
-    PIOc_closefile(ncid);
+    if (msg == PIO_MSG_CLOSE_FILE_BG)
+        PIOc_closefile_async(ncid);
+    else
+        PIOc_closefile(ncid);
 
     PLOG((1, "close_file_handler succeeded!"));
     return PIO_NOERR;
@@ -624,40 +881,44 @@ int att_put_handler(iosystem_desc_t *ios)
     nc_type memtype;    /* Type of att data in memory. */
     PIO_Offset memtype_len; /* Length of element of memtype. */
     void *op;
-    int mpierr;
+    pio_msg_args args;
+    int ret;
 
     PLOG((1, "att_put_handler"));
     assert(ios);
 
     /* Get the parameters for this function that the the comp master
-     * task is broadcasting. */
-    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&varid, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&namelen, 1, MPI_INT,  ios->compmaster, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(name, namelen + 1, MPI_CHAR, ios->compmaster, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&atttype, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&attlen, 1, MPI_OFFSET, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&atttype_len, 1, MPI_OFFSET, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&memtype, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&memtype_len, 1, MPI_OFFSET, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+     * task is sending, in one message. */
+    if ((ret = pio_msg_args_recv(ios, &args)))
+        return ret;
+    ret = pio_msg_args_unpack(&args, &ncid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &varid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &namelen, 1, MPI_INT);
+    if (!ret && (namelen < 0 || namelen > PIO_MAX_NAME))
+        ret = pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, name, namelen + 1, MPI_CHAR);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &atttype, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &attlen, 1, MPI_OFFSET);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &atttype_len, 1, MPI_OFFSET);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &memtype, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &memtype_len, 1, MPI_OFFSET);
 
     /* Allocate memory for the attribute data. */
-    if (!(op = malloc(attlen * memtype_len)))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(op, attlen * memtype_len, MPI_BYTE, 0, ios->intercomm)))
-    {
+    if (!ret && !(op = malloc(attlen * memtype_len)))
+        ret = pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!ret && (ret = pio_msg_args_unpack(&args, op, attlen * memtype_len, MPI_BYTE)))
         free(op);
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    }
+    pio_msg_args_free(&args);
+    if (ret)
+        return ret;
     PLOG((1, "att_put_handler ncid = %d varid = %d namelen = %d name = %s"
           "atttype = %d attlen = %d atttype_len = %d memtype = %d memtype_len = 5d",
           ncid, varid, namelen, name, atttype, attlen, atttype_len, memtype, memtype_len));
@@ -672,6 +933,106 @@ int att_put_handler(iosystem_desc_t *ios)
     return PIO_NOERR;
 }
 
+/**
+ * Write the attributes queued by the computation tasks of a file,
+ * see flush_deferred_atts(). This code only runs on IO tasks.
+ *
+ * All the attributes are written, even after an error; the first
+ * error is returned to the computation tasks.
+ *
+ * @param ios pointer to the iosystem_desc_t.
+ * @returns 0 for success, PIO_EIO for MPI errors, or error code
+ * from netCDF base function.
+ * @internal
+ * @author Ed Hartnett
+ */
+int att_put_batch_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    file_desc_t *file = NULL;
+    pio_msg_args args;
+    int more = 1;
+    int natts = 0;
+    int mpierr = MPI_SUCCESS;
+    int ierr = PIO_NOERR; /* First error in writing the attributes. */
+    int ierr2;
+    int ret;
+
+    PLOG((1, "att_put_batch_handler"));
+    assert(ios);
+
+    /* Get all the attributes, in one message. */
+    if ((ret = pio_msg_args_recv(ios, &args)))
+        return ret;
+    ret = pio_msg_args_unpack(&args, &ncid, 1, MPI_INT);
+    if (!ret && (ret = pio_get_file(ncid, &file)))
+        ret = pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    while (!ret)
+    {
+        int varid;
+        int namelen;
+        char name[PIO_MAX_NAME + 1];
+        nc_type atttype;
+        PIO_Offset attlen;
+        nc_type memtype;
+        PIO_Offset memtype_len;
+        void *op;
+
+        if ((ret = pio_msg_args_unpack(&args, &more, 1, MPI_INT)) || !more)
+            break;
+        ret = pio_msg_args_unpack(&args, &varid, 1, MPI_INT);
+        if (!ret)
+            ret = pio_msg_args_unpack(&args, &namelen, 1, MPI_INT);
+        if (!ret && (namelen < 0 || namelen > PIO_MAX_NAME))
+            ret = pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        if (!ret)
+            ret = pio_msg_args_unpack(&args, name, namelen + 1, MPI_CHAR);
+        if (!ret)
+            ret = pio_msg_args_unpack(&args, &atttype, 1, MPI_INT);
+        if (!ret)
+            ret = pio_msg_args_unpack(&args, &attlen, 1, MPI_OFFSET);
+        if (!ret)
+            ret = pio_msg_args_unpack(&args, &memtype, 1, MPI_INT);
+        if (!ret)
+            ret = pio_msg_args_unpack(&args, &memtype_len, 1, MPI_OFFSET);
+        if (ret)
+            break;
+
+        if (!(op = malloc(attlen * memtype_len)))
+        {
+            ret = pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+            break;
+        }
+        if (!(ret = pio_msg_args_unpack(&args, op, attlen * memtype_len, MPI_BYTE)))
+        {
+            PLOG((2, "att_put_batch_handler varid = %d name = %s attlen = %lld", varid,
+                  name, attlen));
+            if ((ierr2 = put_att_io(file, varid, name, atttype, attlen, memtype, op)) && !ierr)
+                ierr = ierr2;
+            natts++;
+        }
+        free(op);
+    }
+    pio_msg_args_free(&args);
+    PLOG((2, "att_put_batch_handler natts = %d ierr = %d ret = %d", natts, ierr, ret));
+
+    /* A broken message leaves the rest of the attributes unwritten,
+     * but the computation tasks still need an answer. */
+    if (ret && !ierr)
+        ierr = ret;
+
+    /* Join the handling of MPI errors, and share the return code,
+     * as the computation tasks do in flush_deferred_atts(). */
+    if ((mpierr = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    PLOG((2, "att_put_batch_handler complete!"));
+    return ret;
+}
+
 /** Handle attribute operations. This code only runs on IO tasks.
  *
  * @param ios pointer to the iosystem_desc_t.
@@ -760,57 +1121,65 @@ int put_vars_handler(iosystem_desc_t *ios)
     int ndims;           /* Number of dimensions. */
     void *buf;           /* Buffer for data storage. */
     PIO_Offset num_elem; /* Number of data elements in the buffer. */
-    int mpierr;          /* Error code from MPI function calls. */
+    PIO_Offset start[PIO_MAX_DIMS], count[PIO_MAX_DIMS], stride[PIO_MAX_DIMS];
+    pio_msg_args args;   /* The packed parameters. */
+    int ret;
 
     PLOG((1, "put_vars_handler"));
     assert(ios);
 
     /* Get the parameters for this function that the the comp master
-     * task is broadcasting. */
-    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&varid, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&ndims, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-
-    /* Now we know how big to make these arrays. */
-    PIO_Offset start[ndims], count[ndims], stride[ndims];
-
-    if ((mpierr = MPI_Bcast(&start_present, 1, MPI_CHAR, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (start_present)
-        if ((mpierr = MPI_Bcast(start, ndims, MPI_OFFSET, 0, ios->intercomm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    /* PLOG((1, "put_vars_handler getting start[0] = %d ndims = %d", start[0], ndims)); */
-    if ((mpierr = MPI_Bcast(&count_present, 1, MPI_CHAR, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (count_present)
-        if ((mpierr = MPI_Bcast(count, ndims, MPI_OFFSET, 0, ios->intercomm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&stride_present, 1, MPI_CHAR, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (stride_present)
-        if ((mpierr = MPI_Bcast(stride, ndims, MPI_OFFSET, 0, ios->intercomm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&xtype, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&num_elem, 1, MPI_OFFSET, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&typelen, 1, MPI_OFFSET, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+     * task is sending, in one message. */
+    if ((ret = pio_msg_args_recv(ios, &args)))
+        return ret;
+    ret = pio_msg_args_unpack(&args, &ncid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &varid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &ndims, 1, MPI_INT);
+    if (!ret && (ndims < 0 || ndims > PIO_MAX_DIMS))
+        ret = pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &start_present, 1, MPI_CHAR);
+    if (!ret && start_present)
+        ret = pio_msg_args_unpack(&args, start, ndims, MPI_OFFSET);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &count_present, 1, MPI_CHAR);
+    if (!ret && count_present)
+        ret = pio_msg_args_unpack(&args, count, ndims, MPI_OFFSET);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &stride_present, 1, MPI_CHAR);
+    if (!ret && stride_present)
+        ret = pio_msg_args_unpack(&args, stride, ndims, MPI_OFFSET);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &xtype, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &num_elem, 1, MPI_OFFSET);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &typelen, 1, MPI_OFFSET);
+    if (ret)
+    {
+        pio_msg_args_free(&args);
+        return ret;
+    }
     PLOG((1, "put_vars_handler ncid = %d varid = %d ndims = %d "
           "start_present = %d count_present = %d stride_present = %d xtype = %d "
           "num_elem = %d typelen = %d", ncid, varid, ndims, start_present, count_present,
           stride_present, xtype, num_elem, typelen));
 
-    /* Allocate room for our data. */
+    /* Allocate room for our data, and get it. */
     if (!(buf = malloc(num_elem * typelen)))
+    {
+        pio_msg_args_free(&args);
         return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-
-    /* Get the data. */
-    if ((mpierr = MPI_Bcast(buf, num_elem * typelen, MPI_BYTE, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    ret = pio_msg_args_unpack(&args, buf, num_elem * typelen, MPI_BYTE);
+    pio_msg_args_free(&args);
+    if (ret)
+    {
+        free(buf);
+        return ret;
+    }
 
     /* Set the non-NULL pointers. */
     if (start_present)
@@ -1346,12 +1715,13 @@ int inq_varid_handler(iosystem_desc_t *ios)
  * This function is run on the IO tasks to sync a netCDF file.
  *
  * @param ios pointer to the iosystem_desc_t.
+ * @param msg PIO_MSG_SYNC, or PIO_MSG_SYNC_BG for PIOc_sync_async().
  * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
  * from netCDF base function.
  * @internal
  * @author Ed Hartnett
  */
-int sync_file_handler(iosystem_desc_t *ios)
+int sync_file_handler(iosystem_desc_t *ios, int msg)
 {
     int ncid;
     int mpierr;
@@ -1366,7 +1736,10 @@ int sync_file_handler(iosystem_desc_t *ios)
     PLOG((1, "sync_file_handler got parameter ncid = %d", ncid));
 
     /* Call the sync file function. */
-    PIOc_sync(ncid);
+    if (msg == PIO_MSG_SYNC_BG)
+        PIOc_sync_async(ncid);
+    else
+        PIOc_sync(ncid);
 
     PLOG((2, "sync_file_handler succeeded!"));
     return PIO_NOERR;
@@ -1410,6 +1783,45 @@ int setframe_handler(iosystem_desc_t *ios)
     return PIO_NOERR;
 }
 
+/**
+ * This function is run on the IO tasks to set the quantization of a
+ * variable.
+ *
+ * @param ios pointer to the iosystem_desc_t.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int def_var_quantize_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int varid;
+    int quantize_mode;
+    int nsd;
+    int mpierr;
+
+    PLOG((1, "def_var_quantize_handler"));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&varid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&quantize_mode, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&nsd, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((1, "def_var_quantize_handler got parameters ncid = %d varid = %d "
+          "quantize_mode = %d nsd = %d", ncid, varid, quantize_mode, nsd));
+
+    /* Call the function. */
+    PIOc_def_var_quantize(ncid, varid, quantize_mode, nsd);
+
+    PLOG((2, "def_var_quantize_handler succeeded!"));
+    return PIO_NOERR;
+}
+
 /**
  * This function is run on the IO tasks to increment the record
  * dimension value for a netCDF variable.
@@ -1457,6 +1869,7 @@ int advanceframe_handler(iosystem_desc_t *ios)
  */
 int change_def_file_handler(iosystem_desc_t *ios, int msg)
 {
+    PIO_Offset aligns[PIO_ENDDEF_NALIGN + 1];
     int ncid;
     int mpierr;
 
@@ -1464,13 +1877,17 @@ int change_def_file_handler(iosystem_desc_t *ios, int msg)
     assert(ios);
 
     /* Get the parameters for this function that the comp master
-     * task is broadcasting. */
+     * task is broadcasting. Enddef also gets the flag and values of
+     * PIOc_enddef_align(). */
     if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
         return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (msg == PIO_MSG_ENDDEF)
+        if ((mpierr = MPI_Bcast(aligns, PIO_ENDDEF_NALIGN + 1, MPI_OFFSET, 0, ios->intercomm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
 
     /* Call the function. */
     if (msg == PIO_MSG_ENDDEF)
-        PIOc_enddef(ncid);
+        pioc_change_def(ncid, 1, aligns[0] ? aligns + 1 : NULL);
     else
         PIOc_redef(ncid);
 
@@ -1496,30 +1913,39 @@ int def_var_handler(iosystem_desc_t *ios)
     int varid;
     nc_type xtype;
     int ndims;
-    int *dimids;
-    int mpierr;
+    int *dimids = NULL;
+    pio_msg_args args;
+    int ret;
 
     PLOG((1, "def_var_handler comproot = %d", ios->comproot));
     assert(ios);
 
     /* Get the parameters for this function that the he comp master
-     * task is broadcasting. */
-    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&namelen, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(name, namelen + 1, MPI_CHAR, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&xtype, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&ndims, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (!(dimids = malloc(ndims * sizeof(int))))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(dimids, ndims, MPI_INT, 0, ios->intercomm)))
+     * task is sending, in one message. */
+    if ((ret = pio_msg_args_recv(ios, &args)))
+        return ret;
+    ret = pio_msg_args_unpack(&args, &ncid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &namelen, 1, MPI_INT);
+    if (!ret && (namelen < 0 || namelen > PIO_MAX_NAME))
+        ret = pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, name, namelen + 1, MPI_CHAR);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &xtype, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &ndims, 1, MPI_INT);
+    if (!ret && (ndims < 0 || ndims > PIO_MAX_DIMS))
+        ret = pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (!ret && !(dimids = malloc((ndims + 1) * sizeof(int))))
+        ret = pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, dimids, ndims, MPI_INT);
+    pio_msg_args_free(&args);
+    if (ret)
     {
         free(dimids);
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        return ret;
     }
     PLOG((1, "def_var_handler got parameters namelen = %d "
           "name = %s ncid = %d", namelen, name, ncid));
@@ -1585,6 +2011,42 @@ int def_var_chunking_handler(iosystem_desc_t *ios)
     return PIO_NOERR;
 }
 
+/**
+ * This function is run on the IO tasks to set the chunksizes of a
+ * variable from a decomposition.
+ *
+ * @param ios pointer to the iosystem_desc_t.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int def_var_chunking_decomp_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int varid;
+    int ioid;
+    int mpierr;
+
+    assert(ios);
+    PLOG((1, "def_var_chunking_decomp_handler comproot = %d", ios->comproot));
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&varid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&ioid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((1, "def_var_chunking_decomp_handler got parameters ncid = %d varid = %d "
+          "ioid = %d", ncid, varid, ioid));
+
+    /* Call the function. */
+    PIOc_def_var_chunking_decomp(ncid, varid, ioid);
+
+    PLOG((1, "def_var_chunking_decomp_handler succeeded!"));
+    return PIO_NOERR;
+}
+
 /**
  * This function is run on the IO tasks to define fill mode and fill
  * value.
@@ -1771,26 +2233,34 @@ int set_var_chunk_cache_handler(iosystem_desc_t *ios)
 int def_dim_handler(iosystem_desc_t *ios)
 {
     int ncid;
-    int len, namelen;
+    int namelen;
+    PIO_Offset len;
     char name[PIO_MAX_NAME + 1];
     int dimid;
-    int mpierr;
+    pio_msg_args args;
+    int ret;
 
     PLOG((1, "def_dim_handler comproot = %d", ios->comproot));
     assert(ios);
 
     /* Get the parameters for this function that the he comp master
-     * task is broadcasting. */
-    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&namelen, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(name, namelen + 1, MPI_CHAR, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&len, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+     * task is sending, in one message. */
+    if ((ret = pio_msg_args_recv(ios, &args)))
+        return ret;
+    ret = pio_msg_args_unpack(&args, &ncid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &namelen, 1, MPI_INT);
+    if (!ret && (namelen < 0 || namelen > PIO_MAX_NAME))
+        ret = pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, name, namelen + 1, MPI_CHAR);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &len, 1, MPI_OFFSET);
+    pio_msg_args_free(&args);
+    if (ret)
+        return ret;
     PLOG((2, "def_dim_handler got parameters namelen = %d "
-          "name = %s len = %d ncid = %d", namelen, name, len, ncid));
+          "name = %s len = %lld ncid = %d", namelen, name, len, ncid));
 
     /* Call the function. */
     PIOc_def_dim(ncid, name, len, &dimid);
@@ -1984,6 +2454,7 @@ int open_file_handler(iosystem_desc_t *ios)
     int iotype;
     int mode;
     int use_ext_ncid;
+    int retry;
 #ifdef NETCDF_INTEGRATION
     int iosysid;
 #endif /* NETCDF_INTEGRATION */
@@ -2009,8 +2480,12 @@ int open_file_handler(iosystem_desc_t *ios)
         return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
     if ((mpierr = MPI_Bcast(&use_ext_ncid, 1, MPI_INT, 0, ios->intercomm)))
         return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    PLOG((2, "len %d filename %s iotype %d mode %d use_ext_ncid %d",
-          len, filename, iotype, mode, use_ext_ncid));
+    if ((mpierr = MPI_Bcast(&retry, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&ios->hint_auto, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "len %d filename %s iotype %d mode %d use_ext_ncid %d retry %d",
+          len, filename, iotype, mode, use_ext_ncid, retry));
 #ifdef NETCDF_INTEGRATION
     if ((mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, 0, ios->intercomm)))
         return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
@@ -2032,7 +2507,7 @@ int open_file_handler(iosystem_desc_t *ios)
     }
     else
     {
-        PIOc_openfile_retry(ios->iosysid, &ncid, &iotype, filename, mode, 0,
+        PIOc_openfile_retry(ios->iosysid, &ncid, &iotype, filename, mode, retry,
                             use_ext_ncid);
     }
 
@@ -2180,6 +2655,10 @@ int initdecomp_dof_handler(iosystem_desc_t *ios)
 /**
  * This function is run on the IO tasks to do darray writes.
  *
+ * Only the parameters are broadcast; the data are moved from the
+ * computation tasks to the IO tasks which write them by the
+ * rearranger, over the union communicator.
+ *
  * @param ios pointer to the iosystem_desc_t data.
  *
  * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
@@ -2196,62 +2675,74 @@ int write_darray_multi_handler(iosystem_desc_t *ios)
     io_desc_t *iodesc;     /* The IO description. */
     char frame_present;
     int *framep = NULL;
-    int *frame;
+    int *frame = NULL;
     PIO_Offset arraylen;
-    void *array;
     char fillvalue_present;
     void *fillvaluep = NULL;
-    void *fillvalue;
+    void *fillvalue = NULL;
     int flushtodisk;
-    int mpierr;
+    int write_behind;
+    pio_msg_args args;     /* The packed parameters. */
     int ret;
 
     PLOG((1, "write_darray_multi_handler"));
     assert(ios);
 
     /* Get the parameters for this function that the the comp master
-     * task is broadcasting. */
-    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&nvars, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+     * task is sending, in one message. */
+    if ((ret = pio_msg_args_recv(ios, &args)))
+        return ret;
+    ret = pio_msg_args_unpack(&args, &ncid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &nvars, 1, MPI_INT);
+    if (!ret && nvars <= 0)
+        ret = pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (ret)
+    {
+        pio_msg_args_free(&args);
+        return ret;
+    }
     int varids[nvars];
-    if ((mpierr = MPI_Bcast(varids, nvars, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&ioid, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    ret = pio_msg_args_unpack(&args, varids, nvars, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &ioid, 1, MPI_INT);
 
     /* Get decomposition information. */
-    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
-        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
-
-    if ((mpierr = MPI_Bcast(&arraylen, 1, MPI_OFFSET, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (!(array = malloc(arraylen * iodesc->piotype_size)))
-        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(array, arraylen * iodesc->piotype_size, MPI_CHAR, 0,
-                            ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Bcast(&frame_present, 1, MPI_CHAR, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (frame_present)
+    if (!ret && !(iodesc = pio_get_iodesc_from_id(ioid)))
+        ret = pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &arraylen, 1, MPI_OFFSET);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &frame_present, 1, MPI_CHAR);
+    if (!ret && frame_present)
     {
         if (!(frame = malloc(nvars * sizeof(int))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(frame, nvars, MPI_INT, 0, ios->intercomm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            ret = pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        else
+            ret = pio_msg_args_unpack(&args, frame, nvars, MPI_INT);
     }
-    if ((mpierr = MPI_Bcast(&fillvalue_present, 1, MPI_CHAR, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if (fillvalue_present)
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &fillvalue_present, 1, MPI_CHAR);
+    if (!ret && fillvalue_present)
     {
         if (!(fillvalue = malloc(nvars * iodesc->piotype_size)))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(fillvalue, nvars * iodesc->piotype_size, MPI_CHAR, 0, ios->intercomm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            ret = pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        else
+            ret = pio_msg_args_unpack(&args, fillvalue, nvars * iodesc->piotype_size,
+                                      MPI_CHAR);
+    }
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &flushtodisk, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &write_behind, 1, MPI_INT);
+    pio_msg_args_free(&args);
+    if (ret)
+    {
+        free(frame);
+        free(fillvalue);
+        return ret;
     }
-    if ((mpierr = MPI_Bcast(&flushtodisk, 1, MPI_INT, 0, ios->intercomm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
     PLOG((1, "write_darray_multi_handler ncid = %d nvars = %d ioid = %d arraylen = %d "
           "frame_present = %d fillvalue_present flushtodisk = %d", ncid, nvars,
           ioid, arraylen, frame_present, fillvalue_present, flushtodisk));
@@ -2273,21 +2764,166 @@ int write_darray_multi_handler(iosystem_desc_t *ios)
         fillvaluep = fillvalue;
 
     /* Call the function from IO tasks. Errors are handled within
-     * function. */
-    PIOc_write_darray_multi(ncid, varids, ioid, nvars, arraylen, array, framep,
-                            fillvaluep, flushtodisk);
+     * function. In write behind mode the computation tasks are not
+     * waiting, so keep the first error for PIOc_sync(). */
+    ios->write_behind = write_behind;
+    if ((ret = PIOc_write_darray_multi(ncid, varids, ioid, nvars, arraylen, NULL, framep,
+                                       fillvaluep, flushtodisk)))
+        if (write_behind && !file->write_behind_err)
+            file->write_behind_err = ret;
 
     /* Free resources. */
     if (frame_present)
         free(frame);
     if (fillvalue_present)
         free(fillvalue);
-    free(array);
 
     PLOG((1, "write_darray_multi_handler succeeded!"));
     return PIO_NOERR;
 }
 
+/**
+ * This function is run on the IO tasks to reduce distributed arrays
+ * with PIOc_accumulate_darray().
+ *
+ * Only the parameters are sent; the data are moved from the
+ * computation tasks to the IO tasks by the rearranger.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, error code otherwise.
+ * @internal
+ * @author Ed Hartnett
+ */
+int accumulate_darray_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int varid;
+    int ioid;
+    PIO_Offset arraylen;
+    int op;
+    pio_msg_args args;     /* The packed parameters. */
+    int ret;
+
+    PLOG((1, "accumulate_darray_handler"));
+    assert(ios);
+
+    /* Get the parameters for this function that the the comp master
+     * task is sending, in one message. */
+    if ((ret = pio_msg_args_recv(ios, &args)))
+        return ret;
+    ret = pio_msg_args_unpack(&args, &ncid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &varid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &ioid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &arraylen, 1, MPI_OFFSET);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &op, 1, MPI_INT);
+    pio_msg_args_free(&args);
+    if (ret)
+        return ret;
+    PLOG((1, "accumulate_darray_handler ncid = %d varid = %d ioid = %d arraylen = %d op = %d",
+          ncid, varid, ioid, arraylen, op));
+
+    /* Call the function from IO tasks. Errors are handled within
+     * function. */
+    PIOc_accumulate_darray(ncid, varid, ioid, arraylen, NULL, op);
+
+    PLOG((1, "accumulate_darray_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to write the reduction of
+ * distributed arrays with PIOc_write_accumulated().
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ * @author Ed Hartnett
+ */
+int write_accumulated_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int varid;
+    int mpierr;
+
+    PLOG((1, "write_accumulated_handler"));
+    assert(ios);
+
+    /* Get the parameters for this function that the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&varid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((1, "write_accumulated_handler got parameters ncid = %d varid = %d",
+          ncid, varid));
+
+    /* Call the function. */
+    PIOc_write_accumulated(ncid, varid);
+
+    PLOG((2, "write_accumulated_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to read distributed arrays of
+ * several variables with PIOc_read_darray_multi().
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @internal
+ * @author Ed Hartnett
+ */
+int read_darray_multi_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int nvars;
+    int ioid;
+    PIO_Offset arraylen;
+    pio_msg_args args;     /* The packed parameters. */
+    int ret;
+
+    PLOG((1, "read_darray_multi_handler"));
+    assert(ios);
+
+    /* Get the parameters for this function that the the comp master
+     * task is sending, in one message. */
+    if ((ret = pio_msg_args_recv(ios, &args)))
+        return ret;
+    ret = pio_msg_args_unpack(&args, &ncid, 1, MPI_INT);
+    if (!ret)
+        ret = pio_msg_args_unpack(&args, &nvars, 1, MPI_INT);
+    if (!ret)
+    {
+        int varids[nvars];
+
+        ret = pio_msg_args_unpack(&args, varids, nvars, MPI_INT);
+        if (!ret)
+            ret = pio_msg_args_unpack(&args, &ioid, 1, MPI_INT);
+        if (!ret)
+            ret = pio_msg_args_unpack(&args, &arraylen, 1, MPI_OFFSET);
+        pio_msg_args_free(&args);
+        if (ret)
+            return ret;
+        PLOG((1, "read_darray_multi_handler ncid = %d nvars = %d ioid = %d arraylen = %d",
+              ncid, nvars, ioid, arraylen));
+
+        /* Call the function from IO tasks. Errors are handled within
+         * function. */
+        PIOc_read_darray_multi(ncid, varids, ioid, nvars, arraylen, NULL);
+    }
+    else
+        pio_msg_args_free(&args);
+
+    PLOG((1, "read_darray_multi_handler succeeded!"));
+    return ret;
+}
+
 /**
  * This function is run on the IO tasks to read distributed arrays.
  *
@@ -2414,6 +3050,74 @@ int set_chunk_cache_handler(iosystem_desc_t *ios)
     return PIO_NOERR;
 }
 
+/**
+ * This function is run on the IO tasks to set the automatic sizing
+ * of the chunk caches of variables.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @author Ed Hartnett
+ */
+int set_auto_chunk_cache_handler(iosystem_desc_t *ios)
+{
+    int iosysid;
+    PIO_Offset max_size;
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
+
+    PLOG((1, "set_auto_chunk_cache_handler called"));
+    assert(ios);
+
+    /* Get the parameters for this function that the the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&max_size, 1, MPI_OFFSET, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((1, "set_auto_chunk_cache_handler got params iosysid = %d max_size = %lld",
+          iosysid, max_size));
+
+    /* Call the function. */
+    PIOc_set_auto_chunk_cache(iosysid, max_size);
+
+    PLOG((1, "set_auto_chunk_cache_handler succeeded!"));
+    return PIO_NOERR;
+}
+
+/**
+ * This function is run on the IO tasks to set the parallel access
+ * mode of darray writes to a file.
+ *
+ * @param ios pointer to the iosystem_desc_t data.
+ * @returns 0 for success, PIO_EIO for MPI Bcast errors, or error code
+ * from netCDF base function.
+ * @author Ed Hartnett
+ */
+int set_par_access_handler(iosystem_desc_t *ios)
+{
+    int ncid;
+    int par_access;
+    int mpierr = MPI_SUCCESS;  /* Return code from MPI function codes. */
+
+    PLOG((1, "set_par_access_handler called"));
+    assert(ios);
+
+    /* Get the parameters for this function that the the comp master
+     * task is broadcasting. */
+    if ((mpierr = MPI_Bcast(&ncid, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(&par_access, 1, MPI_INT, 0, ios->intercomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((1, "set_par_access_handler got params ncid = %d par_access = %d", ncid,
+          par_access));
+
+    /* Call the function. */
+    PIOc_set_par_access(ncid, par_access);
+
+    PLOG((1, "set_par_access_handler succeeded!"));
+    return PIO_NOERR;
+}
+
 /**
  * This function is run on the IO tasks to get the chunk cache
  * parameters for netCDF-4.
@@ -2611,6 +3315,138 @@ int set_loglevel_handler(iosystem_desc_t *ios)
 }
 
 
+/**
+ * Choose how the IO tasks of async IO systems wait for messages from
+ * the computation tasks. With PIO_ASYNC_WAIT_BACKOFF, the IO root
+ * tests for messages with MPI_Testsome(), and the other IO tasks
+ * wait for it with MPI_Ibcast() and MPI_Test(), each sleeping between
+ * tests for 1 microsecond at first, doubling up to max_sleep while
+ * nothing comes. So idle IO tasks don't keep their cores busy, and
+ * can share them with computation or helper threads.
+ *
+ * This must be called before the async IO system is initialized
+ * (PIOc_init_async() and the like), with the same values on all the
+ * IO tasks.
+ *
+ * @param wait PIO_ASYNC_WAIT_BLOCK (the default) or
+ * PIO_ASYNC_WAIT_BACKOFF.
+ * @param max_sleep the longest sleep in microseconds, for
+ * PIO_ASYNC_WAIT_BACKOFF. If 0, PIO_ASYNC_MAX_SLEEP is used.
+ * @returns 0 for success, PIO_EINVAL for bad values.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_async_wait(int wait, int max_sleep)
+{
+    PLOG((1, "PIOc_set_async_wait wait = %d max_sleep = %d", wait, max_sleep));
+
+    if ((wait != PIO_ASYNC_WAIT_BLOCK && wait != PIO_ASYNC_WAIT_BACKOFF) || max_sleep < 0)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    async_wait = wait;
+    async_max_sleep = max_sleep ? max_sleep : PIO_ASYNC_MAX_SLEEP;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Sleep for the current backoff interval of an idle IO task, and
+ * double it, up to async_max_sleep.
+ *
+ * @param sleep_us pointer to the interval in microseconds.
+ * @author Ed Hartnett
+ */
+static void
+async_backoff(int *sleep_us)
+{
+    struct timespec ts;
+
+    ts.tv_sec = *sleep_us / 1000000;
+    ts.tv_nsec = (long)(*sleep_us % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+    *sleep_us = min(2 * *sleep_us, async_max_sleep);
+}
+
+/**
+ * On the IO root, wait for messages from any of the computation
+ * components, as MPI_Waitsome() does, in the way chosen with
+ * PIOc_set_async_wait().
+ *
+ * @param count the number of requests.
+ * @param req the requests.
+ * @param outcount pointer that gets the number of completed
+ * requests.
+ * @param index gets the indices of the completed requests.
+ * @param status gets the status of the completed requests.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+async_waitsome(int count, MPI_Request *req, int *outcount, int *index, MPI_Status *status)
+{
+    int sleep_us = 1;
+    int mpierr;
+
+    if (async_wait == PIO_ASYNC_WAIT_BLOCK)
+    {
+        if ((mpierr = MPI_Waitsome(count, req, outcount, index, status)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        return PIO_NOERR;
+    }
+
+    /* outcount is MPI_UNDEFINED if there are no active requests. */
+    while (1)
+    {
+        if ((mpierr = MPI_Testsome(count, req, outcount, index, status)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        if (*outcount)
+            break;
+        async_backoff(&sleep_us);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Broadcast ints from the IO root to the other IO tasks, when they
+ * may have to wait for them for a long time, in the way chosen with
+ * PIOc_set_async_wait().
+ *
+ * @param buf pointer to the ints.
+ * @param count the number of ints.
+ * @param io_comm the IO communicator.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+async_wait_bcast(int *buf, int count, MPI_Comm io_comm)
+{
+    MPI_Request req;
+    int sleep_us = 1;
+    int flag = 0;
+    int mpierr;
+
+    if (async_wait == PIO_ASYNC_WAIT_BLOCK)
+    {
+        if ((mpierr = MPI_Bcast(buf, count, MPI_INT, 0, io_comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        return PIO_NOERR;
+    }
+
+    if ((mpierr = MPI_Ibcast(buf, count, MPI_INT, 0, io_comm, &req)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    while (1)
+    {
+        if ((mpierr = MPI_Test(&req, &flag, MPI_STATUS_IGNORE)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        if (flag)
+            break;
+        async_backoff(&sleep_us);
+    }
+
+    return PIO_NOERR;
+}
+
 /**
  * This function is called by the IO tasks.  This function will not
  * return, unless there is an error.
@@ -2627,6 +3463,7 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
 {
     iosystem_desc_t *my_iosys;
     int msg = PIO_MSG_NULL, messages[component_count];
+    int ctl[1 + 2 * component_count]; /* outcount, then index and msg of each. */
     MPI_Request req[component_count];
     MPI_Status status[component_count];
     int index[component_count];
@@ -2669,39 +3506,47 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
             for (int c = 0; c < component_count; c++)
                 PLOG((3, "req[%d] = %d", c, req[c]));
 	    //            if ((mpierr = MPI_Waitany(component_count, req, &index, &status))){
-	    if ((mpierr = MPI_Waitsome(component_count, req, &outcount, index, status))){
-                PLOG((0, "Error from mpi_waitsome %d",mpierr));
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+	    if ((ret = async_waitsome(component_count, req, &outcount, index, status))){
+                PLOG((0, "Error from async_waitsome %d", ret));
+                return ret;
             }
 	    for(int c = 0; c < outcount; c++)
 	      PLOG((3, "Waitsome returned index = %d req[%d] = %d", index[c], index[c], req[index[c]]));
 	    //            msg = messages[index];
             for (int c = 0; c < component_count; c++)
                 PLOG((3, "req[%d] = %d", c, req[c]));
+
+            /* Collect the component index and msg of each completed
+             * request. */
+            ctl[0] = outcount;
+            for (int c = 0; c < outcount; c++)
+            {
+                ctl[1 + 2 * c] = index[c];
+                ctl[2 + 2 * c] = messages[index[c]];
+            }
         }
-        if ((mpierr = MPI_Bcast(&outcount, 1, MPI_INT, 0, io_comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        PLOG((3, "outcount MPI_Bcast complete outcount = %d", outcount));
+
+        /* Send the whole batch to the rest of the IO tasks in one
+         * broadcast. The other IO tasks wait here until a message
+         * comes. */
+        if ((ret = async_wait_bcast(ctl, 1 + 2 * component_count, io_comm)))
+            return ret;
+        outcount = ctl[0];
+        PLOG((3, "control MPI_Bcast complete outcount = %d", outcount));
 	
 	for(int creq=0; creq < outcount; creq++)
 	{
-	  int idx = index[creq];
-	  /* Broadcast the index of the computational component that
-	   * originated the request to the rest of the IO tasks. */
-	  PLOG((3, "About to do Bcast of index = %d io_comm = %d", index, io_comm));
-	  if ((mpierr = MPI_Bcast(&idx, 1, MPI_INT, 0, io_comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-	  PLOG((3, "index MPI_Bcast complete index = %d", idx));
-	  msg = messages[idx];
+	  int idx = ctl[1 + 2 * creq];
+	  msg = ctl[2 + 2 * creq];
+	  PLOG((1, "pio_msg_handler2 index = %d msg = %d", idx, msg));
 
 	  /* Set the correct iosys depending on the index. */
 	  my_iosys = iosys[idx];
 
-	  /* Broadcast the msg value to the rest of the IO tasks. */
-	  PLOG((3, "about to call msg MPI_Bcast io_comm = %d", io_comm));
-	  if ((mpierr = MPI_Bcast(&msg, 1, MPI_INT, 0, io_comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-	  PLOG((1, "pio_msg_handler2 msg MPI_Bcast complete msg = %d", msg));
+	  /* Free the finished broadcasts of background syncs and
+	   * closes. */
+	  if ((ret = pio_bg_progress(my_iosys, false)))
+	    return pio_err(my_iosys, NULL, ret, __FILE__, __LINE__);
 
 	  /* Handle the message. This code is run on all IO tasks. */
 	  switch (msg)
@@ -2716,7 +3561,8 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
 	      ret = create_file_handler(my_iosys);
 	      break;
 	    case PIO_MSG_SYNC:
-	      ret = sync_file_handler(my_iosys);
+	    case PIO_MSG_SYNC_BG:
+	      ret = sync_file_handler(my_iosys, msg);
 	      break;
 	    case PIO_MSG_ENDDEF:
 	    case PIO_MSG_REDEF:
@@ -2727,7 +3573,8 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
 	      ret = open_file_handler(my_iosys);
 	      break;
 	    case PIO_MSG_CLOSE_FILE:
-	      ret = close_file_handler(my_iosys);
+	    case PIO_MSG_CLOSE_FILE_BG:
+	      ret = close_file_handler(my_iosys, msg);
 	      break;
 	    case PIO_MSG_DELETE_FILE:
 	      ret = delete_file_handler(my_iosys);
@@ -2753,6 +3600,9 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
 	    case PIO_MSG_DEF_VAR_CHUNKING:
 	      ret = def_var_chunking_handler(my_iosys);
 	      break;
+	    case PIO_MSG_DEF_VAR_CHUNKING_DECOMP:
+	      ret = def_var_chunking_decomp_handler(my_iosys);
+	      break;
 	    case PIO_MSG_DEF_VAR_FILL:
 	      ret = def_var_fill_handler(my_iosys);
 	      break;
@@ -2801,6 +3651,9 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
 	    case PIO_MSG_PUT_ATT:
 	      ret = att_put_handler(my_iosys);
 	      break;
+	    case PIO_MSG_PUT_ATT_BATCH:
+	      ret = att_put_batch_handler(my_iosys);
+	      break;
 	    case PIO_MSG_INQ_VARID:
 	      ret = inq_varid_handler(my_iosys);
 	      break;
@@ -2825,21 +3678,39 @@ int pio_msg_handler2(int io_rank, int component_count, iosystem_desc_t **iosys,
 	    case PIO_MSG_WRITEDARRAYMULTI:
 	      ret = write_darray_multi_handler(my_iosys);
 	      break;
+	    case PIO_MSG_ACCUMULATE_DARRAY:
+	      ret = accumulate_darray_handler(my_iosys);
+	      break;
+	    case PIO_MSG_WRITE_ACCUMULATED:
+	      ret = write_accumulated_handler(my_iosys);
+	      break;
 	    case PIO_MSG_SETFRAME:
 	      ret = setframe_handler(my_iosys);
 	      break;
+	    case PIO_MSG_DEF_VAR_QUANTIZE:
+	      ret = def_var_quantize_handler(my_iosys);
+	      break;
 	    case PIO_MSG_ADVANCEFRAME:
 	      ret = advanceframe_handler(my_iosys);
 	      break;
 	    case PIO_MSG_READDARRAY:
 	      ret = read_darray_handler(my_iosys);
 	      break;
+	    case PIO_MSG_READDARRAYMULTI:
+	      ret = read_darray_multi_handler(my_iosys);
+	      break;
 	    case PIO_MSG_SETERRORHANDLING:
 	      ret = seterrorhandling_handler(my_iosys);
 	      break;
 	    case PIO_MSG_SET_CHUNK_CACHE:
 	      ret = set_chunk_cache_handler(my_iosys);
 	      break;
+	    case PIO_MSG_SET_AUTO_CHUNK_CACHE:
+	      ret = set_auto_chunk_cache_handler(my_iosys);
+	      break;
+	    case PIO_MSG_SET_PAR_ACCESS:
+	      ret = set_par_access_handler(my_iosys);
+	      break;
 	    case PIO_MSG_GET_CHUNK_CACHE:
 	      ret = get_chunk_cache_handler(my_iosys);
 	      break;
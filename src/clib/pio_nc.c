@@ -103,7 +103,7 @@ PIOc_inq(int ncid, int *ndimsp, int *nvarsp, int *ngattsp, int *unlimdimidp)
     PLOG((1, "PIOc_inq ncid = %d", ncid));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -300,7 +300,7 @@ PIOc_inq_unlimdims(int ncid, int *nunlimdimsp, int *unlimdimidsp)
     PLOG((1, "PIOc_inq_unlimdims ncid = %d", ncid));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -436,7 +436,7 @@ PIOc_inq_type(int ncid, nc_type xtype, char *name, PIO_Offset *sizep)
     PLOG((1, "PIOc_inq_type ncid = %d xtype = %d", ncid, xtype));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -526,7 +526,7 @@ PIOc_inq_format(int ncid, int *formatp)
     PLOG((1, "PIOc_inq ncid = %d", ncid));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -611,7 +611,7 @@ PIOc_inq_dim(int ncid, int dimid, char *name, PIO_Offset *lenp)
     PLOG((1, "PIOc_inq_dim ncid = %d dimid = %d", ncid, dimid));
 
     /* Get the file info, based on the ncid. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -752,7 +752,7 @@ PIOc_inq_dimid(int ncid, const char *name, int *idp)
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Get the file info, based on the ncid. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
     PLOG((2, "iosysid = %d", ios->iosysid));
@@ -857,7 +857,7 @@ PIOc_inq_var(int ncid, int varid, char *name, nc_type *xtypep, int *ndimsp,
     PLOG((1, "PIOc_inq_var ncid = %d varid = %d", ncid, varid));
 
     /* Get the file info, based on the ncid. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1109,7 +1109,7 @@ PIOc_inq_varid(int ncid, const char *name, int *varidp)
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Get file info based on ncid. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1202,7 +1202,7 @@ PIOc_inq_att_eh(int ncid, int varid, const char *name, int eh,
     int ierr;
 
     /* Find file based on ncid. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1370,7 +1370,7 @@ PIOc_inq_attname(int ncid, int varid, int attnum, char *name)
           attnum));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1463,7 +1463,7 @@ PIOc_inq_attid(int ncid, int varid, const char *name, int *idp)
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1557,7 +1557,7 @@ PIOc_rename_dim(int ncid, int dimid, const char *name)
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1611,11 +1611,9 @@ PIOc_rename_dim(int ncid, int dimid, const char *name)
         PLOG((2, "PIOc_inq netcdf call returned %d", ierr));
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -1646,7 +1644,7 @@ PIOc_rename_var(int ncid, int varid, const char *name)
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1700,11 +1698,9 @@ PIOc_rename_var(int ncid, int varid, const char *name)
         PLOG((2, "PIOc_inq netcdf call returned %d", ierr));
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -1737,7 +1733,7 @@ PIOc_rename_att(int ncid, int varid, const char *name,
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1794,11 +1790,9 @@ PIOc_rename_att(int ncid, int varid, const char *name,
             ierr = nc_rename_att(file->fh, varid, name, newname);
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     PLOG((2, "PIOc_rename_att succeeded"));
     return PIO_NOERR;
@@ -1829,7 +1823,7 @@ PIOc_del_att(int ncid, int varid, const char *name)
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1879,11 +1873,9 @@ PIOc_del_att(int ncid, int varid, const char *name)
             ierr = nc_del_att(file->fh, varid, name);
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -1915,7 +1907,7 @@ PIOc_set_fill(int ncid, int fillmode, int *old_modep)
     PLOG((1, "PIOc_set_fill ncid = %d fillmode = %d", ncid, fillmode));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -1968,6 +1960,7 @@ PIOc_set_fill(int ncid, int fillmode, int *old_modep)
         return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
     if (ierr)
         return check_netcdf(file, ierr, __FILE__, __LINE__);
+    file->fill_mode = fillmode;
 
     /* Broadcast results. */
     if (old_modep)
@@ -1998,7 +1991,46 @@ PIOc_set_fill(int ncid, int fillmode, int *old_modep)
 int
 PIOc_enddef(int ncid)
 {
-    return pioc_change_def(ncid, 1);
+    return pioc_change_def(ncid, 1, NULL);
+}
+
+/**
+ * End define mode, reserving free space in the header and aligning
+ * the data, as nc__enddef() and ncmpi__enddef() do. Space reserved
+ * in the header lets attributes and variables be added later (after
+ * PIOc_redef()) without moving all the data of the file, which is
+ * very slow for large files.
+ *
+ * A negative value (such as PIO_DEFAULT) asks for the default:
+ * h_minfree reserves PIO_HEADER_ATT_BYTES for each attribute in the
+ * file; v_align is the stripe size set with PIOc_set_stripe_align(),
+ * if any; v_minfree is 0; other alignments are those of the
+ * library. The values are ignored for netCDF-4 files.
+ *
+ * This routine is called collectively by all tasks in the communicator
+ * ios.union_comm.
+ *
+ * @param ncid the ncid of the open file, obtained from
+ * PIOc_openfile() or PIOc_createfile().
+ * @param h_minfree the free space in bytes to leave at the end of
+ * the header.
+ * @param v_align the alignment in bytes of the start of the fixed
+ * size variables.
+ * @param v_minfree the free space in bytes to leave after the fixed
+ * size variables.
+ * @param r_align the alignment in bytes of the start of the record
+ * variables.
+ * @return PIO_NOERR for success, error code otherwise.
+ * @ingroup PIO_enddef_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_enddef_align(int ncid, PIO_Offset h_minfree, PIO_Offset v_align, PIO_Offset v_minfree,
+                  PIO_Offset r_align)
+{
+    PIO_Offset align[PIO_ENDDEF_NALIGN] = {h_minfree, v_align, v_minfree, r_align};
+
+    return pioc_change_def(ncid, 1, align);
 }
 
 /**
@@ -2018,7 +2050,7 @@ PIOc_enddef(int ncid)
 int
 PIOc_redef(int ncid)
 {
-    return pioc_change_def(ncid, 0);
+    return pioc_change_def(ncid, 0, NULL);
 }
 
 /**
@@ -2047,7 +2079,7 @@ PIOc_def_dim(int ncid, const char *name, PIO_Offset len, int *idp)
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -2064,19 +2096,24 @@ PIOc_def_dim(int ncid, const char *name, PIO_Offset len, int *idp)
         {
             int msg = PIO_MSG_DEF_DIM;
             int namelen = strlen(name);
+            pio_msg_args args;
 
             if (ios->compmaster == MPI_ROOT)
                 mpierr = MPI_Send(&msg, 1,MPI_INT, ios->ioroot, 1, ios->union_comm);
 
+            /* Send all the parameters in one message. */
+            pio_msg_args_init(&args, ios);
             if (!mpierr)
-                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-
+                mpierr = pio_msg_args_pack(&args, &ncid, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&namelen, 1, MPI_INT,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &namelen, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast((void *)name, namelen + 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, name, namelen + 1, MPI_CHAR);
             if (!mpierr)
-                mpierr = MPI_Bcast(&len, 1, MPI_INT,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &len, 1, MPI_OFFSET);
+            if (!mpierr)
+                mpierr = pio_msg_args_send(ios, &args);
+            pio_msg_args_free(&args);
         }
 
 
@@ -2099,11 +2136,9 @@ PIOc_def_dim(int ncid, const char *name, PIO_Offset len, int *idp)
             ierr = nc_def_dim(file->fh, name, (size_t)len, idp);
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     /* Broadcast results to all tasks. Ignore NULL parameters. */
     if (idp)
@@ -2140,22 +2175,25 @@ PIOc_def_var(int ncid, const char *name, nc_type xtype, int ndims,
     iosystem_desc_t *ios;      /* Pointer to io system information. */
     file_desc_t *file;         /* Pointer to file information. */
     int invalid_unlim_dim = 0; /* True invalid dims are used. */
-    int varid;                 /* The varid of the created var. */
+    int varid = -1;            /* The varid of the created var. */
     int rec_var = 0;           /* Non-zero if this var uses unlimited dim. */
     PIO_Offset pio_type_size;  /* Size of pio type in bytes. */
     MPI_Datatype mpi_type;     /* The correspoding MPI type. */
     int mpi_type_size;         /* Size of mpi type. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
     int ierr;                  /* Return code from function calls. */
+    int res[2];                /* The varid and return code of the IO root. */
 
     /* Get the file information. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
-    /* User must provide name. */
+    /* User must provide name, and the dimids. */
     if (!name || strlen(name) > NC_MAX_NAME)
         return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    if (ndims < 0 || ndims > PIO_MAX_DIMS || (ndims && !dimidsp))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
 
     PLOG((1, "PIOc_def_var ncid = %d name = %s xtype = %d ndims = %d", ncid, name,
           xtype, ndims));
@@ -2230,21 +2268,28 @@ PIOc_def_var(int ncid, const char *name, nc_type xtype, int ndims,
             int msg = PIO_MSG_DEF_VAR;
             int namelen = strlen(name);
 
+            pio_msg_args args;
+
             if (ios->compmaster == MPI_ROOT)
                 mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
 
+            /* Send all the parameters in one message. */
+            pio_msg_args_init(&args, ios);
             if (!mpierr)
-                mpierr = MPI_Bcast(&(ncid), 1, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &ncid, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&namelen, 1, MPI_INT,  ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &namelen, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast((void *)name, namelen + 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, name, namelen + 1, MPI_CHAR);
             if (!mpierr)
-                mpierr = MPI_Bcast(&xtype, 1, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, &xtype, 1, MPI_INT);
+            if (!mpierr)
+                mpierr = pio_msg_args_pack(&args, &ndims, 1, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast(&ndims, 1, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_pack(&args, dimidsp, ndims, MPI_INT);
             if (!mpierr)
-                mpierr = MPI_Bcast((void *)dimidsp, ndims, MPI_INT, ios->compmaster, ios->intercomm);
+                mpierr = pio_msg_args_send(ios, &args);
+            pio_msg_args_free(&args);
         }
 
         /* Handle MPI errors. */
@@ -2287,18 +2332,31 @@ PIOc_def_var(int ncid, const char *name, nc_type xtype, int ndims,
         /* For netCDF-4 parallel files, set parallel access to collective. */
         if (!ierr && file->iotype == PIO_IOTYPE_NETCDF4P)
             ierr = nc_var_par_access(file->fh, varid, NC_COLLECTIVE);
+
+        /* Compress the variable, if asked. */
+        if (!ierr && file->compression && ndims && file->do_io)
+            ierr = pio_def_var_compression(file, varid);
 #endif /* _NETCDF4 */
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* The varid and the error of the IO root, which is kept there if
+     * it is deferred. */
+    res[0] = varid;
+    res[1] = ierr;
+
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     /* Broadcast results. */
-    if ((mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Bcast(res, 2, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    varid = res[0];
+
+    /* If a deferred error left no variable, there is no varid to
+     * return, so the error is returned now. */
+    if (varid < 0)
+        return check_netcdf(file, res[1] ? res[1] : PIO_EINVAL, __FILE__, __LINE__);
     if (varidp)
         *varidp = varid;
 
@@ -2352,7 +2410,7 @@ PIOc_def_var_fill(int ncid, int varid, int fill_mode, const void *fill_valuep)
           fill_mode));
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -2442,11 +2500,9 @@ PIOc_def_var_fill(int ncid, int varid, int fill_mode, const void *fill_valuep)
         PLOG((2, "after def_var_fill ierr = %d", ierr));
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -2484,7 +2540,7 @@ PIOc_inq_var_fill(int ncid, int varid, int *no_fill, void *fill_valuep)
     PLOG((1, "PIOc_inq_var_fill ncid = %d varid = %d", ncid, varid));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
     PLOG((2, "found file"));
@@ -2666,7 +2722,7 @@ PIOc_get_att(int ncid, int varid, const char *name, void *ip)
     nc_type atttype;       /* The type of the attribute. */
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
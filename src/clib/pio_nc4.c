@@ -8,6 +8,63 @@
 #include <pio.h>
 #include <pio_internal.h>
 
+/**
+ * Turn on the compression of a file (see PIOc_set_compression()) for
+ * a variable, just after it has been defined. This is called by
+ * PIOc_def_var() on the tasks which do IO for the file.
+ *
+ * With PIO_IOTYPE_NETCDF4P, nothing is done unless netCDF supports
+ * filters with parallel I/O.
+ *
+ * @param file pointer to the file info.
+ * @param varid the ID of the variable.
+ * @return PIO_NOERR for success, otherwise an error code.
+ * @author Ed Hartnett
+ */
+int
+pio_def_var_compression(file_desc_t *file, int varid)
+{
+    int level = file->compression_level;
+    int ierr = PIO_NOERR;
+
+    pioassert(file && file->do_io, "invalid input", __FILE__, __LINE__);
+
+#ifndef HAVE_PAR_FILTERS
+    if (file->iotype == PIO_IOTYPE_NETCDF4P)
+    {
+        PLOG((2, "no parallel filters, varid %d not compressed", varid));
+        return PIO_NOERR;
+    }
+#endif /* HAVE_PAR_FILTERS */
+
+    PLOG((2, "pio_def_var_compression varid %d compression %d level %d", varid,
+          file->compression, level));
+
+#ifdef _NETCDF4
+    switch (file->compression)
+    {
+    case PIO_COMPRESS_ZLIB:
+        ierr = nc_def_var_deflate(file->fh, varid, 1, 1, level ? level : 1);
+        break;
+#if defined(NC_HAS_SZIP_WRITE) && NC_HAS_SZIP_WRITE
+    case PIO_COMPRESS_SZIP:
+        ierr = nc_def_var_szip(file->fh, varid, NC_SZIP_NN, level ? level : 32);
+        break;
+#endif
+#if defined(NC_HAS_ZSTD) && NC_HAS_ZSTD
+    case PIO_COMPRESS_ZSTD:
+        if (!(ierr = nc_def_var_deflate(file->fh, varid, 1, 0, 0)))
+            ierr = nc_def_var_zstandard(file->fh, varid, level ? level : 3);
+        break;
+#endif
+    default:
+        ierr = PIO_ENOTBUILT;
+    }
+#endif /* _NETCDF4 */
+
+    return ierr;
+}
+
 /**
  * Set deflate (zlib) settings for a variable.
  *
@@ -40,7 +97,7 @@ PIOc_def_var_deflate(int ncid, int varid, int shuffle, int deflate,
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -88,11 +145,9 @@ PIOc_def_var_deflate(int ncid, int varid, int shuffle, int deflate,
 #endif
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -131,7 +186,7 @@ PIOc_inq_var_deflate(int ncid, int varid, int *shufflep, int *deflatep,
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -247,7 +302,7 @@ PIOc_def_var_chunking(int ncid, int varid, int storage, const PIO_Offset *chunks
           varid, storage));
 
     /* Find the info about this file. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -326,11 +381,208 @@ PIOc_def_var_chunking(int ncid, int varid, int storage, const PIO_Offset *chunks
 #endif
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find chunksizes which match the IO regions of a decomposition. This
+ * is collective over the IO tasks.
+ *
+ * The first IO region of each IO task is used (the box rearranger has
+ * only one). In each dimension, the chunksize is the greatest common
+ * divisor of the starts and ends of the regions (other than the end
+ * of the dimension), so that no chunk is written by more than one IO
+ * task. If that is less than a quarter of the smallest count, the
+ * regions don't line up; the smallest count is used instead, to
+ * avoid tiny chunks, and a chunk is then written by at most two IO
+ * tasks along each dimension, since it is no longer than any region.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param iodesc pointer to the decomposition.
+ * @param chunksizes array of length iodesc->ndims that gets the
+ * chunksizes.
+ * @return PIO_NOERR for success, otherwise an error code.
+ * @author Ed Hartnett
+ */
+static int
+decomp_chunksizes(iosystem_desc_t *ios, io_desc_t *iodesc, PIO_Offset *chunksizes)
+{
+    int ndims = iodesc->ndims;
+    PIO_Offset mine[2 * ndims];  /* Start and count of the first region here. */
+    PIO_Offset *all;
+    int mpierr;
+
+    for (int d = 0; d < ndims; d++)
+    {
+        mine[d] = iodesc->firstregion ? iodesc->firstregion->start[d] : 0;
+        mine[ndims + d] = iodesc->firstregion ? iodesc->firstregion->count[d] : 0;
+    }
+
+    if (!(all = malloc(2 * ndims * ios->num_iotasks * sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if ((mpierr = MPI_Allgather(mine, 2 * ndims, MPI_OFFSET, all, 2 * ndims, MPI_OFFSET,
+                                ios->io_comm)))
+    {
+        free(all);
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    for (int d = 0; d < ndims; d++)
+    {
+        PIO_Offset g = 0, mincount = 0;
+
+        for (int t = 0; t < ios->num_iotasks; t++)
+        {
+            PIO_Offset *start = &all[2 * ndims * t], *count = start + ndims;
+            PIO_Offset size = 1;
+
+            /* Tasks with no data don't matter. */
+            for (int e = 0; e < ndims; e++)
+                size *= count[e];
+            if (!size)
+                continue;
+
+            /* A chunk may run past the end of the dimension. */
+            for (int k = 0; k < 2; k++)
+            {
+                PIO_Offset a = k ? start[d] + count[d] : start[d];
+
+                if (k && a == iodesc->dimlen[d])
+                    continue;
+                while (a)
+                {
+                    PIO_Offset tmp = g % a;
+                    g = a;
+                    a = tmp;
+                }
+            }
+            mincount = mincount ? min(mincount, count[d]) : count[d];
+        }
+
+        if (!g)
+            chunksizes[d] = mincount ? mincount : iodesc->dimlen[d];
+        else
+            chunksizes[d] = 4 * g < mincount ? mincount : g;
+        PLOG((3, "decomp_chunksizes d %d gcd %lld mincount %lld chunksize %lld", d, g,
+              mincount, chunksizes[d]));
+    }
+    free(all);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set the chunksizes of a variable from a decomposition, so that the
+ * chunks match the data that each IO task writes with
+ * PIOc_write_darray() through that decomposition. Chunks which are
+ * written by more than one IO task are much slower to write, with
+ * parallel HDF5.
+ *
+ * The variable must have the dimensions of the decomposition,
+ * optionally preceded by the unlimited dimension, which gets a
+ * chunksize of 1. The chunksizes are the largest that each IO task
+ * writes whole chunks of, see decomp_chunksizes().
+ *
+ * This function only applies to netCDF-4 files. When used with netCDF
+ * classic files, the error PIO_ENOTNC4 will be returned. Like
+ * PIOc_def_var_chunking(), it must be called in define mode.
+ *
+ * @param ncid the ncid of the open file.
+ * @param varid the ID of the variable to set chunksizes for.
+ * @param ioid the ID of the decomposition the variable will be
+ * written with.
+ * @return PIO_NOERR for success, otherwise an error code.
+ * @ingroup PIO_def_var_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_def_var_chunking_decomp(int ncid, int varid, int ioid)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    io_desc_t *iodesc;     /* The decomposition. */
+    var_desc_t *vdesc;     /* The variable. */
+    int ierr = PIO_NOERR;  /* Return code from function calls. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    PLOG((1, "PIOc_def_var_chunking_decomp ncid = %d varid = %d ioid = %d", ncid,
+          varid, ioid));
+
+    /* Find the info about this file. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Only netCDF-4 files can use this feature. */
+    if (file->iotype != PIO_IOTYPE_NETCDF4P && file->iotype != PIO_IOTYPE_NETCDF4C)
+        return pio_err(ios, file, PIO_ENOTNC4, __FILE__, __LINE__);
+
+    /* Get the decomposition and the variable. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, file, PIO_EBADID, __FILE__, __LINE__);
+    if (get_file_var_desc(file, varid, &vdesc))
+        return pio_err(ios, file, PIO_ENOTVAR, __FILE__, __LINE__);
+
+    /* The variable must have the dimensions of the decomposition. */
+    if (vdesc->ndims != iodesc->ndims &&
+        !(vdesc->rec_var && vdesc->ndims == iodesc->ndims + 1))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_DEF_VAR_CHUNKING_DECOMP;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+
+    /* If this is an IO task, find the chunksizes and call the netCDF
+     * function. */
+    if (ios->ioproc)
+    {
+        PIO_Offset chunksizes[vdesc->ndims];
+        int nrec = vdesc->ndims - iodesc->ndims;
+
+        chunksizes[0] = 1;
+        if (!(ierr = decomp_chunksizes(ios, iodesc, &chunksizes[nrec])))
+        {
+#ifdef _NETCDF4
+            if (file->do_io)
+            {
+                size_t chunksizes_sizet[vdesc->ndims];
+
+                for (int d = 0; d < vdesc->ndims; d++)
+                    chunksizes_sizet[d] = chunksizes[d];
+                ierr = nc_def_var_chunking(file->fh, varid, NC_CHUNKED, chunksizes_sizet);
+            }
+#endif
+        }
+    }
+
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -369,7 +621,7 @@ PIOc_inq_var_chunking(int ncid, int varid, int *storagep, PIO_Offset *chunksizes
     PLOG((1, "PIOc_inq_var_chunking ncid = %d varid = %d"));
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -497,7 +749,7 @@ PIOc_def_var_endian(int ncid, int varid, int endian)
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -537,11 +789,9 @@ PIOc_def_var_endian(int ncid, int varid, int endian)
 #endif
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -576,7 +826,7 @@ PIOc_inq_var_endian(int ncid, int varid, int *endianp)
     PLOG((1, "PIOc_inq_var_endian ncid = %d varid = %d"));
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -730,6 +980,247 @@ PIOc_set_chunk_cache(int iosysid, int iotype, PIO_Offset size, PIO_Offset nelems
     return PIO_NOERR;
 }
 
+/**
+ * Turn on the automatic sizing of the chunk caches of the variables
+ * of PIO_IOTYPE_NETCDF4P files. The first time a variable is read or
+ * written with a decomposition, each IO task sets the chunk cache of
+ * the variable large enough to hold all the chunks that its IO
+ * regions touch, but not larger than max_size. Chunk caches are never
+ * made smaller than they already are.
+ *
+ * The default chunk caches are often too small for the chunks that an
+ * IO task touches in a 3D variable, so that chunks are evicted and
+ * read again many times.
+ *
+ * @param iosysid the IO system ID.
+ * @param max_size the largest chunk cache, in bytes, to set on an IO
+ * task for one variable, or 0 to turn off automatic sizing.
+ * @return PIO_NOERR for success, otherwise an error code.
+ * @ingroup PIO_set_chunk_cache_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_auto_chunk_cache(int iosysid, PIO_Offset max_size)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    PLOG((1, "PIOc_set_auto_chunk_cache iosysid = %d max_size = %lld", iosysid,
+          max_size));
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (max_size < 0)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_AUTO_CHUNK_CACHE; /* Message for async notification. */
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&max_size, 1, MPI_OFFSET, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    ios->auto_chunk_cache = max_size;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set the chunk cache of a variable from the IO regions of a
+ * decomposition on this IO task, if PIOc_set_auto_chunk_cache() is
+ * in use. This is done once for each variable and decomposition. It
+ * is called on all IO tasks, before the data of the variable are
+ * read or written.
+ *
+ * The cache is made large enough for all the chunks touched by the
+ * regions of any IO task, one record at a time, bounded by
+ * ios->auto_chunk_cache. Regions that share chunks are counted
+ * more than once, which only makes the cache larger. Setting the
+ * cache reopens the dataset, which is collective in HDF5, so all IO
+ * tasks use the same size, the largest any of them needs.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param varid the ID of the variable.
+ * @return PIO_NOERR for success, otherwise an error code.
+ * @author Ed Hartnett
+ */
+int
+pio_auto_chunk_cache(file_desc_t *file, io_desc_t *iodesc, int varid)
+{
+    iosystem_desc_t *ios;
+    var_desc_t *vdesc;
+    int ierr;
+
+    pioassert(file && file->iosystem && iodesc, "invalid input", __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if (!ios->auto_chunk_cache || file->iotype != PIO_IOTYPE_NETCDF4P)
+        return PIO_NOERR;
+    if ((ierr = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(ios, file, ierr, __FILE__, __LINE__);
+
+    /* Only do this once for each decomposition. */
+    if (vdesc->cache_ioid == iodesc->ioid)
+        return PIO_NOERR;
+    vdesc->cache_ioid = iodesc->ioid;
+
+#ifdef _NETCDF4
+    {
+        int nrec = vdesc->ndims - iodesc->ndims;  /* Leading dims not in the decomposition. */
+        size_t chunksizes[vdesc->ndims];
+        size_t cur_size, cur_nelems;
+        float preemption;
+        PIO_Offset chunk_bytes = vdesc->pio_type_size;
+        PIO_Offset nchunks = 0;
+        PIO_Offset size;
+        int storage;
+        int mpierr;
+
+        if (nrec < 0)
+            return PIO_NOERR;
+        if ((ierr = nc_inq_var_chunking(file->fh, varid, &storage, chunksizes)))
+            return check_netcdf(file, ierr, __FILE__, __LINE__);
+        if (storage != NC_CHUNKED)
+            return PIO_NOERR;
+
+        /* Find the size of a chunk and the number of chunks that the
+         * regions of this task touch. */
+        for (int d = 0; d < vdesc->ndims; d++)
+            chunk_bytes *= chunksizes[d];
+        for (io_region *region = iodesc->firstregion; region; region = region->next)
+        {
+            PIO_Offset n = 1;
+
+            for (int d = 0; d < iodesc->ndims; d++)
+            {
+                size_t cs = chunksizes[nrec + d];
+
+                if (!region->count[d])
+                    n = 0;
+                else
+                    n *= (region->start[d] + region->count[d] - 1) / cs -
+                        region->start[d] / cs + 1;
+            }
+            nchunks += n;
+        }
+
+        /* All IO tasks use the largest number of chunks. */
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &nchunks, 1, MPI_OFFSET, MPI_MAX,
+                                    ios->io_comm)))
+            return check_mpi(ios, file, mpierr, __FILE__, __LINE__);
+        if (!nchunks)
+            return PIO_NOERR;
+        size = min(nchunks * chunk_bytes, ios->auto_chunk_cache);
+        PLOG((2, "pio_auto_chunk_cache varid %d ioid %d nchunks %lld chunk_bytes %lld "
+              "size %lld", varid, iodesc->ioid, nchunks, chunk_bytes, size));
+
+        /* Only make the cache larger. The number of hash slots should
+         * be well above the number of chunks. */
+        if ((ierr = nc_get_var_chunk_cache(file->fh, varid, &cur_size, &cur_nelems,
+                                           &preemption)))
+            return check_netcdf(file, ierr, __FILE__, __LINE__);
+        if ((size_t)size > cur_size)
+            if ((ierr = nc_set_var_chunk_cache(file->fh, varid, size,
+                                               max(cur_nelems, (size_t)(10 * nchunks + 1)),
+                                               preemption)))
+                return check_netcdf(file, ierr, __FILE__, __LINE__);
+    }
+#endif /* _NETCDF4 */
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set the parallel access mode that darrays are written to a
+ * PIO_IOTYPE_NETCDF4P file with. By default all writes are
+ * collective. With independent access each IO task writes its own
+ * regions without waiting for the others, and IO tasks with fewer
+ * regions than others do not make empty writes. This is much faster
+ * when IO tasks write many small disjoint regions. HDF5 metadata is
+ * still written collectively.
+ *
+ * HDF5 can only extend datasets and run filters collectively, so
+ * record vars, and vars with any filter (such as compression from
+ * PIOc_set_compression() or PIOc_def_var_deflate(), shuffle or
+ * checksums, including those of files that are opened), are always
+ * written collectively.
+ *
+ * This has no effect for PIO_IOTYPE_NETCDF4C files.
+ *
+ * @param ncid the ncid of the open file.
+ * @param par_access PIO_INDEPENDENT or PIO_COLLECTIVE.
+ * @return PIO_NOERR for success, otherwise an error code.
+ * @ingroup PIO_write_darray_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_par_access(int ncid, int par_access)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    int ierr;              /* Return code from function calls. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+
+    PLOG((1, "PIOc_set_par_access ncid = %d par_access = %d", ncid, par_access));
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Only netCDF-4 files can use this feature. */
+    if (file->iotype != PIO_IOTYPE_NETCDF4P && file->iotype != PIO_IOTYPE_NETCDF4C)
+        return pio_err(ios, file, PIO_ENOTNC4, __FILE__, __LINE__);
+    if (par_access != PIO_INDEPENDENT && par_access != PIO_COLLECTIVE)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_SET_PAR_ACCESS;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&par_access, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+
+    file->independent = par_access == PIO_INDEPENDENT;
+
+    return PIO_NOERR;
+}
+
 /**
  * Get current file chunk cache settings from HDF5.
  *
@@ -891,7 +1382,7 @@ PIOc_set_var_chunk_cache(int ncid, int varid, PIO_Offset size, PIO_Offset nelems
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
@@ -936,11 +1427,9 @@ PIOc_set_var_chunk_cache(int ncid, int varid, PIO_Offset size, PIO_Offset nelems
 #endif
     }
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
+    /* Broadcast and check the return code, unless it is deferred. */
+    if ((ierr = check_netcdf_deferred(file, ierr, __FILE__, __LINE__)))
+        return ierr;
 
     return PIO_NOERR;
 }
@@ -980,7 +1469,7 @@ PIOc_get_var_chunk_cache(int ncid, int varid, PIO_Offset *sizep, PIO_Offset *nel
     PLOG((1, "PIOc_get_var_chunk_cache ncid = %d varid = %d"));
 
     /* Get the file info. */
-    if ((ierr = pio_get_file(ncid, &file)))
+    if ((ierr = pio_get_file_open(ncid, &file)))
         return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
     ios = file->iosystem;
 
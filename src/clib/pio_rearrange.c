@@ -4,9 +4,11 @@
   *
   * @author Jim Edwards
   */
+#define PIO_LOG_SUBSYS PIO_LOG_REARR
 #include <config.h>
 #include <pio_internal.h>
 #include <pio.h>
+#include <uthash.h>
 
 #if PIO_USE_MPISERIAL
 #define MPI_Type_create_hvector MPI_Type_hvector
@@ -264,6 +266,246 @@ compute_maxIObuffersize(MPI_Comm io_comm, io_desc_t *iodesc)
     return PIO_NOERR;
 }
 
+/**
+ * Add some bytes to an FNV-1a hash.
+ *
+ * @param h the hash so far.
+ * @param data pointer to the bytes.
+ * @param len number of bytes.
+ * @returns the new hash.
+ * @author Ed Hartnett
+ */
+static unsigned long long
+fnv_hash(unsigned long long h, const void *data, size_t len)
+{
+    const unsigned char *c = data;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= c[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+/**
+ * An entry of the cache of the derived MPI datatypes created by
+ * create_mpi_datatypes(). Decompositions with the same layout get
+ * the same committed datatypes.
+ */
+typedef struct type_cache_entry
+{
+    /** The hash of the basetype, blocksize and displacements. */
+    unsigned long long hash;
+
+    /** The base type, blocksize, number of blocks and block
+     * displacements of the indexed type. */
+    MPI_Datatype basetype;
+    int blocksize;
+    int len;
+    int *displace;
+
+    /** The committed datatype. */
+    MPI_Datatype type;
+
+    /** Number of users of the datatype. */
+    int refcount;
+
+    /** Next entry with the same hash. */
+    struct type_cache_entry *next;
+
+    /** Hash table entries, by hash and by type. */
+    UT_hash_handle hh;
+    UT_hash_handle hh_type;
+} type_cache_entry;
+
+/** The cache of datatypes, by hash. */
+static type_cache_entry *type_cache = NULL;
+
+/** The cache of datatypes, by type. */
+static type_cache_entry *type_cache_by_type = NULL;
+
+#if PIO_THREADS
+/** Lock of the datatype cache. */
+static pthread_rwlock_t type_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+
+/**
+ * Get a committed indexed datatype with constant-sized blocks from
+ * the datatype cache, creating it if it is not there. The datatype
+ * must be released with free_mpi_datatype(). The caller holds the
+ * lock of the datatype cache.
+ *
+ * @param basetype the MPI type of the data.
+ * @param len the number of blocks.
+ * @param blocksize the number of elements in each block.
+ * @param displace array (length len) of the block displacements.
+ * @param type pointer that gets the datatype.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+cache_datatype(MPI_Datatype basetype, int len, int blocksize, const int *displace,
+               MPI_Datatype *type)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    type_cache_entry *head, *e;
+    int mpierr;
+
+    hash = fnv_hash(hash, &basetype, sizeof(MPI_Datatype));
+    hash = fnv_hash(hash, &blocksize, sizeof(int));
+    hash = fnv_hash(hash, displace, len * sizeof(int));
+
+    /* Is the datatype already there? */
+    HASH_FIND(hh, type_cache, &hash, sizeof(hash), head);
+    for (e = head; e; e = e->next)
+        if (e->basetype == basetype && e->blocksize == blocksize && e->len == len &&
+            !memcmp(e->displace, displace, len * sizeof(int)))
+        {
+            PLOG((3, "get_cached_datatype found type len = %d blocksize = %d refcount = %d",
+                  len, blocksize, e->refcount));
+            e->refcount++;
+            *type = e->type;
+            return PIO_NOERR;
+        }
+
+    /* Create an indexed datatype with constant-sized blocks. */
+    PLOG((2, "calling MPI_Type_create_indexed_block len = %d blocksize = %d "
+          "basetype = %d", len, blocksize, basetype));
+    if ((mpierr = MPI_Type_create_indexed_block(len, blocksize, displace, basetype, type)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if (*type == PIO_DATATYPE_NULL)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Commit the MPI data type. */
+    if ((mpierr = MPI_Type_commit(type)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Add it to the cache. */
+    if (!(e = calloc(1, sizeof(type_cache_entry))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(e->displace = malloc(len * sizeof(int))))
+    {
+        free(e);
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    memcpy(e->displace, displace, len * sizeof(int));
+    e->hash = hash;
+    e->basetype = basetype;
+    e->blocksize = blocksize;
+    e->len = len;
+    e->type = *type;
+    e->refcount = 1;
+    if (head)
+    {
+        e->next = head->next;
+        head->next = e;
+    }
+    else
+        HASH_ADD(hh, type_cache, hash, sizeof(hash), e);
+    HASH_ADD(hh_type, type_cache_by_type, type, sizeof(MPI_Datatype), e);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Release a datatype, for free_mpi_datatype(). The caller holds the
+ * lock of the datatype cache.
+ *
+ * @param type pointer to the datatype. Gets PIO_DATATYPE_NULL.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+uncache_datatype(MPI_Datatype *type)
+{
+    type_cache_entry *e;
+    int mpierr;
+
+    HASH_FIND(hh_type, type_cache_by_type, type, sizeof(MPI_Datatype), e);
+    if (e && --e->refcount > 0)
+    {
+        *type = PIO_DATATYPE_NULL;
+        return PIO_NOERR;
+    }
+
+    /* Take the last user's datatype out of the cache. */
+    if (e)
+    {
+        type_cache_entry *head;
+
+        HASH_DELETE(hh_type, type_cache_by_type, e);
+        HASH_FIND(hh, type_cache, &e->hash, sizeof(e->hash), head);
+        if (head == e)
+        {
+            HASH_DELETE(hh, type_cache, e);
+            if (e->next)
+                HASH_ADD(hh, type_cache, hash, sizeof(e->next->hash), e->next);
+        }
+        else
+        {
+            while (head->next != e)
+                head = head->next;
+            head->next = e->next;
+        }
+        free(e->displace);
+        free(e);
+    }
+
+    if ((mpierr = MPI_Type_free(type)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get a datatype from the datatype cache, see cache_datatype().
+ *
+ * @param basetype the MPI type of the data.
+ * @param len the number of blocks.
+ * @param blocksize the number of elements in each block.
+ * @param displace array (length len) of the block displacements.
+ * @param type pointer that gets the datatype.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+get_cached_datatype(MPI_Datatype basetype, int len, int blocksize, const int *displace,
+                    MPI_Datatype *type)
+{
+    int ret;
+
+    pio_wrlock(&type_cache_lock);
+    ret = cache_datatype(basetype, len, blocksize, displace, type);
+    pio_unlock(&type_cache_lock);
+
+    return ret;
+}
+
+/**
+ * Release a datatype created by create_mpi_datatypes(). The datatype
+ * is freed when it has no other users. Datatypes that are not in the
+ * datatype cache are freed.
+ *
+ * @param type pointer to the datatype. Gets PIO_DATATYPE_NULL.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+free_mpi_datatype(MPI_Datatype *type)
+{
+    int ret;
+
+    pioassert(type, "invalid input", __FILE__, __LINE__);
+
+    pio_wrlock(&type_cache_lock);
+    ret = uncache_datatype(type);
+    pio_unlock(&type_cache_lock);
+
+    return ret;
+}
+
 /**
  * Create the derived MPI datatypes used for comp2io and io2comp
  * transfers. Used in define_iodesc_datatypes().
@@ -277,19 +519,20 @@ compute_maxIObuffersize(MPI_Comm io_comm, io_desc_t *iodesc)
  * @param mfrom A pointer to the previous structure in the read/write
  * list. This is always NULL for the BOX rearranger.
  * @param mtype pointer to an array (length msgcnt) which gets the
- * created datatypes. Will be NULL when iodesc->nrecvs == 0.
+ * created datatypes. Will be NULL when iodesc->nrecvs == 0. The
+ * datatypes come from the datatype cache, and must be released with
+ * free_mpi_datatype().
  * @returns 0 on success, error code otherwise.
  * @author Jim Edwards
  */
 int
 create_mpi_datatypes(MPI_Datatype mpitype, int msgcnt,
-                     const PIO_Offset *mindex, const int *mcount, int *mfrom,
+                     const int *mindex, const int *mcount, int *mfrom,
                      MPI_Datatype *mtype)
 {
     int blocksize;
     int numinds = 0;
     PIO_Offset *lindex = NULL;
-    int mpierr; /* Return code from MPI functions. */
     int ret = PIO_NOERR;
 
     /* Check inputs. */
@@ -311,11 +554,13 @@ create_mpi_datatypes(MPI_Datatype mpitype, int msgcnt,
 
     if (mindex)
     {
-      for(int j=0; j<numinds; j++)
-        PLOG((3,"mindex[%d] = %d",j,mindex[j]));
+      if (PLOG_ON(3))
+        for(int j=0; j<numinds; j++)
+          PLOG((3,"mindex[%d] = %d",j,mindex[j]));
       if (!(lindex = malloc(numinds * sizeof(PIO_Offset))))
             return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        memcpy(lindex, mindex, (size_t)(numinds * sizeof(PIO_Offset)));
+        for (int j = 0; j < numinds; j++)
+            lindex[j] = mindex[j];
         PLOG((3, "allocated lindex, copied mindex"));
     }
 
@@ -390,31 +635,16 @@ create_mpi_datatypes(MPI_Datatype mpitype, int msgcnt,
                     displace[j] = ((lindex + pos)[j * blocksize] - 1);
             }
 
-#if PIO_ENABLE_LOGGING
-            int cnt=0;
-            for (int j = 1; j < len; j++){
-              PLOG((4, "displace[%d] = %d blocksize=%d mfrom %x", j, displace[j], blocksize, mfrom));
-            }
-
-#endif /* PIO_ENABLE_LOGGING */
-
-            PLOG((2, "calling MPI_Type_create_indexed_block len = %d blocksize = %d "
-                  "mpitype = %d", len, blocksize, mpitype));
-            /* Create an indexed datatype with constant-sized blocks. */
-            mpierr = MPI_Type_create_indexed_block(len, blocksize, displace,
-                                                   mpitype, &mtype[i]);
+            if (PLOG_ON(4))
+                for (int j = 1; j < len; j++)
+                    PLOG((4, "displace[%d] = %d blocksize=%d mfrom %x", j, displace[j],
+                          blocksize, mfrom));
 
+            /* Get an indexed datatype with constant-sized blocks. */
+            ret = get_cached_datatype(mpitype, len, blocksize, displace, &mtype[i]);
             free(displace);
-            if (mpierr)
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-            if (mtype[i] == PIO_DATATYPE_NULL)
-                return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
-
-            /* Commit the MPI data type. */
-            PLOG((3, "about to commit type"));
-            if ((mpierr = MPI_Type_commit(&mtype[i])))
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+            if (ret)
+                return ret;
             pos += mcount[i];
 
 //                MPI_Aint ext, lb;
@@ -478,7 +708,7 @@ define_iodesc_datatypes(iosystem_desc_t *ios, io_desc_t *iodesc)
             if (iodesc->nrecvs > 0)
             {
                 /* Allocate memory for array of MPI types for the IO tasks. */
-                if (!(iodesc->rtype = malloc(iodesc->nrecvs * sizeof(MPI_Datatype))))
+                if (!(iodesc->rtype = pio_malloc(PIO_MEM_MPITYPE, iodesc->nrecvs * sizeof(MPI_Datatype))))
                     return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
                 PLOG((2, "allocated memory for IO task MPI types iodesc->nrecvs = %d "
                       "iodesc->rearranger = %d", iodesc->nrecvs, iodesc->rearranger));
@@ -513,7 +743,7 @@ define_iodesc_datatypes(iosystem_desc_t *ios, io_desc_t *iodesc)
             ntypes = iodesc->rearranger == PIO_REARR_SUBSET ? 1 : ios->num_iotasks;
 
             /* Allocate memory for array of MPI types for the computation tasks. */
-            if (!(iodesc->stype = malloc(ntypes * sizeof(MPI_Datatype))))
+            if (!(iodesc->stype = pio_malloc(PIO_MEM_MPITYPE, ntypes * sizeof(MPI_Datatype))))
                 return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
             PLOG((3, "allocated memory for computation MPI types ntypes = %d", ntypes));
 
@@ -537,6 +767,33 @@ define_iodesc_datatypes(iosystem_desc_t *ios, io_desc_t *iodesc)
     return PIO_NOERR;
 }
 
+/** A message received in the sparse exchange of compute_counts(). */
+typedef struct nbx_msg
+{
+    /** Rank of the sender in the union communicator. */
+    int source;
+
+    /** Number of indices in the message. */
+    int count;
+
+    /** The indices. */
+    int *buf;
+} nbx_msg;
+
+/**
+ * Compare two received messages by sender, for qsort().
+ *
+ * @param a pointer to an nbx_msg.
+ * @param b pointer to an nbx_msg.
+ * @returns the order of the senders.
+ * @author Ed Hartnett
+ */
+static int
+nbx_msg_cmp(const void *a, const void *b)
+{
+    return ((const nbx_msg *)a)->source - ((const nbx_msg *)b)->source;
+}
+
 /**
  * Completes the mapping for the box rearranger. This function is
  * called from box_rearrange_create(). It is not used for the subset
@@ -547,19 +804,22 @@ define_iodesc_datatypes(iosystem_desc_t *ios, io_desc_t *iodesc)
  * <li>Allocates and inits iodesc->scount, an array (length
  * ios->num_iotasks) containing number of data elements sent to each
  * IO task from current compute task.
- * <li>Uses pio_swapm() to send iodesc->scount array from each
- * computation task to all IO tasks.
+ * <li>Allocates and inits iodesc->sindex arrays (length iodesc->ndof)
+ * which holds indecies for computation tasks.
+ * <li>Sends the list of IO indicies for each IO task to it, with a
+ * sparse data exchange: each compute task sends only to the IO tasks
+ * it has data for, with MPI_Issend(), and the IO tasks receive
+ * whatever arrives, until a non-blocking barrier, entered by each
+ * task when all its sends have been received, completes. So no task
+ * needs arrays of length ios->num_uniontasks, or a dense all-to-all
+ * exchange, to learn its senders.
  * <li>On IO tasks, allocates and inits iodesc->rcount and
  * iodesc->rfrom arrays (length max(1, nrecvs)) which holds the amount
  * of data to expect from each compute task and the rank of that
- * task. .
- * <li>Allocates and inits iodesc->sindex arrays (length iodesc->ndof)
- * which holds indecies for computation tasks.
+ * task, in order of rank.
  * <li>On IO tasks, allocates and inits iodesc->rindex (length
  * totalrecv) with indices of the data to be sent/received from this
  * io task to each compute task.
- * <li>Uses pio_swapm() to send list of indicies on each compute task
- * to the IO tasks.
  * </ul>
  *
  * @param ios pointer to the iosystem_desc_t struct.
@@ -567,15 +827,17 @@ define_iodesc_datatypes(iosystem_desc_t *ios, io_desc_t *iodesc)
  * @param dest_ioproc an array (length maplen) of IO task numbers.
  * @param dest_ioindex an array (length maplen) of IO indicies.
  * @returns 0 on success, error code otherwise.
- * @author Jim Edwards
+ * @author Jim Edwards, Ed Hartnett
  */
 int
 compute_counts(iosystem_desc_t *ios, io_desc_t *iodesc,
                const int *dest_ioproc, const PIO_Offset *dest_ioindex)
 {
-    int *recv_buf = NULL;
+    nbx_msg *msgs = NULL;   /* Messages received on IO tasks. */
     int nrecvs = 0;
-    int ierr;
+    int nsends = 0;
+    int totalrecv = 0;
+    int mpierr;
 
     /* Check inputs. */
     pioassert(ios && iodesc && (iodesc->ndof == 0 ||
@@ -585,18 +847,11 @@ compute_counts(iosystem_desc_t *ios, io_desc_t *iodesc,
     PLOG((1, "compute_counts ios->num_uniontasks = %d ios->compproc %d ios->ioproc %d",
           ios->num_uniontasks, ios->compproc, ios->ioproc));
 
-    /* Arrays for swapm all to all gather calls. */
-    MPI_Datatype sr_types[ios->num_uniontasks];
-    int send_counts[ios->num_uniontasks];
-    int send_displs[ios->num_uniontasks];
-    int recv_counts[ios->num_uniontasks];
-    int recv_displs[ios->num_uniontasks];
-
     /* The list of indeces on each compute task */
-    PIO_Offset *s2rindex = NULL;
+    int *s2rindex = NULL;
     if (iodesc->ndof > 0)
     {
-        if (!(s2rindex = malloc(sizeof(PIO_Offset) * iodesc->ndof)))
+        if (!(s2rindex = malloc(sizeof(int) * iodesc->ndof)))
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
     }
     /* Allocate memory for the array of counts and init to zero. */
@@ -611,114 +866,19 @@ compute_counts(iosystem_desc_t *ios, io_desc_t *iodesc,
             if (dest_ioindex[i] >= 0)
                 (iodesc->scount[dest_ioproc[i]])++;
 
-    /* Initialize arrays used in swapm call. */
-    for (int i = 0; i < ios->num_uniontasks; i++)
-    {
-        send_counts[i] = 0;
-        send_displs[i] = 0;
-        recv_counts[i] = 0;
-        recv_displs[i] = 0;
-        sr_types[i] = MPI_INT;
-    }
-
-    /* Setup for the swapm call. iodesc->scount is the amount of data
-     * this compute task will transfer to/from each iotask. For the
-     * box rearranger there can be more than one IO task per compute
-     * task. This provides enough information to know the size of data
-     * on the iotask, so at line 557 we allocate arrays to hold the
-     * map on the iotasks. iodesc->rcount is an array of the amount of
-     * data to expect from each compute task and iodesc->rfrom is the
-     * rank of that task. */
-    if (ios->compproc)
-    {
-        for (int i = 0; i < ios->num_iotasks; i++)
-        {
-            send_counts[ios->ioranks[i]] = 1;
-            send_displs[ios->ioranks[i]] = i * sizeof(int);
-            PLOG((3, "send_counts[%d] = %d send_displs[%d] = %d", ios->ioranks[i],
-                  send_counts[ios->ioranks[i]], ios->ioranks[i], send_displs[ios->ioranks[i]]));
-        }
-    }
-
-    /* IO tasks need to know how many data elements they will receive
-     * from each compute task. Allocate space for that, and set up
-     * swapm call. */
-    if (ios->ioproc)
-    {
-        /* Allocate memory to hold array of the scounts from all
-         * computation tasks. */
-        if (!(recv_buf = calloc(ios->num_comptasks, sizeof(int))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-
-        /* Initialize arrays that keep track of counts and
-         * displacements for the all-to-all gather. */
-        for (int i = 0; i < ios->num_comptasks; i++)
-        {
-            recv_counts[ios->compranks[i]] = 1;
-            recv_displs[ios->compranks[i]] = i * sizeof(int);
-            PLOG((3, "recv_counts[%d] = %d recv_displs[%d] = %d", ios->compranks[i],
-                  recv_counts[ios->compranks[i]], ios->compranks[i],
-                  recv_displs[ios->compranks[i]]));
-        }
-    }
-
-    PLOG((2, "about to share scount from each compute task to all IO tasks."));
-    /* Share the iodesc->scount from each compute task to all IO
-     * tasks. The scounts will end up in array recv_buf. */
-    if ((ierr = pio_swapm(iodesc->scount, send_counts, send_displs, sr_types,
-                          recv_buf, recv_counts, recv_displs, sr_types, ios->union_comm,
-                          &iodesc->rearr_opts.comp2io)))
-        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-
-    /* On IO tasks, set up data receives. */
-    if (ios->ioproc)
-    {
-        /* Count the number of non-zero scounts from the compute
-         * tasks. */
-        for (int i = 0; i < ios->num_comptasks; i++)
-        {
-            if (recv_buf[i] != 0)
-                nrecvs++;
-            PLOG((3, "recv_buf[%d] = %d", i, recv_buf[i]));
-        }
-
-        /* Get memory to hold the count of data receives. */
-        if (!(iodesc->rcount = calloc(max(1, nrecvs), sizeof(int))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-
-        /* Get memory to hold the list of task data was from. */
-        if (!(iodesc->rfrom = calloc(max(1, nrecvs), sizeof(int))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        PLOG((3, "allocared rfrom max(1, nrecvs) = %d", max(1, nrecvs)));
-
-        nrecvs = 0;
-        for (int i = 0; i < ios->num_comptasks; i++)
-        {
-            if (recv_buf[i] != 0)
-            {
-                iodesc->rcount[nrecvs] = recv_buf[i];
-                iodesc->rfrom[nrecvs] = ios->compranks[i];
-                nrecvs++;
-            }
-        }
-        free(recv_buf);
-    }
-
-    /* ??? */
-    iodesc->nrecvs = nrecvs;
-    PLOG((3, "iodesc->nrecvs = %d", iodesc->nrecvs));
-
     /* Allocate an array for indicies on the computation tasks (the
      * send side when writing). */
     if (iodesc->sindex == NULL && iodesc->ndof > 0)
-        if (!(iodesc->sindex = malloc(iodesc->ndof * sizeof(PIO_Offset))))
+        if (!(iodesc->sindex = pio_malloc(PIO_MEM_INDEX, iodesc->ndof * sizeof(int))))
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
     PLOG((2, "iodesc->ndof = %d ios->num_iotasks = %d", iodesc->ndof, ios->num_iotasks));
 
     int tempcount[ios->num_iotasks];
     int spos[ios->num_iotasks];
+    MPI_Request sreqs[ios->num_iotasks];
 
-    /* ??? */
+    /* spos[i] is the start of the indices for IO task i in sindex and
+     * s2rindex. */
     spos[0] = 0;
     tempcount[0] = 0;
     for (int i = 1; i < ios->num_iotasks; i++)
@@ -728,7 +888,7 @@ compute_counts(iosystem_desc_t *ios, io_desc_t *iodesc,
         PLOG((3, "spos[%d] = %d tempcount[%d] = %d", i, spos[i], i, tempcount[i]));
     }
 
-    /* ??? */
+    /* Sort the local indices by destination IO task. */
     for (int i = 0; i < iodesc->ndof; i++)
     {
         int iorank;
@@ -750,263 +910,1954 @@ compute_counts(iosystem_desc_t *ios, io_desc_t *iodesc,
         }
     }
 
-    /* Initialize arrays to zeros. */
-    for (int i = 0; i < ios->num_uniontasks; i++)
-    {
-        send_counts[i] = 0;
-        send_displs[i] = 0;
-        recv_counts[i] = 0;
-        recv_displs[i] = 0;
-    }
-
-    /* ??? */
+    /* Send the IO indices to each IO task this task has data
+     * for. Synchronous sends complete only when received, which is
+     * what the barrier below relies on. */
     for (int i = 0; i < ios->num_iotasks; i++)
+        if (iodesc->scount[i] > 0)
+            if ((mpierr = MPI_Issend(s2rindex + spos[i], iodesc->scount[i], MPI_INT,
+                                     ios->ioranks[i], PIO_NBX_TAG, ios->union_comm,
+                                     &sreqs[nsends++])))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "compute_counts posted %d sends", nsends));
+
+    /* Receive the messages sent to this task, until all tasks have
+     * had all their sends received. */
     {
-        /* Subset rearranger needs one type, box rearranger needs one for
-         * each IO task. */
-        send_counts[ios->ioranks[i]] = iodesc->scount[i];
-        if (send_counts[ios->ioranks[i]] > 0)
-            send_displs[ios->ioranks[i]] = spos[i] * SIZEOF_MPI_OFFSET;
-        PLOG((3, "ios->ioranks[i] = %d iodesc->scount[%d] = %d spos[%d] = %d",
-              ios->ioranks[i], i, iodesc->scount[i], i, spos[i]));
+        MPI_Request breq = MPI_REQUEST_NULL;
+        int nalloc = 0;
+        int done = 0;
+
+        while (!done)
+        {
+            MPI_Status status;
+            int flag;
+
+            if ((mpierr = MPI_Iprobe(MPI_ANY_SOURCE, PIO_NBX_TAG, ios->union_comm, &flag,
+                                     &status)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            if (flag)
+            {
+                nbx_msg *msg;
+
+                if (nrecvs == nalloc)
+                {
+                    nalloc = nalloc ? 2 * nalloc : 16;
+                    if (!(msgs = realloc(msgs, nalloc * sizeof(nbx_msg))))
+                        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+                }
+                msg = &msgs[nrecvs++];
+                msg->source = status.MPI_SOURCE;
+                if ((mpierr = MPI_Get_count(&status, MPI_INT, &msg->count)))
+                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+                if (!(msg->buf = malloc(msg->count * sizeof(int))))
+                    return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+                if ((mpierr = MPI_Recv(msg->buf, msg->count, MPI_INT, msg->source,
+                                       PIO_NBX_TAG, ios->union_comm, MPI_STATUS_IGNORE)))
+                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+                totalrecv += msg->count;
+                PLOG((3, "received %d indices from %d", msg->count, msg->source));
+            }
+
+            if (breq == MPI_REQUEST_NULL)
+            {
+                int sent;
+
+                if ((mpierr = MPI_Testall(nsends, sreqs, &sent, MPI_STATUSES_IGNORE)))
+                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+                if (sent)
+                    if ((mpierr = MPI_Ibarrier(ios->union_comm, &breq)))
+                        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            }
+            else if ((mpierr = MPI_Test(&breq, &done, MPI_STATUS_IGNORE)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
     }
+    if (s2rindex)
+        free(s2rindex);
 
-    /* Only do this on IO tasks. */
+    /* Only IO tasks get messages. */
+    pioassert(ios->ioproc || !nrecvs, "data sent to a compute task", __FILE__, __LINE__);
+
+    /* On IO tasks, set up data receives, in order of sender. */
     if (ios->ioproc)
     {
-        int totalrecv = 0;
-        for (int i = 0; i < nrecvs; i++)
-        {
-            recv_counts[iodesc->rfrom[i]] = iodesc->rcount[i];
-            totalrecv += iodesc->rcount[i];
-        }
+        PIO_Offset pos = 0;
 
-        recv_displs[0] = 0;
-        for (int i = 1; i < nrecvs; i++)
-        {
-            recv_displs[iodesc->rfrom[i]] = recv_displs[iodesc->rfrom[i - 1]] +
-                iodesc->rcount[i - 1] * SIZEOF_MPI_OFFSET;
-            PLOG((3, "iodesc->rfrom[%d] = %d recv_displs[iodesc->rfrom[i]] = %d", i,
-                  iodesc->rfrom[i], recv_displs[iodesc->rfrom[i]]));
-        }
+        qsort(msgs, nrecvs, sizeof(nbx_msg), nbx_msg_cmp);
+
+        /* Get memory to hold the count of data receives. */
+        if (!(iodesc->rcount = calloc(max(1, nrecvs), sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+        /* Get memory to hold the list of task data was from. */
+        if (!(iodesc->rfrom = calloc(max(1, nrecvs), sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        PLOG((3, "allocared rfrom max(1, nrecvs) = %d", max(1, nrecvs)));
 
         /* rindex is an array of the indices of the data to be sent from
            this io task to each compute task. */
         PLOG((3, "totalrecv = %d", totalrecv));
         if (totalrecv > 0)
         {
-            totalrecv = iodesc->llen;  /* can reduce memory usage here */
-            if (!(iodesc->rindex = calloc(totalrecv, sizeof(PIO_Offset))))
+            pioassert(totalrecv <= iodesc->llen, "too much data for IO task", __FILE__, __LINE__);
+            if (iodesc->llen > INT_MAX)
+                return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+            if (!(iodesc->rindex = pio_calloc(PIO_MEM_INDEX, iodesc->llen, sizeof(int))))
                 return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-            PLOG((3, "allocated totalrecv elements in rindex array"));
+            PLOG((3, "allocated llen elements in rindex array"));
+        }
+
+        for (int i = 0; i < nrecvs; i++)
+        {
+            iodesc->rcount[i] = msgs[i].count;
+            iodesc->rfrom[i] = msgs[i].source;
+            memcpy(iodesc->rindex + pos, msgs[i].buf, msgs[i].count * sizeof(int));
+            pos += msgs[i].count;
+            free(msgs[i].buf);
         }
     }
+    free(msgs);
 
-    /* For the swapm call below, init the types to MPI_OFFSET. */
-    for (int i = 0; i < ios->num_uniontasks; i++)
-        sr_types[i] = MPI_OFFSET;
-
-    /* Here we are sending the mapping from the index on the compute
-     * task to the index on the io task. */
-    /* s2rindex is the list of indeces on each compute task */
-    PLOG((3, "sending mapping"));
-    if ((ierr = pio_swapm(s2rindex, send_counts, send_displs, sr_types, iodesc->rindex,
-                          recv_counts, recv_displs, sr_types, ios->union_comm,
-                          &iodesc->rearr_opts.comp2io)))
-        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-    if(s2rindex)
-        free(s2rindex);
+    iodesc->nrecvs = nrecvs;
+    PLOG((3, "iodesc->nrecvs = %d", iodesc->nrecvs));
 
     return PIO_NOERR;
 }
 
 /**
- * Moves data from compute tasks to IO tasks. This is called from
- * PIOc_write_darray_multi().
+ * If needed, create the send MPI datatypes which index the caller's
+ * unsorted array. When iodesc->needssort is true, iodesc->stype
+ * indexes the array after it has been sorted by pio_sorted_copy(),
+ * so element j of sindex is element remap[sindex[j]] of the caller's
+ * array.
  *
  * @param ios pointer to the iosystem_desc_t struct.
  * @param iodesc a pointer to the io_desc_t struct.
- * @param sbuf send buffer. May be NULL.
- * @param rbuf receive buffer. May be NULL.
- * @param nvars number of variables.
  * @returns 0 on success, error code otherwise.
- * @author Jim Edwards
+ * @author Jim Edwards, Ed Hartnett
  */
-int
-rearrange_comp2io(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
-                  void *rbuf, int nvars)
+static int
+define_iodesc_unsorted_datatypes(iosystem_desc_t *ios, io_desc_t *iodesc)
 {
-    int ntasks;       /* Number of tasks in communicator. */
-    int niotasks;     /* Number of IO tasks. */
-    MPI_Comm mycomm;  /* Communicator that data is transferred over. */
-    int mpierr;       /* Return code from MPI calls. */
+    int *uindex = NULL;
+    int numinds = 0;
     int ret;
 
-#ifdef TIMING
-    /* Start timer if desired. */
-    if ((ret = pio_start_timer("PIO:rearrange_comp2io")))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-#endif /* TIMING */
+    pioassert(ios && iodesc && iodesc->needssort, "invalid input", __FILE__, __LINE__);
 
-    /* Caller must provide these. */
-    pioassert(ios && iodesc && nvars > 0, "invalid input", __FILE__, __LINE__);
+    /* Only computation tasks send data, and the types are only
+     * created once. */
+    if (!ios->compproc || iodesc->ustype)
+        return PIO_NOERR;
 
-    PLOG((1, "rearrange_comp2io nvars = %d iodesc->rearranger = %d", nvars,
-          iodesc->rearranger));
+    /* Make sure the sorted types exist, to learn how many are needed. */
+    if ((ret = define_iodesc_datatypes(ios, iodesc)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-    /* Different rearraangers use different communicators. */
-    if (iodesc->rearranger == PIO_REARR_BOX)
-    {
-        mycomm = ios->union_comm;
-        niotasks = ios->num_iotasks;
-    }
-    else
+    for (int i = 0; i < iodesc->num_stypes; i++)
+        numinds += iodesc->scount[i];
+
+    /* Translate the indices into the sorted array. */
+    if (numinds > 0)
     {
-        mycomm = iodesc->subset_comm;
-        niotasks = 1;
+        if (!(uindex = malloc(numinds * sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        for (int j = 0; j < numinds; j++)
+            uindex[j] = iodesc->remap[iodesc->sindex[j]];
     }
 
-    /* Get the number of tasks. */
-    if ((mpierr = MPI_Comm_size(mycomm, &ntasks)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-    /* These are parameters to pio_swapm to send data from compute to
-     * IO tasks. */
-    int sendcounts[ntasks];
-    int recvcounts[ntasks];
-    int sdispls[ntasks];
-    int rdispls[ntasks];
-    MPI_Datatype sendtypes[ntasks];
-    MPI_Datatype recvtypes[ntasks];
-
-    /* Initialize pio_swapm parameter arrays. */
-    for (int i = 0; i < ntasks; i++)
+    if (!(iodesc->ustype = malloc(iodesc->num_stypes * sizeof(MPI_Datatype))))
     {
-        sendcounts[i] = 0;
-        recvcounts[i] = 0;
-        sdispls[i] = 0;
-        rdispls[i] = 0;
-        recvtypes[i] = PIO_DATATYPE_NULL;
-        sendtypes[i] =  PIO_DATATYPE_NULL;
+        free(uindex);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
     }
-//    PLOG((3, "ntasks = %d iodesc->mpitype_size = %d niotasks = %d", ntasks,
-//          iodesc->mpitype_size, niotasks));
-
-    /* If it has not already been done, define the MPI data types that
-     * will be used for this io_desc_t. */
-//    PLOG((2, "Calling define_iodesc_datatypes at line %d sindex[20] = %d",__LINE__,iodesc->sindex[20]));
-    if ((ret = define_iodesc_datatypes(ios, iodesc)))
+    for (int i = 0; i < iodesc->num_stypes; i++)
+        iodesc->ustype[i] = PIO_DATATYPE_NULL;
+
+    PLOG((2, "Calling create_mpi_datatypes at line %d",__LINE__));
+    ret = create_mpi_datatypes(iodesc->mpitype, iodesc->num_stypes, uindex,
+                               iodesc->scount, NULL, iodesc->ustype);
+    if (uindex)
+        free(uindex);
+    if (ret)
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-    /* If this io proc, we need to exchange data with compute
+    return PIO_NOERR;
+}
+
+/**
+ * Compare two ints, for qsort() and bsearch().
+ *
+ * @param a pointer to first int.
+ * @param b pointer to second int.
+ * @returns -1, 0, or 1, as a is less than, equal to, or greater
+ * than b.
+ * @author Ed Hartnett
+ */
+static int
+compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Find the position of a task in the arrays passed to the exchange
+ * functions of the rearranger. The arrays are indexed by peer, so
+ * this is the index of the task in iodesc->peers.
+ *
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param rank the rank of the task in the rearranger communicator.
+ * @returns the position of the task.
+ * @author Ed Hartnett
+ */
+static int
+rearr_slot(const io_desc_t *iodesc, int rank)
+{
+    int *found;
+
+    found = bsearch(&rank, iodesc->peers, iodesc->npeers, sizeof(int), compare_ints);
+    pioassert(found, "task is not a peer", __FILE__, __LINE__);
+
+    return found - iodesc->peers;
+}
+
+/**
+ * Find the tasks this task exchanges data with in the rearranger,
+ * and allocate the arrays used to describe the exchanges, so that
+ * the work done for each exchange is proportional to the number of
+ * peers, not the size of the communicator. The peers are the IO
+ * tasks this task sends to (from scount), and the compute tasks it
+ * receives from (from rcount and rfrom). Since the partner of each
+ * exchange lists this task too, the same peers serve for both
+ * comp2io and io2comp.
+ *
+ * When the comm_type is PIO_REARR_COMM_NEIGHBOR, this also creates
+ * an MPI distributed graph communicator over the peers. The graph is
+ * symmetric, so one communicator is used in both directions.
+ *
+ * This is called from PIOc_InitDecomp() after the rearranger has
+ * been created, or from the rearrange functions if that was not
+ * done.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+define_rearr_peers(iosystem_desc_t *ios, io_desc_t *iodesc)
+{
+    MPI_Comm mycomm;  /* Communicator that data is transferred over. */
+    int niotasks;     /* Number of IO tasks. */
+    int maxpeers;
+    int *peers;
+    int n = 0;
+    int mpierr;
+
+    pioassert(ios && iodesc && !iodesc->peers, "invalid input", __FILE__, __LINE__);
+
+    /* Different rearrangers use different communicators. */
+    if (iodesc->rearranger == PIO_REARR_BOX)
+    {
+        mycomm = ios->union_comm;
+        niotasks = ios->num_iotasks;
+    }
+    else
+    {
+        mycomm = iodesc->subset_comm;
+        niotasks = 1;
+    }
+
+    /* Collect the IO tasks this task sends to, and the compute tasks
+     * it receives from. */
+    maxpeers = niotasks + (ios->ioproc ? iodesc->nrecvs : 0);
+    if (!(peers = malloc((maxpeers ? maxpeers : 1) * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (iodesc->scount && (!ios->async || ios->compproc))
+        for (int i = 0; i < niotasks; i++)
+            if (iodesc->scount[i] > 0)
+                peers[n++] = iodesc->rearranger == PIO_REARR_SUBSET ? 0 : ios->ioranks[i];
+    if (ios->ioproc && iodesc->rcount)
+        for (int i = 0; i < iodesc->nrecvs; i++)
+            if (iodesc->rcount[i] > 0)
+                peers[n++] = iodesc->rearranger == PIO_REARR_SUBSET ? i : iodesc->rfrom[i];
+
+    /* Sort and remove duplicates. */
+    qsort(peers, n, sizeof(int), compare_ints);
+    iodesc->npeers = 0;
+    for (int i = 0; i < n; i++)
+        if (!iodesc->npeers || peers[i] != peers[iodesc->npeers - 1])
+            peers[iodesc->npeers++] = peers[i];
+    iodesc->peers = peers;
+
+    /* Space for the counts, displacements and types of the
+     * exchanges. */
+    if (!(iodesc->peer_counts = malloc((4 * iodesc->npeers + 1) * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(iodesc->peer_types = malloc((2 * iodesc->npeers + 1) * sizeof(MPI_Datatype))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    PLOG((2, "define_rearr_peers npeers = %d", iodesc->npeers));
+
+    /* Every task lists each of its partners, and the partner lists it
+     * too, so the graph is symmetric. */
+    if (iodesc->rearr_opts.comm_type == PIO_REARR_COMM_NEIGHBOR)
+        if ((mpierr = MPI_Dist_graph_create_adjacent(mycomm, iodesc->npeers, peers,
+                                                     iodesc->npeers ? MPI_UNWEIGHTED : MPI_WEIGHTS_EMPTY,
+                                                     iodesc->npeers, peers,
+                                                     iodesc->npeers ? MPI_UNWEIGHTED : MPI_WEIGHTS_EMPTY,
+                                                     MPI_INFO_NULL, 0, &iodesc->neighbor_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the arrays that describe an exchange of the rearranger, with
+ * an entry for each peer (see define_rearr_peers()), all set to
+ * zero counts and displacements, and null types. The arrays belong
+ * to the iodesc, and are reused by every exchange.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sendcounts pointer that gets the send counts.
+ * @param sdispls pointer that gets the send displacements.
+ * @param sendtypes pointer that gets the send types.
+ * @param recvcounts pointer that gets the receive counts.
+ * @param rdispls pointer that gets the receive displacements.
+ * @param recvtypes pointer that gets the receive types.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+get_rearr_args(iosystem_desc_t *ios, io_desc_t *iodesc, int **sendcounts, int **sdispls,
+               MPI_Datatype **sendtypes, int **recvcounts, int **rdispls,
+               MPI_Datatype **recvtypes)
+{
+    int npeers;
+    int ret;
+
+    /* Find the peers, if this was not done when the decomposition
+     * was created. */
+    if (!iodesc->peers)
+        if ((ret = define_rearr_peers(ios, iodesc)))
+            return ret;
+
+    npeers = iodesc->npeers;
+    for (int i = 0; i < 4 * npeers; i++)
+        iodesc->peer_counts[i] = 0;
+    for (int i = 0; i < 2 * npeers; i++)
+        iodesc->peer_types[i] = PIO_DATATYPE_NULL;
+
+    *sendcounts = iodesc->peer_counts;
+    *sdispls = iodesc->peer_counts + npeers;
+    *recvcounts = iodesc->peer_counts + 2 * npeers;
+    *rdispls = iodesc->peer_counts + 3 * npeers;
+    *sendtypes = iodesc->peer_types;
+    *recvtypes = iodesc->peer_types + npeers;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Can persistent requests be used for a rearrangement with these
+ * flow control options? Persistent requests send the same messages
+ * as pio_swapm() does when there is no handshaking and no limit on
+ * pending requests. With other options (including the default
+ * MPI_Alltoallw()) pio_swapm() is always used.
+ *
+ * @param fc pointer to the flow control options.
+ * @returns true if persistent requests may be used.
+ * @author Ed Hartnett
+ */
+static bool
+use_rearr_persist(const rearr_comm_fc_opt_t *fc)
+{
+    return !fc->hs && fc->max_pend_req == PIO_REARR_COMM_UNLIMITED_PEND_REQ;
+}
+
+/**
+ * Do persistent requests match this rearrangement?
+ *
+ * @param pr pointer to the persistent requests.
+ * @param nvars number of variables.
+ * @param sbuf send buffer.
+ * @param rbuf receive buffer.
+ * @returns true if the requests can be started for this
+ * rearrangement.
+ * @author Ed Hartnett
+ */
+static bool
+rearr_persist_match(const rearr_persist_t *pr, int nvars, const void *sbuf,
+                    const void *rbuf)
+{
+    return pr->reqs && pr->nvars == nvars && pr->sbuf == sbuf && pr->rbuf == rbuf;
+}
+
+/**
+ * Free persistent rearranger requests, and the MPI types they
+ * use. The struct is left empty, ready for reuse.
+ *
+ * @param pr pointer to the persistent requests.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+free_rearr_persist(rearr_persist_t *pr)
+{
+    int mpierr;
+
+    pioassert(pr, "invalid input", __FILE__, __LINE__);
+
+    for (int r = 0; r < pr->nreqs; r++)
+        if (pr->reqs[r] != MPI_REQUEST_NULL)
+            if ((mpierr = MPI_Request_free(&pr->reqs[r])))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    for (int t = 0; t < pr->ntypes; t++)
+        if ((mpierr = MPI_Type_free(&pr->types[t])))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if (pr->reqs)
+        free(pr->reqs);
+    if (pr->types)
+        free(pr->types);
+    memset(pr, 0, sizeof(rearr_persist_t));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Replace persistent rearranger requests with new ones for this
+ * rearrangement. Arguments are as for pio_swapm().
+ *
+ * @param pr pointer to the persistent requests.
+ * @param nvars number of variables.
+ * @param npeers number of peers.
+ * @param peers array (of length npeers) of the ranks of the peers.
+ * @param sbuf send buffer.
+ * @param sendcounts array (of length npeers) of send counts.
+ * @param sdispls array (of length npeers) of send displacements.
+ * @param sendtypes array (of length npeers) of send types.
+ * @param rbuf receive buffer.
+ * @param recvcounts array (of length npeers) of receive counts.
+ * @param rdispls array (of length npeers) of receive displacements.
+ * @param recvtypes array (of length npeers) of receive types.
+ * @param comm communicator.
+ * @param own_types if true, the non-null MPI types in sendtypes and
+ * recvtypes belong to pr from now on, and are freed with the
+ * requests.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+init_rearr_persist(rearr_persist_t *pr, int nvars, int npeers, const int *peers, void *sbuf,
+                   int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+                   void *rbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+                   MPI_Comm comm, bool own_types)
+{
+    int maxreqs = 0;
+    int ret;
+
+    if ((ret = free_rearr_persist(pr)))
+        return ret;
+
+    for (int i = 0; i < npeers; i++)
+    {
+        if (sendcounts[i] > 0)
+            maxreqs++;
+        if (recvcounts[i] > 0)
+            maxreqs++;
+    }
+
+    /* Always allocate reqs, so that a rearrangement without messages
+     * on this task still matches next time. */
+    if (!(pr->reqs = malloc((maxreqs ? maxreqs : 1) * sizeof(MPI_Request))))
+        return PIO_ENOMEM;
+    if (own_types && !(pr->types = malloc((2 * npeers + 1) * sizeof(MPI_Datatype))))
+        return PIO_ENOMEM;
+
+    /* Types now belong to pr, whether or not the requests can be made. */
+    if (own_types)
+        for (int i = 0; i < npeers; i++)
+        {
+            if (sendtypes[i] != PIO_DATATYPE_NULL)
+                pr->types[pr->ntypes++] = sendtypes[i];
+            if (recvtypes[i] != PIO_DATATYPE_NULL)
+                pr->types[pr->ntypes++] = recvtypes[i];
+        }
+
+    if ((ret = pio_swapm_init(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
+                              rdispls, recvtypes, npeers, peers, comm, maxreqs, pr->reqs,
+                              &pr->nreqs)))
+        return ret;
+
+    pr->nvars = nvars;
+    pr->sbuf = sbuf;
+    pr->rbuf = rbuf;
+
+    PLOG((2, "init_rearr_persist nvars = %d nreqs = %d ntypes = %d", nvars, pr->nreqs,
+          pr->ntypes));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Do a rearrangement by starting its persistent requests, and wait
+ * for them to complete.
+ *
+ * @param pr pointer to the persistent requests.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+start_rearr_persist(rearr_persist_t *pr)
+{
+    int mpierr;
+
+    if (!pr->nreqs)
+        return PIO_NOERR;
+
+    if ((mpierr = MPI_Startall(pr->nreqs, pr->reqs)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Waitall(pr->nreqs, pr->reqs, MPI_STATUSES_IGNORE)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Make sure the node leader's buffer can hold nvars arrays of the
+ * gathered data.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param nvars number of variables.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+node_buf_size(iosystem_desc_t *ios, io_desc_t *iodesc, int nvars)
+{
+    size_t size = (size_t)nvars * iodesc->node_ndof * iodesc->mpitype_size;
+
+    if (size > iodesc->node_bufsize)
+    {
+        void *buf;
+
+        if (!(buf = realloc(iodesc->node_buf, size)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        iodesc->node_buf = buf;
+        iodesc->node_bufsize = size;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Gather the data of the tasks on a node to the node leader, for
+ * PIO_REARR_NODE. On the leader, the arrays of the nvars variables
+ * end up one after the other in iodesc->node_buf, each in the order
+ * of the gathered map.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbufs array (length nvars) of pointers to the arrays of the
+ * caller, which are not sorted. If NULL, sbuf is used.
+ * @param sbuf nvars contiguous arrays, sorted if
+ * iodesc->needssort. Ignored if sbufs is provided.
+ * @param nvars number of variables.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+node_gather(iosystem_desc_t *ios, io_desc_t *iodesc, void **sbufs, void *sbuf,
+            int nvars)
+{
+    MPI_Request reqs[nvars];
+    MPI_Datatype stype = iodesc->mpitype;
+    int scount = iodesc->ndof;
+    int mpierr;
+    int ret;
+
+    pioassert(ios && iodesc && iodesc->nnode && nvars > 0, "invalid input",
+              __FILE__, __LINE__);
+
+    if ((ret = node_buf_size(ios, iodesc, nvars)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* The caller's own arrays are picked out in sorted order. */
+    if (sbufs && iodesc->needssort && scount)
+    {
+        stype = iodesc->node_ustype;
+        scount = 1;
+    }
+    if (!sbufs && !sbuf)
+        scount = 0;
+
+    for (int v = 0; v < nvars; v++)
+    {
+        const void *src = sbufs ? sbufs[v] :
+            (char *)sbuf + (size_t)v * iodesc->ndof * iodesc->mpitype_size;
+        void *dst = (char *)iodesc->node_buf + (size_t)v * iodesc->node_ndof * iodesc->mpitype_size;
+
+        if ((mpierr = MPI_Igatherv(src, scount, stype, dst, iodesc->node_counts,
+                                   iodesc->node_displs, iodesc->mpitype, 0, iodesc->node_comm,
+                                   &reqs[v])))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    if ((mpierr = MPI_Waitall(nvars, reqs, MPI_STATUSES_IGNORE)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Scatter the data the node leader received from the IO tasks to the
+ * tasks of the node, for PIO_REARR_NODE.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param rbuf receive buffer, of nvars arrays of length
+ * iodesc->ndof, in sorted order if iodesc->needssort.
+ * @param nvars number of variables.
+ * @param unsorted true if rbuf is the caller's array, which is not
+ * sorted.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+node_scatter(iosystem_desc_t *ios, io_desc_t *iodesc, void *rbuf, int nvars,
+             bool unsorted)
+{
+    MPI_Request reqs[nvars];
+    MPI_Datatype rtype = iodesc->mpitype;
+    int rcount = rbuf ? iodesc->ndof : 0;
+    int mpierr;
+
+    /* The caller's own array is filled in sorted order. */
+    if (unsorted && iodesc->needssort && rcount)
+    {
+        rtype = iodesc->node_ustype;
+        rcount = 1;
+    }
+
+    for (int v = 0; v < nvars; v++)
+    {
+        const void *src = (char *)iodesc->node_buf +
+            (size_t)v * iodesc->node_ndof * iodesc->mpitype_size;
+        void *dst = rbuf ? (char *)rbuf + (size_t)v * iodesc->ndof * iodesc->mpitype_size : NULL;
+
+        if ((mpierr = MPI_Iscatterv(src, iodesc->node_counts, iodesc->node_displs,
+                                    iodesc->mpitype, dst, rcount, rtype, 0,
+                                    iodesc->node_comm, &reqs[v])))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    if ((mpierr = MPI_Waitall(nvars, reqs, MPI_STATUSES_IGNORE)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Check whether the shared memory window can be used for this
+ * subset, and if so find where each element this task sends goes in
+ * the IO task's buffer. This is done on the first call with
+ * PIO_REARR_COMM_SHM. It must be called on all tasks of the subset.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+define_shm(iosystem_desc_t *ios, io_desc_t *iodesc)
+{
+    MPI_Comm node;
+    int subset_size, node_size;
+    int subset_rank;
+    int on_node;
+    PIO_Offset *dst = NULL;  /* Destinations, grouped by sender. */
+    int *counts = NULL, *displs = NULL;
+    int mpierr;
+
+    if ((mpierr = MPI_Comm_size(iodesc->subset_comm, &subset_size)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(iodesc->subset_comm, &subset_rank)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Are all tasks of the subset on one node? */
+    if ((mpierr = MPI_Comm_split_type(iodesc->subset_comm, MPI_COMM_TYPE_SHARED, 0,
+                                      MPI_INFO_NULL, &node)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_size(node, &node_size)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_free(&node)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    on_node = node_size == subset_size;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &on_node, 1, MPI_INT, MPI_MIN,
+                                iodesc->subset_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "define_shm on_node = %d", on_node));
+    if (!on_node)
+    {
+        iodesc->shm_state = -1;
+        return PIO_NOERR;
+    }
+
+    /* The IO task (rank 0 of the subset) sorts its receive indices by
+     * sender. The j-th index from a sender is where the j-th element
+     * that sender sends goes. */
+    if (ios->ioproc)
+    {
+        int numinds = 0;
+
+        if (!(counts = calloc(subset_size, sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        if (!(displs = calloc(subset_size, sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        for (int i = 0; i < iodesc->nrecvs; i++)
+        {
+            displs[i] = numinds;
+            numinds += iodesc->rcount[i];
+        }
+        if (numinds)
+            if (!(dst = malloc(numinds * sizeof(PIO_Offset))))
+                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        for (int k = 0; k < numinds; k++)
+        {
+            int from = iodesc->rfrom[k];
+
+            dst[displs[from] + counts[from]++] = iodesc->rindex[k];
+        }
+    }
+
+    if (iodesc->scount[0] > 0)
+        if (!(iodesc->shm_dst = malloc(iodesc->scount[0] * sizeof(PIO_Offset))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if ((mpierr = MPI_Scatterv(dst, counts, displs, PIO_OFFSET, iodesc->shm_dst,
+                               iodesc->scount[0], PIO_OFFSET, 0, iodesc->subset_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    if (dst)
+        free(dst);
+    if (counts)
+        free(counts);
+    if (displs)
+        free(displs);
+    iodesc->shm_state = 1;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free the shared memory window of a decomposition, if there is one.
+ *
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+free_shm_win(io_desc_t *iodesc)
+{
+    int mpierr;
+
+    if (iodesc->shm_nvars)
+    {
+        if ((mpierr = MPI_Win_unlock_all(iodesc->shm_win)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Win_free(&iodesc->shm_win)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        iodesc->shm_nvars = 0;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free the shared memory window of a decomposition, and the indices
+ * used with it.
+ *
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+free_shm(io_desc_t *iodesc)
+{
+    int ret;
+
+    if ((ret = free_shm_win(iodesc)))
+        return ret;
+    if (iodesc->shm_dst)
+    {
+        free(iodesc->shm_dst);
+        iodesc->shm_dst = NULL;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Moves data from compute tasks to the IO task of a subset through a
+ * shared memory window, for PIO_REARR_COMM_SHM. Each task stores its
+ * elements straight into the IO task's window, at the place the IO
+ * task would have received them. The IO task then copies the window
+ * into rbuf. No messages are sent.
+ *
+ * This must be called on all tasks of the subset.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer. May be NULL.
+ * @param sdisp NULL if the nvars arrays are contiguous (and sorted)
+ * in sbuf, otherwise an array (length nvars) of byte displacements
+ * of each of the caller's (unsorted) arrays relative to sbuf.
+ * @param rbuf receive buffer. May be NULL.
+ * @param nvars number of variables.
+ * @param done pointer that gets true if the data were moved, false
+ * if the window can't be used for this subset.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+shm_comp2io(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf, const MPI_Aint *sdisp,
+            void *rbuf, int nvars, bool *done)
+{
+    size_t size = iodesc->mpitype_size;
+    bool unsorted = sdisp && iodesc->needssort;
+    int mpierr;
+    int ret;
+
+    *done = false;
+    if (!iodesc->shm_state)
+        if ((ret = define_shm(ios, iodesc)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (iodesc->shm_state < 0)
+        return PIO_NOERR;
+
+    /* Make room for nvars arrays in the window. All tasks of the
+     * subset know nvars, so they all agree on this. */
+    if (nvars > iodesc->shm_nvars)
+    {
+        MPI_Aint wsize;
+        int disp_unit;
+
+        if ((ret = free_shm_win(iodesc)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        wsize = ios->ioproc ? (MPI_Aint)nvars * iodesc->llen * size : 0;
+        if ((mpierr = MPI_Win_allocate_shared(wsize, 1, MPI_INFO_NULL, iodesc->subset_comm,
+                                              &iodesc->shm_base, &iodesc->shm_win)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Win_shared_query(iodesc->shm_win, 0, &wsize, &disp_unit,
+                                           &iodesc->shm_base)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Win_lock_all(MPI_MODE_NOCHECK, iodesc->shm_win)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        iodesc->shm_nvars = nvars;
+    }
+
+    /* Wait until the IO task is done with the last contents. */
+    if ((mpierr = MPI_Barrier(iodesc->subset_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Store this task's elements. */
+    if (sbuf)
+    {
+        for (int v = 0; v < nvars; v++)
+        {
+            const char *src = sdisp ? (char *)sbuf + sdisp[v] :
+                (char *)sbuf + (size_t)v * iodesc->ndof * size;
+            char *dst = (char *)iodesc->shm_base + (size_t)v * iodesc->llen * size;
+
+            for (int j = 0; j < iodesc->scount[0]; j++)
+            {
+                PIO_Offset s = unsorted ? iodesc->remap[iodesc->sindex[j]] : iodesc->sindex[j];
+
+                memcpy(dst + iodesc->shm_dst[j] * size, src + s * size, size);
+            }
+        }
+    }
+    if ((mpierr = MPI_Win_sync(iodesc->shm_win)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Barrier(iodesc->subset_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* The IO task now has all the data of the subset. */
+    if (ios->ioproc && rbuf)
+    {
+        if ((mpierr = MPI_Win_sync(iodesc->shm_win)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        memcpy(rbuf, iodesc->shm_base, (size_t)nvars * iodesc->llen * size);
+    }
+    *done = true;
+
+    return PIO_NOERR;
+}
+
+/** A message of a rearrangement packed by PIO, see
+ * PIOc_set_rearr_pack(). */
+typedef struct pack_msg
+{
+    /** Index of the peer in iodesc->peers. */
+    int peer;
+
+    /** Positions (length count) of the elements of the message in
+     * each array. */
+    const int *index;
+
+    /** Number of elements of the message in each array. */
+    int count;
+
+    /** Offset (in elements) of the message in the packed buffer. */
+    size_t off;
+} pack_msg_t;
+
+/**
+ * Copy the elements of one array at the positions in index to a
+ * contiguous buffer, or back. Runs of consecutive positions are
+ * copied with one memcpy().
+ *
+ * @param index array (length count) of positions in arr.
+ * @param count number of elements.
+ * @param size size in bytes of an element.
+ * @param arr the array.
+ * @param packed the contiguous buffer, of count elements.
+ * @param unpack true to copy from packed to arr, false to copy from
+ * arr to packed.
+ * @author Ed Hartnett
+ */
+static void
+pack_runs(const int *index, int count, size_t size, char *arr, char *packed, bool unpack)
+{
+    int run;
+
+    for (int j = 0; j < count; j += run)
+    {
+        for (run = 1; j + run < count && index[j + run] == index[j] + run; run++)
+            ;
+        if (unpack)
+            memcpy(arr + (size_t)index[j] * size, packed + (size_t)j * size, run * size);
+        else
+            memcpy(packed + (size_t)j * size, arr + (size_t)index[j] * size, run * size);
+    }
+}
+
+/**
+ * Pack (or unpack) the messages of a rearrangement. In the packed
+ * buffer each message holds the elements of the first array, then
+ * those of the second, and so on, which is the order the MPI
+ * datatypes of the decomposition would send them in. When PIO is
+ * built with OpenMP, the messages and arrays are copied by different
+ * threads.
+ *
+ * @param msg array (length nmsgs) of messages.
+ * @param nmsgs number of messages.
+ * @param nvars number of arrays.
+ * @param size size in bytes of an element.
+ * @param stride distance in bytes between the arrays in buf.
+ * @param buf the arrays.
+ * @param packed the packed buffer.
+ * @param unpack true to copy from packed to buf.
+ * @author Ed Hartnett
+ */
+static void
+pack_msgs(const pack_msg_t *msg, int nmsgs, int nvars, size_t size, MPI_Aint stride,
+          char *buf, char *packed, bool unpack)
+{
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic)
+#endif
+    for (int m = 0; m < nmsgs; m++)
+        for (int v = 0; v < nvars; v++)
+            pack_runs(msg[m].index, msg[m].count, size, buf + v * stride,
+                      packed + (msg[m].off + (size_t)v * msg[m].count) * size, unpack);
+}
+
+/**
+ * Set up the packed rearrangements of a decomposition, the first time
+ * one is done. This finds the positions in the IO buffer of the
+ * elements from each computation task, in the order they are
+ * sent. For the BOX rearranger these are in rindex already. For the
+ * SUBSET rearranger the elements of rindex are in the order of the IO
+ * buffer, so they are sorted by sender into iodesc->pack_rindex.
+ *
+ * It also finds iodesc->pack_maxlen, so all tasks of the rearranger
+ * agree on whether the packed buffers of a number of variables are
+ * small enough for pio_swapm_peers(). This must be called on all
+ * tasks of mycomm.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param mycomm the communicator of the rearranger.
+ * @param niotasks number of IO tasks in mycomm.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+define_pack_index(iosystem_desc_t *ios, io_desc_t *iodesc, MPI_Comm mycomm, int niotasks)
+{
+    PIO_Offset complen = 0, iolen = 0;
+    int mpierr;
+
+    if (iodesc->pack_maxlen)
+        return PIO_NOERR;
+
+    if (!ios->async || ios->compproc)
+        for (int i = 0; i < niotasks; i++)
+            complen += iodesc->scount[i];
+
+    if (ios->ioproc && iodesc->nrecvs)
+    {
+        int pos[iodesc->nrecvs];
+
+        for (int i = 0; i < iodesc->nrecvs; i++)
+        {
+            pos[i] = iolen;
+            iolen += iodesc->rcount[i];
+        }
+        if (iodesc->rearranger == PIO_REARR_SUBSET)
+        {
+            if (!(iodesc->pack_rindex = pio_malloc(PIO_MEM_INDEX, max(1, iolen) * sizeof(int))))
+                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+            for (int k = 0; k < iolen; k++)
+                iodesc->pack_rindex[pos[iodesc->rfrom[k]]++] = iodesc->rindex[k];
+        }
+    }
+
+    iodesc->pack_maxlen = max(1, max(complen, iolen));
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &iodesc->pack_maxlen, 1, PIO_OFFSET, MPI_MAX,
+                                mycomm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Moves data between compute and IO tasks with buffers packed by PIO
+ * instead of the MPI datatypes of the decomposition, for
+ * PIOc_set_rearr_pack(). The elements of each message are copied
+ * (using sindex and rindex) into one contiguous buffer, which is
+ * sent as plain elements of the basic type, and copied out of the
+ * received buffer in the same way.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer. May be NULL.
+ * @param rbuf receive buffer. May be NULL.
+ * @param nvars number of variables.
+ * @param comp2io true to move the data from compute to IO tasks,
+ * false to move it from IO to compute tasks.
+ * @param mycomm the communicator of the rearranger.
+ * @param niotasks number of IO tasks in mycomm.
+ * @param done pointer that gets true if the data were moved, false
+ * if the packed buffers would be too large to describe with int
+ * displacements. This is the same on all tasks of mycomm.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+rearrange_packed(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf, void *rbuf,
+                 int nvars, bool comp2io, MPI_Comm mycomm, int niotasks, bool *done)
+{
+    size_t size = iodesc->mpitype_size;
+    MPI_Aint iostride = (MPI_Aint)iodesc->llen * size;
+    MPI_Aint compstride = (MPI_Aint)(iodesc->nnode ? iodesc->node_ndof : iodesc->ndof) * size;
+    int ncomp = 0, nio = 0;   /* Number of messages of each side. */
+    size_t compsize = 0, iosize = 0; /* Elements packed on each side. */
+    int *sendcounts, *recvcounts, *sdispls, *rdispls;
+    MPI_Datatype *sendtypes, *recvtypes;
+    const int *rindex;
+    char *comppack = NULL, *iopack = NULL;
+    int ret;
+
+    *done = false;
+    if ((ret = define_pack_index(ios, iodesc, mycomm, niotasks)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* The displacements of pio_swapm_peers() are ints. */
+    if ((size_t)nvars * iodesc->pack_maxlen * size > INT_MAX)
+        return PIO_NOERR;
+    rindex = iodesc->pack_rindex ? iodesc->pack_rindex : iodesc->rindex;
+
+    pack_msg_t compmsg[niotasks];
+    pack_msg_t iomsg[max(1, iodesc->nrecvs)];
+
+    /* The messages of the compute task, one to each IO task it has
+     * elements for. */
+    if (!ios->async || ios->compproc)
+    {
+        int pos = 0;
+
+        for (int i = 0; i < niotasks; i++)
+        {
+            if (iodesc->scount[i] > 0 && (sbuf || !comp2io))
+            {
+                int io_comprank = iodesc->rearranger == PIO_REARR_SUBSET ? 0 : ios->ioranks[i];
+
+                compmsg[ncomp].peer = rearr_slot(iodesc, io_comprank);
+                compmsg[ncomp].index = iodesc->sindex + pos;
+                compmsg[ncomp].count = iodesc->scount[i];
+                compmsg[ncomp++].off = compsize;
+                compsize += (size_t)nvars * iodesc->scount[i];
+            }
+            pos += iodesc->scount[i];
+        }
+    }
+
+    /* The messages of the IO task, one with each compute task it has
+     * elements from. */
+    if (ios->ioproc)
+    {
+        int pos = 0;
+
+        for (int i = 0; i < iodesc->nrecvs; i++)
+        {
+            bool subset = iodesc->rearranger == PIO_REARR_SUBSET;
+
+            if (iodesc->rcount[i] > 0 && (sbuf || comp2io || !subset))
+            {
+                iomsg[nio].peer = rearr_slot(iodesc, subset ? i : iodesc->rfrom[i]);
+                iomsg[nio].index = rindex + pos;
+                iomsg[nio].count = iodesc->rcount[i];
+                iomsg[nio++].off = iosize;
+                iosize += (size_t)nvars * iodesc->rcount[i];
+            }
+            pos += iodesc->rcount[i];
+        }
+    }
+
+    if (!(comppack = malloc(max(1, compsize) * size)) ||
+        !(iopack = malloc(max(1, iosize) * size)))
+    {
+        free(comppack);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+
+    /* Each message is a run of elements of the basic type. */
+    if ((ret = get_rearr_args(ios, iodesc, &sendcounts, &sdispls, &sendtypes, &recvcounts,
+                              &rdispls, &recvtypes)))
+        goto exit;
+    for (int m = 0; m < ncomp; m++)
+    {
+        int p = compmsg[m].peer;
+
+        (comp2io ? sendcounts : recvcounts)[p] = nvars * compmsg[m].count;
+        (comp2io ? sdispls : rdispls)[p] = compmsg[m].off * size;
+        (comp2io ? sendtypes : recvtypes)[p] = iodesc->mpitype;
+    }
+    for (int m = 0; m < nio; m++)
+    {
+        int p = iomsg[m].peer;
+
+        (comp2io ? recvcounts : sendcounts)[p] = nvars * iomsg[m].count;
+        (comp2io ? rdispls : sdispls)[p] = iomsg[m].off * size;
+        (comp2io ? recvtypes : sendtypes)[p] = iodesc->mpitype;
+    }
+
+    if (comp2io)
+    {
+        pack_msgs(compmsg, ncomp, nvars, size, compstride, sbuf, comppack, false);
+        ret = pio_swapm_peers(ios, comppack, sendcounts, sdispls, sendtypes, iopack, recvcounts,
+                              rdispls, recvtypes, iodesc->npeers, iodesc->peers, mycomm,
+                              &iodesc->rearr_opts.comp2io);
+        if (!ret)
+            pack_msgs(iomsg, nio, nvars, size, iostride, rbuf, iopack, true);
+    }
+    else
+    {
+        pack_msgs(iomsg, nio, nvars, size, iostride, sbuf, iopack, false);
+        ret = pio_swapm_peers(ios, iopack, sendcounts, sdispls, sendtypes, comppack, recvcounts,
+                              rdispls, recvtypes, iodesc->npeers, iodesc->peers, mycomm,
+                              &iodesc->rearr_opts.io2comp);
+        if (!ret)
+            pack_msgs(compmsg, ncomp, nvars, size, compstride, rbuf, comppack, true);
+    }
+
+    /* The predefined types must not be freed with those of the
+     * datatype path. */
+    for (int i = 0; i < 2 * iodesc->npeers; i++)
+        iodesc->peer_types[i] = PIO_DATATYPE_NULL;
+    *done = !ret;
+
+exit:
+    free(comppack);
+    free(iopack);
+    if (ret)
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Moves data from compute tasks to IO tasks. This does the work for
+ * rearrange_comp2io() and rearrange_comp2io_nocopy().
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param stype array of send types to use for one variable.
+ * @param sbuf send buffer. May be NULL.
+ * @param sdisp NULL if the nvars arrays are contiguous in sbuf,
+ * otherwise an array (length nvars) of byte displacements of each
+ * array relative to sbuf.
+ * @param rbuf receive buffer. May be NULL.
+ * @param nvars number of variables.
+ * @returns 0 on success, error code otherwise.
+ * @author Jim Edwards
+ */
+static int
+rearrange_comp2io_int(iosystem_desc_t *ios, io_desc_t *iodesc, MPI_Datatype *stype,
+                      void *sbuf, const MPI_Aint *sdisp, void *rbuf, int nvars)
+{
+    int npeers;       /* Number of tasks data is exchanged with. */
+    int niotasks;     /* Number of IO tasks. */
+    MPI_Comm mycomm;  /* Communicator that data is transferred over. */
+    int *sendcounts, *recvcounts, *sdispls, *rdispls;
+    MPI_Datatype *sendtypes, *recvtypes;
+    bool persist;     /* Use persistent requests? */
+    int ndof;         /* Length of each array in sbuf. */
+    int mpierr;       /* Return code from MPI calls. */
+    int ret;
+
+    /* Start timer if they are on. */
+    if ((ret = pio_start_timer(ios, PIO_TIMER_COMP2IO)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Caller must provide these. */
+    pioassert(ios && iodesc && nvars > 0, "invalid input", __FILE__, __LINE__);
+
+    PLOG((1, "rearrange_comp2io nvars = %d iodesc->rearranger = %d", nvars,
+          iodesc->rearranger));
+
+    /* With node aggregation, sbuf holds the data of the whole node. */
+    ndof = iodesc->nnode ? iodesc->node_ndof : iodesc->ndof;
+
+    /* If this exchange was done before with the same buffers, just
+     * start its persistent requests again. The nocopy arrays are
+     * different every time, so they don't get persistent requests. */
+    persist = !sdisp && !ios->rearr_pack &&
+        iodesc->rearr_opts.comm_type != PIO_REARR_COMM_NEIGHBOR &&
+        use_rearr_persist(&iodesc->rearr_opts.comp2io);
+    if (persist && rearr_persist_match(&iodesc->comp2io_persist, nvars, sbuf, rbuf))
+    {
+        if ((ret = start_rearr_persist(&iodesc->comp2io_persist)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        if ((ret = pio_stop_timer(ios, PIO_TIMER_COMP2IO)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        return PIO_NOERR;
+    }
+
+    /* Within a node, the subset rearranger may store the data
+     * straight into the IO task's memory. Device arrays can only be
+     * sent by MPI. */
+    if (iodesc->rearranger == PIO_REARR_SUBSET && !ios->async && !ios->device_buffers &&
+        iodesc->rearr_opts.comm_type == PIO_REARR_COMM_SHM)
+    {
+        bool done;
+
+        if ((ret = shm_comp2io(ios, iodesc, sbuf, sdisp, rbuf, nvars, &done)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        if (done)
+        {
+            if ((ret = pio_stop_timer(ios, PIO_TIMER_COMP2IO)))
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            return PIO_NOERR;
+        }
+    }
+
+    /* Different rearraangers use different communicators. */
+    if (iodesc->rearranger == PIO_REARR_BOX)
+    {
+        mycomm = ios->union_comm;
+        niotasks = ios->num_iotasks;
+    }
+    else
+    {
+        mycomm = iodesc->subset_comm;
+        niotasks = 1;
+    }
+
+    /* PIO may pack the buffers itself, when the arrays are sorted and
+     * contiguous. */
+    if (ios->rearr_pack && !sdisp && iodesc->rearr_opts.comm_type != PIO_REARR_COMM_NEIGHBOR)
+    {
+        bool done;
+
+        if ((ret = rearrange_packed(ios, iodesc, sbuf, rbuf, nvars, true, mycomm, niotasks,
+                                    &done)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        if (done)
+        {
+            if ((ret = pio_stop_timer(ios, PIO_TIMER_COMP2IO)))
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            return PIO_NOERR;
+        }
+    }
+
+    /* These are parameters to pio_swapm_peers to send data from
+     * compute to IO tasks. They have an entry for each peer. */
+    if ((ret = get_rearr_args(ios, iodesc, &sendcounts, &sdispls, &sendtypes, &recvcounts,
+                              &rdispls, &recvtypes)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    npeers = iodesc->npeers;
+//    PLOG((3, "ntasks = %d iodesc->mpitype_size = %d niotasks = %d", ntasks,
+//          iodesc->mpitype_size, niotasks));
+
+    /* If this io proc, we need to exchange data with compute
      * tasks. Create a MPI DataType for that exchange. */
 //    PLOG((2, "ios->ioproc %d iodesc->nrecvs = %d", ios->ioproc, iodesc->nrecvs));
     if (ios->ioproc && iodesc->nrecvs > 0)
     {
-        for (int i = 0; i < iodesc->nrecvs; i++)
+        for (int i = 0; i < iodesc->nrecvs; i++)
+        {
+            if (iodesc->rtype[i] != PIO_DATATYPE_NULL)
+            {
+                int from = rearr_slot(iodesc, iodesc->rearranger == PIO_REARR_SUBSET ? i :
+                                      iodesc->rfrom[i]);
+
+                PLOG((3, "iodesc->rtype[%d] = %d iodesc->rearranger = %d", i, iodesc->rtype[i],
+                      iodesc->rearranger));
+                if (iodesc->rearranger == PIO_REARR_SUBSET)
+                {
+                    PLOG((3, "exchanging data for subset rearranger"));
+                    recvcounts[from] = 1;
+
+                    /*  Create an MPI derived data type from equally
+                     *  spaced blocks of the same size. The block size
+                     *  is 1, the stride here is the length of the
+                     *  collected array (llen). */
+                    if ((mpierr = MPI_Type_create_hvector(nvars, 1, (MPI_Aint)iodesc->llen * iodesc->mpitype_size,
+                                                          iodesc->rtype[i], &recvtypes[from])))
+                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+                    pioassert(recvtypes[from] != PIO_DATATYPE_NULL, "bad mpi type", __FILE__, __LINE__);
+
+                    if ((mpierr = MPI_Type_commit(&recvtypes[from])))
+                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+                }
+                else
+                {
+                    recvcounts[from] = 1;
+                    PLOG((3, "exchanging data for box rearranger i = %d iodesc->rfrom[i] = %d "
+                          "recvcounts[from] = %d", i, iodesc->rfrom[i],
+                          recvcounts[from]));
+
+                    if ((mpierr = MPI_Type_create_hvector(nvars, 1, (MPI_Aint)iodesc->llen * iodesc->mpitype_size,
+                                                          iodesc->rtype[i], &recvtypes[from])))
+                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+                    pioassert(recvtypes[from] != PIO_DATATYPE_NULL,  "bad mpi type",
+                              __FILE__, __LINE__);
+
+                    if ((mpierr = MPI_Type_commit(&recvtypes[from])))
+                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+                    rdispls[from] = 0;
+                }
+            }
+        }
+    }
+
+    /* On compute tasks loop over iotasks and create a data type for
+     * each exchange.  */
+    if(!ios->async || ios->compproc)
+    {
+        for (int i = 0; i < niotasks; i++)
+        {
+            int io_comprank = ios->ioranks[i];
+//            PLOG((3, "ios->ioranks[%d] = %d", i, ios->ioranks[i]));
+            if (iodesc->rearranger == PIO_REARR_SUBSET)
+                io_comprank = 0;
+
+            /* The counts of other peers are already 0. */
+            PLOG((3, "i = %d iodesc->scount[i] = %d", i, iodesc->scount[i]));
+            if (iodesc->scount[i] > 0 && sbuf)
+            {
+                io_comprank = rearr_slot(iodesc, io_comprank);
+                PLOG((3, "io task %d creating sendtypes[%d]", i, io_comprank));
+                sendcounts[io_comprank] = 1;
+                if (sdisp)
+                    mpierr = MPI_Type_create_hindexed_block(nvars, 1, sdisp, stype[i],
+                                                            &sendtypes[io_comprank]);
+                else
+                    mpierr = MPI_Type_create_hvector(nvars, 1, (MPI_Aint)ndof * iodesc->mpitype_size,
+                                                     stype[i], &sendtypes[io_comprank]);
+                if (mpierr)
+                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+                pioassert(sendtypes[io_comprank] != PIO_DATATYPE_NULL,  "bad mpi type", __FILE__, __LINE__);
+
+                if ((mpierr = MPI_Type_commit(&sendtypes[io_comprank])))
+                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+            }
+        }
+    }
+
+    /* Keep persistent requests (and the MPI types) for the next time
+     * this exchange is done. */
+    if (persist)
+    {
+        if ((ret = init_rearr_persist(&iodesc->comp2io_persist, nvars, npeers, iodesc->peers,
+                                      sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
+                                      rdispls, recvtypes, mycomm, true)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        if ((ret = start_rearr_persist(&iodesc->comp2io_persist)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        if ((ret = pio_stop_timer(ios, PIO_TIMER_COMP2IO)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        return PIO_NOERR;
+    }
+
+    /* Data in sbuf on the compute nodes is sent to rbuf on the ionodes */
+//    PLOG((2, "about to call pio_swapm for sbuf"));
+    if (iodesc->rearr_opts.comm_type == PIO_REARR_COMM_NEIGHBOR)
+        ret = pio_neighbor_swapm(sbuf, sendcounts, sendtypes, rbuf, recvcounts, recvtypes,
+                                 npeers, iodesc->neighbor_comm);
+    else
+        ret = pio_swapm_peers(ios, sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts, rdispls,
+                              recvtypes, npeers, iodesc->peers, mycomm,
+                              &iodesc->rearr_opts.comp2io);
+    if (ret)
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Free the MPI types. */
+    for (int i = 0; i < npeers; i++)
+    {
+        PLOG((3, "freeing MPI types for task %d", i));
+        if (sendtypes[i] != PIO_DATATYPE_NULL)
+            if ((mpierr = MPI_Type_free(&sendtypes[i])))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+        if (recvtypes[i] != PIO_DATATYPE_NULL)
+            if ((mpierr = MPI_Type_free(&recvtypes[i])))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    if ((ret = pio_stop_timer(ios, PIO_TIMER_COMP2IO)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Moves data from compute tasks to IO tasks. This is called from
+ * PIOc_write_darray_multi().
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer. May be NULL.
+ * @param rbuf receive buffer. May be NULL.
+ * @param nvars number of variables.
+ * @returns 0 on success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+rearrange_comp2io(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                  void *rbuf, int nvars)
+{
+    int ret;
+
+    /* Caller must provide these. */
+    pioassert(ios && iodesc && nvars > 0, "invalid input", __FILE__, __LINE__);
+
+    /* The levels of an extruded decomposition are moved as variables
+     * of the decomposition it extrudes. */
+    if (iodesc->extrude_parent)
+    {
+        io_desc_t *parent;
+
+        if (!(parent = pio_get_iodesc_from_id(iodesc->extrude_parent)))
+            return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+        return rearrange_comp2io(ios, parent, sbuf, rbuf, nvars * iodesc->extrude_nlev);
+    }
+
+    /* If it has not already been done, define the MPI data types that
+     * will be used for this io_desc_t. */
+//    PLOG((2, "Calling define_iodesc_datatypes at line %d sindex[20] = %d",__LINE__,iodesc->sindex[20]));
+    if ((ret = define_iodesc_datatypes(ios, iodesc)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Gather the data of the node on its leader first. */
+    if (iodesc->nnode)
+    {
+        if ((ret = node_gather(ios, iodesc, NULL, sbuf, nvars)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        sbuf = iodesc->node_buf;
+    }
+
+    return rearrange_comp2io_int(ios, iodesc, iodesc->stype, sbuf, NULL, rbuf, nvars);
+}
+
+/**
+ * Moves data from compute tasks to IO tasks, sending directly from
+ * the caller's arrays. The arrays do not need to be contiguous, and
+ * they are not sorted first, even if iodesc->needssort is true, so no
+ * copy of the data is made on the computation tasks. This is called
+ * from PIOc_write_darray_nocopy_wait().
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbufs array (length nvars) of pointers to the arrays to
+ * send. Ignored on tasks that are not computation tasks.
+ * @param rbuf receive buffer. May be NULL.
+ * @param nvars number of variables.
+ * @returns 0 on success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+rearrange_comp2io_nocopy(iosystem_desc_t *ios, io_desc_t *iodesc, void **sbufs,
+                         void *rbuf, int nvars)
+{
+    MPI_Datatype *stype;
+    void *sbuf = NULL;
+    MPI_Aint sdisp[nvars];
+    int mpierr;
+    int ret;
+
+    /* Caller must provide these. */
+    pioassert(ios && iodesc && nvars > 0, "invalid input", __FILE__, __LINE__);
+
+    /* The levels of an extruded decomposition are moved as variables
+     * of the decomposition it extrudes. */
+    if (iodesc->extrude_parent)
+    {
+        io_desc_t *parent;
+        int nlev = iodesc->extrude_nlev;
+        void *lbufs[nvars * nlev];
+
+        if (!(parent = pio_get_iodesc_from_id(iodesc->extrude_parent)))
+            return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+        for (int v = 0; v < nvars; v++)
+            for (int k = 0; k < nlev; k++)
+                lbufs[v * nlev + k] = ios->compproc && sbufs ? (char *)sbufs[v] +
+                    (size_t)k * parent->ndof * parent->mpitype_size : NULL;
+        return rearrange_comp2io_nocopy(ios, parent, lbufs, rbuf, nvars * nlev);
+    }
+
+    if ((ret = define_iodesc_datatypes(ios, iodesc)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* With node aggregation, the arrays are gathered (in sorted
+     * order) straight from the caller's arrays to the node leader,
+     * and sent on from there. */
+    if (iodesc->nnode)
+    {
+        if ((ret = node_gather(ios, iodesc, sbufs, NULL, nvars)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        return rearrange_comp2io_int(ios, iodesc, iodesc->stype, iodesc->node_buf, NULL,
+                                     rbuf, nvars);
+    }
+
+    /* The sorted types can't be used with the caller's arrays. */
+    stype = iodesc->stype;
+    if (iodesc->needssort)
+    {
+        if ((ret = define_iodesc_unsorted_datatypes(ios, iodesc)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        stype = iodesc->ustype;
+    }
+
+    /* Find the displacement of each array relative to the first. */
+    for (int v = 0; v < nvars; v++)
+        sdisp[v] = 0;
+    if (ios->compproc && sbufs)
+    {
+        MPI_Aint base, addr;
+
+        sbuf = sbufs[0];
+        if ((mpierr = MPI_Get_address(sbufs[0], &base)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        for (int v = 1; v < nvars; v++)
         {
-            if (iodesc->rtype[i] != PIO_DATATYPE_NULL)
-            {
-                PLOG((3, "iodesc->rtype[%d] = %d iodesc->rearranger = %d", i, iodesc->rtype[i],
-                      iodesc->rearranger));
-                if (iodesc->rearranger == PIO_REARR_SUBSET)
-                {
-                    PLOG((3, "exchanging data for subset rearranger"));
-                    recvcounts[i] = 1;
+            if ((mpierr = MPI_Get_address(sbufs[v], &addr)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            sdisp[v] = MPI_Aint_diff(addr, base);
+        }
+    }
 
-                    /*  Create an MPI derived data type from equally
-                     *  spaced blocks of the same size. The block size
-                     *  is 1, the stride here is the length of the
-                     *  collected array (llen). */
-                    if ((mpierr = MPI_Type_create_hvector(nvars, 1, (MPI_Aint)iodesc->llen * iodesc->mpitype_size,
-                                                          iodesc->rtype[i], &recvtypes[i])))
-                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    return rearrange_comp2io_int(ios, iodesc, stype, sbuf, sdisp, rbuf, nvars);
+}
+
+/**
+ * Start moving the data of one variable from compute tasks to IO
+ * tasks, without waiting for the messages to complete. This is
+ * called from PIOc_iwrite_darray(). The requests are completed in
+ * PIOc_wait_darray().
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer, sorted if iodesc->needssort. May be NULL.
+ * @param rbuf receive buffer. May be NULL.
+ * @param reqsp pointer that gets an allocated array of MPI
+ * requests. Must be freed by caller.
+ * @param nreqs pointer that gets the number of requests.
+ * @returns 0 on success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+rearrange_comp2io_start(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                        void *rbuf, MPI_Request **reqsp, int *nreqs)
+{
+    int niotasks;     /* Number of IO tasks. */
+    int maxreqs;      /* Most messages this task may take part in. */
+    MPI_Comm mycomm;  /* Communicator that data is transferred over. */
+    int *sendcounts, *recvcounts, *sdispls, *rdispls;
+    MPI_Datatype *sendtypes, *recvtypes;
+    int ret;
 
-                    pioassert(recvtypes[i] != PIO_DATATYPE_NULL, "bad mpi type", __FILE__, __LINE__);
+    /* Caller must provide these. */
+    pioassert(ios && iodesc && reqsp && nreqs, "invalid input", __FILE__, __LINE__);
 
-                    if ((mpierr = MPI_Type_commit(&recvtypes[i])))
-                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-                }
-                else
-                {
-                    recvcounts[iodesc->rfrom[i]] = 1;
-                    PLOG((3, "exchanging data for box rearranger i = %d iodesc->rfrom[i] = %d "
-                          "recvcounts[iodesc->rfrom[i]] = %d", i, iodesc->rfrom[i],
-                          recvcounts[iodesc->rfrom[i]]));
+    PLOG((1, "rearrange_comp2io_start iodesc->rearranger = %d", iodesc->rearranger));
 
-                    if ((mpierr = MPI_Type_create_hvector(nvars, 1, (MPI_Aint)iodesc->llen * iodesc->mpitype_size,
-                                                          iodesc->rtype[i], &recvtypes[iodesc->rfrom[i]])))
-                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    /* The node gather must finish before the data can be sent on, so
+     * with node aggregation the whole rearrangement is done now. So
+     * it is for the levels of an extruded decomposition. */
+    if (iodesc->nnode || iodesc->extrude_parent)
+    {
+        *reqsp = NULL;
+        *nreqs = 0;
+        return rearrange_comp2io(ios, iodesc, sbuf, rbuf, 1);
+    }
 
-                    pioassert(recvtypes[iodesc->rfrom[i]] != PIO_DATATYPE_NULL,  "bad mpi type",
-                              __FILE__, __LINE__);
+    if ((ret = define_iodesc_datatypes(ios, iodesc)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-                    if ((mpierr = MPI_Type_commit(&recvtypes[iodesc->rfrom[i]])))
-                        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    /* Different rearraangers use different communicators. */
+    if (iodesc->rearranger == PIO_REARR_BOX)
+    {
+        mycomm = ios->union_comm;
+        niotasks = ios->num_iotasks;
+    }
+    else
+    {
+        mycomm = iodesc->subset_comm;
+        niotasks = 1;
+    }
 
-                    rdispls[iodesc->rfrom[i]] = 0;
-                }
+    /* These are parameters to pio_iswapm, with an entry for each
+     * peer. With only one variable the types of the decomposition can
+     * be used directly. */
+    if ((ret = get_rearr_args(ios, iodesc, &sendcounts, &sdispls, &sendtypes, &recvcounts,
+                              &rdispls, &recvtypes)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* On IO tasks, receive from each compute task that has data. */
+    maxreqs = niotasks;
+    if (ios->ioproc && iodesc->nrecvs > 0)
+    {
+        maxreqs += iodesc->nrecvs;
+        for (int i = 0; i < iodesc->nrecvs; i++)
+        {
+            if (iodesc->rtype[i] != PIO_DATATYPE_NULL)
+            {
+                int from = rearr_slot(iodesc, iodesc->rearranger == PIO_REARR_SUBSET ? i :
+                                      iodesc->rfrom[i]);
+
+                recvcounts[from] = 1;
+                recvtypes[from] = iodesc->rtype[i];
             }
         }
     }
 
-    /* On compute tasks loop over iotasks and create a data type for
-     * each exchange.  */
-    if(!ios->async || ios->compproc)
+    /* On compute tasks, send to each IO task that needs our data. */
+    if (!ios->async || ios->compproc)
     {
         for (int i = 0; i < niotasks; i++)
         {
             int io_comprank = ios->ioranks[i];
-//            PLOG((3, "ios->ioranks[%d] = %d", i, ios->ioranks[i]));
+
             if (iodesc->rearranger == PIO_REARR_SUBSET)
                 io_comprank = 0;
 
-            PLOG((3, "i = %d iodesc->scount[i] = %d", i, iodesc->scount[i]));
             if (iodesc->scount[i] > 0 && sbuf)
             {
-                PLOG((3, "io task %d creating sendtypes[%d]", i, io_comprank));
+                io_comprank = rearr_slot(iodesc, io_comprank);
                 sendcounts[io_comprank] = 1;
-                if ((mpierr = MPI_Type_create_hvector(nvars, 1, (MPI_Aint)iodesc->ndof * iodesc->mpitype_size,
-                                                      iodesc->stype[i], &sendtypes[io_comprank])))
-                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-                pioassert(sendtypes[io_comprank] != PIO_DATATYPE_NULL,  "bad mpi type", __FILE__, __LINE__);
-
-                if ((mpierr = MPI_Type_commit(&sendtypes[io_comprank])))
-                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+                sendtypes[io_comprank] = iodesc->stype[i];
             }
-            else
+        }
+    }
+
+    if (!(*reqsp = malloc(maxreqs * sizeof(MPI_Request))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Post the messages. */
+    if ((ret = pio_iswapm(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts, rdispls,
+                          recvtypes, iodesc->npeers, iodesc->peers, mycomm, maxreqs, *reqsp,
+                          nreqs)))
+    {
+        free(*reqsp);
+        *reqsp = NULL;
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Make the MPI type of nvars arrays, each described by type, which
+ * are stride bytes apart. For one array, the type itself is used.
+ *
+ * @param type the type of one array.
+ * @param nvars number of arrays.
+ * @param stride bytes between the start of each array.
+ * @param typep pointer that gets the type.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+multi_var_type(MPI_Datatype type, int nvars, MPI_Aint stride, MPI_Datatype *typep)
+{
+    int mpierr;
+
+    if (nvars == 1)
+    {
+        *typep = type;
+        return PIO_NOERR;
+    }
+    if ((mpierr = MPI_Type_create_hvector(nvars, 1, stride, type, typep)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Type_commit(typep)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Moves data from IO tasks to compute tasks. This does the work for
+ * rearrange_io2comp() and rearrange_io2comp_multi().
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer.
+ * @param rbuf receive buffer.
+ * @param nvars number of variables. With more than one, the arrays
+ * are iodesc->llen elements apart in sbuf, and iodesc->ndof (or
+ * iodesc->node_ndof) elements apart in rbuf.
+ * @param unsorted true if rbuf is the caller's array, which is not
+ * sorted even if iodesc->needssort is true.
+ * @returns 0 on success, error code otherwise.
+ * @author Jim Edwards
+ */
+static int
+rearrange_io2comp_int(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                      void *rbuf, int nvars, bool unsorted)
+{
+    MPI_Comm mycomm;
+    int npeers;   /* Number of tasks data is exchanged with. */
+    int niotasks;
+    int *sendcounts, *recvcounts, *sdispls, *rdispls;
+    MPI_Datatype *sendtypes, *recvtypes;
+    MPI_Aint sstride = (MPI_Aint)iodesc->llen * iodesc->mpitype_size;
+    MPI_Aint rstride = (MPI_Aint)(iodesc->nnode ? iodesc->node_ndof : iodesc->ndof) *
+        iodesc->mpitype_size;
+    MPI_Datatype *rtype;  /* The types of the data received from each IO task. */
+    int ret;
+
+    /* Check inputs. */
+    pioassert(ios && iodesc, "invalid input", __FILE__, __LINE__);
+    PLOG((2, "rearrange_io2comp iodesc->rearranger %d", iodesc->rearranger));
+
+    /* Start timer if they are on. */
+    if ((ret = pio_start_timer(ios, PIO_TIMER_IO2COMP)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Different rearrangers use different communicators and number of
+     * IO tasks. */
+    if (iodesc->rearranger == PIO_REARR_BOX)
+    {
+        mycomm = ios->union_comm;
+        niotasks = ios->num_iotasks;
+    }
+    else
+    {
+        mycomm = iodesc->subset_comm;
+        niotasks = 1;
+    }
+
+//    PLOG((3, "niotasks %d ntasks %d", niotasks, ntasks));
+
+    /* PIO may pack the buffers itself, unless the data are received
+     * into the caller's unsorted array. */
+    if (ios->rearr_pack && !(unsorted && iodesc->needssort) &&
+        iodesc->rearr_opts.comm_type != PIO_REARR_COMM_NEIGHBOR)
+    {
+        bool done;
+
+        if ((ret = rearrange_packed(ios, iodesc, sbuf, rbuf, nvars, false, mycomm, niotasks,
+                                    &done)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        if (done)
+        {
+            if ((ret = pio_stop_timer(ios, PIO_TIMER_IO2COMP)))
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+            return PIO_NOERR;
+        }
+    }
+
+    /* Define the MPI data types that will be used for this
+     * io_desc_t. */
+//    PLOG((2, "Calling define_iodesc_datatypes at line %d",__LINE__));
+    if ((ret = define_iodesc_datatypes(ios, iodesc)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* The sorted types can't be used with the caller's array. */
+    rtype = iodesc->stype;
+    if (unsorted && iodesc->needssort)
+    {
+        if ((ret = define_iodesc_unsorted_datatypes(ios, iodesc)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        rtype = iodesc->ustype;
+    }
+
+    /* Get the arrays needed by the pio_swapm_peers() function, with
+     * an entry for each peer. */
+    if ((ret = get_rearr_args(ios, iodesc, &sendcounts, &sdispls, &sendtypes, &recvcounts,
+                              &rdispls, &recvtypes)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    npeers = iodesc->npeers;
+
+    /* In IO tasks set up sendcounts/sendtypes for pio_swapm() call
+     * below. */
+    if (ios->ioproc)
+    {
+        for (int i = 0; i < iodesc->nrecvs; i++)
+        {
+            if (iodesc->rtype[i] != PIO_DATATYPE_NULL)
             {
-                sendcounts[io_comprank] = 0;
+                if (iodesc->rearranger == PIO_REARR_SUBSET)
+                {
+                    if (sbuf)
+                    {
+                        int to = rearr_slot(iodesc, i);
+
+                        sendcounts[to] = 1;
+                        if ((ret = multi_var_type(iodesc->rtype[i], nvars, sstride,
+                                                  &sendtypes[to])))
+                            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+                    }
+                }
+                else
+                {
+                    int to = rearr_slot(iodesc, iodesc->rfrom[i]);
+
+                    sendcounts[to] = 1;
+                    if ((ret = multi_var_type(iodesc->rtype[i], nvars, sstride, &sendtypes[to])))
+                        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+                }
             }
         }
     }
 
-    /* Data in sbuf on the compute nodes is sent to rbuf on the ionodes */
-//    PLOG((2, "about to call pio_swapm for sbuf"));
-    if ((ret = pio_swapm(sbuf, sendcounts, sdispls, sendtypes,
-                         rbuf, recvcounts, rdispls, recvtypes, mycomm,
-                         &iodesc->rearr_opts.comp2io)))
+    /* In the box rearranger each comp task may communicate with
+     * multiple IO tasks here we are setting the count and data type
+     * of the communication of a given compute task with each io
+     * task. */
+    for (int i = 0; i < niotasks; i++)
+    {
+        int io_comprank = ios->ioranks[i];
+
+        if (iodesc->rearranger == PIO_REARR_SUBSET)
+            io_comprank = 0;
+
+        if (iodesc->scount[i] > 0 && rtype[i] != PIO_DATATYPE_NULL)
+        {
+            io_comprank = rearr_slot(iodesc, io_comprank);
+            recvcounts[io_comprank] = 1;
+            if ((ret = multi_var_type(rtype[i], nvars, rstride, &recvtypes[io_comprank])))
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        }
+    }
+
+    /* Data in sbuf on the ionodes is sent to rbuf on the compute
+     * nodes. When the flow control options allow, persistent
+     * requests are kept and started again each time the same buffers
+     * are used. */
+    if (iodesc->rearr_opts.comm_type == PIO_REARR_COMM_NEIGHBOR)
+    {
+        if ((ret = pio_neighbor_swapm(sbuf, sendcounts, sendtypes, rbuf, recvcounts,
+                                      recvtypes, npeers, iodesc->neighbor_comm)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+    else if (use_rearr_persist(&iodesc->rearr_opts.io2comp) && nvars == 1 && !unsorted)
+    {
+        rearr_persist_t *pr = &iodesc->io2comp_persist;
+
+        if (!rearr_persist_match(pr, 1, sbuf, rbuf))
+            if ((ret = init_rearr_persist(pr, 1, npeers, iodesc->peers, sbuf, sendcounts,
+                                          sdispls, sendtypes, rbuf, recvcounts, rdispls,
+                                          recvtypes, mycomm, false)))
+                return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        if ((ret = start_rearr_persist(pr)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+    else if ((ret = pio_swapm_peers(ios, sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
+                                    rdispls, recvtypes, npeers, iodesc->peers, mycomm,
+                                    &iodesc->rearr_opts.io2comp)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Free the types made for more than one var. */
+    if (nvars > 1)
+        for (int i = 0; i < npeers; i++)
+        {
+            if (sendtypes[i] != PIO_DATATYPE_NULL)
+                MPI_Type_free(&sendtypes[i]);
+            if (recvtypes[i] != PIO_DATATYPE_NULL)
+                MPI_Type_free(&recvtypes[i]);
+        }
+
+    if ((ret = pio_stop_timer(ios, PIO_TIMER_IO2COMP)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-    /* Free the MPI types. */
-    for (int i = 0; i < ntasks; i++)
+    return PIO_NOERR;
+}
+
+/**
+ * Moves the data of nvars variables from IO tasks to compute
+ * tasks. With node aggregation, the data of the node is received by
+ * the node leader, and scattered from there. This does the work for
+ * rearrange_io2comp(), rearrange_io2comp_nocopy() and
+ * rearrange_io2comp_multi().
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer, of nvars arrays of iodesc->llen elements.
+ * @param rbuf receive buffer, of nvars arrays of iodesc->ndof
+ * elements.
+ * @param nvars number of variables.
+ * @param unsorted true if rbuf is the caller's array, which is not
+ * sorted even if iodesc->needssort is true.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+io2comp_vars(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf, void *rbuf, int nvars,
+             bool unsorted)
+{
+    int ret;
+
+    /* The levels of an extruded decomposition are moved as variables
+     * of the decomposition it extrudes. */
+    if (iodesc->extrude_parent)
     {
-        PLOG((3, "freeing MPI types for task %d", i));
-        if (sendtypes[i] != PIO_DATATYPE_NULL)
-            if ((mpierr = MPI_Type_free(&sendtypes[i])))
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        io_desc_t *parent;
 
-        if (recvtypes[i] != PIO_DATATYPE_NULL)
-            if ((mpierr = MPI_Type_free(&recvtypes[i])))
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        if (!(parent = pio_get_iodesc_from_id(iodesc->extrude_parent)))
+            return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+        return io2comp_vars(ios, parent, sbuf, rbuf, nvars * iodesc->extrude_nlev, unsorted);
     }
 
-#ifdef TIMING
-    if ((ret = pio_stop_timer("PIO:rearrange_comp2io")))
+    if (!iodesc->nnode)
+        return rearrange_io2comp_int(ios, iodesc, sbuf, rbuf, nvars, unsorted);
+
+    if ((ret = node_buf_size(ios, iodesc, nvars)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = rearrange_io2comp_int(ios, iodesc, sbuf, iodesc->node_buf, nvars, false)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-#endif /* TIMING */
 
-    return PIO_NOERR;
+    return node_scatter(ios, iodesc, rbuf, nvars, unsorted);
 }
 
 /**
@@ -1023,22 +2874,102 @@ rearrange_comp2io(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
 int
 rearrange_io2comp(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
                   void *rbuf)
+{
+    /* Check inputs. */
+    pioassert(ios && iodesc, "invalid input", __FILE__, __LINE__);
+
+    return io2comp_vars(ios, iodesc, sbuf, rbuf, 1, false);
+}
+
+/**
+ * Moves data from IO tasks to compute tasks, receiving directly into
+ * the caller's array. The array is not sorted afterwards, even if
+ * iodesc->needssort is true, since the data are received with MPI
+ * datatypes that put each element in its place. No copy of the data
+ * is made on the computation tasks. This is used in
+ * PIOc_read_darray() for device arrays (see
+ * PIOc_set_device_buffers()).
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer.
+ * @param rbuf the caller's array. Ignored on tasks that are not
+ * computation tasks.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+rearrange_io2comp_nocopy(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                         void *rbuf)
+{
+    /* Check inputs. */
+    pioassert(ios && iodesc, "invalid input", __FILE__, __LINE__);
+
+    return io2comp_vars(ios, iodesc, sbuf, rbuf, 1, true);
+}
+
+/**
+ * Moves the data of nvars variables from IO tasks to compute tasks,
+ * in one exchange. This function is used in PIOc_read_darray_multi().
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer, of nvars arrays of iodesc->llen elements.
+ * @param rbuf receive buffer, of nvars arrays of iodesc->ndof
+ * elements.
+ * @param nvars number of variables.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+rearrange_io2comp_multi(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                        void *rbuf, int nvars)
+{
+    /* Check inputs. */
+    pioassert(ios && iodesc && nvars > 0, "invalid input", __FILE__, __LINE__);
+
+    return io2comp_vars(ios, iodesc, sbuf, rbuf, nvars, false);
+}
+
+/**
+ * Start moving data from IO tasks to compute tasks, without waiting
+ * for the messages to complete. This is used by PIOc_iread_darray()
+ * and PIOc_wait_darray().
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param iodesc a pointer to the io_desc_t struct.
+ * @param sbuf send buffer.
+ * @param rbuf receive buffer.
+ * @param reqsp pointer that gets an allocated array of MPI
+ * requests. Must be freed by caller.
+ * @param nreqs pointer that gets the number of requests.
+ * @returns 0 on success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+rearrange_io2comp_start(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
+                        void *rbuf, MPI_Request **reqsp, int *nreqs)
 {
     MPI_Comm mycomm;
-    int ntasks;
     int niotasks;
-    int mpierr; /* Return code from MPI calls. */
+    int maxreqs;  /* Most messages this task may take part in. */
+    int *sendcounts, *recvcounts, *sdispls, *rdispls;
+    MPI_Datatype *sendtypes, *recvtypes;
     int ret;
 
     /* Check inputs. */
-    pioassert(ios && iodesc, "invalid input", __FILE__, __LINE__);
-    PLOG((2, "rearrange_io2comp iodesc->rearranger %d", iodesc->rearranger));
+    pioassert(ios && iodesc && reqsp && nreqs, "invalid input", __FILE__, __LINE__);
+    PLOG((2, "rearrange_io2comp_start iodesc->rearranger %d", iodesc->rearranger));
 
-#ifdef TIMING
-    /* Start timer if desired. */
-    if ((ret = pio_start_timer("PIO:rearrange_io2comp")))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-#endif /* TIMING */
+    /* With node aggregation the scatter must wait for the data, so
+     * the whole rearrangement is done now. So it is for the levels of
+     * an extruded decomposition. */
+    if (iodesc->nnode || iodesc->extrude_parent)
+    {
+        *reqsp = NULL;
+        *nreqs = 0;
+        return rearrange_io2comp(ios, iodesc, sbuf, rbuf);
+    }
 
     /* Different rearrangers use different communicators and number of
      * IO tasks. */
@@ -1053,40 +2984,22 @@ rearrange_io2comp(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
         niotasks = 1;
     }
 
-    /* Get the size of this communicator. */
-    if ((mpierr = MPI_Comm_size(mycomm, &ntasks)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-//    PLOG((3, "niotasks %d ntasks %d", niotasks, ntasks));
-
     /* Define the MPI data types that will be used for this
      * io_desc_t. */
-//    PLOG((2, "Calling define_iodesc_datatypes at line %d",__LINE__));
     if ((ret = define_iodesc_datatypes(ios, iodesc)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-    /* Allocate arrays needed by the pio_swapm() function. */
-    int sendcounts[ntasks];
-    int recvcounts[ntasks];
-    int sdispls[ntasks];
-    int rdispls[ntasks];
-    MPI_Datatype sendtypes[ntasks];
-    MPI_Datatype recvtypes[ntasks];
-
-    /* Initialize arrays. */
-    for (int i = 0; i < ntasks; i++)
-    {
-        sendcounts[i] = 0;
-        recvcounts[i] = 0;
-        sdispls[i] = 0;
-        rdispls[i] = 0;
-        sendtypes[i] = PIO_DATATYPE_NULL;
-        recvtypes[i] = PIO_DATATYPE_NULL;
-    }
+    /* Get the arrays needed by the pio_iswapm() function, with an
+     * entry for each peer. */
+    if ((ret = get_rearr_args(ios, iodesc, &sendcounts, &sdispls, &sendtypes, &recvcounts,
+                              &rdispls, &recvtypes)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
-    /* In IO tasks set up sendcounts/sendtypes for pio_swapm() call
-     * below. */
+    /* In IO tasks send to each compute task that needs data. */
+    maxreqs = niotasks;
     if (ios->ioproc)
     {
+        maxreqs += iodesc->nrecvs;
         for (int i = 0; i < iodesc->nrecvs; i++)
         {
             if (iodesc->rtype[i] != PIO_DATATYPE_NULL)
@@ -1095,23 +3008,25 @@ rearrange_io2comp(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
                 {
                     if (sbuf)
                     {
-                        sendcounts[i] = 1;
-                        sendtypes[i] = iodesc->rtype[i];
+                        int to = rearr_slot(iodesc, i);
+
+                        sendcounts[to] = 1;
+                        sendtypes[to] = iodesc->rtype[i];
                     }
                 }
                 else
                 {
-                    sendcounts[iodesc->rfrom[i]] = 1;
-                    sendtypes[iodesc->rfrom[i]] = iodesc->rtype[i];
+                    int to = rearr_slot(iodesc, iodesc->rfrom[i]);
+
+                    sendcounts[to] = 1;
+                    sendtypes[to] = iodesc->rtype[i];
                 }
             }
         }
     }
 
-    /* In the box rearranger each comp task may communicate with
-     * multiple IO tasks here we are setting the count and data type
-     * of the communication of a given compute task with each io
-     * task. */
+    /* On compute tasks receive from each IO task that has our
+     * data. */
     for (int i = 0; i < niotasks; i++)
     {
         int io_comprank = ios->ioranks[i];
@@ -1121,22 +3036,24 @@ rearrange_io2comp(iosystem_desc_t *ios, io_desc_t *iodesc, void *sbuf,
 
         if (iodesc->scount[i] > 0 && iodesc->stype[i] != PIO_DATATYPE_NULL)
         {
+            io_comprank = rearr_slot(iodesc, io_comprank);
             recvcounts[io_comprank] = 1;
             recvtypes[io_comprank] = iodesc->stype[i];
         }
     }
 
-    /* Data in sbuf on the ionodes is sent to rbuf on the compute
-     * nodes. */
-
-    if ((ret = pio_swapm(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
-                         rdispls, recvtypes, mycomm, &iodesc->rearr_opts.io2comp)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (!(*reqsp = malloc(maxreqs * sizeof(MPI_Request))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
 
-#ifdef TIMING
-    if ((ret = pio_stop_timer("PIO:rearrange_io2comp")))
+    /* Post the messages. */
+    if ((ret = pio_iswapm(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts, rdispls,
+                          recvtypes, iodesc->npeers, iodesc->peers, mycomm, maxreqs, *reqsp,
+                          nreqs)))
+    {
+        free(*reqsp);
+        *reqsp = NULL;
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-#endif
+    }
 
     return PIO_NOERR;
 }
@@ -1198,6 +3115,211 @@ determine_fill(iosystem_desc_t *ios, io_desc_t *iodesc, const int *gdimlen,
     return PIO_NOERR;
 }
 
+/**
+ * One IO box, as used by box_find_dest().
+ */
+typedef struct box_key
+{
+    /** Start of the box along the slowest dimension. */
+    PIO_Offset start0;
+
+    /** End (exclusive) of the box along the slowest dimension. */
+    PIO_Offset end0;
+
+    /** The IO task which holds the box. */
+    int iotask;
+} box_key;
+
+/**
+ * Compare two IO boxes by their start along the slowest dimension,
+ * then by IO task. This function is passed to qsort.
+ *
+ * @param a pointer to a box_key.
+ * @param b pointer to another box_key.
+ * @returns -1, 0 or 1.
+ * @author Ed Hartnett
+ */
+static int
+compare_box_keys(const void *a, const void *b)
+{
+    const box_key *x = a;
+    const box_key *y = b;
+
+    if (x->start0 != y->start0)
+        return x->start0 < y->start0 ? -1 : 1;
+    return (x->iotask > y->iotask) - (x->iotask < y->iotask);
+}
+
+/**
+ * Find the IO task, and the index into the data of that IO task, of
+ * each element of a compute task map, for the box rearranger.
+ *
+ * Rather than testing every element against every IO box, the boxes
+ * are grouped by their extent along the slowest dimension, and each
+ * element finds its group with a binary search. The box
+ * partitions of PIO split the slowest dimensions first, so a group
+ * holds one or a few boxes, and the cost is O(maplen * log(nio))
+ * rather than O(maplen * nio). If the extents of the groups overlap
+ * (which a user partition may do) all boxes are searched in IO task
+ * order, as before.
+ *
+ * The loop over the map has no shared state, and is run in parallel
+ * when the library is built with OpenMP.
+ *
+ * @param ndims the number of dimensions.
+ * @param gdimlen an array length ndims with the sizes of the global
+ * dimensions.
+ * @param nio the number of IO tasks.
+ * @param sc_info array of nio messages of length 2 * ndims + 1, each
+ * holding [llen, start[ndims], count[ndims]] of one IO task. IO tasks
+ * with an llen of 0 have no box.
+ * @param maplen the length of the map.
+ * @param compmap a 1 based array of offsets into the global
+ * space. Elements of 0 are not sent anywhere.
+ * @param dest_ioproc array of length maplen that gets the IO task of
+ * each element, or -1 if none.
+ * @param dest_ioindex array of length maplen that gets the index into
+ * the IO task data of each element, or -1 if none.
+ * @returns 0 on success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+box_find_dest(int ndims, const int *gdimlen, int nio, const PIO_Offset *sc_info,
+              int maplen, const PIO_Offset *compmap, int *dest_ioproc,
+              PIO_Offset *dest_ioindex)
+{
+    int sc_info_sz = 2 * ndims + 1;
+    box_key *box;
+    int *grp;     /* Index into box of the first box of each group. */
+    int nbox = 0;
+    int ngrp = 0;
+    PIO_Offset maxend = 0; /* Largest end of the groups so far. */
+
+    pioassert(ndims > 0 && gdimlen && nio >= 0 && (!nio || sc_info) && maplen >= 0 &&
+              (!maplen || (compmap && dest_ioproc && dest_ioindex)), "invalid input",
+              __FILE__, __LINE__);
+
+    if (!(box = malloc(max(nio, 1) * sizeof(box_key))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(grp = malloc((max(nio, 1) + 1) * sizeof(int))))
+    {
+        free(box);
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+
+    /* List the IO tasks which hold data, by their start in the
+     * slowest dimension. */
+    for (int i = 0; i < nio; i++)
+    {
+        const PIO_Offset *msg = &sc_info[i * sc_info_sz];
+
+        if (msg[0] > 0)
+        {
+            box[nbox].start0 = msg[1];
+            box[nbox].end0 = msg[1] + msg[1 + ndims];
+            box[nbox].iotask = i;
+            nbox++;
+        }
+    }
+    qsort(box, nbox, sizeof(box_key), compare_box_keys);
+
+    /* Boxes with the same extent in the slowest dimension make a
+     * group. */
+    for (int b = 0; b < nbox; b++)
+    {
+        if (!b || box[b].start0 != box[b - 1].start0 || box[b].end0 != box[b - 1].end0)
+        {
+            /* Groups which overlap cannot be searched by their
+             * start. Put all boxes in one group, in IO task order. */
+            if (b && box[b].start0 < maxend)
+            {
+                for (int c = 0; c < nbox; c++)
+                {
+                    box[c].start0 = 0;
+                    box[c].end0 = gdimlen[0];
+                }
+                qsort(box, nbox, sizeof(box_key), compare_box_keys);
+                grp[0] = 0;
+                ngrp = 1;
+                PLOG((2, "box_find_dest IO boxes overlap, searching all %d", nbox));
+                break;
+            }
+            grp[ngrp++] = b;
+        }
+        maxend = max(maxend, box[b].end0);
+    }
+    grp[ngrp] = nbox;
+    PLOG((2, "box_find_dest nio = %d nbox = %d ngrp = %d", nio, nbox, ngrp));
+
+#if defined(_OPENMP) && !PIO_ENABLE_LOGGING
+#pragma omp parallel for schedule(static)
+#endif /* _OPENMP */
+    for (int k = 0; k < maplen; k++)
+    {
+        PIO_Offset gcoord[ndims];
+        PIO_Offset lcoord[ndims];
+        int lo = 0, hi = ngrp - 1;
+        int g = -1;
+
+        dest_ioproc[k] = -1;
+        dest_ioindex[k] = -1;
+        if (compmap[k] <= 0)
+            continue;
+
+        /* The compmap array is 1 based but calculations are 0 based. */
+        idx_to_dim_list(ndims, gdimlen, compmap[k] - 1, gcoord);
+
+        /* Find the last group which starts at or before this
+         * element. */
+        while (lo <= hi)
+        {
+            int mid = (lo + hi) / 2;
+
+            if (box[grp[mid]].start0 <= gcoord[0])
+            {
+                g = mid;
+                lo = mid + 1;
+            }
+            else
+                hi = mid - 1;
+        }
+        if (g < 0 || gcoord[0] >= box[grp[g]].end0)
+            continue;
+
+        /* Look for the element in the boxes of the group, in IO task
+         * order. */
+        for (int b = grp[g]; b < grp[g + 1]; b++)
+        {
+            const PIO_Offset *start = &sc_info[box[b].iotask * sc_info_sz + 1];
+            const PIO_Offset *count = start + ndims;
+            bool found = true;
+
+            for (int j = 0; j < ndims; j++)
+            {
+                if (gcoord[j] >= start[j] && gcoord[j] < start[j] + count[j])
+                    lcoord[j] = gcoord[j] - start[j];
+                else
+                {
+                    found = false;
+                    break;
+                }
+            }
+
+            if (found)
+            {
+                dest_ioindex[k] = coord_to_lindex(ndims, lcoord, count);
+                dest_ioproc[k] = box[b].iotask;
+                break;
+            }
+        }
+    }
+
+    free(box);
+    free(grp);
+
+    return PIO_NOERR;
+}
+
 /**
  * The box rearranger computes a mapping between IO tasks and compute
  * tasks such that the data on IO tasks can be written with a single
@@ -1245,7 +3367,7 @@ box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap
     int ret;
 
     /* Check inputs. */
-    pioassert(ios && maplen >= 0 && compmap && gdimlen && ndims > 0 && iodesc,
+    pioassert(ios && maplen >= 0 && (compmap || !maplen) && gdimlen && ndims > 0 && iodesc,
               "invalid input", __FILE__, __LINE__);
     PLOG((1, "box_rearrange_create maplen = %d ndims = %d ios->num_comptasks = %d "
           "ios->num_iotasks = %d", maplen, ndims, ios->num_comptasks, ios->num_iotasks));
@@ -1253,13 +3375,11 @@ box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap
     /* Allocate arrays needed for this function. */
     int *dest_ioproc = NULL; /* Destination IO task for each data element on compute task. */
     PIO_Offset *dest_ioindex = NULL;    /* Offset into IO task array for each data element. */
-    PIO_Offset **gcoord_map = NULL; /* Global coordinate value for each data element. */
     int sendcounts[ios->num_uniontasks]; /* Send counts for swapm call. */
     int sdispls[ios->num_uniontasks];    /* Send displacements for swapm. */
     int recvcounts[ios->num_uniontasks]; /* Receive counts for swapm. */
     int rdispls[ios->num_uniontasks];    /* Receive displacements for swapm. */
     MPI_Datatype dtypes[ios->num_uniontasks]; /* Array of MPI_OFFSET types for swapm. */
-    PIO_Offset iomaplen[ios->num_iotasks];   /* Gets the llen of all IO tasks. */
 
     /* sc_info msg = [iomaplen, starts_for_all_dims, count_for_all_dims] */
     int sc_info_msg_maplen_sz = 1; /* The iomaplen, == 0 implies start/count are invalid */
@@ -1268,11 +3388,9 @@ box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap
     PIO_Offset sc_info_msg_send[sc_info_msg_sz];
     PIO_Offset sc_info_msg_recv[ios->num_iotasks * sc_info_msg_sz];
 
-#ifdef TIMING
-    /* Start timer if desired. */
-    if ((ret = pio_start_timer("PIO:box_rearrange_create")))
+    /* Start timer if they are on. */
+    if ((ret = pio_start_timer(ios, PIO_TIMER_BOX_CREATE)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-#endif /* TIMING */
 
     /* This is the box rearranger. */
     iodesc->rearranger = PIO_REARR_BOX;
@@ -1287,15 +3405,6 @@ box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap
 
         if (!(dest_ioindex = malloc(maplen * sizeof(PIO_Offset))))
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-
-        if (!(gcoord_map = malloc(maplen * sizeof(PIO_Offset*))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-
-        for (int i = 0; i < maplen; i++)
-        {
-            if (!(gcoord_map[i] = calloc(ndims, sizeof(PIO_Offset))))
-                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        }
     }
 
     /* Initialize the sc_info send and recv messages */
@@ -1313,13 +3422,6 @@ box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap
         sc_info_msg_recv[i] = 0;
     }
 
-    /* Initialize array values. */
-    for (int i = 0; i < maplen; i++)
-    {
-        dest_ioproc[i] = -1;
-        dest_ioindex[i] = -1;
-    }
-
     /* Initialize arrays used in swapm. */
     for (int i = 0; i < ios->num_uniontasks; i++)
     {
@@ -1407,7 +3509,7 @@ box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap
     /* Send sc_info msg from iotasks (all iotasks) to all procs(compute and I/O procs)*/
     PLOG((3, "about to call pio_swapm with start/count from iotask ndims = %d",
           ndims));
-    if ((ret = pio_swapm(sc_info_msg_send, sendcounts, sdispls, dtypes, sc_info_msg_recv,
+    if ((ret = pio_swapm(ios, sc_info_msg_send, sendcounts, sdispls, dtypes, sc_info_msg_recv,
                          recvcounts, rdispls, dtypes, ios->union_comm,
                          &iodesc->rearr_opts.io2comp)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
@@ -1418,82 +3520,12 @@ box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap
         PLOG((3, "iomaplen[%d] = %d", i, sc_info_msg_recv[i * sc_info_msg_sz]));
 #endif /* PIO_ENABLE_LOGGING */
 
-    /* Convert a 1-D index into a global coordinate value for each data element */
-    for (int k = 0; k < maplen; k++)
-    {
-        /* The compmap array is 1 based but calculations are 0 based */
-        PLOG((3, "about to call idx_to_dim_list ndims = %d ", ndims));
-        idx_to_dim_list(ndims, gdimlen, compmap[k] - 1, gcoord_map[k]);
-#if PIO_ENABLE_LOGGING
-        for (int d = 0; d < ndims; d++)
-            PLOG((3, "gcoord_map[%d][%d] = %lld", k, d, gcoord_map[k][d]));
-#endif /* PIO_ENABLE_LOGGING */
-    }
-
-    for (int i = 0; i < ios->num_iotasks; i++)
-    {
-        /* First entry in the sc_info msg is the iomaplen */
-        iomaplen[i] = sc_info_msg_recv[i * sc_info_msg_sz];
-        if(iomaplen[i] > 0)
-        {
-            /* The rest of the entries in the sc_info msg are the start and
-             * count arrays
-             */
-            PIO_Offset *start = &(sc_info_msg_recv[i * sc_info_msg_sz + 1]);
-            PIO_Offset *count = &(sc_info_msg_recv[i * sc_info_msg_sz + 1 + ndims]);
-
-#if PIO_ENABLE_LOGGING
-            for (int d = 0; d < ndims; d++)
-                PLOG((3, "start[%d] = %lld count[%d] = %lld", d, start[d], d, count[d]));
-#endif /* PIO_ENABLE_LOGGING */
-
-            /* Moved this outside of loop over maplen, for performance. */
-            PIO_Offset lcoord[ndims];
-
-            /* For each element of the data array on the compute task,
-             * find the IO task to send the data element to, and its
-             * offset into the global data array. */
-            for (int k = 0; k < maplen; k++)
-            {
-                /* An IO task has already been found for this element */
-                if (dest_ioproc[k] >= 0)
-                    continue;
-
-                bool found = true;
-
-                /* Find a destination for each entry in the compmap. */
-                for (int j = 0; j < ndims; j++)
-                {
-                    if (gcoord_map[k][j] >= start[j] && gcoord_map[k][j] < start[j] + count[j])
-                    {
-                        lcoord[j] = gcoord_map[k][j] - start[j];
-                    }
-                    else
-                    {
-                        found = false;
-                        break;
-                    }
-                }
-
-                /* Did we find a destination IO task for this element
-                 * of the computation task data array? If so, remember
-                 * the destination IO task, and determine the index
-                 * for that element in the IO task data. */
-                if (found)
-                {
-                    dest_ioindex[k] = coord_to_lindex(ndims, lcoord, count);
-                    dest_ioproc[k] = i;
-                    PLOG((3, "found dest_ioindex[%d] = %d dest_ioproc[%d] = %d", k, dest_ioindex[k],
-                          k, dest_ioproc[k]));
-                }
-            }
-        }
-    }
-
-    for (int i = 0; i < maplen; i++)
-        free(gcoord_map[i]);
-    free(gcoord_map);
-    gcoord_map = NULL;
+    /* For each element of the data array on the compute task, find
+     * the IO task to send the data element to, and its offset into
+     * the data of that IO task. */
+    if ((ret = box_find_dest(ndims, gdimlen, ios->num_iotasks, sc_info_msg_recv, maplen,
+                             compmap, dest_ioproc, dest_ioindex)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
     /* Check that a destination is found for each compmap entry. */
     for (int k = 0; k < maplen; k++)
@@ -1527,10 +3559,107 @@ box_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
     PLOG((3, "iodesc->maxbytes = %d", iodesc->maxbytes));
 
-#ifdef TIMING
-    if ((ret = pio_stop_timer("PIO:box_rearrange_create")))
+    if ((ret = pio_stop_timer(ios, PIO_TIMER_BOX_CREATE)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Create a two level box rearranger (PIO_REARR_NODE). The maps of
+ * the tasks on each node (as found by MPI_Comm_split_type() with
+ * MPI_COMM_TYPE_SHARED) are gathered on the first task of the node,
+ * the node leader. The box rearranger is then created as if the
+ * leaders held all the data and the other tasks none, so only node
+ * leaders (and the IO tasks) take part in the exchange over the
+ * network. Each rearrangement does a gather or scatter within the
+ * node as well.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param maplen the length of the map.
+ * @param compmap a 1 based array of offsets into the global space,
+ * sorted.
+ * @param gdimlen an array length ndims with the sizes of the global
+ * dimensions.
+ * @param ndims the number of dimensions.
+ * @param iodesc a pointer to the io_desc_t struct, which must be
+ * allocated before this function is called.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+node_rearrange_create(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap,
+                      const int *gdimlen, int ndims, io_desc_t *iodesc)
+{
+    PIO_Offset *nodemap = NULL;  /* The map of the whole node. */
+    int node_rank;
+    int mpierr;
+    int ret;
+
+    pioassert(ios && iodesc && !ios->async, "invalid input", __FILE__, __LINE__);
+
+    iodesc->node_ustype = PIO_DATATYPE_NULL;
+    if ((mpierr = MPI_Comm_split_type(ios->union_comm, MPI_COMM_TYPE_SHARED, ios->union_rank,
+                                      MPI_INFO_NULL, &iodesc->node_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_size(iodesc->node_comm, &iodesc->nnode)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(iodesc->node_comm, &node_rank)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "node_rearrange_create nnode = %d node_rank = %d", iodesc->nnode, node_rank));
+
+    /* The leader learns how much data each task of the node has. */
+    iodesc->node_ndof = 0;
+    if (!node_rank)
+    {
+        if (!(iodesc->node_counts = malloc(iodesc->nnode * sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        if (!(iodesc->node_displs = malloc(iodesc->nnode * sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    if ((mpierr = MPI_Gather(&maplen, 1, MPI_INT, iodesc->node_counts, 1, MPI_INT, 0,
+                             iodesc->node_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (!node_rank)
+    {
+        for (int i = 0; i < iodesc->nnode; i++)
+        {
+            iodesc->node_displs[i] = iodesc->node_ndof;
+            iodesc->node_ndof += iodesc->node_counts[i];
+        }
+        if (iodesc->node_ndof > 0)
+            if (!(nodemap = malloc(iodesc->node_ndof * sizeof(PIO_Offset))))
+                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+
+    /* Gather the maps. */
+    if ((mpierr = MPI_Gatherv(compmap, maplen, PIO_OFFSET, nodemap, iodesc->node_counts,
+                              iodesc->node_displs, PIO_OFFSET, 0, iodesc->node_comm)))
+    {
+        free(nodemap);
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Create the box rearranger for the gathered maps. The tasks
+     * other than the leader have no data, and no map. */
+    ret = box_rearrange_create(ios, iodesc->node_ndof, nodemap, gdimlen, ndims, iodesc);
+    free(nodemap);
+    if (ret)
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-#endif
+
+    /* The box rearranger now describes the gathered data; the
+     * caller's arrays are still maplen long. */
+    iodesc->ndof = maplen;
+
+    /* A type to gather straight from the caller's unsorted arrays. */
+    if (iodesc->needssort && maplen > 0)
+    {
+        if ((mpierr = MPI_Type_create_indexed_block(maplen, 1, iodesc->remap, iodesc->mpitype,
+                                                    &iodesc->node_ustype)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Type_commit(&iodesc->node_ustype)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
 
     return PIO_NOERR;
 }
@@ -1559,11 +3688,9 @@ box_rearrange_create_with_holes(iosystem_desc_t *ios, int maplen,
 {
     int ret;
 
-#ifdef TIMING
-    /* Start timer if desired. */
-    if ((ret = pio_start_timer("PIO:box_rearrange_create_with_holes")))
+    /* Start timer if they are on. */
+    if ((ret = pio_start_timer(ios, PIO_TIMER_BOX_CREATE_HOLES)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-#endif /* TIMING */
 
     /* Check inputs. */
     pioassert(ios && maplen >= 0 && compmap && gdimlen && ndims > 0 && iodesc,
@@ -1574,13 +3701,13 @@ box_rearrange_create_with_holes(iosystem_desc_t *ios, int maplen,
     /* Allocate arrays needed for this function. */
     int *dest_ioproc = NULL; /* Destination IO task for each data element on compute task. */
     PIO_Offset *dest_ioindex = NULL;    /* Offset into IO task array for each data element. */
-    PIO_Offset **gcoord_map = NULL; /* Global coordinate value for each data element. */
     int sendcounts[ios->num_uniontasks]; /* Send counts for swapm call. */
     int sdispls[ios->num_uniontasks];    /* Send displacements for swapm. */
     int recvcounts[ios->num_uniontasks]; /* Receive counts for swapm. */
     int rdispls[ios->num_uniontasks];    /* Receive displacements for swapm. */
     MPI_Datatype dtypes[ios->num_uniontasks]; /* Array of MPI_OFFSET types for swapm. */
     PIO_Offset iomaplen[ios->num_iotasks];   /* Gets the llen of all IO tasks. */
+    PIO_Offset sc_info[ios->num_iotasks * (2 * ndims + 1)]; /* [llen, start, count] of each IO task. */
 
     /* This is the box rearranger. */
     iodesc->rearranger = PIO_REARR_BOX;
@@ -1595,22 +3722,6 @@ box_rearrange_create_with_holes(iosystem_desc_t *ios, int maplen,
 
         if (!(dest_ioindex = malloc(maplen * sizeof(PIO_Offset))))
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-
-        if (!(gcoord_map = malloc(maplen * sizeof(PIO_Offset*))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-
-        for (int i = 0; i < maplen; i++)
-        {
-            if (!(gcoord_map[i] = calloc(ndims, sizeof(PIO_Offset))))
-                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        }
-    }
-
-    /* Initialize array values. */
-    for (int i = 0; i < maplen; i++)
-    {
-        dest_ioproc[i] = -1;
-        dest_ioindex[i] = -1;
     }
 
     /* Initialize arrays used in swapm. */
@@ -1672,7 +3783,7 @@ box_rearrange_create_with_holes(iosystem_desc_t *ios, int maplen,
     /* All-gather the llen to all tasks into array iomaplen. */
     PLOG((3, "calling pio_swapm to allgather llen into array iomaplen, ndims = %d dtypes[0] = %d",
           ndims, dtypes));
-    if ((ret = pio_swapm(&iodesc->llen, sendcounts, sdispls, dtypes, iomaplen, recvcounts,
+    if ((ret = pio_swapm(ios, &iodesc->llen, sendcounts, sdispls, dtypes, iomaplen, recvcounts,
                          rdispls, dtypes, ios->union_comm, &iodesc->rearr_opts.io2comp)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
     PLOG((3, "iodesc->llen = %d", iodesc->llen));
@@ -1681,24 +3792,13 @@ box_rearrange_create_with_holes(iosystem_desc_t *ios, int maplen,
         PLOG((3, "iomaplen[%d] = %d", i, iomaplen[i]));
 #endif /* PIO_ENABLE_LOGGING */
 
-    /* Convert a 1-D index into a global coordinate value for each data element */
-    for (int k = 0; k < maplen; k++)
-    {
-        /* The compmap array is 1 based but calculations are 0 based */
-        PLOG((3, "about to call idx_to_dim_list ndims = %d ", ndims));
-        idx_to_dim_list(ndims, gdimlen, compmap[k] - 1, gcoord_map[k]);
-#if PIO_ENABLE_LOGGING
-        for (int d = 0; d < ndims; d++)
-            PLOG((3, "gcoord_map[%d][%d] = %lld", k, d, gcoord_map[k][d]));
-#endif /* PIO_ENABLE_LOGGING */
-    }
-
     /* For each IO task send starts/counts to all compute tasks. */
     for (int i = 0; i < ios->num_iotasks; i++)
     {
         /* The ipmaplen contains the llen (number of data elements)
          * for this IO task. */
         PLOG((2, "iomaplen[%d] = %d", i, iomaplen[i]));
+        sc_info[i * (2 * ndims + 1)] = iomaplen[i];
 
         /* If there is data for this IO task, send start/count to all
          * compute tasks. */
@@ -1730,9 +3830,9 @@ box_rearrange_create_with_holes(iosystem_desc_t *ios, int maplen,
             /* The start/count array from iotask i is sent to all compute tasks. */
             PLOG((3, "about to call pio_swapm with start/count from iotask %d ndims = %d",
                   i, ndims));
-            if ((ret = pio_swapm(start_count_send, sendcounts, sdispls, dtypes, start_count_recv,
-                                 recvcounts, rdispls, dtypes, ios->union_comm,
-                                 &iodesc->rearr_opts.io2comp)))
+            if ((ret = pio_swapm(ios, start_count_send, sendcounts, sdispls, dtypes,
+                                 start_count_recv, recvcounts, rdispls, dtypes,
+                                 ios->union_comm, &iodesc->rearr_opts.io2comp)))
                 return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
             /* start/count array received: 1st half for start, 2nd half for count */
@@ -1744,51 +3844,18 @@ box_rearrange_create_with_holes(iosystem_desc_t *ios, int maplen,
                 PLOG((3, "start[%d] = %lld count[%d] = %lld", d, start[d], d, count[d]));
 #endif /* PIO_ENABLE_LOGGING */
 
-            /* For each element of the data array on the compute task,
-             * find the IO task to send the data element to, and its
-             * offset into the global data array. */
-            for (int k = 0; k < maplen; k++)
+            for (int d = 0; d < ndims; d++)
             {
-                /* An IO task has already been found for this element */
-                if (dest_ioproc[k] >= 0)
-                    continue;
-
-                PIO_Offset lcoord[ndims];
-                bool found = true;
-
-                /* Find a destination for each entry in the compmap. */
-                for (int j = 0; j < ndims; j++)
-                {
-                    if (gcoord_map[k][j] >= start[j] && gcoord_map[k][j] < start[j] + count[j])
-                    {
-                        lcoord[j] = gcoord_map[k][j] - start[j];
-                    }
-                    else
-                    {
-                        found = false;
-                        break;
-                    }
-                }
-
-                /* Did we find a destination IO task for this element
-                 * of the computation task data array? If so, remember
-                 * the destination IO task, and determine the index
-                 * for that element in the IO task data. */
-                if (found)
-                {
-                    dest_ioindex[k] = coord_to_lindex(ndims, lcoord, count);
-                    dest_ioproc[k] = i;
-                    PLOG((3, "found dest_ioindex[%d] = %d dest_ioproc[%d] = %d", k, dest_ioindex[k],
-                          k, dest_ioproc[k]));
-                }
+                sc_info[i * (2 * ndims + 1) + 1 + d] = start[d];
+                sc_info[i * (2 * ndims + 1) + 1 + ndims + d] = count[d];
             }
         }
     }
 
-    for (int i = 0; i < maplen; i++)
-        free(gcoord_map[i]);
-    free(gcoord_map);
-    gcoord_map = NULL;
+    /* Find the destination of each element of the map. */
+    if ((ret = box_find_dest(ndims, gdimlen, ios->num_iotasks, sc_info, maplen, compmap,
+                             dest_ioproc, dest_ioindex)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
     /* Check that a destination is found for each compmap entry. */
     for (int k = 0; k < maplen; k++)
@@ -1819,10 +3886,8 @@ box_rearrange_create_with_holes(iosystem_desc_t *ios, int maplen,
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
     PLOG((3, "iodesc->maxbytes = %d", iodesc->maxbytes));
 
-#ifdef TIMING
-    if ((ret = pio_stop_timer("PIO:box_rearrange_create_with_holes")))
+    if ((ret = pio_stop_timer(ios, PIO_TIMER_BOX_CREATE_HOLES)))
         return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-#endif /* TIMING */
 
     return PIO_NOERR;
 }
@@ -1855,6 +3920,16 @@ compare_offsets(const void *a, const void *b)
  * as a single data point, but we hope we've aggragated better than
  * that.
  *
+ * The map is sorted, and find_region() grows each region as far as
+ * the map stays contiguous, innermost dimension first. So two
+ * regions found here can never be merged into one start/count
+ * without also writing points that are not in the map. Those points
+ * may belong to other IO tasks, so they can't be written with fill
+ * values here. The box rearranger has no regions to merge: each IO
+ * task writes one start/count, its box, and the holes inside the box
+ * are already in its buffer as fill values. Neither rearranger can
+ * trade fill writes for fewer regions.
+ *
  * @param ndims the number of dimensions
  * @param gdimlen an array length ndims with the sizes of the global
  * dimensions.
@@ -1880,15 +3955,15 @@ get_regions(int ndims, const int *gdimlen, int maplen, const PIO_Offset *map,
     PLOG((1, "get_regions ndims = %d maplen = %d", ndims, maplen));
 
     region = firstregion;
+
+    /* Skip the holes at the start of the map, without running off
+     * the end of a map that is all holes. */
     if (map)
-    {
-        while (map[nmaplen++] <= 0)
+        while (nmaplen < maplen && map[nmaplen] <= 0)
         {
             PLOG((3, "map[%d] = %d", nmaplen, map[nmaplen]));
-            ;
+            nmaplen++;
         }
-        nmaplen--;
-    }
     region->loffset = nmaplen;
     PLOG((2, "region->loffset = %d", region->loffset));
 
@@ -1936,18 +4011,157 @@ get_regions(int ndims, const int *gdimlen, int maplen, const PIO_Offset *map,
     return PIO_NOERR;
 }
 
+/** A task of union_comm, when finding the subset groups. */
+typedef struct subset_task
+{
+    PIO_Offset sort; /**< What the tasks are grouped by. */
+    int rank;        /**< Rank in union_comm. */
+    int io_rank;     /**< Rank in io_comm, or -1 for a computation task. */
+} subset_task;
+
+/* Order subset tasks by sort, then rank. */
+static int
+subset_task_cmp(const void *a, const void *b)
+{
+    const subset_task *ta = a, *tb = b;
+
+    if (ta->sort != tb->sort)
+        return ta->sort < tb->sort ? -1 : 1;
+    return ta->rank - tb->rank;
+}
+
+/**
+ * Find the subset group of this task, for the PIO_SUBSET_PART_NODE
+ * and PIO_SUBSET_PART_MAP partitions. Each task gives a value to
+ * sort by (its node, or the start of its map), and the computation
+ * tasks are dealt out to the IO tasks in that order, at most
+ * ceil(computation tasks / IO tasks) to each IO task. With
+ * PIO_SUBSET_PART_NODE, computation tasks go first to the IO tasks
+ * of their own node.
+ *
+ * @param ios pointer to the iosystem_desc_t struct.
+ * @param sort the value of this task to sort by.
+ * @param node true to put tasks with an IO task of the same sort
+ * value first.
+ * @param colorp pointer that gets the color of this task.
+ * @param keyp pointer that gets the key of this task.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+subset_groups(iosystem_desc_t *ios, PIO_Offset sort, bool node, int *colorp, int *keyp)
+{
+    PIO_Offset mine[2] = {sort, ios->ioproc ? ios->io_rank : -1};
+    PIO_Offset *all;
+    subset_task *comp, *io;
+    int *count;
+    int nunion, ncomp = 0, nio = 0;
+    int cap, cursor = 0;
+    int mpierr;
+
+    if ((mpierr = MPI_Comm_size(ios->union_comm, &nunion)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (!(all = malloc(2 * nunion * sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if ((mpierr = MPI_Allgather(mine, 2, MPI_OFFSET, all, 2, MPI_OFFSET, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    if (!(comp = malloc(nunion * sizeof(subset_task))) ||
+        !(io = malloc(nunion * sizeof(subset_task))) ||
+        !(count = calloc(ios->num_iotasks, sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Split the tasks, and sort them. io_rank of a computation task
+     * gets the IO task it is given to. */
+    for (int r = 0; r < nunion; r++)
+    {
+        subset_task *t = all[2 * r + 1] >= 0 ? &io[nio++] : &comp[ncomp++];
+
+        t->sort = all[2 * r];
+        t->rank = r;
+        t->io_rank = all[2 * r + 1];
+    }
+    qsort(comp, ncomp, sizeof(subset_task), subset_task_cmp);
+    qsort(io, nio, sizeof(subset_task), subset_task_cmp);
+    cap = max(1, (ncomp + ios->num_iotasks - 1) / ios->num_iotasks);
+
+    /* First to the least loaded IO task with the same sort value. */
+    for (int c = 0; c < ncomp; c++)
+    {
+        int best = -1;
+
+        if (node)
+        {
+            subset_task key = {comp[c].sort, -1, -1};
+            int lo = 0, hi = nio;
+
+            /* Find the first IO task of the node. */
+            while (lo < hi)
+            {
+                int mid = (lo + hi) / 2;
+
+                if (subset_task_cmp(&io[mid], &key) < 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for (int i = lo; i < nio && io[i].sort == comp[c].sort; i++)
+                if (count[io[i].io_rank] < cap &&
+                    (best < 0 || count[io[i].io_rank] < count[best]))
+                    best = io[i].io_rank;
+        }
+        if (best >= 0)
+            count[best]++;
+        comp[c].io_rank = best;
+    }
+
+    /* Then the rest, in order, to the IO tasks in order. */
+    for (int c = 0; c < ncomp; c++)
+    {
+        if (comp[c].io_rank >= 0)
+            continue;
+        while (cursor < ios->num_iotasks - 1 && count[cursor] >= cap)
+            cursor++;
+        comp[c].io_rank = cursor;
+        count[cursor]++;
+    }
+
+    /* The IO task is first in its group, then the computation tasks
+     * in sorted order. */
+    *colorp = ios->io_rank;
+    *keyp = 0;
+    if (!ios->ioproc)
+        for (int c = 0; c < ncomp; c++)
+            if (comp[c].rank == ios->union_rank)
+            {
+                *colorp = comp[c].io_rank;
+                *keyp = c + 1;
+            }
+
+    free(all);
+    free(comp);
+    free(io);
+    free(count);
+
+    return PIO_NOERR;
+}
+
 /**
  * Create the MPI communicators needed by the subset rearranger.
  *
  * The subset rearranger needs a mapping from compute tasks to IO
  * task, the only requirement is that each compute task map to one and
- * only one IO task.  This mapping groups by mpi task id others are
- * possible and may be better for certain decompositions
+ * only one IO task. The mapping is chosen with
+ * PIOc_set_subset_part(). By default (PIO_SUBSET_PART_RANK) it
+ * groups by mpi task id, PIO_SUBSET_PART_NODE groups tasks with an
+ * IO task of their node, and PIO_SUBSET_PART_MAP groups tasks with
+ * adjacent parts of the array.
  *
- * The as yet unrealized vision here is that the user would be able to
- * supply an alternative subset partitioning function. Requirements of
- * this function are that there be exactly one io task per compute
- * task group.
+ * The groups of PIO_SUBSET_PART_RANK and PIO_SUBSET_PART_NODE only
+ * depend on the IO system, so their comm is kept on the IO system
+ * and shared by its decompositions. Async always uses
+ * PIO_SUBSET_PART_RANK, since the setting is only made on the
+ * computation tasks.
  *
  * @param ios pointer to the iosystem_desc_t struct.
  * @param iodesc a pointer to the io_desc_t struct.
@@ -1957,17 +4171,56 @@ get_regions(int ndims, const int *gdimlen, int maplen, const PIO_Offset *map,
 int
 default_subset_partition(iosystem_desc_t *ios, io_desc_t *iodesc)
 {
+    int part = ios->async ? PIO_SUBSET_PART_RANK : ios->subset_part;
+    bool shared = part != PIO_SUBSET_PART_MAP;
     int color;
     int key;
     int mpierr; /* Return value from MPI functions. */
+    int ret;
 
     pioassert(ios && iodesc, "invalid input", __FILE__, __LINE__);
     PLOG((1, "default_subset_partition ios->ioproc = %d ios->io_rank = %d "
-          "ios->comp_rank = %d", ios->ioproc, ios->io_rank, ios->comp_rank));
+          "ios->comp_rank = %d part = %d", ios->ioproc, ios->io_rank, ios->comp_rank, part));
+
+    /* Use the comm of the IO system, if it is for this partition. */
+    if (ios->subset_comm_refs && ios->subset_comm_part == part)
+    {
+        iodesc->subset_comm = ios->subset_comm;
+        iodesc->subset_comm_private = false;
+        ios->subset_comm_refs++;
+        return PIO_NOERR;
+    }
 
     /* Create a new comm for each subset group with the io task in
        rank 0 and only 1 io task per group */
-    if (ios->ioproc)
+    if (part == PIO_SUBSET_PART_NODE)
+    {
+        MPI_Comm node_comm;
+        int node_leader = ios->union_rank;
+
+        /* A node is known by the rank of its first task. */
+        if ((mpierr = MPI_Comm_split_type(ios->union_comm, MPI_COMM_TYPE_SHARED, 0,
+                                          MPI_INFO_NULL, &node_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Bcast(&node_leader, 1, MPI_INT, 0, node_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Comm_free(&node_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if ((ret = subset_groups(ios, node_leader, true, &color, &key)))
+            return ret;
+    }
+    else if (part == PIO_SUBSET_PART_MAP)
+    {
+        PIO_Offset map_start = LLONG_MAX;
+
+        /* Tasks without data go last. */
+        for (int i = 0; i < iodesc->maplen; i++)
+            if (iodesc->map[i] > 0 && iodesc->map[i] < map_start)
+                map_start = iodesc->map[i];
+        if ((ret = subset_groups(ios, map_start, false, &color, &key)))
+            return ret;
+    }
+    else if (ios->ioproc)
     {
         key = 0;
         color= ios->io_rank;
@@ -1984,6 +4237,16 @@ default_subset_partition(iosystem_desc_t *ios, io_desc_t *iodesc)
     if ((mpierr = MPI_Comm_split(ios->union_comm, color, key, &iodesc->subset_comm)))
         return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
+    /* Keep it for the next decompositions, unless there is already
+     * one of another partition. */
+    iodesc->subset_comm_private = !shared || ios->subset_comm_refs;
+    if (!iodesc->subset_comm_private)
+    {
+        ios->subset_comm = iodesc->subset_comm;
+        ios->subset_comm_part = part;
+        ios->subset_comm_refs = 1;
+    }
+
     return PIO_NOERR;
 }
 
@@ -2044,7 +4307,7 @@ subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compmap,
     PIO_Offset *iomap = NULL;
     mapsort *map = NULL;
     PIO_Offset totalgridsize;
-    PIO_Offset *srcindex = NULL;
+    int *srcindex = NULL;
     PIO_Offset *myfillgrid = NULL;
     int maxregions;
     int rank, ntasks;
@@ -2127,7 +4390,7 @@ subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compmap,
     /* Allocate an array for indicies on the computation tasks (the
      * send side when writing). */
     if (iodesc->scount[0] > 0)
-        if (!(iodesc->sindex = calloc(iodesc->scount[0], sizeof(PIO_Offset))))
+        if (!(iodesc->sindex = pio_calloc(PIO_MEM_INDEX, iodesc->scount[0], sizeof(int))))
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
 
     j = 0;
@@ -2166,7 +4429,7 @@ subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compmap,
 
         if (iodesc->llen > 0)
         {
-            if (!(srcindex = calloc(iodesc->llen, sizeof(PIO_Offset))))
+            if (!(srcindex = calloc(iodesc->llen, sizeof(int))))
                 return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
         }
     }
@@ -2185,8 +4448,8 @@ subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compmap,
             return pio_err(ios, NULL, ret, __FILE__, __LINE__);
 
     /* Pass the sindex from each compute task to its associated IO task. */
-    if ((mpierr = MPI_Gatherv(iodesc->sindex, iodesc->scount[0], PIO_OFFSET,
-                              srcindex, recvcounts, rdispls, PIO_OFFSET, 0,
+    if ((mpierr = MPI_Gatherv(iodesc->sindex, iodesc->scount[0], MPI_INT,
+                              srcindex, recvcounts, rdispls, MPI_INT, 0,
                               iodesc->subset_comm)))
         return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
@@ -2253,7 +4516,9 @@ subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compmap,
         /* sort the mapping, this will transpose the data into IO order */
         qsort(map, iodesc->llen, sizeof(mapsort), compare_offsets);
 
-        if (!(iodesc->rindex = calloc(1, iodesc->llen * sizeof(PIO_Offset))))
+        if (iodesc->llen > INT_MAX)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        if (!(iodesc->rindex = pio_calloc(PIO_MEM_INDEX, 1, iodesc->llen * sizeof(int))))
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
 
         if (!(iodesc->rfrom = calloc(1, iodesc->llen * sizeof(int))))
@@ -2267,29 +4532,24 @@ subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compmap,
     }
 
     /* For IO tasks init rfrom and rindex arrays (compute tasks have
-     * llen of 0). */
-    int rllen;
-    PIO_Offset soffset;
-    /* we only want a single copy of each source point in the iobuffer but it may be sent to multiple destinations
-       in a read operation */
-    int k=0;
-    PIO_Offset previomap[ntasks];
-    for (i = 0; i < ntasks; i++)
-        previomap[i] = -1;
-    for (i = 0, rllen=0; i < iodesc->llen; i++)
+     * llen of 0). We only want a single copy of each source point in
+     * the iobuffer, but it may be sent to multiple destinations in a
+     * read operation. Since the map is sorted, the repeats of a point
+     * (found in readonly maps, like those with halos) are together,
+     * and share one place in the iobuffer. So each value is read from
+     * the file once, and rllen is the number of distinct points. */
+    int rllen = 0;
+    for (i = 0; i < iodesc->llen; i++)
     {
         mapsort *mptr = &map[i];
         iodesc->rfrom[i] = mptr->rfrom;
-        if(mptr->iomap > previomap[mptr->rfrom])
-        {
-            iomap[rllen] = mptr->iomap;
-            soffset = mptr->soffset;
-        }
-        previomap[mptr->rfrom]=iomap[rllen];
-        srcindex[(cnt[mptr->rfrom])++] = soffset;
-        iodesc->rindex[i] = rllen++;
-        iodesc->rllen = rllen;
+        if (!rllen || mptr->iomap != iomap[rllen - 1])
+            iomap[rllen++] = mptr->iomap;
+        srcindex[(cnt[mptr->rfrom])++] = mptr->soffset;
+        iodesc->rindex[i] = rllen - 1;
     }
+    iodesc->rllen = rllen;
+    PLOG((3, "iodesc->llen %d iodesc->rllen %d", iodesc->llen, iodesc->rllen));
 
 
     /* Handle fill values if needed. */
@@ -2440,8 +4700,8 @@ subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compmap,
     }
 
     /* Scatter values of srcindex to subset communicator. */
-    if ((mpierr = MPI_Scatterv((void *)srcindex, recvcounts, rdispls, PIO_OFFSET,
-                               (void *)iodesc->sindex, iodesc->scount[0],  PIO_OFFSET,
+    if ((mpierr = MPI_Scatterv((void *)srcindex, recvcounts, rdispls, MPI_INT,
+                               (void *)iodesc->sindex, iodesc->scount[0], MPI_INT,
                                0, iodesc->subset_comm)))
         return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
@@ -2480,126 +4740,421 @@ subset_rearrange_create(iosystem_desc_t *ios, int maplen, PIO_Offset *compmap,
     return PIO_NOERR;
 }
 
+/** Number of times each setting is timed by the rearranger
+ * autotuner. The fastest is kept. */
+#define PIO_TUNE_NTRIALS 2
+
+/** Limits on pending requests tried by the rearranger autotuner,
+ * besides unlimited. */
+#define PIO_TUNE_NPEND 2
+static const int tune_pend_req[PIO_TUNE_NPEND] = {64, 8};
+
 /**
- * Performance tuning rearranger.
+ * Time one direction of the rearrangement with flow control options
+ * fc. The slowest time on any task in comm is returned, so all tasks
+ * get the same result.
  *
  * @param ios pointer to the iosystem description struct.
  * @param iodesc pointer to the IO description struct.
+ * @param comp2io true to time rearrange_comp2io(), false to time
+ * rearrange_io2comp().
+ * @param fc the flow control options to use.
+ * @param cbuf buffer on the computation tasks. May be NULL.
+ * @param ibuf buffer on the IO tasks. May be NULL.
+ * @param comm communicator of all tasks that must agree on the result.
+ * @param time pointer that gets the time.
  * @returns 0 on success, error code otherwise.
- * @author Jim Edwards
+ * @author Ed Hartnett
  */
-void
-performance_tune_rearranger(iosystem_desc_t *ios, io_desc_t *iodesc)
+static int
+time_rearranger(iosystem_desc_t *ios, io_desc_t *iodesc, bool comp2io,
+                rearr_comm_fc_opt_t fc, void *cbuf, void *ibuf, MPI_Comm comm,
+                double *time)
 {
-#ifdef TIMING
-#ifdef PERFTUNE
-    double *wall, usr[2], sys[2];
-    void *cbuf, *ibuf;
-    int tsize;
-    int myrank;
-    int mpierr; /* Return code for MPI calls. */
-
-    assert(iodesc);
-    if(iodesc->mpitype == MPI_DATATYPE_NULL)
-        tsize = 0;
+    double start;
+    int mpierr;
+    int ret;
+
+    if (comp2io)
+        iodesc->rearr_opts.comp2io = fc;
     else
-        if ((mpierr = MPI_Type_size(iodesc->mpitype, &tsize)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-    cbuf = NULL;
-    ibuf = NULL;
-    if (iodesc->ndof > 0)
-        if (!(cbuf = bget(iodesc->ndof * tsize)))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+        iodesc->rearr_opts.io2comp = fc;
 
-    if (iodesc->llen > 0)
-        if (!(ibuf = bget(iodesc->llen * tsize)))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
+    *time = 0;
+    for (int t = 0; t < PIO_TUNE_NTRIALS; t++)
+    {
+        double elapsed;
 
-    if (iodesc->rearranger == PIO_REARR_BOX)
-        mycomm = ios->union_comm;
-    else
-        mycomm = iodesc->subset_comm;
+        if ((mpierr = MPI_Barrier(comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        start = MPI_Wtime();
+        if (comp2io)
+            ret = rearrange_comp2io(ios, iodesc, cbuf, ibuf, 1);
+        else
+            ret = rearrange_io2comp(ios, iodesc, ibuf, cbuf);
+        if (ret)
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        elapsed = MPI_Wtime() - start;
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if (!t || elapsed < *time)
+            *time = elapsed;
+    }
 
-    if ((mpierr = MPI_Comm_size(mycomm, &nprocs)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Comm_rank(mycomm, &myrank)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
 
-    int log2 = log(nprocs) / log(2) + 1;
-    if (!(wall = bget(2 * 4 * log2 * sizeof(double))))
-        return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-    double mintime;
+/** Number of ints stored for each entry of the tuning cache. */
+#define PIO_TUNE_NOPTS 7
 
-    if ((mpierr = MPI_Barrier(mycomm)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-    GPTLstamp(&wall[0], &usr[0], &sys[0]);
-    rearrange_comp2io(ios, iodesc, cbuf, ibuf, 1);
-    rearrange_io2comp(ios, iodesc, ibuf, cbuf);
-    GPTLstamp(&wall[1], &usr[1], &sys[1]);
-    mintime = wall[1]-wall[0];
-    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &mintime, 1, MPI_DOUBLE, MPI_MAX, mycomm)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+/**
+ * Compute a signature of a decomposition for the tuning cache. It
+ * depends on the global dimensions, the number of elements on each
+ * task, the rearranger, the data type size, and the IO tasks. All
+ * tasks of the IO system get the same value.
+ *
+ * @param ios pointer to the iosystem description struct.
+ * @param iodesc pointer to the IO description struct.
+ * @param sig pointer that gets the signature.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+rearr_tune_signature(iosystem_desc_t *ios, io_desc_t *iodesc, unsigned long long *sig)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    unsigned long long task;
+    int mpierr;
+
+    /* The hashes of each task's (rank, ndof) are summed, so the
+     * distribution of the map is captured without gathering it. */
+    task = fnv_hash(h, &ios->union_rank, sizeof(int));
+    task = fnv_hash(task, &iodesc->ndof, sizeof(int));
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &task, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM,
+                                ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    h = fnv_hash(h, &task, sizeof(task));
+    h = fnv_hash(h, &iodesc->ndims, sizeof(int));
+    h = fnv_hash(h, iodesc->dimlen, iodesc->ndims * sizeof(int));
+    h = fnv_hash(h, &iodesc->rearranger, sizeof(int));
+    h = fnv_hash(h, &iodesc->mpitype_size, sizeof(int));
+    h = fnv_hash(h, &ios->num_uniontasks, sizeof(int));
+    h = fnv_hash(h, &ios->num_iotasks, sizeof(int));
+    h = fnv_hash(h, ios->ioranks, ios->num_iotasks * sizeof(int));
+    *sig = h;
+
+    return PIO_NOERR;
+}
 
-    handshake = iodesc->rearr_opts.comp2io.hs;
-    isend = iodesc->isend;
-    maxreqs = iodesc->max_requests;
+/**
+ * Look for the rearranger options of a decomposition in the tuning
+ * cache file. The file is read on task 0 of the union communicator,
+ * and the result broadcast. A missing file is not an error. If the
+ * signature appears more than once, the last valid entry is
+ * used. Entries with options that tuning never picks (a comm_type
+ * other than PIO_REARR_COMM_P2P or PIO_REARR_COMM_COLL, hs or isend
+ * other than 0 or 1, or a negative max_pend_req other than
+ * PIO_REARR_COMM_UNLIMITED_PEND_REQ) are ignored.
+ *
+ * @param ios pointer to the iosystem description struct.
+ * @param iodesc pointer to the IO description struct. If found, its
+ * rearr_opts are set.
+ * @param sig the signature of the decomposition.
+ * @param found pointer that gets 1 if the signature was found, 0
+ * otherwise.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+read_rearr_tune_cache(iosystem_desc_t *ios, io_desc_t *iodesc, unsigned long long sig,
+                      int *found)
+{
+    int opts[PIO_TUNE_NOPTS + 1] = {0};  /* Found flag, then the options. */
+    int mpierr;
 
-    for (int i = 0; i < 2; i++)
+    if (!ios->union_rank)
     {
-        if (i == 0)
-            iodesc->rearr_opts.comp2io.hs = false;
-        else
-            iodesc->rearr_opts.comp2io.hs = true;
+        FILE *fp;
 
-        for (int j = 0; j < 2; j++)
+        if ((fp = fopen(ios->rearr_tune_file, "r")))
         {
-            if (j == 0)
-                iodesc->isend = false;
-            else
-                iodesc->isend = true;
+            char line[PIO_MAX_NAME + 1];
 
-            iodesc->max_requests = 0;
-
-            for (nreqs = nprocs; nreqs >= 2; nreqs /= 2)
+            while (fgets(line, sizeof(line), fp))
             {
-                iodesc->max_requests = nreqs;
-                if ((mpierr = MPI_Barrier(mycomm)))
-                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-                GPTLstamp(wall, usr, sys);
-                rearrange_comp2io(ios, iodesc, cbuf, ibuf, 1);
-                rearrange_io2comp(ios, iodesc, ibuf, cbuf);
-                GPTLstamp(wall+1, usr, sys);
-                wall[1] -= wall[0];
-                if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, wall + 1, 1, MPI_DOUBLE, MPI_MAX,
-                                            mycomm)))
-                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+                unsigned long long s;
+                int o[PIO_TUNE_NOPTS];
 
-                if (wall[1] < mintime * 0.95)
-                {
-                    handshake = iodesc->rearr_opts.comp2io.hs;
-                    isend = iodesc->isend;
-                    maxreqs = nreqs;
-                    mintime = wall[1];
-                }
-                else if (wall[1] > mintime * 1.05)
+                if (line[0] == '#')
+                    continue;
+                if (sscanf(line, "%llx %d %d %d %d %d %d %d", &s, &o[0], &o[1], &o[2],
+                           &o[3], &o[4], &o[5], &o[6]) != PIO_TUNE_NOPTS + 1 || s != sig)
+                    continue;
+
+                /* Only options tuning could have picked are used. */
+                if ((o[0] != PIO_REARR_COMM_P2P && o[0] != PIO_REARR_COMM_COLL) ||
+                    (o[1] & ~1) || (o[2] & ~1) || o[3] < PIO_REARR_COMM_UNLIMITED_PEND_REQ ||
+                    (o[4] & ~1) || (o[5] & ~1) || o[6] < PIO_REARR_COMM_UNLIMITED_PEND_REQ)
                 {
-                    exit;
+                    PLOG((1, "invalid rearranger options for signature %016llx in %s ignored",
+                          sig, ios->rearr_tune_file));
+                    continue;
                 }
+                opts[0] = 1;
+                memcpy(&opts[1], o, sizeof(o));
             }
+            fclose(fp);
         }
     }
 
-    iodesc->rearr_opts.comp2io.hs = handshake;
-    iodesc->isend = isend;
-    iodesc->max_requests = maxreqs;
+    if ((mpierr = MPI_Bcast(opts, PIO_TUNE_NOPTS + 1, MPI_INT, 0, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
 
-    PLOG((1, "spmd optimization: maxreqs: %d handshake:%d isend:%d mintime=%f\n",
-          maxreqs,handshake,isend,mintime));
+    if ((*found = opts[0]))
+    {
+        iodesc->rearr_opts.comm_type = opts[1];
+        iodesc->rearr_opts.comp2io.hs = opts[2];
+        iodesc->rearr_opts.comp2io.isend = opts[3];
+        iodesc->rearr_opts.comp2io.max_pend_req = opts[4];
+        iodesc->rearr_opts.io2comp.hs = opts[5];
+        iodesc->rearr_opts.io2comp.isend = opts[6];
+        iodesc->rearr_opts.io2comp.max_pend_req = opts[7];
+        PLOG((1, "rearranger options for signature %016llx found in %s", sig,
+              ios->rearr_tune_file));
+    }
 
-    /* Free memory. */
-    brel(wall);
-    brel(cbuf);
-    brel(ibuf);
-#endif
-#endif
+    return PIO_NOERR;
+}
+
+/**
+ * Add the rearranger options of a decomposition to the tuning cache
+ * file. Only task 0 of the union communicator writes.
+ *
+ * @param ios pointer to the iosystem description struct.
+ * @param iodesc pointer to the IO description struct.
+ * @param sig the signature of the decomposition.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+write_rearr_tune_cache(iosystem_desc_t *ios, io_desc_t *iodesc, unsigned long long sig)
+{
+    int ierr = PIO_NOERR;
+    int mpierr;
+
+    if (!ios->union_rank)
+    {
+        FILE *fp;
+        rearr_opt_t *o = &iodesc->rearr_opts;
+
+        if (!(fp = fopen(ios->rearr_tune_file, "a")))
+            ierr = PIO_EIO;
+        else
+        {
+            if (fprintf(fp, "%016llx %d %d %d %d %d %d %d\n", sig, o->comm_type,
+                        o->comp2io.hs, o->comp2io.isend, o->comp2io.max_pend_req,
+                        o->io2comp.hs, o->io2comp.isend, o->io2comp.max_pend_req) < 0)
+                ierr = PIO_EIO;
+            if (fclose(fp))
+                ierr = PIO_EIO;
+        }
+    }
+
+    /* Everyone learns whether the write worked. */
+    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, 0, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (ierr)
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Time each direction of the rearranger with each set of flow
+ * control options, and keep the fastest in iodesc->rearr_opts. This
+ * is called by performance_tune_rearranger(), which owns the
+ * buffers.
+ *
+ * @param ios pointer to the iosystem description struct.
+ * @param iodesc pointer to the IO description struct.
+ * @param cbuf buffer on the computation tasks. May be NULL.
+ * @param ibuf buffer on the IO tasks. May be NULL.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+tune_rearr_fc(iosystem_desc_t *ios, io_desc_t *iodesc, void *cbuf, void *ibuf)
+{
+    int ret;
+
+    /* Tune each direction in turn. */
+    for (int dir = 0; dir < 2; dir++)
+    {
+        bool comp2io = !dir;
+        rearr_comm_fc_opt_t best = comp2io ? iodesc->rearr_opts.comp2io :
+            iodesc->rearr_opts.io2comp;
+        double mintime;
+
+        /* Time the current settings. */
+        if ((ret = time_rearranger(ios, iodesc, comp2io, best, cbuf, ibuf, ios->union_comm,
+                                   &mintime)))
+            return ret;
+
+        /* Try MPI_Alltoallw (max_pend_req of 0), then the pairwise
+         * exchange with each combination of options. */
+        for (int c = 0; c < 4 * (PIO_TUNE_NPEND + 1) + 1; c++)
+        {
+            rearr_comm_fc_opt_t fc = {false, false, 0};
+            double time;
+
+            if (c)
+            {
+                int p = (c - 1) / 4;
+
+                fc.hs = (c - 1) & 1;
+                fc.isend = ((c - 1) & 2) != 0;
+                fc.max_pend_req = p ? tune_pend_req[p - 1] : PIO_REARR_COMM_UNLIMITED_PEND_REQ;
+            }
+
+            if ((ret = time_rearranger(ios, iodesc, comp2io, fc, cbuf, ibuf, ios->union_comm,
+                                       &time)))
+                return ret;
+
+            if (time < mintime * 0.95)
+            {
+                best = fc;
+                mintime = time;
+            }
+        }
+
+        if (comp2io)
+            iodesc->rearr_opts.comp2io = best;
+        else
+            iodesc->rearr_opts.io2comp = best;
+
+        PLOG((1, "rearranger tuning %s: hs = %d isend = %d max_pend_req = %d time = %f",
+              comp2io ? "comp2io" : "io2comp", best.hs, best.isend, best.max_pend_req,
+              mintime));
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Performance tuning rearranger. If autotuning has been turned on
+ * with PIOc_set_rearr_autotune(), time rearrange_comp2io() and
+ * rearrange_io2comp() with MPI_Alltoallw and with the pairwise
+ * exchange, with and without handshake and isend, for a few limits
+ * on pending requests. The fastest settings for each direction are
+ * stored in iodesc->rearr_opts. A setting must beat the current one
+ * by 5% to replace it, so the settings the user asked for are kept
+ * unless there is a clear winner.
+ *
+ * The times are the slowest on any task of the IO system, so all
+ * tasks (and, for the subset rearranger, all subsets) make the same
+ * choice.
+ *
+ * If a tuning cache file has been set with
+ * PIOc_set_rearr_tune_file(), the options are looked up there first,
+ * with a signature of the decomposition, and the tuned options are
+ * added to it.
+ *
+ * Nothing is done for async, or when PIO_REARR_COMM_NEIGHBOR or
+ * PIO_REARR_COMM_SHM is in use, since they have no flow control
+ * options. If the network was measured with PIOc_probe_iosystem(),
+ * decompositions whose largest exchange is smaller than the
+ * latency-bandwidth product are not tuned either, since their time
+ * is latency and all options give about the same.
+ *
+ * This is called from PIOc_InitDecomp() before define_rearr_peers(),
+ * so the peers are set up for the options that are picked. The
+ * tuning itself defines the peers if it needs them. This must be
+ * called on all tasks of the IO system.
+ *
+ * @param ios pointer to the iosystem description struct.
+ * @param iodesc pointer to the IO description struct.
+ * @returns 0 on success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+performance_tune_rearranger(iosystem_desc_t *ios, io_desc_t *iodesc)
+{
+    void *cbuf = NULL;  /* Data on the computation tasks. */
+    void *ibuf = NULL;  /* Data on the IO tasks. */
+    unsigned long long sig = 0;  /* Signature of the decomposition. */
+    int found;
+    int ret, ret2;
+
+    pioassert(ios && iodesc, "invalid input", __FILE__, __LINE__);
+
+    if (!ios->rearr_autotune || ios->async ||
+        iodesc->rearr_opts.comm_type == PIO_REARR_COMM_NEIGHBOR ||
+        iodesc->rearr_opts.comm_type == PIO_REARR_COMM_SHM)
+        return PIO_NOERR;
+
+    /* Small exchanges are bound by the probed latency. */
+    if (ios->probe_net_bw > 0)
+    {
+        double bytes = (double)max(iodesc->ndof, ios->ioproc ? iodesc->llen : 0) *
+            iodesc->mpitype_size;
+        int mpierr;
+
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &bytes, 1, MPI_DOUBLE, MPI_MAX,
+                                    ios->union_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if (bytes < ios->probe_net_lat * ios->probe_net_bw)
+        {
+            PLOG((1, "rearranger tuning skipped, %g bytes is latency bound", bytes));
+            return PIO_NOERR;
+        }
+    }
+
+    /* Maybe these options were tuned in an earlier run. */
+    if (ios->rearr_tune_file)
+    {
+        if ((ret = rearr_tune_signature(ios, iodesc, &sig)))
+            return ret;
+        if ((ret = read_rearr_tune_cache(ios, iodesc, sig, &found)))
+            return ret;
+        if (found)
+            return PIO_NOERR;
+    }
+
+    /* The contents of the buffers don't matter. */
+    if (iodesc->ndof > 0)
+        if (!(cbuf = calloc(iodesc->ndof, iodesc->mpitype_size)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (ios->ioproc && iodesc->llen > 0)
+        if (!(ibuf = calloc(iodesc->llen, iodesc->mpitype_size)))
+        {
+            free(cbuf);
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+
+    /* Tune each direction in turn. Don't keep requests set up for
+     * the tuning buffers, and free the buffers, even if that
+     * fails. */
+    ret = tune_rearr_fc(ios, iodesc, cbuf, ibuf);
+    if ((ret2 = free_rearr_persist(&iodesc->comp2io_persist)) && !ret)
+        ret = ret2;
+    if ((ret2 = free_rearr_persist(&iodesc->io2comp_persist)) && !ret)
+        ret = ret2;
+    free(cbuf);
+    free(ibuf);
+    if (ret)
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Collective if MPI_Alltoallw won both ways. */
+    if (!iodesc->rearr_opts.comp2io.max_pend_req && !iodesc->rearr_opts.io2comp.max_pend_req)
+        iodesc->rearr_opts.comm_type = PIO_REARR_COMM_COLL;
+    else
+        iodesc->rearr_opts.comm_type = PIO_REARR_COMM_P2P;
+
+    /* Remember the options for the next run. */
+    if (ios->rearr_tune_file)
+        if ((ret = write_rearr_tune_cache(ios, iodesc, sig)))
+            return ret;
+
+    return PIO_NOERR;
 }
@@ -7,6 +7,7 @@
  * @author Jim Edwards
  * @date 2014
  */
+#define PIO_LOG_SUBSYS PIO_LOG_REARR
 #include <config.h>
 #include <pio.h>
 #include <pio_internal.h>
@@ -47,41 +48,133 @@ int pair(int np, int p, int k)
 }
 
 /**
- * Provides the functionality of MPI_Alltoallw with flow control
- * options. Generalized all-to-all communication allowing different
- * datatypes, counts, and displacements for each partner
+ * A peer in the pairwise schedule of pio_swapm_peers().
+ */
+typedef struct swapm_step
+{
+    /** Position in the schedule: the peer is paired with this task
+     * at step key - 1. */
+    int key;
+
+    /** Index of the peer in the peer arrays. */
+    int idx;
+} swapm_step_t;
+
+/**
+ * Compare two steps of the schedule, for qsort().
+ *
+ * @param a pointer to first step.
+ * @param b pointer to second step.
+ * @returns -1, 0, or 1.
+ * @author Jim Edwards
+ */
+static int
+compare_steps(const void *a, const void *b)
+{
+    int x = ((const swapm_step_t *)a)->key;
+    int y = ((const swapm_step_t *)b)->key;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Call MPI_Alltoallw() for an exchange described by peer
+ * arrays. MPI_Alltoallw() needs arrays over the whole communicator,
+ * so they are allocated and filled here.
  *
  * @param sendbuf starting address of send buffer
- * @param sendcounts integer array equal to the number of tasks in
- * communicator comm (ntasks). It specifies the number of elements to
- * send to each processor
- * @param sdispls integer array (of length ntasks). Entry j
- * specifies the displacement in bytes (relative to sendbuf) from
- * which to take the outgoing data destined for process j.
- * @param sendtypes array of datatypes (of length ntasks). Entry j
- * specifies the type of data to send to process j.
+ * @param sendcounts array (of length npeers) of send counts.
+ * @param sdispls array (of length npeers) of send displacements.
+ * @param sendtypes array (of length npeers) of send types.
  * @param recvbuf address of receive buffer.
- * @param recvcounts integer array (of length ntasks) specifying the
- * number of elements that can be received from each processor.
- * @param rdispls integer array (of length ntasks). Entry i
- * specifies the displacement in bytes (relative to recvbuf) at which
- * to place the incoming data from process i.
- * @param recvtypes array of datatypes (of length ntasks). Entry i
- * specifies the type of data received from process i.
- * @param comm MPI communicator for the MPI_Alltoallw call.
+ * @param recvcounts array (of length npeers) of receive counts.
+ * @param rdispls array (of length npeers) of receive displacements.
+ * @param recvtypes array (of length npeers) of receive types.
+ * @param npeers number of peers.
+ * @param peers array (of length npeers) of peer ranks in comm.
+ * @param comm MPI communicator.
+ * @param ntasks size of comm.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+static int
+swapm_alltoallw(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+                void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+                int npeers, const int *peers, MPI_Comm comm, int ntasks)
+{
+    int *counts;           /* Send and receive counts and displacements. */
+    MPI_Datatype *types;   /* Send and receive types. */
+    int mpierr;
+
+    if (!(counts = calloc(4 * ntasks, sizeof(int))))
+        return PIO_ENOMEM;
+    if (!(types = malloc(2 * ntasks * sizeof(MPI_Datatype))))
+    {
+        free(counts);
+        return PIO_ENOMEM;
+    }
+    for (int i = 0; i < 2 * ntasks; i++)
+        types[i] = PIO_DATATYPE_NULL;
+
+    for (int p = 0; p < npeers; p++)
+    {
+        int q = peers[p];
+
+        counts[q] = sendcounts[p];
+        counts[ntasks + q] = sdispls[p];
+        counts[2 * ntasks + q] = recvcounts[p];
+        counts[3 * ntasks + q] = rdispls[p];
+        types[q] = sendtypes[p];
+        types[ntasks + q] = recvtypes[p];
+    }
+
+    /* Call the MPI alltoall without flow control. */
+    PLOG((3, "Calling MPI_Alltoallw without flow control."));
+    mpierr = MPI_Alltoallw(sendbuf, counts, counts + ntasks, types, recvbuf,
+                           counts + 2 * ntasks, counts + 3 * ntasks, types + ntasks, comm);
+    free(counts);
+    free(types);
+    if (mpierr)
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Do the pairwise, flow controlled, exchange of
+ * pio_swapm_peers(). All arrays are allocated by the caller.
+ *
+ * @param sendbuf starting address of send buffer
+ * @param sendcounts array (of length npeers) of send counts.
+ * @param sdispls array (of length npeers) of send displacements.
+ * @param sendtypes array (of length npeers) of send types.
+ * @param recvbuf address of receive buffer.
+ * @param recvcounts array (of length npeers) of receive counts.
+ * @param rdispls array (of length npeers) of receive displacements.
+ * @param recvtypes array (of length npeers) of receive types.
+ * @param peers array (of length npeers) of peer ranks in comm.
+ * @param comm MPI communicator.
  * @param fc pointer to the struct that provided flow control options.
+ * @param my_rank rank of this task in comm.
+ * @param offset_t offset added to the rank of the sender to get the
+ * message tag.
+ * @param steps number of peers in swapids.
+ * @param swapids array (of length steps) of indexes of the peers, in
+ * the order of the pairwise schedule.
+ * @param rcvids array (of length steps) for receive requests.
+ * @param sndids array (of length steps) for send requests.
+ * @param hs_rcvids array (of length steps) for handshake requests.
  * @returns 0 for success, error code otherwise.
  * @author Jim Edwards
  */
-int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
-              void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
-              MPI_Comm comm, rearr_comm_fc_opt_t *fc)
+static int
+swapm_pairwise(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+               void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+               const int *peers, MPI_Comm comm, rearr_comm_fc_opt_t *fc, int my_rank,
+               int offset_t, int steps, const int *swapids, MPI_Request *rcvids,
+               MPI_Request *sndids, MPI_Request *hs_rcvids)
 {
-    int ntasks;  /* Number of tasks in communicator comm. */
-    int my_rank; /* Rank of this task in comm. */
     int tag;
-    int offset_t;
-    int steps;
     int istep;
     int rstep;
     int p;
@@ -92,119 +185,13 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
     MPI_Status status; /* Not actually used - replace with MPI_STATUSES_IGNORE. */
     int mpierr;  /* Return code from MPI functions. */
 
-    PLOG((2, "pio_swapm fc->hs = %d fc->isend = %d fc->max_pend_req = %d", fc->hs,
-          fc->isend, fc->max_pend_req));
-
-    /* Get my rank and size of communicator. */
-    if ((mpierr = MPI_Comm_size(comm, &ntasks)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Comm_rank(comm, &my_rank)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-    PLOG((2, "ntasks = %d my_rank = %d", ntasks, my_rank));
-
-    /* Now we know the size of these arrays. */
-    int swapids[ntasks];
-    MPI_Request rcvids[ntasks];
-    MPI_Request sndids[ntasks];
-    MPI_Request hs_rcvids[ntasks];
-
-    /* Print some debugging info, if logging is enabled. */
-#if PIO_ENABLE_LOGGING
-    {
-        for (int p = 0; p < ntasks; p++)
-            PLOG((4, "sendcounts[%d] = %d sdispls[%d] = %d sendtypes[%d] = %d recvcounts[%d] = %d "
-                  "rdispls[%d] = %d recvtypes[%d] = %d", p, sendcounts[p], p, sdispls[p], p,
-                  sendtypes[p], p, recvcounts[p], p, rdispls[p], p, recvtypes[p]));
-    }
-#endif /* PIO_ENABLE_LOGGING */
-
-    /* If fc->max_pend_req == 0 no throttling is requested and the default
-     * mpi_alltoallw function is used. */
-    if (fc->max_pend_req == 0)
-    {
-        /* Call the MPI alltoall without flow control. */
-        PLOG((3, "Calling MPI_Alltoallw without flow control. comm=%d my_rank=%d",comm,my_rank));
-        if ((mpierr = MPI_Alltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf,
-                                    recvcounts, rdispls, recvtypes, comm))){
-            PLOG((3, "Called MPI_Alltoallw without flow control. mpierr %d",mpierr));
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        }
-        return PIO_NOERR;
-    }
-
-    /* an index for communications tags */
-    offset_t = ntasks;
-
-    /* Send to self. */
-    if (sendcounts[my_rank] > 0)
-    {
-        void *sptr, *rptr;
-        tag = my_rank + offset_t;
-        sptr = (char *)sendbuf + sdispls[my_rank];
-        rptr = (char *)recvbuf + rdispls[my_rank];
-
-        /*
-          MPI_Type_get_extent(sendtypes[my_rank], &lb, &extent);
-          printf("%s %d %d %d\n",__FILE__,__LINE__,extent, lb);
-          MPI_Type_get_extent(recvtypes[my_rank], &lb, &extent);
-          printf("%s %d %d %d\n",__FILE__,__LINE__,extent, lb);
-        */
-
-/* #ifdef ONEWAY */
-/*         /\* If ONEWAY is true we will post mpi_sendrecv comms instead */
-/*          * of irecv/send. *\/ */
-/*         if ((mpierr = MPI_Sendrecv(sptr, sendcounts[my_rank],sendtypes[my_rank], */
-/*                                    my_rank, tag, rptr, recvcounts[my_rank], recvtypes[my_rank], */
-/*                                    my_rank, tag, comm, &status))) */
-/*             return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__); */
-/* #else */
-        if ((mpierr = MPI_Irecv(rptr, recvcounts[my_rank], recvtypes[my_rank],
-                                my_rank, tag, comm, rcvids)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Send(sptr, sendcounts[my_rank], sendtypes[my_rank],
-                               my_rank, tag, comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-        if ((mpierr = MPI_Wait(rcvids, &status)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-/* #endif */
-    }
-
-    PLOG((2, "Done sending to self... sending to other procs"));
-
-    /* When send to self is complete there is nothing left to do if
-     * ntasks==1. */
-    if (ntasks == 1)
-        return PIO_NOERR;
-
-    for (int i = 0; i < ntasks; i++)
+    for (int i = 0; i < steps; i++)
     {
         rcvids[i] = MPI_REQUEST_NULL;
-        swapids[i] = 0;
+        sndids[i] = MPI_REQUEST_NULL;
+        hs_rcvids[i] = MPI_REQUEST_NULL;
     }
 
-    if (fc->isend)
-        for (int i = 0; i < ntasks; i++)
-            sndids[i] = MPI_REQUEST_NULL;
-
-    if (fc->hs)
-        for (int i = 0; i < ntasks; i++)
-            hs_rcvids[i] = MPI_REQUEST_NULL;
-
-    steps = 0;
-    for (istep = 0; istep < ceil2(ntasks) - 1; istep++)
-    {
-        p = pair(ntasks, istep, my_rank);
-        if (p >= 0 && (sendcounts[p] > 0 || recvcounts[p] > 0))
-            swapids[steps++] = p;
-    }
-
-    PLOG((3, "steps=%d", steps));
-
-    if (steps == 0)
-        return PIO_NOERR;
-
     if (steps == 1)
     {
         maxreq = 1;
@@ -247,7 +234,7 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
             if (sendcounts[p] > 0)
             {
                 tag = my_rank + offset_t;
-                if ((mpierr = MPI_Irecv(&hs, 1, MPI_INT, p, tag, comm, hs_rcvids + istep)))
+                if ((mpierr = MPI_Irecv(&hs, 1, MPI_INT, peers[p], tag, comm, hs_rcvids + istep)))
                     return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
             }
         }
@@ -259,15 +246,15 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
         p = swapids[istep];
         if (recvcounts[p] > 0)
         {
-            tag = p + offset_t;
+            tag = peers[p] + offset_t;
             ptr = (char *)recvbuf + rdispls[p];
 
-            if ((mpierr = MPI_Irecv(ptr, recvcounts[p], recvtypes[p], p, tag, comm,
+            if ((mpierr = MPI_Irecv(ptr, recvcounts[p], recvtypes[p], peers[p], tag, comm,
                                     rcvids + istep)))
                 return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
             if (fc->hs)
-                if ((mpierr = MPI_Send(&hs, 1, MPI_INT, p, tag, comm)))
+                if ((mpierr = MPI_Send(&hs, 1, MPI_INT, peers[p], tag, comm)))
                     return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
         }
     }
@@ -301,25 +288,19 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
              */
             if (fc->hs && fc->isend)
             {
-/* #ifdef USE_MPI_ISEND_FOR_FC */
-/*                 if ((mpierr = MPI_Isend(ptr, sendcounts[p], sendtypes[p], p, tag, comm, */
-/*                                         sndids + istep))) */
-/*                     return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__); */
-/* #else */
-                if ((mpierr = MPI_Irsend(ptr, sendcounts[p], sendtypes[p], p, tag, comm,
+                if ((mpierr = MPI_Irsend(ptr, sendcounts[p], sendtypes[p], peers[p], tag, comm,
                                          sndids + istep)))
                     return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-/* #endif */
             }
             else if (fc->isend)
             {
-                if ((mpierr = MPI_Isend(ptr, sendcounts[p], sendtypes[p], p, tag, comm,
+                if ((mpierr = MPI_Isend(ptr, sendcounts[p], sendtypes[p], peers[p], tag, comm,
                                         sndids + istep)))
                     return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
             }
             else
             {
-                if ((mpierr = MPI_Send(ptr, sendcounts[p], sendtypes[p], p, tag, comm)))
+                if ((mpierr = MPI_Send(ptr, sendcounts[p], sendtypes[p], peers[p], tag, comm)))
                     return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
             }
         }
@@ -328,12 +309,13 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
          * then there is a remainder that must be handled. */
         if (istep > maxreqh - 1)
         {
-            p = istep - maxreqh;
-            if (rcvids[p] != MPI_REQUEST_NULL)
+            int r = istep - maxreqh;
+
+            if (rcvids[r] != MPI_REQUEST_NULL)
             {
-                if ((mpierr = MPI_Wait(rcvids + p, &status)))
+                if ((mpierr = MPI_Wait(rcvids + r, &status)))
                     return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-                rcvids[p] = MPI_REQUEST_NULL;
+                rcvids[r] = MPI_REQUEST_NULL;
             }
             if (rstep < steps)
             {
@@ -341,18 +323,20 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
                 if (fc->hs && sendcounts[p] > 0)
                 {
                     tag = my_rank + offset_t;
-                    if ((mpierr = MPI_Irecv(&hs, 1, MPI_INT, p, tag, comm, hs_rcvids+rstep)))
+                    if ((mpierr = MPI_Irecv(&hs, 1, MPI_INT, peers[p], tag, comm,
+                                            hs_rcvids + rstep)))
                         return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
                 }
                 if (recvcounts[p] > 0)
                 {
-                    tag = p + offset_t;
+                    tag = peers[p] + offset_t;
 
                     ptr = (char *)recvbuf + rdispls[p];
-                    if ((mpierr = MPI_Irecv(ptr, recvcounts[p], recvtypes[p], p, tag, comm, rcvids + rstep)))
+                    if ((mpierr = MPI_Irecv(ptr, recvcounts[p], recvtypes[p], peers[p], tag,
+                                            comm, rcvids + rstep)))
                         return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
                     if (fc->hs)
-                        if ((mpierr = MPI_Send(&hs, 1, MPI_INT, p, tag, comm)))
+                        if ((mpierr = MPI_Send(&hs, 1, MPI_INT, peers[p], tag, comm)))
                             return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
                 }
                 rstep++;
@@ -360,18 +344,522 @@ int pio_swapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendty
         }
     }
 
-    /* If steps > 0 there could still be outstanding messages, wait for
-     * them here. */
-    if (steps > 0)
+    /* There could still be outstanding messages, wait for them
+     * here. */
+    PLOG((2, "Waiting for outstanding msgs"));
+    if ((mpierr = MPI_Waitall(steps, rcvids, MPI_STATUSES_IGNORE)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if (fc->isend)
+        if ((mpierr = MPI_Waitall(steps, sndids, MPI_STATUSES_IGNORE)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Provides the functionality of pio_swapm() for an exchange with a
+ * list of peers. The arrays are indexed by peer, not by rank, so
+ * their size (and the work done here) is proportional to the number
+ * of tasks this task exchanges data with, not the size of the
+ * communicator. The messages are the same as those of pio_swapm(),
+ * and are exchanged with the peers in the same order.
+ *
+ * The one exception is when fc->max_pend_req is 0, and
+ * MPI_Alltoallw() is used. Then arrays over the whole communicator
+ * are built for the MPI_Alltoallw() call.
+ *
+ * @param ios pointer to the IO system info, whose timers time the
+ * exchange. Ignored if NULL.
+ * @param sendbuf starting address of send buffer
+ * @param sendcounts integer array (of length npeers). Entry j
+ * specifies the number of elements to send to peer j.
+ * @param sdispls integer array (of length npeers). Entry j
+ * specifies the displacement in bytes (relative to sendbuf) from
+ * which to take the outgoing data destined for peer j.
+ * @param sendtypes array of datatypes (of length npeers). Entry j
+ * specifies the type of data to send to peer j.
+ * @param recvbuf address of receive buffer.
+ * @param recvcounts integer array (of length npeers) specifying the
+ * number of elements that can be received from each peer.
+ * @param rdispls integer array (of length npeers). Entry i
+ * specifies the displacement in bytes (relative to recvbuf) at which
+ * to place the incoming data from peer i.
+ * @param recvtypes array of datatypes (of length npeers). Entry i
+ * specifies the type of data received from peer i.
+ * @param npeers the number of peers.
+ * @param peers array (of length npeers) of the ranks of the peers in
+ * comm. Each rank may only appear once.
+ * @param comm MPI communicator.
+ * @param fc pointer to the struct that provided flow control options.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int pio_swapm_peers(iosystem_desc_t *ios, void *sendbuf, int *sendcounts, int *sdispls,
+                    MPI_Datatype *sendtypes, void *recvbuf, int *recvcounts, int *rdispls,
+                    MPI_Datatype *recvtypes, int npeers, const int *peers, MPI_Comm comm,
+                    rearr_comm_fc_opt_t *fc)
+{
+    int ntasks;  /* Number of tasks in communicator comm. */
+    int my_rank; /* Rank of this task in comm. */
+    int offset_t;
+    int steps = 0;
+    swapm_step_t *order;
+    int *swapids;
+    MPI_Request *reqs;
+    MPI_Status status; /* Not actually used - replace with MPI_STATUSES_IGNORE. */
+    int mpierr;  /* Return code from MPI functions. */
+    int ret;
+
+    PLOG((2, "pio_swapm_peers npeers = %d fc->hs = %d fc->isend = %d fc->max_pend_req = %d",
+          npeers, fc->hs, fc->isend, fc->max_pend_req));
+
+    /* Get my rank and size of communicator. */
+    if ((mpierr = MPI_Comm_size(comm, &ntasks)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(comm, &my_rank)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Print some debugging info, if logging is enabled. */
+#if PIO_ENABLE_LOGGING
+    if (PLOG_ON(4))
+    {
+        for (int p = 0; p < npeers; p++)
+            PLOG((4, "peers[%d] = %d sendcounts = %d sdispls = %d sendtypes = %d recvcounts = %d "
+                  "rdispls = %d recvtypes = %d", p, peers[p], sendcounts[p], sdispls[p],
+                  sendtypes[p], recvcounts[p], rdispls[p], recvtypes[p]));
+    }
+#endif /* PIO_ENABLE_LOGGING */
+
+    /* If fc->max_pend_req == 0 no throttling is requested and the default
+     * mpi_alltoallw function is used. */
+    if (fc->max_pend_req == 0)
+    {
+        if ((ret = pio_start_timer(ios, PIO_TIMER_SWAPM)))
+            return ret;
+        if ((ret = swapm_alltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf, recvcounts,
+                                   rdispls, recvtypes, npeers, peers, comm, ntasks)))
+            return ret;
+        return pio_stop_timer(ios, PIO_TIMER_SWAPM);
+    }
+
+    /* an index for communications tags */
+    offset_t = ntasks;
+
+    /* Send to self. */
+    for (int p = 0; p < npeers; p++)
     {
-        PLOG((2, "Waiting for outstanding msgs"));
-        if ((mpierr = MPI_Waitall(steps, rcvids, MPI_STATUSES_IGNORE)))
+        if (peers[p] == my_rank && sendcounts[p] > 0)
+        {
+            MPI_Request rcvid;
+            int tag = my_rank + offset_t;
+            void *sptr = (char *)sendbuf + sdispls[p];
+            void *rptr = (char *)recvbuf + rdispls[p];
+
+            if ((mpierr = MPI_Irecv(rptr, recvcounts[p], recvtypes[p], my_rank, tag, comm,
+                                    &rcvid)))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+            if ((mpierr = MPI_Send(sptr, sendcounts[p], sendtypes[p], my_rank, tag, comm)))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+            if ((mpierr = MPI_Wait(&rcvid, &status)))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        }
+    }
+
+    PLOG((2, "Done sending to self... sending to other procs"));
+
+    /* Put the other peers in the order of the pairwise schedule. Peer
+     * q is paired with this task at step (q ^ my_rank) - 1. */
+    if (!(order = malloc((npeers ? npeers : 1) * sizeof(swapm_step_t))))
+        return PIO_ENOMEM;
+    for (int p = 0; p < npeers; p++)
+    {
+        if (peers[p] != my_rank && (sendcounts[p] > 0 || recvcounts[p] > 0))
+        {
+            order[steps].key = peers[p] ^ my_rank;
+            order[steps++].idx = p;
+        }
+    }
+
+    PLOG((3, "steps=%d", steps));
+
+    if (steps == 0)
+    {
+        free(order);
+        return PIO_NOERR;
+    }
+    qsort(order, steps, sizeof(swapm_step_t), compare_steps);
+
+    /* Allocate the step arrays. */
+    if (!(swapids = malloc(steps * sizeof(int))))
+    {
+        free(order);
+        return PIO_ENOMEM;
+    }
+    for (int i = 0; i < steps; i++)
+        swapids[i] = order[i].idx;
+    free(order);
+    if (!(reqs = malloc(3 * steps * sizeof(MPI_Request))))
+    {
+        free(swapids);
+        return PIO_ENOMEM;
+    }
+
+    if (!(ret = pio_start_timer(ios, PIO_TIMER_SWAPM)))
+        ret = swapm_pairwise(sendbuf, sendcounts, sdispls, sendtypes, recvbuf, recvcounts,
+                             rdispls, recvtypes, peers, comm, fc, my_rank, offset_t, steps,
+                             swapids, reqs, reqs + steps, reqs + 2 * steps);
+    free(swapids);
+    free(reqs);
+    if (!ret)
+        ret = pio_stop_timer(ios, PIO_TIMER_SWAPM);
+
+    return ret;
+}
+
+/**
+ * Provides the functionality of MPI_Alltoallw with flow control
+ * options. Generalized all-to-all communication allowing different
+ * datatypes, counts, and displacements for each partner
+ *
+ * @param ios pointer to the IO system info, whose timers time the
+ * exchange. Ignored if NULL.
+ * @param sendbuf starting address of send buffer
+ * @param sendcounts integer array equal to the number of tasks in
+ * communicator comm (ntasks). It specifies the number of elements to
+ * send to each processor
+ * @param sdispls integer array (of length ntasks). Entry j
+ * specifies the displacement in bytes (relative to sendbuf) from
+ * which to take the outgoing data destined for process j.
+ * @param sendtypes array of datatypes (of length ntasks). Entry j
+ * specifies the type of data to send to process j.
+ * @param recvbuf address of receive buffer.
+ * @param recvcounts integer array (of length ntasks) specifying the
+ * number of elements that can be received from each processor.
+ * @param rdispls integer array (of length ntasks). Entry i
+ * specifies the displacement in bytes (relative to recvbuf) at which
+ * to place the incoming data from process i.
+ * @param recvtypes array of datatypes (of length ntasks). Entry i
+ * specifies the type of data received from process i.
+ * @param comm MPI communicator for the MPI_Alltoallw call.
+ * @param fc pointer to the struct that provided flow control options.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int pio_swapm(iosystem_desc_t *ios, void *sendbuf, int *sendcounts, int *sdispls,
+              MPI_Datatype *sendtypes, void *recvbuf, int *recvcounts, int *rdispls,
+              MPI_Datatype *recvtypes, MPI_Comm comm, rearr_comm_fc_opt_t *fc)
+{
+    int ntasks;  /* Number of tasks in communicator comm. */
+    int npeers = 0;
+    int *peers;           /* Peer ranks, then their counts and displacements. */
+    MPI_Datatype *types;  /* Send and receive types of the peers. */
+    int mpierr;  /* Return code from MPI functions. */
+    int ret;
+
+    PLOG((2, "pio_swapm fc->hs = %d fc->isend = %d fc->max_pend_req = %d", fc->hs,
+          fc->isend, fc->max_pend_req));
+
+    /* If fc->max_pend_req == 0 no throttling is requested and the default
+     * mpi_alltoallw function is used. */
+    if (fc->max_pend_req == 0)
+    {
+        /* Call the MPI alltoall without flow control. */
+        PLOG((3, "Calling MPI_Alltoallw without flow control. comm=%d", comm));
+        if ((ret = pio_start_timer(ios, PIO_TIMER_SWAPM)))
+            return ret;
+        if ((mpierr = MPI_Alltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf,
+                                    recvcounts, rdispls, recvtypes, comm)))
             return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        if (fc->isend)
-            if ((mpierr = MPI_Waitall(steps, sndids, MPI_STATUSES_IGNORE)))
+        return pio_stop_timer(ios, PIO_TIMER_SWAPM);
+    }
+
+    if ((mpierr = MPI_Comm_size(comm, &ntasks)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Find the tasks that data is exchanged with, and copy their
+     * entries into arrays indexed by peer. */
+    for (int q = 0; q < ntasks; q++)
+        if (sendcounts[q] > 0 || recvcounts[q] > 0)
+            npeers++;
+    if (!(peers = malloc((5 * npeers + 1) * sizeof(int))))
+        return PIO_ENOMEM;
+    if (!(types = malloc((2 * npeers + 1) * sizeof(MPI_Datatype))))
+    {
+        free(peers);
+        return PIO_ENOMEM;
+    }
+    npeers = 0;
+    for (int q = 0; q < ntasks; q++)
+        if (sendcounts[q] > 0 || recvcounts[q] > 0)
+            peers[npeers++] = q;
+    for (int p = 0; p < npeers; p++)
+    {
+        int q = peers[p];
+
+        peers[npeers + p] = sendcounts[q];
+        peers[2 * npeers + p] = sdispls[q];
+        peers[3 * npeers + p] = recvcounts[q];
+        peers[4 * npeers + p] = rdispls[q];
+        types[p] = sendtypes[q];
+        types[npeers + p] = recvtypes[q];
+    }
+
+    ret = pio_swapm_peers(ios, sendbuf, peers + npeers, peers + 2 * npeers, types, recvbuf,
+                          peers + 3 * npeers, peers + 4 * npeers, types + npeers, npeers,
+                          peers, comm, fc);
+    free(peers);
+    free(types);
+
+    return ret;
+}
+
+/**
+ * Post the messages of an MPI_Alltoallw-like exchange, all receives
+ * first, then all sends. This does the work for pio_iswapm() and
+ * pio_swapm_init().
+ *
+ * @param sendbuf starting address of send buffer
+ * @param sendcounts integer array (of length ntasks) of the number
+ * of elements to send to each processor.
+ * @param sdispls integer array (of length ntasks) of displacements
+ * in bytes (relative to sendbuf) of the data for each processor.
+ * @param sendtypes array of datatypes (of length ntasks).
+ * @param recvbuf address of receive buffer.
+ * @param recvcounts integer array (of length ntasks) of the number of
+ * elements that can be received from each processor.
+ * @param rdispls integer array (of length ntasks) of displacements in
+ * bytes (relative to recvbuf) for the data from each processor.
+ * @param recvtypes array of datatypes (of length ntasks).
+ * @param npeers number of peers, ignored if peers is NULL.
+ * @param peers NULL if the arrays are indexed by rank, otherwise an
+ * array (of length npeers) of the ranks of the peers, and the
+ * arrays (of length npeers) are indexed by peer.
+ * @param comm MPI communicator.
+ * @param offset_t offset added to the rank of the sender to get the
+ * message tag.
+ * @param persistent if true, create persistent requests (which are
+ * not started), otherwise start the messages.
+ * @param maxreqs size of the reqs array.
+ * @param reqs array that gets the MPI requests.
+ * @param nreqs pointer that gets the number of requests in reqs.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+swapm_post(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+           void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+           int npeers, const int *peers, MPI_Comm comm, int offset_t, bool persistent,
+           int maxreqs, MPI_Request *reqs, int *nreqs)
+{
+    int ntasks;  /* Number of tasks in communicator comm. */
+    int my_rank; /* Rank of this task in comm. */
+    int mpierr;  /* Return code from MPI functions. */
+
+    pioassert(reqs && nreqs, "invalid input", __FILE__, __LINE__);
+
+    /* Get my rank and size of communicator. */
+    if ((mpierr = MPI_Comm_size(comm, &ntasks)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(comm, &my_rank)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    PLOG((2, "swapm_post ntasks = %d my_rank = %d persistent = %d", ntasks, my_rank,
+          persistent));
+
+    *nreqs = 0;
+    if (!peers)
+        npeers = ntasks;
+
+    /* Post the receives. */
+    for (int p = 0; p < npeers; p++)
+    {
+        if (recvcounts[p] > 0)
+        {
+            void *ptr = (char *)recvbuf + rdispls[p];
+            int q = peers ? peers[p] : p;
+
+            pioassert(*nreqs < maxreqs, "too many requests", __FILE__, __LINE__);
+            if (persistent)
+                mpierr = MPI_Recv_init(ptr, recvcounts[p], recvtypes[p], q, q + offset_t,
+                                       comm, reqs + (*nreqs)++);
+            else
+                mpierr = MPI_Irecv(ptr, recvcounts[p], recvtypes[p], q, q + offset_t,
+                                   comm, reqs + (*nreqs)++);
+            if (mpierr)
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        }
+    }
+
+    /* Post the sends. */
+    for (int p = 0; p < npeers; p++)
+    {
+        if (sendcounts[p] > 0)
+        {
+            void *ptr = (char *)sendbuf + sdispls[p];
+            int q = peers ? peers[p] : p;
+
+            pioassert(*nreqs < maxreqs, "too many requests", __FILE__, __LINE__);
+            if (persistent)
+                mpierr = MPI_Send_init(ptr, sendcounts[p], sendtypes[p], q,
+                                       my_rank + offset_t, comm, reqs + (*nreqs)++);
+            else
+                mpierr = MPI_Isend(ptr, sendcounts[p], sendtypes[p], q,
+                                   my_rank + offset_t, comm, reqs + (*nreqs)++);
+            if (mpierr)
                 return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        }
+    }
+
+    PLOG((3, "swapm_post posted %d requests", *nreqs));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Start an MPI_Alltoallw-like exchange with non-blocking
+ * point-to-point messages, without waiting for it to complete. All
+ * receives are posted before the sends. No flow control is done. The
+ * returned requests must be completed (for example with
+ * MPI_Waitall()) before the send and receive buffers are touched.
+ *
+ * Messages are tagged with the rank of the sender plus
+ * 2*ntasks, so they don't match the messages of a pio_swapm() call
+ * made while this exchange is in flight.
+ *
+ * @param sendbuf starting address of send buffer
+ * @param sendcounts integer array (of length ntasks) of the number
+ * of elements to send to each processor.
+ * @param sdispls integer array (of length ntasks) of displacements
+ * in bytes (relative to sendbuf) of the data for each processor.
+ * @param sendtypes array of datatypes (of length ntasks).
+ * @param recvbuf address of receive buffer.
+ * @param recvcounts integer array (of length ntasks) of the number of
+ * elements that can be received from each processor.
+ * @param rdispls integer array (of length ntasks) of displacements in
+ * bytes (relative to recvbuf) for the data from each processor.
+ * @param recvtypes array of datatypes (of length ntasks).
+ * @param npeers number of peers, ignored if peers is NULL.
+ * @param peers NULL if the arrays are indexed by rank, otherwise an
+ * array (of length npeers) of the ranks of the peers, and the
+ * arrays (of length npeers) are indexed by peer.
+ * @param comm MPI communicator.
+ * @param maxreqs size of the reqs array.
+ * @param reqs array that gets the MPI requests.
+ * @param nreqs pointer that gets the number of requests in reqs.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int pio_iswapm(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+               void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+               int npeers, const int *peers, MPI_Comm comm, int maxreqs, MPI_Request *reqs,
+               int *nreqs)
+{
+    int ntasks;  /* Number of tasks in communicator comm. */
+    int mpierr;  /* Return code from MPI functions. */
+
+    if ((mpierr = MPI_Comm_size(comm, &ntasks)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Use tags past the ones pio_swapm() uses. */
+    return swapm_post(sendbuf, sendcounts, sdispls, sendtypes, recvbuf, recvcounts,
+                      rdispls, recvtypes, npeers, peers, comm, 2 * ntasks, false, maxreqs,
+                      reqs, nreqs);
+}
+
+/**
+ * Create persistent requests for an MPI_Alltoallw-like exchange that
+ * is done over and over with the same buffers. The exchange is done
+ * by starting the requests with MPI_Startall() and completing them
+ * with MPI_Waitall(). The messages (and their tags) are the same as
+ * those of pio_swapm() without handshaking and with an unlimited
+ * number of pending requests, so the two may be used in turn.
+ *
+ * @param sendbuf starting address of send buffer
+ * @param sendcounts integer array (of length ntasks) of the number
+ * of elements to send to each processor.
+ * @param sdispls integer array (of length ntasks) of displacements
+ * in bytes (relative to sendbuf) of the data for each processor.
+ * @param sendtypes array of datatypes (of length ntasks).
+ * @param recvbuf address of receive buffer.
+ * @param recvcounts integer array (of length ntasks) of the number of
+ * elements that can be received from each processor.
+ * @param rdispls integer array (of length ntasks) of displacements in
+ * bytes (relative to recvbuf) for the data from each processor.
+ * @param recvtypes array of datatypes (of length ntasks).
+ * @param npeers number of peers, ignored if peers is NULL.
+ * @param peers NULL if the arrays are indexed by rank, otherwise an
+ * array (of length npeers) of the ranks of the peers, and the
+ * arrays (of length npeers) are indexed by peer.
+ * @param comm MPI communicator.
+ * @param maxreqs size of the reqs array.
+ * @param reqs array that gets the MPI requests.
+ * @param nreqs pointer that gets the number of requests in reqs.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int pio_swapm_init(void *sendbuf, int *sendcounts, int *sdispls, MPI_Datatype *sendtypes,
+                   void *recvbuf, int *recvcounts, int *rdispls, MPI_Datatype *recvtypes,
+                   int npeers, const int *peers, MPI_Comm comm, int maxreqs,
+                   MPI_Request *reqs, int *nreqs)
+{
+    int ntasks;  /* Number of tasks in communicator comm. */
+    int mpierr;  /* Return code from MPI functions. */
+
+    if ((mpierr = MPI_Comm_size(comm, &ntasks)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Use the same tags as pio_swapm(). */
+    return swapm_post(sendbuf, sendcounts, sdispls, sendtypes, recvbuf, recvcounts,
+                      rdispls, recvtypes, npeers, peers, comm, ntasks, true, maxreqs,
+                      reqs, nreqs);
+}
+
+/**
+ * Provides the functionality of pio_swapm() over a neighborhood
+ * communicator, with MPI_Neighbor_alltoallw(). The arrays are
+ * indexed by neighbor (in the order of the neighbors of the
+ * distributed graph), not by rank, so their size is just the number
+ * of neighbors. No flow control is done, and all displacements are
+ * 0. Zero counts may be given with a null type.
+ *
+ * @param sendbuf starting address of send buffer
+ * @param sendcounts integer array (of length nneighbors) of the number
+ * of elements to send to each neighbor.
+ * @param sendtypes array of datatypes (of length nneighbors).
+ * @param recvbuf address of receive buffer.
+ * @param recvcounts integer array (of length nneighbors) of the
+ * number of elements that can be received from each neighbor.
+ * @param recvtypes array of datatypes (of length nneighbors).
+ * @param nneighbors the number of neighbors of this task.
+ * @param comm distributed graph communicator, with the same
+ * neighbors as sources and destinations.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int pio_neighbor_swapm(void *sendbuf, int *sendcounts, MPI_Datatype *sendtypes,
+                       void *recvbuf, int *recvcounts, MPI_Datatype *recvtypes,
+                       int nneighbors, MPI_Comm comm)
+{
+    MPI_Aint displs[nneighbors ? nneighbors : 1];
+    MPI_Datatype stypes[nneighbors ? nneighbors : 1];
+    MPI_Datatype rtypes[nneighbors ? nneighbors : 1];
+    int mpierr;  /* Return code from MPI functions. */
+
+    PLOG((2, "pio_neighbor_swapm nneighbors = %d", nneighbors));
+
+    /* Some MPI libraries don't accept null types, even with zero
+     * counts. */
+    for (int n = 0; n < nneighbors; n++)
+    {
+        displs[n] = 0;
+        stypes[n] = sendtypes[n] == MPI_DATATYPE_NULL ? MPI_BYTE : sendtypes[n];
+        rtypes[n] = recvtypes[n] == MPI_DATATYPE_NULL ? MPI_BYTE : recvtypes[n];
     }
 
+    if ((mpierr = MPI_Neighbor_alltoallw(sendbuf, sendcounts, displs, stypes, recvbuf,
+                                         recvcounts, displs, rtypes, comm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
     return PIO_NOERR;
 }
 
@@ -76,11 +76,9 @@ extern int blocksize;
 /** Used when assiging decomposition IDs. */
 int pio_next_ioid = 512;
 
-/** Sort map. */
-struct sort_map {
-    int remap;
-    PIO_Offset map;
-};
+/** True if IO systems with the same tasks share their communicators,
+ * see PIOc_set_comm_sharing(). */
+bool pio_comm_sharing = false;
 
 /**
  * Check to see if PIO has been initialized.
@@ -187,17 +185,24 @@ PIOc_advanceframe(int ncid, int varid)
     file_desc_t *file;        /* Pointer to file information. */
     var_desc_t *vdesc;        /* Info about the var. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    bool lazy;                /* True if the file is not open yet. */
     int ret;
 
     PLOG((1, "PIOc_advanceframe ncid = %d varid = %d", ncid, varid));
 
+    /* A file that has not been opened yet keeps the frame. */
+    if ((ret = pio_set_lazy_frame(ncid, varid, 0, true, &lazy)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    if (lazy)
+        return PIO_NOERR;
+
     /* Get the file info. */
     if ((ret = pio_get_file(ncid, &file)))
         return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
     ios = file->iosystem;
 
     /* Get info about variable. */
-    if ((ret = get_var_desc(varid, &file->varlist, &vdesc)))
+    if ((ret = get_file_var_desc(file, varid, &vdesc)))
         return pio_err(ios, file, ret, __FILE__, __LINE__);
 
     /* If using async, and not an IO task, then send parameters. */
@@ -248,18 +253,25 @@ PIOc_setframe(int ncid, int varid, int frame)
     file_desc_t *file;        /* Pointer to file information. */
     var_desc_t *vdesc;        /* Info about the var. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    bool lazy;                /* True if the file is not open yet. */
     int ret;
 
     PLOG((1, "PIOc_setframe ncid = %d varid = %d frame = %d", ncid,
           varid, frame));
 
+    /* A file that has not been opened yet keeps the frame. */
+    if ((ret = pio_set_lazy_frame(ncid, varid, frame, false, &lazy)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    if (lazy)
+        return PIO_NOERR;
+
     /* Get file info. */
     if ((ret = pio_get_file(ncid, &file)))
         return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
     ios = file->iosystem;
 
     /* Get info about variable. */
-    if ((ret = get_var_desc(varid, &file->varlist, &vdesc)))
+    if ((ret = get_file_var_desc(file, varid, &vdesc)))
         return pio_err(ios, file, ret, __FILE__, __LINE__);
 
     /* If using async, and not an IO task, then send parameters. */
@@ -294,6 +306,182 @@ PIOc_setframe(int ncid, int varid, int frame)
     return PIO_NOERR;
 }
 
+/**
+ * Set the quantization of a float or double variable. The data
+ * written to the variable with the darray functions are quantized on
+ * the IO tasks, after they are rearranged and before they are
+ * written. The mantissa bits that are not needed for the precision
+ * asked for are set to zeros (or, for bitgroom, alternately to zeros
+ * and ones), so the data compress much better.
+ *
+ * Quantization is lossy. Fill values, zeros, NaNs and infinities are
+ * not changed. Data written with PIOc_put_var() and friends are not
+ * quantized.
+ *
+ * @param ncid the ncid of the file.
+ * @param varid the varid of the variable.
+ * @param quantize_mode PIO_QUANTIZE_BITGROOM, PIO_QUANTIZE_BITROUND,
+ * or PIO_NOQUANTIZE to turn quantization off.
+ * @param nsd the number of significant decimal digits (bitgroom) or
+ * mantissa bits (bitround) to keep. Ignored for PIO_NOQUANTIZE.
+ * @return PIO_NOERR for no error, or error code.
+ * @ingroup PIO_def_var_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_def_var_quantize(int ncid, int varid, int quantize_mode, int nsd)
+{
+    iosystem_desc_t *ios;     /* Pointer to io system information. */
+    file_desc_t *file;        /* Pointer to file information. */
+    var_desc_t *vdesc;        /* Info about the var. */
+    int max_nsd;              /* Largest allowed nsd. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int ret;
+
+    PLOG((1, "PIOc_def_var_quantize ncid = %d varid = %d quantize_mode = %d nsd = %d",
+          ncid, varid, quantize_mode, nsd));
+
+    /* Get file info. */
+    if ((ret = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Get info about variable. */
+    if ((ret = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(ios, file, ret, __FILE__, __LINE__);
+
+    /* Only floating point data can be quantized. */
+    if (vdesc->pio_type != PIO_FLOAT && vdesc->pio_type != PIO_DOUBLE)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Check the mode and the number of significant digits. */
+    switch (quantize_mode)
+    {
+    case PIO_NOQUANTIZE:
+        nsd = 0;
+        break;
+    case PIO_QUANTIZE_BITGROOM:
+        max_nsd = vdesc->pio_type == PIO_FLOAT ? 7 : 15;
+        if (nsd < 1 || nsd > max_nsd)
+            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+        break;
+    case PIO_QUANTIZE_BITROUND:
+        max_nsd = vdesc->pio_type == PIO_FLOAT ? 23 : 52;
+        if (nsd < 1 || nsd > max_nsd)
+            return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+        break;
+    default:
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+    }
+
+    /* If using async, and not an IO task, then send parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_DEF_VAR_QUANTIZE;
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&varid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&quantize_mode, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&nsd, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi(ios, NULL, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Remember the setting. It is used by the write_darray
+     * functions. */
+    vdesc->quantize_mode = quantize_mode;
+    vdesc->nsd = nsd;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Turn on or off the skipping of unchanged data for a variable. When
+ * on, PIOc_write_darray() hashes the array of each task, and if the
+ * array is the same on all tasks as the last one written to the
+ * variable, it is neither buffered, rearranged nor written. This is
+ * for fields that rarely change from one record to the next, like
+ * masks and slowly updated parameters.
+ *
+ * With the PIO_FLUSH_VOTE flush mode the tasks agree whether the
+ * array changed in the flush vote that is done anyway. With
+ * PIO_FLUSH_DETERMINISTIC this costs an MPI_Allreduce() for each
+ * write of the variable.
+ *
+ * A record that is skipped is not written, so it keeps the fill
+ * value. If refvarid is not -1, it is an int variable with the
+ * unlimited dimension only, which gets, for each record written with
+ * PIOc_write_darray(), the record that holds its data: the record
+ * itself, or the last one that was written. Non-record variables are
+ * only written again when they change.
+ *
+ * Only writes with PIOc_write_darray() are compared. Arrays are
+ * compared by 64-bit hash, so a change is missed with a probability
+ * of about 2^-64. The fill value passed with the array, or else that
+ * of the var if the decomposition has holes, is hashed with it, so a
+ * write with another fill value is not skipped. With device arrays
+ * (see PIOc_set_device_buffers()), each array is copied to host
+ * memory by MPI to be hashed, and the tasks agree whether it changed
+ * with an MPI_Allreduce(). This function must be called on all
+ * computation tasks, with the same values.
+ *
+ * @param ncid the ncid of the file.
+ * @param varid the varid of the variable.
+ * @param enable true to skip unchanged arrays, false to write all
+ * (the default).
+ * @param refvarid the varid of the variable that gets the frame of
+ * the data of each record, or -1 for none.
+ * @return PIO_NOERR for no error, or error code.
+ * @ingroup PIO_def_var_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_var_skip_unchanged(int ncid, int varid, bool enable, int refvarid)
+{
+    file_desc_t *file;        /* Pointer to file information. */
+    var_desc_t *vdesc;        /* Info about the var. */
+    var_desc_t *rdesc;        /* Info about the reference var. */
+    int ret;
+
+    PLOG((1, "PIOc_set_var_skip_unchanged ncid = %d varid = %d enable = %d refvarid = %d",
+          ncid, varid, enable, refvarid));
+
+    /* Get file and var info. */
+    if ((ret = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    if ((ret = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(file->iosystem, file, ret, __FILE__, __LINE__);
+
+    /* The reference var must be an int record var. */
+    if (refvarid != -1)
+    {
+        if ((ret = get_file_var_desc(file, refvarid, &rdesc)))
+            return pio_err(file->iosystem, file, ret, __FILE__, __LINE__);
+        if (!rdesc->rec_var || rdesc->ndims != 1 || rdesc->pio_type != PIO_INT)
+            return pio_err(file->iosystem, file, PIO_EINVAL, __FILE__, __LINE__);
+    }
+
+    vdesc->skip_unchanged = enable;
+    vdesc->skip_refvarid = refvarid;
+    vdesc->skip_valid = false;
+
+    return PIO_NOERR;
+}
+
 /**
  * Get the number of IO tasks set.
  *
@@ -318,6 +506,91 @@ PIOc_get_numiotasks(int iosysid, int *numiotasks)
     return PIO_NOERR;
 }
 
+/**
+ * Report the placement of the IO tasks on the nodes. The tasks which
+ * share memory (as found by MPI_Comm_split_type() with
+ * MPI_COMM_TYPE_SHARED) are taken to be on the same node, and the
+ * nodes are numbered from 0 in the order of their lowest rank.
+ *
+ * This works for any iosystem made with PIOc_Init_Intracomm() or
+ * PIOc_Init_Intracomm_topo(). It is collective over the tasks of the
+ * iosystem, so it may not be used with async, where the IO tasks are
+ * busy in the message handler.
+ *
+ * @param iosysid the IO system ID.
+ * @param num_nodes pointer that gets the number of nodes of the
+ * iosystem. Ignored if NULL.
+ * @param num_ionodes pointer that gets the number of nodes holding
+ * at least one IO task. Ignored if NULL.
+ * @param ioranks array of length num_iotasks (see
+ * PIOc_get_numiotasks()) that gets the rank of each IO task. Ignored
+ * if NULL.
+ * @param ionodes array of length num_iotasks that gets the node
+ * number of each IO task. Ignored if NULL.
+ * @returns 0 on success, error code otherwise.
+ * @ingroup PIO_getnumiotasks_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_get_iotask_layout(int iosysid, int *num_nodes, int *num_ionodes, int *ioranks,
+                       int *ionodes)
+{
+    iosystem_desc_t *ios;
+    int *node_of;
+    int nnodes;
+    int ret;
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (ios->async)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Find the node of every task. */
+    if (!(node_of = malloc(ios->num_uniontasks * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if ((ret = pio_node_map(ios->union_comm, &nnodes, node_of)))
+    {
+        free(node_of);
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+
+    if (num_nodes)
+        *num_nodes = nnodes;
+
+    if (ioranks)
+        for (int i = 0; i < ios->num_iotasks; i++)
+            ioranks[i] = ios->ioranks[i];
+
+    if (ionodes)
+        for (int i = 0; i < ios->num_iotasks; i++)
+            ionodes[i] = node_of[ios->ioranks[i]];
+
+    /* Count the nodes that have an IO task. */
+    if (num_ionodes)
+    {
+        bool *has_io;
+
+        if (!(has_io = calloc(nnodes, sizeof(bool))))
+        {
+            free(node_of);
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+        *num_ionodes = 0;
+        for (int i = 0; i < ios->num_iotasks; i++)
+            if (!has_io[node_of[ios->ioranks[i]]])
+            {
+                has_io[node_of[ios->ioranks[i]]] = true;
+                (*num_ionodes)++;
+            }
+        free(has_io);
+    }
+
+    free(node_of);
+
+    return PIO_NOERR;
+}
+
 /**
  * Get the local size of the variable.
  *
@@ -438,24 +711,459 @@ PIOc_set_iosystem_error_handling(int iosysid, int method, int *old_method)
 }
 
 /**
- * Compare.
+ * Sort the positions of a map by its values, by merging its sorted
+ * runs, for maps made of a few sorted pieces, or else with an LSD
+ * radix sort of the 64-bit values, one byte per pass, skipping the
+ * bytes that are the same for all values. Both sorts are stable.
  *
- * @param a pointer to a
- * @param b pointer to b
- * @return -1 if a.map < b.map, 1 if a.map > b.map, 0 if equal
- * @author Jim Edwards
+ * @param ios pointer to the iosystem info, for errors.
+ * @param maplen the length of the map.
+ * @param compmap the map.
+ * @param remap gets the positions of the map in order of value.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
  */
-int
-compare( const void* a, const void* b)
+static int
+sort_compmap(iosystem_desc_t *ios, int maplen, const PIO_Offset *compmap, int *remap)
 {
-    struct sort_map l_a = * ( (struct sort_map *) a );
-    struct sort_map l_b = * ( (struct sort_map *) b );
+    int *tmp;
+    int nruns = 1;
 
-    if ( l_a.map < l_b.map )
-        return -1;
-    else if ( l_a.map > l_b.map )
-        return 1;
-    return 0;
+    if (!(tmp = malloc(sizeof(int) * maplen)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    for (int m = 1; m < maplen; m++)
+        if (compmap[m] < compmap[m - 1])
+            nruns++;
+    PLOG((2, "sort_compmap maplen = %d nruns = %d", maplen, nruns));
+
+    if (nruns <= PIO_SORT_MAX_MERGE_RUNS)
+    {
+        int start[nruns + 1];
+        int *src = remap, *dst = tmp;
+        int r = 0;
+
+        /* Find the runs. */
+        start[r++] = 0;
+        for (int m = 1; m < maplen; m++)
+            if (compmap[m] < compmap[m - 1])
+                start[r++] = m;
+        start[nruns] = maplen;
+        for (int m = 0; m < maplen; m++)
+            remap[m] = m;
+
+        /* Merge pairs of neighbouring runs until there is one. */
+        while (nruns > 1)
+        {
+            int n = 0;
+
+            for (r = 0; r < nruns; r += 2)
+            {
+                int i = start[r], j, k = start[r];
+                int mid = r + 1 < nruns ? start[r + 1] : start[nruns];
+                int end = r + 1 < nruns ? start[r + 2] : start[nruns];
+
+                for (j = mid; i < mid && j < end; )
+                    dst[k++] = compmap[src[j]] < compmap[src[i]] ? src[j++] : src[i++];
+                while (i < mid)
+                    dst[k++] = src[i++];
+                while (j < end)
+                    dst[k++] = src[j++];
+                start[n++] = start[r];
+            }
+            start[n] = maplen;
+            nruns = n;
+            src = dst;
+            dst = src == remap ? tmp : remap;
+        }
+        if (src != remap)
+            memcpy(remap, src, sizeof(int) * maplen);
+    }
+    else
+    {
+        uint64_t *key, *keytmp;
+        uint64_t same = ~(uint64_t)0;   /* Bits that are the same in all keys. */
+        int *src = remap, *dst = tmp;
+
+        if (!(key = malloc(sizeof(uint64_t) * maplen)) ||
+            !(keytmp = malloc(sizeof(uint64_t) * maplen)))
+        {
+            free(key);
+            free(tmp);
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        }
+
+        /* Flip the sign bit so the keys sort as unsigned. */
+        for (int m = 0; m < maplen; m++)
+        {
+            key[m] = (uint64_t)compmap[m] ^ ((uint64_t)1 << 63);
+            same &= ~(key[m] ^ key[0]);
+            remap[m] = m;
+        }
+
+        /* One counting sort pass per byte that differs. */
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t count[257] = {0};
+            uint64_t *kt;
+            int *it;
+
+            if (((same >> shift) & 0xff) == 0xff)
+                continue;
+            for (int m = 0; m < maplen; m++)
+                count[((key[m] >> shift) & 0xff) + 1]++;
+            for (int b = 0; b < 256; b++)
+                count[b + 1] += count[b];
+            for (int m = 0; m < maplen; m++)
+            {
+                size_t pos = count[(key[m] >> shift) & 0xff]++;
+                keytmp[pos] = key[m];
+                dst[pos] = src[m];
+            }
+            kt = key;
+            key = keytmp;
+            keytmp = kt;
+            it = src;
+            src = dst;
+            dst = it;
+        }
+        if (src != remap)
+            memcpy(remap, src, sizeof(int) * maplen);
+        free(key);
+        free(keytmp);
+    }
+    free(tmp);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the runs of consecutive indices in iodesc->remap. If the
+ * average run is at least PIO_REMAP_MIN_RUNLEN elements long, the
+ * start of each run is stored in iodesc->remap_runs, so that
+ * pio_sorted_copy() can copy whole runs instead of single elements.
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition info, with remap set.
+ * @return 0 on success, error code otherwise
+ * @author Ed Hartnett
+ */
+static int
+find_remap_runs(iosystem_desc_t *ios, io_desc_t *iodesc)
+{
+    int nruns = 0;
+    int r = 0;
+
+    iodesc->nremap_runs = 0;
+    iodesc->remap_runs = NULL;
+    if (!iodesc->remap || iodesc->maplen == 0)
+        return PIO_NOERR;
+
+    /* Count the runs. */
+    for (int m = 0; m < iodesc->maplen; m++)
+        if (m == 0 || iodesc->remap[m] != iodesc->remap[m - 1] + 1)
+            nruns++;
+    PLOG((2, "find_remap_runs maplen = %d nruns = %d", iodesc->maplen, nruns));
+
+    /* Short runs are better handled element by element. */
+    if (iodesc->maplen / nruns < PIO_REMAP_MIN_RUNLEN)
+        return PIO_NOERR;
+
+    /* Remember where each run starts. */
+    if (!(iodesc->remap_runs = malloc((nruns + 1) * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (int m = 0; m < iodesc->maplen; m++)
+        if (m == 0 || iodesc->remap[m] != iodesc->remap[m - 1] + 1)
+            iodesc->remap_runs[r++] = m;
+    iodesc->remap_runs[nruns] = iodesc->maplen;
+    iodesc->nremap_runs = nruns;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the stripe size and count to align the PIO_IOPART_STRIPE IO
+ * partition to. The values set with PIOc_set_stripe_align() are used,
+ * or, if they are 0, the striping_unit and striping_factor hints of
+ * the iosystem. This is only called on IO tasks, which are the only
+ * tasks that hold the hints.
+ *
+ * @param ios pointer to the IO system info.
+ * @param stripe_unit pointer that gets the stripe size in bytes, or
+ * 0 if it is not known.
+ * @param stripe_factor pointer that gets the number of stripes, or 0
+ * if it is not known.
+ * @author Ed Hartnett
+ */
+static void
+get_stripe_info(iosystem_desc_t *ios, PIO_Offset *stripe_unit, int *stripe_factor)
+{
+    char val[PIO_MAX_NAME + 1];
+    int flag;
+
+    *stripe_unit = ios->stripe_unit;
+    *stripe_factor = ios->stripe_factor;
+
+    if (ios->info == MPI_INFO_NULL)
+        return;
+    if (!*stripe_unit)
+        if (!MPI_Info_get(ios->info, "striping_unit", PIO_MAX_NAME, val, &flag) && flag)
+            *stripe_unit = atoll(val);
+    if (!*stripe_factor)
+        if (!MPI_Info_get(ios->info, "striping_factor", PIO_MAX_NAME, val, &flag) && flag)
+            *stripe_factor = atoi(val);
+    if (*stripe_factor < 0)
+        *stripe_factor = 0;
+    PLOG((2, "get_stripe_info stripe_unit = %lld stripe_factor = %d", *stripe_unit,
+          *stripe_factor));
+}
+
+/**
+ * Check the result of a user IO partition function (see
+ * PIOc_set_iopart_fn()) on all IO tasks. All IO tasks must give the
+ * same number of IO tasks with data, only those tasks may have data,
+ * each region must be inside the global array, no two regions may
+ * overlap, and the regions must add up to the whole array. Together
+ * these mean the regions cover the array exactly once.
+ *
+ * This is collective over the IO tasks, which all return the same
+ * result.
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition info, with the start
+ * and count from the user function in its first region.
+ * @param ndims the number of dimensions in the variable.
+ * @param gdimlen an array of global size of each dimension.
+ * @param fnerr the error returned by the user function on this
+ * task, or 0.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+check_user_iopart(iosystem_desc_t *ios, io_desc_t *iodesc, int ndims, const int *gdimlen,
+                  int fnerr)
+{
+    PIO_Offset *start = iodesc->firstregion->start;
+    PIO_Offset *count = iodesc->firstregion->count;
+    PIO_Offset mysize = 1, gsize = 1;
+    PIO_Offset *box;       /* Start, then count, of each IO task. */
+    int res[3];            /* Error, and most and fewest IO tasks. */
+    int nbox = 2 * ndims;
+    int bad = 0;
+    int mpierr;
+
+    /* Check the region of this task. */
+    if (fnerr || iodesc->num_aiotasks < 1 || iodesc->num_aiotasks > ios->num_iotasks)
+        bad = 1;
+    for (int d = 0; !bad && d < ndims; d++)
+    {
+        if (start[d] < 0 || count[d] < 0 || start[d] + count[d] > gdimlen[d])
+            bad = 1;
+        mysize *= count[d];
+        gsize *= gdimlen[d];
+    }
+    if (!bad && ios->io_rank >= iodesc->num_aiotasks && mysize)
+        bad = 1;
+
+    /* All IO tasks must agree on the number of IO tasks used. */
+    res[0] = bad;
+    res[1] = iodesc->num_aiotasks;
+    res[2] = -iodesc->num_aiotasks;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, res, 3, MPI_INT, MPI_MAX, ios->io_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (res[0] || res[1] != -res[2])
+        return fnerr ? fnerr : pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Every IO task gets the regions of all of them, and checks that
+     * no two overlap, and that they add up to the whole array. */
+    if (!(box = malloc((ios->num_iotasks * nbox + 1) * sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    memcpy(&box[ios->io_rank * nbox], start, ndims * sizeof(PIO_Offset));
+    memcpy(&box[ios->io_rank * nbox + ndims], count, ndims * sizeof(PIO_Offset));
+    if ((mpierr = MPI_Allgather(MPI_IN_PLACE, nbox, MPI_OFFSET, box, nbox, MPI_OFFSET,
+                                ios->io_comm)))
+    {
+        free(box);
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    mysize = 0;
+    for (int i = 0; !bad && i < ios->num_iotasks; i++)
+    {
+        PIO_Offset *si = &box[i * nbox], *ci = si + ndims;
+        PIO_Offset size = 1;
+
+        for (int d = 0; d < ndims; d++)
+            size *= ci[d];
+        mysize += size;
+        for (int j = 0; size && !bad && j < i; j++)
+        {
+            PIO_Offset *sj = &box[j * nbox], *cj = sj + ndims;
+            int overlap = 1;
+
+            /* Empty regions have a zero count, so never overlap. */
+            for (int d = 0; overlap && d < ndims; d++)
+                if (si[d] >= sj[d] + cj[d] || sj[d] >= si[d] + ci[d])
+                    overlap = 0;
+            bad = overlap;
+        }
+    }
+    free(box);
+    PLOG((2, "check_user_iopart total = %lld gsize = %lld bad = %d", mysize, gsize, bad));
+    if (bad || mysize != gsize)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Compute the start and count of the part of a box decomposition on
+ * this IO task, and the number of IO tasks used, with the IO
+ * partition of the iosystem (see PIOc_set_iopart()). This is only
+ * called on IO tasks.
+ *
+ * The result of a user partition function is checked with
+ * check_user_iopart().
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition info. Gets the start
+ * and count in its first region, the number of IO tasks used, and the
+ * partition used.
+ * @param pio_type the PIO data type used in this decompotion.
+ * @param ndims the number of dimensions in the variable.
+ * @param gdimlen an array of global size of each dimension.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+calc_iopart(iosystem_desc_t *ios, io_desc_t *iodesc, int pio_type, int ndims,
+            const int *gdimlen)
+{
+    PIO_Offset *start = iodesc->firstregion->start;
+    PIO_Offset *count = iodesc->firstregion->count;
+    PIO_Offset stripe_unit;
+    int stripe_factor;
+    int ret;
+
+    iodesc->iopart = ios->iopart;
+    PLOG((2, "calc_iopart iopart = %d", iodesc->iopart));
+
+    switch (ios->iopart)
+    {
+    case PIO_IOPART_SLAB:
+        return CalcStartandCount_slab(pio_type, ndims, gdimlen, ios->num_iotasks, ios->io_rank,
+                                      start, count, &iodesc->num_aiotasks);
+    case PIO_IOPART_STRIPE:
+        /* Without a stripe size, there is nothing to align to. */
+        get_stripe_info(ios, &stripe_unit, &stripe_factor);
+        if (stripe_unit > 0)
+            return CalcStartandCount_stripe(pio_type, ndims, gdimlen, ios->num_iotasks,
+                                            ios->io_rank, stripe_unit, stripe_factor, start,
+                                            count, &iodesc->num_aiotasks);
+        iodesc->iopart = PIO_IOPART_BLOCK;
+        break;
+    case PIO_IOPART_BYTES:
+        return CalcStartandCount_bytes(pio_type, ndims, gdimlen, ios->num_iotasks, ios->io_rank,
+                                       start, count, &iodesc->num_aiotasks);
+    case PIO_IOPART_USER:
+        if ((ret = ios->iopart_fn(pio_type, ndims, gdimlen, ios->num_iotasks, ios->io_rank,
+                                  ios->iopart_arg, start, count, &iodesc->num_aiotasks)))
+            ret = pio_err(ios, NULL, ret, __FILE__, __LINE__);
+        return check_user_iopart(ios, iodesc, ndims, gdimlen, ret);
+    }
+
+    return CalcStartandCount(pio_type, ndims, gdimlen, ios->num_iotasks, ios->io_rank, start,
+                             count, &iodesc->num_aiotasks);
+}
+
+/**
+ * Hash the inputs of PIOc_InitDecomp() with FNV-1a, to find
+ * identical decompositions.
+ *
+ * @param pio_type the basic PIO data type used.
+ * @param ndims the number of dimensions.
+ * @param gdimlen an array length ndims with the sizes of the global
+ * dimensions.
+ * @param maplen the local length of the compmap array.
+ * @param compmap the 1-based compmap.
+ * @param rearr the rearranger.
+ * @return the hash.
+ * @author Ed Hartnett
+ */
+static unsigned long long
+decomp_hash(int pio_type, int ndims, const int *gdimlen, int maplen,
+            const PIO_Offset *compmap, int rearr)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    int head[4] = {pio_type, ndims, maplen, rearr};
+    const unsigned char *b;
+
+    b = (const unsigned char *)head;
+    for (size_t i = 0; i < sizeof(head); i++)
+        h = (h ^ b[i]) * 1099511628211ULL;
+    b = (const unsigned char *)gdimlen;
+    for (size_t i = 0; i < ndims * sizeof(int); i++)
+        h = (h ^ b[i]) * 1099511628211ULL;
+    b = (const unsigned char *)compmap;
+    for (size_t i = 0; i < maplen * sizeof(PIO_Offset); i++)
+        h = (h ^ b[i]) * 1099511628211ULL;
+
+    return h;
+}
+
+/**
+ * Find an existing decomposition which is identical on every task to
+ * the one described by the inputs of PIOc_InitDecomp(). This is
+ * collective over the IO system.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param pio_type the basic PIO data type used.
+ * @param ndims the number of dimensions.
+ * @param gdimlen an array length ndims with the sizes of the global
+ * dimensions.
+ * @param maplen the local length of the compmap array.
+ * @param compmap the 1-based compmap.
+ * @param rearr the rearranger.
+ * @param map_hash the hash of the inputs, from decomp_hash().
+ * @param ioidp pointer that gets the ID of the decomposition, or -1
+ * if there is none.
+ * @return 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+find_shared_decomp(iosystem_desc_t *ios, int pio_type, int ndims, const int *gdimlen,
+                   int maplen, const PIO_Offset *compmap, int rearr,
+                   unsigned long long map_hash, int *ioidp)
+{
+    io_desc_t *iodesc;
+    int cand[2] = {-1, 1};  /* The ioid found here, and minus it. */
+    int mpierr;
+
+    /* Check all the inputs, in case two decompositions have the same
+     * hash. The map of the iodesc may be sorted. */
+    if ((iodesc = pio_find_iodesc_by_hash(ios->iosysid, map_hash)) &&
+        iodesc->piotype == pio_type && iodesc->ndims == ndims && iodesc->maplen == maplen &&
+        iodesc->rearranger == rearr && iodesc->map &&
+        !memcmp(iodesc->dimlen, gdimlen, ndims * sizeof(int)))
+    {
+        int m;
+
+        for (m = 0; m < maplen; m++)
+            if (iodesc->map[m] != compmap[iodesc->remap ? iodesc->remap[m] : m])
+                break;
+        if (m == maplen)
+        {
+            cand[0] = iodesc->ioid;
+            cand[1] = -iodesc->ioid;
+        }
+    }
+
+    /* Every task must have found the same decomposition. */
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, cand, 2, MPI_INT, MPI_MAX, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    *ioidp = cand[0] >= 0 && cand[0] == -cand[1] ? cand[0] : -1;
+    PLOG((2, "find_shared_decomp ioid = %d", *ioidp));
+
+    return PIO_NOERR;
 }
 
 /**
@@ -489,7 +1197,8 @@ compare( const void* a, const void* b)
  * @param ioidp pointer that will get the io description ID. Ignored
  * if NULL.
  * @param rearranger pointer to the rearranger to be used for this
- * decomp or NULL to use the default.
+ * decomp or NULL to use the default. PIO_REARR_NODE is not supported
+ * for async.
  * @param iostart An array of start values for block cyclic
  * decompositions for the SUBSET rearranger. Ignored if block
  * rearranger is used. If NULL and SUBSET rearranger is used, the
@@ -509,6 +1218,7 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
 {
     iosystem_desc_t *ios;  /* Pointer to io system information. */
     io_desc_t *iodesc;     /* The IO description. */
+    unsigned long long map_hash = 0; /* Hash of the inputs, if sharing. */
     int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
     int ierr;              /* Return code. */
 
@@ -587,9 +1297,30 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
 
     }
 
-    /* Allocate space for the iodesc info. This also allocates the
-     * first region and copies the rearranger opts into this
-     * iodesc. */
+    /* If sharing is on, use an identical decomposition if there is
+     * one. */
+    if (ios->decomp_sharing && !ios->async && !iostart && !iocount)
+    {
+        int rearr = rearranger ? *rearranger : ios->default_rearranger;
+        int shared_ioid;
+
+        map_hash = decomp_hash(pio_type, ndims, gdimlen, maplen, compmap, rearr);
+        if ((ierr = find_shared_decomp(ios, pio_type, ndims, gdimlen, maplen, compmap, rearr,
+                                       map_hash, &shared_ioid)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+        if (shared_ioid >= 0)
+        {
+            iodesc = pio_get_iodesc_from_id(shared_ioid);
+            iodesc->refcount++;
+            *ioidp = shared_ioid;
+            PLOG((2, "sharing ioid %d refcount = %d", shared_ioid, iodesc->refcount));
+            return PIO_NOERR;
+        }
+    }
+
+    /* Allocate space for the iodesc info. This also allocates the
+     * first region and copies the rearranger opts into this
+     * iodesc. */
     PLOG((2, "allocating iodesc pio_type %d ndims %d", pio_type, ndims));
     if ((ierr = malloc_iodesc(ios, pio_type, ndims, &iodesc)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
@@ -613,27 +1344,16 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
     }
     if (iodesc->needssort)
     {
-        struct sort_map *tmpsort;
-
-        if (!(tmpsort = malloc(sizeof(struct sort_map) * maplen)))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
         if (!(iodesc->remap = malloc(sizeof(int) * maplen)))
-        {
-            free(tmpsort);
             return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        }
-        for (int m=0; m < maplen; m++)
-        {
-            tmpsort[m].remap = m;
-            tmpsort[m].map = compmap[m];
-        }
-        qsort( tmpsort, maplen, sizeof(struct sort_map), compare );
-        for (int m=0; m < maplen; m++)
-        {
-            iodesc->map[m] = compmap[tmpsort[m].remap];
-            iodesc->remap[m] = tmpsort[m].remap;
-        }
-        free(tmpsort);
+        if ((ierr = sort_compmap(ios, maplen, compmap, iodesc->remap)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+        for (int m = 0; m < maplen; m++)
+            iodesc->map[m] = compmap[iodesc->remap[m]];
+
+        /* Find runs of the map that can be copied whole. */
+        if ((ierr = find_remap_runs(ios, iodesc)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
     }
     else
     {
@@ -659,21 +1379,10 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
     /* Is this the subset rearranger? */
     if (iodesc->rearranger == PIO_REARR_SUBSET)
     {
-      /* check if the decomp is valid for write or is read-only */
-      if(ios->compproc){
-        // It should be okay to use compmap here but test_darray_fill shows
-        // the compmap array modified by this call, TODO - investigate this.
-        PIO_Offset *tmpmap;
-	if (!(tmpmap = malloc(sizeof(PIO_Offset) * maplen)))
-	  return PIO_ENOMEM;
-        memcpy(tmpmap, compmap, maplen*sizeof(PIO_Offset));
-        if((ierr = run_unique_check(ios->comp_comm, (size_t) maplen, tmpmap, &iodesc->readonly)))
+        /* Check if the decomp is valid for write or is read-only. */
+        if ((ierr = check_compmap(ios, iodesc, compmap)))
             return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-	free(tmpmap);
-      }
-        /*      printf("readonly: %d\n",iodesc->readonly);
-        for(int i=0;i<maplen;i++)
-        printf("compmap[%d]=%d\n",i,compmap[i]); */
+
         iodesc->num_aiotasks = ios->num_iotasks;
         PLOG((2, "creating subset rearranger iodesc->num_aiotasks = %d readonly = %d",
               iodesc->num_aiotasks, iodesc->readonly));
@@ -683,6 +1392,11 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
     }
     else /* box rearranger */
     {
+        /* If asked, check if the decomp is read-only. */
+        if (ios->map_dup_check)
+            if ((ierr = check_compmap(ios, iodesc, compmap)))
+                return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
         if (ios->ioproc)
         {
             /*  Unless the user specifies the start and count for each
@@ -699,19 +1413,22 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
             }
             else
             {
-                /* Compute start and count values for each io task. */
-                PLOG((2, "about to call CalcStartandCount pio_type = %d ndims = %d", pio_type, ndims));
-                if ((ierr = CalcStartandCount(pio_type, ndims, gdimlen, ios->num_iotasks,
-                                              ios->io_rank, iodesc->firstregion->start,
-                                              iodesc->firstregion->count, &iodesc->num_aiotasks)))
-                    return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+                /* Compute start and count values for each io task. A
+                 * failure (which all IO tasks agree on) is passed to
+                 * the other tasks as a negative num_aiotasks. */
+                PLOG((2, "about to call calc_iopart pio_type = %d ndims = %d", pio_type, ndims));
+                if ((ierr = calc_iopart(ios, iodesc, pio_type, ndims, gdimlen)))
+                    iodesc->num_aiotasks = ierr;
             }
 
             /* Compute the max io buffer size needed for an iodesc. */
-            if ((ierr = compute_maxIObuffersize(ios->io_comm, iodesc)))
-                return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-            PLOG((3, "compute_maxIObuffersize called iodesc->maxiobuflen = %d",
-                  iodesc->maxiobuflen));
+            if (iodesc->num_aiotasks > 0)
+            {
+                if ((ierr = compute_maxIObuffersize(ios->io_comm, iodesc)))
+                    return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+                PLOG((3, "compute_maxIObuffersize called iodesc->maxiobuflen = %d",
+                      iodesc->maxiobuflen));
+            }
         }
 
         /* Depending on array size and io-blocksize the actual number
@@ -720,13 +1437,50 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
                                 ios->my_comm)))
             return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
         PLOG((3, "iodesc->num_aiotasks = %d", iodesc->num_aiotasks));
+        if (iodesc->num_aiotasks < 0)
+        {
+            /* Nothing has been set up from the partition yet. */
+            ierr = iodesc->num_aiotasks;
+            free(iodesc->map);
+            free(iodesc->remap);
+            free(iodesc->remap_runs);
+            free(iodesc->dimlen);
+            free_region_list(iodesc->firstregion);
+            free(iodesc);
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+        }
 
         /* Compute the communications pattern for this decomposition. */
         if (iodesc->rearranger == PIO_REARR_BOX)
+        {
             if ((ierr = box_rearrange_create(ios, maplen, iodesc->map, gdimlen, ndims, iodesc)))
                 return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+        }
+        else if (iodesc->rearranger == PIO_REARR_NODE)
+        {
+            /* This is a box rearranger between node leaders and IO
+             * tasks, so iodesc->rearranger becomes PIO_REARR_BOX. */
+            if (ios->async)
+                return pio_err(ios, NULL, PIO_EBADREARR, __FILE__, __LINE__);
+            if ((ierr = node_rearrange_create(ios, maplen, iodesc->map, gdimlen, ndims, iodesc)))
+                return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+        }
     }
 
+    /* This function only does something if autotuning is turned on
+     * for this IO system. The options it picks (or finds in the
+     * tuning cache) must be set before the peers are defined. */
+    if ((ierr = performance_tune_rearranger(ios, iodesc)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    /* Find the tasks this task exchanges data with in the
+     * rearranger, unless the tuning already did. (With the
+     * neighborhood rearranger, this also creates a communicator of
+     * just those tasks.) */
+    if (!iodesc->peers)
+        if ((ierr = define_rearr_peers(ios, iodesc)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
     /* Broadcast next ioid to all tasks from io root.*/
     if (ios->async)
     {
@@ -740,6 +1494,9 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
     iodesc->ioid = pio_next_ioid++;
     if (ioidp)
         *ioidp = iodesc->ioid;
+    iodesc->iosysid = iosysid;
+    iodesc->map_hash = map_hash;
+    iodesc->refcount = 1;
 
     /* Add this IO description to the list. */
     if ((ierr = pio_add_to_iodesc_list(iodesc)))
@@ -752,14 +1509,17 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
           iodesc->ioid, iodesc->nrecvs, iodesc->ndof, iodesc->ndims, iodesc->num_aiotasks,
           iodesc->rearranger, iodesc->maxregions, iodesc->needsfill, iodesc->llen,
           iodesc->maxiobuflen));
-    if (iodesc->rindex)
+    if (iodesc->rindex && PLOG_ON(3))
         for (int j = 0; j < iodesc->llen; j++)
-            PLOG((3, "rindex[%d] = %lld", j, iodesc->rindex[j]));
+            PLOG((3, "rindex[%d] = %d", j, iodesc->rindex[j]));
 #endif /* PIO_ENABLE_LOGGING */
 
-    /* This function only does something if pre-processor macro
-     * PERFTUNE is set. */
-    performance_tune_rearranger(ios, iodesc);
+    /* The rearranger no longer needs the map. */
+    if (ios->map_release)
+    {
+        free(iodesc->map);
+        iodesc->map = NULL;
+    }
 
 #ifdef USE_MPE
     pio_stop_mpe_log(DECOMP, __func__);
@@ -785,8 +1545,8 @@ PIOc_InitDecomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int ma
  * transfered.
  * @param ioidp pointer that will get the io description ID.
  * @param rearranger the rearranger to be used for this decomp or 0 to
- * use the default. Valid rearrangers are PIO_REARR_BOX and
- * PIO_REARR_SUBSET.
+ * use the default. Valid rearrangers are PIO_REARR_BOX,
+ * PIO_REARR_SUBSET and PIO_REARR_NODE.
  * @param iostart An array of start values for block cyclic
  * decompositions. If NULL ???
  * @param iocount An array of count values for block cyclic
@@ -832,199 +1592,924 @@ PIOc_init_decomp(int iosysid, int pio_type, int ndims, const int *gdimlen, int m
 }
 
 /**
- * This is a simplified initdecomp which can be used if the memory
- * order of the data can be expressed in terms of start and count on
- * the file. In this case we compute the compdof.
+ * Initialize a decomposition from runs of elements, instead of a
+ * compmap with one entry for each element. Most decompositions of
+ * structured grids are a few runs on each task, so the caller does
+ * not need to build or keep the full compmap.
  *
- * @param iosysid the IO system ID
- * @param pio_type
- * @param ndims the number of dimensions
+ * Run r is the runlen[r] elements starting at the 0-based offset
+ * runstart[r] into the array record on file, each runstride[r]
+ * elements apart. The runs are in the memory order of the local
+ * data. The runs are expanded to a compmap for PIOc_InitDecomp().
+ *
+ * Only the caller saves memory. The runs are expanded while the
+ * decomposition is set up, and the decomposition keeps a map with
+ * one entry for each local element, as with PIOc_InitDecomp(), as do
+ * the rearrangers. So the memory used by PIO, and its peak during
+ * this call, are the same as for the equivalent compmap.
+ *
+ * @param iosysid the IO system ID.
+ * @param pio_type the basic PIO data type used.
+ * @param ndims the number of dimensions in the variable, not
+ * including the unlimited dimension.
  * @param gdimlen an array length ndims with the sizes of the global
  * dimensions.
- * @param start start array
- * @param count count array
- * @param ioidp pointer that gets the IO ID.
- * @returns 0 for success, error code otherwise
+ * @param nruns the number of runs on this task.
+ * @param runstart array of length nruns with the 0-based offset of
+ * the first element of each run.
+ * @param runlen array of length nruns with the number of elements in
+ * each run.
+ * @param runstride array of length nruns with the distance between
+ * the elements of each run. If NULL, all runs are contiguous.
+ * @param ioidp pointer that will get the io description ID.
+ * @param rearranger the rearranger to be used for this decomp or 0 to
+ * use the default.
+ * @param iostart An array of start values for block cyclic
+ * decompositions, or NULL.
+ * @param iocount An array of count values for block cyclic
+ * decompositions, or NULL.
+ * @returns 0 on success, error code otherwise
  * @ingroup PIO_initdecomp_c
- * @author Jim Edwards
+ * @author Ed Hartnett
  */
 int
-PIOc_InitDecomp_bc(int iosysid, int pio_type, int ndims, const int *gdimlen,
-                   const long int *start, const long int *count, int *ioidp)
-
+PIOc_init_decomp_runs(int iosysid, int pio_type, int ndims, const int *gdimlen, int nruns,
+                      const PIO_Offset *runstart, const PIO_Offset *runlen,
+                      const PIO_Offset *runstride, int *ioidp, int rearranger,
+                      const PIO_Offset *iostart, const PIO_Offset *iocount)
 {
     iosystem_desc_t *ios;
-    int n, i, maplen = 1;
-    PIO_Offset prod[ndims], loc[ndims];
-    int rearr = PIO_REARR_SUBSET;
+    PIO_Offset *compmap;
+    PIO_Offset gsize = 1;
+    PIO_Offset maplen = 0;
+    int *rearrangerp = NULL;
+    int m = 0;
+    int ret;
 
-    PLOG((1, "PIOc_InitDecomp_bc iosysid = %d pio_type = %d ndims = %d"));
+    PLOG((1, "PIOc_init_decomp_runs iosysid = %d pio_type = %d ndims = %d nruns = %d",
+          iosysid, pio_type, ndims, nruns));
 
     /* Get the info about the io system. */
     if (!(ios = pio_get_iosystem_from_id(iosysid)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Check for required inputs. */
-    if (!gdimlen || !start || !count || !ioidp)
+    /* Check inputs. */
+    if (!gdimlen || ndims < 1 || nruns < 0 || (nruns && (!runstart || !runlen)) || !ioidp)
         return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    for (int d = 0; d < ndims; d++)
+    {
+        if (gdimlen[d] <= 0)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        gsize *= gdimlen[d];
+    }
 
-    /* Check that dim, start, and count values are not obviously
-     * incorrect. */
-    for (int i = 0; i < ndims; i++)
-        if (gdimlen[i] <= 0 || start[i] < 0 || count[i] < 0 || (start[i] + count[i]) > gdimlen[i])
+    /* Every run must be inside the array. */
+    for (int r = 0; r < nruns; r++)
+    {
+        PIO_Offset stride = runstride ? runstride[r] : 1;
+
+        if (runstart[r] < 0 || runlen[r] < 0 || stride < 1 ||
+            (runlen[r] && runstart[r] + (runlen[r] - 1) * stride >= gsize))
             return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        maplen += runlen[r];
+    }
+    if (maplen > INT_MAX)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    PLOG((2, "maplen = %lld", maplen));
 
-    /* Find the maplen. */
-    for (i = 0; i < ndims; i++)
-        maplen *= count[i];
+    /* If the user specified a non-default rearranger, use it. */
+    if (rearranger)
+        rearrangerp = &rearranger;
 
-    /* Get storage for the compmap. */
-    PIO_Offset compmap[maplen];
+    /* Expand the runs into a 1-based compmap. */
+    if (!(compmap = malloc(sizeof(PIO_Offset) * (maplen ? maplen : 1))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (int r = 0; r < nruns; r++)
+        for (PIO_Offset e = 0; e < runlen[r]; e++)
+            compmap[m++] = runstart[r] + e * (runstride ? runstride[r] : 1) + 1;
 
-    /* Find the compmap. */
-    prod[ndims - 1] = 1;
-    loc[ndims - 1] = 0;
-    for (n = ndims - 2; n >= 0; n--)
+    ret = PIOc_InitDecomp(iosysid, pio_type, ndims, gdimlen, maplen, compmap, ioidp,
+                          rearrangerp, iostart, iocount);
+
+    free(compmap);
+
+    return ret;
+}
+
+/**
+ * Initialize a decomposition for nlev levels of an existing
+ * decomposition, by building its compmap and setting it up with
+ * PIOc_InitDecomp(). This is what PIOc_init_decomp_extrude() does
+ * when async is in use.
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the existing decomposition info.
+ * @param nlev the number of levels.
+ * @param ioidp pointer that will get the io description ID.
+ * @returns 0 on success, error code otherwise
+ * @author Ed Hartnett
+ */
+static int
+extrude_init_decomp(iosystem_desc_t *ios, io_desc_t *iodesc, int nlev, int *ioidp)
+{
+    PIO_Offset *compmap;
+    PIO_Offset gsize = 1;
+    int rearr;
+    int ret;
+
+    /* The map is needed. */
+    if (!iodesc->map)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    int gdimlen[iodesc->ndims + 1];
+    gdimlen[0] = nlev;
+    for (int d = 0; d < iodesc->ndims; d++)
     {
-        prod[n] = prod[n + 1] * gdimlen[n + 1];
-        loc[n] = 0;
+        gdimlen[d + 1] = iodesc->dimlen[d];
+        gsize *= iodesc->dimlen[d];
     }
-    for (i = 0; i < maplen; i++)
+
+    /* Each level is the map (in the original order, if it was
+     * sorted) moved by the size of a level. Holes stay holes. */
+    if (!(compmap = malloc(sizeof(PIO_Offset) * ((PIO_Offset)iodesc->maplen * nlev + 1))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (int m = 0; m < iodesc->maplen; m++)
     {
-        compmap[i] = 1;
-        for (n = ndims - 1; n >= 0; n--)
-            compmap[i] += (start[n] + loc[n]) * prod[n];
+        int e = iodesc->remap ? iodesc->remap[m] : m;
 
-        n = ndims - 1;
-        loc[n] = (loc[n] + 1) % count[n];
-        while (loc[n] == 0 && n > 0)
-        {
-            n--;
-            loc[n] = (loc[n] + 1) % count[n];
-        }
+        for (int k = 0; k < nlev; k++)
+            compmap[(PIO_Offset)k * iodesc->maplen + e] =
+                iodesc->map[m] > 0 ? iodesc->map[m] + k * gsize : 0;
     }
 
-    return PIOc_InitDecomp(iosysid, pio_type, ndims, gdimlen, maplen, compmap, ioidp,
-                           &rearr, NULL, NULL);
+    rearr = iodesc->rearranger;
+    ret = PIOc_InitDecomp(ios->iosysid, iodesc->piotype, iodesc->ndims + 1, gdimlen,
+                          iodesc->maplen * nlev, compmap, ioidp, &rearr, NULL, NULL);
+
+    free(compmap);
+
+    return ret;
 }
 
 /**
- * Library initialization used when IO tasks are a subset of compute
- * tasks.
- *
- * This function creates an MPI intracommunicator between a set of IO
- * tasks and one or more sets of computational tasks.
+ * Copy a list of regions of a decomposition for the levels of an
+ * extruded decomposition. The new regions have a leading level
+ * dimension. With merge, each region covers all the levels, which
+ * is only right for a list of one region: its data for each level in
+ * turn are then the data of the region. Otherwise the regions are
+ * copied for each level, the regions of a level following those of
+ * the level before, and llen elements further on in the buffer.
  *
- * The caller must create all comp_comm and the io_comm MPI
- * communicators before calling this function.
+ * @param ios pointer to the IO system info.
+ * @param first the first region of the list.
+ * @param ndims the number of dimensions of the regions.
+ * @param nlev the number of levels.
+ * @param llen the number of elements of a level in the buffer.
+ * @param merge true to cover all the levels with each region.
+ * @param firstp pointer that gets the new list. It must be freed
+ * with free_region_list(), even after an error.
+ * @returns 0 on success, error code otherwise
+ * @author Ed Hartnett
+ */
+static int
+extrude_regions(iosystem_desc_t *ios, const io_region *first, int ndims, int nlev,
+                PIO_Offset llen, bool merge, io_region **firstp)
+{
+    io_region **next = firstp;
+    int ret;
+
+    *firstp = NULL;
+    for (int k = 0; k < (merge ? 1 : nlev); k++)
+        for (const io_region *region = first; region; region = region->next)
+        {
+            io_region *lregion;
+
+            if ((ret = alloc_region2(ios, ndims + 1, &lregion)))
+                return ret;
+            *next = lregion;
+            next = &lregion->next;
+            lregion->loffset = region->loffset + (int)(k * llen);
+            lregion->start[0] = k;
+            lregion->count[0] = merge ? nlev : 1;
+            for (int d = 0; d < ndims; d++)
+            {
+                lregion->start[d + 1] = region->start[d];
+                lregion->count[d + 1] = region->count[d];
+            }
+        }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Initialize a decomposition for nlev levels of an existing
+ * decomposition. The new decomposition has the unlimited-free
+ * dimensions of the existing one, preceded by a dimension of length
+ * nlev. The local data of each task is its data of the existing
+ * decomposition for each level in turn, so the level varies
+ * slowest. The type and rearranger are those of the existing
+ * decomposition.
  *
- * Internally, this function does the following:
+ * No rearranger is set up for the new decomposition. Each IO task
+ * writes the regions of the existing decomposition for every level,
+ * and the levels are moved by the rearranger of the existing
+ * decomposition, as nlev variables. So this takes no communication
+ * but one MPI_Allreduce(), and little memory. The existing
+ * decomposition is kept until the new one is freed. The new
+ * decomposition has no map, so it can't be written to a decomposition
+ * file, or used with PIOc_read_darray_subset() or
+ * PIOc_init_decomp_gathered().
  *
- * <ul>
- * <li>Initialize logging system (if PIO_ENABLE_LOGGING is set).
- * <li>Allocates and initializes the iosystem_desc_t struct (ios).
- * <li>MPI duplicated user comp_comm to ios->comp_comm and
- * ios->union_comm.
- * <li>Set ios->my_comm to be ios->comp_comm. (Not an MPI
- * duplication.)
- * <li>Find MPI rank in comp_comm, determine ranks of IO tasks,
- * determine whether this task is one of the IO tasks.
- * <li>Identify the root IO tasks.
- * <li>Create MPI groups for IO tasks, and for computation tasks.
- * <li>On IO tasks, create an IO communicator (ios->io_comm).
- * <li>Assign an iosystemid, and put this iosystem_desc_t into the
- * list of open iosystems.
- * </ul>
+ * When async is in use, the compmap of the new decomposition is
+ * built from the map of the existing one instead, and set up with
+ * PIOc_InitDecomp().
  *
- * When complete, there are three MPI communicators (ios->comp_comm,
- * ios->union_comm, and ios->io_comm) that must be freed by MPI.
+ * This function must be called on all tasks of the IO system.
  *
- * @param comp_comm the MPI_Comm of the compute tasks.
- * @param num_iotasks the number of io tasks to use.
- * @param stride the offset between io tasks in the comp_comm. The mod
- * operator is used when computing the IO tasks with the formula:
- * <pre>ios->ioranks[i] = (base + i * ustride) % ios->num_comptasks</pre>.
- * @param base the comp_comm index of the first io task.
- * @param rearr the rearranger to use by default, this may be
- * overriden in the PIO_init_decomp(). The rearranger is not used
- * until the decomposition is initialized.
- * @param iosysidp index of the defined system descriptor.
- * @return 0 on success, otherwise a PIO error code.
- * @ingroup PIO_init_c
- * @author Jim Edwards, Ed Hartnett
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the existing decomposition.
+ * @param nlev the number of levels.
+ * @param ioidp pointer that will get the io description ID.
+ * @returns 0 on success, error code otherwise
+ * @ingroup PIO_initdecomp_c
+ * @author Ed Hartnett
  */
 int
-PIOc_Init_Intracomm(MPI_Comm comp_comm, int num_iotasks, int stride, int base,
-                    int rearr, int *iosysidp)
+PIOc_init_decomp_extrude(int iosysid, int ioid, int nlev, int *ioidp)
 {
     iosystem_desc_t *ios;
-    int ustride;
-    MPI_Group compgroup;  /* Contains tasks involved in computation. */
-    MPI_Group iogroup;    /* Contains the processors involved in I/O. */
-    int num_comptasks; /* The size of the comp_comm. */
-    int mpierr;        /* Return value for MPI calls. */
-    int ret;           /* Return code for function calls. */
-
-    /* Turn on the logging system. */
-    if ((ret = pio_init_logging()))
-        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
-
-#ifdef NETCDF_INTEGRATION
-    PLOG((1, "Initializing netcdf integration"));
-    /* Initialize netCDF integration layer if we need to. */
-    if (!ncint_initialized)
-        PIO_NCINT_initialize();
-#endif /* NETCDF_INTEGRATION */
-
-#ifdef USE_MPE
-    pio_start_mpe_log(INIT);
-#endif /* USE_MPE */
-
-    /* Find the number of computation tasks. */
-    if ((mpierr = MPI_Comm_size(comp_comm, &num_comptasks)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-    PLOG((1, "PIOc_Init_Intracomm comp_comm = %d num_iotasks = %d stride = %d base = %d "
-          "rearr = %d", comp_comm, num_iotasks, stride, base, rearr));
+    io_desc_t *iodesc;
+    io_desc_t *extruded;
+    bool merge;  /* True if the regions cover all the levels. */
+    bool fmerge; /* True if the fill regions cover all the levels. */
+    int ret, ret2;
 
-    /* Check the inputs. */
-    if (!iosysidp || num_iotasks < 1 || num_iotasks * stride > num_comptasks)
-        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    PLOG((1, "PIOc_init_decomp_extrude iosysid = %d ioid = %d nlev = %d", iosysid, ioid,
+          nlev));
 
+    /* Get the IO system and the decomposition. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. A coarse decomposition has no rearranger of its
+     * own. */
+    if (nlev < 1 || !ioidp || iodesc->coarse_factor ||
+        (PIO_Offset)iodesc->maplen * nlev > INT_MAX ||
+        (PIO_Offset)iodesc->maxiobuflen * nlev > INT_MAX ||
+        (PIO_Offset)iodesc->maxholegridsize * nlev > INT_MAX ||
+        (PIO_Offset)iodesc->maxregions * nlev > INT_MAX ||
+        (PIO_Offset)iodesc->maxfillregions * nlev > INT_MAX)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* Allocate memory for the iosystem info. */
-    if (!(ios = calloc(1, sizeof(iosystem_desc_t))))
-        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (ios->async)
+        return extrude_init_decomp(ios, iodesc, nlev, ioidp);
 
-    ios->io_comm = MPI_COMM_NULL;
-    ios->intercomm = MPI_COMM_NULL;
-    ios->error_handler = default_error_handler;
-    ios->default_rearranger = rearr;
-    ios->num_iotasks = num_iotasks;
-    ios->num_comptasks = num_comptasks;
+    if ((ret = malloc_iodesc(ios, iodesc->piotype, iodesc->ndims + 1, &extruded)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (!(extruded->dimlen = malloc((iodesc->ndims + 1) * sizeof(int))))
+    {
+        free_region_list(extruded->firstregion);
+        free(extruded);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    extruded->dimlen[0] = nlev;
+    for (int d = 0; d < iodesc->ndims; d++)
+        extruded->dimlen[d + 1] = iodesc->dimlen[d];
+
+    /* The sizes are those of a level times nlev. A single region
+     * covers all levels. */
+    merge = iodesc->maxregions == 1;
+    fmerge = iodesc->maxfillregions == 1;
+    extruded->extrude_parent = ioid;
+    extruded->extrude_nlev = nlev;
+    extruded->rearranger = iodesc->rearranger;
+    extruded->rearr_opts = iodesc->rearr_opts;
+    extruded->iopart = iodesc->iopart;
+    extruded->num_aiotasks = iodesc->num_aiotasks;
+    extruded->needsfill = iodesc->needsfill;
+    extruded->needssort = iodesc->needssort;
+    extruded->readonly = iodesc->readonly;
+    extruded->maplen = iodesc->maplen * nlev;
+    extruded->ndof = iodesc->ndof * nlev;
+    extruded->llen = iodesc->llen * nlev;
+    extruded->rllen = iodesc->rllen * nlev;
+    extruded->maxiobuflen = iodesc->maxiobuflen * nlev;
+    extruded->holegridsize = iodesc->holegridsize * nlev;
+    extruded->maxholegridsize = iodesc->maxholegridsize * nlev;
+    extruded->maxregions = merge ? 1 : iodesc->maxregions * nlev;
+    extruded->maxfillregions = fmerge ? 1 : iodesc->maxfillregions * nlev;
+
+    /* Copy the regions of the IO tasks for the levels. */
+    if (ios->ioproc)
+    {
+        free_region_list(extruded->firstregion);
+        if (!(ret = extrude_regions(ios, iodesc->firstregion, iodesc->ndims, nlev,
+                                    iodesc->llen, merge, &extruded->firstregion)))
+            ret = extrude_regions(ios, iodesc->fillregion, iodesc->ndims, nlev,
+                                  iodesc->holegridsize, fmerge, &extruded->fillregion);
+    }
 
-    /* For non-async, the IO tasks are a subset of the comptasks. */
-    ios->num_uniontasks = num_comptasks;
+    /* Find the most bytes to buffer before a flush. All tasks take
+     * part, even after an error. */
+    if ((ret2 = compute_maxaggregate_bytes(ios, extruded)) && !ret)
+        ret = ret2;
 
-    /* Initialize the rearranger options. */
-    ios->rearr_opts.comm_type = PIO_REARR_COMM_COLL;
-    ios->rearr_opts.fcd = PIO_REARR_COMM_FC_2D_DISABLE;
+    /* Set the decomposition ID. */
+    if (!ret)
+    {
+        extruded->ioid = pio_next_ioid++;
+        extruded->iosysid = iosysid;
+        extruded->refcount = 1;
+        ret = pio_add_to_iodesc_list(extruded);
+    }
+    if (ret)
+    {
+        free_region_list(extruded->firstregion);
+        free_region_list(extruded->fillregion);
+        free(extruded->dimlen);
+        free(extruded);
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+    *ioidp = extruded->ioid;
 
-    /* Copy the computation communicator into union_comm. */
-    if ((mpierr = MPI_Comm_dup(comp_comm, &ios->union_comm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    /* The existing decomposition moves the data, so it is kept. */
+    iodesc->refcount++;
+    PLOG((2, "PIOc_init_decomp_extrude ioid = %d llen = %lld maxregions = %d", *ioidp,
+          extruded->llen, extruded->maxregions));
 
-    /* Copy the computation communicator into comp_comm. */
-    if ((mpierr = MPI_Comm_dup(comp_comm, &ios->comp_comm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    PLOG((2, "union_comm = %d comp_comm = %d", ios->union_comm, ios->comp_comm));
+    return PIO_NOERR;
+}
 
-    ios->my_comm = ios->comp_comm;
-    ustride = stride;
+/* Compare two offsets, for qsort(). */
+static int
+compare_gathered(const void *a, const void *b)
+{
+    PIO_Offset x = *(const PIO_Offset *)a;
+    PIO_Offset y = *(const PIO_Offset *)b;
 
-    /* Find MPI rank in comp_comm communicator. */
-    if ((mpierr = MPI_Comm_rank(ios->comp_comm, &ios->comp_rank)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    return (x > y) - (x < y);
+}
+
+/**
+ * Initialize a gathered decomposition of an existing decomposition,
+ * for the CF "compression by gathering" of masked data (for example
+ * the land points of a grid). The gathered decomposition has one
+ * dimension, of length npoints, the number of elements of the
+ * existing decomposition that are not holes on any task. Its elements
+ * are those of the existing decomposition in the order of their
+ * offsets in the full grid, so the holes are not stored.
+ *
+ * The existing decomposition then writes and reads vars that have
+ * the gathered dimension in place of its dimensions: when the var
+ * passed to PIOc_write_darray(), PIOc_write_darray_nocopy(),
+ * PIOc_iwrite_darray(), PIOc_write_darray_multi(), PIOc_read_darray(),
+ * PIOc_iread_darray() or PIOc_read_darray_multi() (the first of the
+ * vars, for the multi functions) has one dimension (besides the
+ * unlimited one), and the decomposition has more, the gathered
+ * decomposition is used instead. So the arrays of the computation
+ * tasks don't change. On reads, the holes of the arrays are left as
+ * they are. PIOc_read_darray_subset() returns PIO_EINVAL for these
+ * vars.
+ *
+ * A decomposition has at most one gathered decomposition. To make
+ * another, free the first with PIOc_freedecomp(); until then
+ * PIO_EINVAL is returned.
+ *
+ * The file needs a dimension of length npoints, and a list variable
+ * of type PIO_INT on it, written with PIOc_write_gathered_list(),
+ * which gets the zero-based offsets of the points in the full grid,
+ * and a "compress" attribute with the names of the dimensions of the
+ * full grid (for example "lat lon").
+ *
+ * The offsets of the points of all computation tasks are gathered
+ * on each of them to number the points, so this needs the memory
+ * of npoints offsets on each task, once. The map of the existing
+ * decomposition is needed (see PIOc_set_map_release()). This
+ * function must be called on all computation tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the existing decomposition.
+ * @param npointsp pointer that gets the number of points. Ignored if
+ * NULL.
+ * @param ioidp pointer that will get the io description ID.
+ * @returns 0 on success, error code otherwise
+ * @ingroup PIO_initdecomp_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_init_decomp_gathered(int iosysid, int ioid, PIO_Offset *npointsp, int *ioidp)
+{
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc, *gathered;
+    PIO_Offset *points, *all = NULL, *compmap = NULL;
+    PIO_Offset total = 0, npoints = 0;
+    int nlocal = 0;
+    int rearr;
+    int mpierr;
+    int ret = PIO_NOERR;
+
+    PLOG((1, "PIOc_init_decomp_gathered iosysid = %d ioid = %d", iosysid, ioid));
+
+    /* Get the IO system and the decomposition. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. The map is needed. */
+    if (!ioidp || !iodesc->map || iodesc->coarse_factor || iodesc->gather_parent ||
+        iodesc->gathered_ioid)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* The map is sorted, so the points of this task are the end of
+     * it, in order. */
+    while (nlocal < iodesc->maplen && iodesc->map[iodesc->maplen - 1 - nlocal] > 0)
+        nlocal++;
+    points = iodesc->map + iodesc->maplen - nlocal;
+
+    /* Gather the points of all tasks, sort them, and drop the
+     * repeated ones. */
+    int count[ios->num_comptasks];
+    int displ[ios->num_comptasks];
+
+    if ((mpierr = MPI_Allgather(&nlocal, 1, MPI_INT, count, 1, MPI_INT, ios->comp_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    for (int t = 0; t < ios->num_comptasks; t++)
+    {
+        displ[t] = total;
+        total += count[t];
+    }
+    if (total > INT_MAX)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (!(all = malloc(sizeof(PIO_Offset) * (total + 1))) ||
+        !(compmap = malloc(sizeof(PIO_Offset) * (iodesc->maplen + 1))))
+    {
+        free(all);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    if ((mpierr = MPI_Allgatherv(points, nlocal, MPI_OFFSET, all, count, displ, MPI_OFFSET,
+                                 ios->comp_comm)))
+    {
+        free(all);
+        free(compmap);
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    qsort(all, total, sizeof(PIO_Offset), compare_gathered);
+    for (PIO_Offset p = 0; p < total; p++)
+        if (!npoints || all[p] != all[npoints - 1])
+            all[npoints++] = all[p];
+    PLOG((2, "nlocal = %d total = %lld npoints = %lld", nlocal, total, npoints));
+
+    /* Number the points of this task by their place in the sorted
+     * list (both are sorted), in the original order of the map. */
+    PIO_Offset p = 0;
+    for (int m = 0; m < iodesc->maplen; m++)
+    {
+        int e = iodesc->remap ? iodesc->remap[m] : m;
+
+        compmap[e] = 0;
+        if (iodesc->map[m] > 0)
+        {
+            while (all[p] < iodesc->map[m])
+                p++;
+            compmap[e] = p + 1;
+        }
+    }
+    free(all);
+
+    int gdimlen = npoints;
+    rearr = iodesc->rearranger;
+    if (!(ret = PIOc_InitDecomp(iosysid, iodesc->piotype, 1, &gdimlen, iodesc->maplen,
+                                compmap, ioidp, &rearr, NULL, NULL)))
+    {
+        /* Link the decompositions, for the darray functions. */
+        if (!(gathered = pio_get_iodesc_from_id(*ioidp)))
+            ret = pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+        else
+        {
+            gathered->gather_parent = ioid;
+            iodesc->gathered_ioid = *ioidp;
+            if (npointsp)
+                *npointsp = npoints;
+        }
+    }
+
+    free(compmap);
+
+    return ret;
+}
+
+/**
+ * Free a coarse decomposition that is not in the list of
+ * decompositions, after PIOc_init_decomp_coarse() fails.
+ *
+ * @param coarse pointer to the coarse decomposition info.
+ * @author Ed Hartnett
+ */
+static void
+free_coarse(io_desc_t *coarse)
+{
+    free_region_list(coarse->firstregion);
+    free(coarse->dimlen);
+    free(coarse->coarse_factor);
+    free(coarse);
+}
+
+/**
+ * Initialize a coarse decomposition of an existing decomposition, for
+ * PIOc_write_darray_coarse().
+ *
+ * The coarse decomposition has the dimensions of the existing one,
+ * each divided by its factor (rounding up). With PIO_COARSE_SUBSAMPLE
+ * an element of the coarse array is the element of the existing
+ * array at its indices times the factors. With PIO_COARSE_MEAN it is
+ * the mean of the block of elements starting there (fill values
+ * are skipped), which is only supported for PIO_INT, PIO_FLOAT and
+ * PIO_DOUBLE. Means of PIO_INT are rounded to the nearest integer,
+ * halves away from zero.
+ *
+ * Only the IO tasks have data of a coarse decomposition: each IO
+ * task has the coarse elements of its regions of the existing
+ * decomposition, and computes them from the data it gets from the
+ * rearranger. So the coarse array is never moved from the
+ * computation tasks. For PIO_COARSE_MEAN, the blocks must not be
+ * split between regions, so the start of each region of each IO task
+ * must be a multiple of the factor of each dimension, and its end
+ * too, unless it is the end of the dimension. Otherwise PIO_EINVAL
+ * is returned. The coarse decomposition can only be used with
+ * PIOc_write_darray_coarse(), and PIOc_freedecomp(). It is not
+ * supported with async.
+ *
+ * This function must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the existing decomposition.
+ * @param op the PIO_COARSE method.
+ * @param factor an array of length ndims of the existing
+ * decomposition with the factor of each dimension, 1 or more.
+ * @param ioidp pointer that will get the io description ID.
+ * @returns 0 on success, error code otherwise
+ * @ingroup PIO_initdecomp_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_init_decomp_coarse(int iosysid, int ioid, int op, const int *factor, int *ioidp)
+{
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc;
+    io_desc_t *coarse;
+    io_region **next;
+    int mpierr;
+    int ierr = PIO_NOERR;
+    int ret;
+
+    PLOG((1, "PIOc_init_decomp_coarse iosysid = %d ioid = %d op = %d", iosysid, ioid, op));
+
+    /* Get the IO system and the decomposition. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (!factor || !ioidp || ios->async || iodesc->coarse_factor ||
+        (op != PIO_COARSE_SUBSAMPLE && op != PIO_COARSE_MEAN))
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (op == PIO_COARSE_MEAN && iodesc->piotype != PIO_INT &&
+        iodesc->piotype != PIO_FLOAT && iodesc->piotype != PIO_DOUBLE)
+        return pio_err(ios, NULL, PIO_EBADTYPE, __FILE__, __LINE__);
+    for (int d = 0; d < iodesc->ndims; d++)
+        if (factor[d] < 1)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    if ((ret = malloc_iodesc(ios, iodesc->piotype, iodesc->ndims, &coarse)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (!(coarse->dimlen = malloc(iodesc->ndims * sizeof(int))) ||
+        !(coarse->coarse_factor = malloc(iodesc->ndims * sizeof(int))))
+    {
+        free_coarse(coarse);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    for (int d = 0; d < iodesc->ndims; d++)
+    {
+        coarse->dimlen[d] = (iodesc->dimlen[d] + factor[d] - 1) / factor[d];
+        coarse->coarse_factor[d] = factor[d];
+    }
+    coarse->coarse_parent = ioid;
+    coarse->coarse_op = op;
+    coarse->rearranger = PIO_REARR_BOX;
+    coarse->num_aiotasks = iodesc->num_aiotasks;
+    coarse->maxregions = iodesc->maxregions;
+    coarse->maxbytes = iodesc->maxbytes;
+
+    /* Each region of an IO task has the coarse elements whose first
+     * element is in the region. */
+    if (ios->ioproc)
+    {
+        next = &coarse->firstregion;
+        free_region_list(coarse->firstregion);
+        coarse->firstregion = NULL;
+        for (io_region *region = iodesc->firstregion; region && !ierr; region = region->next)
+        {
+            io_region *cregion;
+            PIO_Offset size = 1;
+
+            if ((ierr = alloc_region2(ios, iodesc->ndims, &cregion)))
+                break;
+            *next = cregion;
+            next = &cregion->next;
+            for (int d = 0; d < iodesc->ndims; d++)
+            {
+                PIO_Offset end = region->start[d] + region->count[d];
+
+                cregion->start[d] = (region->start[d] + factor[d] - 1) / factor[d];
+                cregion->count[d] = (end + factor[d] - 1) / factor[d] - cregion->start[d];
+                if (region->count[d] > 0 && op == PIO_COARSE_MEAN &&
+                    (region->start[d] % factor[d] ||
+                     (end % factor[d] && end != iodesc->dimlen[d])))
+                    ierr = PIO_EINVAL;
+                size *= cregion->count[d];
+            }
+            cregion->loffset = coarse->llen;
+            coarse->llen += size;
+        }
+        if (!ierr && !coarse->firstregion)
+            ierr = alloc_region2(ios, iodesc->ndims, &coarse->firstregion);
+
+        /* All IO tasks must agree. The error codes are negative. */
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &ierr, 1, MPI_INT, MPI_MIN, ios->io_comm)))
+        {
+            free_coarse(coarse);
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
+        if (!ierr)
+            ierr = compute_maxIObuffersize(ios->io_comm, coarse);
+    }
+
+    /* Share the result with the other tasks. */
+    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+    {
+        free_coarse(coarse);
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    if (ierr)
+    {
+        free_coarse(coarse);
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    }
+
+    /* Set the decomposition ID. */
+    coarse->ioid = pio_next_ioid++;
+    *ioidp = coarse->ioid;
+    coarse->iosysid = iosysid;
+    coarse->refcount = 1;
+    if ((ret = pio_add_to_iodesc_list(coarse)))
+    {
+        free_coarse(coarse);
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+    PLOG((2, "PIOc_init_decomp_coarse ioid = %d llen = %lld", *ioidp, coarse->llen));
+
+    return PIO_NOERR;
+}
+
+/**
+ * This is a simplified initdecomp which can be used if the memory
+ * order of the data can be expressed in terms of start and count on
+ * the file. In this case we compute the compdof.
+ *
+ * @param iosysid the IO system ID
+ * @param pio_type
+ * @param ndims the number of dimensions
+ * @param gdimlen an array length ndims with the sizes of the global
+ * dimensions.
+ * @param start start array
+ * @param count count array
+ * @param ioidp pointer that gets the IO ID.
+ * @returns 0 for success, error code otherwise
+ * @ingroup PIO_initdecomp_c
+ * @author Jim Edwards
+ */
+int
+PIOc_InitDecomp_bc(int iosysid, int pio_type, int ndims, const int *gdimlen,
+                   const long int *start, const long int *count, int *ioidp)
+
+{
+    iosystem_desc_t *ios;
+    int n, i;
+    PIO_Offset maplen = 1;
+    PIO_Offset nrows;
+    PIO_Offset *compmap;
+    PIO_Offset prod[ndims], loc[ndims];
+    int rearr = PIO_REARR_SUBSET;
+    int ret;
+
+    PLOG((1, "PIOc_InitDecomp_bc iosysid = %d pio_type = %d ndims = %d", iosysid, pio_type,
+          ndims));
+
+    /* Get the info about the io system. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check for required inputs. */
+    if (!gdimlen || !start || !count || !ioidp || ndims < 1)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Check that dim, start, and count values are not obviously
+     * incorrect. */
+    for (int i = 0; i < ndims; i++)
+        if (gdimlen[i] <= 0 || start[i] < 0 || count[i] < 0 || (start[i] + count[i]) > gdimlen[i])
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Find the maplen. */
+    for (i = 0; i < ndims; i++)
+        maplen *= count[i];
+    if (maplen > INT_MAX)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Get storage for the compmap. It can be much too big for the
+     * stack. */
+    if (!(compmap = malloc(sizeof(PIO_Offset) * (maplen ? maplen : 1))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Find the compmap. The elements along the last dimension are
+     * contiguous in the file, so the offset only has to be found
+     * once for each row of the block. */
+    prod[ndims - 1] = 1;
+    loc[ndims - 1] = 0;
+    for (n = ndims - 2; n >= 0; n--)
+    {
+        prod[n] = prod[n + 1] * gdimlen[n + 1];
+        loc[n] = 0;
+    }
+    nrows = count[ndims - 1] ? maplen / count[ndims - 1] : 0;
+    for (PIO_Offset r = 0; r < nrows; r++)
+    {
+        PIO_Offset row = 1 + start[ndims - 1];
+
+        for (n = ndims - 2; n >= 0; n--)
+            row += (start[n] + loc[n]) * prod[n];
+        for (i = 0; i < count[ndims - 1]; i++)
+            compmap[r * count[ndims - 1] + i] = row + i;
+
+        /* Move to the next row. */
+        for (n = ndims - 2; n >= 0; n--)
+        {
+            loc[n] = (loc[n] + 1) % count[n];
+            if (loc[n])
+                break;
+        }
+    }
+
+    ret = PIOc_InitDecomp(iosysid, pio_type, ndims, gdimlen, maplen, compmap, ioidp,
+                          &rearr, NULL, NULL);
+
+    free(compmap);
+
+    return ret;
+}
+
+/**
+ * Initialize an iosystem in which the IO tasks are a subset of the
+ * compute tasks, given the ranks of the IO tasks. This does the work
+ * of PIOc_Init_Intracomm() and PIOc_Init_Intracomm_topo().
+ *
+ * This function creates an MPI intracommunicator between a set of IO
+ * tasks and one or more sets of computational tasks.
+ *
+ * The caller must create all comp_comm and the io_comm MPI
+ * communicators before calling this function.
+ *
+ * Internally, this function does the following:
+ *
+ * <ul>
+ * <li>Initialize logging system (if PIO_ENABLE_LOGGING is set).
+ * <li>Allocates and initializes the iosystem_desc_t struct (ios).
+ * <li>MPI duplicated user comp_comm to ios->comp_comm and
+ * ios->union_comm.
+ * <li>Set ios->my_comm to be ios->comp_comm. (Not an MPI
+ * duplication.)
+ * <li>Find MPI rank in comp_comm, determine ranks of IO tasks,
+ * determine whether this task is one of the IO tasks.
+ * <li>Identify the root IO tasks.
+ * <li>On IO tasks, create an IO communicator (ios->io_comm). Only
+ * the IO tasks take part in this.
+ * <li>Assign an iosystemid, and put this iosystem_desc_t into the
+ * list of open iosystems.
+ * </ul>
+ *
+ * When complete, there are three MPI communicators (ios->comp_comm,
+ * ios->union_comm, and ios->io_comm) that must be freed by MPI. With
+ * PIOc_set_comm_sharing() on, the communicators of an open IO system
+ * with the same tasks and IO tasks are used instead, and they are
+ * freed with the last IO system that uses them.
+ *
+ * @param comp_comm the MPI_Comm of the compute tasks.
+ * @param num_iotasks the number of io tasks to use.
+ * @param ioranks array of length num_iotasks with the comp_comm
+ * ranks of the IO tasks.
+ * @param rearr the rearranger to use by default.
+ * @param iosysidp index of the defined system descriptor.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+init_intracomm(MPI_Comm comp_comm, int num_iotasks, const int *ioranks, int rearr,
+               int *iosysidp)
+{
+    iosystem_desc_t *ios;
+    iosystem_desc_t *sios = NULL; /* An IO system to share comms with. */
+    MPI_Group compgroup;  /* Contains tasks involved in computation. */
+    MPI_Group iogroup;    /* Contains the processors involved in I/O. */
+    int num_comptasks; /* The size of the comp_comm. */
+    int mpierr;        /* Return value for MPI calls. */
+    int ret;           /* Return code for function calls. */
+
+    /* Turn on the logging system. */
+    if ((ret = pio_init_logging()))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+
+#ifdef NETCDF_INTEGRATION
+    PLOG((1, "Initializing netcdf integration"));
+    /* Initialize netCDF integration layer if we need to. */
+    if (!ncint_initialized)
+        PIO_NCINT_initialize();
+#endif /* NETCDF_INTEGRATION */
+
+#ifdef USE_MPE
+    pio_start_mpe_log(INIT);
+#endif /* USE_MPE */
+
+    /* Find the number of computation tasks. */
+    if ((mpierr = MPI_Comm_size(comp_comm, &num_comptasks)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    PLOG((1, "init_intracomm comp_comm = %d num_iotasks = %d rearr = %d", comp_comm,
+          num_iotasks, rearr));
+
+    /* Check the inputs. */
+    if (!iosysidp || !ioranks || num_iotasks < 1 || num_iotasks > num_comptasks)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Allocate memory for the iosystem info. */
+    if (!(ios = calloc(1, sizeof(iosystem_desc_t))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    ios->io_comm = MPI_COMM_NULL;
+    ios->intercomm = MPI_COMM_NULL;
+    ios->error_handler = default_error_handler;
+    ios->default_rearranger = rearr;
+#ifdef TIMING
+    ios->timing = true;
+#endif /* TIMING */
+    ios->num_iotasks = num_iotasks;
+    ios->num_comptasks = num_comptasks;
+
+    /* For non-async, the IO tasks are a subset of the comptasks. */
+    ios->num_uniontasks = num_comptasks;
+
+    /* Initialize the rearranger options. */
+    ios->rearr_opts.comm_type = PIO_REARR_COMM_COLL;
+    ios->rearr_opts.fcd = PIO_REARR_COMM_FC_2D_DISABLE;
+
+    /* Use the communicators of an IO system with the same tasks, if
+     * allowed. All tasks find the same one, or none. */
+    if (pio_comm_sharing)
+        sios = pio_find_comm_iosystem(comp_comm, num_iotasks, ioranks);
+    if (sios)
+    {
+        if (!sios->comm_refs)
+        {
+            if (!(sios->comm_refs = malloc(sizeof(int))))
+                return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+            *sios->comm_refs = 1;
+        }
+        ios->comm_refs = sios->comm_refs;
+        (*ios->comm_refs)++;
+        ios->union_comm = sios->union_comm;
+        ios->comp_comm = sios->comp_comm;
+        ios->io_comm = sios->io_comm;
+        PLOG((2, "sharing the comms of iosysid %d", sios->iosysid));
+    }
+    else
+    {
+        /* Copy the computation communicator into union_comm. */
+        if ((mpierr = MPI_Comm_dup(comp_comm, &ios->union_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+        /* Copy the computation communicator into comp_comm. */
+        if ((mpierr = MPI_Comm_dup(comp_comm, &ios->comp_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    PLOG((2, "union_comm = %d comp_comm = %d", ios->union_comm, ios->comp_comm));
+
+    ios->my_comm = ios->comp_comm;
+
+    /* Find MPI rank in comp_comm communicator. */
+    if ((mpierr = MPI_Comm_rank(ios->comp_comm, &ios->comp_rank)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
 
     /* With non-async, all tasks are part of computation component. */
     ios->compproc = true;
@@ -1047,64 +2532,228 @@ PIOc_Init_Intracomm(MPI_Comm comp_comm, int num_iotasks, int stride, int base,
         return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
     for (int i = 0; i < ios->num_iotasks; i++)
     {
-        ios->ioranks[i] = (base + i * ustride) % ios->num_comptasks;
+        ios->ioranks[i] = ioranks[i];
         if (ios->ioranks[i] == ios->comp_rank)
             ios->ioproc = true;
         PLOG((3, "ios->ioranks[%d] = %d", i, ios->ioranks[i]));
     }
     ios->ioroot = ios->ioranks[0];
 
-    /* We are not providing an info object. */
-    ios->info = MPI_INFO_NULL;
+    /* We are not providing an info object. */
+    ios->info = MPI_INFO_NULL;
+
+    /* Identify the task that will be the root of the IO communicator. */
+    if (ios->comp_rank == ios->ioranks[0])
+        ios->iomaster = MPI_ROOT;
+
+    /* Create an MPI communicator for the IO tasks. Only they take
+     * part, so the other tasks don't wait for it. */
+    if (!sios && ios->ioproc)
+    {
+        /* Create a group for the computation tasks. */
+        if ((mpierr = MPI_Comm_group(ios->comp_comm, &compgroup)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+        /* Create a group for the IO tasks. */
+        if ((mpierr = MPI_Group_incl(compgroup, ios->num_iotasks, ios->ioranks,
+                                     &iogroup)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+        if ((mpierr = MPI_Comm_create_group(ios->comp_comm, iogroup, 0, &ios->io_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+        /* Free the MPI groups. */
+        MPI_Group_free(&compgroup);
+        MPI_Group_free(&iogroup);
+    }
+
+    /* For the tasks that are doing IO, get their rank within the IO
+     * communicator. If they are not doing IO, set their io_rank to
+     * -1. */
+    if (ios->ioproc)
+    {
+        if ((mpierr = MPI_Comm_rank(ios->io_comm, &ios->io_rank)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    else
+        ios->io_rank = -1;
+    PLOG((3, "ios->io_comm = %d ios->io_rank = %d", ios->io_comm, ios->io_rank));
+
+    /* Rank in the union comm is the same as rank in the comp comm. */
+    ios->union_rank = ios->comp_rank;
+
+    /* Add this ios struct to the list in the PIO library. */
+    *iosysidp = pio_add_to_iosystem_list(ios);
+
+#ifdef USE_MPE
+    pio_stop_mpe_log(INIT, __func__);
+#endif /* USE_MPE */
+    PLOG((2, "Init_Intracomm complete iosysid = %d", *iosysidp));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Library initialization used when IO tasks are a subset of compute
+ * tasks.
+ *
+ * This function creates an MPI intracommunicator between a set of IO
+ * tasks and one or more sets of computational tasks.
+ *
+ * The caller must create all comp_comm and the io_comm MPI
+ * communicators before calling this function.
+ *
+ * Internally, this function does the following:
+ *
+ * <ul>
+ * <li>Initialize logging system (if PIO_ENABLE_LOGGING is set).
+ * <li>Allocates and initializes the iosystem_desc_t struct (ios).
+ * <li>MPI duplicated user comp_comm to ios->comp_comm and
+ * ios->union_comm.
+ * <li>Set ios->my_comm to be ios->comp_comm. (Not an MPI
+ * duplication.)
+ * <li>Find MPI rank in comp_comm, determine ranks of IO tasks,
+ * determine whether this task is one of the IO tasks.
+ * <li>Identify the root IO tasks.
+ * <li>Create MPI groups for IO tasks, and for computation tasks.
+ * <li>On IO tasks, create an IO communicator (ios->io_comm).
+ * <li>Assign an iosystemid, and put this iosystem_desc_t into the
+ * list of open iosystems.
+ * </ul>
+ *
+ * When complete, there are three MPI communicators (ios->comp_comm,
+ * ios->union_comm, and ios->io_comm) that must be freed by MPI.
+ *
+ * @param comp_comm the MPI_Comm of the compute tasks.
+ * @param num_iotasks the number of io tasks to use.
+ * @param stride the offset between io tasks in the comp_comm. The mod
+ * operator is used when computing the IO tasks with the formula:
+ * <pre>ios->ioranks[i] = (base + i * ustride) % ios->num_comptasks</pre>.
+ * @param base the comp_comm index of the first io task.
+ * @param rearr the rearranger to use by default, this may be
+ * overriden in the PIO_init_decomp(). The rearranger is not used
+ * until the decomposition is initialized.
+ * @param iosysidp index of the defined system descriptor.
+ * @return 0 on success, otherwise a PIO error code.
+ * @ingroup PIO_init_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_Init_Intracomm(MPI_Comm comp_comm, int num_iotasks, int stride, int base,
+                    int rearr, int *iosysidp)
+{
+    int *ioranks;
+    int num_comptasks; /* The size of the comp_comm. */
+    int mpierr;        /* Return value for MPI calls. */
+    int ret;           /* Return code for function calls. */
+
+    /* Find the number of computation tasks. */
+    if ((mpierr = MPI_Comm_size(comp_comm, &num_comptasks)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
-    /* Identify the task that will be the root of the IO communicator. */
-    if (ios->comp_rank == ios->ioranks[0])
-        ios->iomaster = MPI_ROOT;
+    PLOG((1, "PIOc_Init_Intracomm comp_comm = %d num_iotasks = %d stride = %d base = %d "
+          "rearr = %d", comp_comm, num_iotasks, stride, base, rearr));
 
-    /* Create a group for the computation tasks. */
-    if ((mpierr = MPI_Comm_group(ios->comp_comm, &compgroup)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    /* Check the inputs. */
+    if (!iosysidp || num_iotasks < 1 || num_iotasks * stride > num_comptasks)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* Create a group for the IO tasks. */
-    if ((mpierr = MPI_Group_incl(compgroup, ios->num_iotasks, ios->ioranks,
-                                 &iogroup)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    /* The IO tasks are spaced stride apart, starting at base. */
+    if (!(ioranks = malloc(num_iotasks * sizeof(int))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (int i = 0; i < num_iotasks; i++)
+        ioranks[i] = (base + i * stride) % num_comptasks;
 
-    /* Create an MPI communicator for the IO tasks. */
-    if ((mpierr = MPI_Comm_create(ios->comp_comm, iogroup, &ios->io_comm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    ret = init_intracomm(comp_comm, num_iotasks, ioranks, rearr, iosysidp);
+    free(ioranks);
 
-    /* Free the MPI groups. */
-    if (compgroup != MPI_GROUP_NULL)
-        MPI_Group_free(&compgroup);
+    return ret;
+}
 
-    if (iogroup != MPI_GROUP_NULL)
-        MPI_Group_free(&iogroup);
+/**
+ * Turn on or off the sharing of communicators between IO systems.
+ * When on, PIOc_Init_Intracomm() and PIOc_Init_Intracomm_topo() use
+ * the communicators of an open IO system whose computation
+ * communicator has the same tasks in the same order, and which has
+ * the same IO tasks, instead of creating new ones. This saves the
+ * collective MPI calls that create them, when a model makes several
+ * IO systems on the same tasks. The communicators are freed with the
+ * last of the IO systems that use them.
+ *
+ * Since their messages then travel on the same communicators, the IO
+ * systems that share must not be used at the same time from
+ * different threads. Async IO systems are never shared.
+ *
+ * This function must be called on all tasks, with the same value,
+ * before the IO systems are initialized.
+ *
+ * @param enable true to share the communicators, false to give each
+ * IO system its own (the default).
+ * @return The previous setting.
+ * @ingroup PIO_init_c
+ * @author Ed Hartnett
+ */
+bool
+PIOc_set_comm_sharing(bool enable)
+{
+    bool old = pio_comm_sharing;
 
-    /* For the tasks that are doing IO, get their rank within the IO
-     * communicator. If they are not doing IO, set their io_rank to
-     * -1. */
-    if (ios->ioproc)
-    {
-        if ((mpierr = MPI_Comm_rank(ios->io_comm, &ios->io_rank)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    }
-    else
-        ios->io_rank = -1;
-    PLOG((3, "ios->io_comm = %d ios->io_rank = %d", ios->io_comm, ios->io_rank));
+    pio_comm_sharing = enable;
 
-    /* Rank in the union comm is the same as rank in the comp comm. */
-    ios->union_rank = ios->comp_rank;
+    return old;
+}
 
-    /* Add this ios struct to the list in the PIO library. */
-    *iosysidp = pio_add_to_iosystem_list(ios);
+/**
+ * Library initialization used when IO tasks are a subset of compute
+ * tasks, with the IO tasks placed using the node layout of comp_comm.
+ *
+ * The tasks which share memory (as found by MPI_Comm_split_type()
+ * with MPI_COMM_TYPE_SHARED) are on the same node. The IO tasks are
+ * dealt out to the nodes round robin, so every node gets an IO task
+ * before any node gets a second, and no node gets more than
+ * iotasks_per_node. On a node, the IO tasks are spread evenly over
+ * the ranks, so with block rank placement they fall on different
+ * sockets. This needs no hardware specific calls, and replaces having
+ * to work out a stride and base by hand.
+ *
+ * Use PIOc_get_iotask_layout() to find the IO tasks that were chosen.
+ *
+ * @param comp_comm the MPI_Comm of the compute tasks.
+ * @param num_iotasks the number of io tasks to use. If 0,
+ * iotasks_per_node IO tasks are used on every node (or all the tasks
+ * of a node, if it has fewer).
+ * @param iotasks_per_node the most IO tasks on any node. If 0, there
+ * is no limit, and num_iotasks must be greater than 0.
+ * @param rearr the rearranger to use by default, this may be
+ * overriden in the PIO_init_decomp().
+ * @param iosysidp index of the defined system descriptor.
+ * @return 0 on success, otherwise a PIO error code.
+ * @ingroup PIO_init_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_Init_Intracomm_topo(MPI_Comm comp_comm, int num_iotasks, int iotasks_per_node,
+                         int rearr, int *iosysidp)
+{
+    int *ioranks;
+    int ret;
 
-#ifdef USE_MPE
-    pio_stop_mpe_log(INIT, __func__);
-#endif /* USE_MPE */
-    PLOG((2, "Init_Intracomm complete iosysid = %d", *iosysidp));
+    PLOG((1, "PIOc_Init_Intracomm_topo comp_comm = %d num_iotasks = %d "
+          "iotasks_per_node = %d rearr = %d", comp_comm, num_iotasks, iotasks_per_node,
+          rearr));
 
-    return PIO_NOERR;
+    if (!iosysidp)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Choose the IO tasks from the node layout. */
+    if ((ret = pio_topo_ioranks(comp_comm, num_iotasks, iotasks_per_node, &num_iotasks,
+                                &ioranks)))
+        return ret;
+
+    ret = init_intracomm(comp_comm, num_iotasks, ioranks, rearr, iosysidp);
+    free(ioranks);
+
+    return ret;
 }
 
 /**
@@ -1324,17 +2973,400 @@ PIOc_set_hint(int iosysid, const char *hint, const char *hintval)
     if (!hint || !hintval)
         return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    PLOG((1, "PIOc_set_hint hint = %s hintval = %s", hint, hintval));
-
-    /* Make sure we have an info object. */
-    if (ios->info == MPI_INFO_NULL)
-        if ((mpierr = MPI_Info_create(&ios->info)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-
-    /* Set the MPI hint. */
-    if (ios->ioproc)
-        if ((mpierr = MPI_Info_set(ios->info, (char *)hint, (char *)hintval)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((1, "PIOc_set_hint hint = %s hintval = %s", hint, hintval));
+
+    /* Make sure we have an info object. */
+    if (ios->info == MPI_INFO_NULL)
+        if ((mpierr = MPI_Info_create(&ios->info)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Set the MPI hint. */
+    if (ios->ioproc)
+        if ((mpierr = MPI_Info_set(ios->info, (char *)hint, (char *)hintval)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Derive MPI-IO hints for the parallel files (pnetcdf and netCDF-4
+ * parallel) created and opened afterwards in an iosystem.
+ *
+ * The default collective buffering of ROMIO is made for many
+ * writers with small, scattered pieces of data. The IO tasks of PIO
+ * have already gathered the data into large pieces, so ROMIO's
+ * defaults (one aggregator per node, a 16 MB buffer) mostly add a
+ * second, slower round of aggregation. With this setting, each file
+ * is created or opened with:
+ *
+ * - cb_nodes set to the number of IO tasks (or to the value set with
+ *   PIOc_set_file_cb_nodes()), and cb_config_list allowing as many
+ *   aggregators on a node as there are IO tasks on it, so the IO
+ *   tasks are the aggregators.
+ * - cb_buffer_size set to the largest IO buffer of the
+ *   decompositions of the iosystem, rounded up to the stripe or block
+ *   size of the file system, between 1 MB and 64 MB.
+ * - On Lustre and GPFS, romio_cb_write and romio_cb_read enabled and
+ *   data sieving of writes disabled.
+ * - On Lustre, for new files, striping_factor set to the number of
+ *   aggregators and striping_unit to 1 MB.
+ *
+ * The file system is found with statfs() on the IO root. Hints set
+ * with PIOc_set_hint() are not changed.
+ *
+ * With async, the setting is sent to the IO tasks with each create
+ * and open, so this function need only be called on the computation
+ * tasks. Otherwise it must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable non-zero to derive the hints, 0 (the default) to use
+ * only the hints set with PIOc_set_hint().
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_set_hint_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_hint_auto(int iosysid, int enable)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_hint_auto iosysid = %d enable = %d", iosysid, enable));
+
+    /* Get the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    ios->hint_auto = enable ? 1 : 0;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set the cb_nodes MPI-IO hint of the parallel files created
+ * afterwards with PIOc_createfile() or PIOc_create().
+ *
+ * A small file, such as a diagnostic file, gains little from having
+ * all the IO tasks write it to the file system. For the parallel
+ * iotypes (pnetcdf and netCDF-4 parallel), the file is created with
+ * the MPI-IO hint cb_nodes set to cb_nodes, so that only that many
+ * aggregators do the collective writes to the file system. This is
+ * only a hint: the file is still opened on all the IO tasks, all of
+ * them still take part in each MPI-IO call and get the data of the
+ * rearranger, and MPI-IO implementations may ignore it. The serial
+ * iotypes are always accessed by one IO task.
+ *
+ * With async, the setting is sent to the IO tasks with each create,
+ * so this function need only be called on the computation tasks.
+ * Otherwise it must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param cb_nodes the number of aggregators, or 0 (the default) for
+ * the number of IO tasks. Values not less than the number of IO
+ * tasks mean all of them.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_file_cb_nodes(int iosysid, int cb_nodes)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_file_cb_nodes iosysid = %d cb_nodes = %d", iosysid, cb_nodes));
+
+    /* Get the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (cb_nodes < 0)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    ios->file_cb_nodes = cb_nodes;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Stage the darray writes of the pnetcdf files created afterwards
+ * with PIOc_createfile() or PIOc_create() in a node-local directory,
+ * such as an NVMe burst buffer.
+ *
+ * Each IO task of such a file appends the rearranged data of its
+ * darray writes, with their start and count, to a log file of its
+ * own in dir, instead of posting them to pnetcdf. The log is drained
+ * into the netCDF file whenever the pending writes of the file are
+ * flushed: by PIOc_sync(), PIOc_redef(), PIOc_closefile(), and by
+ * darray writes with flushtodisk. Until then, the writes only cost
+ * the bandwidth of the local disk. With async, PIOc_sync_async() and
+ * PIOc_closefile_async() drain the log on the IO tasks while the
+ * computation tasks go on, so bursts of writes such as restart files
+ * are taken off the critical path of the model.
+ *
+ * The log of a file is named after the file and the IO rank, and is
+ * removed from dir as soon as it is opened, so nothing is left
+ * behind. Data read back from the file before a sync may not include
+ * staged writes.
+ *
+ * With async, the directory is sent to the IO tasks with each create,
+ * so this function need only be called on the computation tasks.
+ * Otherwise it must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param dir the directory, which must exist on the nodes of all IO
+ * tasks, or NULL or an empty string (the default) to write directly
+ * to the file.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_stage_dir(int iosysid, const char *dir)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_stage_dir iosysid = %d dir = %s", iosysid, dir ? dir : "NULL"));
+
+    /* Get the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (dir && strlen(dir) > PIO_MAX_NAME * 4)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    free(ios->stage_dir);
+    ios->stage_dir = NULL;
+    if (dir && dir[0] && !(ios->stage_dir = strdup(dir)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the distributed arrays of the files created afterwards with
+ * PIOc_createfile() or PIOc_create() to checkpoint files, one for
+ * each IO task, and read them back from those files when the files
+ * are opened afterwards with PIOc_openfile() or PIOc_open().
+ *
+ * This is meant for restart files that are read back by the same
+ * model on the same layout. Each IO task appends the rearranged data
+ * of each darray write to its own file, named <file>.ckpt.<io rank>,
+ * as it is in the IO buffer, after the start and count of its
+ * regions. There is no collective IO, and no conversion of the
+ * data. The netCDF file still holds the dimensions, vars and
+ * attributes, and the data written with the other functions, such as
+ * PIOc_put_var(), but not the data of the darray writes.
+ *
+ * On a read, if each IO task has the same regions as the task that
+ * wrote its file, each IO task reads its data back with one read of
+ * its own file. Otherwise, such as with a different number of IO
+ * tasks, each IO task assembles its regions from the regions of all
+ * the checkpoint files, so a restart on another layout is only
+ * slower. Files with checkpoint files can only be opened for writing
+ * with the number of IO tasks that created them.
+ *
+ * The files created with checkpoint files get the global attribute
+ * PIO_checkpoint_files, the number of checkpoint files. Files with
+ * this attribute are read from their checkpoint files whenever they
+ * are opened, whether or not this setting is on, so the setting only
+ * applies to the files created.
+ *
+ * With async, the setting is sent to the IO tasks with each create,
+ * so this function need only be called on the computation
+ * tasks. Otherwise it must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable non-zero to use checkpoint files, 0 (the default) to
+ * write and read the arrays in the netCDF files.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_checkpoint(int iosysid, int enable)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_checkpoint iosysid = %d enable = %d", iosysid, enable));
+
+    /* Get the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    ios->checkpoint = enable ? 1 : 0;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Tell PIO that the arrays passed to PIOc_write_darray(),
+ * PIOc_write_darray_multi(), PIOc_write_darray_nocopy() and
+ * PIOc_read_darray() may be in device (GPU) memory.
+ *
+ * The data are then never touched by the CPU on the computation
+ * tasks. Writes are not copied into the write multi buffer, but are
+ * sent to the IO tasks at once by the rearranger, straight from the
+ * caller's array, with MPI datatypes that pick the elements in the
+ * order of the decomposition. Reads are received straight into the
+ * caller's array in the same way. The data on the IO tasks are in
+ * host memory, as always. This needs an MPI library that can send
+ * from and receive into device memory (CUDA-aware or ROCm-aware
+ * MPI), which is the caller's responsibility.
+ *
+ * Since the writes are not aggregated, each write is a
+ * rearrangement of its own. The read cache and PIO_REARR_COMM_SHM
+ * need the data in host memory, and are not used. The conversions of
+ * PIOc_write_darray_tc() return PIO_EINVAL. The other darray
+ * functions, and fill values, still need host memory. Skipping
+ * unchanged arrays (see PIOc_set_var_skip_unchanged()) costs a copy
+ * of each array to host memory, to hash it.
+ *
+ * This must be called on all computation tasks of the IO system. It
+ * is not needed on the IO tasks of an async IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable non-zero if the arrays may be in device memory, 0
+ * (the default) if they are in host memory.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_device_buffers(int iosysid, int enable)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_device_buffers iosysid = %d enable = %d", iosysid, enable));
+
+    /* Get the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    ios->device_buffers = enable ? 1 : 0;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set the number of subfiles that the PIO_IOTYPE_NETCDF files created
+ * afterwards with PIOc_createfile() or PIOc_create() are written as.
+ *
+ * Classic netCDF files are otherwise written and read by IO task 0
+ * alone. With subfiles, the IO tasks are divided into num_subfiles
+ * groups of consecutive IO tasks, and the first task of each group
+ * writes the data of its group to a classic netCDF file of its
+ * own, named filename.N, where N is the number of the subfile. All
+ * subfiles have all the dimensions, variables and attributes, but
+ * only the decomposed data of their group. The file filename itself
+ * is a small index file, with the number of subfiles and IO tasks
+ * in its global attributes.
+ *
+ * PIOc_openfile() and PIOc_open() with PIO_IOTYPE_NETCDF recognize
+ * the index file, and read the data of each group from its
+ * subfile. So a subfiled file can only be read with an iosystem with
+ * the same number of IO tasks, and through decompositions that put
+ * the same data on each IO task as when it was written. The get
+ * functions, like PIOc_get_var(), read all subfiles, and take each
+ * value from the subfile where it is not the fill value. So the
+ * subfiles must be written in fill mode, the default, to be read
+ * with them; otherwise they return PIO_EINVAL. Errors of any
+ * subfile are returned on all tasks.
+ *
+ * With async, the setting is sent to the IO tasks with each create,
+ * so this function need only be called on the computation tasks.
+ * Otherwise it must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param num_subfiles the number of subfiles, or 0 (the default) for
+ * an ordinary file. Values greater than the number of IO tasks mean
+ * one subfile for each IO task.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_subfiles(int iosysid, int num_subfiles)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_subfiles iosysid = %d num_subfiles = %d", iosysid, num_subfiles));
+
+    /* Get the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (num_subfiles < 0)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    ios->num_subfiles = num_subfiles;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set the compression of the variables of the netCDF-4 files
+ * (PIO_IOTYPE_NETCDF4C and PIO_IOTYPE_NETCDF4P) created afterwards
+ * with PIOc_createfile() or PIOc_create(). The compression is turned
+ * on for each variable with dimensions, as it is defined. It can be
+ * changed for a variable with PIOc_def_var_deflate() before
+ * PIOc_enddef().
+ *
+ * With PIO_IOTYPE_NETCDF4P, the compression is only used if netCDF
+ * supports filters with parallel I/O (HAVE_PAR_FILTERS). Each chunk
+ * is then compressed by the IO task which writes it, so the chunks
+ * should be matched to the decomposition with
+ * PIOc_def_var_chunking_decomp(). Otherwise the IO tasks must
+ * exchange the data of the chunks they share before compression.
+ *
+ * With async, the setting is sent to the IO tasks with each create,
+ * so this function need only be called on the computation tasks.
+ * Otherwise it must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param compression the compression, see PIO_COMPRESSION.
+ * PIO_COMPRESS_NONE (the default) turns compression off.
+ * @param level the level of the compression, or 0 for the default
+ * of the method (1 for zlib, 32 pixels per block for szip, 3 for
+ * zstandard).
+ * @returns 0 for success, PIO_ENOTBUILT if netCDF was not built with
+ * the method, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_compression(int iosysid, int compression, int level)
+{
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_compression iosysid = %d compression = %d level = %d", iosysid,
+          compression, level));
+
+    /* Get the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    switch (compression)
+    {
+    case PIO_COMPRESS_NONE:
+        level = 0;
+        break;
+    case PIO_COMPRESS_ZLIB:
+        if (level < 0 || level > 9)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        break;
+    case PIO_COMPRESS_SZIP:
+        if (level < 0 || level > 32 || level % 2)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+#if !defined(NC_HAS_SZIP_WRITE) || !NC_HAS_SZIP_WRITE
+        return pio_err(ios, NULL, PIO_ENOTBUILT, __FILE__, __LINE__);
+#endif
+        break;
+    case PIO_COMPRESS_ZSTD:
+        if (level < 0 || level > 22)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+#if !defined(NC_HAS_ZSTD) || !NC_HAS_ZSTD
+        return pio_err(ios, NULL, PIO_ENOTBUILT, __FILE__, __LINE__);
+#endif
+        break;
+    default:
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    }
+
+    ios->compression = compression;
+    ios->compression_level = level;
 
     return PIO_NOERR;
 }
@@ -1397,6 +3429,18 @@ PIOc_free_iosystem(int iosysid)
         PLOG((3, "async errors bcast"));
     }
 
+    /* Log what the library still holds, and the peaks. */
+    pio_log_mem_usage();
+
+    /* Write the trace of the library calls, if it is on. */
+    if (ios->trace_file)
+        if ((ierr = pio_write_trace(ios)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    /* Free the node buffers of PIO_READ_NODE. */
+    if ((ierr = free_read_comms(ios)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
     /* Free this memory that was allocated in init_intracomm. */
     if (ios->ioranks)
         free(ios->ioranks);
@@ -1404,12 +3448,20 @@ PIOc_free_iosystem(int iosysid)
     if (ios->compranks)
         free(ios->compranks);
     PLOG((3, "Freed compranks."));
+    if (ios->rearr_tune_file)
+        free(ios->rearr_tune_file);
+    if (ios->stage_dir)
+        free(ios->stage_dir);
 
     /* Learn the number of open IO systems. */
     if ((ierr = pio_num_iosystem(&niosysid)))
         return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
     PLOG((2, "%d iosystems are still open.", niosysid));
 
+    /* Complete the result broadcasts of background closes. */
+    if ((ierr = pio_bg_progress(ios, true)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
     /* Free the MPI communicators. my_comm is just a copy (but not an
      * MPI copy), so does not have to have an MPI_Comm_free()
      * call. comp_comm and io_comm are MPI duplicates of the comms
@@ -1417,12 +3469,27 @@ PIOc_free_iosystem(int iosysid)
      * MPI. */
     if (ios->intercomm != MPI_COMM_NULL)
         MPI_Comm_free(&ios->intercomm);
+    if (ios->comm_refs && --(*ios->comm_refs))
+    {
+        /* Other IO systems still use the communicators. */
+        ios->union_comm = MPI_COMM_NULL;
+        ios->io_comm = MPI_COMM_NULL;
+        ios->comp_comm = MPI_COMM_NULL;
+    }
+    else
+        free(ios->comm_refs);
     if (ios->union_comm != MPI_COMM_NULL)
         MPI_Comm_free(&ios->union_comm);
     if (ios->io_comm != MPI_COMM_NULL)
         MPI_Comm_free(&ios->io_comm);
     if (ios->comp_comm != MPI_COMM_NULL)
         MPI_Comm_free(&ios->comp_comm);
+    if (ios->subset_comm_refs)
+        MPI_Comm_free(&ios->subset_comm);
+
+    /* Free the darray buffers kept for reuse, and the read cache. */
+    pio_iobuf_pool_free(ios);
+    pio_read_cache_clear(ios, NULL, -1);
     if (ios->my_comm != MPI_COMM_NULL)
         ios->my_comm = MPI_COMM_NULL;
 
@@ -1688,9 +3755,12 @@ PIOc_init_async(MPI_Comm world, int num_io_procs, int *io_proc_list,
         return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
     PLOG((3, "created IO group - io_group = %d MPI_GROUP_EMPTY = %d", io_group, MPI_GROUP_EMPTY));
 
-    /* There is one shared IO comm. Create it. */
-    if ((ret = MPI_Comm_create(world, io_group, &io_comm)))
-        return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+    /* There is one shared IO comm. Create it. Only the IO tasks take
+     * part. */
+    io_comm = MPI_COMM_NULL;
+    if (in_io)
+        if ((ret = MPI_Comm_create_group(world, io_group, PIO_ASYNC_COMM_TAG, &io_comm)))
+            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
     PLOG((3, "created io comm io_comm = %d", io_comm));
 
     /* Does the user want a copy of the IO communicator? */
@@ -1741,6 +3811,9 @@ PIOc_init_async(MPI_Comm world, int num_io_procs, int *io_proc_list,
         my_iosys->my_comm = MPI_COMM_NULL;
         my_iosys->async = 1;
         my_iosys->error_handler = default_error_handler;
+#ifdef TIMING
+        my_iosys->timing = true;
+#endif /* TIMING */
         my_iosys->num_comptasks = num_procs_per_comp[cmp];
         my_iosys->num_iotasks = num_io_procs;
         my_iosys->num_uniontasks = my_iosys->num_comptasks + my_iosys->num_iotasks;
@@ -1843,11 +3916,12 @@ PIOc_init_async(MPI_Comm world, int num_io_procs, int *io_proc_list,
               union_group[cmp], nprocs_union));
 
         /* Create an intracomm for this component. Only processes in
-         * the component need to participate in the intracomm create
-         * call. */
+         * the component participate in the intracomm create call. */
         PLOG((3, "creating intracomm cmp = %d from group[%d] = %d", cmp, cmp, group[cmp]));
-        if ((ret = MPI_Comm_create(world, group[cmp], &my_iosys->comp_comm)))
-            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+        if (in_cmp)
+            if ((ret = MPI_Comm_create_group(world, group[cmp], PIO_ASYNC_COMM_TAG + 2 * cmp + 1,
+                                             &my_iosys->comp_comm)))
+                return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
 
         if (in_cmp)
         {
@@ -1894,8 +3968,11 @@ PIOc_init_async(MPI_Comm world, int num_io_procs, int *io_proc_list,
         /* All the processes in this component, and the IO component,
          * are part of the union_comm. */
         PLOG((3, "before creating union_comm my_iosys->io_comm = %d group = %d", my_iosys->io_comm, union_group[cmp]));
-        if ((ret = MPI_Comm_create(world, union_group[cmp], &my_iosys->union_comm)))
-            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+        if (in_io || in_cmp)
+            if ((ret = MPI_Comm_create_group(world, union_group[cmp],
+                                             PIO_ASYNC_COMM_TAG + 2 * cmp + 2,
+                                             &my_iosys->union_comm)))
+                return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
         PLOG((3, "created union comm for cmp %d my_iosys->union_comm %d", cmp, my_iosys->union_comm));
 
 
@@ -2000,6 +4077,281 @@ PIOc_init_async(MPI_Comm world, int num_io_procs, int *io_proc_list,
     return PIO_NOERR;
 }
 
+/**
+ * Library initialization for async with a separate set of IO tasks
+ * for each computation component.
+ *
+ * With PIOc_init_async() all the computation components share one
+ * set of IO tasks, and pio_msg_handler2() on those tasks handles the
+ * messages of the components one at a time. A slow write from one
+ * component then holds up all the others. Here, each component gets
+ * its own IO tasks, which run their own message handler, so the
+ * components are served at the same time and do not wait behind
+ * each other.
+ *
+ * (The IO tasks are split, rather than running the handlers in
+ * threads, because the netCDF and HDF5 libraries, and the PIO lists
+ * of files and decompositions, are not thread-safe.)
+ *
+ * This is collective over world. Each task must be in at most one
+ * component, as either an IO or a computation task; tasks in no
+ * component return at once. The IO tasks do not return until
+ * PIOc_free_iosystem() is called on the computation tasks of their
+ * component.
+ *
+ * @param world the communicator containing all the available tasks.
+ * @param component_count number of computational components.
+ * @param num_io_procs an array of length component_count with the
+ * number of IO tasks for each component.
+ * @param io_proc_list an array of length component_count of arrays
+ * with the ranks in world of the IO tasks of each component.
+ * @param num_procs_per_comp an array of length component_count with
+ * the number of computation tasks in each component.
+ * @param proc_list an array of length component_count of arrays with
+ * the ranks in world of the computation tasks of each component.
+ * @param rearranger the default rearranger to use for decompositions
+ * in these IO systems.
+ * @param iosysidp pointer to array of length component_count that
+ * gets the iosysid for each component. Tasks get -1 for the
+ * components they are not part of.
+ * @return PIO_NOERR on success, error code otherwise.
+ * @ingroup PIO_init_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_init_async_split(MPI_Comm world, int component_count, int *num_io_procs,
+                      int **io_proc_list, int *num_procs_per_comp, int **proc_list,
+                      int rearranger, int *iosysidp)
+{
+    MPI_Comm sub_world;   /* The tasks of my component. */
+    MPI_Group world_group, sub_group;
+    int my_rank, world_size;
+    int *owner;           /* Component of each task in world. */
+    int color = MPI_UNDEFINED;
+    int mpierr;
+    int ret = PIO_NOERR;
+
+    /* Check input parameters. */
+    if (component_count < 1 || !num_io_procs || !io_proc_list || !num_procs_per_comp ||
+        !proc_list || !iosysidp)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    for (int cmp = 0; cmp < component_count; cmp++)
+        if (num_io_procs[cmp] < 1 || num_procs_per_comp[cmp] < 1 || !io_proc_list[cmp] ||
+            !proc_list[cmp])
+            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Comm_rank(world, &my_rank)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_size(world, &world_size)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Find the component of each task. The lists are the same on all
+     * tasks, so all tasks agree on whether they are valid. */
+    if (!(owner = malloc(world_size * sizeof(int))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    for (int p = 0; p < world_size; p++)
+        owner[p] = MPI_UNDEFINED;
+    for (int cmp = 0; cmp < component_count && !ret; cmp++)
+    {
+        for (int p = 0; p < num_io_procs[cmp] + num_procs_per_comp[cmp]; p++)
+        {
+            int rank = p < num_io_procs[cmp] ? io_proc_list[cmp][p] :
+                proc_list[cmp][p - num_io_procs[cmp]];
+
+            if (rank < 0 || rank >= world_size || owner[rank] != MPI_UNDEFINED)
+            {
+                ret = PIO_EINVAL;
+                break;
+            }
+            owner[rank] = cmp;
+        }
+    }
+    color = owner[my_rank];
+    free(owner);
+    if (ret)
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+
+    for (int cmp = 0; cmp < component_count; cmp++)
+        iosysidp[cmp] = -1;
+
+    /* Each component, with its IO tasks, gets a communicator of its
+     * own. */
+    if ((mpierr = MPI_Comm_split(world, color, my_rank, &sub_world)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if (color == MPI_UNDEFINED)
+        return PIO_NOERR;
+    PLOG((1, "PIOc_init_async_split component %d of %d", color, component_count));
+
+    /* Find the ranks of my component in sub_world. The groups and
+     * sub_world are freed even if this fails. */
+    {
+        int nio = num_io_procs[color];
+        int ncomp = num_procs_per_comp[color];
+        int sub_io_list[nio];
+        int sub_comp_list[ncomp];
+        int *sub_proc_list[1] = {sub_comp_list};
+
+        world_group = sub_group = MPI_GROUP_NULL;
+        if (!(mpierr = MPI_Comm_group(world, &world_group)) &&
+            !(mpierr = MPI_Comm_group(sub_world, &sub_group)) &&
+            !(mpierr = MPI_Group_translate_ranks(world_group, nio, io_proc_list[color],
+                                                 sub_group, sub_io_list)))
+            mpierr = MPI_Group_translate_ranks(world_group, ncomp, proc_list[color],
+                                               sub_group, sub_comp_list);
+        if (world_group != MPI_GROUP_NULL)
+            MPI_Group_free(&world_group);
+        if (sub_group != MPI_GROUP_NULL)
+            MPI_Group_free(&sub_group);
+        if (mpierr)
+        {
+            MPI_Comm_free(&sub_world);
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        }
+
+        /* The IO tasks stay in here, serving only this component,
+         * until it frees its iosystem. */
+        ret = PIOc_init_async(sub_world, nio, sub_io_list, 1, &ncomp, sub_proc_list,
+                              NULL, NULL, rearranger, &iosysidp[color]);
+    }
+
+    if ((mpierr = MPI_Comm_free(&sub_world)) && !ret)
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if (ret)
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+
+    PLOG((2, "successfully done with PIOc_init_async_split"));
+    return PIO_NOERR;
+}
+
+/**
+ * Find the ranks in world of the IO tasks and of the tasks of each
+ * computation component, from their communicators. Used by
+ * PIOc_init_async_from_comms() and
+ * PIOc_init_async_from_comms_split(). This is collective over world.
+ *
+ * @param world the communicator containing all the available tasks.
+ * @param component_count pointer to the number of computational
+ * components. It gets the largest value of any task.
+ * @param comp_comm an array of size component_count with the comm of
+ * each component, MPI_COMM_NULL on tasks not in it.
+ * @param io_comm the communicator of the IO tasks, MPI_COMM_NULL on
+ * other tasks.
+ * @param num_io_procs pointer that gets the number of IO tasks.
+ * @param io_proc_list pointer that gets an array (length
+ * num_io_procs) of the ranks of the IO tasks in world.
+ * @param num_procs_per_comp pointer that gets an array (length
+ * component_count) of the number of tasks of each component.
+ * @param proc_list pointer that gets an array (length
+ * component_count) of arrays of the ranks in world of the tasks of
+ * each component. The arrays must be freed with free_async_lists().
+ * @return PIO_NOERR on success, error code otherwise.
+ * @author Jim Edwards
+ */
+static int
+get_async_lists(MPI_Comm world, int *component_count, MPI_Comm *comp_comm, MPI_Comm io_comm,
+                int *num_io_procs, int **io_proc_list, int **num_procs_per_comp,
+                int ***proc_list)
+{
+    int my_rank;          /* Rank of this task. */
+    int **my_proc_list;   /* Array of arrays of procs for comp components. */
+    int ret;              /* Return code. */
+
+    /* Get num_io_procs from io_comm, share with world */
+    *num_io_procs = 0;
+    if (io_comm != MPI_COMM_NULL)
+    {
+        if ((ret = MPI_Comm_size(io_comm, num_io_procs)))
+            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+    }
+    if ((ret = MPI_Allreduce(MPI_IN_PLACE, num_io_procs, 1, MPI_INT, MPI_MAX, world)))
+        return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+
+    /* Get io_proc_list from io_comm, share with world */
+    if (!(*io_proc_list = (int*) calloc(*num_io_procs, sizeof(int))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (io_comm != MPI_COMM_NULL)
+    {
+        int my_io_rank;
+        if ((ret = MPI_Comm_rank(io_comm, &my_io_rank)))
+            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+        if ((ret = MPI_Comm_rank(world, &my_rank)))
+            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+        (*io_proc_list)[my_io_rank] = my_rank;
+        *component_count = 0;
+    }
+    if ((ret = MPI_Allreduce(MPI_IN_PLACE, *io_proc_list, *num_io_procs, MPI_INT, MPI_MAX,
+                             world)))
+        return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+
+    /* Get num_procs_per_comp for each comp and share with world */
+    if ((ret = MPI_Allreduce(MPI_IN_PLACE, component_count, 1, MPI_INT, MPI_MAX, world)))
+        return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+
+    if (!(*num_procs_per_comp = (int *) malloc(*component_count * sizeof(int))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    for(int cmp=0; cmp < *component_count; cmp++)
+    {
+        (*num_procs_per_comp)[cmp] = 0;
+        if(comp_comm[cmp] != MPI_COMM_NULL)
+            if ((ret = MPI_Comm_size(comp_comm[cmp], &((*num_procs_per_comp)[cmp]))))
+                return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+        if ((ret = MPI_Allreduce(MPI_IN_PLACE, &((*num_procs_per_comp)[cmp]), 1, MPI_INT,
+                                 MPI_MAX, world)))
+            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+
+    }
+
+    /* Get proc list for each comp and share with world */
+    if (!(my_proc_list = (int**) calloc(*component_count, sizeof(int*))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    *proc_list = my_proc_list;
+
+    for(int cmp=0; cmp < *component_count; cmp++)
+    {
+        if (!(my_proc_list[cmp] = (int *) malloc((*num_procs_per_comp)[cmp] * sizeof(int))))
+            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        for(int i = 0; i < (*num_procs_per_comp)[cmp]; i++)
+            my_proc_list[cmp][i] = 0;
+        if(comp_comm[cmp] != MPI_COMM_NULL){
+            int my_comp_rank;
+            if ((ret = MPI_Comm_rank(comp_comm[cmp], &my_comp_rank)))
+                return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+            if ((ret = MPI_Comm_rank(world, &my_rank)))
+                return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+            my_proc_list[cmp][my_comp_rank] = my_rank;
+        }
+        if ((ret = MPI_Allreduce(MPI_IN_PLACE, my_proc_list[cmp], (*num_procs_per_comp)[cmp],
+                                 MPI_INT, MPI_MAX, world)))
+            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free the arrays of get_async_lists().
+ *
+ * @param component_count number of computational components.
+ * @param io_proc_list array of the ranks of the IO tasks.
+ * @param num_procs_per_comp array of the number of tasks of each
+ * component.
+ * @param proc_list array of arrays of the ranks of the tasks of each
+ * component.
+ * @author Jim Edwards
+ */
+static void
+free_async_lists(int component_count, int *io_proc_list, int *num_procs_per_comp,
+                 int **proc_list)
+{
+    if (proc_list)
+        for(int cmp=0; cmp < component_count; cmp++)
+            free(proc_list[cmp]);
+    free(proc_list);
+    free(io_proc_list);
+    free(num_procs_per_comp);
+}
+
 /**
  * Library initialization used when IO tasks are distinct from compute
  * tasks.
@@ -2065,14 +4417,13 @@ int
 PIOc_init_async_from_comms(MPI_Comm world, int component_count, MPI_Comm *comp_comm,
                            MPI_Comm io_comm, int rearranger, int *iosysidp)
 {
-    int my_rank;          /* Rank of this task. */
-    int **my_proc_list;   /* Array of arrays of procs for comp components. */
-    int *io_proc_list; /* List of processors in IO component. */
-    int *num_procs_per_comp; /* List of number of tasks in each component */
+    int **my_proc_list = NULL;   /* Array of arrays of procs for comp components. */
+    int *io_proc_list = NULL; /* List of processors in IO component. */
+    int *num_procs_per_comp = NULL; /* List of number of tasks in each component */
     int num_io_procs = 0;
     int ret;              /* Return code. */
 #ifdef USE_MPE
-    bool in_io = false;
+    bool in_io = io_comm != MPI_COMM_NULL;
 #endif /* USE_MPE */
 
 #ifdef USE_MPE
@@ -2089,89 +4440,135 @@ PIOc_init_async_from_comms(MPI_Comm world, int component_count, MPI_Comm *comp_c
         return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
     PLOG((1, "PIOc_init_async_from_comms component_count = %d", component_count));
 
-    /* Get num_io_procs from io_comm, share with world */
-    if (io_comm != MPI_COMM_NULL)
+    /* Find the tasks of each component, and the IO tasks. */
+    if ((ret = get_async_lists(world, &component_count, comp_comm, io_comm, &num_io_procs,
+                               &io_proc_list, &num_procs_per_comp, &my_proc_list)))
     {
-#ifdef USE_MPE
-        in_io = true;
-#endif /* USE_MPE */
-        if ((ret = MPI_Comm_size(io_comm, &num_io_procs)))
-            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+        free_async_lists(component_count, io_proc_list, num_procs_per_comp, my_proc_list);
+        return ret;
     }
-    if ((ret = MPI_Allreduce(MPI_IN_PLACE, &num_io_procs, 1, MPI_INT, MPI_MAX, world)))
-        return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
 
-    /* Get io_proc_list from io_comm, share with world */
-    io_proc_list = (int*) calloc(num_io_procs, sizeof(int));
-    if (io_comm != MPI_COMM_NULL)
-    {
-        int my_io_rank;
-        if ((ret = MPI_Comm_rank(io_comm, &my_io_rank)))
-            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
-        if ((ret = MPI_Comm_rank(world, &my_rank)))
-            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
-        io_proc_list[my_io_rank] = my_rank;
-        component_count = 0;
-    }
-    if ((ret = MPI_Allreduce(MPI_IN_PLACE, io_proc_list, num_io_procs, MPI_INT, MPI_MAX, world)))
-        return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+    if((ret = PIOc_init_async(world, num_io_procs, io_proc_list, component_count,
+                           num_procs_per_comp, my_proc_list, NULL, NULL, rearranger,
+                              iosysidp)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
 
-    /* Get num_procs_per_comp for each comp and share with world */
-    if ((ret = MPI_Allreduce(MPI_IN_PLACE, &(component_count), 1, MPI_INT, MPI_MAX, world)))
-        return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+    free_async_lists(component_count, io_proc_list, num_procs_per_comp, my_proc_list);
 
-    num_procs_per_comp = (int *) malloc(component_count * sizeof(int));
+#ifdef USE_MPE
+    if (!in_io)
+        pio_stop_mpe_log(INIT, __func__);
+#endif /* USE_MPE */
 
-    for(int cmp=0; cmp < component_count; cmp++)
-    {
-        num_procs_per_comp[cmp] = 0;
-        if(comp_comm[cmp] != MPI_COMM_NULL)
-            if ((ret = MPI_Comm_size(comp_comm[cmp], &(num_procs_per_comp[cmp]))))
-                return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
-        if ((ret = MPI_Allreduce(MPI_IN_PLACE, &(num_procs_per_comp[cmp]), 1, MPI_INT, MPI_MAX, world)))
-            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+    PLOG((2, "successfully done with PIOc_init_async_from_comms"));
+    return PIO_NOERR;
+}
+
+/**
+ * Library initialization used when IO tasks are distinct from compute
+ * tasks, with the IO tasks divided between the components.
+ *
+ * This is like PIOc_init_async_from_comms(), but instead of all the
+ * components sharing all the IO tasks, the tasks of io_comm are split
+ * into consecutive groups, one for each component, and each group
+ * serves only the files of its component (see
+ * PIOc_init_async_split()). So a long write of one component (say,
+ * ocean restarts) does not hold up the files of the others (say,
+ * atmosphere history), which are written at the same time by other
+ * IO tasks.
+ *
+ * The IO tasks are divided by component, not by file, because the
+ * message handler of the IO tasks runs every operation of an
+ * iosystem on all its IO tasks.
+ *
+ * This is collective over world. component_count and io_share must
+ * be the same on all tasks. Each task must be in at most one
+ * computation component, and the IO tasks may not be in any. Tasks
+ * in io_comm do not return until PIOc_free_iosystem() is called on
+ * the computation tasks of their component.
+ *
+ * @param world the communicator containing all the available tasks.
+ * @param component_count number of computational components.
+ * @param comp_comm an array of size component_count which are the
+ * defined comms of each component - comp_comm should be
+ * MPI_COMM_NULL on tasks outside the tasks of each comm.
+ * @param io_comm a communicator for the IO group, tasks in this comm
+ * do not return from this call.
+ * @param io_share an array of size component_count with the number
+ * of IO tasks for each component. The first io_share[0] tasks of
+ * io_comm serve component 0, the next io_share[1] component 1, and
+ * so on. Each must be at least 1, and together they must be the size
+ * of io_comm.
+ * @param rearranger the default rearranger to use for decompositions
+ * in these IO systems.
+ * @param iosysidp pointer to array of length component_count that
+ * gets the iosysid for each component. Tasks get -1 for the
+ * components they are not part of.
+ * @return PIO_NOERR on success, error code otherwise.
+ * @ingroup PIO_init_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_init_async_from_comms_split(MPI_Comm world, int component_count, MPI_Comm *comp_comm,
+                                 MPI_Comm io_comm, const int *io_share, int rearranger,
+                                 int *iosysidp)
+{
+    int **my_proc_list = NULL;   /* Array of arrays of procs for comp components. */
+    int *io_proc_list = NULL; /* List of processors in IO component. */
+    int *num_procs_per_comp = NULL; /* List of number of tasks in each component */
+    int num_io_procs = 0;
+    int ncomp = component_count;
+    int total = 0;
+    int ret;              /* Return code. */
 
+    /* Check input parameters. */
+    if (component_count < 1 || !comp_comm || !io_share || !iosysidp ||
+        (rearranger != PIO_REARR_BOX && rearranger != PIO_REARR_SUBSET))
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    for (int cmp = 0; cmp < component_count; cmp++)
+    {
+        if (io_share[cmp] < 1)
+            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        total += io_share[cmp];
     }
 
-    /* Get proc list for each comp and share with world */
-    my_proc_list = (int**) malloc(component_count * sizeof(int*));
+    /* Turn on the logging system for PIO. */
+    if ((ret = pio_init_logging()))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    PLOG((1, "PIOc_init_async_from_comms_split component_count = %d", component_count));
 
-    for(int cmp=0; cmp < component_count; cmp++)
+    /* Find the tasks of each component, and the IO tasks. */
+    if ((ret = get_async_lists(world, &ncomp, comp_comm, io_comm, &num_io_procs,
+                               &io_proc_list, &num_procs_per_comp, &my_proc_list)))
     {
-        if (!(my_proc_list[cmp] = (int *) malloc(num_procs_per_comp[cmp] * sizeof(int))))
-            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        for(int i = 0; i < num_procs_per_comp[cmp]; i++)
-            my_proc_list[cmp][i] = 0;
-        if(comp_comm[cmp] != MPI_COMM_NULL){
-            int my_comp_rank;
-            if ((ret = MPI_Comm_rank(comp_comm[cmp], &my_comp_rank)))
-                return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
-            if ((ret = MPI_Comm_rank(world, &my_rank)))
-                return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
-            my_proc_list[cmp][my_comp_rank] = my_rank;
-        }
-        if ((ret = MPI_Allreduce(MPI_IN_PLACE, my_proc_list[cmp], num_procs_per_comp[cmp],
-                                 MPI_INT, MPI_MAX, world)))
-            return check_mpi(NULL, NULL, ret, __FILE__, __LINE__);
+        free_async_lists(ncomp, io_proc_list, num_procs_per_comp, my_proc_list);
+        return ret;
+    }
+    if (ncomp != component_count || total != num_io_procs)
+    {
+        free_async_lists(ncomp, io_proc_list, num_procs_per_comp, my_proc_list);
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
     }
 
-    if((ret = PIOc_init_async(world, num_io_procs, io_proc_list, component_count,
-                           num_procs_per_comp, my_proc_list, NULL, NULL, rearranger,
-                              iosysidp)))
-        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    /* Each component gets the next io_share[cmp] IO tasks. */
+    {
+        int *io_lists[component_count];
+        int pos = 0;
 
-    for(int cmp=0; cmp < component_count; cmp++)
-        free(my_proc_list[cmp]);
-    free(my_proc_list);
-    free(io_proc_list);
-    free(num_procs_per_comp);
+        for (int cmp = 0; cmp < component_count; cmp++)
+        {
+            io_lists[cmp] = io_proc_list + pos;
+            pos += io_share[cmp];
+        }
 
-#ifdef USE_MPE
-    if (!in_io)
-        pio_stop_mpe_log(INIT, __func__);
-#endif /* USE_MPE */
+        ret = PIOc_init_async_split(world, component_count, (int *)io_share, io_lists,
+                                    num_procs_per_comp, my_proc_list, rearranger, iosysidp);
+    }
+    free_async_lists(ncomp, io_proc_list, num_procs_per_comp, my_proc_list);
+    if (ret)
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
 
-    PLOG((2, "successfully done with PIOc_init_async_from_comms"));
+    PLOG((2, "successfully done with PIOc_init_async_from_comms_split"));
     return PIO_NOERR;
 }
 
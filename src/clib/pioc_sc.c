@@ -179,7 +179,8 @@ PIO_Offset GCDblocksize(int arrlen, const PIO_Offset *arr_in)
 
 /**
  * Compute start and count values for each io task. This is used in
- * PIOc_InitDecomp() for the box rearranger only.
+ * PIOc_InitDecomp() for the box rearranger only, and is the
+ * PIO_IOPART_BLOCK IO partition.
  *
  * @param pio_type the PIO data type used in this decompotion.
  * @param ndims the number of dimensions in the variable, not
@@ -365,3 +366,230 @@ int CalcStartandCount(int pio_type, int ndims, const int *gdims, int num_io_proc
 
     return PIO_NOERR;
 }
+
+/**
+ * Compute start and count values for each io task, so that each IO
+ * task covers whole, aligned file system stripes. This is used in
+ * PIOc_InitDecomp() for the box rearranger with the PIO_IOPART_STRIPE
+ * IO partition, see PIOc_set_stripe_align().
+ *
+ * The data are split along the slowest varying dimension only, so
+ * the part of each IO task is contiguous in the file. The split is
+ * made in chunks of the smallest number of slowest dimension indices
+ * whose size is a whole number of stripes, so every IO task starts on
+ * a stripe boundary (relative to the start of the variable, or of the
+ * record, for record variables). If there are more IO tasks than
+ * stripes (OSTs), the number used is rounded down to a multiple of
+ * stripe_factor, so each stripe gets the same number of writers.
+ *
+ * If this would use fewer than half the IO tasks that
+ * CalcStartandCount() would use, that is used instead.
+ *
+ * @param pio_type the PIO data type used in this decompotion.
+ * @param ndims the number of dimensions in the variable, not
+ * including the unlimited dimension.
+ * @param gdims an array of global size of each dimension.
+ * @param num_io_procs the number of IO tasks.
+ * @param myiorank rank of this task in IO communicator.
+ * @param stripe_unit the stripe size in bytes.
+ * @param stripe_factor the number of stripes (OSTs), or 0 if not
+ * known.
+ * @param start array of length ndims with data start values.
+ * @param count array of length ndims with data count values.
+ * @param num_aiotasks the number of IO tasks used.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+CalcStartandCount_stripe(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                         int myiorank, PIO_Offset stripe_unit, int stripe_factor,
+                         PIO_Offset *start, PIO_Offset *count, int *num_aiotasks)
+{
+    int basesize;      /* Size in bytes of base data type. */
+    PIO_Offset slab;   /* Bytes in one index of the slowest dimension. */
+    PIO_Offset chunk;  /* Slowest dimension indices in one aligned chunk. */
+    int nchunks;
+    int use_io_procs;
+    int calc_io_procs;
+    int ret;
+
+    /* Check inputs. */
+    pioassert(pio_type > 0 && ndims > 0 && gdims && num_io_procs > 0 && start && count &&
+              stripe_unit > 0 && stripe_factor >= 0, "invalid input", __FILE__, __LINE__);
+    PLOG((1, "CalcStartandCount_stripe pio_type = %d ndims = %d num_io_procs = %d "
+          "myiorank = %d stripe_unit = %lld stripe_factor = %d", pio_type, ndims,
+          num_io_procs, myiorank, stripe_unit, stripe_factor));
+
+    /* Find the partition without alignment. This gives the number
+     * of IO tasks that the blocksize calls for. */
+    if ((ret = CalcStartandCount(pio_type, ndims, gdims, num_io_procs, myiorank, start,
+                                 count, &calc_io_procs)))
+        return ret;
+    *num_aiotasks = calc_io_procs;
+
+    /* Determine the size of the data type. */
+    if ((ret = find_mpi_type(pio_type, NULL, &basesize)))
+        return ret;
+
+    /* Find the size of a chunk of whole stripes. */
+    slab = basesize;
+    for (int i = 1; i < ndims; i++)
+        slab *= gdims[i];
+    if (!slab || !gdims[0])
+        return PIO_NOERR;
+    chunk = stripe_unit / lgcd(slab, stripe_unit);
+    nchunks = (int)((gdims[0] + chunk - 1) / chunk);
+
+    /* How many IO tasks can be used? */
+    use_io_procs = min(calc_io_procs, nchunks);
+    if (stripe_factor > 0 && use_io_procs > stripe_factor)
+        use_io_procs -= use_io_procs % stripe_factor;
+    PLOG((2, "slab = %lld chunk = %lld nchunks = %d use_io_procs = %d calc_io_procs = %d",
+          slab, chunk, nchunks, use_io_procs, calc_io_procs));
+
+    /* Too few aligned chunks to keep the IO tasks busy, so keep the
+     * unaligned partition. */
+    if (use_io_procs * 2 < calc_io_procs)
+        return PIO_NOERR;
+
+    /* Deal the chunks out to the IO tasks. */
+    for (int i = 0; i < ndims; i++)
+    {
+        start[i] = 0;
+        count[i] = myiorank < use_io_procs ? gdims[i] : 0;
+    }
+    if (myiorank < use_io_procs)
+    {
+        PIO_Offset cstart, ccount;
+
+        compute_one_dim(nchunks, use_io_procs, myiorank, &cstart, &ccount);
+        start[0] = cstart * chunk;
+        count[0] = min((cstart + ccount) * chunk, (PIO_Offset)gdims[0]) - start[0];
+    }
+
+    /* Return the number of IO procs used to the caller. */
+    *num_aiotasks = use_io_procs;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Compute start and count values for each io task, using as many IO
+ * tasks as possible, with the bytes balanced between them. This is
+ * the PIO_IOPART_BYTES IO partition.
+ *
+ * The IO tasks are arranged in a grid, with p[d] tasks along
+ * dimension d, and each dimension is split evenly. Starting with the
+ * slowest dimension, p[d] is the largest divisor of the IO tasks
+ * left that is no more than gdims[d], so that all num_io_procs tasks
+ * are used when the dimensions allow.
+ *
+ * @param pio_type the PIO data type used in this decompotion.
+ * @param ndims the number of dimensions in the variable, not
+ * including the unlimited dimension.
+ * @param gdims an array of global size of each dimension.
+ * @param num_io_procs the number of IO tasks.
+ * @param myiorank rank of this task in IO communicator.
+ * @param start array of length ndims with data start values.
+ * @param count array of length ndims with data count values.
+ * @param num_aiotasks the number of IO tasks used.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+CalcStartandCount_bytes(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                        int myiorank, PIO_Offset *start, PIO_Offset *count, int *num_aiotasks)
+{
+    int p[ndims];
+    int left = num_io_procs;
+    int use_io_procs = 1;
+
+    /* Check inputs. */
+    pioassert(pio_type > 0 && ndims > 0 && gdims && num_io_procs > 0 && start && count,
+              "invalid input", __FILE__, __LINE__);
+
+    /* Find the grid of IO tasks. */
+    for (int d = 0; d < ndims; d++)
+    {
+        p[d] = max(1, min(left, gdims[d]));
+        while (left % p[d])
+            p[d]--;
+        left /= p[d];
+        use_io_procs *= p[d];
+    }
+    PLOG((2, "CalcStartandCount_bytes num_io_procs = %d use_io_procs = %d", num_io_procs,
+          use_io_procs));
+
+    /* Find the place of this task in the grid, fastest dimension
+     * last. */
+    if (myiorank < use_io_procs)
+    {
+        int r = myiorank;
+
+        for (int d = ndims - 1; d >= 0; d--)
+        {
+            compute_one_dim(gdims[d], p[d], r % p[d], &start[d], &count[d]);
+            r /= p[d];
+        }
+    }
+    else
+    {
+        for (int d = 0; d < ndims; d++)
+        {
+            start[d] = 0;
+            count[d] = 0;
+        }
+    }
+
+    /* Return the number of IO procs used to the caller. */
+    *num_aiotasks = use_io_procs;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Compute start and count values for each io task, splitting the
+ * data along the slowest varying dimension only, so that the part of
+ * each IO task is contiguous in the file. The number of IO tasks is
+ * chosen as in CalcStartandCount(), but is not more than the length
+ * of the slowest dimension. This is the PIO_IOPART_SLAB IO partition.
+ *
+ * @param pio_type the PIO data type used in this decompotion.
+ * @param ndims the number of dimensions in the variable, not
+ * including the unlimited dimension.
+ * @param gdims an array of global size of each dimension.
+ * @param num_io_procs the number of IO tasks.
+ * @param myiorank rank of this task in IO communicator.
+ * @param start array of length ndims with data start values.
+ * @param count array of length ndims with data count values.
+ * @param num_aiotasks the number of IO tasks used.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+CalcStartandCount_slab(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                       int myiorank, PIO_Offset *start, PIO_Offset *count, int *num_aiotasks)
+{
+    int use_io_procs;
+    int ret;
+
+    /* The block partition gives the number of IO tasks wanted. */
+    if ((ret = CalcStartandCount(pio_type, ndims, gdims, num_io_procs, myiorank, start,
+                                 count, &use_io_procs)))
+        return ret;
+    use_io_procs = max(1, min(use_io_procs, gdims[0]));
+    PLOG((2, "CalcStartandCount_slab use_io_procs = %d", use_io_procs));
+
+    for (int i = 0; i < ndims; i++)
+    {
+        start[i] = 0;
+        count[i] = myiorank < use_io_procs ? gdims[i] : 0;
+    }
+    if (myiorank < use_io_procs)
+        compute_one_dim(gdims[0], use_io_procs, myiorank, &start[0], &count[0]);
+
+    /* Return the number of IO procs used to the caller. */
+    *num_aiotasks = use_io_procs;
+
+    return PIO_NOERR;
+}
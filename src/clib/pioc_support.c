@@ -2,18 +2,45 @@
  * Support functions for the PIO library.
  */
 #include "config.h"
+#include <unistd.h>
 #if PIO_ENABLE_LOGGING
 #include <stdarg.h>
-#include <unistd.h>
 #endif /* PIO_ENABLE_LOGGING */
 #include <pio.h>
 #include <pio_internal.h>
+#include <parallel_sort.h>
 
 #include <execinfo.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif /* __linux__ */
 
 /** This is used with text decomposition files. */
 #define VERSNO 2001
 
+/** The statfs() magic number of Lustre file systems. */
+#define PIO_LUSTRE_MAGIC 0x0BD00BD0
+
+/** The statfs() magic number of GPFS file systems. */
+#define PIO_GPFS_MAGIC 0x47504653
+
+/** The stripe size of new Lustre files with PIOc_set_hint_auto(). */
+#define PIO_AUTO_STRIPE_UNIT 1048576
+
+/** The smallest cb_buffer_size set by PIOc_set_hint_auto(). */
+#define PIO_AUTO_MIN_CB_BUFFER 1048576
+
+/** The largest cb_buffer_size set by PIOc_set_hint_auto(). */
+#define PIO_AUTO_MAX_CB_BUFFER 67108864
+
+/** The first value in binary decomposition files ("PIOMAPB"). A file
+ * written with the other byte order won't match it. */
+#define PIO_MAP_BIN_MAGIC 0x50494f4d415042LL
+
+/** The number of values before the dimlens in binary decomposition
+ * files: the magic number, version, npes and ndims. */
+#define PIO_MAP_BIN_HDR 4
+
 /** Used to shift file index to first two bytes of ncid. */
 #define ID_SHIFT 16
 
@@ -28,6 +55,7 @@
 #define ERROR_PREFIX "ERROR: "
 #define NC_LEVEL_DIFF 3
 int pio_log_level = 0;
+int pio_log_levels[PIO_LOG_NUM_SUBSYS];
 int pio_log_ref_cnt = 0;
 int my_rank;
 FILE *LOG_FILE = NULL;
@@ -52,3127 +80,7609 @@ extern int diosysid;
 int nc4_file_change_ncid(int ncid, unsigned short new_ncid_index);
 #endif /* NETCDF_INTEGRATION */
 
+/** The names of the timers, indexed by the PIO_TIMER_* IDs. */
+static const char *pio_timer_name[PIO_NUM_TIMERS] = {
+    "PIO:write_darray_multi_par", "PIO:write_darray_multi_serial",
+    "PIO:read_darray_nc", "PIO:read_darray_nc_serial", "PIO:rearrange_comp2io",
+    "PIO:rearrange_io2comp", "PIO:box_rearrange_create",
+    "PIO:box_rearrange_create_with_holes", "PIO:swapm", "PIO:wait_all",
+    "PIOc_write_darray", "PIOc_write_darray_multi", "PIOc_read_darray", "PIOc_sync",
+    "PIOc_closefile"};
+
+#ifdef TIMING
+/** The GPTL handles of the timers, so that GPTL does not have to look
+ * up their names on each call. */
+static void *pio_timer_handle[PIO_NUM_TIMERS];
+#endif /* TIMING */
+
+/** An event of the trace: a timer, and the times (from the start of
+ * the trace) it was started and stopped. */
+typedef struct pio_trace_event
+{
+    double start;
+    double end;
+    int timer;
+} pio_trace_event;
+
+/** The trace of this task, see PIOc_set_trace(). */
+static pio_trace_event *pio_trace;
+
+/** The number of events in pio_trace, and its allocated length. */
+static int pio_trace_len;
+static int pio_trace_size;
+
+/** The number of events dropped because pio_trace was full. */
+static PIO_Offset pio_trace_dropped;
+
+/** The MPI_Wtime() of the start of the trace. */
+static double pio_trace_start;
+
+/** True if the events are being added to pio_trace. */
+static bool pio_tracing;
+
+/** The number of IO systems with the trace on. The events are kept
+ * until the trace of the last of them is written. */
+static int pio_trace_refs;
+
+#if PIO_THREADS
+/** Lock of the trace, which threads using different IO systems add
+ * events to at the same time. */
+static pthread_rwlock_t trace_lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+
 /**
- * Start the PIO timer.
+ * Start a timer of an IO system. Use the pio_start_timer() macro,
+ * which does nothing when the timers of the IO system are off. When
+ * the library is built with GPTL, the GPTL timer of the same name is
+ * started too.
  *
- * @param name name of the timer.
+ * @param ios pointer to the IO system info.
+ * @param timer the ID of the timer, one of the PIO_TIMER_* values.
  * @return 0 for success, error code otherwise.
  * @author Ed Hartnett
  */
 int
-pio_start_timer(const char *name)
+pio_timer_start(iosystem_desc_t *ios, int timer)
 {
+    pioassert(ios && timer >= 0 && timer < PIO_NUM_TIMERS, "invalid input", __FILE__,
+              __LINE__);
+
 #ifdef TIMING
-    GPTLstart(name);
+    GPTLstart_handle(pio_timer_name[timer], &pio_timer_handle[timer]);
 #endif /* TIMING */
+    ios->timers[timer].start = MPI_Wtime();
+    ios->timers[timer].running = true;
+
     return PIO_NOERR;
 }
 
 /**
- * Stop the PIO timer.
+ * Stop a timer of an IO system, see pio_timer_start(). A timer that
+ * is not running, because it was already stopped by pio_err(), is
+ * left as it is.
  *
- * @param name name of the timer.
+ * @param ios pointer to the IO system info.
+ * @param timer the ID of the timer, one of the PIO_TIMER_* values.
  * @return 0 for success, error code otherwise.
  * @author Ed Hartnett
  */
 int
-pio_stop_timer(const char *name)
+pio_timer_stop(iosystem_desc_t *ios, int timer)
 {
+    pio_timer_t *t;
+    double end = MPI_Wtime();
+
+    pioassert(ios && timer >= 0 && timer < PIO_NUM_TIMERS, "invalid input", __FILE__,
+              __LINE__);
+
+    t = &ios->timers[timer];
+    if (!t->running)
+        return PIO_NOERR;
+    t->running = false;
+    t->total += end - t->start;
+    t->count++;
+
+    /* Add the event to the trace, if it is on. */
+    pio_wrlock(&trace_lock);
+    if (pio_tracing)
+    {
+        if (pio_trace_len == pio_trace_size && pio_trace_size < PIO_MAX_TRACE_EVENTS)
+        {
+            int size = pio_trace_size ? 2 * pio_trace_size : 1024;
+            pio_trace_event *trace;
+
+            if ((trace = realloc(pio_trace, size * sizeof(pio_trace_event))))
+            {
+                pio_trace = trace;
+                pio_trace_size = size;
+            }
+        }
+        if (pio_trace_len < pio_trace_size)
+        {
+            pio_trace[pio_trace_len].start = t->start - pio_trace_start;
+            pio_trace[pio_trace_len].end = end - pio_trace_start;
+            pio_trace[pio_trace_len++].timer = timer;
+        }
+        else
+            pio_trace_dropped++;
+    }
+    pio_unlock(&trace_lock);
 #ifdef TIMING
-    GPTLstop(name);
+    GPTLstop_handle(pio_timer_name[timer], &pio_timer_handle[timer]);
 #endif /* TIMING */
+
     return PIO_NOERR;
 }
 
 /**
- * Return a string description of an error code. If zero is passed,
- * the errmsg will be "No error".
+ * Turn on or off the timers of the hot paths of an IO system (the
+ * darray writes and reads, and the rearranger). They are on by
+ * default when the library is built with GPTL, in which case the GPTL
+ * timers of the same names are kept too, and off otherwise. When
+ * off, they cost one test per call.
  *
- * @param pioerr the error code returned by a PIO function call.
- * @param errmsg Pointer that will get the error message. The message
- * will be PIO_MAX_NAME chars or less.
- * @return 0 on success.
- * @author Jim Edwards
+ * Each IO system has its own timers, so threads using different IO
+ * systems do not share them. Turning the timers on when they are off
+ * sets them to 0, as PIOc_reset_timing() does, so that the calls
+ * running while they were off are not counted.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to turn the timers on, false to turn them off.
+ * @return 0 for success, PIO_EBADID if the IO system is not found.
+ * @author Ed Hartnett
  */
 int
-PIOc_strerror(int pioerr, char *errmsg)
+PIOc_set_timing(int iosysid, bool enable)
 {
-    PLOG((1, "PIOc_strerror pioerr = %d", pioerr));
+    iosystem_desc_t *ios;
 
-    /* Caller must provide this. */
-    pioassert(errmsg, "pointer to errmsg string must be provided", __FILE__,
-              __LINE__);
+    PLOG((1, "PIOc_set_timing iosysid = %d enable = %d", iosysid, enable));
 
-    /* System error? NetCDF and pNetCDF errors are always negative. */
-    if (pioerr > 0)
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (enable && !ios->timing)
+        memset(ios->timers, 0, sizeof(ios->timers));
+    ios->timing = enable;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the total time and number of calls of a timer of an IO system
+ * on this task, since the IO system was created, or since the last
+ * PIOc_reset_timing().
+ *
+ * @param iosysid the IO system ID.
+ * @param name the name of the timer, e.g. "PIO:rearrange_comp2io".
+ * @param time pointer that gets the total time in seconds. Ignored if
+ * NULL.
+ * @param count pointer that gets the number of calls. Ignored if
+ * NULL.
+ * @return 0 for success, PIO_EBADID if the IO system is not found,
+ * PIO_EINVAL if there is no timer of that name.
+ * @author Ed Hartnett
+ */
+int
+PIOc_get_timing(int iosysid, const char *name, double *time, PIO_Offset *count)
+{
+    iosystem_desc_t *ios;
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!name)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    for (int t = 0; t < PIO_NUM_TIMERS; t++)
     {
-        const char *cp = (const char *)strerror(pioerr);
-        if (cp)
-            strncpy(errmsg, cp, PIO_MAX_NAME);
-        else
-            strcpy(errmsg, "Unknown Error");
-    }
-    else if (pioerr == PIO_NOERR)
-        strcpy(errmsg, "No error");
-    else if (pioerr <= NC2_ERR && pioerr >= NC4_LAST_ERROR)     /* NetCDF error? */
-        strncpy(errmsg, nc_strerror(pioerr), PIO_MAX_NAME);
-#if defined(_PNETCDF)
-    else if (pioerr > PIO_FIRST_ERROR_CODE)     /* pNetCDF error? */
-        strncpy(errmsg, ncmpi_strerror(pioerr), PIO_MAX_NAME);
-#endif /* defined( _PNETCDF) */
-    else
-        /* Handle PIO errors. */
-        switch(pioerr)
+        if (!strcmp(name, pio_timer_name[t]))
         {
-        case PIO_EBADIOTYPE:
-            strcpy(errmsg, "Bad IO type");
-            break;
-        case PIO_EVARDIMMISMATCH:
-            strcpy(errmsg, "Variable dim mismatch in multivar call");
-            break;
-        case PIO_EBADREARR:
-            strcpy(errmsg, "Rearranger mismatch in async mode");
-            break;
-        default:
-            strcpy(errmsg, "Unknown Error: Unrecognized error code");
+            if (time)
+                *time = ios->timers[t].total;
+            if (count)
+                *count = ios->timers[t].count;
+            return PIO_NOERR;
         }
+    }
 
-    return PIO_NOERR;
+    return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 }
 
 /**
- * Set the logging level if PIO was built with
- * PIO_ENABLE_LOGGING. Set to -1 for nothing, 0 for errors only, 1 for
- * important logging, and so on. Log levels below 1 are only printed
- * on the io/component root.
- *
- * A log file is also produced for each task. The file is called
- * pio_log_X.txt, where X is the (0-based) task number.
- *
- * If the library is not built with logging, this function does
- * nothing.
+ * Set the total time and number of calls of all timers of an IO
+ * system to 0.
  *
- * @param level the logging level, 0 for errors only, 5 for max
- * verbosity.
- * @returns 0 on success, error code otherwise.
+ * @param iosysid the IO system ID.
+ * @return 0 for success, PIO_EBADID if the IO system is not found.
  * @author Ed Hartnett
  */
 int
-PIOc_set_log_level(int level)
+PIOc_reset_timing(int iosysid)
 {
+    iosystem_desc_t *ios;
 
-#if PIO_ENABLE_LOGGING
-    /* Set the log level. */
-    pio_log_level = level;
-    if(!LOG_FILE)
-        pio_init_logging();
-    PLOG((0,"set loglevel to %d", level));
-#endif /* PIO_ENABLE_LOGGING */
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    for (int t = 0; t < PIO_NUM_TIMERS; t++)
+    {
+        ios->timers[t].total = 0;
+        ios->timers[t].count = 0;
+    }
 
     return PIO_NOERR;
 }
+
 /**
- * Set the logging level value from the root compute task on all tasks
- * if PIO was built with
- * PIO_ENABLE_LOGGING. Set to -1 for nothing, 0 for errors only, 1 for
- * important logging, and so on. Log levels below 1 are only printed
- * on the io/component root.
+ * Record a trace of the library on the tasks of an IO system, to find
+ * the tasks that are slow. The start and end of each of the timed
+ * functions (see PIOc_set_timing()) are kept on each task, which
+ * includes the PIOc_write_darray(), PIOc_write_darray_multi(),
+ * PIOc_read_darray(), PIOc_sync() and PIOc_closefile() calls, the
+ * rearranger, the pio_swapm() exchanges and the pnetcdf
+ * ncmpi_wait_all() calls. This turns the timers of the IO system
+ * on.
  *
- * A log file is also produced for each task. The file is called
- * pio_log_X.txt, where X is the (0-based) task number.
+ * When the IO system is freed, the traces of all its tasks are
+ * written by its first task to the file, in the Chrome trace event
+ * JSON format, which can be viewed with chrome://tracing or
+ * Perfetto. Each task is a process, named by its rank. The times of
+ * the tasks are from the call to this function, which is
+ * synchronized.
  *
- * If the library is not built with logging, this function does
- * nothing.
+ * At most PIO_MAX_TRACE_EVENTS events are kept on each task. There is
+ * one trace for all the IO systems of a task, so the file of each IO
+ * system also has the events of the other IO systems with their
+ * timers on at the same time. The trace is kept until the files of all of them are
+ * written. With async, only the computation tasks are traced.
  *
- * @param iosysid the IO system ID
- * @param level the logging level, 0 for errors only, 5 for max
- * verbosity.
- * @returns 0 on success, error code otherwise.
- * @author Jim Edwards
+ * If the trace of the IO system is already on, its file is written
+ * first, as when the IO system is freed. So a NULL file name writes
+ * the trace and stops it.
+ *
+ * This function must be called on all tasks of the IO system (with
+ * async, all computation tasks), with the same file name.
+ *
+ * @param iosysid the IO system ID.
+ * @param filename name of the trace file, or NULL to stop tracing.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
  */
-int PIOc_set_global_log_level(int iosysid, int level)
+int
+PIOc_set_trace(int iosysid, const char *filename)
 {
-#if PIO_ENABLE_LOGGING
     iosystem_desc_t *ios;
-    int mpierr=0, mpierr2;
+    int mpierr;
+    int ierr;
 
+    PLOG((1, "PIOc_set_trace iosysid = %d filename = %s", iosysid,
+          filename ? filename : "NULL"));
+
+    /* Get the IO system info. */
     if (!(ios = pio_get_iosystem_from_id(iosysid)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    if (ios->async)
+    /* Write the events kept so far. */
+    if (ios->trace_file)
+        if ((ierr = pio_write_trace(ios)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+
+    if (filename)
     {
-        if(!ios->ioproc)
+        /* Start the trace at the same time on all tasks, unless
+         * another IO system has it on already. */
+        if ((mpierr = MPI_Barrier(ios->my_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if (!(ios->trace_file = strdup(filename)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        pio_wrlock(&trace_lock);
+        if (!pio_trace_refs++)
         {
-            int msg = PIO_MSG_SETLOGLEVEL;
-            if (ios->compmaster == MPI_ROOT)
-                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            pio_trace_len = 0;
+            pio_trace_dropped = 0;
+            pio_trace_start = MPI_Wtime();
+            pio_tracing = true;
         }
-
+        pio_unlock(&trace_lock);
+        if (!ios->timing)
+            memset(ios->timers, 0, sizeof(ios->timers));
+        ios->timing = true;
     }
-    if (!mpierr)
-        mpierr = MPI_Bcast(&level, 1, MPI_INT, ios->comproot, ios->union_comm);
 
-    /* Handle MPI errors. */
-    if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-        check_mpi(ios, NULL, mpierr2, __FILE__, __LINE__);
-    if (mpierr)
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
 
+/** The bytes allocated by the library in each PIO_MEM_* category on
+ * this task, now and at most. */
+static PIO_Offset pio_mem_current[PIO_MEM_NUM_CAT];
+static PIO_Offset pio_mem_peak[PIO_MEM_NUM_CAT];
 
-    /* Set the log level on all tasks */
-    PIOc_set_log_level(level);
-    PLOG((level, "set_global_log_level, level = %d", level));
+#if PIO_THREADS
+/** Lock of the memory counts, which threads using different IO
+ * systems change at the same time. */
+static pthread_rwlock_t mem_lock = PTHREAD_RWLOCK_INITIALIZER;
 #endif
-    return PIO_NOERR;
+
+/** The names of the PIO_MEM_* categories, for the log. */
+static const char *pio_mem_name[PIO_MEM_NUM_CAT] = {
+    "wmb", "iobuf", "fillbuf", "index", "mpitype", "msg", "accum", "read_cache"};
+
+/** Header in front of each counted allocation, keeping its size. The
+ * union keeps the memory after it aligned for any type. */
+typedef union pio_mem_hdr
+{
+    size_t size;
+    long double ld;
+    long long ll;
+    void *p;
+} pio_mem_hdr;
+
+/* Count size bytes (negative when freed) in a category. */
+static void
+pio_mem_count(int category, PIO_Offset size)
+{
+    pioassert(category >= 0 && category < PIO_MEM_NUM_CAT, "invalid category",
+              __FILE__, __LINE__);
+
+    pio_wrlock(&mem_lock);
+    pio_mem_current[category] += size;
+    if (pio_mem_current[category] > pio_mem_peak[category])
+        pio_mem_peak[category] = pio_mem_current[category];
+    pio_unlock(&mem_lock);
 }
 
+/**
+ * Allocate memory, counted in a category, see PIOc_get_mem_usage().
+ * Free it with pio_free(). Unlike malloc(), this never returns NULL
+ * for a size of 0, unless out of memory.
+ *
+ * @param category the PIO_MEM_* category.
+ * @param size the number of bytes.
+ * @returns pointer to the memory, or NULL if out of memory.
+ * @author Ed Hartnett
+ */
+void *
+pio_malloc(int category, size_t size)
+{
+    pio_mem_hdr *hdr;
 
-#ifdef USE_MPE
+    if (!(hdr = malloc(sizeof(pio_mem_hdr) + size)))
+        return NULL;
+    hdr->size = size;
+    pio_mem_count(category, size);
 
-/* This array holds even numbers for MPE. */
-int event_num[2][NUM_EVENTS];
+    return hdr + 1;
+}
 
-/* This keeps track of whether MPE has been initialized. */
-int mpe_logging_initialized = 0;
+/**
+ * Allocate memory set to 0, counted in a category. Free it with
+ * pio_free().
+ *
+ * @param category the PIO_MEM_* category.
+ * @param nmemb the number of elements.
+ * @param size the size of an element.
+ * @returns pointer to the memory, or NULL if out of memory.
+ * @author Ed Hartnett
+ */
+void *
+pio_calloc(int category, size_t nmemb, size_t size)
+{
+    pio_mem_hdr *hdr;
 
-/** This will set up the MPE logging event numbers. The calling
- * program does not need to call MPE_Init_log(), that is done by the
- * mpe library in MPI_Init(). MPE must be installed, get it from
- * https://www.mcs.anl.gov/research/projects/perfvis/software/MPE/. PIO
- * and the whole I/O stack must be built with MPE.
+    if (!(hdr = calloc(1, sizeof(pio_mem_hdr) + nmemb * size)))
+        return NULL;
+    hdr->size = nmemb * size;
+    pio_mem_count(category, hdr->size);
+
+    return hdr + 1;
+}
+
+/**
+ * Change the size of memory from pio_malloc(), pio_calloc() or
+ * pio_realloc(), or allocate it if ptr is NULL. As with realloc(),
+ * the memory is left as it was if this fails.
  *
- * @param my_rank rank of processor in MPI_COMM_WORLD.
+ * @param category the PIO_MEM_* category, which must not change.
+ * @param ptr pointer to the memory, or NULL.
+ * @param size the new number of bytes.
+ * @returns pointer to the memory, or NULL if out of memory.
  * @author Ed Hartnett
  */
-int
-init_mpe(int my_rank)
+void *
+pio_realloc(int category, void *ptr, size_t size)
 {
-    /* If we've already initialized MPE states, just return. */
-    if (mpe_logging_initialized++)
-        return 0;
+    pio_mem_hdr *hdr;
+    size_t old_size;
 
-    /* Get a bunch of event numbers. */
-    event_num[START][INIT] = MPE_Log_get_event_number();
-    event_num[END][INIT] = MPE_Log_get_event_number();
-    event_num[START][DECOMP] = MPE_Log_get_event_number();
-    event_num[END][DECOMP] = MPE_Log_get_event_number();
-    event_num[START][CREATE] = MPE_Log_get_event_number();
-    event_num[END][CREATE] = MPE_Log_get_event_number();
-    event_num[START][OPEN] = MPE_Log_get_event_number();
-    event_num[END][OPEN] = MPE_Log_get_event_number();
-    event_num[START][DARRAY_WRITE] = MPE_Log_get_event_number();
-    event_num[END][DARRAY_WRITE] = MPE_Log_get_event_number();
-    event_num[START][CLOSE] = MPE_Log_get_event_number();
-    event_num[END][CLOSE] = MPE_Log_get_event_number();
-    event_num[START][DARRAY_READ] = MPE_Log_get_event_number();
-    event_num[END][DARRAY_READ] = MPE_Log_get_event_number();
+    if (!ptr)
+        return pio_malloc(category, size);
 
-    /* On rank 0, set up the info states. */
-    if (!my_rank)
-    {
-        /* Available colors: "white", "black", "red", "yellow", "green",
-           "cyan", "blue", "magenta", "aquamarine", "forestgreen",
-           "orange", "marroon", "brown", "pink", "coral", "gray" */
-        MPE_Describe_info_state(event_num[START][INIT], event_num[END][INIT],
-                                "PIO init", "green", "%s");
-        MPE_Describe_info_state(event_num[START][DECOMP],
-                                event_num[END][DECOMP], "PIO decomposition",
-                                "cyan", "%s");
-        MPE_Describe_info_state(event_num[START][CREATE], event_num[END][CREATE],
-                                "PIO create file", "red", "%s");
-        MPE_Describe_info_state(event_num[START][OPEN], event_num[END][OPEN],
-                                "PIO open file", "orange", "%s");
-        MPE_Describe_info_state(event_num[START][DARRAY_WRITE],
-                                event_num[END][DARRAY_WRITE], "PIO darray write",
-                                "pink", "%s");
-        MPE_Describe_info_state(event_num[START][DARRAY_READ],
-                                event_num[END][DARRAY_READ], "PIO darray read",
-                                "magenta", "%s");
-        MPE_Describe_info_state(event_num[START][CLOSE],
-                                event_num[END][CLOSE], "PIO close",
-                                "white", "%s");
-    }
-    return 0;
-}
+    old_size = ((pio_mem_hdr *)ptr - 1)->size;
+    if (!(hdr = realloc((pio_mem_hdr *)ptr - 1, sizeof(pio_mem_hdr) + size)))
+        return NULL;
+    hdr->size = size;
+    pio_mem_count(category, (PIO_Offset)size - (PIO_Offset)old_size);
 
-/**
- * Start MPE logging.
- *
- * @param state_num the MPE event state number to START (ex. INIT).
- * @author Ed Hartnett
- */
-void
-pio_start_mpe_log(int state)
-{
-    if (MPE_Log_event(event_num[START][state], 0, NULL))
-        pio_err(NULL, NULL, PIO_EIO, __FILE__, __LINE__);
+    return hdr + 1;
 }
 
 /**
- * End MPE logging.
+ * Free memory from pio_malloc(), pio_calloc() or pio_realloc().
  *
- * @param state one of the MPE states defined in pio_internal.h.
- * @param msg a text message to describe the state. Will be truncated
- * to MPE_MAX_MSG_LEN.
+ * @param category the PIO_MEM_* category it was allocated in.
+ * @param ptr pointer to the memory. Ignored if NULL.
  * @author Ed Hartnett
  */
 void
-pio_stop_mpe_log(int state, const char *msg)
+pio_free(int category, void *ptr)
 {
-    MPE_LOG_BYTES bytebuf;
-    int pos = 0;
-    int msglen;
-    int ret;
+    pio_mem_hdr *hdr;
 
-    /* Truncate messages longer than MPE_MAX_MSG_LEN. */
-    msglen = strlen(msg) > MPE_MAX_MSG_LEN ? MPE_MAX_MSG_LEN : strlen(msg);
+    if (!ptr)
+        return;
 
-    /* Tell MPE to stop the state, with a message. */
-    MPE_Log_pack(bytebuf, &pos, 's', msglen, msg);
-    if ((ret = MPE_Log_event(event_num[END][state], 0, bytebuf)))
-        pio_err(NULL, NULL, PIO_EIO, __FILE__, __LINE__);
+    hdr = (pio_mem_hdr *)ptr - 1;
+    pio_mem_count(category, -(PIO_Offset)hdr->size);
+    free(hdr);
 }
 
-#endif /* USE_MPE */
+/** Header of the darray buffers of the IO tasks, which keeps how
+ * they were allocated, and links them in the pool of the IO
+ * system. */
+typedef union pio_iobuf_hdr
+{
+    struct
+    {
+        union pio_iobuf_hdr *next; /* Next buffer of the pool. */
+        size_t size;               /* Bytes after the header. */
+        bool mpi_mem;              /* True if from MPI_Alloc_mem(). */
+    } b;
+    long double ld;
+    long long ll;
+    void *p;
+} pio_iobuf_hdr;
+
+/* Give the memory of a darray buffer back to the system. */
+static void
+pio_iobuf_release(pio_iobuf_hdr *hdr)
+{
+    pio_mem_count(PIO_MEM_IOBUF, -(PIO_Offset)hdr->b.size);
+    if (hdr->b.mpi_mem)
+        MPI_Free_mem(hdr);
+    else
+        free(hdr);
+}
 
 /**
- * Initialize logging.  Open log file, if not opened yet, or increment
- * ref count if already open.
+ * Allocate a darray buffer of the IO tasks, counted in
+ * PIO_MEM_IOBUF. The smallest buffer of the pool of the IO system
+ * that is large enough is used, if there is one. Free it with
+ * pio_iobuf_free(). As with pio_malloc(), a size of 0 gives a
+ * buffer.
  *
- * @author Jayesh Krishna, Ed Hartnett
+ * @param ios pointer to the IO system info.
+ * @param size the number of bytes.
+ * @returns pointer to the buffer, or NULL if out of memory.
+ * @author Ed Hartnett
  */
-int
-pio_init_logging(void)
+void *
+pio_iobuf_alloc(iosystem_desc_t *ios, size_t size)
 {
-    int ret = PIO_NOERR;
-
-#ifdef USE_MPE
-    {
-        int mpe_rank;
-        int mpierr;
+    pio_iobuf_hdr **best = NULL;
+    pio_iobuf_hdr *hdr;
 
-        if ((mpierr = MPI_Comm_rank(MPI_COMM_WORLD, &mpe_rank)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-        if ((ret = init_mpe(mpe_rank)))
-            return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
-    }
-#endif /* USE_MPE */
-
-#if PIO_ENABLE_LOGGING
-    if (!LOG_FILE && pio_log_level > 0)
-    {
-        char log_filename[PIO_MAX_NAME];
-        int mpierr;
-
-        /* Create a filename with the rank in it. */
-        if ((mpierr = MPI_Comm_rank(MPI_COMM_WORLD, &my_rank)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        sprintf(log_filename, "pio_log_%d.log", my_rank);
-
-        /* Open a file for this rank to log messages. */
-        if (!(LOG_FILE = fopen(log_filename, "w")))
-            return pio_err(NULL, NULL, PIO_EIO, __FILE__, __LINE__);
+    pioassert(ios, "invalid input", __FILE__, __LINE__);
 
-        pio_log_ref_cnt = 1;
-    }
-    else if(LOG_FILE)
+    /* Look for a buffer in the pool. */
+    for (pio_iobuf_hdr **h = (pio_iobuf_hdr **)&ios->iobuf_pool; *h; h = &(*h)->b.next)
+        if ((*h)->b.size >= size && (!best || (*h)->b.size < (*best)->b.size))
+            best = h;
+    if (best)
     {
-        pio_log_ref_cnt++;
+        hdr = *best;
+        *best = hdr->b.next;
+        ios->iobuf_pool_bytes -= hdr->b.size;
+        PLOG((3, "pio_iobuf_alloc size %lld from pool buffer of %lld", (long long)size,
+              (long long)hdr->b.size));
+        return hdr + 1;
     }
-#endif /* PIO_ENABLE_LOGGING */
-
-    return ret;
-}
 
-/**
- * Finalize logging - close log files, if open.
- */
-void
-pio_finalize_logging(void)
-{
-#if PIO_ENABLE_LOGGING
-    pio_log_ref_cnt -= 1;
-    if (LOG_FILE)
+    /* Allocate a new one. If that fails, give back the pool and try
+     * again. */
+    for (int tries = 0; tries < 2; tries++)
     {
-        if (pio_log_ref_cnt == 0)
+        if (ios->iobuf_mpi_mem)
         {
-            fclose(LOG_FILE);
-            LOG_FILE = NULL;
+            if (MPI_Alloc_mem(sizeof(pio_iobuf_hdr) + size, MPI_INFO_NULL, &hdr))
+                hdr = NULL;
         }
         else
-            PLOG((2, "pio_finalize_logging, postpone close, ref_cnt = %d",
-                  pio_log_ref_cnt));
+            hdr = malloc(sizeof(pio_iobuf_hdr) + size);
+        if (hdr || !ios->iobuf_pool)
+            break;
+        pio_iobuf_pool_free(ios);
     }
-#endif /* PIO_ENABLE_LOGGING */
+    if (!hdr)
+        return NULL;
+
+    hdr->b.next = NULL;
+    hdr->b.size = size;
+    hdr->b.mpi_mem = ios->iobuf_mpi_mem;
+    pio_mem_count(PIO_MEM_IOBUF, size);
+
+    return hdr + 1;
 }
 
-#if PIO_ENABLE_LOGGING
 /**
- * This function prints out a message, if the severity of the message
- * is lower than the global pio_log_level. To use it, do something
- * like this:
- *
- * pio_log(0, "this computer will explode in %d seconds", i);
- *
- * After the first arg (the severity), use the rest like a normal
- * printf statement. Output will appear on stdout.
- * This function is heavily based on the function in section 15.5 of
- * the C FAQ.
- *
- * In code this functions should be wrapped in the PLOG(()) macro.
+ * Free a darray buffer from pio_iobuf_alloc(). It is kept in the
+ * pool of the IO system when the pool is on and the buffer is no
+ * larger than the pool, and the oldest buffers of the pool are freed
+ * to keep the pool within its size.
  *
- * @param severity the severity of the message, 0 for error messages,
- * then increasing levels of verbosity.
- * @param fmt the format string.
- * @param ... the arguments used in format string.
+ * @param ios pointer to the IO system info.
+ * @param buf pointer to the buffer. Ignored if NULL.
  * @author Ed Hartnett
  */
 void
-pio_log(int severity, const char *fmt, ...)
+pio_iobuf_free(iosystem_desc_t *ios, void *buf)
 {
-    va_list argp;
-    int t;
-    int rem_len = MAX_LOG_MSG;
-    char msg[MAX_LOG_MSG];
-    char *ptr = msg;
-    char rank_str[MAX_RANK_STR];
+    pio_iobuf_hdr *hdr;
 
-    /* If the severity is greater than the log level, we don't print
-       this message. */
-    if (severity > pio_log_level)
-        return;
+    pioassert(ios, "invalid input", __FILE__, __LINE__);
 
-    /* If the severity is 0, only print on rank 0. */
-    if (severity < 1 && my_rank != 0)
+    if (!buf)
         return;
+    hdr = (pio_iobuf_hdr *)buf - 1;
 
-    /* If the severity is zero, this is an error. Otherwise insert that
-       many tabs before the message. */
-    if (!severity)
-    {
-        strncpy(ptr, ERROR_PREFIX, (rem_len > 0) ? rem_len : 0);
-        ptr += strlen(ERROR_PREFIX);
-        rem_len -= strlen(ERROR_PREFIX);
-    }
-
-    for (t = 0; t < severity; t++)
+    /* Without a pool, or for buffers that do not fit or are of the
+     * other kind of memory, just free it. */
+    if (!ios->iobuf_pool_max || (PIO_Offset)hdr->b.size > ios->iobuf_pool_max ||
+        hdr->b.mpi_mem != ios->iobuf_mpi_mem)
     {
-        strncpy(ptr++, "\t", (rem_len > 0) ? rem_len : 0);
-        rem_len--;
+        pio_iobuf_release(hdr);
+        return;
     }
 
-    /* Show the rank. */
-    snprintf(rank_str, MAX_RANK_STR, "%d ", my_rank);
-    strncpy(ptr, rank_str, (rem_len > 0) ? rem_len : 0);
-    ptr += strlen(rank_str);
-    rem_len -= strlen(rank_str);
-
-    /* /\* Show the severity. *\/ */
-    /* snprintf(rank_str, MAX_RANK_STR, ":%d ", severity); */
-    /* strncpy(ptr, rank_str, (rem_len > 0) ? rem_len : 0); */
-    /* ptr += strlen(rank_str); */
-    /* rem_len -= strlen(rank_str); */
+    /* The newest buffer is first. */
+    hdr->b.next = ios->iobuf_pool;
+    ios->iobuf_pool = hdr;
+    ios->iobuf_pool_bytes += hdr->b.size;
 
-    /* Print out the variable list of args with vprintf. */
-    va_start(argp, fmt);
-    vsnprintf(ptr, ((rem_len > 0) ? rem_len : 0), fmt, argp);
-    va_end(argp);
+    /* Free the oldest until the pool is within its size. */
+    while (ios->iobuf_pool_bytes > ios->iobuf_pool_max)
+    {
+        pio_iobuf_hdr **last = (pio_iobuf_hdr **)&ios->iobuf_pool;
 
-    /* Put on a final linefeed. */
-    ptr = msg + strlen(msg);
-    rem_len = MAX_LOG_MSG - strlen(msg);
-    strncpy(ptr, "\n\0", (rem_len > 0) ? rem_len : 0);
+        while ((*last)->b.next)
+            last = &(*last)->b.next;
+        ios->iobuf_pool_bytes -= (*last)->b.size;
+        pio_iobuf_release(*last);
+        *last = NULL;
+    }
+}
 
-    /* Send message to stdout. */
-    fprintf(stdout, "%s", msg);
+/**
+ * Free the darray buffers in the pool of an IO system.
+ *
+ * @param ios pointer to the IO system info.
+ * @author Ed Hartnett
+ */
+void
+pio_iobuf_pool_free(iosystem_desc_t *ios)
+{
+    pioassert(ios, "invalid input", __FILE__, __LINE__);
 
-    /* Send message to log file. */
-    if (LOG_FILE)
-        fprintf(LOG_FILE, "%s", msg);
+    while (ios->iobuf_pool)
+    {
+        pio_iobuf_hdr *hdr = ios->iobuf_pool;
 
-    /* Ensure an immediate flush of stdout. */
-    fflush(stdout);
-    if (LOG_FILE)
-        fflush(LOG_FILE);
+        ios->iobuf_pool = hdr->b.next;
+        pio_iobuf_release(hdr);
+    }
+    ios->iobuf_pool_bytes = 0;
 }
-#endif /* PIO_ENABLE_LOGGING */
 
 /**
- * Obtain a backtrace and print it to stderr. This is appended to the
- * text decomposition file.
+ * Keep the darray buffers of the IO tasks of an IO system for reuse,
+ * instead of freeing them after each write or read. The buffers hold
+ * the data of all the variables of a multi-variable write, so they
+ * can be large, and allocating them again for each write costs page
+ * faults.
  *
- * Note from Jim:
+ * A freed buffer is kept when the buffers kept would be no more than
+ * max_bytes, freeing the oldest if needed, and the smallest buffer
+ * that is large enough is used for the next write or read. The
+ * buffers kept are counted in PIO_MEM_IOBUF, see
+ * PIOc_get_mem_usage().
  *
- * The stack trace can be used to identify the usage in
- * the model code of the particular decomposition in question and so
- * if using the pio performance tool leads to tuning that could be
- * applied in the model you know more or less where to do it.
+ * With mpi_mem, the buffers are allocated with MPI_Alloc_mem(), which
+ * some MPI libraries register with the network, to make RDMA
+ * transfers to and from them faster.
  *
- * It's also useful if you have a model bug - then you have 20 or so
- * decomp files and you need to identify the one that was problematic.
- * So it's used as an add to the developer and not used at all by any
- * automated process or tools.
+ * This function must be called on all tasks of the IO system. It
+ * frees the buffers kept so far. In async mode it has no effect on
+ * the IO tasks.
  *
- * @param fp file pointer to send output to
- * @author Jim Edwards
+ * @param iosysid the IO system ID.
+ * @param max_bytes the most bytes kept on each IO task, or 0 to free
+ * the buffers (the default).
+ * @param mpi_mem true to allocate the buffers with MPI_Alloc_mem().
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
  */
-void
-print_trace(FILE *fp)
+int
+PIOc_set_iobuf_pool(int iosysid, PIO_Offset max_bytes, bool mpi_mem)
 {
-    void *array[10];
-    size_t size;
-    char **strings;
-    size_t i;
+    iosystem_desc_t *ios;
 
-    /* Note that this won't actually work. */
-    if (fp == NULL)
-        fp = stderr;
+    PLOG((1, "PIOc_set_iobuf_pool iosysid = %d max_bytes = %lld mpi_mem = %d", iosysid,
+          (long long)max_bytes, mpi_mem));
 
-    size = backtrace(array, 10);
-    strings = backtrace_symbols(array, size);
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    fprintf(fp,"Obtained %zd stack frames.\n", size);
+    if (max_bytes < 0)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    for (i = 0; i < size; i++)
-        fprintf(fp,"%s\n", strings[i]);
+    pio_iobuf_pool_free(ios);
+    ios->iobuf_pool_max = max_bytes;
+    ios->iobuf_mpi_mem = mpi_mem;
 
-    free(strings);
+    return PIO_NOERR;
 }
 
 /**
- * Abort program and call MPI_Abort().
+ * Get the memory allocated by the library on this task in a
+ * category, to find what holds the memory of the IO tasks. Only the
+ * large buffers of the library are counted: the multi-var write
+ * buffers of the computation tasks (PIO_MEM_WMB), the darray buffers
+ * of the IO tasks (PIO_MEM_IOBUF), the fill value buffers of the
+ * holes of decompositions (PIO_MEM_FILLBUF), the sindex and rindex
+ * arrays of decompositions (PIO_MEM_INDEX), the arrays of the MPI
+ * types of decompositions (PIO_MEM_MPITYPE, not counting the memory
+ * of the types inside MPI) and the buffers of the async messages
+ * (PIO_MEM_MSG).
  *
- * @param msg an error message
- * @param fname name of code file where error occured
- * @param line the line of code where the error occurred.
- * @author Jim Edwards
+ * The memory of all categories is logged at level 1 when an IO
+ * system is freed.
+ *
+ * @param category the PIO_MEM_* category.
+ * @param current pointer that gets the bytes allocated now. Ignored
+ * if NULL.
+ * @param peak pointer that gets the most bytes allocated at any time
+ * since the start of the program. Ignored if NULL.
+ * @return 0 for success, PIO_EINVAL for a bad category.
+ * @author Ed Hartnett
  */
-void
-piodie(const char *msg, const char *fname, int line)
+int
+PIOc_get_mem_usage(int category, PIO_Offset *current, PIO_Offset *peak)
 {
-    fprintf(stderr,"Abort with message %s in file %s at line %d\n",
-            msg ? msg : "_", fname ? fname : "_", line);
+    if (category < 0 || category >= PIO_MEM_NUM_CAT)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    print_trace(stderr);
-#ifdef _MPISERIAL
-    abort();
-#else
-    MPI_Abort(MPI_COMM_WORLD, -1);
-#endif
+    pio_rdlock(&mem_lock);
+    if (current)
+        *current = pio_mem_current[category];
+    if (peak)
+        *peak = pio_mem_peak[category];
+    pio_unlock(&mem_lock);
+
+    return PIO_NOERR;
 }
 
 /**
- * Perform an assert. Note that this function does nothing if NDEBUG
- * is defined.
+ * Log the memory allocated by the library on this task, see
+ * PIOc_get_mem_usage().
  *
- * @param expression the expression to be evaluated
- * @param msg an error message
- * @param fname name of code file where error occured
- * @param line the line of code where the error occurred.
- * @author Jim Edwards
+ * @author Ed Hartnett
  */
 void
-pioassert(_Bool expression, const char *msg, const char *fname, int line)
+pio_log_mem_usage(void)
 {
-#ifndef NDEBUG
-    if (!expression)
-        piodie(msg, fname, line);
-#endif
+    for (int c = 0; c < PIO_MEM_NUM_CAT; c++)
+        PLOG((1, "memory %s current = %lld peak = %lld", pio_mem_name[c],
+              pio_mem_current[c], pio_mem_peak[c]));
 }
 
 /**
- * Handle MPI errors. An error message is sent to stderr, then the
- * check_netcdf() function is called with PIO_EIO.
+ * Write the trace of the tasks of an IO system to its trace file. The
+ * first task of ios->my_comm gets the events of each of the other
+ * tasks in turn, and writes them. The other tasks only send their
+ * events if the first task could open the file and allocate room for
+ * them, so an error there does not leave any task waiting.
  *
- * @param ios pointer to the iosystem_info_t. May be NULL.
- * @param file pointer to the file_desc_t info. Ignored if NULL.
- * @param mpierr the MPI return code to handle
- * @param filename the name of the code file where error occured.
- * @param line the line of code where error occured.
- * @return PIO_NOERR for no error, otherwise PIO_EIO.
+ * @param ios pointer to the IO system info.
+ * @param trace the events of this task.
+ * @param len the number of events.
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
-int
-check_mpi(iosystem_desc_t *ios, file_desc_t *file, int mpierr,
-          const char *filename, int line)
+static int
+write_trace_file(iosystem_desc_t *ios, pio_trace_event *trace, int len)
 {
-    if (mpierr)
+    FILE *fp = NULL;
+    int my_rank, ntasks;
+    int ferr = PIO_NOERR;
+    int mpierr;
+
+    if ((mpierr = MPI_Comm_rank(ios->my_comm, &my_rank)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_size(ios->my_comm, &ntasks)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "write_trace_file %d events", len));
+
+    if (my_rank)
     {
-        char errstring[MPI_MAX_ERROR_STRING];
-        int errstrlen;
+        int ok;
 
-        /* If we can get an error string from MPI, print it to stderr. */
-        if (!MPI_Error_string(mpierr, errstring, &errstrlen))
-            fprintf(stderr, "MPI ERROR: %s in file %s at line %d\n",
-                    errstring, filename ? filename : "_", line);
+        /* Send the number of events to the first task, and the
+         * events if it can take them. */
+        if ((mpierr = MPI_Send(&len, 1, MPI_INT, 0, 0, ios->my_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if (len)
+        {
+            if ((mpierr = MPI_Recv(&ok, 1, MPI_INT, 0, 0, ios->my_comm, MPI_STATUS_IGNORE)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            if (ok)
+                if ((mpierr = MPI_Send(trace, len * sizeof(pio_trace_event), MPI_BYTE, 0, 0,
+                                       ios->my_comm)))
+                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
+    }
+    else
+    {
+        pio_trace_event *events = trace;
+        int nevents = len;
+        int first = 1;
 
-        /* Handle all MPI errors as PIO_EIO. */
-        return pio_err(ios, file, PIO_EIO, filename, line);
+        if (!(fp = fopen(ios->trace_file, "w")))
+            ferr = PIO_EIO;
+        else
+            fprintf(fp, "{\"traceEvents\":[\n");
+
+        for (int t = 0; t < ntasks; t++)
+        {
+            /* Get the events of the other tasks. */
+            if (t)
+            {
+                int ok;
+
+                if ((mpierr = MPI_Recv(&nevents, 1, MPI_INT, t, 0, ios->my_comm,
+                                       MPI_STATUS_IGNORE)))
+                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+                events = NULL;
+                if (nevents)
+                {
+                    if (fp && !(events = malloc(nevents * sizeof(pio_trace_event))))
+                        ferr = PIO_ENOMEM;
+                    ok = events != NULL;
+                    if ((mpierr = MPI_Send(&ok, 1, MPI_INT, t, 0, ios->my_comm)))
+                    {
+                        free(events);
+                        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+                    }
+                    if (ok)
+                    {
+                        if ((mpierr = MPI_Recv(events, nevents * sizeof(pio_trace_event),
+                                               MPI_BYTE, t, 0, ios->my_comm, MPI_STATUS_IGNORE)))
+                        {
+                            free(events);
+                            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+                        }
+                    }
+                    else
+                        nevents = 0;
+                }
+            }
+
+            /* Write them, with the times in microseconds. */
+            if (fp)
+            {
+                fprintf(fp, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                        "\"args\":{\"name\":\"task %d\"}}", first ? "" : ",\n", t, t);
+                first = 0;
+                for (int e = 0; e < nevents; e++)
+                    fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,"
+                            "\"ts\":%.3f,\"dur\":%.3f}", pio_timer_name[events[e].timer], t,
+                            events[e].start * 1e6, (events[e].end - events[e].start) * 1e6);
+            }
+            if (t)
+                free(events);
+        }
+
+        if (fp)
+        {
+            fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+            if (fclose(fp))
+                ferr = PIO_EIO;
+        }
     }
+
+    /* Tell all tasks whether the file was written. */
+    if ((mpierr = MPI_Bcast(&ferr, 1, MPI_INT, 0, ios->my_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (ferr)
+        return pio_err(ios, NULL, ferr, __FILE__, __LINE__);
+
     return PIO_NOERR;
 }
 
 /**
- * Check the result of a netCDF API call.
+ * Write the trace of the tasks of an IO system to its trace file, see
+ * PIOc_set_trace(), and turn off the trace of the IO system. The
+ * events are freed when no other IO system has the trace on. Called
+ * on the tasks of ios->my_comm from PIOc_set_trace() and
+ * PIOc_free_iosystem().
  *
- * @param file pointer to the PIO structure describing this
- * file. Ignored if NULL.
- * @param status the return value from the netCDF call.
- * @param fname the name of the code file.
- * @param line the line number of the netCDF call in the code.
- * @return the error code
+ * @param ios pointer to the IO system info.
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
 int
-check_netcdf(file_desc_t *file, int status, const char *fname, int line)
+pio_write_trace(iosystem_desc_t *ios)
 {
-    return check_netcdf2(NULL, file, status, fname, line);
+    pio_trace_event *trace = NULL;
+    int len = 0;
+    int ierr = PIO_NOERR;
+    int ret;
+
+    pioassert(ios && ios->trace_file, "invalid input", __FILE__, __LINE__);
+
+    /* Copy the events, so that other threads can add to the trace
+     * while they are sent. */
+    pio_rdlock(&trace_lock);
+    PLOG((2, "pio_write_trace %d events, %lld dropped", pio_trace_len,
+          (long long)pio_trace_dropped));
+    if (pio_trace_len && (trace = malloc(pio_trace_len * sizeof(pio_trace_event))))
+    {
+        memcpy(trace, pio_trace, pio_trace_len * sizeof(pio_trace_event));
+        len = pio_trace_len;
+    }
+    else if (pio_trace_len)
+        ierr = PIO_ENOMEM;
+    pio_unlock(&trace_lock);
+
+    /* Without room for the copy, the events of this task are left
+     * out, but the others are still written. */
+    if ((ret = write_trace_file(ios, trace, len)))
+        ierr = ret;
+    free(trace);
+
+    free(ios->trace_file);
+    ios->trace_file = NULL;
+    pio_wrlock(&trace_lock);
+    if (!--pio_trace_refs)
+    {
+        free(pio_trace);
+        pio_trace = NULL;
+        pio_trace_len = 0;
+        pio_trace_size = 0;
+        pio_tracing = false;
+    }
+    pio_unlock(&trace_lock);
+
+    return ierr;
 }
 
 /**
- * Check the result of a netCDF API call. This is the same as
- * check_netcdf() except for the extra iosystem_desc_t pointer, which
- * is used to determine error handling when there is no file_desc_t
- * pointer.
+ * Return a string description of an error code. If zero is passed,
+ * the errmsg will be "No error".
  *
- * @param ios pointer to the iosystem description struct. Ignored if NULL.
- * @param file pointer to the PIO structure describing this file. Ignored if NULL.
- * @param status the return value from the netCDF call.
- * @param fname the name of the code file.
- * @param line the line number of the netCDF call in the code.
- * @return the error code
- * @author Ed Hartnett
+ * @param pioerr the error code returned by a PIO function call.
+ * @param errmsg Pointer that will get the error message. The message
+ * will be PIO_MAX_NAME chars or less.
+ * @return 0 on success.
+ * @author Jim Edwards
  */
 int
-check_netcdf2(iosystem_desc_t *ios, file_desc_t *file, int status,
-              const char *fname, int line)
+PIOc_strerror(int pioerr, char *errmsg)
 {
-    int eh = default_error_handler; /* Error handler that will be used. */
-    int rbuf;
-    /* User must provide this. */
-    pioassert(fname, "code file name must be provided", __FILE__, __LINE__);
+    PLOG((1, "PIOc_strerror pioerr = %d", pioerr));
 
-    if (file && file->iosystem->ioproc &&
-        (file->iotype == PIO_IOTYPE_PNETCDF || file->iotype == PIO_IOTYPE_NETCDF4P))
+    /* Caller must provide this. */
+    pioassert(errmsg, "pointer to errmsg string must be provided", __FILE__,
+              __LINE__);
+
+    /* System error? NetCDF and pNetCDF errors are always negative. */
+    if (pioerr > 0)
     {
-        if (file->iosystem->io_rank == 0)
-            MPI_Reduce(MPI_IN_PLACE, &status, 1, MPI_INT, MPI_MIN, 0, file->iosystem->io_comm);
+        const char *cp = (const char *)strerror(pioerr);
+        if (cp)
+            strncpy(errmsg, cp, PIO_MAX_NAME);
         else
-            MPI_Reduce(&status, &rbuf, 1, MPI_INT, MPI_MIN, 0, file->iosystem->io_comm);
+            strcpy(errmsg, "Unknown Error");
     }
+    else if (pioerr == PIO_NOERR)
+        strcpy(errmsg, "No error");
+    else if (pioerr <= NC2_ERR && pioerr >= NC4_LAST_ERROR)     /* NetCDF error? */
+        strncpy(errmsg, nc_strerror(pioerr), PIO_MAX_NAME);
+#if defined(_PNETCDF)
+    else if (pioerr > PIO_FIRST_ERROR_CODE)     /* pNetCDF error? */
+        strncpy(errmsg, ncmpi_strerror(pioerr), PIO_MAX_NAME);
+#endif /* defined( _PNETCDF) */
+    else
+        /* Handle PIO errors. */
+        switch(pioerr)
+        {
+        case PIO_EBADIOTYPE:
+            strcpy(errmsg, "Bad IO type");
+            break;
+        case PIO_EVARDIMMISMATCH:
+            strcpy(errmsg, "Variable dim mismatch in multivar call");
+            break;
+        case PIO_EBADREARR:
+            strcpy(errmsg, "Rearranger mismatch in async mode");
+            break;
+        default:
+            strcpy(errmsg, "Unknown Error: Unrecognized error code");
+        }
 
-    PLOG((1, "check_netcdf2 status = %d fname = %s line = %d", status, fname, line));
+    return PIO_NOERR;
+}
 
-    /* Pick an error handler. */
-    if (ios)
-        eh = ios->error_handler;
-    if (file)
-        eh = file->iosystem->error_handler;
-    pioassert(eh == PIO_INTERNAL_ERROR || eh == PIO_BCAST_ERROR || eh == PIO_RETURN_ERROR,
-              "invalid error handler", __FILE__, __LINE__);
-    PLOG((2, "check_netcdf2 chose error handler = %d", eh));
+/**
+ * Set the logging level if PIO was built with
+ * PIO_ENABLE_LOGGING. Set to -1 for nothing, 0 for errors only, 1 for
+ * important logging, and so on. Log levels below 1 are only printed
+ * on the io/component root.
+ *
+ * A log file is also produced for each task. The file is called
+ * pio_log_X.txt, where X is the (0-based) task number.
+ *
+ * If the library is not built with logging, this function does
+ * nothing.
+ *
+ * @param level the logging level, 0 for errors only, 5 for max
+ * verbosity.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_log_level(int level)
+{
 
-    /* Decide what to do based on the error handler. */
-    if (eh == PIO_INTERNAL_ERROR && status != PIO_NOERR)
-    {
-        char errmsg[PIO_MAX_NAME + 1];  /* Error message. */
-        PIOc_strerror(status, errmsg);
-        piodie(errmsg, fname, line);        /* Die! */
-    }
-    else if (eh == PIO_BCAST_ERROR)
-    {
-        if (ios)
-            MPI_Bcast(&status, 1, MPI_INT, ios->ioroot, ios->my_comm);
-        else if (file)
-            MPI_Bcast(&status, 1, MPI_INT, file->iosystem->ioroot, file->iosystem->my_comm);
-        PLOG((2, "check_netcdf2 status returned = %d", status));
-    }
+#if PIO_ENABLE_LOGGING
+    /* Set the log level, of all subsystems. */
+    pio_log_level = level;
+    for (int s = 0; s < PIO_LOG_NUM_SUBSYS; s++)
+        pio_log_levels[s] = level;
+    if(!LOG_FILE)
+        pio_init_logging();
+    PLOG((0,"set loglevel to %d", level));
+#endif /* PIO_ENABLE_LOGGING */
 
-    /* For PIO_RETURN_ERROR, just return the error. */
-    return status;
+    return PIO_NOERR;
 }
 
 /**
- * Handle an error in PIO. This will consult the error handler
- * settings and either call MPI_Abort() or return an error code.
- *
- * The error hanlder has three settings:
- *
- * Errors cause abort: PIO_INTERNAL_ERROR.
+ * Set the logging level of one part of the library, on this task, if
+ * PIO was built with PIO_ENABLE_LOGGING. This allows, for example,
+ * the rearranger to be logged in detail while the rest of the library
+ * only logs errors. PIOc_set_log_level() sets the level of all parts.
  *
- * Error codes are broadcast to all tasks: PIO_BCAST_ERROR.
+ * The level is checked before the arguments of a log message are
+ * evaluated, so that there is little cost to a library built with
+ * logging when the levels are low.
  *
- * Errors are returned to caller with no internal action:
- * PIO_RETURN_ERROR.
+ * If the library is not built with logging, this function does
+ * nothing.
  *
- * @param ios pointer to the IO system info. Ignored if NULL.
- * @param file pointer to the file description data. Ignored if
- * NULL. If provided file->iosystem is used as ios pointer.
- * @param err_num the error code
- * @param fname name of code file where error occured.
- * @param line the line of code where the error occurred.
- * @returns err_num if abort is not called.
- * @author Jim Edwards
+ * @param subsys the part of the library, one of PIO_LOG_GENERAL,
+ * PIO_LOG_REARR (the rearrangers), PIO_LOG_DARRAY (the distributed
+ * array reads and writes) or PIO_LOG_MSG (the async message handler).
+ * @param level the logging level, 0 for errors only, 5 for max
+ * verbosity.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
  */
 int
-pio_err(iosystem_desc_t *ios, file_desc_t *file, int err_num, const char *fname,
-        int line)
+PIOc_set_log_level_subsys(int subsys, int level)
 {
-    char err_msg[PIO_MAX_NAME + 1];
-    int err_handler = default_error_handler; /* Default error handler. */
-    int ret;
-
-    /* User must provide this. */
-    pioassert(fname, "file name must be provided", __FILE__, __LINE__);
+    if (subsys < 0 || subsys >= PIO_LOG_NUM_SUBSYS)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* No harm, no foul. */
-    if (err_num == PIO_NOERR)
-        return PIO_NOERR;
+#if PIO_ENABLE_LOGGING
+    /* pio_log_level is the highest level of any subsystem. */
+    pio_log_levels[subsys] = level;
+    pio_log_level = level;
+    for (int s = 0; s < PIO_LOG_NUM_SUBSYS; s++)
+        if (pio_log_levels[s] > pio_log_level)
+            pio_log_level = pio_log_levels[s];
+    if(!LOG_FILE)
+        pio_init_logging();
+    PLOG((1, "set loglevel of subsystem %d to %d", subsys, level));
+#endif /* PIO_ENABLE_LOGGING */
 
-    /* Get the error message. */
-    if ((ret = PIOc_strerror(err_num, err_msg)))
-        return ret;
-
-    /* If logging is in use, log an error message. */
-    PLOG((0, "%s err_num = %d fname = %s line = %d", err_msg, err_num, fname ? fname : '\0', line));
-
-    /* What error handler should we use? */
-    if (file)
-        err_handler = file->iosystem->error_handler;
-    else if (ios)
-        err_handler = ios->error_handler;
-
-    PLOG((2, "pio_err chose error handler = %d", err_handler));
-
-    /* Should we abort? */
-    if (err_handler == PIO_INTERNAL_ERROR)
-    {
-        /* For debugging only, this will print a traceback of the call tree.  */
-        print_trace(stderr);
-        MPI_Abort(MPI_COMM_WORLD, -1);
-    }
-
-    /* What should we do here??? */
-    if (err_handler == PIO_BCAST_ERROR)
-    {
-        /* ??? */
-    }
-
-    /* If abort was not called, we'll get here. */
-    return err_num;
-}
+    return PIO_NOERR;
+}
 
 /**
- * Allocate a region struct, and initialize it.
+ * Set the logging level value from the root compute task on all tasks
+ * if PIO was built with
+ * PIO_ENABLE_LOGGING. Set to -1 for nothing, 0 for errors only, 1 for
+ * important logging, and so on. Log levels below 1 are only printed
+ * on the io/component root.
  *
- * @param ios pointer to the IO system info, used for error
- * handling. Ignored if NULL.
- * @param ndims the number of dimensions for the data in this region.
- * @param regionp a pointer that gets a pointer to the newly allocated
- * io_region struct.
- * @returns 0 for success, error code otherwise.
+ * A log file is also produced for each task. The file is called
+ * pio_log_X.txt, where X is the (0-based) task number.
+ *
+ * If the library is not built with logging, this function does
+ * nothing.
+ *
+ * @param iosysid the IO system ID
+ * @param level the logging level, 0 for errors only, 5 for max
+ * verbosity.
+ * @returns 0 on success, error code otherwise.
  * @author Jim Edwards
  */
-int
-alloc_region2(iosystem_desc_t *ios, int ndims, io_region **regionp)
+int PIOc_set_global_log_level(int iosysid, int level)
 {
-    io_region *region;
+#if PIO_ENABLE_LOGGING
+    iosystem_desc_t *ios;
+    int mpierr=0, mpierr2;
 
-    /* Check inputs. */
-    pioassert(ndims >= 0 && regionp, "invalid input", __FILE__, __LINE__);
-    PLOG((1, "alloc_region2 ndims = %d sizeof(io_region) = %d", ndims,
-          sizeof(io_region)));
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Allocate memory for the io_region struct. */
-    if (!(region = calloc(1, sizeof(io_region))))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (ios->async)
+    {
+        if(!ios->ioproc)
+        {
+            int msg = PIO_MSG_SETLOGLEVEL;
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+        }
 
-    /* Allocate memory for the array of start indicies. */
-    if (!(region->start = calloc(ndims, sizeof(PIO_Offset))))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    if (!mpierr)
+        mpierr = MPI_Bcast(&level, 1, MPI_INT, ios->comproot, ios->union_comm);
 
-    /* Allocate memory for the array of counts. */
-    if (!(region->count = calloc(ndims, sizeof(PIO_Offset))))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    /* Handle MPI errors. */
+    if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+        check_mpi(ios, NULL, mpierr2, __FILE__, __LINE__);
+    if (mpierr)
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
 
-    /* Return pointer to new region to caller. */
-    *regionp = region;
 
+    /* Set the log level on all tasks */
+    PIOc_set_log_level(level);
+    PLOG((level, "set_global_log_level, level = %d", level));
+#endif
     return PIO_NOERR;
 }
 
-/**
- * Given a PIO type, find the MPI type and the type size.
+
+#ifdef USE_MPE
+
+/* This array holds even numbers for MPE. */
+int event_num[2][NUM_EVENTS];
+
+/* This keeps track of whether MPE has been initialized. */
+int mpe_logging_initialized = 0;
+
+/** This will set up the MPE logging event numbers. The calling
+ * program does not need to call MPE_Init_log(), that is done by the
+ * mpe library in MPI_Init(). MPE must be installed, get it from
+ * https://www.mcs.anl.gov/research/projects/perfvis/software/MPE/. PIO
+ * and the whole I/O stack must be built with MPE.
  *
- * @param pio_type a PIO type, PIO_INT, PIO_FLOAT, etc.
- * @param mpi_type a pointer to MPI_Datatype that will get the MPI
- * type that coresponds to the PIO type. Ignored if NULL.
- * @param type_size a pointer to int that will get the size of the
- * type, in bytes. (For example, 4 for PIO_INT). Ignored if NULL.
- * @returns 0 for success, error code otherwise.
- * @author Jim Edwards
+ * @param my_rank rank of processor in MPI_COMM_WORLD.
+ * @author Ed Hartnett
  */
 int
-find_mpi_type(int pio_type, MPI_Datatype *mpi_type, int *type_size)
+init_mpe(int my_rank)
 {
-    MPI_Datatype my_mpi_type;
-    int my_type_size;
+    /* If we've already initialized MPE states, just return. */
+    if (mpe_logging_initialized++)
+        return 0;
 
-    /* Decide on the base type. */
-    switch(pio_type)
+    /* Get a bunch of event numbers. */
+    event_num[START][INIT] = MPE_Log_get_event_number();
+    event_num[END][INIT] = MPE_Log_get_event_number();
+    event_num[START][DECOMP] = MPE_Log_get_event_number();
+    event_num[END][DECOMP] = MPE_Log_get_event_number();
+    event_num[START][CREATE] = MPE_Log_get_event_number();
+    event_num[END][CREATE] = MPE_Log_get_event_number();
+    event_num[START][OPEN] = MPE_Log_get_event_number();
+    event_num[END][OPEN] = MPE_Log_get_event_number();
+    event_num[START][DARRAY_WRITE] = MPE_Log_get_event_number();
+    event_num[END][DARRAY_WRITE] = MPE_Log_get_event_number();
+    event_num[START][CLOSE] = MPE_Log_get_event_number();
+    event_num[END][CLOSE] = MPE_Log_get_event_number();
+    event_num[START][DARRAY_READ] = MPE_Log_get_event_number();
+    event_num[END][DARRAY_READ] = MPE_Log_get_event_number();
+
+    /* On rank 0, set up the info states. */
+    if (!my_rank)
     {
-    case PIO_BYTE:
-#ifdef _MPISERIAL
-        my_mpi_type = MPI_BYTE;
-#else
-        my_mpi_type = MPI_SIGNED_CHAR;
-#endif
-        my_type_size = NETCDF_CHAR_SIZE;
-        break;
-    case PIO_CHAR:
-        my_mpi_type = MPI_CHAR;
-        my_type_size = NETCDF_CHAR_SIZE;
-        break;
-    case PIO_SHORT:
-        my_mpi_type = MPI_SHORT;
-        my_type_size = NETCDF_SHORT_SIZE;
-        break;
-    case PIO_INT:
-        my_mpi_type = MPI_INT;
-        my_type_size = NETCDF_INT_FLOAT_SIZE;
-        break;
-    case PIO_FLOAT:
-        my_mpi_type = MPI_FLOAT;
-        my_type_size = NETCDF_INT_FLOAT_SIZE;
-        break;
-    case PIO_DOUBLE:
-        my_mpi_type = MPI_DOUBLE;
-        my_type_size = NETCDF_DOUBLE_INT64_SIZE;
-        break;
-#ifdef _NETCDF4
-    case PIO_UBYTE:
-        my_mpi_type = MPI_UNSIGNED_CHAR;
-        my_type_size = NETCDF_CHAR_SIZE;
-        break;
-    case PIO_USHORT:
-        my_mpi_type = MPI_UNSIGNED_SHORT;
-        my_type_size = NETCDF_SHORT_SIZE;
-        break;
-    case PIO_UINT:
-        my_mpi_type = MPI_UNSIGNED;
-        my_type_size = NETCDF_INT_FLOAT_SIZE;
-        break;
-    case PIO_INT64:
-        my_mpi_type = MPI_LONG_LONG;
-        my_type_size = NETCDF_DOUBLE_INT64_SIZE;
-        break;
-    case PIO_UINT64:
-        my_mpi_type = MPI_UNSIGNED_LONG_LONG;
-        my_type_size = NETCDF_DOUBLE_INT64_SIZE;
-        break;
-    case PIO_STRING:
-        my_mpi_type = MPI_CHAR;
-        my_type_size = NETCDF_CHAR_SIZE;
-        break;
-#endif /* _NETCDF4 */
-    default:
-        return PIO_EBADTYPE;
+        /* Available colors: "white", "black", "red", "yellow", "green",
+           "cyan", "blue", "magenta", "aquamarine", "forestgreen",
+           "orange", "marroon", "brown", "pink", "coral", "gray" */
+        MPE_Describe_info_state(event_num[START][INIT], event_num[END][INIT],
+                                "PIO init", "green", "%s");
+        MPE_Describe_info_state(event_num[START][DECOMP],
+                                event_num[END][DECOMP], "PIO decomposition",
+                                "cyan", "%s");
+        MPE_Describe_info_state(event_num[START][CREATE], event_num[END][CREATE],
+                                "PIO create file", "red", "%s");
+        MPE_Describe_info_state(event_num[START][OPEN], event_num[END][OPEN],
+                                "PIO open file", "orange", "%s");
+        MPE_Describe_info_state(event_num[START][DARRAY_WRITE],
+                                event_num[END][DARRAY_WRITE], "PIO darray write",
+                                "pink", "%s");
+        MPE_Describe_info_state(event_num[START][DARRAY_READ],
+                                event_num[END][DARRAY_READ], "PIO darray read",
+                                "magenta", "%s");
+        MPE_Describe_info_state(event_num[START][CLOSE],
+                                event_num[END][CLOSE], "PIO close",
+                                "white", "%s");
     }
-
-    /* If caller wants MPI type, set it. */
-    if (mpi_type)
-        *mpi_type = my_mpi_type;
-
-    /* If caller wants type size, set it. */
-    if (type_size)
-        *type_size = my_type_size;
-
-    return PIO_NOERR;
+    return 0;
 }
 
 /**
- * Allocate space for an IO description struct, and initialize it.
+ * Start MPE logging.
  *
- * @param ios pointer to the IO system info, used for error
- * handling.
- * @param piotype the PIO data type (ex. PIO_FLOAT, PIO_INT, etc.).
- * @param ndims the number of dimensions.
- * @param iodesc pointer that gets the newly allocated io_desc_t.
- * @returns 0 for success, error code otherwise.
- * @author Jim Edwards
+ * @param state_num the MPE event state number to START (ex. INIT).
+ * @author Ed Hartnett
  */
-int
-malloc_iodesc(iosystem_desc_t *ios, int piotype, int ndims,
-              io_desc_t **iodesc)
+void
+pio_start_mpe_log(int state)
 {
-    MPI_Datatype mpi_type;
-    PIO_Offset type_size;
-    int mpierr;
-    int ret;
-
-    /* Check input. */
-    pioassert(ios && piotype > 0 && ndims >= 0 && iodesc,
-              "invalid input", __FILE__, __LINE__);
+    if (MPE_Log_event(event_num[START][state], 0, NULL))
+        pio_err(NULL, NULL, PIO_EIO, __FILE__, __LINE__);
+}
 
-    PLOG((1, "malloc_iodesc piotype = %d ndims = %d", piotype, ndims));
+/**
+ * End MPE logging.
+ *
+ * @param state one of the MPE states defined in pio_internal.h.
+ * @param msg a text message to describe the state. Will be truncated
+ * to MPE_MAX_MSG_LEN.
+ * @author Ed Hartnett
+ */
+void
+pio_stop_mpe_log(int state, const char *msg)
+{
+    MPE_LOG_BYTES bytebuf;
+    int pos = 0;
+    int msglen;
+    int ret;
 
-    /* Get the MPI type corresponding with the PIO type. */
-    if ((ret = find_mpi_type(piotype, &mpi_type, NULL)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    /* Truncate messages longer than MPE_MAX_MSG_LEN. */
+    msglen = strlen(msg) > MPE_MAX_MSG_LEN ? MPE_MAX_MSG_LEN : strlen(msg);
 
-    /* What is the size of the pio type? */
-    if ((ret = pioc_pnetcdf_inq_type(0, piotype, NULL, &type_size)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    /* Tell MPE to stop the state, with a message. */
+    MPE_Log_pack(bytebuf, &pos, 's', msglen, msg);
+    if ((ret = MPE_Log_event(event_num[END][state], 0, bytebuf)))
+        pio_err(NULL, NULL, PIO_EIO, __FILE__, __LINE__);
+}
 
-    /* Allocate space for the io_desc_t struct. */
-    if (!(*iodesc = calloc(1, sizeof(io_desc_t))))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+#endif /* USE_MPE */
 
-    /* Remember the pio type and its size. */
-    (*iodesc)->piotype = piotype;
-    (*iodesc)->piotype_size = type_size;
+/**
+ * Initialize logging.  Open log file, if not opened yet, or increment
+ * ref count if already open.
+ *
+ * @author Jayesh Krishna, Ed Hartnett
+ */
+int
+pio_init_logging(void)
+{
+    int ret = PIO_NOERR;
 
-    /* Remember the MPI type. */
-    (*iodesc)->mpitype = mpi_type;
+#ifdef USE_MPE
+    {
+        int mpe_rank;
+        int mpierr;
 
-    /* Get the size of the type. */
-    if (mpi_type == MPI_DATATYPE_NULL)
-        (*iodesc)->mpitype_size = 0;
-    else
-        if ((mpierr = MPI_Type_size((*iodesc)->mpitype, &(*iodesc)->mpitype_size)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Comm_rank(MPI_COMM_WORLD, &mpe_rank)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
-    /* Initialize some values in the struct. */
-    (*iodesc)->maxregions = 1;
-    (*iodesc)->ioid = -1;
-    (*iodesc)->ndims = ndims;
-    (*iodesc)->readonly = 0;
+        if ((ret = init_mpe(mpe_rank)))
+            return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    }
+#endif /* USE_MPE */
 
-    /* Allocate space for, and initialize, the first region. */
-    if ((ret = alloc_region2(ios, ndims, &((*iodesc)->firstregion))))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+#if PIO_ENABLE_LOGGING
+    if (!LOG_FILE && pio_log_level > 0)
+    {
+        char log_filename[PIO_MAX_NAME];
+        int mpierr;
 
-    /* Set the swap memory settings to defaults for this IO system. */
-    (*iodesc)->rearr_opts = ios->rearr_opts;
+        /* Create a filename with the rank in it. */
+        if ((mpierr = MPI_Comm_rank(MPI_COMM_WORLD, &my_rank)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        sprintf(log_filename, "pio_log_%d.log", my_rank);
 
-    return PIO_NOERR;
+        /* Open a file for this rank to log messages. */
+        if (!(LOG_FILE = fopen(log_filename, "w")))
+            return pio_err(NULL, NULL, PIO_EIO, __FILE__, __LINE__);
+
+        pio_log_ref_cnt = 1;
+    }
+    else if(LOG_FILE)
+    {
+        pio_log_ref_cnt++;
+    }
+#endif /* PIO_ENABLE_LOGGING */
+
+    return ret;
 }
 
 /**
- * Free a region list.
- *
- * top a pointer to the start of the list to free.
- * @author Jim Edwards
+ * Finalize logging - close log files, if open.
  */
 void
-free_region_list(io_region *top)
+pio_finalize_logging(void)
 {
-    io_region *ptr, *tptr;
-
-    ptr = top;
-    while (ptr)
+#if PIO_ENABLE_LOGGING
+    pio_log_ref_cnt -= 1;
+    if (LOG_FILE)
     {
-        if (ptr->start)
-            free(ptr->start);
-        if (ptr->count)
-            free(ptr->count);
-        tptr = ptr;
-        ptr = ptr->next;
-        free(tptr);
+        if (pio_log_ref_cnt == 0)
+        {
+            fclose(LOG_FILE);
+            LOG_FILE = NULL;
+        }
+        else
+            PLOG((2, "pio_finalize_logging, postpone close, ref_cnt = %d",
+                  pio_log_ref_cnt));
     }
+#endif /* PIO_ENABLE_LOGGING */
 }
 
+#if PIO_ENABLE_LOGGING
 /**
- * Free a decomposition map.
+ * This function prints out a message, if the severity of the message
+ * is lower than the global pio_log_level. To use it, do something
+ * like this:
  *
- * @param iosysid the IO system ID.
- * @param ioid the ID of the decomposition map to free.
- * @returns 0 for success, error code otherwise.
- * @ingroup PIO_freedecomp_c
- * @author Jim Edwards
+ * pio_log(0, "this computer will explode in %d seconds", i);
+ *
+ * After the first arg (the severity), use the rest like a normal
+ * printf statement. Output will appear on stdout.
+ * This function is heavily based on the function in section 15.5 of
+ * the C FAQ.
+ *
+ * In code this functions should be wrapped in the PLOG(()) macro.
+ *
+ * @param severity the severity of the message, 0 for error messages,
+ * then increasing levels of verbosity.
+ * @param fmt the format string.
+ * @param ... the arguments used in format string.
+ * @author Ed Hartnett
  */
-int
-PIOc_freedecomp(int iosysid, int ioid)
+void
+pio_log(int severity, const char *fmt, ...)
 {
-    iosystem_desc_t *ios;
-    io_desc_t *iodesc;
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
-
-    PLOG((1, "PIOc_freedecomp iosysid = %d ioid = %d", iosysid, ioid));
+    va_list argp;
+    int t;
+    int rem_len = MAX_LOG_MSG;
+    char msg[MAX_LOG_MSG];
+    char *ptr = msg;
+    char rank_str[MAX_RANK_STR];
 
-    if (!(ios = pio_get_iosystem_from_id(iosysid)))
-        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    /* If the severity is greater than the log level, we don't print
+       this message. */
+    if (severity > pio_log_level)
+        return;
 
-    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
-        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+    /* If the severity is 0, only print on rank 0. */
+    if (severity < 1 && my_rank != 0)
+        return;
 
-    /* If async is in use, and this is not an IO task, bcast the parameters. */
-    if (ios->async)
+    /* If the severity is zero, this is an error. Otherwise insert that
+       many tabs before the message. */
+    if (!severity)
     {
-        if (!ios->ioproc)
-        {
-            int msg = PIO_MSG_FREEDECOMP; /* Message for async notification. */
-
-            if (ios->compmaster == MPI_ROOT)
-                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
-
-            if (!mpierr)
-                mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            PLOG((2, "PIOc_freedecomp iosysid = %d ioid = %d", iosysid, ioid));
-        }
+        strncpy(ptr, ERROR_PREFIX, (rem_len > 0) ? rem_len : 0);
+        ptr += strlen(ERROR_PREFIX);
+        rem_len -= strlen(ERROR_PREFIX);
+    }
 
-        /* Handle MPI errors. */
-        PLOG((3, "handling mpierr %d ios->comproot %d", mpierr, ios->comproot));
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(NULL, NULL, mpierr2, __FILE__, __LINE__);
-        PLOG((3, "handling mpierr2 %d", mpierr2));
-        if (mpierr)
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    for (t = 0; t < severity; t++)
+    {
+        strncpy(ptr++, "\t", (rem_len > 0) ? rem_len : 0);
+        rem_len--;
     }
 
-    PLOG((3, "freeing map, dimlen"));
-    /* Free the map. */
-    free(iodesc->map);
+    /* Show the rank. */
+    snprintf(rank_str, MAX_RANK_STR, "%d ", my_rank);
+    strncpy(ptr, rank_str, (rem_len > 0) ? rem_len : 0);
+    ptr += strlen(rank_str);
+    rem_len -= strlen(rank_str);
 
-    /* Free the dimlens. */
-    free(iodesc->dimlen);
+    /* /\* Show the severity. *\/ */
+    /* snprintf(rank_str, MAX_RANK_STR, ":%d ", severity); */
+    /* strncpy(ptr, rank_str, (rem_len > 0) ? rem_len : 0); */
+    /* ptr += strlen(rank_str); */
+    /* rem_len -= strlen(rank_str); */
 
-    if (iodesc->remap)
-        free(iodesc->remap);
+    /* Print out the variable list of args with vprintf. */
+    va_start(argp, fmt);
+    vsnprintf(ptr, ((rem_len > 0) ? rem_len : 0), fmt, argp);
+    va_end(argp);
 
-    PLOG((3, "freeing rfrom, rtype"));
-    if (iodesc->rfrom)
-        free(iodesc->rfrom);
+    /* Put on a final linefeed. */
+    ptr = msg + strlen(msg);
+    rem_len = MAX_LOG_MSG - strlen(msg);
+    strncpy(ptr, "\n\0", (rem_len > 0) ? rem_len : 0);
 
-    if (iodesc->rtype)
-    {
-        for (int i = 0; i < iodesc->nrecvs; i++)
-            if (iodesc->rtype[i] != PIO_DATATYPE_NULL)
-                if ((mpierr = MPI_Type_free(&iodesc->rtype[i])))
-                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    /* Send message to stdout. */
+    fprintf(stdout, "%s", msg);
 
-        free(iodesc->rtype);
-    }
+    /* Send message to log file. */
+    if (LOG_FILE)
+        fprintf(LOG_FILE, "%s", msg);
 
-    PLOG((3, "freeing stype, scount"));
-    if (iodesc->stype)
-    {
-        for (int i = 0; i < iodesc->num_stypes; i++)
-            if (iodesc->stype[i] != PIO_DATATYPE_NULL)
-                if ((mpierr = MPI_Type_free(iodesc->stype + i)))
-                    return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-
-        iodesc->num_stypes = 0;
-        free(iodesc->stype);
-    }
-
-    if (iodesc->scount)
-        free(iodesc->scount);
-
-    if (iodesc->rcount)
-        free(iodesc->rcount);
+    /* Ensure an immediate flush of stdout. */
+    fflush(stdout);
+    if (LOG_FILE)
+        fflush(LOG_FILE);
+}
+#endif /* PIO_ENABLE_LOGGING */
 
-    if (iodesc->sindex)
-        free(iodesc->sindex);
+/**
+ * Obtain a backtrace and print it to stderr. This is appended to the
+ * text decomposition file.
+ *
+ * Note from Jim:
+ *
+ * The stack trace can be used to identify the usage in
+ * the model code of the particular decomposition in question and so
+ * if using the pio performance tool leads to tuning that could be
+ * applied in the model you know more or less where to do it.
+ *
+ * It's also useful if you have a model bug - then you have 20 or so
+ * decomp files and you need to identify the one that was problematic.
+ * So it's used as an add to the developer and not used at all by any
+ * automated process or tools.
+ *
+ * @param fp file pointer to send output to
+ * @author Jim Edwards
+ */
+void
+print_trace(FILE *fp)
+{
+    void *array[10];
+    size_t size;
+    char **strings;
+    size_t i;
 
-    if (iodesc->rindex)
-        free(iodesc->rindex);
+    /* Note that this won't actually work. */
+    if (fp == NULL)
+        fp = stderr;
 
-    PLOG((3, "freeing regions"));
-    if (iodesc->firstregion)
-        free_region_list(iodesc->firstregion);
+    size = backtrace(array, 10);
+    strings = backtrace_symbols(array, size);
 
-    if (iodesc->fillregion)
-        free_region_list(iodesc->fillregion);
+    fprintf(fp,"Obtained %zd stack frames.\n", size);
 
-    if (iodesc->rearranger == PIO_REARR_SUBSET)
-        if ((mpierr = MPI_Comm_free(&iodesc->subset_comm)))
-            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    for (i = 0; i < size; i++)
+        fprintf(fp,"%s\n", strings[i]);
 
-    return pio_delete_iodesc_from_list(ioid);
+    free(strings);
 }
 
 /**
- * Read a decomposition map from a file. The decomp file is only read
- * by task 0 in the communicator.
+ * Abort program and call MPI_Abort().
  *
- * @param file the filename
- * @param ndims pointer to an int with the number of dims.
- * @param gdims pointer to an array of dimension ids.
- * @param fmaplen
- * @param map
- * @param comm
- * @returns 0 for success, error code otherwise.
+ * @param msg an error message
+ * @param fname name of code file where error occured
+ * @param line the line of code where the error occurred.
  * @author Jim Edwards
  */
-int
-PIOc_readmap(const char *file, int *ndims, int **gdims, PIO_Offset *fmaplen,
-             PIO_Offset **map, MPI_Comm comm)
+void
+piodie(const char *msg, const char *fname, int line)
 {
-    int npes, myrank;
-    int rnpes, rversno;
-    int j;
-    int *tdims;
-    PIO_Offset *tmap;
-    MPI_Status status;
-    PIO_Offset maplen;
-    int mpierr; /* Return code for MPI calls. */
+    fprintf(stderr,"Abort with message %s in file %s at line %d\n",
+            msg ? msg : "_", fname ? fname : "_", line);
 
-    /* Check inputs. */
-    if (!file || !ndims || !gdims || !fmaplen || !map)
-        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    print_trace(stderr);
+#ifdef _MPISERIAL
+    abort();
+#else
+    MPI_Abort(MPI_COMM_WORLD, -1);
+#endif
+}
 
-    if ((mpierr = MPI_Comm_size(comm, &npes)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Comm_rank(comm, &myrank)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+/**
+ * Perform an assert. Note that this function does nothing if NDEBUG
+ * is defined.
+ *
+ * @param expression the expression to be evaluated
+ * @param msg an error message
+ * @param fname name of code file where error occured
+ * @param line the line of code where the error occurred.
+ * @author Jim Edwards
+ */
+void
+pioassert(_Bool expression, const char *msg, const char *fname, int line)
+{
+#ifndef NDEBUG
+    if (!expression)
+        piodie(msg, fname, line);
+#endif
+}
 
-    if (myrank == 0)
+/**
+ * Handle MPI errors. An error message is sent to stderr, then the
+ * check_netcdf() function is called with PIO_EIO.
+ *
+ * @param ios pointer to the iosystem_info_t. May be NULL.
+ * @param file pointer to the file_desc_t info. Ignored if NULL.
+ * @param mpierr the MPI return code to handle
+ * @param filename the name of the code file where error occured.
+ * @param line the line of code where error occured.
+ * @return PIO_NOERR for no error, otherwise PIO_EIO.
+ * @author Ed Hartnett
+ */
+int
+check_mpi(iosystem_desc_t *ios, file_desc_t *file, int mpierr,
+          const char *filename, int line)
+{
+    if (mpierr)
     {
-        FILE *fp = fopen(file, "r");
-        if (!fp)
-            pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
-
-        if (fscanf(fp,"version %d npes %d ndims %d\n", &rversno, &rnpes, ndims) != 3)
-            pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
-        if (rversno != VERSNO)
-            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
-
-        if (rnpes < 1 || rnpes > npes)
-            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
-
-        if ((mpierr = MPI_Bcast(&rnpes, 1, MPI_INT, 0, comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(ndims, 1, MPI_INT, 0, comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        if (!(tdims = calloc(*ndims, sizeof(int))))
-            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        for (int i = 0; i < *ndims; i++)
-            if (fscanf(fp,"%d ", tdims + i) != 1)
-                pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
-
-        if ((mpierr = MPI_Bcast(tdims, *ndims, MPI_INT, 0, comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-
-        for (int i = 0; i < rnpes; i++)
-        {
-            if (fscanf(fp, "%d %lld", &j, &maplen) != 2)
-                pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
-            if (j != i)  // Not sure how this could be possible
-                return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
-            if (!(tmap = malloc(maplen * sizeof(PIO_Offset))))
-                return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-            for (j = 0; j < maplen; j++)
-                if (fscanf(fp, "%lld ", tmap + j) != 1)
-                    pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        char errstring[MPI_MAX_ERROR_STRING];
+        int errstrlen;
 
-            if (i > 0)
-            {
-                if ((mpierr = MPI_Send(&maplen, 1, PIO_OFFSET, i, i + npes, comm)))
-                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-                if ((mpierr = MPI_Send(tmap, maplen, PIO_OFFSET, i, i, comm)))
-                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-                free(tmap);
-            }
-            else
-            {
-                *map = tmap;
-                *fmaplen = maplen;
-            }
-        }
-        fclose(fp);
-    }
-    else
-    {
-        if ((mpierr = MPI_Bcast(&rnpes, 1, MPI_INT, 0, comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(ndims, 1, MPI_INT, 0, comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        if (!(tdims = calloc(*ndims, sizeof(int))))
-            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(tdims, *ndims, MPI_INT, 0, comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        /* If we can get an error string from MPI, print it to stderr. */
+        if (!MPI_Error_string(mpierr, errstring, &errstrlen))
+            fprintf(stderr, "MPI ERROR: %s in file %s at line %d\n",
+                    errstring, filename ? filename : "_", line);
 
-        if (myrank < rnpes)
-        {
-            if ((mpierr = MPI_Recv(&maplen, 1, PIO_OFFSET, 0, myrank + npes, comm, &status)))
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-            if (!(tmap = malloc(maplen * sizeof(PIO_Offset))))
-                return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-            if ((mpierr = MPI_Recv(tmap, maplen, PIO_OFFSET, 0, myrank, comm, &status)))
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-            *map = tmap;
-        }
-        else
-        {
-            tmap = NULL;
-            maplen = 0;
-        }
-        *fmaplen = maplen;
+        /* Handle all MPI errors as PIO_EIO. */
+        return pio_err(ios, file, PIO_EIO, filename, line);
     }
-    *gdims = tdims;
     return PIO_NOERR;
 }
 
 /**
- * Read a decomposition map from file.
+ * Check the result of a netCDF API call.
  *
- * @param file the filename
- * @param ndims pointer to the number of dimensions
- * @param gdims pointer to an array of dimension ids
- * @param maplen pointer to the length of the map
- * @param map pointer to the map array
- * @param f90_comm
- * @returns 0 for success, error code otherwise.
- * @author Jim Edwards
+ * @param file pointer to the PIO structure describing this
+ * file. Ignored if NULL.
+ * @param status the return value from the netCDF call.
+ * @param fname the name of the code file.
+ * @param line the line number of the netCDF call in the code.
+ * @return the error code
+ * @author Ed Hartnett
  */
 int
-PIOc_readmap_from_f90(const char *file, int *ndims, int **gdims, PIO_Offset *maplen,
-                      PIO_Offset **map, int f90_comm)
+check_netcdf(file_desc_t *file, int status, const char *fname, int line)
 {
-    return PIOc_readmap(file, ndims, gdims, maplen, map, MPI_Comm_f2c(f90_comm));
+    return check_netcdf2(NULL, file, status, fname, line);
 }
 
 /**
- * Write the decomposition map to a file using netCDF, everyones
- * favorite data format.
+ * Check the result of a netCDF API call. This is the same as
+ * check_netcdf() except for the extra iosystem_desc_t pointer, which
+ * is used to determine error handling when there is no file_desc_t
+ * pointer.
  *
- * @param iosysid the IO system ID.
- * @param filename the filename to be used.
- * @param cmode for PIOc_create(). Will be bitwise or'd with NC_WRITE.
- * @param ioid the ID of the IO description.
- * @param title optional title attribute for the file. Must be less than
- * PIO_MAX_NAME + 1 if provided. Ignored if NULL.
- * @param history optial history attribute for the file. Must be less
- * than PIO_MAX_NAME + 1 if provided. Ignored if NULL.
- * @param fortran_order set to non-zero if fortran array ordering is
- * used, or to zero if C array ordering is used.
- * @returns 0 for success, error code otherwise.
+ * @param ios pointer to the iosystem description struct. Ignored if NULL.
+ * @param file pointer to the PIO structure describing this file. Ignored if NULL.
+ * @param status the return value from the netCDF call.
+ * @param fname the name of the code file.
+ * @param line the line number of the netCDF call in the code.
+ * @return the error code
  * @author Ed Hartnett
  */
 int
-PIOc_write_nc_decomp(int iosysid, const char *filename, int cmode, int ioid,
-                     char *title, char *history, int fortran_order)
+check_netcdf2(iosystem_desc_t *ios, file_desc_t *file, int status,
+              const char *fname, int line)
 {
-    iosystem_desc_t *ios; /* IO system info. */
-    io_desc_t *iodesc;    /* Decomposition info. */
-    int max_maplen;       /* The maximum maplen used for any task. */
-    int *full_map;        /* 2D array holds all map info for all tasks. */
-    int *my_map;          /* 1D array holds all map info for this task. */
-    int mpierr;
-    int ret;
-
-    /* Get the IO system info. */
-    if (!(ios = pio_get_iosystem_from_id(iosysid)))
-        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
-
-    /* Check inputs. */
-    if (!filename)
-        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
-    if (title)
-        if (strlen(title) > PIO_MAX_NAME)
-            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
-    if (history)
-        if (strlen(history) > PIO_MAX_NAME)
-            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    int eh = default_error_handler; /* Error handler that will be used. */
+    int rbuf;
+    /* User must provide this. */
+    pioassert(fname, "code file name must be provided", __FILE__, __LINE__);
 
-    PLOG((1, "PIOc_write_nc_decomp filename = %s iosysid = %d ioid = %d "
-          "ios->num_comptasks = %d", filename, iosysid, ioid, ios->num_comptasks));
+    if (file && file->iosystem->ioproc &&
+        (file->iotype == PIO_IOTYPE_PNETCDF || file->iotype == PIO_IOTYPE_NETCDF4P))
+    {
+        if (file->iosystem->io_rank == 0)
+            MPI_Reduce(MPI_IN_PLACE, &status, 1, MPI_INT, MPI_MIN, 0, file->iosystem->io_comm);
+        else
+            MPI_Reduce(&status, &rbuf, 1, MPI_INT, MPI_MIN, 0, file->iosystem->io_comm);
+    }
 
-    /* Get the IO desc, which describes the decomposition. */
-    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
-        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+    PLOG((1, "check_netcdf2 status = %d fname = %s line = %d", status, fname, line));
 
-    /* Allocate memory for array which will contain the length of the
-     * map on each task, for all computation tasks. */
-    int task_maplen[ios->num_comptasks];
-    PLOG((3, "ios->num_comptasks = %d", ios->num_comptasks));
+    /* Pick an error handler. */
+    if (ios)
+        eh = ios->error_handler;
+    if (file)
+        eh = file->iosystem->error_handler;
+    pioassert(eh == PIO_INTERNAL_ERROR || eh == PIO_BCAST_ERROR || eh == PIO_RETURN_ERROR,
+              "invalid error handler", __FILE__, __LINE__);
+    PLOG((2, "check_netcdf2 chose error handler = %d", eh));
 
-    /* Gather maplens from all computation tasks and fill the
-     * task_maplen array on all tasks. */
-    if ((mpierr = MPI_Allgather(&iodesc->maplen, 1, MPI_INT, task_maplen, 1, MPI_INT,
-                                ios->comp_comm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    /* Decide what to do based on the error handler. */
+    if (eh == PIO_INTERNAL_ERROR && status != PIO_NOERR)
+    {
+        char errmsg[PIO_MAX_NAME + 1];  /* Error message. */
+        PIOc_strerror(status, errmsg);
+        piodie(errmsg, fname, line);        /* Die! */
+    }
+    else if (eh == PIO_BCAST_ERROR)
+    {
+        if (ios)
+            MPI_Bcast(&status, 1, MPI_INT, ios->ioroot, ios->my_comm);
+        else if (file)
+            MPI_Bcast(&status, 1, MPI_INT, file->iosystem->ioroot, file->iosystem->my_comm);
+        PLOG((2, "check_netcdf2 status returned = %d", status));
+    }
 
-    /* Find the max maplen. */
-    if ((mpierr = MPI_Allreduce(&iodesc->maplen, &max_maplen, 1, MPI_INT, MPI_MAX,
-                                ios->comp_comm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    PLOG((3, "max_maplen = %d", max_maplen));
+    /* For PIO_RETURN_ERROR, just return the error. */
+    return status;
+}
 
-    if (!(full_map = malloc(sizeof(int) * ios->num_comptasks * max_maplen)))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+/**
+ * Check the return code of a netCDF call that defines or changes the
+ * metadata of a file (PIOc_def_dim(), PIOc_put_att() and so on).
+ *
+ * Without deferred errors, status is broadcast from the IO root and
+ * checked with check_netcdf(). With deferred errors (see
+ * PIOc_set_defer_errors()), the first error of each task is kept in
+ * the file, and PIO_NOERR is returned with no communication. The
+ * errors are checked at the next call of check_netcdf_sync().
+ *
+ * @param file pointer to the file.
+ * @param status the return value from the netCDF call, on this task.
+ * @param fname the name of the code file.
+ * @param line the line number of the netCDF call in the code.
+ * @return the error code.
+ * @author Ed Hartnett
+ */
+int
+check_netcdf_deferred(file_desc_t *file, int status, const char *fname, int line)
+{
+    int mpierr;
 
-    if (!(my_map = malloc(sizeof(int) * max_maplen)))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    pioassert(file && fname, "invalid input", __FILE__, __LINE__);
 
-    /* Fill local array with my map. Use the fill value for unused */
-    /* elements at the end if max_maplen is longer than maplen. Also
-     * subtract 1 because the iodesc->map is 1-based. */
-    for (int e = 0; e < max_maplen; e++)
+    if (file->defer_errors)
     {
-        my_map[e] = e < iodesc->maplen ? iodesc->map[e] - 1 : NC_FILL_INT;
-        PLOG((3, "my_map[%d] = %d", e, my_map[e]));
+        if (status && !file->deferred_err)
+        {
+            PLOG((1, "check_netcdf_deferred status = %d fname = %s line = %d", status,
+                  fname, line));
+            file->deferred_err = status;
+        }
+        return PIO_NOERR;
     }
 
-    /* Gather my_map from all computation tasks and fill the full_map array. */
-    if ((mpierr = MPI_Allgather(my_map, max_maplen, MPI_INT, full_map, max_maplen,
-                                MPI_INT, ios->comp_comm)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    /* Each subfile of a subfiled file is changed by its own IO task. */
+    if (file->num_subfiles && file->iosystem->ioproc)
+        status = pio_subfile_err(file->iosystem, status);
+    if ((mpierr = MPI_Bcast(&status, 1, MPI_INT, file->iosystem->ioroot,
+                            file->iosystem->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    if (status)
+        return check_netcdf(file, status, fname, line);
 
-    free(my_map);
+    return PIO_NOERR;
+}
 
-    for (int p = 0; p < ios->num_comptasks; p++)
-        for (int e = 0; e < max_maplen; e++)
-            PLOG((3, "full_map[%d][%d] = %d", p, e, full_map[p * max_maplen + e]));
+/**
+ * Check the return code of a netCDF call at a point where the
+ * deferred errors of the file are checked: PIOc_enddef(),
+ * PIOc_redef(), PIOc_sync() and PIOc_check_errors().
+ *
+ * Without deferred errors, status is broadcast from the IO root. With
+ * deferred errors, the status, or the first deferred error of the
+ * task if status is PIO_NOERR, is reduced over all tasks, in one
+ * collective. The error, if any, is then handled by check_netcdf().
+ *
+ * @param file pointer to the file.
+ * @param status the return value from the netCDF call, on this task.
+ * @param fname the name of the code file.
+ * @param line the line number of the netCDF call in the code.
+ * @return the error code.
+ * @author Ed Hartnett
+ */
+int
+check_netcdf_sync(file_desc_t *file, int status, const char *fname, int line)
+{
+    iosystem_desc_t *ios;
+    int mpierr;
 
-    /* Write the netCDF decomp file. */
-    if ((ret = pioc_write_nc_decomp_int(ios, filename, cmode, iodesc->ndims, iodesc->dimlen,
-                                        ios->num_comptasks, task_maplen, full_map, title,
-                                        history, fortran_order)))
-        return ret;
+    pioassert(file && fname, "invalid input", __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    if (file->defer_errors)
+    {
+        if (!status)
+            status = file->deferred_err;
+        file->deferred_err = PIO_NOERR;
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &status, 1, MPI_INT, MPI_MIN, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+    else
+    {
+        if (file->num_subfiles && ios->ioproc)
+            status = pio_subfile_err(ios, status);
+        if ((mpierr = MPI_Bcast(&status, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+    if (status)
+        return check_netcdf(file, status, fname, line);
 
-    free(full_map);
     return PIO_NOERR;
 }
 
 /**
- * Read the decomposition map from a netCDF decomp file produced by
- * PIOc_write_nc_decomp().
+ * Handle an error in PIO. This will consult the error handler
+ * settings and either call MPI_Abort() or return an error code.
  *
- * @param iosysid the IO system ID.
- * @param filename the name of the decomp file.
- * @param ioidp pointer that will get the newly-assigned ID of the IO
- * description. The ioid is needed to later free the decomposition.
- * @param comm an MPI communicator.
- * @param pio_type the PIO type to be used as the type for the data.
- * @param title pointer that will get optial title attribute for the
- * file. Will be less than PIO_MAX_NAME + 1 if provided. Ignored if
- * NULL.
- * @param history pointer that will get optial history attribute for
- * the file. Will be less than PIO_MAX_NAME + 1 if provided. Ignored if
- * NULL.
- * @param fortran_order pointer that gets set to 1 if fortran array
- * ordering is used, or to zero if C array ordering is used.
- * @returns 0 for success, error code otherwise.
- * @author Ed Hartnett
+ * The error hanlder has three settings:
+ *
+ * Errors cause abort: PIO_INTERNAL_ERROR.
+ *
+ * Error codes are broadcast to all tasks: PIO_BCAST_ERROR.
+ *
+ * Errors are returned to caller with no internal action:
+ * PIO_RETURN_ERROR.
+ *
+ * @param ios pointer to the IO system info. Ignored if NULL.
+ * @param file pointer to the file description data. Ignored if
+ * NULL. If provided file->iosystem is used as ios pointer.
+ * @param err_num the error code
+ * @param fname name of code file where error occured.
+ * @param line the line of code where the error occurred.
+ * @returns err_num if abort is not called.
+ * @author Jim Edwards
  */
 int
-PIOc_read_nc_decomp(int iosysid, const char *filename, int *ioidp, MPI_Comm comm,
-                    int pio_type, char *title, char *history, int *fortran_order)
+pio_err(iosystem_desc_t *ios, file_desc_t *file, int err_num, const char *fname,
+        int line)
 {
-    iosystem_desc_t *ios; /* Pointer to the IO system info. */
-    int ndims;            /* The number of data dims (except unlim). */
-    int max_maplen;       /* The max maplen of any task. */
-    int *global_dimlen;   /* An array with sizes of global dimensions. */
-    int *task_maplen;     /* A map of one tasks mapping to global data. */
-    int *full_map;        /* A map with the task maps of every task. */
-    int num_tasks_decomp; /* The number of tasks for this decomp. */
-    int size;             /* Size of comm. */
-    int my_rank;          /* Task rank in comm. */
-    char source_in[PIO_MAX_NAME + 1];  /* Text metadata in decomp file. */
-    char version_in[PIO_MAX_NAME + 1]; /* Text metadata in decomp file. */
-    int mpierr;
+    char err_msg[PIO_MAX_NAME + 1];
+    int err_handler = default_error_handler; /* Default error handler. */
     int ret;
 
-    /* Get the IO system info. */
-    if (!(ios = pio_get_iosystem_from_id(iosysid)))
-        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    /* User must provide this. */
+    pioassert(fname, "file name must be provided", __FILE__, __LINE__);
 
-    /* Check inputs. */
-    if (!filename || !ioidp)
-        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    /* No harm, no foul. */
+    if (err_num == PIO_NOERR)
+        return PIO_NOERR;
 
-    PLOG((1, "PIOc_read_nc_decomp filename = %s iosysid = %d pio_type = %d",
-          filename, iosysid, pio_type));
+    /* The error returns of the timed functions skip their
+     * pio_stop_timer(), so stop the timers that are running. */
+    if (file)
+        ios = file->iosystem;
+    if (ios)
+        for (int t = 0; t < PIO_NUM_TIMERS; t++)
+            if (ios->timers[t].running)
+                pio_timer_stop(ios, t);
+
+    /* Get the error message. */
+    if ((ret = PIOc_strerror(err_num, err_msg)))
+        return ret;
+
+    /* If logging is in use, log an error message. */
+    PLOG((0, "%s err_num = %d fname = %s line = %d", err_msg, err_num, fname ? fname : '\0', line));
+
+    /* What error handler should we use? */
+    if (file)
+        err_handler = file->iosystem->error_handler;
+    else if (ios)
+        err_handler = ios->error_handler;
+
+    PLOG((2, "pio_err chose error handler = %d", err_handler));
+
+    /* Should we abort? */
+    if (err_handler == PIO_INTERNAL_ERROR)
+    {
+        /* For debugging only, this will print a traceback of the call tree.  */
+        print_trace(stderr);
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+
+    /* What should we do here??? */
+    if (err_handler == PIO_BCAST_ERROR)
+    {
+        /* ??? */
+    }
+
+    /* If abort was not called, we'll get here. */
+    return err_num;
+}
+
+/**
+ * Allocate a region struct, and initialize it.
+ *
+ * @param ios pointer to the IO system info, used for error
+ * handling. Ignored if NULL.
+ * @param ndims the number of dimensions for the data in this region.
+ * @param regionp a pointer that gets a pointer to the newly allocated
+ * io_region struct.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+alloc_region2(iosystem_desc_t *ios, int ndims, io_region **regionp)
+{
+    io_region *region;
+
+    /* Check inputs. */
+    pioassert(ndims >= 0 && regionp, "invalid input", __FILE__, __LINE__);
+    PLOG((1, "alloc_region2 ndims = %d sizeof(io_region) = %d", ndims,
+          sizeof(io_region)));
+
+    /* Allocate memory for the io_region struct. */
+    if (!(region = calloc(1, sizeof(io_region))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Allocate memory for the array of start indicies. */
+    if (!(region->start = calloc(ndims, sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Allocate memory for the array of counts. */
+    if (!(region->count = calloc(ndims, sizeof(PIO_Offset))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Return pointer to new region to caller. */
+    *regionp = region;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Given a PIO type, find the MPI type and the type size.
+ *
+ * @param pio_type a PIO type, PIO_INT, PIO_FLOAT, etc.
+ * @param mpi_type a pointer to MPI_Datatype that will get the MPI
+ * type that coresponds to the PIO type. Ignored if NULL.
+ * @param type_size a pointer to int that will get the size of the
+ * type, in bytes. (For example, 4 for PIO_INT). Ignored if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+find_mpi_type(int pio_type, MPI_Datatype *mpi_type, int *type_size)
+{
+    MPI_Datatype my_mpi_type;
+    int my_type_size;
+
+    /* Decide on the base type. */
+    switch(pio_type)
+    {
+    case PIO_BYTE:
+#ifdef _MPISERIAL
+        my_mpi_type = MPI_BYTE;
+#else
+        my_mpi_type = MPI_SIGNED_CHAR;
+#endif
+        my_type_size = NETCDF_CHAR_SIZE;
+        break;
+    case PIO_CHAR:
+        my_mpi_type = MPI_CHAR;
+        my_type_size = NETCDF_CHAR_SIZE;
+        break;
+    case PIO_SHORT:
+        my_mpi_type = MPI_SHORT;
+        my_type_size = NETCDF_SHORT_SIZE;
+        break;
+    case PIO_INT:
+        my_mpi_type = MPI_INT;
+        my_type_size = NETCDF_INT_FLOAT_SIZE;
+        break;
+    case PIO_FLOAT:
+        my_mpi_type = MPI_FLOAT;
+        my_type_size = NETCDF_INT_FLOAT_SIZE;
+        break;
+    case PIO_DOUBLE:
+        my_mpi_type = MPI_DOUBLE;
+        my_type_size = NETCDF_DOUBLE_INT64_SIZE;
+        break;
+#ifdef _NETCDF4
+    case PIO_UBYTE:
+        my_mpi_type = MPI_UNSIGNED_CHAR;
+        my_type_size = NETCDF_CHAR_SIZE;
+        break;
+    case PIO_USHORT:
+        my_mpi_type = MPI_UNSIGNED_SHORT;
+        my_type_size = NETCDF_SHORT_SIZE;
+        break;
+    case PIO_UINT:
+        my_mpi_type = MPI_UNSIGNED;
+        my_type_size = NETCDF_INT_FLOAT_SIZE;
+        break;
+    case PIO_INT64:
+        my_mpi_type = MPI_LONG_LONG;
+        my_type_size = NETCDF_DOUBLE_INT64_SIZE;
+        break;
+    case PIO_UINT64:
+        my_mpi_type = MPI_UNSIGNED_LONG_LONG;
+        my_type_size = NETCDF_DOUBLE_INT64_SIZE;
+        break;
+    case PIO_STRING:
+        my_mpi_type = MPI_CHAR;
+        my_type_size = NETCDF_CHAR_SIZE;
+        break;
+#endif /* _NETCDF4 */
+    default:
+        return PIO_EBADTYPE;
+    }
+
+    /* If caller wants MPI type, set it. */
+    if (mpi_type)
+        *mpi_type = my_mpi_type;
+
+    /* If caller wants type size, set it. */
+    if (type_size)
+        *type_size = my_type_size;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Allocate space for an IO description struct, and initialize it.
+ *
+ * @param ios pointer to the IO system info, used for error
+ * handling.
+ * @param piotype the PIO data type (ex. PIO_FLOAT, PIO_INT, etc.).
+ * @param ndims the number of dimensions.
+ * @param iodesc pointer that gets the newly allocated io_desc_t.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+malloc_iodesc(iosystem_desc_t *ios, int piotype, int ndims,
+              io_desc_t **iodesc)
+{
+    MPI_Datatype mpi_type;
+    PIO_Offset type_size;
+    int mpierr;
+    int ret;
+
+    /* Check input. */
+    pioassert(ios && piotype > 0 && ndims >= 0 && iodesc,
+              "invalid input", __FILE__, __LINE__);
+
+    PLOG((1, "malloc_iodesc piotype = %d ndims = %d", piotype, ndims));
+
+    /* Get the MPI type corresponding with the PIO type. */
+    if ((ret = find_mpi_type(piotype, &mpi_type, NULL)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* What is the size of the pio type? */
+    if ((ret = pioc_pnetcdf_inq_type(0, piotype, NULL, &type_size)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Allocate space for the io_desc_t struct. */
+    if (!(*iodesc = calloc(1, sizeof(io_desc_t))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Remember the pio type and its size. */
+    (*iodesc)->piotype = piotype;
+    (*iodesc)->piotype_size = type_size;
+
+    /* Remember the MPI type. */
+    (*iodesc)->mpitype = mpi_type;
+
+    /* Get the size of the type. */
+    if (mpi_type == MPI_DATATYPE_NULL)
+        (*iodesc)->mpitype_size = 0;
+    else
+        if ((mpierr = MPI_Type_size((*iodesc)->mpitype, &(*iodesc)->mpitype_size)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Initialize some values in the struct. */
+    (*iodesc)->maxregions = 1;
+    for (int k = 0; k < 2; k++)
+        (*iodesc)->vard_type[k] = MPI_DATATYPE_NULL;
+    (*iodesc)->ioid = -1;
+    (*iodesc)->ndims = ndims;
+    (*iodesc)->readonly = 0;
+
+    /* Allocate space for, and initialize, the first region. */
+    if ((ret = alloc_region2(ios, ndims, &((*iodesc)->firstregion))))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Set the swap memory settings to defaults for this IO system. */
+    (*iodesc)->rearr_opts = ios->rearr_opts;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free a region list.
+ *
+ * top a pointer to the start of the list to free.
+ * @author Jim Edwards
+ */
+void
+free_region_list(io_region *top)
+{
+    io_region *ptr, *tptr;
+
+    ptr = top;
+    while (ptr)
+    {
+        if (ptr->start)
+            free(ptr->start);
+        if (ptr->count)
+            free(ptr->count);
+        tptr = ptr;
+        ptr = ptr->next;
+        free(tptr);
+    }
+}
+
+/**
+ * Free a decomposition map.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the decomposition map to free.
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_freedecomp_c
+ * @author Jim Edwards
+ */
+int
+PIOc_freedecomp(int iosysid, int ioid)
+{
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc;
+    int parent;  /* The decomposition an extruded one extrudes. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function calls. */
+    int ret;
+
+    PLOG((1, "PIOc_freedecomp iosysid = %d ioid = %d", iosysid, ioid));
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* A shared decomposition is only freed by the last user. */
+    if (iodesc->refcount > 1)
+    {
+        iodesc->refcount--;
+        PLOG((2, "ioid %d still has %d users", ioid, iodesc->refcount));
+        return PIO_NOERR;
+    }
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_FREEDECOMP; /* Message for async notification. */
+
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            if (!mpierr)
+                mpierr = MPI_Bcast(&iosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ioid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            PLOG((2, "PIOc_freedecomp iosysid = %d ioid = %d", iosysid, ioid));
+        }
+
+        /* Handle MPI errors. */
+        PLOG((3, "handling mpierr %d ios->comproot %d", mpierr, ios->comproot));
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, NULL, mpierr2, __FILE__, __LINE__);
+        PLOG((3, "handling mpierr2 %d", mpierr2));
+        if (mpierr)
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* A gathered decomposition is no longer used by its parent. */
+    if (iodesc->gather_parent)
+    {
+        io_desc_t *parent = pio_get_iodesc_from_id(iodesc->gather_parent);
+
+        if (parent && parent->gathered_ioid == ioid)
+            parent->gathered_ioid = 0;
+    }
+
+    PLOG((3, "freeing map, dimlen"));
+    /* Free the map. */
+    free(iodesc->map);
+
+    /* Free the dimlens. */
+    free(iodesc->dimlen);
+    free(iodesc->coarse_factor);
+
+    if (iodesc->remap)
+        free(iodesc->remap);
+
+    if (iodesc->remap_runs)
+        free(iodesc->remap_runs);
+
+    /* Free any persistent rearranger requests. */
+    if ((ret = free_rearr_persist(&iodesc->comp2io_persist)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = free_rearr_persist(&iodesc->io2comp_persist)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    PLOG((3, "freeing rfrom, rtype"));
+    if (iodesc->rfrom)
+        free(iodesc->rfrom);
+
+    if (iodesc->rtype)
+    {
+        for (int i = 0; i < iodesc->nrecvs; i++)
+            if (iodesc->rtype[i] != PIO_DATATYPE_NULL)
+                if ((ret = free_mpi_datatype(&iodesc->rtype[i])))
+                    return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+        pio_free(PIO_MEM_MPITYPE, iodesc->rtype);
+    }
+
+    PLOG((3, "freeing stype, scount"));
+    if (iodesc->stype)
+    {
+        for (int i = 0; i < iodesc->num_stypes; i++)
+            if (iodesc->stype[i] != PIO_DATATYPE_NULL)
+                if ((ret = free_mpi_datatype(iodesc->stype + i)))
+                    return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+        pio_free(PIO_MEM_MPITYPE, iodesc->stype);
+    }
+
+    if (iodesc->ustype)
+    {
+        for (int i = 0; i < iodesc->num_stypes; i++)
+            if (iodesc->ustype[i] != PIO_DATATYPE_NULL)
+                if ((ret = free_mpi_datatype(iodesc->ustype + i)))
+                    return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+        free(iodesc->ustype);
+    }
+    iodesc->num_stypes = 0;
+
+    /* Free the file types of vard. */
+    for (int k = 0; k < 2; k++)
+        if (iodesc->vard_fndims[k] && iodesc->vard_type[k] != MPI_DATATYPE_NULL)
+            if ((mpierr = MPI_Type_free(&iodesc->vard_type[k])))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    if (iodesc->scount)
+        free(iodesc->scount);
+
+    if (iodesc->rcount)
+        free(iodesc->rcount);
+
+    if (iodesc->sindex)
+        pio_free(PIO_MEM_INDEX, iodesc->sindex);
+
+    if (iodesc->rindex)
+        pio_free(PIO_MEM_INDEX, iodesc->rindex);
+
+    if (iodesc->pack_rindex)
+        pio_free(PIO_MEM_INDEX, iodesc->pack_rindex);
+
+    PLOG((3, "freeing regions"));
+    if (iodesc->firstregion)
+        free_region_list(iodesc->firstregion);
+
+    if (iodesc->fillregion)
+        free_region_list(iodesc->fillregion);
+
+    if ((ret = free_shm(iodesc)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* The subset comm of the IO system is freed with the last
+     * decomposition that uses it. A private one is freed here. */
+    if (iodesc->rearranger == PIO_REARR_SUBSET && iodesc->subset_comm_private)
+    {
+        if ((mpierr = MPI_Comm_free(&iodesc->subset_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    else if (iodesc->rearranger == PIO_REARR_SUBSET && !iodesc->extrude_parent &&
+             ios->subset_comm_refs && !--ios->subset_comm_refs)
+        if ((mpierr = MPI_Comm_free(&ios->subset_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    if (iodesc->nnode)
+    {
+        if ((mpierr = MPI_Comm_free(&iodesc->node_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if (iodesc->node_ustype != PIO_DATATYPE_NULL)
+            if ((mpierr = MPI_Type_free(&iodesc->node_ustype)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        free(iodesc->node_counts);
+        free(iodesc->node_displs);
+        free(iodesc->node_buf);
+    }
+
+    if (iodesc->peers)
+    {
+        if (iodesc->rearr_opts.comm_type == PIO_REARR_COMM_NEIGHBOR)
+            if ((mpierr = MPI_Comm_free(&iodesc->neighbor_comm)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        free(iodesc->peers);
+        free(iodesc->peer_counts);
+        free(iodesc->peer_types);
+    }
+
+    /* The ioid may be used again for another decomposition. */
+    pio_read_cache_clear(ios, NULL, ioid);
+
+    /* An extruded decomposition holds a reference to the
+     * decomposition it extrudes. */
+    parent = iodesc->extrude_parent;
+    if ((ret = pio_delete_iodesc_from_list(ioid)))
+        return ret;
+    if (parent)
+        return PIOc_freedecomp(iosysid, parent);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read a decomposition map from a file. Text decomp files are only
+ * read by task 0 in the communicator. Binary decomp files, written by
+ * PIOc_writemap_bin(), are read by all tasks with PIOc_readmap_bin().
+ *
+ * @param file the filename
+ * @param ndims pointer to an int with the number of dims.
+ * @param gdims pointer to an array of dimension ids.
+ * @param fmaplen
+ * @param map
+ * @param comm
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+PIOc_readmap(const char *file, int *ndims, int **gdims, PIO_Offset *fmaplen,
+             PIO_Offset **map, MPI_Comm comm)
+{
+    int npes, myrank;
+    int rnpes, rversno;
+    int j;
+    int *tdims;
+    PIO_Offset *tmap;
+    MPI_Status status;
+    PIO_Offset maplen;
+    int bin = 0;
+    int mpierr; /* Return code for MPI calls. */
+
+    /* Check inputs. */
+    if (!file || !ndims || !gdims || !fmaplen || !map)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Comm_size(comm, &npes)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(comm, &myrank)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Binary decomp files are read in parallel by
+     * PIOc_readmap_bin(). */
+    if (myrank == 0)
+    {
+        FILE *fp;
+        PIO_Offset magic;
+
+        if ((fp = fopen(file, "r")))
+        {
+            if (fread(&magic, sizeof(PIO_Offset), 1, fp) == 1 && magic == PIO_MAP_BIN_MAGIC)
+                bin = 1;
+            fclose(fp);
+        }
+    }
+    if ((mpierr = MPI_Bcast(&bin, 1, MPI_INT, 0, comm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if (bin)
+        return PIOc_readmap_bin(file, ndims, gdims, fmaplen, map, comm);
+
+    if (myrank == 0)
+    {
+        FILE *fp = fopen(file, "r");
+        if (!fp)
+            pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+        if (fscanf(fp,"version %d npes %d ndims %d\n", &rversno, &rnpes, ndims) != 3)
+            pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+        if (rversno != VERSNO)
+            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+        if (rnpes < 1 || rnpes > npes)
+            return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+        if ((mpierr = MPI_Bcast(&rnpes, 1, MPI_INT, 0, comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Bcast(ndims, 1, MPI_INT, 0, comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        if (!(tdims = calloc(*ndims, sizeof(int))))
+            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        for (int i = 0; i < *ndims; i++)
+            if (fscanf(fp,"%d ", tdims + i) != 1)
+                pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+        if ((mpierr = MPI_Bcast(tdims, *ndims, MPI_INT, 0, comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+        for (int i = 0; i < rnpes; i++)
+        {
+            if (fscanf(fp, "%d %lld", &j, &maplen) != 2)
+                pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+            if (j != i)  // Not sure how this could be possible
+                return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+            if (!(tmap = malloc(maplen * sizeof(PIO_Offset))))
+                return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+            for (j = 0; j < maplen; j++)
+                if (fscanf(fp, "%lld ", tmap + j) != 1)
+                    pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+            if (i > 0)
+            {
+                if ((mpierr = MPI_Send(&maplen, 1, PIO_OFFSET, i, i + npes, comm)))
+                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+                if ((mpierr = MPI_Send(tmap, maplen, PIO_OFFSET, i, i, comm)))
+                    return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+                free(tmap);
+            }
+            else
+            {
+                *map = tmap;
+                *fmaplen = maplen;
+            }
+        }
+        fclose(fp);
+    }
+    else
+    {
+        if ((mpierr = MPI_Bcast(&rnpes, 1, MPI_INT, 0, comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Bcast(ndims, 1, MPI_INT, 0, comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        if (!(tdims = calloc(*ndims, sizeof(int))))
+            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        if ((mpierr = MPI_Bcast(tdims, *ndims, MPI_INT, 0, comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+        if (myrank < rnpes)
+        {
+            if ((mpierr = MPI_Recv(&maplen, 1, PIO_OFFSET, 0, myrank + npes, comm, &status)))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+            if (!(tmap = malloc(maplen * sizeof(PIO_Offset))))
+                return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+            if ((mpierr = MPI_Recv(tmap, maplen, PIO_OFFSET, 0, myrank, comm, &status)))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+            *map = tmap;
+        }
+        else
+        {
+            tmap = NULL;
+            maplen = 0;
+        }
+        *fmaplen = maplen;
+    }
+    *gdims = tdims;
+    return PIO_NOERR;
+}
+
+/**
+ * Read a binary decomposition map file, written by
+ * PIOc_writemap_bin(). The file is read collectively with MPI-IO, and
+ * each task only reads its own part of the map, which it finds from
+ * the index in the file. Tasks beyond the number of tasks which wrote
+ * the file get an empty map.
+ *
+ * @param file the filename
+ * @param ndims pointer to an int that gets the number of dims.
+ * @param gdims pointer that gets an array of the global dimension
+ * lengths. This must be freed by the caller.
+ * @param fmaplen pointer that gets the length of the map of this task.
+ * @param map pointer that gets the map of this task. This must be
+ * freed by the caller.
+ * @param comm the MPI communicator.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_readmap_bin(const char *file, int *ndims, int **gdims, PIO_Offset *fmaplen,
+                 PIO_Offset **map, MPI_Comm comm)
+{
+    MPI_File fh;
+    PIO_Offset hdr[PIO_MAP_BIN_HDR] = {0};
+    PIO_Offset idx[2] = {0, 0};
+    PIO_Offset *tdims;
+    PIO_Offset *tmap = NULL;
+    int npes, myrank;
+    int ret = PIO_NOERR;
+    int mpierr; /* Return code for MPI calls. */
+
+    /* Check inputs. */
+    if (!file || !ndims || !gdims || !fmaplen || !map)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Comm_size(comm, &npes)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(comm, &myrank)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((1, "PIOc_readmap_bin file = %s npes = %d", file, npes));
+
+    if ((mpierr = MPI_File_open(comm, (char *)file, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Every task reads the header, so they all agree about it. */
+    if ((mpierr = MPI_File_read_at_all(fh, 0, hdr, PIO_MAP_BIN_HDR, PIO_OFFSET,
+                                       MPI_STATUS_IGNORE)))
+    {
+        MPI_File_close(&fh);
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    }
+    if (hdr[0] != PIO_MAP_BIN_MAGIC || hdr[1] != VERSNO || hdr[2] < 1 || hdr[2] > npes ||
+        hdr[3] < 1)
+    {
+        MPI_File_close(&fh);
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    }
+    *ndims = hdr[3];
+
+    if (!(tdims = malloc(*ndims * sizeof(PIO_Offset))))
+    {
+        MPI_File_close(&fh);
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+
+    /* Read the dimlens, and the start and end of the map of this task
+     * from the index. */
+    mpierr = MPI_File_read_at_all(fh, PIO_MAP_BIN_HDR * sizeof(PIO_Offset), tdims, *ndims,
+                                  PIO_OFFSET, MPI_STATUS_IGNORE);
+    if (!mpierr)
+        mpierr = MPI_File_read_at_all(fh, (PIO_MAP_BIN_HDR + *ndims + myrank) * sizeof(PIO_Offset),
+                                      idx, myrank < hdr[2] ? 2 : 0, PIO_OFFSET,
+                                      MPI_STATUS_IGNORE);
+    if (!mpierr && idx[1] > idx[0])
+        if (!(tmap = malloc((idx[1] - idx[0]) * sizeof(PIO_Offset))))
+            ret = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    PLOG((2, "myrank = %d map from %lld to %lld", myrank, idx[0], idx[1]));
+
+    /* Read the map of this task. */
+    if (!mpierr)
+        mpierr = MPI_File_read_at_all(fh, idx[0] * sizeof(PIO_Offset), tmap,
+                                      tmap ? idx[1] - idx[0] : 0, PIO_OFFSET,
+                                      MPI_STATUS_IGNORE);
+    if (!mpierr)
+        mpierr = MPI_File_close(&fh);
+    else
+        MPI_File_close(&fh);
+
+    if (!mpierr && !ret)
+    {
+        if (!(*gdims = malloc(*ndims * sizeof(int))))
+            ret = pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        else
+            for (int d = 0; d < *ndims; d++)
+                (*gdims)[d] = tdims[d];
+    }
+    free(tdims);
+    if (mpierr || ret)
+    {
+        free(tmap);
+        return mpierr ? check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__) : ret;
+    }
+
+    *map = tmap;
+    *fmaplen = tmap ? idx[1] - idx[0] : 0;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read a decomposition map from file.
+ *
+ * @param file the filename
+ * @param ndims pointer to the number of dimensions
+ * @param gdims pointer to an array of dimension ids
+ * @param maplen pointer to the length of the map
+ * @param map pointer to the map array
+ * @param f90_comm
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+PIOc_readmap_from_f90(const char *file, int *ndims, int **gdims, PIO_Offset *maplen,
+                      PIO_Offset **map, int f90_comm)
+{
+    return PIOc_readmap(file, ndims, gdims, maplen, map, MPI_Comm_f2c(f90_comm));
+}
+
+/**
+ * Get the summary of the balance of a decomposition, to write to a
+ * decomp file. This is an internal function.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the decomposition.
+ * @param report array of length DECOMP_REPORT_LEN that gets the
+ * summary.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+decomp_report_text(int iosysid, int ioid, char *report)
+{
+    pio_decomp_report_t r;
+    int ret;
+
+    if ((ret = PIOc_get_decomp_report(iosysid, ioid, &r)))
+        return ret;
+    snprintf(report, DECOMP_REPORT_LEN, "IO tasks %d; IO bytes per IO task min %lld "
+             "max %lld mean %.0f; regions per IO task min %d max %d; rearranger "
+             "messages per comp task max %d per IO task max %d; fill fraction %.3f",
+             r.num_iotasks, (long long)r.min_iobytes, (long long)r.max_iobytes,
+             r.mean_iobytes, r.min_regions, r.max_regions, r.max_comp_msgs,
+             r.max_io_msgs, r.fill_fraction);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the global attributes of a netCDF decomp file. This is an
+ * internal function.
+ *
+ * @param ios pointer to io system info.
+ * @param ncid the ncid of the decomp file, in define mode.
+ * @param max_maplen the maximum maplen of any task.
+ * @param title title attribute, ignored if NULL.
+ * @param history history attribute, ignored if NULL.
+ * @param fortran_order set to non-zero if using fortran array
+ * ordering, 0 for C array ordering.
+ * @param report summary of the balance of the decomposition, ignored
+ * if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+write_decomp_atts(iosystem_desc_t *ios, int ncid, int max_maplen, const char *title,
+                  const char *history, int fortran_order, const char *report)
+{
+    int ret;
+
+    /* Write an attribute with the version of this file. */
+    char version[PIO_MAX_NAME + 1];
+    sprintf(version, "%d.%d.%d", PIO_VERSION_MAJOR, PIO_VERSION_MINOR, PIO_VERSION_PATCH);
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_VERSION_ATT_NAME,
+                                 strlen(version) + 1, version)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write an attribute with the max map len. */
+    if ((ret = PIOc_put_att_int(ncid, NC_GLOBAL, DECOMP_MAX_MAPLEN_ATT_NAME,
+                                PIO_INT, 1, &max_maplen)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write title attribute, if the user provided one. */
+    if (title)
+        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_TITLE_ATT_NAME,
+                                     strlen(title) + 1, title)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write history attribute, if the user provided one. */
+    if (history)
+        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_HISTORY_ATT_NAME,
+                                     strlen(history) + 1, history)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write the summary of the balance of the IO tasks, if there is
+     * one. */
+    if (report)
+        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_REPORT_ATT_NAME,
+                                     strlen(report) + 1, report)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write a source attribute. */
+    char source[] = "Decomposition file produced by PIO library.";
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_SOURCE_ATT_NAME,
+                                 strlen(source) + 1, source)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write an attribute with array ordering (C or Fortran). */
+    char c_order_str[] = DECOMP_C_ORDER_STR;
+    char fortran_order_str[] = DECOMP_FORTRAN_ORDER_STR;
+    char *my_order_str = fortran_order ? fortran_order_str : c_order_str;
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_ORDER_ATT_NAME,
+                                 strlen(my_order_str) + 1, my_order_str)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write an attribute with the stack trace. This can be helpful
+     * for debugging. */
+    void *bt[MAX_BACKTRACE];
+    size_t bt_size;
+    char **bt_strings;
+    bt_size = backtrace(bt, MAX_BACKTRACE);
+    bt_strings = backtrace_symbols(bt, bt_size);
+
+    /* Find the max size. */
+    int max_bt_size = 0;
+    for (int b = 0; b < bt_size; b++)
+        if (strlen(bt_strings[b]) > max_bt_size)
+            max_bt_size = strlen(bt_strings[b]);
+    if (max_bt_size > PIO_MAX_NAME)
+        max_bt_size = PIO_MAX_NAME;
+
+    /* Copy the backtrace into one long string. */
+    char full_bt[max_bt_size * bt_size + bt_size + 1];
+    full_bt[0] = '\0';
+    for (int b = 0; b < bt_size; b++)
+    {
+        strncat(full_bt, bt_strings[b], max_bt_size);
+        strcat(full_bt, "\n");
+    }
+    free(bt_strings);
+
+    /* Write the stack trace as an attribute. */
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_BACKTRACE_ATT_NAME,
+                                 strlen(full_bt) + 1, full_bt)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read the global attributes of a netCDF decomp file. This is an
+ * internal function.
+ *
+ * @param ios pointer to io system info.
+ * @param ncid the ncid of the open decomp file.
+ * @param max_maplen pointer that gets the maximum maplen of any task.
+ * @param title pointer that gets the title attribute, or an empty
+ * string. Ignored if NULL.
+ * @param history pointer that gets the history attribute, or an
+ * empty string. Ignored if NULL.
+ * @param source pointer that gets the source attribute, or an empty
+ * string. Ignored if NULL.
+ * @param version pointer that gets the version attribute. Ignored if
+ * NULL.
+ * @param fortran_order pointer that gets 1 for fortran array
+ * ordering, 0 for C array ordering. Ignored if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+read_decomp_atts(iosystem_desc_t *ios, int ncid, int *max_maplen, char *title, char *history,
+                 char *source, char *version, int *fortran_order)
+{
+    int peh;
+    int ret;
+
+    /* Read version attribute. */
+    char version_in[PIO_MAX_NAME + 1];
+    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_VERSION_ATT_NAME, version_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    PLOG((3, "version_in = %s", version_in));
+    if (version)
+        strncpy(version, version_in, PIO_MAX_NAME + 1);
+
+    /* Read order attribute. */
+    char order_in[PIO_MAX_NAME + 1];
+    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_ORDER_ATT_NAME, order_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    PLOG((3, "order_in = %s", order_in));
+    if (fortran_order)
+    {
+        if (!strncmp(order_in, DECOMP_C_ORDER_STR, PIO_MAX_NAME + 1))
+            *fortran_order = 0;
+        else if (!strncmp(order_in, DECOMP_FORTRAN_ORDER_STR, PIO_MAX_NAME + 1))
+            *fortran_order = 1;
+        else
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    }
+
+    /* Read attribute with the max map len. */
+    int max_maplen_in;
+    if ((ret = PIOc_get_att_int(ncid, NC_GLOBAL, DECOMP_MAX_MAPLEN_ATT_NAME, &max_maplen_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    PLOG((3, "max_maplen_in = %d", max_maplen_in));
+    *max_maplen = max_maplen_in;
+
+    /* Read title attribute, if it is in the file. */
+    peh = PIOc_Set_File_Error_Handling(ncid, PIO_BCAST_ERROR);
+    char title_in[PIO_MAX_NAME + 1];
+    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_TITLE_ATT_NAME, title_in);
+    if (ret == PIO_NOERR)
+    {
+        /* If the caller wants it, copy the title for them. */
+        if (title)
+            strncpy(title, title_in, PIO_MAX_NAME + 1);
+    }
+    else if (ret == PIO_ENOTATT)
+    {
+        /* No title attribute. */
+        if (title)
+            title[0] = '\0';
+    }
+    else
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Read history attribute, if it is in the file. */
+    char history_in[PIO_MAX_NAME + 1];
+    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_HISTORY_ATT_NAME, history_in);
+    if (ret == PIO_NOERR)
+    {
+        /* If the caller wants it, copy the history for them. */
+        if (history)
+            strncpy(history, history_in, PIO_MAX_NAME + 1);
+    }
+    else if (ret == PIO_ENOTATT)
+    {
+        /* No history attribute. */
+        if (history)
+            history[0] = '\0';
+    }
+    else
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Read source attribute. */
+    char source_in[PIO_MAX_NAME + 1];
+    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_SOURCE_ATT_NAME, source_in);
+    if (ret == PIO_NOERR)
+    {
+        if (source)
+            strncpy(source, source_in, PIO_MAX_NAME + 1);
+    }
+    else if (ret == PIO_ENOTATT)
+    {
+        if (source)
+            source[0] = '\0';
+    }
+    else
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    PIOc_Set_File_Error_Handling(ncid, peh);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the decomposition map to a file using netCDF, everyones
+ * favorite data format.
+ *
+ * @param iosysid the IO system ID.
+ * @param filename the filename to be used.
+ * @param cmode for PIOc_create(). Will be bitwise or'd with NC_WRITE.
+ * @param ioid the ID of the IO description.
+ * @param title optional title attribute for the file. Must be less than
+ * PIO_MAX_NAME + 1 if provided. Ignored if NULL.
+ * @param history optial history attribute for the file. Must be less
+ * than PIO_MAX_NAME + 1 if provided. Ignored if NULL.
+ * @param fortran_order set to non-zero if fortran array ordering is
+ * used, or to zero if C array ordering is used.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_write_nc_decomp(int iosysid, const char *filename, int cmode, int ioid,
+                     char *title, char *history, int fortran_order)
+{
+    iosystem_desc_t *ios; /* IO system info. */
+    io_desc_t *iodesc;    /* Decomposition info. */
+    int max_maplen;       /* The maximum maplen used for any task. */
+    int *full_map;        /* 2D array holds all map info for all tasks. */
+    int *my_map;          /* 1D array holds all map info for this task. */
+    char report_text[DECOMP_REPORT_LEN];
+    char *report = NULL;  /* Summary of the balance of the IO tasks. */
+    int mpierr;
+    int ret;
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (!filename)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (title)
+        if (strlen(title) > PIO_MAX_NAME)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (history)
+        if (strlen(history) > PIO_MAX_NAME)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    PLOG((1, "PIOc_write_nc_decomp filename = %s iosysid = %d ioid = %d "
+          "ios->num_comptasks = %d", filename, iosysid, ioid, ios->num_comptasks));
+
+    /* Get the IO desc, which describes the decomposition. Its map
+     * must not have been released. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!iodesc->map)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Summarize the balance of the IO tasks. */
+    if (!ios->async)
+    {
+        if ((ret = decomp_report_text(iosysid, ioid, report_text)))
+            return ret;
+        report = report_text;
+    }
+
+    /* Allocate memory for array which will contain the length of the
+     * map on each task, for all computation tasks. */
+    int task_maplen[ios->num_comptasks];
+    PLOG((3, "ios->num_comptasks = %d", ios->num_comptasks));
+
+    /* Gather maplens from all computation tasks and fill the
+     * task_maplen array on all tasks. */
+    if ((mpierr = MPI_Allgather(&iodesc->maplen, 1, MPI_INT, task_maplen, 1, MPI_INT,
+                                ios->comp_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Find the max maplen. */
+    if ((mpierr = MPI_Allreduce(&iodesc->maplen, &max_maplen, 1, MPI_INT, MPI_MAX,
+                                ios->comp_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((3, "max_maplen = %d", max_maplen));
+
+    if (!(full_map = malloc(sizeof(int) * ios->num_comptasks * max_maplen)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    if (!(my_map = malloc(sizeof(int) * max_maplen)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Fill local array with my map. Use the fill value for unused */
+    /* elements at the end if max_maplen is longer than maplen. Also
+     * subtract 1 because the iodesc->map is 1-based. */
+    for (int e = 0; e < max_maplen; e++)
+    {
+        my_map[e] = e < iodesc->maplen ? iodesc->map[e] - 1 : NC_FILL_INT;
+        PLOG((3, "my_map[%d] = %d", e, my_map[e]));
+    }
+
+    /* Gather my_map from all computation tasks and fill the full_map array. */
+    if ((mpierr = MPI_Allgather(my_map, max_maplen, MPI_INT, full_map, max_maplen,
+                                MPI_INT, ios->comp_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    free(my_map);
+
+    for (int p = 0; p < ios->num_comptasks; p++)
+        for (int e = 0; e < max_maplen; e++)
+            PLOG((3, "full_map[%d][%d] = %d", p, e, full_map[p * max_maplen + e]));
+
+    /* Write the netCDF decomp file. */
+    if ((ret = pioc_write_nc_decomp_int(ios, filename, cmode, iodesc->ndims, iodesc->dimlen,
+                                        ios->num_comptasks, task_maplen, full_map, title,
+                                        history, fortran_order, report)))
+        return ret;
+
+    free(full_map);
+    return PIO_NOERR;
+}
+
+/**
+ * Read the map of one task from a ragged netCDF decomp file, written
+ * by PIOc_write_nc_decomp_ragged(). Each task reads its own map with
+ * PIOc_read_darray(). This is an internal function.
+ *
+ * @param ios pointer to io system info.
+ * @param ncid the ncid of the open decomp file.
+ * @param my_rank the rank of this task in the decomp.
+ * @param size the number of tasks, which must match the decomp file.
+ * @param ndims pointer that gets the number of dims.
+ * @param global_dimlen pointer that gets an array with the global
+ * dimension lengths. Must be freed by caller.
+ * @param maplen pointer that gets the maplen of this task.
+ * @param compmap pointer that gets the 1-based map of this task. Must
+ * be freed by caller.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+read_nc_decomp_ragged(iosystem_desc_t *ios, int ncid, int my_rank, int size, int *ndims,
+                      int **global_dimlen, int *maplen, PIO_Offset **compmap)
+{
+    int dimid, varid;
+    PIO_Offset ndims_in, num_tasks_in, total_in;
+    int *my_map;
+    PIO_Offset *elem;
+    int map_ioid;
+    int total;
+    PIO_Offset sum_maplen = 0;
+    int ret;
+
+    /* Find the dim lengths. */
+    if ((ret = PIOc_inq_dimid(ncid, DECOMP_DIM_DIM, &dimid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dimlen(ncid, dimid, &ndims_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dimid(ncid, DECOMP_TASK_DIM_NAME, &dimid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dimlen(ncid, dimid, &num_tasks_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dimid(ncid, DECOMP_MAPELEM_DIM_NAME, &dimid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dimlen(ncid, dimid, &total_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    PLOG((2, "read_nc_decomp_ragged ndims = %lld num_tasks = %lld total = %lld", ndims_in,
+          num_tasks_in, total_in));
+
+    /* The decomp must be for this number of tasks. */
+    if (num_tasks_in != size)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (total_in > INT_MAX)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    *ndims = ndims_in;
+    total = total_in;
+
+    /* Read the global sizes, and the maplen and offset of all
+     * tasks. These are small. */
+    int task_maplen[num_tasks_in];
+    int task_offset[num_tasks_in];
+    if (!(*global_dimlen = malloc(ndims_in * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(ret = PIOc_inq_varid(ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, &varid)) &&
+        !(ret = PIOc_get_var_int(ncid, varid, *global_dimlen)) &&
+        !(ret = PIOc_inq_varid(ncid, DECOMP_MAPLEN_VAR_NAME, &varid)) &&
+        !(ret = PIOc_get_var_int(ncid, varid, task_maplen)) &&
+        !(ret = PIOc_inq_varid(ncid, DECOMP_MAP_OFFSET_VAR_NAME, &varid)))
+        ret = PIOc_get_var_int(ncid, varid, task_offset);
+    if (!ret)
+    {
+        for (int t = 0; t < num_tasks_in; t++)
+            sum_maplen += task_maplen[t];
+        *maplen = task_maplen[my_rank];
+        if (task_offset[my_rank] < 0 || task_offset[my_rank] + (PIO_Offset)*maplen > total)
+            ret = PIO_EINVAL;
+    }
+
+    /* Read the map of this task. */
+    if (!ret)
+        ret = PIOc_inq_varid(ncid, DECOMP_MAP_VAR_NAME, &varid);
+    if (!ret && !(my_map = malloc((*maplen + 1) * sizeof(int))))
+        ret = PIO_ENOMEM;
+    if (!ret && !(elem = malloc((*maplen + 1) * sizeof(PIO_Offset))))
+    {
+        free(my_map);
+        ret = PIO_ENOMEM;
+    }
+    if (ret)
+    {
+        free(*global_dimlen);
+        *global_dimlen = NULL;
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+    for (int e = 0; e < *maplen; e++)
+        elem[e] = task_offset[my_rank] + e + 1;
+    if (sum_maplen &&
+        !(ret = PIOc_InitDecomp(ios->iosysid, PIO_INT, 1, &total, *maplen, elem, &map_ioid,
+                                NULL, NULL, NULL)))
+    {
+        ret = PIOc_read_darray(ncid, varid, map_ioid, *maplen, my_map);
+        PIOc_freedecomp(ios->iosysid, map_ioid);
+    }
+
+    /* The map in the file is 0-based. */
+    if (!ret)
+        for (int e = 0; e < *maplen; e++)
+            elem[e] = my_map[e] + 1;
+    free(my_map);
+    if (ret)
+    {
+        free(elem);
+        free(*global_dimlen);
+        *global_dimlen = NULL;
+        return ret;
+    }
+    *compmap = elem;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Define and write the vars of a ragged decomp file, created by
+ * PIOc_write_nc_decomp_ragged(). The caller closes the file.
+ *
+ * @param ios pointer to the IO system info.
+ * @param iodesc pointer to the decomposition info.
+ * @param ncid the ncid of the decomp file.
+ * @param task_maplen the maplen of each computation task.
+ * @param task_offset the start of the map of each computation task
+ * in the map var.
+ * @param max_maplen the maximum maplen of any task.
+ * @param total_maplen the sum of the maplens of all tasks.
+ * @param title optional title attribute for the file. Ignored if
+ * NULL.
+ * @param history optional history attribute for the file. Ignored
+ * if NULL.
+ * @param fortran_order set to non-zero if fortran array ordering is
+ * used.
+ * @param report summary of the balance of the IO tasks, or NULL.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+write_nc_decomp_ragged_vars(iosystem_desc_t *ios, io_desc_t *iodesc, int ncid,
+                            int *task_maplen, int *task_offset, int max_maplen,
+                            int total_maplen, char *title, char *history,
+                            int fortran_order, const char *report)
+{
+    int dimids[3];        /* The dims, task and map element dimids. */
+    int gsize_varid, maplen_varid, offset_varid, map_varid;
+    int *my_map;          /* The 0-based map of this task. */
+    PIO_Offset *compmap;  /* Where my_map goes in the map var. */
+    int map_ioid;         /* The decomposition of the map var. */
+    int ret;
+
+    if ((ret = write_decomp_atts(ios, ncid, max_maplen, title, history, fortran_order,
+                                 report)))
+        return ret;
+    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_LAYOUT_ATT_NAME,
+                                 strlen(DECOMP_RAGGED_STR) + 1, DECOMP_RAGGED_STR)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* The map element dim has the total length of all maps. A length
+     * of 0 would make it unlimited. */
+    if ((ret = PIOc_def_dim(ncid, DECOMP_DIM_DIM, iodesc->ndims, &dimids[0])))
+        return ret;
+    if ((ret = PIOc_def_dim(ncid, DECOMP_TASK_DIM_NAME, ios->num_comptasks, &dimids[1])))
+        return ret;
+    if ((ret = PIOc_def_dim(ncid, DECOMP_MAPELEM_DIM_NAME, total_maplen ? total_maplen : 1,
+                            &dimids[2])))
+        return ret;
+    if ((ret = PIOc_def_var(ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, NC_INT, 1, &dimids[0],
+                            &gsize_varid)))
+        return ret;
+    if ((ret = PIOc_def_var(ncid, DECOMP_MAPLEN_VAR_NAME, NC_INT, 1, &dimids[1],
+                            &maplen_varid)))
+        return ret;
+    if ((ret = PIOc_def_var(ncid, DECOMP_MAP_OFFSET_VAR_NAME, NC_INT, 1, &dimids[1],
+                            &offset_varid)))
+        return ret;
+    if ((ret = PIOc_def_var(ncid, DECOMP_MAP_VAR_NAME, NC_INT, 1, &dimids[2], &map_varid)))
+        return ret;
+    if ((ret = PIOc_enddef(ncid)))
+        return ret;
+
+    /* Write the global dimension sizes, maplens and offsets. */
+    if ((ret = PIOc_put_var_int(ncid, gsize_varid, iodesc->dimlen)))
+        return ret;
+    if ((ret = PIOc_put_var_int(ncid, maplen_varid, task_maplen)))
+        return ret;
+    if ((ret = PIOc_put_var_int(ncid, offset_varid, task_offset)))
+        return ret;
+
+    /* Each task writes its own map, 0-based, to its part of the map
+     * var. */
+    if (!(my_map = malloc((iodesc->maplen + 1) * sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(compmap = malloc((iodesc->maplen + 1) * sizeof(PIO_Offset))))
+    {
+        free(my_map);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+    for (int e = 0; e < iodesc->maplen; e++)
+    {
+        my_map[e] = iodesc->map[e] - 1;
+        compmap[e] = task_offset[ios->comp_rank] + e + 1;
+    }
+    if (total_maplen &&
+        !(ret = PIOc_InitDecomp(ios->iosysid, PIO_INT, 1, &total_maplen, iodesc->maplen,
+                                compmap, &map_ioid, NULL, NULL, NULL)))
+    {
+        ret = PIOc_write_darray(ncid, map_varid, map_ioid, iodesc->maplen, my_map, NULL);
+        PIOc_freedecomp(ios->iosysid, map_ioid);
+    }
+    free(compmap);
+    free(my_map);
+
+    return ret;
+}
+
+/**
+ * Write the decomposition map to a netCDF file with the ragged
+ * layout. The maps of all tasks are concatenated in a 1D map var,
+ * with the start of the map of each task in the map_offset var, so no
+ * space is wasted on padding when the decomposition is
+ * unbalanced. The map is written in parallel with
+ * PIOc_write_darray(), so it is never gathered on one task. The sum
+ * of the maplens of all tasks must fit in an int.
+ *
+ * Ragged decomp files can be read by PIOc_read_nc_decomp(), but not
+ * by PIO versions which only know the dense layout written by
+ * PIOc_write_nc_decomp().
+ *
+ * @param iosysid the IO system ID.
+ * @param filename the filename to be used.
+ * @param cmode for PIOc_create(). Will be bitwise or'd with NC_WRITE.
+ * @param ioid the ID of the IO description.
+ * @param title optional title attribute for the file. Must be less than
+ * PIO_MAX_NAME + 1 if provided. Ignored if NULL.
+ * @param history optial history attribute for the file. Must be less
+ * than PIO_MAX_NAME + 1 if provided. Ignored if NULL.
+ * @param fortran_order set to non-zero if fortran array ordering is
+ * used, or to zero if C array ordering is used.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_write_nc_decomp_ragged(int iosysid, const char *filename, int cmode, int ioid,
+                            char *title, char *history, int fortran_order)
+{
+    iosystem_desc_t *ios; /* IO system info. */
+    io_desc_t *iodesc;    /* Decomposition info. */
+    int max_maplen = 0;   /* The maximum maplen used for any task. */
+    PIO_Offset total_maplen = 0; /* The sum of the maplens of all tasks. */
+    char report_text[DECOMP_REPORT_LEN];
+    char *report = NULL;  /* Summary of the balance of the IO tasks. */
+    int ncid;
+    int mpierr;
+    int ret, ret2;
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (!filename)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if ((title && strlen(title) > PIO_MAX_NAME) || (history && strlen(history) > PIO_MAX_NAME))
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    PLOG((1, "PIOc_write_nc_decomp_ragged filename = %s iosysid = %d ioid = %d", filename,
+          iosysid, ioid));
+
+    /* Get the IO desc, which describes the decomposition. Its map
+     * must not have been released. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!iodesc->map)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Summarize the balance of the IO tasks. */
+    if (!ios->async)
+    {
+        if ((ret = decomp_report_text(iosysid, ioid, report_text)))
+            return ret;
+        report = report_text;
+    }
+
+    /* Only the maplens are gathered, to find where each map goes. The
+     * offsets are ints in the file, and the map var is written with a
+     * decomposition, whose dim lengths are ints. */
+    int task_maplen[ios->num_comptasks];
+    int task_offset[ios->num_comptasks];
+    if ((mpierr = MPI_Allgather(&iodesc->maplen, 1, MPI_INT, task_maplen, 1, MPI_INT,
+                                ios->comp_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    for (int t = 0; t < ios->num_comptasks; t++)
+    {
+        task_offset[t] = total_maplen;
+        total_maplen += task_maplen[t];
+        max_maplen = max(max_maplen, task_maplen[t]);
+        if (total_maplen > INT_MAX)
+            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    }
+    PLOG((2, "total_maplen = %lld max_maplen = %d", total_maplen, max_maplen));
+
+    /* Create the netCDF decomp file. */
+    if ((ret = PIOc_create(ios->iosysid, filename, cmode | NC_WRITE, &ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Close the file, even if writing it failed. */
+    ret = write_nc_decomp_ragged_vars(ios, iodesc, ncid, task_maplen, task_offset,
+                                      max_maplen, total_maplen, title, history,
+                                      fortran_order, report);
+    if ((ret2 = PIOc_closefile(ncid)) && !ret)
+        ret = ret2;
+    if (ret)
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read the decomposition map from a netCDF decomp file produced by
+ * PIOc_write_nc_decomp() or PIOc_write_nc_decomp_ragged(). Ragged
+ * decomp files are read in parallel, each task reading only its own
+ * map.
+ *
+ * @param iosysid the IO system ID.
+ * @param filename the name of the decomp file.
+ * @param ioidp pointer that will get the newly-assigned ID of the IO
+ * description. The ioid is needed to later free the decomposition.
+ * @param comm an MPI communicator.
+ * @param pio_type the PIO type to be used as the type for the data.
+ * @param title pointer that will get optial title attribute for the
+ * file. Will be less than PIO_MAX_NAME + 1 if provided. Ignored if
+ * NULL.
+ * @param history pointer that will get optial history attribute for
+ * the file. Will be less than PIO_MAX_NAME + 1 if provided. Ignored if
+ * NULL.
+ * @param fortran_order pointer that gets set to 1 if fortran array
+ * ordering is used, or to zero if C array ordering is used.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_read_nc_decomp(int iosysid, const char *filename, int *ioidp, MPI_Comm comm,
+                    int pio_type, char *title, char *history, int *fortran_order)
+{
+    iosystem_desc_t *ios; /* Pointer to the IO system info. */
+    int ndims;            /* The number of data dims (except unlim). */
+    int max_maplen;       /* The max maplen of any task. */
+    int *global_dimlen;   /* An array with sizes of global dimensions. */
+    int *task_maplen;     /* A map of one tasks mapping to global data. */
+    int *full_map;        /* A map with the task maps of every task. */
+    int num_tasks_decomp; /* The number of tasks for this decomp. */
+    int size;             /* Size of comm. */
+    int my_rank;          /* Task rank in comm. */
+    char source_in[PIO_MAX_NAME + 1];  /* Text metadata in decomp file. */
+    char version_in[PIO_MAX_NAME + 1]; /* Text metadata in decomp file. */
+    char layout_in[PIO_MAX_NAME + 1];  /* Map layout of the decomp file. */
+    PIO_Offset layout_len;
+    int ncid;
+    int peh;
+    int mpierr;
+    int ret;
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (!filename || !ioidp)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    PLOG((1, "PIOc_read_nc_decomp filename = %s iosysid = %d pio_type = %d",
+          filename, iosysid, pio_type));
+
+    /* Get the communicator size and task rank. */
+    if ((mpierr = MPI_Comm_size(comm, &size)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(comm, &my_rank)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "size = %d my_rank = %d", size, my_rank));
+
+    /* Find the layout of the map. Files without the layout attribute
+     * have the dense layout. */
+    if ((ret = PIOc_open(iosysid, filename, NC_NOWRITE, &ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    peh = PIOc_Set_File_Error_Handling(ncid, PIO_BCAST_ERROR);
+    layout_in[0] = '\0';
+    ret = PIOc_inq_attlen(ncid, NC_GLOBAL, DECOMP_LAYOUT_ATT_NAME, &layout_len);
+    if (!ret && layout_len <= PIO_MAX_NAME)
+        ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_LAYOUT_ATT_NAME, layout_in);
+    PIOc_Set_File_Error_Handling(ncid, peh);
+    if (ret && ret != PIO_ENOTATT)
+    {
+        PIOc_closefile(ncid);
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    }
+
+    /* Each task reads its own part of a ragged map. */
+    if (!ret && !strncmp(layout_in, DECOMP_RAGGED_STR, PIO_MAX_NAME + 1))
+    {
+        PIO_Offset *compmap;
+        int maplen;
+
+        /* Close the file, even if reading it failed. */
+        if ((ret = read_decomp_atts(ios, ncid, &max_maplen, title, history, source_in,
+                                    version_in, fortran_order)) ||
+            (ret = read_nc_decomp_ragged(ios, ncid, my_rank, size, &ndims, &global_dimlen,
+                                         &maplen, &compmap)))
+        {
+            PIOc_closefile(ncid);
+            return ret;
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+        /* Initialize the decomposition. */
+        ret = PIOc_InitDecomp(iosysid, pio_type, ndims, global_dimlen, maplen, compmap, ioidp,
+                              NULL, NULL, NULL);
+        free(compmap);
+        free(global_dimlen);
+
+        return ret;
+    }
+    if ((ret = PIOc_closefile(ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Read the file. This allocates three arrays that we have to
+     * free. */
+    if ((ret = pioc_read_nc_decomp_int(iosysid, filename, &ndims, &global_dimlen, &num_tasks_decomp,
+                                       &task_maplen, &max_maplen, &full_map, title, history,
+                                       source_in, version_in, fortran_order)))
+        return ret;
+    PLOG((2, "ndims = %d num_tasks_decomp = %d max_maplen = %d", ndims, num_tasks_decomp,
+          max_maplen));
+
+    /* If the size does not match the number of tasks in the decomp,
+     * that's an error. */
+    if (size != num_tasks_decomp)
+        ret = PIO_EINVAL;
+
+    /* Now initialize the iodesc on each task for this decomposition. */
+    if (!ret)
+    {
+        PIO_Offset *compmap;
+
+        if (!(compmap = malloc(sizeof(PIO_Offset) * task_maplen[my_rank])))
+            return PIO_ENOMEM;
+
+        /* Copy array into PIO_Offset array. Make it 1 based. */
+        for (int e = 0; e < task_maplen[my_rank]; e++)
+            compmap[e] = full_map[my_rank * max_maplen + e] + 1;
+
+        /* Initialize the decomposition. */
+        ret = PIOc_InitDecomp(iosysid, pio_type, ndims, global_dimlen, task_maplen[my_rank],
+                              compmap, ioidp, NULL, NULL, NULL);
+
+        free(compmap);
+    }
+
+    /* Free resources. */
+    free(global_dimlen);
+    free(task_maplen);
+    free(full_map);
+
+    return ret;
+}
+
+/**
+ * Write the decomp information in netCDF. This is an internal
+ * function.
+ *
+ * @param ios pointer to io system info.
+ * @param filename the name the decomp file will have.
+ * @param cmode for PIOc_create(). Will be bitwise or'd with NC_WRITE.
+ * @param ndims number of dims in the data being described.
+ * @param global_dimlen an array, of size ndims, with the size of the
+ * global array in each dimension.
+ * @param num_tasks the number of tasks the data are decomposed over.
+ * @param task_maplen array of size num_tasks with the length of the
+ * map for each task.
+ * @param map pointer to a 2D array of size [num_tasks][max_maplen]
+ * with the 0-based mapping from local to global array elements.
+ * @param title null-terminated string that will be written as an
+ * attribute. If provided, length must be < PIO_MAX_NAME + 1. Ignored
+ * if NULL.
+ * @param history null-terminated string that will be written as an
+ * attribute. If provided, length must be < PIO_MAX_NAME + 1. Ignored
+ * if NULL.
+ * @param fortran_order set to non-zero if using fortran array
+ * ordering, 0 for C array ordering.
+ * @param report summary of the balance of the decomposition, written
+ * as an attribute. Ignored if NULL.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pioc_write_nc_decomp_int(iosystem_desc_t *ios, const char *filename, int cmode, int ndims,
+                         int *global_dimlen, int num_tasks, int *task_maplen, int *map,
+                         const char *title, const char *history, int fortran_order,
+                         const char *report)
+{
+    int max_maplen = 0;
+    int ncid;
+    int ret;
+
+    /* Check inputs. */
+    pioassert(ios && filename && global_dimlen && task_maplen &&
+              (!title || strlen(title) <= PIO_MAX_NAME) &&
+              (!history || strlen(history) <= PIO_MAX_NAME), "invalid input",
+              __FILE__, __LINE__);
+
+    PLOG((2, "pioc_write_nc_decomp_int filename = %s ndims = %d num_tasks = %d", filename,
+          ndims, num_tasks));
+
+    /* Find the maximum maplen. */
+    for (int t = 0; t < num_tasks; t++)
+        if (task_maplen[t] > max_maplen)
+            max_maplen = task_maplen[t];
+    PLOG((3, "max_maplen = %d", max_maplen));
+
+    /* Create the netCDF decomp file. */
+    if ((ret = PIOc_create(ios->iosysid, filename, cmode | NC_WRITE, &ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Write the global attributes. */
+    if ((ret = write_decomp_atts(ios, ncid, max_maplen, title, history, fortran_order,
+                                 report)))
+        return ret;
+
+    /* We need a dimension for the dimensions in the data. (Example:
+     * for 4D data we will need to store 4 dimension IDs.) */
+    int dim_dimid;
+    if ((ret = PIOc_def_dim(ncid, DECOMP_DIM_DIM, ndims, &dim_dimid)))
+        return ret;
+
+    /* We need a dimension for tasks. If we have 4 tasks, we need to
+     * store an array of length 4 with the size of the local array on
+     * each task. */
+    int task_dimid;
+    if ((ret = PIOc_def_dim(ncid, DECOMP_TASK_DIM_NAME, num_tasks, &task_dimid)))
+        return ret;
+
+    /* We need a dimension for the map. It's length may vary, we will
+     * use the max_maplen for the dimension size. */
+    int mapelem_dimid;
+    if ((ret = PIOc_def_dim(ncid, DECOMP_MAPELEM_DIM_NAME, max_maplen,
+                            &mapelem_dimid)))
+        return ret;
+
+    /* Define a var to hold the global size of the array for each
+     * dimension. */
+    int gsize_varid;
+    if ((ret = PIOc_def_var(ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, NC_INT, 1,
+                            &dim_dimid, &gsize_varid)))
+        return ret;
+
+    /* Define a var to hold the length of the local array on each task. */
+    int maplen_varid;
+    if ((ret = PIOc_def_var(ncid, DECOMP_MAPLEN_VAR_NAME, NC_INT, 1, &task_dimid,
+                            &maplen_varid)))
+        return ret;
+
+    /* Define a 2D var to hold the length of the local array on each task. */
+    int map_varid;
+    int map_dimids[2] = {task_dimid, mapelem_dimid};
+    if ((ret = PIOc_def_var(ncid, DECOMP_MAP_VAR_NAME, NC_INT, 2, map_dimids,
+                            &map_varid)))
+        return ret;
+
+    /* End define mode, to write data. */
+    if ((ret = PIOc_enddef(ncid)))
+        return ret;
+
+    /* Write the global dimension sizes. */
+    if ((PIOc_put_var_int(ncid, gsize_varid, global_dimlen)))
+        return ret;
+
+    /* Write the size of the local array on each task. */
+    if ((PIOc_put_var_int(ncid, maplen_varid, task_maplen)))
+        return ret;
+
+    /* Write the map. */
+    if ((PIOc_put_var_int(ncid, map_varid, map)))
+        return ret;
+
+    /* Close the netCDF decomp file. */
+    if ((ret = PIOc_closefile(ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Read the decomp information from a netCDF decomp file. This is an
+ * internal function.
+ *
+ * @param iosysid the IO system ID.
+ * @param filename the name the decomp file will have.
+ * @param ndims pointer to int that will get number of dims in the
+ * data being described. Ignored if NULL.
+ * @param global_dimlen a pointer that gets an array, of size ndims,
+ * that will have the size of the global array in each
+ * dimension. Ignored if NULL, otherwise must be freed by caller.
+ * @param num_tasks pointer to int that gets the number of tasks the
+ * data are decomposed over. Ignored if NULL.
+ * @param task_maplen pointer that gets array of size num_tasks that
+ * gets the length of the map for each task. Ignored if NULL,
+ * otherwise must be freed by caller.
+ * @param max_maplen pointer to int that gets the maximum maplen for
+ * any task. Ignored if NULL.
+ * @param map pointer that gets a 2D array of size [num_tasks][max_maplen]
+ * that will have the 0-based mapping from local to global array
+ * elements. Ignored if NULL, otherwise must be freed by caller.
+ * @param title pointer that will get the contents of title attribute,
+ * if present. If present, title will be < PIO_MAX_NAME + 1 in
+ * length. Ignored if NULL.
+ * @param history pointer that will get the contents of history attribute,
+ * if present. If present, history will be < PIO_MAX_NAME + 1 in
+ * length. Ignored if NULL.
+ * @param source pointer that will get the contents of source
+ * attribute. Source will be < PIO_MAX_NAME + 1 in length. Ignored if
+ * NULL.
+ * @param version pointer that will get the contents of version
+ * attribute. It will be < PIO_MAX_NAME + 1 in length. Ignored if
+ * NULL.
+ * @param fortran_order int pointer that will get a 0 if this
+ * decomposition file uses C array ordering, 1 if it uses Fortran
+ * array ordering.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pioc_read_nc_decomp_int(int iosysid, const char *filename, int *ndims, int **global_dimlen,
+                        int *num_tasks, int **task_maplen, int *max_maplen, int **map, char *title,
+                        char *history, char *source, char *version, int *fortran_order)
+{
+    iosystem_desc_t *ios;
+    int max_maplen_in;
+    int ncid;
+    int ret;
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Check inputs. */
+    if (!filename)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    PLOG((1, "pioc_read_nc_decomp_int iosysid = %d filename = %s", iosysid, filename));
+    
+    
+    /* Open the netCDF decomp file. */
+    if ((ret = PIOc_open(iosysid, filename, NC_WRITE, &ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+
+    /* Read the global attributes. */
+    if ((ret = read_decomp_atts(ios, ncid, &max_maplen_in, title, history, source, version,
+                                fortran_order)))
+        return ret;
+    if (max_maplen)
+        *max_maplen = max_maplen_in;
+
+    /* Read dimension for the dimensions in the data. (Example: for 4D
+     * data we will need to store 4 dimension IDs.) */
+    int dim_dimid;
+    PIO_Offset ndims_in;
+    if ((ret = PIOc_inq_dimid(ncid, DECOMP_DIM_DIM, &dim_dimid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dim(ncid, dim_dimid, NULL, &ndims_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (ndims)
+        *ndims = ndims_in;
+
+    /* Read the global sizes of the array. */
+    int gsize_varid;
+    int global_dimlen_in[ndims_in];
+    if ((ret = PIOc_inq_varid(ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, &gsize_varid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_get_var_int(ncid, gsize_varid, global_dimlen_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (global_dimlen)
+    {
+        if (!(*global_dimlen = malloc(ndims_in * sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        for (int d = 0; d < ndims_in; d++)
+            (*global_dimlen)[d] = global_dimlen_in[d];
+    }
+
+    /* Read dimension for tasks. If we have 4 tasks, we need to store
+     * an array of length 4 with the size of the local array on each
+     * task. */
+    int task_dimid;
+    PIO_Offset num_tasks_in;
+    if ((ret = PIOc_inq_dimid(ncid, DECOMP_TASK_DIM_NAME, &task_dimid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_inq_dim(ncid, task_dimid, NULL, &num_tasks_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (num_tasks)
+        *num_tasks = num_tasks_in;
+
+    /* Read the length if the local array on each task. */
+    int maplen_varid;
+    int task_maplen_in[num_tasks_in];
+    if ((ret = PIOc_inq_varid(ncid, DECOMP_MAPLEN_VAR_NAME, &maplen_varid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_get_var_int(ncid, maplen_varid, task_maplen_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (task_maplen)
+    {
+        if (!(*task_maplen = malloc(num_tasks_in * sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        for (int t = 0; t < num_tasks_in; t++)
+            (*task_maplen)[t] = task_maplen_in[t];
+    }
+
+    /* Read the map. */
+    int map_varid;
+    int *map_in;
+
+    if (!(map_in = malloc(sizeof(int) * num_tasks_in * max_maplen_in)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    if ((ret = PIOc_inq_varid(ncid, DECOMP_MAP_VAR_NAME, &map_varid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if ((ret = PIOc_get_var_int(ncid, map_varid, map_in)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (map)
+    {
+        if (!(*map = malloc(num_tasks_in * max_maplen_in * sizeof(int))))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+        for (int t = 0; t < num_tasks_in; t++)
+            for (int l = 0; l < max_maplen_in; l++)
+                (*map)[t * max_maplen_in + l] = map_in[t * max_maplen_in + l];
+    }
+    free(map_in);
+
+    /* Close the netCDF decomp file. */
+    PLOG((2, "pioc_read_nc_decomp_int about to close file ncid = %d", ncid));
+    if ((ret = PIOc_closefile(ncid)))
+        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    PLOG((2, "pioc_read_nc_decomp_int closed file"));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the decomposition map to a file.
+ *
+ * @param file the filename to be used.
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the IO description.
+ * @param comm an MPI communicator.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+PIOc_write_decomp(const char *file, int iosysid, int ioid, MPI_Comm comm)
+{
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc;
+
+    PLOG((1, "PIOc_write_decomp file = %s iosysid = %d ioid = %d", file, iosysid, ioid));
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!iodesc->map)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    return PIOc_writemap(file, iodesc->ndims, iodesc->dimlen, iodesc->maplen, iodesc->map,
+                         comm);
+}
+
+/**
+ * Write the decomposition map to a file.
+ *
+ * @param file the filename
+ * @param ndims the number of dimensions
+ * @param gdims an array of dimension ids
+ * @param maplen the length of the map
+ * @param map the map array
+ * @param comm an MPI communicator.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+PIOc_writemap(const char *file, int ndims, const int *gdims, PIO_Offset maplen,
+              PIO_Offset *map, MPI_Comm comm)
+{
+    int npes, myrank;
+    PIO_Offset *nmaplen = NULL;
+    MPI_Status status;
+    int i;
+    PIO_Offset *nmap;
+    int mpierr; /* Return code for MPI calls. */
+
+    PLOG((1, "PIOc_writemap file = %s ndims = %d maplen = %d", file, ndims, maplen));
+
+    if ((mpierr = MPI_Comm_size(comm, &npes)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(comm, &myrank)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "npes = %d myrank = %d", npes, myrank));
+
+    /* Allocate memory for the nmaplen. */
+    if (myrank == 0)
+        if (!(nmaplen = malloc(npes * sizeof(PIO_Offset))))
+            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Gather(&maplen, 1, PIO_OFFSET, nmaplen, 1, PIO_OFFSET, 0, comm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Only rank 0 writes the file. */
+    if (myrank == 0)
+    {
+        FILE *fp;
+
+        /* Open the file to write. */
+        if (!(fp = fopen(file, "w")))
+            return pio_err(NULL, NULL, PIO_EIO, __FILE__, __LINE__);
+
+        /* Write the version and dimension info. */
+        fprintf(fp,"version %d npes %d ndims %d \n", VERSNO, npes, ndims);
+        for (i = 0; i < ndims; i++)
+            fprintf(fp, "%d ", gdims[i]);
+        fprintf(fp, "\n");
+
+        /* Write the map. */
+        fprintf(fp, "0 %lld\n", nmaplen[0]);
+        for (i = 0; i < nmaplen[0]; i++)
+            fprintf(fp, "%lld ", map[i]);
+        fprintf(fp,"\n");
+
+        for (i = 1; i < npes; i++)
+        {
+            PLOG((2, "creating nmap for i = %d", i));
+            nmap = (PIO_Offset *)malloc(nmaplen[i] * sizeof(PIO_Offset));
+
+            if ((mpierr = MPI_Send(&i, 1, MPI_INT, i, npes + i, comm)))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+            if ((mpierr = MPI_Recv(nmap, nmaplen[i], PIO_OFFSET, i, i, comm, &status)))
+                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+            PLOG((2,"MPI_Recv map complete"));
+
+            fprintf(fp, "%d %lld\n", i, nmaplen[i]);
+            for (int j = 0; j < nmaplen[i]; j++)
+                fprintf(fp, "%lld ", nmap[j]);
+            fprintf(fp, "\n");
+
+            free(nmap);
+        }
+        /* Free memory for the nmaplen. */
+        free(nmaplen);
+        fprintf(fp, "\n");
+        print_trace(fp);
+
+        /* Close the file. */
+        fclose(fp);
+        PLOG((2,"decomp file closed."));
+    }
+    else
+    {
+        PLOG((2,"ready to MPI_Recv..."));
+        if ((mpierr = MPI_Recv(&i, 1, MPI_INT, 0, npes+myrank, comm, &status)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        PLOG((2,"MPI_Recv got %d", i));
+        if ((mpierr = MPI_Send(map, maplen, PIO_OFFSET, 0, myrank, comm)))
+            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+        PLOG((2,"MPI_Send map complete"));
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the decomposition map to a file for F90.
+ *
+ * @param file the filename
+ * @param ndims the number of dimensions
+ * @param gdims an array of dimension ids
+ * @param maplen the length of the map
+ * @param map the map array
+ * @param f90_comm an MPI communicator.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards
+ */
+int
+PIOc_writemap_from_f90(const char *file, int ndims, const int *gdims,
+                       PIO_Offset maplen, const PIO_Offset *map, int f90_comm)
+{
+    return PIOc_writemap(file, ndims, gdims, maplen, (PIO_Offset *)map,
+                         MPI_Comm_f2c(f90_comm));
+}
+
+/**
+ * Write a decomposition map to a binary file, which can be read in
+ * parallel by PIOc_readmap_bin() or PIOc_readmap(). Each task writes
+ * its own part of the map collectively with MPI-IO, instead of
+ * sending it to task 0, as PIOc_writemap() does.
+ *
+ * All values in the file are PIO_Offset, in the byte order of the
+ * machine that wrote it. The file starts with the magic number, the
+ * version, the number of tasks and the number of dims, then the
+ * dimlens. Then there is an index of npes + 1 values: the position
+ * (in values, from the start of the file) of the map of each task,
+ * and the end of the last map. The maps follow.
+ *
+ * @param file the filename
+ * @param ndims the number of dimensions
+ * @param gdims an array of the global dimension lengths
+ * @param maplen the length of the map of this task
+ * @param map the map array of this task
+ * @param comm an MPI communicator.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+PIOc_writemap_bin(const char *file, int ndims, const int *gdims, PIO_Offset maplen,
+                  PIO_Offset *map, MPI_Comm comm)
+{
+    MPI_File fh;
+    PIO_Offset *hdr;
+    PIO_Offset idx[2];
+    PIO_Offset mystart = 0;
+    PIO_Offset first;
+    int npes, myrank;
+    int mpierr; /* Return code for MPI calls. */
+
+    /* Check inputs. */
+    if (!file || ndims < 1 || !gdims || maplen < 0 || (maplen && !map))
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Comm_size(comm, &npes)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(comm, &myrank)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((1, "PIOc_writemap_bin file = %s ndims = %d maplen = %lld", file, ndims, maplen));
+
+    /* Find where the map of this task goes. */
+    if ((mpierr = MPI_Exscan(&maplen, &mystart, 1, PIO_OFFSET, MPI_SUM, comm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if (!myrank)
+        mystart = 0;
+    first = PIO_MAP_BIN_HDR + ndims + npes + 1;
+    idx[0] = first + mystart;
+    idx[1] = idx[0] + maplen;
+
+    if (!(hdr = malloc((PIO_MAP_BIN_HDR + ndims) * sizeof(PIO_Offset))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    hdr[0] = PIO_MAP_BIN_MAGIC;
+    hdr[1] = VERSNO;
+    hdr[2] = npes;
+    hdr[3] = ndims;
+    for (int d = 0; d < ndims; d++)
+        hdr[PIO_MAP_BIN_HDR + d] = gdims[d];
+
+    if ((mpierr = MPI_File_open(comm, (char *)file, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                                MPI_INFO_NULL, &fh)))
+    {
+        free(hdr);
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Task 0 writes the header, each task writes its index entry (and
+     * the last task the end of the maps), then each task writes its
+     * map. */
+    mpierr = MPI_File_set_size(fh, 0);
+    if (!mpierr)
+        mpierr = MPI_File_write_at_all(fh, 0, hdr, myrank ? 0 : PIO_MAP_BIN_HDR + ndims,
+                                       PIO_OFFSET, MPI_STATUS_IGNORE);
+    if (!mpierr)
+        mpierr = MPI_File_write_at_all(fh, (PIO_MAP_BIN_HDR + ndims + myrank) * sizeof(PIO_Offset),
+                                       idx, myrank == npes - 1 ? 2 : 1, PIO_OFFSET,
+                                       MPI_STATUS_IGNORE);
+    if (!mpierr)
+        mpierr = MPI_File_write_at_all(fh, idx[0] * sizeof(PIO_Offset), map, maplen,
+                                       PIO_OFFSET, MPI_STATUS_IGNORE);
+    if (!mpierr)
+        mpierr = MPI_File_close(&fh);
+    else
+        MPI_File_close(&fh);
+    free(hdr);
+    if (mpierr)
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Set an MPI-IO hint, unless it is already set.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param info the info object.
+ * @param hint the name of the hint.
+ * @param hintval the value of the hint.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+set_hint_default(iosystem_desc_t *ios, MPI_Info info, const char *hint,
+                 const char *hintval)
+{
+    char val[PIO_MAX_NAME + 1];
+    int flag;
+    int mpierr;
+
+    if ((mpierr = MPI_Info_get(info, (char *)hint, PIO_MAX_NAME, val, &flag)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (flag)
+        return PIO_NOERR;
+    if ((mpierr = MPI_Info_set(info, (char *)hint, (char *)hintval)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "auto hint %s = %s", hint, hintval));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the type and block size of the file system of a file. The IO
+ * root calls statfs() on the directory of the file, and the result is
+ * broadcast to the IO tasks. This is collective over the IO tasks.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param filename the name of the file.
+ * @param fs_info array of 2 that gets the file system magic number
+ * (0 if unknown) and the block size.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+get_fs_info(iosystem_desc_t *ios, const char *filename, long *fs_info)
+{
+    int mpierr;
+
+    fs_info[0] = 0;
+    fs_info[1] = 0;
+#ifdef __linux__
+    if (!ios->io_rank)
+    {
+        char dir[strlen(filename) + 2];
+        char *slash;
+        struct statfs sfs;
+
+        strcpy(dir, filename);
+        if ((slash = strrchr(dir, '/')))
+            slash[1] = '\0';
+        else
+            strcpy(dir, ".");
+        if (!statfs(dir, &sfs))
+        {
+            fs_info[0] = (long)sfs.f_type;
+            fs_info[1] = (long)sfs.f_bsize;
+        }
+    }
+#endif /* __linux__ */
+    if ((mpierr = MPI_Bcast(fs_info, 2, MPI_LONG, 0, ios->io_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    PLOG((2, "get_fs_info %s fs_type = 0x%lx block size = %ld", filename,
+          fs_info[0], fs_info[1]));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Derive the MPI-IO hints of a parallel file from the IO tasks, the
+ * decompositions and the file system (see PIOc_set_hint_auto()). This
+ * is collective over the IO tasks.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param filename the name of the file.
+ * @param create non-zero if the file is being created.
+ * @param cb_nodes the number of IO tasks to write the file.
+ * @param info the info object that gets the hints.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+set_auto_hints(iosystem_desc_t *ios, const char *filename, int create, int cb_nodes,
+               MPI_Info info)
+{
+    char hintval[PIO_MAX_NAME + 1];
+    long fs_info[2];
+    PIO_Offset unit, bufsize;
+    int node_iotasks;
+    int parallel_fs;
+    int mpierr;
+    int ret;
+
+    if ((ret = pio_count_node_iotasks(ios)))
+        return ret;
+    if ((ret = get_fs_info(ios, filename, fs_info)))
+        return ret;
+    parallel_fs = fs_info[0] == PIO_LUSTRE_MAGIC || fs_info[0] == PIO_GPFS_MAGIC;
+
+    /* The hints must be the same on all IO tasks, so allow as many
+     * aggregators on each node as the node with the most IO tasks
+     * has. */
+    if ((mpierr = MPI_Allreduce(&ios->node_iotasks, &node_iotasks, 1, MPI_INT, MPI_MAX,
+                                ios->io_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    /* The IO tasks are the aggregators. */
+    snprintf(hintval, PIO_MAX_NAME, "%d", cb_nodes);
+    if ((ret = set_hint_default(ios, info, "cb_nodes", hintval)))
+        return ret;
+    snprintf(hintval, PIO_MAX_NAME, "*:%d", node_iotasks);
+    if ((ret = set_hint_default(ios, info, "cb_config_list", hintval)))
+        return ret;
+
+    /* The collective buffer holds the IO buffer of the largest
+     * decomposition, in whole stripes or blocks. */
+    unit = fs_info[0] == PIO_LUSTRE_MAGIC ? PIO_AUTO_STRIPE_UNIT : fs_info[1];
+    if (ios->stripe_unit)
+        unit = ios->stripe_unit;
+    if ((bufsize = pio_max_iobuf_bytes(ios->iosysid)))
+    {
+        if (unit > 0)
+            bufsize = (bufsize + unit - 1) / unit * unit;
+        bufsize = min(max(bufsize, PIO_AUTO_MIN_CB_BUFFER), PIO_AUTO_MAX_CB_BUFFER);
+        snprintf(hintval, PIO_MAX_NAME, "%lld", (long long)bufsize);
+        if ((ret = set_hint_default(ios, info, "cb_buffer_size", hintval)))
+            return ret;
+    }
+
+    if (parallel_fs)
+    {
+        if ((ret = set_hint_default(ios, info, "romio_cb_write", "enable")))
+            return ret;
+        if ((ret = set_hint_default(ios, info, "romio_cb_read", "enable")))
+            return ret;
+        if ((ret = set_hint_default(ios, info, "romio_ds_write", "disable")))
+            return ret;
+    }
+
+    /* The striping of a Lustre file is fixed when it is created. */
+    if (create && fs_info[0] == PIO_LUSTRE_MAGIC)
+    {
+        snprintf(hintval, PIO_MAX_NAME, "%d", cb_nodes);
+        if ((ret = set_hint_default(ios, info, "striping_factor", hintval)))
+            return ret;
+        snprintf(hintval, PIO_MAX_NAME, "%lld", (long long)unit);
+        if ((ret = set_hint_default(ios, info, "striping_unit", hintval)))
+            return ret;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the MPI Info object to create or open a parallel file with. If
+ * a new file is to have fewer aggregators than IO tasks (see
+ * PIOc_set_file_cb_nodes()), the hints are derived automatically (see
+ * PIOc_set_hint_auto()), or the metadata of NETCDF4P files is
+ * accessed collectively (see PIOc_set_nc4p_coll_meta()), this is a
+ * copy of the info of the iosystem with those hints added, otherwise
+ * it is the info of the iosystem. This is collective over the IO
+ * tasks.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param filename the name of the file.
+ * @param iotype the iotype of the file.
+ * @param create non-zero if the file is being created.
+ * @param infop pointer that gets the info object. If it is not
+ * ios->info, the caller must free it with MPI_Info_free().
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+get_file_info(iosystem_desc_t *ios, const char *filename, int iotype, int create,
+              MPI_Info *infop)
+{
+    char hintval[PIO_MAX_NAME + 1];
+    int cb_nodes = 0;
+    bool coll_meta = ios->nc4p_coll_meta && iotype == PIO_IOTYPE_NETCDF4P;
+    int mpierr;
+    int ret;
+
+    *infop = ios->info;
+    if (create && ios->file_cb_nodes && ios->file_cb_nodes < ios->num_iotasks)
+        cb_nodes = ios->file_cb_nodes;
+    if (!cb_nodes && !ios->hint_auto && !coll_meta)
+        return PIO_NOERR;
+
+    if (ios->info == MPI_INFO_NULL)
+        mpierr = MPI_Info_create(infop);
+    else
+        mpierr = MPI_Info_dup(ios->info, infop);
+    if (mpierr)
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    if (cb_nodes)
+    {
+        snprintf(hintval, PIO_MAX_NAME, "%d", cb_nodes);
+        if ((mpierr = MPI_Info_set(*infop, "cb_nodes", hintval)))
+        {
+            MPI_Info_free(infop);
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
+        PLOG((2, "creating file with cb_nodes = %s", hintval));
+    }
+
+    if (ios->hint_auto)
+        if ((ret = set_auto_hints(ios, filename, create, cb_nodes ? cb_nodes : ios->num_iotasks,
+                                  *infop)))
+        {
+            MPI_Info_free(infop);
+            return ret;
+        }
+
+    /* Collective buffering, so the collective IO of HDF5 goes
+     * through the aggregators. */
+    if (coll_meta)
+        if ((ret = set_hint_default(ios, *infop, "romio_cb_read", "enable")) ||
+            (ret = set_hint_default(ios, *infop, "romio_cb_write", "enable")))
+        {
+            MPI_Info_free(infop);
+            return ret;
+        }
+
+    return PIO_NOERR;
+}
+
+#ifdef _NETCDF4
+/**
+ * Make the access of all the vars of an opened NETCDF4P file
+ * collective, for PIOc_set_nc4p_coll_meta(). netCDF opens the vars
+ * for independent access, so the first access of each var would read
+ * its metadata independently on each IO task.
+ *
+ * @param ncid the netCDF ID of the file.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+set_coll_access(int ncid)
+{
+    int nvars;
+    int ret;
+
+    if ((ret = nc_inq_nvars(ncid, &nvars)))
+        return ret;
+    for (int v = 0; v < nvars; v++)
+        if ((ret = nc_var_par_access(ncid, v, NC_COLLECTIVE)))
+            return ret;
+
+    return PIO_NOERR;
+}
+#endif /* _NETCDF4 */
+
+/**
+ * Open the stage log of a new pnetcdf file on this IO task, in the
+ * stage directory of the iosystem (see PIOc_set_stage_dir()). The
+ * log is removed from the directory right away, so it goes when it
+ * is closed, or when the program ends.
+ *
+ * @param file pointer to the file info.
+ * @param filename the name of the file.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+open_stage_log(file_desc_t *file, const char *filename)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    const char *base = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+    char logname[strlen(ios->stage_dir) + strlen(base) + 32];
+
+    snprintf(logname, sizeof(logname), "%s/%s.%d.stage", ios->stage_dir, base, ios->io_rank);
+    if (!(file->stage_fp = fopen(logname, "w+b")))
+        return PIO_EIO;
+    unlink(logname);
+    PLOG((2, "open_stage_log %s", logname));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Get the same error code on all the IO tasks, from the error codes
+ * of each, such as those of the tasks which do the IO for the
+ * subfiles of a subfiled file (see PIOc_set_subfiles()). This is
+ * collective over the IO tasks.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param ierr the error code on this task.
+ * @returns the first error code (the smallest negative one, else the
+ * largest positive one) of all IO tasks, or 0 if there was none.
+ * @author Ed Hartnett
+ */
+int
+pio_subfile_err(iosystem_desc_t *ios, int ierr)
+{
+    int err[2] = {ierr, -ierr};
+    int mpierr;
+
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, err, 2, MPI_INT, MPI_MIN, ios->io_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+
+    return err[0] < 0 ? err[0] : -err[1];
+}
+
+/**
+ * Divide the IO tasks into the groups of the subfiles of a file, see
+ * PIOc_set_subfiles(). The first IO task of each group does the IO
+ * for the subfile of the group. This is collective over the IO
+ * tasks.
+ *
+ * @param file pointer to the file info, with num_subfiles set.
+ * @param subfilep pointer that gets the number of the subfile of this
+ * task.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+split_subfiles(file_desc_t *file, int *subfilep)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int sub_rank;
+    int mpierr;
+
+    *subfilep = (int)((long long)ios->io_rank * file->num_subfiles / ios->num_iotasks);
+    if ((mpierr = MPI_Comm_split(ios->io_comm, *subfilep, ios->io_rank, &file->subfile_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(file->subfile_comm, &sub_rank)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    file->do_io = !sub_rank;
+    PLOG((2, "split_subfiles subfile %d sub_rank %d", *subfilep, sub_rank));
+
+    return PIO_NOERR;
+}
+
+/**
+ * Open or create the subfile of this task, on the first IO task of
+ * each subfile. If this fails on any IO task, the subfiles are
+ * closed again. This is collective over the IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param filename the name of the index file.
+ * @param mode the netCDF mode.
+ * @param create non-zero to create the subfiles, otherwise they are
+ * opened.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+open_subfile(file_desc_t *file, const char *filename, int mode, int create)
+{
+    char subname[PIO_MAX_NAME + 16];
+    int subfile;
+    int ierr = PIO_NOERR;
+
+    if ((ierr = split_subfiles(file, &subfile)))
+        return ierr;
+
+    if (file->do_io)
+    {
+        snprintf(subname, sizeof(subname), "%s.%d", filename, subfile);
+        PLOG((2, "%s subfile %s mode %d", create ? "creating" : "opening", subname, mode));
+        if (create)
+            ierr = nc_create(subname, mode, &file->fh);
+        else
+            ierr = nc_open(subname, mode, &file->fh);
+    }
+
+    if ((ierr = pio_subfile_err(file->iosystem, ierr)))
+    {
+        if (file->do_io && file->fh != -1)
+            nc_close(file->fh);
+        MPI_Comm_free(&file->subfile_comm);
+        file->num_subfiles = 0;
+    }
+
+    return ierr;
+}
+
+/**
+ * Create a PIO_IOTYPE_NETCDF file as subfiles, see
+ * PIOc_set_subfiles(). IO task 0 writes the index file, then the
+ * first IO task of each subfile creates the subfile, which is left
+ * open. This is collective over the IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param filename the name of the file.
+ * @param mode the netCDF mode.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+create_subfiles(file_desc_t *file, const char *filename, int mode)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int ierr = PIO_NOERR;
+
+    file->num_subfiles = min(ios->num_subfiles, ios->num_iotasks);
+
+    if (!ios->io_rank)
+    {
+        int ncid;
+        int ret;
+
+        if (!(ierr = nc_create(filename, mode, &ncid)))
+        {
+            ierr = nc_put_att_int(ncid, NC_GLOBAL, PIO_SUBFILES_ATT, NC_INT, 1,
+                                  &file->num_subfiles);
+            if (!ierr)
+                ierr = nc_put_att_int(ncid, NC_GLOBAL, PIO_SUBFILE_IOTASKS_ATT, NC_INT, 1,
+                                      &ios->num_iotasks);
+            if ((ret = nc_close(ncid)) && !ierr)
+                ierr = ret;
+        }
+    }
+    if ((ierr = pio_subfile_err(ios, ierr)))
+    {
+        file->num_subfiles = 0;
+        return ierr;
+    }
+
+    return open_subfile(file, filename, mode, 1);
+}
+
+/**
+ * Open a PIO_IOTYPE_NETCDF file on the IO tasks. IO task 0 opens the
+ * file. If it is the index file of a subfiled file (see
+ * PIOc_set_subfiles()), it is closed again, and the first IO task of
+ * each subfile opens the subfile instead. This is collective over the
+ * IO tasks.
+ *
+ * @param file pointer to the file info.
+ * @param filename the name of the file.
+ * @param mode the netCDF mode.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+open_classic(file_desc_t *file, const char *filename, int mode)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    int info[2] = {PIO_NOERR, 0}; /* Error code and number of subfiles. */
+    int mpierr;
+
+    if (!ios->io_rank && !(info[0] = nc_open(filename, mode, &file->fh)))
+    {
+        if (!nc_get_att_int(file->fh, NC_GLOBAL, PIO_SUBFILES_ATT, &info[1]))
+        {
+            int num_iotasks;
+            int ret;
+
+            /* The data must be read by the same IO tasks as wrote them. */
+            if (!(info[0] = nc_get_att_int(file->fh, NC_GLOBAL, PIO_SUBFILE_IOTASKS_ATT,
+                                           &num_iotasks)))
+                if (num_iotasks != ios->num_iotasks || info[1] < 1 ||
+                    info[1] > num_iotasks)
+                    info[0] = PIO_EINVAL;
+            if ((ret = nc_close(file->fh)) && !info[0])
+                info[0] = ret;
+            file->fh = -1;
+        }
+        else
+            info[1] = 0;
+    }
+    if ((mpierr = MPI_Bcast(info, 2, MPI_INT, 0, ios->io_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (info[0] || !info[1])
+        return info[0];
+
+    PLOG((2, "open_classic %s has %d subfiles", filename, info[1]));
+    file->num_subfiles = info[1];
+
+    return open_subfile(file, filename, mode, 0);
+}
+
+/**
+ * Create a new file using pio. This is an internal function that is
+ * called by both PIOc_create() and PIOc_createfile(). Input
+ * parameters are read on comp task 0 and ignored elsewhere.
+ *
+ * @param iosysid A defined pio system ID, obtained from
+ * PIOc_Init_Intracomm() or PIOc_InitAsync().
+ * @param ncidp A pointer that gets the ncid of the newly created
+ * file. This is the PIO ncid. Within PIO, the file will have a
+ * different ID, the file->fh. When netCDF integration is used, the
+ * PIO ncid is also stored in the netcdf-c internal file list, and the
+ * PIO code is called by the netcdf-c dispatch code. In this case,
+ * there are two ncids for the file, the PIO ncid, and the file->fh
+ * ncid.
+ * @param iotype A pointer to a pio output format. Must be one of
+ * PIO_IOTYPE_PNETCDF, PIO_IOTYPE_NETCDF, PIO_IOTYPE_NETCDF4C, or
+ * PIO_IOTYPE_NETCDF4P.
+ * @param filename The filename to create.
+ * @param mode The netcdf mode for the create operation.
+ * @param use_ext_ncid non-zero to use an externally assigned ncid
+ * (used in the netcdf integration layer).
+ *
+ * @returns 0 for success, error code otherwise.
+ * @ingroup PIO_createfile_c
+ * @author Ed Hartnett
+ */
+int
+PIOc_createfile_int(int iosysid, int *ncidp, int *iotype, const char *filename,
+                    int mode, int use_ext_ncid)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
+    int ierr;              /* Return code from function calls. */
+
+#ifdef USE_MPE
+    pio_start_mpe_log(CREATE);
+#endif /* USE_MPE */
+
+    /* Get the IO system info from the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* User must provide valid input for these parameters. */
+    if (!ncidp || !iotype || !filename || strlen(filename) > PIO_MAX_NAME)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* A valid iotype must be specified. */
+    if (!iotype_is_valid(*iotype))
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    PLOG((1, "PIOc_createfile_int iosysid %d iotype %d filename %s mode %d "
+          "use_ext_ncid %d", iosysid, *iotype, filename, mode, use_ext_ncid));
+
+    /* Allocate space for the file info. */
+    if (!(file = calloc(sizeof(file_desc_t), 1)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Fill in some file values. */
+    file->fh = -1;
+    file->iosystem = ios;
+    file->iotype = *iotype;
+    file->buffer = NULL;
+    file->writable = 1;
+    file->defer_errors = ios->defer_errors && !ios->async;
+    if (!(file->fname = strdup(filename)))
+    {
+        free(file);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+
+    /* Arrays read from an earlier file of this name are stale. */
+    pio_read_cache_clear(ios, filename, -1);
+
+    /* The default fill mode of the netCDF library. */
+    file->fill_mode = file->iotype == PIO_IOTYPE_PNETCDF ? NC_NOFILL : NC_FILL;
+
+    /* Read and write distributed arrays with varn or vard. */
+    file->use_vard = file->iotype == PIO_IOTYPE_PNETCDF && PIO_VARD_DEFAULT;
+
+    /* Set to true if this task should participate in IO (only true for
+     * one task with netcdf serial files. */
+    if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_PNETCDF ||
+        ios->io_rank == 0)
+        file->do_io = 1;
+
+    PLOG((2, "file->do_io = %d ios->async = %d", file->do_io, ios->async));
+
+    /* If async is in use, and this is not an IO task, bcast the
+     * parameters. */
+    if (ios->async)
+    {
+        if (!ios->ioproc)
+        {
+            int msg = PIO_MSG_CREATE_FILE;
+            size_t len = strlen(filename);
+            char ncidp_present = ncidp ? 1 : 0;
+
+            /* Send the message to the message handler. */
+            PLOG((3, "msg %d ios->union_comm %d MPI_COMM_NULL %d", msg, ios->union_comm, MPI_COMM_NULL));
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            /* Send the parameters of the function call. */
+            if (!mpierr)
+                mpierr = MPI_Bcast(&len, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast((void *)filename, len + 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&file->iotype, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&mode, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&use_ext_ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncidp_present, 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+            if (ncidp_present)
+                if (!mpierr)
+                    mpierr = MPI_Bcast(ncidp, 1, MPI_INT, ios->compmaster, ios->intercomm);
+#ifdef NETCDF_INTEGRATION
+            if (!mpierr)
+                mpierr = MPI_Bcast(&diosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+#endif /* NETCDF_INTEGRATION */
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ios->file_cb_nodes, 1, MPI_INT, ios->compmaster,
+                                   ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ios->num_subfiles, 1, MPI_INT, ios->compmaster,
+                                   ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ios->compression, 1, MPI_INT, ios->compmaster,
+                                   ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ios->compression_level, 1, MPI_INT, ios->compmaster,
+                                   ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ios->hint_auto, 1, MPI_INT, ios->compmaster,
+                                   ios->intercomm);
+            if (!mpierr)
+            {
+                int slen = ios->stage_dir ? strlen(ios->stage_dir) : 0;
+
+                mpierr = MPI_Bcast(&slen, 1, MPI_INT, ios->compmaster, ios->intercomm);
+                if (!mpierr && slen)
+                    mpierr = MPI_Bcast(ios->stage_dir, slen + 1, MPI_CHAR, ios->compmaster,
+                                       ios->intercomm);
+            }
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ios->checkpoint, 1, MPI_INT, ios->compmaster,
+                                   ios->intercomm);
+            PLOG((2, "len %d filename %s iotype %d mode %d use_ext_ncid %d "
+                  "ncidp_present %d file_cb_nodes %d num_subfiles %d", len, filename,
+                  file->iotype, mode, use_ext_ncid, ncidp_present, ios->file_cb_nodes,
+                  ios->num_subfiles));
+        }
+
+        /* Handle MPI errors. */
+        PLOG((2, "handling mpi errors mpierr = %d", mpierr));
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+
+    /* The variables of netCDF-4 files get the compression of the
+     * iosystem. */
+    if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_NETCDF4C)
+    {
+        file->compression = ios->compression;
+        file->compression_level = ios->compression_level;
+    }
+
+    /* If this task is in the IO component, do the IO. */
+    if (ios->ioproc)
+    {
+        MPI_Info info = ios->info;
+
+        /* Limit the IO tasks that access a parallel file, and set
+         * the automatic hints, if asked. */
+        if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_PNETCDF)
+            if ((ierr = get_file_info(ios, filename, file->iotype, 1, &info)))
+            {
+                free(file->fname);
+                free(file);
+                return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+            }
+
+        switch (file->iotype)
+        {
+#ifdef _NETCDF4
+        case PIO_IOTYPE_NETCDF4P:
+            mode = mode |  NC_MPIIO | NC_NETCDF4;
+            PLOG((2, "Calling nc_create_par io_comm = %d mode = %d fh = %d",
+                  ios->io_comm, mode, file->fh));
+            ierr = nc_create_par(filename, mode, ios->io_comm, info, &file->fh);
+            PLOG((2, "nc_create_par returned %d file->fh = %d", ierr, file->fh));
+            break;
+        case PIO_IOTYPE_NETCDF4C:
+            mode = mode | NC_NETCDF4;
+#endif
+        case PIO_IOTYPE_NETCDF:
+            if (file->iotype == PIO_IOTYPE_NETCDF && ios->num_subfiles > 1 &&
+                ios->num_iotasks > 1)
+                ierr = create_subfiles(file, filename, mode);
+            else if (!ios->io_rank)
+            {
+                PLOG((2, "Calling nc_create mode = %d", mode));
+                ierr = nc_create(filename, mode, &file->fh);
+            }
+            break;
+#ifdef _PNETCDF
+        case PIO_IOTYPE_PNETCDF:
+            PLOG((2, "Calling ncmpi_create mode = %d", mode));
+            if (!(ierr = ncmpi_create(ios->io_comm, filename, mode, info, &file->fh)))
+            {
+                /* The stage log and buffer are set up on each IO
+                 * task, so get their errors on all of them. */
+                if (ios->stage_dir)
+                    ierr = pio_subfile_err(ios, open_stage_log(file, filename));
+                if (!ierr)
+                    ierr = get_file_buffer_limit(ios, &file->buffer_limit);
+                if (!ierr)
+                    ierr = pio_subfile_err(ios, ncmpi_buffer_attach(file->fh,
+                                                                    file->buffer_limit));
+
+                /* Don't leave the file open if there was an error. */
+                if (ierr)
+                {
+                    if (file->stage_fp)
+                        fclose(file->stage_fp);
+                    file->stage_fp = NULL;
+                    ncmpi_close(file->fh);
+                }
+            }
+            break;
+#endif
+        }
+        if (info != ios->info)
+            MPI_Info_free(&info);
+
+        /* Mark the file, and create the checkpoint file of this IO
+         * task, if asked. */
+        if (ios->checkpoint)
+        {
+            int ret = ierr;
+
+            if (!ret)
+                ret = pio_ckpt_mark(file);
+            if (!ret)
+                ret = pio_ckpt_create(file, filename);
+
+            /* Get the error on all IO tasks, also those that don't
+             * create the file, and don't leave it open. */
+            ret = pio_subfile_err(ios, ret);
+            if (ret && !ierr)
+            {
+#ifdef _PNETCDF
+                if (file->iotype == PIO_IOTYPE_PNETCDF)
+                    ncmpi_close(file->fh);
+                else
+#endif /* _PNETCDF */
+                if (file->do_io && file->fh != -1)
+                    nc_close(file->fh);
+                ierr = ret;
+            }
+        }
+        PLOG((3, "create call complete file->fh %d", file->fh));
+    }
+    else if (ios->checkpoint)
+        file->ckpt_nfiles = ios->num_iotasks;
+
+    /* Broadcast and check the return code. */
+    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    /* If there was an error, free the memory we allocated and handle error. */
+    if (ierr)
+    {
+        pio_ckpt_close(file);
+        free(file->fname);
+        free(file);
+        return check_netcdf2(ios, NULL, ierr, __FILE__, __LINE__);
+    }
+
+    /* Broadcast writablility to all tasks. */
+    if ((mpierr = MPI_Bcast(&file->writable, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    /* Broadcast next ncid to all tasks from io root, necessary
+     * because files may be opened on mutilple iosystems, causing the
+     * underlying library to reuse ncids. Hilarious confusion
+     * ensues. */
+    if (ios->async)
+    {
+        PLOG((3, "createfile bcasting pio_next_ncid %d", pio_next_ncid));
+        if ((mpierr = MPI_Bcast(&pio_next_ncid, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        PLOG((3, "createfile bcast pio_next_ncid %d", pio_next_ncid));
+    }
+
+    /* Assign the PIO ncid. */
+    file->pio_ncid = pio_next_ncid++;
+
+    /* With the netCDF integration layer, we must override the ncid
+     * generated on the computation processors, with the ncid
+     * generated by the I/O processors (which know about all open
+     * files). In normal PIO operation, the ncid is generated here. */
+#ifdef NETCDF_INTEGRATION
+    if (use_ext_ncid)
+    {
+        /* The ncid was assigned on the computational
+         * processors. Change the ncid to one that I/O and
+         * computational components can agree on. */
+        if ((ierr = nc4_file_change_ncid(*ncidp, file->pio_ncid)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+        file->pio_ncid = file->pio_ncid << ID_SHIFT;
+        file->ncint_file++;
+        PLOG((2, "changed ncid to file->pio_ncid = %d", file->pio_ncid));
+    }
+#endif /* NETCDF_INTEGRATION */
+    PLOG((2, "file->fh = %d file->pio_ncid = %d", file->fh, file->pio_ncid));
+
+    /* Return the ncid to the caller. */
+    *ncidp = file->pio_ncid;
+
+    /* Add the struct with this files info to the global list of
+     * open files. */
+    pio_add_to_file_list(file);
+
+#ifdef USE_MPE
+    pio_stop_mpe_log(CREATE, __func__);
+#endif /* USE_MPE */
+    PLOG((2, "Created file %s file->fh = %d file->pio_ncid = %d", filename,
+          file->fh, file->pio_ncid));
+
+    return ierr;
+}
+
+/**
+ * Check that a file meets PIO requirements for use of unlimited
+ * dimensions. This function is only called on netCDF-4 files. If the
+ * file is found to violate PIO requirements it is closed.
+ *
+ * @param ncid the file->fh for this file (the real netCDF ncid, not
+ * the pio_ncid).
+ * @returns 0 if file is OK, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+check_unlim_use(int ncid)
+{
+#ifdef _NETCDF4
+    int nunlimdims; /* Number of unlimited dims in file. */
+    int nvars;       /* Number of vars in file. */
+    int ierr;        /* Return code. */
+
+    /* Are there 2 or more unlimited dims in this file? */
+    if ((ierr = nc_inq_unlimdims(ncid, &nunlimdims, NULL)))
+        return ierr;
+    if (nunlimdims < 2)
+        return PIO_NOERR;
+
+    /* How many vars in file? */
+    if ((ierr = nc_inq_nvars(ncid, &nvars)))
+        return ierr;
+
+    /* Check each var. */
+    for (int v = 0; v < nvars && !ierr; v++)
+    {
+        int nvardims;
+        if ((ierr = nc_inq_varndims(ncid, v, &nvardims)))
+            return ierr;
+        int vardimid[nvardims];
+        if ((ierr = nc_inq_vardimid(ncid, v, vardimid)))
+            return ierr;
+
+        /* Check all var dimensions, except the first. If we find
+         * unlimited, that's a problem. */
+        for (int vd = 1; vd < nvardims; vd++)
+        {
+            size_t dimlen;
+            if ((ierr = nc_inq_dimlen(ncid, vardimid[vd], &dimlen)))
+                return ierr;
+            if (dimlen == NC_UNLIMITED)
+            {
+                nc_close(ncid);
+                return PIO_EINVAL;
+            }
+        }
+    }
+#endif /* _NETCDF4 */
+
+    return PIO_NOERR;
+}
+
+/**
+ * Internal function to allocate the header of a file, as one block
+ * of memory with the arrays after the struct.
+ *
+ * @param nvars the number of vars.
+ * @param ndims the number of dims.
+ * @param ndimids the sum of the ndims of the vars.
+ * @param names non-zero to include the var names.
+ * @param metap pointer that gets the header, which must be freed by
+ * the caller.
+ *
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+alloc_file_meta(int nvars, int ndims, int ndimids, int names,
+                pio_file_meta **metap)
+{
+    pio_file_meta *meta;
+    size_t size;
+    char *p;
+
+    /* The dims come first, as they hold a PIO_Offset. */
+    size = sizeof(pio_file_meta) + ndims * sizeof(pio_dim_meta) +
+        nvars * sizeof(pio_var_meta) + ndimids * sizeof(int);
+    if (names)
+        size += nvars * (PIO_MAX_NAME + 1);
+
+    if (!(meta = calloc(1, size)))
+        return PIO_ENOMEM;
+    meta->nvars = nvars;
+    meta->ndims = ndims;
+    meta->ndimids = ndimids;
+    meta->names = names;
+    meta->size = size;
+
+    p = (char *)(meta + 1);
+    meta->dims = (pio_dim_meta *)p;
+    p += ndims * sizeof(pio_dim_meta);
+    meta->vars = (pio_var_meta *)p;
+    p += nvars * sizeof(pio_var_meta);
+    meta->dimids = (int *)p;
+    p += ndimids * sizeof(int);
+    meta->var_names = names ? (char (*)[PIO_MAX_NAME + 1])p : NULL;
+
+    *metap = meta;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Internal function used when opening an existing file. This function
+ * is called by PIOc_openfile_retry() on the IO tasks. It reads the
+ * header of the file, which is then broadcast to all tasks in one
+ * message. The results end up in the file_desc_t and var_desc_t
+ * structs for this file and the vars in it.
+ *
+ * @param file pointer to the file_desc_t for this file.
+ * @param ncid the ncid assigned to the file when opened.
+ * @param iotype the iotype used to open the file.
+ * @param names non-zero to also read the names of the vars, which
+ * are only needed by the netCDF integration layer.
+ * @param metap pointer that gets the header. It must be freed by
+ * the caller.
+ *
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_openfile_c
+ * @author Ed Hartnett
+ */
+static int
+inq_file_metadata(file_desc_t *file, int ncid, int iotype, int names,
+                  pio_file_meta **metap)
+{
+    pio_file_meta *meta;
+    int nvars, ndims, ngatts;
+    int nunlimdims = 0;        /* The number of unlimited dimensions. */
+    int unlimdimid;
+    int ndimids = 0;
+    int *dimids;
+    int mpierr;
+    int ret;
+
+    /* Check inputs. */
+    pioassert(metap, "pointer must be provided", __FILE__, __LINE__);
+
+    /* How many dims, vars and atts in the file? */
+    if (iotype == PIO_IOTYPE_PNETCDF)
+    {
+#ifdef _PNETCDF
+        if ((ret = ncmpi_inq(ncid, &ndims, &nvars, &ngatts, &unlimdimid)))
+            return pio_err(NULL, file, ret, __FILE__, __LINE__);
+#endif /* _PNETCDF */
+    }
+    else
+    {
+        if ((ret = nc_inq(ncid, &ndims, &nvars, &ngatts, &unlimdimid)))
+            return pio_err(NULL, file, ret, __FILE__, __LINE__);
+    }
+
+    /* How many unlimited dims for this file? */
+    if (iotype == PIO_IOTYPE_PNETCDF || iotype == PIO_IOTYPE_NETCDF)
+        nunlimdims = unlimdimid == -1 ? 0 : 1;
+    else
+    {
+#ifdef _NETCDF4
+        if ((ret = nc_inq_unlimdims(ncid, &nunlimdims, NULL)))
+            return pio_err(NULL, file, ret, __FILE__, __LINE__);
+#endif /* _NETCDF4 */
+    }
+
+    /* Learn the unlimited dimension ID(s), if there are any. */
+    int unlimdimids[nunlimdims ? nunlimdims : 1];
+    if (nunlimdims)
+    {
+        if (iotype == PIO_IOTYPE_PNETCDF || iotype == PIO_IOTYPE_NETCDF)
+        {
+            unlimdimids[0] = unlimdimid;
+        }
+        else
+        {
+#ifdef _NETCDF4
+            if ((ret = nc_inq_unlimdims(ncid, NULL, unlimdimids)))
+                return pio_err(NULL, file, ret, __FILE__, __LINE__);
+#endif /* _NETCDF4 */
+        }
+    }
+
+    /* Find the space needed for the dimids of the vars. */
+    for (int v = 0; v < nvars; v++)
+    {
+        int var_ndims;
+
+        if (iotype == PIO_IOTYPE_PNETCDF)
+        {
+#ifdef _PNETCDF
+            if ((ret = ncmpi_inq_varndims(ncid, v, &var_ndims)))
+                return pio_err(NULL, file, ret, __FILE__, __LINE__);
+#endif /* _PNETCDF */
+        }
+        else
+        {
+            if ((ret = nc_inq_varndims(ncid, v, &var_ndims)))
+                return pio_err(NULL, file, ret, __FILE__, __LINE__);
+        }
+        ndimids += var_ndims;
+    }
+
+    /* Allocate storage for the header. */
+    if ((ret = alloc_file_meta(nvars, ndims, ndimids, names, &meta)))
+        return pio_err(NULL, file, ret, __FILE__, __LINE__);
+    meta->ngatts = ngatts;
+
+    /* Learn about each dimension in the file. */
+    for (int d = 0; d < ndims; d++)
+    {
+        if (iotype == PIO_IOTYPE_PNETCDF)
+        {
+#ifdef _PNETCDF
+            ret = ncmpi_inq_dim(ncid, d, meta->dims[d].name, &meta->dims[d].len);
+#endif /* _PNETCDF */
+        }
+        else
+        {
+            size_t len;
+
+            if (!(ret = nc_inq_dim(ncid, d, meta->dims[d].name, &len)))
+                meta->dims[d].len = len;
+        }
+        if (ret)
+        {
+            free(meta);
+            return pio_err(NULL, file, ret, __FILE__, __LINE__);
+        }
+        for (int ud = 0; ud < nunlimdims; ud++)
+            if (unlimdimids[ud] == d)
+                meta->dims[d].unlim = 1;
+    }
+
+    /* Learn about each variable in the file. */
+    dimids = meta->dimids;
+    for (int v = 0; v < nvars; v++)
+    {
+        pio_var_meta *var = &meta->vars[v];
+        char *name = names ? meta->var_names[v] : NULL;
+        nc_type my_type;
+        MPI_Datatype mpi_type;
+
+        /* Find type of the var and its dims and atts. Also learn
+         * about type. */
+        if (iotype == PIO_IOTYPE_PNETCDF)
+        {
+#ifdef _PNETCDF
+            PIO_Offset type_size;
+
+            if ((ret = ncmpi_inq_var(ncid, v, name, &my_type, &var->ndims, dimids,
+                                     &var->natts)))
+                break;
+            if ((ret = pioc_pnetcdf_inq_type(ncid, my_type, NULL, &type_size)))
+                break;
+            var->pio_type_size = type_size;
+#endif /* _PNETCDF */
+        }
+        else
+        {
+            size_t type_size;
+
+            if ((ret = nc_inq_var(ncid, v, name, &my_type, &var->ndims, dimids,
+                                  &var->natts)))
+                break;
+            if ((ret = nc_inq_type(ncid, my_type, NULL, &type_size)))
+                break;
+            var->pio_type_size = type_size;
+        }
+        var->pio_type = (int)my_type;
+
+        /* Get the size of the MPI type corresponding with the PIO
+         * type. */
+        if ((ret = find_mpi_type(var->pio_type, &mpi_type, NULL)))
+            break;
+        if (mpi_type == MPI_DATATYPE_NULL)
+            var->mpi_type_size = 0;
+        else
+            if ((mpierr = MPI_Type_size(mpi_type, &var->mpi_type_size)))
+            {
+                free(meta);
+                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+            }
+
+        /* Only the first dim of a var may be unlimited, for PIO. */
+        for (int d = 0; d < var->ndims; d++)
+        {
+            for (int ud = 0; ud < nunlimdims; ud++)
+            {
+                if (dimids[d] == unlimdimids[ud])
+                {
+                    if (d)
+                        ret = PIO_EINVAL;
+                    var->rec_var = 1;
+                }
+            }
+        }
+        if (ret)
+            break;
+        dimids += var->ndims;
+    } /* next var */
+
+    if (ret)
+    {
+        free(meta);
+        return pio_err(NULL, file, ret, __FILE__, __LINE__);
+    }
+
+    *metap = meta;
+
+    return PIO_NOERR;
+}
+
+/**
+ * Find the appropriate IOTYPE from mode flags to nc_open(). The
+ * following flags have meaning:
+ * - NC_NETCDF4 - use netCDF-4/HDF5 format
+ * - NC_MPIIO - when used with NC_NETCDF4, use parallel I/O.
+ * - NC_PNETCDF - use classic format with pnetcdf parallel I/O.
+ *
+ * @param mode the mode flag from nc_open().
+ * @param iotype pointer that gets the IOTYPE.
+ *
+ * @return 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+find_iotype_from_omode(int mode, int *iotype)
+{
+    /* Check inputs. */
+    pioassert(iotype, "pointer to iotype must be provided", __FILE__, __LINE__);
+
+    /* Figure out the iotype. */
+    if (mode & NC_NETCDF4)
+    {
+        if (mode & NC_MPIIO || mode & NC_MPIPOSIX)
+            *iotype = PIO_IOTYPE_NETCDF4P;
+        else
+            *iotype = PIO_IOTYPE_NETCDF4C;
+    }
+    else
+    {
+        if (mode & NC_PNETCDF || mode & NC_MPIIO)
+            *iotype = PIO_IOTYPE_PNETCDF;
+        else
+            *iotype = PIO_IOTYPE_NETCDF;
+    }
+
+    return PIO_NOERR;
+}
+
+
+/**
+ * Find the appropriate IOTYPE from mode flags to nc_create().
+ *
+ * @param cmode the mode flag from nc_create().
+ * @param iotype pointer that gets the IOTYPE.
+ *
+ * @return 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+find_iotype_from_cmode(int cmode, int *iotype)
+{
+    /* Check inputs. */
+    pioassert(iotype, "pointer to iotype must be provided", __FILE__, __LINE__);
+
+    /* Figure out the iotype. */
+    if (cmode & NC_NETCDF4)
+    {
+        if (cmode & NC_MPIIO || cmode & NC_MPIPOSIX)
+            *iotype = PIO_IOTYPE_NETCDF4P;
+        else
+            *iotype = PIO_IOTYPE_NETCDF4C;
+    }
+    else
+    {
+        if (cmode & NC_PNETCDF || cmode & NC_MPIIO)
+            *iotype = PIO_IOTYPE_PNETCDF;
+        else
+            *iotype = PIO_IOTYPE_NETCDF;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Internal function to choose the iotype for opening an existing
+ * file from the first bytes of the file. Classic, 64-bit offset and
+ * CDF5 files start with "CDF" and a version byte, netCDF-4 files
+ * carry the HDF5 signature at offset 0, 512, 1024 or 2048. A classic
+ * file asked for as netCDF-4 parallel is opened with pnetcdf, a
+ * classic file asked for as netCDF-4 serial with netCDF serial, and a
+ * netCDF-4 file asked for as pnetcdf with netCDF-4 parallel, so the
+ * open does not need to fail first. A change of iotype is logged.
+ * This is called on the IO root.
+ *
+ * @param filename the name of the file.
+ * @param iotype the iotype asked for.
+ * @returns the iotype to open the file with. If the file can't be
+ * read or has an unknown format, the iotype asked for.
+ * @author Ed Hartnett
+ */
+static int
+sniff_iotype(const char *filename, int iotype)
+{
+    static const char hdf5_sig[8] = {'\211', 'H', 'D', 'F', '\r', '\n', '\032', '\n'};
+    char magic[8];
+    int hdf5 = 0, cdf = 0;
+    FILE *fp;
+
+    if (!(fp = fopen(filename, "rb")))
+        return iotype;
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic))
+        cdf = !strncmp(magic, "CDF", 3) && (magic[3] == 1 || magic[3] == 2 ||
+                                            magic[3] == 5);
+    for (long off = 0; !cdf && !hdf5 && off <= 2048; off = off ? off * 2 : 512)
+    {
+        if (fseek(fp, off, SEEK_SET) || fread(magic, 1, sizeof(magic), fp) != sizeof(magic))
+            break;
+        hdf5 = !memcmp(magic, hdf5_sig, sizeof(magic));
+    }
+    fclose(fp);
+    PLOG((2, "sniff_iotype %s cdf = %d hdf5 = %d", filename, cdf, hdf5));
+
+    if (cdf && iotype == PIO_IOTYPE_NETCDF4P)
+    {
+#ifdef _PNETCDF
+        PLOG((1, "%s is a classic file, opening it with pnetcdf", filename));
+        return PIO_IOTYPE_PNETCDF;
+#else
+        PLOG((1, "%s is a classic file, opening it with netCDF serial", filename));
+        return PIO_IOTYPE_NETCDF;
+#endif /* _PNETCDF */
+    }
+    if (cdf && iotype == PIO_IOTYPE_NETCDF4C)
+    {
+        PLOG((1, "%s is a classic file, opening it with netCDF serial", filename));
+        return PIO_IOTYPE_NETCDF;
+    }
+    if (hdf5 && iotype == PIO_IOTYPE_PNETCDF)
+    {
+#if defined(_NETCDF4) && !defined(_MPISERIAL)
+        PLOG((1, "%s is a netCDF-4 file, opening it with netCDF-4 parallel", filename));
+        return PIO_IOTYPE_NETCDF4P;
+#else
+        PLOG((1, "%s is a netCDF-4 file, opening it with netCDF serial", filename));
+        return PIO_IOTYPE_NETCDF;
+#endif /* _NETCDF4 */
+    }
+
+    return iotype;
+}
+
+/**
+ * Open an existing file, for PIOc_openfile_retry(). If lazy is true,
+ * the file is only added to the list of files, with the values the
+ * open needs, see PIOc_set_lazy_open().
+ *
+ * @param iosysid a defined pio system descriptor.
+ * @param ncidp a pio file descriptor.
+ * @param iotype a pio output format.
+ * @param filename the filename to open
+ * @param mode the netcdf mode for the open operation
+ * @param retry non-zero to automatically retry with netCDF serial
+ * classic.
+ * @param use_ext_ncid non-zero to use an externally assigned ncid
+ * (used in the netcdf integration layer).
+ * @param lazy true to leave the open until the file is first used.
+ *
+ * @return 0 for success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
+ */
+static int
+openfile_int(int iosysid, int *ncidp, int *iotype, const char *filename,
+             int mode, int retry, int use_ext_ncid, bool lazy)
+{
+    iosystem_desc_t *ios;      /* Pointer to io system information. */
+    file_desc_t *file;         /* Pointer to file information. */
+    int imode;                 /* Internal mode val for netcdf4 file open. */
+    pio_file_meta *meta = NULL; /* The header of the file. */
+    int counts[4] = {0};       /* The sizes of the header. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /** Return code from MPI function codes. */
+    int ierr = PIO_NOERR;      /* Return code from function calls. */
+
+#ifdef USE_MPE
+    pio_start_mpe_log(OPEN);
+#endif /* USE_MPE */
+
+    /* Get the IO system info from the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* User must provide valid input for these parameters. */
+    if (!ncidp || !iotype || !filename)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    if (*iotype < PIO_IOTYPE_PNETCDF || *iotype > PIO_IOTYPE_NETCDF4P)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    PLOG((2, "openfile_int iosysid = %d iotype = %d filename = %s mode = %d retry = %d "
+          "lazy = %d", iosysid, *iotype, filename, mode, retry, lazy));
+
+    /* Allocate space for the file info. */
+    if (!(file = calloc(sizeof(*file), 1)))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Fill in some file values. */
+    file->fh = -1;
+    file->iotype = *iotype;
+    file->iosystem = ios;
+    file->writable = (mode & PIO_WRITE) ? 1 : 0;
+    file->defer_errors = ios->defer_errors && !ios->async;
+    if (!(file->fname = strdup(filename)))
+    {
+        free(file);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
+
+    /* Arrays read from this file may be changed through a writable
+     * open. */
+    if (file->writable)
+        pio_read_cache_clear(ios, filename, -1);
+
+    /* Only keep what the open needs, if it is left until the file is
+     * used. See pio_open_lazy_file(). */
+    if (lazy)
+    {
+        file->lazy = true;
+        file->lazy_mode = mode;
+        file->lazy_retry = retry;
+        file->pio_ncid = pio_next_ncid++;
+        *ncidp = file->pio_ncid;
+        pio_add_to_file_list(file);
+        PLOG((2, "Lazily opened file %s file->pio_ncid = %d", filename, file->pio_ncid));
+        return PIO_NOERR;
+    }
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
+    {
+        int msg = PIO_MSG_OPEN_FILE;
+        size_t len = strlen(filename);
+
+        if (!ios->ioproc)
+        {
+            /* Send the message to the message handler. */
+            if (ios->compmaster == MPI_ROOT)
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+
+            /* Send the parameters of the function call. */
+            if (!mpierr)
+                mpierr = MPI_Bcast(&len, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast((void *)filename, len + 1, MPI_CHAR, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&file->iotype, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&mode, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&use_ext_ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&retry, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ios->hint_auto, 1, MPI_INT, ios->compmaster,
+                                   ios->intercomm);
+#ifdef NETCDF_INTEGRATION
+            if (!mpierr)
+                mpierr = MPI_Bcast(&diosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+#endif /* NETCDF_INTEGRATION */
+        }
+
+        /* Handle MPI errors. */
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Choose the iotype from the format of the file, so that a
+     * mismatched iotype does not cost a failed open. */
+    if (retry)
+    {
+        if (ios->ioroot == ios->union_rank)
+            file->iotype = sniff_iotype(filename, file->iotype);
+        if ((mpierr = MPI_Bcast(&file->iotype, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+        PLOG((2, "PIOc_openfile_retry iotype = %d", file->iotype));
+    }
+
+    /* The default fill mode of the netCDF library. */
+    file->fill_mode = file->iotype == PIO_IOTYPE_PNETCDF ? NC_NOFILL : NC_FILL;
+
+    /* Read and write distributed arrays with varn or vard. */
+    file->use_vard = file->iotype == PIO_IOTYPE_PNETCDF && PIO_VARD_DEFAULT;
+
+    /* Set to true if this task should participate in IO (only true
+     * for one task with netcdf serial files. */
+    if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_PNETCDF ||
+        ios->io_rank == 0)
+        file->do_io = 1;
+
+    /* If this is an IO task, then call the netCDF function. */
+    if (ios->ioproc)
+    {
+        MPI_Info info = ios->info;
+
+        /* Set the automatic hints of a parallel file, if asked. */
+        if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_PNETCDF)
+            if ((ierr = get_file_info(ios, filename, file->iotype, 0, &info)))
+            {
+                free(file->fname);
+                free(file);
+                return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+            }
+
+        switch (file->iotype)
+        {
+#ifdef _NETCDF4
+
+        case PIO_IOTYPE_NETCDF4P:
+#ifdef _MPISERIAL
+            ierr = nc_open(filename, mode, &file->fh);
+#else
+            imode = mode |  NC_MPIIO;
+            if ((ierr = nc_open_par(filename, imode, ios->io_comm, info,
+                                    &file->fh)))
+                break;
+
+            /* Access the vars collectively from the start, if asked. */
+            if (ios->nc4p_coll_meta)
+            {
+                if ((ierr = set_coll_access(file->fh)))
+                    break;
+                file->coll_access = true;
+            }
+
+            /* Check the vars for valid use of unlim dims. */
+            if ((ierr = check_unlim_use(file->fh)))
+                break;
+
+            if ((ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_NETCDF4P,
+                                          use_ext_ncid, &meta)))
+                break;
+            PLOG((2, "PIOc_openfile_retry:nc_open_par filename = %s mode = %d "
+                  "imode = %d ierr = %d", filename, mode, imode, ierr));
+#endif
+            break;
+
+        case PIO_IOTYPE_NETCDF4C:
+            if (ios->io_rank == 0)
+            {
+                if ((ierr = nc_open(filename, mode, &file->fh)))
+                    break;
+                /* Check the vars for valid use of unlim dims. */
+                if ((ierr = check_unlim_use(file->fh)))
+                    break;
+                ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_NETCDF4C,
+                                         use_ext_ncid, &meta);
+                PLOG((2, "PIOc_openfile_retry:nc_open for 4C filename = %s mode = %d "
+                      "ierr = %d", filename, mode, ierr));
+            }
+            break;
+#endif /* _NETCDF4 */
+
+        case PIO_IOTYPE_NETCDF:
+            /* This may be the index file of subfiles. */
+            if ((ierr = open_classic(file, filename, mode)))
+                break;
+            if (file->do_io)
+            {
+                ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_NETCDF,
+                                         use_ext_ncid, &meta);
+                PLOG((2, "PIOc_openfile_retry:nc_open for classic filename = %s mode = %d "
+                      "ierr = %d", filename, mode, ierr));
+            }
+            break;
+
+#ifdef _PNETCDF
+        case PIO_IOTYPE_PNETCDF:
+            ierr = ncmpi_open(ios->io_comm, filename, mode, info, &file->fh);
+
+            // This should only be done with a file opened to append
+            if (ierr == PIO_NOERR && (mode & PIO_WRITE))
+            {
+                if (!(ierr = get_file_buffer_limit(ios, &file->buffer_limit)))
+                {
+                    if (ios->iomaster == MPI_ROOT)
+                        PLOG((2, "%d Setting IO buffer %ld", __LINE__, file->buffer_limit));
+                    ierr = ncmpi_buffer_attach(file->fh, file->buffer_limit);
+                }
+            }
+            PLOG((2, "ncmpi_open(%s) : fd = %d", filename, file->fh));
+
+            if (!ierr)
+                ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_PNETCDF,
+                                         use_ext_ncid, &meta);
+            break;
+#endif
+
+        default:
+            return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
+        }
+        if (info != ios->info)
+            MPI_Info_free(&info);
+
+        /* If the caller requested a retry, and we failed to open a
+           file due to an incompatible type of NetCDF, try it once
+           with just plain old basic NetCDF. */
+        if (retry)
+        {
+            PLOG((2, "retry error code ierr = %d io_rank %d", ierr, ios->io_rank));
+            if ((ierr == NC_ENOTNC || ierr == NC_EINVAL) && (file->iotype != PIO_IOTYPE_NETCDF))
+            {
+                if (ios->iomaster == MPI_ROOT)
+                    printf("PIO2 pio_file.c retry NETCDF\n");
+
+                /* reset ierr on all tasks */
+                ierr = PIO_NOERR;
+
+                /* reset file markers for NETCDF on all tasks */
+                file->iotype = PIO_IOTYPE_NETCDF;
+
+                /* open netcdf file serially on main task */
+                if (ios->io_rank == 0)
+                {
+                    ierr = nc_open(filename, mode, &file->fh);
+                    if (ierr == PIO_NOERR)
+                        ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_NETCDF,
+                                                 use_ext_ncid, &meta);
+                }
+                else
+                    file->do_io = 0;
+            }
+            PLOG((2, "retry nc_open(%s) : fd = %d, iotype = %d, do_io = %d, ierr = %d",
+                  filename, file->fh, file->iotype, file->do_io, ierr));
+        }
+
+        /* Open the checkpoint files of the file, if it has them. */
+        {
+            int ret = pio_ckpt_open(file, filename);
+
+            /* Don't leave the file open if they can't be. */
+            if (ret && !ierr)
+            {
+#ifdef _PNETCDF
+                if (file->iotype == PIO_IOTYPE_PNETCDF)
+                    ncmpi_close(file->fh);
+                else
+#endif /* _PNETCDF */
+                if (file->do_io)
+                    nc_close(file->fh);
+                ierr = ret;
+            }
+        }
+    }
+
+    /* Broadcast and check the return code. */
+    if (ios->ioroot == ios->union_rank)
+        PLOG((2, "Bcasting error code ierr %d ios->ioroot %d ios->my_comm %d",
+              ierr, ios->ioroot, ios->my_comm));
+    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    PLOG((2, "Bcast openfile_retry error code ierr = %d", ierr));
+
+    /* If there was an error, free allocated memory and deal with the error. */
+    if (ierr)
+    {
+        pio_ckpt_close(file);
+        free(meta);
+        free(file->fname);
+        free(file);
+        return check_netcdf2(ios, NULL, ierr, __FILE__, __LINE__);
+    }
+
+    /* Broadcast writability to all tasks. */
+    if ((mpierr = MPI_Bcast(&file->writable, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    /* Broadcast the number of checkpoint files to all tasks. */
+    if ((mpierr = MPI_Bcast(&file->ckpt_nfiles, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    /* Broadcast some values to all tasks from io root. */
+    if (ios->async)
+    {
+        PLOG((3, "open bcasting pio_next_ncid %d ios->ioroot %d", pio_next_ncid, ios->ioroot));
+        if ((mpierr = MPI_Bcast(&pio_next_ncid, 1, MPI_INT, ios->ioroot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    }
+
+    /* Broadcast the header from the IO root, in one message after
+     * its sizes. The other IO tasks use the one of the IO root. */
+    if (meta && ios->union_rank != ios->ioroot)
+    {
+        free(meta);
+        meta = NULL;
+    }
+    if (meta)
+    {
+        counts[0] = meta->nvars;
+        counts[1] = meta->ndims;
+        counts[2] = meta->ndimids;
+        counts[3] = meta->ngatts;
+    }
+    if ((mpierr = MPI_Bcast(counts, 4, MPI_INT, ios->ioroot, ios->my_comm)))
+        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    if (!meta)
+    {
+        if ((ierr = alloc_file_meta(counts[0], counts[1], counts[2], use_ext_ncid,
+                                    &meta)))
+            return pio_err(ios, file, ierr, __FILE__, __LINE__);
+        meta->ngatts = counts[3];
+    }
+    if (meta->size > sizeof(pio_file_meta))
+        if ((mpierr = MPI_Bcast(meta + 1, (int)(meta->size - sizeof(pio_file_meta)),
+                                MPI_BYTE, ios->ioroot, ios->my_comm)))
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+
+    /* With the netCDF integration layer, the ncid is assigned for PIO
+     * by the netCDF dispatch layer code. So it is passed in. In
+     * normal PIO operation, the ncid is generated here. */
+#ifdef NETCDF_INTEGRATION
+    if (use_ext_ncid)
+    {
+        /* The ncid was assigned on the computational
+         * processors. Change the ncid to one that I/O and
+         * computational components can agree on. */
+        file->pio_ncid = pio_next_ncid++;
+        if ((ierr = nc4_file_change_ncid(*ncidp, file->pio_ncid)))
+            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
+        file->pio_ncid = file->pio_ncid << ID_SHIFT;
+        file->ncint_file++;
+        PLOG((2, "changed ncid to file->pio_ncid = %d", file->pio_ncid));
+    }
+    else
+#endif /* NETCDF_INTEGRATION */
+    {
+        /* Create the ncid that the user will see. This is necessary
+         * because otherwise ncids will be reused if files are opened
+         * on multiple iosystems. */
+        file->pio_ncid = pio_next_ncid++;
+
+        /* Return the PIO ncid to the user. */
+        *ncidp = file->pio_ncid;
+    }
+
+    /* Add this file to the list of currently open files. */
+    pio_add_to_file_list(file);
+
+    /* Add info about the variables to the file_desc_t struct. The
+     * MPI type is found on each task, MPI_Datatype handles need not
+     * be the same on all tasks. */
+    for (int v = 0; v < meta->nvars; v++)
+    {
+        pio_var_meta *var = &meta->vars[v];
+        MPI_Datatype mpi_type;
+
+        if ((ierr = find_mpi_type(var->pio_type, &mpi_type, NULL)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+        if ((ierr = add_to_varlist(v, var->rec_var, var->pio_type, var->pio_type_size,
+                                   mpi_type, var->mpi_type_size, var->ndims,
+                                   &file->varlist)))
+            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    }
+    file->nvars = meta->nvars;
+
+    /* The netCDF integration layer keeps the header for its metadata
+     * cache. */
+    if (use_ext_ncid)
+        file->open_meta = meta;
+    else
+        free(meta);
+
+#ifdef USE_MPE
+    pio_stop_mpe_log(OPEN, __func__);
+#endif /* USE_MPE */
+    PLOG((2, "Opened file %s file->pio_ncid = %d file->fh = %d ierr = %d",
+          filename, file->pio_ncid, file->fh, ierr));
+
+    return ierr;
+}
+
+/**
+ * Open an existing file using PIO library. This is an internal
+ * function. Depending on the value of the retry parameter, a failed
+ * open operation will be handled differently. If retry is non-zero,
+ * then a failed attempt to open a file with netCDF-4 (serial or
+ * parallel), or parallel-netcdf will be followed by an attempt to
+ * open the file as a serial classic netCDF file. This is an important
+ * feature to some NCAR users. The functionality is exposed to the
+ * user as PIOc_openfile() (which does the retry), and PIOc_open()
+ * (which does not do the retry).
+ *
+ * With retry, the IO root first reads the start of the file and
+ * broadcasts the iotype matching its format, so a netCDF-4 file
+ * asked for with pnetcdf, or a classic file asked for with netCDF-4,
+ * is opened directly with the right library. A classic file asked
+ * for with netCDF-4 serial stays serial, with netCDF classic.
+ *
+ * If PIOc_set_lazy_open() is on, and async is not in use, the file is
+ * not opened until it is first used, see pio_open_lazy_file().
+ *
+ * Input parameters are read on comp task 0 and ignored elsewhere.
+ *
+ * @param iosysid a defined pio system descriptor.
+ * @param ncidp a pio file descriptor.
+ * @param iotype a pio output format.
+ * @param filename the filename to open
+ * @param mode the netcdf mode for the open operation
+ * @param retry non-zero to automatically retry with netCDF serial
+ * classic.
+ * @param use_ext_ncid non-zero to use an externally assigned ncid
+ * (used in the netcdf integration layer).
+ *
+ * @return 0 for success, error code otherwise.
+ * @ingroup PIO_openfile_c
+ * @author Jim Edwards, Ed Hartnett
+ */
+int
+PIOc_openfile_retry(int iosysid, int *ncidp, int *iotype, const char *filename,
+                    int mode, int retry, int use_ext_ncid)
+{
+    iosystem_desc_t *ios;      /* Pointer to io system information. */
 
-    /* Get the communicator size and task rank. */
-    if ((mpierr = MPI_Comm_size(comm, &size)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Comm_rank(comm, &my_rank)))
-        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
-    PLOG((2, "size = %d my_rank = %d", size, my_rank));
+    /* Get the IO system info from the iosysid. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Read the file. This allocates three arrays that we have to
-     * free. */
-    if ((ret = pioc_read_nc_decomp_int(iosysid, filename, &ndims, &global_dimlen, &num_tasks_decomp,
-                                       &task_maplen, &max_maplen, &full_map, title, history,
-                                       source_in, version_in, fortran_order)))
-        return ret;
-    PLOG((2, "ndims = %d num_tasks_decomp = %d max_maplen = %d", ndims, num_tasks_decomp,
-          max_maplen));
+    return openfile_int(iosysid, ncidp, iotype, filename, mode, retry, use_ext_ncid,
+                        ios->lazy_open && !ios->async && !use_ext_ncid);
+}
 
-    /* If the size does not match the number of tasks in the decomp,
-     * that's an error. */
-    if (size != num_tasks_decomp)
-        ret = PIO_EINVAL;
+/**
+ * Open a file that was opened lazily, on its first use. The file is
+ * opened as PIOc_openfile_retry() would have, and its file_desc_t
+ * takes the place of the lazy one in the list of files, under the
+ * same ncid. The lazy one is freed. If the open fails, the lazy one
+ * is kept, and may still be closed.
+ *
+ * This is called by pio_get_file_open(), from the functions that
+ * must be called on all tasks of the IO system, so the open is
+ * collective. Functions that are not collective, like
+ * PIOc_setframe(), PIOc_File_is_Open() and PIOc_file_wait(), do not
+ * open the file. Frames set before the open are set on the vars here.
+ *
+ * @param lazy pointer to the file_desc_t of the lazily opened file.
+ * @param filep pointer that gets the file_desc_t of the open file.
+ *
+ * @return 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_open_lazy_file(file_desc_t *lazy, file_desc_t **filep)
+{
+    file_desc_t *file;
+    int iotype = lazy->iotype;
+    int ncid;
+    int ierr;
 
-    /* Now initialize the iodesc on each task for this decomposition. */
-    if (!ret)
-    {
-        PIO_Offset *compmap;
+    PLOG((2, "pio_open_lazy_file ncid = %d fname = %s", lazy->pio_ncid, lazy->fname));
 
-        if (!(compmap = malloc(sizeof(PIO_Offset) * task_maplen[my_rank])))
-            return PIO_ENOMEM;
+    if ((ierr = openfile_int(lazy->iosystem->iosysid, &ncid, &iotype, lazy->fname,
+                             lazy->lazy_mode, lazy->lazy_retry, 0, false)))
+        return ierr;
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(lazy->iosystem, NULL, ierr, __FILE__, __LINE__);
 
-        /* Copy array into PIO_Offset array. Make it 1 based. */
-        for (int e = 0; e < task_maplen[my_rank]; e++)
-            compmap[e] = full_map[my_rank * max_maplen + e] + 1;
+    /* The open file gets the ncid the user has. */
+    pio_replace_file(lazy, file);
 
-        /* Initialize the decomposition. */
-        ret = PIOc_InitDecomp(iosysid, pio_type, ndims, global_dimlen, task_maplen[my_rank],
-                              compmap, ioidp, NULL, NULL, NULL);
+    /* Set the frames that were set before the open. */
+    for (int f = 0; !ierr && f < lazy->nlazy_frames; f++)
+    {
+        var_desc_t *vdesc;
 
-        free(compmap);
+        if (!(ierr = get_file_var_desc(file, lazy->lazy_frames[2 * f], &vdesc)))
+            vdesc->record = lazy->lazy_frames[2 * f + 1];
     }
+    free(lazy->lazy_frames);
+    free(lazy->fname);
+    free(lazy);
+    if (ierr)
+        return pio_err(file->iosystem, file, ierr, __FILE__, __LINE__);
 
-    /* Free resources. */
-    free(global_dimlen);
-    free(task_maplen);
-    free(full_map);
+    *filep = file;
 
-    return ret;
+    return PIO_NOERR;
 }
 
 /**
- * Write the decomp information in netCDF. This is an internal
- * function.
+ * Internal function to provide inq_type function for pnetcdf.
  *
- * @param ios pointer to io system info.
- * @param filename the name the decomp file will have.
- * @param cmode for PIOc_create(). Will be bitwise or'd with NC_WRITE.
- * @param ndims number of dims in the data being described.
- * @param global_dimlen an array, of size ndims, with the size of the
- * global array in each dimension.
- * @param num_tasks the number of tasks the data are decomposed over.
- * @param task_maplen array of size num_tasks with the length of the
- * map for each task.
- * @param map pointer to a 2D array of size [num_tasks][max_maplen]
- * with the 0-based mapping from local to global array elements.
- * @param title null-terminated string that will be written as an
- * attribute. If provided, length must be < PIO_MAX_NAME + 1. Ignored
- * if NULL.
- * @param history null-terminated string that will be written as an
- * attribute. If provided, length must be < PIO_MAX_NAME + 1. Ignored
- * if NULL.
- * @param fortran_order set to non-zero if using fortran array
- * ordering, 0 for C array ordering.
- * @returns 0 for success, error code otherwise.
+ * @param ncid ignored because pnetcdf does not have user-defined
+ * types.
+ * @param xtype type to learn about.
+ * @param name pointer that gets name of type. Ignored if NULL.
+ * @param sizep pointer that gets size of type. Ignored if NULL.
+ * @returns 0 on success, error code otherwise.
  * @author Ed Hartnett
  */
 int
-pioc_write_nc_decomp_int(iosystem_desc_t *ios, const char *filename, int cmode, int ndims,
-                         int *global_dimlen, int num_tasks, int *task_maplen, int *map,
-                         const char *title, const char *history, int fortran_order)
+pioc_pnetcdf_inq_type(int ncid, nc_type xtype, char *name,
+                      PIO_Offset *sizep)
 {
-    int max_maplen = 0;
-    int ncid;
-    int ret;
+    int typelen;
 
-    /* Check inputs. */
-    pioassert(ios && filename && global_dimlen && task_maplen &&
-              (!title || strlen(title) <= PIO_MAX_NAME) &&
-              (!history || strlen(history) <= PIO_MAX_NAME), "invalid input",
-              __FILE__, __LINE__);
+    switch (xtype)
+    {
+    case NC_UBYTE:
+    case NC_BYTE:
+    case NC_CHAR:
+        typelen = 1;
+        break;
+    case NC_SHORT:
+    case NC_USHORT:
+        typelen = 2;
+        break;
+    case NC_UINT:
+    case NC_INT:
+    case NC_FLOAT:
+        typelen = 4;
+        break;
+    case NC_UINT64:
+    case NC_INT64:
+    case NC_DOUBLE:
+        typelen = 8;
+        break;
+    default:
+        return PIO_EBADTYPE;
+    }
 
-    PLOG((2, "pioc_write_nc_decomp_int filename = %s ndims = %d num_tasks = %d", filename,
-          ndims, num_tasks));
+    /* If pointers were supplied, copy results. */
+    if (sizep)
+        *sizep = typelen;
+    if (name)
+        strcpy(name, "some type");
 
-    /* Find the maximum maplen. */
-    for (int t = 0; t < num_tasks; t++)
-        if (task_maplen[t] > max_maplen)
-            max_maplen = task_maplen[t];
-    PLOG((3, "max_maplen = %d", max_maplen));
+    return PIO_NOERR;
+}
 
-    /* Create the netCDF decomp file. */
-    if ((ret = PIOc_create(ios->iosysid, filename, cmode | NC_WRITE, &ncid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+/**
+ * On an IO task, find the header space and alignments to end define
+ * mode with, replacing each negative value of align with its
+ * default:
+ * <ul>
+ * <li>h_minfree: PIO_HEADER_ATT_BYTES for each attribute of the file,
+ * so attributes can be added later without moving the data.
+ * <li>v_align: the stripe size of the IO system (see
+ * PIOc_set_stripe_align()), or the library default.
+ * <li>v_minfree: 0.
+ * <li>r_align: the library default.
+ * </ul>
+ * The library defaults are those of nc_enddef() (4 byte alignment)
+ * and ncmpi_enddef() (0, which uses the hints of the file).
+ *
+ * @param file pointer to the file info.
+ * @param align the h_minfree, v_align, v_minfree and r_align asked for.
+ * @param out gets the values to use.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+enddef_align_values(file_desc_t *file, const PIO_Offset *align, PIO_Offset *out)
+{
+    PIO_Offset lib_align = file->iotype == PIO_IOTYPE_PNETCDF ? 0 : 4;
+    int natts = 0;
+    int ierr = PIO_NOERR;
 
-    /* Write an attribute with the version of this file. */
-    char version[PIO_MAX_NAME + 1];
-    sprintf(version, "%d.%d.%d", PIO_VERSION_MAJOR, PIO_VERSION_MINOR, PIO_VERSION_PATCH);
-    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_VERSION_ATT_NAME,
-                                 strlen(version) + 1, version)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (align[0] < 0)
+    {
+        int nvars, n;
 
-    /* Write an attribute with the max map len. */
-    if ((ret = PIOc_put_att_int(ncid, NC_GLOBAL, DECOMP_MAX_MAPLEN_ATT_NAME,
-                                PIO_INT, 1, &max_maplen)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+#ifdef _PNETCDF
+        if (file->iotype == PIO_IOTYPE_PNETCDF)
+        {
+            if (!(ierr = ncmpi_inq_natts(file->fh, &natts)) &&
+                !(ierr = ncmpi_inq_nvars(file->fh, &nvars)))
+                for (int v = 0; v < nvars && !ierr; v++)
+                    if (!(ierr = ncmpi_inq_varnatts(file->fh, v, &n)))
+                        natts += n;
+        }
+#endif /* _PNETCDF */
+        if (file->iotype != PIO_IOTYPE_PNETCDF)
+        {
+            if (!(ierr = nc_inq_natts(file->fh, &natts)) &&
+                !(ierr = nc_inq_nvars(file->fh, &nvars)))
+                for (int v = 0; v < nvars && !ierr; v++)
+                    if (!(ierr = nc_inq_varnatts(file->fh, v, &n)))
+                        natts += n;
+        }
+    }
 
-    /* Write title attribute, if the user provided one. */
-    if (title)
-        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_TITLE_ATT_NAME,
-                                     strlen(title) + 1, title)))
-            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    out[0] = align[0] < 0 ? (PIO_Offset)natts * PIO_HEADER_ATT_BYTES : align[0];
+    out[1] = align[1] >= 0 ? align[1] :
+        file->iosystem->stripe_unit ? file->iosystem->stripe_unit : lib_align;
+    out[2] = align[2] < 0 ? 0 : align[2];
+    out[3] = align[3] < 0 ? lib_align : align[3];
+    PLOG((3, "enddef_align_values h_minfree %lld v_align %lld v_minfree %lld r_align %lld",
+          out[0], out[1], out[2], out[3]));
 
-    /* Write history attribute, if the user provided one. */
-    if (history)
-        if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_HISTORY_ATT_NAME,
-                                     strlen(history) + 1, history)))
-            return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    return ierr;
+}
 
-    /* Write a source attribute. */
-    char source[] = "Decomposition file produced by PIO library.";
-    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_SOURCE_ATT_NAME,
-                                 strlen(source) + 1, source)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+/**
+ * This is an internal function that handles both PIOc_enddef and
+ * PIOc_redef.
+ *
+ * @param ncid the ncid of the file to enddef or redef
+ * @param is_enddef set to non-zero for enddef, 0 for redef.
+ * @param align NULL, or for enddef, the h_minfree, v_align,
+ * v_minfree and r_align of PIOc_enddef_align().
+ * @returns PIO_NOERR on success, error code on failure.
+ * @author Ed Hartnett
+ */
+int
+pioc_change_def(int ncid, int is_enddef, const PIO_Offset *align)
+{
+    iosystem_desc_t *ios;  /* Pointer to io system information. */
+    file_desc_t *file;     /* Pointer to file information. */
+    PIO_Offset aligns[PIO_ENDDEF_NALIGN + 1] = {0}; /* Flag, then align. */
+    int ierr = PIO_NOERR;  /* Return code from function calls. */
+    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
 
-    /* Write an attribute with array ordering (C or Fortran). */
-    char c_order_str[] = DECOMP_C_ORDER_STR;
-    char fortran_order_str[] = DECOMP_FORTRAN_ORDER_STR;
-    char *my_order_str = fortran_order ? fortran_order_str : c_order_str;
-    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_ORDER_ATT_NAME,
-                                 strlen(my_order_str) + 1, my_order_str)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    PLOG((2, "pioc_change_def ncid = %d is_enddef = %d", ncid, is_enddef));
 
-    /* Write an attribute with the stack trace. This can be helpful
-     * for debugging. */
-    void *bt[MAX_BACKTRACE];
-    size_t bt_size;
-    char **bt_strings;
-    bt_size = backtrace(bt, MAX_BACKTRACE);
-    bt_strings = backtrace_symbols(bt, bt_size);
+    if (align)
+    {
+        aligns[0] = 1;
+        memcpy(aligns + 1, align, PIO_ENDDEF_NALIGN * sizeof(PIO_Offset));
+    }
 
-    /* Find the max size. */
-    int max_bt_size = 0;
-    for (int b = 0; b < bt_size; b++)
-        if (strlen(bt_strings[b]) > max_bt_size)
-            max_bt_size = strlen(bt_strings[b]);
-    if (max_bt_size > PIO_MAX_NAME)
-        max_bt_size = PIO_MAX_NAME;
+    /* Find the info about this file. When I check the return code
+     * here, some tests fail. ???*/
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
 
-    /* Copy the backtrace into one long string. */
-    char full_bt[max_bt_size * bt_size + bt_size + 1];
-    full_bt[0] = '\0';
-    for (int b = 0; b < bt_size; b++)
+    /* Write any queued attributes first. */
+    if (ios->async && !ios->ioproc)
+        if ((ierr = flush_deferred_atts(file)))
+            return ierr;
+
+    /* If async is in use, and this is not an IO task, bcast the parameters. */
+    if (ios->async)
     {
-        strncat(full_bt, bt_strings[b], max_bt_size);
-        strcat(full_bt, "\n");
+        if (!ios->ioproc)
+        {
+            int msg = is_enddef ? PIO_MSG_ENDDEF : PIO_MSG_REDEF;
+            if (ios->compmaster == MPI_ROOT)
+              {
+                PLOG((2, "pioc_change_def request sent"));
+                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+              }
+            if (!mpierr)
+                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
+            if (!mpierr && is_enddef)
+                mpierr = MPI_Bcast(aligns, PIO_ENDDEF_NALIGN + 1, MPI_OFFSET, ios->compmaster,
+                                   ios->intercomm);
+            PLOG((3, "pioc_change_def ncid = %d mpierr = %d", ncid, mpierr));
+        }
+
+        /* Handle MPI errors. */
+        PLOG((3, "pioc_change_def handling MPI errors my_comm=%d", ios->my_comm));
+        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
+            check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
+        if (mpierr)
+            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
     }
-    free(bt_strings);
 
-    /* Write the stack trace as an attribute. */
-    if ((ret = PIOc_put_att_text(ncid, NC_GLOBAL, DECOMP_BACKTRACE_ATT_NAME,
-                                 strlen(full_bt) + 1, full_bt)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    /* If this is an IO task, then call the netCDF function. */
+    PLOG((3, "pioc_change_def ios->ioproc = %d", ios->ioproc));
+    if (ios->ioproc)
+    {
+        PLOG((3, "pioc_change_def calling netcdf function file->fh = %d file->do_io = %d iotype = %d",
+              file->fh, file->do_io, file->iotype));
+        PIO_Offset a[PIO_ENDDEF_NALIGN];
 
-    /* We need a dimension for the dimensions in the data. (Example:
-     * for 4D data we will need to store 4 dimension IDs.) */
-    int dim_dimid;
-    if ((ret = PIOc_def_dim(ncid, DECOMP_DIM_DIM, ndims, &dim_dimid)))
-        return ret;
+        /* Find the alignment values. */
+        if (is_enddef && aligns[0] && (file->iotype == PIO_IOTYPE_PNETCDF || file->do_io))
+            ierr = enddef_align_values(file, aligns + 1, a);
 
-    /* We need a dimension for tasks. If we have 4 tasks, we need to
-     * store an array of length 4 with the size of the local array on
-     * each task. */
-    int task_dimid;
-    if ((ret = PIOc_def_dim(ncid, DECOMP_TASK_DIM_NAME, num_tasks, &task_dimid)))
-        return ret;
+#ifdef _PNETCDF
+        if (file->iotype == PIO_IOTYPE_PNETCDF && !ierr)
+        {
+            if (is_enddef && aligns[0])
+                ierr = ncmpi__enddef(file->fh, a[0], a[1], a[2], a[3]);
+            else if (is_enddef)
+                ierr = ncmpi_enddef(file->fh);
+            else if (!(ierr = flush_output_buffer(file, true, 0)))
+                ierr = ncmpi_redef(file->fh);
+        }
+#endif /* _PNETCDF */
+        if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io && !ierr)
+        {
+            if (is_enddef && aligns[0])
+            {
+                PLOG((3, "pioc_change_def calling nc__enddef file->fh = %d", file->fh));
+                ierr = nc__enddef(file->fh, a[0], a[1], a[2], a[3]);
+            }
+            else if (is_enddef)
+            {
+                PLOG((3, "pioc_change_def calling nc_enddef file->fh = %d", file->fh));
+                ierr = nc_enddef(file->fh);
+            }
+            else
+                ierr = nc_redef(file->fh);
+        }
+    }
 
-    /* We need a dimension for the map. It's length may vary, we will
-     * use the max_maplen for the dimension size. */
-    int mapelem_dimid;
-    if ((ret = PIOc_def_dim(ncid, DECOMP_MAPELEM_DIM_NAME, max_maplen,
-                            &mapelem_dimid)))
-        return ret;
+    /* Broadcast and check the return code, with any deferred
+     * errors. */
+    PLOG((3, "pioc_change_def bcasting return code ierr = %d", ierr));
+    if ((ierr = check_netcdf_sync(file, ierr, __FILE__, __LINE__)))
+        return ierr;
+    PLOG((3, "pioc_change_def succeeded"));
 
-    /* Define a var to hold the global size of the array for each
-     * dimension. */
-    int gsize_varid;
-    if ((ret = PIOc_def_var(ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, NC_INT, 1,
-                            &dim_dimid, &gsize_varid)))
-        return ret;
+    return ierr;
+}
 
-    /* Define a var to hold the length of the local array on each task. */
-    int maplen_varid;
-    if ((ret = PIOc_def_var(ncid, DECOMP_MAPLEN_VAR_NAME, NC_INT, 1, &task_dimid,
-                            &maplen_varid)))
-        return ret;
+/**
+ * Check whether an IO type is valid for the build.
+ *
+ * @param iotype the IO type to check
+ * @returns 0 if valid, non-zero otherwise.
+ * @author Jim Edwards
+ */
+int
+iotype_is_valid(int iotype)
+{
+    /* Assume it's not valid. */
+    int ret = 0;
 
-    /* Define a 2D var to hold the length of the local array on each task. */
-    int map_varid;
-    int map_dimids[2] = {task_dimid, mapelem_dimid};
-    if ((ret = PIOc_def_var(ncid, DECOMP_MAP_VAR_NAME, NC_INT, 2, map_dimids,
-                            &map_varid)))
-        return ret;
+    /* All builds include netCDF. */
+    if (iotype == PIO_IOTYPE_NETCDF)
+        ret++;
 
-    /* End define mode, to write data. */
-    if ((ret = PIOc_enddef(ncid)))
-        return ret;
+    /* Some builds include netCDF-4. */
+#ifdef _NETCDF4
+    if (iotype == PIO_IOTYPE_NETCDF4C || iotype == PIO_IOTYPE_NETCDF4P)
+        ret++;
+#endif /* _NETCDF4 */
 
-    /* Write the global dimension sizes. */
-    if ((PIOc_put_var_int(ncid, gsize_varid, global_dimlen)))
-        return ret;
+    /* Some builds include pnetcdf. */
+    if (iotype == PIO_IOTYPE_PNETCDF)
+        ret++;
+#ifdef _PNETCDF
+#endif /* _PNETCDF */
 
-    /* Write the size of the local array on each task. */
-    if ((PIOc_put_var_int(ncid, maplen_varid, task_maplen)))
-        return ret;
+    return ret;
+}
 
-    /* Write the map. */
-    if ((PIOc_put_var_int(ncid, map_varid, map)))
-        return ret;
+/**
+ * Set the rearranger options associated with an iosystem
+ *
+ * @param iosysid a defined pio system descriptor.
+ * @param comm_type Type of communication (pt2pt/coll) used
+ * by the rearranger. See PIO_REARR_COMM_TYPE for more detail.
+ * Possible values are :
+ * PIO_REARR_COMM_P2P (Point to point communication)
+ * PIO_REARR_COMM_COLL (Collective communication)
+ * PIO_REARR_COMM_NEIGHBOR (Neighborhood collective communication,
+ * with only the tasks that exchange data)
+ * PIO_REARR_COMM_SHM (Shared memory, for the subset rearranger, from
+ * compute to io processes, when they share a node)
+ * @param fcd Flow control direction for the rearranger.
+ * See PIO_REARR_COMM_FC_DIR for more detail.
+ * Possible values are :
+ * PIO_REARR_COMM_FC_2D_ENABLE : Enable flow control from
+ * compute processes to io processes and vice versa
+ * PIO_REARR_COMM_FC_1D_COMP2IO : Enable flow control from
+ * compute processes to io processes (only)
+ * PIO_REARR_COMM_FC_1D_IO2COMP : Enable flow control from
+ * io processes to compute processes (only)
+ * PIO_REARR_COMM_FC_2D_DISABLE : Disable flow control from
+ * compute processes to io processes and vice versa.
+ * @param enable_hs_c2i Enable handshake while rearranging
+ * data, from compute to io processes
+ * @param enable_isend_c2i Enable isends while rearranging
+ * data, from compute to io processes
+ * @param max_pend_req_c2i Maximum pending requests during
+ * data rearragment from compute processes to io processes
+ * @param enable_hs_i2c Enable handshake while rearranging
+ * data, from io to compute processes
+ * @param enable_isend_i2c Enable isends while rearranging
+ * data, from io to compute processes
+ * @param max_pend_req_i2c Maximum pending requests during
+ * data rearragment from io processes to compute processes
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Jayesh Krishna
+ */
+int
+PIOc_set_rearr_opts(int iosysid, int comm_type, int fcd, bool enable_hs_c2i,
+                    bool enable_isend_c2i, int max_pend_req_c2i,
+                    bool enable_hs_i2c, bool enable_isend_i2c,
+                    int max_pend_req_i2c)
+{
+    iosystem_desc_t *ios;
+    rearr_opt_t user_rearr_opts = {
+        comm_type, fcd,
+        {enable_hs_c2i,enable_isend_c2i, max_pend_req_c2i},
+        {enable_hs_i2c, enable_isend_i2c, max_pend_req_i2c}
+    };
 
-    /* Close the netCDF decomp file. */
-    if ((ret = PIOc_closefile(ncid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    /* Check inputs. */
+    if ((comm_type != PIO_REARR_COMM_P2P && comm_type != PIO_REARR_COMM_COLL &&
+         comm_type != PIO_REARR_COMM_NEIGHBOR && comm_type != PIO_REARR_COMM_SHM) ||
+        (fcd < 0 || fcd > PIO_REARR_COMM_FC_2D_DISABLE) ||
+        (max_pend_req_c2i != PIO_REARR_COMM_UNLIMITED_PEND_REQ && max_pend_req_c2i < 0) ||
+        (max_pend_req_i2c != PIO_REARR_COMM_UNLIMITED_PEND_REQ && max_pend_req_i2c < 0))
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Set the options. */
+    ios->rearr_opts = user_rearr_opts;
 
     return PIO_NOERR;
 }
 
 /**
- * Read the decomp information from a netCDF decomp file. This is an
- * internal function.
+ * Turn on or off autotuning of the rearranger options. When on,
+ * PIOc_InitDecomp() times the data rearrangement of each new
+ * decomposition with MPI_Alltoallw and with the point to point
+ * exchange, trying different handshake, isend and pending request
+ * settings, and keeps the fastest in each direction. The settings
+ * from PIOc_set_rearr_opts() are the starting point, and are only
+ * replaced by a clearly faster one.
+ *
+ * Tuning costs a few dozen rearrangements of one variable per
+ * decomposition. It is not done for async, or when
+ * PIO_REARR_COMM_NEIGHBOR or PIO_REARR_COMM_SHM is in use.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
  *
  * @param iosysid the IO system ID.
- * @param filename the name the decomp file will have.
- * @param ndims pointer to int that will get number of dims in the
- * data being described. Ignored if NULL.
- * @param global_dimlen a pointer that gets an array, of size ndims,
- * that will have the size of the global array in each
- * dimension. Ignored if NULL, otherwise must be freed by caller.
- * @param num_tasks pointer to int that gets the number of tasks the
- * data are decomposed over. Ignored if NULL.
- * @param task_maplen pointer that gets array of size num_tasks that
- * gets the length of the map for each task. Ignored if NULL,
- * otherwise must be freed by caller.
- * @param max_maplen pointer to int that gets the maximum maplen for
- * any task. Ignored if NULL.
- * @param map pointer that gets a 2D array of size [num_tasks][max_maplen]
- * that will have the 0-based mapping from local to global array
- * elements. Ignored if NULL, otherwise must be freed by caller.
- * @param title pointer that will get the contents of title attribute,
- * if present. If present, title will be < PIO_MAX_NAME + 1 in
- * length. Ignored if NULL.
- * @param history pointer that will get the contents of history attribute,
- * if present. If present, history will be < PIO_MAX_NAME + 1 in
- * length. Ignored if NULL.
- * @param source pointer that will get the contents of source
- * attribute. Source will be < PIO_MAX_NAME + 1 in length. Ignored if
- * NULL.
- * @param version pointer that will get the contents of version
- * attribute. It will be < PIO_MAX_NAME + 1 in length. Ignored if
- * NULL.
- * @param fortran_order int pointer that will get a 0 if this
- * decomposition file uses C array ordering, 1 if it uses Fortran
- * array ordering.
- * @returns 0 for success, error code otherwise.
+ * @param enable true to turn on autotuning, false to turn it off
+ * (the default).
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
 int
-pioc_read_nc_decomp_int(int iosysid, const char *filename, int *ndims, int **global_dimlen,
-                        int *num_tasks, int **task_maplen, int *max_maplen, int **map, char *title,
-                        char *history, char *source, char *version, int *fortran_order)
+PIOc_set_rearr_autotune(int iosysid, bool enable)
 {
     iosystem_desc_t *ios;
-    int ncid;
-    int ret;
-    int peh;
+
+    PLOG((1, "PIOc_set_rearr_autotune iosysid = %d enable = %d", iosysid, enable));
 
     /* Get the IO system info. */
     if (!(ios = pio_get_iosystem_from_id(iosysid)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Check inputs. */
-    if (!filename)
-        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
-
-    PLOG((1, "pioc_read_nc_decomp_int iosysid = %d filename = %s", iosysid, filename));
-    
-    
-    /* Open the netCDF decomp file. */
-    if ((ret = PIOc_open(iosysid, filename, NC_WRITE, &ncid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    ios->rearr_autotune = enable;
 
-    /* Read version attribute. */
-    char version_in[PIO_MAX_NAME + 1];
-    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_VERSION_ATT_NAME, version_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    PLOG((3, "version_in = %s", version_in));
-    if (version)
-        strncpy(version, version_in, PIO_MAX_NAME + 1);
+    return PIO_NOERR;
+}
 
-    /* Read order attribute. */
-    char order_in[PIO_MAX_NAME + 1];
-    if ((ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_ORDER_ATT_NAME, order_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    PLOG((3, "order_in = %s", order_in));
-    if (fortran_order)
-    {
-        if (!strncmp(order_in, DECOMP_C_ORDER_STR, PIO_MAX_NAME + 1))
-            *fortran_order = 0;
-        else if (!strncmp(order_in, DECOMP_FORTRAN_ORDER_STR, PIO_MAX_NAME + 1))
-            *fortran_order = 1;
-        else
-            return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
-    }
+/**
+ * Set a file in which tuned rearranger options are kept between
+ * runs. When autotuning is on (see PIOc_set_rearr_autotune()),
+ * PIOc_InitDecomp() looks up the decomposition in this file, by a
+ * signature of its global dimensions, number of elements on each
+ * task, rearranger, data type size and IO tasks. If it is found, the
+ * stored options are used without tuning. Otherwise the decomposition
+ * is tuned, and the result is added to the file.
+ *
+ * The file is a text file with one line for each decomposition. It
+ * is only read and written by task 0 of the IO system, so it need
+ * only be visible there. It does not have to exist.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same file name.
+ *
+ * @param iosysid the IO system ID.
+ * @param filename name of the tuning cache file, or NULL to not use
+ * one (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_rearr_tune_file(int iosysid, const char *filename)
+{
+    iosystem_desc_t *ios;
 
-    /* Read attribute with the max map len. */
-    int max_maplen_in;
-    if ((ret = PIOc_get_att_int(ncid, NC_GLOBAL, DECOMP_MAX_MAPLEN_ATT_NAME, &max_maplen_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    PLOG((3, "max_maplen_in = %d", max_maplen_in));
-    if (max_maplen)
-        *max_maplen = max_maplen_in;
+    PLOG((1, "PIOc_set_rearr_tune_file iosysid = %d filename = %s", iosysid,
+          filename ? filename : "NULL"));
 
-    /* Read title attribute, if it is in the file. */
-    peh = PIOc_Set_File_Error_Handling(ncid, PIO_BCAST_ERROR);
-    char title_in[PIO_MAX_NAME + 1];
-    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_TITLE_ATT_NAME, title_in);
-    if (ret == PIO_NOERR)
-    {
-        /* If the caller wants it, copy the title for them. */
-        if (title)
-            strncpy(title, title_in, PIO_MAX_NAME + 1);
-    }
-    else if (ret == PIO_ENOTATT)
-    {
-        /* No title attribute. */
-        if (title)
-            title[0] = '\0';
-    }
-    else
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Read history attribute, if it is in the file. */
-    char history_in[PIO_MAX_NAME + 1];
-    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_HISTORY_ATT_NAME, history_in);
-    if (ret == PIO_NOERR)
-    {
-        /* If the caller wants it, copy the history for them. */
-        if (history)
-            strncpy(history, history_in, PIO_MAX_NAME + 1);
-    }
-    else if (ret == PIO_ENOTATT)
-    {
-        /* No history attribute. */
-        if (history)
-            history[0] = '\0';
-    }
-    else
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    if (ios->rearr_tune_file)
+        free(ios->rearr_tune_file);
+    ios->rearr_tune_file = NULL;
+    if (filename)
+        if (!(ios->rearr_tune_file = strdup(filename)))
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
 
-    /* Read source attribute. */
-    char source_in[PIO_MAX_NAME + 1];
-    ret = PIOc_get_att_text(ncid, NC_GLOBAL, DECOMP_SOURCE_ATT_NAME, source_in);
-    if (ret == PIO_NOERR)
-    {
-        if (source)
-            strncpy(source, source_in, PIO_MAX_NAME + 1);
-    }
-    else if (ret == PIO_ENOTATT)
-    {
-        if (source)
-            source[0] = '\0';
-    }
-    else
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
 
-    PIOc_Set_File_Error_Handling(ncid, peh);
-    /* Read dimension for the dimensions in the data. (Example: for 4D
-     * data we will need to store 4 dimension IDs.) */
-    int dim_dimid;
-    PIO_Offset ndims_in;
-    if ((ret = PIOc_inq_dimid(ncid, DECOMP_DIM_DIM, &dim_dimid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if ((ret = PIOc_inq_dim(ncid, dim_dimid, NULL, &ndims_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if (ndims)
-        *ndims = ndims_in;
+/**
+ * Turn on or off alignment of the box rearranger IO partition to file
+ * system stripes, the PIO_IOPART_STRIPE IO partition (see
+ * PIOc_set_iopart()). When on, PIOc_InitDecomp() splits the data of a box
+ * decomposition over the IO tasks along the slowest dimension, so
+ * that each IO task covers whole stripes, starting on a stripe
+ * boundary. This avoids the lock contention of IO tasks sharing
+ * stripes on Lustre and GPFS. See CalcStartandCount_stripe().
+ *
+ * The stripe size and count may be given here, or, if 0, are taken
+ * from the striping_unit and striping_factor hints set with
+ * PIOc_set_hint() when the decomposition is created. If there is no
+ * stripe size, the usual partition is used.
+ *
+ * Stripe boundaries are relative to the start of each variable. So
+ * that variables start on a stripe for PIO_IOTYPE_PNETCDF, the
+ * nc_var_align_size hint is set to the stripe size, unless it has
+ * already been set.
+ *
+ * Decompositions which were already created are not changed. This
+ * function must be called on all tasks of the IO system, with the
+ * same values.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to turn on stripe alignment, false to go back to
+ * the default, PIO_IOPART_BLOCK.
+ * @param striping_unit the stripe size in bytes, or 0 to use the
+ * striping_unit hint.
+ * @param striping_factor the number of stripes, or 0 to use the
+ * striping_factor hint.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_stripe_align(int iosysid, bool enable, int striping_unit, int striping_factor)
+{
+    iosystem_desc_t *ios;
+    int mpierr;
 
-    /* Read the global sizes of the array. */
-    int gsize_varid;
-    int global_dimlen_in[ndims_in];
-    if ((ret = PIOc_inq_varid(ncid, DECOMP_GLOBAL_SIZE_VAR_NAME, &gsize_varid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if ((ret = PIOc_get_var_int(ncid, gsize_varid, global_dimlen_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if (global_dimlen)
-    {
-        if (!(*global_dimlen = malloc(ndims_in * sizeof(int))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        for (int d = 0; d < ndims_in; d++)
-            (*global_dimlen)[d] = global_dimlen_in[d];
-    }
+    PLOG((1, "PIOc_set_stripe_align iosysid = %d enable = %d striping_unit = %d "
+          "striping_factor = %d", iosysid, enable, striping_unit, striping_factor));
 
-    /* Read dimension for tasks. If we have 4 tasks, we need to store
-     * an array of length 4 with the size of the local array on each
-     * task. */
-    int task_dimid;
-    PIO_Offset num_tasks_in;
-    if ((ret = PIOc_inq_dimid(ncid, DECOMP_TASK_DIM_NAME, &task_dimid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if ((ret = PIOc_inq_dim(ncid, task_dimid, NULL, &num_tasks_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if (num_tasks)
-        *num_tasks = num_tasks_in;
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Read the length if the local array on each task. */
-    int maplen_varid;
-    int task_maplen_in[num_tasks_in];
-    if ((ret = PIOc_inq_varid(ncid, DECOMP_MAPLEN_VAR_NAME, &maplen_varid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if ((ret = PIOc_get_var_int(ncid, maplen_varid, task_maplen_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if (task_maplen)
+    if (striping_unit < 0 || striping_factor < 0)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    ios->iopart = enable ? PIO_IOPART_STRIPE : PIO_IOPART_BLOCK;
+    ios->stripe_unit = striping_unit;
+    ios->stripe_factor = striping_factor;
+
+    /* Start the variables on a stripe boundary. */
+    if (enable && striping_unit && ios->ioproc)
     {
-        if (!(*task_maplen = malloc(num_tasks_in * sizeof(int))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        for (int t = 0; t < num_tasks_in; t++)
-            (*task_maplen)[t] = task_maplen_in[t];
+        char val[PIO_MAX_NAME + 1];
+        int flag = 0;
+
+        if (ios->info == MPI_INFO_NULL)
+            if ((mpierr = MPI_Info_create(&ios->info)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if ((mpierr = MPI_Info_get(ios->info, "nc_var_align_size", PIO_MAX_NAME, val, &flag)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        if (!flag)
+        {
+            snprintf(val, PIO_MAX_NAME, "%d", striping_unit);
+            if ((mpierr = MPI_Info_set(ios->info, "nc_var_align_size", val)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
     }
 
-    /* Read the map. */
-    int map_varid;
-    int *map_in;
+    return PIO_NOERR;
+}
 
-    if (!(map_in = malloc(sizeof(int) * num_tasks_in * max_maplen_in)))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+/**
+ * Choose how the data of box decompositions are split between the IO
+ * tasks. This applies to the decompositions created after the call,
+ * so different decompositions may use different partitions. The
+ * partitions are:
+ *
+ * <ul>
+ * <li>PIO_IOPART_BLOCK, blocks of about blocksize bytes (the
+ * default, see PIOc_set_blocksize()).
+ * <li>PIO_IOPART_SLAB, slabs of the slowest varying dimension, so
+ * each IO task has a contiguous part of the file.
+ * <li>PIO_IOPART_STRIPE, slabs of whole file system stripes, see
+ * PIOc_set_stripe_align(), which also sets the stripe size.
+ * <li>PIO_IOPART_BYTES, all IO tasks are used, with the bytes
+ * balanced between them.
+ * <li>PIO_IOPART_USER, the partition from the function set with
+ * PIOc_set_iopart_fn().
+ * </ul>
+ *
+ * When the start and count are passed to PIOc_InitDecomp(), they are
+ * used instead. The subset rearranger does not use the partition.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param iopart the IO partition.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_iopart(int iosysid, int iopart)
+{
+    iosystem_desc_t *ios;
 
-    if ((ret = PIOc_inq_varid(ncid, DECOMP_MAP_VAR_NAME, &map_varid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if ((ret = PIOc_get_var_int(ncid, map_varid, map_in)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    if (map)
-    {
-        if (!(*map = malloc(num_tasks_in * max_maplen_in * sizeof(int))))
-            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
-        for (int t = 0; t < num_tasks_in; t++)
-            for (int l = 0; l < max_maplen_in; l++)
-                (*map)[t * max_maplen_in + l] = map_in[t * max_maplen_in + l];
-    }
-    free(map_in);
+    PLOG((1, "PIOc_set_iopart iosysid = %d iopart = %d", iosysid, iopart));
 
-    /* Close the netCDF decomp file. */
-    PLOG((2, "pioc_read_nc_decomp_int about to close file ncid = %d", ncid));
-    if ((ret = PIOc_closefile(ncid)))
-        return pio_err(ios, NULL, ret, __FILE__, __LINE__);
-    PLOG((2, "pioc_read_nc_decomp_int closed file"));
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* A user partition needs a function. */
+    if (iopart < PIO_IOPART_BLOCK || iopart > PIO_IOPART_USER ||
+        (iopart == PIO_IOPART_USER && !ios->iopart_fn))
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    ios->iopart = iopart;
 
     return PIO_NOERR;
 }
 
 /**
- * Write the decomposition map to a file.
+ * Choose how the SUBSET rearranger groups the computation tasks with
+ * the IO tasks, for the decompositions created after this call. See
+ * PIO_SUBSET_PART.
+ *
+ * PIO_SUBSET_PART_NODE groups a computation task with an IO task of
+ * its node, when that IO task has room. PIO_SUBSET_PART_MAP groups
+ * computation tasks holding adjacent parts of the array, which makes a
+ * communicator for each decomposition. Each IO task gets at most
+ * ceil(computation tasks / IO tasks) computation tasks.
+ *
+ * This function must be called on all tasks of the IO system. In
+ * async mode it has no effect, and PIO_SUBSET_PART_RANK is used.
  *
- * @param file the filename to be used.
  * @param iosysid the IO system ID.
- * @param ioid the ID of the IO description.
- * @param comm an MPI communicator.
- * @returns 0 for success, error code otherwise.
- * @author Jim Edwards
+ * @param part one of PIO_SUBSET_PART.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
  */
 int
-PIOc_write_decomp(const char *file, int iosysid, int ioid, MPI_Comm comm)
+PIOc_set_subset_part(int iosysid, int part)
 {
     iosystem_desc_t *ios;
-    io_desc_t *iodesc;
 
-    PLOG((1, "PIOc_write_decomp file = %s iosysid = %d ioid = %d", file, iosysid, ioid));
+    PLOG((1, "PIOc_set_subset_part iosysid = %d part = %d", iosysid, part));
 
+    /* Get the IO system info. */
     if (!(ios = pio_get_iosystem_from_id(iosysid)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
-        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (part < PIO_SUBSET_PART_RANK || part > PIO_SUBSET_PART_MAP)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    return PIOc_writemap(file, iodesc->ndims, iodesc->dimlen, iodesc->maplen, iodesc->map,
-                         comm);
+    ios->subset_part = part;
+
+    return PIO_NOERR;
 }
 
 /**
- * Write the decomposition map to a file.
+ * Set a user function to split the data of box decompositions
+ * between the IO tasks, and use it (the PIO_IOPART_USER partition).
+ * See PIO_iopart_fn for what the function must do. The result is
+ * checked when the decomposition is created, and PIOc_InitDecomp()
+ * returns PIO_EINVAL if the regions do not cover the array.
  *
- * @param file the filename
- * @param ndims the number of dimensions
- * @param gdims an array of dimension ids
- * @param maplen the length of the map
- * @param map the map array
- * @param comm an MPI communicator.
- * @returns 0 for success, error code otherwise.
- * @author Jim Edwards
+ * This function must be called on all tasks of the IO system.
+ *
+ * @param iosysid the IO system ID.
+ * @param fn the partition function, or NULL to go back to
+ * PIO_IOPART_BLOCK.
+ * @param arg a pointer passed to fn. May be NULL.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
  */
 int
-PIOc_writemap(const char *file, int ndims, const int *gdims, PIO_Offset maplen,
-              PIO_Offset *map, MPI_Comm comm)
+PIOc_set_iopart_fn(int iosysid, PIO_iopart_fn fn, void *arg)
 {
-    int npes, myrank;
-    PIO_Offset *nmaplen = NULL;
-    MPI_Status status;
-    int i;
-    PIO_Offset *nmap;
-    int mpierr; /* Return code for MPI calls. */
-
-    PLOG((1, "PIOc_writemap file = %s ndims = %d maplen = %d", file, ndims, maplen));
+    iosystem_desc_t *ios;
 
-    if ((mpierr = MPI_Comm_size(comm, &npes)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-    if ((mpierr = MPI_Comm_rank(comm, &myrank)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-    PLOG((2, "npes = %d myrank = %d", npes, myrank));
+    PLOG((1, "PIOc_set_iopart_fn iosysid = %d", iosysid));
 
-    /* Allocate memory for the nmaplen. */
-    if (myrank == 0)
-        if (!(nmaplen = malloc(npes * sizeof(PIO_Offset))))
-            return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    if ((mpierr = MPI_Gather(&maplen, 1, PIO_OFFSET, nmaplen, 1, PIO_OFFSET, 0, comm)))
-        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    ios->iopart_fn = fn;
+    ios->iopart_arg = arg;
+    ios->iopart = fn ? PIO_IOPART_USER : PIO_IOPART_BLOCK;
 
-    /* Only rank 0 writes the file. */
-    if (myrank == 0)
-    {
-        FILE *fp;
+    return PIO_NOERR;
+}
 
-        /* Open the file to write. */
-        if (!(fp = fopen(file, "w")))
-            return pio_err(NULL, NULL, PIO_EIO, __FILE__, __LINE__);
+/**
+ * Turn on or off the exact check for repeated values in the maps of
+ * box decompositions. When on, PIOc_InitDecomp() sorts the map in
+ * parallel over the computation tasks (see check_compmap()), and a
+ * decomposition with a value repeated on more than one task, or more
+ * than once on one task, is marked read only. Writing with it is then
+ * an error. The map is never gathered on a single task.
+ *
+ * Decompositions for the subset rearranger are always checked, since
+ * the subset rearranger needs to know.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to check box decompositions, false to not check
+ * them (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_map_dup_check(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-        /* Write the version and dimension info. */
-        fprintf(fp,"version %d npes %d ndims %d \n", VERSNO, npes, ndims);
-        for (i = 0; i < ndims; i++)
-            fprintf(fp, "%d ", gdims[i]);
-        fprintf(fp, "\n");
+    PLOG((1, "PIOc_set_map_dup_check iosysid = %d enable = %d", iosysid, enable));
 
-        /* Write the map. */
-        fprintf(fp, "0 %lld\n", nmaplen[0]);
-        for (i = 0; i < nmaplen[0]; i++)
-            fprintf(fp, "%lld ", map[i]);
-        fprintf(fp,"\n");
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-        for (i = 1; i < npes; i++)
-        {
-            PLOG((2, "creating nmap for i = %d", i));
-            nmap = (PIO_Offset *)malloc(nmaplen[i] * sizeof(PIO_Offset));
+    ios->map_dup_check = enable;
 
-            if ((mpierr = MPI_Send(&i, 1, MPI_INT, i, npes + i, comm)))
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-            if ((mpierr = MPI_Recv(nmap, nmaplen[i], PIO_OFFSET, i, i, comm, &status)))
-                return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-            PLOG((2,"MPI_Recv map complete"));
+    return PIO_NOERR;
+}
 
-            fprintf(fp, "%d %lld\n", i, nmaplen[i]);
-            for (int j = 0; j < nmaplen[i]; j++)
-                fprintf(fp, "%lld ", nmap[j]);
-            fprintf(fp, "\n");
+/**
+ * Turn on or off the release of decomposition maps. When on,
+ * PIOc_InitDecomp() frees the map of each new decomposition once its
+ * rearranger is set up, which saves maplen PIO_Offsets per
+ * decomposition on each task. Functions that need the map then
+ * return PIO_EINVAL for the decomposition: PIOc_write_nc_decomp(),
+ * PIOc_write_nc_decomp_ragged(), PIOc_write_decomp() and, with
+ * async, PIOc_init_decomp_extrude(). Decompositions without a map are not
+ * shared (see PIOc_set_decomp_sharing()).
+ *
+ * Decompositions created before the call are not changed.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to release maps, false to keep them (the
+ * default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_map_release(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-            free(nmap);
-        }
-        /* Free memory for the nmaplen. */
-        free(nmaplen);
-        fprintf(fp, "\n");
-        print_trace(fp);
+    PLOG((1, "PIOc_set_map_release iosysid = %d enable = %d", iosysid, enable));
 
-        /* Close the file. */
-        fclose(fp);
-        PLOG((2,"decomp file closed."));
-    }
-    else
-    {
-        PLOG((2,"ready to MPI_Recv..."));
-        if ((mpierr = MPI_Recv(&i, 1, MPI_INT, 0, npes+myrank, comm, &status)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        PLOG((2,"MPI_Recv got %d", i));
-        if ((mpierr = MPI_Send(map, maplen, PIO_OFFSET, 0, myrank, comm)))
-            return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
-        PLOG((2,"MPI_Send map complete"));
-    }
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    ios->map_release = enable;
 
     return PIO_NOERR;
 }
 
 /**
- * Write the decomposition map to a file for F90.
+ * Turn on or off lazy opening of files. When on, PIOc_openfile(),
+ * PIOc_openfile2() and PIOc_open() only check their arguments and
+ * return an ncid. The file is opened, and its metadata read, by the
+ * first call that uses the ncid. So a model that opens many forcing
+ * files, but reads only some of them in a run, does not pay for the
+ * opens of the others. PIOc_closefile() of a file that was never used
+ * does no IO.
  *
- * @param file the filename
- * @param ndims the number of dimensions
- * @param gdims an array of dimension ids
- * @param maplen the length of the map
- * @param map the map array
- * @param f90_comm an MPI communicator.
- * @returns 0 for success, error code otherwise.
- * @author Jim Edwards
+ * The open is done by the first collective call with the ncid (one
+ * that must be called on all tasks of the IO system), so errors of
+ * the open (such as a missing file) are returned by that call, not by
+ * the open. Calls that are not collective, such as
+ * PIOc_File_is_Open(), PIOc_setframe(), PIOc_advanceframe(),
+ * PIOc_get_file_stats() and PIOc_file_wait(), do not open the file;
+ * frames set before the open are kept, and an invalid varid given to
+ * them is only reported by the open. Files of async iosystems are
+ * always opened at once.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to open files lazily, false to open them at once
+ * (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
  */
 int
-PIOc_writemap_from_f90(const char *file, int ndims, const int *gdims,
-                       PIO_Offset maplen, const PIO_Offset *map, int f90_comm)
+PIOc_set_lazy_open(int iosysid, bool enable)
 {
-    return PIOc_writemap(file, ndims, gdims, maplen, (PIO_Offset *)map,
-                         MPI_Comm_f2c(f90_comm));
+    iosystem_desc_t *ios;
+
+    PLOG((1, "PIOc_set_lazy_open iosysid = %d enable = %d", iosysid, enable));
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    ios->lazy_open = enable;
+
+    return PIO_NOERR;
 }
 
 /**
- * Create a new file using pio. This is an internal function that is
- * called by both PIOc_create() and PIOc_createfile(). Input
- * parameters are read on comp task 0 and ignored elsewhere.
+ * Turn on or off packing of rearranger buffers by PIO. By default
+ * data are moved between compute and IO tasks with MPI derived
+ * datatypes built from the decomposition, and MPI packs and unpacks
+ * them. When on, PIO copies the elements of each message into a
+ * contiguous buffer itself (using the sindex and rindex of the
+ * decomposition, with one memcpy() for each run of consecutive
+ * elements), and MPI sends plain elements of the basic type. This
+ * helps with MPI implementations whose derived datatypes are slow.
+ * When PIO is built with OpenMP (PIO_ENABLE_OPENMP), the messages are
+ * packed and unpacked by several threads.
  *
- * @param iosysid A defined pio system ID, obtained from
- * PIOc_Init_Intracomm() or PIOc_InitAsync().
- * @param ncidp A pointer that gets the ncid of the newly created
- * file. This is the PIO ncid. Within PIO, the file will have a
- * different ID, the file->fh. When netCDF integration is used, the
- * PIO ncid is also stored in the netcdf-c internal file list, and the
- * PIO code is called by the netcdf-c dispatch code. In this case,
- * there are two ncids for the file, the PIO ncid, and the file->fh
- * ncid.
- * @param iotype A pointer to a pio output format. Must be one of
- * PIO_IOTYPE_PNETCDF, PIO_IOTYPE_NETCDF, PIO_IOTYPE_NETCDF4C, or
- * PIO_IOTYPE_NETCDF4P.
- * @param filename The filename to create.
- * @param mode The netcdf mode for the create operation.
- * @param use_ext_ncid non-zero to use an externally assigned ncid
- * (used in the netcdf integration layer).
+ * The setting is used by the blocking rearrangements of
+ * PIOc_write_darray(), PIOc_write_darray_multi(), PIOc_read_darray()
+ * and PIOc_read_darray_multi(). It is not used with
+ * PIO_REARR_COMM_NEIGHBOR, nor when the data are moved straight
+ * from or to the caller's unsorted arrays.
  *
- * @returns 0 for success, error code otherwise.
- * @ingroup PIO_createfile_c
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to pack the buffers in PIO, false to use MPI
+ * derived datatypes (the default).
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
 int
-PIOc_createfile_int(int iosysid, int *ncidp, int *iotype, const char *filename,
-                    int mode, int use_ext_ncid)
+PIOc_set_rearr_pack(int iosysid, bool enable)
 {
-    iosystem_desc_t *ios;  /* Pointer to io system information. */
-    file_desc_t *file;     /* Pointer to file information. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI function codes. */
-    int ierr;              /* Return code from function calls. */
+    iosystem_desc_t *ios;
 
-#ifdef USE_MPE
-    pio_start_mpe_log(CREATE);
-#endif /* USE_MPE */
+    PLOG((1, "PIOc_set_rearr_pack iosysid = %d enable = %d", iosysid, enable));
 
-    /* Get the IO system info from the iosysid. */
+    /* Get the IO system info. */
     if (!(ios = pio_get_iosystem_from_id(iosysid)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* User must provide valid input for these parameters. */
-    if (!ncidp || !iotype || !filename || strlen(filename) > PIO_MAX_NAME)
-        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    ios->rearr_pack = enable;
 
-    /* A valid iotype must be specified. */
-    if (!iotype_is_valid(*iotype))
-        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
 
-    PLOG((1, "PIOc_createfile_int iosysid %d iotype %d filename %s mode %d "
-          "use_ext_ncid %d", iosysid, *iotype, filename, mode, use_ext_ncid));
+/**
+ * Turn on or off collective access of the metadata of NETCDF4P
+ * files, as far as it can be set through netCDF. When on,
+ * PIOc_createfile() and PIOc_openfile() of NETCDF4P files:
+ *
+ * - Add the MPI-IO hints romio_cb_read and romio_cb_write = enable
+ * (collective buffering), unless they were set by the user. These
+ * are hints of ROMIO, not HDF5 settings: they only make the
+ * collective reads and writes of HDF5, including those of its
+ * metadata, go through the aggregators instead of every IO
+ * task. Other MPI-IO implementations ignore them.
+ *
+ * - Set the access mode of all the vars of an opened file to
+ * NC_COLLECTIVE at once, so the metadata of each var is read
+ * collectively the first time it is used. This is the same mode the
+ * vars of new files get. It also makes the PIOc_get_var() and
+ * PIOc_put_var() family of functions collective for the vars of the
+ * file, as they are for new files; the darray functions set the
+ * access mode of each write anyway (see PIOc_set_par_access()).
+ *
+ * The HDF5 collective metadata operations themselves
+ * (H5Pset_all_coll_metadata_ops() and H5Pset_coll_metadata_write())
+ * are set up by netCDF, not by this function; versions of netCDF
+ * built with HDF5 1.10 or later turn them on for all parallel
+ * files. The file space strategy (paged aggregation) of HDF5 can't
+ * be set through netCDF.
+ *
+ * Files of other iotypes are not changed. This function must be
+ * called on all tasks of the IO system, with the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to access the metadata of NETCDF4P files
+ * collectively, false to use the defaults of netCDF (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_nc4p_coll_meta(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-    /* Allocate space for the file info. */
-    if (!(file = calloc(sizeof(file_desc_t), 1)))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    PLOG((1, "PIOc_set_nc4p_coll_meta iosysid = %d enable = %d", iosysid, enable));
 
-    /* Fill in some file values. */
-    file->fh = -1;
-    file->iosystem = ios;
-    file->iotype = *iotype;
-    file->buffer = NULL;
-    file->writable = 1;
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Set to true if this task should participate in IO (only true for
-     * one task with netcdf serial files. */
-    if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_PNETCDF ||
-        ios->io_rank == 0)
-        file->do_io = 1;
+    ios->nc4p_coll_meta = enable;
 
-    PLOG((2, "file->do_io = %d ios->async = %d", file->do_io, ios->async));
+    return PIO_NOERR;
+}
 
-    /* If async is in use, and this is not an IO task, bcast the
-     * parameters. */
-    if (ios->async)
-    {
-        if (!ios->ioproc)
-        {
-            int msg = PIO_MSG_CREATE_FILE;
-            size_t len = strlen(filename);
-            char ncidp_present = ncidp ? 1 : 0;
+/**
+ * Turn on or off the adaptive aggregation of darray writes. When on,
+ * the number of arrays PIOc_write_darray() and
+ * PIOc_write_darray_nocopy() buffer for a decomposition before
+ * flushing is chosen from the time taken by the earlier flushes of
+ * that decomposition. After each full flush the number is doubled or
+ * halved, in the direction that gave the better rate, so it follows
+ * the best flush size of the file system as it changes. The number
+ * never exceeds what the aggregate buffer limit of the decomposition
+ * allows (see PIOc_set_compute_buffer_limit() and
+ * PIOc_set_buffer_size_limit()), so the memory limits still hold.
+ *
+ * Each full flush costs one MPI_Allreduce() on the computation
+ * tasks, so they all choose the same number. With pnetcdf, the time
+ * of the waits for the writes of the decomposition is added to that
+ * of the next full flush. With async, the time is that of sending the
+ * data to the IO tasks.
+ *
+ * This function must be called on all computation tasks of the IO
+ * system, with the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to choose the aggregation from the write rate,
+ * false to flush at the aggregate buffer limit (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_adaptive_aggregation(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-            /* Send the message to the message handler. */
-            PLOG((3, "msg %d ios->union_comm %d MPI_COMM_NULL %d", msg, ios->union_comm, MPI_COMM_NULL));
-            if (ios->compmaster == MPI_ROOT)
-                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+    PLOG((1, "PIOc_set_adaptive_aggregation iosysid = %d enable = %d", iosysid, enable));
 
-            /* Send the parameters of the function call. */
-            if (!mpierr)
-                mpierr = MPI_Bcast(&len, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast((void *)filename, len + 1, MPI_CHAR, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&file->iotype, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&mode, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&use_ext_ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&ncidp_present, 1, MPI_CHAR, ios->compmaster, ios->intercomm);
-            if (ncidp_present)
-                if (!mpierr)
-                    mpierr = MPI_Bcast(ncidp, 1, MPI_INT, ios->compmaster, ios->intercomm);
-#ifdef NETCDF_INTEGRATION
-            if (!mpierr)
-                mpierr = MPI_Bcast(&diosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-#endif /* NETCDF_INTEGRATION */
-            PLOG((2, "len %d filename %s iotype %d mode %d use_ext_ncid %d "
-                  "ncidp_present %d", len, filename, file->iotype, mode,
-                  use_ext_ncid, ncidp_present));
-        }
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-        /* Handle MPI errors. */
-        PLOG((2, "handling mpi errors mpierr = %d", mpierr));
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    }
+    ios->adaptive_agg = enable;
 
-    /* If this task is in the IO component, do the IO. */
-    if (ios->ioproc)
-    {
-        switch (file->iotype)
-        {
-#ifdef _NETCDF4
-        case PIO_IOTYPE_NETCDF4P:
-            mode = mode |  NC_MPIIO | NC_NETCDF4;
-            PLOG((2, "Calling nc_create_par io_comm = %d mode = %d fh = %d",
-                  ios->io_comm, mode, file->fh));
-            ierr = nc_create_par(filename, mode, ios->io_comm, ios->info, &file->fh);
-            PLOG((2, "nc_create_par returned %d file->fh = %d", ierr, file->fh));
-            break;
-        case PIO_IOTYPE_NETCDF4C:
-            mode = mode | NC_NETCDF4;
-#endif
-        case PIO_IOTYPE_NETCDF:
-            if (!ios->io_rank)
-            {
-                PLOG((2, "Calling nc_create mode = %d", mode));
-                ierr = nc_create(filename, mode, &file->fh);
-            }
-            break;
-#ifdef _PNETCDF
-        case PIO_IOTYPE_PNETCDF:
-            PLOG((2, "Calling ncmpi_create mode = %d", mode));
-            ierr = ncmpi_create(ios->io_comm, filename, mode, ios->info, &file->fh);
-            if (!ierr)
-                ierr = ncmpi_buffer_attach(file->fh, pio_pnetcdf_buffer_size_limit);
-            break;
-#endif
-        }
-        PLOG((3, "create call complete file->fh %d", file->fh));
-    }
+    return PIO_NOERR;
+}
 
-    /* Broadcast and check the return code. */
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+/**
+ * Time an exchange in which each computation task sends bytes bytes
+ * to an IO task, with pio_swapm() over the union communicator, as the
+ * rearranger does. The slowest time on any task is returned. This
+ * must be called on all tasks of a non-async IO system.
+ *
+ * @param ios pointer to the iosystem description struct.
+ * @param bytes the number of bytes each computation task sends.
+ * @param sbuf buffer of at least bytes bytes.
+ * @param rbuf buffer on the IO tasks for the bytes of all the tasks
+ * that send to them. Ignored on other tasks.
+ * @param time pointer that gets the time in seconds.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+time_probe_exchange(iosystem_desc_t *ios, int bytes, char *sbuf, char *rbuf, double *time)
+{
+    int n = ios->num_uniontasks;
+    int *counts;          /* Send and receive counts and displacements. */
+    MPI_Datatype *types;
+    int nrecv = 0;
+    double start;
+    int ierr;
+    int mpierr;
 
-    /* If there was an error, free the memory we allocated and handle error. */
-    if (ierr)
+    if (!(counts = calloc(n * 4, sizeof(int))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if (!(types = malloc(n * sizeof(MPI_Datatype))))
     {
-        free(file);
-        return check_netcdf2(ios, NULL, ierr, __FILE__, __LINE__);
+        free(counts);
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
     }
+    for (int i = 0; i < n; i++)
+        types[i] = MPI_BYTE;
 
-    /* Broadcast writablility to all tasks. */
-    if ((mpierr = MPI_Bcast(&file->writable, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    /* Task c sends to IO task c % num_iotasks. */
+    counts[ios->ioranks[ios->union_rank % ios->num_iotasks]] = bytes;
+    if (ios->ioproc)
+        for (int c = ios->io_rank; c < n; c += ios->num_iotasks)
+        {
+            counts[2 * n + c] = bytes;
+            counts[3 * n + c] = nrecv++ * bytes;
+        }
 
-    /* Broadcast next ncid to all tasks from io root, necessary
-     * because files may be opened on mutilple iosystems, causing the
-     * underlying library to reuse ncids. Hilarious confusion
-     * ensues. */
-    if (ios->async)
+    if ((mpierr = MPI_Barrier(ios->union_comm)))
     {
-        PLOG((3, "createfile bcasting pio_next_ncid %d", pio_next_ncid));
-        if ((mpierr = MPI_Bcast(&pio_next_ncid, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-        PLOG((3, "createfile bcast pio_next_ncid %d", pio_next_ncid));
+        free(counts);
+        free(types);
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
     }
+    start = MPI_Wtime();
+    ierr = pio_swapm(ios, sbuf, counts, &counts[n], types, rbuf, &counts[2 * n], &counts[3 * n],
+                     types, ios->union_comm, &ios->rearr_opts.comp2io);
+    *time = MPI_Wtime() - start;
+    free(counts);
+    free(types);
+    if (ierr)
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
 
-    /* Assign the PIO ncid. */
-    file->pio_ncid = pio_next_ncid++;
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, time, 1, MPI_DOUBLE, MPI_MAX, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
 
-    /* With the netCDF integration layer, we must override the ncid
-     * generated on the computation processors, with the ncid
-     * generated by the I/O processors (which know about all open
-     * files). In normal PIO operation, the ncid is generated here. */
-#ifdef NETCDF_INTEGRATION
-    if (use_ext_ncid)
+    return PIO_NOERR;
+}
+
+/**
+ * Measure the bandwidth and latency of the file system, with a
+ * collective write of PIO_PROBE_FS_BYTES from each IO task to a
+ * scratch file, which is deleted. The latency is the time to open
+ * the file. The results are sent to all tasks of the IO system.
+ *
+ * @param ios pointer to the iosystem description struct.
+ * @param scratch_dir the directory of the scratch file.
+ * @param bw pointer that gets the bandwidth in bytes/s.
+ * @param lat pointer that gets the latency in seconds.
+ * @returns 0 on success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+probe_filesystem(iosystem_desc_t *ios, const char *scratch_dir, double *bw, double *lat)
+{
+    double res[3] = {0, 0, 0};  /* Error, open time, write time. */
+    int mpierr;
+
+    /* Errors are sent to all tasks with the results, so that no task
+     * is left waiting in a collective call. */
+    if (ios->ioproc)
     {
-        /* The ncid was assigned on the computational
-         * processors. Change the ncid to one that I/O and
-         * computational components can agree on. */
-        if ((ierr = nc4_file_change_ncid(*ncidp, file->pio_ncid)))
-            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-        file->pio_ncid = file->pio_ncid << ID_SHIFT;
-        file->ncint_file++;
-        PLOG((2, "changed ncid to file->pio_ncid = %d", file->pio_ncid));
-    }
-#endif /* NETCDF_INTEGRATION */
-    PLOG((2, "file->fh = %d file->pio_ncid = %d", file->fh, file->pio_ncid));
+        char path[PIO_MAX_NAME * 4 + 1];
+        MPI_File fh;
+        MPI_Status status;
+        char *buf = NULL;
+        double t0, t1;
+        int err = 0;
+
+        if (strlen(scratch_dir) > PIO_MAX_NAME * 3)
+            err = -PIO_EINVAL;
+        else if (!(buf = calloc(PIO_PROBE_FS_BYTES, 1)))
+            err = -PIO_ENOMEM;
+        else
+            sprintf(path, "%s/pio_probe.tmp", scratch_dir);
 
-    /* Return the ncid to the caller. */
-    *ncidp = file->pio_ncid;
+        /* The open is collective, so all IO tasks must do it, or none. */
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MAX, ios->io_comm)))
+        {
+            free(buf);
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+        }
+        if (!err)
+        {
+            if ((mpierr = MPI_Barrier(ios->io_comm)))
+            {
+                free(buf);
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            }
+            t0 = MPI_Wtime();
+            if (MPI_File_open(ios->io_comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY |
+                              MPI_MODE_DELETE_ON_CLOSE, ios->info, &fh))
+                err = -PIO_EIO;
+            t1 = MPI_Wtime();
+            res[1] = t1 - t0;
+            if (!err)
+            {
+                if (MPI_File_write_at_all(fh, (MPI_Offset)ios->io_rank * PIO_PROBE_FS_BYTES,
+                                          buf, PIO_PROBE_FS_BYTES, MPI_BYTE, &status) ||
+                    MPI_File_sync(fh))
+                    err = -PIO_EIO;
+                res[2] = MPI_Wtime() - t1;
+                if (MPI_File_close(&fh))
+                    err = -PIO_EIO;
+            }
+        }
+        free(buf);
+        res[0] = err;
 
-    /* Add the struct with this files info to the global list of
-     * open files. */
-    pio_add_to_file_list(file);
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, res, 3, MPI_DOUBLE, MPI_MAX, ios->io_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
 
-#ifdef USE_MPE
-    pio_stop_mpe_log(CREATE, __func__);
-#endif /* USE_MPE */
-    PLOG((2, "Created file %s file->fh = %d file->pio_ncid = %d", filename,
-          file->fh, file->pio_ncid));
+    if ((mpierr = MPI_Bcast(res, 3, MPI_DOUBLE, ios->ioroot, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if (res[0])
+        return pio_err(ios, NULL, -(int)res[0], __FILE__, __LINE__);
 
-    return ierr;
+    *lat = res[1];
+    *bw = (double)ios->num_iotasks * PIO_PROBE_FS_BYTES / max(res[2], 1e-9);
+
+    return PIO_NOERR;
 }
 
 /**
- * Check that a file meets PIO requirements for use of unlimited
- * dimensions. This function is only called on netCDF-4 files. If the
- * file is found to violate PIO requirements it is closed.
+ * Write the results of PIOc_probe_iosystem() to the cache file, in
+ * place of any earlier results with the same signature, so the file
+ * has one line for each machine. The file is written to a temporary
+ * file first, which is renamed.
  *
- * @param ncid the file->fh for this file (the real netCDF ncid, not
- * the pio_ncid).
- * @returns 0 if file is OK, error code otherwise.
+ * @param cache_file name of the cache file.
+ * @param sig the signature of the machine.
+ * @param res the four results.
+ * @returns 0 on success, error code otherwise.
  * @author Ed Hartnett
  */
-int
-check_unlim_use(int ncid)
+static int
+write_probe_cache(const char *cache_file, unsigned long long sig, const double *res)
 {
-#ifdef _NETCDF4
-    int nunlimdims; /* Number of unlimited dims in file. */
-    int nvars;       /* Number of vars in file. */
-    int ierr;        /* Return code. */
-
-    /* Are there 2 or more unlimited dims in this file? */
-    if ((ierr = nc_inq_unlimdims(ncid, &nunlimdims, NULL)))
-        return ierr;
-    if (nunlimdims < 2)
-        return PIO_NOERR;
+    char tmpname[strlen(cache_file) + 5];
+    char line[PIO_MAX_NAME + 1];
+    FILE *in, *out;
+    int ierr = PIO_NOERR;
 
-    /* How many vars in file? */
-    if ((ierr = nc_inq_nvars(ncid, &nvars)))
-        return ierr;
+    sprintf(tmpname, "%s.tmp", cache_file);
+    if (!(out = fopen(tmpname, "w")))
+        return PIO_EIO;
 
-    /* Check each var. */
-    for (int v = 0; v < nvars && !ierr; v++)
+    /* Keep the results of other machines. */
+    if ((in = fopen(cache_file, "r")))
     {
-        int nvardims;
-        if ((ierr = nc_inq_varndims(ncid, v, &nvardims)))
-            return ierr;
-        int vardimid[nvardims];
-        if ((ierr = nc_inq_vardimid(ncid, v, vardimid)))
-            return ierr;
-
-        /* Check all var dimensions, except the first. If we find
-         * unlimited, that's a problem. */
-        for (int vd = 1; vd < nvardims; vd++)
+        while (!ierr && fgets(line, sizeof(line), in))
         {
-            size_t dimlen;
-            if ((ierr = nc_inq_dimlen(ncid, vardimid[vd], &dimlen)))
-                return ierr;
-            if (dimlen == NC_UNLIMITED)
-            {
-                nc_close(ncid);
-                return PIO_EINVAL;
-            }
+            unsigned long long s;
+
+            if (line[0] != '#' && sscanf(line, "%llx", &s) == 1 && s == sig)
+                continue;
+            if (fputs(line, out) == EOF)
+                ierr = PIO_EIO;
         }
+        fclose(in);
     }
-#endif /* _NETCDF4 */
+    if (fprintf(out, "%016llx %.17g %.17g %.17g %.17g\n", sig, res[0], res[1], res[2],
+                res[3]) < 0)
+        ierr = PIO_EIO;
+    if (fclose(out))
+        ierr = PIO_EIO;
+    if (!ierr && rename(tmpname, cache_file))
+        ierr = PIO_EIO;
+    if (ierr)
+        remove(tmpname);
 
-    return PIO_NOERR;
+    return ierr;
 }
 
 /**
- * Internal function used when opening an existing file. This function
- * is called by PIOc_openfile_retry(). It learns some things about the
- * metadata in that file. The results end up in the file_desc_t and
- * var_desc_t structs for this file and the vars in it.
+ * Measure the network and file system of an IO system, for use as
+ * priors by the tuning features. The results are kept in the IO
+ * system, and may be read with PIOc_get_probe().
  *
- * @param file pointer to the file_desc_t for this file.
- * @param ncid the ncid assigned to the file when opened.
- * @param iotype the iotype used to open the file.
- * @param nvars a pointer that gets the number of vars in the file.
-
- * @param rec_var gets an array (length nvars) of rec_var values for
- * each var in the file. This array must be freed by caller.
- * @param pio_type gets an array (length nvars) of pio_type values for
- * each var in the file. This array must be freed by caller.
- * @param pio_type_size gets an array (length nvars) of the size of
- * the PIO type for each var in the file. This array must be freed by
- * caller.
- * @param mpi_type gets an array (length nvars) of MPI type values for
- * each var in the file. This array must be freed by caller.
- * @param mpi_type_size gets an array (length nvars) of the size of
- * the MPI type for each var in the file. This array must be freed by
- * caller.
- * @param ndim gets an array (length nvars) with the number of
- * dimensions of each var.
+ * The network is timed with an exchange of PIO_PROBE_NET_BYTES from
+ * each computation task to an IO task, with the rearranger's
+ * pio_swapm() and the comp2io options of the IO system. The bandwidth
+ * is that of each task, while all send at once, and the latency is
+ * the time of a one byte exchange. If scratch_dir is not NULL, the IO
+ * tasks also write PIO_PROBE_FS_BYTES each to a scratch file in that
+ * directory, which is deleted; otherwise the file system is not
+ * measured. The probe takes well under a second on most machines.
  *
- * @return 0 for success, error code otherwise.
- * @ingroup PIO_openfile_c
+ * If cache_file is not NULL, the results are looked up there first,
+ * with a signature of the machine (the name of the node of task 0,
+ * without trailing digits), the number of tasks and IO tasks, and the
+ * scratch directory. If they are not found, the new results are
+ * written to it, in place of any old ones with the same signature.
+ * The file is a text file read and written by task 0 only.
+ *
+ * The measurements are used by:
+ *
+ * - PIOc_set_adaptive_aggregation(), which starts each decomposition
+ * at the number of arrays for which the file system latency is
+ * PIO_AGG_TOLERANCE of the flush time, instead of at the aggregate
+ * buffer limit.
+ * - PIOc_set_rearr_autotune(), which does not tune decompositions
+ * whose exchange is smaller than the latency-bandwidth product of the
+ * network, since the options make no difference to them.
+ *
+ * This function must be called on all tasks of the IO system. It is
+ * not supported with async.
+ *
+ * @param iosysid the IO system ID.
+ * @param scratch_dir directory on the file system the IO tasks write
+ * to, or NULL to not measure the file system.
+ * @param cache_file name of the file that caches the results between
+ * runs, or NULL to always measure.
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
-static int
-inq_file_metadata(file_desc_t *file, int ncid, int iotype, int *nvars,
-                  int **rec_var, int **pio_type, int **pio_type_size,
-                  MPI_Datatype **mpi_type, int **mpi_type_size, int **ndims)
+int
+PIOc_probe_iosystem(int iosysid, const char *scratch_dir, const char *cache_file)
 {
-    int nunlimdims = 0;        /* The number of unlimited dimensions. */
-    int unlimdimid;
-    int *unlimdimids;
+    iosystem_desc_t *ios;
+    double res[5] = {0};  /* Found flag, then the results. */
+    unsigned long long sig = 14695981039346656037ULL;  /* Signature of the machine. */
     int mpierr;
     int ret;
 
-    /* Check inputs. */
-    pioassert(rec_var && pio_type && pio_type_size && mpi_type && mpi_type_size,
-              "pointers must be provided", __FILE__, __LINE__);
+    PLOG((1, "PIOc_probe_iosystem iosysid = %d scratch_dir = %s cache_file = %s", iosysid,
+          scratch_dir ? scratch_dir : "NULL", cache_file ? cache_file : "NULL"));
 
-    /* How many vars in the file? */
-    if (iotype == PIO_IOTYPE_PNETCDF)
-    {
-#ifdef _PNETCDF
-        if ((ret = ncmpi_inq_nvars(ncid, nvars)))
-            return pio_err(NULL, file, PIO_ENOMEM, __FILE__, __LINE__);
-#endif /* _PNETCDF */
-    }
-    else
-    {
-        if ((ret = nc_inq_nvars(ncid, nvars)))
-            return pio_err(NULL, file, PIO_ENOMEM, __FILE__, __LINE__);
-    }
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Allocate storage for info about each var. */
-    if (*nvars)
-    {
-        if (!(*rec_var = malloc(*nvars * sizeof(int))))
-            return PIO_ENOMEM;
-        if (!(*pio_type = malloc(*nvars * sizeof(int))))
-            return PIO_ENOMEM;
-        if (!(*pio_type_size = malloc(*nvars * sizeof(int))))
-            return PIO_ENOMEM;
-        if (!(*mpi_type = malloc(*nvars * sizeof(MPI_Datatype))))
-            return PIO_ENOMEM;
-        if (!(*mpi_type_size = malloc(*nvars * sizeof(int))))
-            return PIO_ENOMEM;
-        if (!(*ndims = malloc(*nvars * sizeof(int))))
-            return PIO_ENOMEM;
-    }
+    /* The IO tasks of async are busy in the message handler. */
+    if (ios->async)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* How many unlimited dims for this file? */
-    if (iotype == PIO_IOTYPE_PNETCDF)
-    {
-#ifdef _PNETCDF
-        if ((ret = ncmpi_inq_unlimdim(ncid, &unlimdimid)))
-            return pio_err(NULL, file, ret, __FILE__, __LINE__);
-        nunlimdims = unlimdimid == -1 ? 0 : 1;
-#endif /* _PNETCDF */
-    }
-    else if (iotype == PIO_IOTYPE_NETCDF)
-    {
-        if ((ret = nc_inq_unlimdim(ncid, &unlimdimid)))
-            return pio_err(NULL, file, ret, __FILE__, __LINE__);
-        nunlimdims = unlimdimid == -1 ? 0 : 1;
-    }
-    else
+    /* Maybe this machine was probed in an earlier run. */
+    if (cache_file)
     {
-#ifdef _NETCDF4
-        if ((ret = nc_inq_unlimdims(ncid, &nunlimdims, NULL)))
-            return pio_err(NULL, file, ret, __FILE__, __LINE__);
-#endif /* _NETCDF4 */
+        if (!ios->union_rank)
+        {
+            char name[MPI_MAX_PROCESSOR_NAME + 1];
+            const char *c;
+            int len;
+            FILE *fp;
+
+            /* Node numbers change from job to job, so leave them
+             * out. */
+            if (MPI_Get_processor_name(name, &len))
+                len = 0;
+            while (len > 0 && name[len - 1] >= '0' && name[len - 1] <= '9')
+                len--;
+            for (int i = 0; i < len; i++)
+                sig = (sig ^ (unsigned char)name[i]) * 1099511628211ULL;
+            for (c = scratch_dir ? scratch_dir : ""; *c; c++)
+                sig = (sig ^ (unsigned char)*c) * 1099511628211ULL;
+            sig = (sig ^ (unsigned)ios->num_uniontasks) * 1099511628211ULL;
+            sig = (sig ^ (unsigned)ios->num_iotasks) * 1099511628211ULL;
+
+            if ((fp = fopen(cache_file, "r")))
+            {
+                char line[PIO_MAX_NAME + 1];
+
+                while (fgets(line, sizeof(line), fp))
+                {
+                    unsigned long long s;
+                    double r[4];
+
+                    if (line[0] == '#')
+                        continue;
+                    if (sscanf(line, "%llx %lg %lg %lg %lg", &s, &r[0], &r[1], &r[2],
+                               &r[3]) == 5 && s == sig)
+                    {
+                        res[0] = 1;
+                        memcpy(&res[1], r, sizeof(r));
+                    }
+                }
+                fclose(fp);
+            }
+        }
+
+        if ((mpierr = MPI_Bcast(res, 5, MPI_DOUBLE, 0, ios->union_comm)))
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
     }
 
-    /* Learn the unlimited dimension ID(s), if there are any. */
-    if (nunlimdims)
+    if (!res[0])
     {
-        if (!(unlimdimids = malloc(nunlimdims * sizeof(int))))
-            return pio_err(NULL, file, PIO_ENOMEM, __FILE__, __LINE__);
-        if (iotype == PIO_IOTYPE_PNETCDF || iotype == PIO_IOTYPE_NETCDF)
+        char *sbuf, *rbuf = NULL;
+        double small = 0, large = 0;
+        int nomem;
+
+        /* Each IO task gets the bytes of every num_iotasks-th task. */
+        sbuf = calloc(PIO_PROBE_NET_BYTES, 1);
+        if (ios->ioproc)
+            rbuf = calloc((ios->num_uniontasks - ios->io_rank + ios->num_iotasks - 1) /
+                          ios->num_iotasks, PIO_PROBE_NET_BYTES);
+        nomem = !sbuf || (ios->ioproc && !rbuf);
+        if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, &nomem, 1, MPI_INT, MPI_MAX,
+                                    ios->union_comm)))
+            nomem = -1;
+        if (nomem)
         {
-            unlimdimids[0] = unlimdimid;
+            free(sbuf);
+            free(rbuf);
+            if (nomem < 0)
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
         }
-        else
+
+        /* Keep the fastest of a few trials. */
+        ret = PIO_NOERR;
+        for (int t = 0; !ret && t < PIO_PROBE_NTRIALS; t++)
         {
-#ifdef _NETCDF4
-            if ((ret = nc_inq_unlimdims(ncid, NULL, unlimdimids)))
-                return pio_err(NULL, file, ret, __FILE__, __LINE__);
-#endif /* _NETCDF4 */
+            double time;
+
+            if (!(ret = time_probe_exchange(ios, 1, sbuf, rbuf, &time)))
+                small = t ? min(small, time) : time;
+            if (!ret && !(ret = time_probe_exchange(ios, PIO_PROBE_NET_BYTES, sbuf, rbuf, &time)))
+                large = t ? min(large, time) : time;
+        }
+        free(sbuf);
+        if (rbuf)
+            free(rbuf);
+        if (ret)
+            return ret;
+        res[1] = PIO_PROBE_NET_BYTES / max(large - small, 1e-9);
+        res[2] = small;
+
+        if (scratch_dir)
+            if ((ret = probe_filesystem(ios, scratch_dir, &res[3], &res[4])))
+                return ret;
+
+        /* Remember the results for the next run. */
+        if (cache_file)
+        {
+            int ierr = PIO_NOERR;
+
+            if (!ios->union_rank)
+                ierr = write_probe_cache(cache_file, sig, &res[1]);
+
+            /* Everyone learns whether the write worked. */
+            if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, 0, ios->union_comm)))
+                return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+            if (ierr)
+                return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
         }
     }
 
-    /* Learn about each variable in the file. */
-    for (int v = 0; v < *nvars; v++)
-    {
-        int var_ndims;   /* Number of dims for this var. */
-        nc_type my_type;
+    ios->probe_net_bw = res[1];
+    ios->probe_net_lat = res[2];
+    ios->probe_fs_bw = res[3];
+    ios->probe_fs_lat = res[4];
+    PLOG((1, "probe: net_bw = %g net_lat = %g fs_bw = %g fs_lat = %g cached = %d",
+          res[1], res[2], res[3], res[4], (int)res[0]));
 
-        /* Find type of the var and number of dims in this var. Also
-         * learn about type. */
-        if (iotype == PIO_IOTYPE_PNETCDF)
-        {
-#ifdef _PNETCDF
-            PIO_Offset type_size;
+    return PIO_NOERR;
+}
 
-            if ((ret = ncmpi_inq_var(ncid, v, NULL, &my_type, &var_ndims, NULL, NULL)))
-                return pio_err(NULL, file, ret, __FILE__, __LINE__);
-            (*pio_type)[v] = (int)my_type;
-            (*ndims)[v] = var_ndims;
-            if ((ret = pioc_pnetcdf_inq_type(ncid, (*pio_type)[v], NULL, &type_size)))
-                return check_netcdf(file, ret, __FILE__, __LINE__);
-            (*pio_type_size)[v] = type_size;
-#endif /* _PNETCDF */
-        }
-        else
-        {
-            size_t type_size;
+/**
+ * Get the results of PIOc_probe_iosystem(). All are 0 if the IO
+ * system has not been probed, and the file system ones are 0 if it
+ * was probed without a scratch directory.
+ *
+ * @param iosysid the IO system ID.
+ * @param net_bw pointer that gets the network bandwidth of each task
+ * in bytes/s, with all computation tasks sending at once. Ignored if
+ * NULL.
+ * @param net_lat pointer that gets the network latency in
+ * seconds. Ignored if NULL.
+ * @param fs_bw pointer that gets the file system bandwidth in
+ * bytes/s. Ignored if NULL.
+ * @param fs_lat pointer that gets the file system latency in
+ * seconds. Ignored if NULL.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_get_probe(int iosysid, double *net_bw, double *net_lat, double *fs_bw, double *fs_lat)
+{
+    iosystem_desc_t *ios;
+
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-            if ((ret = nc_inq_var(ncid, v, NULL, &my_type, &var_ndims, NULL, NULL)))
-                return pio_err(NULL, file, ret, __FILE__, __LINE__);
-            (*pio_type)[v] = (int)my_type;
-            (*ndims)[v] = var_ndims;
-            if ((ret = nc_inq_type(ncid, (*pio_type)[v], NULL, &type_size)))
-                return check_netcdf(file, ret, __FILE__, __LINE__);
-            (*pio_type_size)[v] = type_size;
-        }
+    if (net_bw)
+        *net_bw = ios->probe_net_bw;
+    if (net_lat)
+        *net_lat = ios->probe_net_lat;
+    if (fs_bw)
+        *fs_bw = ios->probe_fs_bw;
+    if (fs_lat)
+        *fs_lat = ios->probe_fs_lat;
 
-        /* Get the MPI type corresponding with the PIO type. */
-        if ((ret = find_mpi_type((*pio_type)[v], &(*mpi_type)[v], NULL)))
-            return pio_err(NULL, file, ret, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
 
-        /* Get the size of the MPI type. */
-        if ((*mpi_type)[v] == MPI_DATATYPE_NULL)
-            (*mpi_type_size)[v] = 0;
-        else
-            if ((mpierr = MPI_Type_size((*mpi_type)[v], &(*mpi_type_size)[v])))
-                return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+/**
+ * Turn on or off the sharing of identical decompositions. When on,
+ * PIOc_InitDecomp() returns the ID of an existing decomposition of
+ * the IO system, if every task gave it the same type, dimensions,
+ * rearranger and map. No new rearranger is created. Each
+ * PIOc_InitDecomp() call must still be matched by a
+ * PIOc_freedecomp(), which frees the decomposition after the last one.
+ *
+ * Decompositions with a user-provided iostart and iocount are never
+ * shared. Sharing is not done when async is in use.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to share identical decompositions, false to
+ * always create a new one (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_decomp_sharing(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-        /* What are the dimids associated with this var? */
-        if (var_ndims)
-        {
-            int var_dimids[var_ndims];
-            if (iotype == PIO_IOTYPE_PNETCDF)
-            {
-#ifdef _PNETCDF
-                if ((ret = ncmpi_inq_vardimid(ncid, v, var_dimids)))
-                    return pio_err(NULL, file, ret, __FILE__, __LINE__);
-#endif /* _PNETCDF */
-            }
-            else
-            {
-                if ((ret = nc_inq_vardimid(ncid, v, var_dimids)))
-                    return pio_err(NULL, file, ret, __FILE__, __LINE__);
-            }
+    PLOG((1, "PIOc_set_decomp_sharing iosysid = %d enable = %d", iosysid, enable));
 
-            /* Check against each variable dimid agains each unlimited
-             * dimid. */
-            for (int d = 0; d < var_ndims; d++)
-            {
-                int unlim_found = 0;
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-                /* Check against each unlimited dimid. */
-                for (int ud = 0; ud < nunlimdims; ud++)
-                {
-                    if (var_dimids[d] == unlimdimids[ud])
-                    {
-                        unlim_found++;
-                        break;
-                    }
-                }
+    ios->decomp_sharing = enable;
 
-                /* Only first dim may be unlimited, for PIO. */
-                if (unlim_found)
-                {
-                    if (d == 0){
-                        (*rec_var)[v] = 1;
-                        break;
-                    }
-                    else
-                        return pio_err(NULL, file, PIO_EINVAL, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
 
-                }
-                else
-                    (*rec_var)[v] = 0;
+/**
+ * Turn on or off leaving the holes of SUBSET decompositions to the
+ * fill mode of the netCDF library. By default, PIOc_write_darray()
+ * writes fill values to the parts of a variable that are not in the
+ * map of the decomposition, for every record. When on, and the file
+ * is in NC_FILL mode (see PIOc_set_fill()), the netCDF library has
+ * already filled them, and they are not written. Only the holes of
+ * the records of pnetcdf files are still written, since pnetcdf does
+ * not fill new records.
+ *
+ * The holes then get the fill value of the variable in the file, not
+ * a fill value given to PIOc_write_darray(). For classic and pnetcdf
+ * files, the fill mode must be set before PIOc_enddef(), so the
+ * non-record variables are filled. Variables with NC_NOFILL set by
+ * PIOc_def_var_fill() must not be written with this on.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to leave holes to the netCDF library, false to
+ * write them (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_library_fill(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-            }
-        }
+    PLOG((1, "PIOc_set_library_fill iosysid = %d enable = %d", iosysid, enable));
 
-    } /* next var */
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Free resources. */
-    if (nunlimdims)
-        free(unlimdimids);
+    ios->library_fill = enable;
 
     return PIO_NOERR;
 }
 
 /**
- * Find the appropriate IOTYPE from mode flags to nc_open(). The
- * following flags have meaning:
- * - NC_NETCDF4 - use netCDF-4/HDF5 format
- * - NC_MPIIO - when used with NC_NETCDF4, use parallel I/O.
- * - NC_PNETCDF - use classic format with pnetcdf parallel I/O.
+ * Choose how the distributed arrays of a pnetcdf file are read and
+ * written. By default, the regions of each IO task are given to
+ * pnetcdf as lists of start/count arrays (ncmpi_iput_varn() and
+ * ncmpi_get_varn_all()). When on, they are described by an MPI file
+ * type instead (ncmpi_put_vard_all() and ncmpi_get_vard_all()), which
+ * is built once for each decomposition. Which is faster depends on
+ * the decomposition. The default is on if PIO was built with
+ * PIO_USE_PNETCDF_VARD.
  *
- * @param mode the mode flag from nc_open().
- * @param iotype pointer that gets the IOTYPE.
+ * vard writes are not buffered: each PIOc_write_darray() flush writes
+ * the data before returning. Reads with vard are never posted
+ * without waiting for them. Other iotypes ignore this setting, see
+ * PIOc_inq_vard().
  *
- * @return 0 on success, error code otherwise.
+ * This function must be called on all tasks, with the same value. It
+ * can't be changed from the default when async is in use.
+ *
+ * @param ncid the ncid of the open file.
+ * @param enable true to use vard, false to use varn.
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
 int
-find_iotype_from_omode(int mode, int *iotype)
+PIOc_set_vard(int ncid, bool enable)
 {
-    /* Check inputs. */
-    pioassert(iotype, "pointer to iotype must be provided", __FILE__, __LINE__);
+    iosystem_desc_t *ios;
+    file_desc_t *file;
+    int ierr;
 
-    /* Figure out the iotype. */
-    if (mode & NC_NETCDF4)
-    {
-        if (mode & NC_MPIIO || mode & NC_MPIPOSIX)
-            *iotype = PIO_IOTYPE_NETCDF4P;
-        else
-            *iotype = PIO_IOTYPE_NETCDF4C;
-    }
-    else
-    {
-        if (mode & NC_PNETCDF || mode & NC_MPIIO)
-            *iotype = PIO_IOTYPE_PNETCDF;
-        else
-            *iotype = PIO_IOTYPE_NETCDF;
-    }
+    PLOG((1, "PIOc_set_vard ncid = %d enable = %d", ncid, enable));
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* The IO tasks of async would not know. */
+    if (ios->async && enable != PIO_VARD_DEFAULT)
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    file->use_vard = enable && file->iotype == PIO_IOTYPE_PNETCDF;
 
     return PIO_NOERR;
 }
 
-
 /**
- * Find the appropriate IOTYPE from mode flags to nc_create().
- *
- * @param cmode the mode flag from nc_create().
- * @param iotype pointer that gets the IOTYPE.
+ * Find out whether the distributed arrays of a file are read and
+ * written with the vard functions of pnetcdf, see PIOc_set_vard().
+ * This is only ever true for pnetcdf files.
  *
- * @return 0 on success, error code otherwise.
+ * @param ncid the ncid of the open file.
+ * @param use_vard pointer that gets true if vard is used. Ignored if
+ * NULL.
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
 int
-find_iotype_from_cmode(int cmode, int *iotype)
+PIOc_inq_vard(int ncid, bool *use_vard)
 {
-    /* Check inputs. */
-    pioassert(iotype, "pointer to iotype must be provided", __FILE__, __LINE__);
+    file_desc_t *file;
+    int ierr;
 
-    /* Figure out the iotype. */
-    if (cmode & NC_NETCDF4)
-    {
-        if (cmode & NC_MPIIO || cmode & NC_MPIPOSIX)
-            *iotype = PIO_IOTYPE_NETCDF4P;
-        else
-            *iotype = PIO_IOTYPE_NETCDF4C;
-    }
-    else
-    {
-        if (cmode & NC_PNETCDF || cmode & NC_MPIIO)
-            *iotype = PIO_IOTYPE_PNETCDF;
-        else
-            *iotype = PIO_IOTYPE_NETCDF;
-    }
+    /* Get the file info. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+
+    if (use_vard)
+        *use_vard = file->use_vard;
 
     return PIO_NOERR;
 }
 
 /**
- * Open an existing file using PIO library. This is an internal
- * function. Depending on the value of the retry parameter, a failed
- * open operation will be handled differently. If retry is non-zero,
- * then a failed attempt to open a file with netCDF-4 (serial or
- * parallel), or parallel-netcdf will be followed by an attempt to
- * open the file as a serial classic netCDF file. This is an important
- * feature to some NCAR users. The functionality is exposed to the
- * user as PIOc_openfile() (which does the retry), and PIOc_open()
- * (which does not do the retry).
- *
- * Input parameters are read on comp task 0 and ignored elsewhere.
- *
- * @param iosysid a defined pio system descriptor.
- * @param ncidp a pio file descriptor.
- * @param iotype a pio output format.
- * @param filename the filename to open
- * @param mode the netcdf mode for the open operation
- * @param retry non-zero to automatically retry with netCDF serial
- * classic.
- * @param use_ext_ncid non-zero to use an externally assigned ncid
- * (used in the netcdf integration layer).
+ * Get the I/O statistics of a file on this task. The counters are
+ * kept from the open or create of the file, by PIOc_write_darray(),
+ * PIOc_write_darray_multi(), PIOc_read_darray() and the flushes of
+ * pending writes. The rearranger counters are of this computation
+ * task, the ones of the file access are of this IO task (and are 0
+ * on tasks that do no IO).
  *
- * @return 0 for success, error code otherwise.
- * @ingroup PIO_openfile_c
- * @author Jim Edwards, Ed Hartnett
+ * @param ncid the ncid of the open file.
+ * @param stats pointer that gets the statistics.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
  */
 int
-PIOc_openfile_retry(int iosysid, int *ncidp, int *iotype, const char *filename,
-                    int mode, int retry, int use_ext_ncid)
+PIOc_get_file_stats(int ncid, pio_stats_t *stats)
 {
-    iosystem_desc_t *ios;      /* Pointer to io system information. */
-    file_desc_t *file;         /* Pointer to file information. */
-    int imode;                 /* Internal mode val for netcdf4 file open. */
-    int nvars = 0;
-    int *rec_var = NULL;
-    int *pio_type = NULL;
-    int *pio_type_size = NULL;
-    MPI_Datatype *mpi_type = NULL;
-    int *mpi_type_size = NULL;
-    int *ndims = NULL;
-    int mpierr = MPI_SUCCESS, mpierr2;  /** Return code from MPI function codes. */
-    int ierr = PIO_NOERR;      /* Return code from function calls. */
+    file_desc_t *file;
+    int ierr;
 
-#ifdef USE_MPE
-    pio_start_mpe_log(OPEN);
-#endif /* USE_MPE */
+    /* Get the file info. */
+    if ((ierr = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
 
-    /* Get the IO system info from the iosysid. */
-    if (!(ios = pio_get_iosystem_from_id(iosysid)))
-        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!stats)
+        return pio_err(NULL, file, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* User must provide valid input for these parameters. */
-    if (!ncidp || !iotype || !filename)
-        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
-    if (*iotype < PIO_IOTYPE_PNETCDF || *iotype > PIO_IOTYPE_NETCDF4P)
-        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    *stats = file->stats;
 
-    PLOG((2, "PIOc_openfile_retry iosysid = %d iotype = %d filename = %s mode = %d retry = %d",
-          iosysid, *iotype, filename, mode, retry));
+    return PIO_NOERR;
+}
 
-    /* Allocate space for the file info. */
-    if (!(file = calloc(sizeof(*file), 1)))
-        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+/**
+ * Get the I/O statistics of a decomposition on this task, summed over
+ * all the files it was used with. See PIOc_get_file_stats().
+ *
+ * @param ioid the ID of the decomposition.
+ * @param stats pointer that gets the statistics.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_get_iodesc_stats(int ioid, pio_stats_t *stats)
+{
+    io_desc_t *iodesc;
 
-    /* Fill in some file values. */
-    file->fh = -1;
-    file->iotype = *iotype;
-    file->iosystem = ios;
-    file->writable = (mode & PIO_WRITE) ? 1 : 0;
+    /* Get the decomposition info. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Set to true if this task should participate in IO (only true
-     * for one task with netcdf serial files. */
-    if (file->iotype == PIO_IOTYPE_NETCDF4P || file->iotype == PIO_IOTYPE_PNETCDF ||
-        ios->io_rank == 0)
-        file->do_io = 1;
+    if (!stats)
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* If async is in use, and this is not an IO task, bcast the parameters. */
-    if (ios->async)
-    {
-        int msg = PIO_MSG_OPEN_FILE;
-        size_t len = strlen(filename);
+    *stats = iodesc->stats;
 
-        if (!ios->ioproc)
-        {
-            /* Send the message to the message handler. */
-            if (ios->compmaster == MPI_ROOT)
-                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
+    return PIO_NOERR;
+}
 
-            /* Send the parameters of the function call. */
-            if (!mpierr)
-                mpierr = MPI_Bcast(&len, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast((void *)filename, len + 1, MPI_CHAR, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&file->iotype, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&mode, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            if (!mpierr)
-                mpierr = MPI_Bcast(&use_ext_ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-#ifdef NETCDF_INTEGRATION
-            if (!mpierr)
-                mpierr = MPI_Bcast(&diosysid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-#endif /* NETCDF_INTEGRATION */
-        }
+/**
+ * Get a summary of the balance of the load of a decomposition over
+ * the tasks of its IO system: the bytes of one field and the number
+ * of file regions on each IO task, the number of rearranger messages
+ * of each task, and the fraction of the data written which is fill
+ * values for holes. An uneven load on the IO tasks makes writes
+ * slow. The summary is also printed to the log at level 1, and
+ * written to decomp files (see PIOc_write_nc_decomp()).
+ *
+ * This function must be called on all tasks of the IO system. It
+ * can not be used when async is in use.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of the decomposition.
+ * @param report pointer that gets the summary.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_get_decomp_report(int iosysid, int ioid, pio_decomp_report_t *report)
+{
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc;
+    io_desc_t *rdesc;  /* The decomposition whose rearranger moves the data. */
+    PIO_Offset maxv[4] = {0, 0, 0, 0}; /* IO bytes, regions, comp and IO msgs. */
+    PIO_Offset minv[2] = {LLONG_MAX, LLONG_MAX}; /* IO bytes, regions. */
+    PIO_Offset sumv[2] = {0, 0};       /* IO elements, hole elements. */
+    int mpierr;
 
-        /* Handle MPI errors. */
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    }
+    /* Get the IO system and decomposition info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (!report || ios->async)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* If this is an IO task, then call the netCDF function. */
-    if (ios->ioproc)
-    {
-        switch (file->iotype)
-        {
-#ifdef _NETCDF4
+    /* The levels of an extruded decomposition are moved by the
+     * rearranger of the decomposition it extrudes. */
+    for (rdesc = iodesc; rdesc->extrude_parent; )
+        if (!(rdesc = pio_get_iodesc_from_id(rdesc->extrude_parent)))
+            return pio_err(ios, NULL, PIO_EBADID, __FILE__, __LINE__);
+
+    /* Find the load of this task. */
+    if (ios->ioproc)
+    {
+        int nregions = 0;
+
+        if (iodesc->llen > 0)
+            for (io_region *region = iodesc->firstregion; region; region = region->next)
+                nregions++;
+        maxv[0] = minv[0] = iodesc->llen * iodesc->mpitype_size;
+        maxv[1] = minv[1] = nregions;
+        for (int r = 0; r < rdesc->nrecvs; r++)
+            if (rdesc->rcount && rdesc->rcount[r] > 0)
+                maxv[3]++;
+        sumv[0] = iodesc->llen;
+        sumv[1] = iodesc->needsfill ? iodesc->holegridsize : 0;
+    }
+    if (ios->compproc && rdesc->scount)
+        for (int i = 0; i < ios->num_iotasks; i++)
+            if (rdesc->scount[i] > 0)
+                maxv[2]++;
 
-        case PIO_IOTYPE_NETCDF4P:
-#ifdef _MPISERIAL
-            ierr = nc_open(filename, mode, &file->fh);
-#else
-            imode = mode |  NC_MPIIO;
-            if ((ierr = nc_open_par(filename, imode, ios->io_comm, ios->info,
-                                    &file->fh)))
-                break;
+    /* Combine the loads of all tasks. */
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, maxv, 4, MPI_OFFSET, MPI_MAX, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, minv, 2, MPI_OFFSET, MPI_MIN, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Allreduce(MPI_IN_PLACE, sumv, 2, MPI_OFFSET, MPI_SUM, ios->union_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
 
-            /* Check the vars for valid use of unlim dims. */
-            if ((ierr = check_unlim_use(file->fh)))
-                break;
+    report->num_iotasks = ios->num_iotasks;
+    report->min_iobytes = minv[0];
+    report->max_iobytes = maxv[0];
+    report->mean_iobytes = (double)sumv[0] * iodesc->mpitype_size / ios->num_iotasks;
+    report->min_regions = minv[1];
+    report->max_regions = maxv[1];
+    report->max_comp_msgs = maxv[2];
+    report->max_io_msgs = maxv[3];
+    report->fill_fraction = sumv[0] + sumv[1] ? (double)sumv[1] / (sumv[0] + sumv[1]) : 0;
+
+    PLOG((1, "PIOc_get_decomp_report ioid %d IO bytes min %lld max %lld mean %g regions "
+          "min %d max %d msgs comp %d io %d fill fraction %g", ioid,
+          (long long)report->min_iobytes, (long long)report->max_iobytes,
+          report->mean_iobytes, report->min_regions, report->max_regions,
+          report->max_comp_msgs, report->max_io_msgs, report->fill_fraction));
 
-            if ((ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_NETCDF4P,
-                                          &nvars, &rec_var, &pio_type,
-                                          &pio_type_size, &mpi_type,
-                                          &mpi_type_size, &ndims)))
-                break;
-            PLOG((2, "PIOc_openfile_retry:nc_open_par filename = %s mode = %d "
-                  "imode = %d ierr = %d", filename, mode, imode, ierr));
-#endif
-            break;
+    return PIO_NOERR;
+}
 
-        case PIO_IOTYPE_NETCDF4C:
-            if (ios->io_rank == 0)
-            {
-                if ((ierr = nc_open(filename, mode, &file->fh)))
-                    break;
-                /* Check the vars for valid use of unlim dims. */
-                if ((ierr = check_unlim_use(file->fh)))
-                    break;
-                ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_NETCDF4C,
-                                         &nvars, &rec_var, &pio_type,
-                                         &pio_type_size, &mpi_type,
-                                         &mpi_type_size, &ndims);
-                PLOG((2, "PIOc_openfile_retry:nc_open for 4C filename = %s mode = %d "
-                      "ierr = %d", filename, mode, ierr));
-            }
-            break;
-#endif /* _NETCDF4 */
+/**
+ * Turn on or off deferred errors, for the files created or opened
+ * after this call.
+ *
+ * Normally the return code of each netCDF call is broadcast from the
+ * IO root, so defining a file with many dimensions, variables and
+ * attributes costs one collective per call. With deferred errors,
+ * the calls that define or change the metadata (PIOc_def_dim(),
+ * PIOc_def_var(), PIOc_put_att(), the renames, PIOc_del_att() and the
+ * PIOc_def_var_*() settings) keep the first error of each task
+ * instead, and return PIO_NOERR. The errors are checked, in one
+ * collective, by the next PIOc_enddef(), PIOc_redef(), PIOc_sync(),
+ * PIOc_closefile() or PIOc_check_errors(), which returns the error
+ * (the lowest code of all tasks) through the error handler.
+ *
+ * Until then, the IDs returned by a failed call are not valid. Only
+ * PIOc_def_var() returns the error at once, if the variable was not
+ * defined on the IO root, since it has no varid to return. The error
+ * is still kept, and returned again by the next check.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value. It has no effect in async mode.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to defer the errors, false to check each call
+ * (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_defer_errors(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-        case PIO_IOTYPE_NETCDF:
-            if (ios->io_rank == 0)
-            {
-                if ((ierr = nc_open(filename, mode, &file->fh)))
-                    break;
-                ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_NETCDF,
-                                         &nvars, &rec_var, &pio_type,
-                                         &pio_type_size, &mpi_type,
-                                         &mpi_type_size, &ndims);
-                PLOG((2, "PIOc_openfile_retry:nc_open for classic filename = %s mode = %d "
-                      "ierr = %d", filename, mode, ierr));
-            }
-            break;
+    PLOG((1, "PIOc_set_defer_errors iosysid = %d enable = %d", iosysid, enable));
 
-#ifdef _PNETCDF
-        case PIO_IOTYPE_PNETCDF:
-            ierr = ncmpi_open(ios->io_comm, filename, mode, ios->info, &file->fh);
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-            // This should only be done with a file opened to append
-            if (ierr == PIO_NOERR && (mode & PIO_WRITE))
-            {
-                if (ios->iomaster == MPI_ROOT)
-                    PLOG((2, "%d Setting IO buffer %ld", __LINE__,
-                          pio_pnetcdf_buffer_size_limit));
-                ierr = ncmpi_buffer_attach(file->fh, pio_pnetcdf_buffer_size_limit);
-            }
-            PLOG((2, "ncmpi_open(%s) : fd = %d", filename, file->fh));
+    ios->defer_errors = enable;
 
-            if (!ierr)
-                ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_PNETCDF,
-                                         &nvars, &rec_var, &pio_type,
-                                         &pio_type_size, &mpi_type,
-                                         &mpi_type_size, &ndims);
-            break;
-#endif
+    return PIO_NOERR;
+}
 
-        default:
-            return pio_err(ios, file, PIO_EBADIOTYPE, __FILE__, __LINE__);
-        }
+/**
+ * Check the deferred errors of a file, see PIOc_set_defer_errors().
+ * If the file does not defer errors, this does nothing.
+ *
+ * This function must be called on all tasks of the IO system.
+ *
+ * @param ncid the ncid of the file.
+ * @return 0 if no task had an error since the last check, otherwise
+ * the error.
+ * @author Ed Hartnett
+ */
+int
+PIOc_check_errors(int ncid)
+{
+    file_desc_t *file;
+    int ret;
 
-        /* If the caller requested a retry, and we failed to open a
-           file due to an incompatible type of NetCDF, try it once
-           with just plain old basic NetCDF. */
-        if (retry)
-        {
-            PLOG((2, "retry error code ierr = %d io_rank %d", ierr, ios->io_rank));
-            if ((ierr == NC_ENOTNC || ierr == NC_EINVAL) && (file->iotype != PIO_IOTYPE_NETCDF))
-            {
-                if (ios->iomaster == MPI_ROOT)
-                    printf("PIO2 pio_file.c retry NETCDF\n");
+    PLOG((1, "PIOc_check_errors ncid = %d", ncid));
 
-                /* reset ierr on all tasks */
-                ierr = PIO_NOERR;
+    /* Get the file info. */
+    if ((ret = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
 
-                /* reset file markers for NETCDF on all tasks */
-                file->iotype = PIO_IOTYPE_NETCDF;
+    if (!file->defer_errors)
+        return PIO_NOERR;
 
-                /* open netcdf file serially on main task */
-                if (ios->io_rank == 0)
-                {
-                    ierr = nc_open(filename, mode, &file->fh);
-                    if (ierr == PIO_NOERR)
-                        ierr = inq_file_metadata(file, file->fh, PIO_IOTYPE_NETCDF,
-                                                 &nvars, &rec_var, &pio_type,
-                                                 &pio_type_size, &mpi_type,
-                                                 &mpi_type_size, &ndims);
-                }
-                else
-                    file->do_io = 0;
-            }
-            PLOG((2, "retry nc_open(%s) : fd = %d, iotype = %d, do_io = %d, ierr = %d",
-                  filename, file->fh, file->iotype, file->do_io, ierr));
-        }
-    }
+    return check_netcdf_sync(file, PIO_NOERR, __FILE__, __LINE__);
+}
 
-    /* Broadcast and check the return code. */
-    if (ios->ioroot == ios->union_rank)
-        PLOG((2, "Bcasting error code ierr %d ios->ioroot %d ios->my_comm %d",
-              ierr, ios->ioroot, ios->my_comm));
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    PLOG((2, "Bcast openfile_retry error code ierr = %d", ierr));
+/**
+ * Turn on or off printing the I/O statistics of each file of the IO
+ * system when it is closed. The counters are summed, and the times
+ * are the maximum, over the tasks of the IO system (with async, over
+ * the computation tasks), and printed by the first of them.
+ *
+ * This function must be called on all tasks of the IO system, with
+ * the same value.
+ *
+ * @param iosysid the IO system ID.
+ * @param enable true to print the statistics at PIOc_closefile(),
+ * false to not (the default).
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+PIOc_set_stats_report(int iosysid, bool enable)
+{
+    iosystem_desc_t *ios;
 
-    /* If there was an error, free allocated memory and deal with the error. */
-    if (ierr)
-    {
-        free(file);
-        return check_netcdf2(ios, NULL, ierr, __FILE__, __LINE__);
-    }
+    PLOG((1, "PIOc_set_stats_report iosysid = %d enable = %d", iosysid, enable));
 
-    /* Broadcast writability to all tasks. */
-    if ((mpierr = MPI_Bcast(&file->writable, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Broadcast some values to all tasks from io root. */
-    if (ios->async)
-    {
-        PLOG((3, "open bcasting pio_next_ncid %d ios->ioroot %d", pio_next_ncid, ios->ioroot));
-        if ((mpierr = MPI_Bcast(&pio_next_ncid, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    }
+    ios->stats_report = enable;
 
-    if ((mpierr = MPI_Bcast(&nvars, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
+    return PIO_NOERR;
+}
 
-    /* Non io tasks need to allocate to store info about variables. */
-    if (nvars && !rec_var)
-    {
-        if (!(rec_var = malloc(nvars * sizeof(int))))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-        if (!(pio_type = malloc(nvars * sizeof(int))))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-        if (!(pio_type_size = malloc(nvars * sizeof(int))))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-        if (!(mpi_type = malloc(nvars * sizeof(MPI_Datatype))))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-        if (!(mpi_type_size = malloc(nvars * sizeof(int))))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-        if (!(ndims = malloc(nvars * sizeof(int))))
-            return pio_err(ios, file, PIO_ENOMEM, __FILE__, __LINE__);
-    }
-    if (nvars)
-    {
-        if ((mpierr = MPI_Bcast(rec_var, nvars, MPI_INT, ios->ioroot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(pio_type, nvars, MPI_INT, ios->ioroot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(pio_type_size, nvars, MPI_INT, ios->ioroot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(mpi_type, nvars*(int)(sizeof(MPI_Datatype)/sizeof(int)), MPI_INT, ios->ioroot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(mpi_type_size, nvars, MPI_INT, ios->ioroot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-        if ((mpierr = MPI_Bcast(ndims, nvars, MPI_INT, ios->ioroot, ios->my_comm)))
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    }
+/**
+ * Add the statistics of a darray write or read, done by an IO task,
+ * to a file and its decomposition.
+ *
+ * @param file pointer to the file info.
+ * @param iodesc pointer to the decomposition info.
+ * @param write true for a write, false for a read.
+ * @param fill true for a write of the fill values of the holes, which
+ * adds to the bytes and regions written, but is not a darray write.
+ * @param nvars the number of vars written or read.
+ * @param llen the number of elements of each var in the IO buffer.
+ * @param nregions the number of regions of the file accessed.
+ * @param start the MPI_Wtime() at the start of the access.
+ * @author Ed Hartnett
+ */
+void
+pio_stats_io(file_desc_t *file, io_desc_t *iodesc, bool write, bool fill, int nvars,
+             PIO_Offset llen, int nregions, double start)
+{
+    PIO_Offset bytes = llen * nvars * iodesc->mpitype_size;
+    double elapsed = MPI_Wtime() - start;
 
-    /* With the netCDF integration layer, the ncid is assigned for PIO
-     * by the netCDF dispatch layer code. So it is passed in. In
-     * normal PIO operation, the ncid is generated here. */
-#ifdef NETCDF_INTEGRATION
-    if (use_ext_ncid)
+    if (write)
     {
-        /* The ncid was assigned on the computational
-         * processors. Change the ncid to one that I/O and
-         * computational components can agree on. */
-        file->pio_ncid = pio_next_ncid++;
-        if ((ierr = nc4_file_change_ncid(*ncidp, file->pio_ncid)))
-            return pio_err(NULL, file, ierr, __FILE__, __LINE__);
-        file->pio_ncid = file->pio_ncid << ID_SHIFT;
-        file->ncint_file++;
-        PLOG((2, "changed ncid to file->pio_ncid = %d", file->pio_ncid));
+        if (!fill)
+            pio_stats_add(file, iodesc, nwrites, 1);
+        pio_stats_add(file, iodesc, bytes_written, bytes);
+        pio_stats_add(file, iodesc, write_time, elapsed);
     }
     else
-#endif /* NETCDF_INTEGRATION */
     {
-        /* Create the ncid that the user will see. This is necessary
-         * because otherwise ncids will be reused if files are opened
-         * on multiple iosystems. */
-        file->pio_ncid = pio_next_ncid++;
-
-        /* Return the PIO ncid to the user. */
-        *ncidp = file->pio_ncid;
+        pio_stats_add(file, iodesc, nreads, 1);
+        pio_stats_add(file, iodesc, bytes_read, bytes);
+        pio_stats_add(file, iodesc, read_time, elapsed);
     }
+    pio_stats_add(file, iodesc, nregions, nregions);
+}
 
-    /* Add this file to the list of currently open files. */
-    pio_add_to_file_list(file);
+/**
+ * Print the I/O statistics of a file, summed (and for the times, the
+ * maximum) over the tasks of ios->my_comm. Called from
+ * PIOc_closefile() on those tasks when PIOc_set_stats_report() is
+ * on. With async, this is the computation tasks, on which the
+ * setting is made.
+ *
+ * @param file pointer to the file info.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+pio_report_file_stats(file_desc_t *file)
+{
+    iosystem_desc_t *ios = file->iosystem;
+    pio_stats_t *s = &file->stats;
+    PIO_Offset count[9] = {s->comp2io_bytes, s->io2comp_bytes, s->bytes_written,
+                           s->bytes_read, s->nregions, s->nwrites, s->nreads,
+                           s->nflushes, s->nwaits};
+    double time[4] = {s->rearrange_time, s->write_time, s->read_time, s->wait_time};
+    PIO_Offset count_sum[9];
+    double time_max[4];
+    int my_rank;
+    int mpierr;
 
-    /* Add info about the variables to the file_desc_t struct. */
-    for (int v = 0; v < nvars; v++)
-        if ((ierr = add_to_varlist(v, rec_var[v], pio_type[v], pio_type_size[v],
-                                   mpi_type[v], mpi_type_size[v], ndims[v],
-                                   &file->varlist)))
-            return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
-    file->nvars = nvars;
+    if ((mpierr = MPI_Comm_rank(ios->my_comm, &my_rank)))
+        return check_mpi(ios, file, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Reduce(count, count_sum, 9, MPI_OFFSET, MPI_SUM, 0, ios->my_comm)))
+        return check_mpi(ios, file, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Reduce(time, time_max, 4, MPI_DOUBLE, MPI_MAX, 0, ios->my_comm)))
+        return check_mpi(ios, file, mpierr, __FILE__, __LINE__);
 
-    /* Free resources. */
-    if (nvars)
-    {
-        if (rec_var)
-            free(rec_var);
-        if (pio_type)
-            free(pio_type);
-        if (pio_type_size)
-            free(pio_type_size);
-        if (mpi_type)
-            free(mpi_type);
-        if (mpi_type_size)
-            free(mpi_type_size);
-        if (ndims)
-            free(ndims);
+    if (!my_rank)
+    {
+        printf("PIO stats of file %d: %lld writes, %lld reads, %lld regions, "
+               "%lld flushes, %lld waits\n", file->pio_ncid, (long long)count_sum[5],
+               (long long)count_sum[6], (long long)count_sum[4],
+               (long long)count_sum[7], (long long)count_sum[8]);
+        printf("PIO stats of file %d: bytes comp->io %lld io->comp %lld "
+               "written %lld read %lld\n", file->pio_ncid, (long long)count_sum[0],
+               (long long)count_sum[1], (long long)count_sum[2],
+               (long long)count_sum[3]);
+        printf("PIO stats of file %d: max time (s) rearrange %g write %g "
+               "read %g wait %g\n", file->pio_ncid, time_max[0], time_max[1],
+               time_max[2], time_max[3]);
     }
 
-#ifdef USE_MPE
-    pio_stop_mpe_log(OPEN, __func__);
-#endif /* USE_MPE */
-    PLOG((2, "Opened file %s file->pio_ncid = %d file->fh = %d ierr = %d",
-          filename, file->pio_ncid, file->fh, ierr));
-
-    return ierr;
+    return PIO_NOERR;
 }
 
 /**
- * Internal function to provide inq_type function for pnetcdf.
+ * Choose which computation tasks get the data read from
+ * non-distributed variables of a file with the PIOc_get_var*()
+ * functions. By default (PIO_READ_ALL) the data are broadcast to
+ * every task. With PIO_READ_ROOT, only the computation task root gets
+ * them, and the buf of the other tasks may be NULL. With
+ * PIO_READ_NODE, the first task of each node gets them, into a buffer
+ * from PIOc_alloc_node_buf(), so that the tasks of a node share one
+ * copy. The other tasks must pass a buf in the same node buffer, and
+ * can read the data when the function returns.
  *
- * @param ncid ignored because pnetcdf does not have user-defined
- * types.
- * @param xtype type to learn about.
- * @param name pointer that gets name of type. Ignored if NULL.
- * @param sizep pointer that gets size of type. Ignored if NULL.
- * @returns 0 on success, error code otherwise.
+ * Only PIO_READ_ALL can be used when async is in use. The delivery
+ * does not apply to attributes or to distributed arrays.
+ *
+ * This function must be called on all tasks, with the same values.
+ *
+ * @param ncid the ncid of the open file.
+ * @param delivery one of PIO_READ_DELIVERY.
+ * @param root the rank in the computation communicator of the task
+ * that gets the data with PIO_READ_ROOT. Ignored otherwise.
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
 int
-pioc_pnetcdf_inq_type(int ncid, nc_type xtype, char *name,
-                      PIO_Offset *sizep)
-{
-    int typelen;
-
-    switch (xtype)
-    {
-    case NC_UBYTE:
-    case NC_BYTE:
-    case NC_CHAR:
-        typelen = 1;
-        break;
-    case NC_SHORT:
-    case NC_USHORT:
-        typelen = 2;
-        break;
-    case NC_UINT:
-    case NC_INT:
-    case NC_FLOAT:
-        typelen = 4;
-        break;
-    case NC_UINT64:
-    case NC_INT64:
-    case NC_DOUBLE:
-        typelen = 8;
-        break;
-    default:
-        return PIO_EBADTYPE;
-    }
+PIOc_set_read_delivery(int ncid, int delivery, int root)
+{
+    iosystem_desc_t *ios;
+    file_desc_t *file;
+    int ierr;
 
-    /* If pointers were supplied, copy results. */
-    if (sizep)
-        *sizep = typelen;
-    if (name)
-        strcpy(name, "some type");
+    PLOG((1, "PIOc_set_read_delivery ncid = %d delivery = %d root = %d", ncid, delivery,
+          root));
+
+    /* Get the file info. */
+    if ((ierr = pio_get_file_open(ncid, &file)))
+        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
+    ios = file->iosystem;
+
+    /* Check inputs. */
+    if (delivery < PIO_READ_ALL || delivery > PIO_READ_NODE ||
+        (delivery != PIO_READ_ALL && ios->async) ||
+        (delivery == PIO_READ_ROOT && (root < 0 || root >= ios->num_comptasks)))
+        return pio_err(ios, file, PIO_EINVAL, __FILE__, __LINE__);
+
+    file->read_delivery = delivery;
+    file->read_root = root;
 
     return PIO_NOERR;
 }
 
 /**
- * This is an internal function that handles both PIOc_enddef and
- * PIOc_redef.
+ * Create the communicators used by PIO_READ_NODE, if they have not
+ * been created yet. This is collective over the computation tasks.
  *
- * @param ncid the ncid of the file to enddef or redef
- * @param is_enddef set to non-zero for enddef, 0 for redef.
- * @returns PIO_NOERR on success, error code on failure.
+ * @param ios pointer to the iosystem info.
+ * @return 0 on success, otherwise a PIO error code.
  * @author Ed Hartnett
  */
 int
-pioc_change_def(int ncid, int is_enddef)
+get_read_comms(iosystem_desc_t *ios)
 {
-    iosystem_desc_t *ios;  /* Pointer to io system information. */
-    file_desc_t *file;     /* Pointer to file information. */
-    int ierr = PIO_NOERR;  /* Return code from function calls. */
-    int mpierr = MPI_SUCCESS, mpierr2;  /* Return code from MPI functions. */
-
-    PLOG((2, "pioc_change_def ncid = %d is_enddef = %d", ncid, is_enddef));
+    int node_rank;
+    bool leader;
+    int mpierr;
 
-    /* Find the info about this file. When I check the return code
-     * here, some tests fail. ???*/
-    if ((ierr = pio_get_file(ncid, &file)))
-        return pio_err(NULL, NULL, ierr, __FILE__, __LINE__);
-    ios = file->iosystem;
+    if (ios->read_comms)
+        return PIO_NOERR;
 
-    /* If async is in use, and this is not an IO task, bcast the parameters. */
-    if (ios->async)
-    {
-        if (!ios->ioproc)
-        {
-            int msg = is_enddef ? PIO_MSG_ENDDEF : PIO_MSG_REDEF;
-            if (ios->compmaster == MPI_ROOT)
-              {
-                PLOG((2, "pioc_change_def request sent"));
-                mpierr = MPI_Send(&msg, 1, MPI_INT, ios->ioroot, 1, ios->union_comm);
-              }
-            if (!mpierr)
-                mpierr = MPI_Bcast(&ncid, 1, MPI_INT, ios->compmaster, ios->intercomm);
-            PLOG((3, "pioc_change_def ncid = %d mpierr = %d", ncid, mpierr));
-        }
+    if ((mpierr = MPI_Comm_split_type(ios->comp_comm, MPI_COMM_TYPE_SHARED, ios->comp_rank,
+                                      MPI_INFO_NULL, &ios->read_node_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(ios->read_node_comm, &node_rank)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
 
-        /* Handle MPI errors. */
-        PLOG((3, "pioc_change_def handling MPI errors my_comm=%d", ios->my_comm));
-        if ((mpierr2 = MPI_Bcast(&mpierr, 1, MPI_INT, ios->comproot, ios->my_comm)))
-            check_mpi(NULL, file, mpierr2, __FILE__, __LINE__);
-        if (mpierr)
-            return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    }
+    /* The IO root task is rank 0 of the node leaders. */
+    leader = !node_rank || ios->iomaster == MPI_ROOT;
+    if ((mpierr = MPI_Comm_split(ios->comp_comm, leader ? 0 : MPI_UNDEFINED,
+                                 ios->iomaster == MPI_ROOT ? 0 : ios->comp_rank + 1,
+                                 &ios->read_leader_comm)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    ios->read_comms = true;
 
-    /* If this is an IO task, then call the netCDF function. */
-    PLOG((3, "pioc_change_def ios->ioproc = %d", ios->ioproc));
-    if (ios->ioproc)
-    {
-        PLOG((3, "pioc_change_def calling netcdf function file->fh = %d file->do_io = %d iotype = %d",
-              file->fh, file->do_io, file->iotype));
-#ifdef _PNETCDF
-        if (file->iotype == PIO_IOTYPE_PNETCDF)
-        {
-            if (is_enddef)
-                ierr = ncmpi_enddef(file->fh);
-            else
-                ierr = ncmpi_redef(file->fh);
-        }
-#endif /* _PNETCDF */
-        if (file->iotype != PIO_IOTYPE_PNETCDF && file->do_io)
-        {
-            if (is_enddef)
-            {
-                PLOG((3, "pioc_change_def calling nc_enddef file->fh = %d", file->fh));
-                ierr = nc_enddef(file->fh);
-            }
-            else
-                ierr = nc_redef(file->fh);
-        }
-    }
+    return PIO_NOERR;
+}
 
-    /* Broadcast and check the return code. */
-    PLOG((3, "pioc_change_def bcasting return code ierr = %d", ierr));
-    if ((mpierr = MPI_Bcast(&ierr, 1, MPI_INT, ios->ioroot, ios->my_comm)))
-        return check_mpi(NULL, file, mpierr, __FILE__, __LINE__);
-    if (ierr)
-        return check_netcdf(file, ierr, __FILE__, __LINE__);
-    PLOG((3, "pioc_change_def succeeded"));
+/**
+ * Find the node buffer that contains an address.
+ *
+ * @param ios pointer to the iosystem info.
+ * @param buf the address.
+ * @return pointer to the node buffer, or NULL if buf is not in one.
+ * @author Ed Hartnett
+ */
+pio_node_buf_t *
+find_node_buf(iosystem_desc_t *ios, const void *buf)
+{
+    for (pio_node_buf_t *nb = ios->node_bufs; nb; nb = nb->next)
+        if ((const char *)buf >= (char *)nb->buf &&
+            (const char *)buf < (char *)nb->buf + nb->size)
+            return nb;
 
-    return ierr;
+    return NULL;
 }
 
 /**
- * Check whether an IO type is valid for the build.
+ * Allocate a buffer shared by the computation tasks of each node, to
+ * read data into with PIO_READ_NODE (see PIOc_set_read_delivery()).
+ * The memory is allocated once on each node, in an MPI shared memory
+ * window. Every task gets the address of its node's buffer.
  *
- * @param iotype the IO type to check
- * @returns 0 if valid, non-zero otherwise.
- * @author Jim Edwards
+ * This function must be called on all computation tasks, with the
+ * same size. It can't be used when async is in use.
+ *
+ * @param iosysid the IO system ID.
+ * @param size the size of the buffer in bytes.
+ * @param bufp pointer that gets the address of the buffer.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
  */
 int
-iotype_is_valid(int iotype)
+PIOc_alloc_node_buf(int iosysid, PIO_Offset size, void **bufp)
 {
-    /* Assume it's not valid. */
-    int ret = 0;
+    iosystem_desc_t *ios;
+    pio_node_buf_t *nb;
+    void *base;
+    int node_rank;
+    int ierr;
+    int mpierr;
 
-    /* All builds include netCDF. */
-    if (iotype == PIO_IOTYPE_NETCDF)
-        ret++;
+    PLOG((1, "PIOc_alloc_node_buf iosysid = %d size = %lld", iosysid, size));
 
-    /* Some builds include netCDF-4. */
-#ifdef _NETCDF4
-    if (iotype == PIO_IOTYPE_NETCDF4C || iotype == PIO_IOTYPE_NETCDF4P)
-        ret++;
-#endif /* _NETCDF4 */
+    /* Get the IO system info. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
+    if (ios->async || size < 0 || !bufp)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
 
-    /* Some builds include pnetcdf. */
-    if (iotype == PIO_IOTYPE_PNETCDF)
-        ret++;
-#ifdef _PNETCDF
-#endif /* _PNETCDF */
+    if ((ierr = get_read_comms(ios)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_rank(ios->read_node_comm, &node_rank)))
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
 
-    return ret;
+    if (!(nb = calloc(1, sizeof(pio_node_buf_t))))
+        return pio_err(ios, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    nb->size = size;
+
+    /* The first task of the node has the memory, the others map
+     * it. */
+    mpierr = MPI_Win_allocate_shared(node_rank ? 0 : size, 1, MPI_INFO_NULL,
+                                     ios->read_node_comm, &base, &nb->win);
+    if (!mpierr && node_rank)
+    {
+        MPI_Aint wsize;
+        int disp_unit;
+
+        mpierr = MPI_Win_shared_query(nb->win, 0, &wsize, &disp_unit, &base);
+    }
+    if (!mpierr)
+        mpierr = MPI_Win_lock_all(MPI_MODE_NOCHECK, nb->win);
+    if (mpierr)
+    {
+        free(nb);
+        return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+    nb->buf = base;
+
+    /* Add it to the list of the iosystem. */
+    nb->next = ios->node_bufs;
+    ios->node_bufs = nb;
+    *bufp = base;
+
+    return PIO_NOERR;
 }
 
 /**
- * Set the rearranger options associated with an iosystem
+ * Free a buffer allocated with PIOc_alloc_node_buf(). This function
+ * must be called on all computation tasks.
  *
- * @param iosysid a defined pio system descriptor.
- * @param comm_type Type of communication (pt2pt/coll) used
- * by the rearranger. See PIO_REARR_COMM_TYPE for more detail.
- * Possible values are :
- * PIO_REARR_COMM_P2P (Point to point communication)
- * PIO_REARR_COMM_COLL (Collective communication)
- * @param fcd Flow control direction for the rearranger.
- * See PIO_REARR_COMM_FC_DIR for more detail.
- * Possible values are :
- * PIO_REARR_COMM_FC_2D_ENABLE : Enable flow control from
- * compute processes to io processes and vice versa
- * PIO_REARR_COMM_FC_1D_COMP2IO : Enable flow control from
- * compute processes to io processes (only)
- * PIO_REARR_COMM_FC_1D_IO2COMP : Enable flow control from
- * io processes to compute processes (only)
- * PIO_REARR_COMM_FC_2D_DISABLE : Disable flow control from
- * compute processes to io processes and vice versa.
- * @param enable_hs_c2i Enable handshake while rearranging
- * data, from compute to io processes
- * @param enable_isend_c2i Enable isends while rearranging
- * data, from compute to io processes
- * @param max_pend_req_c2i Maximum pending requests during
- * data rearragment from compute processes to io processes
- * @param enable_hs_i2c Enable handshake while rearranging
- * data, from io to compute processes
- * @param enable_isend_i2c Enable isends while rearranging
- * data, from io to compute processes
- * @param max_pend_req_i2c Maximum pending requests during
- * data rearragment from io processes to compute processes
+ * @param iosysid the IO system ID.
+ * @param buf the address of the buffer.
  * @return 0 on success, otherwise a PIO error code.
- * @author Jayesh Krishna
+ * @author Ed Hartnett
  */
 int
-PIOc_set_rearr_opts(int iosysid, int comm_type, int fcd, bool enable_hs_c2i,
-                    bool enable_isend_c2i, int max_pend_req_c2i,
-                    bool enable_hs_i2c, bool enable_isend_i2c,
-                    int max_pend_req_i2c)
+PIOc_free_node_buf(int iosysid, void *buf)
 {
     iosystem_desc_t *ios;
-    rearr_opt_t user_rearr_opts = {
-        comm_type, fcd,
-        {enable_hs_c2i,enable_isend_c2i, max_pend_req_c2i},
-        {enable_hs_i2c, enable_isend_i2c, max_pend_req_i2c}
-    };
+    pio_node_buf_t **nbp;
+    int mpierr;
 
-    /* Check inputs. */
-    if ((comm_type != PIO_REARR_COMM_P2P && comm_type != PIO_REARR_COMM_FC_1D_COMP2IO) ||
-        (fcd < 0 || fcd > PIO_REARR_COMM_FC_2D_DISABLE) ||
-        (max_pend_req_c2i != PIO_REARR_COMM_UNLIMITED_PEND_REQ && max_pend_req_c2i < 0) ||
-        (max_pend_req_i2c != PIO_REARR_COMM_UNLIMITED_PEND_REQ && max_pend_req_i2c < 0))
-        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+    PLOG((1, "PIOc_free_node_buf iosysid = %d", iosysid));
 
     /* Get the IO system info. */
     if (!(ios = pio_get_iosystem_from_id(iosysid)))
         return pio_err(NULL, NULL, PIO_EBADID, __FILE__, __LINE__);
 
-    /* Set the options. */
-    ios->rearr_opts = user_rearr_opts;
+    /* Find the buffer. */
+    for (nbp = &ios->node_bufs; *nbp && (*nbp)->buf != buf; nbp = &(*nbp)->next)
+        ;
+    if (!*nbp)
+        return pio_err(ios, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    {
+        pio_node_buf_t *nb = *nbp;
+
+        *nbp = nb->next;
+        mpierr = MPI_Win_unlock_all(nb->win);
+        if (!mpierr)
+            mpierr = MPI_Win_free(&nb->win);
+        free(nb);
+        if (mpierr)
+            return check_mpi(ios, NULL, mpierr, __FILE__, __LINE__);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Free the node buffers and the communicators used by PIO_READ_NODE.
+ * Called from PIOc_free_iosystem().
+ *
+ * @param ios pointer to the iosystem info.
+ * @return 0 on success, otherwise a PIO error code.
+ * @author Ed Hartnett
+ */
+int
+free_read_comms(iosystem_desc_t *ios)
+{
+    int ierr;
+
+    while (ios->node_bufs)
+        if ((ierr = PIOc_free_node_buf(ios->iosysid, ios->node_bufs->buf)))
+            return ierr;
+
+    if (ios->read_comms)
+    {
+        MPI_Comm_free(&ios->read_node_comm);
+        if (ios->read_leader_comm != MPI_COMM_NULL)
+            MPI_Comm_free(&ios->read_leader_comm);
+        ios->read_comms = false;
+    }
 
     return PIO_NOERR;
 }
@@ -3247,121 +7757,38 @@ determine_procs(int num_io_procs, int component_count, int *num_procs_per_comp,
 }
 
 /**
- * Used in check_compmap to sort the compmap in accending order.
- * 
- * @param a pointer to an offset
- * @param b pointer to another offset
- * @returns 0 if offsets are the same or if either pointer is NULL
- * @author Jim Edwards
- */
-
-int offsetsort(const void *a,const void *b)
-{
-    return (*(PIO_Offset *)a - *(PIO_Offset *)b);
-}
-
-/**
- * check_compmap gathers the entire compmap to comp task 0, sorts it into accending order
- * then looks for repeated values > 0.  If any repeated values are found the iodesc is marked 
- * read only.
+ * Find whether a decomposition map has repeated values, and so may
+ * only be used for reading, since it doesn't make sense to write a
+ * single value from more than one location. iodesc->readonly is set
+ * on the computation tasks.
+ *
+ * The check is exact and the global map is never gathered on one
+ * task: the map is sorted in parallel over the computation tasks
+ * with run_unique_check(). Values less than 1 (holes) may repeat.
  *
  * @param ios pointer to the iosystem_desc_t struct.
  * @param iodesc a pointer to the io_desc_t struct.
  * @param compmap a 1 based array of offsets into the array record on
- * file. A 0 in this array indicates a value which should not be
- * transfered.
- * @returns True if a repeated value is found, False otherwise.
- * @author Jim Edwards
+ * file, of length iodesc->maplen. A 0 in this array indicates a value
+ * which should not be transfered.
+ * @returns 0 for success, error code otherwise.
+ * @author Jim Edwards, Ed Hartnett
  */
-
-
-bool check_compmap(iosystem_desc_t *ios, io_desc_t *iodesc,const PIO_Offset *compmap)
+int
+check_compmap(iosystem_desc_t *ios, io_desc_t *iodesc, const PIO_Offset *compmap)
 {
     int ierr;
-    bool readonly = 0;
 
-    if(ios->compproc) 
-    {
-#ifdef OLDWAY
-        int *gmaplen;
-        if(ios->compmaster == MPI_ROOT)
-            gmaplen = malloc(ios->num_comptasks * sizeof(int));
-        else
-            gmaplen = NULL;
-#else
-        int gmaplen;
-#endif
-        /* First gather the non-zero array lengths from all compute tasks */
-        int lmaplen=0;
-        PIO_Offset lmax=0, lmin=LONG_MAX;
-        PIO_Offset gmax, gmin;
-        for(int i=0; i < iodesc->maplen; i++)
-        {
-            if(compmap[i] > 0)
-            {
-                lmaplen++;
-                lmax = (compmap[i] > lmax) ? compmap[i] : lmax;
-                lmin = (compmap[i] < lmin) ? compmap[i] : lmin;
-            }
-        }
-        if ((ierr = MPI_Allreduce(&lmaplen, &gmaplen, 1, MPI_INT, MPI_SUM, ios->comp_comm)))
-            return check_mpi(ios, NULL, ierr, __FILE__,__LINE__);
-        if ((ierr = MPI_Allreduce(&lmax, &gmax, 1, MPI_LONG, MPI_MAX, ios->comp_comm)))
-            return check_mpi(ios, NULL, ierr, __FILE__,__LINE__);
-        if ((ierr = MPI_Allreduce(&lmin, &gmin, 1, MPI_LONG, MPI_MIN, ios->comp_comm)))
-            return check_mpi(ios, NULL, ierr, __FILE__,__LINE__);
-        /* This is not an exhaustive condition, but is suffienct for most cases */
-        if((gmax - gmin + 1) < gmaplen)
-            readonly = 1;
-
-#ifdef OLDWAY
-        if ((ierr = MPI_Gather(&(iodesc->maplen), 1, MPI_INT, gmaplen, 1, MPI_INT, 0, ios->comp_comm)))
-            return check_mpi(ios, NULL, ierr, __FILE__,__LINE__);
-
-        int *displs;
-        int gcompmaplen=0;
-        int *gcompmaps;
-        if(ios->compmaster == MPI_ROOT)
-        {
-            displs = malloc(ios->num_comptasks * sizeof(int));
-            displs[0] = 0;
-            for(int i=1; i<ios->num_comptasks; i++)
-            {
-                displs[i] = displs[i-1] + gmaplen[i-1];
-            }
-            gcompmaplen = displs[ios->num_comptasks-1] + gmaplen[ios->num_comptasks-1];
-            gcompmaps = malloc(gcompmaplen * sizeof(PIO_Offset)); 
-//            printf("gcompmaplen %d\n",gcompmaplen);
-//            for(int i=0;i<ios->num_comptasks; i++)
-//                printf("gmaplen=%d displs[%d]=%d\n",gmaplen[i], i,displs[i]);
-        }
+    pioassert(ios && iodesc && (compmap || !iodesc->maplen), "invalid input",
+              __FILE__, __LINE__);
 
-        /* next gather the compmap arrays */
-        if ((ierr = MPI_Gatherv(compmap, iodesc->maplen, MPI_OFFSET, gcompmaps, gmaplen, displs, MPI_OFFSET, 0, ios->comp_comm)))
-            return check_mpi(ios, NULL, ierr, __FILE__,__LINE__);
+    if (!ios->compproc)
+        return PIO_NOERR;
 
-        if(ios->compmaster == MPI_ROOT)
-        {
-            /* sort */
-            qsort(gcompmaps, gcompmaplen, sizeof(MPI_OFFSET), offsetsort);
-            /* look for duplicate values > 0 (0 dups are okay) */
-            for(int i=1; i < gcompmaplen; i++)
-            {
-                if(gcompmaps[i] > 0 && gcompmaps[i] == gcompmaps[i-1])
-                {
-                    readonly = 1;
-                    break;
-                }
-            }
-            free(gmaplen);
-            free(displs);
-            free(gcompmaps);
-        }
-        
-    }
-    MPI_Bcast(&readonly, 1, MPI_CHAR, ios->comproot, ios->my_comm);
-#else
-    }
-#endif
-    return readonly;
+    if ((ierr = run_unique_check(ios->comp_comm, (size_t)iodesc->maplen, (PIO_Offset *)compmap,
+                                 &iodesc->readonly)))
+        return pio_err(ios, NULL, ierr, __FILE__, __LINE__);
+    PLOG((2, "check_compmap readonly = %d", iodesc->readonly));
+
+    return PIO_NOERR;
 }
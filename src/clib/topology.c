@@ -1,363 +1,208 @@
-#if defined(BGQDONT)
-
+/**
+ * @file
+ * Portable placement of the IO tasks using the node layout of the
+ * communicator. The tasks which share memory (found with
+ * MPI_Comm_split_type()) are taken to be on the same node, and the
+ * IO tasks are spread over the nodes, rather than being chosen with
+ * a fixed stride over the ranks.
+ *
+ * This replaces the old Blue Gene/Q only code, which needed the
+ * MPIX and kernel personality calls.
+ *
+ * @author Jim Edwards, Ed Hartnett
+ */
+#include <config.h>
 #include <pio.h>
 #include <pio_internal.h>
 
-#include <math.h>
-
-#include <kernel/process.h>
-#include <kernel/location.h>
-#include <firmware/include/personality.h>
-#include <mpix.h>
-
-#define   Personality                    Personality_t
-
-int rank;
-int np;
-int my_name_len;
-char my_name[255];
-
-void identity(const MPI_Comm comm, int *iotask)
-{
-    MPIX_Hardware_t hw;
-    char message[100];
-    /* Number of MPI tasks per Pset */
-    int coreId;
-    int *TasksPerPset;
-    int *tmp;
-    int i,ierr;
-    Personality_t pers;
-
-    MPI_Comm_rank(comm,&rank);
-    MPI_Comm_size(comm,&np);
-    MPI_Get_processor_name(my_name, &my_name_len);
-
-
-    MPIX_Hardware(&hw);
-
-    Kernel_GetPersonality(&pers, sizeof(pers));
-
-    int numIONodes,numPsets,numNodesInPset,rankInPset;
-    int numpsets, psetID, psetsize, psetrank;
-
-    bgq_pset_info (comm, &numpsets, &psetID, &psetsize, &psetrank);
-
-    numIONodes = numpsets;
-    numNodesInPset = psetsize;
-    rankInPset = rank;
-    numPsets = numpsets;
-
-    if(rank == 0) { printf("number of IO nodes in block: %i \n",numIONodes);}
-    if(rank == 0) { printf("number of Psets in block : %i \n",numPsets);}
-    if(rank == 0) { printf("number of compute nodes in Pset: %i \n",numNodesInPset);}
-
-    int psetNum;
-    psetNum = psetID;
-
-#ifdef DEBUG
-    if((*iotask)>0) {
-        printf( "%04i (%-50s %s) %i yes\n", rank, my_name, message, psetNum );
-    } else {
-        printf( "%04i (%-50s %s) %i --\n", rank, my_name, message, psetNum);
-    }
-    printf("MPI task %6i is rank %3i in Pset: %3i \n",rank, rankInPset,psetNum);
-#endif
-    /* Determine which core on node....  I don't want to put more than one io-task per node */
-    coreId = Kernel_PhysicalProcessorID ();
-
-    TasksPerPset = malloc(numPsets*sizeof(int));
-    tmp = malloc(numPsets*sizeof(int));
-    for(i=0;i<numPsets;i++) tmp[i]=0;
-    if(coreId == 0) {tmp[psetNum]=1;}
-    ierr = MPI_Allreduce(tmp,TasksPerPset,numPsets,MPI_INT,MPI_SUM,comm);
-    if(rank == 0) {
-        for(i=0;i<numPsets;i++) {printf("Pset: %3i has %3i nodes \n",i,TasksPerPset[i]);}
-    }
-    free(tmp);
-    free(TasksPerPset);
-}
-
-void determineiotasks(const MPI_Comm comm, int *numiotasks,int *base, int *stride, int *rearr,
-                      bool *iamIOtask)
+/**
+ * Find the node of each task in a communicator. The nodes are
+ * numbered from 0 in the order of their lowest rank. This is
+ * collective over comm.
+ *
+ * @param comm the communicator.
+ * @param nnodes pointer that gets the number of nodes.
+ * @param node_of array, with one element for each task in comm, that
+ * gets the node number of each task.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_node_map(MPI_Comm comm, int *nnodes, int *node_of)
 {
-
-/*
-
-  Returns the correct numiotasks and the flag iamIOtask
-
-  Some concepts:
-
-  processor set:     A group of processors on the Blue Gene system which have
-  one or more IO processor (Pset)
-
-  IO-node:           A special Blue Gene node dedicated to performing IO.  There
-  are one or more per processor set
-
-  IO-client:         This is software concept.  This refers to the MPI task
-  which performs IO for the PIO library
-*/
-    int psetNum;
-    int coreId;
-    int iam;
-    int task_count;
-
-    MPIX_Hardware_t hw;
-    /*  Get the personality  */
-    Personality_t pers;
-
-    MPIX_Hardware(&hw);
-
-    MPI_Comm_rank(comm, &rank);
-
-    MPI_Comm_size(comm, &np);
-
-    MPI_Get_processor_name(my_name, &my_name_len);
-
-
-
-    /* printf("Determine io tasks: proc %i: tasks= %i numiotasks=%i stride= %i \n", rank, np, (*numiotasks), (*stride)); */
-
-    if((*rearr) > 0) {
-
-
-        Kernel_GetPersonality(&pers, sizeof(pers));
-
-        int numIONodes, numPsets, numNodesInPset, rankInPset;
-        int numiotasks_per_node, remainder = 0, numIONodes_per_pset;
-        int lstride;
-
-        /* Number of computational nodes in processor set */
-
-        int numpsets, psetID, psetsize, psetrank;
-        bgq_pset_info (comm,&numpsets, &psetID, &psetsize, &psetrank);
-        numIONodes = numpsets;
-        numNodesInPset = psetsize;
-
-        /*     printf("Determine io tasks: me %i : nodes in pset= %i ionodes = %i\n", rank, numNodesInPset, numIONodes); */
-
-        if((*numiotasks) < 0 ) {
-            /* negative numiotasks value indicates that this is the number per IO-node */
-            (*numiotasks) = - (*numiotasks);
-            if((*numiotasks) > numNodesInPset) {
-                numiotasks_per_node = numNodesInPset;
-            } else  {
-                numiotasks_per_node = (*numiotasks);
-            }
-            remainder = 0;
-        } else if ((*numiotasks) > 0 ) {
-            /* balance the number of iotasks to number of IO nodes */
-            numiotasks_per_node = floor((float)(*numiotasks)/ (float) numIONodes);
-            /* put a minumum here so that we have a chance  - though this may be too low */
-            if (numiotasks_per_node < 1) {
-                numiotasks_per_node = 1;
-                *numiotasks = numIONodes;
-            }
-            remainder = (*numiotasks) - numiotasks_per_node * numIONodes;
-        } else if ((*numiotasks) == 0 ) {
-            if((*stride) > 0) {
-                numiotasks_per_node = numNodesInPset/(*stride);
-                if (numiotasks_per_node < 1) {
-                    numiotasks_per_node = 1;
-                    *numiotasks = numIONodes;
-                }
-            } else {
-                numiotasks_per_node = 8;  /* default number of IO-client per IO-node is not otherwise specificied */
-            }
-            remainder = 0;
-        }
-
-        /* number of IO nodes with a larger number of io-client per io-node */
-        if(remainder > 0) {
-            if(rank ==0) {printf("Unbalanced IO-configuration: %i IO-nodes have %i IO-clients : %i IO-nodes have %i IO-clients \n",
-                                 remainder, numiotasks_per_node+1, numIONodes-remainder,numiotasks_per_node);}
-            lstride = min(np,floor((float)numNodesInPset/(float)(numiotasks_per_node+1)));
-        } else {
-            if(rank == 0) {
-                printf("Balanced IO-configuration: %i IO-nodes have %i IO-clients\n",numIONodes-remainder, numiotasks_per_node);
-            }
-            lstride = min(np,floor((float)numNodesInPset/(float)numiotasks_per_node));
-        }
-
-        /* Number of processor sets */
-        numPsets = numpsets;
-
-        /* number of IO nodes in processor set (I need to add
-           code to deal with the case where numIONodes_per_pset != 1 works
-           correctly) */
-        numIONodes_per_pset = numIONodes/numPsets;
-
-        /* Determine which core on node....  I don't want to put more than one io-task per node */
-        coreId = Kernel_PhysicalProcessorID ();
-
-        /* What is the rank of this node in the processor set */
-
-        psetNum = psetID;
-        rankInPset = psetrank;
-
-        /* printf("Pset #: %i has %i nodes in Pset; base = %i\n",psetNum,numNodesInPset, *base); */
-
-        (*iamIOtask) = false;   /* initialize to zero */
-
-        if (numiotasks_per_node == numNodesInPset)(*base) = 0;  /* Reset the base to 0 if we are using all tasks */
-
-
-        /* start stridding MPI tasks from base task */
-        iam = max(0,rankInPset-(*base));
-        if (iam >= 0)  {
-            /* mark tasks that will be IO-tasks  or IO-clients */
-            /*    printf("iam = %d lstride = %d coreID = %d\n",iam,lstride,coreId); */
-            if((iam % lstride == 0) && (coreId == 0) ) {  /* only io tasks indicated by stride and coreId = 0 */
-                if((iam/lstride) < numiotasks_per_node) {
-                    /* only set the first (numiotasks_per_node - 1) tasks */
-                    (*iamIOtask) = true;
-                } else if ((iam/lstride) == numiotasks_per_node) {
-                    /*  If there is an uneven number of io-clients to io-nodes
-                        allocate the first remainder - 1 processor sets to
-                        have a total of numiotasks_per_node */
-                    if(psetNum < remainder) {(*iamIOtask) = true;
-                    };
-                }
-            }
-            /*       printf("comm = %d iam = %d lstride = %d coreID = %d iamIOtask = %i \n",comm, iam,lstride,coreId,(*iamIOtask)); */
+    MPI_Comm node_comm;
+    MPI_Comm leader_comm;
+    int rank, size;
+    int node_rank;
+    int node = 0;
+    int mpierr;
+
+    pioassert(nnodes && node_of, "invalid input", __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Comm_rank(comm, &rank)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+    if ((mpierr = MPI_Comm_size(comm, &size)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* Group the tasks which share memory. */
+    if ((mpierr = MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                                      &node_comm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    /* The lowest rank on each node is its leader. Ordering the
+     * leaders by rank numbers the nodes. The communicators are freed
+     * even if this fails. */
+    if (!(mpierr = MPI_Comm_rank(node_comm, &node_rank)) &&
+        !(mpierr = MPI_Comm_split(comm, node_rank ? MPI_UNDEFINED : 0, rank, &leader_comm)))
+    {
+        if (leader_comm != MPI_COMM_NULL)
+        {
+            mpierr = MPI_Comm_rank(leader_comm, &node);
+            MPI_Comm_free(&leader_comm);
         }
-    }else{
-        /* We are not doing rearrangement.... so all tasks are io-tasks */
-        (*iamIOtask) = true;
+        if (!mpierr)
+            mpierr = MPI_Bcast(&node, 1, MPI_INT, 0, node_comm);
     }
+    MPI_Comm_free(&node_comm);
+    if (mpierr)
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
-    /*printf("comm = %d myrank = %i iotask = %i \n", comm, rank, (*iamIOtask));*/
-
-    /* now we need to correctly determine the numiotasks */
-    MPI_Allreduce(iamIOtask, &task_count, 1, MPI_INT, MPI_SUM, comm);
-
-    (*numiotasks) = task_count;
+    /* Every task learns the node of every other task. */
+    if ((mpierr = MPI_Allgather(&node, 1, MPI_INT, node_of, 1, MPI_INT, comm)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
 
+    *nnodes = 0;
+    for (int i = 0; i < size; i++)
+        if (node_of[i] + 1 > *nnodes)
+            *nnodes = node_of[i] + 1;
+    PLOG((2, "pio_node_map size = %d nnodes = %d", size, *nnodes));
 
+    return PIO_NOERR;
 }
 
-int bgq_ion_id (void)
-{
-    int iA,  iB,  iC,  iD,  iE;                /* The local node's coordinates  */
-    int nA,  nB,  nC,  nD,  nE;                /* Size of each torus dimension  */
-    int brA, brB, brC, brD, brE;               /* The bridge node's coordinates */
-    int io_node_route_id;
-
-    Personality_t personality;
-
-    Kernel_GetPersonality(&personality, sizeof(personality));
-
-    iA  = personality.Network_Config.Acoord;
-    iB  = personality.Network_Config.Bcoord;
-    iC  = personality.Network_Config.Ccoord;
-    iD  = personality.Network_Config.Dcoord;
-    iE  = personality.Network_Config.Ecoord;
-
-    nA  = personality.Network_Config.Anodes;
-    nB  = personality.Network_Config.Bnodes;
-    nC  = personality.Network_Config.Cnodes;
-    nD  = personality.Network_Config.Dnodes;
-    nE  = personality.Network_Config.Enodes;
-
-    brA = personality.Network_Config.cnBridge_A;
-    brB = personality.Network_Config.cnBridge_B;
-    brC = personality.Network_Config.cnBridge_C;
-    brD = personality.Network_Config.cnBridge_D;
-    brE = personality.Network_Config.cnBridge_E;
-
-/*
- * This is the bridge node, numbered in ABCDE order, E increments first.
- * It is considered the unique "io node route identifer" because each
- * bridge node only has one torus link to one io node.
+/**
+ * Choose the IO tasks using the node layout of a communicator.
+ *
+ * The IO tasks are dealt out to the nodes one at a time, so that
+ * every node gets one IO task before any node gets two. No node gets
+ * more than iotasks_per_node of them. Within a node the chosen tasks
+ * are spread evenly over the ranks of the node, so that with the
+ * usual block placement of ranks they land on different sockets
+ * (and so, usually, different NICs).
+ *
+ * This is collective over comm.
+ *
+ * @param comm the communicator the IO tasks are chosen from.
+ * @param num_iotasks the number of IO tasks wanted. If 0, then
+ * iotasks_per_node IO tasks are used on every node.
+ * @param iotasks_per_node the most IO tasks to put on any node. If
+ * 0, there is no limit.
+ * @param num_iotasksp pointer that gets the number of IO tasks.
+ * @param ioranksp pointer that gets an array, of length
+ * *num_iotasksp, of the ranks of the IO tasks in comm, in increasing
+ * order. Must be freed by the caller.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
  */
-
-    io_node_route_id = brE + brD*nE + brC*nD*nE + brB*nC*nD*nE + brA*nB*nC*nD*nE;
-
-    return io_node_route_id;
-
-}
-
-
-
-int bgq_pset_info (MPI_Comm comm, int* tot_pset, int* psetID, int* pset_size, int* rank_in_pset)
+int
+pio_topo_ioranks(MPI_Comm comm, int num_iotasks, int iotasks_per_node,
+                 int *num_iotasksp, int **ioranksp)
 {
-    MPI_Comm comp_comm, pset_comm, bridge_comm;
-    int comp_rank, status, key, bridge_root, tot_bridges, cur_pset, itr, t_buf;
-    int temp_id, rem_psets;
-    MPI_Status mpi_status;
-
-    MPI_Comm_rank (comm, &comp_rank);
-
-    status = MPI_Comm_dup ( comm, &comp_comm);
-    if ( MPI_SUCCESS != status)
+    int size;
+    int nnodes;
+    int *node_of;
+    int *node_size; /* Number of tasks on each node. */
+    int *node_cap;  /* Most IO tasks each node may have. */
+    int *node_nio;  /* Number of IO tasks chosen on each node. */
+    int *node_seen; /* Tasks of each node visited so far. */
+    int *ioranks;
+    int total = 0;
+    int n = 0;
+    int mpierr;
+    int ret;
+
+    pioassert(num_iotasksp && ioranksp, "invalid input", __FILE__, __LINE__);
+
+    if (num_iotasks < 0 || iotasks_per_node < 0 || (!num_iotasks && !iotasks_per_node))
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
+
+    if ((mpierr = MPI_Comm_size(comm, &size)))
+        return check_mpi(NULL, NULL, mpierr, __FILE__, __LINE__);
+
+    if (!(node_of = malloc(size * sizeof(int))))
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    if ((ret = pio_node_map(comm, &nnodes, node_of)))
     {
-        printf(" Error duplicating communicator \n");
-        MPI_Abort(comm, status);
+        free(node_of);
+        return ret;
     }
 
-    // Compute the ION BridgeNode ID
-    key = bgq_ion_id ();
-
-    // Create the pset_comm per bridge node
-    status = MPI_Comm_split ( comp_comm, key, comp_rank, &pset_comm);
-    if ( MPI_SUCCESS != status)
+    if (!(node_size = calloc(nnodes * 4, sizeof(int))))
     {
-        printf(" Error splitting communicator \n");
-        MPI_Abort(comm, status);
+        free(node_of);
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
     }
+    node_cap = node_size + nnodes;
+    node_nio = node_cap + nnodes;
+    node_seen = node_nio + nnodes;
 
-    // Calculate the rank in pset and pset size
-    MPI_Comm_rank (pset_comm, rank_in_pset);
-    MPI_Comm_size (pset_comm, pset_size);
-
-    // Create the Bridge root nodes communicator
-    bridge_root = 0;
-    if (0 == *rank_in_pset)
-        bridge_root = 1;
-
-    // Calculate the total number of bridge nodes / psets
-    tot_bridges = 0;
-    MPI_Allreduce (&bridge_root, &tot_bridges, 1, MPI_INT, MPI_SUM, comm);
-
-    *tot_pset = tot_bridges;
-
-    // Calculate the Pset ID
-    cur_pset = 0;
-    rem_psets = tot_bridges;
-    if ((0 == comp_rank) && (bridge_root ==1))
+    for (int i = 0; i < size; i++)
+        node_size[node_of[i]]++;
+    for (int j = 0; j < nnodes; j++)
     {
-        *psetID = 0;
-        rem_psets = tot_bridges-1;
-        cur_pset++;
+        node_cap[j] = iotasks_per_node ? min(iotasks_per_node, node_size[j]) : node_size[j];
+        total += node_cap[j];
     }
 
-    t_buf = 0; // Dummy value
-    if (0 == comp_rank)
+    /* Is it possible to place this many IO tasks? */
+    if (!num_iotasks)
+        num_iotasks = total;
+    if (num_iotasks > total)
     {
-        for (itr = 0; itr < rem_psets; itr++)
-        {
-            MPI_Recv (&t_buf,1, MPI_INT,  MPI_ANY_SOURCE, MPI_ANY_TAG,comm, &mpi_status);
-            MPI_Send (&cur_pset, 1, MPI_INT, mpi_status.MPI_SOURCE, 0, comm);
-            cur_pset++;
-        }
+        free(node_of);
+        free(node_size);
+        return pio_err(NULL, NULL, PIO_EINVAL, __FILE__, __LINE__);
     }
 
-    if ((1 == bridge_root) && ( 0 != comp_rank))
+    /* Deal the IO tasks out to the nodes, round robin. */
+    for (int left = num_iotasks; left; )
+        for (int j = 0; j < nnodes && left; j++)
+            if (node_nio[j] < node_cap[j])
+            {
+                node_nio[j]++;
+                left--;
+            }
+
+    if (!(ioranks = malloc(num_iotasks * sizeof(int))))
     {
-        MPI_Send (&t_buf, 1, MPI_INT, 0, 0, comm);
-        MPI_Recv (&temp_id,1, MPI_INT, 0, 0, comm, &mpi_status);
+        free(node_of);
+        free(node_size);
+        return pio_err(NULL, NULL, PIO_ENOMEM, __FILE__, __LINE__);
+    }
 
-        *psetID = temp_id;
-        /*printf (" Pset ID is %d \n", *psetID);*/
+    /* On each node, take the tasks at local index k * size / nio. */
+    for (int i = 0; i < size; i++)
+    {
+        int j = node_of[i];
+        int local = node_seen[j]++;
+
+        for (int k = 0; k < node_nio[j]; k++)
+            if ((int)((long long)k * node_size[j] / node_nio[j]) == local)
+            {
+                ioranks[n++] = i;
+                break;
+            }
     }
-    // Broadcast the PSET ID to all ranks in the psetcomm
-    MPI_Bcast ( psetID, 1, MPI_INT, 0, pset_comm);
+    pioassert(n == num_iotasks, "wrong number of IO tasks", __FILE__, __LINE__);
 
-    // Free the split comm
-    MPI_Comm_free (&pset_comm);
+    for (int i = 0; i < num_iotasks; i++)
+        PLOG((3, "topo ioranks[%d] = %d node %d", i, ioranks[i], node_of[ioranks[i]]));
 
-    MPI_Barrier (comm);
+    free(node_of);
+    free(node_size);
 
-    return 0;
-}
+    *num_iotasksp = num_iotasks;
+    *ioranksp = ioranks;
 
-#endif
+    return PIO_NOERR;
+}
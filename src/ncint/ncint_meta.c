@@ -0,0 +1,458 @@
+/**
+ * @file
+ * @internal Metadata cache of the netCDF integration layer.
+ *
+ * The dims, vars and atts of a file are kept on the computation
+ * tasks, so that the inquiry functions of the dispatch layer can
+ * answer without a call (with async, a message) to the IO tasks.
+ *
+ * @author Ed Hartnett
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pio_internal.h>
+#include "ncintdispatch.h"
+
+/**
+ * @internal Get the metadata cache of a file.
+ *
+ * @param ncid File ID.
+ *
+ * @return pointer to the cache, or NULL if the file has none.
+ * @author Ed Hartnett
+ */
+ncint_meta_t *
+ncint_get_meta(int ncid)
+{
+    file_desc_t *file;
+
+    if (pio_get_file(ncid, &file))
+        return NULL;
+
+    return file->ncint_meta;
+}
+
+/**
+ * @internal Free a list of cached attributes.
+ *
+ * @param att the first att of the list.
+ * @author Ed Hartnett
+ */
+static void
+free_atts(ncint_att_t *att)
+{
+    while (att)
+    {
+        ncint_att_t *next = att->next;
+        free(att);
+        att = next;
+    }
+}
+
+/**
+ * @internal Free a metadata cache.
+ *
+ * @param meta pointer to the cache, may be NULL.
+ * @author Ed Hartnett
+ */
+void
+ncint_meta_free(ncint_meta_t *meta)
+{
+    if (!meta)
+        return;
+
+    for (int v = 0; v < meta->nvars; v++)
+    {
+        free(meta->vars[v].dimids);
+        free_atts(meta->vars[v].atts);
+    }
+    free(meta->vars);
+    free(meta->dims);
+    free_atts(meta->gatts);
+    free(meta);
+}
+
+/**
+ * @internal Fill the metadata cache from the header that was
+ * broadcast when the file was opened.
+ *
+ * @param meta pointer to the cache.
+ * @param header the header of the file.
+ *
+ * @return ::NC_NOERR No error, or error code.
+ * @author Ed Hartnett
+ */
+static int
+meta_from_header(ncint_meta_t *meta, pio_file_meta *header)
+{
+    int *dimids = header->dimids;
+
+    if (header->ndims && !(meta->dims = calloc(header->ndims, sizeof(ncint_dim_t))))
+        return PIO_ENOMEM;
+    meta->ndims = header->ndims;
+    for (int d = 0; d < header->ndims; d++)
+    {
+        strcpy(meta->dims[d].name, header->dims[d].name);
+        meta->dims[d].len = header->dims[d].len;
+        meta->dims[d].unlim = header->dims[d].unlim;
+    }
+
+    if (header->nvars && !(meta->vars = calloc(header->nvars, sizeof(ncint_var_t))))
+        return PIO_ENOMEM;
+    meta->nvars = header->nvars;
+    for (int v = 0; v < header->nvars; v++)
+    {
+        ncint_var_t *var = &meta->vars[v];
+
+        var->ndims = header->vars[v].ndims;
+        if (!(var->dimids = malloc((var->ndims ? var->ndims : 1) * sizeof(int))))
+            return PIO_ENOMEM;
+        memcpy(var->dimids, dimids, var->ndims * sizeof(int));
+        dimids += var->ndims;
+        strcpy(var->name, header->var_names[v]);
+        var->xtype = header->vars[v].pio_type;
+        var->natts = header->vars[v].natts;
+    }
+    meta->ngatts = header->ngatts;
+
+    return PIO_NOERR;
+}
+
+/**
+ * @internal Create the metadata cache of a file. For a file that was
+ * opened, the dims and vars are taken from the header which was
+ * broadcast by PIOc_openfile_retry(), or else read from the
+ * file. This is called collectively by all computation tasks.
+ *
+ * @param ncid File ID.
+ * @param empty non-zero for a new file, which has no metadata yet.
+ *
+ * @return ::NC_NOERR No error, or error code.
+ * @author Ed Hartnett
+ */
+int
+ncint_meta_load(int ncid, int empty)
+{
+    file_desc_t *file;
+    ncint_meta_t *meta;
+    int ndims = 0, nvars = 0, ngatts = 0;
+    int nunlimdims = 0;
+    int ret;
+
+    if ((ret = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+
+    if (!(meta = calloc(1, sizeof(ncint_meta_t))))
+        return pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+
+    /* Use the header of the file, without asking the IO tasks. */
+    if (file->open_meta && file->open_meta->names)
+    {
+        ret = meta_from_header(meta, file->open_meta);
+        free(file->open_meta);
+        file->open_meta = NULL;
+        if (ret)
+        {
+            ncint_meta_free(meta);
+            return pio_err(file->iosystem, file, ret, __FILE__, __LINE__);
+        }
+        ncint_meta_free(file->ncint_meta);
+        file->ncint_meta = meta;
+        return PIO_NOERR;
+    }
+
+    if (!empty)
+    {
+        if ((ret = PIOc_inq(ncid, &ndims, &nvars, &ngatts, NULL)))
+            goto exit;
+        if ((ret = PIOc_inq_unlimdims(ncid, &nunlimdims, NULL)))
+            goto exit;
+    }
+
+    /* Read the dims. */
+    if (ndims)
+    {
+        int unlimdimids[nunlimdims ? nunlimdims : 1];
+
+        if (nunlimdims)
+            if ((ret = PIOc_inq_unlimdims(ncid, NULL, unlimdimids)))
+                goto exit;
+
+        if (!(meta->dims = calloc(ndims, sizeof(ncint_dim_t))))
+        {
+            ret = pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+            goto exit;
+        }
+        meta->ndims = ndims;
+        for (int d = 0; d < ndims; d++)
+        {
+            PIO_Offset len;
+
+            if ((ret = PIOc_inq_dim(ncid, d, meta->dims[d].name, &len)))
+                goto exit;
+            meta->dims[d].len = len;
+            for (int u = 0; u < nunlimdims; u++)
+                if (unlimdimids[u] == d)
+                    meta->dims[d].unlim = 1;
+        }
+    }
+
+    /* Read the vars. */
+    if (nvars)
+    {
+        if (!(meta->vars = calloc(nvars, sizeof(ncint_var_t))))
+        {
+            ret = pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+            goto exit;
+        }
+        meta->nvars = nvars;
+        for (int v = 0; v < nvars; v++)
+        {
+            ncint_var_t *var = &meta->vars[v];
+
+            if ((ret = PIOc_inq_varndims(ncid, v, &var->ndims)))
+                goto exit;
+            if (!(var->dimids = malloc((var->ndims ? var->ndims : 1) * sizeof(int))))
+            {
+                ret = pio_err(file->iosystem, file, PIO_ENOMEM, __FILE__, __LINE__);
+                goto exit;
+            }
+            if ((ret = PIOc_inq_var(ncid, v, var->name, &var->xtype, NULL, var->dimids,
+                                    &var->natts)))
+                goto exit;
+        }
+    }
+    meta->ngatts = ngatts;
+
+    PLOG((2, "ncint_meta_load ncid %d ndims %d nvars %d ngatts %d", ncid, ndims,
+          nvars, ngatts));
+
+    ncint_meta_free(file->ncint_meta);
+    file->ncint_meta = meta;
+    return PIO_NOERR;
+
+exit:
+    ncint_meta_free(meta);
+    return ret;
+}
+
+/**
+ * @internal Add a new dimension to the metadata cache.
+ *
+ * @param meta pointer to the cache.
+ * @param dimid the ID of the new dim.
+ * @param name the name of the new dim.
+ * @param len the length of the new dim, or NC_UNLIMITED.
+ *
+ * @return ::NC_NOERR No error, or error code.
+ * @author Ed Hartnett
+ */
+int
+ncint_meta_def_dim(ncint_meta_t *meta, int dimid, const char *name, size_t len)
+{
+    ncint_dim_t *dims;
+
+    pioassert(meta && dimid == meta->ndims && name, "invalid input", __FILE__,
+              __LINE__);
+
+    if (!(dims = realloc(meta->dims, (meta->ndims + 1) * sizeof(ncint_dim_t))))
+        return PIO_ENOMEM;
+    meta->dims = dims;
+
+    strncpy(dims[dimid].name, name, NC_MAX_NAME);
+    dims[dimid].name[NC_MAX_NAME] = '\0';
+    dims[dimid].len = len;
+    dims[dimid].unlim = len == NC_UNLIMITED;
+    meta->ndims++;
+
+    return PIO_NOERR;
+}
+
+/**
+ * @internal Add a new variable to the metadata cache.
+ *
+ * @param meta pointer to the cache.
+ * @param varid the ID of the new var.
+ * @param name the name of the new var.
+ * @param xtype the type of the new var.
+ * @param ndims the number of dims of the new var.
+ * @param dimidsp the dimids of the new var.
+ *
+ * @return ::NC_NOERR No error, or error code.
+ * @author Ed Hartnett
+ */
+int
+ncint_meta_def_var(ncint_meta_t *meta, int varid, const char *name, nc_type xtype,
+                   int ndims, const int *dimidsp)
+{
+    ncint_var_t *vars;
+    ncint_var_t *var;
+
+    pioassert(meta && varid == meta->nvars && name, "invalid input", __FILE__,
+              __LINE__);
+
+    if (!(vars = realloc(meta->vars, (meta->nvars + 1) * sizeof(ncint_var_t))))
+        return PIO_ENOMEM;
+    meta->vars = vars;
+
+    var = &vars[varid];
+    memset(var, 0, sizeof(ncint_var_t));
+    if (!(var->dimids = malloc((ndims ? ndims : 1) * sizeof(int))))
+        return PIO_ENOMEM;
+    strncpy(var->name, name, NC_MAX_NAME);
+    var->xtype = xtype;
+    var->ndims = ndims;
+    if (ndims)
+        memcpy(var->dimids, dimidsp, ndims * sizeof(int));
+    meta->nvars++;
+
+    return PIO_NOERR;
+}
+
+/**
+ * @internal Find the list of cached atts of a var.
+ *
+ * @param meta pointer to the cache.
+ * @param varid the var ID, or NC_GLOBAL.
+ *
+ * @return pointer to the head of the list, or NULL for a bad varid.
+ * @author Ed Hartnett
+ */
+static ncint_att_t **
+att_list(ncint_meta_t *meta, int varid)
+{
+    if (varid == NC_GLOBAL)
+        return &meta->gatts;
+    if (varid < 0 || varid >= meta->nvars)
+        return NULL;
+    return &meta->vars[varid].atts;
+}
+
+/**
+ * @internal Find the number of atts of a var in the cache.
+ *
+ * @param meta pointer to the cache.
+ * @param varid the var ID, or NC_GLOBAL.
+ *
+ * @return pointer to the number of atts, or NULL for a bad varid.
+ * @author Ed Hartnett
+ */
+static int *
+att_count(ncint_meta_t *meta, int varid)
+{
+    if (varid == NC_GLOBAL)
+        return &meta->ngatts;
+    if (varid < 0 || varid >= meta->nvars)
+        return NULL;
+    return &meta->vars[varid].natts;
+}
+
+/**
+ * @internal Find an attribute in the metadata cache.
+ *
+ * @param meta pointer to the cache.
+ * @param varid the var ID, or NC_GLOBAL.
+ * @param name the name of the att.
+ *
+ * @return pointer to the att, or NULL if it is not in the cache.
+ * @author Ed Hartnett
+ */
+ncint_att_t *
+ncint_meta_find_att(ncint_meta_t *meta, int varid, const char *name)
+{
+    ncint_att_t **list;
+
+    if (!name || !(list = att_list(meta, varid)))
+        return NULL;
+
+    for (ncint_att_t *att = *list; att; att = att->next)
+        if (!strcmp(att->name, name))
+            return att;
+
+    return NULL;
+}
+
+/**
+ * @internal Remember the type and length of an attribute, after it
+ * was written or inquired about. If the att was not in the cache,
+ * and not all atts of the var are, it may or may not be new, so the
+ * number of atts of the var is no longer known.
+ *
+ * @param meta pointer to the cache.
+ * @param varid the var ID, or NC_GLOBAL.
+ * @param name the name of the att.
+ * @param xtype the type of the att.
+ * @param len the length of the att.
+ * @param written non-zero if the att was just written.
+ *
+ * @return ::NC_NOERR No error, or error code.
+ * @author Ed Hartnett
+ */
+int
+ncint_meta_put_att(ncint_meta_t *meta, int varid, const char *name, nc_type xtype,
+                   size_t len, int written)
+{
+    ncint_att_t **list;
+    ncint_att_t *att;
+    int *natts;
+
+    if (!(list = att_list(meta, varid)))
+        return PIO_NOERR;
+    natts = att_count(meta, varid);
+
+    if (!(att = ncint_meta_find_att(meta, varid, name)))
+    {
+        int ncached = 0;
+
+        /* If all atts of the var are cached, this one is new. */
+        for (att = *list; att; att = att->next)
+            ncached++;
+        if (written)
+            *natts = *natts == ncached ? *natts + 1 : -1;
+        if (!(att = calloc(1, sizeof(ncint_att_t))))
+            return PIO_ENOMEM;
+        strncpy(att->name, name, NC_MAX_NAME);
+        att->next = *list;
+        *list = att;
+    }
+    att->xtype = xtype;
+    att->len = len;
+
+    return PIO_NOERR;
+}
+
+/**
+ * @internal Forget an attribute, after it was deleted or renamed.
+ *
+ * @param meta pointer to the cache.
+ * @param varid the var ID, or NC_GLOBAL.
+ * @param name the name of the att.
+ * @author Ed Hartnett
+ */
+void
+ncint_meta_del_att(ncint_meta_t *meta, int varid, const char *name)
+{
+    ncint_att_t **list;
+    int *natts;
+
+    if (!(list = att_list(meta, varid)))
+        return;
+
+    for (ncint_att_t **a = list; *a; a = &(*a)->next)
+    {
+        if (!strcmp((*a)->name, name))
+        {
+            ncint_att_t *att = *a;
+            *a = att->next;
+            free(att);
+            break;
+        }
+    }
+
+    /* The att numbers of the var have changed. */
+    natts = att_count(meta, varid);
+    if (*natts > 0)
+        (*natts)--;
+}
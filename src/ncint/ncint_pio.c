@@ -177,3 +177,40 @@ nc_free_decomp(int ioid)
     PLOG((1, "nc_free_decomp ioid %d", ioid));
     return PIOc_freedecomp(diosysid, ioid);
 }
+
+/**
+ * Associate a decomposition with a variable. After this call, the
+ * ordinary nc_put_var()/nc_put_vara() and nc_get_var()/nc_get_vara()
+ * calls on the var are distributed array calls: the data are the
+ * local part of the var for the decomposition, and they are written
+ * with PIOc_write_darray(), so they are buffered and go through the
+ * rearranger. Of start, only the record index is used, for record
+ * vars. Pass an ioid of 0 to go back to the non-distributed calls.
+ *
+ * @param ncid the ncid of the open file.
+ * @param varid the variable ID.
+ * @param ioid the decomposition ID, from nc_def_decomp(), or 0.
+ *
+ * @return PIO_NOERR for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+nc_def_var_decomp(int ncid, int varid, int ioid)
+{
+    file_desc_t *file;
+    var_desc_t *vdesc;
+    int ret;
+
+    PLOG((1, "nc_def_var_decomp ncid %d varid %d ioid %d", ncid, varid, ioid));
+
+    if ((ret = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    if ((ret = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(file->iosystem, file, ret, __FILE__, __LINE__);
+    if (ioid && !pio_get_iodesc_from_id(ioid))
+        return pio_err(file->iosystem, file, PIO_EBADID, __FILE__, __LINE__);
+
+    vdesc->ncint_ioid = ioid;
+
+    return PIO_NOERR;
+}
@@ -7,6 +7,7 @@
 
 #include "config.h"
 #include <stdlib.h>
+#include <string.h>
 #include "pio.h"
 #include "pio_internal.h"
 #include "ncintdispatch.h"
@@ -222,6 +223,14 @@ PIO_NCINT_create(const char *path, int cmode, size_t initialsz, int basepe,
     if ((ret = PIOc_createfile_int(diosysid, &ncid, &iotype, path, cmode, 1)))
         return ret;
 
+    /* Start the metadata cache of the new file. If that fails, the
+     * file is closed, so it is not left open without a cache. */
+    if ((ret = ncint_meta_load(ncid, 1)))
+    {
+        PIO_NCINT_close(ncid, NULL);
+        return ret;
+    }
+
     return PIO_NOERR;
 }
 
@@ -273,17 +282,28 @@ PIO_NCINT_open(const char *path, int mode, int basepe, size_t *chunksizehintp,
     if ((ret = PIOc_openfile_retry(diosysid, &ncid, &iotype, path, mode, 0, 1)))
         return ret;
 
+    /* Read the metadata into the cache, so inquiries about it
+     * need not go to the IO tasks. If that fails, the file is
+     * closed. */
+    if ((ret = ncint_meta_load(ncid, 0)))
+    {
+        PIO_NCINT_close(ncid, NULL);
+        return ret;
+    }
+
     return NC_NOERR;
 }
 
 /**
- * @internal This just calls nc_enddef, ignoring the extra parameters.
+ * @internal End define mode. The values nc_enddef() passes (0, 4, 0,
+ * 4) call PIOc_enddef(), so the file gets the defaults of its IO
+ * type; others, from nc__enddef(), are passed to PIOc_enddef_align().
  *
  * @param ncid File and group ID.
- * @param h_minfree Ignored.
- * @param v_align Ignored.
- * @param v_minfree Ignored.
- * @param r_align Ignored.
+ * @param h_minfree Free space to leave in the header.
+ * @param v_align Alignment of the fixed size variables.
+ * @param v_minfree Free space to leave after the fixed size variables.
+ * @param r_align Alignment of the record variables.
  *
  * @return ::NC_NOERR No error.
  * @author Ed Hartnett
@@ -292,7 +312,21 @@ int
 PIO_NCINT__enddef(int ncid, size_t h_minfree, size_t v_align,
                   size_t v_minfree, size_t r_align)
 {
-    return PIOc_enddef(ncid);
+    int ret;
+
+    if (!h_minfree && v_align == 4 && !v_minfree && r_align == 4)
+        ret = PIOc_enddef(ncid);
+    else
+        ret = PIOc_enddef_align(ncid, h_minfree, v_align, v_minfree, r_align);
+    if (ret)
+        return ret;
+
+    /* The define functions keep the metadata cache coherent, so it
+     * only needs to be read if there is none. */
+    if (!ncint_get_meta(ncid))
+        return ncint_meta_load(ncid, 0);
+
+    return PIO_NOERR;
 }
 
 /**
@@ -345,11 +379,13 @@ PIO_NCINT_abort(int ncid)
 int
 PIO_NCINT_close(int ncid, void *v)
 {
+    ncint_meta_t *meta = ncint_get_meta(ncid);
     int retval;
 
     /* Tell PIO to close the file. */
     if ((retval = PIOc_closefile(ncid)))
         return retval;
+    ncint_meta_free(meta);
 
     /* Delete the group name. */
     if ((retval = nc4_file_list_del(ncid)))
@@ -449,7 +485,25 @@ PIO_NCINT_inq_format_extended(int ncid, int *formatp, int *modep)
 int
 PIO_NCINT_inq(int ncid, int *ndimsp, int *nvarsp, int *nattsp, int *unlimdimidp)
 {
-    return PIOc_inq(ncid, ndimsp, nvarsp, nattsp, unlimdimidp);
+    ncint_meta_t *meta;
+    int ret;
+
+    if (!(meta = ncint_get_meta(ncid)))
+        return PIOc_inq(ncid, ndimsp, nvarsp, nattsp, unlimdimidp);
+
+    if (nattsp && meta->ngatts < 0)
+        if ((ret = PIOc_inq_natts(ncid, &meta->ngatts)))
+            return ret;
+    if (ndimsp)
+        *ndimsp = meta->ndims;
+    if (nvarsp)
+        *nvarsp = meta->nvars;
+    if (nattsp)
+        *nattsp = meta->ngatts;
+    if (unlimdimidp)
+        return PIO_NCINT_inq_unlimdim(ncid, unlimdimidp);
+
+    return PIO_NOERR;
 }
 
 /**
@@ -475,7 +529,19 @@ PIO_NCINT_inq_type(int ncid, nc_type typeid1, char *name, size_t *size)
 int
 PIO_NCINT_def_dim(int ncid, const char *name, size_t len, int *idp)
 {
-    return PIOc_def_dim(ncid, name, len, idp);
+    ncint_meta_t *meta;
+    int dimid;
+    int ret;
+
+    if ((ret = PIOc_def_dim(ncid, name, len, &dimid)))
+        return ret;
+    if (idp)
+        *idp = dimid;
+
+    if ((meta = ncint_get_meta(ncid)))
+        return ncint_meta_def_dim(meta, dimid, name, len);
+
+    return PIO_NOERR;
 }
 
 /**
@@ -494,6 +560,23 @@ PIO_NCINT_def_dim(int ncid, const char *name, size_t len, int *idp)
 int
 PIO_NCINT_inq_dimid(int ncid, const char *name, int *idp)
 {
+    ncint_meta_t *meta;
+
+    /* Dims which are not in the cache are looked for in the file,
+     * which also returns the usual error if there is none. */
+    if ((meta = ncint_get_meta(ncid)) && name)
+    {
+        for (int d = 0; d < meta->ndims; d++)
+        {
+            if (!strcmp(meta->dims[d].name, name))
+            {
+                if (idp)
+                    *idp = d;
+                return PIO_NOERR;
+            }
+        }
+    }
+
     return PIOc_inq_dimid(ncid, name, idp);
 }
 
@@ -516,6 +599,20 @@ PIO_NCINT_inq_dimid(int ncid, const char *name, int *idp)
 int
 PIO_NCINT_inq_dim(int ncid, int dimid, char *name, size_t *lenp)
 {
+    ncint_meta_t *meta;
+
+    /* The length of an unlimited dim changes as records are
+     * written, so it is always read from the file. */
+    if ((meta = ncint_get_meta(ncid)) && dimid >= 0 && dimid < meta->ndims &&
+        !(lenp && meta->dims[dimid].unlim))
+    {
+        if (name)
+            strcpy(name, meta->dims[dimid].name);
+        if (lenp)
+            *lenp = meta->dims[dimid].len;
+        return PIO_NOERR;
+    }
+
     return PIOc_inq_dim(ncid, dimid, name, (PIO_Offset *)lenp);
 }
 
@@ -536,6 +633,25 @@ PIO_NCINT_inq_dim(int ncid, int dimid, char *name, size_t *lenp)
 int
 PIO_NCINT_inq_unlimdim(int ncid, int *unlimdimidp)
 {
+    ncint_meta_t *meta;
+
+    if ((meta = ncint_get_meta(ncid)))
+    {
+        if (unlimdimidp)
+        {
+            *unlimdimidp = -1;
+            for (int d = 0; d < meta->ndims; d++)
+            {
+                if (meta->dims[d].unlim)
+                {
+                    *unlimdimidp = d;
+                    break;
+                }
+            }
+        }
+        return PIO_NOERR;
+    }
+
     return PIOc_inq_unlimdim(ncid, unlimdimidp);
 }
 
@@ -557,7 +673,15 @@ PIO_NCINT_inq_unlimdim(int ncid, int *unlimdimidp)
 int
 PIO_NCINT_rename_dim(int ncid, int dimid, const char *name)
 {
-    return PIOc_rename_dim(ncid, dimid, name);
+    ncint_meta_t *meta;
+    int ret;
+
+    if ((ret = PIOc_rename_dim(ncid, dimid, name)))
+        return ret;
+    if ((meta = ncint_get_meta(ncid)) && dimid >= 0 && dimid < meta->ndims)
+        strncpy(meta->dims[dimid].name, name, NC_MAX_NAME);
+
+    return PIO_NOERR;
 }
 
 /**
@@ -578,7 +702,30 @@ int
 PIO_NCINT_inq_att(int ncid, int varid, const char *name, nc_type *xtypep,
                   size_t *lenp)
 {
-    return PIOc_inq_att(ncid, varid, name, xtypep, (PIO_Offset *)lenp);
+    ncint_meta_t *meta;
+    ncint_att_t *att;
+    nc_type xtype;
+    PIO_Offset len;
+    int ret;
+
+    if (!(meta = ncint_get_meta(ncid)))
+        return PIOc_inq_att(ncid, varid, name, xtypep, (PIO_Offset *)lenp);
+
+    /* Remember atts the first time they are inquired about. */
+    if (!(att = ncint_meta_find_att(meta, varid, name)))
+    {
+        if ((ret = PIOc_inq_att(ncid, varid, name, &xtype, &len)))
+            return ret;
+        if ((ret = ncint_meta_put_att(meta, varid, name, xtype, len, 0)))
+            return ret;
+        att = ncint_meta_find_att(meta, varid, name);
+    }
+    if (xtypep)
+        *xtypep = att->xtype;
+    if (lenp)
+        *lenp = att->len;
+
+    return PIO_NOERR;
 }
 
 /**
@@ -631,7 +778,16 @@ PIO_NCINT_inq_attname(int ncid, int varid, int attnum, char *name)
 int
 PIO_NCINT_rename_att(int ncid, int varid, const char *name, const char *newname)
 {
-    return PIOc_rename_att(ncid, varid, name, newname);
+    ncint_meta_t *meta;
+    ncint_att_t *att;
+    int ret;
+
+    if ((ret = PIOc_rename_att(ncid, varid, name, newname)))
+        return ret;
+    if ((meta = ncint_get_meta(ncid)) && (att = ncint_meta_find_att(meta, varid, name)))
+        strncpy(att->name, newname, NC_MAX_NAME);
+
+    return PIO_NOERR;
 }
 
 /**
@@ -649,7 +805,15 @@ PIO_NCINT_rename_att(int ncid, int varid, const char *name, const char *newname)
 int
 PIO_NCINT_del_att(int ncid, int varid, const char *name)
 {
-    return PIOc_del_att(ncid, varid, name);
+    ncint_meta_t *meta;
+    int ret;
+
+    if ((ret = PIOc_del_att(ncid, varid, name)))
+        return ret;
+    if ((meta = ncint_get_meta(ncid)))
+        ncint_meta_del_att(meta, varid, name);
+
+    return PIO_NOERR;
 }
 
 /**
@@ -682,15 +846,35 @@ int
 PIO_NCINT_put_att(int ncid, int varid, const char *name, nc_type file_type,
                   size_t len, const void *data, nc_type mem_type)
 {
-    return PIOc_put_att_tc(ncid, varid, name, file_type, (PIO_Offset)len,
-                           mem_type,  data);
+    ncint_meta_t *meta;
+    int ret;
+
+    if ((ret = PIOc_put_att_tc(ncid, varid, name, file_type, (PIO_Offset)len,
+                               mem_type,  data)))
+        return ret;
+    if ((meta = ncint_get_meta(ncid)))
+        return ncint_meta_put_att(meta, varid, name, file_type, len, 1);
+
+    return PIO_NOERR;
 }
 
 int
 PIO_NCINT_def_var(int ncid, const char *name, nc_type xtype, int ndims,
                   const int *dimidsp, int *varidp)
 {
-    return PIOc_def_var(ncid, name, xtype, ndims, dimidsp, varidp);
+    ncint_meta_t *meta;
+    int varid;
+    int ret;
+
+    if ((ret = PIOc_def_var(ncid, name, xtype, ndims, dimidsp, &varid)))
+        return ret;
+    if (varidp)
+        *varidp = varid;
+
+    if ((meta = ncint_get_meta(ncid)))
+        return ncint_meta_def_var(meta, varid, name, xtype, ndims, dimidsp);
+
+    return PIO_NOERR;
 }
 
 /**
@@ -709,6 +893,21 @@ PIO_NCINT_def_var(int ncid, const char *name, nc_type xtype, int ndims,
 int
 PIO_NCINT_inq_varid(int ncid, const char *name, int *varidp)
 {
+    ncint_meta_t *meta;
+
+    if ((meta = ncint_get_meta(ncid)) && name)
+    {
+        for (int v = 0; v < meta->nvars; v++)
+        {
+            if (!strcmp(meta->vars[v].name, name))
+            {
+                if (varidp)
+                    *varidp = v;
+                return PIO_NOERR;
+            }
+        }
+    }
+
     return PIOc_inq_varid(ncid, name, varidp);
 }
 
@@ -741,7 +940,60 @@ PIO_NCINT_inq_varid(int ncid, const char *name, int *varidp)
 int
 PIO_NCINT_rename_var(int ncid, int varid, const char *name)
 {
-    return PIOc_rename_var(ncid, varid, name);
+    ncint_meta_t *meta;
+    int ret;
+
+    if ((ret = PIOc_rename_var(ncid, varid, name)))
+        return ret;
+    if ((meta = ncint_get_meta(ncid)) && varid >= 0 && varid < meta->nvars)
+        strncpy(meta->vars[varid].name, name, NC_MAX_NAME);
+
+    return PIO_NOERR;
+}
+
+/**
+ * @internal Find the decomposition set with nc_def_var_decomp() for a
+ * var. For record vars, also set the record to the first index of
+ * start.
+ *
+ * @param ncid File ID.
+ * @param varid Variable ID.
+ * @param start Array of start indices, may be NULL.
+ * @param memtype The type of the data in memory, which must be the
+ * type of the decomposition, or NC_NAT.
+ * @param iodescp Pointer that gets the decomposition, or NULL if the
+ * var has none.
+ *
+ * @returns ::NC_NOERR for success
+ * @author Ed Hartnett
+ */
+static int
+get_var_darray(int ncid, int varid, const size_t *start, nc_type memtype,
+               io_desc_t **iodescp)
+{
+    file_desc_t *file;
+    var_desc_t *vdesc;
+    int ret;
+
+    *iodescp = NULL;
+    if ((ret = pio_get_file(ncid, &file)))
+        return pio_err(NULL, NULL, ret, __FILE__, __LINE__);
+    if (varid == NC_GLOBAL)
+        return PIO_NOERR;
+    if ((ret = get_file_var_desc(file, varid, &vdesc)))
+        return pio_err(file->iosystem, file, ret, __FILE__, __LINE__);
+    if (!vdesc->ncint_ioid)
+        return PIO_NOERR;
+
+    if (!(*iodescp = pio_get_iodesc_from_id(vdesc->ncint_ioid)))
+        return pio_err(file->iosystem, file, PIO_EBADID, __FILE__, __LINE__);
+    if (memtype != NC_NAT && memtype != (*iodescp)->piotype)
+        return pio_err(file->iosystem, file, PIO_EBADTYPE, __FILE__, __LINE__);
+    if (vdesc->rec_var)
+        if ((ret = PIOc_setframe(ncid, varid, start ? (int)start[0] : 0)))
+            return ret;
+
+    return PIO_NOERR;
 }
 
 /**
@@ -761,6 +1013,15 @@ int
 PIO_NCINT_get_vara(int ncid, int varid, const size_t *start,
                    const size_t *count, void *value, nc_type t)
 {
+    io_desc_t *iodesc;
+    int ret;
+
+    /* Vars with a decomposition are read as distributed arrays. */
+    if ((ret = get_var_darray(ncid, varid, start, t, &iodesc)))
+        return ret;
+    if (iodesc)
+        return PIOc_read_darray(ncid, varid, iodesc->ioid, iodesc->ndof, value);
+
     return PIOc_get_vars_tc(ncid, varid, (PIO_Offset *)start,
                             (PIO_Offset *)count, NULL, t, value);
 }
@@ -784,6 +1045,17 @@ int
 PIO_NCINT_put_vara(int ncid, int varid, const size_t *startp,
                    const size_t *countp, const void *op, int memtype)
 {
+    io_desc_t *iodesc;
+    int ret;
+
+    /* Vars with a decomposition are written as distributed arrays,
+     * buffered with the other darray writes of the file. */
+    if ((ret = get_var_darray(ncid, varid, startp, memtype, &iodesc)))
+        return ret;
+    if (iodesc)
+        return PIOc_write_darray(ncid, varid, iodesc->ioid, iodesc->ndof,
+                                 (void *)op, NULL);
+
     return PIOc_put_vars_tc(ncid, varid, (PIO_Offset *)startp,
                             (PIO_Offset *)countp, NULL, memtype, op);
 }
@@ -882,17 +1154,40 @@ PIO_NCINT_inq_var_all(int ncid, int varid, char *name, nc_type *xtypep,
                       int *no_fill, void *fill_valuep, int *endiannessp,
                       unsigned int *idp, size_t *nparamsp, unsigned int *params)
 {
+    ncint_meta_t *meta;
     int ret;
 
-    ret = PIOc_inq_var(ncid, varid, name, xtypep, ndimsp, dimidsp, nattsp);
+    if ((meta = ncint_get_meta(ncid)) && varid >= 0 && varid < meta->nvars)
+    {
+        ncint_var_t *var = &meta->vars[varid];
+
+        if (nattsp && var->natts < 0)
+            if ((ret = PIOc_inq_varnatts(ncid, varid, &var->natts)))
+                return ret;
+        if (name)
+            strcpy(name, var->name);
+        if (xtypep)
+            *xtypep = var->xtype;
+        if (ndimsp)
+            *ndimsp = var->ndims;
+        if (dimidsp)
+            memcpy(dimidsp, var->dimids, var->ndims * sizeof(int));
+        if (nattsp)
+            *nattsp = var->natts;
+        ret = PIO_NOERR;
+    }
+    else
+        ret = PIOc_inq_var(ncid, varid, name, xtypep, ndimsp, dimidsp, nattsp);
 
-    if (!ret)
+    /* The storage settings are not cached, and nc_inq_var() does
+     * not ask for them. */
+    if (!ret && (contiguousp || chunksizesp))
 	ret = PIOc_inq_var_chunking(ncid, varid, contiguousp, (MPI_Offset *)chunksizesp);
 
-    if (!ret)
+    if (!ret && (shufflep || deflatep || deflate_levelp))
 	ret = PIOc_inq_var_deflate(ncid, varid, shufflep, deflatep, deflate_levelp);
 
-    if (!ret)
+    if (!ret && endiannessp)
 	ret = PIOc_inq_var_endian(ncid, varid, endiannessp);
     
     return ret;
@@ -935,6 +1230,26 @@ PIO_NCINT_def_var_fill(int ncid, int varid, int no_fill, const void *fill_value)
 int
 PIO_NCINT_inq_unlimdims(int ncid, int *nunlimdimsp, int *unlimdimidsp)
 {
+    ncint_meta_t *meta;
+
+    if ((meta = ncint_get_meta(ncid)))
+    {
+        int nunlimdims = 0;
+
+        for (int d = 0; d < meta->ndims; d++)
+        {
+            if (meta->dims[d].unlim)
+            {
+                if (unlimdimidsp)
+                    unlimdimidsp[nunlimdims] = d;
+                nunlimdims++;
+            }
+        }
+        if (nunlimdimsp)
+            *nunlimdimsp = nunlimdims;
+        return PIO_NOERR;
+    }
+
     return PIOc_inq_unlimdims(ncid, nunlimdimsp, unlimdimidsp);
 }
 
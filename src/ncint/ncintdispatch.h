@@ -11,6 +11,76 @@
 #include "config.h"
 #include <netcdf_dispatch.h>
 
+/** A dimension in the metadata cache of a file. */
+typedef struct ncint_dim_t
+{
+    /** Name of the dimension. */
+    char name[NC_MAX_NAME + 1];
+
+    /** Length of the dimension. Not kept for unlimited dimensions,
+     * which grow as records are written. */
+    size_t len;
+
+    /** Non-zero for an unlimited dimension. */
+    int unlim;
+} ncint_dim_t;
+
+/** An attribute in the metadata cache of a file. */
+typedef struct ncint_att_t
+{
+    /** Name of the attribute. */
+    char name[NC_MAX_NAME + 1];
+
+    /** Type and length of the attribute. */
+    nc_type xtype;
+    size_t len;
+
+    /** Next attribute of the same var. */
+    struct ncint_att_t *next;
+} ncint_att_t;
+
+/** A variable in the metadata cache of a file. */
+typedef struct ncint_var_t
+{
+    /** Name of the variable. */
+    char name[NC_MAX_NAME + 1];
+
+    /** Type of the variable. */
+    nc_type xtype;
+
+    /** Number of dimensions and their IDs. */
+    int ndims;
+    int *dimids;
+
+    /** Number of attributes, or -1 if not known. */
+    int natts;
+
+    /** The attributes of the var seen so far. */
+    ncint_att_t *atts;
+} ncint_var_t;
+
+/**
+ * The metadata of a file, kept on the computation tasks so inquiry
+ * calls need not go to the IO tasks. It is loaded when the file is
+ * opened, and kept up to date by the define functions of the
+ * dispatch layer.
+ */
+typedef struct ncint_meta_t
+{
+    /** Dimensions, by dimid. */
+    int ndims;
+    ncint_dim_t *dims;
+
+    /** Variables, by varid. */
+    int nvars;
+    ncint_var_t *vars;
+
+    /** Number of global attributes, or -1 if not known, and the
+     * global attributes seen so far. */
+    int ngatts;
+    ncint_att_t *gatts;
+} ncint_meta_t;
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -153,6 +223,33 @@ extern "C" {
     PIO_NCINT_def_var_chunking(int ncid, int varid, int storage, const size_t *chunksizesp);
 
 
+    /* Functions for the metadata cache. */
+    extern ncint_meta_t *
+    ncint_get_meta(int ncid);
+
+    extern int
+    ncint_meta_load(int ncid, int empty);
+
+    extern void
+    ncint_meta_free(ncint_meta_t *meta);
+
+    extern int
+    ncint_meta_def_dim(ncint_meta_t *meta, int dimid, const char *name, size_t len);
+
+    extern int
+    ncint_meta_def_var(ncint_meta_t *meta, int varid, const char *name, nc_type xtype,
+                       int ndims, const int *dimidsp);
+
+    extern ncint_att_t *
+    ncint_meta_find_att(ncint_meta_t *meta, int varid, const char *name);
+
+    extern int
+    ncint_meta_put_att(ncint_meta_t *meta, int varid, const char *name, nc_type xtype,
+                       size_t len, int written);
+
+    extern void
+    ncint_meta_del_att(ncint_meta_t *meta, int varid, const char *name);
+
     extern int
     PIO_NCINT_filter_actions(int ncid, int varid, int action, struct NC_Filterobject* spec);
 
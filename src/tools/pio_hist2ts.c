@@ -0,0 +1,675 @@
+/**
+ * @file
+ * Convert history files to time-series files with PIO.
+ *
+ * History files hold many variables, and one or a few records
+ * (time slices) of each. This program writes one time-series file for
+ * each time-varying variable of the history files, holding all the
+ * records of the variable from all the history files, in the order
+ * the history files are given.
+ *
+ * Usage:
+ *
+ * mpiexec -n N pio_hist2ts [-o prefix] [-t iotype] [-i num_iotasks]
+ *     [-g num_groups] [-v var1,var2,...] hist1.nc [hist2.nc ...]
+ *
+ * (Run pio_hist2ts --help for the long names of the options.)
+ *
+ * - -o The prefix of the time-series files, which are named
+ *   prefix.var.nc (default "ts").
+ * - -t The iotype, one of pnetcdf, netcdf, netcdf4c, netcdf4p
+ *   (default pnetcdf if available, otherwise netcdf).
+ * - -i The number of IO tasks of each group (default all tasks of the
+ *   group).
+ * - -g The number of groups of tasks (default 1). The tasks are split
+ *   into groups, each with its own IO system, and the variables are
+ *   dealt out to the groups, so that the time-series files are
+ *   written at the same time.
+ * - -v The variables to convert (default all variables with the
+ *   unlimited dimension and at least one other dimension).
+ *
+ * The variables are read with PIOc_read_darray() and written with
+ * PIOc_write_darray(), with a block decomposition of the non-record
+ * dimensions of each variable over the tasks of the group. The
+ * writes are buffered by PIO, and written together with those of the
+ * following records, so the reads of the history files go on while
+ * the IO tasks write the time-series file.
+ *
+ * The coordinate variables of the dimensions of a variable, and the
+ * variables that have only the unlimited dimension (such as time),
+ * are copied into each time-series file, as are the attributes of
+ * all of them and the global attributes of the first history file.
+ * Variables of string and user-defined types are left out.
+ *
+ * @author Ed Hartnett
+ */
+
+#include <config.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <pio.h>
+#include <pio_tools.h>
+
+/** The name of this program. */
+#define PROG_NAME "pio_hist2ts"
+
+/** The default prefix of the time-series files. */
+#define DEFAULT_PREFIX "ts"
+
+/** The rank of this task in its group. Only rank 0 of each group
+ * prints errors, since the errors of PIO are the same on all tasks
+ * of the IO system. */
+static int err_rank;
+
+/** Print an error, on rank 0 of the group. */
+#define PRINT_ERR(e) do {                                               \
+        if (!err_rank)                                                  \
+        {                                                               \
+            char errmsg[PIO_MAX_NAME + 1];                              \
+            PIOc_strerror((e), errmsg);                                 \
+            fprintf(stderr, "%s: %s line %d: %s\n", PROG_NAME, __FILE__, __LINE__, \
+                    errmsg);                                            \
+        }                                                               \
+    } while (0)
+
+/** Handle an error by printing it and returning it. */
+#define ERR(e) do {                                                     \
+        PRINT_ERR(e);                                                   \
+        return (e);                                                     \
+    } while (0)
+
+/** Handle an error by printing it, and going to the clean up at
+ * exit with ret set to it. */
+#define BAIL(e) do {                                                    \
+        ret = (e);                                                      \
+        PRINT_ERR(ret);                                                 \
+        goto exit;                                                      \
+    } while (0)
+
+const char *argp_program_version = PROG_NAME " 0.1";
+const char *argp_program_bug_address = "<https://github.com/NCAR/ParallelIO>";
+
+static char doc[] = "convert history files to time-series files, in parallel with pio";
+
+static char args_doc[] = "HIST...";
+
+static struct argp_option options[] = {
+    {"prefix", 'o', "PREFIX", 0, "Prefix of the time-series files (default " DEFAULT_PREFIX ")"},
+    {"iotype", 't', "IOTYPE", 0, "Iotype: pnetcdf,netcdf,netcdf4c,netcdf4p (default pnetcdf if available, else netcdf)"},
+    {"iotasks", 'i', "N", 0, "Number of IO tasks of each group (default all)"},
+    {"groups", 'g', "N", 0, "Number of groups of tasks (default 1)"},
+    {"vars", 'v', "LIST", 0, "Variables to convert, as var1,var2,... (default all)"},
+    { 0 }
+};
+
+/** The options and arguments of the program. */
+struct arguments
+{
+    const char *prefix;
+    const char *iotype;
+    const char *vars;
+    int niotasks;
+    int ngroups;
+    char **files;
+    int nfiles;
+};
+
+/** Parse one option or argument. */
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+    case 'o':
+        arguments->prefix = arg;
+        break;
+    case 't':
+        arguments->iotype = arg;
+        break;
+    case 'i':
+        arguments->niotasks = atoi(arg);
+        break;
+    case 'g':
+        arguments->ngroups = atoi(arg);
+        break;
+    case 'v':
+        arguments->vars = arg;
+        break;
+    case ARGP_KEY_ARGS:
+        arguments->files = state->argv + state->next;
+        arguments->nfiles = state->argc - state->next;
+        break;
+    case ARGP_KEY_NO_ARGS:
+        argp_usage(state);
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/** Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+/** A variable of the history files. */
+typedef struct hist_var
+{
+    /** Name of the variable. */
+    char name[PIO_MAX_NAME + 1];
+
+    /** Type of the variable. */
+    nc_type xtype;
+
+    /** Number of dimensions, including the unlimited one. */
+    int ndims;
+
+    /** Dimension IDs in the first history file. */
+    int dimids[PIO_MAX_VAR_DIMS];
+} hist_var;
+
+/** The history files and what they hold. */
+typedef struct hist_files
+{
+    /** Number of history files. */
+    int nfiles;
+
+    /** The ncids of the open history files. */
+    int *ncid;
+
+    /** The number of records in each history file. */
+    PIO_Offset *nrecs;
+
+    /** The unlimited dimension of the first history file. */
+    int unlimdimid;
+
+    /** The variables with only the unlimited dimension, which are
+     * copied into each time-series file. */
+    int naux;
+    hist_var *aux;
+
+    /** The variables to write time-series files of. */
+    int nts;
+    hist_var *ts;
+} hist_files;
+
+/**
+ * Is the name in a comma separated list of names? An empty or NULL
+ * list holds every name.
+ *
+ * @param list the comma separated list, or NULL.
+ * @param name the name to look for.
+ * @returns non-zero if the name is in the list.
+ * @author Ed Hartnett
+ */
+static int
+in_list(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = list;
+
+    if (!list || !*list)
+        return 1;
+
+    while (p)
+    {
+        if (!strncmp(p, name, len) && (p[len] == ',' || p[len] == '\0'))
+            return 1;
+        if ((p = strchr(p, ',')))
+            p++;
+    }
+
+    return 0;
+}
+
+/**
+ * Learn the variables of the first history file, and the number of
+ * records of each history file.
+ *
+ * @param hist pointer to the history files, whose ncids are set.
+ * @param varlist comma separated list of variables to convert, or
+ * NULL for all.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+inq_hist_files(hist_files *hist, const char *varlist)
+{
+    int ncid = hist->ncid[0];
+    int nvars;
+    int ret;
+
+    if ((ret = PIOc_inq_unlimdim(ncid, &hist->unlimdimid)))
+        ERR(ret);
+    if (hist->unlimdimid < 0)
+        ERR(PIO_EINVAL);
+
+    /* The number of records of each history file. */
+    for (int h = 0; h < hist->nfiles; h++)
+    {
+        int unlimdimid;
+
+        if ((ret = PIOc_inq_unlimdim(hist->ncid[h], &unlimdimid)))
+            ERR(ret);
+        if (unlimdimid < 0)
+            ERR(PIO_EINVAL);
+        if ((ret = PIOc_inq_dimlen(hist->ncid[h], unlimdimid, &hist->nrecs[h])))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_inq_nvars(ncid, &nvars)))
+        ERR(ret);
+    if (!(hist->aux = malloc(nvars * sizeof(hist_var))))
+        ERR(PIO_ENOMEM);
+    if (!(hist->ts = malloc(nvars * sizeof(hist_var))))
+        ERR(PIO_ENOMEM);
+
+    /* Sort the record variables into those that are copied and those
+     * that get a time-series file. Character variables with other
+     * dimensions, and string and user-defined variables, are left
+     * out. */
+    for (int v = 0; v < nvars; v++)
+    {
+        hist_var var;
+
+        if ((ret = PIOc_inq_var(ncid, v, var.name, &var.xtype, &var.ndims, var.dimids,
+                                NULL)))
+            ERR(ret);
+        if (!var.ndims || var.dimids[0] != hist->unlimdimid || var.xtype >= PIO_STRING)
+            continue;
+
+        if (var.ndims == 1)
+            hist->aux[hist->naux++] = var;
+        else if (var.xtype != PIO_CHAR && in_list(varlist, var.name))
+            hist->ts[hist->nts++] = var;
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Define a variable of the first history file in a time-series
+ * file, with its attributes. The dimensions it needs are defined if
+ * they are not yet.
+ *
+ * @param hist pointer to the history files.
+ * @param var pointer to the variable.
+ * @param ncid the ncid of the time-series file, in define mode.
+ * @param dimmap the dimids of the time-series file, by dimid of the
+ * first history file, -1 for those not yet defined.
+ * @param varidp pointer that gets the varid in the time-series file.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+def_ts_var(hist_files *hist, hist_var *var, int ncid, int *dimmap, int *varidp)
+{
+    int dimids[PIO_MAX_VAR_DIMS];
+    int varid_in;
+    int ret;
+
+    for (int d = 0; d < var->ndims; d++)
+    {
+        int dimid = var->dimids[d];
+
+        if (dimmap[dimid] < 0)
+        {
+            char name[PIO_MAX_NAME + 1];
+            PIO_Offset len;
+
+            if ((ret = PIOc_inq_dim(hist->ncid[0], dimid, name, &len)))
+                ERR(ret);
+            if (dimid == hist->unlimdimid)
+                len = PIO_UNLIMITED;
+            if ((ret = PIOc_def_dim(ncid, name, len, &dimmap[dimid])))
+                ERR(ret);
+        }
+        dimids[d] = dimmap[dimid];
+    }
+
+    if ((ret = PIOc_def_var(ncid, var->name, var->xtype, var->ndims, dimids, varidp)))
+        ERR(ret);
+    if ((ret = PIOc_inq_varid(hist->ncid[0], var->name, &varid_in)))
+        ERR(ret);
+    if ((ret = pio_tool_copy_atts(hist->ncid[0], varid_in, ncid, *varidp)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Copy the whole of a variable without the unlimited dimension from
+ * the first history file.
+ *
+ * @param hist pointer to the history files.
+ * @param name the name of the variable.
+ * @param ncid the ncid of the time-series file, in data mode.
+ * @param varid the varid in the time-series file.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+copy_static_var(hist_files *hist, const char *name, int ncid, int varid)
+{
+    int ncid_in = hist->ncid[0];
+    int varid_in;
+    int ndims, dimids[PIO_MAX_VAR_DIMS];
+    nc_type xtype;
+    PIO_Offset len = 1, size;
+    void *buf;
+    int ret;
+
+    if ((ret = PIOc_inq_varid(ncid_in, name, &varid_in)))
+        ERR(ret);
+    if ((ret = PIOc_inq_var(ncid_in, varid_in, NULL, &xtype, &ndims, dimids, NULL)))
+        ERR(ret);
+    if ((ret = PIOc_inq_type(ncid_in, xtype, NULL, &size)))
+        ERR(ret);
+    for (int d = 0; d < ndims; d++)
+    {
+        PIO_Offset dimlen;
+
+        if ((ret = PIOc_inq_dimlen(ncid_in, dimids[d], &dimlen)))
+            ERR(ret);
+        len *= dimlen;
+    }
+
+    if (!(buf = malloc(len * size + 1)))
+        ERR(PIO_ENOMEM);
+    if (!(ret = PIOc_get_var(ncid_in, varid_in, buf)))
+        ret = PIOc_put_var(ncid, varid, buf);
+    free(buf);
+    if (ret)
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Write the time-series file of one variable.
+ *
+ * @param iosysid the IO system ID of the group.
+ * @param comm the communicator of the group.
+ * @param iotype the iotype of the time-series file.
+ * @param prefix the prefix of the name of the time-series file.
+ * @param hist pointer to the history files.
+ * @param var pointer to the variable.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+static int
+write_ts_file(int iosysid, MPI_Comm comm, int iotype, const char *prefix,
+              hist_files *hist, hist_var *var)
+{
+    char filename[PIO_MAX_NAME * 2 + 16];
+    int ncid = -1, varid;
+    int *aux_varid = NULL;
+    int *aux_varid_in = NULL;
+    int coord_varid[PIO_MAX_VAR_DIMS];
+    int *dimmap = NULL;
+    int ndims;
+    int gdimlen[PIO_MAX_VAR_DIMS];
+    PIO_Offset nelems = 1, start, maplen, size;
+    PIO_Offset *compmap = NULL;
+    void *buf = NULL;
+    int ioid = -1;
+    int rank, size_comm;
+    PIO_Offset rec = 0;
+    int ret;
+
+    if ((ret = MPI_Comm_rank(comm, &rank)))
+        return ret;
+    if ((ret = MPI_Comm_size(comm, &size_comm)))
+        return ret;
+    if ((ret = PIOc_inq_ndims(hist->ncid[0], &ndims)))
+        ERR(ret);
+    if (!(dimmap = malloc(ndims * sizeof(int))))
+        ERR(PIO_ENOMEM);
+    for (int d = 0; d < ndims; d++)
+        dimmap[d] = -1;
+
+    /* Define the time-series file. */
+    snprintf(filename, sizeof(filename), "%s.%s.nc", prefix, var->name);
+    if ((ret = PIOc_createfile(iosysid, &ncid, &iotype, filename, PIO_CLOBBER)))
+    {
+        ncid = -1;
+        BAIL(ret);
+    }
+    if ((ret = pio_tool_copy_atts(hist->ncid[0], PIO_GLOBAL, ncid, PIO_GLOBAL)))
+        BAIL(ret);
+    if (hist->naux && (!(aux_varid = malloc(hist->naux * sizeof(int))) ||
+                       !(aux_varid_in = malloc(hist->naux * sizeof(int)))))
+        BAIL(PIO_ENOMEM);
+    for (int a = 0; a < hist->naux; a++)
+        if ((ret = def_ts_var(hist, &hist->aux[a], ncid, dimmap, &aux_varid[a])))
+            BAIL(ret);
+
+    /* The coordinate variables of the other dimensions. */
+    for (int d = 1; d < var->ndims; d++)
+    {
+        hist_var coord;
+        int varid_in;
+
+        coord_varid[d] = -1;
+        if ((ret = PIOc_inq_dimname(hist->ncid[0], var->dimids[d], coord.name)))
+            BAIL(ret);
+        if (PIOc_inq_varid(hist->ncid[0], coord.name, &varid_in))
+            continue;
+        if ((ret = PIOc_inq_var(hist->ncid[0], varid_in, NULL, &coord.xtype, &coord.ndims,
+                                coord.dimids, NULL)))
+            BAIL(ret);
+        if (coord.ndims != 1 || coord.dimids[0] != var->dimids[d] ||
+            coord.xtype >= PIO_STRING)
+            continue;
+        if ((ret = def_ts_var(hist, &coord, ncid, dimmap, &coord_varid[d])))
+            BAIL(ret);
+    }
+
+    if ((ret = def_ts_var(hist, var, ncid, dimmap, &varid)))
+        BAIL(ret);
+    if ((ret = PIOc_enddef(ncid)))
+        BAIL(ret);
+
+    for (int d = 1; d < var->ndims; d++)
+        if (coord_varid[d] >= 0)
+        {
+            char name[PIO_MAX_NAME + 1];
+
+            if ((ret = PIOc_inq_dimname(hist->ncid[0], var->dimids[d], name)))
+                BAIL(ret);
+            if ((ret = copy_static_var(hist, name, ncid, coord_varid[d])))
+                BAIL(ret);
+        }
+
+    /* Deal out the elements of a record in blocks. The decomposition
+     * functions take int lengths. */
+    for (int d = 1; d < var->ndims; d++)
+    {
+        PIO_Offset dimlen;
+
+        if ((ret = PIOc_inq_dimlen(hist->ncid[0], var->dimids[d], &dimlen)))
+            BAIL(ret);
+        if (dimlen > INT_MAX)
+            BAIL(PIO_EINVAL);
+        gdimlen[d - 1] = (int)dimlen;
+        nelems *= dimlen;
+    }
+    start = nelems * rank / size_comm;
+    maplen = nelems * (rank + 1) / size_comm - start;
+    if (maplen > INT_MAX)
+        BAIL(PIO_EINVAL);
+    if ((ret = PIOc_inq_type(hist->ncid[0], var->xtype, NULL, &size)))
+        BAIL(ret);
+    if (!(compmap = malloc((maplen + 1) * sizeof(PIO_Offset))) ||
+        !(buf = malloc((maplen + 1) * size)))
+        BAIL(PIO_ENOMEM);
+    for (PIO_Offset i = 0; i < maplen; i++)
+        compmap[i] = start + i;
+    if ((ret = PIOc_init_decomp(iosysid, var->xtype, var->ndims - 1, gdimlen, (int)maplen,
+                                compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+    {
+        ioid = -1;
+        BAIL(ret);
+    }
+
+    /* Copy the records. */
+    for (int h = 0; h < hist->nfiles; h++)
+    {
+        int varid_in;
+
+        if ((ret = PIOc_inq_varid(hist->ncid[h], var->name, &varid_in)))
+            BAIL(ret);
+        for (int a = 0; a < hist->naux; a++)
+            if ((ret = PIOc_inq_varid(hist->ncid[h], hist->aux[a].name, &aux_varid_in[a])))
+                BAIL(ret);
+
+        for (PIO_Offset r = 0; r < hist->nrecs[h]; r++, rec++)
+        {
+            for (int a = 0; a < hist->naux; a++)
+            {
+                PIO_Offset start_in = r, start_out = rec, count = 1;
+                long long value; /* Big enough for one value of any numeric type. */
+
+                if ((ret = PIOc_get_vara(hist->ncid[h], aux_varid_in[a], &start_in, &count,
+                                         &value)))
+                    BAIL(ret);
+                if ((ret = PIOc_put_vara(ncid, aux_varid[a], &start_out, &count, &value)))
+                    BAIL(ret);
+            }
+
+            if ((ret = PIOc_setframe(hist->ncid[h], varid_in, (int)r)))
+                BAIL(ret);
+            if ((ret = PIOc_read_darray(hist->ncid[h], varid_in, ioid, maplen, buf)))
+                BAIL(ret);
+            if ((ret = PIOc_setframe(ncid, varid, (int)rec)))
+                BAIL(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, maplen, buf, NULL)))
+                BAIL(ret);
+        }
+    }
+
+    /* The buffered writes use the decomposition, so the file is
+     * closed first. */
+    ret = PIOc_closefile(ncid);
+    ncid = -1;
+    if (ret)
+        BAIL(ret);
+
+exit:
+    if (ncid >= 0)
+        PIOc_closefile(ncid);
+    if (ioid >= 0)
+        PIOc_freedecomp(iosysid, ioid);
+    free(compmap);
+    free(buf);
+    free(aux_varid);
+    free(aux_varid_in);
+    free(dimmap);
+
+    return ret;
+}
+
+/**
+ * Convert history files to time-series files.
+ *
+ * @param argc argument count
+ * @param argv array of arguments
+ * @returns 0 for success, non-zero otherwise.
+ * @author Ed Hartnett
+ */
+int
+main(int argc, char **argv)
+{
+    struct arguments arguments = {0};
+    int iotype = PIOc_iotype_available(PIO_IOTYPE_PNETCDF) ? PIO_IOTYPE_PNETCDF :
+        PIO_IOTYPE_NETCDF;
+    int my_rank, ntasks;
+    int group, group_size;
+    MPI_Comm group_comm;
+    int iosysid;
+    hist_files hist = {0};
+    int ret;
+
+    if ((ret = MPI_Init(&argc, &argv)))
+        MPI_Abort(MPI_COMM_WORLD, ret);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ntasks);
+
+    arguments.prefix = DEFAULT_PREFIX;
+    arguments.ngroups = 1;
+    mpi_argp_parse(my_rank, &argp, argc, argv, 0, 0, &arguments);
+    if ((arguments.iotype && (pio_tool_iotype(arguments.iotype, &iotype) ||
+                              !PIOc_iotype_available(iotype))) ||
+        arguments.ngroups < 1 || arguments.ngroups > ntasks || arguments.niotasks < 0)
+    {
+        if (!my_rank)
+            fprintf(stderr, "%s: bad option value, see --help\n", PROG_NAME);
+        MPI_Finalize();
+        return 1;
+    }
+
+    /* Split the tasks into groups of neighbouring ranks. */
+    group = (int)((long long)my_rank * arguments.ngroups / ntasks);
+    if ((ret = MPI_Comm_split(MPI_COMM_WORLD, group, my_rank, &group_comm)))
+        MPI_Abort(MPI_COMM_WORLD, ret);
+    MPI_Comm_rank(group_comm, &err_rank);
+    MPI_Comm_size(group_comm, &group_size);
+    if (!arguments.niotasks || arguments.niotasks > group_size)
+        arguments.niotasks = group_size;
+
+    if ((ret = PIOc_Init_Intracomm(group_comm, arguments.niotasks,
+                                   group_size / arguments.niotasks, 0, PIO_REARR_BOX,
+                                   &iosysid)))
+        MPI_Abort(MPI_COMM_WORLD, ret);
+    if ((ret = PIOc_set_iosystem_error_handling(iosysid, PIO_RETURN_ERROR, NULL)))
+        MPI_Abort(MPI_COMM_WORLD, ret);
+
+    /* Open the history files. */
+    hist.nfiles = arguments.nfiles;
+    if (!(hist.ncid = malloc(hist.nfiles * sizeof(int))) ||
+        !(hist.nrecs = malloc(hist.nfiles * sizeof(PIO_Offset))))
+        MPI_Abort(MPI_COMM_WORLD, PIO_ENOMEM);
+    for (int h = 0; h < hist.nfiles; h++)
+    {
+        int hist_iotype = iotype;
+
+        if ((ret = PIOc_openfile(iosysid, &hist.ncid[h], &hist_iotype, arguments.files[h],
+                                 PIO_NOWRITE)))
+        {
+            if (!my_rank)
+                fprintf(stderr, "%s: cannot open %s\n", PROG_NAME, arguments.files[h]);
+            MPI_Abort(MPI_COMM_WORLD, ret);
+        }
+    }
+    if ((ret = inq_hist_files(&hist, arguments.vars)))
+        MPI_Abort(MPI_COMM_WORLD, ret);
+
+    /* Write the time-series files of the variables of this group. */
+    for (int v = group; v < hist.nts; v += arguments.ngroups)
+    {
+        if (!err_rank)
+            printf("%s: writing %s.%s.nc\n", PROG_NAME, arguments.prefix, hist.ts[v].name);
+        if ((ret = write_ts_file(iosysid, group_comm, iotype, arguments.prefix, &hist,
+                                 &hist.ts[v])))
+            MPI_Abort(MPI_COMM_WORLD, ret);
+    }
+
+    for (int h = 0; h < hist.nfiles; h++)
+        if ((ret = PIOc_closefile(hist.ncid[h])))
+            MPI_Abort(MPI_COMM_WORLD, ret);
+    free(hist.ncid);
+    free(hist.nrecs);
+    free(hist.aux);
+    free(hist.ts);
+
+    if ((ret = PIOc_free_iosystem(iosysid)))
+        MPI_Abort(MPI_COMM_WORLD, ret);
+    MPI_Comm_free(&group_comm);
+    MPI_Finalize();
+
+    return 0;
+}
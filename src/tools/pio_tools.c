@@ -0,0 +1,85 @@
+/**
+ * @file
+ * Functions shared by the PIO tools, such as pio_hist2ts, and by the
+ * pioconvert performance driver.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pio_tools.h>
+
+/** The names of the iotypes. */
+static const char *iotype_name[] = {"pnetcdf", "netcdf", "netcdf4c", "netcdf4p", NULL};
+
+/** The iotypes, in the order of their names. */
+static const int iotype_value[] = {PIO_IOTYPE_PNETCDF, PIO_IOTYPE_NETCDF,
+                                   PIO_IOTYPE_NETCDF4C, PIO_IOTYPE_NETCDF4P};
+
+/**
+ * Find an iotype from its name: pnetcdf, netcdf, netcdf4c or
+ * netcdf4p.
+ *
+ * @param name the name of the iotype.
+ * @param iotypep pointer that gets the iotype.
+ * @returns 0 for success, PIO_EINVAL for an unknown name.
+ * @author Ed Hartnett
+ */
+int
+pio_tool_iotype(const char *name, int *iotypep)
+{
+    for (int i = 0; iotype_name[i]; i++)
+        if (!strcmp(name, iotype_name[i]))
+        {
+            *iotypep = iotype_value[i];
+            return PIO_NOERR;
+        }
+
+    return PIO_EINVAL;
+}
+
+/**
+ * Copy the attributes of a variable, or the global attributes, to
+ * another file. This is collective over the tasks of the IO system.
+ *
+ * @param ncid_in the ncid of the file to copy from.
+ * @param varid_in the varid to copy from, or PIO_GLOBAL.
+ * @param ncid_out the ncid of the file to copy to, in define mode.
+ * @param varid_out the varid to copy to, or PIO_GLOBAL.
+ * @returns 0 for success, error code otherwise.
+ * @author Ed Hartnett
+ */
+int
+pio_tool_copy_atts(int ncid_in, int varid_in, int ncid_out, int varid_out)
+{
+    int natts;
+    int ret;
+
+    if (varid_in == PIO_GLOBAL)
+        ret = PIOc_inq_natts(ncid_in, &natts);
+    else
+        ret = PIOc_inq_varnatts(ncid_in, varid_in, &natts);
+
+    for (int a = 0; a < natts && !ret; a++)
+    {
+        char name[PIO_MAX_NAME + 1];
+        nc_type xtype;
+        PIO_Offset len, size;
+        void *value;
+
+        if ((ret = PIOc_inq_attname(ncid_in, varid_in, a, name)))
+            break;
+        if ((ret = PIOc_inq_att(ncid_in, varid_in, name, &xtype, &len)))
+            break;
+        if ((ret = PIOc_inq_type(ncid_in, xtype, NULL, &size)))
+            break;
+        if (!(value = malloc(len * size + 1)))
+            return PIO_ENOMEM;
+        if (!(ret = PIOc_get_att(ncid_in, varid_in, name, value)))
+            ret = PIOc_put_att(ncid_out, varid_out, name, xtype, len, value);
+        free(value);
+    }
+
+    return ret;
+}
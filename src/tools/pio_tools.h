@@ -0,0 +1,24 @@
+/**
+ * @file
+ * Functions shared by the PIO tools, such as pio_hist2ts, and by the
+ * pioconvert performance driver.
+ *
+ * @author Ed Hartnett
+ */
+#ifndef __PIO_TOOLS__
+#define __PIO_TOOLS__
+
+#include <argp.h>
+#include <pio.h>
+
+/* Find an iotype from its name. */
+int pio_tool_iotype(const char *name, int *iotypep);
+
+/* Copy the attributes of a variable, or the global attributes. */
+int pio_tool_copy_atts(int ncid_in, int varid_in, int ncid_out, int varid_out);
+
+/* Call argp_parse(), with output from rank 0 only. */
+error_t mpi_argp_parse(const int rank, const struct argp *argp, int argc, char **argv,
+                       unsigned flags, int *arg_index, void *input);
+
+#endif /* __PIO_TOOLS__ */
@@ -0,0 +1,374 @@
+/*
+ * Benchmark of the throughput of the IO server of async mode, and
+ * of the time the computation tasks stall waiting for it.
+ *
+ * For each combination of component count, number of IO tasks,
+ * message size (elements of the darray written by each computation
+ * task) and number of metadata calls, each component creates a file,
+ * makes the metadata calls (PIOc_put_att_int(), each one message to
+ * the IO tasks), writes its frames and closes the file. The time of
+ * each phase is measured on the computation tasks, and one CSV or
+ * JSON record is printed for each combination.
+ *
+ * For example:
+ *
+ * mpiexec -n 64 ./pioasyncperf -c 1,2,4 -i 4,8 -s 1000,100000 -m 0,100
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <argp.h>
+#include <mpi.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tools.h>
+
+const char *argp_program_version = "pioasyncperf 0.1";
+const char *argp_program_bug_address = "<https://github.com/NCAR/ParallelIO>";
+
+static char doc[] =
+    "a benchmark of the throughput of the async IO server";
+
+static struct argp_option options[] = {
+    {"components", 'c', "LIST", 0, "Numbers of computation components (default 1)"},
+    {"iotasks", 'i', "LIST", 0, "Numbers of IO tasks (default 1)"},
+    {"sizes", 's', "LIST", 0, "Elements written by each computation task per frame (default 100000)"},
+    {"metadata", 'm', "LIST", 0, "Numbers of metadata calls (default 100)"},
+    {"iotype", 't', "NAME", 0, "Iotype: pnetcdf,netcdf,netcdf4c,netcdf4p (default netcdf)"},
+    {"rearranger", 'R', "NAME", 0, "Rearranger: box,subset (default box)"},
+    {"frames", 'f', "N", 0, "Number of frames (default 10)"},
+    {"json", 'j', 0, 0, "Print JSON instead of CSV"},
+    {"output", 'o', "FILE", 0, "File the results are written to (default stdout)"},
+    { 0 }
+};
+
+/* The most values of each list option. */
+#define MAX_LIST 16
+
+/* The number of phases timed. */
+#define NUM_PHASES 5
+
+/* Names of the phases. */
+static const char *phase_name[NUM_PHASES] = {"create", "metadata", "write", "close", "total"};
+
+struct arguments
+{
+    char *components;
+    char *iotasks;
+    char *sizes;
+    char *metadata;
+    char *iotype;
+    char *rearranger;
+    char *output;
+    int nframes;
+    bool json;
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+    case 'c':
+        arguments->components = arg;
+        break;
+    case 'i':
+        arguments->iotasks = arg;
+        break;
+    case 's':
+        arguments->sizes = arg;
+        break;
+    case 'm':
+        arguments->metadata = arg;
+        break;
+    case 't':
+        arguments->iotype = arg;
+        break;
+    case 'R':
+        arguments->rearranger = arg;
+        break;
+    case 'f':
+        arguments->nframes = atoi(arg);
+        break;
+    case 'j':
+        arguments->json = true;
+        break;
+    case 'o':
+        arguments->output = arg;
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, 0, doc };
+
+/* Find the values of a comma separated list of numbers. */
+static int
+parse_numbers(const char *list, PIO_Offset *out)
+{
+    char buf[PIO_MAX_NAME + 1];
+    int n = 0;
+
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (char *tok = strtok(buf, ","); tok && n < MAX_LIST; tok = strtok(NULL, ","))
+        out[n++] = atoll(tok);
+
+    return n;
+}
+
+/* Write a file from one component, timing the phases. phase gets the
+ * time of each phase on this task. */
+static int
+run_component(int iosysid, MPI_Comm comp_comm, int iotype, int cmp, PIO_Offset size,
+              int nmeta, int nframes, double *phase)
+{
+    char filename[PIO_MAX_NAME + 1];
+    char name[PIO_MAX_NAME + 1];
+    int ntasks, rank;
+    int gdim;
+    int dimid[2];
+    int ncid, varid, ioid;
+    PIO_Offset *compdof;
+    int *data;
+    double start, t0;
+    int ret;
+
+    MPI_Comm_size(comp_comm, &ntasks);
+    MPI_Comm_rank(comp_comm, &rank);
+
+    /* Each task has a block of size elements. */
+    gdim = size * ntasks;
+    if (!(compdof = malloc((size ? size : 1) * sizeof(PIO_Offset))))
+        return PIO_ENOMEM;
+    if (!(data = malloc((size ? size : 1) * sizeof(int))))
+        return PIO_ENOMEM;
+    for (PIO_Offset e = 0; e < size; e++)
+    {
+        compdof[e] = rank * size + e;
+        data[e] = cmp;
+    }
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, 1, &gdim, size, compdof, &ioid, 0, NULL,
+                                NULL)))
+        return ret;
+    free(compdof);
+
+    MPI_Barrier(comp_comm);
+    t0 = start = MPI_Wtime();
+    snprintf(filename, sizeof(filename), "pioasyncperf_%d.nc", cmp);
+    if ((ret = PIOc_createfile(iosysid, &ncid, &iotype, filename, PIO_CLOBBER)))
+        return ret;
+    phase[0] = MPI_Wtime() - start;
+
+    /* Each metadata call is one message to the IO tasks. */
+    start = MPI_Wtime();
+    for (int m = 0; m < nmeta; m++)
+    {
+        snprintf(name, sizeof(name), "att%6.6d", m);
+        if ((ret = PIOc_put_att_int(ncid, PIO_GLOBAL, name, PIO_INT, 1, &m)))
+            return ret;
+    }
+    if ((ret = PIOc_def_dim(ncid, "time", PIO_UNLIMITED, &dimid[0])))
+        return ret;
+    if ((ret = PIOc_def_dim(ncid, "x", gdim, &dimid[1])))
+        return ret;
+    if ((ret = PIOc_def_var(ncid, "data", PIO_INT, 2, dimid, &varid)))
+        return ret;
+    if ((ret = PIOc_enddef(ncid)))
+        return ret;
+    phase[1] = MPI_Wtime() - start;
+
+    /* The time spent in PIOc_write_darray() is the time the
+     * computation stalls for the IO server. */
+    start = MPI_Wtime();
+    for (int f = 0; f < nframes; f++)
+    {
+        if ((ret = PIOc_setframe(ncid, varid, f)))
+            return ret;
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, size, data, NULL)))
+            return ret;
+    }
+    phase[2] = MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    if ((ret = PIOc_closefile(ncid)))
+        return ret;
+    phase[3] = MPI_Wtime() - start;
+    phase[4] = MPI_Wtime() - t0;
+
+    free(data);
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Print the results of one combination. */
+static void
+print_result(FILE *fp, struct arguments *arguments, int ncomp, int niotasks,
+             PIO_Offset size, int nmeta, double bytes, double *phase, bool first)
+{
+    double mib = bytes / (1024 * 1024);
+    double meta_us = nmeta ? phase[1] * 1e6 / nmeta : 0;
+
+    if (arguments->json)
+    {
+        fprintf(fp, "%s  {\"components\": %d, \"iotasks\": %d, \"size\": %lld, "
+                "\"metadata\": %d, \"frames\": %d, \"bytes\": %.0f",
+                first ? "" : ",\n", ncomp, niotasks, (long long)size, nmeta,
+                arguments->nframes, bytes);
+        for (int p = 0; p < NUM_PHASES; p++)
+            fprintf(fp, ", \"%s_s\": %g", phase_name[p], phase[p]);
+        fprintf(fp, ", \"metadata_us_per_call\": %g, \"MiBps\": %g}", meta_us,
+                mib / phase[NUM_PHASES - 1]);
+    }
+    else
+    {
+        if (first)
+        {
+            fprintf(fp, "components,iotasks,size,metadata,frames,bytes");
+            for (int p = 0; p < NUM_PHASES; p++)
+                fprintf(fp, ",%s_s", phase_name[p]);
+            fprintf(fp, ",metadata_us_per_call,MiBps\n");
+        }
+        fprintf(fp, "%d,%d,%lld,%d,%d,%.0f", ncomp, niotasks, (long long)size, nmeta,
+                arguments->nframes, bytes);
+        for (int p = 0; p < NUM_PHASES; p++)
+            fprintf(fp, ",%g", phase[p]);
+        fprintf(fp, ",%g,%g\n", meta_us, mib / phase[NUM_PHASES - 1]);
+    }
+    fflush(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    struct arguments arguments;
+    PIO_Offset ncomp[MAX_LIST], niotasks[MAX_LIST], size[MAX_LIST], nmeta[MAX_LIST];
+    int nncomp, nniotasks, nsize, nnmeta;
+    int iotype = PIO_IOTYPE_NETCDF;
+    int rearr = PIO_REARR_BOX;
+    FILE *fp = stdout;
+    bool first = true;
+    int rank, ntasks;
+    int ret = PIO_NOERR;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ntasks);
+
+    memset(&arguments, 0, sizeof(arguments));
+    arguments.components = "1";
+    arguments.iotasks = "1";
+    arguments.sizes = "100000";
+    arguments.metadata = "100";
+    arguments.nframes = 10;
+    mpi_argp_parse(rank, &argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.rearranger && !strcmp(arguments.rearranger, "subset"))
+        rearr = PIO_REARR_SUBSET;
+    if ((arguments.iotype && pio_tool_iotype(arguments.iotype, &iotype)) ||
+        (arguments.rearranger && rearr != PIO_REARR_SUBSET &&
+         strcmp(arguments.rearranger, "box")))
+    {
+        if (!rank)
+            fprintf(stderr, "Bad option value, see --help.\n");
+        MPI_Finalize();
+        return 1;
+    }
+    nncomp = parse_numbers(arguments.components, ncomp);
+    nniotasks = parse_numbers(arguments.iotasks, niotasks);
+    nsize = parse_numbers(arguments.sizes, size);
+    nnmeta = parse_numbers(arguments.metadata, nmeta);
+
+    if (!rank && arguments.output)
+        if (!(fp = fopen(arguments.output, "w")))
+        {
+            perror(arguments.output);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    if (!rank && arguments.json)
+        fprintf(fp, "[\n");
+
+    for (int c = 0; c < nncomp && !ret; c++)
+        for (int i = 0; i < nniotasks && !ret; i++)
+        {
+            int num_comp = ncomp[c];
+            int num_io = niotasks[i];
+            int num_procs_per_comp[MAX_LIST];
+            int iosysid[MAX_LIST];
+            MPI_Comm comp_comm[MAX_LIST];
+            MPI_Comm io_comm;
+            int my_comp = -1;
+            int first_task = num_io;
+
+            /* The computation tasks are shared between the components. */
+            if (num_comp < 1 || num_comp > MAX_LIST || num_io < 1 || ntasks - num_io < num_comp)
+                continue;
+            for (int cmp = 0; cmp < num_comp; cmp++)
+            {
+                num_procs_per_comp[cmp] = (ntasks - num_io) * (cmp + 1) / num_comp -
+                    (ntasks - num_io) * cmp / num_comp;
+                if (rank >= first_task && rank < first_task + num_procs_per_comp[cmp])
+                    my_comp = cmp;
+                first_task += num_procs_per_comp[cmp];
+                comp_comm[cmp] = MPI_COMM_NULL;
+            }
+
+            for (int s = 0; s < nsize && !ret; s++)
+                for (int m = 0; m < nnmeta && !ret; m++)
+                {
+                    double phase[NUM_PHASES] = {0};
+                    int err[2];
+                    double bytes = (double)size[s] * (ntasks - num_io) * sizeof(int) *
+                        arguments.nframes;
+
+                    /* The IO tasks do not return until the components
+                     * have freed their IO systems. */
+                    if ((ret = PIOc_init_async(MPI_COMM_WORLD, num_io, NULL, num_comp,
+                                               num_procs_per_comp, NULL, &io_comm, comp_comm,
+                                               rearr, iosysid)))
+                        break;
+
+                    if (my_comp >= 0)
+                    {
+                        if ((ret = run_component(iosysid[my_comp], comp_comm[my_comp], iotype,
+                                                 my_comp, size[s], nmeta[m], arguments.nframes,
+                                                 phase)))
+                            fprintf(stderr, "%d: component %d failed with error %d\n", rank,
+                                    my_comp, ret);
+                        PIOc_free_iosystem(iosysid[my_comp]);
+                        MPI_Comm_free(&comp_comm[my_comp]);
+                    }
+                    else
+                        MPI_Comm_free(&io_comm);
+
+                    /* Any error of any task fails the run. PIO errors
+                     * are negative, MPI errors positive. */
+                    err[0] = ret;
+                    err[1] = -ret;
+                    MPI_Allreduce(MPI_IN_PLACE, err, 2, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+                    ret = err[0] < 0 ? err[0] : -err[1];
+
+                    /* The slowest computation task sets the pace. */
+                    MPI_Allreduce(MPI_IN_PLACE, phase, NUM_PHASES, MPI_DOUBLE, MPI_MAX,
+                                  MPI_COMM_WORLD);
+                    if (!rank && !ret)
+                        print_result(fp, &arguments, num_comp, num_io, size[s], nmeta[m],
+                                     bytes, phase, first);
+                    first = false;
+                }
+        }
+
+    if (!rank && arguments.json)
+        fprintf(fp, "\n]\n");
+    if (!rank && arguments.output)
+        fclose(fp);
+
+    MPI_Finalize();
+
+    return ret ? 1 : 0;
+}
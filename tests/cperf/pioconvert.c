@@ -0,0 +1,509 @@
+/*
+ * Convert a netCDF file from one format to another with PIO, in
+ * parallel. The file is opened with any iotype, and written with
+ * another, with the chunk sizes and deflate settings given for a
+ * netCDF-4 output file. For example, a CDF5 file written with
+ * pnetcdf is made a chunked, compressed netCDF-4 file with:
+ *
+ * mpiexec -n 64 ./pioconvert -t netcdf4p -c lev/1,lat/96,lon/144 -d 1
+ * in.nc out.nc
+ *
+ * and back with:
+ *
+ * mpiexec -n 64 ./pioconvert -t pnetcdf out.nc back.nc
+ *
+ * The dimensions, variables and attributes are copied as they
+ * are. The data of each numeric variable with dimensions are read
+ * with PIOc_read_darray() and written with PIOc_write_darray(), one
+ * record at a time, with a block decomposition of its non-record
+ * dimensions over all tasks. Variables of the same type and shape
+ * share a decomposition. The records are copied in order, all
+ * variables of a record before the next, so that PIO aggregates the
+ * writes of a record and writes them while the next one is read.
+ * Other variables are copied whole with PIOc_get_vara() and
+ * PIOc_put_vara().
+ *
+ * Classic format output files are written as CDF5.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <argp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <pio.h>
+#include <pio_tools.h>
+
+const char *argp_program_version = "pioconvert 0.1";
+const char *argp_program_bug_address = "<https://github.com/NCAR/ParallelIO>";
+
+static char doc[] =
+    "convert a netCDF file to another format, in parallel with pio";
+
+static char args_doc[] = "IN OUT";
+
+static struct argp_option options[] = {
+    {"in-iotype", 'T', "IOTYPE", 0, "Iotype to read with: pnetcdf,netcdf,netcdf4c,netcdf4p (default pnetcdf)"},
+    {"iotype", 't', "IOTYPE", 0, "Iotype to write with (default netcdf4p)"},
+    {"iotasks", 'i', "N", 0, "Number of IO tasks (default all)"},
+    {"stride", 's', "N", 0, "Stride of the IO tasks (default 1)"},
+    {"chunks", 'c', "LIST", 0, "Chunk lengths of dims as dim/len,... for netCDF-4 output"},
+    {"deflate", 'd', "LEVEL", 0, "Deflate level for netCDF-4 output (default 0, none)"},
+    {"shuffle", 'S', 0, 0, "Turn on the shuffle filter for netCDF-4 output"},
+    { 0 }
+};
+
+struct arguments
+{
+    char *args[2];
+    char *in_iotype;
+    char *iotype;
+    char *chunks;
+    int niotasks;
+    int stride;
+    int deflate;
+    bool shuffle;
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+    case 'T':
+        arguments->in_iotype = arg;
+        break;
+    case 't':
+        arguments->iotype = arg;
+        break;
+    case 'i':
+        arguments->niotasks = atoi(arg);
+        break;
+    case 's':
+        arguments->stride = atoi(arg);
+        break;
+    case 'c':
+        arguments->chunks = arg;
+        break;
+    case 'd':
+        arguments->deflate = atoi(arg);
+        break;
+    case 'S':
+        arguments->shuffle = true;
+        break;
+    case ARGP_KEY_ARG:
+        if (state->arg_num >= 2)
+            argp_usage(state);
+        arguments->args[state->arg_num] = arg;
+        break;
+    case ARGP_KEY_END:
+        if (state->arg_num < 2)
+            argp_usage(state);
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+/* A decomposition of the non-record dims of some of the vars. */
+typedef struct decomp
+{
+    nc_type xtype;
+    int ndims;
+    int dimids[PIO_MAX_VAR_DIMS];
+    int ioid;
+    PIO_Offset maplen;
+} decomp;
+
+/* What is known of a var of the input file. */
+typedef struct var_info
+{
+    nc_type xtype;
+    int ndims;
+    int dimids[PIO_MAX_VAR_DIMS];
+    bool rec_var;
+
+    /* The decomposition the var is copied with, or NULL if it is
+     * copied whole. */
+    decomp *decomp;
+} var_info;
+
+/* Find the chunk length of a dim in a list of dim/len, or 0 if it is
+ * not in the list. */
+static PIO_Offset
+find_chunk(const char *list, const char *dimname)
+{
+    size_t len = strlen(dimname);
+    const char *p = list;
+
+    while (p)
+    {
+        if (!strncmp(p, dimname, len) && p[len] == '/')
+            return atoll(p + len + 1);
+        if ((p = strchr(p, ',')))
+            p++;
+    }
+
+    return 0;
+}
+
+/* Define the dims, vars and atts of the input file in the output
+ * file, which is left in data mode. */
+static int
+copy_metadata(int ncid_in, int ncid_out, int iotype, struct arguments *arguments,
+              int nvars, var_info *var)
+{
+    int ndims, unlimdimid;
+    int ret;
+
+    if ((ret = PIOc_inq_ndims(ncid_in, &ndims)))
+        return ret;
+    if ((ret = PIOc_inq_unlimdim(ncid_in, &unlimdimid)))
+        return ret;
+
+    /* The dims of a file are numbered from 0, so they keep their
+     * dimids. */
+    for (int d = 0; d < ndims; d++)
+    {
+        char name[PIO_MAX_NAME + 1];
+        PIO_Offset len;
+        int dimid;
+
+        if ((ret = PIOc_inq_dim(ncid_in, d, name, &len)))
+            return ret;
+        if ((ret = PIOc_def_dim(ncid_out, name, d == unlimdimid ? PIO_UNLIMITED : len,
+                                &dimid)))
+            return ret;
+    }
+
+    for (int v = 0; v < nvars; v++)
+    {
+        char name[PIO_MAX_NAME + 1];
+        int varid;
+
+        if ((ret = PIOc_inq_var(ncid_in, v, name, &var[v].xtype, &var[v].ndims,
+                                var[v].dimids, NULL)))
+            return ret;
+        var[v].rec_var = var[v].ndims && var[v].dimids[0] == unlimdimid;
+        if ((ret = PIOc_def_var(ncid_out, name, var[v].xtype, var[v].ndims, var[v].dimids,
+                                &varid)))
+            return ret;
+
+        /* Chunk and compress netCDF-4 vars with dims, as asked. */
+        if ((iotype == PIO_IOTYPE_NETCDF4C || iotype == PIO_IOTYPE_NETCDF4P) && var[v].ndims)
+        {
+            if (arguments->chunks)
+            {
+                PIO_Offset chunksize[PIO_MAX_VAR_DIMS];
+
+                for (int d = 0; d < var[v].ndims; d++)
+                {
+                    char dimname[PIO_MAX_NAME + 1];
+
+                    if ((ret = PIOc_inq_dim(ncid_in, var[v].dimids[d], dimname,
+                                            &chunksize[d])))
+                        return ret;
+                    if (var[v].dimids[d] == unlimdimid)
+                        chunksize[d] = 1;
+                    if (find_chunk(arguments->chunks, dimname) > 0)
+                        chunksize[d] = find_chunk(arguments->chunks, dimname);
+                }
+                if ((ret = PIOc_def_var_chunking(ncid_out, varid, NC_CHUNKED, chunksize)))
+                    return ret;
+            }
+            if (arguments->deflate > 0 || arguments->shuffle)
+                if ((ret = PIOc_def_var_deflate(ncid_out, varid, arguments->shuffle,
+                                                arguments->deflate > 0, arguments->deflate)))
+                    return ret;
+        }
+
+        if ((ret = pio_tool_copy_atts(ncid_in, v, ncid_out, v)))
+            return ret;
+    }
+
+    if ((ret = pio_tool_copy_atts(ncid_in, PIO_GLOBAL, ncid_out, PIO_GLOBAL)))
+        return ret;
+
+    return PIOc_enddef(ncid_out);
+}
+
+/* Find or make the decomposition of the non-record dims of a var. It
+ * is a block decomposition of the elements of a record over all
+ * tasks. */
+static int
+get_decomp(int iosysid, int ncid, int rank, int ntasks, var_info *var, decomp *decomps,
+           int *ndecomps)
+{
+    int first = var->rec_var ? 1 : 0;
+    int ndims = var->ndims - first;
+    decomp *dc = &decomps[*ndecomps];
+    int gdimlen[PIO_MAX_VAR_DIMS];
+    PIO_Offset nelems = 1, start;
+    PIO_Offset *compmap;
+    int ret;
+
+    for (int i = 0; i < *ndecomps; i++)
+        if (decomps[i].xtype == var->xtype && decomps[i].ndims == ndims &&
+            !memcmp(decomps[i].dimids, var->dimids + first, ndims * sizeof(int)))
+        {
+            var->decomp = &decomps[i];
+            return PIO_NOERR;
+        }
+
+    dc->xtype = var->xtype;
+    dc->ndims = ndims;
+    memcpy(dc->dimids, var->dimids + first, ndims * sizeof(int));
+    for (int d = 0; d < ndims; d++)
+    {
+        PIO_Offset len;
+
+        if ((ret = PIOc_inq_dimlen(ncid, dc->dimids[d], &len)))
+            return ret;
+        gdimlen[d] = (int)len;
+        nelems *= len;
+    }
+    start = nelems * rank / ntasks;
+    dc->maplen = nelems * (rank + 1) / ntasks - start;
+    if (!(compmap = malloc((dc->maplen + 1) * sizeof(PIO_Offset))))
+        return PIO_ENOMEM;
+    for (PIO_Offset i = 0; i < dc->maplen; i++)
+        compmap[i] = start + i;
+    ret = PIOc_init_decomp(iosysid, dc->xtype, ndims, gdimlen, (int)dc->maplen, compmap,
+                           &dc->ioid, PIO_REARR_BOX, NULL, NULL);
+    free(compmap);
+    if (ret)
+        return ret;
+
+    var->decomp = dc;
+    (*ndecomps)++;
+
+    return PIO_NOERR;
+}
+
+/* Copy a var whole. The counts are those of the input file, since
+ * the output file may not have all the records yet. */
+static int
+copy_whole_var(int ncid_in, int ncid_out, int varid, var_info *var)
+{
+    PIO_Offset start[PIO_MAX_VAR_DIMS] = {0}, count[PIO_MAX_VAR_DIMS];
+    PIO_Offset len = 1, size;
+    void *buf;
+    int ret;
+
+    for (int d = 0; d < var->ndims; d++)
+    {
+        if ((ret = PIOc_inq_dimlen(ncid_in, var->dimids[d], &count[d])))
+            return ret;
+        len *= count[d];
+    }
+    if ((ret = PIOc_inq_type(ncid_in, var->xtype, NULL, &size)))
+        return ret;
+    if (!(buf = malloc(len * size + 1)))
+        return PIO_ENOMEM;
+    if (!(ret = PIOc_get_vara(ncid_in, varid, start, count, buf)))
+        ret = PIOc_put_vara(ncid_out, varid, start, count, buf);
+    free(buf);
+
+    return ret;
+}
+
+/* Copy the records of the record vars, all vars of a record before
+ * the next, and the whole of the other vars. Add the bytes copied to
+ * bytes. */
+static int
+copy_vars(int ncid_in, int ncid_out, int nvars, var_info *var, PIO_Offset nrecs, void *buf,
+          double *bytes)
+{
+    PIO_Offset size;
+    int ret;
+
+    for (int v = 0; v < nvars; v++)
+    {
+        if ((ret = PIOc_inq_type(ncid_in, var[v].xtype, NULL, &size)))
+            return ret;
+        if (!var[v].decomp)
+        {
+            if ((ret = copy_whole_var(ncid_in, ncid_out, v, &var[v])))
+                return ret;
+        }
+        else if (!var[v].rec_var)
+        {
+            if ((ret = PIOc_read_darray(ncid_in, v, var[v].decomp->ioid,
+                                        var[v].decomp->maplen, buf)))
+                return ret;
+            if ((ret = PIOc_write_darray(ncid_out, v, var[v].decomp->ioid,
+                                         var[v].decomp->maplen, buf, NULL)))
+                return ret;
+        }
+        if (var[v].decomp)
+            *bytes += (double)var[v].decomp->maplen * size * (var[v].rec_var ? nrecs : 1);
+    }
+
+    for (PIO_Offset r = 0; r < nrecs; r++)
+        for (int v = 0; v < nvars; v++)
+        {
+            if (!var[v].rec_var || !var[v].decomp)
+                continue;
+            if ((ret = PIOc_setframe(ncid_in, v, (int)r)))
+                return ret;
+            if ((ret = PIOc_read_darray(ncid_in, v, var[v].decomp->ioid,
+                                        var[v].decomp->maplen, buf)))
+                return ret;
+            if ((ret = PIOc_setframe(ncid_out, v, (int)r)))
+                return ret;
+            if ((ret = PIOc_write_darray(ncid_out, v, var[v].decomp->ioid,
+                                         var[v].decomp->maplen, buf, NULL)))
+                return ret;
+        }
+
+    /* Flush the buffered writes, which use the decompositions. */
+    return PIOc_sync(ncid_out);
+}
+
+/* Copy the data of all vars, and return the number of bytes
+ * copied. The decompositions and the buffer are freed on all
+ * returns. */
+static int
+copy_data(int iosysid, int ncid_in, int ncid_out, int rank, int ntasks, int nvars,
+          var_info *var, double *bytes)
+{
+    decomp *decomps;
+    int ndecomps = 0;
+    PIO_Offset nrecs = 0, maxlen = 1, size;
+    int unlimdimid;
+    void *buf = NULL;
+    int ret;
+
+    if ((ret = PIOc_inq_unlimdim(ncid_in, &unlimdimid)))
+        return ret;
+    if (unlimdimid >= 0)
+        if ((ret = PIOc_inq_dimlen(ncid_in, unlimdimid, &nrecs)))
+            return ret;
+    if (!(decomps = malloc((nvars + 1) * sizeof(decomp))))
+        return PIO_ENOMEM;
+
+    /* Find the decompositions, and the largest buffer they need. */
+    for (int v = 0; v < nvars && !ret; v++)
+    {
+        var[v].decomp = NULL;
+        if (var[v].xtype == PIO_CHAR || var[v].xtype == PIO_STRING ||
+            var[v].ndims == (var[v].rec_var ? 1 : 0))
+            continue;
+        if (!(ret = get_decomp(iosysid, ncid_in, rank, ntasks, &var[v], decomps, &ndecomps)) &&
+            !(ret = PIOc_inq_type(ncid_in, var[v].xtype, NULL, &size)))
+            if (var[v].decomp->maplen * size > maxlen)
+                maxlen = var[v].decomp->maplen * size;
+    }
+    if (!ret && !(buf = malloc(maxlen)))
+        ret = PIO_ENOMEM;
+
+    *bytes = 0;
+    if (!ret)
+        ret = copy_vars(ncid_in, ncid_out, nvars, var, nrecs, buf, bytes);
+
+    for (int i = 0; i < ndecomps; i++)
+    {
+        int ret2;
+
+        if ((ret2 = PIOc_freedecomp(iosysid, decomps[i].ioid)) && !ret)
+            ret = ret2;
+    }
+    free(decomps);
+    free(buf);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    struct arguments arguments;
+    int in_iotype, iotype;
+    int iosysid;
+    int ncid_in, ncid_out;
+    int nvars;
+    var_info *var = NULL;
+    double bytes = 0, start;
+    int rank;
+    int ntasks;
+    int ret = PIO_NOERR;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ntasks);
+
+    memset(&arguments, 0, sizeof(arguments));
+    arguments.in_iotype = "pnetcdf";
+    arguments.iotype = "netcdf4p";
+    arguments.niotasks = ntasks;
+    arguments.stride = 1;
+    mpi_argp_parse(rank, &argp, argc, argv, 0, 0, &arguments);
+
+    if (pio_tool_iotype(arguments.in_iotype, &in_iotype) ||
+        pio_tool_iotype(arguments.iotype, &iotype) || arguments.niotasks < 1 ||
+        arguments.stride < 1 || (arguments.niotasks - 1) * arguments.stride >= ntasks ||
+        arguments.deflate < 0)
+    {
+        if (!rank)
+            fprintf(stderr, "Bad option value, see --help.\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if ((ret = PIOc_Init_Intracomm(MPI_COMM_WORLD, arguments.niotasks, arguments.stride, 0,
+                                   PIO_REARR_BOX, &iosysid)))
+        MPI_Abort(MPI_COMM_WORLD, ret);
+    PIOc_Set_IOSystem_Error_Handling(iosysid, PIO_BCAST_ERROR);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    start = MPI_Wtime();
+
+    /* Open the input file, and create the output file like it. */
+    if (!(ret = PIOc_openfile(iosysid, &ncid_in, &in_iotype, arguments.args[0], PIO_NOWRITE)))
+    {
+        int cmode = PIO_CLOBBER;
+
+        if (iotype == PIO_IOTYPE_PNETCDF || iotype == PIO_IOTYPE_NETCDF)
+            cmode |= PIO_64BIT_DATA;
+        if (!(ret = PIOc_inq_nvars(ncid_in, &nvars)) &&
+            !(ret = (var = malloc((nvars + 1) * sizeof(var_info))) ? PIO_NOERR : PIO_ENOMEM) &&
+            !(ret = PIOc_createfile(iosysid, &ncid_out, &iotype, arguments.args[1], cmode)))
+        {
+            if (!(ret = copy_metadata(ncid_in, ncid_out, iotype, &arguments, nvars, var)))
+                ret = copy_data(iosysid, ncid_in, ncid_out, rank, ntasks, nvars, var, &bytes);
+            if (!ret)
+                ret = PIOc_closefile(ncid_out);
+        }
+        if (!ret)
+            ret = PIOc_closefile(ncid_in);
+    }
+    free(var);
+
+    if (ret)
+    {
+        if (!rank)
+            fprintf(stderr, "converting %s to %s failed with error %d\n", arguments.args[0],
+                    arguments.args[1], ret);
+    }
+    else
+    {
+        double time = MPI_Wtime() - start;
+
+        MPI_Allreduce(MPI_IN_PLACE, &bytes, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        if (!rank)
+            printf("converted %s to %s: %.0f bytes of darrays in %g s, %g MiB/s\n",
+                   arguments.args[0], arguments.args[1], bytes, time,
+                   bytes / (1024 * 1024) / time);
+    }
+
+    PIOc_free_iosystem(iosysid);
+    MPI_Finalize();
+
+    return ret ? 1 : 0;
+}
@@ -1,28 +1,88 @@
+/*
+ * Benchmark of PIO with the decompositions of a real model. The
+ * decompositions are read from decomp files written by
+ * PIOc_write_nc_decomp() or PIOc_write_nc_decomp_ragged(). For each
+ * combination of iotype, rearranger, number of IO tasks, rearranger
+ * comm type and pnetcdf buffer limit, N variables are written over M
+ * frames, and read back. The bandwidth and the time of each phase are
+ * printed as CSV or JSON, one record for each combination.
+ *
+ * For example:
+ *
+ * mpiexec -n 64 ./piodecomptest -w decomp.nc -t pnetcdf,netcdf4p
+ * -R box,subset -i 4,8,16 -n 10 -f 3 -o results.csv
+ *
+ * The number of MPI tasks must be the number of tasks of the decomp
+ * files. Instead of a decomp file, a synthetic decomposition may be
+ * generated with -g (see tests/performance/decomp_gen.h), for
+ * example -g cubed_sphere -G 120,0,30 for 6 panels of 120 x 120
+ * columns with 30 levels.
+ *
+ * @author Jim Edwards, Ed Hartnett
+ */
 #include <config.h>
 #include <argp.h>
 #include <mpi.h>
 #include <pio.h>
 #include <pio_internal.h>
+#include <decomp_gen.h>
 
-const char *argp_program_version = "pioperformance 0.1";
+const char *argp_program_version = "pioperformance 0.2";
 const char *argp_program_bug_address = "<https://github.com/NCAR/ParallelIO>";
 
-static char doc[] = 
+static char doc[] =
     "a test of pio for performance and correctness of a given decomposition";
 
 static struct argp_option options[] = {
     {"wdecomp", 'w', "FILE", 0, "Decomposition file for write"},
     {"rdecomp", 'r', "FILE", 0, "Decomposition file for read (same as write if not provided)"},
-    {"variable", 'v', "NAME", 0, "Variable name to write and/or read"},
+    {"variable", 'v', "NAME", 0, "Base name of the variables to write and read"},
+    {"iotypes", 't', "LIST", 0, "Iotypes: pnetcdf,netcdf,netcdf4c,netcdf4p (default pnetcdf)"},
+    {"rearrangers", 'R', "LIST", 0, "Rearrangers: box,subset (default subset)"},
+    {"iotasks", 'i', "LIST", 0, "Numbers of IO tasks (default 4)"},
+    {"stride", 's', "N", 0, "Stride of the IO tasks (default 1)"},
+    {"comm", 'c', "LIST", 0, "Rearranger comm types: coll,p2p,neighbor,shm (default coll)"},
+    {"max-pend-req", 'm', "N", 0, "Max pending requests of the p2p comm type (default unlimited)"},
+    {"handshake", 'H', 0, 0, "Use handshaking and isends in the p2p comm type"},
+    {"buffer-limits", 'b', "LIST", 0, "Pnetcdf buffer limits in bytes (default the library's)"},
+    {"nvars", 'n', "N", 0, "Number of variables (default 1)"},
+    {"frames", 'f', "N", 0, "Number of frames (default 1)"},
+    {"verify", 'x', 0, 0, "Check the data read"},
+    {"json", 'j', 0, 0, "Print JSON instead of CSV"},
+    {"output", 'o', "FILE", 0, "File the results are written to (default stdout)"},
+    {"generate", 'g', "TYPE", 0, "Generate the decomposition: block,cubed_sphere,sfc,land"},
+    {"gdims", 'G', "NX,NY,NZ", 0, "Size of the generated decomposition (default 360,180,1)"},
+    {"halo", 'a', "N", 0, "Halo width of the generated block decomposition (default 0)"},
+    {"hole-fraction", 'l', "F", 0, "Fraction of ocean of the generated land decomposition (default 0.3)"},
     { 0 }
 };
 
-struct arguments 
+/* The most values of each list option. */
+#define MAX_LIST 16
+
+struct arguments
 {
     char *args[2];
     char *wdecomp_file;
     char *rdecomp_file;
     char *varname;
+    char *iotypes;
+    char *rearrangers;
+    char *iotasks;
+    char *comms;
+    char *buffer_limits;
+    char *output;
+    char *generate;
+    char *gdims;
+    int halo;
+    double hole_fraction;
+    int stride;
+    int max_pend_req;
+    bool handshake;
+    int nvars;
+    int nframes;
+    bool verify;
+    bool json;
 };
 
 static error_t
@@ -41,6 +101,57 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case 'v':
         arguments->varname = arg;
         break;
+    case 't':
+        arguments->iotypes = arg;
+        break;
+    case 'R':
+        arguments->rearrangers = arg;
+        break;
+    case 'i':
+        arguments->iotasks = arg;
+        break;
+    case 's':
+        arguments->stride = atoi(arg);
+        break;
+    case 'c':
+        arguments->comms = arg;
+        break;
+    case 'm':
+        arguments->max_pend_req = atoi(arg);
+        break;
+    case 'H':
+        arguments->handshake = true;
+        break;
+    case 'b':
+        arguments->buffer_limits = arg;
+        break;
+    case 'n':
+        arguments->nvars = atoi(arg);
+        break;
+    case 'f':
+        arguments->nframes = atoi(arg);
+        break;
+    case 'x':
+        arguments->verify = true;
+        break;
+    case 'j':
+        arguments->json = true;
+        break;
+    case 'o':
+        arguments->output = arg;
+        break;
+    case 'g':
+        arguments->generate = arg;
+        break;
+    case 'G':
+        arguments->gdims = arg;
+        break;
+    case 'a':
+        arguments->halo = atoi(arg);
+        break;
+    case 'l':
+        arguments->hole_fraction = atof(arg);
+        break;
     case ARGP_KEY_ARG:
         if (state->arg_num >= 2)
             argp_usage(state);
@@ -63,270 +174,465 @@ error_t mpi_argp_parse(const int rank,
                        int *arg_index,
                        void *input);
 
-static int debug = 0;
-
-double *dvarw, *dvarr;
-float *fvarw, *fvarr;
-int *ivarw, *ivarr;
-char *cvarw, *cvarr;
-
-int test_write_darray(int iosys, const char decomp_file[], int rank, const char myvarname[])
+/* The names of the values of the list options. */
+static const char *iotype_name[] = {"pnetcdf", "netcdf", "netcdf4c", "netcdf4p", NULL};
+static const int iotype_value[] = {PIO_IOTYPE_PNETCDF, PIO_IOTYPE_NETCDF,
+                                   PIO_IOTYPE_NETCDF4C, PIO_IOTYPE_NETCDF4P};
+static const char *rearr_name[] = {"box", "subset", NULL};
+static const int rearr_value[] = {PIO_REARR_BOX, PIO_REARR_SUBSET};
+static const char *comm_name[] = {"p2p", "coll", "neighbor", "shm", NULL};
+static const int comm_value[] = {PIO_REARR_COMM_P2P, PIO_REARR_COMM_COLL,
+                                 PIO_REARR_COMM_NEIGHBOR, PIO_REARR_COMM_SHM};
+
+/* The timers of the phases, see PIOc_get_timing(). */
+#define NUM_PHASES 4
+static const char *phase_timer[NUM_PHASES][2] = {
+    {"PIO:rearrange_comp2io", NULL},
+    {"PIO:write_darray_multi_par", "PIO:write_darray_multi_serial"},
+    {"PIO:rearrange_io2comp", NULL},
+    {"PIO:read_darray_nc", "PIO:read_darray_nc_serial"}};
+static const char *phase_name[NUM_PHASES] = {"comp2io", "write_io", "io2comp", "read_io"};
+
+/* The results of one combination. */
+typedef struct result
 {
-    int ierr;
-    int comm_size;
-    int ncid;
-    int iotype = PIO_IOTYPE_PNETCDF;
-    int ndims;
-    int *global_dimlen;
-    int num_tasks;
-    int *maplen;
-    int maxmaplen;
-    int *full_map;
-    int *dimid;
-    int varid;
-    int globalsize;
-    int ioid;
-    char dimname[PIO_MAX_NAME];
-    char varname[PIO_MAX_NAME];
-
-    ierr = pioc_read_nc_decomp_int(iosys, decomp_file, &ndims, &global_dimlen, &num_tasks, 
-                                   &maplen, &maxmaplen, &full_map, NULL, NULL, NULL, NULL, NULL);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
-
-    ierr = MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
-    /* TODO: allow comm_size to be >= num_tasks */
-    if(comm_size != num_tasks)
-    {
-        if(rank == 0)
-        {
-            printf("Not enough MPI tasks for decomp, expected task count %d\n",num_tasks);
-            ierr = MPI_Abort(MPI_COMM_WORLD, -1);
-        }
-    }
-       
-    ierr = PIOc_createfile(iosys, &ncid, &iotype, "testfile.nc", PIO_CLOBBER);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
-    
-    dimid = calloc(ndims,sizeof(int));
-    for(int i=0; i<ndims; i++)
+    int iotype;
+    int rearr;
+    int niotasks;
+    int comm;
+    PIO_Offset buffer_limit;
+    double bytes;
+    double write_time;
+    double read_time;
+    double phase[NUM_PHASES];
+    int errors;
+} result;
+
+/* Find the values of a comma separated list of names. Returns the
+ * number of values, or -1 if a name is not known. */
+static int
+parse_names(const char *list, const char **names, const int *values, int *out)
+{
+    char buf[PIO_MAX_NAME + 1];
+    int n = 0;
+
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (char *tok = strtok(buf, ","); tok && n < MAX_LIST; tok = strtok(NULL, ","))
     {
-        sprintf(dimname,"dim%4.4d",i);
-        ierr = PIOc_def_dim(ncid, dimname, (PIO_Offset) global_dimlen[i], &(dimid[i]));
-        if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+        int i;
+
+        for (i = 0; names[i]; i++)
+            if (!strcmp(tok, names[i]))
+                break;
+        if (!names[i])
+            return -1;
+        out[n++] = values[i];
     }
-    /* TODO: support multiple variables and types*/
-    if(myvarname != NULL)
-        sprintf(varname,"%s",myvarname);        
-    else
-        sprintf(varname,"var%4.4d",0);
 
-    ierr = PIOc_def_var(ncid, varname, PIO_DOUBLE, ndims, dimid, &varid);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+    return n;
+}
 
-    free(dimid);
-    ierr = PIOc_enddef(ncid);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+/* Find the values of a comma separated list of numbers. */
+static int
+parse_numbers(const char *list, PIO_Offset *out)
+{
+    char buf[PIO_MAX_NAME + 1];
+    int n = 0;
 
-    PIO_Offset *dofmap;
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (char *tok = strtok(buf, ","); tok && n < MAX_LIST; tok = strtok(NULL, ","))
+        out[n++] = atoll(tok);
 
-    if (!(dofmap = malloc(sizeof(PIO_Offset) * maplen[rank])))
-        return PIO_ENOMEM;
+    return n;
+}
 
-    /* Copy array into PIO_Offset array. */
-    dvarw = malloc(sizeof(double)*maplen[rank]);
-    for (int e = 0; e < maplen[rank]; e++)
-    {
-        dofmap[e] = full_map[rank * maxmaplen + e]+1;
-        dvarw[e] = dofmap[e];
-    }
-    /* allocated in pioc_read_nc_decomp_int */
-    free(full_map);
-    ierr = PIOc_InitDecomp(iosys, PIO_DOUBLE, ndims, global_dimlen, maplen[rank],
-                           dofmap, &ioid, NULL, NULL, NULL);
-
-    free(global_dimlen);
-    double dsum=0;
-    for(int i=0; i < maplen[rank]; i++)
-        dsum += dvarw[i];
-    printf("%d: dvarwsum = %d\n",rank, dsum);
-
-    ierr = PIOc_write_darray(ncid, varid, ioid, maplen[rank], dvarw, NULL);
-    free(maplen);
-    ierr = PIOc_closefile(ncid);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
-
-    return ierr;
+/* Find the name of a value of a list option. */
+static const char *
+value_name(int value, const char **names, const int *values)
+{
+    for (int i = 0; names[i]; i++)
+        if (values[i] == value)
+            return names[i];
+    return "unknown";
 }
 
+/* The value written to element e (1-based, in the global array) of
+ * var v at frame f. */
+static double
+data_value(PIO_Offset e, int v, int f)
+{
+    return e + v * 0.001 + f * 0.000001;
+}
 
-int test_read_darray(int iosys,const char decomp_file[], int rank, const char myvarname[])
+/* Get the time of the phases since the last PIOc_reset_timing(), the
+ * maximum over all tasks. */
+static int
+get_phase_times(int iosysid, double *phase)
 {
-    int ierr;
-    int comm_size;
-    int ncid;
-    int iotype = PIO_IOTYPE_PNETCDF;
-    int ndims;
-    int *global_dimlen;
-    int num_tasks;
-    int *maplen;
-    int maxmaplen;
-    int *full_map;
-    int *dimid;
-    int varid;
-    int globalsize;
-    int ioid;
-    int pio_type;
-    char dimname[PIO_MAX_NAME];
-    char varname[PIO_MAX_NAME];
-
-    ierr = pioc_read_nc_decomp_int(iosys, decomp_file, &ndims, &global_dimlen, &num_tasks, 
-                                   &maplen, &maxmaplen, &full_map, NULL, NULL, NULL, NULL, NULL);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
-
-    ierr = MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
-    /* TODO: allow comm_size to be >= num_tasks */
-    if(comm_size != num_tasks)
+    for (int p = 0; p < NUM_PHASES; p++)
     {
-        if(rank == 0)
+        phase[p] = 0;
+        for (int t = 0; t < 2 && phase_timer[p][t]; t++)
         {
-            printf("Not enough MPI tasks for decomp, expected task count %d\n",num_tasks);
-            ierr = MPI_Abort(MPI_COMM_WORLD, -1);
+            double time;
+            int ret;
+
+            if ((ret = PIOc_get_timing(iosysid, phase_timer[p][t], &time, NULL)))
+                return ret;
+            phase[p] += time;
         }
     }
-       
-    ierr = PIOc_openfile(iosys, &ncid, &iotype, "testfile.nc", PIO_NOWRITE);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
-    
-    /* TODO: support multiple variables and types*/
-    if(myvarname != NULL)
-        sprintf(varname,"%s",myvarname);        
-    else
-        sprintf(varname,"var%4.4d",0);
-    ierr = PIOc_inq_varid(ncid, varname, &varid);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
 
-    ierr = PIOc_inq_varndims(ncid, varid, &ndims);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+    return MPI_Allreduce(MPI_IN_PLACE, phase, NUM_PHASES, MPI_DOUBLE, MPI_MAX,
+                         MPI_COMM_WORLD);
+}
 
-    ierr = PIOc_inq_vartype(ncid, varid, &pio_type);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+/* Generate a synthetic decomposition. */
+static int
+generate_decomp(int iosysid, struct arguments *arguments, int rank, int *ioid)
+{
+    PIO_Offset dims[3] = {360, 180, 1};
+    PIO_Offset maplen;
+    PIO_Offset *map;
+    int type = decomp_gen_type(arguments->generate);
+    int ntasks;
+    int ndims;
+    int gdims[3];
+    int ret;
+
+    if (arguments->gdims)
+        parse_numbers(arguments->gdims, dims);
+    MPI_Comm_size(MPI_COMM_WORLD, &ntasks);
+    if ((ret = decomp_gen_dims(type, dims[0], dims[1], dims[2], &ndims, gdims)))
+        return ret;
+    if ((ret = decomp_gen(type, rank, ntasks, dims[0], dims[1], dims[2], arguments->halo,
+                          arguments->hole_fraction, &maplen, NULL)))
+        return ret;
+    if (!(map = malloc((maplen ? maplen : 1) * sizeof(PIO_Offset))))
+        return PIO_ENOMEM;
+    if (!(ret = decomp_gen(type, rank, ntasks, dims[0], dims[1], dims[2], arguments->halo,
+                           arguments->hole_fraction, &maplen, map)))
+        ret = PIOc_InitDecomp(iosysid, PIO_DOUBLE, ndims, gdims, maplen, map, ioid, NULL,
+                              NULL, NULL);
+    free(map);
 
-    dimid = calloc(ndims,sizeof(int));
-    ierr = PIOc_inq_vardimid(ncid, varid, dimid);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+    return ret;
+}
 
-    for(int i=0; i<ndims; i++)
+/* Write and read the vars with one iotype and IO system. */
+static int
+run_case(int iosysid, struct arguments *arguments, int rank, result *res)
+{
+    char filename[PIO_MAX_NAME + 1];
+    char name[PIO_MAX_NAME + 1];
+    const char *base = arguments->varname ? arguments->varname : "var";
+    io_desc_t *iodesc;
+    int wioid, rioid;
+    int ncid;
+    int *dimid;
+    int varid[arguments->nvars];
+    PIO_Offset arraylen;
+    PIO_Offset gsize = 1;
+    double *data;
+    double start;
+    int ret;
+
+    /* Generate or read the decompositions. */
+    if (arguments->generate)
     {
-        PIO_Offset gdimlen;
-        ierr = PIOc_inq_dimlen(ncid, dimid[i], &gdimlen);
-        
-        pioassert(gdimlen == global_dimlen[i], "testfile.nc does not match decomposition file",__FILE__,__LINE__);
+        if ((ret = generate_decomp(iosysid, arguments, rank, &wioid)))
+            return ret;
     }
-    free(dimid);
-    PIO_Offset *dofmap;
-
-    if (!(dofmap = malloc(sizeof(PIO_Offset) * maplen[rank])))
+    else if ((ret = PIOc_read_nc_decomp(iosysid, arguments->wdecomp_file, &wioid,
+                                        MPI_COMM_WORLD, PIO_DOUBLE, NULL, NULL, NULL)))
+        return ret;
+    rioid = wioid;
+    if (!arguments->generate && strcmp(arguments->rdecomp_file, arguments->wdecomp_file))
+        if ((ret = PIOc_read_nc_decomp(iosysid, arguments->rdecomp_file, &rioid,
+                                       MPI_COMM_WORLD, PIO_DOUBLE, NULL, NULL, NULL)))
+            return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(wioid)))
+        return PIO_EBADID;
+    arraylen = iodesc->maplen;
+    for (int d = 0; d < iodesc->ndims; d++)
+        gsize *= iodesc->dimlen[d];
+    res->bytes = (double)gsize * sizeof(double) * arguments->nvars * arguments->nframes;
+
+    if (!(data = malloc((arraylen ? arraylen : 1) * sizeof(double))))
         return PIO_ENOMEM;
 
-    for (int e = 0; e < maplen[rank]; e++)
+    /* Create the file, with a time dim and the dims of the decomp. */
+    snprintf(filename, sizeof(filename), "piodecomptest_%s.nc",
+             value_name(res->iotype, iotype_name, iotype_value));
+    if (!(dimid = malloc((iodesc->ndims + 1) * sizeof(int))))
+        return PIO_ENOMEM;
+    MPI_Barrier(MPI_COMM_WORLD);
+    if ((ret = PIOc_reset_timing(iosysid)))
+        return ret;
+    start = MPI_Wtime();
+    if ((ret = PIOc_createfile(iosysid, &ncid, &res->iotype, filename, PIO_CLOBBER)))
+        return ret;
+    if ((ret = PIOc_def_dim(ncid, "time", PIO_UNLIMITED, &dimid[0])))
+        return ret;
+    for (int d = 0; d < iodesc->ndims; d++)
     {
-        dofmap[e] = full_map[rank * maxmaplen + e] + 1;
+        snprintf(name, sizeof(name), "dim%4.4d", d);
+        if ((ret = PIOc_def_dim(ncid, name, (PIO_Offset)iodesc->dimlen[d], &dimid[d + 1])))
+            return ret;
     }
-    free(full_map);
-//    PIOc_set_log_level(3);
-    ierr = PIOc_InitDecomp(iosys, pio_type, ndims, global_dimlen, maplen[rank],
-                           dofmap, &ioid, NULL, NULL, NULL);
-    free(dofmap);
-    free(global_dimlen);
-    switch(pio_type)
+    for (int v = 0; v < arguments->nvars; v++)
     {
-    case PIO_DOUBLE:
-        dvarr = malloc(sizeof(double)*maplen[rank]);
-        ierr = PIOc_read_darray(ncid, varid, ioid, maplen[rank], dvarr);
-        double dsum=0;
-        for(int i=0; i < maplen[rank]; i++)
-            dsum += dvarr[i];
-        printf("%d: dsum = %d\n",rank, dsum);
-        break;
-    case PIO_INT:
-        ivarr = malloc(sizeof(int)*maplen[rank]);
-        ierr = PIOc_read_darray(ncid, varid, ioid, maplen[rank], ivarr);
-        int isum=0;
-        for(int i=0; i < maplen[rank]; i++)
-            isum += ivarr[i];
-        printf("%d: isum = %d\n",rank, isum);
-        break;
-    case PIO_FLOAT:
-        fvarr = malloc(sizeof(float)*maplen[rank]);
-        ierr = PIOc_read_darray(ncid, varid, ioid, maplen[rank], fvarr);
-        float fsum=0;
-        for(int i=0; i < maplen[rank]; i++)
-            fsum += fvarr[i];
-        printf("%d: fsum = %f\n",rank, fsum);
-        break;
-    case PIO_BYTE:
-        cvarr = malloc(sizeof(char)*maplen[rank]);
-        ierr = PIOc_read_darray(ncid, varid, ioid, maplen[rank], cvarr);
-        int csum=0;
-        for(int i=0; i < maplen[rank]; i++)
-            csum += (int) cvarr[i];
-        printf("%d: csum = %d\n",rank, csum);
-        break;
+        snprintf(name, sizeof(name), "%s%4.4d", base, v);
+        if ((ret = PIOc_def_var(ncid, name, PIO_DOUBLE, iodesc->ndims + 1, dimid, &varid[v])))
+            return ret;
     }
+    if ((ret = PIOc_enddef(ncid)))
+        return ret;
+
+    /* Write the frames. */
+    for (int f = 0; f < arguments->nframes; f++)
+        for (int v = 0; v < arguments->nvars; v++)
+        {
+            for (PIO_Offset e = 0; e < arraylen; e++)
+                data[e] = data_value(iodesc->map[e], v, f);
+            if ((ret = PIOc_setframe(ncid, varid[v], f)))
+                return ret;
+            if ((ret = PIOc_write_darray(ncid, varid[v], wioid, arraylen, data, NULL)))
+                return ret;
+        }
+    if ((ret = PIOc_closefile(ncid)))
+        return ret;
+    res->write_time = MPI_Wtime() - start;
+
+    /* Read them back. */
+    if (!(iodesc = pio_get_iodesc_from_id(rioid)))
+        return PIO_EBADID;
+    arraylen = iodesc->maplen;
+    free(data);
+    if (!(data = malloc((arraylen ? arraylen : 1) * sizeof(double))))
+        return PIO_ENOMEM;
+    MPI_Barrier(MPI_COMM_WORLD);
+    start = MPI_Wtime();
+    if ((ret = PIOc_openfile(iosysid, &ncid, &res->iotype, filename, PIO_NOWRITE)))
+        return ret;
+    for (int f = 0; f < arguments->nframes; f++)
+        for (int v = 0; v < arguments->nvars; v++)
+        {
+            if ((ret = PIOc_setframe(ncid, varid[v], f)))
+                return ret;
+            if ((ret = PIOc_read_darray(ncid, varid[v], rioid, arraylen, data)))
+                return ret;
+            if (arguments->verify)
+                for (PIO_Offset e = 0; e < arraylen; e++)
+                    if (iodesc->map[e] > 0 && data[e] != data_value(iodesc->map[e], v, f))
+                        res->errors++;
+        }
+    if ((ret = PIOc_closefile(ncid)))
+        return ret;
+    res->read_time = MPI_Wtime() - start;
 
-    ierr = PIOc_closefile(ncid);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+    if ((ret = get_phase_times(iosysid, res->phase)))
+        return ret;
+    MPI_Allreduce(MPI_IN_PLACE, &res->write_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &res->read_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &res->errors, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
 
-    if(rank == 3)
-    {
-        for(int i=0; i < maplen[rank]; i++)
-            printf("dvarr[%d] = %f\n",i, dvarr[i]);
-    }
-    free(maplen);
-    return ierr;
+    free(data);
+    free(dimid);
+    if (rioid != wioid)
+        if ((ret = PIOc_freedecomp(iosysid, rioid)))
+            return ret;
+    if ((ret = PIOc_freedecomp(iosysid, wioid)))
+        return ret;
 
+    return PIO_NOERR;
 }
 
+/* Print the results of one combination. */
+static void
+print_result(FILE *fp, struct arguments *arguments, result *res, bool first)
+{
+    const char *iotype = value_name(res->iotype, iotype_name, iotype_value);
+    const char *rearr = value_name(res->rearr, rearr_name, rearr_value);
+    const char *comm = value_name(res->comm, comm_name, comm_value);
+    double mib = res->bytes / (1024 * 1024);
 
+    if (arguments->json)
+    {
+        fprintf(fp, "%s  {\"iotype\": \"%s\", \"rearranger\": \"%s\", \"iotasks\": %d, "
+                "\"comm\": \"%s\", \"buffer_limit\": %lld, \"nvars\": %d, \"frames\": %d, "
+                "\"bytes\": %.0f, \"write_s\": %g, \"write_MiBps\": %g, \"read_s\": %g, "
+                "\"read_MiBps\": %g", first ? "" : ",\n", iotype, rearr, res->niotasks,
+                comm, (long long)res->buffer_limit, arguments->nvars, arguments->nframes,
+                res->bytes, res->write_time, mib / res->write_time, res->read_time,
+                mib / res->read_time);
+        for (int p = 0; p < NUM_PHASES; p++)
+            fprintf(fp, ", \"%s_s\": %g", phase_name[p], res->phase[p]);
+        fprintf(fp, ", \"errors\": %d}", res->errors);
+    }
+    else
+    {
+        if (first)
+        {
+            fprintf(fp, "iotype,rearranger,iotasks,comm,buffer_limit,nvars,frames,bytes,"
+                    "write_s,write_MiBps,read_s,read_MiBps");
+            for (int p = 0; p < NUM_PHASES; p++)
+                fprintf(fp, ",%s_s", phase_name[p]);
+            fprintf(fp, ",errors\n");
+        }
+        fprintf(fp, "%s,%s,%d,%s,%lld,%d,%d,%.0f,%g,%g,%g,%g", iotype, rearr, res->niotasks,
+                comm, (long long)res->buffer_limit, arguments->nvars, arguments->nframes,
+                res->bytes, res->write_time, mib / res->write_time, res->read_time,
+                mib / res->read_time);
+        for (int p = 0; p < NUM_PHASES; p++)
+            fprintf(fp, ",%g", res->phase[p]);
+        fprintf(fp, ",%d\n", res->errors);
+    }
+    fflush(fp);
+}
 
 int main(int argc, char *argv[])
 {
     struct arguments arguments;
-    int ierr;
+    int iotype[MAX_LIST], rearr[MAX_LIST], comm[MAX_LIST];
+    PIO_Offset niotasks[MAX_LIST], buffer_limit[MAX_LIST];
+    PIO_Offset default_limit;
+    int niotype, nrearr, ncomm, nniotasks, nbuffer_limit;
+    FILE *fp = stdout;
+    bool first = true;
     int rank;
     int comm_size;
-    int iosys;
-    int iotasks;
-    MPI_Init(&argc, &argv);
+    int ret = PIO_NOERR;
 
+    MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-
     MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
 
-    arguments.wdecomp_file = NULL;
-    arguments.rdecomp_file = NULL;
-    arguments.varname = NULL;
+    memset(&arguments, 0, sizeof(arguments));
+    arguments.iotypes = "pnetcdf";
+    arguments.rearrangers = "subset";
+    arguments.iotasks = "4";
+    arguments.comms = "coll";
+    arguments.stride = 1;
+    arguments.max_pend_req = PIO_REARR_COMM_UNLIMITED_PEND_REQ;
+    arguments.nvars = 1;
+    arguments.nframes = 1;
+
+    arguments.hole_fraction = 0.3;
     mpi_argp_parse(rank, &argp, argc, argv, 0, 0, &arguments);
 
-    if(! arguments.rdecomp_file)
-        arguments.rdecomp_file = arguments.wdecomp_file;
-
-    iotasks = comm_size/36;
-
-    ierr = PIOc_Init_Intracomm(MPI_COMM_WORLD, 4, 1, 0, PIO_REARR_SUBSET, &iosys);
-    if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
-
-    if(arguments.wdecomp_file)
+    if (!arguments.wdecomp_file && !arguments.generate)
     {
-        ierr = test_write_darray(iosys, arguments.wdecomp_file, rank, arguments.varname);
-        if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+        if (!rank)
+            fprintf(stderr, "A decomposition file or generator is needed, see --help.\n");
+        MPI_Finalize();
+        return 1;
     }
-    if(arguments.rdecomp_file)
+    if (!arguments.rdecomp_file)
+        arguments.rdecomp_file = arguments.wdecomp_file;
+
+    /* Find the combinations to run. */
+    niotype = parse_names(arguments.iotypes, iotype_name, iotype_value, iotype);
+    nrearr = parse_names(arguments.rearrangers, rearr_name, rearr_value, rearr);
+    ncomm = parse_names(arguments.comms, comm_name, comm_value, comm);
+    nniotasks = parse_numbers(arguments.iotasks, niotasks);
+    nbuffer_limit = arguments.buffer_limits ?
+        parse_numbers(arguments.buffer_limits, buffer_limit) : 1;
+    if (!arguments.buffer_limits)
+        buffer_limit[0] = 0;
+    if (arguments.generate && decomp_gen_type(arguments.generate) < 0)
+        niotype = -1;
+    if (niotype < 1 || nrearr < 1 || ncomm < 1 || nniotasks < 1 || arguments.nvars < 1 ||
+        arguments.nframes < 1)
     {
-        ierr = test_read_darray(iosys, arguments.rdecomp_file, rank, arguments.varname);
-        if(ierr || debug) printf("%d %d\n",__LINE__,ierr);
+        if (!rank)
+            fprintf(stderr, "Bad option value, see --help.\n");
+        MPI_Finalize();
+        return 1;
     }
+
+    if (!rank && arguments.output)
+        if (!(fp = fopen(arguments.output, "w")))
+        {
+            perror(arguments.output);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    if (!rank && arguments.json)
+        fprintf(fp, "[\n");
+
+    /* The pnetcdf buffer limit of the cases without one. */
+    default_limit = PIOc_set_buffer_size_limit(0);
+
+    for (int i = 0; i < nniotasks && !ret; i++)
+        for (int r = 0; r < nrearr && !ret; r++)
+            for (int c = 0; c < ncomm && !ret; c++)
+            {
+                int iosysid;
+                int fret;
+
+                if (niotasks[i] < 1 || (niotasks[i] - 1) * arguments.stride >= comm_size)
+                    continue;
+                if ((ret = PIOc_Init_Intracomm(MPI_COMM_WORLD, niotasks[i], arguments.stride,
+                                               0, rearr[r], &iosysid)))
+                {
+                    if (!rank)
+                        fprintf(stderr, "PIOc_Init_Intracomm failed with error %d\n", ret);
+                    break;
+                }
+                PIOc_Set_IOSystem_Error_Handling(iosysid, PIO_BCAST_ERROR);
+
+                /* The phases are timed with the library timers. */
+                ret = PIOc_set_timing(iosysid, true);
+                if (!ret)
+                    ret = PIOc_set_rearr_opts(iosysid, comm[c], PIO_REARR_COMM_FC_2D_ENABLE,
+                                              arguments.handshake, arguments.handshake,
+                                              arguments.max_pend_req, arguments.handshake,
+                                              arguments.handshake, arguments.max_pend_req);
+                if (ret && !rank)
+                    fprintf(stderr, "setting up the IO system failed with error %d\n", ret);
+
+                for (int t = 0; t < niotype && !ret; t++)
+                    for (int b = 0; b < nbuffer_limit && !ret; b++)
+                    {
+                        result res;
+
+                        /* Only pnetcdf has a buffer limit. */
+                        if (b && iotype[t] != PIO_IOTYPE_PNETCDF)
+                            continue;
+                        memset(&res, 0, sizeof(res));
+                        res.iotype = iotype[t];
+                        res.rearr = rearr[r];
+                        res.niotasks = niotasks[i];
+                        res.comm = comm[c];
+                        res.buffer_limit = buffer_limit[b];
+                        PIOc_set_buffer_size_limit(buffer_limit[b] ? buffer_limit[b] :
+                                                   default_limit);
+
+                        if ((ret = run_case(iosysid, &arguments, rank, &res)))
+                        {
+                            if (!rank)
+                                fprintf(stderr, "%s failed with error %d\n",
+                                        value_name(iotype[t], iotype_name, iotype_value),
+                                        ret);
+                            break;
+                        }
+                        if (!rank)
+                            print_result(fp, &arguments, &res, first);
+                        first = false;
+                    }
+
+                /* Free the IO system, also after an error. */
+                if ((fret = PIOc_free_iosystem(iosysid)) && !ret)
+                    ret = fret;
+            }
+    PIOc_set_buffer_size_limit(default_limit);
+
+    if (!rank && arguments.json)
+        fprintf(fp, "\n]\n");
+    if (!rank && arguments.output)
+        fclose(fp);
+
     MPI_Finalize();
 
+    return ret ? 1 : 0;
 }
-
@@ -0,0 +1,476 @@
+/*
+ * Benchmark of the rearrangers alone, without any file IO. The data
+ * of N variables is moved with rearrange_comp2io() and
+ * rearrange_io2comp() (and so pio_swapm()), for each combination of
+ * rearranger, number of IO tasks, comm type, handshake, isend and max
+ * pending requests given, and the time and bandwidth of each
+ * direction is printed as CSV or JSON. Use this to choose the
+ * settings of PIOc_set_rearr_opts() on a new machine.
+ *
+ * The decomposition is read from a decomp file (only when setting up
+ * each combination), or generated with -g (see
+ * tests/performance/decomp_gen.h).
+ *
+ * For example:
+ *
+ * mpiexec -n 64 ./piorearrperf -w decomp.nc -c p2p,coll -k 0,1 -e 0,1
+ * -m -1,64 -i 8
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <argp.h>
+#include <mpi.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <decomp_gen.h>
+
+const char *argp_program_version = "piorearrperf 0.1";
+const char *argp_program_bug_address = "<https://github.com/NCAR/ParallelIO>";
+
+static char doc[] =
+    "a benchmark of the pio rearrangers without file IO";
+
+static struct argp_option options[] = {
+    {"wdecomp", 'w', "FILE", 0, "Decomposition file"},
+    {"generate", 'g', "TYPE", 0, "Generate the decomposition: block,cubed_sphere,sfc,land"},
+    {"gdims", 'G', "NX,NY,NZ", 0, "Size of the generated decomposition (default 360,180,1)"},
+    {"rearrangers", 'R', "LIST", 0, "Rearrangers: box,subset (default box,subset)"},
+    {"iotasks", 'i', "LIST", 0, "Numbers of IO tasks (default 4)"},
+    {"stride", 's', "N", 0, "Stride of the IO tasks (default 1)"},
+    {"comm", 'c', "LIST", 0, "Comm types: p2p,coll,neighbor,shm (default p2p,coll)"},
+    {"handshake", 'k', "LIST", 0, "Handshake settings, 0 or 1 (default 0)"},
+    {"isend", 'e', "LIST", 0, "Isend settings, 0 or 1 (default 0)"},
+    {"max-pend-req", 'm', "LIST", 0, "Max pending requests, -1 for unlimited (default -1)"},
+    {"nvars", 'n', "N", 0, "Number of variables moved at once (default 1)"},
+    {"reps", 'r', "N", 0, "Number of repetitions of each move (default 10)"},
+    {"json", 'j', 0, 0, "Print JSON instead of CSV"},
+    {"output", 'o', "FILE", 0, "File the results are written to (default stdout)"},
+    { 0 }
+};
+
+/* The most values of each list option. */
+#define MAX_LIST 16
+
+struct arguments
+{
+    char *wdecomp_file;
+    char *generate;
+    char *gdims;
+    char *rearrangers;
+    char *iotasks;
+    char *comms;
+    char *handshakes;
+    char *isends;
+    char *max_pend_reqs;
+    char *output;
+    int stride;
+    int nvars;
+    int nreps;
+    bool json;
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+    case 'w':
+        arguments->wdecomp_file = arg;
+        break;
+    case 'g':
+        arguments->generate = arg;
+        break;
+    case 'G':
+        arguments->gdims = arg;
+        break;
+    case 'R':
+        arguments->rearrangers = arg;
+        break;
+    case 'i':
+        arguments->iotasks = arg;
+        break;
+    case 's':
+        arguments->stride = atoi(arg);
+        break;
+    case 'c':
+        arguments->comms = arg;
+        break;
+    case 'k':
+        arguments->handshakes = arg;
+        break;
+    case 'e':
+        arguments->isends = arg;
+        break;
+    case 'm':
+        arguments->max_pend_reqs = arg;
+        break;
+    case 'n':
+        arguments->nvars = atoi(arg);
+        break;
+    case 'r':
+        arguments->nreps = atoi(arg);
+        break;
+    case 'j':
+        arguments->json = true;
+        break;
+    case 'o':
+        arguments->output = arg;
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, 0, doc };
+
+error_t mpi_argp_parse(const int rank,
+                       const struct argp *argp,
+                       int argc,
+                       char **argv,
+                       unsigned flags,
+                       int *arg_index,
+                       void *input);
+
+/* The names of the values of the list options. */
+static const char *rearr_name[] = {"box", "subset", NULL};
+static const int rearr_value[] = {PIO_REARR_BOX, PIO_REARR_SUBSET};
+static const char *comm_name[] = {"p2p", "coll", "neighbor", "shm", NULL};
+static const int comm_value[] = {PIO_REARR_COMM_P2P, PIO_REARR_COMM_COLL,
+                                 PIO_REARR_COMM_NEIGHBOR, PIO_REARR_COMM_SHM};
+
+/* The settings and results of one combination. */
+typedef struct result
+{
+    int rearr;
+    int niotasks;
+    int comm;
+    int handshake;
+    int isend;
+    int max_pend_req;
+    double bytes;
+    double comp2io_time;
+    double io2comp_time;
+    double swapm_time;
+} result;
+
+/* Find the values of a comma separated list of names. Returns the
+ * number of values, or -1 if a name is not known. */
+static int
+parse_names(const char *list, const char **names, const int *values, int *out)
+{
+    char buf[PIO_MAX_NAME + 1];
+    int n = 0;
+
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (char *tok = strtok(buf, ","); tok && n < MAX_LIST; tok = strtok(NULL, ","))
+    {
+        int i;
+
+        for (i = 0; names[i]; i++)
+            if (!strcmp(tok, names[i]))
+                break;
+        if (!names[i])
+            return -1;
+        out[n++] = values[i];
+    }
+
+    return n;
+}
+
+/* Find the values of a comma separated list of numbers. */
+static int
+parse_ints(const char *list, int *out)
+{
+    char buf[PIO_MAX_NAME + 1];
+    int n = 0;
+
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (char *tok = strtok(buf, ","); tok && n < MAX_LIST; tok = strtok(NULL, ","))
+        out[n++] = atoi(tok);
+
+    return n;
+}
+
+/* Find the name of a value of a list option. */
+static const char *
+value_name(int value, const char **names, const int *values)
+{
+    for (int i = 0; names[i]; i++)
+        if (values[i] == value)
+            return names[i];
+    return "unknown";
+}
+
+/* Set up the decomposition, from the decomp file or a generator. */
+static int
+get_decomp(int iosysid, struct arguments *arguments, int rank, int ntasks, int *ioid)
+{
+    int dims[3] = {360, 180, 1};
+    PIO_Offset maplen;
+    PIO_Offset *map;
+    int type;
+    int ndims;
+    int gdims[3];
+    int ret;
+
+    if (!arguments->generate)
+        return PIOc_read_nc_decomp(iosysid, arguments->wdecomp_file, ioid, MPI_COMM_WORLD,
+                                   PIO_DOUBLE, NULL, NULL, NULL);
+
+    type = decomp_gen_type(arguments->generate);
+    if (arguments->gdims)
+        parse_ints(arguments->gdims, dims);
+    if ((ret = decomp_gen_dims(type, dims[0], dims[1], dims[2], &ndims, gdims)))
+        return ret;
+    if ((ret = decomp_gen(type, rank, ntasks, dims[0], dims[1], dims[2], 0, 0.3, &maplen,
+                          NULL)))
+        return ret;
+    if (!(map = malloc((maplen ? maplen : 1) * sizeof(PIO_Offset))))
+        return PIO_ENOMEM;
+    if ((ret = decomp_gen(type, rank, ntasks, dims[0], dims[1], dims[2], 0, 0.3, &maplen,
+                          map)))
+    {
+        free(map);
+        return ret;
+    }
+    ret = PIOc_InitDecomp(iosysid, PIO_DOUBLE, ndims, gdims, maplen, map, ioid, NULL, NULL,
+                          NULL);
+    free(map);
+
+    return ret;
+}
+
+/* Move the data of the vars back and forth nreps times, timing each
+ * direction. */
+static int
+run_case(int iosysid, int ioid, struct arguments *arguments, result *res)
+{
+    iosystem_desc_t *ios;
+    io_desc_t *iodesc;
+    PIO_Offset local_bytes;
+    void *sbuf, *rbuf;
+    double start;
+    int ret;
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return PIO_EBADID;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return PIO_EBADID;
+
+    local_bytes = (PIO_Offset)iodesc->ndof * iodesc->piotype_size;
+    if ((ret = MPI_Allreduce(MPI_IN_PLACE, &local_bytes, 1, MPI_OFFSET, MPI_SUM,
+                             MPI_COMM_WORLD)))
+        return ret;
+    res->bytes = (double)local_bytes * arguments->nvars;
+
+    sbuf = calloc(iodesc->ndof ? iodesc->ndof * arguments->nvars : 1, iodesc->piotype_size);
+    rbuf = calloc(iodesc->llen ? iodesc->llen * arguments->nvars : 1, iodesc->mpitype_size);
+    if (!sbuf || !rbuf)
+    {
+        free(sbuf);
+        free(rbuf);
+        return PIO_ENOMEM;
+    }
+
+    /* The first move sets up the MPI types, and is not timed. */
+    if ((ret = rearrange_comp2io(ios, iodesc, sbuf, ios->ioproc ? rbuf : NULL,
+                                 arguments->nvars)))
+        goto exit;
+    if ((ret = PIOc_reset_timing(iosysid)))
+        goto exit;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    start = MPI_Wtime();
+    for (int r = 0; r < arguments->nreps; r++)
+        if ((ret = rearrange_comp2io(ios, iodesc, sbuf, ios->ioproc ? rbuf : NULL,
+                                     arguments->nvars)))
+            goto exit;
+    MPI_Barrier(MPI_COMM_WORLD);
+    res->comp2io_time = (MPI_Wtime() - start) / arguments->nreps;
+
+    /* rearrange_io2comp() moves one var at a time. */
+    start = MPI_Wtime();
+    for (int r = 0; r < arguments->nreps; r++)
+        for (int v = 0; v < arguments->nvars; v++)
+            if ((ret = rearrange_io2comp(ios, iodesc, ios->ioproc ? rbuf : NULL, sbuf)))
+                goto exit;
+    MPI_Barrier(MPI_COMM_WORLD);
+    res->io2comp_time = (MPI_Wtime() - start) / arguments->nreps;
+
+    /* The time spent in pio_swapm(), out of both directions. */
+    if ((ret = PIOc_get_timing(iosysid, "PIO:swapm", &res->swapm_time, NULL)))
+        goto exit;
+    res->swapm_time /= arguments->nreps;
+    MPI_Allreduce(MPI_IN_PLACE, &res->swapm_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+exit:
+    free(sbuf);
+    free(rbuf);
+
+    return ret;
+}
+
+/* Print the results of one combination. */
+static void
+print_result(FILE *fp, struct arguments *arguments, result *res, bool first)
+{
+    const char *rearr = value_name(res->rearr, rearr_name, rearr_value);
+    const char *comm = value_name(res->comm, comm_name, comm_value);
+    double mib = res->bytes / (1024 * 1024);
+
+    if (arguments->json)
+        fprintf(fp, "%s  {\"rearranger\": \"%s\", \"iotasks\": %d, \"comm\": \"%s\", "
+                "\"handshake\": %d, \"isend\": %d, \"max_pend_req\": %d, \"nvars\": %d, "
+                "\"bytes\": %.0f, \"comp2io_s\": %g, \"comp2io_MiBps\": %g, "
+                "\"io2comp_s\": %g, \"io2comp_MiBps\": %g, \"swapm_s\": %g}",
+                first ? "" : ",\n", rearr, res->niotasks, comm, res->handshake, res->isend,
+                res->max_pend_req, arguments->nvars, res->bytes, res->comp2io_time,
+                mib / res->comp2io_time, res->io2comp_time, mib / res->io2comp_time,
+                res->swapm_time);
+    else
+    {
+        if (first)
+            fprintf(fp, "rearranger,iotasks,comm,handshake,isend,max_pend_req,nvars,bytes,"
+                    "comp2io_s,comp2io_MiBps,io2comp_s,io2comp_MiBps,swapm_s\n");
+        fprintf(fp, "%s,%d,%s,%d,%d,%d,%d,%.0f,%g,%g,%g,%g,%g\n", rearr, res->niotasks, comm,
+                res->handshake, res->isend, res->max_pend_req, arguments->nvars, res->bytes,
+                res->comp2io_time, mib / res->comp2io_time, res->io2comp_time,
+                mib / res->io2comp_time, res->swapm_time);
+    }
+    fflush(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    struct arguments arguments;
+    int rearr[MAX_LIST], niotasks[MAX_LIST], comm[MAX_LIST];
+    int handshake[MAX_LIST], isend[MAX_LIST], max_pend_req[MAX_LIST];
+    int nrearr, nniotasks, ncomm, nhandshake, nisend, nmax_pend_req;
+    FILE *fp = stdout;
+    bool first = true;
+    int rank, ntasks;
+    int ret = PIO_NOERR;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ntasks);
+
+    memset(&arguments, 0, sizeof(arguments));
+    arguments.rearrangers = "box,subset";
+    arguments.iotasks = "4";
+    arguments.comms = "p2p,coll";
+    arguments.handshakes = "0";
+    arguments.isends = "0";
+    arguments.max_pend_reqs = "-1";
+    arguments.stride = 1;
+    arguments.nvars = 1;
+    arguments.nreps = 10;
+    mpi_argp_parse(rank, &argp, argc, argv, 0, 0, &arguments);
+
+    nrearr = parse_names(arguments.rearrangers, rearr_name, rearr_value, rearr);
+    ncomm = parse_names(arguments.comms, comm_name, comm_value, comm);
+    nniotasks = parse_ints(arguments.iotasks, niotasks);
+    nhandshake = parse_ints(arguments.handshakes, handshake);
+    nisend = parse_ints(arguments.isends, isend);
+    nmax_pend_req = parse_ints(arguments.max_pend_reqs, max_pend_req);
+    if ((!arguments.wdecomp_file && !arguments.generate) ||
+        (arguments.generate && decomp_gen_type(arguments.generate) < 0) ||
+        nrearr < 1 || ncomm < 1 || arguments.nvars < 1 || arguments.nreps < 1)
+    {
+        if (!rank)
+            fprintf(stderr, "Bad options, see --help.\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (!rank && arguments.output)
+        if (!(fp = fopen(arguments.output, "w")))
+        {
+            perror(arguments.output);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    if (!rank && arguments.json)
+        fprintf(fp, "[\n");
+
+    for (int r = 0; r < nrearr && !ret; r++)
+        for (int i = 0; i < nniotasks && !ret; i++)
+        {
+            int iosysid, ioid;
+
+            if (niotasks[i] < 1 || (niotasks[i] - 1) * arguments.stride >= ntasks)
+                continue;
+            if ((ret = PIOc_Init_Intracomm(MPI_COMM_WORLD, niotasks[i], arguments.stride, 0,
+                                           rearr[r], &iosysid)))
+                break;
+            PIOc_Set_IOSystem_Error_Handling(iosysid, PIO_BCAST_ERROR);
+
+            /* pio_swapm() is timed with the library timers. */
+            if ((ret = PIOc_set_timing(iosysid, true)))
+                break;
+
+            for (int c = 0; c < ncomm && !ret; c++)
+                for (int h = 0; h < nhandshake && !ret; h++)
+                    for (int e = 0; e < nisend && !ret; e++)
+                        for (int m = 0; m < nmax_pend_req && !ret; m++)
+                        {
+                            result res;
+
+                            /* Only p2p uses handshake, isend and max pend req. */
+                            if (comm[c] != PIO_REARR_COMM_P2P && (h || e || m))
+                                continue;
+                            memset(&res, 0, sizeof(res));
+                            res.rearr = rearr[r];
+                            res.niotasks = niotasks[i];
+                            res.comm = comm[c];
+                            res.handshake = handshake[h];
+                            res.isend = isend[e];
+                            res.max_pend_req = max_pend_req[m];
+                            if ((ret = PIOc_set_rearr_opts(iosysid, comm[c],
+                                                           PIO_REARR_COMM_FC_2D_ENABLE,
+                                                           handshake[h], isend[e],
+                                                           max_pend_req[m], handshake[h],
+                                                           isend[e], max_pend_req[m])))
+                                break;
+
+                            /* The decomposition copies the rearranger
+                             * options, so it is set up for each
+                             * combination of them. */
+                            if ((ret = get_decomp(iosysid, &arguments, rank, ntasks, &ioid)))
+                            {
+                                if (!rank)
+                                    fprintf(stderr, "Could not set up the decomposition, "
+                                            "error %d\n", ret);
+                                break;
+                            }
+                            ret = run_case(iosysid, ioid, &arguments, &res);
+                            PIOc_freedecomp(iosysid, ioid);
+                            if (ret)
+                            {
+                                if (!rank)
+                                    fprintf(stderr, "%s %s failed with error %d\n",
+                                            value_name(rearr[r], rearr_name, rearr_value),
+                                            value_name(comm[c], comm_name, comm_value), ret);
+                                break;
+                            }
+                            if (!rank)
+                                print_result(fp, &arguments, &res, first);
+                            first = false;
+                        }
+
+            PIOc_free_iosystem(iosysid);
+        }
+
+    if (!rank && arguments.json)
+        fprintf(fp, "\n]\n");
+    if (!rank && arguments.output)
+        fclose(fp);
+
+    MPI_Finalize();
+
+    return ret ? 1 : 0;
+}
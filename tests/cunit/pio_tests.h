@@ -123,4 +123,8 @@ int run_test_main(int argc, char **argv, int min_ntasks, int max_ntasks,
 /* Create a 2D decomposition used in some tests. */
 int create_decomposition_2d(int ntasks, int my_rank, int iosysid, int *dim_len_2d, int *ioid,
                             int pio_type);
+
+/* Create a 2D decomposition with each block of the map reversed. */
+int create_decomposition_reversed(int ntasks, int my_rank, int iosysid, int *dim_len_2d,
+                                  int rearranger, int *ioid);
 #endif /* _PIO_TESTS_H */
@@ -74,6 +74,12 @@ int main(int argc, char **argv)
                             NULL, NULL, NULL, NULL, PIO_REARR_BOX, iosysid) != PIO_EINVAL)
             ERR(ERR_WRONG);
 
+        /* Let the IO task sleep while waiting for messages. */
+        if (PIOc_set_async_wait(TEST_VAL_42, 0) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_set_async_wait(PIO_ASYNC_WAIT_BACKOFF, 100)))
+            ERR(ret);
+
         /* Initialize the IO system. */
         if ((ret = PIOc_init_async(test_comm, NUM_IO_PROCS, io_proc_list, COMPONENT_COUNT,
                                    num_procs, (int **)proc_list, NULL, NULL, PIO_REARR_BOX, iosysid)))
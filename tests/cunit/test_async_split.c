@@ -0,0 +1,181 @@
+/*
+ * Tests for PIOc_init_async_split() and
+ * PIOc_init_async_from_comms_split(). Each computation component gets
+ * its own IO task, so the components are served at the same time.
+ *
+ * This test runs on four ranks. There are two components, each with
+ * one IO task and one computation task. Each component creates and
+ * checks a sample netCDF file.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_async_split"
+
+/* Number of computational components to create. */
+#define COMPONENT_COUNT 2
+
+/* Create and check the sample files of a component, then free its
+ * iosystem. Only called on computation tasks. */
+int run_component(int iosysid, int num_flavors, int *flavor, int my_rank, int my_comp_idx,
+                  const char *prefix)
+{
+    int ret;
+
+    for (int flv = 0; flv < num_flavors; flv++)
+    {
+        for (int sample = 0; sample < NUM_SAMPLES; sample++)
+        {
+            char filename[PIO_MAX_NAME * 2 + 1]; /* Test filename. */
+            char iotype_name[PIO_MAX_NAME + 1];
+
+            /* Create a filename. */
+            if ((ret = get_iotype_name(flavor[flv], iotype_name)))
+                return ret;
+            sprintf(filename, "%s_%s_%d_%d.nc", prefix, iotype_name, sample, my_comp_idx);
+
+            /* Create sample file. */
+            if ((ret = create_nc_sample(sample, iosysid, flavor[flv], filename, my_rank, NULL)))
+                AERR2(ret, iosysid);
+
+            /* Check the file for correctness. */
+            if ((ret = check_nc_sample(sample, iosysid, flavor[flv], filename, my_rank, NULL)))
+                AERR2(ret, iosysid);
+        }
+    } /* next netcdf flavor */
+
+    /* Finalize the IO system. Only call this from the computation tasks. */
+    if ((ret = PIOc_free_iosystem(iosysid)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
+/* Run the split async test. */
+int main(int argc, char **argv)
+{
+    int my_rank; /* Zero-based rank of processor. */
+    int ntasks; /* Number of processors involved in current execution. */
+    int num_flavors; /* Number of PIO netCDF flavors in this build. */
+    MPI_Comm test_comm;
+    int ret; /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, TARGET_NTASKS, TARGET_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    /* Only do something on TARGET_NTASKS tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid[COMPONENT_COUNT]; /* The IDs for the parallel I/O systems. */
+        int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+        int num_io[COMPONENT_COUNT] = {1, 1};
+        int num_procs[COMPONENT_COUNT] = {1, 1};
+        int io_list_0[1] = {0}, io_list_1[1] = {2};
+        int comp_list_0[1] = {1}, comp_list_1[1] = {3};
+        int *io_proc_list[COMPONENT_COUNT] = {io_list_0, io_list_1};
+        int *proc_list[COMPONENT_COUNT] = {comp_list_0, comp_list_1};
+        int my_comp_idx = my_rank / 2; /* Index in iosysid array. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        /* Is the current process a computation task? */
+        int comp_task = my_rank % 2;
+
+        /* Check for invalid values. */
+        if (PIOc_init_async_split(test_comm, 0, num_io, io_proc_list, num_procs,
+                                  proc_list, PIO_REARR_BOX, iosysid) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if (PIOc_init_async_split(test_comm, COMPONENT_COUNT, num_io, NULL, num_procs,
+                                  proc_list, PIO_REARR_BOX, iosysid) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if (PIOc_init_async_split(test_comm, COMPONENT_COUNT, num_io, io_proc_list, num_procs,
+                                  proc_list, PIO_REARR_BOX, NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        /* A task may not be in two components. */
+        {
+            int *bad_proc_list[COMPONENT_COUNT] = {comp_list_0, comp_list_0};
+
+            if (PIOc_init_async_split(test_comm, COMPONENT_COUNT, num_io, io_proc_list,
+                                      num_procs, bad_proc_list, PIO_REARR_BOX,
+                                      iosysid) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+        }
+
+        /* Initialize the IO systems. */
+        if ((ret = PIOc_init_async_split(test_comm, COMPONENT_COUNT, num_io, io_proc_list,
+                                         num_procs, proc_list, PIO_REARR_BOX, iosysid)))
+            ERR(ERR_INIT);
+
+        /* Each task only gets the iosysid of its own component. */
+        if (iosysid[!my_comp_idx] != -1)
+            ERR(ERR_WRONG);
+
+        /* The IO tasks return here only after their component has
+         * freed its iosystem. */
+        if (comp_task)
+            if ((ret = run_component(iosysid[my_comp_idx], num_flavors, flavor, my_rank,
+                                     my_comp_idx, TEST_NAME)))
+                return ret;
+
+        /* Now divide the IO tasks of one io_comm between the
+         * components. */
+        {
+            MPI_Comm io_comm, my_comm;
+            MPI_Comm comp_comm[COMPONENT_COUNT] = {MPI_COMM_NULL, MPI_COMM_NULL};
+            int io_share[COMPONENT_COUNT] = {1, 1};
+            int bad_share[COMPONENT_COUNT] = {1, 0};
+
+            /* Ranks 0 and 2 are the IO tasks, 1 and 3 the components. */
+            if ((ret = MPI_Comm_split(test_comm, comp_task ? 1 + my_comp_idx : 0, my_rank,
+                                      &my_comm)))
+                MPIERR(ret);
+            io_comm = comp_task ? MPI_COMM_NULL : my_comm;
+            if (comp_task)
+                comp_comm[my_comp_idx] = my_comm;
+
+            /* Check for invalid values. */
+            if (PIOc_init_async_from_comms_split(test_comm, COMPONENT_COUNT, comp_comm, io_comm,
+                                                 NULL, PIO_REARR_BOX, iosysid) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+            if (PIOc_init_async_from_comms_split(test_comm, COMPONENT_COUNT, comp_comm, io_comm,
+                                                 bad_share, PIO_REARR_BOX,
+                                                 iosysid) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+
+            if ((ret = PIOc_init_async_from_comms_split(test_comm, COMPONENT_COUNT, comp_comm,
+                                                        io_comm, io_share, PIO_REARR_BOX,
+                                                        iosysid)))
+                ERR(ERR_INIT);
+            if (iosysid[!my_comp_idx] != -1)
+                ERR(ERR_WRONG);
+
+            if (comp_task)
+                if ((ret = run_component(iosysid[my_comp_idx], num_flavors, flavor, my_rank,
+                                         my_comp_idx, TEST_NAME "_comms")))
+                    return ret;
+
+            if ((ret = MPI_Comm_free(&my_comm)))
+                MPIERR(ret);
+        }
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize test. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ERR_AWFUL;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+
+    return 0;
+}
@@ -1044,6 +1044,46 @@ int create_decomposition_2d(int ntasks, int my_rank, int iosysid, int *dim_len_2
     return 0;
 }
 
+/*
+ * Create a 2D decomposition in which each task has a block of the
+ * array, with the elements of its block in reverse order, so the
+ * rearranger has to sort the map.
+ *
+ * @param ntasks the number of available tasks
+ * @param my_rank rank of this task.
+ * @param iosysid the IO system ID.
+ * @param dim_len_2d an array of length 2 with the dim lengths.
+ * @param rearranger the rearranger to use.
+ * @param ioid a pointer that gets the ID of this decomposition.
+ * @returns 0 for success, error code otherwise.
+ **/
+int create_decomposition_reversed(int ntasks, int my_rank, int iosysid, int *dim_len_2d,
+                                  int rearranger, int *ioid)
+{
+    PIO_Offset elements_per_pe;     /* Array elements per processing unit. */
+    PIO_Offset *compdof;  /* The decomposition mapping. */
+    int ret;
+
+    elements_per_pe = dim_len_2d[0] * dim_len_2d[1] / ntasks;
+
+    /* Allocate space for the decomposition array. */
+    if (!(compdof = malloc(elements_per_pe * sizeof(PIO_Offset))))
+        return PIO_ENOMEM;
+
+    /* Describe the decomposition. This is a 1-based array, so add 1! */
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + (elements_per_pe - i);
+
+    /* Create the PIO decomposition for this test. */
+    ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, dim_len_2d, elements_per_pe,
+                          compdof, ioid, &rearranger, NULL, NULL);
+
+    /* Free the mapping. */
+    free(compdof);
+
+    return ret;
+}
+
 /*
  * This creates a test netCDF file in the specified format. This file
  * is simple, with a global attribute, 2 dimensions, a scalar var, and
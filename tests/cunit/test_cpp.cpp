@@ -0,0 +1,167 @@
+/*
+ * Tests for the C++ interface of pio.hpp. Darrays are written to a
+ * file through pio::decomp and pio::file from a vector, a span (with
+ * C++20) and a vector of another type, which is converted, and read
+ * back.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_cpp"
+
+/* The length of the non-record dimension. */
+#define X_DIM_LEN 16
+
+/* The number of records written. */
+#define NUM_RECS 3
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The value of element i of record r. */
+static int value(int r, PIO_Offset i)
+{
+    return r * 100 + (int)i;
+}
+
+/* Write a record from each kind of container, read them back, and
+ * check them. */
+static int test_cpp(MPI_Comm test_comm, int my_rank)
+{
+    PIO_Offset elements_per_pe = X_DIM_LEN / TARGET_NTASKS;
+    std::vector<PIO_Offset> compmap(elements_per_pe);
+    const char *filename = TEST_NAME ".nc";
+
+    for (PIO_Offset i = 0; i < elements_per_pe; i++)
+        compmap[i] = my_rank * elements_per_pe + i;
+
+    pio::iosystem ios(test_comm, NUM_IO_PROCS, 1, 0);
+    pio::decomp<int> d(ios, {X_DIM_LEN}, compmap);
+    if (d.size() != (std::size_t)elements_per_pe)
+        return 1;
+
+    {
+        pio::file f = pio::file::create(ios, PIO_IOTYPE_NETCDF, filename);
+        int dimids[2] = {f.def_dim("time", PIO_UNLIMITED), f.def_dim("x", X_DIM_LEN)};
+        int varid = f.def_var<int>("data", {dimids[0], dimids[1]});
+        std::vector<int> data(elements_per_pe);
+        std::vector<double> ddata(elements_per_pe);
+
+        f.enddef();
+
+        /* Record 0 from a vector. */
+        for (PIO_Offset i = 0; i < elements_per_pe; i++)
+            data[i] = value(0, compmap[i]);
+        f.setframe(varid, 0);
+        f.write_darray(varid, d, data);
+
+        /* Record 1 from a span, or a pointer without C++20. */
+        for (PIO_Offset i = 0; i < elements_per_pe; i++)
+            data[i] = value(1, compmap[i]);
+        f.setframe(varid, 1);
+#ifdef __cpp_lib_span
+        f.write_darray(varid, d, std::span<const int>(data));
+#else
+        f.write_darray(varid, d, data.data(), data.size());
+#endif /* __cpp_lib_span */
+
+        /* Record 2 from doubles, converted to the int of the
+         * decomposition with PIOc_write_darray_tc(). */
+        for (PIO_Offset i = 0; i < elements_per_pe; i++)
+            ddata[i] = value(2, compmap[i]);
+        f.setframe(varid, 2);
+        f.write_darray(varid, d, ddata);
+
+        f.close();
+    }
+
+    {
+        pio::file f = pio::file::open(ios, PIO_IOTYPE_NETCDF, filename);
+        std::vector<int> data_in(elements_per_pe);
+
+        for (int r = 0; r < NUM_RECS; r++)
+        {
+            std::fill(data_in.begin(), data_in.end(), -1);
+            f.setframe(0, r);
+#ifdef __cpp_lib_span
+            if (r == 1)
+                f.read_darray(0, d, std::span<int>(data_in));
+            else
+#endif /* __cpp_lib_span */
+                f.read_darray(0, d, data_in);
+            for (PIO_Offset i = 0; i < elements_per_pe; i++)
+                if (data_in[i] != value(r, compmap[i]))
+                    return 1;
+        }
+    }
+
+    /* Errors are thrown with their PIO error code. */
+    try
+    {
+        pio::file f = pio::file::open(ios, PIO_IOTYPE_NETCDF, "no_such_file.nc");
+        return 1;
+    }
+    catch (const pio::error &e)
+    {
+        if (e.code() == PIO_NOERR)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Run tests of the C++ interface. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    MPI_Comm test_comm;
+    int ret = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ntasks);
+    if (ntasks < TARGET_NTASKS)
+    {
+        fprintf(stderr, "ERROR: Number of processors must be at least %d for this test!\n",
+                TARGET_NTASKS);
+        MPI_Finalize();
+        return 1;
+    }
+    MPI_Comm_split(MPI_COMM_WORLD, my_rank < TARGET_NTASKS, my_rank, &test_comm);
+
+    PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL);
+
+    if (my_rank < TARGET_NTASKS)
+    {
+        try
+        {
+            ret = test_cpp(test_comm, my_rank);
+        }
+        catch (const pio::error &e)
+        {
+            fprintf(stderr, "%d %s: %s\n", my_rank, TEST_NAME, e.what());
+            ret = e.code();
+        }
+    }
+
+    MPI_Comm_free(&test_comm);
+    MPI_Finalize();
+    if (ret)
+    {
+        fprintf(stderr, "%d %s FAILED with %d\n", my_rank, TEST_NAME, ret);
+        return 1;
+    }
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -326,6 +326,1446 @@ int test_darray(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank
     return PIO_NOERR;
 }
 
+/**
+ * Test PIOc_write_darray_tc(), writing double data to a float
+ * variable through a float decomposition.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_FLOAT.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_tc(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the netCDF varable. */
+    PIO_Offset arraylen = 4;
+    double test_data_double[arraylen];
+    float test_data_float_in[arraylen];
+    short test_data_short[arraylen];
+    int ret;       /* Return code. */
+
+    /* Initialize some data. */
+    for (int f = 0; f < arraylen; f++)
+    {
+        test_data_double[f] = my_rank * 10 + f + 0.5;
+        test_data_short[f] = f;
+    }
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_tc_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create a file with a float variable. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_FLOAT, NDIM, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            ERR(ret);
+
+        /* Only narrowing conversions are supported. */
+        if (PIOc_write_darray_tc(ncid, varid, ioid, arraylen, PIO_SHORT, test_data_short,
+                                 NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        /* Write the double data, converted to float. */
+        if ((ret = PIOc_write_darray_tc(ncid, varid, ioid, arraylen, PIO_DOUBLE,
+                                        test_data_double, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Read the data back and check it. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_float_in)))
+            ERR(ret);
+        for (int f = 0; f < arraylen; f++)
+            if (test_data_float_in[f] != (float)test_data_double[f])
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test the read cache. A static field is read again after the file is
+ * reopened, and served from the cache, which the statistics of the
+ * decomposition show.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_read_cache(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the netCDF varable. */
+    PIO_Offset arraylen = 4;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    pio_stats_t stats[2];  /* The stats before and after a read. */
+    iosystem_desc_t *ios;
+    int ret;       /* Return code. */
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        ERR(ERR_WRONG);
+    for (int f = 0; f < arraylen; f++)
+        test_data[f] = my_rank * 10 + f + 0.25;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_read_cache_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create a file with a double variable. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        if (PIOc_set_read_cache(iosysid, -1) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_set_read_cache(iosysid, 1024 * 1024)))
+            ERR(ret);
+
+        /* Read the data twice, with the file opened twice. */
+        for (int r = 0; r < 2; r++)
+        {
+            if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+                ERR(ret);
+            if ((ret = PIOc_setframe(ncid, varid, 0)))
+                ERR(ret);
+            memset(test_data_in, 0, sizeof(test_data_in));
+            if ((ret = PIOc_get_iodesc_stats(ioid, &stats[0])))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            if ((ret = PIOc_get_iodesc_stats(ioid, &stats[1])))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != test_data[f])
+                    ERR(ERR_WRONG);
+
+            /* The first read goes to the file, the second is served
+             * from the cache, without a read or the rearranger. */
+            if (!r && ios->ioproc && stats[1].nreads != stats[0].nreads + 1)
+                ERR(ERR_WRONG);
+            if (r && (stats[1].nreads != stats[0].nreads ||
+                      stats[1].io2comp_bytes != stats[0].io2comp_bytes))
+                ERR(ERR_WRONG);
+            if (!ios->read_cache || ios->read_cache->next ||
+                ios->read_cache_size != arraylen * sizeof(double))
+                ERR(ERR_WRONG);
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+        }
+
+        /* Opening the file for writing drops its arrays. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_WRITE)))
+            ERR(ret);
+        if (ios->read_cache || ios->read_cache_size)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Turn the cache off. */
+        if ((ret = PIOc_set_read_cache(iosysid, 0)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test staging the darray writes of pnetcdf files in a local
+ * directory with PIOc_set_stage_dir(). The staged writes are only in
+ * the file after PIOc_sync().
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_stage(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+#define NUM_STAGE_FRAMES 2
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the netCDF varable. */
+    PIO_Offset arraylen = 4;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    int ret;       /* Return code. */
+
+    if (PIOc_set_stage_dir(iosysid + TEST_VAL_42, ".") != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_set_stage_dir(iosysid, ".")))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_stage_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create a file with a double variable. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Write some frames, and drain them into the file. */
+        for (int fr = 0; fr < NUM_STAGE_FRAMES; fr++)
+        {
+            for (int f = 0; f < arraylen; f++)
+                test_data[f] = fr * 100 + my_rank * 10 + f + 0.5;
+            if ((ret = PIOc_setframe(ncid, varid, fr)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+
+        for (int fr = 0; fr < NUM_STAGE_FRAMES; fr++)
+        {
+            if ((ret = PIOc_setframe(ncid, varid, fr)))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != fr * 100 + my_rank * 10 + f + 0.5)
+                    ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIOc_set_stage_dir(iosysid, NULL);
+}
+
+/**
+ * Test writing the darray writes to checkpoint files with
+ * PIOc_set_checkpoint(), and reading them back when the file is
+ * opened again, with the same IO tasks, and with half of them and
+ * checkpoint files off, which reads the records of other layouts.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @param test_comm the communicator the test is running on.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_checkpoint(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank,
+                           MPI_Comm test_comm)
+{
+#define NUM_CKPT_FRAMES 2
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the netCDF varable. */
+    PIO_Offset arraylen = 4;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    int ret;       /* Return code. */
+
+    if (PIOc_set_checkpoint(iosysid + TEST_VAL_42, 1) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_set_checkpoint(iosysid, 1)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_ckpt_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create a file with a double variable. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Write some frames. */
+        for (int fr = 0; fr < NUM_CKPT_FRAMES; fr++)
+        {
+            for (int f = 0; f < arraylen; f++)
+                test_data[f] = fr * 100 + my_rank * 10 + f + 0.5;
+            if ((ret = PIOc_setframe(ncid, varid, fr)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Read the frames back from the checkpoint files. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        for (int fr = NUM_CKPT_FRAMES - 1; fr >= 0; fr--)
+        {
+            if ((ret = PIOc_setframe(ncid, varid, fr)))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != fr * 100 + my_rank * 10 + f + 0.5)
+                    ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+    if ((ret = PIOc_set_checkpoint(iosysid, 0)))
+        ERR(ret);
+
+    /* Read the files back on 2 IO tasks, without checkpoint files
+     * on. The attribute of the files still finds theirs. */
+    {
+        int dim_len_2d[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+        int iosysid2, ioid2;
+        int natts;
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, TARGET_NTASKS / 2, 2, 0, PIO_REARR_BOX,
+                                       &iosysid2)))
+            ERR(ret);
+        if ((ret = create_decomposition_2d(TARGET_NTASKS, my_rank, iosysid2, dim_len_2d,
+                                           &ioid2, PIO_DOUBLE)))
+            ERR(ret);
+        for (int fmt = 0; fmt < num_flavors; fmt++)
+        {
+            sprintf(filename, "data_%s_ckpt_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+            if ((ret = PIOc_openfile(iosysid2, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+                ERR(ret);
+            if ((ret = PIOc_inq_natts(ncid, &natts)))
+                ERR(ret);
+            if (natts != 1)
+                ERR(ERR_WRONG);
+            for (int fr = 0; fr < NUM_CKPT_FRAMES; fr++)
+            {
+                if ((ret = PIOc_setframe(ncid, varid, fr)))
+                    ERR(ret);
+                if ((ret = PIOc_read_darray(ncid, varid, ioid2, arraylen, test_data_in)))
+                    ERR(ret);
+                for (int f = 0; f < arraylen; f++)
+                    if (test_data_in[f] != fr * 100 + my_rank * 10 + f + 0.5)
+                        ERR(ERR_WRONG);
+            }
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+
+            /* The layout that wrote the files is needed to write
+             * them. */
+            if (PIOc_openfile(iosysid2, &ncid, &flavor[fmt], filename, PIO_WRITE) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_freedecomp(iosysid2, ioid2)))
+            ERR(ret);
+        if ((ret = PIOc_free_iosystem(iosysid2)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test writing and reading with PIOc_set_device_buffers(). Host
+ * arrays can be used for the test, since the data are only moved by
+ * MPI. The data are written with the decomposition, and with one
+ * whose map on each task is reversed, so that the unsorted MPI types
+ * of the rearranger pick the elements.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_device(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the netCDF varable. */
+    int rioid;     /* The ID of the reversed decomposition. */
+    PIO_Offset arraylen = 4;
+    PIO_Offset compmap[arraylen];
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    io_desc_t *iodesc;
+    int ret;       /* Return code. */
+
+    if (PIOc_set_device_buffers(iosysid + TEST_VAL_42, 1) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_set_device_buffers(iosysid, 1)))
+        ERR(ret);
+
+    /* Task r has row x = r of the array, from its end. */
+    for (int f = 0; f < arraylen; f++)
+        compmap[f] = my_rank * arraylen + arraylen - 1 - f;
+    if ((ret = PIOc_init_decomp(iosysid, PIO_DOUBLE, NDIM2, &dim_len[1], arraylen, compmap,
+                                &rioid, PIO_REARR_BOX, NULL, NULL)))
+        ERR(ret);
+    if (!(iodesc = pio_get_iodesc_from_id(rioid)) || !iodesc->needssort)
+        ERR(ERR_WRONG);
+
+    for (int f = 0; f < arraylen; f++)
+        test_data[f] = my_rank * 10 + f + 0.5;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_device_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create a file with a double variable. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Conversions can't be done on device arrays. */
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            ERR(ret);
+        if (PIOc_write_darray_tc(ncid, varid, ioid, arraylen, PIO_FLOAT, test_data,
+                                 NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        /* Write the data, and read it back, with each
+         * decomposition. */
+        for (int r = 0; r < 2; r++)
+        {
+            if ((ret = PIOc_write_darray(ncid, varid, r ? rioid : ioid, arraylen, test_data,
+                                         NULL)))
+                ERR(ret);
+            if ((ret = PIOc_sync(ncid)))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid, r ? rioid : ioid, arraylen,
+                                        test_data_in)))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != test_data[f])
+                    ERR(ERR_WRONG);
+        }
+
+        /* The reversed decomposition read the elements of each row
+         * in reverse. */
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+            ERR(ret);
+        for (int f = 0; f < arraylen; f++)
+            if (test_data_in[f] != test_data[arraylen - 1 - f])
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, rioid)))
+        ERR(ret);
+
+    return PIOc_set_device_buffers(iosysid, 0);
+}
+
+/**
+ * Test writing one array to two files with PIOc_write_darray_files().
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_files(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+#define NUM_DARRAY_FILES 2
+    char filename[NUM_DARRAY_FILES][PIO_MAX_NAME + 1]; /* Names for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid[NUM_DARRAY_FILES];   /* The ncids of the netCDF files. */
+    int varid[NUM_DARRAY_FILES];  /* The IDs of the netCDF varables. */
+    PIO_Offset arraylen = 4;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    int ret;       /* Return code. */
+
+    for (int f = 0; f < arraylen; f++)
+        test_data[f] = my_rank * 10 + f + 0.5;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        /* Create the files, each with a double variable. The second
+         * file has a second var, so the varids differ. */
+        for (int nf = 0; nf < NUM_DARRAY_FILES; nf++)
+        {
+            sprintf(filename[nf], "data_%s_files_%d_iotype_%d.nc", TEST_NAME, nf, flavor[fmt]);
+            if ((ret = PIOc_createfile(iosysid, &ncid[nf], &flavor[fmt], filename[nf],
+                                       PIO_CLOBBER)))
+                ERR(ret);
+            for (int d = 0; d < NDIM; d++)
+                if ((ret = PIOc_def_dim(ncid[nf], dim_name[d], (PIO_Offset)dim_len[d],
+                                        &dimids[d])))
+                    ERR(ret);
+            if (nf)
+                if ((ret = PIOc_def_var(ncid[nf], VAR_NAME2, PIO_DOUBLE, NDIM, dimids,
+                                        &varid[nf])))
+                    ERR(ret);
+            if ((ret = PIOc_def_var(ncid[nf], VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid[nf])))
+                ERR(ret);
+            if ((ret = PIOc_enddef(ncid[nf])))
+                ERR(ret);
+            if ((ret = PIOc_setframe(ncid[nf], varid[nf], 0)))
+                ERR(ret);
+        }
+
+        /* Write the array to both files. */
+        if (PIOc_write_darray_files(0, ncid, varid, ioid, arraylen, test_data,
+                                    NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_write_darray_files(NUM_DARRAY_FILES, ncid, varid, ioid, arraylen,
+                                           test_data, NULL)))
+            ERR(ret);
+
+        /* Read it back from each file. */
+        for (int nf = 0; nf < NUM_DARRAY_FILES; nf++)
+        {
+            if ((ret = PIOc_closefile(ncid[nf])))
+                ERR(ret);
+            if ((ret = PIOc_openfile(iosysid, &ncid[nf], &flavor[fmt], filename[nf],
+                                     PIO_NOWRITE)))
+                ERR(ret);
+            if ((ret = PIOc_setframe(ncid[nf], varid[nf], 0)))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid[nf], varid[nf], ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != test_data[f])
+                    ERR(ERR_WRONG);
+            if ((ret = PIOc_closefile(ncid[nf])))
+                ERR(ret);
+        }
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test writing an array and a subsampled version of it, and the means
+ * of its pairs of elements along y, with PIOc_write_darray_coarse().
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_coarse(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+#define COARSE_FACTOR 2
+#define NUM_COARSE_OPS 2
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    char cdim_name[NDIM2][PIO_MAX_NAME + 1] = {"cx", "cy"};
+    int op[NUM_COARSE_OPS] = {PIO_COARSE_SUBSAMPLE, PIO_COARSE_MEAN};
+    /* Each IO task has a row of the array, and the blocks of a mean
+     * can't be split between IO tasks, so the means are along y
+     * only. */
+    int factor[NUM_COARSE_OPS][NDIM2] = {{COARSE_FACTOR, COARSE_FACTOR}, {1, COARSE_FACTOR}};
+    int dimids[NDIM];      /* The dimension IDs. */
+    int cdimids[NDIM];     /* The dimension IDs of the coarse var. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid, cvarid;     /* The IDs of the vars. */
+    int cioid;     /* The ID of the coarse decomposition. */
+    PIO_Offset arraylen = 4;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    double cdata_in[X_DIM_LEN][Y_DIM_LEN / COARSE_FACTOR];
+    int ret;       /* Return code. */
+
+    /* Task r has row x = r of the array. */
+    for (int f = 0; f < arraylen; f++)
+        test_data[f] = my_rank * 10 + f + 0.5;
+
+    /* Bad parameters. */
+    if (PIOc_init_decomp_coarse(iosysid, ioid, PIO_COARSE_SUBSAMPLE, NULL, &cioid) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_init_decomp_coarse(iosysid, ioid, 0, factor[0], &cioid) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+
+    /* The blocks of the means along x would be split between IO
+     * tasks. */
+    if (PIOc_init_decomp_coarse(iosysid, ioid, PIO_COARSE_MEAN, factor[0], &cioid) !=
+        PIO_EINVAL)
+        ERR(ERR_WRONG);
+
+    for (int o = 0; o < NUM_COARSE_OPS; o++)
+    {
+        PIO_Offset start[NDIM] = {0, 0, 0};
+        PIO_Offset count[NDIM] = {1, X_DIM_LEN / factor[o][0], Y_DIM_LEN / factor[o][1]};
+
+        if ((ret = PIOc_init_decomp_coarse(iosysid, ioid, op[o], factor[o], &cioid)))
+            ERR(ret);
+
+        for (int fmt = 0; fmt < num_flavors; fmt++)
+        {
+            sprintf(filename, "data_%s_coarse_%d_iotype_%d.nc", TEST_NAME, op[o], flavor[fmt]);
+
+            /* Create a file with the var and its coarse version. */
+            if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+                ERR(ret);
+            for (int d = 0; d < NDIM; d++)
+                if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                    ERR(ret);
+            cdimids[0] = dimids[0];
+            for (int d = 0; d < NDIM2; d++)
+                if ((ret = PIOc_def_dim(ncid, cdim_name[d], (PIO_Offset)count[d + 1],
+                                        &cdimids[d + 1])))
+                    ERR(ret);
+            if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+                ERR(ret);
+            if ((ret = PIOc_def_var(ncid, VAR_NAME2, PIO_DOUBLE, NDIM, cdimids, &cvarid)))
+                ERR(ret);
+            if ((ret = PIOc_enddef(ncid)))
+                ERR(ret);
+            if ((ret = PIOc_setframe(ncid, varid, 0)))
+                ERR(ret);
+            if ((ret = PIOc_setframe(ncid, cvarid, 0)))
+                ERR(ret);
+
+            /* The coarse decomposition can't be used by itself. */
+            if (PIOc_write_darray(ncid, cvarid, cioid, 1, test_data, NULL) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+            if ((ret = PIOc_write_darray_coarse(ncid, varid, cvarid, cioid, arraylen,
+                                                test_data, NULL)))
+                ERR(ret);
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+
+            /* Check the array and its coarse version. */
+            if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+                ERR(ret);
+            if ((ret = PIOc_setframe(ncid, varid, 0)))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != test_data[f])
+                    ERR(ERR_WRONG);
+            if ((ret = PIOc_get_vara_double(ncid, cvarid, start, count, (double *)cdata_in)))
+                ERR(ret);
+            for (int i = 0; i < count[1]; i++)
+                for (int j = 0; j < count[2]; j++)
+                {
+                    double *c = (double *)cdata_in + i * count[2] + j;
+                    double expected = i * factor[o][0] * 10 + j * factor[o][1] + 0.5;
+
+                    /* The mean of a pair is half way between them. */
+                    if (op[o] == PIO_COARSE_MEAN)
+                        expected += 0.5;
+                    if (*c != expected)
+                        ERR(ERR_WRONG);
+                }
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+        }
+
+        if ((ret = PIOc_freedecomp(iosysid, cioid)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test PIOc_read_darray_subset(), reading a box of x = 1..2, y = 1..2
+ * through the decomposition.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_subset(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the var. */
+    PIO_Offset arraylen = 4;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    PIO_Offset start[NDIM2] = {1, 1};
+    PIO_Offset count[NDIM2] = {2, 2};
+    PIO_Offset bad_count[NDIM2] = {2, Y_DIM_LEN};
+    int ret;       /* Return code. */
+
+    /* Task r has row x = r of the array. */
+    for (int f = 0; f < arraylen; f++)
+        test_data[f] = my_rank * 10 + f + 0.5;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_subset_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            ERR(ret);
+
+        /* Bad parameters. */
+        if (PIOc_read_darray_subset(ncid, varid, ioid, NULL, count, arraylen,
+                                    test_data_in) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if (PIOc_read_darray_subset(ncid, varid, ioid, start, bad_count, arraylen,
+                                    test_data_in) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        /* Only the elements in the box are read. */
+        for (int f = 0; f < arraylen; f++)
+            test_data_in[f] = -1;
+        if ((ret = PIOc_read_darray_subset(ncid, varid, ioid, start, count, arraylen,
+                                           test_data_in)))
+            ERR(ret);
+        for (int f = 0; f < arraylen; f++)
+        {
+            bool in_box = my_rank >= 1 && my_rank <= 2 && f >= 1 && f <= 2;
+
+            if (test_data_in[f] != (in_box ? test_data[f] : -1))
+                ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test PIOc_init_decomp_gathered() and PIOc_write_gathered_list(),
+ * storing only the points of a checkerboard mask (x + y even).
+ *
+ * @param iosysid the IO system ID.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_gathered(int iosysid, int num_flavors, int *flavor, int my_rank)
+{
+#define NUM_POINTS (X_DIM_LEN * Y_DIM_LEN / 2)
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dim_len_2d[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid, listid;     /* The IDs of the data and list vars. */
+    int ioid, gioid;       /* The IDs of the masked and gathered decompositions. */
+    int ioid2;             /* The ID of a second gathered decomposition. */
+    int request;           /* The request of PIOc_iread_darray(). */
+    PIO_Offset arraylen = 4;
+    PIO_Offset compdof[arraylen];
+    PIO_Offset npoints;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    double data_in[NUM_POINTS];
+    int list_in[NUM_POINTS];
+    int ret;       /* Return code. */
+
+    /* Task r has row x = r of the array, without the odd points. */
+    for (int f = 0; f < arraylen; f++)
+    {
+        compdof[f] = (my_rank + f) % 2 ? 0 : my_rank * arraylen + f + 1;
+        test_data[f] = my_rank * 10 + f + 0.5;
+    }
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_DOUBLE, NDIM2, dim_len_2d, arraylen, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        ERR(ret);
+
+    /* Bad parameters. */
+    if (PIOc_init_decomp_gathered(iosysid + TEST_VAL_42, ioid, &npoints, &gioid) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if (PIOc_init_decomp_gathered(iosysid, ioid, &npoints, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+
+    if ((ret = PIOc_init_decomp_gathered(iosysid, ioid, &npoints, &gioid)))
+        ERR(ret);
+    if (npoints != NUM_POINTS)
+        ERR(ERR_WRONG);
+
+    /* A decomposition has only one gathered decomposition. */
+    if (PIOc_init_decomp_gathered(iosysid, ioid, &npoints, &ioid2) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_gathered_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create a file with the list var and a gathered record var. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, "land", npoints, &dimids[1])))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "land", PIO_INT, 1, &dimids[1], &listid)))
+            ERR(ret);
+        if ((ret = PIOc_put_att_text(ncid, listid, "compress", strlen("x y"), "x y")))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM2, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Only the gathered decomposition has a list. */
+        if (PIOc_write_gathered_list(ncid, listid, ioid) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_write_gathered_list(ncid, listid, gioid)))
+            ERR(ret);
+
+        /* The data are written with the masked decomposition. */
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Check the points, in the order of the list. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_get_var_int(ncid, listid, list_in)))
+            ERR(ret);
+        if ((ret = PIOc_get_var_double(ncid, varid, data_in)))
+            ERR(ret);
+        for (int p = 0; p < NUM_POINTS; p++)
+        {
+            int x = p / (Y_DIM_LEN / 2), y = 2 * (p % (Y_DIM_LEN / 2)) + x % 2;
+
+            if (list_in[p] != x * Y_DIM_LEN + y || data_in[p] != x * 10 + y + 0.5)
+                ERR(ERR_WRONG);
+        }
+
+        /* Read them back through the masked decomposition, with each
+         * read function. The holes are not changed. */
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            ERR(ret);
+        for (int rf = 0; rf < 3; rf++)
+        {
+            for (int f = 0; f < arraylen; f++)
+                test_data_in[f] = -1;
+            if (rf == 0)
+                ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in);
+            else if (rf == 1)
+                ret = PIOc_read_darray_multi(ncid, &varid, ioid, 1, arraylen, test_data_in);
+            else if (!(ret = PIOc_iread_darray(ncid, varid, ioid, arraylen, test_data_in,
+                                               &request)))
+                ret = PIOc_wait_darray(ncid, request);
+            if (ret)
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != (compdof[f] ? test_data[f] : -1))
+                    ERR(ERR_WRONG);
+        }
+
+        /* A box of the grid can't be read from the points. */
+        {
+            PIO_Offset start[NDIM2] = {0, 0}, count[NDIM2] = {1, 1};
+
+            if (PIOc_read_darray_subset(ncid, varid, ioid, start, count, arraylen,
+                                        test_data_in) != PIO_EINVAL)
+                ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, gioid)))
+        ERR(ret);
+    return PIOc_freedecomp(iosysid, ioid);
+}
+
+/**
+ * Test PIOc_accumulate_darray() and PIOc_write_accumulated(), finding
+ * the mean and maximum of some arrays on the IO tasks.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_accumulate(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+#define NUM_ACCUM 3
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid[2];  /* The IDs of the mean and max vars. */
+    PIO_Offset arraylen = 4;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    int ret;       /* Return code. */
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_accum_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create a file with two double variables. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid[0])))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME2, PIO_DOUBLE, NDIM, dimids, &varid[1])))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Nothing has been accumulated yet. */
+        if (PIOc_write_accumulated(ncid, varid[0]) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        /* Accumulate some arrays. */
+        for (int a = 0; a < NUM_ACCUM; a++)
+        {
+            for (int f = 0; f < arraylen; f++)
+                test_data[f] = my_rank * 10 + f + a;
+            if ((ret = PIOc_accumulate_darray(ncid, varid[0], ioid, arraylen, test_data,
+                                              PIO_ACCUM_MEAN)))
+                ERR(ret);
+            if ((ret = PIOc_accumulate_darray(ncid, varid[1], ioid, arraylen, test_data,
+                                              PIO_ACCUM_MAX)))
+                ERR(ret);
+        }
+
+        /* The reduction can't change. */
+        if (PIOc_accumulate_darray(ncid, varid[0], ioid, arraylen, test_data,
+                                   PIO_ACCUM_SUM) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        /* Write the results. */
+        for (int v = 0; v < 2; v++)
+        {
+            if ((ret = PIOc_setframe(ncid, varid[v], 0)))
+                ERR(ret);
+            if ((ret = PIOc_write_accumulated(ncid, varid[v])))
+                ERR(ret);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Read the data back and check it. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        for (int v = 0; v < 2; v++)
+        {
+            if ((ret = PIOc_setframe(ncid, varid[v], 0)))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid[v], ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != my_rank * 10 + f + (v ? NUM_ACCUM - 1 : 1))
+                    ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test PIOc_set_var_skip_unchanged(). The same array is written to
+ * records 0 and 1, and a changed one to record 2. Record 1 is
+ * skipped, and the reference var says its data are in record 0. This
+ * is done with host arrays, and with device arrays (see
+ * PIOc_set_device_buffers()), which are hashed in host memory.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_skip(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+#define NUM_SKIP_RECS 3
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid, refvarid;   /* The IDs of the data and reference vars. */
+    PIO_Offset arraylen = 4;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    int ref_in[NUM_SKIP_RECS];
+    int expected_ref[NUM_SKIP_RECS] = {0, 0, 2};
+    int ret;       /* Return code. */
+
+    for (int fd = 0; fd < num_flavors * 2; fd++)
+    {
+        /* Each iotype with host arrays, then with device arrays. */
+        int fmt = fd / 2;
+        int device = fd % 2;
+
+        if ((ret = PIOc_set_device_buffers(iosysid, device)))
+            ERR(ret);
+        sprintf(filename, "data_%s_skip_%d_iotype_%d.nc", TEST_NAME, device, flavor[fmt]);
+
+        /* Create a file with a double var and its reference var. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "frame", PIO_INT, 1, dimids, &refvarid)))
+            ERR(ret);
+
+        /* The reference var must be an int record var. */
+        if (PIOc_set_var_skip_unchanged(ncid, varid, true, varid) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if (PIOc_set_var_skip_unchanged(ncid + TEST_VAL_42, varid, true, refvarid) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_set_var_skip_unchanged(ncid, varid, true, refvarid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Write the same array twice, then a changed one. */
+        for (int r = 0; r < NUM_SKIP_RECS; r++)
+        {
+            for (int f = 0; f < arraylen; f++)
+                test_data[f] = my_rank * 10 + f + (r == NUM_SKIP_RECS - 1 ? 0.5 : 0);
+            if ((ret = PIOc_setframe(ncid, varid, r)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Check the reference var, and the data of each record
+         * through it. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_get_var_int(ncid, refvarid, ref_in)))
+            ERR(ret);
+        for (int r = 0; r < NUM_SKIP_RECS; r++)
+        {
+            if (ref_in[r] != expected_ref[r])
+                ERR(ERR_WRONG);
+            if ((ret = PIOc_setframe(ncid, varid, ref_in[r])))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (test_data_in[f] != my_rank * 10 + f + (r == NUM_SKIP_RECS - 1 ? 0.5 : 0))
+                    ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIOc_set_device_buffers(iosysid, 0);
+}
+
+/**
+ * Test the I/O statistics of files and decompositions. Records are
+ * written through a decomposition with holes, so that the holes are
+ * filled, and read back. The writes of the fill values are not
+ * counted as darray writes.
+ *
+ * @param iosysid the IO system ID.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_stats(int iosysid, int num_flavors, int *flavor, int my_rank)
+{
+#define NUM_STATS_RECS 3
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dim_len_2d[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the netCDF varable. */
+    int ioid;      /* The ID of the decomposition with holes. */
+    PIO_Offset arraylen = 4;
+    PIO_Offset compdof[arraylen];
+    PIO_Offset bytes = NUM_STATS_RECS * arraylen * sizeof(double);
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    double fillvalue = -1;
+    pio_stats_t stats;
+    iosystem_desc_t *ios;
+    int ret;       /* Return code. */
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        ERR(ERR_WRONG);
+
+    /* Task r has row x = r of the array, without the odd points. */
+    for (int f = 0; f < arraylen; f++)
+        compdof[f] = (my_rank + f) % 2 ? 0 : my_rank * arraylen + f + 1;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_DOUBLE, NDIM2, dim_len_2d, arraylen, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_stats_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Write each record in its own flush. */
+        for (int r = 0; r < NUM_STATS_RECS; r++)
+        {
+            for (int f = 0; f < arraylen; f++)
+                test_data[f] = r * 100 + my_rank * 10 + f;
+            if ((ret = PIOc_setframe(ncid, varid, r)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, &fillvalue)))
+                ERR(ret);
+            if ((ret = PIOc_sync(ncid)))
+                ERR(ret);
+        }
+
+        /* Check the statistics of the writes. */
+        if (PIOc_get_file_stats(ncid + TEST_VAL_42, &stats) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if (PIOc_get_file_stats(ncid, NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_get_file_stats(ncid, &stats)))
+            ERR(ret);
+        if (stats.comp2io_bytes != bytes || stats.io2comp_bytes || stats.nreads)
+            ERR(ERR_WRONG);
+        if (ios->ioproc && (stats.nwrites != NUM_STATS_RECS || !stats.bytes_written ||
+                            !stats.nregions))
+            ERR(ERR_WRONG);
+        if (!ios->ioproc && (stats.nwrites || stats.bytes_written))
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Read it back, and check the statistics of the reads. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        for (int r = 0; r < NUM_STATS_RECS; r++)
+        {
+            if ((ret = PIOc_setframe(ncid, varid, r)))
+                ERR(ret);
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int f = 0; f < arraylen; f++)
+                if (compdof[f] && test_data_in[f] != r * 100 + my_rank * 10 + f)
+                    ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_get_file_stats(ncid, &stats)))
+            ERR(ret);
+        if (stats.io2comp_bytes != bytes || stats.comp2io_bytes || stats.nwrites)
+            ERR(ERR_WRONG);
+        if (ios->ioproc && (stats.nreads != NUM_STATS_RECS || !stats.bytes_read))
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    /* The decomposition has the statistics of all the files. */
+    if (PIOc_get_iodesc_stats(ioid + TEST_VAL_42, &stats) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if (PIOc_get_iodesc_stats(ioid, NULL) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if ((ret = PIOc_get_iodesc_stats(ioid, &stats)))
+        ERR(ret);
+    if (stats.comp2io_bytes != num_flavors * bytes || stats.io2comp_bytes != num_flavors * bytes)
+        ERR(ERR_WRONG);
+    if (ios->ioproc && (stats.nwrites != num_flavors * NUM_STATS_RECS ||
+                        stats.nreads != num_flavors * NUM_STATS_RECS))
+        ERR(ERR_WRONG);
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test the limit of the write multi buffers of a task (see
+ * PIOc_set_compute_buffer_limit()). Records of two variables with
+ * different decompositions are written to a file. The decompositions
+ * are created before the limit is lowered, so that they would buffer
+ * all the records, and only the limit of the task makes them
+ * flush. The buffers of the task never hold more than the limit, and
+ * the array being written.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_buffer_limit(int iosysid, int ioid, int num_flavors, int *flavor,
+                             int my_rank)
+{
+#define NUM_LIMIT_RECS 6
+#define NUM_LIMIT_VARS 2
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid[NUM_LIMIT_VARS];  /* The IDs of the netCDF varables. */
+    int dim_len_2d[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+    int ioids[NUM_LIMIT_VARS];
+    PIO_Offset arraylen = 4;
+    PIO_Offset limit = 3 * arraylen * sizeof(double);
+    PIO_Offset old_limit;
+    PIO_Offset current;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    int ret;       /* Return code. */
+
+    /* A second decomposition, with a buffer of its own. */
+    ioids[0] = ioid;
+    if ((ret = create_decomposition_2d(TARGET_NTASKS, my_rank, iosysid, dim_len_2d,
+                                       &ioids[1], PIO_DOUBLE)))
+        return ret;
+    old_limit = PIOc_set_compute_buffer_limit(limit);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "data_%s_buffer_limit_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid[0])))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME2, PIO_DOUBLE, NDIM, dimids, &varid[1])))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Write more records than fit in the limit. */
+        for (int r = 0; r < NUM_LIMIT_RECS; r++)
+            for (int v = 0; v < NUM_LIMIT_VARS; v++)
+            {
+                for (int f = 0; f < arraylen; f++)
+                    test_data[f] = v * 1000 + r * 100 + my_rank * 10 + f;
+                if ((ret = PIOc_setframe(ncid, varid[v], r)))
+                    ERR(ret);
+                if ((ret = PIOc_write_darray(ncid, varid[v], ioids[v], arraylen, test_data,
+                                             NULL)))
+                    ERR(ret);
+                if ((ret = PIOc_get_mem_usage(PIO_MEM_WMB, &current, NULL)))
+                    ERR(ret);
+                if (current > limit + arraylen * (PIO_Offset)sizeof(double))
+                    ERR(ERR_WRONG);
+            }
+
+        /* Every record was written, by the flushes and the close. */
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        for (int r = 0; r < NUM_LIMIT_RECS; r++)
+            for (int v = 0; v < NUM_LIMIT_VARS; v++)
+            {
+                if ((ret = PIOc_setframe(ncid, varid[v], r)))
+                    ERR(ret);
+                if ((ret = PIOc_read_darray(ncid, varid[v], ioids[v], arraylen,
+                                            test_data_in)))
+                    ERR(ret);
+                for (int f = 0; f < arraylen; f++)
+                    if (test_data_in[f] != v * 1000 + r * 100 + my_rank * 10 + f)
+                        ERR(ERR_WRONG);
+            }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    PIOc_set_compute_buffer_limit(old_limit);
+    if ((ret = PIOc_freedecomp(iosysid, ioids[1])))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
+/**
+ * Test the pool of darray buffers of the IO tasks
+ * (PIOc_set_iobuf_pool()). Records are written and read back with a
+ * pool, which keeps the buffers afterwards, and with a pool too small
+ * for them, which keeps none.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a decomposition of type PIO_DOUBLE.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_darray_iobuf_pool(int iosysid, int ioid, int num_flavors, int *flavor,
+                           int my_rank)
+{
+#define IOBUF_POOL_BYTES (1024 * 1024)
+#define NUM_POOL_SIZES 2
+    iosystem_desc_t *ios;
+    char filename[PIO_MAX_NAME + 1]; /* Name for the output files. */
+    int dimids[NDIM];      /* The dimension IDs. */
+    int ncid;      /* The ncid of the netCDF file. */
+    int varid;     /* The ID of the netCDF varable. */
+    PIO_Offset pool_bytes[NUM_POOL_SIZES] = {IOBUF_POOL_BYTES, 1};
+    PIO_Offset arraylen = 4;
+    PIO_Offset current;
+    double test_data[arraylen];
+    double test_data_in[arraylen];
+    int ret;       /* Return code. */
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return ERR_WRONG;
+
+    /* These should not work. */
+    if (PIOc_set_iobuf_pool(iosysid + TEST_VAL_42, IOBUF_POOL_BYTES, false) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_set_iobuf_pool(iosysid, -1, false) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    for (int p = 0; p < NUM_POOL_SIZES; p++)
+    {
+        if ((ret = PIOc_set_iobuf_pool(iosysid, pool_bytes[p], false)))
+            return ret;
+
+        for (int fmt = 0; fmt < num_flavors; fmt++)
+        {
+            sprintf(filename, "data_%s_iobuf_pool_%d_iotype_%d.nc", TEST_NAME, p, flavor[fmt]);
+            if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+                return ret;
+            for (int d = 0; d < NDIM; d++)
+                if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                    return ret;
+            if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_DOUBLE, NDIM, dimids, &varid)))
+                return ret;
+            if ((ret = PIOc_enddef(ncid)))
+                return ret;
+            for (int r = 0; r < NUM_TIMESTEPS; r++)
+            {
+                for (int f = 0; f < arraylen; f++)
+                    test_data[f] = r * 100 + my_rank * 10 + f;
+                if ((ret = PIOc_setframe(ncid, varid, r)))
+                    return ret;
+                if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+                    return ret;
+            }
+            if ((ret = PIOc_closefile(ncid)))
+                return ret;
+
+            /* The buffers of the reads come from the pool. */
+            if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+                return ret;
+            for (int r = 0; r < NUM_TIMESTEPS; r++)
+            {
+                if ((ret = PIOc_setframe(ncid, varid, r)))
+                    return ret;
+                if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                    return ret;
+                for (int f = 0; f < arraylen; f++)
+                    if (test_data_in[f] != r * 100 + my_rank * 10 + f)
+                        return ERR_WRONG;
+            }
+            if ((ret = PIOc_closefile(ncid)))
+                return ret;
+
+            /* The IO tasks keep their buffers in the pool, if they
+             * fit. */
+            if ((ret = PIOc_get_mem_usage(PIO_MEM_IOBUF, &current, NULL)))
+                return ret;
+            if (current > pool_bytes[p] || (ios->ioproc && !p && !current))
+                return ERR_WRONG;
+        }
+
+        /* Turning off the pool gives back the buffers. */
+        if ((ret = PIOc_set_iobuf_pool(iosysid, 0, false)))
+            return ret;
+        if ((ret = PIOc_get_mem_usage(PIO_MEM_IOBUF, &current, NULL)))
+            return ret;
+        if (current)
+            return ERR_WRONG;
+    }
+
+    return PIO_NOERR;
+}
+
 /**
  * Run all the tests.
  *
@@ -361,6 +1801,77 @@ int test_all_darray(int iosysid, int num_flavors, int *flavor, int my_rank,
         if ((ret = test_darray(iosysid, ioid, num_flavors, flavor, my_rank, pio_type[t])))
             return ret;
 
+        /* Test the reductions on the IO tasks. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_accumulate(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test skipping unchanged arrays. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_skip(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test the read cache. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_read_cache(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test staging the writes in a local directory. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_stage(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test the checkpoint files. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_checkpoint(iosysid, ioid, num_flavors, flavor, my_rank,
+                                              test_comm)))
+                return ret;
+
+        /* Test device buffers. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_device(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test the I/O statistics. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_stats(iosysid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test the limit of the write multi buffers. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_buffer_limit(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test the pool of darray buffers of the IO tasks. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_iobuf_pool(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test writing to several files at once. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_files(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test the coarse output. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_coarse(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test reading a box through the decomposition. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_subset(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test storing the points of a mask only. */
+        if (pio_type[t] == PIO_DOUBLE)
+            if ((ret = test_darray_gathered(iosysid, num_flavors, flavor, my_rank)))
+                return ret;
+
+        /* Test writing double data through the float decomposition. */
+        if (pio_type[t] == PIO_FLOAT)
+            if ((ret = test_darray_tc(iosysid, ioid, num_flavors, flavor, my_rank)))
+                return ret;
+
         /* Free the PIO decomposition. */
         if ((ret = PIOc_freedecomp(iosysid, ioid)))
             ERR(ret);
@@ -93,16 +93,22 @@ int run_darray_async_test(int iosysid, int my_rank, MPI_Comm test_comm,
     if ((ret = PIOc_write_nc_decomp(iosysid, decomp_filename, 0, ioid, NULL, NULL, 0)))
         return ret;
 
-    for (int fmt = 0; fmt < num_flavors; fmt++)
+    /* Write each iotype, then write it again with a background sync
+     * and close. */
+    for (int f = 0; f < 2 * num_flavors; f++)
     {
+        int fmt = f % num_flavors;
+        int background = f / num_flavors;
         int ncid;
         int dimid;
         int varid;
+        int done = 0;
         char data_filename[PIO_MAX_NAME + 1];
         float my_data = my_rank * 10;
 
         /* Generate a file name. */
-        sprintf(data_filename, "data_%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+        sprintf(data_filename, "data_%s%s_iotype_%d.nc", TEST_NAME,
+                background ? "_background" : "", flavor[fmt]);
 
         /* Create sample output file. */
         if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], data_filename,
@@ -125,9 +131,29 @@ int run_darray_async_test(int iosysid, int my_rank, MPI_Comm test_comm,
         if ((ret = PIOc_write_darray(ncid, varid, ioid, ELEM1, &my_data, NULL)))
             AERR(ret);
 
-        /* Close the file. */
-        if ((ret = PIOc_closefile(ncid)))
-            AERR(ret);
+        if (!background)
+        {
+            /* Close the file. */
+            if ((ret = PIOc_closefile(ncid)))
+                AERR(ret);
+        }
+        else
+        {
+            /* Sync and close the file in the background. */
+            if ((ret = PIOc_sync_async(ncid)))
+                AERR(ret);
+            if ((ret = PIOc_file_wait(ncid)))
+                AERR(ret);
+            if ((ret = PIOc_closefile_async(ncid)))
+                AERR(ret);
+            while (!done)
+                if ((ret = PIOc_file_test(ncid, &done)))
+                    AERR(ret);
+
+            /* The ncid has been freed. */
+            if (PIOc_file_wait(ncid) != PIO_EBADID)
+                AERR(ERR_WRONG);
+        }
 
         /* Check the file for correctness. */
         if ((ret = check_darray_file(iosysid, data_filename, PIO_IOTYPE_NETCDF, my_rank)))
@@ -191,6 +217,17 @@ int main(int argc, char **argv)
             if ((ret = run_darray_async_test(iosysid, my_rank, test_comm, num_flavors, flavor)))
                 return ret;
 
+            /* Run it again without waiting for the IO task to write
+             * the data. */
+            if (PIOc_set_write_behind(iosysid + TEST_VAL_42, true) != PIO_EBADID)
+                ERR(ERR_WRONG);
+            if ((ret = PIOc_set_write_behind(iosysid, true)))
+                ERR(ret);
+            if ((ret = run_darray_async_test(iosysid, my_rank, test_comm, num_flavors, flavor)))
+                return ret;
+            if ((ret = PIOc_set_write_behind(iosysid, false)))
+                ERR(ret);
+
             /* Finalize PIO system. */
             if ((ret = PIOc_free_iosystem(iosysid)))
                 return ret;
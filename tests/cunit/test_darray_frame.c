@@ -41,6 +41,7 @@
 
 /* The names of variable in the netCDF output files. */
 #define VAR_NAME "prc"
+#define VAR_NAME2 "prc2"
 
 /**
  * Test the darray functionality. Create a netCDF file with 3
@@ -96,6 +97,7 @@ int test_frame_simple(int iosysid, int num_iotypes, int *iotype, int my_rank,
         int dim_len[NDIM3] = {TIME_LEN_SHORT, LAT_LEN_SHORT, LON_LEN_SHORT};
         char dim_name[NDIM3][PIO_MAX_NAME + 1] = {"time", "lat", "lon"};
         int varid;     /* The ID of the netCDF varable. */
+        int varid2;    /* The ID of a second var, written in turn with the first. */
 
         /* Create the filename. */
         sprintf(filename, "simple_frame_%s_iotype_%d_rearr_%d.nc", TEST_NAME, iotype[fmt],
@@ -114,6 +116,8 @@ int test_frame_simple(int iosysid, int num_iotypes, int *iotype, int my_rank,
         /* Define a variable. */
         if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_INT, NDIM3, dimids, &varid)))
             ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME2, PIO_INT, NDIM3, dimids, &varid2)))
+            ERR(ret);
 
         /* End define mode. */
         if ((ret = PIOc_enddef(ncid)))
@@ -135,6 +139,16 @@ int test_frame_simple(int iosysid, int num_iotypes, int *iotype, int my_rank,
             /* Write the data. */
             if ((ret = PIOc_write_darray(ncid, varid, ioid, elements_per_pe, test_data_int, NULL)))
                 ERR(ret);
+
+            /* Write the second var between the frames of the first,
+             * so the frames of each are not next to each other in the
+             * write buffer. */
+            for (int i = 0; i < elements_per_pe; i++)
+                test_data_int[i] = -(my_rank + r * 100);
+            if ((ret = PIOc_setframe(ncid, varid2, r)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid2, ioid, elements_per_pe, test_data_int, NULL)))
+                ERR(ret);
         }
 
         /* Close the netCDF file. */
@@ -163,6 +177,15 @@ int test_frame_simple(int iosysid, int num_iotypes, int *iotype, int my_rank,
                 for (int f = 0; f < elements_per_pe; f++)
                     if (test_data_int_in[f] != my_rank + r * 100)
                         return ERR_WRONG;
+
+                /* Check the second var. */
+                if ((ret = PIOc_setframe(ncid2, varid2, r)))
+                    ERR(ret);
+                if ((ret = PIOc_read_darray(ncid2, varid2, ioid, elements_per_pe, test_data_int_in)))
+                    ERR(ret);
+                for (int f = 0; f < elements_per_pe; f++)
+                    if (test_data_int_in[f] != -(my_rank + r * 100))
+                        return ERR_WRONG;
             }
 
             /* Close the netCDF file. */
@@ -62,7 +62,10 @@ int dim_len[NDIM] = {NC_UNLIMITED, X_DIM_LEN, Y_DIM_LEN};
 /**
  * Test the darray functionality. Create a netCDF file with 3
  * dimensions and 3 variable, and use PIOc_write_darray_multi() to
- * write one record of data to all three vars at once.
+ * write one record of data to all three vars at once. Then do it
+ * again, with the records of the vars set with PIOc_setframe()
+ * instead of passed to PIOc_write_darray_multi(). Read it back one
+ * var at a time, and with PIOc_read_darray_multi().
  *
  * @param iosysid the IO system ID.
  * @param ioid the ID of the decomposition.
@@ -271,16 +274,25 @@ int test_darray(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank
                 if ((ret = PIOc_enddef(ncid)))
                     ERR(ret);
 
-                /* Set the value of the record dimension. */
-                if ((ret = PIOc_setframe(ncid, varid[0], 0)))
-                    ERR(ret);
-
+                /* Set the value of the record dimension. In the
+                 * second test case each var gets its own record, set
+                 * with PIOc_setframe() only, and no frame is passed
+                 * to the _multi function. */
                 int frame[NVAR] = {0, 0, 0};
                 int flushtodisk = test_multi;
 
+                for (int v = 0; v < NVAR; v++)
+                {
+                    if (test_multi)
+                        frame[v] = v;
+                    if ((ret = PIOc_setframe(ncid, varid[v], frame[v])))
+                        ERR(ret);
+                }
+
                 /* Write the data with the _multi function. */
-                if ((ret = PIOc_write_darray_multi(ncid, varid, ioid, NVAR, arraylen, test_data, frame,
-                                                   fillvalue, flushtodisk)))
+                if ((ret = PIOc_write_darray_multi(ncid, varid, ioid, NVAR, arraylen, test_data,
+                                                   test_multi ? NULL : frame, fillvalue,
+                                                   flushtodisk)))
                     ERR(ret);
 
                 /* Close the netCDF file. */
@@ -296,7 +308,7 @@ int test_darray(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank
                 for (int v = 0; v < NVAR; v++)
                 {
                     /* Set the value of the record dimension. */
-                    if ((ret = PIOc_setframe(ncid2, varid[v], 0)))
+                    if ((ret = PIOc_setframe(ncid2, varid[v], frame[v])))
                         ERR(ret);
 
                     /* Read the data. */
@@ -360,6 +372,21 @@ int test_darray(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank
                     }
                 }
 
+                /* Read all the vars at once with the _multi function,
+                 * and make sure we get correct data. */
+                {
+                    PIO_Offset type_size;
+
+                    if ((ret = PIOc_inq_type(ncid2, pio_type, NULL, &type_size)))
+                        ERR(ret);
+                    char multi_in[NVAR * arraylen * type_size];
+
+                    if ((ret = PIOc_read_darray_multi(ncid2, varid, ioid, NVAR, arraylen, multi_in)))
+                        ERR(ret);
+                    if (memcmp(multi_in, test_data, NVAR * arraylen * type_size))
+                        ERR(ERR_WRONG);
+                }
+
                 /* Close the netCDF file. */
                 if ((ret = PIOc_closefile(ncid2)))
                     ERR(ret);
@@ -46,6 +46,13 @@
 /* Number of variables in the test file. */
 #define NUM_VAR 4
 
+/* Compute buffer limit of the adaptive aggregation tests, so that
+ * only a few arrays are buffered before a flush. */
+#define AGG_BUFFER_LIMIT 64
+
+/* The file the results of PIOc_probe_iosystem() are cached in. */
+#define PROBE_CACHE_FILE "test_darray_multivar_probe.txt"
+
 /* The dimension names. */
 char dim_name[NDIM][PIO_MAX_NAME + 1] = {"timestep", "x", "y"};
 
@@ -479,6 +486,60 @@ int test_multivar_darray(int iosysid, int ioid, int num_flavors, int *flavor,
     return PIO_NOERR;
 }
 
+/**
+ * Test that the aggregation of a decomposition is adapted after a
+ * full flush. The decomposition flushes every 2 arrays, and the first
+ * full flush always halves that.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a PIO_BYTE decomposition.
+ * @param iotype the iotype to use.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_adapt_agg(int iosysid, int ioid, int iotype, int my_rank)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM];
+    int ncid;
+    int varid;
+    io_desc_t *iodesc;
+    signed char data[4];
+    int ret;
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        ERR(ERR_WRONG);
+    for (int i = 0; i < 4; i++)
+        data[i] = my_rank * 10 + i;
+
+    sprintf(filename, "%s_adapt_agg_iotype_%d.nc", TEST_NAME, iotype);
+    if ((ret = PIOc_createfile(iosysid, &ncid, &iotype, filename, PIO_CLOBBER)))
+        ERR(ret);
+    for (int d = 0; d < NDIM; d++)
+        if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+            ERR(ret);
+    if ((ret = PIOc_def_var(ncid, var_name[0], PIO_BYTE, NDIM, dimids, &varid)))
+        ERR(ret);
+    if ((ret = PIOc_enddef(ncid)))
+        ERR(ret);
+
+    /* The third record flushes the first two. */
+    for (int r = 0; r < 3; r++)
+    {
+        if ((ret = PIOc_setframe(ncid, varid, r)))
+            ERR(ret);
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, 4, data, NULL)))
+            ERR(ret);
+    }
+    if (iodesc->agg_rate <= 0 || iodesc->agg_dir != -1 || iodesc->agg_arrays != 1)
+        ERR(ERR_WRONG);
+
+    if ((ret = PIOc_closefile(ncid)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
 /**
  * Run all the tests.
  *
@@ -503,6 +564,7 @@ int test_all_darray(int iosysid, int num_flavors, int *flavor, int my_rank,
     int test_type[NUM_TYPES_TO_TEST] = {PIO_BYTE, PIO_CHAR, PIO_SHORT, PIO_INT, PIO_FLOAT, PIO_DOUBLE};
 #endif /* _NETCDF4 */
     int ioid;
+    io_desc_t *iodesc;
     int dim_len_2d[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
     int ret; /* Return code. */
 
@@ -516,6 +578,18 @@ int test_all_darray(int iosysid, int num_flavors, int *flavor, int my_rank,
                                            &ioid, test_type[t])))
             return ret;
 
+        /* No full flush of the decomposition has been timed yet. */
+        if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+            ERR(ERR_WRONG);
+        if (iodesc->agg_rate || iodesc->agg_arrays)
+            ERR(ERR_WRONG);
+
+        /* Flush every 2 arrays, so the tests make full flushes. */
+        iodesc->agg_arrays = 2;
+        if (!t)
+            if ((ret = test_adapt_agg(iosysid, ioid, flavor[0], my_rank)))
+                return ret;
+
         /* Run the different combinations of use_fill and use_default. */
         for (int f = 0; f < NUM_FILL_TESTS; f++)
         {
@@ -531,6 +605,11 @@ int test_all_darray(int iosysid, int num_flavors, int *flavor, int my_rank,
                 return ret;
         }
 
+        /* The aggregation of the decomposition was adapted. */
+        if (iodesc->agg_rate <= 0 || iodesc->agg_arrays < 1 ||
+            iodesc->agg_arrays > max(1, iodesc->maxbytes / iodesc->mpitype_size))
+            ERR(ERR_WRONG);
+
         /* Free the PIO decomposition. */
         if ((ret = PIOc_freedecomp(iosysid, ioid)))
             ERR(ret);
@@ -544,6 +623,8 @@ int main(int argc, char **argv)
 {
 #define NUM_REARRANGERS 2
     int rearranger[NUM_REARRANGERS] = {PIO_REARR_BOX, PIO_REARR_SUBSET};
+#define NUM_FLUSH_MODES 2
+    int flush_mode[NUM_FLUSH_MODES] = {PIO_FLUSH_VOTE, PIO_FLUSH_DETERMINISTIC};
     int my_rank;
     int ntasks;
     int num_flavors;         /* Number of PIO netCDF flavors in this build. */
@@ -571,26 +652,124 @@ int main(int argc, char **argv)
         if ((ret = get_iotypes(&num_flavors, flavor)))
             ERR(ret);
 
-        /* Test for both arrangers. */
+        /* Test for both arrangers, both flush modes, and with and
+         * without the pnetcdf attached buffer. */
         for (int r = 0; r < NUM_REARRANGERS; r++)
         {
+            for (int m = 0; m < NUM_FLUSH_MODES * 2; m++)
+            {
+                int old_mode;
+                PIO_Offset old_limit;
+                bool bput = m >= NUM_FLUSH_MODES;
+
+                /* Initialize the PIO IO system. This specifies how
+                 * many and which processors are involved in I/O. */
+                if ((ret = PIOc_Init_Intracomm(test_comm, TARGET_NTASKS, ioproc_stride,
+                                               ioproc_start, rearranger[r], &iosysid)))
+                    return ret;
+
+                /* Check the flush mode setting. */
+                if (PIOc_set_darray_flush_mode(iosysid + TEST_VAL_42, flush_mode[m % NUM_FLUSH_MODES],
+                                               NULL) != PIO_EBADID)
+                    ERR(ERR_WRONG);
+                if (PIOc_set_darray_flush_mode(iosysid, TEST_VAL_42, NULL) != PIO_EINVAL)
+                    ERR(ERR_WRONG);
+                if ((ret = PIOc_set_darray_flush_mode(iosysid, flush_mode[m % NUM_FLUSH_MODES],
+                                                      &old_mode)))
+                    ERR(ret);
+                if (old_mode != PIO_FLUSH_VOTE)
+                    ERR(ERR_WRONG);
 
-            /* Initialize the PIO IO system. This specifies how
-             * many and which processors are involved in I/O. */
-            if ((ret = PIOc_Init_Intracomm(test_comm, TARGET_NTASKS, ioproc_stride,
-                                           ioproc_start, rearranger[r], &iosysid)))
-                return ret;
-            /* printf("test Rearranger %d\n",rearranger[r]); */
-            /* Run tests. */
-            if ((ret = test_all_darray(iosysid, num_flavors, flavor, my_rank, test_comm,
-                                       rearranger[r])))
-                return ret;
-            /* printf("test Rearranger %d complete\n",rearranger[r]); */
+                /* Check the attached buffer setting. */
+                if (PIOc_set_pnetcdf_bput(iosysid + TEST_VAL_42, bput) != PIO_EBADID)
+                    ERR(ERR_WRONG);
+                if ((ret = PIOc_set_pnetcdf_bput(iosysid, bput)))
+                    ERR(ret);
 
-            /* Finalize PIO system. */
-            if ((ret = PIOc_free_iosystem(iosysid)))
-                return ret;
+                /* Adapt the aggregation, with a compute buffer limit
+                 * small enough that the write multi buffers fill
+                 * up. */
+                if (PIOc_set_adaptive_aggregation(iosysid + TEST_VAL_42, true) != PIO_EBADID)
+                    ERR(ERR_WRONG);
+                if ((ret = PIOc_set_adaptive_aggregation(iosysid, true)))
+                    ERR(ret);
+                old_limit = PIOc_set_compute_buffer_limit(AGG_BUFFER_LIMIT);
+
+                /* Probe the machine, to start the adaptive aggregation
+                 * from. The second probe gets the cached results. */
+                if (bput)
+                {
+                    double probe[3][4];
 
+                    if (!my_rank)
+                        remove(PROBE_CACHE_FILE);
+                    MPI_Barrier(test_comm);
+                    if (PIOc_probe_iosystem(iosysid + TEST_VAL_42, ".", NULL) != PIO_EBADID)
+                        ERR(ERR_WRONG);
+                    for (int p = 0; p < 2; p++)
+                    {
+                        if ((ret = PIOc_probe_iosystem(iosysid, ".", PROBE_CACHE_FILE)))
+                            ERR(ret);
+                        if ((ret = PIOc_get_probe(iosysid, &probe[p][0], &probe[p][1],
+                                                  &probe[p][2], &probe[p][3])))
+                            ERR(ret);
+
+                        /* Latencies are well under a second, and a task
+                         * can't move a byte in less than a latency. */
+                        for (int v = 0; v < 4; v += 2)
+                            if (probe[p][v] <= 0 || probe[p][v + 1] <= 0 ||
+                                probe[p][v + 1] >= 1 || probe[p][v] * probe[p][v + 1] < 1)
+                                ERR(ERR_WRONG);
+                    }
+                    for (int v = 0; v < 4; v++)
+                        if (probe[1][v] != probe[0][v])
+                            ERR(ERR_WRONG);
+
+                    /* Without a scratch directory the file system is
+                     * not measured. */
+                    if ((ret = PIOc_probe_iosystem(iosysid, NULL, PROBE_CACHE_FILE)))
+                        ERR(ret);
+                    if ((ret = PIOc_get_probe(iosysid, &probe[2][0], &probe[2][1],
+                                              &probe[2][2], &probe[2][3])))
+                        ERR(ret);
+                    if (probe[2][0] <= 0 || probe[2][2] || probe[2][3])
+                        ERR(ERR_WRONG);
+
+                    /* The cache has one line for each of the two
+                     * signatures. */
+                    if (!my_rank)
+                    {
+                        char line[PIO_MAX_NAME + 1];
+                        FILE *fp;
+                        int nlines = 0;
+
+                        if (!(fp = fopen(PROBE_CACHE_FILE, "r")))
+                            ERR(ERR_WRONG);
+                        while (fgets(line, sizeof(line), fp))
+                            nlines++;
+                        fclose(fp);
+                        if (nlines != 2)
+                            ERR(ERR_WRONG);
+                        remove(PROBE_CACHE_FILE);
+                    }
+
+                    /* Put back the probe with the file system. */
+                    if ((ret = PIOc_probe_iosystem(iosysid, ".", NULL)))
+                        ERR(ret);
+                }
+
+                /* printf("test Rearranger %d\n",rearranger[r]); */
+                /* Run tests. */
+                if ((ret = test_all_darray(iosysid, num_flavors, flavor, my_rank, test_comm,
+                                           rearranger[r])))
+                    return ret;
+                PIOc_set_compute_buffer_limit(old_limit);
+                /* printf("test Rearranger %d complete\n",rearranger[r]); */
+
+                /* Finalize PIO system. */
+                if ((ret = PIOc_free_iosystem(iosysid)))
+                    return ret;
+            }
         }
 
     } /* endif my_rank < TARGET_NTASKS */
@@ -0,0 +1,185 @@
+/*
+ * Tests for PIOc_write_darray_nocopy().
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_darray_nocopy"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 1
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 4
+#define Y_DIM_LEN 4
+
+/* Number of variables in the test file. */
+#define NUM_VAR 3
+
+/* Number of rearrangers to test. */
+#define NUM_REARRANGERS 2
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"x", "y"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+
+/* Write several vars with PIOc_write_darray_nocopy(), then read them
+ * back and check them. */
+int test_nocopy(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank,
+                int ntasks, int rearranger)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM2];
+    int varid[NUM_VAR];
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    int test_data[NUM_VAR][arraylen];
+    int test_data_in[arraylen];
+    int ncid;
+    int ret;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_iotype_%d_rearr_%d.nc", TEST_NAME, flavor[fmt], rearranger);
+
+        /* Create the file, dims and vars. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM2; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        for (int v = 0; v < NUM_VAR; v++)
+        {
+            char var_name[PIO_MAX_NAME + 1];
+
+            sprintf(var_name, "var_%d", v);
+            if ((ret = PIOc_def_var(ncid, var_name, PIO_INT, NDIM2, dimids, &varid[v])))
+                ERR(ret);
+        }
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Init the data. Each var keeps its own array. */
+        for (int v = 0; v < NUM_VAR; v++)
+            for (int i = 0; i < arraylen; i++)
+                test_data[v][i] = my_rank * 1000 + v * 100 + i;
+
+        /* Bad ids. */
+        if (PIOc_write_darray_nocopy(ncid + TEST_VAL_42, varid[0], ioid, arraylen,
+                                     test_data[0], NULL) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if (PIOc_write_darray_nocopy(ncid, varid[0], ioid + TEST_VAL_42, arraylen,
+                                     test_data[0], NULL) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if (PIOc_write_darray_nocopy_wait(ncid + TEST_VAL_42) != PIO_EBADID)
+            ERR(ERR_WRONG);
+
+        /* Write the data without copying it. */
+        for (int v = 0; v < NUM_VAR; v++)
+            if ((ret = PIOc_write_darray_nocopy(ncid, varid[v], ioid, arraylen,
+                                                test_data[v], NULL)))
+                ERR(ret);
+        if ((ret = PIOc_write_darray_nocopy_wait(ncid)))
+            ERR(ret);
+
+        /* The arrays may now be changed. */
+        for (int v = 0; v < NUM_VAR; v++)
+            for (int i = 0; i < arraylen; i++)
+                test_data[v][i] = -1;
+
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Reopen the file and check the data. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        for (int v = 0; v < NUM_VAR; v++)
+        {
+            if ((ret = PIOc_read_darray(ncid, varid[v], ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int i = 0; i < arraylen; i++)
+                if (test_data_in[i] != my_rank * 1000 + v * 100 + i)
+                    ERR(ERR_WRONG);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/* Run tests for darray functions. */
+int main(int argc, char **argv)
+{
+    int rearranger[NUM_REARRANGERS] = {PIO_REARR_BOX, PIO_REARR_SUBSET};
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid;                 /* The ID of the decomposition. */
+        int ioproc_stride = 1;    /* Stride in the mpi rank between io tasks. */
+        int ioproc_start = 0;     /* Zero based rank of first processor to be used for I/O. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        for (int r = 0; r < NUM_REARRANGERS; r++)
+        {
+            if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, ioproc_stride,
+                                           ioproc_start, rearranger[r], &iosysid)))
+                return ret;
+
+            if ((ret = create_decomposition_reversed(TARGET_NTASKS, my_rank, iosysid, dim_len,
+                                                     rearranger[r], &ioid)))
+                return ret;
+
+            if ((ret = test_nocopy(iosysid, ioid, num_flavors, flavor, my_rank,
+                                   TARGET_NTASKS, rearranger[r])))
+                return ret;
+
+            if ((ret = PIOc_freedecomp(iosysid, ioid)))
+                ERR(ret);
+
+            if ((ret = PIOc_free_iosystem(iosysid)))
+                return ret;
+        }
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,330 @@
+/*
+ * Tests for setting the chunksizes of a variable from a
+ * decomposition, PIOc_def_var_chunking_decomp(), for compressing
+ * the vars of netCDF-4 files, PIOc_set_compression(), and for sizing
+ * chunk caches from decompositions, PIOc_set_auto_chunk_cache().
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_decomp_chunking"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+#define NDIM3 3
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 8
+#define Y_DIM_LEN 6
+
+/* The largest chunk cache set for a var. */
+#define CHUNK_CACHE_MAX 1048576
+
+/* The dimension names. */
+char dim_name[NDIM3][PIO_MAX_NAME + 1] = {"time", "x", "y"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM3] = {NC_UNLIMITED, X_DIM_LEN, Y_DIM_LEN};
+
+/* Create a decomposition with a block of rows on each task. */
+int create_decomposition(int ntasks, int my_rank, int iosysid, int *ioid)
+{
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    PIO_Offset compdof[X_DIM_LEN * Y_DIM_LEN];
+    int ret;
+
+    /* Describe the decomposition. This is a 1-based array, so add 1! */
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i + 1;
+
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, &dim_len[1], elements_per_pe,
+                               compdof, ioid, NULL, NULL, NULL)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Check that the chunks match the IO region of this task. */
+int check_chunks(int iosysid, int ioid, PIO_Offset *chunksize)
+{
+    io_desc_t *iodesc;
+    iosystem_desc_t *ios;
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return ERR_WRONG;
+
+    /* One record in each chunk. */
+    if (chunksize[0] != 1)
+        return ERR_WRONG;
+
+    /* Every IO task writes whole chunks, but for the last chunk of a
+     * dimension. */
+    if (ios->ioproc && iodesc->firstregion)
+        for (int d = 0; d < NDIM2; d++)
+        {
+            PIO_Offset end = iodesc->firstregion->start[d] + iodesc->firstregion->count[d];
+
+            if (chunksize[d + 1] < 1 || iodesc->firstregion->start[d] % chunksize[d + 1] ||
+                (end != dim_len[d + 1] && end % chunksize[d + 1]))
+                return ERR_WRONG;
+        }
+
+    return PIO_NOERR;
+}
+
+/* Check that the chunk cache of a var was sized for a decomposition
+ * on the IO tasks of a NETCDF4P file. */
+int check_chunk_cache(int ncid, int varid, int ioid, int iotype)
+{
+    file_desc_t *file;
+    var_desc_t *vdesc;
+    int ret;
+
+    if ((ret = pio_get_file(ncid, &file)))
+        return ret;
+    if ((ret = get_var_desc(varid, &file->varlist, &vdesc)))
+        return ret;
+    if (vdesc->cache_ioid != (iotype == PIO_IOTYPE_NETCDF4P && file->iosystem->ioproc ?
+                              ioid : 0))
+        return ERR_WRONG;
+
+#ifdef _NETCDF4
+    /* The cache is the same size on all IO tasks, and big enough for
+     * the chunks of the regions of this one. */
+    if (iotype == PIO_IOTYPE_NETCDF4P && file->iosystem->ioproc)
+    {
+        iosystem_desc_t *ios = file->iosystem;
+        io_desc_t *iodesc;
+        size_t chunksizes[NDIM3];
+        size_t size, nelems;
+        float preemption;
+        PIO_Offset chunk_bytes = sizeof(int);
+        PIO_Offset nchunks = 0;
+        PIO_Offset sizes[2];
+        int storage;
+
+        if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+            return ERR_WRONG;
+        if ((ret = nc_inq_var_chunking(file->fh, varid, &storage, chunksizes)))
+            return ret;
+        if ((ret = nc_get_var_chunk_cache(file->fh, varid, &size, &nelems, &preemption)))
+            return ret;
+        for (int d = 0; d < NDIM3; d++)
+            chunk_bytes *= chunksizes[d];
+        for (io_region *region = iodesc->firstregion; region; region = region->next)
+        {
+            PIO_Offset n = 1;
+
+            for (int d = 0; d < NDIM2; d++)
+                n *= region->count[d] ? (region->start[d] + region->count[d] - 1) /
+                    chunksizes[d + 1] - region->start[d] / chunksizes[d + 1] + 1 : 0;
+            nchunks += n;
+        }
+        if (size < (size_t)min(nchunks * chunk_bytes, CHUNK_CACHE_MAX))
+            return ERR_WRONG;
+        sizes[0] = size;
+        sizes[1] = -(PIO_Offset)size;
+        if ((ret = MPI_Allreduce(MPI_IN_PLACE, sizes, 2, MPI_OFFSET, MPI_MAX, ios->io_comm)))
+            return ret;
+        if (sizes[0] != -sizes[1])
+            return ERR_WRONG;
+    }
+#endif /* _NETCDF4 */
+
+    return PIO_NOERR;
+}
+
+/* Set the chunksizes from the decomposition, then write and read the
+ * var. */
+int test_decomp_chunking(int iosysid, int ioid, int num_flavors, int *flavor,
+                         int my_rank, int ntasks)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM3];
+    int varid, varid2;
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    int test_data[arraylen];
+    int test_data_in[arraylen];
+    int ncid;
+    int ret;
+
+    for (int i = 0; i < arraylen; i++)
+        test_data[i] = my_rank * 100 + i;
+
+    /* Bad compression settings. */
+    if (PIOc_set_compression(iosysid + TEST_VAL_42, PIO_COMPRESS_ZLIB, 1) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_set_compression(iosysid, TEST_VAL_42, 1) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_set_compression(iosysid, PIO_COMPRESS_ZLIB, TEST_VAL_42) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    /* Compress the netCDF-4 files. */
+    if ((ret = PIOc_set_compression(iosysid, PIO_COMPRESS_ZLIB, 1)))
+        return ret;
+
+    /* Size the chunk caches from the decomposition. */
+    if (PIOc_set_auto_chunk_cache(iosysid + TEST_VAL_42, CHUNK_CACHE_MAX) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_set_auto_chunk_cache(iosysid, -1) != PIO_EINVAL)
+        return ERR_WRONG;
+    if ((ret = PIOc_set_auto_chunk_cache(iosysid, CHUNK_CACHE_MAX)))
+        return ret;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create the file, dims and vars. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            return ret;
+        for (int d = 0; d < NDIM3; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                return ret;
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM3, dimids, &varid)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "var2", PIO_INT, 1, &dimids[1], &varid2)))
+            return ret;
+
+        if (flavor[fmt] == PIO_IOTYPE_NETCDF4C || flavor[fmt] == PIO_IOTYPE_NETCDF4P)
+        {
+            int storage;
+            PIO_Offset chunksize[NDIM3];
+            int deflate, deflate_level;
+            int expect_deflate = 0;
+
+            /* Bad inputs. */
+            if (PIOc_def_var_chunking_decomp(ncid + TEST_VAL_42, varid, ioid) != PIO_EBADID)
+                return ERR_WRONG;
+            if (PIOc_def_var_chunking_decomp(ncid, varid, ioid + TEST_VAL_42) != PIO_EBADID)
+                return ERR_WRONG;
+            if (PIOc_def_var_chunking_decomp(ncid, TEST_VAL_42, ioid) != PIO_ENOTVAR)
+                return ERR_WRONG;
+            if (PIOc_def_var_chunking_decomp(ncid, varid2, ioid) != PIO_EINVAL)
+                return ERR_WRONG;
+
+            if ((ret = PIOc_def_var_chunking_decomp(ncid, varid, ioid)))
+                return ret;
+            if ((ret = PIOc_inq_var_chunking(ncid, varid, &storage, chunksize)))
+                return ret;
+            if (storage != NC_CHUNKED)
+                return ERR_WRONG;
+            if ((ret = check_chunks(iosysid, ioid, chunksize)))
+                return ret;
+
+            /* The var is compressed, if filters can be used. */
+            if (flavor[fmt] == PIO_IOTYPE_NETCDF4C)
+                expect_deflate = 1;
+#ifdef HAVE_PAR_FILTERS
+            else
+                expect_deflate = 1;
+#endif
+            if ((ret = PIOc_inq_var_deflate(ncid, varid, NULL, &deflate, &deflate_level)))
+                return ret;
+            if (deflate != expect_deflate || (deflate && deflate_level != 1))
+                return ERR_WRONG;
+        }
+        else
+        {
+            /* Only netCDF-4 files have chunks. */
+            if (PIOc_def_var_chunking_decomp(ncid, varid, ioid) != PIO_ENOTNC4)
+                return ERR_WRONG;
+        }
+
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+
+        /* Write a record and read it back. */
+        if ((ret = PIOc_setframe(ncid, varid, 0)))
+            return ret;
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+            return ret;
+        if ((ret = PIOc_sync(ncid)))
+            return ret;
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+            return ret;
+        for (int i = 0; i < arraylen; i++)
+            if (test_data_in[i] != test_data[i])
+                return ERR_WRONG;
+        if ((ret = check_chunk_cache(ncid, varid, ioid, flavor[fmt])))
+            return ret;
+
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    if ((ret = PIOc_set_auto_chunk_cache(iosysid, 0)))
+        return ret;
+
+    return PIOc_set_compression(iosysid, PIO_COMPRESS_NONE, 0);
+}
+
+/* Run tests for chunking from decompositions. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid;                 /* The ID of the decomposition. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, 1, 0, PIO_REARR_BOX,
+                                       &iosysid)))
+            ERR(ret);
+
+        if ((ret = create_decomposition(TARGET_NTASKS, my_rank, iosysid, &ioid)))
+            ERR(ret);
+
+        if ((ret = test_decomp_chunking(iosysid, ioid, num_flavors, flavor, my_rank,
+                                        TARGET_NTASKS)))
+            ERR(ret);
+
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            ERR(ret);
+
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
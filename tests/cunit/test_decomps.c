@@ -31,6 +31,7 @@
 /* Files of decompositions. */
 #define DECOMP_FILE "decomp.txt"
 #define DECOMP_BC_FILE "decomp.txt"
+#define DECOMP_BIN_FILE "decomp.bin"
 
 /* Used when initializing PIO. */
 #define STRIDE1 1
@@ -162,6 +163,46 @@ int test_decomp1(int iosysid, int use_io, int my_rank, MPI_Comm test_comm)
     if (ndims != 2 || fmaplen != 4)
         return ERR_WRONG;
 
+    /* These should not work. */
+    if (PIOc_writemap_bin(NULL, ndims, gdims, fmaplen, map, test_comm) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_writemap_bin(DECOMP_BIN_FILE, 0, gdims, fmaplen, map, test_comm) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_readmap_bin(DECOMP_BIN_FILE, &ndims, (int **)&gdims, &fmaplen, NULL,
+                         test_comm) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    /* Write the map as a binary decomp file, and read it back, both
+     * directly and through PIOc_readmap(). */
+    if ((ret = PIOc_writemap_bin(DECOMP_BIN_FILE, ndims, gdims, fmaplen, map, test_comm)))
+        return ret;
+    for (int r = 0; r < 2; r++)
+    {
+        int ndims_in;
+        int *gdims_in;
+        PIO_Offset fmaplen_in;
+        PIO_Offset *map_in;
+
+        if (r)
+            ret = PIOc_readmap(DECOMP_BIN_FILE, &ndims_in, &gdims_in, &fmaplen_in, &map_in,
+                               test_comm);
+        else
+            ret = PIOc_readmap_bin(DECOMP_BIN_FILE, &ndims_in, &gdims_in, &fmaplen_in, &map_in,
+                                   test_comm);
+        if (ret)
+            return ret;
+        if (ndims_in != ndims || fmaplen_in != fmaplen)
+            return ERR_WRONG;
+        for (int d = 0; d < ndims; d++)
+            if (gdims_in[d] != gdims[d])
+                return ERR_WRONG;
+        for (int i = 0; i < fmaplen; i++)
+            if (map_in[i] != map[i])
+                return ERR_WRONG;
+        free(map_in);
+        free(gdims_in);
+    }
+
     free(map);
     free(gdims);
 
@@ -178,6 +219,144 @@ int test_decomp1(int iosysid, int use_io, int my_rank, MPI_Comm test_comm)
     return 0;
 }
 
+/**
+ * Test PIOc_init_decomp_runs().
+ *
+ * @param iosysid the IO system ID.
+ * @param my_rank the 0-based rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_decomp_runs(int iosysid, int my_rank)
+{
+    int slice_dimlen[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset runstart[2], runlen[2], runstride[2];
+    PIO_Offset bad_runlen = X_DIM_LEN * Y_DIM_LEN + 1;
+    io_desc_t *iodesc;
+    int ioid;
+    int ret;
+
+    /* This task has one contiguous run. */
+    runstart[0] = my_rank * elements_per_pe;
+    runlen[0] = elements_per_pe;
+
+    /* These should not work. */
+    if (PIOc_init_decomp_runs(iosysid + TEST_VAL_42, PIO_INT, NDIM2, slice_dimlen, 1, runstart,
+                              runlen, NULL, &ioid, 0, NULL, NULL) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_init_decomp_runs(iosysid, PIO_INT, NDIM2, NULL, 1, runstart, runlen, NULL, &ioid,
+                              0, NULL, NULL) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_init_decomp_runs(iosysid, PIO_INT, NDIM2, slice_dimlen, 1, NULL, runlen, NULL,
+                              &ioid, 0, NULL, NULL) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_init_decomp_runs(iosysid, PIO_INT, NDIM2, slice_dimlen, 1, runstart, &bad_runlen,
+                              NULL, &ioid, 0, NULL, NULL) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    if ((ret = PIOc_init_decomp_runs(iosysid, PIO_INT, NDIM2, slice_dimlen, 1, runstart, runlen,
+                                     NULL, &ioid, 0, NULL, NULL)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->maplen != elements_per_pe)
+        return ERR_WRONG;
+    for (int e = 0; e < iodesc->maplen; e++)
+        if (iodesc->map[e] != my_rank * elements_per_pe + e + 1)
+            return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    /* Now each task has a column, in two strided runs. */
+    for (int r = 0; r < 2; r++)
+    {
+        runstart[r] = r * (X_DIM_LEN / 2) * Y_DIM_LEN + my_rank;
+        runlen[r] = X_DIM_LEN / 2;
+        runstride[r] = Y_DIM_LEN;
+    }
+    if ((ret = PIOc_init_decomp_runs(iosysid, PIO_INT, NDIM2, slice_dimlen, 2, runstart, runlen,
+                                     runstride, &ioid, 0, NULL, NULL)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->maplen != X_DIM_LEN)
+        return ERR_WRONG;
+    for (int e = 0; e < iodesc->maplen; e++)
+        if (iodesc->map[e] != e * Y_DIM_LEN + my_rank + 1)
+            return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    return 0;
+}
+
+/**
+ * Test sharing of identical decompositions,
+ * PIOc_set_decomp_sharing().
+ *
+ * @param iosysid the IO system ID.
+ * @param my_rank the 0-based rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_decomp_sharing(int iosysid, int my_rank)
+{
+    int slice_dimlen[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset compdof[elements_per_pe];
+    int ioid, ioid2, ioid3;
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i + 1;
+
+    /* This should not work. */
+    if (PIOc_set_decomp_sharing(iosysid + TEST_VAL_42, true) != PIO_EBADID)
+        return ERR_WRONG;
+
+    if ((ret = PIOc_set_decomp_sharing(iosysid, true)))
+        return ret;
+
+    /* The same decomposition twice is shared. */
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, slice_dimlen, elements_per_pe, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        return ret;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, slice_dimlen, elements_per_pe, compdof,
+                               &ioid2, NULL, NULL, NULL)))
+        return ret;
+    if (ioid2 != ioid)
+        return ERR_WRONG;
+
+    /* A different type, or a different map on one task, is not. */
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_FLOAT, NDIM2, slice_dimlen, elements_per_pe,
+                               compdof, &ioid3, NULL, NULL, NULL)))
+        return ret;
+    if (ioid3 == ioid)
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid3)))
+        return ret;
+    if (!my_rank)
+        compdof[0] = 0;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, slice_dimlen, elements_per_pe, compdof,
+                               &ioid3, NULL, NULL, NULL)))
+        return ret;
+    if (ioid3 == ioid)
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid3)))
+        return ret;
+
+    /* The shared decomposition is freed by the second free. */
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+    if (!pio_get_iodesc_from_id(ioid))
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid2)))
+        return ret;
+    if (PIOc_freedecomp(iosysid, ioid) != PIO_EBADID)
+        return ERR_WRONG;
+
+    return PIOc_set_decomp_sharing(iosysid, false);
+}
+
 /**
  * Test PIOc_InitDecomp_bc().
  *
@@ -249,6 +428,352 @@ int test_decomp_bc(int iosysid, int my_rank, MPI_Comm test_comm)
     return 0;
 }
 
+/**
+ * Test PIOc_init_decomp_extrude(). The levels of a 2D decomposition
+ * with holes, whose map needs sorting, are written and read back.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a 2D decomposition.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param my_rank the 0-based rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_decomp_extrude(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank)
+{
+#define NLEV 3
+    char filename[PIO_MAX_NAME + 1];
+    char dim_name[NDIM][PIO_MAX_NAME + 1] = {"lev", "x", "y"};
+    int dim_len[NDIM] = {NLEV, X_DIM_LEN, Y_DIM_LEN};
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset compdof[X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS];
+    int maplen = elements_per_pe - 1;
+    int data[NLEV * X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS];
+    int data_in[NLEV * X_DIM_LEN * Y_DIM_LEN];
+    int dimids[NDIM];
+    io_desc_t *iodesc, *iodesc3;
+    int ioid2, ioid3;
+    int varid;
+    int ret;
+
+    /* These should not work. */
+    if (PIOc_init_decomp_extrude(iosysid + TEST_VAL_42, ioid, NLEV, &ioid3) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_init_decomp_extrude(iosysid, ioid + TEST_VAL_42, NLEV, &ioid3) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_init_decomp_extrude(iosysid, ioid, 0, &ioid3) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_init_decomp_extrude(iosysid, ioid, NLEV, NULL) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    /* Each task has its block backwards, without its first
+     * element. */
+    for (int e = 0; e < maplen; e++)
+        compdof[e] = my_rank * elements_per_pe + elements_per_pe - e;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, &dim_len[1], maplen, compdof, &ioid2,
+                               NULL, NULL, NULL)))
+        return ret;
+    if ((ret = PIOc_init_decomp_extrude(iosysid, ioid2, NLEV, &ioid3)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid2)) || !(iodesc3 = pio_get_iodesc_from_id(ioid3)))
+        return ERR_WRONG;
+
+    /* The levels are moved by the rearranger of the 2D
+     * decomposition, so the new one has no map. */
+    if (iodesc3->ndims != NDIM2 + 1 || iodesc3->dimlen[0] != NLEV ||
+        iodesc3->dimlen[1] != X_DIM_LEN || iodesc3->dimlen[2] != Y_DIM_LEN ||
+        iodesc3->maplen != NLEV * iodesc->maplen || iodesc3->llen != NLEV * iodesc->llen ||
+        iodesc3->piotype != iodesc->piotype || iodesc3->rearranger != iodesc->rearranger ||
+        iodesc3->needsfill != iodesc->needsfill || !iodesc3->needssort || iodesc3->map ||
+        iodesc3->extrude_parent != ioid2 || iodesc3->extrude_nlev != NLEV)
+        return ERR_WRONG;
+
+    /* The 2D decomposition is kept until the levels are freed. */
+    if ((ret = PIOc_freedecomp(iosysid, ioid2)))
+        return ret;
+    if (!pio_get_iodesc_from_id(ioid2))
+        return ERR_WRONG;
+
+    for (int k = 0; k < NLEV; k++)
+        for (int e = 0; e < maplen; e++)
+            data[k * maplen + e] = k * 100 + compdof[e] - 1;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        int ncid;
+
+        sprintf(filename, "%s_extrude_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Write all levels at once. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            return ret;
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                return ret;
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM, dimids, &varid)))
+            return ret;
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+        if ((ret = PIOc_write_darray(ncid, varid, ioid3, NLEV * maplen, data, NULL)))
+            return ret;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+
+        /* Check the file, and read the levels back. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            return ret;
+        if ((ret = PIOc_get_var_int(ncid, varid, data_in)))
+            return ret;
+        for (int k = 0; k < NLEV; k++)
+            for (int i = 0; i < X_DIM_LEN * Y_DIM_LEN; i++)
+                if (data_in[k * X_DIM_LEN * Y_DIM_LEN + i] !=
+                    (i % elements_per_pe ? k * 100 + i : NC_FILL_INT))
+                    return ERR_WRONG;
+        if ((ret = PIOc_read_darray(ncid, varid, ioid3, NLEV * maplen, data_in)))
+            return ret;
+        for (int e = 0; e < NLEV * maplen; e++)
+            if (data_in[e] != data[e])
+                return ERR_WRONG;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid3)))
+        return ret;
+    if (pio_get_iodesc_from_id(ioid2))
+        return ERR_WRONG;
+
+    return 0;
+}
+
+/**
+ * Test PIOc_get_decomp_report() with a full decomposition, and with
+ * one that leaves half of the grid to the fill.
+ *
+ * @param iosysid the IO system ID.
+ * @param ioid the ID of a 2D decomposition that covers the grid.
+ * @param my_rank the 0-based rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_decomp_report(int iosysid, int ioid, int my_rank)
+{
+    int dim_len_2d[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset compdof[X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS];
+    pio_decomp_report_t report;
+    int ioid2;
+    int ret;
+
+    /* These should not work. */
+    if (PIOc_get_decomp_report(iosysid + TEST_VAL_42, ioid, &report) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_get_decomp_report(iosysid, ioid + TEST_VAL_42, &report) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_get_decomp_report(iosysid, ioid, NULL) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    /* The IO tasks share the whole grid, with no fill. */
+    if ((ret = PIOc_get_decomp_report(iosysid, ioid, &report)))
+        return ret;
+    if (report.num_iotasks != NUM_IO4 ||
+        report.mean_iobytes != X_DIM_LEN * Y_DIM_LEN / NUM_IO4 * sizeof(int) ||
+        report.min_iobytes > report.mean_iobytes ||
+        report.max_iobytes < report.mean_iobytes || report.min_regions > report.max_regions ||
+        report.max_regions < 1 || report.max_comp_msgs < 1 || report.fill_fraction != 0)
+        return ERR_WRONG;
+
+    /* Each task has only the first half of its block, so half of
+     * the grid is fill. This is a 1-based array, 0 is a hole. */
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = i < elements_per_pe / 2 ? my_rank * elements_per_pe + i + 1 : 0;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, dim_len_2d, elements_per_pe,
+                               compdof, &ioid2, NULL, NULL, NULL)))
+        return ret;
+    if ((ret = PIOc_get_decomp_report(iosysid, ioid2, &report)))
+        return ret;
+    if (report.num_iotasks != NUM_IO4 ||
+        report.mean_iobytes != X_DIM_LEN * Y_DIM_LEN / 2 / NUM_IO4 * sizeof(int) ||
+        report.fill_fraction != 0.5)
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid2)))
+        return ret;
+
+    return 0;
+}
+
+/**
+ * Test that PIOc_get_mem_usage() counts the indexes of
+ * decompositions, and that freeing a decomposition gives them back.
+ *
+ * @param iosysid the IO system ID.
+ * @param my_rank the 0-based rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_decomp_mem(int iosysid, int my_rank)
+{
+    int dim_len_2d[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset compdof[X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS];
+    PIO_Offset current, peak, current2, peak2;
+    int ioid2;
+    int ret;
+
+    /* These should not work. */
+    if (PIOc_get_mem_usage(-1, &current, &peak) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_get_mem_usage(PIO_MEM_NUM_CAT, &current, &peak) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    /* The decomposition made by the caller is counted. */
+    if ((ret = PIOc_get_mem_usage(PIO_MEM_INDEX, &current, &peak)))
+        return ret;
+    if (current <= 0 || peak < current)
+        return ERR_WRONG;
+
+    /* Another decomposition, with the block of each task reversed so
+     * it is not shared, adds its indexes. */
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + elements_per_pe - i;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, dim_len_2d, elements_per_pe,
+                               compdof, &ioid2, NULL, NULL, NULL)))
+        return ret;
+    if ((ret = PIOc_get_mem_usage(PIO_MEM_INDEX, &current2, &peak2)))
+        return ret;
+    if (current2 <= current || peak2 < current2)
+        return ERR_WRONG;
+
+    /* Freeing it gives them back, but the peak stays. */
+    if ((ret = PIOc_freedecomp(iosysid, ioid2)))
+        return ret;
+    if ((ret = PIOc_get_mem_usage(PIO_MEM_INDEX, &current2, &peak)))
+        return ret;
+    if (current2 != current || peak != peak2)
+        return ERR_WRONG;
+
+    return 0;
+}
+
+/**
+ * Test leaving the holes of a decomposition to the fill mode of the
+ * netCDF library, PIOc_set_library_fill(). The arrays are written
+ * with a fill value which is not the one of the file, so the holes
+ * written by PIO can be told from the ones left to the library.
+ *
+ * @param iosysid the IO system ID.
+ * @param num_flavors the number of IOTYPES available in this build.
+ * @param flavor array of available iotypes.
+ * @param rearranger the rearranger of the IO system.
+ * @param my_rank rank of this task.
+ * @returns 0 for success, error code otherwise.
+ */
+int test_library_fill(int iosysid, int num_flavors, int *flavor, int rearranger,
+                      int my_rank)
+{
+#define NREC 2
+#define HOLE_FILL -99
+    char filename[PIO_MAX_NAME + 1];
+    char dim_name[NDIM][PIO_MAX_NAME + 1] = {"time", "x", "y"};
+    int dim_len[NDIM] = {NC_UNLIMITED, X_DIM_LEN, Y_DIM_LEN};
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset compdof[X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS];
+    int data[X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS];
+    int data_in[NREC * X_DIM_LEN * Y_DIM_LEN];
+    int dimids[NDIM];
+    int varid, rec_varid;
+    int fillvalue = HOLE_FILL;
+    int ioid;
+    int ret;
+
+    /* Each task writes only the first half of its block. */
+    for (int e = 0; e < elements_per_pe / 2; e++)
+    {
+        compdof[e] = my_rank * elements_per_pe + e + 1;
+        data[e] = my_rank * 100 + e;
+    }
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, &dim_len[1], elements_per_pe / 2,
+                               compdof, &ioid, NULL, NULL, NULL)))
+        return ret;
+
+    if (PIOc_set_library_fill(iosysid + TEST_VAL_42, true) != PIO_EBADID)
+        return ERR_WRONG;
+
+    /* Write each file with PIO filling the holes, then with the
+     * library filling them. */
+    for (int f = 0; f < 2 * num_flavors; f++)
+    {
+        int lib = f / num_flavors, fmt = f % num_flavors;
+        int ncid;
+
+        if ((ret = PIOc_set_library_fill(iosysid, lib)))
+            return ret;
+        sprintf(filename, "%s_library_fill_%d_%d.nc", TEST_NAME, lib, flavor[fmt]);
+
+        /* Create a file in fill mode. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            return ret;
+        if ((ret = PIOc_set_fill(ncid, NC_FILL, NULL)))
+            return ret;
+        for (int d = 0; d < NDIM; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                return ret;
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM2, &dimids[1], &varid)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "rec_var", PIO_INT, NDIM, dimids, &rec_varid)))
+            return ret;
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+
+        /* Write the var and some records of the record var. */
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, elements_per_pe / 2, data,
+                                     &fillvalue)))
+            return ret;
+        for (int r = 0; r < NREC; r++)
+        {
+            if ((ret = PIOc_setframe(ncid, rec_varid, r)))
+                return ret;
+            if ((ret = PIOc_write_darray(ncid, rec_varid, ioid, elements_per_pe / 2, data,
+                                         &fillvalue)))
+                return ret;
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+
+        /* The holes left to the library have the default fill
+         * value. The BOX rearranger always writes them, and pnetcdf
+         * does not fill records. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            return ret;
+        for (int v = 0; v < 2; v++)
+        {
+            int nrec = v ? NREC : 1;
+            bool skipped = lib && rearranger == PIO_REARR_SUBSET &&
+                (!v || flavor[fmt] != PIO_IOTYPE_PNETCDF);
+
+            if ((ret = PIOc_get_var_int(ncid, v ? rec_varid : varid, data_in)))
+                return ret;
+            for (int r = 0; r < nrec; r++)
+                for (int i = 0; i < X_DIM_LEN * Y_DIM_LEN; i++)
+                {
+                    int t = i / elements_per_pe, e = i % elements_per_pe;
+                    int hole = skipped ? NC_FILL_INT : HOLE_FILL;
+                    int expected = e < elements_per_pe / 2 ? t * 100 + e : hole;
+
+                    if (data_in[r * X_DIM_LEN * Y_DIM_LEN + i] != expected)
+                        return ERR_WRONG;
+                }
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    if ((ret = PIOc_set_library_fill(iosysid, false)))
+        return ret;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    return 0;
+}
+
 /**
  * Test the decomp read/write functionality.
  *
@@ -288,13 +813,21 @@ int test_decomp_read_write(int iosysid, int ioid, int num_flavors, int *flavor,
 
         /* Use PIO to create the decomp file in each of the four
          * available ways. */
-        for (int fmt = 0; fmt < num_flavors; fmt++)
+        for (int fmt = 0; fmt < 2 * num_flavors; fmt++)
         {
-            /* Create the filename. */
-            sprintf(filename, "decomp_%s_iotype_%d_rearr_%d_decomp_type_%d.nc", TEST_NAME,
-                    flavor[fmt], rearranger, decomp_file_type);
+            /* Write both the dense and the ragged layouts. */
+            int ragged = fmt >= num_flavors;
 
-            if ((ret = PIOc_write_nc_decomp(iosysid, filename, cmode, ioid, NULL, NULL, 0)))
+            /* Create the filename. */
+            sprintf(filename, "decomp_%s_iotype_%d_rearr_%d_decomp_type_%d%s.nc", TEST_NAME,
+                    flavor[fmt % num_flavors], rearranger, decomp_file_type,
+                    ragged ? "_ragged" : "");
+
+            if (ragged)
+                ret = PIOc_write_nc_decomp_ragged(iosysid, filename, cmode, ioid, NULL, NULL, 0);
+            else
+                ret = PIOc_write_nc_decomp(iosysid, filename, cmode, ioid, NULL, NULL, 0);
+            if (ret)
                 return ret;
 
             /* Read the data. */
@@ -401,6 +934,14 @@ int main(int argc, char **argv)
                 if ((ret = test_decomp1(iosysid, io_test, my_rank, test_comm)))
                     return ret;
 
+                /* Test PIOc_init_decomp_runs(). */
+                if ((ret = test_decomp_runs(iosysid, my_rank)))
+                    return ret;
+
+                /* Test PIOc_set_decomp_sharing(). */
+                if ((ret = test_decomp_sharing(iosysid, my_rank)))
+                    return ret;
+
                 /* Test PIOc_InitDecomp_bc(). */
                 if ((ret = test_decomp_bc(iosysid, my_rank, test_comm)))
                     return ret;
@@ -410,6 +951,23 @@ int main(int argc, char **argv)
                                                    PIO_INT)))
                     return ret;
 
+                /* Test PIOc_init_decomp_extrude(). */
+                if ((ret = test_decomp_extrude(iosysid, ioid, num_flavors, flavor, my_rank)))
+                    return ret;
+
+                /* Test PIOc_get_decomp_report(). */
+                if ((ret = test_decomp_report(iosysid, ioid, my_rank)))
+                    return ret;
+
+                /* Test PIOc_get_mem_usage(). */
+                if ((ret = test_decomp_mem(iosysid, my_rank)))
+                    return ret;
+
+                /* Test PIOc_set_library_fill(). */
+                if ((ret = test_library_fill(iosysid, num_flavors, flavor, rearranger[r],
+                                             my_rank)))
+                    return ret;
+
                 /* Test decomposition read/write. */
                 if ((ret = test_decomp_read_write(iosysid, ioid, num_flavors, flavor, rearranger[r],
                                                   my_rank, test_comm)))
@@ -419,6 +977,16 @@ int main(int argc, char **argv)
                 if ((ret = PIOc_freedecomp(iosysid, ioid)))
                     ERR(ret);
 
+                /* Freeing the last decomposition freed all indexes. */
+                {
+                    PIO_Offset current;
+
+                    if ((ret = PIOc_get_mem_usage(PIO_MEM_INDEX, &current, NULL)))
+                        ERR(ret);
+                    if (current)
+                        ERR(ERR_WRONG);
+                }
+
                 /* Finalize PIO systems. */
                 if ((ret = PIOc_free_iosystem(iosysid)))
                     ERR(ret);
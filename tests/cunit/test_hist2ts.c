@@ -0,0 +1,320 @@
+/*
+ * Tests for the pio_hist2ts tool, which converts history files to
+ * time-series files. Run with the argument create, this writes two
+ * small history files. Then pio_hist2ts is run on them, with the
+ * prefix test_hist2ts_ts. Run with the argument check, this checks
+ * the time-series files it wrote.
+ *
+ * The history files are also the input of the test of the pioconvert
+ * performance driver. Run with the arguments copy FILE, this checks
+ * that FILE holds the same data as the first history file.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_hist2ts"
+
+/* The number of history files. */
+#define NUM_HIST 2
+
+/* The number of records in each history file. */
+#define NUM_RECS 2
+
+/* The length of the non-record dimension. */
+#define X_DIM_LEN 8
+
+/* The number of time-varying variables, each of which gets a
+ * time-series file. */
+#define NUM_TS_VARS 2
+
+/* The names of the time-varying variables. */
+char ts_var_name[NUM_TS_VARS][PIO_MAX_NAME + 1] = {"T", "P"};
+
+/* The value of element x of record rec of a time-varying variable. */
+#define TS_VALUE(v, rec, x) ((v) * 1000 + (rec) * 10 + (x))
+
+/* The value of the global attribute. */
+#define TITLE "history"
+
+/* Write the history files. */
+int create_hist(int iosysid, int my_rank)
+{
+    int iotype = PIO_IOTYPE_NETCDF;
+    PIO_Offset elements_per_pe = X_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset compdof[X_DIM_LEN / TARGET_NTASKS];
+    int dim_len = X_DIM_LEN;
+    int ioid;
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i + 1;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, 1, &dim_len, elements_per_pe, compdof,
+                               &ioid, NULL, NULL, NULL)))
+        return ret;
+
+    for (int h = 0; h < NUM_HIST; h++)
+    {
+        char filename[PIO_MAX_NAME + 1];
+        int ncid, dimids[2], time_varid, x_varid, varid[NUM_TS_VARS];
+        int x[X_DIM_LEN];
+
+        sprintf(filename, "%s_%d.nc", TEST_NAME, h);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &iotype, filename, PIO_CLOBBER)))
+            return ret;
+        if ((ret = PIOc_put_att_text(ncid, PIO_GLOBAL, "title", strlen(TITLE), TITLE)))
+            return ret;
+        if ((ret = PIOc_def_dim(ncid, "time", PIO_UNLIMITED, &dimids[0])))
+            return ret;
+        if ((ret = PIOc_def_dim(ncid, "x", X_DIM_LEN, &dimids[1])))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "time", PIO_DOUBLE, 1, dimids, &time_varid)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "x", PIO_INT, 1, &dimids[1], &x_varid)))
+            return ret;
+        for (int v = 0; v < NUM_TS_VARS; v++)
+            if ((ret = PIOc_def_var(ncid, ts_var_name[v], PIO_INT, 2, dimids, &varid[v])))
+                return ret;
+        if ((ret = PIOc_put_att_text(ncid, varid[0], "units", 1, "K")))
+            return ret;
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+
+        for (int i = 0; i < X_DIM_LEN; i++)
+            x[i] = i * 2;
+        if ((ret = PIOc_put_var_int(ncid, x_varid, x)))
+            return ret;
+        for (int r = 0; r < NUM_RECS; r++)
+        {
+            PIO_Offset start = r, count = 1;
+            double time = h * NUM_RECS + r + 0.5;
+            int data[X_DIM_LEN / TARGET_NTASKS];
+
+            if ((ret = PIOc_put_vara_double(ncid, time_varid, &start, &count, &time)))
+                return ret;
+            for (int v = 0; v < NUM_TS_VARS; v++)
+            {
+                for (int i = 0; i < elements_per_pe; i++)
+                    data[i] = TS_VALUE(v, h * NUM_RECS + r, compdof[i] - 1);
+                if ((ret = PIOc_setframe(ncid, varid[v], r)))
+                    return ret;
+                if ((ret = PIOc_write_darray(ncid, varid[v], ioid, elements_per_pe, data,
+                                             NULL)))
+                    return ret;
+            }
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Check the time-series files. Each has the global attribute, the
+ * time and x variables, and all records of its variable. */
+int check_ts(int iosysid)
+{
+    for (int v = 0; v < NUM_TS_VARS; v++)
+    {
+        char filename[PIO_MAX_NAME + 1];
+        char title[PIO_MAX_NAME + 1] = "";
+        char units[PIO_MAX_NAME + 1] = "";
+        int iotype = PIO_IOTYPE_NETCDF;
+        int ncid, varid, time_varid, x_varid;
+        PIO_Offset nrecs;
+        double time[NUM_HIST * NUM_RECS];
+        int x[X_DIM_LEN];
+        int data[NUM_HIST * NUM_RECS * X_DIM_LEN];
+        int nvars;
+        int ret;
+
+        sprintf(filename, "%s_ts.%s.nc", TEST_NAME, ts_var_name[v]);
+        if ((ret = PIOc_openfile(iosysid, &ncid, &iotype, filename, PIO_NOWRITE)))
+            return ret;
+        if ((ret = PIOc_get_att_text(ncid, PIO_GLOBAL, "title", title)))
+            return ret;
+        if (strcmp(title, TITLE))
+            return ERR_WRONG;
+
+        /* Only the variable itself, time and x are in the file. */
+        if ((ret = PIOc_inq_nvars(ncid, &nvars)))
+            return ret;
+        if (nvars != 3)
+            return ERR_WRONG;
+        if ((ret = PIOc_inq_dimlen(ncid, 0, &nrecs)))
+            return ret;
+        if (nrecs != NUM_HIST * NUM_RECS)
+            return ERR_WRONG;
+
+        if ((ret = PIOc_inq_varid(ncid, "time", &time_varid)))
+            return ret;
+        if ((ret = PIOc_get_var_double(ncid, time_varid, time)))
+            return ret;
+        for (int r = 0; r < NUM_HIST * NUM_RECS; r++)
+            if (time[r] != r + 0.5)
+                return ERR_WRONG;
+
+        if ((ret = PIOc_inq_varid(ncid, "x", &x_varid)))
+            return ret;
+        if ((ret = PIOc_get_var_int(ncid, x_varid, x)))
+            return ret;
+        for (int i = 0; i < X_DIM_LEN; i++)
+            if (x[i] != i * 2)
+                return ERR_WRONG;
+
+        if ((ret = PIOc_inq_varid(ncid, ts_var_name[v], &varid)))
+            return ret;
+        if ((ret = PIOc_get_var_int(ncid, varid, data)))
+            return ret;
+        for (int r = 0; r < NUM_HIST * NUM_RECS; r++)
+            for (int i = 0; i < X_DIM_LEN; i++)
+                if (data[r * X_DIM_LEN + i] != TS_VALUE(v, r, i))
+                    return ERR_WRONG;
+
+        /* The attributes of the variable are copied. */
+        if (!v)
+        {
+            if ((ret = PIOc_get_att_text(ncid, varid, "units", units)))
+                return ret;
+            if (strcmp(units, "K"))
+                return ERR_WRONG;
+        }
+
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    return PIO_NOERR;
+}
+
+/* Check that a file holds the same data as the first history
+ * file. */
+int check_copy(int iosysid, const char *filename)
+{
+    char title[PIO_MAX_NAME + 1] = "";
+    int iotype = PIO_IOTYPE_NETCDF;
+    int ncid, varid;
+    int nvars;
+    PIO_Offset nrecs;
+    double time[NUM_RECS];
+    int x[X_DIM_LEN];
+    int data[NUM_RECS * X_DIM_LEN];
+    int ret;
+
+    if ((ret = PIOc_openfile(iosysid, &ncid, &iotype, filename, PIO_NOWRITE)))
+        return ret;
+    if ((ret = PIOc_get_att_text(ncid, PIO_GLOBAL, "title", title)))
+        return ret;
+    if (strcmp(title, TITLE))
+        return ERR_WRONG;
+    if ((ret = PIOc_inq_nvars(ncid, &nvars)))
+        return ret;
+    if (nvars != NUM_TS_VARS + 2)
+        return ERR_WRONG;
+    if ((ret = PIOc_inq_dimlen(ncid, 0, &nrecs)))
+        return ret;
+    if (nrecs != NUM_RECS)
+        return ERR_WRONG;
+
+    if ((ret = PIOc_inq_varid(ncid, "time", &varid)))
+        return ret;
+    if ((ret = PIOc_get_var_double(ncid, varid, time)))
+        return ret;
+    for (int r = 0; r < NUM_RECS; r++)
+        if (time[r] != r + 0.5)
+            return ERR_WRONG;
+    if ((ret = PIOc_inq_varid(ncid, "x", &varid)))
+        return ret;
+    if ((ret = PIOc_get_var_int(ncid, varid, x)))
+        return ret;
+    for (int i = 0; i < X_DIM_LEN; i++)
+        if (x[i] != i * 2)
+            return ERR_WRONG;
+    for (int v = 0; v < NUM_TS_VARS; v++)
+    {
+        if ((ret = PIOc_inq_varid(ncid, ts_var_name[v], &varid)))
+            return ret;
+        if ((ret = PIOc_get_var_int(ncid, varid, data)))
+            return ret;
+        for (int r = 0; r < NUM_RECS; r++)
+            for (int i = 0; i < X_DIM_LEN; i++)
+                if (data[r * X_DIM_LEN + i] != TS_VALUE(v, r, i))
+                    return ERR_WRONG;
+    }
+
+    if ((ret = PIOc_closefile(ncid)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Write the history files, check the time-series files, or check a
+ * copy of the first history file. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if (!((argc == 2 && (!strcmp(argv[1], "create") || !strcmp(argv[1], "check"))) ||
+          (argc == 3 && !strcmp(argv[1], "copy"))))
+    {
+        if (!my_rank)
+            fprintf(stderr, "usage: %s create|check|copy FILE\n", TEST_NAME);
+        ERR(ERR_AWFUL);
+    }
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, TARGET_NTASKS, 1, 0, PIO_REARR_BOX,
+                                       &iosysid)))
+            ERR(ret);
+
+        if (!strcmp(argv[1], "create"))
+        {
+            if ((ret = create_hist(iosysid, my_rank)))
+                ERR(ret);
+        }
+        else if (!strcmp(argv[1], "check"))
+        {
+            if ((ret = check_ts(iosysid)))
+                ERR(ret);
+        }
+        else if ((ret = check_copy(iosysid, argv[2])))
+            ERR(ret);
+
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
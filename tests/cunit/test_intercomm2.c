@@ -49,6 +49,11 @@
 #define SHORT_ATT_NAME "short_gatt_test_intercomm2"
 #define FLOAT_ATT_NAME "float_gatt_test_intercomm2"
 #define DOUBLE_ATT_NAME "double_gatt_test_intercomm2"
+#define LONG_ATT_NAME "long_gatt_test_intercomm2"
+
+/* The length of an attribute too long for the first part of a
+ * packed async message. */
+#define LONG_ATT_LEN 1000
 
 /* The value of the global attribute in the netCDF output file. */
 #define ATT_VALUE 42
@@ -107,7 +112,7 @@ int check_file(int iosysid, int format, char *filename, int my_rank)
     /* Find the number of dimensions, variables, and global attributes.*/
     if ((ret = PIOc_inq(ncid, &ndims, &nvars, &ngatts, &unlimdimid)))
         ERR(ret);
-    if (ndims != 1 || nvars != 1 || ngatts != 4 || unlimdimid != -1)
+    if (ndims != 1 || nvars != 1 || ngatts != 5 || unlimdimid != -1)
         ERR(ERR_WRONG);
 
     /* This should return PIO_NOERR. */
@@ -125,7 +130,7 @@ int check_file(int iosysid, int format, char *filename, int my_rank)
         ERR(ERR_WRONG);
     if ((ret = PIOc_inq_natts(ncid, &ngatts2)))
         ERR(ret);
-    if (ngatts2 != 4)
+    if (ngatts2 != 5)
         ERR(ERR_WRONG);
     if ((ret = PIOc_inq_unlimdim(ncid, &unlimdimid2)))
         ERR(ret);
@@ -245,6 +250,19 @@ int check_file(int iosysid, int format, char *filename, int my_rank)
         ERR(ret);
     if (double_att_data != ATT_VALUE)
         ERR(ERR_WRONG);
+    {
+        int long_att_data[LONG_ATT_LEN];
+
+        if ((ret = PIOc_inq_attlen(ncid, NC_GLOBAL, LONG_ATT_NAME, &attlen)))
+            ERR(ret);
+        if (attlen != LONG_ATT_LEN)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_get_att_int(ncid, NC_GLOBAL, LONG_ATT_NAME, long_att_data)))
+            ERR(ret);
+        for (int i = 0; i < LONG_ATT_LEN; i++)
+            if (long_att_data[i] != ATT_VALUE + i)
+                ERR(ERR_WRONG);
+    }
 
     /* These should not work. */
     if (PIOc_inq_att(ncid + TEST_VAL_42, NC_GLOBAL, ATT_NAME, &atttype, &attlen) != PIO_EBADID)
@@ -472,6 +490,21 @@ int main(int argc, char **argv)
                 if ((ret = PIOc_put_att_double(ncid, NC_GLOBAL, DOUBLE_ATT_NAME, NC_DOUBLE, 1, &double_att_data)))
                     ERR(ret);
 
+                /* This one is sent in two parts. It is queued, and
+                 * written by the enddef. */
+                int long_att_data[LONG_ATT_LEN];
+                for (int i = 0; i < LONG_ATT_LEN; i++)
+                    long_att_data[i] = ATT_VALUE + i;
+                if (PIOc_set_defer_atts(iosysid[my_comp_idx] + TEST_VAL_42, true) != PIO_EBADID)
+                    ERR(ERR_WRONG);
+                if ((ret = PIOc_set_defer_atts(iosysid[my_comp_idx], true)))
+                    ERR(ret);
+                if ((ret = PIOc_put_att_int(ncid, NC_GLOBAL, LONG_ATT_NAME, NC_INT, LONG_ATT_LEN,
+                                            long_att_data)))
+                    ERR(ret);
+                if ((ret = PIOc_set_defer_atts(iosysid[my_comp_idx], false)))
+                    ERR(ret);
+
                 /* Check some att types. */
                 nc_type myatttype;
                 if ((ret = PIOc_inq_atttype(ncid, NC_GLOBAL, SHORT_ATT_NAME, &myatttype)))
@@ -8,6 +8,7 @@
  */
 #include <config.h>
 #include <pio.h>
+#include <pio_internal.h>
 #include <pio_tests.h>
 
 /* The number of tasks this test should run on. */
@@ -204,9 +205,68 @@ int main(int argc, char **argv)
         if ((ret = PIOc_free_iosystem(iosysid)))
             ERR(ret);
 
-        /* Finalize PIO system. */
-        if ((ret = PIOc_free_iosystem(iosysid_world)))
-            ERR(ret);
+        /* Initialize IO systems that share the communicators of the
+         * world one, and one that can't (it has other IO tasks). */
+        {
+            int iosysid_shared, iosysid_other;
+            iosystem_desc_t *world, *shared, *other;
+            int result;
+
+            if (PIOc_set_comm_sharing(true))
+                ERR(ERR_WRONG);
+            if ((ret = PIOc_Init_Intracomm(test_comm, 4, 1, 0, 1, &iosysid_shared)))
+                ERR(ret);
+            if ((ret = PIOc_Init_Intracomm(test_comm, 2, 1, 0, 1, &iosysid_other)))
+                ERR(ret);
+            if (!PIOc_set_comm_sharing(false))
+                ERR(ERR_WRONG);
+
+            /* The shared IO system has the same communicators, the
+             * other has its own copies. */
+            if (!(world = pio_get_iosystem_from_id(iosysid_world)) ||
+                !(shared = pio_get_iosystem_from_id(iosysid_shared)) ||
+                !(other = pio_get_iosystem_from_id(iosysid_other)))
+                ERR(ERR_WRONG);
+            if (shared->union_comm != world->union_comm ||
+                shared->comp_comm != world->comp_comm || shared->io_comm != world->io_comm ||
+                !shared->comm_refs || *shared->comm_refs != 2 || other->comm_refs)
+                ERR(ERR_WRONG);
+            if ((ret = MPI_Comm_compare(shared->comp_comm, world->comp_comm, &result)))
+                MPIERR(ret);
+            if (result != MPI_IDENT)
+                ERR(ERR_WRONG);
+            if ((ret = MPI_Comm_compare(other->comp_comm, world->comp_comm, &result)))
+                MPIERR(ret);
+            if (result != MPI_CONGRUENT)
+                ERR(ERR_WRONG);
+
+            /* The shared communicators outlive the IO system that
+             * made them. */
+            if ((ret = PIOc_free_iosystem(iosysid_world)))
+                ERR(ret);
+            if (*shared->comm_refs != 1)
+                ERR(ERR_WRONG);
+            if ((ret = MPI_Comm_compare(shared->comp_comm, test_comm, &result)))
+                MPIERR(ret);
+            if (result != MPI_CONGRUENT)
+                ERR(ERR_WRONG);
+            for (int i = 0; i < num_flavors; i++)
+            {
+                char fname3[] = "pio_iosys_test_file3.nc";
+                int ncid;
+
+                if ((ret = create_file(test_comm, iosysid_shared, iotypes[i], fname3, ATTNAME,
+                                       DIMNAME, my_rank)))
+                    ERR(ret);
+                if ((ret = open_and_check_file(test_comm, iosysid_other, iotypes[i], &ncid,
+                                               fname3, ATTNAME, DIMNAME, 0, my_rank)))
+                    ERR(ret);
+            }
+            if ((ret = PIOc_free_iosystem(iosysid_other)))
+                ERR(ret);
+            if ((ret = PIOc_free_iosystem(iosysid_shared)))
+                ERR(ret);
+        }
     } /* my_rank < TARGET_NTASKS */
 
     /* Finalize test. */
@@ -30,6 +30,15 @@
 /* Used to set PIOc_set_buffer_size_limit(). */
 #define NEW_LIMIT 200000
 
+/* Used to set PIOc_set_compute_buffer_limit(). */
+#define NEW_CN_LIMIT 4000000
+
+/* The default of PIOc_set_compute_buffer_limit(). */
+#define CN_LIMIT 33554432
+
+/* Used to set PIOc_set_buffer_size_auto(). */
+#define AUTO_FRACTION 0.01
+
 /* Run test. */
 int main(int argc, char **argv)
 {
@@ -71,6 +80,14 @@ int main(int argc, char **argv)
         if (oldlimit != NEW_LIMIT)
             ERR(ERR_WRONG);
 
+        /* Try setting the limit of the computation task buffers. */
+        if ((oldlimit = PIOc_set_compute_buffer_limit(NEW_CN_LIMIT)) != CN_LIMIT)
+            ERR(ERR_WRONG);
+        if ((oldlimit = PIOc_set_compute_buffer_limit(-NEW_CN_LIMIT)) != NEW_CN_LIMIT)
+            ERR(ERR_WRONG);
+        if ((oldlimit = PIOc_set_compute_buffer_limit(CN_LIMIT)) != NEW_CN_LIMIT)
+            ERR(ERR_WRONG);
+
         /* Figure out iotypes. */
         if ((ret = get_iotypes(&num_flavors, flavor)))
             ERR(ret);
@@ -148,6 +165,17 @@ int main(int argc, char **argv)
                                        &iosysid_world)))
             ERR(ret);
 
+        /* Size the pnetcdf buffers of the files from the node
+         * memory. */
+        if (PIOc_set_buffer_size_auto(iosysid_world + TEST_VAL_42, AUTO_FRACTION) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if (PIOc_set_buffer_size_auto(iosysid_world, -AUTO_FRACTION) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if (PIOc_set_buffer_size_auto(iosysid_world, 1.0) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_set_buffer_size_auto(iosysid_world, AUTO_FRACTION)))
+            ERR(ret);
+
         int ncid;
         int ncid2;
         for (int i = 0; i < num_flavors; i++)
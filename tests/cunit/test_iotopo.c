@@ -0,0 +1,221 @@
+/*
+ * Tests for the placement of the IO tasks using the node layout,
+ * PIOc_Init_Intracomm_topo() and PIOc_get_iotask_layout(), and for
+ * the cb_nodes hint of new files, PIOc_set_file_cb_nodes().
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_iotopo"
+
+/* Number of IO tasks asked for in the fixed count test. */
+#define NUM_IO_PROCS 2
+
+/* Length of the dimension of the file written by fewer IO tasks. */
+#define DIM_LEN 4
+
+/* Check the layout of an iosystem. The IO tasks must be in
+ * increasing order and no node may have more than per_node of
+ * them. If spread is true, they must be over as many nodes as
+ * possible. */
+int check_layout(int iosysid, int per_node, bool spread, int my_rank)
+{
+    int num_iotasks;
+    int num_nodes, num_ionodes;
+    int ioranks[TARGET_NTASKS];
+    int ionodes[TARGET_NTASKS];
+    int count[TARGET_NTASKS] = {0};
+    bool ioproc = false;
+    int ret;
+
+    if ((ret = PIOc_get_numiotasks(iosysid, &num_iotasks)))
+        return ret;
+    if ((ret = PIOc_get_iotask_layout(iosysid, &num_nodes, &num_ionodes, ioranks, ionodes)))
+        return ret;
+    if (num_iotasks < 1 || num_iotasks > TARGET_NTASKS || num_nodes < 1 ||
+        num_ionodes < 1 || num_ionodes > num_nodes)
+        return ERR_WRONG;
+    if (spread && num_ionodes != min(num_nodes, num_iotasks))
+        return ERR_WRONG;
+
+    for (int i = 0; i < num_iotasks; i++)
+    {
+        if (i && ioranks[i] <= ioranks[i - 1])
+            return ERR_WRONG;
+        if (ionodes[i] < 0 || ionodes[i] >= num_nodes)
+            return ERR_WRONG;
+        if (per_node && ++count[ionodes[i]] > per_node)
+            return ERR_WRONG;
+        if (ioranks[i] == my_rank)
+            ioproc = true;
+    }
+
+    /* The iosystem agrees on which tasks do IO. */
+    {
+        iosystem_desc_t *ios;
+
+        if (!(ios = pio_get_iosystem_from_id(iosysid)))
+            return ERR_WRONG;
+        if (ios->ioproc != ioproc || ios->ioroot != ioranks[0])
+            return ERR_WRONG;
+    }
+
+    return PIO_NOERR;
+}
+
+/* Create a file with one aggregator, and check it. */
+int test_file_cb_nodes(int iosysid)
+{
+    iosystem_desc_t *ios;
+    int num_flavors;
+    int flavor[NUM_FLAVORS];
+    int data[DIM_LEN] = {1, 2, 3, 4};
+    int data_in[DIM_LEN];
+    int ret;
+
+    if ((ret = get_iotypes(&num_flavors, flavor)))
+        return ret;
+
+    /* Bad inputs. */
+    if (PIOc_set_file_cb_nodes(iosysid + TEST_VAL_42, 1) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_set_file_cb_nodes(iosysid, -1) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    if ((ret = PIOc_set_file_cb_nodes(iosysid, 1)))
+        return ret;
+
+    /* New parallel files get the hint, opened ones don't. */
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return ERR_WRONG;
+    if (ios->ioproc && ios->num_iotasks > 1)
+    {
+        char val[MPI_MAX_INFO_VAL + 1];
+        MPI_Info info;
+        int flag;
+
+        if ((ret = get_file_info(ios, TEST_NAME, PIO_IOTYPE_PNETCDF, 1, &info)))
+            return ret;
+        if (info == MPI_INFO_NULL)
+            return ERR_WRONG;
+        if ((ret = MPI_Info_get(info, "cb_nodes", MPI_MAX_INFO_VAL, val, &flag)))
+            return ret;
+        if (!flag || strcmp(val, "1"))
+            return ERR_WRONG;
+        MPI_Info_free(&info);
+        if ((ret = get_file_info(ios, TEST_NAME, PIO_IOTYPE_PNETCDF, 0, &info)))
+            return ret;
+        if (info != ios->info)
+            return ERR_WRONG;
+    }
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        char filename[PIO_MAX_NAME + 1];
+        int ncid, dimid, varid;
+
+        sprintf(filename, "%s_file_cb_nodes_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            return ret;
+        if ((ret = PIOc_def_dim(ncid, "x", DIM_LEN, &dimid)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, 1, &dimid, &varid)))
+            return ret;
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+        if ((ret = PIOc_put_var_int(ncid, varid, data)))
+            return ret;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            return ret;
+        if ((ret = PIOc_get_var_int(ncid, varid, data_in)))
+            return ret;
+        for (int i = 0; i < DIM_LEN; i++)
+            if (data_in[i] != data[i])
+                return ERR_WRONG;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    return PIOc_set_file_cb_nodes(iosysid, 0);
+}
+
+/* Run tests for IO task placement. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+
+        /* Bad inputs. */
+        if (PIOc_Init_Intracomm_topo(test_comm, 0, 0, PIO_REARR_BOX, &iosysid) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if (PIOc_Init_Intracomm_topo(test_comm, TARGET_NTASKS + 1, 0, PIO_REARR_BOX,
+                                     &iosysid) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+        if (PIOc_Init_Intracomm_topo(test_comm, 1, 1, PIO_REARR_BOX, NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        /* One IO task on each node. */
+        if ((ret = PIOc_Init_Intracomm_topo(test_comm, 0, 1, PIO_REARR_BOX, &iosysid)))
+            ERR(ret);
+        if ((ret = check_layout(iosysid, 1, true, my_rank)))
+            ERR(ret);
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+
+        /* A fixed number of IO tasks, with no limit per node. */
+        if ((ret = PIOc_Init_Intracomm_topo(test_comm, NUM_IO_PROCS, 0, PIO_REARR_SUBSET,
+                                            &iosysid)))
+            ERR(ret);
+        if ((ret = check_layout(iosysid, 0, true, my_rank)))
+            ERR(ret);
+        if ((ret = test_file_cb_nodes(iosysid)))
+            ERR(ret);
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+
+        /* The layout can be asked for with the stride placement too. */
+        if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, 1, 0, PIO_REARR_BOX,
+                                       &iosysid)))
+            ERR(ret);
+        if ((ret = check_layout(iosysid, 0, false, my_rank)))
+            ERR(ret);
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * Tests for writing darrays to netCDF-4 parallel files with
+ * independent access, PIOc_set_par_access().
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_par_access"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* Number of rearrangers to test. */
+#define NUM_REARRANGERS_TO_TEST 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 8
+#define Y_DIM_LEN 4
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"x", "y"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+
+/* Create a decomposition where each task has every ntasks-th point,
+ * so the IO tasks get many small regions. */
+int create_decomposition(int ntasks, int my_rank, int iosysid, int *ioid)
+{
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    PIO_Offset compdof[X_DIM_LEN * Y_DIM_LEN];
+    int ret;
+
+    /* Describe the decomposition. This is a 1-based array, so add 1! */
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = i * ntasks + my_rank + 1;
+
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, dim_len, elements_per_pe,
+                               compdof, ioid, NULL, NULL, NULL)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Write a var with independent access and read it back. A var with
+ * a filter is written too, which must be written collectively even
+ * though the file is not compressed. */
+int test_par_access(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank,
+                    int ntasks)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM2];
+    int varid, varid2;
+    bool filter;
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    int test_data[arraylen];
+    int test_data_in[arraylen];
+    int ncid;
+    int ret;
+
+    for (int i = 0; i < arraylen; i++)
+        test_data[i] = my_rank * 100 + i;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create the file, dims and var. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            return ret;
+        for (int d = 0; d < NDIM2; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                return ret;
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM2, dimids, &varid)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "var2", PIO_INT, NDIM2, dimids, &varid2)))
+            return ret;
+
+        /* Shuffle var2, if filters can be used. */
+        filter = flavor[fmt] == PIO_IOTYPE_NETCDF4C;
+#ifdef HAVE_PAR_FILTERS
+        filter = filter || flavor[fmt] == PIO_IOTYPE_NETCDF4P;
+#endif
+        if (filter)
+            if ((ret = PIOc_def_var_deflate(ncid, varid2, 1, 0, 0)))
+                return ret;
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+
+        if (flavor[fmt] == PIO_IOTYPE_NETCDF4C || flavor[fmt] == PIO_IOTYPE_NETCDF4P)
+        {
+            /* Bad inputs. */
+            if (PIOc_set_par_access(ncid + TEST_VAL_42, PIO_INDEPENDENT) != PIO_EBADID)
+                return ERR_WRONG;
+            if (PIOc_set_par_access(ncid, TEST_VAL_42) != PIO_EINVAL)
+                return ERR_WRONG;
+
+            if ((ret = PIOc_set_par_access(ncid, PIO_INDEPENDENT)))
+                return ret;
+        }
+        else
+        {
+            /* Only netCDF-4 files have an access mode. */
+            if (PIOc_set_par_access(ncid, PIO_INDEPENDENT) != PIO_ENOTNC4)
+                return ERR_WRONG;
+        }
+
+        /* Write the data and read it back. */
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+            return ret;
+        if ((ret = PIOc_write_darray(ncid, varid2, ioid, arraylen, test_data, NULL)))
+            return ret;
+        if ((ret = PIOc_sync(ncid)))
+            return ret;
+        for (int v = 0; v < 2; v++)
+        {
+            if ((ret = PIOc_read_darray(ncid, v ? varid2 : varid, ioid, arraylen,
+                                        test_data_in)))
+                return ret;
+            for (int i = 0; i < arraylen; i++)
+                if (test_data_in[i] != test_data[i])
+                    return ERR_WRONG;
+        }
+
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    return PIO_NOERR;
+}
+
+/* Run tests for independent access. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int rearranger[NUM_REARRANGERS_TO_TEST] = {PIO_REARR_BOX, PIO_REARR_SUBSET};
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        for (int r = 0; r < NUM_REARRANGERS_TO_TEST; r++)
+        {
+            int iosysid;              /* The ID for the parallel I/O system. */
+            int ioid;                 /* The ID of the decomposition. */
+
+            if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, 1, 0, rearranger[r],
+                                           &iosysid)))
+                ERR(ret);
+
+            if ((ret = create_decomposition(TARGET_NTASKS, my_rank, iosysid, &ioid)))
+                ERR(ret);
+
+            if ((ret = test_par_access(iosysid, ioid, num_flavors, flavor, my_rank,
+                                       TARGET_NTASKS)))
+                ERR(ret);
+
+            if ((ret = PIOc_freedecomp(iosysid, ioid)))
+                ERR(ret);
+
+            if ((ret = PIOc_free_iosystem(iosysid)))
+                ERR(ret);
+        }
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -4,6 +4,7 @@
  * @author Ed Hartnett
  */
 #include <config.h>
+#include <sys/stat.h>
 #include <pio.h>
 #include <pio_internal.h>
 #include <pio_tests.h>
@@ -68,6 +69,10 @@ PIO_Offset chunksize[NDIM] = {2, X_DIM_LEN/2, Y_DIM_LEN/2};
 #define NDIM1 1
 #define DIM_LEN 4
 
+/* For the record var of the lazy open test. */
+#define NDIM2 2
+#define DIM_NAME_2 "time"
+
 /* Length of the max maplen in decomp testing. */
 #define MAX_MAPLEN 1
 
@@ -684,6 +689,12 @@ int define_metadata(int ncid, int my_rank, int flavor)
         ERR(ERR_WRONG);
     if (PIOc_def_var(ncid, too_long_name, PIO_INT, NDIM, dimids, &varid) != PIO_EINVAL)
         ERR(ERR_WRONG);
+    if (PIOc_def_var(ncid, VAR_NAME, PIO_INT, -1, dimids, &varid) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_def_var(ncid, VAR_NAME, PIO_INT, PIO_MAX_DIMS + 1, dimids, &varid) != PIO_EINVAL)
+        ERR(ERR_WRONG);
+    if (PIOc_def_var(ncid, VAR_NAME, PIO_INT, NDIM, NULL, &varid) != PIO_EINVAL)
+        ERR(ERR_WRONG);
 
     /* Define a variable. Test that varidp can be NULL. Since this is
      * the first var in the file, the varid will be 0. */
@@ -925,6 +936,126 @@ int test_names(int iosysid, int num_flavors, int *flavor, int my_rank,
     return PIO_NOERR;
 }
 
+/* Check the hints PIOc_set_hint_auto() derives for a parallel file:
+ * all IO tasks are aggregators, and cb_config_list is the same on all
+ * IO tasks.
+ *
+ * @param iosysid the iosystem ID, with automatic hints on.
+ * @param filename the name of the file.
+ * @param flavor the iotype of the file.
+ * @returns 0 for success, error code otherwise.
+ */
+int check_hint_auto(int iosysid, const char *filename, int flavor)
+{
+    iosystem_desc_t *ios;
+    char val[MPI_MAX_INFO_VAL + 1];
+    MPI_Info info;
+    int node_iotasks[2];
+    int flag;
+    int ret;
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return ERR_WRONG;
+    if (!ios->ioproc || (flavor != PIO_IOTYPE_PNETCDF && flavor != PIO_IOTYPE_NETCDF4P))
+        return PIO_NOERR;
+
+    if ((ret = get_file_info(ios, filename, flavor, 0, &info)))
+        return ret;
+    if (info == MPI_INFO_NULL)
+        return ERR_WRONG;
+    if ((ret = MPI_Info_get(info, "cb_nodes", MPI_MAX_INFO_VAL, val, &flag)))
+        return ret;
+    if (!flag || atoi(val) != ios->num_iotasks)
+        return ERR_WRONG;
+    if ((ret = MPI_Info_get(info, "cb_config_list", MPI_MAX_INFO_VAL, val, &flag)))
+        return ret;
+    if (!flag || sscanf(val, "*:%d", &node_iotasks[0]) != 1)
+        return ERR_WRONG;
+    if (node_iotasks[0] < ios->node_iotasks || node_iotasks[0] > ios->num_iotasks)
+        return ERR_WRONG;
+    if (info != ios->info)
+        MPI_Info_free(&info);
+
+    /* The same on all IO tasks. */
+    node_iotasks[1] = -node_iotasks[0];
+    if ((ret = MPI_Allreduce(MPI_IN_PLACE, node_iotasks, 2, MPI_INT, MPI_MAX, ios->io_comm)))
+        return ret;
+    if (node_iotasks[0] != -node_iotasks[1])
+        return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
+/* Check the effect of PIOc_set_nc4p_coll_meta() on a file that was
+ * opened: the access mode of its vars, and the collective buffering
+ * hints of the MPI-IO file, as the MPI-IO library reports them with
+ * MPI_File_get_info() if it knows them (ROMIO does).
+ *
+ * @param iosysid the iosystem ID.
+ * @param ncid the ncid of the open file.
+ * @param filename the name of the file.
+ * @param flavor the iotype of the file.
+ * @param enable true if collective metadata access is on.
+ * @returns 0 for success, error code otherwise.
+ */
+int check_coll_meta(int iosysid, int ncid, const char *filename, int flavor, bool enable)
+{
+    iosystem_desc_t *ios;
+    file_desc_t *file;
+    int ret;
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return ERR_WRONG;
+    if ((ret = pio_get_file(ncid, &file)))
+        return ret;
+    if (flavor != PIO_IOTYPE_NETCDF4P)
+        return file->coll_access ? ERR_WRONG : PIO_NOERR;
+    if (file->coll_access != enable)
+        return ERR_WRONG;
+
+    if (ios->ioproc)
+    {
+        const char *hint[2] = {"romio_cb_read", "romio_cb_write"};
+        char val[MPI_MAX_INFO_VAL + 1];
+        MPI_Info info, used;
+        MPI_File fh;
+        int flag;
+
+        if ((ret = get_file_info(ios, filename, flavor, 0, &info)))
+            return ret;
+        if ((ret = MPI_File_open(ios->io_comm, filename, MPI_MODE_RDONLY, info, &fh)))
+            return ret;
+        if ((ret = MPI_File_get_info(fh, &used)))
+            return ret;
+        for (int h = 0; h < 2; h++)
+        {
+            /* The info the file is opened with has the hints... */
+            if (info != MPI_INFO_NULL)
+            {
+                if ((ret = MPI_Info_get(info, hint[h], MPI_MAX_INFO_VAL, val, &flag)))
+                    return ret;
+                if (flag != enable || (flag && strcmp(val, "enable")))
+                    return ERR_WRONG;
+            }
+            else if (enable)
+                return ERR_WRONG;
+
+            /* ...and ROMIO uses them. */
+            if ((ret = MPI_Info_get(used, hint[h], MPI_MAX_INFO_VAL, val, &flag)))
+                return ret;
+            if (enable && flag && strcmp(val, "enable"))
+                return ERR_WRONG;
+        }
+        MPI_Info_free(&used);
+        if ((ret = MPI_File_close(&fh)))
+            return ret;
+        if (info != ios->info)
+            MPI_Info_free(&info);
+    }
+
+    return PIO_NOERR;
+}
+
 /* Test file operations.
  *
  * @param iosysid the iosystem ID that will be used for the test.
@@ -1019,6 +1150,52 @@ int test_files(int iosysid, int num_flavors, int *flavor, int my_rank)
         if ((ret = PIOc_closefile(ncid)))
             ERR(ret);
 
+        /* PIOc_openfile() opens the file whatever iotype is asked
+         * for, picking the iotype from the format of the file. Open
+         * it with automatic MPI-IO hints. */
+        if (PIOc_set_hint_auto(iosysid + 1, 1) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_set_hint_auto(iosysid, 1)))
+            ERR(ret);
+        for (int fmt2 = 0; fmt2 < num_flavors; fmt2++)
+        {
+            int iotype = flavor[fmt2];
+
+            if ((ret = PIOc_openfile(iosysid, &ncid, &iotype, filename, PIO_NOWRITE)))
+                ERR(ret);
+            if ((ret = check_metadata(ncid, my_rank, flavor[fmt])))
+                ERR(ret);
+            if ((ret = check_hint_auto(iosysid, filename, iotype)))
+                ERR(ret);
+            if ((ret = PIOc_closefile(ncid)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_set_hint_auto(iosysid, 0)))
+            ERR(ret);
+
+        /* Open it with collective metadata access for NETCDF4P. */
+        if (PIOc_set_nc4p_coll_meta(iosysid + 1, true) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_set_nc4p_coll_meta(iosysid, true)))
+            ERR(ret);
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = check_metadata(ncid, my_rank, flavor[fmt])))
+            ERR(ret);
+        if ((ret = check_coll_meta(iosysid, ncid, filename, flavor[fmt], true)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_set_nc4p_coll_meta(iosysid, false)))
+            ERR(ret);
+
+        /* Without it, the vars keep the access mode of netCDF. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = check_coll_meta(iosysid, ncid, filename, flavor[fmt], false)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
     }
 
     return PIO_NOERR;
@@ -1072,6 +1249,183 @@ int test_empty_files(int iosysid, int num_flavors, int *flavor, int my_rank)
 
     return PIO_NOERR;
 }
+/* Test lazy opening of files, with PIOc_set_lazy_open(). */
+int test_lazy_open(int iosysid, int num_flavors, int *flavor, int my_rank)
+{
+    int ncid, ncid2, dimid;
+    int dimids[NDIM2];
+    int varid;
+    int ioid;
+    int ndims;
+    float data, data_in;
+    int ret;    /* Return code. */
+
+    if ((ret = create_decomposition(TARGET_NTASKS, my_rank, iosysid, DIM_LEN, &ioid)))
+        ERR(ret);
+
+    if ((ret = PIOc_set_lazy_open(iosysid, true)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        char filename[PIO_MAX_NAME * 2 + 1]; /* Test filename. */
+        char iotype_name[PIO_MAX_NAME + 1];
+
+        /* Create a filename. */
+        if ((ret = get_iotype_name(flavor[fmt], iotype_name)))
+            ERR(ret);
+        sprintf(filename, "%s_lazy_%s.nc", TEST_NAME, iotype_name);
+
+        /* Creating a file is not lazy. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, DIM_LEN, &dimids[1])))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME_2, NC_UNLIMITED, &dimids[0])))
+            ERR(ret);
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_FLOAT, NDIM2, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Write 3 records. */
+        for (int r = 0; r < 3; r++)
+        {
+            data = my_rank + r * 10;
+            if ((ret = PIOc_setframe(ncid, varid, r)))
+                ERR(ret);
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, 1, &data, NULL)))
+                ERR(ret);
+        }
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Calls that are not collective do not open the file, and
+         * frames set before the open are used. */
+        if ((ret = PIOc_openfile2(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if (!PIOc_File_is_Open(ncid))
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_setframe(ncid, varid, 1)))
+            ERR(ret);
+        if ((ret = PIOc_advanceframe(ncid, varid)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, 1, &data_in)))
+            ERR(ret);
+        if (data_in != my_rank + 20)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Open a file that does not exist. The error comes on first
+         * use. */
+        if ((ret = PIOc_openfile2(iosysid, &ncid, &flavor[fmt], "no_such_file.nc",
+                                  PIO_NOWRITE)))
+            ERR(ret);
+        if (PIOc_inq_ndims(ncid, &ndims) == PIO_NOERR)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Open the file and close it without using it. */
+        if ((ret = PIOc_openfile2(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        /* Open the file twice, and use the second one. It keeps its
+         * ncid when it is opened. */
+        if ((ret = PIOc_openfile2(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_openfile2(iosysid, &ncid2, &flavor[fmt], filename, PIO_NOWRITE)))
+            ERR(ret);
+        if ((ret = PIOc_inq_ndims(ncid2, &ndims)))
+            ERR(ret);
+        if (ndims != NDIM2)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_inq_dimid(ncid2, DIM_NAME, &dimid)))
+            ERR(ret);
+        if (dimid != 0)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_closefile(ncid2)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_set_lazy_open(iosysid, false)))
+        ERR(ret);
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
+/* Test deferred errors, with PIOc_set_defer_errors(). */
+int test_defer_errors(int iosysid, int num_flavors, int *flavor, int my_rank)
+{
+    int ncid, dimid, varid, varid2;
+    int ret;    /* Return code. */
+
+    /* Check the error handling. */
+    if (PIOc_set_defer_errors(iosysid + TEST_VAL_42, true) != PIO_EBADID)
+        ERR(ERR_WRONG);
+    if (PIOc_check_errors(TEST_VAL_42) != PIO_EBADID)
+        ERR(ERR_WRONG);
+
+    if ((ret = PIOc_set_defer_errors(iosysid, true)))
+        ERR(ret);
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        char filename[PIO_MAX_NAME * 2 + 1]; /* Test filename. */
+        char iotype_name[PIO_MAX_NAME + 1];
+
+        /* Create a filename. */
+        if ((ret = get_iotype_name(flavor[fmt], iotype_name)))
+            ERR(ret);
+        sprintf(filename, "%s_defer_%s.nc", TEST_NAME, iotype_name);
+
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, X_DIM_LEN, &dimid)))
+            ERR(ret);
+        if ((ret = PIOc_check_errors(ncid)))
+            ERR(ret);
+
+        /* A variable that is not defined has no varid, so its error
+         * is returned at once, and again by the check. */
+        if ((ret = PIOc_def_var(ncid, VAR_NAME, PIO_INT, 1, &dimid, &varid)))
+            ERR(ret);
+        varid2 = -TEST_VAL_42;
+        if (PIOc_def_var(ncid, VAR_NAME, PIO_INT, 1, &dimid, &varid2) != PIO_ENAMEINUSE)
+            ERR(ERR_WRONG);
+        if (varid2 != -TEST_VAL_42)
+            ERR(ERR_WRONG);
+        if (PIOc_check_errors(ncid) != PIO_ENAMEINUSE)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_check_errors(ncid)))
+            ERR(ret);
+
+        /* The repeated name is only reported at the enddef. */
+        if ((ret = PIOc_def_dim(ncid, DIM_NAME, X_DIM_LEN, &dimid)))
+            ERR(ret);
+        if (PIOc_enddef(ncid) != PIO_ENAMEINUSE)
+            ERR(ERR_WRONG);
+
+        /* The error has been reported. */
+        if ((ret = PIOc_check_errors(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    if ((ret = PIOc_set_defer_errors(iosysid, false)))
+        ERR(ret);
+
+    return PIO_NOERR;
+}
+
 
 /* Check that the fill values are correctly reported by find_var_fill().
  *
@@ -1690,8 +2044,8 @@ int test_nc4(int iosysid, int num_flavors, int *flavor, int my_rank)
 }
 
 /* This function is part of test_scalar(). It tests the contents of
- * the scalar var. */
-int check_scalar_var(int ncid, int varid, int flavor, int my_rank)
+ * the scalar var, which has natts attributes. */
+int check_scalar_var(int ncid, int varid, int flavor, int my_rank, int natts)
 {
     char var_name_in[PIO_MAX_NAME + 1];
     int var_type_in;
@@ -1706,7 +2060,7 @@ int check_scalar_var(int ncid, int varid, int flavor, int my_rank)
         ERR(ret);
 
     /* Is the metadata correct? */
-    if (strcmp(var_name_in, VAR_NAME) || var_type_in != PIO_INT || ndims_in != 0 || natts_in != 0)
+    if (strcmp(var_name_in, VAR_NAME) || var_type_in != PIO_INT || ndims_in != 0 || natts_in != natts)
         ERR(ERR_WRONG);
 
     /* Get the value. */
@@ -1720,6 +2074,28 @@ int check_scalar_var(int ncid, int varid, int flavor, int my_rank)
     return 0;
 }
 
+/* This function is part of test_scalar(). It syncs a classic file
+ * and gets its size, which only changes when the library moves the
+ * data to make room for the header. The size is -1 for netCDF-4
+ * files, and with async, where the IO tasks may still be writing. */
+int get_classic_size(int ncid, const char *filename, int flavor, int async,
+                     PIO_Offset *size)
+{
+    struct stat st;
+    int ret;
+
+    *size = -1;
+    if (async || (flavor != PIO_IOTYPE_NETCDF && flavor != PIO_IOTYPE_PNETCDF))
+        return PIO_NOERR;
+    if ((ret = PIOc_sync(ncid)))
+        return ret;
+    if (stat(filename, &st))
+        return ERR_WRONG;
+    *size = st.st_size;
+
+    return PIO_NOERR;
+}
+
 /* Test scalar vars. */
 int test_scalar(int iosysid, int num_flavors, int *flavor, int my_rank, int async,
                 MPI_Comm test_comm)
@@ -1804,6 +2180,7 @@ int test_scalar(int iosysid, int num_flavors, int *flavor, int my_rank, int asyn
     {
         char filename[PIO_MAX_NAME * 2 + 1]; /* Test filename. */
         char iotype_name[PIO_MAX_NAME + 1];
+        PIO_Offset size[2];  /* The file size before and after an attribute. */
 
         /* Create a filename. */
         if ((ret = get_iotype_name(flavor[fmt], iotype_name)))
@@ -1828,8 +2205,42 @@ int test_scalar(int iosysid, int num_flavors, int *flavor, int my_rank, int asyn
             ERR(ret);
 
         /* Check the scalar var. */
-        if ((ret = check_scalar_var(ncid, varid, flavor[fmt], my_rank)))
+        if ((ret = check_scalar_var(ncid, varid, flavor[fmt], my_rank, 0)))
+            ERR(ret);
+
+        /* Write it again, then go back into define mode, which must
+         * flush the pending write. */
+        if ((ret = PIOc_put_var_int(ncid, varid, &test_val)))
             ERR(ret);
+        if ((ret = PIOc_redef(ncid)))
+            ERR(ret);
+
+        /* End define mode leaving space in the header, and the
+         * default alignments. */
+        if ((ret = PIOc_enddef_align(ncid, 1024, PIO_DEFAULT, PIO_DEFAULT, PIO_DEFAULT)))
+            ERR(ret);
+        if ((ret = check_scalar_var(ncid, varid, flavor[fmt], my_rank, 0)))
+            ERR(ret);
+        if ((ret = get_classic_size(ncid, filename, flavor[fmt], async, &size[0])))
+            ERR(ret);
+        if (size[0] != -1 && size[0] < 1024)
+            ERR(ERR_WRONG);
+
+        /* Add an attribute, using the space left in the header. */
+        if ((ret = PIOc_redef(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_put_att_int(ncid, varid, ATT_NAME, PIO_INT, 1, &test_val)))
+            ERR(ret);
+        if ((ret = PIOc_enddef_align(ncid, PIO_DEFAULT, PIO_DEFAULT, PIO_DEFAULT, PIO_DEFAULT)))
+            ERR(ret);
+        if ((ret = check_scalar_var(ncid, varid, flavor[fmt], my_rank, 1)))
+            ERR(ret);
+
+        /* The data was not moved. */
+        if ((ret = get_classic_size(ncid, filename, flavor[fmt], async, &size[1])))
+            ERR(ret);
+        if (size[1] != size[0])
+            ERR(ERR_WRONG);
 
         /* Close the netCDF file. */
         if ((ret = PIOc_closefile(ncid)))
@@ -1840,7 +2251,7 @@ int test_scalar(int iosysid, int num_flavors, int *flavor, int my_rank, int asyn
             ERR(ret);
 
         /* Check the scalar var again. */
-        if ((ret = check_scalar_var(ncid, varid, flavor[fmt], my_rank)))
+        if ((ret = check_scalar_var(ncid, varid, flavor[fmt], my_rank, 1)))
             ERR(ret);
 
         /* Close the netCDF file. */
@@ -1932,7 +2343,7 @@ int test_decomp_internal(int my_test_size, int my_rank, int iosysid, int dim_len
     /* Write the decomposition file. */
     if ((ret = pioc_write_nc_decomp_int(ios, nc_filename, 0, NDIM1, global_dimlen,
                                         TARGET_NTASKS, task_maplen, (int *)map, title,
-                                        history, 0)))
+                                        history, 0, NULL)))
         ERR(ret);
 
     int ndims_in;
@@ -2360,6 +2771,14 @@ int test_all(int iosysid, int num_flavors, int *flavor, int my_rank, MPI_Comm te
         if ((ret = test_empty_files(iosysid, num_flavors, flavor, my_rank)))
             ERR(ret);
 
+        /* Test deferred errors. */
+        if ((ret = test_defer_errors(iosysid, num_flavors, flavor, my_rank)))
+            ERR(ret);
+
+        /* Test lazy opening of files. */
+        if ((ret = test_lazy_open(iosysid, num_flavors, flavor, my_rank)))
+            ERR(ret);
+
         /* Test decomposition internal functions. */
         if ((ret = test_decomp_internal(my_test_size, my_rank, iosysid, DIM_LEN, test_comm, async)))
             ERR(ret);
@@ -0,0 +1,225 @@
+/*
+ * Tests for the quantization of the data of a variable on the IO
+ * tasks, PIOc_def_var_quantize().
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_quantize"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The length of the dimension of the sample data. */
+#define DIM_LEN 16
+
+/* The number of significant bits kept by bitround. */
+#define NSB 8
+
+/* The number of significant digits kept by bitgroom. */
+#define NSD 3
+
+/* Create a decomposition with a block of the dimension on each
+ * task. */
+int create_decomposition(int ntasks, int my_rank, int iosysid, int pio_type, int *ioid)
+{
+    PIO_Offset elements_per_pe = DIM_LEN / ntasks;
+    PIO_Offset compdof[DIM_LEN];
+    int dim_len = DIM_LEN;
+    int ret;
+
+    /* Describe the decomposition. This is a 1-based array, so add 1! */
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i + 1;
+
+    if ((ret = PIOc_InitDecomp(iosysid, pio_type, 1, &dim_len, elements_per_pe,
+                               compdof, ioid, NULL, NULL, NULL)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Check that the float data were bitrounded. */
+int check_float(float *data, float *data_in, PIO_Offset arraylen)
+{
+    for (int i = 0; i < arraylen; i++)
+    {
+        union {float f; uint32_t u;} v;
+
+        /* Fill values are left alone. */
+        if (data[i] == PIO_FILL_FLOAT)
+        {
+            if (data_in[i] != PIO_FILL_FLOAT)
+                return ERR_WRONG;
+            continue;
+        }
+
+        /* The low bits of the mantissa are zeros, and the value is
+         * rounded to NSB bits. */
+        v.f = data_in[i];
+        if (v.u & ((1U << (23 - NSB)) - 1))
+            return ERR_WRONG;
+        if (fabs(data_in[i] - data[i]) > fabs(data[i]) / (1 << NSB))
+            return ERR_WRONG;
+    }
+
+    return PIO_NOERR;
+}
+
+/* Write quantized float and double vars, and check them. */
+int test_quantize(int iosysid, int ioid_float, int ioid_double, int num_flavors,
+                  int *flavor, int my_rank, int ntasks)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimid;
+    int varid_float, varid_double, varid_int;
+    PIO_Offset arraylen = DIM_LEN / ntasks;
+    float data_float[arraylen], data_float_in[arraylen];
+    double data_double[arraylen], data_double_in[arraylen];
+    int ncid;
+    int ret;
+
+    for (int i = 0; i < arraylen; i++)
+    {
+        data_float[i] = my_rank * 100 + i + 0.123456789f;
+        data_double[i] = my_rank * 100 + i + 0.123456789;
+    }
+    data_float[0] = PIO_FILL_FLOAT;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create the file, dims and vars. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            return ret;
+        if ((ret = PIOc_def_dim(ncid, "x", DIM_LEN, &dimid)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "var_float", PIO_FLOAT, 1, &dimid, &varid_float)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "var_double", PIO_DOUBLE, 1, &dimid, &varid_double)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "var_int", PIO_INT, 1, &dimid, &varid_int)))
+            return ret;
+
+        /* Bad inputs. */
+        if (PIOc_def_var_quantize(ncid + TEST_VAL_42, varid_float, PIO_QUANTIZE_BITROUND,
+                                  NSB) != PIO_EBADID)
+            return ERR_WRONG;
+        if (PIOc_def_var_quantize(ncid, TEST_VAL_42, PIO_QUANTIZE_BITROUND, NSB) != PIO_ENOTVAR)
+            return ERR_WRONG;
+        if (PIOc_def_var_quantize(ncid, varid_int, PIO_QUANTIZE_BITROUND, NSB) != PIO_EINVAL)
+            return ERR_WRONG;
+        if (PIOc_def_var_quantize(ncid, varid_float, TEST_VAL_42, NSB) != PIO_EINVAL)
+            return ERR_WRONG;
+        if (PIOc_def_var_quantize(ncid, varid_float, PIO_QUANTIZE_BITROUND, 24) != PIO_EINVAL)
+            return ERR_WRONG;
+        if (PIOc_def_var_quantize(ncid, varid_double, PIO_QUANTIZE_BITGROOM, 16) != PIO_EINVAL)
+            return ERR_WRONG;
+
+        if ((ret = PIOc_def_var_quantize(ncid, varid_float, PIO_QUANTIZE_BITROUND, NSB)))
+            return ret;
+        if ((ret = PIOc_def_var_quantize(ncid, varid_double, PIO_QUANTIZE_BITGROOM, NSD)))
+            return ret;
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+
+        /* Write the data. */
+        if ((ret = PIOc_write_darray(ncid, varid_float, ioid_float, arraylen, data_float,
+                                     NULL)))
+            return ret;
+        if ((ret = PIOc_write_darray(ncid, varid_double, ioid_double, arraylen, data_double,
+                                     NULL)))
+            return ret;
+        if ((ret = PIOc_sync(ncid)))
+            return ret;
+
+        /* Read it back. The data of the caller are not changed. */
+        if ((ret = PIOc_read_darray(ncid, varid_float, ioid_float, arraylen, data_float_in)))
+            return ret;
+        if ((ret = check_float(data_float, data_float_in, arraylen)))
+            return ret;
+        if ((ret = PIOc_read_darray(ncid, varid_double, ioid_double, arraylen,
+                                    data_double_in)))
+            return ret;
+        for (int i = 0; i < arraylen; i++)
+            if (fabs(data_double_in[i] - data_double[i]) > fabs(data_double[i]) * 1e-3)
+                return ERR_WRONG;
+
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    return PIO_NOERR;
+}
+
+/* Run tests for quantization. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid_float, ioid_double; /* The IDs of the decompositions. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, 1, 0, PIO_REARR_BOX,
+                                       &iosysid)))
+            ERR(ret);
+
+        if ((ret = create_decomposition(TARGET_NTASKS, my_rank, iosysid, PIO_FLOAT,
+                                        &ioid_float)))
+            ERR(ret);
+        if ((ret = create_decomposition(TARGET_NTASKS, my_rank, iosysid, PIO_DOUBLE,
+                                        &ioid_double)))
+            ERR(ret);
+
+        if ((ret = test_quantize(iosysid, ioid_float, ioid_double, num_flavors, flavor,
+                                 my_rank, TARGET_NTASKS)))
+            ERR(ret);
+
+        if ((ret = PIOc_freedecomp(iosysid, ioid_float)))
+            ERR(ret);
+        if ((ret = PIOc_freedecomp(iosysid, ioid_double)))
+            ERR(ret);
+
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
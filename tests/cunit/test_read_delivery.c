@@ -0,0 +1,175 @@
+/*
+ * Tests for delivering the data read from non-distributed variables
+ * to only some of the tasks, PIOc_set_read_delivery(), and for
+ * buffers shared by the tasks of a node, PIOc_alloc_node_buf().
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_read_delivery"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* Length of the dimension of the var. */
+#define DIM_LEN 16
+
+/* The task that gets the data with PIO_READ_ROOT. It is not the IO
+ * root task. */
+#define READ_ROOT 3
+
+/* Check the data read. */
+int check_data(int *data_in)
+{
+    for (int i = 0; i < DIM_LEN; i++)
+        if (data_in[i] != i * 10)
+            return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
+/* Write a var, and read it back with each delivery. */
+int test_read_delivery(int iosysid, int num_flavors, int *flavor, int my_rank)
+{
+    int data[DIM_LEN];
+    int data_in[DIM_LEN];
+    int ret;
+
+    for (int i = 0; i < DIM_LEN; i++)
+        data[i] = i * 10;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        char filename[PIO_MAX_NAME + 1];
+        int ncid, dimid, varid;
+        int *node_data;
+
+        /* Create the file. */
+        sprintf(filename, "%s_%d.nc", TEST_NAME, flavor[fmt]);
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            return ret;
+        if ((ret = PIOc_def_dim(ncid, "x", DIM_LEN, &dimid)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, 1, &dimid, &varid)))
+            return ret;
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+        if ((ret = PIOc_put_var_int(ncid, varid, data)))
+            return ret;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            return ret;
+
+        /* Bad inputs. */
+        if (PIOc_set_read_delivery(ncid + TEST_VAL_42, PIO_READ_ROOT, 0) != PIO_EBADID)
+            return ERR_WRONG;
+        if (PIOc_set_read_delivery(ncid, TEST_VAL_42, 0) != PIO_EINVAL)
+            return ERR_WRONG;
+        if (PIOc_set_read_delivery(ncid, PIO_READ_ROOT, TARGET_NTASKS) != PIO_EINVAL)
+            return ERR_WRONG;
+
+        /* Only the root task gets the data. The others don't need a
+         * buffer. */
+        if ((ret = PIOc_set_read_delivery(ncid, PIO_READ_ROOT, READ_ROOT)))
+            return ret;
+        if ((ret = PIOc_get_var_int(ncid, varid, my_rank == READ_ROOT ? data_in : NULL)))
+            return ret;
+        if (my_rank == READ_ROOT)
+            if ((ret = check_data(data_in)))
+                return ret;
+
+        /* The tasks of each node share one copy of the data. */
+        if ((ret = PIOc_set_read_delivery(ncid, PIO_READ_NODE, 0)))
+            return ret;
+        if ((ret = PIOc_alloc_node_buf(iosysid, DIM_LEN * sizeof(int), (void **)&node_data)))
+            return ret;
+        if (PIOc_get_var_int(ncid, varid, data_in) != PIO_EINVAL)
+            return ERR_WRONG;
+        if ((ret = PIOc_get_var_int(ncid, varid, node_data)))
+            return ret;
+        if ((ret = check_data(node_data)))
+            return ret;
+        if (PIOc_free_node_buf(iosysid, data_in) != PIO_EINVAL)
+            return ERR_WRONG;
+        if ((ret = PIOc_free_node_buf(iosysid, node_data)))
+            return ret;
+
+        /* Back to every task getting a copy. */
+        if ((ret = PIOc_set_read_delivery(ncid, PIO_READ_ALL, 0)))
+            return ret;
+        if ((ret = PIOc_get_var_int(ncid, varid, data_in)))
+            return ret;
+        if ((ret = check_data(data_in)))
+            return ret;
+
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    return PIO_NOERR;
+}
+
+/* Run tests for read delivery. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, 1, 0, PIO_REARR_BOX,
+                                       &iosysid)))
+            ERR(ret);
+
+        /* Bad inputs. */
+        if (PIOc_alloc_node_buf(iosysid + TEST_VAL_42, 1, NULL) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if (PIOc_alloc_node_buf(iosysid, 1, NULL) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        if ((ret = test_read_delivery(iosysid, num_flavors, flavor, my_rank)))
+            ERR(ret);
+
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
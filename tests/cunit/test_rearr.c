@@ -135,6 +135,61 @@ int test_ceil2_pair()
     return 0;
 }
 
+/* Test the pio_sorted_copy() function, element by element and with
+ * runs of the remap.
+ * @returns 0 for success, error code otherwise.*/
+int test_sorted_copy()
+{
+#define SC_NRUNS 4
+#define SC_RUNLEN 8
+#define SC_MAPLEN (SC_NRUNS * SC_RUNLEN)
+#define SC_NVARS 2
+    io_desc_t iodesc = {0};
+    int remap[SC_MAPLEN];
+    int remap_runs[SC_NRUNS + 1];
+    int data[SC_NVARS * SC_MAPLEN];
+    int sorted[SC_NVARS * SC_MAPLEN];
+    int unsorted[SC_NVARS * SC_MAPLEN];
+    int ret;
+
+    /* The runs of the map are in reverse order. */
+    for (int r = 0; r < SC_NRUNS; r++)
+    {
+        remap_runs[r] = r * SC_RUNLEN;
+        for (int i = 0; i < SC_RUNLEN; i++)
+            remap[r * SC_RUNLEN + i] = (SC_NRUNS - 1 - r) * SC_RUNLEN + i;
+    }
+    remap_runs[SC_NRUNS] = SC_MAPLEN;
+    for (int i = 0; i < SC_NVARS * SC_MAPLEN; i++)
+        data[i] = i;
+
+    iodesc.piotype = PIO_INT;
+    iodesc.maplen = SC_MAPLEN;
+    iodesc.remap = remap;
+
+    /* Try without, then with, the runs. */
+    for (int use_runs = 0; use_runs < 2; use_runs++)
+    {
+        iodesc.remap_runs = use_runs ? remap_runs : NULL;
+        iodesc.nremap_runs = use_runs ? SC_NRUNS : 0;
+
+        if ((ret = pio_sorted_copy(data, sorted, &iodesc, SC_NVARS, 0)))
+            return ret;
+        for (int v = 0; v < SC_NVARS; v++)
+            for (int m = 0; m < SC_MAPLEN; m++)
+                if (sorted[v * SC_MAPLEN + m] != data[v * SC_MAPLEN + remap[m]])
+                    return ERR_WRONG;
+
+        if ((ret = pio_sorted_copy(sorted, unsorted, &iodesc, SC_NVARS, 1)))
+            return ret;
+        for (int i = 0; i < SC_NVARS * SC_MAPLEN; i++)
+            if (unsorted[i] != data[i])
+                return ERR_WRONG;
+    }
+
+    return 0;
+}
+
 /* Test the create_mpi_datatypes() function.
  * @returns 0 for success, error code otherwise.*/
 int test_create_mpi_datatypes(int rearr)
@@ -146,7 +201,7 @@ int test_create_mpi_datatypes(int rearr)
 
     {
         int msgcnt = 1;
-        PIO_Offset mindex[1] = {0};
+        int mindex[1] = {0};
         int mcount[1] = {1};
         MPI_Datatype mtype;
 
@@ -155,13 +210,13 @@ int test_create_mpi_datatypes(int rearr)
             return ret;
 
         /* Free the type. */
-        if ((mpierr = MPI_Type_free(&mtype)))
-            MPIERR(mpierr);
+        if ((ret = free_mpi_datatype(&mtype)))
+            return ret;
     }
 
     {
         int msgcnt = 4;
-        PIO_Offset mindex[4] = {0, 0, 0, 0};
+        int mindex[4] = {0, 0, 0, 0};
         int mcount[4] = {1, 1, 1, 1};
         MPI_Datatype mtype2[4];
 
@@ -177,11 +232,15 @@ int test_create_mpi_datatypes(int rearr)
                 MPIERR(mpierr);
             if (lb != 0 || extent != 4)
                 return ERR_WRONG;
+
+            /* The types are the same, so they come from the cache. */
+            if (mtype2[t] != mtype2[0])
+                return ERR_WRONG;
         }
 
         /* Free them. */
         for (int t = 0; t < 4; t++)
-            if ((mpierr = MPI_Type_free(&mtype2[t])))
+            if ((ret = free_mpi_datatype(&mtype2[t])))
                 return ERR_WRONG;
     }
 
@@ -252,6 +311,73 @@ int test_coord_to_lindex()
     return 0;
 }
 
+/* Test the box_find_dest() function, with IO boxes which split both
+ * dimensions, and with IO boxes which overlap. */
+int test_box_find_dest()
+{
+#define FD_NIO 4
+#define FD_MSG (2 * NDIM2 + 1)
+    const int gdimlen[NDIM2] = {4, 6};
+    int maplen = 24;
+    PIO_Offset compmap[24];
+    int dest_ioproc[24];
+    PIO_Offset dest_ioindex[24];
+    /* [llen, start, count] of each IO task. The boxes are 2x3, and
+     * are given out of order. */
+    PIO_Offset sc_info[FD_NIO * FD_MSG] = {6, 2, 3, 2, 3,
+                                           6, 0, 0, 2, 3,
+                                           6, 2, 0, 2, 3,
+                                           6, 0, 3, 2, 3};
+    /* Here IO task 0 holds everything, and IO task 1 the first
+     * row. IO task 0 is found first. */
+    PIO_Offset sc_info2[2 * FD_MSG] = {24, 0, 0, 4, 6,
+                                       6, 0, 0, 1, 6};
+    int ret;
+
+    /* Every element, backwards, with a hole at the start. */
+    for (int k = 0; k < maplen; k++)
+        compmap[k] = maplen - k;
+    compmap[0] = 0;
+
+    if ((ret = box_find_dest(NDIM2, gdimlen, FD_NIO, sc_info, maplen, compmap, dest_ioproc,
+                             dest_ioindex)))
+        return ret;
+    for (int k = 0; k < maplen; k++)
+    {
+        int x = (compmap[k] - 1) / gdimlen[1];
+        int y = (compmap[k] - 1) % gdimlen[1];
+        int io = x < 2 ? (y < 3 ? 1 : 3) : (y < 3 ? 2 : 0);
+
+        if (!compmap[k])
+        {
+            if (dest_ioproc[k] != -1 || dest_ioindex[k] != -1)
+                return ERR_WRONG;
+            continue;
+        }
+        if (dest_ioproc[k] != io || dest_ioindex[k] != (x % 2) * 3 + y % 3)
+            return ERR_WRONG;
+    }
+
+    if ((ret = box_find_dest(NDIM2, gdimlen, 2, sc_info2, maplen, compmap, dest_ioproc,
+                             dest_ioindex)))
+        return ret;
+    for (int k = 1; k < maplen; k++)
+        if (dest_ioproc[k] != 0 || dest_ioindex[k] != compmap[k] - 1)
+            return ERR_WRONG;
+
+    /* With no IO data, nothing is found. */
+    sc_info2[0] = 0;
+    sc_info2[FD_MSG] = 0;
+    if ((ret = box_find_dest(NDIM2, gdimlen, 2, sc_info2, maplen, compmap, dest_ioproc,
+                             dest_ioindex)))
+        return ret;
+    for (int k = 0; k < maplen; k++)
+        if (dest_ioproc[k] != -1)
+            return ERR_WRONG;
+
+    return 0;
+}
+
 /* Test compute_maxIObuffersize() function. */
 int test_compute_maxIObuffersize(MPI_Comm test_comm, int my_rank)
 {
@@ -435,6 +561,21 @@ int test_get_regions(int my_rank)
     free(ior1->count);
     free(ior1);
 
+    /* A map of only holes gives one empty region. */
+    {
+        PIO_Offset holes[MAPLEN] = {0, 0};
+
+        if ((ret = alloc_region2(NULL, NDIM1, &ior1)))
+            return ret;
+        if ((ret = get_regions(ndims, gdimlen, MAPLEN, holes, &maxregions, ior1)))
+            return ret;
+        if (maxregions != 1 || ior1->next || ior1->loffset != MAPLEN || ior1->count[0])
+            return ERR_WRONG;
+        free(ior1->start);
+        free(ior1->count);
+        free(ior1);
+    }
+
     return 0;
 }
 
@@ -485,7 +626,6 @@ int test_define_iodesc_datatypes(int my_rank)
 #define NUM_REARRANGERS 2
     int rearranger[NUM_REARRANGERS] = {PIO_REARR_BOX, PIO_REARR_SUBSET};
     io_desc_t iodesc;
-    int mpierr;
     int ret = PIO_NOERR;
 
     /* Run the functon. */
@@ -515,7 +655,7 @@ int test_define_iodesc_datatypes(int my_rank)
             PBAIL(PIO_ENOMEM);
         if (!(iodesc.rfrom = malloc(iodesc.nrecvs * sizeof(int))))
             PBAIL(PIO_ENOMEM);
-        if (!(iodesc.rindex = malloc(1 * sizeof(PIO_Offset))))
+        if (!(iodesc.rindex = malloc(1 * sizeof(int))))
             PBAIL(PIO_ENOMEM);
         iodesc.rindex[0] = 0;
         iodesc.rcount[0] = 1;
@@ -525,7 +665,7 @@ int test_define_iodesc_datatypes(int my_rank)
         /* The two rearrangers create a different number of send types. */
         int num_send_types = iodesc.rearranger == PIO_REARR_BOX ? ios.num_iotasks : 1;
 
-        if (!(iodesc.sindex = malloc(num_send_types * sizeof(PIO_Offset))))
+        if (!(iodesc.sindex = malloc(num_send_types * sizeof(int))))
             PBAIL(PIO_ENOMEM);
         if (!(iodesc.scount = malloc(num_send_types * sizeof(int))))
             PBAIL(PIO_ENOMEM);
@@ -541,12 +681,12 @@ int test_define_iodesc_datatypes(int my_rank)
 
         /* We created send types, so free them. */
         for (int st = 0; st < num_send_types; st++)
-            if ((mpierr = MPI_Type_free(&iodesc.stype[st])))
-                MPIBAIL(mpierr);
+            if ((ret = free_mpi_datatype(&iodesc.stype[st])))
+                PBAIL(ret);
 
         /* We created one receive type, so free it. */
-        if ((mpierr = MPI_Type_free(&iodesc.rtype[0])))
-            MPIBAIL(mpierr);
+        if ((ret = free_mpi_datatype(&iodesc.rtype[0])))
+            PBAIL(ret);
 
         /* Free resources. */
         if (iodesc.rtype)
@@ -694,6 +834,418 @@ int test_init_decomp(int iosysid, MPI_Comm test_comm, int my_rank)
     return 0;
 }
 
+/* Test autotuning of the rearranger options in PIOc_InitDecomp(). */
+int test_rearr_autotune(int iosysid, int my_rank)
+{
+    int ioid;
+    PIO_Offset compmap[MAPLEN2] = {my_rank * 2, (my_rank + 1) * 2};
+    const int gdimlen[NDIM1] = {8};
+    io_desc_t *iodesc;
+    int ret;
+
+    /* This should not work. */
+    if (PIOc_set_rearr_autotune(TEST_VAL_42, true) != PIO_EBADID)
+        return ERR_WRONG;
+
+    if ((ret = PIOc_set_rearr_autotune(iosysid, true)))
+        return ret;
+
+    /* Initialize a decomposition, which tunes the options. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        return ret;
+
+    /* Which settings win depends on the machine, but they must make
+     * sense. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->rearr_opts.comp2io.max_pend_req < PIO_REARR_COMM_UNLIMITED_PEND_REQ ||
+        iodesc->rearr_opts.io2comp.max_pend_req < PIO_REARR_COMM_UNLIMITED_PEND_REQ)
+        return ERR_WRONG;
+    if ((iodesc->rearr_opts.comm_type == PIO_REARR_COMM_COLL) !=
+        (!iodesc->rearr_opts.comp2io.max_pend_req && !iodesc->rearr_opts.io2comp.max_pend_req))
+        return ERR_WRONG;
+
+    /* Free it. */
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    if ((ret = PIOc_set_rearr_autotune(iosysid, false)))
+        return ret;
+
+    return 0;
+}
+
+/* A user IO partition, which puts all the data on the first IO
+ * task. If arg is not NULL, it leaves out the last element. */
+int all_on_first(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                 int myiorank, void *arg, PIO_Offset *start, PIO_Offset *count,
+                 int *num_aiotasks)
+{
+    for (int d = 0; d < ndims; d++)
+    {
+        start[d] = 0;
+        count[d] = myiorank ? 0 : gdims[d];
+    }
+    if (arg && !myiorank)
+        count[ndims - 1]--;
+    *num_aiotasks = 1;
+
+    return 0;
+}
+
+/* A bad user IO partition, in which the first two IO tasks both get
+ * the first half of the array. The sizes add up to the whole array,
+ * but the second half is not covered. */
+int overlap_on_first_two(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                         int myiorank, void *arg, PIO_Offset *start, PIO_Offset *count,
+                         int *num_aiotasks)
+{
+    for (int d = 0; d < ndims; d++)
+    {
+        start[d] = 0;
+        count[d] = myiorank < 2 ? gdims[d] : 0;
+    }
+    count[0] = myiorank < 2 ? gdims[0] / 2 : 0;
+    *num_aiotasks = 2;
+
+    return 0;
+}
+
+/* A bad user IO partition, which puts all the data on the first IO
+ * task, but does not give the same number of IO tasks on each. */
+int all_on_first_disagree(int pio_type, int ndims, const int *gdims, int num_io_procs,
+                          int myiorank, void *arg, PIO_Offset *start, PIO_Offset *count,
+                          int *num_aiotasks)
+{
+    all_on_first(pio_type, ndims, gdims, num_io_procs, myiorank, NULL, start, count,
+                 num_aiotasks);
+    *num_aiotasks = myiorank + 1;
+
+    return 0;
+}
+
+/* Test the choice of IO partition in PIOc_InitDecomp(). */
+int test_iopart(int iosysid, int numio, int my_rank)
+{
+#define NUM_IOPARTS 4
+    int iopart[NUM_IOPARTS] = {PIO_IOPART_BLOCK, PIO_IOPART_SLAB, PIO_IOPART_STRIPE,
+                               PIO_IOPART_BYTES};
+    int ioid;
+    PIO_Offset compmap[MAPLEN2] = {my_rank * 2, (my_rank + 1) * 2};
+    const int gdimlen[NDIM1] = {8};
+    io_desc_t *iodesc;
+    iosystem_desc_t *ios;
+    int bad = 1;
+    int ret;
+
+    if (!(ios = pio_get_iosystem_from_id(iosysid)))
+        return ERR_WRONG;
+
+    /* These should not work. */
+    if (PIOc_set_iopart(TEST_VAL_42, PIO_IOPART_SLAB) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_set_iopart(iosysid, TEST_VAL_42) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_set_iopart(iosysid, PIO_IOPART_USER) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    for (int p = 0; p < NUM_IOPARTS; p++)
+    {
+        if ((ret = PIOc_set_iopart(iosysid, iopart[p])))
+            return ret;
+        if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                    compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+            return ret;
+        if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+            return ERR_WRONG;
+
+        /* With no stripe size, stripe alignment is not used. Only
+         * the balanced partition uses all the IO tasks for this
+         * little array. */
+        if (ios->ioproc && iodesc->iopart !=
+            (iopart[p] == PIO_IOPART_STRIPE ? PIO_IOPART_BLOCK : iopart[p]))
+            return ERR_WRONG;
+        if (iodesc->num_aiotasks != (iopart[p] == PIO_IOPART_BYTES ? numio : 1))
+            return ERR_WRONG;
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            return ret;
+    }
+
+    /* A user partition. */
+    if ((ret = PIOc_set_iopart_fn(iosysid, all_on_first, NULL)))
+        return ret;
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->num_aiotasks != 1 || (ios->ioproc && iodesc->iopart != PIO_IOPART_USER))
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    /* A user partition which does not cover the array is caught on
+     * all tasks. */
+    if ((ret = PIOc_set_iopart_fn(iosysid, all_on_first, &bad)))
+        return ret;
+    if (PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2, compmap, &ioid,
+                         PIO_REARR_BOX, NULL, NULL) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    /* So are overlapping regions, and IO tasks which disagree on
+     * the number of IO tasks used. */
+    if (numio > 1)
+    {
+        if ((ret = PIOc_set_iopart_fn(iosysid, overlap_on_first_two, NULL)))
+            return ret;
+        if (PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2, compmap, &ioid,
+                             PIO_REARR_BOX, NULL, NULL) != PIO_EINVAL)
+            return ERR_WRONG;
+        if ((ret = PIOc_set_iopart_fn(iosysid, all_on_first_disagree, NULL)))
+            return ret;
+        if (PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2, compmap, &ioid,
+                             PIO_REARR_BOX, NULL, NULL) != PIO_EINVAL)
+            return ERR_WRONG;
+    }
+
+    /* Back to the default. */
+    if ((ret = PIOc_set_iopart_fn(iosysid, NULL, NULL)))
+        return ret;
+    if (ios->iopart != PIO_IOPART_BLOCK)
+        return ERR_WRONG;
+
+    return 0;
+}
+
+/* Test the check for repeated values in box decomposition maps. */
+int test_map_dup_check(int iosysid, int my_rank)
+{
+    int ioid;
+    PIO_Offset dupmap[MAPLEN2] = {my_rank * 2, (my_rank + 1) * 2};
+    PIO_Offset compmap[MAPLEN2] = {my_rank * 2 + 1, my_rank * 2 + 2};
+    const int gdimlen[NDIM1] = {8};
+    io_desc_t *iodesc;
+    int ret;
+
+    /* This should not work. */
+    if (PIOc_set_map_dup_check(TEST_VAL_42, true) != PIO_EBADID)
+        return ERR_WRONG;
+
+    if ((ret = PIOc_set_map_dup_check(iosysid, true)))
+        return ret;
+
+    /* Neighboring tasks share a value in this map. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                dupmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->readonly != (TARGET_NTASKS > 1))
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    /* This one has no repeats. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->readonly)
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    /* All tasks read the same values. With the subset rearranger,
+     * each value is read once into the IO buffer. */
+    {
+        PIO_Offset halomap[MAPLEN2] = {1, 2};
+
+        if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                    halomap, &ioid, PIO_REARR_SUBSET, NULL, NULL)))
+            return ret;
+        if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+            return ERR_WRONG;
+        if (iodesc->readonly != (TARGET_NTASKS > 1))
+            return ERR_WRONG;
+        if (iodesc->llen > 0 && iodesc->rllen != MAPLEN2)
+            return ERR_WRONG;
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            return ret;
+    }
+
+    if ((ret = PIOc_set_map_dup_check(iosysid, false)))
+        return ret;
+
+    return 0;
+}
+
+/* Test the sorting of unsorted maps in PIOc_init_decomp(), for a map
+ * of two sorted pieces, a scrambled one of a few runs, which are
+ * merged, and one of more than PIO_SORT_MAX_MERGE_RUNS runs, which
+ * is radix sorted. */
+int test_map_sort(int iosysid, int my_rank)
+{
+#define SORT_MAPLEN 64
+#define NUM_SORT_MAPS 3
+    /* The stride through the map of each kind of map. */
+    const int stride[NUM_SORT_MAPS] = {1, 7, 37};
+    PIO_Offset compmap[SORT_MAPLEN];
+    const int gdimlen[NDIM1] = {SORT_MAPLEN * TARGET_NTASKS};
+    io_desc_t *iodesc;
+    int ioid;
+    int ret;
+
+    for (int s = 0; s < NUM_SORT_MAPS; s++)
+    {
+        int nruns = 1;
+
+        /* Each task has every TARGET_NTASKS-th element. The first map
+         * starts in the middle. */
+        for (int m = 0; m < SORT_MAPLEN; m++)
+        {
+            int t = (m * stride[s] + (s ? 0 : SORT_MAPLEN / 2)) % SORT_MAPLEN;
+            compmap[m] = (PIO_Offset)t * TARGET_NTASKS + my_rank;
+            if (m && compmap[m] < compmap[m - 1])
+                nruns++;
+        }
+        if ((nruns > PIO_SORT_MAX_MERGE_RUNS) != (s == NUM_SORT_MAPS - 1))
+            return ERR_WRONG;
+
+        if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, SORT_MAPLEN,
+                                    compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+            return ret;
+        if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+            return ERR_WRONG;
+        if (!iodesc->needssort || !iodesc->remap)
+            return ERR_WRONG;
+        for (int m = 0; m < SORT_MAPLEN; m++)
+        {
+            if (iodesc->map[m] != compmap[iodesc->remap[m]])
+                return ERR_WRONG;
+            if (m && iodesc->map[m] <= iodesc->map[m - 1])
+                return ERR_WRONG;
+        }
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            return ret;
+    }
+
+    return 0;
+}
+
+/* Test releasing the maps of decompositions. */
+int test_map_release(int iosysid, int my_rank)
+{
+    int ioid;
+    PIO_Offset compmap[MAPLEN2] = {my_rank * 2 + 1, my_rank * 2 + 2};
+    const int gdimlen[NDIM1] = {8};
+    io_desc_t *iodesc;
+    int ret;
+
+    if (PIOc_set_map_release(TEST_VAL_42, true) != PIO_EBADID)
+        return ERR_WRONG;
+    if ((ret = PIOc_set_map_release(iosysid, true)))
+        return ret;
+
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->map || iodesc->maplen != MAPLEN2)
+        return ERR_WRONG;
+
+    /* The map can't be written. */
+    if (PIOc_write_nc_decomp(iosysid, TEST_NAME "_released.nc", 0, ioid, NULL, NULL,
+                             0) != PIO_EINVAL)
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    return PIOc_set_map_release(iosysid, false);
+}
+
+/* Test the cache of tuned rearranger options. */
+int test_rearr_tune_cache(int iosysid, MPI_Comm test_comm, int my_rank)
+{
+#define TUNE_FILE TEST_NAME "_tune_cache.txt"
+    int ioid;
+    PIO_Offset compmap[MAPLEN2] = {my_rank * 2, (my_rank + 1) * 2};
+    const int gdimlen[NDIM1] = {8};
+    io_desc_t *iodesc;
+    int mpierr;
+    int ret;
+
+    /* Start with no cache file. */
+    if (!my_rank)
+        remove(TUNE_FILE);
+    if ((mpierr = MPI_Barrier(test_comm)))
+        MPIERR(mpierr);
+
+    if ((ret = PIOc_set_rearr_autotune(iosysid, true)))
+        return ret;
+    if ((ret = PIOc_set_rearr_tune_file(iosysid, TUNE_FILE)))
+        return ret;
+
+    /* This tunes the options, and adds them to the file. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        return ret;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    /* Add an entry with the same signature, and options that tuning
+     * never picks. The last entry wins. */
+    if (!my_rank)
+    {
+        FILE *fp;
+        char line[PIO_MAX_NAME + 1];
+        unsigned long long sig;
+
+        if (!(fp = fopen(TUNE_FILE, "r")))
+            return ERR_WRONG;
+        if (!fgets(line, sizeof(line), fp) || sscanf(line, "%llx", &sig) != 1)
+            return ERR_WRONG;
+        fclose(fp);
+        if (!(fp = fopen(TUNE_FILE, "a")))
+            return ERR_WRONG;
+        fprintf(fp, "%016llx %d 1 1 %d 1 0 %d\n", sig, PIO_REARR_COMM_P2P, TEST_VAL_42,
+                TEST_VAL_42 + 1);
+
+        /* Entries with options tuning can't pick are ignored. */
+        fprintf(fp, "%016llx %d 0 0 0 0 0 0\n", sig, PIO_REARR_COMM_NEIGHBOR);
+        fprintf(fp, "%016llx %d 2 0 0 0 0 0\n", sig, PIO_REARR_COMM_COLL);
+        fprintf(fp, "%016llx %d 0 0 -2 0 0 0\n", sig, PIO_REARR_COMM_P2P);
+        fclose(fp);
+    }
+    if ((mpierr = MPI_Barrier(test_comm)))
+        MPIERR(mpierr);
+
+    /* Now the options come from the last valid entry of the file,
+     * and the peers are defined for them. */
+    if ((ret = PIOc_init_decomp(iosysid, PIO_INT, NDIM1, gdimlen, MAPLEN2,
+                                compmap, &ioid, PIO_REARR_BOX, NULL, NULL)))
+        return ret;
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (iodesc->rearr_opts.comm_type != PIO_REARR_COMM_P2P ||
+        !iodesc->rearr_opts.comp2io.hs || !iodesc->rearr_opts.comp2io.isend ||
+        iodesc->rearr_opts.comp2io.max_pend_req != TEST_VAL_42 ||
+        !iodesc->rearr_opts.io2comp.hs || iodesc->rearr_opts.io2comp.isend ||
+        iodesc->rearr_opts.io2comp.max_pend_req != TEST_VAL_42 + 1 || !iodesc->peers)
+        return ERR_WRONG;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    if ((ret = PIOc_set_rearr_tune_file(iosysid, NULL)))
+        return ret;
+    if ((ret = PIOc_set_rearr_autotune(iosysid, false)))
+        return ret;
+
+    return 0;
+}
+
 /* Test for the box_rearrange_create() function. */
 int test_box_rearrange_create(MPI_Comm test_comm, int my_rank)
 {
@@ -927,7 +1479,7 @@ int test_box_rearrange_create_2(MPI_Comm test_comm, int my_rank)
 int test_default_subset_partition(MPI_Comm test_comm, int my_rank)
 {
     iosystem_desc_t *ios;
-    io_desc_t *iodesc;
+    io_desc_t *iodesc, *iodesc2;
     int mpierr;
     int ret;
 
@@ -943,21 +1495,98 @@ int test_default_subset_partition(MPI_Comm test_comm, int my_rank)
     ios->io_rank = my_rank;
     ios->union_comm = test_comm;
 
+    /* Allocate a second IO desc, which will share the comm. */
+    if (!(iodesc2 = calloc(1, sizeof(io_desc_t))))
+        return PIO_ENOMEM;
+
     /* Run the function to test. */
     if ((ret = default_subset_partition(ios, iodesc)))
         return ret;
+    if (ios->subset_comm_refs != 1 || iodesc->subset_comm != ios->subset_comm)
+        return ERR_WRONG;
+
+    /* A second decomposition of the IO system gets the same comm. */
+    if ((ret = default_subset_partition(ios, iodesc2)))
+        return ret;
+    if (ios->subset_comm_refs != 2 || iodesc2->subset_comm != iodesc->subset_comm)
+        return ERR_WRONG;
 
     /* Free the created communicator. */
-    if ((mpierr = MPI_Comm_free(&iodesc->subset_comm)))
+    if ((mpierr = MPI_Comm_free(&ios->subset_comm)))
         MPIERR(mpierr);
 
     /* Free resources from test. */
+    free(iodesc2);
     free(iodesc);
     free(ios);
 
     return 0;
 }
 
+/* Test the node and map partitions of default_subset_partition. */
+int test_subset_part(MPI_Comm test_comm, int my_rank)
+{
+    int parts[] = {PIO_SUBSET_PART_NODE, PIO_SUBSET_PART_MAP};
+    iosystem_desc_t *ios;
+    int ntasks;
+    int mpierr;
+    int ret;
+
+    if ((mpierr = MPI_Comm_size(test_comm, &ntasks)))
+        MPIERR(mpierr);
+
+    /* Allocate IO system info struct for this test. */
+    if (!(ios = calloc(1, sizeof(iosystem_desc_t))))
+        return PIO_ENOMEM;
+
+    /* Every other task is an IO task. */
+    ios->ioproc = !(my_rank % 2);
+    ios->io_rank = ios->ioproc ? my_rank / 2 : -1;
+    ios->num_iotasks = (ntasks + 1) / 2;
+    ios->num_comptasks = ntasks;
+    ios->union_rank = my_rank;
+    ios->union_comm = test_comm;
+
+    for (int p = 0; p < sizeof(parts) / sizeof(int); p++)
+    {
+        io_desc_t *iodesc;
+        PIO_Offset map = ntasks - my_rank;
+        int rank, size;
+
+        if (!(iodesc = calloc(1, sizeof(io_desc_t))))
+            return PIO_ENOMEM;
+        iodesc->map = &map;
+        iodesc->maplen = 1;
+
+        ios->subset_part = parts[p];
+        if ((ret = default_subset_partition(ios, iodesc)))
+            return ret;
+
+        /* The map partition is private to the decomposition. */
+        if (iodesc->subset_comm_private != (parts[p] == PIO_SUBSET_PART_MAP))
+            return ERR_WRONG;
+
+        /* Each group has its IO task first, and at most one
+         * computation task per IO task. */
+        if ((mpierr = MPI_Comm_rank(iodesc->subset_comm, &rank)))
+            MPIERR(mpierr);
+        if ((mpierr = MPI_Comm_size(iodesc->subset_comm, &size)))
+            MPIERR(mpierr);
+        if ((ios->ioproc && rank) || (!ios->ioproc && !rank) || size > 2)
+            return ERR_WRONG;
+
+        /* Free the created communicator. */
+        if ((mpierr = MPI_Comm_free(&iodesc->subset_comm)))
+            MPIERR(mpierr);
+        ios->subset_comm_refs = 0;
+        free(iodesc);
+    }
+
+    free(ios);
+
+    return 0;
+}
+
 /* Test function rearrange_comp2io. */
 int test_rearrange_comp2io(MPI_Comm test_comm, int my_rank)
 {
@@ -966,12 +1595,12 @@ int test_rearrange_comp2io(MPI_Comm test_comm, int my_rank)
     void *sbuf = NULL;
     void *rbuf = NULL;
     int nvars = 1;
+    int rbuf_expected[4];
     io_region *ior1 = NULL;
     int maplen = 2;
     PIO_Offset compmap[2] = {1, 0};
     const int gdimlen[NDIM1] = {8};
     int ndims = NDIM1;
-    int mpierr;
     int ret;
 
     /* Allocate some space for data. */
@@ -1044,21 +1673,44 @@ int test_rearrange_comp2io(MPI_Comm test_comm, int my_rank)
         PBAIL(ret);
 
     /* Run the function to test. */
+    for (int i = 0; i < 4; i++)
+        ((int *)sbuf)[i] = my_rank * 10 + i;
     if ((ret = rearrange_comp2io(ios, iodesc, sbuf, rbuf, nvars)))
         PBAIL(ret);
+    memcpy(rbuf_expected, rbuf, 4 * sizeof(int));
+
+    /* With p2p messages and no limit on pending requests, persistent
+     * requests are made the first time and reused after that, and
+     * must give the same results. */
+    iodesc->rearr_opts.comp2io.max_pend_req = PIO_REARR_COMM_UNLIMITED_PEND_REQ;
+    for (int t = 0; t < 2; t++)
+    {
+        memset(rbuf, 0, 4 * sizeof(int));
+        if ((ret = rearrange_comp2io(ios, iodesc, sbuf, rbuf, nvars)))
+            PBAIL(ret);
+        if (!iodesc->comp2io_persist.reqs || iodesc->comp2io_persist.sbuf != sbuf ||
+            iodesc->comp2io_persist.rbuf != rbuf || iodesc->comp2io_persist.nvars != nvars)
+            PBAIL(ERR_WRONG);
+        if (memcmp(rbuf, rbuf_expected, 4 * sizeof(int)))
+            PBAIL(ERR_WRONG);
+    }
+    if ((ret = free_rearr_persist(&iodesc->comp2io_persist)))
+        PBAIL(ret);
+    if (iodesc->comp2io_persist.reqs)
+        PBAIL(ERR_WRONG);
 
     /* We created send types, so free them. */
     for (int st = 0; st < num_send_types; st++)
         if (iodesc->stype[st] != PIO_DATATYPE_NULL)
-            if ((mpierr = MPI_Type_free(&iodesc->stype[st])))
-                MPIBAIL(mpierr);
+            if ((ret = free_mpi_datatype(&iodesc->stype[st])))
+                PBAIL(ret);
 
     /* We created one receive type, so free it. */
     if (iodesc->rtype)
         for (int r = 0; r < iodesc->nrecvs; r++)
             if (iodesc->rtype[r] != PIO_DATATYPE_NULL)
-                if ((mpierr = MPI_Type_free(&iodesc->rtype[r])))
-                    MPIBAIL(mpierr);
+                if ((ret = free_mpi_datatype(&iodesc->rtype[r])))
+                    PBAIL(ret);
 
 exit:
     /* Free resources allocated in library code. */
@@ -1076,6 +1728,12 @@ exit:
         free(iodesc->rfrom);
     if (iodesc->rindex)
         free(iodesc->rindex);
+    if (iodesc->peers)
+    {
+        free(iodesc->peers);
+        free(iodesc->peer_counts);
+        free(iodesc->peer_types);
+    }
 
     /* Free resources from test. */
     if (ior1)
@@ -1112,7 +1770,6 @@ int test_rearrange_io2comp(MPI_Comm test_comm, int my_rank)
     PIO_Offset compmap[2] = {1, 0};
     const int gdimlen[NDIM1] = {8};
     int ndims = NDIM1;
-    int mpierr;
     int ret;
 
     /* Allocate some space for data. */
@@ -1195,15 +1852,15 @@ int test_rearrange_io2comp(MPI_Comm test_comm, int my_rank)
     /* We created send types, so free them. */
     for (int st = 0; st < num_send_types; st++)
         if (iodesc->stype[st] != PIO_DATATYPE_NULL)
-            if ((mpierr = MPI_Type_free(&iodesc->stype[st])))
-                MPIBAIL(mpierr);
+            if ((ret = free_mpi_datatype(&iodesc->stype[st])))
+                PBAIL(ret);
 
     /* We created one receive type, so free it. */
     if (iodesc->rtype)
         for (int r = 0; r < iodesc->nrecvs; r++)
             if (iodesc->rtype[r] != PIO_DATATYPE_NULL)
-                if ((mpierr = MPI_Type_free(&iodesc->rtype[r])))
-                    MPIBAIL(mpierr);
+                if ((ret = free_mpi_datatype(&iodesc->rtype[r])))
+                    PBAIL(ret);
 
 exit:
     /* Free resources allocated in library code. */
@@ -1216,6 +1873,9 @@ exit:
         free(iodesc->rcount);
         free(iodesc->rfrom);
         free(iodesc->rindex);
+        free(iodesc->peers);
+        free(iodesc->peer_counts);
+        free(iodesc->peer_types);
     }
 
     /* Free resources from test. */
@@ -1252,6 +1912,9 @@ int run_no_iosys_tests(int my_rank, MPI_Comm test_comm)
     if ((ret = test_coord_to_lindex()))
         return ret;
 
+    if ((ret = test_box_find_dest()))
+        return ret;
+
     if ((ret = test_compute_maxIObuffersize(test_comm, my_rank)))
         return ret;
 
@@ -1279,6 +1942,9 @@ int run_no_iosys_tests(int my_rank, MPI_Comm test_comm)
     if ((ret = test_compare_offsets()))
         return ret;
 
+    if ((ret = test_sorted_copy()))
+        return ret;
+
     if ((ret = test_compute_counts(test_comm, my_rank)))
         return ret;
 
@@ -1291,6 +1957,9 @@ int run_no_iosys_tests(int my_rank, MPI_Comm test_comm)
     if ((ret = test_default_subset_partition(test_comm, my_rank)))
         return ret;
 
+    if ((ret = test_subset_part(test_comm, my_rank)))
+        return ret;
+
     if ((ret = test_rearrange_comp2io(test_comm, my_rank)))
         return ret;
 
@@ -1528,6 +2197,24 @@ int run_iosys_tests(int numio, int iosysid, int my_rank, MPI_Comm test_comm,
     if ((ret = test_init_decomp(iosysid, test_comm, my_rank)))
         return ret;
 
+    if ((ret = test_rearr_autotune(iosysid, my_rank)))
+        return ret;
+
+    if ((ret = test_rearr_tune_cache(iosysid, test_comm, my_rank)))
+        return ret;
+
+    if ((ret = test_iopart(iosysid, numio, my_rank)))
+        return ret;
+
+    if ((ret = test_map_dup_check(iosysid, my_rank)))
+        return ret;
+
+    if ((ret = test_map_sort(iosysid, my_rank)))
+        return ret;
+
+    if ((ret = test_map_release(iosysid, my_rank)))
+        return ret;
+
     if ((ret = test_scalar(numio, iosysid, test_comm, my_rank, num_flavors, flavor)))
         return ret;
 
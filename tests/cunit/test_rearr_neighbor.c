@@ -0,0 +1,202 @@
+/*
+ * Tests for the neighborhood collective rearranger comm type,
+ * PIO_REARR_COMM_NEIGHBOR.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_rearr_neighbor"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 4
+#define Y_DIM_LEN 4
+
+/* Number of rearrangers to test. */
+#define NUM_REARRANGERS 2
+
+/* Number of times each var is written and read. */
+#define NUM_TIMES 3
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"x", "y"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+
+/* Check the neighbors of the decomposition. */
+int check_neighbors(int ioid)
+{
+    io_desc_t *iodesc;
+    int ntasks;
+    int mpierr;
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+
+    /* Every task has data, so it has at least one neighbor. */
+    if (iodesc->rearr_opts.comm_type != PIO_REARR_COMM_NEIGHBOR ||
+        iodesc->npeers < 1 || !iodesc->peers)
+        return ERR_WRONG;
+
+    /* The neighbors are sorted, and there is one entry for each. */
+    for (int n = 1; n < iodesc->npeers; n++)
+        if (iodesc->peers[n] <= iodesc->peers[n - 1])
+            return ERR_WRONG;
+
+    /* The graph is symmetric. */
+    {
+        int indegree, outdegree, weighted;
+
+        if ((mpierr = MPI_Dist_graph_neighbors_count(iodesc->neighbor_comm, &indegree,
+                                                     &outdegree, &weighted)))
+            MPIERR(mpierr);
+        if (indegree != iodesc->npeers || outdegree != iodesc->npeers)
+            return ERR_WRONG;
+    }
+    if ((mpierr = MPI_Comm_size(iodesc->neighbor_comm, &ntasks)))
+        MPIERR(mpierr);
+    if (iodesc->npeers > ntasks)
+        return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
+/* Write a var several times, reading it back each time. */
+int test_neighbor(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank,
+                  int ntasks, int rearranger)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM2];
+    int varid;
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    int test_data[arraylen];
+    int test_data_in[arraylen];
+    int ncid;
+    int ret;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_iotype_%d_rearr_%d.nc", TEST_NAME, flavor[fmt], rearranger);
+
+        /* Create the file, dims and var. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM2; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM2, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        for (int t = 0; t < NUM_TIMES; t++)
+        {
+            for (int i = 0; i < arraylen; i++)
+                test_data[i] = my_rank * 1000 + t * 100 + i;
+
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+                ERR(ret);
+            if ((ret = PIOc_sync(ncid)))
+                ERR(ret);
+
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int i = 0; i < arraylen; i++)
+                if (test_data_in[i] != test_data[i])
+                    ERR(ERR_WRONG);
+        }
+
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/* Run tests for the neighborhood rearranger comm type. */
+int main(int argc, char **argv)
+{
+    int rearranger[NUM_REARRANGERS] = {PIO_REARR_BOX, PIO_REARR_SUBSET};
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid;                 /* The ID of the decomposition. */
+        int ioproc_stride = 1;    /* Stride in the mpi rank between io tasks. */
+        int ioproc_start = 0;     /* Zero based rank of first processor to be used for I/O. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        for (int r = 0; r < NUM_REARRANGERS; r++)
+        {
+            if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, ioproc_stride,
+                                           ioproc_start, rearranger[r], &iosysid)))
+                return ret;
+
+            /* Use neighborhood collectives in the rearranger. */
+            if ((ret = PIOc_set_rearr_opts(iosysid, PIO_REARR_COMM_NEIGHBOR,
+                                           PIO_REARR_COMM_FC_2D_DISABLE, false, false,
+                                           PIO_REARR_COMM_UNLIMITED_PEND_REQ, false, false,
+                                           PIO_REARR_COMM_UNLIMITED_PEND_REQ)))
+                return ret;
+
+            if ((ret = create_decomposition_reversed(TARGET_NTASKS, my_rank, iosysid, dim_len,
+                                                     rearranger[r], &ioid)))
+                return ret;
+
+            if ((ret = check_neighbors(ioid)))
+                return ret;
+
+            if ((ret = test_neighbor(iosysid, ioid, num_flavors, flavor, my_rank,
+                                     TARGET_NTASKS, rearranger[r])))
+                return ret;
+
+            if ((ret = PIOc_freedecomp(iosysid, ioid)))
+                ERR(ret);
+
+            if ((ret = PIOc_free_iosystem(iosysid)))
+                return ret;
+        }
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Tests for the two level rearranger, PIO_REARR_NODE, which gathers
+ * the data of the tasks on each node before sending it to the IO
+ * tasks.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_rearr_node"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 4
+#define Y_DIM_LEN 4
+
+/* Number of times each var is written and read. */
+#define NUM_TIMES 3
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"x", "y"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+
+/* Check the node aggregation of the decomposition. */
+int check_node(int ioid, int ntasks, MPI_Comm test_comm)
+{
+    io_desc_t *iodesc;
+    int node_size, node_rank;
+    int total;
+    int mpierr;
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+
+    /* Internally this is a box rearranger. */
+    if (iodesc->rearranger != PIO_REARR_BOX || iodesc->nnode < 1 || !iodesc->needssort)
+        return ERR_WRONG;
+    if ((mpierr = MPI_Comm_size(iodesc->node_comm, &node_size)))
+        MPIERR(mpierr);
+    if ((mpierr = MPI_Comm_rank(iodesc->node_comm, &node_rank)))
+        MPIERR(mpierr);
+    if (node_size != iodesc->nnode)
+        return ERR_WRONG;
+
+    /* The node of each task has the same tasks as its node in
+     * test_comm, so when the test runs on one host (as it does in
+     * make check) the non-leaders, which have no map of the node,
+     * are covered. */
+    {
+        MPI_Comm shared_comm;
+        int shared_size;
+
+        if ((mpierr = MPI_Comm_split_type(test_comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
+                                          &shared_comm)))
+            MPIERR(mpierr);
+        if ((mpierr = MPI_Comm_size(shared_comm, &shared_size)))
+            MPIERR(mpierr);
+        if ((mpierr = MPI_Comm_free(&shared_comm)))
+            MPIERR(mpierr);
+        if (shared_size != iodesc->nnode)
+            return ERR_WRONG;
+    }
+
+    /* Only the leaders hold data, and together they hold it all. */
+    if (node_rank && iodesc->node_ndof)
+        return ERR_WRONG;
+    if ((mpierr = MPI_Allreduce(&iodesc->node_ndof, &total, 1, MPI_INT, MPI_SUM, test_comm)))
+        MPIERR(mpierr);
+    if (total != X_DIM_LEN * Y_DIM_LEN || iodesc->ndof != X_DIM_LEN * Y_DIM_LEN / ntasks)
+        return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
+/* Write a var several times, with the different write functions,
+ * reading it back each time. */
+int test_node(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank,
+              int ntasks)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM2];
+    int varid;
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    int test_data[arraylen];
+    int test_data_in[arraylen];
+    int ncid;
+    int ret;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create the file, dims and var. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM2; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM2, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        for (int t = 0; t < NUM_TIMES; t++)
+        {
+            int request;
+
+            for (int i = 0; i < arraylen; i++)
+                test_data[i] = my_rank * 1000 + t * 100 + i;
+
+            /* Write with each of the write functions. */
+            if (t == 0)
+            {
+                if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+                    ERR(ret);
+            }
+            else if (t == 1)
+            {
+                if ((ret = PIOc_write_darray_nocopy(ncid, varid, ioid, arraylen, test_data,
+                                                    NULL)))
+                    ERR(ret);
+                if ((ret = PIOc_write_darray_nocopy_wait(ncid)))
+                    ERR(ret);
+            }
+            else
+            {
+                if ((ret = PIOc_iwrite_darray(ncid, varid, ioid, arraylen, test_data, NULL,
+                                              &request)))
+                    ERR(ret);
+                if ((ret = PIOc_wait_darray(ncid, request)))
+                    ERR(ret);
+            }
+            if ((ret = PIOc_sync(ncid)))
+                ERR(ret);
+
+            /* Read it back, both ways. */
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int i = 0; i < arraylen; i++)
+                if (test_data_in[i] != test_data[i])
+                    ERR(ERR_WRONG);
+
+            memset(test_data_in, 0, sizeof(test_data_in));
+            if ((ret = PIOc_iread_darray(ncid, varid, ioid, arraylen, test_data_in, &request)))
+                ERR(ret);
+            if ((ret = PIOc_wait_darray(ncid, request)))
+                ERR(ret);
+            for (int i = 0; i < arraylen; i++)
+                if (test_data_in[i] != test_data[i])
+                    ERR(ERR_WRONG);
+        }
+
+        /* Device arrays are gathered on the node, and scattered
+         * back, straight from the unsorted arrays of the caller. */
+        if ((ret = PIOc_set_device_buffers(iosysid, 1)))
+            ERR(ret);
+        for (int i = 0; i < arraylen; i++)
+            test_data[i] = my_rank * 1000 + NUM_TIMES * 100 + i;
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+        memset(test_data_in, 0, sizeof(test_data_in));
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+            ERR(ret);
+        for (int i = 0; i < arraylen; i++)
+            if (test_data_in[i] != test_data[i])
+                ERR(ERR_WRONG);
+        if ((ret = PIOc_set_device_buffers(iosysid, 0)))
+            ERR(ret);
+
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+
+/* Run tests for the node rearranger. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid;                 /* The ID of the decomposition. */
+        int ioproc_stride = 1;    /* Stride in the mpi rank between io tasks. */
+        int ioproc_start = 0;     /* Zero based rank of first processor to be used for I/O. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, ioproc_stride,
+                                       ioproc_start, PIO_REARR_BOX, &iosysid)))
+            return ret;
+
+        if ((ret = create_decomposition_reversed(TARGET_NTASKS, my_rank, iosysid, dim_len,
+                                                 PIO_REARR_NODE, &ioid)))
+            return ret;
+
+        if ((ret = check_node(ioid, TARGET_NTASKS, test_comm)))
+            return ret;
+
+        if ((ret = test_node(iosysid, ioid, num_flavors, flavor, my_rank, TARGET_NTASKS)))
+            return ret;
+
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            ERR(ret);
+
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            return ret;
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Tests for rearranger buffers packed by PIO, see
+ * PIOc_set_rearr_pack(), with the box and subset rearrangers.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_rearr_pack"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 4
+#define Y_DIM_LEN 4
+
+/* Number of vars written together. */
+#define NVARS 2
+
+/* Number of rearrangers tested. */
+#define NUM_REARRANGERS 2
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"x", "y"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+
+/* Write two vars, one at a time and together, reading them back each
+ * time. */
+int test_pack(int iosysid, int ioid, int rearranger, int num_flavors, int *flavor,
+              int my_rank, int ntasks)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM2];
+    int varid[NVARS];
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    int test_data[NVARS * arraylen];
+    int test_data_in[NVARS * arraylen];
+    io_desc_t *iodesc;
+    int ncid;
+    int ret;
+
+    for (int i = 0; i < NVARS * arraylen; i++)
+        test_data[i] = my_rank * 1000 + i;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_rearr_%d_iotype_%d.nc", TEST_NAME, rearranger, flavor[fmt]);
+
+        /* Create the file, dims and vars. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM2; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        for (int v = 0; v < NVARS; v++)
+        {
+            char var_name[PIO_MAX_NAME + 1];
+
+            sprintf(var_name, "var_%d", v);
+            if ((ret = PIOc_def_var(ncid, var_name, PIO_INT, NDIM2, dimids, &varid[v])))
+                ERR(ret);
+        }
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        /* Write one var, and read it back. */
+        if ((ret = PIOc_write_darray(ncid, varid[0], ioid, arraylen, test_data, NULL)))
+            ERR(ret);
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+        if ((ret = PIOc_read_darray(ncid, varid[0], ioid, arraylen, test_data_in)))
+            ERR(ret);
+        for (int i = 0; i < arraylen; i++)
+            if (test_data_in[i] != test_data[i])
+                ERR(ERR_WRONG);
+
+        /* Write both vars in one rearrangement, and read them back the
+         * same way. */
+        if ((ret = PIOc_write_darray_multi(ncid, varid, ioid, NVARS, arraylen, test_data,
+                                           NULL, NULL, false)))
+            ERR(ret);
+        if ((ret = PIOc_sync(ncid)))
+            ERR(ret);
+        memset(test_data_in, 0, sizeof(test_data_in));
+        if ((ret = PIOc_read_darray_multi(ncid, varid, ioid, NVARS, arraylen, test_data_in)))
+            ERR(ret);
+        for (int i = 0; i < NVARS * arraylen; i++)
+            if (test_data_in[i] != test_data[i])
+                ERR(ERR_WRONG);
+
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+    }
+
+    /* The packed rearrangements were set up. */
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+    if (!iodesc->pack_maxlen)
+        return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
+/* Run tests for rearranger buffers packed by PIO. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    int rearranger[NUM_REARRANGERS] = {PIO_REARR_BOX, PIO_REARR_SUBSET};
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid;                 /* The ID of the decomposition. */
+        int ioproc_stride = 1;    /* Stride in the mpi rank between io tasks. */
+        int ioproc_start = 0;     /* Zero based rank of first processor to be used for I/O. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        for (int r = 0; r < NUM_REARRANGERS; r++)
+        {
+            if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, ioproc_stride,
+                                           ioproc_start, rearranger[r], &iosysid)))
+                return ret;
+
+            /* Bad iosysid. */
+            if (PIOc_set_rearr_pack(iosysid + TEST_VAL_42, true) != PIO_EBADID)
+                ERR(ERR_WRONG);
+
+            /* Have PIO pack the buffers. */
+            if ((ret = PIOc_set_rearr_pack(iosysid, true)))
+                return ret;
+
+            if ((ret = create_decomposition_reversed(TARGET_NTASKS, my_rank, iosysid, dim_len,
+                                                     rearranger[r], &ioid)))
+                return ret;
+
+            if ((ret = test_pack(iosysid, ioid, rearranger[r], num_flavors, flavor, my_rank,
+                                 TARGET_NTASKS)))
+                return ret;
+
+            if ((ret = PIOc_freedecomp(iosysid, ioid)))
+                ERR(ret);
+
+            if ((ret = PIOc_free_iosystem(iosysid)))
+                return ret;
+        }
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
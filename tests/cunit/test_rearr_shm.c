@@ -0,0 +1,206 @@
+/*
+ * Tests for the shared memory rearranger comm type,
+ * PIO_REARR_COMM_SHM, with the subset rearranger.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_rearr_shm"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 4
+#define Y_DIM_LEN 4
+
+/* Number of times each var is written and read. */
+#define NUM_TIMES 3
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"x", "y"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+
+/* Check whether the shared memory window was used. All the tasks of
+ * this test are on one node, so it should have been. */
+int check_shm(int ioid)
+{
+    io_desc_t *iodesc;
+
+    if (!(iodesc = pio_get_iodesc_from_id(ioid)))
+        return ERR_WRONG;
+
+    if (iodesc->rearr_opts.comm_type != PIO_REARR_COMM_SHM || !iodesc->needssort)
+        return ERR_WRONG;
+    if (iodesc->shm_state != 1 || iodesc->shm_nvars < 1 || !iodesc->shm_base)
+        return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
+/* Write a var several times, with the different write functions,
+ * reading it back each time. */
+int test_shm(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank,
+             int ntasks)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM2];
+    int varid;
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    int test_data[arraylen];
+    int test_data_in[arraylen];
+    int ncid;
+    int ret;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        sprintf(filename, "%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create the file, dims and var. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM2; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM2, dimids, &varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(ncid)))
+            ERR(ret);
+
+        for (int t = 0; t < NUM_TIMES; t++)
+        {
+            int request;
+
+            for (int i = 0; i < arraylen; i++)
+                test_data[i] = my_rank * 1000 + t * 100 + i;
+
+            /* Write with each of the write functions. */
+            if (t == 0)
+            {
+                if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+                    ERR(ret);
+            }
+            else if (t == 1)
+            {
+                if ((ret = PIOc_write_darray_nocopy(ncid, varid, ioid, arraylen, test_data,
+                                                    NULL)))
+                    ERR(ret);
+                if ((ret = PIOc_write_darray_nocopy_wait(ncid)))
+                    ERR(ret);
+            }
+            else
+            {
+                if ((ret = PIOc_iwrite_darray(ncid, varid, ioid, arraylen, test_data, NULL,
+                                              &request)))
+                    ERR(ret);
+                if ((ret = PIOc_wait_darray(ncid, request)))
+                    ERR(ret);
+            }
+            if ((ret = PIOc_sync(ncid)))
+                ERR(ret);
+
+            /* Read it back, both ways. */
+            if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+                ERR(ret);
+            for (int i = 0; i < arraylen; i++)
+                if (test_data_in[i] != test_data[i])
+                    ERR(ERR_WRONG);
+
+            memset(test_data_in, 0, sizeof(test_data_in));
+            if ((ret = PIOc_iread_darray(ncid, varid, ioid, arraylen, test_data_in, &request)))
+                ERR(ret);
+            if ((ret = PIOc_wait_darray(ncid, request)))
+                ERR(ret);
+            for (int i = 0; i < arraylen; i++)
+                if (test_data_in[i] != test_data[i])
+                    ERR(ERR_WRONG);
+        }
+
+        if ((ret = PIOc_closefile(ncid)))
+            ERR(ret);
+
+        if ((ret = check_shm(ioid)))
+            return ret;
+    }
+
+    return PIO_NOERR;
+}
+
+/* Run tests for the shared memory rearranger comm type. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid;                 /* The ID of the decomposition. */
+        int ioproc_stride = 1;    /* Stride in the mpi rank between io tasks. */
+        int ioproc_start = 0;     /* Zero based rank of first processor to be used for I/O. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, ioproc_stride,
+                                       ioproc_start, PIO_REARR_SUBSET, &iosysid)))
+            return ret;
+
+        /* Use shared memory from compute to IO tasks. */
+        if ((ret = PIOc_set_rearr_opts(iosysid, PIO_REARR_COMM_SHM,
+                                       PIO_REARR_COMM_FC_2D_DISABLE, false, false,
+                                       PIO_REARR_COMM_UNLIMITED_PEND_REQ, false, false,
+                                       PIO_REARR_COMM_UNLIMITED_PEND_REQ)))
+            return ret;
+
+        if ((ret = create_decomposition_reversed(TARGET_NTASKS, my_rank, iosysid, dim_len,
+                                                 PIO_REARR_SUBSET, &ioid)))
+            return ret;
+
+        if ((ret = test_shm(iosysid, ioid, num_flavors, flavor, my_rank, TARGET_NTASKS)))
+            return ret;
+
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            ERR(ret);
+
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            return ret;
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <pio.h>
 #include <pio_tests.h>
 #include <pio_internal.h>
+#include <parallel_sort.h>
 
 /* The number of tasks this test should run on. */
 #define TARGET_NTASKS 4
@@ -111,7 +112,7 @@ int run_spmd_tests(MPI_Comm test_comm)
             }
 
             /* Run the swapm function. */
-            if ((ret = pio_swapm(sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
+            if ((ret = pio_swapm(NULL, sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
                                  rdispls, recvtypes, test_comm, &fc)))
                 return ret;
 
@@ -133,6 +134,74 @@ int run_spmd_tests(MPI_Comm test_comm)
     return 0;
 }
 
+/* Test pio_swapm_peers() by having each task exchange data only
+ * with the tasks before and after it, and itself. */
+int run_swapm_peers_tests(MPI_Comm test_comm)
+{
+#define MAX_PEERS 3
+    int my_rank;  /* 0-based rank in test_comm. */
+    int ntasks;   /* Number of tasks in test_comm. */
+    int peers[MAX_PEERS];
+    int npeers = 0;
+    int sbuf;
+    int rbuf[MAX_PEERS];
+    int sendcounts[MAX_PEERS], recvcounts[MAX_PEERS];
+    int sdispls[MAX_PEERS], rdispls[MAX_PEERS];
+    MPI_Datatype sendtypes[MAX_PEERS], recvtypes[MAX_PEERS];
+    int mpierr;   /* Return value from MPI calls. */
+    int ret;      /* Return value. */
+
+    /* Learn rank and size. */
+    if ((mpierr = MPI_Comm_size(test_comm, &ntasks)))
+        MPIERR(mpierr);
+    if ((mpierr = MPI_Comm_rank(test_comm, &my_rank)))
+        MPIERR(mpierr);
+
+    /* The peers, in no particular order, each appearing once. */
+    peers[npeers++] = my_rank;
+    if (ntasks > 1)
+        peers[npeers++] = (my_rank + 1) % ntasks;
+    if (ntasks > 2)
+        peers[npeers++] = (my_rank + ntasks - 1) % ntasks;
+
+    sbuf = my_rank;
+    for (int p = 0; p < npeers; p++)
+    {
+        sendcounts[p] = 1;
+        sdispls[p] = 0;
+        sendtypes[p] = MPI_INT;
+        recvcounts[p] = 1;
+        rdispls[p] = p * sizeof(int);
+        recvtypes[p] = MPI_INT;
+    }
+
+    /* Try Alltoallw, and the pairwise exchange with different flow
+     * control. */
+    for (int itest = 0; itest < NUM_TEST_CASES; itest++)
+    {
+        rearr_comm_fc_opt_t fc = {itest % 2, itest > 2, PIO_REARR_COMM_UNLIMITED_PEND_REQ};
+
+        if (itest == 0)
+            fc.max_pend_req = 0;
+        else if (itest == 4)
+            fc.max_pend_req = 1;
+
+        for (int p = 0; p < npeers; p++)
+            rbuf[p] = -999;
+
+        if ((ret = pio_swapm_peers(NULL, &sbuf, sendcounts, sdispls, sendtypes, rbuf, recvcounts,
+                                   rdispls, recvtypes, npeers, peers, test_comm, &fc)))
+            return ret;
+
+        /* Each peer sent us its rank. */
+        for (int p = 0; p < npeers; p++)
+            if (rbuf[p] != peers[p])
+                return ERR_WRONG;
+    }
+
+    return 0;
+}
+
 /* Test some of the functions in the file pioc_sc.c.
  *
  * @param test_comm the MPI communicator that the test code is running on.
@@ -488,6 +557,55 @@ int test_varlists3()
     return 0;
 }
 
+/**
+ * Test finding the vars of a file through its index.
+ *
+ * @author Ed Hartnett
+ */
+int test_varlists_index()
+{
+    file_desc_t file = {0};
+    var_desc_t *var_desc;
+    var_desc_t *var_desc2;
+    int ret;
+
+    /* Add some vars. */
+    for (int v = 0; v < 3; v++)
+        if ((ret = add_to_varlist(v, v % 2, PIO_INT, 4, MPI_INT, 4, v, &file.varlist)))
+            return ret;
+    file.nvars = 3;
+
+    /* Find them, which adds them to the index. */
+    for (int v = 0; v < 3; v++)
+    {
+        if ((ret = get_file_var_desc(&file, v, &var_desc)))
+            return ret;
+        if ((ret = get_var_desc(v, &file.varlist, &var_desc2)))
+            return ret;
+        if (var_desc != var_desc2 || var_desc->varid != v || file.var_index_len < 3 ||
+            file.var_index[v] != var_desc)
+            return ERR_WRONG;
+    }
+    if ((ret = get_file_var_desc(&file, 1, &var_desc)))
+        return ret;
+    if (var_desc->varid != 1 || var_desc->rec_var != 1)
+        return ERR_WRONG;
+
+    /* Vars which are not there. */
+    if (get_file_var_desc(&file, 3, &var_desc) != PIO_ENOTVAR)
+        return ERR_WRONG;
+    if (get_file_var_desc(&file, -1, &var_desc) != PIO_ENOTVAR)
+        return ERR_WRONG;
+
+    /* Free them. */
+    while (file.varlist)
+        if ((ret = delete_var_desc(file.varlist->varid, &file.varlist)))
+            return ret;
+    free(file.var_index);
+
+    return 0;
+}
+
 /* Test the ceil2() and pair() functions. */
 int test_ceil2_pair()
 {
@@ -614,6 +732,59 @@ int test_misc()
     return 0;
 }
 
+/* Test the log levels of the parts of the library,
+ * PIOc_set_log_level_subsys(). */
+int test_log_levels()
+{
+    /* These should not work. */
+    if (PIOc_set_log_level_subsys(-1, 0) != PIO_EINVAL)
+        return ERR_WRONG;
+    if (PIOc_set_log_level_subsys(PIO_LOG_NUM_SUBSYS, 0) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    /* Log only the rearrangers. */
+    if (PIOc_set_log_level(-1))
+        return ERR_WRONG;
+    if (PIOc_set_log_level_subsys(PIO_LOG_REARR, 2))
+        return ERR_WRONG;
+
+#if PIO_ENABLE_LOGGING
+    int nlogged = 0;
+
+    for (int s = 0; s < PIO_LOG_NUM_SUBSYS; s++)
+        if (pio_log_levels[s] != (s == PIO_LOG_REARR ? 2 : -1))
+            return ERR_WRONG;
+
+    /* This file logs as PIO_LOG_GENERAL, which is off, so the
+     * arguments of its messages are not evaluated. */
+    if (PLOG_ON(0))
+        return ERR_WRONG;
+    PLOG((1, "test_log_levels nlogged %d", nlogged++));
+    if (nlogged)
+        return ERR_WRONG;
+
+    /* Turning it on logs the message. */
+    if (PIOc_set_log_level_subsys(PIO_LOG_GENERAL, 1))
+        return ERR_WRONG;
+    if (!PLOG_ON(1) || PLOG_ON(2))
+        return ERR_WRONG;
+    PLOG((1, "test_log_levels nlogged %d", nlogged++));
+    if (nlogged != 1)
+        return ERR_WRONG;
+#endif /* PIO_ENABLE_LOGGING */
+
+    /* Set all parts back. */
+    if (PIOc_set_log_level(-1))
+        return ERR_WRONG;
+#if PIO_ENABLE_LOGGING
+    for (int s = 0; s < PIO_LOG_NUM_SUBSYS; s++)
+        if (pio_log_levels[s] != -1)
+            return ERR_WRONG;
+#endif /* PIO_ENABLE_LOGGING */
+
+    return 0;
+}
+
 /* This test code was recovered from main() in pioc_sc.c. */
 int test_CalcStartandCount()
 {
@@ -665,6 +836,232 @@ int test_CalcStartandCount()
     return 0;
 }
 
+/* Test the stripe aligned partition, CalcStartandCount_stripe(). */
+int test_CalcStartandCount_stripe()
+{
+#define STRIPE_UNIT 65536
+#define STRIPE_FACTOR 8
+#define STRIPE_IO_PROCS 12
+    int ndims = 2;
+    int gdims[2] = {2048, 2048};
+    int gdims1[2] = {1, 100000};
+    PIO_Offset slab = 2048 * sizeof(double);
+    PIO_Offset start[ndims], kount[ndims];
+    PIO_Offset start1[ndims], kount1[ndims];
+    PIO_Offset next = 0;
+    int numaiotasks, numaiotasks1;
+    int ret;
+
+    /* Each IO task gets whole stripes, and 8 tasks are used, one
+     * for each stripe. */
+    for (int iorank = 0; iorank < STRIPE_IO_PROCS; iorank++)
+    {
+        if ((ret = CalcStartandCount_stripe(PIO_DOUBLE, ndims, gdims, STRIPE_IO_PROCS, iorank,
+                                            STRIPE_UNIT, STRIPE_FACTOR, start, kount,
+                                            &numaiotasks)))
+            return ret;
+        if (numaiotasks != STRIPE_FACTOR)
+            return ERR_WRONG;
+        if (iorank >= numaiotasks)
+        {
+            if (kount[0] || kount[1])
+                return ERR_WRONG;
+            continue;
+        }
+        if (start[0] != next || (start[0] * slab) % STRIPE_UNIT || start[1] ||
+            kount[1] != gdims[1] || !kount[0])
+            return ERR_WRONG;
+        next += kount[0];
+    }
+    if (next != gdims[0])
+        return ERR_WRONG;
+
+    /* Here there is only one aligned chunk, so the usual partition
+     * is kept. */
+    for (int iorank = 0; iorank < STRIPE_IO_PROCS; iorank++)
+    {
+        if ((ret = CalcStartandCount_stripe(PIO_DOUBLE, ndims, gdims1, STRIPE_IO_PROCS, iorank,
+                                            STRIPE_UNIT, 0, start, kount, &numaiotasks)))
+            return ret;
+        if ((ret = CalcStartandCount(PIO_DOUBLE, ndims, gdims1, STRIPE_IO_PROCS, iorank,
+                                     start1, kount1, &numaiotasks1)))
+            return ret;
+        if (numaiotasks != numaiotasks1)
+            return ERR_WRONG;
+        for (int d = 0; d < ndims; d++)
+            if (start[d] != start1[d] || kount[d] != kount1[d])
+                return ERR_WRONG;
+    }
+
+    return 0;
+}
+
+/* Test the slab and balanced IO partitions, CalcStartandCount_slab()
+ * and CalcStartandCount_bytes(). */
+int test_CalcStartandCount_parts()
+{
+#define PART_IO_PROCS 12
+    int ndims = 3;
+    int gdims[3] = {5, 64, 100};
+    PIO_Offset start[ndims], kount[ndims];
+    long int total = 0;
+    int numaiotasks;
+    int ret;
+
+    /* Slabs of the slowest dimension: no more IO tasks than it is
+     * long, each with a contiguous part. */
+    for (int iorank = 0; iorank < PART_IO_PROCS; iorank++)
+    {
+        if ((ret = CalcStartandCount_slab(PIO_DOUBLE, ndims, gdims, PART_IO_PROCS, iorank,
+                                          start, kount, &numaiotasks)))
+            return ret;
+        if (numaiotasks < 1 || numaiotasks > gdims[0])
+            return ERR_WRONG;
+        if (iorank < numaiotasks && (start[1] || start[2] || kount[1] != gdims[1] ||
+                                     kount[2] != gdims[2]))
+            return ERR_WRONG;
+        total += kount[0] * kount[1] * kount[2];
+    }
+    if (total != gdims[0] * gdims[1] * gdims[2])
+        return ERR_WRONG;
+
+    /* Balanced bytes: every IO task is used, though there is only
+     * 256 KB of data. */
+    total = 0;
+    for (int iorank = 0; iorank < PART_IO_PROCS; iorank++)
+    {
+        if ((ret = CalcStartandCount_bytes(PIO_DOUBLE, ndims, gdims, PART_IO_PROCS, iorank,
+                                           start, kount, &numaiotasks)))
+            return ret;
+        if (numaiotasks != PART_IO_PROCS || !kount[0] || !kount[1] || !kount[2])
+            return ERR_WRONG;
+        total += kount[0] * kount[1] * kount[2];
+    }
+    if (total != gdims[0] * gdims[1] * gdims[2])
+        return ERR_WRONG;
+
+    return 0;
+}
+
+/* Test the parallel sort, parallel_sort(), with a map long enough
+ * for the radix sort, including negative and large values. */
+int test_parallel_sort(MPI_Comm test_comm)
+{
+#define PS_LEN 1000
+    PIO_Offset map[PS_LEN];
+    PIO_Offset ends[2], *all_ends;
+    long long sum = 0, sorted_sum = 0, total, sorted_total;
+    int my_rank, ntasks;
+    CVector sorted;
+    int mpierr;
+    int ret;
+
+    if ((mpierr = MPI_Comm_rank(test_comm, &my_rank)))
+        MPIERR(mpierr);
+    if ((mpierr = MPI_Comm_size(test_comm, &ntasks)))
+        MPIERR(mpierr);
+
+    for (int i = 0; i < PS_LEN; i++)
+    {
+        map[i] = ((PIO_Offset)(i * ntasks + my_rank) * 7919) % (PS_LEN * ntasks);
+        if (i % 3 == 0)
+            map[i] = -map[i];
+        if (i % 7 == 0)
+            map[i] += (PIO_Offset)1 << 40;
+        sum += map[i];
+    }
+
+    sorted = parallel_sort(test_comm, (CVector){map, PS_LEN}, &ret);
+    if (ret)
+        return ret;
+
+    /* Sorted on each task. */
+    for (size_t i = 1; i < sorted.N; i++)
+        if (sorted.data[i] < sorted.data[i - 1])
+            return ERR_WRONG;
+    for (size_t i = 0; i < sorted.N; i++)
+        sorted_sum += sorted.data[i];
+
+    /* Nothing lost. */
+    if ((mpierr = MPI_Allreduce(&sum, &total, 1, MPI_LONG_LONG, MPI_SUM, test_comm)))
+        MPIERR(mpierr);
+    if ((mpierr = MPI_Allreduce(&sorted_sum, &sorted_total, 1, MPI_LONG_LONG, MPI_SUM,
+                                test_comm)))
+        MPIERR(mpierr);
+    if (total != sorted_total)
+        return ERR_WRONG;
+
+    /* Sorted across the tasks. */
+    ends[0] = sorted.N ? sorted.data[0] : LLONG_MAX;
+    ends[1] = sorted.N ? sorted.data[sorted.N - 1] : LLONG_MIN;
+    if (!(all_ends = malloc(2 * ntasks * sizeof(PIO_Offset))))
+        return PIO_ENOMEM;
+    if ((mpierr = MPI_Allgather(ends, 2, MPI_OFFSET, all_ends, 2, MPI_OFFSET, test_comm)))
+        MPIERR(mpierr);
+    for (int t = 1, last = 0; t < ntasks; t++)
+    {
+        if (all_ends[2 * t] == LLONG_MAX)
+            continue;
+        if (all_ends[2 * t] < all_ends[2 * last + 1])
+            return ERR_WRONG;
+        last = t;
+    }
+    free(all_ends);
+    free(sorted.data);
+
+    return 0;
+}
+
+/* Test the parallel check for repeated values, run_unique_check(). */
+int test_unique_check(MPI_Comm test_comm)
+{
+#define UC_LEN 200
+    PIO_Offset map[UC_LEN], map_copy[UC_LEN];
+    int my_rank, ntasks;
+    bool has_dups;
+    int mpierr;
+    int ret;
+
+    if ((mpierr = MPI_Comm_rank(test_comm, &my_rank)))
+        MPIERR(mpierr);
+    if ((mpierr = MPI_Comm_size(test_comm, &ntasks)))
+        MPIERR(mpierr);
+
+    /* A scrambled map with no repeats, with holes that repeat. */
+    for (int i = 0; i < UC_LEN; i++)
+        map[i] = (i % 10 == 9) ? 0 : ((PIO_Offset)(i * ntasks + my_rank) * 7919) %
+            (UC_LEN * ntasks) + 1;
+    memcpy(map_copy, map, sizeof(map));
+    if ((ret = run_unique_check(test_comm, UC_LEN, map, &has_dups)))
+        return ret;
+    if (has_dups)
+        return ERR_WRONG;
+
+    /* The map is not changed. */
+    for (int i = 0; i < UC_LEN; i++)
+        if (map[i] != map_copy[i])
+            return ERR_WRONG;
+
+    /* A value repeated on two tasks is found. */
+    if (my_rank == ntasks - 1)
+        map[UC_LEN / 2] = 1;
+    if (my_rank == 0)
+        map[0] = 1;
+    if ((ret = run_unique_check(test_comm, UC_LEN, map, &has_dups)))
+        return ret;
+    if (!has_dups)
+        return ERR_WRONG;
+
+    /* Some tasks may have no map. Leaving out the odd tasks leaves
+     * out the repeat on the last task. */
+    if ((ret = run_unique_check(test_comm, my_rank % 2 ? 0 : UC_LEN, map, &has_dups)))
+        return ret;
+    if (has_dups != (ntasks % 2 == 1))
+        return ERR_WRONG;
+
+    return 0;
+}
+
 /* Test the GCDblocksize() function. */
 int run_GCDblocksize_tests(MPI_Comm test_comm)
 {
@@ -753,9 +1150,24 @@ int main(int argc, char **argv)
         if ((ret = run_spmd_tests(test_comm)))
             return ret;
 
+        if ((ret = run_swapm_peers_tests(test_comm)))
+            return ret;
+
         if ((ret = test_CalcStartandCount()))
             return ret;
 
+        if ((ret = test_CalcStartandCount_stripe()))
+            return ret;
+
+        if ((ret = test_CalcStartandCount_parts()))
+            return ret;
+
+        if ((ret = test_parallel_sort(test_comm)))
+            return ret;
+
+        if ((ret = test_unique_check(test_comm)))
+            return ret;
+
         if ((ret = test_lists()))
             return ret;
 
@@ -771,6 +1183,9 @@ int main(int argc, char **argv)
         if ((ret = test_varlists3()))
             return ret;
 
+        if ((ret = test_varlists_index()))
+            return ret;
+
         if ((ret = test_ceil2_pair()))
             return ret;
 
@@ -780,6 +1195,9 @@ int main(int argc, char **argv)
         if ((ret = test_misc()))
             return ret;
 
+        if ((ret = test_log_levels()))
+            return ret;
+
         /* Finalize PIO system. */
         if ((ret = PIOc_free_iosystem(iosysid)))
             return ret;
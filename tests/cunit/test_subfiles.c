@@ -0,0 +1,252 @@
+/*
+ * Tests for writing and reading classic netCDF files as subfiles,
+ * PIOc_set_subfiles().
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_subfiles"
+
+/* Number of subfiles. */
+#define NUM_SUBFILES 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 4
+#define Y_DIM_LEN 4
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"x", "y"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {X_DIM_LEN, Y_DIM_LEN};
+
+/* Create a decomposition with a block of rows on each task. */
+int create_decomposition(int ntasks, int my_rank, int iosysid, int *ioid)
+{
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    PIO_Offset compdof[X_DIM_LEN * Y_DIM_LEN];
+    int ret;
+
+    /* Describe the decomposition. This is a 1-based array, so add 1! */
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i + 1;
+
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, NDIM2, dim_len, elements_per_pe,
+                               compdof, ioid, NULL, NULL, NULL)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Write a subfiled file, check the files on disk, and read it
+ * back. */
+int test_subfiles(int iosysid, int ioid, int my_rank, int ntasks)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int iotype = PIO_IOTYPE_NETCDF;
+    int dimids[NDIM2];
+    int varid;
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / ntasks;
+    int test_data[arraylen];
+    int test_data_in[arraylen];
+    int att_val = TEST_VAL_42;
+    int att_in;
+    int ncid;
+    int ret;
+
+    sprintf(filename, "%s.nc", TEST_NAME);
+    for (int i = 0; i < arraylen; i++)
+        test_data[i] = my_rank * 100 + i;
+
+    /* Bad inputs. */
+    if (PIOc_set_subfiles(iosysid + TEST_VAL_42, NUM_SUBFILES) != PIO_EBADID)
+        return ERR_WRONG;
+    if (PIOc_set_subfiles(iosysid, -1) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    if ((ret = PIOc_set_subfiles(iosysid, NUM_SUBFILES)))
+        return ret;
+
+    /* Create the file, with an attribute, and write the data. */
+    if ((ret = PIOc_createfile(iosysid, &ncid, &iotype, filename, PIO_CLOBBER)))
+        return ret;
+    for (int d = 0; d < NDIM2; d++)
+        if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+            return ret;
+    if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM2, dimids, &varid)))
+        return ret;
+    if ((ret = PIOc_put_att_int(ncid, NC_GLOBAL, "att", PIO_INT, 1, &att_val)))
+        return ret;
+    if ((ret = PIOc_enddef(ncid)))
+        return ret;
+    if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, test_data, NULL)))
+        return ret;
+    if ((ret = PIOc_closefile(ncid)))
+        return ret;
+
+    /* Later files are ordinary files again. */
+    if ((ret = PIOc_set_subfiles(iosysid, 0)))
+        return ret;
+
+    /* The index file has the number of subfiles, and each subfile
+     * has the metadata. */
+    if (!my_rank)
+    {
+        char subname[PIO_MAX_NAME + 16];
+        int nc_ncid;
+        int num_subfiles;
+
+        if ((ret = nc_open(filename, NC_NOWRITE, &nc_ncid)))
+            return ret;
+        if ((ret = nc_get_att_int(nc_ncid, NC_GLOBAL, PIO_SUBFILES_ATT, &num_subfiles)))
+            return ret;
+        if (num_subfiles != NUM_SUBFILES)
+            return ERR_WRONG;
+        if ((ret = nc_close(nc_ncid)))
+            return ret;
+
+        for (int s = 0; s < NUM_SUBFILES; s++)
+        {
+            sprintf(subname, "%s.%d", filename, s);
+            if ((ret = nc_open(subname, NC_NOWRITE, &nc_ncid)))
+                return ret;
+            if ((ret = nc_get_att_int(nc_ncid, NC_GLOBAL, "att", &att_in)))
+                return ret;
+            if (att_in != att_val)
+                return ERR_WRONG;
+            if ((ret = nc_close(nc_ncid)))
+                return ret;
+        }
+    }
+
+    /* Read it back through the same decomposition. */
+    if ((ret = PIOc_openfile(iosysid, &ncid, &iotype, filename, PIO_NOWRITE)))
+        return ret;
+    if ((ret = PIOc_get_att_int(ncid, NC_GLOBAL, "att", &att_in)))
+        return ret;
+    if (att_in != att_val)
+        return ERR_WRONG;
+    if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, test_data_in)))
+        return ret;
+    for (int i = 0; i < arraylen; i++)
+        if (test_data_in[i] != test_data[i])
+            return ERR_WRONG;
+
+    /* The get functions see the data of all subfiles. */
+    {
+        int data_in[X_DIM_LEN * Y_DIM_LEN];
+
+        if ((ret = PIOc_get_var_int(ncid, varid, data_in)))
+            return ret;
+        for (int i = 0; i < X_DIM_LEN * Y_DIM_LEN; i++)
+            if (data_in[i] != (i / arraylen) * 100 + i % arraylen)
+                return ERR_WRONG;
+    }
+    if ((ret = PIOc_closefile(ncid)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* A subfiled file can't be opened with a different number of IO
+ * tasks. Deleting it deletes the subfiles. */
+int test_subfiles_iotasks(MPI_Comm test_comm, int my_rank)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int iotype = PIO_IOTYPE_NETCDF;
+    int iosysid;
+    int ncid;
+    int ret;
+
+    sprintf(filename, "%s.nc", TEST_NAME);
+
+    if ((ret = PIOc_Init_Intracomm(test_comm, 1, 1, 0, PIO_REARR_BOX, &iosysid)))
+        return ret;
+    if (PIOc_openfile(iosysid, &ncid, &iotype, filename, PIO_NOWRITE) != PIO_EINVAL)
+        return ERR_WRONG;
+
+    if ((ret = PIOc_deletefile(iosysid, filename)))
+        return ret;
+    if (!my_rank)
+    {
+        char subname[PIO_MAX_NAME + 16];
+        int nc_ncid;
+
+        for (int s = 0; s < NUM_SUBFILES; s++)
+        {
+            sprintf(subname, "%s.%d", filename, s);
+            if (nc_open(subname, NC_NOWRITE, &nc_ncid) == NC_NOERR)
+                return ERR_WRONG;
+        }
+    }
+
+    if ((ret = PIOc_free_iosystem(iosysid)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Run tests for subfiles. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid;                 /* The ID of the decomposition. */
+
+        /* Every task does IO. */
+        if ((ret = PIOc_Init_Intracomm(test_comm, TARGET_NTASKS, 1, 0, PIO_REARR_BOX,
+                                       &iosysid)))
+            ERR(ret);
+
+        if ((ret = create_decomposition(TARGET_NTASKS, my_rank, iosysid, &ioid)))
+            ERR(ret);
+
+        if ((ret = test_subfiles(iosysid, ioid, my_rank, TARGET_NTASKS)))
+            ERR(ret);
+
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            ERR(ret);
+
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+
+        if ((ret = test_subfiles_iotasks(test_comm, my_rank)))
+            ERR(ret);
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
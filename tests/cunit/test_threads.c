@@ -0,0 +1,221 @@
+/*
+ * Tests for threads using different IO systems at the same time, in
+ * a build with thread-safe tables (PIO_ENABLE_THREADS). Each thread
+ * writes and reads back darrays of its own pnetcdf file, through its
+ * own IO system and decomposition.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_threads"
+
+/* Number of processors that will do IO in each IO system. */
+#define NUM_IO_PROCS 2
+
+/* The number of threads, each with its own IO system. */
+#define NUM_THREADS 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data along each dimension. */
+#define X_DIM_LEN 4
+#define Y_DIM_LEN 4
+
+/* The number of records written by each thread. */
+#define NUM_RECS 8
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"time", "x"};
+
+#if PIO_THREADS
+#include <pthread.h>
+
+/* What each thread writes, and its result. */
+typedef struct thread_arg
+{
+    int ncid;
+    int varid;
+    int ioid;
+    int my_rank;
+    int thread;
+    int ret;
+} thread_arg;
+
+/* Write the records of the file of a thread, and read them back. */
+void *
+write_read(void *varg)
+{
+    thread_arg *arg = varg;
+    PIO_Offset arraylen = X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS;
+    int data[arraylen];
+    int data_in[arraylen];
+
+    arg->ret = PIO_NOERR;
+    for (int r = 0; !arg->ret && r < NUM_RECS; r++)
+    {
+        for (int i = 0; i < arraylen; i++)
+            data[i] = arg->thread * 10000 + r * 100 + arg->my_rank * 10 + i;
+        if (!(arg->ret = PIOc_setframe(arg->ncid, arg->varid, r)))
+            arg->ret = PIOc_write_darray(arg->ncid, arg->varid, arg->ioid, arraylen, data, NULL);
+    }
+    if (!arg->ret)
+        arg->ret = PIOc_sync(arg->ncid);
+
+    for (int r = 0; !arg->ret && r < NUM_RECS; r++)
+    {
+        if (!(arg->ret = PIOc_setframe(arg->ncid, arg->varid, r)))
+            arg->ret = PIOc_read_darray(arg->ncid, arg->varid, arg->ioid, arraylen, data_in);
+        for (int i = 0; !arg->ret && i < arraylen; i++)
+            if (data_in[i] != arg->thread * 10000 + r * 100 + arg->my_rank * 10 + i)
+                arg->ret = ERR_WRONG;
+    }
+
+    return NULL;
+}
+
+/* Write and read a file in each thread at the same time, each
+ * through its own IO system. */
+int test_threads(MPI_Comm test_comm, int my_rank)
+{
+    int dim_len[NDIM2] = {NC_UNLIMITED, X_DIM_LEN * Y_DIM_LEN};
+    PIO_Offset elements_per_pe = X_DIM_LEN * Y_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset compdof[elements_per_pe];
+    int iotype = PIO_IOTYPE_PNETCDF;
+    int iosysid[NUM_THREADS];
+    pthread_t tid[NUM_THREADS];
+    thread_arg arg[NUM_THREADS];
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i + 1;
+
+    /* Create the IO systems, decompositions and files on this
+     * thread, since that allocates shared IDs. The IO systems have
+     * different IO tasks, and their own communicators. */
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        char filename[PIO_MAX_NAME + 1];
+        int dimids[NDIM2];
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, 2, t, PIO_REARR_BOX,
+                                       &iosysid[t])))
+            ERR(ret);
+        if ((ret = PIOc_InitDecomp(iosysid[t], PIO_INT, 1, &dim_len[1], elements_per_pe,
+                                   compdof, &arg[t].ioid, NULL, NULL, NULL)))
+            ERR(ret);
+        sprintf(filename, "%s_%d.nc", TEST_NAME, t);
+        if ((ret = PIOc_createfile(iosysid[t], &arg[t].ncid, &iotype, filename, PIO_CLOBBER)))
+            ERR(ret);
+        for (int d = 0; d < NDIM2; d++)
+            if ((ret = PIOc_def_dim(arg[t].ncid, dim_name[d], (PIO_Offset)dim_len[d],
+                                    &dimids[d])))
+                ERR(ret);
+        if ((ret = PIOc_def_var(arg[t].ncid, "data", PIO_INT, NDIM2, dimids, &arg[t].varid)))
+            ERR(ret);
+        if ((ret = PIOc_enddef(arg[t].ncid)))
+            ERR(ret);
+        arg[t].my_rank = my_rank;
+        arg[t].thread = t;
+    }
+
+    /* Write and read all files at the same time. */
+    for (int t = 0; t < NUM_THREADS; t++)
+        if (pthread_create(&tid[t], NULL, write_read, &arg[t]))
+            ERR(ERR_AWFUL);
+    for (int t = 0; t < NUM_THREADS; t++)
+        if (pthread_join(tid[t], NULL))
+            ERR(ERR_AWFUL);
+    for (int t = 0; t < NUM_THREADS; t++)
+        if (arg[t].ret)
+            ERR(arg[t].ret);
+
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        if ((ret = PIOc_closefile(arg[t].ncid)))
+            ERR(ret);
+        if ((ret = PIOc_freedecomp(iosysid[t], arg[t].ioid)))
+            ERR(ret);
+        if ((ret = PIOc_free_iosystem(iosysid[t])))
+            ERR(ret);
+    }
+
+    return PIO_NOERR;
+}
+#endif /* PIO_THREADS */
+
+/* Run tests of threads. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int provided;            /* The thread support of MPI. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize MPI with threads. */
+    if ((ret = MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided)))
+        MPIERR(ret);
+    if ((ret = MPI_Comm_rank(MPI_COMM_WORLD, &my_rank)))
+        MPIERR(ret);
+    if ((ret = MPI_Comm_size(MPI_COMM_WORLD, &ntasks)))
+        MPIERR(ret);
+    if (ntasks < MIN_NTASKS)
+    {
+        fprintf(stderr, "ERROR: Number of processors must be at least %d for this test!\n",
+                MIN_NTASKS);
+        return ERR_AWFUL;
+    }
+    if ((ret = MPI_Comm_split(MPI_COMM_WORLD, my_rank < TARGET_NTASKS, my_rank, &test_comm)))
+        MPIERR(ret);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+#if PIO_THREADS
+        int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+        int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+        bool have_pnetcdf = false;
+
+        /* Figure out iotypes. Only pnetcdf can be used by threads;
+         * the netCDF library is not thread-safe. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+        for (int fmt = 0; fmt < num_flavors; fmt++)
+            if (flavor[fmt] == PIO_IOTYPE_PNETCDF)
+                have_pnetcdf = true;
+
+        if (provided == MPI_THREAD_MULTIPLE && have_pnetcdf)
+        {
+            if ((ret = test_threads(test_comm, my_rank)))
+                return ret;
+        }
+        else if (!my_rank)
+            printf("%s skipped: MPI_THREAD_MULTIPLE or pnetcdf is not available\n", TEST_NAME);
+#else
+        if (!my_rank)
+            printf("%s skipped: PIO was built without PIO_ENABLE_THREADS\n", TEST_NAME);
+#endif /* PIO_THREADS */
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * Tests for the timers of the IO systems, PIOc_set_timing(), and the
+ * trace of the library calls, PIOc_set_trace(). Two IO systems trace
+ * at the same time. The trace of the first is written when it is
+ * freed, and the trace of the second, which has the events of both,
+ * when it is turned off. Each trace file is read back and checked
+ * line by line.
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_trace"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The number of IO systems traced at the same time. */
+#define NUM_IOSYS 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data. */
+#define X_DIM_LEN 16
+
+/* The number of records written. */
+#define NUM_RECS 3
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"time", "x"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {NC_UNLIMITED, X_DIM_LEN};
+
+/* Write a file of NUM_RECS records of a darray. The timers of the IO
+ * system must be on. */
+int write_file(int iosysid, int iotype, const char *filename, int my_rank)
+{
+    PIO_Offset elements_per_pe = X_DIM_LEN / TARGET_NTASKS;
+    PIO_Offset compdof[X_DIM_LEN / TARGET_NTASKS];
+    int data[X_DIM_LEN / TARGET_NTASKS];
+    int ncid, varid, ioid;
+    int dimids[NDIM2];
+    PIO_Offset count, count_in;
+    int ret;
+
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i + 1;
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, 1, &dim_len[1], elements_per_pe,
+                               compdof, &ioid, NULL, NULL, NULL)))
+        return ret;
+
+    if ((ret = PIOc_createfile(iosysid, &ncid, &iotype, filename, PIO_CLOBBER)))
+        return ret;
+    for (int d = 0; d < NDIM2; d++)
+        if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+            return ret;
+    if ((ret = PIOc_def_var(ncid, "data", PIO_INT, NDIM2, dimids, &varid)))
+        return ret;
+    if ((ret = PIOc_enddef(ncid)))
+        return ret;
+
+    /* A failing call stops its timer, so it is counted. */
+    if ((ret = PIOc_get_timing(iosysid, "PIOc_write_darray_multi", NULL, &count)))
+        return ret;
+    if (PIOc_write_darray_multi(ncid, &varid, ioid, 0, elements_per_pe, data, NULL, NULL,
+                                false) != PIO_EINVAL)
+        return ERR_WRONG;
+    if ((ret = PIOc_get_timing(iosysid, "PIOc_write_darray_multi", NULL, &count_in)))
+        return ret;
+    if (count_in != count + 1)
+        return ERR_WRONG;
+
+    for (int r = 0; r < NUM_RECS; r++)
+    {
+        for (int i = 0; i < elements_per_pe; i++)
+            data[i] = r * 100 + (int)compdof[i];
+        if ((ret = PIOc_setframe(ncid, varid, r)))
+            return ret;
+        if ((ret = PIOc_write_darray(ncid, varid, ioid, elements_per_pe, data, NULL)))
+            return ret;
+    }
+    if ((ret = PIOc_closefile(ncid)))
+        return ret;
+    if ((ret = PIOc_freedecomp(iosysid, ioid)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Check every line of a trace file of ntasks tasks. Each task must
+ * have its process name and some events. nevents gets the number of
+ * events of the named call on each task. */
+int check_trace(const char *filename, int ntasks, const char *call, int *nevents)
+{
+    FILE *fp;
+    char line[PIO_MAX_NAME * 2 + 1];
+    int task = -1;
+    int total = 0;
+    int closed = 0;
+    int ret = PIO_NOERR;
+
+    for (int t = 0; t < ntasks; t++)
+        nevents[t] = 0;
+
+    if (!(fp = fopen(filename, "r")))
+        return ERR_WRONG;
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, "{\"traceEvents\":[\n"))
+        ret = ERR_WRONG;
+    while (!ret && fgets(line, sizeof(line), fp))
+    {
+        char name[PIO_MAX_NAME + 1];
+        int pid, pid2;
+        double ts, dur;
+
+        /* Nothing follows the end of the events. */
+        if (closed)
+            ret = ERR_WRONG;
+        else if (!strcmp(line, "],\"displayTimeUnit\":\"ms\"}\n"))
+            closed = 1;
+
+        /* The process name starts the events of each task in turn. */
+        else if (sscanf(line, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                        "\"args\":{\"name\":\"task %d\"}}", &pid, &pid2) == 2)
+        {
+            if (pid != task + 1 || pid2 != pid)
+                ret = ERR_WRONG;
+            task = pid;
+        }
+        else if (sscanf(line, "{\"name\":\"%[^\"]\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,"
+                        "\"ts\":%lf,\"dur\":%lf}", name, &pid, &ts, &dur) == 4)
+        {
+            if (pid != task || ts < 0 || dur < 0)
+                ret = ERR_WRONG;
+            else if (!strcmp(name, call))
+                nevents[task]++;
+            total++;
+        }
+        else
+            ret = ERR_WRONG;
+    }
+    fclose(fp);
+    if (ret)
+        return ret;
+
+    if (!closed || task != ntasks - 1 || !total)
+        return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
+/* Run tests of the trace. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid[NUM_IOSYS];
+        char trace_file[NUM_IOSYS][PIO_MAX_NAME + 1];
+        char filename[PIO_MAX_NAME + 1];
+        double time;
+        PIO_Offset count;
+        int nmulti[TARGET_NTASKS], nclose[TARGET_NTASKS];
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        for (int s = 0; s < NUM_IOSYS; s++)
+            if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, 1, s, PIO_REARR_BOX,
+                                           &iosysid[s])))
+                ERR(ret);
+
+        /* Check bad IDs and names. */
+        if (PIOc_set_timing(iosysid[0] + TEST_VAL_42, true) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if (PIOc_reset_timing(iosysid[0] + TEST_VAL_42) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if (PIOc_get_timing(iosysid[0] + TEST_VAL_42, "PIOc_write_darray", &time,
+                            &count) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        if (PIOc_get_timing(iosysid[0], "PIO:no_such_timer", &time, &count) != PIO_EINVAL)
+            ERR(ERR_WRONG);
+
+        /* Each IO system has its own timers. */
+        if ((ret = PIOc_set_timing(iosysid[0], true)))
+            ERR(ret);
+        if ((ret = PIOc_set_timing(iosysid[1], false)))
+            ERR(ret);
+        sprintf(filename, "%s_timing.nc", TEST_NAME);
+        if ((ret = write_file(iosysid[0], flavor[0], filename, my_rank)))
+            ERR(ret);
+        if ((ret = PIOc_get_timing(iosysid[0], "PIOc_write_darray", &time, &count)))
+            ERR(ret);
+        if (count != NUM_RECS || time < 0)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_get_timing(iosysid[0], "PIO:rearrange_comp2io", &time, &count)))
+            ERR(ret);
+        if (count < 1 || time < 0)
+            ERR(ERR_WRONG);
+        if ((ret = PIOc_get_timing(iosysid[1], "PIOc_write_darray", &time, &count)))
+            ERR(ret);
+        if (count || time)
+            ERR(ERR_WRONG);
+
+        /* Turning the timers on again sets them to 0. */
+        if ((ret = PIOc_set_timing(iosysid[0], false)))
+            ERR(ret);
+        if ((ret = PIOc_set_timing(iosysid[0], true)))
+            ERR(ret);
+        if ((ret = PIOc_get_timing(iosysid[0], "PIOc_write_darray", &time, &count)))
+            ERR(ret);
+        if (count || time)
+            ERR(ERR_WRONG);
+
+        /* Trace both IO systems. */
+        if (PIOc_set_trace(iosysid[0] + TEST_VAL_42, TEST_NAME) != PIO_EBADID)
+            ERR(ERR_WRONG);
+        for (int s = 0; s < NUM_IOSYS; s++)
+        {
+            sprintf(trace_file[s], "%s_%d.json", TEST_NAME, s);
+            if ((ret = PIOc_set_trace(iosysid[s], trace_file[s])))
+                ERR(ret);
+        }
+
+        /* Write a file with the first IO system, and free it. */
+        sprintf(filename, "%s_0.nc", TEST_NAME);
+        if ((ret = write_file(iosysid[0], flavor[0], filename, my_rank)))
+            ERR(ret);
+        if ((ret = PIOc_free_iosystem(iosysid[0])))
+            ERR(ret);
+
+        /* The second IO system is still traced. */
+        sprintf(filename, "%s_1.nc", TEST_NAME);
+        if ((ret = write_file(iosysid[1], flavor[0], filename, my_rank)))
+            ERR(ret);
+
+        /* Turning off the trace writes it. */
+        if ((ret = PIOc_set_trace(iosysid[1], NULL)))
+            ERR(ret);
+        if ((ret = PIOc_free_iosystem(iosysid[1])))
+            ERR(ret);
+
+        /* The first trace has one file, the second both. */
+        if (!my_rank)
+        {
+            if ((ret = check_trace(trace_file[0], TARGET_NTASKS, "PIOc_write_darray_multi",
+                                   nmulti)))
+                ERR(ret);
+            if ((ret = check_trace(trace_file[0], TARGET_NTASKS, "PIOc_closefile", nclose)))
+                ERR(ret);
+            for (int t = 0; t < TARGET_NTASKS; t++)
+                if (nmulti[t] < 1 || nclose[t] != 1)
+                    ERR(ERR_WRONG);
+            if ((ret = check_trace(trace_file[1], TARGET_NTASKS, "PIOc_closefile", nclose)))
+                ERR(ret);
+            for (int t = 0; t < TARGET_NTASKS; t++)
+                if (nclose[t] != 2)
+                    ERR(ERR_WRONG);
+        }
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
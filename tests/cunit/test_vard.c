@@ -0,0 +1,229 @@
+/*
+ * Tests for reading and writing distributed arrays of pnetcdf files
+ * with the vard functions, PIOc_set_vard().
+ *
+ * @author Ed Hartnett
+ */
+#include <config.h>
+#include <pio.h>
+#include <pio_internal.h>
+#include <pio_tests.h>
+
+/* The number of tasks this test should run on. */
+#define TARGET_NTASKS 4
+
+/* The minimum number of tasks this test should run on. */
+#define MIN_NTASKS 4
+
+/* The name of this test. */
+#define TEST_NAME "test_vard"
+
+/* Number of processors that will do IO. */
+#define NUM_IO_PROCS 2
+
+/* The number of dimensions in the example data. */
+#define NDIM2 2
+
+/* The length of our sample data. */
+#define X_DIM_LEN 16
+
+/* The number of records written. */
+#define NUM_RECS 3
+
+/* The dimension names. */
+char dim_name[NDIM2][PIO_MAX_NAME + 1] = {"time", "x"};
+
+/* Length of the dimensions in the sample data. */
+int dim_len[NDIM2] = {NC_UNLIMITED, X_DIM_LEN};
+
+/* Create a decomposition with a block of x on each task. */
+int create_decomposition(int ntasks, int my_rank, int iosysid, int *ioid)
+{
+    PIO_Offset elements_per_pe = X_DIM_LEN / ntasks;
+    PIO_Offset compdof[X_DIM_LEN];
+    int ret;
+
+    /* Describe the decomposition. This is a 1-based array, so add 1! */
+    for (int i = 0; i < elements_per_pe; i++)
+        compdof[i] = my_rank * elements_per_pe + i + 1;
+
+    if ((ret = PIOc_InitDecomp(iosysid, PIO_INT, 1, &dim_len[1], elements_per_pe,
+                               compdof, ioid, NULL, NULL, NULL)))
+        return ret;
+
+    return PIO_NOERR;
+}
+
+/* Read back the records, and the non-record var. */
+int check_vars(int ncid, int varid, int varid2, int ioid, PIO_Offset arraylen,
+               int my_rank)
+{
+    int data_in[arraylen];
+    int ret;
+
+    for (int r = 0; r < NUM_RECS; r++)
+    {
+        if ((ret = PIOc_setframe(ncid, varid, r)))
+            return ret;
+        if ((ret = PIOc_read_darray(ncid, varid, ioid, arraylen, data_in)))
+            return ret;
+        for (int i = 0; i < arraylen; i++)
+            if (data_in[i] != my_rank * 100 + r * 10 + i)
+                return ERR_WRONG;
+    }
+    if ((ret = PIOc_read_darray(ncid, varid2, ioid, arraylen, data_in)))
+        return ret;
+    for (int i = 0; i < arraylen; i++)
+        if (data_in[i] != -(my_rank * 100 + i))
+            return ERR_WRONG;
+
+    return PIO_NOERR;
+}
+
+/* Write records with vard and varn, and read them back with both. */
+int test_vard(int iosysid, int ioid, int num_flavors, int *flavor, int my_rank,
+              int ntasks)
+{
+    char filename[PIO_MAX_NAME + 1];
+    int dimids[NDIM2];
+    int varid, varid2;
+    PIO_Offset arraylen = X_DIM_LEN / ntasks;
+    int data[arraylen];
+    int ncid;
+    bool use_vard;
+    int ret;
+
+    for (int fmt = 0; fmt < num_flavors; fmt++)
+    {
+        bool pnetcdf = flavor[fmt] == PIO_IOTYPE_PNETCDF;
+
+        sprintf(filename, "%s_iotype_%d.nc", TEST_NAME, flavor[fmt]);
+
+        /* Create the file, dims and vars. */
+        if ((ret = PIOc_createfile(iosysid, &ncid, &flavor[fmt], filename, PIO_CLOBBER)))
+            return ret;
+        for (int d = 0; d < NDIM2; d++)
+            if ((ret = PIOc_def_dim(ncid, dim_name[d], (PIO_Offset)dim_len[d], &dimids[d])))
+                return ret;
+        if ((ret = PIOc_def_var(ncid, "var", PIO_INT, NDIM2, dimids, &varid)))
+            return ret;
+        if ((ret = PIOc_def_var(ncid, "var2", PIO_INT, 1, &dimids[1], &varid2)))
+            return ret;
+        if ((ret = PIOc_enddef(ncid)))
+            return ret;
+
+        /* Bad inputs. */
+        if (PIOc_set_vard(ncid + TEST_VAL_42, true) != PIO_EBADID)
+            return ERR_WRONG;
+        if (PIOc_inq_vard(ncid + TEST_VAL_42, &use_vard) != PIO_EBADID)
+            return ERR_WRONG;
+
+        /* Only pnetcdf files use vard. */
+        if ((ret = PIOc_set_vard(ncid, true)))
+            return ret;
+        if ((ret = PIOc_inq_vard(ncid, &use_vard)))
+            return ret;
+        if (use_vard != pnetcdf)
+            return ERR_WRONG;
+
+        /* Write the first records and the non-record var with vard,
+         * and the last record with varn. */
+        for (int r = 0; r < NUM_RECS; r++)
+        {
+            if (r == NUM_RECS - 1)
+            {
+                if ((ret = PIOc_set_vard(ncid, false)))
+                    return ret;
+                if ((ret = PIOc_inq_vard(ncid, &use_vard)))
+                    return ret;
+                if (use_vard)
+                    return ERR_WRONG;
+            }
+            for (int i = 0; i < arraylen; i++)
+                data[i] = my_rank * 100 + r * 10 + i;
+            if ((ret = PIOc_setframe(ncid, varid, r)))
+                return ret;
+            if ((ret = PIOc_write_darray(ncid, varid, ioid, arraylen, data, NULL)))
+                return ret;
+            if ((ret = PIOc_sync(ncid)))
+                return ret;
+        }
+        if ((ret = PIOc_set_vard(ncid, true)))
+            return ret;
+        for (int i = 0; i < arraylen; i++)
+            data[i] = -(my_rank * 100 + i);
+        if ((ret = PIOc_write_darray(ncid, varid2, ioid, arraylen, data, NULL)))
+            return ret;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+
+        /* Read it back with both. */
+        if ((ret = PIOc_openfile(iosysid, &ncid, &flavor[fmt], filename, PIO_NOWRITE)))
+            return ret;
+        if ((ret = PIOc_set_vard(ncid, true)))
+            return ret;
+        if ((ret = check_vars(ncid, varid, varid2, ioid, arraylen, my_rank)))
+            return ret;
+        if ((ret = PIOc_set_vard(ncid, false)))
+            return ret;
+        if ((ret = check_vars(ncid, varid, varid2, ioid, arraylen, my_rank)))
+            return ret;
+        if ((ret = PIOc_closefile(ncid)))
+            return ret;
+    }
+
+    return PIO_NOERR;
+}
+
+/* Run tests for vard. */
+int main(int argc, char **argv)
+{
+    int my_rank;
+    int ntasks;
+    int num_flavors;         /* Number of PIO netCDF flavors in this build. */
+    int flavor[NUM_FLAVORS]; /* iotypes for the supported netCDF IO flavors. */
+    MPI_Comm test_comm;      /* A communicator for this test. */
+    int ret;                 /* Return code. */
+
+    /* Initialize test. */
+    if ((ret = pio_test_init2(argc, argv, &my_rank, &ntasks, MIN_NTASKS, MIN_NTASKS,
+                              -1, &test_comm)))
+        ERR(ERR_INIT);
+
+    if ((ret = PIOc_set_iosystem_error_handling(PIO_DEFAULT, PIO_RETURN_ERROR, NULL)))
+        return ret;
+
+    /* Only do something on max_ntasks tasks. */
+    if (my_rank < TARGET_NTASKS)
+    {
+        int iosysid;              /* The ID for the parallel I/O system. */
+        int ioid;                 /* The ID of the decomposition. */
+
+        /* Figure out iotypes. */
+        if ((ret = get_iotypes(&num_flavors, flavor)))
+            ERR(ret);
+
+        if ((ret = PIOc_Init_Intracomm(test_comm, NUM_IO_PROCS, 1, 0, PIO_REARR_BOX,
+                                       &iosysid)))
+            ERR(ret);
+
+        if ((ret = create_decomposition(TARGET_NTASKS, my_rank, iosysid, &ioid)))
+            ERR(ret);
+
+        if ((ret = test_vard(iosysid, ioid, num_flavors, flavor, my_rank, TARGET_NTASKS)))
+            ERR(ret);
+
+        if ((ret = PIOc_freedecomp(iosysid, ioid)))
+            ERR(ret);
+
+        if ((ret = PIOc_free_iosystem(iosysid)))
+            ERR(ret);
+    } /* endif my_rank < TARGET_NTASKS */
+
+    /* Finalize the MPI library. */
+    if ((ret = pio_test_finalize(&test_comm)))
+        return ret;
+
+    printf("%d %s SUCCESS!!\n", my_rank, TEST_NAME);
+    return 0;
+}
@@ -20,9 +20,45 @@
 #define NDIM2 2
 #define NDIM3 3
 #define TEST_VAL_42 42
+#define ATT_NAME "att_name"
+#define ATT_NAME2 "att_name2"
 
 extern NC_Dispatch NCINT_dispatcher;
 
+/* Check the metadata of the test file. */
+int
+check_metadata(int ncid)
+{
+    int ndims, nvars, ngatts, unlimdimid;
+    int dimid_in[NDIM3], varid_in, dimid;
+    char name_in[NC_MAX_NAME + 1];
+    size_t len_in;
+    nc_type xtype_in;
+    int ndims_in, natts_in;
+
+    if (nc_inq(ncid, &ndims, &nvars, &ngatts, &unlimdimid)) PERR;
+    if (ndims != NDIM3 || nvars != 1 || ngatts != 1 || unlimdimid != 0) PERR;
+    if (nc_inq_dimid(ncid, DIM_NAME_Y, &dimid)) PERR;
+    if (dimid != 2) PERR;
+    if (nc_inq_dim(ncid, dimid, name_in, &len_in)) PERR;
+    if (strcmp(name_in, DIM_NAME_Y) || len_in != DIM_LEN_Y) PERR;
+    if (nc_inq_dim(ncid, 0, name_in, &len_in)) PERR;
+    if (strcmp(name_in, DIM_NAME_UNLIMITED) || len_in != 0) PERR;
+    if (nc_inq_varid(ncid, VAR_NAME, &varid_in)) PERR;
+    if (varid_in != 0) PERR;
+    if (nc_inq_var(ncid, varid_in, name_in, &xtype_in, &ndims_in, dimid_in,
+                   &natts_in)) PERR;
+    if (strcmp(name_in, VAR_NAME) || xtype_in != NC_INT || ndims_in != NDIM3 ||
+        natts_in != 1) PERR;
+    for (int d = 0; d < NDIM3; d++)
+        if (dimid_in[d] != d) PERR;
+    if (nc_inq_att(ncid, varid_in, ATT_NAME, &xtype_in, &len_in)) PERR;
+    if (xtype_in != NC_INT || len_in != 1) PERR;
+    if (nc_inq_varid(ncid, "no_such_var", &varid_in) != NC_ENOTVAR) PERR;
+
+    return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -123,6 +159,110 @@ main(int argc, char **argv)
     }
     PSUMMARIZE_ERR;
 
+    if (!my_rank)
+        printf("*** testing nc_put_vara/nc_get_vara on a var with a decomposition...");
+    {
+        int ncid, ioid;
+        int dimid[NDIM3], varid;
+        int dimlen[NDIM3] = {NC_UNLIMITED, DIM_LEN_X, DIM_LEN_Y};
+        size_t start[NDIM3] = {1, 0, 0};
+        size_t count[NDIM3] = {1, DIM_LEN_X, DIM_LEN_Y};
+        int iosysid;
+        size_t elements_per_pe;
+        size_t *compdof;
+        int *my_data;
+        int *data_in;
+        int i;
+
+        if (nc_def_iosystem(MPI_COMM_WORLD, 1, 1, 0, 0, &iosysid)) PERR;
+        if (PIOc_set_iosystem_error_handling(iosysid, PIO_RETURN_ERROR, NULL) < 0) PERR;
+
+        /* Create a file with a 3D record var. */
+        if (nc_create(FILE_NAME, NC_PIO, &ncid)) PERR;
+        if (nc_def_dim(ncid, DIM_NAME_UNLIMITED, dimlen[0], &dimid[0])) PERR;
+        if (nc_def_dim(ncid, DIM_NAME_X, dimlen[1], &dimid[1])) PERR;
+        if (nc_def_dim(ncid, DIM_NAME_Y, dimlen[2], &dimid[2])) PERR;
+        if (nc_def_var(ncid, VAR_NAME, NC_INT, NDIM3, dimid, &varid)) PERR;
+
+        elements_per_pe = DIM_LEN_X * DIM_LEN_Y / ntasks;
+        if (!(compdof = malloc(elements_per_pe * sizeof(size_t))))
+            PERR;
+        for (i = 0; i < elements_per_pe; i++)
+            compdof[i] = my_rank * elements_per_pe + i;
+        if (nc_def_decomp(iosysid, PIO_INT, NDIM2, &dimlen[1], elements_per_pe,
+                          compdof, &ioid, 1, NULL, NULL)) PERR;
+        free(compdof);
+
+        /* Bad ioid. */
+        if (nc_def_var_decomp(ncid, varid, ioid + TEST_VAL_42) != PIO_EBADID) PERR;
+
+        /* The ordinary put on this var now writes the local data of the
+         * decomposition, to the record in start. */
+        if (nc_def_var_decomp(ncid, varid, ioid)) PERR;
+        if (!(my_data = malloc(elements_per_pe * sizeof(int)))) PERR;
+        for (i = 0; i < elements_per_pe; i++)
+            my_data[i] = my_rank * 10 + i;
+        if (nc_put_vara_int(ncid, varid, start, count, my_data)) PERR;
+
+        /* The type must be the type of the decomposition. */
+        if (nc_put_vara_float(ncid, varid, start, count, (float *)my_data) != PIO_EBADTYPE) PERR;
+        if (nc_close(ncid)) PERR;
+
+        /* Read it back with both the ordinary get on a var with the
+         * decomposition, and with nc_get_vard. */
+        if (!(data_in = malloc(elements_per_pe * sizeof(int)))) PERR;
+        if (nc_open(FILE_NAME, NC_PIO, &ncid)) PERR;
+        if (nc_get_vard_int(ncid, varid, ioid, 1, data_in)) PERR;
+        for (i = 0; i < elements_per_pe; i++)
+            if (data_in[i] != my_data[i]) PERR;
+        if (nc_def_var_decomp(ncid, varid, ioid)) PERR;
+        memset(data_in, 0, elements_per_pe * sizeof(int));
+        if (nc_get_vara_int(ncid, varid, start, count, data_in)) PERR;
+        for (i = 0; i < elements_per_pe; i++)
+            if (data_in[i] != my_data[i]) PERR;
+        if (nc_close(ncid)) PERR;
+
+        free(data_in);
+        free(my_data);
+        if (nc_free_decomp(ioid)) PERR;
+        if (nc_free_iosystem(iosysid)) PERR;
+    }
+    PSUMMARIZE_ERR;
+
+    if (!my_rank)
+        printf("*** testing inquiries about the metadata of a file...");
+    {
+        int ncid;
+        int dimid[NDIM3], varid;
+        int dimlen[NDIM3] = {NC_UNLIMITED, DIM_LEN_X, DIM_LEN_Y};
+        int iosysid;
+        int att_val = TEST_VAL_42;
+
+        if (nc_def_iosystem(MPI_COMM_WORLD, 1, 1, 0, 0, &iosysid)) PERR;
+        if (PIOc_set_iosystem_error_handling(iosysid, PIO_RETURN_ERROR, NULL) < 0) PERR;
+
+        /* Create a file, the cache is kept by the define functions. */
+        if (nc_create(FILE_NAME, NC_PIO, &ncid)) PERR;
+        if (nc_def_dim(ncid, DIM_NAME_UNLIMITED, dimlen[0], &dimid[0])) PERR;
+        if (nc_def_dim(ncid, DIM_NAME_X, dimlen[1], &dimid[1])) PERR;
+        if (nc_def_dim(ncid, DIM_NAME_Y, dimlen[2], &dimid[2])) PERR;
+        if (nc_def_var(ncid, VAR_NAME, NC_INT, NDIM3, dimid, &varid)) PERR;
+        if (nc_put_att_int(ncid, varid, ATT_NAME, NC_INT, 1, &att_val)) PERR;
+        if (nc_put_att_int(ncid, NC_GLOBAL, ATT_NAME, NC_INT, 1, &att_val)) PERR;
+        if (nc_put_att_int(ncid, NC_GLOBAL, ATT_NAME2, NC_INT, 1, &att_val)) PERR;
+        if (nc_del_att(ncid, NC_GLOBAL, ATT_NAME2)) PERR;
+        if (check_metadata(ncid)) PERR;
+        if (nc_close(ncid)) PERR;
+
+        /* Open it again, the cache is read from the file. */
+        if (nc_open(FILE_NAME, NC_PIO, &ncid)) PERR;
+        if (check_metadata(ncid)) PERR;
+        if (nc_close(ncid)) PERR;
+
+        if (nc_free_iosystem(iosysid)) PERR;
+    }
+    PSUMMARIZE_ERR;
+
     /* Finalize MPI. */
     MPI_Finalize();
     PFINAL_RESULTS;
@@ -0,0 +1,281 @@
+/*
+ * Generators of synthetic decompositions for the performance tests.
+ *
+ * The maps are 1-based, with 0 for a hole, as used by
+ * PIOc_InitDecomp() and PIO_initdecomp(). For DECOMP_GEN_BLOCK,
+ * DECOMP_GEN_SFC and DECOMP_GEN_LAND, the point (x, y, z) of the
+ * global array is element x + nx * (y + ny * z) + 1. For
+ * DECOMP_GEN_CUBED_SPHERE, column c of level z is element c + 6 * nx
+ * * nx * z + 1.
+ *
+ * @author Ed Hartnett
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "decomp_gen.h"
+
+/** The size in columns of the patches of land of DECOMP_GEN_LAND. */
+#define LAND_PATCH 4
+
+/**
+ * Find the type of a generator from its name.
+ *
+ * @param name block, cubed_sphere, sfc or land.
+ * @returns the type, or -1 if the name is not known.
+ */
+int
+decomp_gen_type(const char *name)
+{
+    if (!strcmp(name, "block"))
+        return DECOMP_GEN_BLOCK;
+    if (!strcmp(name, "cubed_sphere"))
+        return DECOMP_GEN_CUBED_SPHERE;
+    if (!strcmp(name, "sfc"))
+        return DECOMP_GEN_SFC;
+    if (!strcmp(name, "land"))
+        return DECOMP_GEN_LAND;
+    return -1;
+}
+
+/**
+ * Get the dims of the global array of a generator, slowest varying
+ * first (C order). Levels are left out when nz is 1.
+ *
+ * @param type the type of generator.
+ * @param nx the number of columns in x (for DECOMP_GEN_CUBED_SPHERE,
+ * in each direction of a panel).
+ * @param ny the number of columns in y. Ignored for
+ * DECOMP_GEN_CUBED_SPHERE.
+ * @param nz the number of levels.
+ * @param ndims gets the number of dims.
+ * @param gdims array of at least 3 that gets the dims.
+ * @returns 0 for success, PIO_EINVAL for a bad argument.
+ */
+int
+decomp_gen_dims(int type, int nx, int ny, int nz, int *ndims, int *gdims)
+{
+    int d = 0;
+
+    if (nx < 1 || nz < 1 || (type != DECOMP_GEN_CUBED_SPHERE && ny < 1))
+        return PIO_EINVAL;
+
+    if (nz > 1)
+        gdims[d++] = nz;
+    if (type == DECOMP_GEN_CUBED_SPHERE)
+        gdims[d++] = 6 * nx * nx;
+    else
+    {
+        gdims[d++] = ny;
+        gdims[d++] = nx;
+    }
+    *ndims = d;
+
+    return PIO_NOERR;
+}
+
+/* Find the piece [start, start + len) of n points of task i of p. */
+static void
+piece(PIO_Offset n, int p, int i, PIO_Offset *start, PIO_Offset *len)
+{
+    *start = n * i / p;
+    *len = n * (i + 1) / p - *start;
+}
+
+/* Cut ntasks into px x py, with blocks as square as possible. */
+static void
+factor_tasks(int ntasks, int nx, int ny, int *px, int *py)
+{
+    double best = -1;
+
+    for (int p = 1; p <= ntasks; p++)
+    {
+        double perim;
+
+        if (ntasks % p)
+            continue;
+        perim = (double)nx / p + (double)ny / (ntasks / p);
+        if (best < 0 || perim < best)
+        {
+            best = perim;
+            *px = p;
+            *py = ntasks / p;
+        }
+    }
+}
+
+/* Find point (x, y) of distance d along a Hilbert curve in an n x n
+ * square, where n is a power of 2. */
+static void
+hilbert_point(int n, PIO_Offset d, int *x, int *y)
+{
+    *x = *y = 0;
+    for (int s = 1; s < n; s *= 2)
+    {
+        int rx = (d / 2) & 1;
+        int ry = (d ^ rx) & 1;
+
+        if (!ry)
+        {
+            if (rx)
+            {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+            int t = *x;
+            *x = *y;
+            *y = t;
+        }
+        *x += s * rx;
+        *y += s * ry;
+        d /= 4;
+    }
+}
+
+/* Walk the columns of an nx x ny grid along a Hilbert curve, adding
+ * offset + x + nx * y to cols for the columns of positions [lo, hi)
+ * of the walk. pos is the position of the walk, kept between calls
+ * so that several grids can be walked one after the other. */
+static void
+hilbert_cols(int nx, int ny, PIO_Offset offset, PIO_Offset lo, PIO_Offset hi,
+             PIO_Offset *pos, PIO_Offset *cols, PIO_Offset *ncols)
+{
+    int n = 1;
+
+    while (n < nx || n < ny)
+        n *= 2;
+
+    for (PIO_Offset d = 0; d < (PIO_Offset)n * n && *pos < hi; d++)
+    {
+        int x, y;
+
+        hilbert_point(n, d, &x, &y);
+        if (x >= nx || y >= ny)
+            continue;
+        if (*pos >= lo)
+            cols[(*ncols)++] = offset + x + (PIO_Offset)nx * y;
+        (*pos)++;
+    }
+}
+
+/* Is column (x, y) ocean? Ocean is in patches of LAND_PATCH x
+ * LAND_PATCH columns, the same on all tasks. */
+static int
+is_ocean(int x, int y, double hole_fraction)
+{
+    unsigned h = (unsigned)(x / LAND_PATCH) * 2654435761u ^
+        (unsigned)(y / LAND_PATCH) * 2246822519u;
+
+    h ^= h >> 15;
+    h *= 2654435761u;
+    h ^= h >> 13;
+
+    return (h % 10000) < hole_fraction * 10000;
+}
+
+/**
+ * Get the map of one task of a synthetic decomposition.
+ *
+ * Call with a NULL map to get the length of the map, then again with
+ * a map of that length.
+ *
+ * @param type the type of generator, see decomp_gen.h.
+ * @param rank the task.
+ * @param ntasks the number of tasks.
+ * @param nx the number of columns in x (for DECOMP_GEN_CUBED_SPHERE,
+ * in each direction of a panel).
+ * @param ny the number of columns in y. Ignored for
+ * DECOMP_GEN_CUBED_SPHERE.
+ * @param nz the number of levels.
+ * @param halo width of the halo of DECOMP_GEN_BLOCK. Ignored for the
+ * others.
+ * @param hole_fraction the fraction of the columns left out by
+ * DECOMP_GEN_LAND. Ignored for the others.
+ * @param maplen gets the length of the map.
+ * @param map NULL, or an array of maplen that gets the map.
+ * @returns 0 for success, PIO_EINVAL for a bad argument, PIO_ENOMEM
+ * when out of memory.
+ */
+int
+decomp_gen(int type, int rank, int ntasks, int nx, int ny, int nz, int halo,
+           double hole_fraction, PIO_Offset *maplen, PIO_Offset *map)
+{
+    PIO_Offset ncol = type == DECOMP_GEN_CUBED_SPHERE ? 6 * (PIO_Offset)nx * nx :
+        (PIO_Offset)nx * ny;
+    PIO_Offset *cols = NULL;
+    PIO_Offset ncols = 0;
+
+    if (!maplen || rank < 0 || ntasks < 1 || rank >= ntasks || nx < 1 || nz < 1 ||
+        (type != DECOMP_GEN_CUBED_SPHERE && ny < 1) || halo < 0 || hole_fraction < 0 ||
+        hole_fraction > 1)
+        return PIO_EINVAL;
+
+    switch (type)
+    {
+    case DECOMP_GEN_BLOCK:
+    case DECOMP_GEN_LAND:
+    {
+        PIO_Offset x0, lx, y0, ly, e = 0;
+        int px, py;
+
+        factor_tasks(ntasks, nx, ny, &px, &py);
+        piece(nx, px, rank % px, &x0, &lx);
+        piece(ny, py, rank / px, &y0, &ly);
+
+        if (type == DECOMP_GEN_BLOCK)
+        {
+            /* The halo points are in the map, as holes. */
+            *maplen = (lx + 2 * halo) * (ly + 2 * halo) * nz;
+            if (map)
+                for (int z = 0; z < nz; z++)
+                    for (PIO_Offset y = y0 - halo; y < y0 + ly + halo; y++)
+                        for (PIO_Offset x = x0 - halo; x < x0 + lx + halo; x++)
+                            map[e++] = (x < x0 || x >= x0 + lx || y < y0 || y >= y0 + ly) ? 0 :
+                                x + nx * (y + (PIO_Offset)ny * z) + 1;
+            return PIO_NOERR;
+        }
+
+        /* The ocean columns are not in the map at all. */
+        for (PIO_Offset y = y0; y < y0 + ly; y++)
+            for (PIO_Offset x = x0; x < x0 + lx; x++)
+                if (!is_ocean(x, y, hole_fraction))
+                    ncols++;
+        *maplen = ncols * nz;
+        if (map)
+            for (int z = 0; z < nz; z++)
+                for (PIO_Offset y = y0; y < y0 + ly; y++)
+                    for (PIO_Offset x = x0; x < x0 + lx; x++)
+                        if (!is_ocean(x, y, hole_fraction))
+                            map[e++] = x + nx * (y + (PIO_Offset)ny * z) + 1;
+        return PIO_NOERR;
+    }
+
+    case DECOMP_GEN_CUBED_SPHERE:
+    case DECOMP_GEN_SFC:
+    {
+        PIO_Offset lo, len, pos = 0;
+
+        piece(ncol, ntasks, rank, &lo, &len);
+        *maplen = len * nz;
+        if (!map)
+            return PIO_NOERR;
+
+        if (!(cols = malloc((len ? len : 1) * sizeof(PIO_Offset))))
+            return PIO_ENOMEM;
+        if (type == DECOMP_GEN_SFC)
+            hilbert_cols(nx, ny, 0, lo, lo + len, &pos, cols, &ncols);
+        else
+            for (int p = 0; p < 6; p++)
+                hilbert_cols(nx, nx, p * (PIO_Offset)nx * nx, lo, lo + len, &pos, cols,
+                             &ncols);
+
+        for (int z = 0; z < nz; z++)
+            for (PIO_Offset c = 0; c < ncols; c++)
+                map[z * ncols + c] = cols[c] + ncol * z + 1;
+        free(cols);
+        return PIO_NOERR;
+    }
+
+    default:
+        return PIO_EINVAL;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * Generators of synthetic decompositions for the performance tests,
+ * resembling those of real models. They are used by the C
+ * (tests/cperf) and Fortran (tests/performance) benchmarks.
+ *
+ * @author Ed Hartnett
+ */
+#ifndef _DECOMP_GEN_H
+#define _DECOMP_GEN_H
+
+#include <pio.h>
+
+/** 2D (nz == 1) or 3D grid of nx x ny x nz, cut into a block of
+ * columns on each task. Each block is surrounded by halo points,
+ * which are holes (0) in the map, as in the memory of a model. */
+#define DECOMP_GEN_BLOCK 1
+
+/** Cubed sphere of 6 panels of nx x nx columns, with nz levels, as in
+ * a spectral element model. The columns of each panel are ordered
+ * along a Hilbert curve, and each task gets a contiguous piece of
+ * that order. */
+#define DECOMP_GEN_CUBED_SPHERE 2
+
+/** nx x ny x nz grid, with the columns ordered along a Hilbert
+ * curve, and each task getting a contiguous piece of the curve. */
+#define DECOMP_GEN_SFC 3
+
+/** nx x ny x nz grid cut into blocks of columns as with
+ * DECOMP_GEN_BLOCK, but with about hole_fraction of the columns
+ * (those over the ocean) left out of the map, as in a land model. */
+#define DECOMP_GEN_LAND 4
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+    /* Find the type of a generator from its name. */
+    int decomp_gen_type(const char *name);
+
+    /* Get the dims of the global array of a generator. */
+    int decomp_gen_dims(int type, int nx, int ny, int nz, int *ndims, int *gdims);
+
+    /* Get the map of one task. */
+    int decomp_gen(int type, int rank, int ntasks, int nx, int ny, int nz, int halo,
+                   double hole_fraction, PIO_Offset *maplen, PIO_Offset *map);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _DECOMP_GEN_H */